@@ -0,0 +1,37 @@
+#ifndef QTNG_ACCESS_LOG_H
+#define QTNG_ACCESS_LOG_H
+
+#include <QtCore/qstring.h>
+#include "hostaddress.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// the access log of servers. the records are appended to a binary buffer in a few memcpy, and formatted and written by
+// a background thread. the records coming while the buffer is full are dropped instead of blocking the eventloops.
+// thread safe, one log can be shared by many servers, see BaseStreamServer::setAccessLog().
+class AccessLogPrivate;
+class AccessLog
+{
+public:
+    explicit AccessLog(const QString &filePath = QString());  // append to the file, or stdout if filePath is empty.
+    ~AccessLog();  // the buffered records are written before it returns.
+public:
+    void logRequest(const HostAddress &peer, const QString &method, const QString &path, int status, qint64 bodySize);
+    void logError(const HostAddress &peer, const QString &method, const QString &path, int status,
+                  const QString &message);
+    void logProxy(const HostAddress &peer, const QString &command, const QString &target, quint16 port,
+                  const HostAddress &forwardAddress, bool success);
+public:
+    int maxBufferSize() const;  // in bytes, default to 4MB.
+    void setMaxBufferSize(int maxBufferSize);
+    quint64 droppedRecords() const;
+    void flush();  // block current thread until the buffered records are written.
+private:
+    AccessLogPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(AccessLog)
+    Q_DISABLE_COPY(AccessLog)
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_ACCESS_LOG_H
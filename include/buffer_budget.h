@@ -0,0 +1,76 @@
+#ifndef QTNG_BUFFER_BUDGET_H
+#define QTNG_BUFFER_BUDGET_H
+
+#include <QtCore/qsharedpointer.h>
+#include "config.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// accounts the bytes buffered in user space by the subsystems, so a busy process is slowed down before it runs out of
+// memory. there is one process wide budget, and one budget for every thread (i.e. every eventloop) whose bytes are
+// counted by the global budget too. the limits are zero (unlimited) by default.
+//
+//     BufferBudget::global()->setLimits(256 * 1024 * 1024, 512 * 1024 * 1024);
+//
+// beyond the soft limit, the producers which can wait (the receivers of DataChannel and KcpSocket senders, etc.) are
+// paused until the consumers release some bytes. beyond the hard limit, tryCharge() fails, and the memory bodies of
+// HttpResponse are refused.
+class BufferBudgetPrivate;
+class BufferBudget
+{
+public:
+    enum Consumer {
+        DataChannelReceiving = 0,
+        DataChannelSending = 1,
+        Exchanger = 2,
+        HttpBody = 3,
+        KcpSending = 4,
+    };
+    enum { ConsumerCount = 5 };
+public:
+    ~BufferBudget();
+    static QSharedPointer<BufferBudget> global();
+    static QSharedPointer<BufferBudget> current();  // the budget of this thread.
+public:
+    void setLimits(qint64 softLimit, qint64 hardLimit);
+    qint64 softLimit() const;
+    qint64 hardLimit() const;
+    qint64 used() const;
+    qint64 used(Consumer consumer) const;
+    void charge(Consumer consumer, qint64 bytes);
+    bool tryCharge(Consumer consumer, qint64 bytes);  // returns false if the hard limit would be exceeded.
+    void release(Consumer consumer, qint64 bytes);
+    bool isPressured() const;  // the soft limit of this or the global budget is reached.
+    // returns false if it is still pressured after timeout, so the soft limit never deadlocks the consumers.
+    bool waitForRoom(float timeout = 1.0f);
+private:
+    explicit BufferBudget(QSharedPointer<BufferBudget> parent);
+    BufferBudgetPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(BufferBudget)
+    Q_DISABLE_COPY(BufferBudget)
+};
+
+// the bytes charged by one buffer, which are released when it is destroyed.
+class BufferCharge
+{
+public:
+    explicit BufferCharge(BufferBudget::Consumer consumer);
+    ~BufferCharge();
+public:
+    void add(qint64 bytes);
+    bool tryAdd(qint64 bytes);
+    void sub(qint64 bytes);
+    void set(qint64 bytes);  // charges or releases the difference.
+    qint64 size() const { return bytes; }
+    bool isPressured() const { return budget->isPressured(); }
+    bool waitForRoom(float timeout = 1.0f) { return budget->waitForRoom(timeout); }
+private:
+    const QSharedPointer<BufferBudget> budget;
+    const BufferBudget::Consumer consumer;
+    qint64 bytes;
+    Q_DISABLE_COPY(BufferCharge)
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_BUFFER_BUDGET_H
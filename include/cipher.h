@@ -66,6 +66,9 @@ public:
     QByteArray addData(const QByteArray &data) { return addData(data.constData(), data.size()); }
     QByteArray addData(const char *data, int len);
     QByteArray finalData();
+    // writes to out which has len + blockSize() bytes at least, out can be the same as in but not overlapped
+    // otherwise. returns the bytes written, or -1 if failed.
+    int update(const char *in, int len, char *out);
 public:
     QByteArray update(const QByteArray &data) { return addData(data.constData(), data.size()); }
     QByteArray update(const char *data, int len) { return addData(data, len); }
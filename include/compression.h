@@ -0,0 +1,117 @@
+#ifndef QTNG_COMPRESSION_H
+#define QTNG_COMPRESSION_H
+
+#include <QtCore/qbytearray.h>
+#include "io_utils.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// the zstd and brotli codecs are optional. the files fail at the first read() or write() if the library is not built
+// in, check qIsContentCodingSupported() before using them. write(data, 0) ends the stream of compress files.
+class ZstdCompressFilePrivate;
+class ZstdCompressFile : public FileLike
+{
+public:
+    ZstdCompressFile(QSharedPointer<FileLike> backend, int level = 3);
+    virtual ~ZstdCompressFile() override;
+public:
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *data, qint32 size) override;
+    virtual void close() override { }
+    virtual qint64 size() override { return -1; }
+private:
+    ZstdCompressFilePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(ZstdCompressFile);
+};
+
+class ZstdDecompressFilePrivate;
+// the window is limited to 8MB as rfc 8878 recommends for http, so a peer can not make us allocate too much.
+class ZstdDecompressFile : public FileLike
+{
+public:
+    ZstdDecompressFile(QSharedPointer<FileLike> backend);
+    virtual ~ZstdDecompressFile() override;
+public:
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *data, qint32 size) override;
+    virtual void close() override { }
+    virtual qint64 size() override { return -1; }
+private:
+    ZstdDecompressFilePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(ZstdDecompressFile);
+};
+
+class BrotliCompressFilePrivate;
+class BrotliCompressFile : public FileLike
+{
+public:
+    // the quality is 0~11, the default 5 is fast enough for dynamic contents.
+    BrotliCompressFile(QSharedPointer<FileLike> backend, int quality = 5);
+    virtual ~BrotliCompressFile() override;
+public:
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *data, qint32 size) override;
+    virtual void close() override { }
+    virtual qint64 size() override { return -1; }
+private:
+    BrotliCompressFilePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(BrotliCompressFile);
+};
+
+class BrotliDecompressFilePrivate;
+class BrotliDecompressFile : public FileLike
+{
+public:
+    BrotliDecompressFile(QSharedPointer<FileLike> backend);
+    virtual ~BrotliDecompressFile() override;
+public:
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *data, qint32 size) override;
+    virtual void close() override { }
+    virtual qint64 size() override { return -1; }
+private:
+    BrotliDecompressFilePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(BrotliDecompressFile);
+};
+
+class ZstdPacketCompressorPrivate;
+// the zstd version of PacketCompressor, every packet is flushed and the window is shared by the packets.
+class ZstdPacketCompressor
+{
+public:
+    explicit ZstdPacketCompressor(int level = 3);
+    ~ZstdPacketCompressor();
+public:
+    bool compress(const QByteArray &packet, QByteArray *compressed);
+private:
+    ZstdPacketCompressorPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(ZstdPacketCompressor);
+    Q_DISABLE_COPY(ZstdPacketCompressor)
+};
+
+class ZstdPacketDecompressorPrivate;
+class ZstdPacketDecompressor
+{
+public:
+    ZstdPacketDecompressor();
+    ~ZstdPacketDecompressor();
+public:
+    // fails if the packet is larger than maxSize. the decompressor is broken after any failure.
+    bool decompress(const QByteArray &compressed, QByteArray *packet, int maxSize);
+private:
+    ZstdPacketDecompressorPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(ZstdPacketDecompressor);
+    Q_DISABLE_COPY(ZstdPacketDecompressor)
+};
+
+// the http content codings: "gzip", "deflate", "zstd" and "br". the coding must be in lower case.
+bool qIsContentCodingSupported(const QByteArray &coding);
+// the value of Accept-Encoding header for all supported codings, or "identity" if none.
+QByteArray qAcceptEncoding();
+// return null if the coding is not supported. the level is passed to the codec, -1 for its default.
+QSharedPointer<FileLike> qContentEncoder(const QByteArray &coding, QSharedPointer<FileLike> input, int level = -1);
+QSharedPointer<FileLike> qContentDecoder(const QByteArray &coding, QSharedPointer<FileLike> input);
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_COMPRESSION_H
@@ -14,6 +14,10 @@
 #  endif
 #endif
 
+#ifndef DEFAULT_COROUTINE_STACK_POOL_SIZE
+#  define DEFAULT_COROUTINE_STACK_POOL_SIZE 128
+#endif
+
 QTNETWORKNG_NAMESPACE_BEGIN
 
 class CoroutineException
@@ -68,14 +72,43 @@ public:
     bool raise(CoroutineException *exception);
     bool yield();
     quintptr id() const;
+    // the bytes of stack touched by this coroutine, counted by resident pages. return 0 if it is unknown.
+    size_t stackHighWaterMark() const;
+    size_t stackSize() const;
+    // give back the stack pages below the frames in use every time this coroutine switches away, so a coroutine waiting
+    // for an idle connection costs only its live frames after a deep call. the stack is never moved, so the pointers
+    // to it stay valid. costs a madvise() per switch after going deeper, does nothing on windows. default to false.
+    void setStackTrimmingEnabled(bool enabled);
+    bool isStackTrimmingEnabled() const;
 
     BaseCoroutine *previous() const;
     void setPrevious(BaseCoroutine *previous);
 
     static BaseCoroutine *current();
+    // stacks of finished coroutines are cached per thread and per stack size, at most `count` for each size.
+    static void setMaxPooledStacks(quint32 count);
+    static quint32 maxPooledStacks();
+    // place a PROT_NONE page below the stacks of coroutines created afterwards, default to false.
+    static void setStackGuardEnabled(bool enabled);
+    static bool isStackGuardEnabled();
+    // cut the stacks of coroutines created afterwards from transparent huge pages, which takes less tlb misses for many
+    // coroutines. the pooled stacks keep their pages, and the stack trimming splits them. linux only, default to false.
+    static void setHugePageStacksEnabled(bool enabled);
+    static bool isHugePageStacksEnabled();
+    // the time this coroutine has run and the times it switched away, counted while the accounting is enabled.
+    qint64 runTimeNsecs() const;
+    quint64 switchCount() const;
+    // the accounting reads the clock at every switch, default to false.
+    static void setAccountingEnabled(bool enabled);
+    static bool isAccountingEnabled();
+    // warn about coroutines running longer than msecs without switching, with their ids and names. the accounting is
+    // enabled if msecs is not zero, and zero disables the warnings.
+    static void setSlowSliceThreshold(quint32 msecs);
+    static quint32 slowSliceThreshold();
 public:
-    Deferred<BaseCoroutine *> started;
-    Deferred<BaseCoroutine *> finished;
+    // allocated by the first callback. the hook of finished belongs to Coroutine.
+    LazyDeferred<BaseCoroutine *> started;
+    LazyDeferred<BaseCoroutine *> finished;
 protected:
     void setState(BaseCoroutine::State state);
     virtual void cleanup();
@@ -85,6 +118,50 @@ private:
     Q_DECLARE_PRIVATE_D(dd_ptr, BaseCoroutine)
 };
 
+// the untyped part of CoroutineLocal<T>. the ids are never reused, the values of a destroyed CoroutineLocal are leaked
+// by the coroutines still alive, as QThreadStorage does.
+class CoroutineLocalData
+{
+public:
+    explicit CoroutineLocalData(void (*destructor)(void *));
+    ~CoroutineLocalData();
+    void **get() const;
+    void **set(void *p);
+private:
+    const int id;
+    Q_DISABLE_COPY(CoroutineLocalData)
+};
+
+// like QThreadStorage, but every coroutine has its own value, which is deleted with the coroutine.
+template<typename T>
+class CoroutineLocal
+{
+public:
+    CoroutineLocal()
+        : d(deleteData)
+    {
+    }
+    bool hasLocalData() const { return d.get() != nullptr; }
+    T &localData()
+    {
+        void **v = d.get();
+        if (!v) {
+            v = d.set(new T());
+        }
+        return *static_cast<T *>(*v);
+    }
+    T localData() const
+    {
+        void **v = d.get();
+        return v ? *static_cast<T *>(*v) : T();
+    }
+    void setLocalData(const T &t) { d.set(new T(t)); }
+private:
+    static void deleteData(void *p) { delete static_cast<T *>(p); }
+    CoroutineLocalData d;
+    Q_DISABLE_COPY(CoroutineLocal)
+};
+
 QTNETWORKNG_NAMESPACE_END
 
 class QDebug;
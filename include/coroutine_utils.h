@@ -21,12 +21,12 @@ T callInEventLoop(std::function<T()> func)
     QSharedPointer<T> result(new T());
     QSharedPointer<Event> done(new Event());
 
-    std::function<void()> wrapper = [result, done, func]() mutable {
+    auto wrapper = [result, done, func]() mutable {
         *result = func();
         done->set();
     };
 
-    int callbackId = EventLoopCoroutine::get()->callLater(0, new LambdaFunctor(wrapper));
+    int callbackId = EventLoopCoroutine::get()->callLater(0, makeFunctor(std::move(wrapper)));
     try {
         done->wait();
         EventLoopCoroutine::get()->cancelCall(callbackId);
@@ -43,12 +43,12 @@ inline void callInEventLoop(std::function<void()> func, quint32 msecs = 0)
 
     QSharedPointer<Event> done(new Event());
 
-    std::function<void()> wrapper = [done, func]() {
+    auto wrapper = [done, func]() {
         func();
         done->set();
     };
 
-    int callbackId = EventLoopCoroutine::get()->callLater(msecs, new LambdaFunctor(wrapper));
+    int callbackId = EventLoopCoroutine::get()->callLater(msecs, makeFunctor(std::move(wrapper)));
     try {
         done->wait();
         EventLoopCoroutine::get()->cancelCall(callbackId);
@@ -61,7 +61,7 @@ inline void callInEventLoop(std::function<void()> func, quint32 msecs = 0)
 inline void callInEventLoopAsync(std::function<void()> func, quint32 msecs = 0)
 {
     //    Q_ASSERT(static_cast<QBaseCoroutine*>(EventLoopCoroutine::get()) != QBaseCoroutine::current());
-    EventLoopCoroutine::get()->callLater(msecs, new LambdaFunctor(func));
+    EventLoopCoroutine::get()->callLater(msecs, makeFunctor(std::move(func)));
 }
 
 template<typename EventLoop>
@@ -159,7 +159,13 @@ private:
     QPointer<EventLoopCoroutine> eventloop;
 };
 
-inline QSharedPointer<Event> spawnInThread(const std::function<void()> &func)
+// run the function in a process wide pool of worker threads, which is grown lazily up to deferCallThreads() and the
+// idle workers exit after a minute. the calls are queued if all workers are busy, so the functions which block for
+// long or wait for another spawnInThread() call should use spawnInNewThread() instead.
+QSharedPointer<Event> spawnInThread(const std::function<void()> &func);
+
+// run the function in a new thread which is deleted after that.
+inline QSharedPointer<Event> spawnInNewThread(const std::function<void()> &func)
 {
     QSharedPointer<Event> done = QSharedPointer<Event>::create();
     DeferCallThread *thread = new DeferCallThread(func, done, EventLoopCoroutine::get());
@@ -167,6 +173,10 @@ inline QSharedPointer<Event> spawnInThread(const std::function<void()> &func)
     return done;
 }
 
+// the maximum number of worker threads used by spawnInThread() and callInThread(), 4 * idealThreadCount() by default.
+void setDeferCallThreads(int threads);
+int deferCallThreads();
+
 template<typename T>
 T callInThread(std::function<T()> func)
 {
@@ -214,11 +224,36 @@ public:
     virtual void run() override;
 public:
     void apply(const std::function<void()> &f);
+    // for the latency critical threads owning a dedicated core. both are applied when the thread starts. a pinned thread
+    // allocates its memory from the numa node of its cpu.
+    void setCpuAffinity(int cpu);  // -1 to leave it to the scheduler, which is the default.
+    void setBusyPolling(quint32 usecs);  // see setEventLoopBusyPolling().
+    static bool pinCurrentThread(int cpu);
 private:
     CoroutineThreadPrivate * const dd_ptr;
     Q_DECLARE_PRIVATE_D(dd_ptr, CoroutineThread);
 };
 
+class CoroutineRuntimePrivate;
+// runs coroutines in a number of threads. every thread has a deque of functions, spawnAnywhere() puts to the deque of
+// current thread if it is called in the runtime, and the idle threads steal functions from the others. a coroutine is
+// never moved after it starts, so it may use sockets freely, but the functions must not share the sockets of other
+// threads.
+class CoroutineRuntime
+{
+public:
+    explicit CoroutineRuntime(int threads = 0);  // default to QThread::idealThreadCount().
+    ~CoroutineRuntime();  // run the spawned functions to end and wait the threads.
+public:
+    // returns an event which is set after the function returns, the event can be waited in any thread and coroutine.
+    QSharedPointer<ThreadEvent> spawnAnywhere(const std::function<void()> &func);
+    int threadCount() const;
+private:
+    CoroutineRuntimePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(CoroutineRuntime)
+    Q_DISABLE_COPY(CoroutineRuntime)
+};
+
 bool waitThread(QThread *thread);
 bool waitProcess(class QProcess *process);
 
@@ -285,8 +320,10 @@ public:
     QSharedPointer<Coroutine> any();
 
     inline QSharedPointer<Coroutine> spawnWithName(const QString &name, const std::function<void()> &func,
-                                                   bool replace = false);
-    inline QSharedPointer<Coroutine> spawn(const std::function<void()> &func);
+                                                   bool replace = false,
+                                                   size_t stackSize = DEFAULT_COROUTINE_STACK_SIZE);
+    inline QSharedPointer<Coroutine> spawn(const std::function<void()> &func,
+                                           size_t stackSize = DEFAULT_COROUTINE_STACK_SIZE);
     //    inline QSharedPointer<Coroutine> spawnInThread(const std::function<void()> &func);
     //    inline QSharedPointer<Coroutine> spawnInThreadWithName(const QString &name, const std::function<void()> &func,
     //    bool replace = false);
@@ -346,31 +383,34 @@ public:
     }
 private:
     void deleteCoroutine(BaseCoroutine *coroutine);
+    friend class CoroutinePrivate;
+    QSharedPointer<Coroutine> take(Coroutine *coroutine);  // O(1), the last one fills the hole.
 private:
     QList<QSharedPointer<Coroutine>> coroutines;
+    QHash<Coroutine *, int> indexes;
 };
 
 QSharedPointer<Coroutine> CoroutineGroup::spawnWithName(const QString &name, const std::function<void()> &func,
-                                                        bool replace)
+                                                        bool replace, size_t stackSize)
 {
     QSharedPointer<Coroutine> old = get(name);
     if (!old.isNull()) {
         if (replace) {
             old->kill();
-            coroutines.removeOne(old);
+            take(old.data());
             old->join();
         } else {
             return old;
         }
     }
-    QSharedPointer<Coroutine> coroutine(Coroutine::spawn(func));
+    QSharedPointer<Coroutine> coroutine(Coroutine::spawn(func, stackSize));
     add(coroutine, name);
     return coroutine;
 }
 
-QSharedPointer<Coroutine> CoroutineGroup::spawn(const std::function<void()> &func)
+QSharedPointer<Coroutine> CoroutineGroup::spawn(const std::function<void()> &func, size_t stackSize)
 {
-    QSharedPointer<Coroutine> coroutine(Coroutine::spawn(func));
+    QSharedPointer<Coroutine> coroutine(Coroutine::spawn(func, stackSize));
     add(coroutine);
     return coroutine;
 }
@@ -446,30 +486,39 @@ private:
     template<typename T, typename Func, typename... ARGS>
     T apply_dispatch(Func func, ARGS... args, detail::VoidType);
 private:
-    // for map()
-    template<typename T, typename S>
-    std::function<T(S)> makeResult(std::function<T(S)> func);
-
-    // for each()
-    template<typename S>
-    std::function<void(S)> makeResult(std::function<void(S)> func);
+    // for map() and each(). every worker thread takes the ranges of [0, size) by itself, starting with
+    // size / (2 * threads) items and shrinking as the remaining ones, so there is one round trip per thread.
+    void callChunks(int size, const std::function<void(int, int)> &func);
 private:
     QList<QSharedPointer<class ThreadPoolWorkThread>> threads;
     QSharedPointer<Semaphore> semaphore;
+    int capacity;
 };
 
 template<typename T, typename S>
 QList<T> ThreadPool::map(std::function<T(S)> func, const QList<S> &l)
 {
-    std::function<T(S)> f = [this, func](const S &s) -> T { return this->apply<T>(func, s); };
-    return CoroutineGroup::map(f, l);
+    // the results are written in place, and the shared copies are kept for the workers even if this coroutine is killed.
+    QSharedPointer<QVector<T>> results(new QVector<T>(l.size()));
+    QSharedPointer<const QList<S>> items(new QList<S>(l));
+    T *out = results->data();
+    callChunks(l.size(), [func, results, items, out](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            out[i] = func(items->at(i));
+        }
+    });
+    return results->toList();
 }
 
 template<typename S>
 void ThreadPool::each(std::function<void(S)> func, const QList<S> &l)
 {
-    std::function<void(S)> f = [this, func](const S &s) -> void { this->apply<void>(func, s); };
-    CoroutineGroup::each(f, l);
+    QSharedPointer<const QList<S>> items(new QList<S>(l));
+    callChunks(l.size(), [func, items](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            func(items->at(i));
+        }
+    });
 }
 
 // FIXME if ARGS is `const QString &`, apply may cause crash!
@@ -53,6 +53,11 @@ public:
     quint32
     capacity() const;  // so, a data channel may consume `maxPacketSize * capacity` bytes of receiving buffer memory.
     quint32 receivingQueueSize() const;
+    // credit based flow control of this channel, the peer sends at most `window` bytes not read by recvPacket().
+    // the sub channels made afterwards inherit it. both peers must support it, and it is disabled by default.
+    void setReceivingWindow(quint32 window);
+    quint32 receivingWindow() const;
+    qint64 sendingWindow() const;  // bytes the peer allows me to send, -1 if the peer does not use credits.
     DataChannelPole pole() const;
     void setName(const QString &name);
     QString name() const;
@@ -60,7 +65,15 @@ public:
     bool isBroken() const;
     bool sendPacket(const QByteArray &packet);
     bool sendPacketAsync(const QByteArray &packet);
+    // the packet starts with reservedHeaderSize() bytes, which are filled with the headers of virtual channels in
+    // place instead of copying the payload. see MsgPackStream::pack(value, channel->reservedHeaderSize()).
+    quint32 reservedHeaderSize() const;
+    bool sendReservedPacket(QByteArray packet);
     QByteArray recvPacket();
+    // take the packets queued at once, blocked until there is one at least. returns empty list if broken.
+    QList<QByteArray> recvPackets(quint32 maxCount = 64);
+    // queue all packets and wait for the last one only. returns false if any packet is not sent.
+    bool sendPackets(const QList<QByteArray> &packets);
     void abort();
     QSharedPointer<VirtualChannel> makeChannel();
     QSharedPointer<VirtualChannel> takeChannel();
@@ -88,18 +101,84 @@ public:
     float keepaliveTimeout() const;
     void setKeepaliveInterval(float keepaliveInterval);
     float keepaliveInterval() const;
+    // wait a while to send more packets together, default to 0 which sends the queued packets at once.
+    void setFlushDelay(float flushDelay);
+    float flushDelay() const;
+    // send the packets larger than payloadSizeHint() by fragments, so the small packets of other channels can go
+    // between them. the peer must support it, default to false.
+    void setFragmentation(bool fragmentation);
+    bool fragmentation() const;
+    // compress the packets larger than threshold by zlib, with the dictionary shared by all channels of connection.
+    // the packets are compressed only if both peers enable it. returns false if zlib is not available.
+    bool setCompression(bool enabled, int level = -1, quint32 threshold = 256);
+    bool isCompressing() const;
+    // compress by zstd instead of zlib once both peers choose it, with the window shared by all channels too. the
+    // peer must support it, default to DeflateCompression. like the compact framing, the switch can not be undone.
+    // returns false if zstd is not available.
+    enum CompressionMethod { DeflateCompression, ZstdCompression };
+    bool setCompressionMethod(CompressionMethod method);
+    CompressionMethod compressionMethod() const;  // the method of packets sent.
+    // switch to the varint header of 2~3 bytes instead of 8 bytes, once both peers enable it. the switch can not be
+    // undone, and disabling it only stops a pending switch.
+    void setCompactFraming(bool enabled);
+    bool compactFraming() const;  // the frames sent are compact.
     quint32 sendingQueueSize() const;
     QSharedPointer<SocketLike> connection() const;
 private:
     Q_DECLARE_PRIVATE(SocketChannel)
 };
 
+class SharedMemoryChannelPrivate;
+// a data channel between the processes of one host. the packets are copied through a pair of single producer rings in
+// shared memory, and the local socket only carries the wake up bytes while the peer is sleeping, and tells the closing
+// of peer. it is not supported on windows.
+class SharedMemoryChannel : public DataChannel
+{
+    Q_DISABLE_COPY(SharedMemoryChannel)
+public:
+    // the positive pole creates the rings of ringSize bytes, rounded up to the power of 2, and sends them through the
+    // connected local socket, which is received by the negative pole. returns null if failed.
+    static QSharedPointer<SharedMemoryChannel> create(QSharedPointer<Socket> connection, DataChannelPole pole,
+                                                      quint32 ringSize = 1024 * 1024);
+public:
+    quint32 ringSize() const;
+    quint32 pendingPacketsSize() const;  // the packets waiting for the space of ring.
+    QSharedPointer<Socket> connection() const;
+private:
+    SharedMemoryChannel(QSharedPointer<Socket> connection, DataChannelPole pole, char *memory, quint32 ringSize);
+    Q_DECLARE_PRIVATE(SharedMemoryChannel)
+};
+
+class BondedChannelPrivate;
+// stripes the packets across several paths, such as the socket channels of tcp and kcp connections to the same peer.
+// every packet goes to the path of least rtt times queued packets, and is delivered in order by the sequence number.
+// the packets not acknowledged are sent again by other paths if one path is broken, so the channel is broken only
+// after all paths are gone. both peers must bond the paths in the same way.
+class BondedChannel : public DataChannel
+{
+    Q_DISABLE_COPY(BondedChannel)
+public:
+    BondedChannel(const QList<QSharedPointer<DataChannel>> &paths, DataChannelPole pole);
+public:
+    // add a new path, such as a reconnected one. returns false if the path is broken or its packets are smaller.
+    bool addPath(QSharedPointer<DataChannel> path);
+    QList<QSharedPointer<DataChannel>> paths() const;
+    qint64 pathRtt(QSharedPointer<DataChannel> path) const;  // msecs, -1 if not measured.
+    quint32 unackedPacketsSize() const;
+private:
+    Q_DECLARE_PRIVATE(BondedChannel)
+};
+
 class VirtualChannelPrivate;
 class VirtualChannel : public DataChannel
 {
     Q_DISABLE_COPY(VirtualChannel)
 public:
     quint32 channelNumber() const;
+    // the share of connection bandwidth while other channels are busy, default to 1. it only works for the
+    // channels made by SocketChannel, and the commands are always sent before data.
+    void setWeight(quint32 weight);
+    quint32 weight() const;
 protected:
     VirtualChannel(DataChannel *parentChannel, DataChannelPole pole, quint32 channelNumber);
 private:
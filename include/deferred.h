@@ -9,6 +9,9 @@
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
+template<typename ARG>
+class LazyDeferred;
+
 template<typename ARG>
 class Deferred
 {
@@ -26,6 +29,7 @@ public:
     void erroback(const ARG &arg) { run(arg, false); }
 private:
     void run(const ARG &arg, bool ok);
+    friend class LazyDeferred<ARG>;
 private:
     QList<std::tuple<int, Callback, Callback>> stack;
     QPair<ARG, bool> originalResult;
@@ -56,6 +60,62 @@ private:
     bool ran;
 };
 
+// like Deferred, but the stack of callbacks is allocated by the first callback added, so the objects which rarely
+// have callbacks cost nothing. one hook of plain function runs before the callbacks, which is never allocated, and
+// is kept for the owner of this object.
+template<typename ARG>
+class LazyDeferred
+{
+public:
+    typedef typename Deferred<ARG>::Callback Callback;
+    typedef void (*Hook)(void *data, const ARG &arg);
+    LazyDeferred()
+        : deferred(nullptr)
+        , hook(nullptr)
+        , hookData(nullptr)
+        , result()
+        , ran(false)
+        , ok(false)
+    {
+    }
+    ~LazyDeferred() { delete deferred; }
+public:
+    int addCallbacks(Callback callback, Callback errback) { return ensure()->addCallbacks(callback, errback); }
+    int addBoth(Callback callback) { return addCallbacks(callback, callback); }
+    int addCallback(Callback callback) { return ensure()->addCallback(callback); }
+    int addErrback(Callback errback) { return ensure()->addErrback(errback); }
+    void clear()
+    {
+        if (deferred) {
+            deferred->clear();
+        }
+    }
+    void remove(int id)
+    {
+        if (deferred) {
+            deferred->remove(id);
+        }
+    }
+    void callback(const ARG &arg) { run(arg, true); }
+    void erroback(const ARG &arg) { run(arg, false); }
+    void setHook(Hook hook, void *hookData)
+    {
+        this->hook = hook;
+        this->hookData = hookData;
+    }
+private:
+    Deferred<ARG> *ensure();
+    void run(const ARG &arg, bool ok);
+private:
+    Deferred<ARG> *deferred;
+    Hook hook;
+    void *hookData;
+    ARG result;
+    bool ran;
+    bool ok;
+    Q_DISABLE_COPY(LazyDeferred)
+};
+
 template<typename ARG>
 Deferred<ARG>::Deferred()
     : nextId(1)
@@ -123,6 +183,37 @@ void Deferred<ARG>::run(const ARG &arg, bool ok)
     }
 }
 
+template<typename ARG>
+Deferred<ARG> *LazyDeferred<ARG>::ensure()
+{
+    if (!deferred) {
+        deferred = new Deferred<ARG>();
+        if (ran) {
+            // so the callbacks added afterwards are called at once.
+            if (ok) {
+                deferred->callback(result);
+            } else {
+                deferred->erroback(result);
+            }
+        }
+    }
+    return deferred;
+}
+
+template<typename ARG>
+void LazyDeferred<ARG>::run(const ARG &arg, bool ok)
+{
+    result = arg;
+    ran = true;
+    this->ok = ok;
+    if (hook) {
+        hook(hookData, arg);
+    }
+    if (deferred) {
+        deferred->run(arg, ok);
+    }
+}
+
 Deferred<void>::Deferred()
     : nextId(1)
     , ran(false)
@@ -0,0 +1,49 @@
+#ifndef QTNG_DNS_H
+#define QTNG_DNS_H
+
+#include <QtCore/qstringlist.h>
+#include <QtCore/qsharedpointer.h>
+#include "hostaddress.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+class DnsResolverPrivate;
+class DnsResolver
+{
+public:
+    DnsResolver();  // empty configuration, call loadResolvConf() and loadHostsFile() or set it manually.
+    virtual ~DnsResolver();
+public:
+    // resolve A/AAAA records and follow CNAME, blocking the current coroutine only.
+    // the minimum ttl of answers in seconds is written to *ttl if it is not null. zero means the answers must not be
+    // cached, and the answers of getaddrinfo() have 60 seconds.
+    QList<HostAddress> resolve(const QString &hostName,
+                               int allowProtocol = HostAddress::IPv4Protocol | HostAddress::IPv6Protocol,
+                               quint32 *ttl = nullptr);
+public:
+    QList<HostAddress> nameServers() const;
+    void setNameServers(const QList<HostAddress> &nameServers);  // fall back to getaddrinfo() in thread if empty.
+    quint16 nameServerPort() const;  // of udp and tcp, default to 53. a local stub resolver may listen on another.
+    void setNameServerPort(quint16 port);
+    QStringList searchDomains() const;
+    void setSearchDomains(const QStringList &searchDomains);
+    int ndots() const;  // default to 1
+    void setNdots(int ndots);
+    float timeout() const;  // of one attempt in seconds, default to 5.0
+    void setTimeout(float secs);
+    int attempts() const;  // default to 2
+    void setAttempts(int attempts);
+    void addHost(const QString &hostName, const HostAddress &address);  // same as one line of hosts file.
+public:
+    bool loadResolvConf(const QString &filePath = QString());  // default to /etc/resolv.conf
+    bool loadHostsFile(const QString &filePath = QString());  // default to /etc/hosts or the windows one.
+    static QSharedPointer<DnsResolver> instance();  // the default resolver of current thread, load system config.
+private:
+    DnsResolverPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(DnsResolver)
+    Q_DISABLE_COPY(DnsResolver)
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_DNS_H
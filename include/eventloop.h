@@ -27,13 +27,23 @@ public:
     static Coroutine *current();
     static void msleep(quint32 msecs);
     static void sleep(float secs) { msleep(static_cast<quint32>(secs * 1000)); }
-    static Coroutine *spawn(std::function<void()> f);
+    static Coroutine *spawn(std::function<void()> f, size_t stackSize = DEFAULT_COROUTINE_STACK_SIZE);
+    // no handle is returned, so the finished coroutines are kept in a per-thread free list and run the next functions
+    // without allocating new objects and stacks. at most maxPooledStacks() idle coroutines are kept.
+    static void spawnDetached(std::function<void()> f);
     static void preferLibev();
+    static void preferEpoll();  // linux only, falls back to the default eventloop elsewhere.
+    static void preferKqueue();  // macos and bsd only, falls back to the default eventloop elsewhere.
+    static void preferIoUring();  // epoll with io_uring completions for sockets, falls back to epoll.
+    // the qt eventloop of main thread keeps signals and slots working, but leaves the sockets and timers of coroutines to
+    // epoll, and only watches the epoll fd. linux only, falls back to the qt eventloop elsewhere.
+    static void preferQtWithEpoll();
 protected:
     virtual void cleanup() override;
 private:
     CoroutinePrivate * const d_ptr;
     Q_DECLARE_PRIVATE(Coroutine)
+    friend class CoroutineGroup;
 };
 
 class TimeoutException : public CoroutineException
@@ -45,6 +55,8 @@ public:
     virtual CoroutineException *clone() const override;
 };
 
+// raise TimeoutException in current coroutine after secs. the Timeout objects of one coroutine are nested as a stack of
+// deadlines, and the inner ones later than the inherited deadline arm no timer, because the outer one fires first.
 class Timeout : public QObject
 {
 public:
@@ -53,11 +65,53 @@ public:
     ~Timeout();
 public:
     void restart();
+    // the earliest deadline of current coroutine in the msecs of EventLoopCoroutine::now(), or -1 if there is none.
+    static qint64 currentDeadline();
+    // the secs left before currentDeadline(), or -1. the waits with their own timers should not wait longer.
+    static float remaining();
+private:
+    void arm();
+    qint64 inheritedDeadline() const;
 private:
     quint32 msecs;
     int timeoutId;
+    qint64 deadline;
+    Timeout *parent;  // the outer Timeout of the same coroutine.
+    Timeout **top;  // the innermost Timeout of the coroutine, which lives in its coroutine locals.
+    QPointer<BaseCoroutine> coroutine;
 };
 
+// a snapshot of the eventloop of the current thread. the counters are not reset, export their increments as rates.
+// the gauges are -1 if the backend does not track them.
+struct EventLoopMetrics
+{
+    enum { LatencyBuckets = 9 };
+    EventLoopMetrics();
+    // the upper bound in microseconds of a latency bucket, bucket i counts iterations shorter than 16 * 4^i us. the
+    // last bucket has no bound and returns -1.
+    static qint64 latencyBucketBound(int bucket);
+
+    quint64 iterations;
+    quint64 callbacks;  // the watcher and timer callbacks run by the eventloop.
+    quint32 lastIterationCallbacks;
+    quint32 maxIterationCallbacks;
+    qint64 pollNsecs;  // time blocked in the backend poll.
+    qint64 busyNsecs;  // time spent in iterations, running callbacks and the coroutines they switch to.
+    quint64 latencies[LatencyBuckets];  // the histogram of the busy time of iterations.
+    int watchers;
+    int timers;
+    int pendingThreadSafeCalls;  // callLaterThreadSafe() calls not taken by the eventloop yet.
+    int coroutines;  // the live Coroutine objects created in this thread.
+};
+
+// must be called in the thread of the eventloop, which is created if there is none.
+EventLoopMetrics eventLoopMetrics();
+
+// after an iteration running some callbacks, the eventloop of current thread polls without blocking for usecs before it
+// sleeps again, trading a cpu core for lower and steadier latency. 0 disables it, which is the default. only the epoll
+// and libev eventloops honor it, see also Socket::BusyPollSocketOption and CoroutineThread::setCpuAffinity().
+void setEventLoopBusyPolling(quint32 usecs);
+
 // useful for qt application.
 int startQtLoop();
 
@@ -13,6 +13,7 @@ public:
     GzipCompressFile(QSharedPointer<FileLike> backend, int level = -1);
     virtual ~GzipCompressFile() override;
 public:
+    void setBufferSize(qint32 inputSize, qint32 outputSize);  // default to 8KB and 32KB.
     virtual qint32 read(char *data, qint32 size) override;
     virtual qint32 write(const char *, qint32) override;
     virtual void close() override { }
@@ -29,6 +30,7 @@ public:
     GzipDecompressFile(QSharedPointer<FileLike> input);
     virtual ~GzipDecompressFile() override;
 public:
+    void setBufferSize(qint32 inputSize, qint32 outputSize);  // the input size is fixed since the first read().
     virtual qint32 read(char *data, qint32 size) override;
     virtual qint32 write(const char *, qint32) override;
     virtual void close() override { }
@@ -38,9 +40,78 @@ private:
     Q_DECLARE_PRIVATE(GzipDecompressFile);
 };
 
+class ThreadPool;
+class ParallelGzipCompressFilePrivate;
+// splits the input into blocks which are compressed by the threads of pool, and joins them into one gzip stream.
+// every block is primed with the last 32KB of the input before it, so the ratio is close to GzipCompressFile.
+class ParallelGzipCompressFile : public FileLike
+{
+public:
+    // a new pool is made if pool is null.
+    ParallelGzipCompressFile(QSharedPointer<FileLike> backend, int level = -1,
+                             QSharedPointer<ThreadPool> pool = QSharedPointer<ThreadPool>());
+    virtual ~ParallelGzipCompressFile() override;
+public:
+    void setBlockSize(qint32 blockSize);  // default to 128KB, fixed since the first read().
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *, qint32) override;  // not supported.
+    virtual void close() override { }
+    virtual qint64 size() override { return -1; }
+private:
+    ParallelGzipCompressFilePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(ParallelGzipCompressFile);
+};
+
+class PacketCompressorPrivate;
+// compresses packets one by one with a dictionary shared by the packets, like the context takeover of
+// permessage-deflate. every packet is flushed to be decompressed at once, and they must be decompressed in order.
+class PacketCompressor
+{
+public:
+    explicit PacketCompressor(int level = -1);
+    ~PacketCompressor();
+public:
+    bool compress(const QByteArray &packet, QByteArray *compressed);
+private:
+    PacketCompressorPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(PacketCompressor);
+    Q_DISABLE_COPY(PacketCompressor)
+};
+
+class PacketDecompressorPrivate;
+class PacketDecompressor
+{
+public:
+    PacketDecompressor();
+    ~PacketDecompressor();
+public:
+    // fails if the packet is larger than maxSize. the decompressor is broken after any failure.
+    bool decompress(const QByteArray &compressed, QByteArray *packet, int maxSize);
+private:
+    PacketDecompressorPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(PacketDecompressor);
+    Q_DISABLE_COPY(PacketDecompressor)
+};
+
 bool qGzipCompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> output, int level = -1);
+// the zlib format, which is the "deflate" content encoding of http.
+bool qDeflateCompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> output, int level = -1);
 bool qGzipDecompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> output);
 
+// the one-shot versions, the output is allocated once by deflateBound(). return null byte array if failed.
+QByteArray qGzipCompress(const QByteArray &data, int level = -1);
+QByteArray qDeflateCompress(const QByteArray &data, int level = -1);
+// gzip, zlib and raw deflate are detected. fails if the data is larger than maxSize, unlimited if maxSize < 0.
+bool qGzipDecompress(const QByteArray &compressed, QByteArray *data, int maxSize = -1);
+
+// the crc32 of gzip and zip. pass the last result as crc to continue, which starts with 0. folded by PCLMUL on x86 if
+// the cpu has it, by the crc instructions on ARMv8 if the compiler targets them, and by zlib-ng if it is linked.
+quint32 qCrc32(const char *data, qint64 size, quint32 crc = 0);
+inline quint32 qCrc32(const QByteArray &data, quint32 crc = 0)
+{
+    return qCrc32(data.constData(), data.size(), crc);
+}
+
 QTNETWORKNG_NAMESPACE_END
 
 #endif  // QTNG_GZIP_H
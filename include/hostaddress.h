@@ -1,7 +1,9 @@
 #ifndef QTNG_HOSTADDRESS_H
 #define QTNG_HOSTADDRESS_H
 
+#include <string.h>
 #include <QtCore/qobject.h>
+#include <QtCore/qhash.h>
 #include <QtCore/qshareddata.h>
 #include <QtCore/qlist.h>
 #include "config.h"
@@ -132,14 +134,71 @@ public:
     QString scopeId() const;
     void setScopeId(const QString &id);
 
+    // returns true if the host is an ip literal, such as 127.0.0.1, ::1, fe80::1%eth0 and [::1]. the host names are
+    // rejected without allocation, so it is checked before dns by every connect and resolve path.
+    static bool parseLiteral(const QString &host, HostAddress *address);
     static QList<HostAddress> getHostAddressByName(const QString &hostName);
 
     friend uint qHash(const HostAddress &key, uint seed) noexcept;
 private:
     friend class HostAddressPrivate;
+    friend class CompactHostAddress;
     QExplicitlySharedDataPointer<HostAddressPrivate> d;
 };
 
+// a plain 20 bytes value of address, used as the key of hash tables looked up by every connection or datagram, such as
+// the per-address counters of servers. copying, comparing and hashing it never allocate. the ipv4 addresses are stored
+// mapped to ipv6 like HostAddress does, and only the numeric scope ids are kept.
+class CompactHostAddress
+{
+public:
+    CompactHostAddress()
+        : tag(static_cast<quint8>(HostAddress::UnknownNetworkLayerProtocol))
+    {
+        memset(c, 0, sizeof(c));
+    }
+    CompactHostAddress(const HostAddress &address);
+    explicit CompactHostAddress(const sockaddr *sockaddr);
+    explicit CompactHostAddress(IPv4Address ipv4);
+public:
+    HostAddress toHostAddress() const;
+    bool isNull() const { return protocol() == HostAddress::UnknownNetworkLayerProtocol; }
+    HostAddress::NetworkLayerProtocol protocol() const
+    {
+        return static_cast<HostAddress::NetworkLayerProtocol>(static_cast<qint8>(tag & 0xff));
+    }
+    quint32 scopeId() const { return tag >> 8; }  // 0 if not set, at most 24 bits.
+    const quint8 *data() const { return c; }  // 16 bytes.
+    bool operator==(const CompactHostAddress &other) const
+    {
+        return tag == other.tag && memcmp(c, other.c, sizeof(c)) == 0;
+    }
+    bool operator!=(const CompactHostAddress &other) const { return !operator==(other); }
+    bool operator<(const CompactHostAddress &other) const
+    {
+        const int r = memcmp(c, other.c, sizeof(c));
+        return r < 0 || (r == 0 && tag < other.tag);
+    }
+private:
+    void setProtocol(HostAddress::NetworkLayerProtocol protocol, quint32 scopeId)
+    {
+        tag = (scopeId << 8) | static_cast<quint8>(protocol);
+    }
+private:
+    quint8 c[16];
+    quint32 tag;  // the scope id and protocol.
+};
+
+inline uint qHash(const CompactHostAddress &key, uint seed = 0) Q_DECL_NOEXCEPT
+{
+    Q_STATIC_ASSERT(sizeof(CompactHostAddress) == 20);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 4, 0))
+    return qHashBits(&key, sizeof(CompactHostAddress), seed);
+#else
+    return qHash(QByteArray::fromRawData(reinterpret_cast<const char *>(&key), sizeof(CompactHostAddress)), seed);
+#endif
+}
+
 QTNETWORKNG_NAMESPACE_END
 
 QT_BEGIN_NAMESPACE
@@ -151,5 +210,6 @@ QT_END_NAMESPACE
 
 // Q_DECLARE_SHARED(QTNETWORKNG_NAMESPACE::HostAddress);
 Q_DECLARE_METATYPE(QTNETWORKNG_NAMESPACE::HostAddress)
+Q_DECLARE_TYPEINFO(QTNETWORKNG_NAMESPACE::CompactHostAddress, Q_PRIMITIVE_TYPE);
 
 #endif  // QTNG_HOSTADDRESS_H
@@ -12,6 +12,7 @@
 #include "coroutine.h"
 #include "http_utils.h"
 #include "http_cookie.h"
+#include "json_stream.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
@@ -19,7 +20,8 @@ class FormData
 {
 public:
     FormData();
-    QByteArray toByteArray() const;
+    QByteArray toByteArray() const;  // the streamed files are read into memory.
+    QSharedPointer<FileLike> toFileLike() const;  // yields the parts while it is read, files are not buffered.
 
     void addFile(const QString &name, const QString &filename, const QByteArray &data,
                  const QString &contentType = QString())
@@ -39,6 +41,10 @@ public:
         files.append(File(name, filename, data, newContentType));
     }
 
+    // the file is read while sending the request, so it can be much larger than memory.
+    void addFile(const QString &name, const QString &filename, QSharedPointer<FileLike> file,
+                 const QString &contentType = QString());
+
     void addQuery(const QString &key, const QString &value) { queries.append(Query(key, value)); }
 public:
     struct Query
@@ -60,9 +66,17 @@ public:
             , contentType(contentType)
         {
         }
+        File(const QString &name, const QString &filename, QSharedPointer<FileLike> file, const QString &contentType)
+            : name(name)
+            , filename(filename)
+            , file(file)
+            , contentType(contentType)
+        {
+        }
         QString name;
         QString filename;
         QByteArray data;
+        QSharedPointer<FileLike> file;  // used instead of data if not null.
         QString contentType;
     };
 
@@ -127,6 +141,13 @@ public:
     void setTimeout(float timeout);
     QSharedPointer<SocketLike> connection() const;
     void useConnection(QSharedPointer<SocketLike> connection);
+    bool recordTimings() const;
+    void setRecordTimings(bool recordTimings);  // fill HttpResponse::timings(), false by default.
+    // send a duplicate by another connection if the response does not come in `delay` seconds, and take the first
+    // response. 0 for the p95 latency of the server, negative to disable, which is the default. only GET and HEAD
+    // requests without body are hedged. see HttpSession::setHedgingBudget().
+    float hedgeDelay() const;
+    void setHedgeDelay(float delay);
 public:
     void setBody(const FormData &formData);
     void setBody(const QJsonDocument &json);
@@ -146,6 +167,29 @@ public:
     virtual QString what() const;
 };
 
+// the phases of a request in microseconds, -1 if the phase is skipped or the timings are not recorded. http2
+// streams record the connection phases only.
+struct HttpTimings
+{
+    HttpTimings()
+        : dns(-1)
+        , connect(-1)
+        , tlsHandshake(-1)
+        , timeToFirstByte(-1)
+        , headerParse(-1)
+        , bodyDownload(-1)
+        , reusedConnection(false)
+    {
+    }
+    qint64 dns;  // skipped if the host is an address or a proxy is used.
+    qint64 connect;  // to the server or the proxy.
+    qint64 tlsHandshake;
+    qint64 timeToFirstByte;  // after the request headers are sent, including the upload of request body.
+    qint64 headerParse;  // after the first byte, until the whole head is read.
+    qint64 bodyDownload;  // skipped if the response is streamed.
+    bool reusedConnection;  // a keep-alive, pipelined or http2 connection of ConnectionPool.
+};
+
 class HttpResponsePrivate;
 class HttpResponse : public HttpHeaderManager
 {
@@ -172,13 +216,26 @@ public:
     void setHistory(const QList<HttpResponse> &history);
     HttpVersion version() const;
     void setVersion(HttpVersion version);
+    HttpTimings timings() const;  // of this response only, the redirections have their own in history().
+    void setTimings(const HttpTimings &timings);
 
     QSharedPointer<SocketLike> takeStream(QByteArray *readBytes);
     QSharedPointer<FileLike> bodyAsFile(bool processEncoding = true);
     QByteArray body();
+    // pull the decoded body into the buffer of caller, returns 0 at the end or -1 if failed. request with
+    // streamResponse = true, so the body is read from the connection only as fast as the caller consumes it.
+    qint32 readChunk(char *data, qint32 size);
+    // call back with every decoded block until the end, or until the callback returns false.
+    bool readBody(std::function<bool(const char *data, qint32 size)> callback, qint32 blockSize = 1024 * 16);
     void setBody(const QByteArray &body);
     QString text();
     QJsonDocument json();
+    // parse the json body while it is read, without buffering the body or building the document. the callback is
+    // called with every token until the end of document, or until it returns false. returns false if the body is not
+    // a complete json document or the callback stops.
+    bool readJson(std::function<bool(JsonStreamReader &reader)> callback);
+    // transcode the json body into msgpack while it is read, see JsonMsgPackTranscoder.
+    bool readJsonAsMsgPack(MsgPackStream *out, bool splitTopArray = false);
     QString html();
 
     bool isOk() const;
@@ -193,8 +250,72 @@ private:
     friend class HttpSessionPrivate;
 };
 
+struct HttpConnectionPoolStats
+{
+    HttpConnectionPoolStats()
+        : servers(0)
+        , idleConnections(0)
+        , pipeliningConnections(0)
+        , createdConnections(0)
+        , reusedConnections(0)
+        , pipelinedRequests(0)
+        , droppedConnections(0)
+        , http2Connections(0)
+        , multiplexedRequests(0)
+        , hedgedRequests(0)
+    {
+    }
+    int servers;
+    int idleConnections;
+    int pipeliningConnections;
+    quint64 createdConnections;
+    quint64 reusedConnections;  // idle connections taken by requests.
+    quint64 pipelinedRequests;  // requests sent before the previous response is read.
+    quint64 droppedConnections;  // idle connections closed by peers or expired.
+    int http2Connections;
+    quint64 multiplexedRequests;  // requests sent as http2 streams.
+    quint64 hedgedRequests;  // duplicates sent for the slow requests.
+};
+
+// the connections made to one resolved address of servers, see HttpSession::setBalancingAddresses().
+struct HttpAddressStats
+{
+    HttpAddressStats()
+        : connections(0)
+        , createdConnections(0)
+        , failedConnections(0)
+        , rtt(0)
+        , evicted(false)
+    {
+    }
+    HostAddress address;
+    int connections;  // the open http/1 connections.
+    quint64 createdConnections;
+    quint64 failedConnections;
+    quint32 rtt;  // the round trip time of connections in microseconds, 0 if the platform does not report it.
+    bool evicted;  // failed lately, skipped while other addresses are alive.
+};
+
 class Socks5Proxy;
 class HttpProxy;
+class PreparedHttpRequestPrivate;
+// a request serialized once by HttpSession::prepare(), and sent many times with another path, body or a few more
+// headers, such as the probes of health checkers and load generators. the sending makes no HttpRequest or QUrl.
+class PreparedHttpRequest
+{
+public:
+    PreparedHttpRequest();
+    PreparedHttpRequest(const PreparedHttpRequest &other);
+    ~PreparedHttpRequest();
+    PreparedHttpRequest &operator=(const PreparedHttpRequest &other);
+public:
+    bool isValid() const;
+    HttpRequest request() const;
+private:
+    QSharedPointer<PreparedHttpRequestPrivate> d;
+    friend class HttpSession;
+};
+
 class HttpSessionPrivate;
 class HttpCacheManager;
 class HttpSession
@@ -345,6 +466,12 @@ public:
     HttpResponse when(const QUrl &url);
 
     HttpResponse send(HttpRequest &request);
+    // send the requests by at most `concurrency` coroutines, and no more than maxConnectionsPerServer() of them
+    // go to the same server at a time. the responses are in the order of requests.
+    QList<HttpResponse> sendMany(QList<HttpRequest> &requests, int concurrency = 8);
+    // the same, but call back with the index of request as soon as every response is completed.
+    void sendMany(QList<HttpRequest> &requests, std::function<void(int index, HttpResponse &response)> callback,
+                  int concurrency = 8);
     HttpCookieJar &cookieJar();
     HttpCookie cookie(const QUrl &url, const QString &name);
     void setManagingCookies(bool managingCookies);
@@ -357,6 +484,39 @@ public:
 
     void setKeepAlive(bool keepAlive);
     bool keepAlive() const;
+    // send GET requests on busy connections without waiting for the previous responses. off by default as
+    // many servers and proxies do not handle it well. responses without Content-Length stop the pipeline.
+    void setPipelining(bool pipelining);
+    bool pipelining() const;
+    // send the first bytes of new connections in the SYN once the servers gave their cookies, which saves a round trip
+    // for short requests. off by default, see Socket::FastOpenConnectSocketOption.
+    void setTcpFastOpen(bool tcpFastOpen);
+    bool tcpFastOpen() const;
+    HttpConnectionPoolStats connectionPoolStats() const;
+    // the duplicates of hedged requests are limited to this ratio of the requests enabling HttpRequest::hedgeDelay(),
+    // default to 0.1. the duplicates go to the pooled connections, so they may wait behind the slow one if pipelining.
+    void setHedgingBudget(float budget);
+    float hedgingBudget() const;
+    // spread the new connections over all resolved addresses of server instead of the first reachable one. the less
+    // busy one of two random addresses is taken, and the failed addresses are skipped for 10 seconds. off by default.
+    void setBalancingAddresses(bool balancingAddresses);
+    bool balancingAddresses() const;
+    QList<HttpAddressStats> addressStats() const;  // of the addresses connected with balancing.
+    // the GET and HEAD requests identical to one in flight wait for its response instead of going to the server, so
+    // an expired entry of cache manager is fetched or revalidated once. the waiters share the response, so streamed
+    // responses are not coalesced. off by default.
+    void setCoalescingRequests(bool coalescingRequests);
+    bool coalescingRequests() const;
+    // make `count` connections to the server of url in background, including the tls handshake, and keep them idle.
+    // the h2 servers get one shared connection after the exchange of SETTINGS. the idle connections are limited by
+    // maxConnectionsPerServer(), and nothing is made if keepAlive() is false.
+    void preconnect(const QUrl &url, int count = 1);
+    // keep at least `count` idle connections to the server of url, which are made again once taken or closed. they
+    // are not dropped by the idle timeout. set to 0 to stop, nothing is kept if keepAlive() is false.
+    void setMinIdleConnections(const QUrl &url, int count);
+    // the unexpired Alt-Svc advertisements of the origin of url, recorded from the https responses. the requests are
+    // not sent to them yet, http/3 needs a quic transport, which the bundled libressl can not handshake.
+    QList<HttpAlternativeService> alternativeServices(const QUrl &url) const;
 
     QString defaultUserAgent() const;
     void setDefaultUserAgent(const QString &userAgent);
@@ -378,6 +538,15 @@ public:
 #ifndef QTNG_NO_CRYPTO
     class SslConfiguration &sslConfiguration();
 #endif
+public:
+    // the cookies, cache and redirects of session are not applied to the prepared requests. the query of request is
+    // merged into its path once, and the body is given by every send().
+    PreparedHttpRequest prepare(const HttpRequest &request);
+    // pathAndQuery is encoded such as `/health?full=1`, the path of prepared request is used if it is empty. the url
+    // of response is the one of prepared request.
+    HttpResponse send(const PreparedHttpRequest &prepared, const QByteArray &pathAndQuery = QByteArray(),
+                      const QByteArray &body = QByteArray(),
+                      const QList<HttpHeader> &extraHeaders = QList<HttpHeader>());
 private:
     HttpSessionPrivate *d_ptr;
     Q_DECLARE_PRIVATE(HttpSession)
@@ -389,11 +558,19 @@ public:
     HttpCacheManager();
     virtual ~HttpCacheManager();
 public:
+    // store the response if it is allowed by Cache-Control, Expires and Vary.
     virtual bool addResponse(HttpResponse &response);
+    // replace the response by the cached one if it is fresh.
     virtual bool getResponse(HttpResponse *response);
+    // called if getResponse() returns false, the If-None-Match and If-Modified-Since headers to revalidate the stale
+    // one are appended to `validators`. returns false if there is nothing to revalidate.
+    virtual bool getValidators(HttpResponse *response, QList<HttpHeader> *validators);
+    // merge the 304 response of revalidation into the cached one, and replace it by the cached one.
+    virtual bool updateResponse(HttpResponse *response);
 protected:
     virtual bool store(const QString &url, const QByteArray &data);
     virtual QByteArray load(const QString &url);
+    virtual void remove(const QString &url);
 };
 
 class HttpMemoryCacheManagerPrivate;
@@ -403,33 +580,46 @@ public:
     HttpMemoryCacheManager();
     virtual ~HttpMemoryCacheManager() override;
 public:
-    float expireTime() const;
+    float expireTime() const;  // the entries are dropped after it even if they can be revalidated.
     void setExpireTime(float expireTime);
+    qint64 maxSize() const;  // the least recently used entries are dropped if it is exceeded, default to 64MB.
+    void setMaxSize(qint64 maxSize);
+    qint64 size() const;
 protected:
-    QMap<QString, QByteArray> &cache();
+    // a copy of the packed entries by keys, which are the urls of GET and `METHOD url` of the others. it can not be
+    // changed in place, as the entries are counted by size and lru, use store() and remove() instead.
+    const QMap<QString, QByteArray> cache() const;
     virtual bool store(const QString &url, const QByteArray &data) override;
     virtual QByteArray load(const QString &url) override;
+    virtual void remove(const QString &url) override;
 private:
     HttpMemoryCacheManagerPrivate * const d_ptr;
     Q_DECLARE_PRIVATE(HttpMemoryCacheManager)
 };
 
+class HttpDiskCacheManagerPrivate;
+// the entries are appended to segment files in cacheDir and indexed in memory. the writes are done by a thread, and
+// the sparse segments are compacted by rewriting their live entries.
 class HttpDiskCacheManager : public HttpCacheManager
 {
 public:
-    HttpDiskCacheManager(const QDir &cacheDir)
-        : cacheDir(cacheDir)
-    {
-    }
-    HttpDiskCacheManager(const QString &cacheDir)
-        : cacheDir(cacheDir)
-    {
-    }
+    HttpDiskCacheManager(const QDir &cacheDir);
+    HttpDiskCacheManager(const QString &cacheDir);
+    virtual ~HttpDiskCacheManager() override;
+public:
+    qint64 maxSize() const;  // the oldest segments are dropped if it is exceeded, default to 1GB.
+    void setMaxSize(qint64 maxSize);
+    qint64 size() const;
+    bool flush();  // wait for the pending writes.
 protected:
-    virtual bool store(const QString &url, const QByteArray &data);
-    virtual QByteArray load(const QString &url);
+    virtual bool store(const QString &url, const QByteArray &data) override;
+    virtual QByteArray load(const QString &url) override;
+    virtual void remove(const QString &url) override;
 protected:
     QDir cacheDir;
+private:
+    HttpDiskCacheManagerPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(HttpDiskCacheManager)
 };
 
 class HTTPError : public RequestError
@@ -552,6 +742,13 @@ public:
     virtual QString what() const;
 };
 
+// the body would exceed the hard limit of BufferBudget.
+class BufferBudgetExceeded : public RequestError
+{
+public:
+    virtual QString what() const;
+};
+
 QTNETWORKNG_NAMESPACE_END
 
 #endif  // QTNG_HTTP_H
@@ -98,6 +98,8 @@ public:
     virtual ~HttpCookieJar();
 
     virtual QList<HttpCookie> cookiesForUrl(const QUrl &url) const;
+    // the `Cookie` header made of cookiesForUrl(), override it too if cookiesForUrl() is overridden.
+    virtual QByteArray cookieHeaderForUrl(const QUrl &url) const;
     virtual bool setCookiesFromUrl(const QList<HttpCookie> &cookieList, const QUrl &url);
 
     virtual bool insertCookie(const HttpCookie &cookie);
@@ -0,0 +1,108 @@
+#ifndef QTNG_HTTP_ROUTER_H
+#define QTNG_HTTP_ROUTER_H
+
+#include <QtCore/qstring.h>
+#include <QtCore/qstringlist.h>
+#include <QtCore/qvector.h>
+#include "config.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// the values captured by a route, such as {"id": "42"} if "/users/:id" matches "/users/42".
+class HttpRouteParams
+{
+public:
+    QString value(const QString &name, const QString &defaultValue = QString()) const;
+    bool contains(const QString &name) const;
+    int size() const { return params.size(); }
+    bool isEmpty() const { return params.isEmpty(); }
+public:
+    QVector<QPair<QString, QString>> params;  // percent decoded, in the order of pattern.
+};
+
+class HttpRouteTreePrivate;
+// a radix tree of static prefixes, the path is matched char by char without splitting it. a ":name" segment captures
+// one segment, and a "*name" segment at the end captures the rest. static routes are preferred to parameters, and
+// parameters to the rest.
+class HttpRouteTree
+{
+public:
+    HttpRouteTree();
+    ~HttpRouteTree();
+public:
+    // returns false if the pattern is invalid or conflicts with another one.
+    bool insert(const QString &method, const QString &pattern, int id);
+    // returns -1 if not found. the methods of path are returned by allowedMethods if only the method is not matched.
+    // the query string of path is ignored, and HEAD falls back to GET.
+    int match(const QString &method, const QString &path, HttpRouteParams *params,
+              QStringList *allowedMethods = nullptr) const;
+private:
+    HttpRouteTreePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(HttpRouteTree)
+    Q_DISABLE_COPY(HttpRouteTree)
+};
+
+// dispatches requests to member functions of request handler. it is usually a static member shared by all handlers.
+//
+//     void MyHandler::doMethod()
+//     {
+//         QStringList allowed;
+//         if (!router()->dispatch(this, method, path, &allowed)) {
+//             sendError(allowed.isEmpty() ? HttpStatus::NotFound : HttpStatus::MethodNotAllowed);
+//         }
+//     }
+template<typename HandlerType>
+class HttpRouter
+{
+public:
+    typedef void (HandlerType::*RouteFunction)(const HttpRouteParams &params);
+public:
+    bool addRoute(const QString &method, const QString &pattern, RouteFunction func);
+    bool get(const QString &pattern, RouteFunction func) { return addRoute(QString::fromLatin1("GET"), pattern, func); }
+    bool post(const QString &pattern, RouteFunction func)
+    {
+        return addRoute(QString::fromLatin1("POST"), pattern, func);
+    }
+    bool put(const QString &pattern, RouteFunction func) { return addRoute(QString::fromLatin1("PUT"), pattern, func); }
+    bool patch(const QString &pattern, RouteFunction func)
+    {
+        return addRoute(QString::fromLatin1("PATCH"), pattern, func);
+    }
+    bool remove(const QString &pattern, RouteFunction func)
+    {
+        return addRoute(QString::fromLatin1("DELETE"), pattern, func);
+    }
+    // returns false if no route is matched.
+    bool dispatch(HandlerType *handler, const QString &method, const QString &path,
+                  QStringList *allowedMethods = nullptr) const;
+private:
+    HttpRouteTree tree;
+    QVector<RouteFunction> functions;
+};
+
+template<typename HandlerType>
+bool HttpRouter<HandlerType>::addRoute(const QString &method, const QString &pattern, RouteFunction func)
+{
+    if (!tree.insert(method, pattern, functions.size())) {
+        return false;
+    }
+    functions.append(func);
+    return true;
+}
+
+template<typename HandlerType>
+bool HttpRouter<HandlerType>::dispatch(HandlerType *handler, const QString &method, const QString &path,
+                                       QStringList *allowedMethods) const
+{
+    HttpRouteParams params;
+    int id = tree.match(method, path, &params, allowedMethods);
+    if (id < 0) {
+        return false;
+    }
+    (handler->*functions.at(id))(params);
+    return true;
+}
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_HTTP_ROUTER_H
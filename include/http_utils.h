@@ -7,6 +7,7 @@
 #include <QtCore/qlist.h>
 #include <QtCore/qurl.h>
 #include <QtCore/qmap.h>
+#include <QtCore/qvector.h>
 #include "socket_utils.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
@@ -66,6 +67,7 @@ enum HttpStatus {
     UnprocessableEntity = 422,
     Locked = 423,
     FailedDependency = 424,
+    TooEarly = 425,
     UpgradeRequired = 426,
     PreconditionRequired = 428,
     TooManyRequests = 429,
@@ -118,6 +120,22 @@ QDateTime fromHttpDate(const QByteArray &value);
 QByteArray toHttpDate(const QDateTime &dt);
 QString toString(KnownHeader knownHeader);
 
+// an alternative service advertised by the Alt-Svc header of rfc 7838, such as `h3=":443"; ma=3600`.
+struct HttpAlternativeService
+{
+    HttpAlternativeService()
+        : port(0)
+    {
+    }
+    QByteArray protocol;  // the alpn id, h3 or h2.
+    QString host;  // empty if it is the same host.
+    quint16 port;
+    QDateTime expires;
+};
+
+// parse the Alt-Svc header. clear is set if the value is `clear`, which drops the known services of the origin.
+QList<HttpAlternativeService> parseAltSvc(const QByteArray &value, bool *clear = nullptr);
+
 struct HttpHeader
 {
     HttpHeader(const QString &name, const QByteArray &value)
@@ -134,6 +152,91 @@ struct HttpHeader
 QDataStream &operator>>(QDataStream &ds, HttpHeader &header);
 QDataStream &operator<<(QDataStream &ds, const HttpHeader &header);
 
+// keep the insertion order for serialization, but find known headers by a fixed slot and the others by an
+// open-addressed table of their first entries. the names are compared case insensitively.
+//
+// it replaces the QList<HttpHeader> which WithHttpHeaders::headers was. the read-only operations of QList are kept for
+// the subclasses using it, but the entries can not be changed in place, use removeAt() and append() instead.
+class HttpHeaderStorage
+{
+public:
+    // skips the removed entries.
+    class const_iterator
+    {
+    public:
+        const_iterator(const HttpHeader *p, const HttpHeader *end)
+            : p(p)
+            , end(end)
+        {
+            skip();
+        }
+        const HttpHeader &operator*() const { return *p; }
+        const HttpHeader *operator->() const { return p; }
+        const_iterator &operator++()
+        {
+            ++p;
+            skip();
+            return *this;
+        }
+        bool operator==(const const_iterator &other) const { return p == other.p; }
+        bool operator!=(const const_iterator &other) const { return p != other.p; }
+    private:
+        void skip()
+        {
+            while (p != end && p->name.isNull()) {
+                ++p;
+            }
+        }
+        const HttpHeader *p;
+        const HttpHeader *end;
+    };
+public:
+    HttpHeaderStorage();
+    HttpHeaderStorage(const QList<HttpHeader> &headers);
+public:
+    void append(const HttpHeader &header, bool normalize = false);
+    // the QList operations, by the index of entries not removed.
+    int size() const { return entries.size() - removedCount; }
+    int count() const { return size(); }
+    bool isEmpty() const { return size() == 0; }
+    const HttpHeader &at(int i) const;
+    void removeAt(int i);
+    const_iterator begin() const { return const_iterator(entries.constData(), entries.constData() + entries.size()); }
+    const_iterator end() const
+    {
+        return const_iterator(entries.constData() + entries.size(), entries.constData() + entries.size());
+    }
+    const_iterator constBegin() const { return begin(); }
+    const_iterator constEnd() const { return end(); }
+    operator QList<HttpHeader>() const { return toList(); }
+    bool contains(const QString &name) const { return firstIndex(name) >= 0; }
+    bool contains(KnownHeader header) const { return knownSlots[header] >= 0; }
+    QByteArray value(const QString &name, const QByteArray &defaultValue) const;
+    QByteArray value(KnownHeader header, const QByteArray &defaultValue) const;
+    QList<QByteArray> values(const QString &name) const;
+    QList<QByteArray> values(KnownHeader header) const;
+    bool removeFirst(const QString &name);
+    bool removeFirst(KnownHeader header);
+    void clear();
+    QList<HttpHeader> toList() const;
+    // append the `Name: value\r\n` lines to out without copying the entries.
+    int serializedSize() const;
+    void serialize(QByteArray *out) const;
+private:
+    int firstIndex(const QString &name) const;
+    int nextIndex(int from, const QString &name) const;
+    int unknownSlot(const QString &name) const;
+    void insertUnknown(int index);
+    bool removeEntry(int index);
+    void rebuild();
+private:
+    QVector<HttpHeader> entries;  // removed entries are kept with empty names until rebuild().
+    int knownSlots[HostHeader + 1];  // the first entry of every known header, or -1.
+    QVector<int> unknownSlots;  // the first entry of every other name, or -1. the size is a power of 2.
+    int unknownCount;
+    int removedCount;
+};
+
 template<typename Base>
 class WithHttpHeaders : public Base
 {
@@ -167,11 +270,12 @@ public:
     QList<QByteArray> multiHeader(const QString &name) const;
     QList<QByteArray> multiHeader(KnownHeader header) const;
 #endif
-    QList<HttpHeader> allHeaders() const { return headers; }
+    QList<HttpHeader> allHeaders() const { return headers.toList(); }
     void setHeaders(const QMap<QString, QByteArray> headers);
-    void setHeaders(const QList<HttpHeader> &headers) { this->headers = headers; }
+    void setHeaders(const QList<HttpHeader> &headers) { this->headers = HttpHeaderStorage(headers); }
 protected:
-    QList<HttpHeader> headers;
+    // it was a QList<HttpHeader>, see HttpHeaderStorage for the operations kept.
+    HttpHeaderStorage headers;
 };
 class EmptyClass
 {
@@ -183,14 +287,14 @@ class HttpHeaderManager : public WithHttpHeaders<EmptyClass>
 template<typename Base>
 void WithHttpHeaders<Base>::setContentLength(qint64 contentLength)
 {
-    setHeader(QString::fromLatin1("Content-Length"), QString::number(contentLength).toLatin1());
+    setHeader(ContentLengthHeader, QByteArray::number(contentLength));
 }
 
 template<typename Base>
 qint64 WithHttpHeaders<Base>::getContentLength() const
 {
     bool ok;
-    QByteArray s = header(QString::fromLatin1("Content-Length"));
+    QByteArray s = header(ContentLengthHeader);
     qint64 l = s.toLongLong(&ok);
     if (ok) {
         if (l >= 0) {
@@ -206,19 +310,19 @@ qint64 WithHttpHeaders<Base>::getContentLength() const
 template<typename Base>
 void WithHttpHeaders<Base>::setContentType(const QString &contentType)
 {
-    setHeader(QString::fromLatin1("Content-Type"), contentType.toUtf8());
+    setHeader(ContentTypeHeader, contentType.toUtf8());
 }
 
 template<typename Base>
 QString WithHttpHeaders<Base>::getContentType() const
 {
-    return QString::fromUtf8(header(QString::fromLatin1("Content-Type"), "text/plain"));
+    return QString::fromUtf8(header(ContentTypeHeader, "text/plain"));
 }
 
 template<typename Base>
 QUrl WithHttpHeaders<Base>::getLocation() const
 {
-    const QByteArray &value = header(QString::fromLatin1("Location"));
+    const QByteArray &value = header(LocationHeader);
     if (value.isEmpty()) {
         return QUrl();
     }
@@ -233,13 +337,13 @@ QUrl WithHttpHeaders<Base>::getLocation() const
 template<typename Base>
 void WithHttpHeaders<Base>::setLocation(const QUrl &url)
 {
-    setHeader(QString::fromLatin1("Location"), url.toEncoded(QUrl::FullyEncoded));
+    setHeader(LocationHeader, url.toEncoded(QUrl::FullyEncoded));
 }
 
 template<typename Base>
 QDateTime WithHttpHeaders<Base>::getLastModified() const
 {
-    const QByteArray &value = header(QString::fromLatin1("Last-Modified"));
+    const QByteArray &value = header(LastModifiedHeader);
     if (value.isEmpty()) {
         return QDateTime();
     }
@@ -249,7 +353,7 @@ QDateTime WithHttpHeaders<Base>::getLastModified() const
 template<typename Base>
 void WithHttpHeaders<Base>::setLastModified(const QDateTime &lastModified)
 {
-    setHeader(QString::fromLatin1("Last-Modified"), toHttpDate(lastModified));
+    setHeader(LastModifiedHeader, toHttpDate(lastModified));
 }
 
 template<typename Base>
@@ -271,39 +375,26 @@ QDateTime WithHttpHeaders<Base>::getModifedSince() const
 template<typename Base>
 bool WithHttpHeaders<Base>::hasHeader(const QString &headerName) const
 {
-    for (int i = 0; i < headers.size(); ++i) {
-        const HttpHeader &header = headers.at(i);
-        if (header.name.compare(headerName, Qt::CaseInsensitive) == 0) {
-            return true;
-        }
-    }
-    return false;
+    return headers.contains(headerName);
 }
 
 template<typename Base>
 bool WithHttpHeaders<Base>::removeHeader(const QString &headerName)
 {
-    for (int i = 0; i < headers.size(); ++i) {
-        const HttpHeader &header = headers.at(i);
-        if (header.name.compare(headerName, Qt::CaseInsensitive) == 0) {
-            headers.removeAt(i);
-            return true;
-        }
-    }
-    return false;
+    return headers.removeFirst(headerName);
 }
 
 template<typename Base>
 void WithHttpHeaders<Base>::setHeader(const QString &name, const QByteArray &value)
 {
-    removeHeader(name);
-    addHeader(name, value);
+    headers.removeFirst(name);
+    headers.append(HttpHeader(name, value), true);
 }
 
 template<typename Base>
 void WithHttpHeaders<Base>::addHeader(const QString &name, const QByteArray &value)
 {
-    headers.append(HttpHeader(normalizeHeaderName(name), value));
+    headers.append(HttpHeader(name, value), true);
 }
 
 template<typename Base>
@@ -315,43 +406,38 @@ void WithHttpHeaders<Base>::addHeader(const HttpHeader &header)
 template<typename Base>
 void WithHttpHeaders<Base>::setHeader(KnownHeader header, const QByteArray &value)
 {
-    setHeader(toString(header), value);
+    headers.removeFirst(header);
+    headers.append(HttpHeader(toString(header), value));
 }
 
 template<typename Base>
 void WithHttpHeaders<Base>::addHeader(KnownHeader header, const QByteArray &value)
 {
-    addHeader(toString(header), value);
+    headers.append(HttpHeader(toString(header), value));
 }
 
 template<typename Base>
 bool WithHttpHeaders<Base>::hasHeader(KnownHeader header) const
 {
-    return hasHeader(toString(header));
+    return headers.contains(header);
 }
 
 template<typename Base>
 bool WithHttpHeaders<Base>::removeHeader(KnownHeader header)
 {
-    return removeHeader(toString(header));
+    return headers.removeFirst(header);
 }
 
 template<typename Base>
 QByteArray WithHttpHeaders<Base>::header(const QString &headerName, const QByteArray &defaultValue) const
 {
-    for (int i = 0; i < headers.size(); ++i) {
-        const HttpHeader &header = headers.at(i);
-        if (header.name.compare(headerName, Qt::CaseInsensitive) == 0) {
-            return header.value;
-        }
-    }
-    return defaultValue;
+    return headers.value(headerName, defaultValue);
 }
 
 template<typename Base>
 QByteArray WithHttpHeaders<Base>::header(KnownHeader knownHeader, const QByteArray &defaultValue) const
 {
-    return header(toString(knownHeader), defaultValue);
+    return headers.value(knownHeader, defaultValue);
 }
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
@@ -363,20 +449,13 @@ QByteArray WithHttpHeaders<Base>::header(KnownHeader knownHeader, const QByteArr
 template<typename Base>
 QBYTEARRAYLIST WithHttpHeaders<Base>::multiHeader(const QString &headerName) const
 {
-    QBYTEARRAYLIST l;
-    for (int i = 0; i < headers.size(); ++i) {
-        const HttpHeader &header = headers.at(i);
-        if (header.name.compare(headerName, Qt::CaseInsensitive) == 0) {
-            l.append(header.value);
-        }
-    }
-    return l;
+    return headers.values(headerName);
 }
 
 template<typename Base>
 QBYTEARRAYLIST WithHttpHeaders<Base>::multiHeader(KnownHeader header) const
 {
-    return multiHeader(toString(header));
+    return headers.values(header);
 }
 
 #undef QBYTEARRAYLIST
@@ -386,7 +465,7 @@ void WithHttpHeaders<Base>::setHeaders(const QMap<QString, QByteArray> headers)
 {
     this->headers.clear();
     for (QMap<QString, QByteArray>::const_iterator itor = headers.constBegin(); itor != headers.constEnd(); ++itor) {
-        this->headers.append(HttpHeader(normalizeHeaderName(itor.key()), itor.value()));
+        this->headers.append(HttpHeader(itor.key(), itor.value()), true);
     }
 }
 
@@ -404,13 +483,12 @@ public:
     };
 public:
     HeaderSplitter(QSharedPointer<SocketLike> connection, const QByteArray &buf, int debugLevel = 0)
-        : connection(connection)
-        , buf(buf)
+        : reader(connection, buf)
         , debugLevel(debugLevel)
     {
     }
     HeaderSplitter(QSharedPointer<SocketLike> connection, int debugLevel = 0)
-        : connection(connection)
+        : reader(connection)
         , debugLevel(debugLevel)
     {
     }
@@ -418,8 +496,7 @@ public:
     HttpHeader nextHeader(Error *error);
     QList<HttpHeader> headers(int maxHeaders, Error *error);
 public:
-    QSharedPointer<SocketLike> connection;
-    QByteArray buf;
+    BufferedSocketReader reader;  // takeBuffered() returns the partial body after headers.
     int debugLevel;
 };
 
@@ -434,16 +511,15 @@ public:
     };
 public:
     ChunkedBlockReader(QSharedPointer<SocketLike> connection, const QByteArray &buf)
-        : connection(connection)
-        , buf(buf)
+        : debugLevel(0)
+        , reader(connection, buf)
     {
     }
 public:
     QByteArray nextBlock(qint64 leftBytes, Error *error);
 public:
     int debugLevel;
-    QSharedPointer<SocketLike> connection;
-    QByteArray buf;
+    BufferedSocketReader reader;
 };
 
 class PlainBodyFile : public FileLike
@@ -458,6 +534,7 @@ public:
     const qint64 contentLength;
     const QSharedPointer<SocketLike> stream;
     QByteArray partialBody;
+    qint32 partialPos;  // the bytes of partialBody read.
     qint64 count;
 };
 
@@ -469,12 +546,30 @@ public:
     virtual qint32 write(const char *, qint32) override { return -1; }
     virtual void close() override { }
     virtual qint64 size() override { return -1; }
+private:
+    bool nextChunk();
 public:
     ChunkedBlockReader reader;
     ChunkedBlockReader::Error error;
-    QByteArray buf;
     qint64 maxBodySize;
     qint64 count;
+    qint64 leftInChunk;  // the chunk data is read into the buffer of caller directly.
+    bool needCrlf;  // the CRLF after the data of last chunk.
+    bool eof;
+};
+
+// reads the body of unknown size as chunked transfer-encoding, the body is read while sending.
+class ChunkedEncodedFile : public FileLike
+{
+public:
+    explicit ChunkedEncodedFile(QSharedPointer<FileLike> body);
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *, qint32) override { return -1; }
+    virtual void close() override { body->close(); }
+    virtual qint64 size() override { return -1; }
+public:
+    QSharedPointer<FileLike> body;
+    QByteArray buf;
     bool eof;
 };
 
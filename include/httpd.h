@@ -14,6 +14,35 @@ QTNETWORKNG_NAMESPACE_BEGIN
 #  define QBYTEARRAYLIST QList<QByteArray>
 #endif
 
+// writes the response body through a buffer, made by BaseHttpRequestHandler::startBody(). the head of response goes
+// out with the first block of body, and the buffer is sent once it is full. the body is chunked if the handler did not
+// send Content-Length, so finish() must be called at the end. do not keep it after the request is handled.
+class HttpResponseWriter
+{
+public:
+    bool write(const char *data, qint32 size);
+    bool write(const QByteArray &data) { return write(data.constData(), data.size()); }
+    bool flush();
+    bool finish();
+    bool isChunked() const { return chunked; }
+    qint64 bodySize() const { return count; }
+private:
+    HttpResponseWriter(QSharedPointer<SocketLike> connection, const QByteArray &head, qint32 bufferSize, bool chunked,
+                       bool discarding);
+    void frame();
+private:
+    QSharedPointer<SocketLike> connection;
+    QByteArray buffer;  // the head and the framed chunks not sent, followed by the body of the next chunk.
+    qint64 count;
+    qint32 bufferSize;
+    qint32 bodyStart;
+    bool chunked;
+    bool discarding;  // the response of HEAD has no body.
+    bool finished;
+    bool broken;
+    friend class BaseHttpRequestHandler;
+};
+
 class BaseHttpRequestHandler : public WithHttpHeaders<BaseRequestHandler>
 {
 public:
@@ -37,22 +66,52 @@ protected:  // http protocol, parsing request and making response.
     virtual void handle();
     virtual void handleOneRequest();
     virtual bool parseRequest();
+    virtual void handleHttp2(const QByteArray &buffered);  // serve every stream by a new handler of the server.
+    virtual bool parseHttp2Request();
+    // called before doMethod() if the client waits for 100 Continue before sending the body. returns false to reject
+    // the body after sending an error, and the connection is closed. the default one rejects the Content-Length
+    // larger than maxBodySize by 413. 100 Continue is sent at the first read of body.
+    virtual bool checkContinue();
     virtual bool sendError(HttpStatus status, const QString &longMessage = QString());
     virtual bool sendResponse(HttpStatus status, const QString &longMessage = QString());
     virtual QString errorMessage(HttpStatus status, const QString &shortMessage, const QString &longMessage);
     virtual QString errorMessageContentType();
     virtual QString dateTimeString();
+    // the chunked framing is always decoded, and the content encoding is decoded only if processEncoding is true.
     virtual QSharedPointer<FileLike> bodyAsFile(bool processEncoding = true);
+    // read the decoded body from connection while reading the returned file, so uploads can be piped to disk or
+    // upstream without buffering. the file fails after maxSize bytes, unlimited if maxSize < 0. returns null and
+    // sends 413 if Content-Length is larger than maxSize. 100 Continue is sent at the first read if it is expected.
+    QSharedPointer<FileLike> bodyStream(qint64 maxSize = -1);
 protected:  // util methods.
     void sendCommandLine(HttpStatus status, const QString &shortMessage);
     void sendHeader(KnownHeader name, const QByteArray &value) { sendHeader(toString(name).toLatin1(), value); }
     void sendHeader(const QByteArray &name, const QByteArray &value);
+    // pre-encoded "Name: value\r\n" lines, such as a static QByteArray shared by all responses. Connection and
+    // Transfer-Encoding must be sent by sendHeader() instead, so the handler knows about them.
+    void sendHeaders(const QByteArray &block);
     bool endHeader();
+    // instead of endHeader(), for the body written by pieces. Transfer-Encoding is chunked if Content-Length is not
+    // sent and the client speaks http/1.1, or else the connection is closed after the body. returns null if failed.
+    QSharedPointer<HttpResponseWriter> startBody(qint32 bufferSize = 1024 * 16);
+    QByteArray serverNameBytes();  // serverName() is called once for every connection.
     bool readBody();
 protected:
     virtual QByteArray tryToHandleMagicCode(bool &done);
 private:
-    QBYTEARRAYLIST headerCache;  // used for sendHeader() & endHeader()
+    QSharedPointer<FileLike> openBody(bool processEncoding, qint64 maxSize);
+    void finishHead();
+    bool hasUnreadBody();
+    QSharedPointer<class RequestBodyFile> bodyReader;  // opened by bodyAsFile() or bodyStream().
+    QSharedPointer<ChunkedBodyFile> chunkedBody;  // the framing of bodyReader, if the body is chunked.
+    QByteArray statusLine;  // set by sendCommandLine(), and sent before the headers.
+    QByteArray headerBuffer;  // the lines of sendHeader() & sendHeaders(), reused by the requests of a connection.
+    QByteArray http2Preface;  // the prior knowledge h2c is found by parseRequest().
+    QByteArray pipelined;  // the next requests received with the current one.
+    // replaces the request while pipelined requests are buffered, so their responses are sent by one write.
+    QSharedPointer<class PipelinedResponseWriter> pipelineWriter;
+    QByteArray serverNameCache;
+    bool waitingNextRequest;  // the connection is kept alive after the last request.
 public:
     static QString normalizePath(const QString &path);
 protected:
@@ -60,9 +119,12 @@ protected:
     QString path;  // sent by client.
     QByteArray body;  // sent by client.
     HttpVersion version;  // sent by client.
+    // received in tls early data, which may be replayed by attackers. reply TooEarly to the requests not idempotent.
+    bool earlyData;
 protected:
     HttpVersion serverVersion;  // default to HTTP 1.1
     float requestTimeout;  // default to 1 hour.
+    float keepAliveTimeout;  // seconds to wait for the next request of keep-alive connection, default to 60.
     qint32 maxBodySize;  // default to 32MB, unlimited if -1
     enum CloseConnectionStatus { Yes, No, Maybe } closeConnection;  // determined by http version and connection header.
 };
@@ -73,6 +135,11 @@ class StaticHttpRequestHandler : public BaseHttpRequestHandler
 public:
     StaticHttpRequestHandler()
         : enableDirectoryListing(false)
+        , openFileCacheSize(256)
+        , openFileCacheValid(1.0f)
+        , compressionCacheSize(1024 * 1024 * 16)
+        , enableCompression(true)
+        , enableAsyncFileIO(false)
     {
     }
 protected:
@@ -80,8 +147,15 @@ protected:
     virtual QSharedPointer<FileLike> listDirectory(const QDir &dir, const QString &displayDir);
     virtual bool loadMissingFile(const QFileInfo &fileInfo);
     virtual QFileInfo getIndexFile(const QDir &dir);
+    virtual QByteArray makeETag(const QFileInfo &fileInfo);
+    bool checkNotModified(const QFileInfo &fileInfo, const QByteArray &etag, const QByteArray &lastModified);
 protected:
     bool enableDirectoryListing;
+    int openFileCacheSize;  // the opened files kept by every thread, default to 256, disabled if 0.
+    float openFileCacheValid;  // seconds before a cached file is checked by stat() again, default to 1.
+    qint64 compressionCacheSize;  // bytes of compressed files kept by every thread, default to 16MB.
+    bool enableCompression;  // zstd, br, gzip or deflate the text files, or serve the .gz sibling. default to true.
+    bool enableAsyncFileIO;  // read the files in RawFile::ioThreadPool() for slow disks, default to false.
 };
 
 class SimpleHttpRequestHandler : public StaticHttpRequestHandler
@@ -101,6 +175,28 @@ protected:
     QDir rootDir;
 };
 
+// the idle upstream connections of BaseHttpProxyRequestHandler, keyed by host and port. one pool is shared by all
+// handlers of a server, and the connections are kept for the thread which made them.
+class HttpProxyUpstreamPoolPrivate;
+class HttpProxyUpstreamPool
+{
+public:
+    HttpProxyUpstreamPool();
+    ~HttpProxyUpstreamPool();
+public:
+    QSharedPointer<SocketLike> take(const QString &hostName, quint16 port);  // null if there is no alive one.
+    void release(const QString &hostName, quint16 port, QSharedPointer<SocketLike> connection);
+    void clear();
+    int maxIdlePerHost() const;  // default to 8.
+    void setMaxIdlePerHost(int maxIdlePerHost);
+    float idleTimeout() const;  // in seconds, default to 30.
+    void setIdleTimeout(float idleTimeout);
+private:
+    HttpProxyUpstreamPoolPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(HttpProxyUpstreamPool)
+    Q_DISABLE_COPY(HttpProxyUpstreamPool)
+};
+
 class BaseHttpProxyRequestHandler : public BaseHttpRequestHandler
 {
 protected:
@@ -115,11 +211,24 @@ protected:
                           bool success);
     virtual QSharedPointer<SocketLike> makeConnection(const QString &remoteHostName, quint16 remotePort,
                                                       HostAddress *forwardAddress);
+    // the pool shared by the handlers of server, such as the one kept by userData() of server. default to nullptr,
+    // which makes a new upstream connection for every plain http request.
+    virtual HttpProxyUpstreamPool *upstreamPool();
 protected:
     virtual QSharedPointer<class HttpResponse> sendRequest(class HttpRequest &request) = 0;
     virtual void exchangeAsync(QSharedPointer<SocketLike> request, QSharedPointer<SocketLike> forward) = 0;
 };
 
+// serve MetricsRegistry and the eventloop metrics of the serving thread to prometheus scrapers, at any path.
+class MetricsHttpRequestHandler : public BaseHttpRequestHandler
+{
+protected:
+    virtual void doGET() override;
+    virtual void doHEAD() override;
+protected:
+    virtual QByteArray makeMetrics();
+};
+
 // static http(s) server serving current directory.
 class SimpleHttpServer : public TcpServer<SimpleHttpRequestHandler>
 {
@@ -8,6 +8,8 @@
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
+class SocketLike;
+class ThreadPool;
 class FileLike
 {
 public:
@@ -23,6 +25,8 @@ public:
 public:
     static QSharedPointer<FileLike> rawFile(QSharedPointer<QFile> f);
     static QSharedPointer<FileLike> rawFile(QFile *f) { return rawFile(QSharedPointer<QFile>(f)); }
+    // the reads and writes are done in the io threads, see RawFile::setAsync().
+    static QSharedPointer<FileLike> asyncFile(QSharedPointer<QFile> f);
     static QSharedPointer<FileLike> open(const QString &filepath, const QString &mode = QString());
     static QSharedPointer<FileLike> bytes(const QByteArray &data);
     static QSharedPointer<FileLike> bytes(QByteArray *data);
@@ -41,12 +45,24 @@ public:
     virtual qint64 size() override;
 public:
     bool seek(qint64 pos);
+    qint64 pos() const;
     QString fileName() const;
+    // the disk io is done in the threads of pool, and only the current coroutine waits for a slow disk. the position
+    // is taken when read() or write() is called, so the file can still be shared by coroutines which seek before
+    // every read. the default pool is shared by the file of the current thread. sendfile() copies async files in user
+    // space instead of calling sendfile(2), which blocks the event loop.
+    void setAsync(bool async, QSharedPointer<ThreadPool> pool = QSharedPointer<ThreadPool>());
+    bool isAsync() const { return !pool.isNull(); }
+    static QSharedPointer<ThreadPool> ioThreadPool();
 public:
     static QSharedPointer<RawFile> open(const QString &filepath, const QString &mode = QString());
     static QSharedPointer<RawFile> open(const QString &filepath, QIODevice::OpenMode mode);
 public:
     QSharedPointer<QFile> f;
+    QSharedPointer<ThreadPool> pool;
+private:
+    qint32 asyncRead(char *data, qint32 size);
+    qint32 asyncWrite(const char *data, qint32 size);
 };
 
 class BytesIOPrivate;
@@ -68,8 +84,77 @@ private:
     Q_DECLARE_PRIVATE(BytesIO)
 };
 
+class SegmentedBytesIOPrivate;
+// a fifo of bytes kept in chunks. write() appends to the back and read() consumes from the front, the written bytes
+// are never moved, so building a large body does not reallocate. the segments are handed to sendv() as they are.
+class SegmentedBytesIO : public FileLike
+{
+public:
+    explicit SegmentedBytesIO(qint32 chunkSize = 1024 * 16);
+    virtual ~SegmentedBytesIO() override;
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *data, qint32 size) override;
+    virtual void close() override;
+    virtual qint64 size() override;  // the bytes not read yet.
+    virtual QByteArray readall(bool *ok) override;
+public:
+    void append(const QByteArray &data);  // keep the data as a segment without copying.
+    qint64 skip(qint64 size);  // drop the bytes from the front, returns the dropped size.
+    bool isEmpty() const;
+    // the unread bytes, share the memory with the buffer except that the first one is copied if partly read.
+    QList<QByteArray> segments() const;
+    QList<QByteArray> takeSegments();
+    // sendv() the unread bytes and consume what is sent, returns false if not all bytes are sent.
+    bool sendTo(QSharedPointer<SocketLike> socket);
+private:
+    SegmentedBytesIOPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(SegmentedBytesIO)
+};
+
+class MappedFilePrivate;
+// maps the whole file read-only, read() is a memcpy from the mapping. the views returned by view() share the memory
+// with the mapping, they must not be used after the file is closed or destroyed.
+class MappedFile : public FileLike
+{
+public:
+    enum Advice {
+        NormalAccess,
+        SequentialAccess,
+        RandomAccess,
+        WillNeed,
+        DontNeed,
+    };
+public:
+    MappedFile(QSharedPointer<QFile> f);
+    virtual ~MappedFile() override;
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *data, qint32 size) override;  // always returns -1.
+    virtual void close() override;
+    virtual qint64 size() override;
+    virtual QByteArray readall(bool *ok) override;
+public:
+    bool isValid() const;
+    const char *data() const;
+    // returns null if the range is out of the file. len < 0 means to the end of file.
+    QByteArray view(qint64 offset, qint32 len = -1) const;
+    // madvise() the pages of range, returns false if it is not supported.
+    bool advise(Advice advice, qint64 offset = 0, qint64 len = -1);
+    bool seek(qint64 pos);
+    qint64 pos() const;
+public:
+    // returns null if the file can not be opened or mapped.
+    static QSharedPointer<MappedFile> open(const QString &filepath);
+private:
+    MappedFilePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(MappedFile)
+};
+
 bool sendfile(QSharedPointer<FileLike> inputFile, QSharedPointer<FileLike> outputFile, qint64 bytesToCopy = -1,
               int suitableBlockSize = 1024 * 8);
+// copy bytesToCopy bytes from offset of inputFile, or to the end if bytesToCopy < 0. a RawFile is sent to a tcp
+// Socket by sendfile() or TransmitFile() without copying it to user space.
+bool sendfile(QSharedPointer<FileLike> inputFile, QSharedPointer<SocketLike> outputSocket, qint64 offset,
+              qint64 bytesToCopy);
 
 class PosixPathPrivate;
 class PosixPath
@@ -0,0 +1,91 @@
+#ifndef QTNG_JSON_STREAM_H
+#define QTNG_JSON_STREAM_H
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qstring.h>
+#include "config.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+class MsgPackStream;
+
+// an incremental json parser. the bytes are fed by pieces as they come, and the tokens are pulled one by one without
+// building the document, so the memory does not grow with the size of document.
+//
+//     JsonStreamReader reader;
+//     reader.addData(block);
+//     JsonStreamReader::Token token;
+//     while ((token = reader.next()) != JsonStreamReader::NeedMoreData) {
+//         if (token == JsonStreamReader::Key && reader.stringValue() == "id") { ... }
+//     }
+//
+// call finish() after the last block, so the number at the end of document is taken and the truncated documents are
+// reported as Invalid. the strings are unescaped to utf-8 bytes, which are not validated.
+class JsonStreamReaderPrivate;
+class JsonStreamReader
+{
+public:
+    enum Token {
+        NeedMoreData,
+        StartObject,
+        EndObject,
+        StartArray,
+        EndArray,
+        Key,
+        String,
+        Integer,
+        Double,
+        Bool,
+        Null,
+        EndOfDocument,
+        Invalid,
+    };
+public:
+    JsonStreamReader();
+    ~JsonStreamReader();
+public:
+    void addData(const char *data, qint32 size);
+    void addData(const QByteArray &data) { addData(data.constData(), data.size()); }
+    void finish();  // no more data.
+    Token next();
+    Token token() const;
+    QByteArray stringValue() const;  // the utf-8 bytes of Key or String.
+    QString toString() const;
+    qint64 integerValue() const;
+    double doubleValue() const;  // of Double or Integer.
+    bool boolValue() const;
+    int depth() const;  // of the arrays and objects not ended.
+    qint64 offset() const;  // the bytes consumed.
+    void setMaxDepth(int maxDepth);  // deeper documents are Invalid, default to 512.
+    int maxDepth() const;
+    QString errorString() const;
+private:
+    JsonStreamReaderPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(JsonStreamReader)
+    Q_DISABLE_COPY(JsonStreamReader)
+};
+
+// transcodes json to msgpack while the bytes are fed, without building the document. msgpack needs the sizes of
+// arrays and maps before their elements, so every container is buffered until it ends. if splitTopArray is true, the
+// elements of top array are written as a sequence of msgpack values, so only one element is buffered at once.
+class JsonMsgPackTranscoderPrivate;
+class JsonMsgPackTranscoder
+{
+public:
+    explicit JsonMsgPackTranscoder(MsgPackStream *out, bool splitTopArray = false);
+    ~JsonMsgPackTranscoder();
+public:
+    bool addData(const char *data, qint32 size);  // returns false if the json is invalid or the writing failed.
+    bool addData(const QByteArray &data) { return addData(data.constData(), data.size()); }
+    bool finish();  // returns false if the document is not complete.
+    quint64 valuesWritten() const;  // the top values written to out.
+    QString errorString() const;
+private:
+    JsonMsgPackTranscoderPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(JsonMsgPackTranscoder)
+    Q_DISABLE_COPY(JsonMsgPackTranscoder)
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_JSON_STREAM_H
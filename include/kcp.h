@@ -15,6 +15,20 @@ public:
         FastInternet,
         Ethernet,
         Loopback,
+        // starts as Internet, then tunes the interval, resending and send window every second by the measured rtt,
+        // loss and send queue. the mtu is not changed.
+        Adaptive,
+    };
+    struct Statistics
+    {
+        quint32 rtt;  // smoothed, in msecs.
+        quint32 rto;
+        float lossRate;  // the smoothed ratio of segments resent after timeout.
+        quint32 retransmissions;  // the total segments resent after timeout.
+        quint32 sendQueueSize;  // the segments waiting for sending or acknowledgement.
+        quint32 sendWindow;
+        quint32 receiveWindow;
+        quint32 interval;
     };
 public:
     explicit KcpSocket(HostAddress::NetworkLayerProtocol protocol = HostAddress::IPv4Protocol);
@@ -29,8 +43,30 @@ public:
     void setUdpPacketSize(quint32 udpPacketSize);
     quint32 udpPacketSize() const;
     quint32 payloadSizeHint() const;
+    // probes the largest udp payload which is not fragmented on the path, starting from 1200 bytes, and raises the
+    // udpPacketSize() and payloadSizeHint() live. it searches again every ten minutes. the peer answers the probes if
+    // it supports them, otherwise the base is kept. set it before connecting, the slaves of server inherit it. returns
+    // false if the platform can not forbid the fragmentation.
+    bool setPathMtuDiscovery(bool enabled);
+    bool isPathMtuDiscoveryEnabled() const;
+    Statistics statistics() const;
+    // kcp keeps the boundary of messages. in message mode, every send() is one message received by one recv() if the
+    // buffer of receiver is large enough, and the messages larger than maxMessageSize() are refused. only the sender
+    // needs it, the protocol is not changed.
+    void setMessageMode(bool messageMode);
+    bool isMessageMode() const;
+    qint32 maxMessageSize() const;
     void setTearDownTime(float secs);
     float tearDownTime() const;
+    // sends parityShards reed-solomon shards for every dataShards packets, so lost packets are recovered without
+    // retransmission. it is used if the peer supports it, and the slaves of server inherit it. 0 to disable.
+    bool setForwardErrorCorrection(int dataShards, int parityShards);
+    int fecDataShards() const;
+    int fecParityShards() const;
+    // for one of count servers bound to the same port with Socket::ReusePortHint, in the order of binding. the
+    // connection ids of its slaves are congruent to index modulo count, and a reuseport bpf program steers their
+    // datagrams to it even if the address of client is changed. returns false if the program is not supported.
+    bool setShard(int index, int count);
     Event busy;
     Event notBusy;
 public:
@@ -75,8 +111,10 @@ public:
     qint32 sendall(const char *data, qint32 size);
     QByteArray recv(qint32 size);
     QByteArray recvall(qint32 size);
+    qint32 recvInto(QByteArray &buf, qint32 maxSize);  // reuses the capacity of buf, which is resized to the result.
     qint32 send(const QByteArray &data);
     qint32 sendall(const QByteArray &data);
+    qint32 sendv(const QList<QByteArray> &data);  // kcp copies into segments anyway, buffers are queued one by one.
 
     virtual bool filter(char *data, qint32 *len, HostAddress *addr, quint16 *port);
     qint32 udpSend(const char *data, qint32 size, const HostAddress &addr, quint16 port);
@@ -2,8 +2,11 @@
 #define QTNG_LOCKS_H
 
 #include <QtCore/qqueue.h>
+#include <QtCore/qvector.h>
 #include <QtCore/qsharedpointer.h>
 #include <QtCore/qreadwritelock.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qatomic.h>
 #include "coroutine.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
@@ -86,6 +89,9 @@ public:
 public:
     void link(Event &other);
     void unlink(Event &other);
+    // call back once when the event is set, in the caller of set(). the stackless tasks wait events by this.
+    int addSetCallback(std::function<void()> callback);
+    void removeSetCallback(int callbackId);
 private:
     EventPrivate * const d_ptr;
     Q_DECLARE_PRIVATE(Event)
@@ -192,6 +198,47 @@ private:
     Q_DISABLE_COPY(Gate)
 };
 
+class RWLockPrivate;
+// a reader-writer lock of coroutines. the writers waiting go before the readers coming later, so the readers can not
+// starve the writers. if fair, the readers waiting while a writer holds the lock go before the next writer.
+class RWLock
+{
+public:
+    explicit RWLock(bool fair = false);
+    virtual ~RWLock();
+public:
+    bool lockForRead(bool blocking = true);
+    bool lockForWrite(bool blocking = true);
+    void unlock();
+    bool isLocked() const;
+    bool isWriting() const;
+    quint32 readers() const;
+    quint32 getting() const;
+private:
+    QSharedPointer<RWLockPrivate> d;
+    Q_DISABLE_COPY(RWLock)
+};
+
+class ThreadRWLockPrivate;
+// the writer-preferring RWLock shared by the coroutines of several threads, such as CoroutineThread, and the threads
+// without eventloop. the short critical sections of readers only take a mutex.
+class ThreadRWLock
+{
+public:
+    ThreadRWLock();
+    virtual ~ThreadRWLock();
+public:
+    bool lockForRead(bool blocking = true);
+    bool lockForWrite(bool blocking = true);
+    void unlock();
+    bool isLocked() const;
+    bool isWriting() const;
+    quint32 readers() const;
+private:
+    QSharedPointer<ThreadRWLockPrivate> d;
+    Q_DISABLE_COPY(ThreadRWLock)
+};
+
 template<typename LockType>
 class ScopedLock
 {
@@ -221,6 +268,48 @@ private:
     bool success;
 };
 
+template<typename LockType>
+class ScopedReadLock
+{
+public:
+    ScopedReadLock(LockType &lock)
+        : lock(lock)
+        , success(lock.lockForRead())
+    {
+    }
+    ~ScopedReadLock()
+    {
+        if (success) {
+            lock.unlock();
+        }
+    }
+    inline bool isSuccess() const { return success; }
+private:
+    LockType &lock;
+    bool success;
+};
+
+template<typename LockType>
+class ScopedWriteLock
+{
+public:
+    ScopedWriteLock(LockType &lock)
+        : lock(lock)
+        , success(lock.lockForWrite())
+    {
+    }
+    ~ScopedWriteLock()
+    {
+        if (success) {
+            lock.unlock();
+        }
+    }
+    inline bool isSuccess() const { return success; }
+private:
+    LockType &lock;
+    bool success;
+};
+
 template<typename T, typename EventType, typename ReadWriteLockType>
 class QueueType
 {
@@ -237,6 +326,7 @@ public:
     bool returns(const T &e);  // like put() but insert e to the head of queue.
     bool returnsForcely(const T &e);  // like putForcedly() but insert e to the head of queue.
     T get();
+    QList<T> getMany(quint32 maxCount);  // blocked until not empty, then takes at most maxCount elements at once.
     T peek();
     void clear();
     bool remove(const T &e);
@@ -314,6 +404,146 @@ class MultiThreadQueue : public MultiQueueType<T, ThreadEvent, QReadWriteLock>
 {
 };
 
+// the bounded mpmc queue of dmitry vyukov for threads and coroutines. put() and get() are lock free while the queue is
+// neither full nor empty, the events are used only to block. the capacity is rounded up to a power of two.
+template<typename T>
+class LockFreeThreadQueue
+{
+public:
+    explicit LockFreeThreadQueue(quint32 capacity);
+    ~LockFreeThreadQueue();
+public:
+    bool tryPut(const T &e);  // returns false if full.
+    bool tryGet(T *e);  // returns false if empty.
+    bool put(const T &e);  // blocked until not full.
+    T get();  // blocked until not empty.
+public:
+    inline quint32 capacity() const { return static_cast<quint32>(mask + 1); }
+    quint32 size() const;  // not exact while other threads are using the queue.
+    inline bool isEmpty() const { return size() == 0; }
+private:
+    struct Cell
+    {
+        QAtomicInteger<quintptr> sequence;
+        T data;
+    };
+    Cell *cells;
+    quintptr mask;
+    char padding1[64];
+    QAtomicInteger<quintptr> enqueuePos;
+    char padding2[64];
+    QAtomicInteger<quintptr> dequeuePos;
+    char padding3[64];
+    QAtomicInt putters;
+    QAtomicInt getters;
+    ThreadEvent notFull;
+    ThreadEvent notEmpty;
+    Q_DISABLE_COPY(LockFreeThreadQueue)
+};
+
+template<typename T>
+class MultiChannel;
+
+// a bounded channel between the coroutines and threads of any event loops, on top of the lock free ring of
+// LockFreeThreadQueue. the events are touched only if the other side is waiting. after close(), send() fails and
+// recv() returns the remaining items before failing.
+template<typename T>
+class Channel
+{
+public:
+    explicit Channel(quint32 capacity);
+public:
+    bool trySend(const T &e);  // returns false if full or closed.
+    bool send(const T &e);  // blocked until not full, returns false if closed.
+    quint32 sendMany(const QList<T> &l);  // blocked until all items are sent, returns the number sent before closed.
+    bool tryRecv(T *e);  // returns false if empty.
+    bool recv(T *e);  // blocked until not empty, returns false if closed and drained.
+    QList<T> recvMany(quint32 maxItems);  // blocked until not empty, returns at most maxItems items.
+    void close();
+public:
+    inline bool isClosed() const { return closed.loadAcquire(); }
+    inline quint32 capacity() const { return ring.capacity(); }
+    inline quint32 size() const { return ring.size(); }
+    inline bool isEmpty() const { return ring.isEmpty(); }
+private:
+    struct Waiting
+    {
+        explicit Waiting(QAtomicInt &n)
+            : n(n)
+        {
+            n.ref();
+        }
+        ~Waiting() { n.deref(); }
+        QAtomicInt &n;
+    };
+    void notifyReceivers();
+    void notifySenders();
+private:
+    LockFreeThreadQueue<T> ring;
+    QAtomicInt closed;
+    QAtomicInt senders;
+    QAtomicInt receivers;
+    ThreadEvent notFull;
+    ThreadEvent notEmpty;
+    QMutex selectorsMutex;
+    QList<ThreadEvent *> selectors;  // the events of MultiChannel, set with notEmpty.
+    friend class MultiChannel<T>;
+    Q_DISABLE_COPY(Channel)
+};
+
+// receive from many channels in one coroutine, the channels are taken in turn. it is not thread safe itself.
+template<typename T>
+class MultiChannel
+{
+public:
+    MultiChannel()
+        : next(0)
+    {
+    }
+    ~MultiChannel();
+public:
+    void addChannel(QSharedPointer<Channel<T>> channel);
+    void removeChannel(QSharedPointer<Channel<T>> channel);
+    bool tryRecv(T *e, int *index = nullptr);  // index is the position of channel which the item comes from.
+    bool recv(T *e, int *index = nullptr);  // blocked until any channel is not empty, false if all are closed and drained.
+private:
+    QList<QSharedPointer<Channel<T>>> channels;
+    ThreadEvent notEmpty;
+    int next;
+    Q_DISABLE_COPY(MultiChannel)
+};
+
+// a fixed capacity queue of coroutines in a ring buffer. the events are touched only if the queue turns empty or
+// full, and the batch functions move many items at once.
+template<typename T>
+class RingQueue
+{
+public:
+    explicit RingQueue(quint32 capacity);
+public:
+    bool put(const T &e);  // blocked until not full.
+    bool putMany(const QList<T> &l);  // blocked until all items are put, returns false if the queue is deleted.
+    T get();  // blocked until not empty.
+    QList<T> getMany(quint32 maxItems);  // blocked until not empty, returns at most maxItems items.
+    void clear();
+public:
+    inline bool isEmpty() const { return count == 0; }
+    inline bool isFull() const { return count == static_cast<quint32>(items.size()); }
+    inline quint32 capacity() const { return static_cast<quint32>(items.size()); }
+    inline quint32 size() const { return count; }
+    inline quint32 getting() const { return notEmpty.getting(); }
+private:
+    inline void pushItem(const T &e);
+    inline T popItem();
+private:
+    QVector<T> items;
+    quint32 head;
+    quint32 count;
+    Event notEmpty;
+    Event notFull;
+    Q_DISABLE_COPY(RingQueue)
+};
+
 template<typename T, typename EventType, typename ReadWriteLockType>
 QueueType<T, EventType, ReadWriteLockType>::QueueType(quint32 capacity)
     : mCapacity(capacity)
@@ -453,6 +683,29 @@ T QueueType<T, EventType, ReadWriteLockType>::get()
     return e;
 }
 
+template<typename T, typename EventType, typename ReadWriteLockType>
+QList<T> QueueType<T, EventType, ReadWriteLockType>::getMany(quint32 maxCount)
+{
+    QList<T> result;
+    if (maxCount == 0 || !notEmpty.wait()) {
+        return result;
+    }
+    lock.lockForWrite();
+    const quint32 n = qMin(maxCount, static_cast<quint32>(queue.size()));
+    result.reserve(static_cast<int>(n));
+    for (quint32 i = 0; i < n; ++i) {
+        result.append(queue.dequeue());
+    }
+    if (this->queue.isEmpty()) {
+        notEmpty.clear();
+    }
+    if (static_cast<quint32>(queue.size()) < mCapacity) {
+        notFull.set();
+    }
+    lock.unlock();
+    return result;
+}
+
 template<typename T, typename EventType, typename ReadWriteLockType>
 T QueueType<T, EventType, ReadWriteLockType>::peek()
 {
@@ -577,6 +830,481 @@ inline T MultiQueueType<T, EventType, ReadWriteLockType>::wait()
     return result;
 }
 
+template<typename T>
+LockFreeThreadQueue<T>::LockFreeThreadQueue(quint32 capacity)
+    : enqueuePos(0)
+    , dequeuePos(0)
+    , putters(0)
+    , getters(0)
+{
+    quintptr n = 2;
+    while (n < capacity && n < (1u << 30)) {
+        n <<= 1;
+    }
+    cells = new Cell[n];
+    mask = n - 1;
+    for (quintptr i = 0; i < n; ++i) {
+        cells[i].sequence.storeRelease(i);
+    }
+}
+
+template<typename T>
+LockFreeThreadQueue<T>::~LockFreeThreadQueue()
+{
+    delete[] cells;
+}
+
+template<typename T>
+bool LockFreeThreadQueue<T>::tryPut(const T &e)
+{
+    Cell *cell;
+    quintptr pos = enqueuePos.loadAcquire();
+    while (true) {
+        cell = &cells[pos & mask];
+        const qintptr diff = static_cast<qintptr>(cell->sequence.loadAcquire()) - static_cast<qintptr>(pos);
+        if (diff == 0) {
+            if (enqueuePos.testAndSetRelaxed(pos, pos + 1)) {
+                break;
+            }
+            pos = enqueuePos.loadAcquire();
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = enqueuePos.loadAcquire();
+        }
+    }
+    cell->data = e;
+    cell->sequence.storeRelease(pos + 1);
+    // a full barrier before reading the count, or the waiter may miss this item.
+    if (getters.fetchAndAddOrdered(0) > 0) {
+        notEmpty.set();
+    }
+    return true;
+}
+
+template<typename T>
+bool LockFreeThreadQueue<T>::tryGet(T *e)
+{
+    Cell *cell;
+    quintptr pos = dequeuePos.loadAcquire();
+    while (true) {
+        cell = &cells[pos & mask];
+        const qintptr diff = static_cast<qintptr>(cell->sequence.loadAcquire()) - static_cast<qintptr>(pos + 1);
+        if (diff == 0) {
+            if (dequeuePos.testAndSetRelaxed(pos, pos + 1)) {
+                break;
+            }
+            pos = dequeuePos.loadAcquire();
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = dequeuePos.loadAcquire();
+        }
+    }
+    *e = cell->data;
+    cell->data = T();
+    cell->sequence.storeRelease(pos + mask + 1);
+    if (putters.fetchAndAddOrdered(0) > 0) {
+        notFull.set();
+    }
+    return true;
+}
+
+// the event is cleared before trying again, so the set() of a tryGet() done after that is never lost.
+template<typename T>
+bool LockFreeThreadQueue<T>::put(const T &e)
+{
+    if (tryPut(e)) {
+        return true;
+    }
+    putters.ref();
+    bool ok = true;
+    while (true) {
+        notFull.clear();
+        if (tryPut(e)) {
+            break;
+        }
+        if (!notFull.wait()) {
+            ok = false;
+            break;
+        }
+    }
+    putters.deref();
+    return ok;
+}
+
+template<typename T>
+T LockFreeThreadQueue<T>::get()
+{
+    T e;
+    if (tryGet(&e)) {
+        return e;
+    }
+    getters.ref();
+    while (true) {
+        notEmpty.clear();
+        if (tryGet(&e)) {
+            break;
+        }
+        if (!notEmpty.wait()) {
+            e = T();
+            break;
+        }
+    }
+    getters.deref();
+    return e;
+}
+
+template<typename T>
+quint32 LockFreeThreadQueue<T>::size() const
+{
+    const qintptr n = static_cast<qintptr>(enqueuePos.loadAcquire() - dequeuePos.loadAcquire());
+    return static_cast<quint32>(qBound<qintptr>(0, n, static_cast<qintptr>(mask + 1)));
+}
+
+template<typename T>
+Channel<T>::Channel(quint32 capacity)
+    : ring(capacity)
+    , closed(false)
+    , senders(0)
+    , receivers(0)
+{
+}
+
+// a full barrier before reading the count, or the waiter may miss the item.
+template<typename T>
+void Channel<T>::notifyReceivers()
+{
+    if (receivers.fetchAndAddOrdered(0) > 0) {
+        notEmpty.set();
+        QMutexLocker locker(&selectorsMutex);
+        for (ThreadEvent *selector : selectors) {
+            selector->set();
+        }
+    }
+}
+
+template<typename T>
+void Channel<T>::notifySenders()
+{
+    if (senders.fetchAndAddOrdered(0) > 0) {
+        notFull.set();
+    }
+}
+
+template<typename T>
+bool Channel<T>::trySend(const T &e)
+{
+    if (isClosed() || !ring.tryPut(e)) {
+        return false;
+    }
+    notifyReceivers();
+    return true;
+}
+
+template<typename T>
+bool Channel<T>::send(const T &e)
+{
+    if (trySend(e)) {
+        return true;
+    }
+    Waiting waiting(senders);
+    while (!isClosed()) {
+        notFull.clear();
+        if (trySend(e)) {
+            return true;
+        }
+        if (!notFull.wait()) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// the receivers are notified once for every batch put without blocking.
+template<typename T>
+quint32 Channel<T>::sendMany(const QList<T> &l)
+{
+    int i = 0;
+    while (i < l.size()) {
+        int n = 0;
+        while (i < l.size() && !isClosed() && ring.tryPut(l.at(i))) {
+            ++i;
+            ++n;
+        }
+        if (n > 0) {
+            notifyReceivers();
+        }
+        if (i < l.size()) {
+            if (!send(l.at(i))) {
+                break;
+            }
+            ++i;
+        }
+    }
+    return static_cast<quint32>(i);
+}
+
+template<typename T>
+bool Channel<T>::tryRecv(T *e)
+{
+    if (!ring.tryGet(e)) {
+        return false;
+    }
+    notifySenders();
+    return true;
+}
+
+// the items sent before close() are always received, so try again after it is found closed.
+template<typename T>
+bool Channel<T>::recv(T *e)
+{
+    if (tryRecv(e)) {
+        return true;
+    }
+    Waiting waiting(receivers);
+    while (true) {
+        notEmpty.clear();
+        if (tryRecv(e)) {
+            return true;
+        }
+        if (isClosed()) {
+            return tryRecv(e);
+        }
+        if (!notEmpty.wait()) {
+            return false;
+        }
+    }
+}
+
+template<typename T>
+QList<T> Channel<T>::recvMany(quint32 maxItems)
+{
+    QList<T> l;
+    T e;
+    if (maxItems == 0 || !recv(&e)) {
+        return l;
+    }
+    l.append(e);
+    while (static_cast<quint32>(l.size()) < maxItems && ring.tryGet(&e)) {
+        l.append(e);
+    }
+    notifySenders();
+    return l;
+}
+
+template<typename T>
+void Channel<T>::close()
+{
+    if (closed.fetchAndStoreOrdered(true)) {
+        return;
+    }
+    notEmpty.set();
+    notFull.set();
+    QMutexLocker locker(&selectorsMutex);
+    for (ThreadEvent *selector : selectors) {
+        selector->set();
+    }
+}
+
+template<typename T>
+MultiChannel<T>::~MultiChannel()
+{
+    for (QSharedPointer<Channel<T>> channel : channels) {
+        QMutexLocker locker(&channel->selectorsMutex);
+        channel->selectors.removeOne(&notEmpty);
+    }
+}
+
+template<typename T>
+void MultiChannel<T>::addChannel(QSharedPointer<Channel<T>> channel)
+{
+    if (channel.isNull() || channels.contains(channel)) {
+        return;
+    }
+    QMutexLocker locker(&channel->selectorsMutex);
+    channel->selectors.append(&notEmpty);
+    channels.append(channel);
+}
+
+template<typename T>
+void MultiChannel<T>::removeChannel(QSharedPointer<Channel<T>> channel)
+{
+    if (!channels.removeOne(channel)) {
+        return;
+    }
+    QMutexLocker locker(&channel->selectorsMutex);
+    channel->selectors.removeOne(&notEmpty);
+}
+
+template<typename T>
+bool MultiChannel<T>::tryRecv(T *e, int *index)
+{
+    const int n = channels.size();
+    for (int i = 0; i < n; ++i) {
+        const int j = (next + i) % n;
+        if (channels.at(j)->tryRecv(e)) {
+            next = j + 1;
+            if (index) {
+                *index = j;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T>
+bool MultiChannel<T>::recv(T *e, int *index)
+{
+    if (tryRecv(e, index)) {
+        return true;
+    }
+    // the channels may be removed by other coroutines while waiting.
+    const QList<QSharedPointer<Channel<T>>> waitingChannels = channels;
+    for (QSharedPointer<Channel<T>> channel : waitingChannels) {
+        channel->receivers.ref();
+    }
+    bool ok = false;
+    try {
+        while (true) {
+            notEmpty.clear();
+            if (tryRecv(e, index)) {
+                ok = true;
+                break;
+            }
+            bool allClosed = true;
+            for (QSharedPointer<Channel<T>> channel : channels) {
+                allClosed = allClosed && channel->isClosed();
+            }
+            if (allClosed) {
+                ok = tryRecv(e, index);
+                break;
+            }
+            if (!notEmpty.wait()) {
+                break;
+            }
+        }
+    } catch (...) {
+        for (QSharedPointer<Channel<T>> channel : waitingChannels) {
+            channel->receivers.deref();
+        }
+        throw;
+    }
+    for (QSharedPointer<Channel<T>> channel : waitingChannels) {
+        channel->receivers.deref();
+    }
+    return ok;
+}
+
+template<typename T>
+RingQueue<T>::RingQueue(quint32 capacity)
+    : items(static_cast<int>(qBound<quint32>(1, capacity, INT_MAX)))
+    , head(0)
+    , count(0)
+{
+    notEmpty.clear();
+    notFull.set();
+}
+
+template<typename T>
+inline void RingQueue<T>::pushItem(const T &e)
+{
+    const quint32 n = static_cast<quint32>(items.size());
+    items[static_cast<int>((head + count) % n)] = e;
+    if (count++ == 0) {
+        notEmpty.set();
+    }
+    if (count == n) {
+        notFull.clear();
+    }
+}
+
+template<typename T>
+inline T RingQueue<T>::popItem()
+{
+    const quint32 n = static_cast<quint32>(items.size());
+    T e = items.at(static_cast<int>(head));
+    items[static_cast<int>(head)] = T();
+    head = (head + 1) % n;
+    if (count-- == n) {
+        notFull.set();
+    }
+    if (count == 0) {
+        notEmpty.clear();
+    }
+    return e;
+}
+
+template<typename T>
+bool RingQueue<T>::put(const T &e)
+{
+    while (isFull()) {
+        if (!notFull.wait()) {
+            return false;
+        }
+    }
+    pushItem(e);
+    return true;
+}
+
+template<typename T>
+bool RingQueue<T>::putMany(const QList<T> &l)
+{
+    int i = 0;
+    while (i < l.size()) {
+        while (isFull()) {
+            if (!notFull.wait()) {
+                return false;
+            }
+        }
+        while (i < l.size() && !isFull()) {
+            pushItem(l.at(i++));
+        }
+    }
+    return true;
+}
+
+template<typename T>
+T RingQueue<T>::get()
+{
+    while (isEmpty()) {
+        if (!notEmpty.wait()) {
+            return T();
+        }
+    }
+    return popItem();
+}
+
+template<typename T>
+QList<T> RingQueue<T>::getMany(quint32 maxItems)
+{
+    QList<T> l;
+    while (isEmpty()) {
+        if (!notEmpty.wait()) {
+            return l;
+        }
+    }
+    const quint32 n = qMin(maxItems, count);
+    l.reserve(static_cast<int>(n));
+    for (quint32 i = 0; i < n; ++i) {
+        l.append(popItem());
+    }
+    return l;
+}
+
+template<typename T>
+void RingQueue<T>::clear()
+{
+    for (int i = 0; i < items.size(); ++i) {
+        items[i] = T();
+    }
+    head = 0;
+    count = 0;
+    notEmpty.clear();
+    notFull.set();
+}
+
 QTNETWORKNG_NAMESPACE_END
 
 #endif  // QTNG_LOCKS_H
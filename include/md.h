@@ -2,6 +2,7 @@
 #define QTNG_MD_H
 
 #include <QtCore/qbytearray.h>
+#include <QtCore/qlist.h>
 #include "crypto.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
@@ -28,6 +29,11 @@ public:
     inline void addData(const QByteArray &data) { addData(data.constData(), data.size()); }
     void addData(const char *data, int len);
     QByteArray result();
+    // writes the digest to out which has digestSize() bytes at least. returns the size of digest, or -1 if failed.
+    int result(char *out);
+    int digestSize() const;  // in bytes, -1 if the algorithm is not available.
+    // start a new digest with the same context, so the digests of many small data do not allocate contexts.
+    bool reset();
 public:
     inline void update(const QByteArray &data) { addData(data.constData(), data.size()); }
     inline void update(const char *data, int len) { addData(data, len); }
@@ -36,6 +42,9 @@ public:
 public:
     static QByteArray hash(const QByteArray &data, Algorithm algo);
     static QByteArray digest(const QByteArray &data, Algorithm algo);
+    // hash every item of data by one context. the results are in the same order, and empty for the failed ones.
+    static QList<QByteArray> hashMany(const QList<QByteArray> &data, Algorithm algo);
+    static QList<QByteArray> digestMany(const QList<QByteArray> &data, Algorithm algo);
 private:
     MessageDigestPrivate * const d_ptr;
     Q_DECLARE_PRIVATE(MessageDigest)
@@ -0,0 +1,102 @@
+#ifndef QTNG_METRICS_H
+#define QTNG_METRICS_H
+
+#include <QtCore/qatomic.h>
+#include <QtCore/qbytearray.h>
+#include <QtCore/qvector.h>
+#include "config.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// process wide metrics exported in the prometheus text format. metrics are registered once and live until the process
+// exits, so the hot code keeps their pointers and every update is one or two relaxed atomic additions.
+class Metric
+{
+public:
+    enum Type {
+        Counter,
+        Gauge,
+        Histogram,
+    };
+    virtual ~Metric();
+    Type type() const { return t; }
+    QByteArray name() const { return metricName; }
+    virtual void writeTo(QByteArray *out) const = 0;  // the samples without the HELP and TYPE lines.
+protected:
+    Metric(Type type, const QByteArray &name);
+    const QByteArray metricName;
+private:
+    const Type t;
+    Q_DISABLE_COPY(Metric)
+};
+
+class MetricCounter : public Metric
+{
+public:
+    explicit MetricCounter(const QByteArray &name);
+    void add(quint64 n = 1) { v.fetchAndAddRelaxed(n); }
+    quint64 value() const { return v.loadAcquire(); }
+    virtual void writeTo(QByteArray *out) const override;
+private:
+    QAtomicInteger<quint64> v;
+};
+
+class MetricGauge : public Metric
+{
+public:
+    explicit MetricGauge(const QByteArray &name);
+    void add(qint64 n = 1) { v.fetchAndAddRelaxed(n); }
+    void sub(qint64 n = 1) { v.fetchAndSubRelaxed(n); }
+    void set(qint64 n) { v.storeRelease(n); }
+    qint64 value() const { return v.loadAcquire(); }
+    virtual void writeTo(QByteArray *out) const override;
+private:
+    QAtomicInteger<qint64> v;
+};
+
+// values are observed in microseconds and exported in seconds, as prometheus expects.
+class MetricHistogram : public Metric
+{
+public:
+    MetricHistogram(const QByteArray &name, const QVector<qint64> &bounds);
+    virtual ~MetricHistogram() override;
+    void observe(qint64 usecs);
+    quint64 count() const { return total.loadAcquire(); }
+    virtual void writeTo(QByteArray *out) const override;
+public:
+    static QVector<qint64> latencyBounds();  // 1ms to 10s.
+private:
+    const QVector<qint64> bounds;  // the upper bounds in ascending order, in microseconds.
+    QAtomicInteger<quint64> *buckets;  // not cumulative, and the last one is +Inf.
+    QAtomicInteger<quint64> total;
+    QAtomicInteger<qint64> sum;
+};
+
+class MetricsRegistryPrivate;
+class MetricsRegistry
+{
+public:
+    static MetricsRegistry *instance();
+public:
+    // the same name returns the same metric, or null if it is registered as another type.
+    MetricCounter *counter(const QByteArray &name, const QByteArray &help);
+    MetricGauge *gauge(const QByteArray &name, const QByteArray &help);
+    MetricHistogram *histogram(const QByteArray &name, const QByteArray &help,
+                               const QVector<qint64> &bounds = MetricHistogram::latencyBounds());
+    // append all metrics in the text exposition format 0.0.4.
+    void writeTo(QByteArray *out) const;
+    QByteArray exposition() const;
+private:
+    MetricsRegistry();
+    ~MetricsRegistry();
+    MetricsRegistryPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(MetricsRegistry)
+    Q_DISABLE_COPY(MetricsRegistry)
+};
+
+// append the eventLoopMetrics() of the current thread in the text exposition format.
+void writeEventLoopMetrics(QByteArray *out);
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_METRICS_H
@@ -3,6 +3,7 @@
 
 #include <limits>
 #include <type_traits>
+#include <string.h>
 #include <QtCore/qvariant.h>
 #include <QtCore/qiodevice.h>
 #include <QtCore/qdatetime.h>
@@ -74,6 +75,7 @@ public:
     bool readArrayHeader(quint32 &len);
     bool readMapHeader(quint32 &len);
     bool readExtHeader(quint32 &len, quint8 msgpackType);
+    bool readString(QByteArray &utf8);  // the utf-8 bytes of str without decoding.
 
     MsgPackStream &operator<<(bool b);
     MsgPackStream &operator<<(quint8 u8);
@@ -96,7 +98,28 @@ public:
     bool writeArrayHeader(quint32 len);
     bool writeMapHeader(quint32 len);
     bool writeExtHeader(quint32 len, quint8 msgpackType);
+    bool writeString(const QByteArray &utf8);  // the utf-8 bytes are written as str without encoding.
+
+    // packs fixed-width numbers as an extension of one byte type code and their big endian bytes, which is smaller
+    // than the array of msgpack numbers and copied by blocks. both peers must know it.
+    enum { TypedArrayExtType = 0x54 };
+    template<typename T>
+    bool writeTypedArray(const QVector<T> &values);
+    template<typename T>
+    bool readTypedArray(QVector<T> &values);
+
+    // the bytes of packed t, counted by packing t without writing. returns -1 if t can not be packed.
+    template<typename T>
+    static qint64 packedSize(const T &t);
+    // packs t into one allocation of the exact size. the first `reserved` bytes are left for the caller, such as the
+    // headers written by DataChannel::sendReservedPacket(). returns a null byte array if t can not be packed.
+    template<typename T>
+    static QByteArray pack(const T &t, int reserved = 0);
 private:
+    enum CountingMode { Counting };
+    explicit MsgPackStream(CountingMode);  // counts the written bytes, for packedSize().
+    qint64 countedSize() const;
+    qint64 readTypedArrayHeader(char code, int elementSize);  // returns the number of elements, or -1.
     MsgPackExtUserData *getUserData(intptr_t key) const;
 private:
     MsgPackStreamPrivate * const d_ptr;
@@ -104,6 +127,92 @@ private:
     Q_DISABLE_COPY(MsgPackStream);
 };
 
+// walks a packed buffer in place, the values not asked are skipped without decoding. strings, binaries and
+// extensions are returned by QByteArray::fromRawData() which shares the buffer, so keep the buffer while using them.
+//
+//     MsgPackView message(packet);
+//     if (message.value("type").toBytes() == "ping") {
+//         qint64 id = message.value("id").toInteger();
+//     }
+class MsgPackView
+{
+public:
+    enum Type { Invalid, Nil, Bool, Integer, UnsignedInteger, Float, Double, String, Binary, Array, Map, Extension };
+public:
+    MsgPackView();
+    explicit MsgPackView(const QByteArray &data);  // the first value of data, data is referenced by all views.
+    MsgPackView(const char *data, int size);  // data is not copied nor referenced.
+public:
+    Type type() const { return t; }
+    bool isValid() const { return t != Invalid; }
+    bool isNil() const { return t == Nil; }
+    bool toBool(bool defaultValue = false) const;
+    qint64 toInteger(qint64 defaultValue = 0) const;  // also accepts unsigned integers which fit.
+    quint64 toUnsignedInteger(quint64 defaultValue = 0) const;
+    double toDouble(double defaultValue = 0.0) const;  // also accepts float and integers.
+    QByteArray toBytes() const;  // the payload of str, bin and ext without copying.
+    QString toString() const;  // decoded from the utf-8 payload of str.
+    quint8 extensionType() const;
+    QVariant toVariant() const;  // decoded by MsgPackStream.
+    QByteArray raw() const;  // the packed bytes of this value without copying.
+public:
+    int size() const;  // the number of elements of array or pairs of map.
+    MsgPackView at(int i) const;  // the i-th element of array, the previous ones are skipped.
+    MsgPackView value(const QByteArray &key) const;  // the value of the first str key in map equals to key.
+    MsgPackView first() const;  // the first element of array or the first key of map.
+    MsgPackView next() const;  // the value after this one, invalid if it is out of buffer.
+private:
+    MsgPackView(const QByteArray &holder, const uchar *p, const uchar *end);
+    void parse();
+private:
+    QByteArray holder;
+    const uchar *p;  // the first byte of this value.
+    const uchar *end;  // of buffer.
+    const uchar *payload;  // the payload of scalars, or the first element of containers.
+    const uchar *valueEnd;  // the end of payload for scalars, or null for containers until skipped.
+    quint64 length;  // the bytes of scalar payload, or the number of elements of container.
+    Type t;
+};
+
+// splits a stream of packed values by the bytes fed in arbitrary chunks. the scanning state is kept between
+// feeds, so the bytes are scanned once, and the values are decoded from the buffer which receives socket input.
+//
+//     MsgPackUnpacker unpacker;
+//     while (true) {
+//         qint32 n = socket->recv(unpacker.beginFeed(1024 * 64), 1024 * 64);
+//         if (n <= 0) break;
+//         unpacker.endFeed(n);
+//         QVariant v;
+//         while (unpacker.take(v)) { ... }
+//         if (unpacker.isCorrupt()) break;
+//     }
+class MsgPackUnpackerPrivate;
+class MsgPackUnpacker
+{
+public:
+    MsgPackUnpacker();
+    ~MsgPackUnpacker();
+public:
+    void feed(const char *data, int size);
+    void feed(const QByteArray &data) { feed(data.constData(), data.size()); }
+    char *beginFeed(int size);  // returns the space of size bytes at the end of buffer, to receive into.
+    void endFeed(int size);  // size bytes are written to the space returned by beginFeed().
+    bool hasNext() const;  // a complete value is buffered.
+    QByteArray peek() const;  // the packed bytes of next value, valid until the next call of other methods.
+    void skip();  // drops the next value.
+    QByteArray takeRaw();  // the packed bytes of next value copied out of buffer.
+    template<typename T>
+    bool take(T &t);  // decodes the next value, returns false if there is not a complete value or it is invalid.
+    bool isCorrupt() const;  // the stream is not msgpack or a length exceeds lengthLimit(), nothing is taken since.
+    int bufferedSize() const;
+    void setLengthLimit(quint32 limit);  // of strings, binaries, extensions and containers.
+    quint32 lengthLimit() const;
+private:
+    MsgPackUnpackerPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(MsgPackUnpacker)
+    Q_DISABLE_COPY(MsgPackUnpacker);
+};
+
 /**
  * @brief The FirstByte enum
  * From Message Pack spec
@@ -269,6 +378,14 @@ MsgPackStream &operator<<(MsgPackStream &s, const QVector<T> &list)
     return s;
 }
 
+// the arrays of numbers are packed by blocks, in the same bytes as the generic ones.
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<float> &list);
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<double> &list);
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<qint32> &list);
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<quint32> &list);
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<qint64> &list);
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<quint64> &list);
+
 template<typename K, typename V>
 MsgPackStream &operator<<(MsgPackStream &s, const QMap<K, V> &map)
 {
@@ -374,6 +491,9 @@ MsgPackStream &operator>>(MsgPackStream &s, QVector<T> &list)
     return s;
 }
 
+MsgPackStream &operator>>(MsgPackStream &s, QVector<float> &list);
+MsgPackStream &operator>>(MsgPackStream &s, QVector<double> &list);
+
 template<typename K, typename V>
 MsgPackStream &operator>>(MsgPackStream &s, QMap<K, V> &map)
 {
@@ -423,8 +543,201 @@ MsgPackStream &operator>>(MsgPackStream &s, QHash<K, V> &map)
     return s;
 }
 
+template<typename T>
+struct MsgPackTypedArrayCode;
+#define QTNG_MSGPACK_TYPED_ARRAY_CODE(T, c) \
+    template<>                              \
+    struct MsgPackTypedArrayCode<T>         \
+    {                                       \
+        static const char value = c;        \
+    };
+QTNG_MSGPACK_TYPED_ARRAY_CODE(qint8, 'b')
+QTNG_MSGPACK_TYPED_ARRAY_CODE(quint8, 'B')
+QTNG_MSGPACK_TYPED_ARRAY_CODE(qint16, 'h')
+QTNG_MSGPACK_TYPED_ARRAY_CODE(quint16, 'H')
+QTNG_MSGPACK_TYPED_ARRAY_CODE(qint32, 'i')
+QTNG_MSGPACK_TYPED_ARRAY_CODE(quint32, 'I')
+QTNG_MSGPACK_TYPED_ARRAY_CODE(qint64, 'q')
+QTNG_MSGPACK_TYPED_ARRAY_CODE(quint64, 'Q')
+QTNG_MSGPACK_TYPED_ARRAY_CODE(float, 'f')
+QTNG_MSGPACK_TYPED_ARRAY_CODE(double, 'd')
+#undef QTNG_MSGPACK_TYPED_ARRAY_CODE
+
+// converts between big endian and host order in place, the loop is vectorized by compilers.
+template<typename T>
+inline void msgPackSwapBlock(T *values, int count)
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    typedef typename QIntegerForSizeof<T>::Unsigned U;
+    for (int i = 0; i < count; ++i) {
+        U u;
+        memcpy(&u, values + i, sizeof(U));
+        u = qbswap(u);
+        memcpy(values + i, &u, sizeof(U));
+    }
+#else
+    Q_UNUSED(values);
+    Q_UNUSED(count);
+#endif
+}
+
+template<typename T>
+bool MsgPackStream::writeTypedArray(const QVector<T> &values)
+{
+    const qint64 size = static_cast<qint64>(values.size()) * static_cast<qint64>(sizeof(T));
+    if (size + 1 > std::numeric_limits<qint32>::max()) {
+        setStatus(WriteFailed);
+        return false;
+    }
+    if (!writeExtHeader(static_cast<quint32>(size + 1), TypedArrayExtType)) {
+        return false;
+    }
+    const char code = MsgPackTypedArrayCode<T>::value;
+    if (!writeBytes(&code, 1)) {
+        return false;
+    }
+    QVector<T> block(values);
+    msgPackSwapBlock(block.data(), block.size());
+    return writeBytes(reinterpret_cast<const char *>(block.constData()), size);
+}
+
+template<typename T>
+bool MsgPackStream::readTypedArray(QVector<T> &values)
+{
+    const qint64 count = readTypedArrayHeader(MsgPackTypedArrayCode<T>::value, static_cast<int>(sizeof(T)));
+    if (count < 0) {
+        return false;
+    }
+    values.resize(static_cast<int>(count));
+    if (!readBytes(reinterpret_cast<char *>(values.data()), count * static_cast<qint64>(sizeof(T)))) {
+        values.clear();
+        return false;
+    }
+    msgPackSwapBlock(values.data(), values.size());
+    return true;
+}
+
+template<typename T>
+qint64 MsgPackStream::packedSize(const T &t)
+{
+    MsgPackStream s(Counting);
+    s << t;
+    if (s.status() != Ok) {
+        return -1;
+    }
+    return s.countedSize();
+}
+
+template<typename T>
+QByteArray MsgPackStream::pack(const T &t, int reserved)
+{
+    const qint64 size = packedSize(t);
+    if (size < 0 || reserved < 0 || size + reserved > std::numeric_limits<int>::max()) {
+        return QByteArray();
+    }
+    QByteArray bs;
+    bs.reserve(static_cast<int>(size + reserved));
+    bs.fill('\0', reserved);
+    MsgPackStream s(&bs, QIODevice::WriteOnly | QIODevice::Append);
+    s << t;
+    if (s.status() != Ok) {
+        return QByteArray();
+    }
+    return bs;
+}
+
+template<typename T>
+bool MsgPackUnpacker::take(T &t)
+{
+    if (!hasNext()) {
+        return false;
+    }
+    MsgPackStream s(peek());
+    s >> t;
+    skip();
+    return s.status() == MsgPackStream::Ok;
+}
+
+// the packed str of a field name, made once for every field by QTNG_MSGPACK_FIELDS().
+inline QByteArray msgPackKey(const char *name)
+{
+    QByteArray bs;
+    MsgPackStream s(&bs, QIODevice::WriteOnly);
+    s << QString::fromUtf8(name);
+    return bs;
+}
+
 QTNETWORKNG_NAMESPACE_END
 
+#define QTNG_MSGPACK_EXPAND(x) x
+#define QTNG_MSGPACK_CONCAT_(a, b) a##b
+#define QTNG_MSGPACK_CONCAT(a, b) QTNG_MSGPACK_CONCAT_(a, b)
+#define QTNG_MSGPACK_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ...) N
+#define QTNG_MSGPACK_NARGS(...) \
+    QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define QTNG_MSGPACK_EACH_1(m, x) m(x)
+#define QTNG_MSGPACK_EACH_2(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_1(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_3(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_2(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_4(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_3(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_5(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_4(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_6(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_5(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_7(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_6(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_8(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_7(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_9(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_8(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_10(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_9(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_11(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_10(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_12(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_11(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_13(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_12(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_14(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_13(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_15(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_14(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH_16(m, x, ...) m(x) QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_EACH_15(m, __VA_ARGS__))
+#define QTNG_MSGPACK_EACH(m, ...) \
+    QTNG_MSGPACK_EXPAND(QTNG_MSGPACK_CONCAT(QTNG_MSGPACK_EACH_, QTNG_MSGPACK_NARGS(__VA_ARGS__))(m, __VA_ARGS__))
+
+#define QTNG_MSGPACK_WRITE_FIELD(field)                                                             \
+    if (s.status() == QTNETWORKNG_NAMESPACE::MsgPackStream::Ok) {                                   \
+        static const QByteArray key = QTNETWORKNG_NAMESPACE::msgPackKey(#field);                    \
+        s.writeBytes(key.constData(), key.size());                                                  \
+        s << o.field;                                                                               \
+    }
+#define QTNG_MSGPACK_READ_FIELD(field) \
+    else if (key == #field) { s >> o.field; }
+
+// makes operator<<() and operator>>() of a struct with at most 16 fields, put it in the namespace of struct. the
+// struct is packed as a map of field names, the unknown keys are skipped and the missing fields are not changed.
+//
+//     struct Message { QString type; qint64 id; };
+//     QTNG_MSGPACK_FIELDS(Message, type, id)
+#define QTNG_MSGPACK_FIELDS(Type, ...)                                                                             \
+    inline QTNETWORKNG_NAMESPACE::MsgPackStream &operator<<(QTNETWORKNG_NAMESPACE::MsgPackStream &s, const Type &o) \
+    {                                                                                                              \
+        if (!s.writeMapHeader(QTNG_MSGPACK_NARGS(__VA_ARGS__))) {                                                  \
+            return s;                                                                                              \
+        }                                                                                                          \
+        QTNG_MSGPACK_EACH(QTNG_MSGPACK_WRITE_FIELD, __VA_ARGS__)                                                   \
+        return s;                                                                                                  \
+    }                                                                                                              \
+    inline QTNETWORKNG_NAMESPACE::MsgPackStream &operator>>(QTNETWORKNG_NAMESPACE::MsgPackStream &s, Type &o)      \
+    {                                                                                                              \
+        quint32 len = 0;                                                                                           \
+        if (!s.readMapHeader(len)) {                                                                               \
+            return s;                                                                                              \
+        }                                                                                                          \
+        QByteArray key;                                                                                            \
+        for (quint32 i = 0; i < len && s.status() == QTNETWORKNG_NAMESPACE::MsgPackStream::Ok; ++i) {              \
+            if (!s.readString(key)) {                                                                              \
+                break;                                                                                             \
+            }                                                                                                      \
+            if (false) { }                                                                                         \
+            QTNG_MSGPACK_EACH(QTNG_MSGPACK_READ_FIELD, __VA_ARGS__)                                                \
+            else {                                                                                                 \
+                QVariant skipped;                                                                                  \
+                s >> skipped;                                                                                      \
+            }                                                                                                      \
+        }                                                                                                          \
+        return s;                                                                                                  \
+    }
+
 Q_DECLARE_METATYPE(QTNETWORKNG_NAMESPACE::MsgPackExtData)
 
 #endif  // STREAM_H
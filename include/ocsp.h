@@ -0,0 +1,36 @@
+#ifndef QTNG_OCSP_H
+#define QTNG_OCSP_H
+
+#include <QtCore/qdatetime.h>
+#include <QtCore/qurl.h>
+#include "ssl.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+class HttpSession;
+class OcspStaplingPrivate;
+// keeps the ocsp response of a server certificate for SslConfiguration::setOcspStaplingCallback(). it is fetched from
+// the responder written in the certificate by a background coroutine, and refreshed halfway to its next update. only
+// the good responses are stapled, and nothing before the first one comes, so the handshakes never wait for responders.
+class OcspStapling : public OcspStaplingCallback
+{
+public:
+    OcspStapling(const Certificate &certificate, const Certificate &issuer,
+                 QSharedPointer<HttpSession> session = QSharedPointer<HttpSession>());
+    virtual ~OcspStapling() override;
+public:
+    virtual QByteArray response() override;  // thread safe, empty if there is none or it is expired.
+    QUrl responderUrl() const;
+    QDateTime nextUpdate() const;
+    bool start();  // spawn the refreshing coroutine in current thread, false if the certificate has no responder.
+    void stop();
+    bool refresh();  // fetch a response now, blocks current coroutine.
+private:
+    OcspStaplingPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(OcspStapling)
+    Q_DISABLE_COPY(OcspStapling)
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_OCSP_H
@@ -2,6 +2,8 @@
 #define QTNG_COROUTINE_P_H
 
 #include <QtCore/qthreadstorage.h>
+#include <QtCore/qatomic.h>
+#include <QtCore/qvector.h>
 #include "../coroutine.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
@@ -28,6 +30,20 @@ protected:
 
 BaseCoroutine *createMainCoroutine();
 
+// the memory of coroutine stacks is recycled instead of mapping again. the free stacks are kept in thread local
+// storage, grouped by the stack size. the pages of returned stacks are given back to system by madvise().
+// guarded stacks have an extra PROT_NONE page below the returned address, and are pooled separately.
+class CoroutineStackPool
+{
+public:
+    static void *allocate(size_t stackSize, bool guarded = false);
+    static void release(void *stack, size_t stackSize, bool guarded = false);
+    static size_t highWaterMark(void *stack, size_t stackSize);
+    // give back the pages below sp, which is in the stack of a coroutine switching away. trimmed is the boundary of
+    // the last call, the syscall is skipped if the word right below it is still zero.
+    static void trim(void *stack, size_t stackSize, const void *sp, char **trimmed);
+};
+
 class CurrentCoroutineStorage
 {
 public:
@@ -44,6 +60,71 @@ private:
 
 CurrentCoroutineStorage &currentCoroutine();
 
+// the run time of coroutines, see BaseCoroutine::setAccountingEnabled(). a slice is the time between switching to a
+// coroutine and switching away from it, the time eventloops block in poll is not counted.
+struct CoroutineSliceStats
+{
+    CoroutineSliceStats()
+        : runNsecs(0)
+        , switches(0)
+        , sliceNsecs(0)
+        , sliceStarted(-1)
+        , generation(0)
+    {
+    }
+    qint64 runNsecs;
+    quint64 switches;
+    qint64 sliceNsecs;  // the part of current slice before the last pause.
+    qint64 sliceStarted;  // -1 if the slice is paused or the coroutine is not running.
+    int generation;  // the slice is valid only if it is started by the current generation of accounting.
+};
+
+// implemented by the backends.
+CoroutineSliceStats *coroutineSliceStats(BaseCoroutine *coroutine);
+
+// zero if the accounting is disabled, otherwise it changes every time it is enabled.
+extern QBasicAtomicInt coroutineAccountingGeneration;
+
+void doAccountCoroutineSwitch(BaseCoroutine *old, BaseCoroutine *coroutine, int generation);
+void doPauseCoroutineSlice(bool pause, int generation);
+
+// the backends call it right before switching from the old coroutine to the new one.
+inline void accountCoroutineSwitch(BaseCoroutine *old, BaseCoroutine *coroutine)
+{
+    const int generation = coroutineAccountingGeneration.loadAcquire();
+    if (Q_UNLIKELY(generation)) {
+        doAccountCoroutineSwitch(old, coroutine, generation);
+    }
+}
+
+// the eventloops call them around their blocking poll.
+inline void pauseCoroutineSlice()
+{
+    const int generation = coroutineAccountingGeneration.loadAcquire();
+    if (Q_UNLIKELY(generation)) {
+        doPauseCoroutineSlice(true, generation);
+    }
+}
+
+inline void resumeCoroutineSlice()
+{
+    const int generation = coroutineAccountingGeneration.loadAcquire();
+    if (Q_UNLIKELY(generation)) {
+        doPauseCoroutineSlice(false, generation);
+    }
+}
+
+// the values of CoroutineLocal, indexed by the ids of CoroutineLocalData. they are deleted with the coroutine.
+struct CoroutineLocalValues
+{
+    ~CoroutineLocalValues() { clear(); }
+    void clear();
+    QVector<void *> values;
+};
+
+// implemented by the backends.
+CoroutineLocalValues *coroutineLocalValues(BaseCoroutine *coroutine);
+
 QTNETWORKNG_NAMESPACE_END
 
 #endif  // QTNG_COROUTINE_P_H
@@ -6,6 +6,7 @@ extern "C" {
 #include <openssl/x509.h>
 #include <openssl/err.h>
 }
+#include <QtCore/qdatetime.h>
 #include "../md.h"
 #include "../cipher.h"
 #include "../pkey.h"
@@ -18,6 +19,7 @@ const EVP_MD *getOpenSSL_MD(MessageDigest::Algorithm algo);
 const EVP_CIPHER *getOpenSSL_CIPHER(Cipher::Algorithm algo, Cipher::Mode mode);
 bool openssl_setPkey(PublicKey *key, EVP_PKEY *pkey, bool hasPrivate);
 bool openssl_setCertificate(Certificate *cert, X509 *x509);
+QDateTime getTimeFromASN1(const ASN1_TIME *aTime);
 
 QTNETWORKNG_NAMESPACE_END
 
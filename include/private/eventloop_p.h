@@ -1,27 +1,52 @@
 #ifndef QTNG_EVENTLOOP_P_H
 #define QTNG_EVENTLOOP_P_H
 
+#include <type_traits>
+#include <utility>
+#include <QtCore/qvector.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qvarlengtharray.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qpointer.h>
 #include "../eventloop.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
+// the eventloop takes the ownership of functors and deletes them, except the borrowed ones. a borrowed functor is
+// kept by its owner, such as a waiting coroutine on its stack, which must remove the watcher or cancel the call
+// before destroying it. so a blocking wait allocates nothing.
 class Functor
 {
 public:
+    explicit Functor(bool borrowed = false)
+        : borrowed(borrowed)
+    {
+    }
     virtual ~Functor();
     virtual void operator()() = 0;
+    bool isBorrowed() const { return borrowed; }
+private:
+    const bool borrowed;
 };
 
+inline void releaseFunctor(Functor *callback)
+{
+    if (callback && !callback->isBorrowed()) {
+        delete callback;
+    }
+}
+
 class DoNothingFunctor : public Functor
 {
 public:
     virtual void operator()();
 };
 
+// must not touch itself after yielding, the waiting coroutine may destroy a borrowed one before it returns.
 class YieldCurrentFunctor : public Functor
 {
 public:
-    explicit YieldCurrentFunctor();
+    explicit YieldCurrentFunctor(bool borrowed = false);
     virtual void operator()();
     QPointer<BaseCoroutine> coroutine;
 };
@@ -49,12 +74,310 @@ public:
     std::function<void()> callback;
 };
 
+// keeps the callable in itself, so there is one allocation instead of two of LambdaFunctor and std::function.
+template<typename F>
+class CallableFunctor : public Functor
+{
+public:
+    explicit CallableFunctor(F &&callable)
+        : callable(std::move(callable))
+    {
+    }
+    explicit CallableFunctor(const F &callable)
+        : callable(callable)
+    {
+    }
+    virtual void operator()() override { callable(); }
+private:
+    F callable;
+};
+
+template<typename F>
+Functor *makeFunctor(F &&callable)
+{
+    return new CallableFunctor<typename std::decay<F>::type>(std::forward<F>(callable));
+}
+
+// watcher ids encode the slot index (plus one, ids must not be zero) and a generation counter, so a stale id does
+// not reach a recycled slot until the generation wraps, see FreeSlotQueue.
+static const int WatcherIdIndexBits = 21;
+static const quint32 WatcherIdIndexMask = (1u << WatcherIdIndexBits) - 1;
+static const quint32 WatcherIdGenerationMask = (1u << (31 - WatcherIdIndexBits)) - 1;
+
+// the tables of watchers do not grow past the ids, they return 0 instead.
+inline bool hasFreeWatcherIndex(int size)
+{
+    return static_cast<quint32>(size) < WatcherIdIndexMask;
+}
+
+inline int makeWatcherId(int index, quint32 generation)
+{
+    Q_ASSERT(index >= 0 && static_cast<quint32>(index) + 1 <= WatcherIdIndexMask);
+    return static_cast<int>(((generation & WatcherIdGenerationMask) << WatcherIdIndexBits)
+                            | (static_cast<quint32>(index) + 1));
+}
+
+inline int indexOfWatcherId(int watcherId)
+{
+    return static_cast<int>(static_cast<quint32>(watcherId) & WatcherIdIndexMask) - 1;
+}
+
+inline quint32 generationOfWatcherId(int watcherId)
+{
+    return (static_cast<quint32>(watcherId) >> WatcherIdIndexBits) & WatcherIdGenerationMask;
+}
+
+// the freed slots of watchers and timers are reused in fifo order, and only while more than MinimumFree of them are
+// free. so a slot comes back after a thousand others at least, and the 10 bits generation of a stale id wraps after a
+// million insertions instead of 1024. the links are the members of slots, which are free otherwise.
+class FreeSlotQueue
+{
+public:
+    enum { MinimumFree = 1024 };
+    FreeSlotQueue()
+        : head(-1)
+        , tail(-1)
+        , count(0)
+    {
+    }
+    template<typename Slots, typename Link>
+    int take(Slots &slots, Link link);  // returns -1 if a new slot should be appended.
+    template<typename Slots, typename Link>
+    void put(Slots &slots, Link link, int index);
+private:
+    int head;
+    int tail;
+    int count;
+};
+
+template<typename Slots, typename Link>
+int FreeSlotQueue::take(Slots &slots, Link link)
+{
+    if (count <= MinimumFree) {
+        return -1;
+    }
+    const int index = head;
+    head = slots[index].*link;
+    if (head < 0) {
+        tail = -1;
+    }
+    --count;
+    return index;
+}
+
+template<typename Slots, typename Link>
+void FreeSlotQueue::put(Slots &slots, Link link, int index)
+{
+    slots[index].*link = -1;
+    if (tail >= 0) {
+        slots[tail].*link = index;
+    } else {
+        head = index;
+    }
+    tail = index;
+    ++count;
+}
+
+// the watcher registry of eventloop backends. lookup by id, insertion and removal are O(1), io watchers are also
+// chained per fd so triggerIoWatchers() only visits the watchers of that fd. the table does not own the watchers.
+template<typename T>
+class WatcherTable
+{
+public:
+    WatcherTable()
+        : count(0)
+    {
+    }
+    // watchers with fd < 0 are not indexed by fd. returns 0 if there are too many, the caller still owns the watcher.
+    int insert(T *watcher, qintptr fd = -1);
+    T *value(int watcherId) const;
+    T *take(int watcherId);
+    QVarLengthArray<int, 8> idsOfFd(qintptr fd) const;
+    QList<T *> values() const;
+    int size() const { return count; }
+    bool isEmpty() const { return count == 0; }
+private:
+    struct Slot
+    {
+        T *watcher;
+        qintptr fd;
+        int prev;
+        int next;  // the next slot of the same fd, or the next free slot.
+        quint32 generation;
+    };
+    QVector<Slot> entries;
+    QHash<qintptr, int> firstSlotOfFd;
+    FreeSlotQueue freeSlots;
+    int count;
+};
+
+template<typename T>
+int WatcherTable<T>::insert(T *watcher, qintptr fd)
+{
+    int index = freeSlots.take(entries, &Slot::next);
+    if (index < 0) {
+        if (!hasFreeWatcherIndex(entries.size())) {
+            return 0;
+        }
+        index = entries.size();
+        Slot empty;
+        empty.generation = 0;
+        entries.append(empty);
+    }
+    Slot &slot = entries[index];
+    slot.watcher = watcher;
+    slot.fd = fd;
+    slot.prev = -1;
+    slot.next = -1;
+    if (fd >= 0) {
+        typename QHash<qintptr, int>::iterator itor = firstSlotOfFd.find(fd);
+        if (itor != firstSlotOfFd.end()) {
+            slot.next = itor.value();
+            entries[slot.next].prev = index;
+            itor.value() = index;
+        } else {
+            firstSlotOfFd.insert(fd, index);
+        }
+    }
+    ++count;
+    return makeWatcherId(index, slot.generation);
+}
+
+template<typename T>
+T *WatcherTable<T>::value(int watcherId) const
+{
+    int index = indexOfWatcherId(watcherId);
+    if (index < 0 || index >= entries.size()) {
+        return nullptr;
+    }
+    const Slot &slot = entries.at(index);
+    if (!slot.watcher || (slot.generation & WatcherIdGenerationMask) != generationOfWatcherId(watcherId)) {
+        return nullptr;
+    }
+    return slot.watcher;
+}
+
+template<typename T>
+T *WatcherTable<T>::take(int watcherId)
+{
+    T *watcher = value(watcherId);
+    if (!watcher) {
+        return nullptr;
+    }
+    int index = indexOfWatcherId(watcherId);
+    Slot &slot = entries[index];
+    if (slot.fd >= 0) {
+        if (slot.prev >= 0) {
+            entries[slot.prev].next = slot.next;
+        } else if (slot.next >= 0) {
+            firstSlotOfFd[slot.fd] = slot.next;
+        } else {
+            firstSlotOfFd.remove(slot.fd);
+        }
+        if (slot.next >= 0) {
+            entries[slot.next].prev = slot.prev;
+        }
+    }
+    slot.watcher = nullptr;
+    slot.fd = -1;
+    slot.prev = -1;
+    ++slot.generation;
+    freeSlots.put(entries, &Slot::next, index);
+    --count;
+    return watcher;
+}
+
+template<typename T>
+QVarLengthArray<int, 8> WatcherTable<T>::idsOfFd(qintptr fd) const
+{
+    QVarLengthArray<int, 8> ids;
+    for (int index = firstSlotOfFd.value(fd, -1); index >= 0; index = entries.at(index).next) {
+        ids.append(makeWatcherId(index, entries.at(index).generation));
+    }
+    return ids;
+}
+
+template<typename T>
+QList<T *> WatcherTable<T>::values() const
+{
+    QList<T *> result;
+    for (const Slot &slot : entries) {
+        if (slot.watcher) {
+            result.append(slot.watcher);
+        }
+    }
+    return result;
+}
+
+// the queue of callLaterThreadSafe(). a lock free multi producer single consumer queue: producers only exchange the
+// head, and wakeups are coalesced, so only the first push after a drain needs to wake the eventloop up.
+class CallLaterQueue
+{
+public:
+    CallLaterQueue();
+    ~CallLaterQueue();  // deletes the callbacks not taken.
+public:
+    bool push(quint32 msecs, Functor *callback);  // thread safe, returns true if the eventloop should be woken up.
+    void clearWakeup();  // call before draining, so the next push wakes the eventloop again.
+    bool pop(quint32 *msecs, Functor **callback);  // the eventloop thread only.
+    int size() const { return count.loadAcquire(); }
+private:
+    struct Node
+    {
+        QAtomicPointer<Node> next;
+        Functor *callback;
+        quint32 msecs;
+    };
+    QAtomicPointer<Node> head;
+    Node *tail;
+    Node stub;
+    QAtomicInt wakeupPending;
+    QAtomicInt count;
+    Q_DISABLE_COPY(CallLaterQueue)
+};
+
 /*
 #if QT_VERSION < 0x050000
 typedef qptrdiff qintptr;
 #endif
 */
 
+// an io operation performed by the eventloop on behalf of the current coroutine.
+struct CompletionIo
+{
+    enum Operation {
+        Poll,
+        Recv,
+        Send,
+        Accept,
+        RecvMsg,
+        SendMsg,
+        Connect,
+        TransmitFile,  // data is the file HANDLE, address points to the qint64 offset. iocp only.
+    };
+    CompletionIo(Operation operation, qintptr fd)
+        : operation(operation)
+        , fd(fd)
+        , data(nullptr)
+        , size(0)
+        , flags(0)
+        , address(nullptr)
+        , addressSize(0)
+        , result(0)
+        , hasResult(false)
+    {
+    }
+    Operation operation;
+    qintptr fd;
+    void *data;  // the buffer, or the msghdr of RecvMsg and SendMsg.
+    size_t size;
+    int flags;  // msg flags, accept flags, or poll events.
+    void *address;  // the peer address of Connect, and of RecvMsg and SendMsg if there is no msghdr.
+    int addressSize;
+    qint64 result;  // the syscall result, or -errno.
+    bool hasResult;  // false if only readiness was waited, the caller should retry its syscall.
+};
+
 class EventLoopCoroutinePrivate;
 class EventLoopCoroutine : public BaseCoroutine
 {
@@ -78,9 +401,21 @@ public:
     void callLaterThreadSafe(quint32 msecs, Functor *callback);  // the ownership of callback is taken
     int callRepeat(quint32 msecs, Functor *callback);  // the ownership of callback is taken
     void cancelCall(int callbackId);
+    // coarse calls share a timer wheel with 1ms resolution, they are cheaper to create, cancel and restart.
+    int callLaterCoarse(quint32 msecs, Functor *callback);  // the ownership of callback is taken
+    bool restartCall(int callbackId, quint32 msecs);  // returns false if it is not a pending coarse call.
     int exitCode();
     bool runUntil(BaseCoroutine *coroutine);
     void yield();
+    bool completeIo(CompletionIo *io);  // returns false if the eventloop only supports readiness watchers.
+    EventLoopMetrics metrics();
+    void setBusyPolling(quint32 usecs);  // see setEventLoopBusyPolling().
+    quint32 busyPolling();
+    // the msecs of a monotonic clock, and since epoch. they are read once after every poll, so the timestamps of
+    // keepalives and caches cost no clock reading, but lag behind by the time of current iteration. the monotonic one
+    // is comparable between threads.
+    qint64 now();
+    qint64 wallNow();
 public:
     static EventLoopCoroutine *get();
 protected:
@@ -99,11 +434,46 @@ public:
     ~ScopedIoWatcher();
     void start();
 private:
+    YieldCurrentFunctor callback;  // borrowed by the eventloop, so waiting allocates nothing.
     EventLoopCoroutine::EventType event;
     qintptr fd;
     int watcherId;
 };
 
+// the first coroutine joining waits on the stack, and wakes by one functor. the others wait for a lazy event.
+struct CoroutineJoiner
+{
+    BaseCoroutine *coroutine;
+    bool woken;
+    bool deleted;
+};
+
+class Event;
+class CoroutineGroup;
+class CoroutinePrivate : public QObject
+{
+public:
+    CoroutinePrivate(Coroutine *q, QObject *obj, const char *slot);
+    virtual ~CoroutinePrivate();
+    void wakeJoiners(bool deleted);
+    static void onFinished(void *data, BaseCoroutine *const &);
+private:
+    Coroutine * const q_ptr;
+    CoroutineJoiner *joiner;
+    Event *finishedEvent;
+    QPointer<CoroutineGroup> group;  // instead of a callback of finished.
+    QObject * const obj;
+    const char * const slot;
+    const QSharedPointer<QAtomicInt> liveCounter;
+    int callbackId;
+
+    Q_DECLARE_PUBLIC(Coroutine)
+    friend struct StartCoroutineFunctor;
+    friend struct KillCoroutineFunctor;
+    friend class CoroutineGroup;
+};
+
+class TimerWheel;
 class EventLoopCoroutinePrivate
 {
 public:
@@ -123,8 +493,27 @@ public:
     virtual int exitCode() = 0;
     virtual bool runUntil(BaseCoroutine *coroutine) = 0;
     virtual void yield() = 0;
+    virtual bool completeIo(CompletionIo *io);
+    virtual void fillMetrics(EventLoopMetrics *metrics);  // backends add the gauges they track.
+public:
+    TimerWheel *timerWheel();
+    // backends call these around their blocking poll, and countCallback() before every callback.
+    void beforePoll();
+    void afterPoll();
+    void countCallback() { ++iterationCallbacks; }
+    bool shouldSpin();  // called after beforePoll(), true if the poll should not block.
 protected:
     EventLoopCoroutine * const q_ptr;
+    TimerWheel *wheel;
+    EventLoopMetrics counters;
+    QElapsedTimer metricsClock;
+    qint64 pollStarted;
+    qint64 iterationStarted;
+    quint32 iterationCallbacks;
+    qint64 spinNsecs;
+    qint64 lastActive;  // when the last poll following some callbacks started.
+    qint64 cachedNow;  // -1 if the backend does not call afterPoll().
+    qint64 cachedWallNow;  // -1 until it is read in current iteration.
     static EventLoopCoroutinePrivate *getPrivateHelper(EventLoopCoroutine *coroutine) { return coroutine->d_func(); }
     Q_DECLARE_PUBLIC(EventLoopCoroutine)
 };
@@ -142,6 +531,32 @@ private:
 
 CurrentLoopStorage *currentLoop();
 
+#ifdef QTNETWORKNG_USE_EPOLL
+class EpollEventLoopCoroutine : public EventLoopCoroutine
+{
+public:
+    explicit EpollEventLoopCoroutine(bool useIoUring = false);
+};
+
+// the qt eventloop with the sockets and timers handled by epoll, see Coroutine::preferQtWithEpoll().
+class QtEpollEventLoopCoroutine : public EventLoopCoroutine
+{
+public:
+    QtEpollEventLoopCoroutine();
+};
+
+int startQtEpollLoop(EventLoopCoroutine *eventLoop);
+bool isQtWithEpollPreferred();
+#endif
+
+#ifdef QTNETWORKNG_USE_KQUEUE
+class KqueueEventLoopCoroutine : public EventLoopCoroutine
+{
+public:
+    KqueueEventLoopCoroutine();
+};
+#endif
+
 #ifdef QTNETWOKRNG_USE_EV
 class EvEventLoopCoroutine : public EventLoopCoroutine
 {
@@ -154,6 +569,14 @@ class WinEventLoopCoroutine : public EventLoopCoroutine
 public:
     WinEventLoopCoroutine();
 };
+
+class IocpEventLoopCoroutine : public EventLoopCoroutine
+{
+public:
+    IocpEventLoopCoroutine();
+public:
+    static bool isAvailable();
+};
 #endif
 
 #ifdef QTNETWOKRNG_USE_WIN
@@ -60,6 +60,8 @@ public:
     void setAddress(const IPv4Address ipv4_ = 0);
     void setAddress(const IPv6Address ipv6);
     bool parse(const QString &ipString);
+    enum LiteralResult { LiteralParsed, NotLiteral, MaybeLiteral };
+    LiteralResult parseLiteral(const QChar *begin, const QChar *end, bool allowBrackets);
     void clear();
 
     QString scopeId;
@@ -0,0 +1,261 @@
+#ifndef QTNG_HTTP2_P_H
+#define QTNG_HTTP2_P_H
+
+#include <QtCore/qmap.h>
+#include "../locks.h"
+#include "../coroutine_utils.h"
+#include "../socket_utils.h"
+#include "../http_utils.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// rfc 7540, the names of headers are always lower case.
+struct HPackHeader
+{
+    HPackHeader() { }
+    HPackHeader(const QByteArray &name, const QByteArray &value)
+        : name(name)
+        , value(value)
+    {
+    }
+    quint32 size() const { return static_cast<quint32>(name.size() + value.size()) + 32; }
+    QByteArray name;
+    QByteArray value;
+};
+
+// the dynamic table of rfc 7541, the newest entry is at the front.
+class HPackTable
+{
+public:
+    HPackTable();
+public:
+    bool lookup(quint32 index, HPackHeader *header) const;  // index starts from 1, includes the static table.
+    int find(const HPackHeader &header, bool *valueMatched) const;  // returns 0 if not found.
+    void insert(const HPackHeader &header);
+    void setMaxSize(quint32 maxSize);
+    quint32 maxSize() const { return currentMaxSize; }
+private:
+    void evict(quint32 wanted);
+    QList<HPackHeader> entries;
+    quint32 currentSize;
+    quint32 currentMaxSize;
+};
+
+class HPackEncoder
+{
+public:
+    HPackEncoder();
+public:
+    QByteArray encode(const QList<HPackHeader> &headers);
+    void setMaxTableSize(quint32 maxSize);  // from SETTINGS_HEADER_TABLE_SIZE of peer.
+private:
+    HPackTable table;
+    quint32 pendingTableSize;
+    bool tableSizeChanged;
+};
+
+class HPackDecoder
+{
+public:
+    HPackDecoder();
+public:
+    bool decode(const QByteArray &block, QList<HPackHeader> *headers);  // false means COMPRESSION_ERROR.
+    void setMaxTableSize(quint32 maxSize);  // the SETTINGS_HEADER_TABLE_SIZE we sent.
+    void setMaxHeaderListSize(quint32 maxSize) { maxHeaderListSize = maxSize; }
+private:
+    HPackTable table;
+    quint32 allowedTableSize;
+    quint32 maxHeaderListSize;
+};
+
+namespace HPack {
+void encodeInteger(quint32 value, int prefixBits, quint8 firstByte, QByteArray *out);
+bool decodeInteger(const char *&p, const char *end, int prefixBits, quint32 *value);
+void encodeString(const QByteArray &s, QByteArray *out);  // use huffman code if it is shorter.
+bool decodeString(const char *&p, const char *end, QByteArray *out);
+}  // namespace HPack
+
+enum Http2FrameType {
+    Http2DataFrame = 0x0,
+    Http2HeadersFrame = 0x1,
+    Http2PriorityFrame = 0x2,
+    Http2RstStreamFrame = 0x3,
+    Http2SettingsFrame = 0x4,
+    Http2PushPromiseFrame = 0x5,
+    Http2PingFrame = 0x6,
+    Http2GoAwayFrame = 0x7,
+    Http2WindowUpdateFrame = 0x8,
+    Http2ContinuationFrame = 0x9,
+};
+
+enum Http2FrameFlag {
+    Http2EndStreamFlag = 0x1,
+    Http2AckFlag = 0x1,
+    Http2EndHeadersFlag = 0x4,
+    Http2PaddedFlag = 0x8,
+    Http2PriorityFlag = 0x20,
+};
+
+enum Http2ErrorCode {
+    Http2NoError = 0x0,
+    Http2ProtocolError = 0x1,
+    Http2InternalError = 0x2,
+    Http2FlowControlError = 0x3,
+    Http2SettingsTimeout = 0x4,
+    Http2StreamClosed = 0x5,
+    Http2FrameSizeError = 0x6,
+    Http2RefusedStream = 0x7,
+    Http2Cancel = 0x8,
+    Http2CompressionError = 0x9,
+    Http2ConnectError = 0xa,
+    Http2EnhanceYourCalm = 0xb,
+    Http2InadequateSecurity = 0xc,
+    Http2Http11Required = 0xd,
+};
+
+enum Http2Setting {
+    Http2HeaderTableSize = 0x1,
+    Http2EnablePush = 0x2,
+    Http2MaxConcurrentStreams = 0x3,
+    Http2InitialWindowSize = 0x4,
+    Http2MaxFrameSize = 0x5,
+    Http2MaxHeaderListSize = 0x6,
+};
+
+class Http2Stream
+{
+public:
+    explicit Http2Stream(quint32 id);
+public:
+    quint32 id;
+    QList<QList<HPackHeader>> headerBlocks;  // received but not taken, the informational ones, final and trailers.
+    QByteArray data;  // received but not read.
+    Condition changed;
+    qint64 sendWindow;
+    qint64 recvWindow;
+    qint32 consumed;  // read since the last WINDOW_UPDATE.
+    quint32 errorCode;
+    bool headersSent;
+    bool localClosed;
+    bool remoteClosed;
+    bool reset;
+};
+
+// one connection shared by many coroutines, each of them works on its own stream. a coroutine reads frames and
+// dispatches them to streams, the writers take turns by a lock.
+class Http2Connection
+{
+public:
+    Http2Connection(QSharedPointer<SocketLike> connection, bool asServer);
+    virtual ~Http2Connection();
+public:
+    // the client sends preface, the server reads it after the bytes buffered by caller. both send SETTINGS and
+    // start reading frames.
+    bool handshake(const QByteArray &buffered = QByteArray());
+    // client only, waits for a free stream if MAX_CONCURRENT_STREAMS is reached.
+    QSharedPointer<Http2Stream> openStream(const QList<HPackHeader> &headers, bool endStream);
+    bool sendHeaders(QSharedPointer<Http2Stream> stream, const QList<HPackHeader> &headers, bool endStream);
+    bool sendData(QSharedPointer<Http2Stream> stream, const char *data, qint32 size, bool endStream);
+    bool recvHeaders(QSharedPointer<Http2Stream> stream, QList<HPackHeader> *headers);  // false at end or error.
+    qint32 recvData(QSharedPointer<Http2Stream> stream, char *data, qint32 size);  // returns 0 at end of stream.
+    void closeStream(QSharedPointer<Http2Stream> stream);  // reset it if not finished, must be called by users.
+    void goAway(Http2ErrorCode errorCode);
+    bool join();  // wait for the connection closed.
+    bool isValid() const;
+    bool canOpenStream() const { return isValid() && !goingAway; }
+    int activeStreams() const { return streams.size(); }
+protected:
+    virtual void handleNewStream(QSharedPointer<Http2Stream> stream);  // server only, refused by default.
+private:
+    void readFrames();
+    bool handleFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload);
+    bool handleHeaderBlock(quint32 streamId, const QByteArray &block, bool endStream);
+    bool handleData(quint8 flags, quint32 streamId, const QByteArray &payload);
+    bool handleSettings(quint8 flags, const QByteArray &payload);
+    bool handleWindowUpdate(quint32 streamId, const QByteArray &payload);
+    void handleGoAway(const QByteArray &payload);
+    void resetStream(QSharedPointer<Http2Stream> stream, Http2ErrorCode errorCode, bool sendFrame);
+    void removeStream(QSharedPointer<Http2Stream> stream);
+    bool sendFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload);
+    bool sendFrames(const QByteArray &frames);
+    void appendHeaderFrames(QByteArray *frames, quint32 streamId, const QByteArray &block, bool endStream);
+    void setBroken();
+public:
+    QSharedPointer<SocketLike> connection;
+    int debugLevel;
+private:
+    HPackEncoder encoder;
+    HPackDecoder decoder;
+    QByteArray pending;  // received by handshake() but not read as frames.
+    QMap<quint32, QSharedPointer<Http2Stream>> streams;
+    Lock writeLock;
+    Condition windowChanged;  // the flow control windows or the available streams are changed.
+    Event closed;
+    CoroutineGroup *operations;
+    qint64 sendWindow;
+    qint64 recvWindow;
+    qint32 consumed;
+    quint32 nextStreamId;
+    quint32 lastPeerStreamId;
+    quint32 remoteMaxConcurrentStreams;
+    quint32 remoteInitialWindowSize;
+    quint32 remoteMaxFrameSize;
+    bool asServer;
+    bool goingAway;
+    bool broken;
+};
+
+// the body of one stream as a socket, so the http/1 body readers and writers can work on it.
+class Http2StreamSocket : public SocketLike
+{
+public:
+    Http2StreamSocket(QSharedPointer<Http2Connection> http2, QSharedPointer<Http2Stream> stream);
+    virtual ~Http2StreamSocket() override;
+public:
+    virtual Socket::SocketError error() const override;
+    virtual QString errorString() const override;
+    virtual bool isValid() const override;
+    virtual HostAddress localAddress() const override;
+    virtual quint16 localPort() const override;
+    virtual HostAddress peerAddress() const override;
+    virtual QString peerName() const override;
+    virtual quint16 peerPort() const override;
+    virtual qintptr fileno() const override;
+    virtual Socket::SocketType type() const override;
+    virtual Socket::SocketState state() const override;
+    virtual HostAddress::NetworkLayerProtocol protocol() const override;
+    virtual QString localAddressURI() const override;
+    virtual QString peerAddressURI() const override;
+
+    virtual QSharedPointer<SocketLike> accept() override;
+    virtual Socket *acceptRaw() override;
+    virtual bool bind(const HostAddress &address, quint16 port = 0,
+                      Socket::BindMode mode = Socket::DefaultForPlatform) override;
+    virtual bool bind(quint16 port = 0, Socket::BindMode mode = Socket::DefaultForPlatform) override;
+    virtual bool connect(const HostAddress &addr, quint16 port) override;
+    virtual bool connect(const QString &hostName, quint16 port,
+                         QSharedPointer<SocketDnsCache> dnsCache = QSharedPointer<SocketDnsCache>()) override;
+    virtual void close() override;
+    virtual void abort() override;
+    virtual bool listen(int backlog) override;
+    virtual bool setOption(Socket::SocketOption option, const QVariant &value) override;
+    virtual QVariant option(Socket::SocketOption option) const override;
+
+    virtual qint32 recv(char *data, qint32 size) override;
+    virtual qint32 recvall(char *data, qint32 size) override;
+    virtual qint32 send(const char *data, qint32 size) override;
+    virtual qint32 sendall(const char *data, qint32 size) override;
+    virtual QByteArray recv(qint32 size) override;
+    virtual QByteArray recvall(qint32 size) override;
+    virtual qint32 send(const QByteArray &data) override;
+    virtual qint32 sendall(const QByteArray &data) override;
+public:
+    bool finish();  // send END_STREAM.
+public:
+    QSharedPointer<Http2Connection> http2;
+    QSharedPointer<Http2Stream> stream;
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_HTTP2_P_H
@@ -1,6 +1,7 @@
 #ifndef QTNG_HTTP_P_H
 #define QTNG_HTTP_P_H
 
+#include <QtCore/qhash.h>
 #include "../http.h"
 #include "../locks.h"
 #include "../socket.h"
@@ -8,19 +9,106 @@
 #include "../coroutine_utils.h"
 #include "../http_proxy.h"
 #include "../ssl.h"
+#include "http2_p.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
 class HttpProxy;
 class Socks5Proxy;
+// connections are shared by requests to the same server through the same socket proxy.
+struct ConnectionPoolKey
+{
+    QString scheme;
+    QString host;
+    quint16 port;
+    QString proxy;  // the type, user, host and port of selected socket proxy, or empty for direct connections.
+};
+
+inline bool operator==(const ConnectionPoolKey &a, const ConnectionPoolKey &b)
+{
+    return a.port == b.port && a.proxy == b.proxy && a.host == b.host && a.scheme == b.scheme;
+}
+
+inline uint qHash(const ConnectionPoolKey &key, uint seed = 0)
+{
+    return qHash(key.host, seed) ^ qHash(key.scheme, seed) ^ qHash(key.proxy, seed)
+            ^ (static_cast<uint>(key.port) << 16);
+}
+
+class PooledAddress
+{
+public:
+    enum { EvictionMsecs = 10 * 1000 };
+    explicit PooledAddress(const HostAddress &address)
+        : address(address)
+        , connections(0)
+        , createdConnections(0)
+        , failedConnections(0)
+        , evictedUntil(0)
+        , rtt(0)
+    {
+    }
+public:
+    HostAddress address;
+    int connections;
+    quint64 createdConnections;
+    quint64 failedConnections;
+    qint64 evictedUntil;  // msecs of EventLoopCoroutine::now()
+    quint32 rtt;  // the smoothed TcpInfo::rtt of new connections, 0 if unknown.
+};
+
+class PooledConnection
+{
+public:
+    explicit PooledConnection(QSharedPointer<SocketLike> connection,
+                              QSharedPointer<PooledAddress> address = QSharedPointer<PooledAddress>())
+        : connection(connection)
+        , address(address)
+        , sentRequests(0)
+        , readResponses(0)
+        , lastUsed(0)
+        , broken(false)
+    {
+        if (!address.isNull()) {
+            ++address->connections;
+        }
+    }
+    ~PooledConnection()
+    {
+        if (!address.isNull()) {
+            --address->connections;
+        }
+    }
+public:
+    QSharedPointer<SocketLike> connection;
+    QSharedPointer<PooledAddress> address;  // counts this connection while it lives, if made with balancing.
+    QByteArray unread;  // the beginning of the next pipelined response, received with the previous one.
+    Lock writing;
+    Condition turn;  // notified after every response is read, the pipelined responses are read in order.
+    quint64 sentRequests;
+    quint64 readResponses;
+    qint64 lastUsed;  // msecs of EventLoopCoroutine::now()
+    bool broken;  // a response is not read completely, nothing can be read from this connection.
+};
+
 class ConnectionPoolItem
 {
 public:
-    ConnectionPoolItem() { }
+    ConnectionPoolItem()
+        : lastUsed(0)
+        , connecting(0)
+        , minIdle(0)
+    {
+    }
 public:
-    QDateTime lastUsed;
     QSharedPointer<Semaphore> semaphore;
-    QList<QSharedPointer<SocketLike>> connections;
+    QList<QSharedPointer<PooledConnection>> idle;  // the least recently used one is at the front.
+    QList<QSharedPointer<PooledConnection>> pipelining;  // busy connections accepting more requests.
+    QSharedPointer<Http2Connection> http2;  // shared by all requests if the server speaks h2.
+    QUrl warmUrl;  // preconnected to keep minIdle idle connections.
+    qint64 lastUsed;
+    int connecting;  // by preconnect().
+    int minIdle;
 };
 
 class ConnectionPool
@@ -28,29 +116,88 @@ class ConnectionPool
 public:
     ConnectionPool();
     virtual ~ConnectionPool();
-    QSharedPointer<Semaphore> getSemaphore(const QUrl &url);
-    void recycle(const QUrl &url, QSharedPointer<SocketLike> connection);
-    QSharedPointer<SocketLike> oldConnectionForUrl(const QUrl &url);
-    QSharedPointer<SocketLike> newConnectionForUrl(const QUrl &url, RequestError **error);
+    ConnectionPoolKey keyForUrl(const QUrl &url) const;
+    QSharedPointer<Semaphore> getSemaphore(const ConnectionPoolKey &key);
+    QSharedPointer<PooledConnection> idleConnection(const ConnectionPoolKey &key);
+    QSharedPointer<PooledConnection> pipelinedConnection(const ConnectionPoolKey &key);
+    void startPipelining(const ConnectionPoolKey &key, QSharedPointer<PooledConnection> pooled);
+    // must be called once for every pooled request, reusable means its response was read completely.
+    void release(const ConnectionPoolKey &key, QSharedPointer<PooledConnection> pooled, bool reusable);
+    QSharedPointer<Http2Connection> http2Connection(const ConnectionPoolKey &key);
+    QSharedPointer<Http2Connection> startHttp2(const ConnectionPoolKey &key, QSharedPointer<SocketLike> connection,
+                                               bool shared);
+    QSharedPointer<SocketLike> newConnectionForUrl(const QUrl &url, RequestError **error,
+                                                   HttpTimings *timings = nullptr,
+                                                   QSharedPointer<PooledAddress> *address = nullptr,
+                                                   const QByteArray &earlyData = QByteArray());
+    Socket *connectBalanced(const QString &host, quint16 port, QSharedPointer<PooledAddress> *address);
     void removeUnusedConnections();
+    void preconnect(const QUrl &url, int count);
+    void setMinIdleConnections(const QUrl &url, int count);
+    void makeIdleConnection(const QUrl &url, const ConnectionPoolKey &key);
+    HttpConnectionPoolStats poolStats() const;
     QSharedPointer<SocketProxy> socketProxy() const;
     QSharedPointer<HttpProxy> httpProxy() const;
     void setSocketProxy(QSharedPointer<SocketProxy> proxy);
     void setHttpProxy(QSharedPointer<HttpProxy> proxy);
 private:
-    ConnectionPoolItem &getItem(const QUrl &url);
+    ConnectionPoolItem &getItem(const ConnectionPoolKey &key);
 public:
-    QMap<QUrl, ConnectionPoolItem> items;
+    QHash<ConnectionPoolKey, ConnectionPoolItem> items;
+    QHash<HostAddress, QSharedPointer<PooledAddress>> addresses;
     QSharedPointer<SocketDnsCache> dnsCache;
     QSharedPointer<BaseProxySwitcher> proxySwitcher;
 #ifndef QTNG_NO_CRYPTO
     SslConfiguration sslConfig;
 #endif
+    HttpConnectionPoolStats stats;
     int maxConnectionsPerServer;
+    int maxPipelinedRequests;
     int timeToLive;
     float defaultConnectionTimeout;
     float defaultTimeout;
     CoroutineGroup *operations;
+    bool pipelining;
+    bool tcpFastOpen;
+    bool balancingAddresses;
+};
+
+// the latencies of the last requests to a server, which decide the delays of hedged requests.
+struct HttpLatencyWindow
+{
+    enum { Size = 64, MinSamples = 16 };
+    HttpLatencyWindow()
+        : next(0)
+    {
+    }
+    void add(qint64 msecs);
+    qint64 percentile(int p) const;  // -1 if there are too few samples.
+    QVector<qint64> samples;
+    int next;
+};
+
+// the response of a request in flight, shared with the identical requests arriving meanwhile.
+struct HttpInflightRequest
+{
+    HttpInflightRequest()
+        : completed(false)
+    {
+    }
+    Event done;
+    HttpResponse response;
+    bool completed;  // false if the first request is killed, the waiters send their own.
+};
+
+// the request line is split into the parts before and after the path.
+class PreparedHttpRequestPrivate
+{
+public:
+    HttpRequest request;  // without body.
+    QUrl url;
+    QByteArray method;  // such as `GET `.
+    QByteArray path;
+    QByteArray version;  // such as ` HTTP/1.1\r\n`.
+    QByteArray headers;  // without Content-Length and the empty line.
 };
 
 class HttpSessionPrivate : public ConnectionPool
@@ -58,18 +205,48 @@ class HttpSessionPrivate : public ConnectionPool
 public:
     HttpSessionPrivate(HttpSession *q_ptr);
     virtual ~HttpSessionPrivate();
-    QList<HttpHeader> makeHeaders(HttpRequest &request, const QUrl &url);
-    void mergeCookies(HttpRequest &request, const QUrl &url);
+    QList<HttpHeader> makeHeaders(HttpRequest &request, const QUrl &url, const QByteArray &cookieHeader);
+    // write the request line and the headers of makeHeaders() into one buffer sized in advance.
+    QByteArray serializeRequest(HttpRequest &request, const QUrl &url, const QByteArray &cookieHeader,
+                                const QList<HttpHeader> &validators, const char *version);
+    const QByteArray &hostBlock(const QUrl &url);
+    static bool isChunkedBody(HttpRequest &request);
+    QByteArray mergeCookies(HttpRequest &request, const QUrl &url);  // returns the Cookie header if it is cached.
     HttpResponse send(HttpRequest &req);
+    HttpResponse sendHedged(HttpRequest &request);
+    static QByteArray coalescingKey(HttpRequest &request, const QUrl &url);
+    // send the serialized head and the body of request through a pooled connection, and read the response.
+    HttpResponse transfer(HttpRequest &request, HttpResponse &response, const QByteArray &headerBytes, bool chunkedBody,
+                          const std::function<QList<HttpHeader>()> &http2Headers);
+    HttpResponse sendHttp2(HttpRequest &request, HttpResponse &response, QSharedPointer<Http2Connection> http2,
+                           const QList<HttpHeader> &headers);
+    bool prepare(const HttpRequest &request, PreparedHttpRequestPrivate *prepared);
+    HttpResponse sendPrepared(const PreparedHttpRequestPrivate &prepared, const QByteArray &pathAndQuery,
+                              const QByteArray &body, const QList<HttpHeader> &extraHeaders);
+    void mergeResponseCookies(HttpResponse &response);
+    void finishResponse(HttpRequest &request, HttpResponse &response);
+    void recordAltSvc(const QUrl &url, const QByteArray &value);
 public:
+    QHash<QString, QList<HttpAlternativeService>> alternativeServices;  // keyed by origin.
+    QHash<ConnectionPoolKey, HttpLatencyWindow> latencies;  // of the requests enabling hedging.
+    QHash<QByteArray, QSharedPointer<HttpInflightRequest>> inflights;  // keyed by coalescingKey().
     HttpCookieJar cookieJar;
     QSharedPointer<HttpCacheManager> cacheManager;
     QString defaultUserAgent;
+    // the preformatted header lines, which are cleared if the values are changed.
+    QByteArray userAgentBlock;
+    QByteArray acceptBlock;
+    QByteArray cachedHostBlock;  // of the last host.
+    QString cachedHost;
+    int cachedPort;
+    float hedgingBudget;
+    float hedgingTokens;  // every request enabling hedging earns hedgingBudget, and every duplicate costs 1.
     HttpVersion defaultVersion;
     HttpSession *q_ptr;
     int debugLevel;
     bool managingCookies;
     bool keepAlive;
+    bool coalescingRequests;
     friend void setProxySwitcher(HttpSession *session, QSharedPointer<BaseProxySwitcher> switcher);
     static inline HttpSessionPrivate *getPrivateHelper(HttpSession *session) { return session->d_ptr; }
     Q_DECLARE_PUBLIC(HttpSession)
@@ -0,0 +1,45 @@
+#ifndef QTNG_HTTP_PARSER_P_H
+#define QTNG_HTTP_PARSER_P_H
+
+#include "../http_utils.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// a view into the receiving buffer.
+struct HttpSlice
+{
+    qint32 offset;
+    qint32 length;
+};
+
+struct HttpHeaderSlice
+{
+    HttpSlice name;
+    HttpSlice value;
+    int knownHeader;  // KnownHeader, or -1
+};
+
+enum HttpParseResult {
+    HttpParseError = -1,
+    HttpParseIncomplete = -2,
+    HttpParseTooManyHeaders = -3,
+};
+
+// parse the request line and headers without copying. *numHeaders is the capacity of headers on entry.
+// returns the size of the head including the empty line, or a HttpParseResult. minorVersion is -1 for HTTP/0.9.
+int parseHttpRequestHead(const char *buf, int len, HttpSlice *method, HttpSlice *path, int *minorVersion,
+                         HttpHeaderSlice *headers, int *numHeaders);
+int parseHttpResponseHead(const char *buf, int len, int *minorVersion, int *statusCode, HttpSlice *message,
+                          HttpHeaderSlice *headers, int *numHeaders);
+
+// the tests compare the sse4.2 path with the scalar one. returns false if the build has no sse4.2 path.
+bool setHttpParserSimdEnabled(bool enabled);
+
+int findKnownHeader(const char *name, int len);  // case insensitive, returns -1 if it is not a KnownHeader.
+int findKnownHeader(const QString &name);
+const QString &internedHeaderName(int knownHeader);
+QList<HttpHeader> toHttpHeaders(const char *buf, const HttpHeaderSlice *headers, int numHeaders);
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_HTTP_PARSER_P_H
@@ -0,0 +1,79 @@
+#ifndef QTNG_KCP_FEC_P_H
+#define QTNG_KCP_FEC_P_H
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qlist.h>
+#include <QtCore/qmap.h>
+#include <QtCore/qscopedpointer.h>
+#include <QtCore/qvector.h>
+#include "../config.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// the reed-solomon erasure code over GF(256) with a systematic cauchy matrix. any dataShards of all shards recover
+// the data shards. all shards of one encode() or reconstruct() have the same size.
+class ReedSolomon
+{
+public:
+    ReedSolomon(int dataShards, int parityShards);
+public:
+    int dataShards() const { return k; }
+    int parityShards() const { return m; }
+    void encode(const QVector<QByteArray> &data, QVector<QByteArray> *parity) const;
+    // the missing shards are null, and the missing data shards are filled if at least dataShards are present.
+    bool reconstruct(QVector<QByteArray> *shards) const;
+    static bool isValid(int dataShards, int parityShards);
+private:
+    int k;
+    int m;
+    QVector<quint8> matrix;  // the m * k parity rows.
+};
+
+// groups the kcp output into dataShards, and makes parityShards for every group. the shard sequences are
+// increased one by one, so the group and the index of shard are known from its sequence.
+class KcpFecEncoder
+{
+public:
+    KcpFecEncoder(int dataShards, int parityShards);
+public:
+    // returns the sequence of data shard. the parity shards are returned if the group is full, and the sequence of
+    // the first one is the next to the data shard.
+    quint32 addData(const char *data, int size, QVector<QByteArray> *parity);
+    int dataShards() const { return rs.dataShards(); }
+    int parityShards() const { return rs.parityShards(); }
+private:
+    ReedSolomon rs;
+    QVector<QByteArray> pending;  // the data shards of current group, with two bytes length prefixed.
+    int maxSize;
+    quint32 nextSeq;
+};
+
+class KcpFecDecoder
+{
+public:
+    KcpFecDecoder();
+public:
+    // the data shards are delivered to kcp by caller. the missing data shards recovered by this one are returned.
+    void addShard(quint32 seq, int dataShards, int parityShards, const char *shard, int size, bool isParity,
+                  QList<QByteArray> *recovered);
+private:
+    struct Group
+    {
+        Group()
+            : received(0)
+            , receivedData(0)
+            , done(false)
+        {
+        }
+        QVector<QByteArray> shards;
+        int received;
+        int receivedData;
+        bool done;
+    };
+    QMap<quint32, Group> groups;
+    QScopedPointer<ReedSolomon> rs;
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_KCP_FEC_P_H
@@ -1,6 +1,8 @@
 #ifndef QTNG_NETWORK_INTERFACE_P_H
 #define QTNG_NETWORK_INTERFACE_P_H
 
+#include <QtCore/qatomic.h>
+#include <QtCore/qmutex.h>
 #include "../network_interface.h"
 #include "hostaddress_p.h"
 
@@ -74,8 +76,20 @@ public:
 
     // convenience:
     QSharedDataPointer<NetworkInterfacePrivate> empty;
+    // set by the platform watcher if the interfaces are changed.
+    QAtomicInt changed;
 private:
     QList<NetworkInterfacePrivate *> scan();
+    // the platform code watches the changes of interfaces by netlink or NotifyIpInterfaceChange(). returns true if the
+    // cached interfaces are stale, always true if the changes can not be watched.
+    bool checkChanges();
+    void stopWatching();
+private:
+    QMutex cacheLock;
+    QList<QSharedDataPointer<NetworkInterfacePrivate>> cache;
+    qintptr watchers[2];  // the netlink socket, or the notification handles of windows.
+    bool watching;
+    bool cacheValid;
 };
 
 QTNETWORKNG_NAMESPACE_END
@@ -10,6 +10,9 @@
 QTNETWORKNG_NAMESPACE_BEGIN
 
 union qt_sockaddr;
+#ifdef Q_OS_WIN
+struct RegisteredIoQueue;
+#endif
 
 class EventLoopCoroutine;
 class HostAddress;
@@ -60,15 +63,22 @@ public:
     void setError(Socket::SocketError error, ErrorString errorString);
     bool checkState() const
     {
-        return fd > 0 && (error == Socket::NoError || type != Socket::TcpSocket);
+        return fd > 0 && (error == Socket::NoError || !isStream());
     }  // not very accurate
+    bool isStream() const { return type == Socket::TcpSocket || type == Socket::LocalSocket; }
+    bool isLocal() const { return type == Socket::LocalSocket || type == Socket::LocalDatagramSocket; }
     bool isValid() const;
+    bool isIdleConnected() const;
+    TcpInfo tcpInfo() const;
 
     Socket *accept();
+    QList<Socket *> acceptMany(int maxCount);
     bool bind(const HostAddress &address, quint16 port = 0, Socket::BindMode mode = Socket::DefaultForPlatform);
     bool bind(quint16 port = 0, Socket::BindMode mode = Socket::DefaultForPlatform);
     bool connect(const HostAddress &host, quint16 port);
     bool connect(const QString &hostName, quint16 port, QSharedPointer<SocketDnsCache> dnsCache);
+    bool bind(const QString &path);
+    bool connect(const QString &path);
     void close();
     void abort();
     bool listen(int backlog);
@@ -83,9 +93,29 @@ public:
 
     qint32 recv(char *data, qint32 size, bool all);
     qint32 send(const char *data, qint32 size, bool all);
+    qint32 sendv(const QList<QByteArray> &buffers);
+    qint64 sendfile(QFile *file, qint64 offset, qint64 count);
+    qint32 sendfds(const char *data, qint32 size, const QList<qintptr> &fds);
+    qint32 recvfds(char *data, qint32 size, QList<qintptr> *fds);
     qint32 recvfrom(char *data, qint32 size, HostAddress *addr, quint16 *port);
     qint32 sendto(const char *data, qint32 size, const HostAddress &addr, quint16 port);
+    qint32 recvfromMany(char *buffer, qint32 datagramSize, qint32 count, qint32 *sizes, HostAddress *addrs,
+                        quint16 *ports);
+    qint32 sendtoMany(const QList<QByteArray> &datagrams, const HostAddress &addr, quint16 port);
+    qint32 sendtoMany(const QList<QByteArray> &datagrams, const HostAddress *addrs, const quint16 *ports);
     bool fetchConnectionParameters();
+#ifdef Q_OS_LINUX
+    qint32 sendZeroCopy(const QByteArray &data);
+    void reapZeroCopy();  // drop the buffers which the kernel has sent.
+#endif
+#ifdef Q_OS_WIN
+    bool enableRegisteredIo();
+    void closeRegisteredIo();
+    qint32 recvfromRegistered(char *buffer, qint32 datagramSize, qint32 count, qint32 *sizes, HostAddress *addrs,
+                              quint16 *ports);
+    qint32 sendtoRegistered(const QList<QByteArray> &datagrams, const HostAddress *addrs, const quint16 *ports,
+                            bool sameAddress);
+#endif
 public:
     bool setPortAndAddress(quint16 port, const HostAddress &address, qt_sockaddr *aa, int *sockAddrSize);
     bool createSocket();
@@ -101,6 +131,8 @@ public:
     quint16 localPort;
     HostAddress peerAddress;
     quint16 peerPort;
+    QString localPath;  // of unix domain sockets.
+    QString peerPath;
 #ifdef Q_OS_WIN
     qintptr fd;
 #else
@@ -108,10 +140,42 @@ public:
 #endif
     Lock readLock;
     Lock writeLock;
+    bool udpSegmentUnsupported;
+#ifdef Q_OS_LINUX
+    struct ZeroCopyBuffer
+    {
+        quint32 sequence;  // of the last MSG_ZEROCOPY send() referring it.
+        QByteArray data;
+    };
+    QList<ZeroCopyBuffer> zeroCopyBuffers;  // in the order of sending.
+    quint32 zeroCopySequence;
+    bool zeroCopy;
+#endif
+#ifdef Q_OS_WIN
+    RegisteredIoQueue *registeredIo;  // of RegisteredIoSocketOption.
+#endif
 
     Q_DECLARE_PUBLIC(Socket)
 };
 
+// recv(size) receives into a buffer of this thread and copies out the short results, so recv(65536) of a small message
+// does not keep 64KB. every waiting coroutine takes its own buffer, which is given back after receiving.
+QByteArray takeRecvBuffer(qint32 size);
+QByteArray finishRecvBuffer(QByteArray &buf, qint32 bytes);  // returns the received bytes.
+
+// resizes buf to the received bytes, and keeps its capacity for the next call.
+template<typename SocketType>
+qint32 recvIntoBuffer(SocketType *socket, QByteArray &buf, qint32 maxSize)
+{
+    if (buf.capacity() < maxSize) {
+        buf.reserve(maxSize);
+    }
+    buf.resize(maxSize);
+    qint32 bytes = socket->recv(buf.data(), maxSize);
+    buf.resize(qMax(bytes, 0));
+    return bytes;
+}
+
 QTNETWORKNG_NAMESPACE_END
 
 #endif  // QTNG_SOCKET_P_H
@@ -0,0 +1,17 @@
+#ifndef QTNG_SOCKS5_P_H
+#define QTNG_SOCKS5_P_H
+
+#include "../hostaddress.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// the datagrams relayed by UDP ASSOCIATE start with RSV, FRAG, ATYP, DST.ADDR and DST.PORT, see RFC 1928 section 7.
+// the hostName is used if it is not empty.
+bool packSocks5UdpHeader(const QString &hostName, const HostAddress &address, quint16 port, QByteArray *buf);
+
+// returns the size of header, or -1 if it is invalid or fragmented. fragments are not supported.
+int unpackSocks5UdpHeader(const char *data, int size, QString *hostName, HostAddress *address, quint16 *port);
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_SOCKS5_P_H
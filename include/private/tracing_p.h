@@ -0,0 +1,69 @@
+#ifndef QTNG_TRACING_P_H
+#define QTNG_TRACING_P_H
+
+#include <QtCore/qatomic.h>
+#include "../tracing.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+#ifdef QTNG_HAVE_TRACING
+
+// the names, categories and argument names must be string literals, events keep the pointers only.
+extern QBasicAtomicInt tracingEnabled;
+qint64 traceNow();  // microseconds.
+void traceComplete(const char *category, const char *name, qint64 started, const char *argName, qint64 arg);
+void traceInstant(const char *category, const char *name, const char *argName, qint64 arg);
+
+class TraceScope
+{
+public:
+    TraceScope(const char *category, const char *name, const char *argName = nullptr, qint64 arg = 0)
+        : category(category)
+        , name(name)
+        , argName(argName)
+        , arg(arg)
+        , started(tracingEnabled.loadAcquire() ? traceNow() : -1)
+    {
+    }
+    ~TraceScope()
+    {
+        if (started >= 0) {
+            traceComplete(category, name, started, argName, arg);
+        }
+    }
+private:
+    const char * const category;
+    const char * const name;
+    const char * const argName;
+    const qint64 arg;
+    const qint64 started;
+};
+
+#  define QTNG_TRACE_CONCAT2(a, b) a##b
+#  define QTNG_TRACE_CONCAT(a, b) QTNG_TRACE_CONCAT2(a, b)
+#  define QTNG_TRACE_SCOPE(category, name) \
+      QTNETWORKNG_NAMESPACE::TraceScope QTNG_TRACE_CONCAT(qtngTraceScope, __LINE__)(category, name)
+#  define QTNG_TRACE_SCOPE_ARG(category, name, argName, arg)                                         \
+      QTNETWORKNG_NAMESPACE::TraceScope QTNG_TRACE_CONCAT(qtngTraceScope, __LINE__)(category, name, \
+                                                                                    argName, arg)
+#  define QTNG_TRACE_INSTANT(category, name, argName, arg)                              \
+      do {                                                                              \
+          if (QTNETWORKNG_NAMESPACE::tracingEnabled.loadAcquire()) {                    \
+              QTNETWORKNG_NAMESPACE::traceInstant(category, name, argName, arg);       \
+          }                                                                             \
+      } while (0)
+#else
+#  define QTNG_TRACE_SCOPE(category, name) \
+      do {                                 \
+      } while (0)
+#  define QTNG_TRACE_SCOPE_ARG(category, name, argName, arg) \
+      do {                                                   \
+      } while (0)
+#  define QTNG_TRACE_INSTANT(category, name, argName, arg) \
+      do {                                                 \
+      } while (0)
+#endif
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_TRACING_P_H
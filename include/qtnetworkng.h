@@ -5,6 +5,7 @@
 #include "locks.h"
 #include "eventloop.h"
 #include "socket.h"
+#include "dns.h"
 #include "socket_utils.h"
 #include "coroutine_utils.h"
 #include "http.h"
@@ -13,13 +14,22 @@
 #include "http_cookie.h"
 #include "socks5_proxy.h"
 #include "msgpack.h"
+#include "json_stream.h"
 #include "httpd.h"
+#include "http_router.h"
+#include "websocket.h"
 #include "kcp.h"
 #include "socket_server.h"
 #include "network_interface.h"
+#include "metrics.h"
+#include "buffer_budget.h"
+#include "tracing.h"
+#include "task.h"
+#include "access_log.h"
 
 #ifndef QTNG_NO_CRYPTO
 #  include "ssl.h"
+#  include "ocsp.h"
 #  include "random.h"
 #  include "md.h"
 #  include "cipher.h"
@@ -32,5 +42,6 @@
 #endif
 
 #include "data_channel.h"
+#include "rpc.h"
 
 #endif  // QTNG_QTNETWORKNG_H
@@ -8,6 +8,9 @@
 QTNETWORKNG_NAMESPACE_BEGIN
 
 QByteArray randomBytes(int i);
+// writes to the buffer of caller. the bytes come from a chacha20 generator of every thread, which is seeded and
+// reseeded by the system rng. returns false if the system rng failed before the first seed.
+bool randomBytes(char *out, int numBytes);
 
 QTNETWORKNG_NAMESPACE_END
 
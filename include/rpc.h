@@ -0,0 +1,207 @@
+#ifndef QTNG_RPC_H
+#define QTNG_RPC_H
+
+#include <tuple>
+#include <functional>
+#include <type_traits>
+#include "data_channel.h"
+#include "msgpack.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+struct RpcError
+{
+    enum Code {
+        NoError = 0,
+        ChannelBroken = 1,
+        Timeout = 2,
+        MethodNotFound = 3,
+        InvalidParams = 4,
+        InvalidResult = 5,
+        RemoteError = 6,  // returned by the handler of peer.
+    };
+    RpcError()
+        : code(NoError)
+    {
+    }
+    RpcError(Code code, const QString &message)
+        : code(code)
+        , message(message)
+    {
+    }
+    bool isOk() const { return code == NoError; }
+    Code code;
+    QString message;
+};
+
+template<int...>
+struct RpcIndexes
+{
+};
+
+template<int N, int... Is>
+struct RpcMakeIndexes : RpcMakeIndexes<N - 1, N - 1, Is...>
+{
+};
+
+template<int... Is>
+struct RpcMakeIndexes<0, Is...>
+{
+    typedef RpcIndexes<Is...> Type;
+};
+
+// the params are packed as a msgpack array by the codecs of their types at compile time.
+template<typename... Args>
+QByteArray packRpcParams(const Args &...args)
+{
+    QByteArray params;
+    MsgPackStream s(&params, QIODevice::WriteOnly);
+    s.writeArrayHeader(static_cast<quint32>(sizeof...(Args)));
+    int unused[] = { 0, ((s << args), 0)... };
+    Q_UNUSED(unused);
+    if (s.status() != MsgPackStream::Ok) {
+        return QByteArray();
+    }
+    return params;
+}
+
+template<typename Tuple, int... Is>
+bool unpackRpcParams(const QByteArray &params, Tuple &values, RpcIndexes<Is...>)
+{
+    MsgPackStream s(params);
+    quint32 len;
+    if (!s.readArrayHeader(len) || len != sizeof...(Is)) {
+        return false;
+    }
+    int unused[] = { 0, ((s >> std::get<Is>(values)), 0)... };
+    Q_UNUSED(unused);
+    return s.status() == MsgPackStream::Ok;
+}
+
+template<typename R, typename... Args>
+struct RpcInvoker
+{
+    template<int... Is>
+    static bool invoke(const std::function<R(Args...)> &func, std::tuple<typename std::decay<Args>::type...> &values,
+                       RpcIndexes<Is...>, QByteArray *result)
+    {
+        *result = MsgPackStream::pack(func(std::get<Is>(values)...));
+        return !result->isNull();
+    }
+};
+
+template<typename... Args>
+struct RpcInvoker<void, Args...>
+{
+    template<int... Is>
+    static bool invoke(const std::function<void(Args...)> &func, std::tuple<typename std::decay<Args>::type...> &values,
+                       RpcIndexes<Is...>, QByteArray *result)
+    {
+        func(std::get<Is>(values)...);
+        *result = MsgPackStream::pack(QVariant());
+        return true;
+    }
+};
+
+class RpcPeerPrivate;
+// calls and serves the methods over one data channel. the calls of many coroutines are pipelined and matched by the
+// call ids, and the messages queued in one turn are sent together by DataChannel::sendPackets(). the deadlines of
+// calls are the coarse timers of eventloop. every message is a msgpack array:
+//
+//     [0, callId, method, params]        the request, params is an array.
+//     [1, callId, error, result]         the response, error is nil or [code, message].
+//     [2, method, params]                the notification which is not responded.
+//
+//     RpcPeer peer(channel);
+//     peer.registerMethod("add", std::function<qint32(qint32, qint32)>([](qint32 a, qint32 b) { return a + b; }));
+//     qint32 sum;
+//     if (peer.call("add", &sum, 1, 2).isOk()) { ... }
+//
+// the handlers run in their own coroutines, at most maxPendingCalls at once, which is also the limit of calls waiting
+// for responses. delete the peer after all callers return.
+class RpcPeer
+{
+public:
+    // returns the error to fail the call, which is usually RpcError::RemoteError.
+    typedef std::function<RpcError(const QByteArray &params, QByteArray *result)> Handler;
+public:
+    explicit RpcPeer(QSharedPointer<DataChannel> channel, quint32 maxPendingCalls = 1024);
+    ~RpcPeer();
+public:
+    // the params and result are packed msgpack values. timeout is in seconds, 0 for no deadline and negative numbers
+    // for callTimeout().
+    RpcError callRaw(const QString &method, const QByteArray &params, QByteArray *result, float timeout = -1);
+    bool notifyRaw(const QString &method, const QByteArray &params);
+    void registerRawMethod(const QString &method, Handler handler);
+    void unregisterMethod(const QString &method);
+
+    template<typename R, typename... Args>
+    RpcError call(const QString &method, R *result, const Args &...args);
+    template<typename... Args>
+    bool notify(const QString &method, const Args &...args);
+    template<typename R, typename... Args>
+    void registerMethod(const QString &method, std::function<R(Args...)> func);
+    template<typename R, typename... Args>
+    void registerMethod(const QString &method, R (*func)(Args...))
+    {
+        registerMethod(method, std::function<R(Args...)>(func));
+    }
+public:
+    void setCallTimeout(float timeout);  // default to 30 seconds.
+    float callTimeout() const;
+    quint32 pendingCallsSize() const;
+    QSharedPointer<DataChannel> channel() const;
+    bool isBroken() const;
+    void close();
+private:
+    RpcPeerPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(RpcPeer)
+    Q_DISABLE_COPY(RpcPeer)
+};
+
+template<typename R, typename... Args>
+RpcError RpcPeer::call(const QString &method, R *result, const Args &...args)
+{
+    const QByteArray &params = packRpcParams(args...);
+    if (params.isNull()) {
+        return RpcError(RpcError::InvalidParams, QString::fromLatin1("can not pack the params."));
+    }
+    QByteArray packed;
+    RpcError error = callRaw(method, params, &packed);
+    if (!error.isOk()) {
+        return error;
+    }
+    MsgPackStream s(packed);
+    s >> *result;
+    if (s.status() != MsgPackStream::Ok) {
+        return RpcError(RpcError::InvalidResult, QString::fromLatin1("can not unpack the result."));
+    }
+    return error;
+}
+
+template<typename... Args>
+bool RpcPeer::notify(const QString &method, const Args &...args)
+{
+    const QByteArray &params = packRpcParams(args...);
+    return !params.isNull() && notifyRaw(method, params);
+}
+
+template<typename R, typename... Args>
+void RpcPeer::registerMethod(const QString &method, std::function<R(Args...)> func)
+{
+    registerRawMethod(method, [func](const QByteArray &params, QByteArray *result) -> RpcError {
+        typedef typename RpcMakeIndexes<sizeof...(Args)>::Type Indexes;
+        std::tuple<typename std::decay<Args>::type...> values;
+        if (!unpackRpcParams(params, values, Indexes())) {
+            return RpcError(RpcError::InvalidParams, QString::fromLatin1("invalid params."));
+        }
+        if (!RpcInvoker<R, Args...>::invoke(func, values, Indexes(), result)) {
+            return RpcError(RpcError::InvalidResult, QString::fromLatin1("can not pack the result."));
+        }
+        return RpcError();
+    });
+}
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_RPC_H
@@ -9,6 +9,9 @@
 #include "network_interface.h"
 #include "private/eventloop_p.h"
 #include "locks.h"
+#include "coroutine_utils.h"
+
+QT_FORWARD_DECLARE_CLASS(QFile)
 
 #ifdef fileno  // android define fileno() function as macro
 #  undef fileno
@@ -16,6 +19,41 @@
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
+// the statistics of a tcp connection kept by the kernel. the fields which the platform does not report are zero.
+struct TcpInfo
+{
+    TcpInfo()
+        : rtt(0)
+        , rttVariance(0)
+        , minRtt(0)
+        , congestionWindow(0)
+        , slowStartThreshold(0)
+        , mss(0)
+        , retransmits(0)
+        , lost(0)
+        , deliveryRate(0)
+        , bytesSent(0)
+        , bytesReceived(0)
+        , bytesRetransmitted(0)
+        , valid(false)
+    {
+    }
+    bool isValid() const { return valid; }
+    quint32 rtt;  // the smoothed round trip time in microseconds.
+    quint32 rttVariance;  // in microseconds.
+    quint32 minRtt;  // in microseconds.
+    quint32 congestionWindow;  // in segments.
+    quint32 slowStartThreshold;  // in segments.
+    quint32 mss;  // of sending.
+    quint32 retransmits;  // the segments retransmitted since connected.
+    quint32 lost;  // the segments considered lost now.
+    quint64 deliveryRate;  // the recent goodput in bytes per second.
+    quint64 bytesSent;
+    quint64 bytesReceived;
+    quint64 bytesRetransmitted;
+    bool valid;
+};
+
 class SocketPrivate;
 class SocketDnsCache;
 class Socket
@@ -27,7 +65,8 @@ public:
         // SctpSocket = QAbstractSocket::SctpSocket,
         // define for other XXXSocket types. not used here.
         KcpSocket = 3,
-        LocalSocket = 4,
+        LocalSocket = 4,  // the stream of unix domain socket, the protocol is ignored.
+        LocalDatagramSocket = 5,
         UnknownSocketType = -1
     };
     Q_ENUMS(SocketType)
@@ -90,10 +129,28 @@ public:
         MaxStreamsSocketOption = 13,  // for sctp
         NonBlockingSocketOption = 14,
         BindExclusively = 15,
-        PathMtuSocketOption = 16
+        PathMtuSocketOption = 16,
+        BusyPollSocketOption = 17,  // SO_BUSY_POLL in microseconds, linux only.
+        // the queue length of pending fast open connections of listening socket, set it before listen(). linux only.
+        FastOpenSocketOption = 18,  // TCP_FASTOPEN
+        // connect() returns at once, and the first send() carries its data in the SYN if the cookie of server is
+        // cached, or does the usual handshake. set it before connect(), linux 4.11 or later.
+        FastOpenConnectSocketOption = 19,  // TCP_FASTOPEN_CONNECT
+        // accept() returns a connection only after its first data comes, or the seconds passed. linux only.
+        DeferAcceptSocketOption = 20,  // TCP_DEFER_ACCEPT
+        // sendall(const QByteArray &) sends the large buffers without copying them, and keeps them until the kernel is
+        // done. the small ones are copied as usual. linux 4.14 or later.
+        ZeroCopySocketOption = 21,  // SO_ZEROCOPY
+        // recvfromMany() and sendtoMany() of udp socket go through the buffers registered to windows RIO, which moves
+        // many datagrams without a syscall for each. set it before bind(), and receive only by recvfromMany() then.
+        // windows 8 or later.
+        RegisteredIoSocketOption = 22,
+        // the name of congestion control algorithm as a string, such as "cubic" or "bbr" if its module is loaded.
+        // linux and freebsd.
+        CongestionControlSocketOption = 23,  // TCP_CONGESTION
     };
     Q_ENUMS(SocketOption)
-    enum BindFlag { DefaultForPlatform = 0x0, ShareAddress = 0x1, DontShareAddress = 0x2, ReuseAddressHint = 0x4 };
+    enum BindFlag { DefaultForPlatform = 0x0, ShareAddress = 0x1, DontShareAddress = 0x2, ReuseAddressHint = 0x4, ReusePortHint = 0x8 };
     Q_DECLARE_FLAGS(BindMode, BindFlag)
 public:
     explicit Socket(HostAddress::NetworkLayerProtocol protocol = HostAddress::IPv4Protocol,
@@ -104,6 +161,9 @@ public:
     SocketError error() const;
     QString errorString() const;
     bool isValid() const;
+    bool isIdleConnected() const;  // tcp only, false if the peer closed it or sent anything. never blocks.
+    // tcp only, by TCP_INFO of linux and SIO_TCP_INFO of windows 10. returns an invalid one on other platforms.
+    TcpInfo tcpInfo() const;
     HostAddress localAddress() const;
     quint16 localPort() const;
     HostAddress peerAddress() const;
@@ -117,11 +177,19 @@ public:
     QString peerAddressURI() const;
 
     Socket *accept();
+    // wait for one connection like accept(), and take at most maxCount - 1 more from the backlog without waiting.
+    QList<Socket *> acceptMany(int maxCount);
     bool bind(const HostAddress &address, quint16 port = 0, BindMode mode = DefaultForPlatform);
     bool bind(quint16 port = 0, BindMode mode = DefaultForPlatform);
     bool connect(const HostAddress &host, quint16 port);
     bool connect(const QString &hostName, quint16 port,
                  QSharedPointer<SocketDnsCache> dnsCache = QSharedPointer<SocketDnsCache>());
+    // the path of LocalSocket and LocalDatagramSocket, the names starting with '@' are in the abstract namespace of
+    // linux. bind() does not remove the file left by former servers.
+    bool bind(const QString &path);
+    bool connect(const QString &path);
+    QString localPath() const;
+    QString peerPath() const;  // empty if the peer is not bound.
     void close();
     void abort();
     bool listen(int backlog);
@@ -142,10 +210,26 @@ public:
 
     QByteArray recvall(qint32 size);
     QByteArray recv(qint32 size);
+    qint32 recvInto(QByteArray &buf, qint32 maxSize);  // reuses the capacity of buf, which is resized to the result.
     qint32 send(const QByteArray &data);
     qint32 sendall(const QByteArray &data);
+    qint32 sendv(const QList<QByteArray> &data);  // send all buffers like sendall(), without joining them.
+    // send count bytes of file from offset, or to the end if count < 0. the file is copied inside the kernel by
+    // sendfile() or TransmitFile() if possible. returns the bytes sent or -1.
+    qint64 sendfile(QFile *file, qint64 offset, qint64 count = -1);
+    // pass the file descriptors with the data by SCM_RIGHTS, such as the connections accepted by another process. the
+    // data is at least one byte. the received descriptors are owned by caller, which makes Socket(qintptr) of them.
+    qint32 sendfds(const char *data, qint32 size, const QList<qintptr> &fds);
+    qint32 recvfds(char *data, qint32 size, QList<qintptr> *fds);
     QByteArray recvfrom(qint32 size, HostAddress *addr, quint16 *port);
     qint32 sendto(const QByteArray &data, const HostAddress &addr, quint16 port);
+    // move several datagrams in one syscall where recvmmsg()/sendmmsg() exist. the i-th datagram is received into
+    // buffer + i * datagramSize, and sizes[i] is larger than datagramSize if it was truncated. returns count or -1.
+    qint32 recvfromMany(char *buffer, qint32 datagramSize, qint32 count, qint32 *sizes, HostAddress *addrs,
+                        quint16 *ports);
+    qint32 sendtoMany(const QList<QByteArray> &datagrams, const HostAddress &addr, quint16 port);  // returns count
+    // the i-th datagram is sent to addrs[i] and ports[i], such as the datagrams of many peers of udp server.
+    qint32 sendtoMany(const QList<QByteArray> &datagrams, const HostAddress *addrs, const quint16 *ports);
 
     static QList<HostAddress> resolve(const QString &hostName);
     static Socket *createConnection(const HostAddress &host, quint16 port, Socket::SocketError *error = nullptr,
@@ -154,6 +238,8 @@ public:
                                     QSharedPointer<SocketDnsCache> dnsCache = QSharedPointer<SocketDnsCache>(),
                                     int allowProtocol = HostAddress::IPv4Protocol | HostAddress::IPv6Protocol);
     static Socket *createServer(const HostAddress &host, quint16 port, int backlog = 50);
+    static Socket *createLocalConnection(const QString &path, Socket::SocketError *error = nullptr);
+    static Socket *createLocalServer(const QString &path, int backlog = 50);
 private:
     SocketPrivate * const d_ptr;
     Q_DECLARE_PRIVATE(Socket)
@@ -162,6 +248,7 @@ private:
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(Socket::BindMode)
 
+class SocketLike;
 class PollPrivate;
 class Poll
 {
@@ -171,13 +258,25 @@ public:
         ReadWrite = EventLoopCoroutine::ReadWrite,
         Write = EventLoopCoroutine::Write,
     };
+    // one of socket and socketLike is set, as it is added.
+    struct ReadyEvent
+    {
+        QSharedPointer<Socket> socket;
+        QSharedPointer<SocketLike> socketLike;
+        EventType events;
+    };
 public:
     Poll();
     virtual ~Poll();
 public:
     void add(QSharedPointer<Socket> socket, EventType event);
     void remove(QSharedPointer<Socket> socket);
-    QSharedPointer<Socket> wait(float msecs = 0.0);
+    // the SslSocket with decrypted bytes buffered is ready to read, even if the fd is not.
+    void add(QSharedPointer<SocketLike> socket, EventType event);
+    void remove(QSharedPointer<SocketLike> socket);
+    QSharedPointer<Socket> wait(float msecs = 0.0);  // null if timeout, or the ready one is added as SocketLike.
+    // wait until some sockets are ready, return at most maxEvents of them. empty if timeout.
+    QList<ReadyEvent> waitMany(int maxEvents = 64, float secs = 0.0);
 private:
     PollPrivate * const d_ptr;
     Q_DECLARE_PRIVATE(Poll)
@@ -193,7 +292,12 @@ public:
     QList<HostAddress> resolve(const QString &hostName);
     bool hasHost(const QString &hostName) const;
     void addHost(const QString &hostName, const QList<HostAddress> &addrList);
-    void addHost(const QString &hostName, const HostAddress &addr);
+    void addHost(const QString &hostName, const HostAddress &addr);  // added hosts never expire.
+public:
+    quint32 maxTtl() const;  // answers are kept no longer than it in seconds, default to 3600.
+    void setMaxTtl(quint32 secs);
+    quint32 negativeTtl() const;  // missing names are kept no longer than it in seconds, default to 30. 0 disables it.
+    void setNegativeTtl(quint32 secs);
 private:
     SocketDnsCachePrivate * const d_ptr;
     Q_DECLARE_PRIVATE(SocketDnsCache)
@@ -229,6 +333,65 @@ SocketType *createConnection(const HostAddress &addr, quint16 port, Socket::Sock
     return nullptr;
 }
 
+// rfc8305: interleave address families starting with IPv6, filtered by allowProtocol.
+QList<HostAddress> happyEyeballsOrder(const QList<HostAddress> &addresses, int allowProtocol);
+
+const quint32 HappyEyeballsAttemptDelay = 250;
+
+// start the next attempt every 250ms or once the previous one fails. the first winner is kept, losers are aborted.
+template<typename SocketType>
+SocketType *happyEyeballsConnect(const QList<HostAddress> &addresses, quint16 port, Socket::SocketError *error,
+                                 std::function<SocketType *(HostAddress::NetworkLayerProtocol)> func)
+{
+    // owned here until returned, so it is not leaked if this coroutine is killed while waiting.
+    QScopedPointer<SocketType> winner;
+    Socket::SocketError lastError = Socket::HostNotFoundError;
+    int started = 0;
+    int failed = 0;
+    bool startNext = true;
+    Event progress;
+    CoroutineGroup operations;  // destroyed first, so the attempts never see dangling references.
+    while (!winner && failed < addresses.size()) {
+        if (startNext && started < addresses.size()) {
+            startNext = false;
+            const HostAddress addr = addresses.at(started);
+            const int attempt = ++started;
+            operations.spawn([addr, port, func, &winner, &lastError, &failed, &startNext, &progress] {
+                QScopedPointer<SocketType> socket(
+                        func(addr.isIPv4() ? HostAddress::IPv4Protocol : HostAddress::IPv6Protocol));
+                if (socket && socket->connect(addr, port)) {
+                    if (!winner) {
+                        winner.reset(socket.take());
+                    }
+                } else {
+                    if (socket) {
+                        lastError = socket->error();
+                    }
+                    ++failed;
+                    startNext = true;
+                }
+                progress.set();
+            });
+            if (started < addresses.size()) {
+                operations.spawn([attempt, &started, &startNext, &progress] {
+                    Coroutine::msleep(HappyEyeballsAttemptDelay);
+                    if (started == attempt) {
+                        startNext = true;
+                        progress.set();
+                    }
+                });
+            }
+        }
+        progress.clear();
+        progress.wait();
+    }
+    operations.killall();
+    if (error) {
+        *error = winner.isNull() ? lastError : Socket::NoError;
+    }
+    return winner.take();
+}
+
 template<typename SocketType>
 SocketType *createConnection(const QString &hostName, quint16 port, Socket::SocketError *error,
                              QSharedPointer<SocketDnsCache> dnsCache, int allowProtocol,
@@ -236,7 +399,7 @@ SocketType *createConnection(const QString &hostName, quint16 port, Socket::Sock
 {
     QList<HostAddress> addresses;
     HostAddress t;
-    if (t.setAddress(hostName)) {
+    if (HostAddress::parseLiteral(hostName, &t)) {
         addresses.append(t);
     } else {
         if (dnsCache.isNull()) {
@@ -252,17 +415,15 @@ SocketType *createConnection(const QString &hostName, quint16 port, Socket::Sock
         }
         return nullptr;
     }
-    for (int i = 0; i < addresses.size(); ++i) {
-        const HostAddress &addr = addresses.at(i);
-        SocketType *socket = createConnection<SocketType>(addr, port, error, allowProtocol, func);
-        if (socket) {
-            return socket;
+    addresses = happyEyeballsOrder(addresses, allowProtocol);
+    if (addresses.size() == 1) {
+        SocketType *socket = createConnection<SocketType>(addresses.first(), port, error, allowProtocol, func);
+        if (!socket && error && *error == Socket::NoError) {
+            *error = Socket::HostNotFoundError;
         }
+        return socket;
     }
-    if (error && *error == Socket::NoError) {
-        *error = Socket::HostNotFoundError;
-    }
-    return nullptr;
+    return happyEyeballsConnect<SocketType>(addresses, port, error, func);
 }
 
 template<typename SocketType>
@@ -10,6 +10,24 @@
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
+struct StreamServerCounters
+{
+    StreamServerCounters()
+        : activeConnections(0)
+        , acceptedConnections(0)
+        , rejectedConnections(0)
+        , acceptPauses(0)
+        , killedConnections(0)
+    {
+    }
+    qint64 activeConnections;
+    quint64 acceptedConnections;
+    quint64 rejectedConnections;  // by maxConnectionsPerAddress() or verifyRequest().
+    quint64 acceptPauses;  // accepting is paused because of maxConnections().
+    quint64 killedConnections;  // not finished before the timeout of drain().
+};
+
+class AccessLog;
 class BaseStreamServerPrivate;
 class BaseStreamServer
 {
@@ -29,14 +47,74 @@ public:
     void setAllowReuseAddress(bool b);
     int requestQueueSize() const;  // default to 100
     void setRequestQueueSize(int requestQueueSize);
+    // number of threads accepting requests, each owns a listener bound to the same port with SO_REUSEPORT.
+    // processRequest() is called from all of them. default to 1, take effect in the next start().
+    int workerThreads() const;
+    void setWorkerThreads(int workerThreads);
+    // serve in worker processes, and let this one supervise them. the supervisor binds the listener once and runs the
+    // executable again for every worker, which finds the listener inherited and serves it instead of binding. the
+    // crashed workers are restarted, and stop() lets them drain. tcp servers of a QCoreApplication on unix only, the
+    // program should run one such server. default to 0 which serves in this process, take effect in the next start().
+    int workerProcesses() const;
+    void setWorkerProcesses(int workerProcesses);
+    // start a new generation of workers running the executable on disk, and drain the old one. they share the
+    // listener, so no connection in the backlog is dropped and the new workers accept at once. supervisor only.
+    void reloadWorkers();
+    // stop accepting while there are maxConnections connections, so the pending ones wait in the backlog of kernel
+    // instead of taking memory of us. counted over all worker threads, default to 0 which means unlimited.
+    int maxConnections() const;
+    void setMaxConnections(int maxConnections);
+    // the connections from an address beyond the limit are closed after accepted. default to 0 which means unlimited.
+    int maxConnectionsPerAddress() const;
+    void setMaxConnectionsPerAddress(int maxConnectionsPerAddress);
+    // the connections taken from the backlog in one wakeup, default to 16. 1 makes the server call getRequest() for
+    // every connection, for the subclasses overriding it.
+    int acceptBatchSize() const;
+    void setAcceptBatchSize(int acceptBatchSize);
+    // accept the data in the SYN of clients having a fast open cookie, see Socket::FastOpenSocketOption. default to 0
+    // which disables it, take effect in the next start().
+    int fastOpenQueueSize() const;
+    void setFastOpenQueueSize(int fastOpenQueueSize);
+    // accept the connections after their first data come, so handlers do not wait for the requests of idle clients.
+    // default to 0 which disables it, see Socket::DeferAcceptSocketOption.
+    int deferAccept() const;  // in seconds.
+    void setDeferAccept(int secs);
+    // enable BaseCoroutine::setStackTrimmingEnabled() for the coroutines of connections, for the servers keeping many
+    // idle connections. default to false.
+    bool stackTrimming() const;
+    void setStackTrimming(bool stackTrimming);
+    // the stack size of the coroutines of connections, such as 32KB for a simple proxy. every handler must fit in it,
+    // the overflow is not detected unless BaseCoroutine::setStackGuardEnabled(). default to
+    // DEFAULT_COROUTINE_STACK_SIZE.
+    size_t stackSize() const;
+    void setStackSize(size_t stackSize);
+    // send every tcp connection to the listener of the cpu which received it, and pin the thread of listener i to cpu
+    // i, so the packets of a connection stay on one core. the connections received by cpu c go to listener
+    // c % workerThreads(), so set workerThreads() to the cpus handling the queues of nic. the thread of server owns
+    // listener 0 and is pinned too. linux only, by a reuseport bpf program or SO_INCOMING_CPU on the older kernels.
+    // default to false, take effect in the next start().
+    bool steeringByCpu() const;
+    void setSteeringByCpu(bool steeringByCpu);
+    StreamServerCounters counters() const;
+    // the connections accepted by every listener, in the order of listenerIndex().
+    QList<quint64> acceptedConnectionsPerListener() const;
     bool serveForever();  // serve blocking
     bool start();  // serve in background
     void stop();  // stop serving
+    // stop accepting, wait at most timeout seconds for the connections in progress, and kill the rest. the http request
+    // handlers close the keep-alive connections after current request. returns false if some are killed.
+    bool drain(float timeout = 30.0f);
+    bool isDraining() const;
     bool wait();  // wait for server stopped
     virtual bool isSecure() const;  // is this ssl?
+    // handle a stream multiplexed in an accepted request, such as a http2 stream, by a new request handler.
+    void processSubRequest(QSharedPointer<SocketLike> request);
 public:
     void setUserData(void *data);  // the owner of data is not changed.
     void *userData() const;
+    // the request handlers write their logs to it if set, or print them to stdout.
+    void setAccessLog(QSharedPointer<AccessLog> accessLog);
+    QSharedPointer<AccessLog> accessLog() const;
 public:
     quint16 serverPort() const;
     HostAddress serverAddress() const;
@@ -46,10 +124,13 @@ public:
     QSharedPointer<Event> stopped;
 protected:
     virtual bool serverBind();  // bind()
+    // the order of binding of the listener of current thread, which is its index in the SO_REUSEPORT group.
+    int listenerIndex() const;
     virtual bool serverActivate();  // listen()
     virtual void serverClose();  // close()
     virtual bool serviceActions();  // default to nothing, called before accept next request.
     virtual QSharedPointer<SocketLike> getRequest();  // accept();
+    virtual QList<QSharedPointer<SocketLike>> getRequests(int maxCount);  // acceptMany();
     virtual QSharedPointer<SocketLike>
     prepareRequest(QSharedPointer<SocketLike> request);  // ssl handshake, default to nothing for tcp
     virtual bool verifyRequest(QSharedPointer<SocketLike> request);
@@ -109,6 +190,7 @@ public:
 protected:
     virtual QSharedPointer<SocketLike> serverCreate() override;
     virtual void processRequest(QSharedPointer<SocketLike> request) override;
+    virtual bool serverActivate() override;
 };
 
 template<typename RequestHandler>
@@ -117,6 +199,19 @@ QSharedPointer<SocketLike> KcpServer<RequestHandler>::serverCreate()
     return asSocketLike(KcpSocket::createServer(serverAddress(), serverPort(), 0));
 }
 
+template<typename RequestHandler>
+bool KcpServer<RequestHandler>::serverActivate()
+{
+    // pin every session to the worker thread accepted it, even if the address of client is changed.
+    if (workerThreads() > 1) {
+        QSharedPointer<KcpSocket> kcpSocket = convertSocketLikeToKcpSocket(serverSocket());
+        if (!kcpSocket.isNull()) {
+            kcpSocket->setShard(listenerIndex(), workerThreads());
+        }
+    }
+    return BaseStreamServer::serverActivate();
+}
+
 template<typename RequestHandler>
 void KcpServer<RequestHandler>::processRequest(QSharedPointer<SocketLike> request)
 {
@@ -126,6 +221,89 @@ void KcpServer<RequestHandler>::processRequest(QSharedPointer<SocketLike> reques
     handler.run();
 }
 
+// serves a unix domain socket, the paths starting with '@' are in the abstract namespace of linux. the file left by a
+// former server is removed if nobody listens to it and allowReuseAddress() is true, and the file is removed after the
+// server stops. there is one listener, workerThreads() is not supported.
+template<typename RequestHandler>
+class LocalServer : public BaseStreamServer
+{
+public:
+    explicit LocalServer(const QString &serverPath)
+        : BaseStreamServer(HostAddress(), 0)
+        , path(serverPath)
+    {
+    }
+    QString serverPath() const { return path; }
+protected:
+    virtual QSharedPointer<SocketLike> serverCreate() override;
+    virtual void processRequest(QSharedPointer<SocketLike> request) override;
+    virtual bool serverBind() override;
+    virtual bool serverActivate() override;
+    virtual void serverClose() override;
+private:
+    QString path;
+};
+
+template<typename RequestHandler>
+QSharedPointer<SocketLike> LocalServer<RequestHandler>::serverCreate()
+{
+    return asSocketLike(Socket::createLocalServer(path, 0));
+}
+
+template<typename RequestHandler>
+bool LocalServer<RequestHandler>::serverBind()
+{
+    QSharedPointer<Socket> socket = convertSocketLikeToSocket(serverSocket());
+    if (socket.isNull()) {
+        return false;
+    }
+    if (socket->state() == Socket::BoundState || socket->state() == Socket::ListeningState) {
+        return true;
+    }
+    if (socket->bind(path)) {
+        return true;
+    }
+    if (socket->error() != Socket::AddressInUseError || !allowReuseAddress() || path.startsWith(QLatin1Char('@'))) {
+        return false;
+    }
+    QScopedPointer<Socket> probe(Socket::createLocalConnection(path));
+    if (!probe.isNull()) {
+        return false;  // another server is listening.
+    }
+    QFile::remove(path);
+    return socket->bind(path);
+}
+
+template<typename RequestHandler>
+bool LocalServer<RequestHandler>::serverActivate()
+{
+    QSharedPointer<SocketLike> socket = serverSocket();
+    if (socket->state() == Socket::ListeningState) {
+        return true;
+    }
+    return socket->state() == Socket::BoundState && socket->listen(requestQueueSize());
+}
+
+template<typename RequestHandler>
+void LocalServer<RequestHandler>::serverClose()
+{
+    QSharedPointer<SocketLike> socket = serverSocket();
+    const bool bound = socket->state() == Socket::BoundState || socket->state() == Socket::ListeningState;
+    BaseStreamServer::serverClose();
+    if (bound && !path.startsWith(QLatin1Char('@'))) {
+        QFile::remove(path);
+    }
+}
+
+template<typename RequestHandler>
+void LocalServer<RequestHandler>::processRequest(QSharedPointer<SocketLike> request)
+{
+    RequestHandler handler;
+    handler.request = request;
+    handler.server = this;
+    handler.run();
+}
+
 #ifndef QTNG_NO_CRYPTO
 
 template<typename ServerType>
@@ -297,6 +475,9 @@ protected:
     virtual void handle() override;
 protected:
     virtual void doConnect(const QString &hostName, const HostAddress &hostAddress, quint16 port);
+    // relay datagrams between the client and targets until the request is closed. the client tells where its datagrams
+    // come from by hostAddress and port, which are ignored, as the datagrams are accepted from the peer of request.
+    virtual void doUdpAssociate(const HostAddress &hostAddress, quint16 port);
     virtual void doFailed(const QString &hostName, const HostAddress &hostAddress, quint16 port);
     virtual QSharedPointer<SocketLike> makeConnection(const QString &hostName, const HostAddress &hostAddress,
                                                       quint16 port, HostAddress *forwardAddress);
@@ -310,6 +491,7 @@ private:
     void handleRequest();
     bool handshake();
     bool parseAddress(QString *hostName, HostAddress *addr, quint16 *port);
+    void relayDatagrams(QSharedPointer<Socket> relay, const HostAddress &clientAddress);
 };
 
 QTNETWORKNG_NAMESPACE_END
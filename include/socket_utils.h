@@ -34,6 +34,8 @@ public:
     virtual QString peerAddressURI() const = 0;
 
     virtual QSharedPointer<SocketLike> accept() = 0;
+    // wait for one connection, and take at most maxCount - 1 more without waiting. default to one accept().
+    virtual QList<QSharedPointer<SocketLike>> acceptMany(int maxCount);
     virtual Socket *acceptRaw() = 0;
     virtual bool bind(const HostAddress &address, quint16 port = 0,
                       Socket::BindMode mode = Socket::DefaultForPlatform) = 0;
@@ -53,14 +55,80 @@ public:
     virtual qint32 sendall(const char *data, qint32 size) = 0;
     virtual QByteArray recv(qint32 size) = 0;
     virtual QByteArray recvall(qint32 size) = 0;
+    qint32 recvInto(QByteArray &buf, qint32 maxSize);  // reuses the capacity of buf, which is resized to the result.
     virtual qint32 send(const QByteArray &data) = 0;
     virtual qint32 sendall(const QByteArray &data) = 0;
+    virtual qint32 sendv(const QList<QByteArray> &data);  // default to sendall() every buffer.
+    // some bytes can be received without waiting for the fd, such as the records decrypted by SslSocket.
+    virtual bool hasPendingData() const;
+    // the largest message kept whole by one sendall() and received by one recv(), 0 for byte streams.
+    virtual qint32 maxMessageSize() const;
+    // of the tcp connection underneath, such as the one of SslSocket. default to an invalid one.
+    virtual TcpInfo tcpInfo() const;
 public:
     virtual qint32 read(char *data, qint32 size) override;
     virtual qint32 write(const char *data, qint32 size) override;
     virtual qint64 size() override;
 };
 
+// read a SocketLike through one buffer, so parsers can scan and consume it without allocating for every recv().
+class BufferedSocketReader
+{
+public:
+    enum Error {
+        NoError,
+        ConnectionError,
+        LimitExceeded,
+    };
+public:
+    explicit BufferedSocketReader(QSharedPointer<SocketLike> connection, const QByteArray &buf = QByteArray(),
+                                  qint32 blockSize = 1024 * 8);
+public:
+    qint32 fill();  // receive one more block, returns the bytes received, 0 at eof or -1 if failed.
+    QByteArray peek(qint32 size);  // wait until size bytes are buffered or eof, without consuming them.
+    // returns the bytes before the delimiter, the delimiter is consumed too.
+    QByteArray readUntil(const QByteArray &delimiter, qint32 maxSize, Error *error);
+    QByteArray readExactly(qint32 size);  // returns less bytes only at eof or error.
+    qint32 read(char *data, qint32 size);  // the buffered bytes first, or one recv().
+    void skip(qint32 size);
+    void unread(const QByteArray &data);  // push back to the front.
+    QByteArray takeBuffered();  // take all buffered bytes, such as the partial body after headers.
+    qint32 bufferedSize() const { return buf.size() - pos; }
+    const char *bufferedData() const { return buf.constData() + pos; }
+public:
+    QSharedPointer<SocketLike> connection;  // not replaced after constructed.
+private:
+    void compact();
+    qint32 recvSome(char *data, qint32 size);
+    Socket *plain;  // the plain socket behind connection, which is called directly.
+    QByteArray buf;
+    qint32 pos;  // the consumed bytes at the front of buf.
+    qint32 blockSize;
+};
+
+// a token bucket of bytes, which may be shared by the connections of one tenant in many threads. the tokens are refilled
+// lazily while taken, and overdrawn by the last read, so a throttled reader sleeps once for the debt before reading
+// again, instead of waking for every chunk. the socket is not read meanwhile, and tcp slows down the sender.
+class RateLimiterPrivate;
+class RateLimiter
+{
+public:
+    // the burst defaults to the bytes of one second. a rate <= 0 is unlimited.
+    explicit RateLimiter(qint64 bytesPerSecond, qint64 burstBytes = 0);
+    ~RateLimiter();
+public:
+    void setRate(qint64 bytesPerSecond, qint64 burstBytes = 0);
+    qint64 rate() const;
+    qint64 burst() const;
+    qint64 available();  // negative if overdrawn.
+    qint64 wait(qint64 maxBytes);  // sleeps till some tokens are available, and returns at most maxBytes of them.
+    void consume(qint64 bytes);
+private:
+    RateLimiterPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(RateLimiter)
+    Q_DISABLE_COPY(RateLimiter)
+};
+
 class ExchangerPrivate;
 class Exchanger
 {
@@ -69,6 +137,8 @@ public:
               float timeout = 30.0);
     ~Exchanger();
 public:
+    // shape the bytes from request to forward, and the bytes back. share the limiters among the exchangers of a tenant.
+    void setRateLimiters(QSharedPointer<RateLimiter> upload, QSharedPointer<RateLimiter> download);
     void exchange();
 private:
     ExchangerPrivate * const d_ptr;
@@ -90,6 +160,9 @@ inline QSharedPointer<SocketLike> asSocketLike(Socket *s)
 }
 
 QSharedPointer<Socket> convertSocketLikeToSocket(QSharedPointer<SocketLike> socket);
+// the plain socket wrapped by asSocketLike(), or null. the hot loops call it directly instead of through the virtual
+// SocketLike, and without copying the QSharedPointer like convertSocketLikeToSocket().
+Socket *plainSocketOf(const QSharedPointer<SocketLike> &socket);
 
 QTNETWORKNG_NAMESPACE_END
 
@@ -38,6 +38,30 @@ private:
     Error err;
 };
 
+class Socks5UdpAssociationPrivate;
+// datagrams relayed by the proxy, see Socks5Proxy::udpAssociate(). the proxy keeps the association as long as the
+// control connection, which is closed with this object.
+class Socks5UdpAssociation
+{
+public:
+    ~Socks5UdpAssociation();
+public:
+    qint32 sendto(const QByteArray &data, const HostAddress &addr, quint16 port);
+    qint32 sendto(const QByteArray &data, const QString &hostName, quint16 port);  // resolved by the proxy.
+    qint32 sendtoMany(const QList<QByteArray> &datagrams, const HostAddress &addr, quint16 port);
+    QByteArray recvfrom(qint32 size, HostAddress *addr, quint16 *port);
+    void close();
+    bool isValid() const;
+    HostAddress relayAddress() const;
+    quint16 relayPort() const;
+private:
+    explicit Socks5UdpAssociation(Socks5UdpAssociationPrivate *d);
+    Socks5UdpAssociationPrivate * const d_ptr;
+    friend class Socks5ProxyPrivate;
+    Q_DECLARE_PRIVATE(Socks5UdpAssociation)
+    Q_DISABLE_COPY(Socks5UdpAssociation)
+};
+
 class Socks5ProxyPrivate;
 class Socks5Proxy : public SocketProxy
 {
@@ -64,6 +88,8 @@ public:
     virtual QSharedPointer<SocketLike> connect(const QString &remoteHost, quint16 port) override;
     virtual QSharedPointer<SocketLike> connect(const HostAddress &remoteHost, quint16 port) override;
     QSharedPointer<SocketLike> listen(quint16 port);
+    // UDP ASSOCIATE, throws Socks5Exception if the proxy refuses.
+    QSharedPointer<Socks5UdpAssociation> udpAssociate();
 
     bool isNull() const;
     Capabilities capabilities() const;
@@ -76,6 +102,15 @@ public:
     void setPort(quint16 port);
     void setUser(const QString &user);
     void setPassword(const QString &password);
+    // send greeting, authentication and CONNECT in one write, saving two round trips for every new connection. only
+    // one auth method is offered, so the replies are known. some strict proxies may reject it, default to false.
+    bool isPipeliningEnabled() const;
+    void setPipeliningEnabled(bool enabled);
+    // keep some connections which finished greeting and authentication, then connect() sends CONNECT only. they are
+    // refilled in background after taken. default to 0, which disables the pool.
+    int idleConnections() const;
+    void setIdleConnections(int count);
+    void prewarm();  // start filling the idle connections now, instead of at the first connect().
 public:
     void swap(Socks5Proxy &other) { qSwap(d_ptr, other.d_ptr); }
     bool operator!=(const Socks5Proxy &other) const { return !(*this == other); }
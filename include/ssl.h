@@ -46,6 +46,16 @@ public:
     virtual QString choose(const QString &hostName) = 0;
 };
 
+// servers staple the returned ocsp response, DER encoded or empty for none, to the handshakes asking for it. it is called
+// in the eventloops and the handshake threads, so it must be thread safe and must not block. see OcspStapling.
+class OcspStaplingCallback
+{
+public:
+    virtual ~OcspStaplingCallback() { }
+    virtual QByteArray response() = 0;
+};
+
+class ThreadPool;
 class SslConfigurationPrivate;
 class SslConfiguration
 {
@@ -65,10 +75,18 @@ public:
     Ssl::PeerVerifyMode peerVerifyMode() const;
     int peerVerifyDepth() const;
     PrivateKey privateKey() const;
+    int sessionCacheSize() const;
+    int sessionTicketKeyLifetime() const;
+    bool kernelTlsEnabled() const;
+    int dynamicRecordThreshold() const;
+    int maxEarlyData() const;
+    QSharedPointer<ThreadPool> handshakeThreadPool() const;
     bool onlySecureProtocol() const;
     bool supportCompression() const;
     bool sendTlsExtHostName() const;
     QSharedPointer<ChooseTlsExtNameCallback> tlsExtHostNameCallback() const;
+    QHash<QString, SslConfiguration> serverNameConfigurations() const;
+    QSharedPointer<OcspStaplingCallback> ocspStaplingCallback() const;
 
     void addCaCertificate(const Certificate &certificate);
     void addCaCertificates(const QList<Certificate> &certificates);
@@ -81,12 +99,37 @@ public:
                        const QByteArray &passPhrase = QByteArray());
     void setSslProtocol(Ssl::SslProtocol protocol);
     void setAllowedNextProtocols(const QList<QByteArray> &protocols);
+    // the sessions to resume, kept by clients per host and port, or by servers. 0 disables session resumption.
+    void setSessionCacheSize(int size);  // default to 1024
+    // servers encrypt session tickets by a new key every lifetime, 0 disables tickets.
+    void setSessionTicketKeyLifetime(int seconds);  // default to 3600
+    // linux only, encrypt the sent records by kernel after handshaking tls 1.2 with aes-gcm over a plain tcp socket.
+    void setKernelTlsEnabled(bool enabled);  // default to false
+    // the records fit one tcp segment until so many bytes are sent, and again after idle for a second, so the peer
+    // decrypts the first bytes without waiting for a whole 16KB record. 0 always sends the records as large as possible.
+    void setDynamicRecordThreshold(int bytes);  // default to 1MB
+    // servers accept so many bytes of tls 1.3 early data from the clients resuming a session, which recv() returns
+    // before the rest. a ClientHello seen again in the window of ticket age is rejected, but only by this process, so
+    // the early data may still be replayed to other processes or hosts sharing the ticket keys. serve only the
+    // idempotent requests from it, see SslSocket::isReadingEarlyData(). 0 disables it. returns false if the tls
+    // library does not support early data, which needs openssl 1.1.1 and is missing in libressl.
+    bool setMaxEarlyData(int bytes);  // default to 0
+    // run the expensive crypto of handshakes in the pool, so the event loop keeps serving other coroutines.
+    void setHandshakeThreadPool(QSharedPointer<ThreadPool> pool);  // default to null, in the event loop.
     void setOnlySecureProtocol(bool onlySecureProtocol);
     void setSupportCompression(bool supportCompression);
     void setSendTlsExtHostName(bool sendTlsExtHostName);
     void setTlsExtHostNameCallback(QSharedPointer<ChooseTlsExtNameCallback> callback);
+    // servers choose a configuration by the server name which clients send, such as "example.com" or "*.example.com",
+    // and use its certificate, private key and alpn protocols. the others and the unknown names use this one. their
+    // contexts are made once and cached, so one server may host thousands of domains. add them before serving.
+    void addServerNameConfiguration(const QString &hostName, const SslConfiguration &config);
+    void setOcspStaplingCallback(QSharedPointer<OcspStaplingCallback> callback);  // for servers.
 public:
     static QList<SslCipher> supportedCiphers();
+    // the configurations without ca certificates trust these. they are parsed once and shared by the process, so
+    // addCaCertificates(systemCaCertificates()) to an empty configuration copies nothing.
+    static QList<Certificate> systemCaCertificates();
     static SslConfiguration testPurpose(const QString &commonName, const QString &countryCode,
                                         const QString &organization);
 public:
@@ -193,6 +236,16 @@ public:
     QList<Certificate> localCertificateChain() const;
     QByteArray nextNegotiatedProtocol() const;
     NextProtocolNegotiationStatus nextProtocolNegotiationStatus() const;
+    bool isSessionReused() const;
+    bool isKernelTlsActive() const;  // sendfile() skips user space crypto if true.
+    // clients send the data in the first flight if the resumed tls 1.3 session allows early data and negotiated the
+    // same alpn protocol, or none. call it before handshake(), and send the data again if it is not accepted.
+    // returns false if the tls library does not support early data.
+    bool setEarlyData(const QByteArray &data, const QByteArray &nextProtocol = QByteArray());
+    bool isEarlyDataAccepted() const;  // by the server, after handshake.
+    // servers only, recv() has not returned all of the early data yet. what it returns may be replayed by attackers.
+    bool isReadingEarlyData() const;
+    bool hasPendingData() const;  // recv() returns without waiting for the socket.
     SslMode mode() const;
     Certificate peerCertificate() const;
     QList<Certificate> peerCertificateChain() const;
@@ -243,8 +296,10 @@ public:
     qint32 sendall(const char *data, qint32 size);
     QByteArray recv(qint32 size);
     QByteArray recvall(qint32 size);
+    qint32 recvInto(QByteArray &buf, qint32 maxSize);  // reuses the capacity of buf, which is resized to the result.
     qint32 send(const QByteArray &data);
     qint32 sendall(const QByteArray &data);
+    qint32 sendv(const QList<QByteArray> &data);  // small buffers are joined into one tls record.
 
     static SslSocket *createConnection(const HostAddress &host, quint16 port,
                                        const SslConfiguration &config = SslConfiguration(),
@@ -275,6 +330,12 @@ QSharedPointer<SslSocket> convertSocketLikeToSslSocket(QSharedPointer<SocketLike
 // XXX we always assume the cipher is stream cipher
 QSharedPointer<SocketLike> encrypted(QSharedPointer<Cipher> cipher, QSharedPointer<SocketLike> socket);
 
+// authenticated encryption by AES128/AES256 in gcm mode or ChaCha20Poly1305, the key is 16 or 32 bytes. the data of
+// one send() is split into records of at most maxRecordSize bytes, and every record is checked by the peer. both
+// peers must use the same algorithm, key and maxRecordSize. returns null if the algorithm or key is not valid.
+QSharedPointer<SocketLike> encryptedRecords(Cipher::Algorithm algo, const QByteArray &key,
+                                            QSharedPointer<SocketLike> socket, qint32 maxRecordSize = 1024 * 16);
+
 QTNETWORKNG_NAMESPACE_END
 
 Q_DECLARE_METATYPE(QList<QTNETWORKNG_NAMESPACE::SslError>)
@@ -0,0 +1,523 @@
+#ifndef QTNG_TASK_H
+#define QTNG_TASK_H
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qsharedpointer.h>
+#include "eventloop.h"
+#include "locks.h"
+#include "socket.h"
+
+// Task<T> is a stackless coroutine of c++20, which costs only its frame instead of a stack. the library is built with
+// c++11, the tasks are available if the program is compiled with c++20.
+#if defined(__has_include)
+#  if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#    define QTNG_HAVE_TASK 1
+#    include <coroutine>
+#    include <exception>
+#    include <optional>
+#    include <utility>
+#  endif
+#endif
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// the eventloop hooks of tasks. callbacks are called in the eventloop of current thread, with the data passed in.
+class TaskScheduler
+{
+public:
+    typedef void (*Callback)(void *data);
+    static int callLater(quint32 msecs, Callback callback, void *data);
+    static void cancelCall(int callId);
+    // the watcher keeps calling back until it is stopped or removed.
+    static int watch(qintptr fd, bool writing, Callback callback, void *data);
+    static void stopWatching(int watcherId);
+    static void removeWatcher(int watcherId);
+    // wait in the current coroutine, or run the eventloop until the event is set if it is called outside of
+    // coroutines.
+    static bool wait(Event &event);
+};
+
+#ifdef QTNG_HAVE_TASK
+
+template<typename T>
+class Task;
+
+namespace detail {
+
+template<typename T>
+class TaskPromise;
+
+class TaskPromiseBase
+{
+public:
+    TaskPromiseBase()
+        : finished(nullptr)
+        , startCallId(0)
+        , started(false)
+        , detached(false)
+    {
+    }
+    ~TaskPromiseBase() { delete finished; }
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        template<typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+        {
+            TaskPromiseBase &promise = handle.promise();
+            if (promise.finished) {
+                promise.finished->set();
+            }
+            if (promise.continuation) {
+                return promise.continuation;
+            }
+            if (promise.detached) {
+                handle.destroy();
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept { }
+    };
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+public:
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    Event *finished;  // created by join().
+    int startCallId;
+    bool started;
+    bool detached;  // the frame destroys itself at the end.
+};
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object();
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T takeResult()
+    {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+    std::optional<T> value;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object();
+    void return_void() { }
+    void takeResult()
+    {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+}  // namespace detail
+
+// a task is started by start(), or when it is awaited by another task or joined by a stackful coroutine. it always
+// runs in the eventloop of its thread, so it must not call the blocking functions. wait by co_await instead.
+template<typename T = void>
+class Task
+{
+public:
+    typedef detail::TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    explicit Task(Handle handle)
+        : handle(handle)
+    {
+    }
+    Task(Task &&other) noexcept
+        : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() { reset(); }
+public:
+    bool isValid() const { return static_cast<bool>(handle); }
+    bool isFinished() const { return handle && handle.done(); }
+    void start();
+    // the task runs to the end without this object, the result and exception are dropped.
+    void detach();
+    // called from stackful coroutines. the exception of task is rethrown.
+    T join();
+    // co_await a task from another task.
+    bool await_ready() const noexcept { return !handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept;
+    T await_resume() { return handle.promise().takeResult(); }
+private:
+    void reset();
+    static void resumeStarted(void *address);
+    Handle handle;
+};
+
+template<typename T>
+void Task<T>::resumeStarted(void *address)
+{
+    Handle h = Handle::from_address(address);
+    h.promise().startCallId = 0;
+    h.resume();
+}
+
+template<typename T>
+void Task<T>::start()
+{
+    if (!handle || handle.promise().started) {
+        return;
+    }
+    handle.promise().started = true;
+    handle.promise().startCallId = TaskScheduler::callLater(0, &Task<T>::resumeStarted, handle.address());
+}
+
+template<typename T>
+void Task<T>::detach()
+{
+    if (!handle) {
+        return;
+    }
+    start();
+    if (handle.done()) {
+        handle.destroy();
+    } else {
+        handle.promise().detached = true;
+    }
+    handle = nullptr;
+}
+
+template<typename T>
+T Task<T>::join()
+{
+    start();
+    if (!handle.done()) {
+        if (!handle.promise().finished) {
+            handle.promise().finished = new Event();
+        }
+        TaskScheduler::wait(*handle.promise().finished);
+    }
+    return handle.promise().takeResult();
+}
+
+template<typename T>
+std::coroutine_handle<> Task<T>::await_suspend(std::coroutine_handle<> awaiting) noexcept
+{
+    promise_type &promise = handle.promise();
+    promise.continuation = awaiting;
+    if (promise.started) {
+        return std::noop_coroutine();
+    }
+    promise.started = true;
+    return handle;
+}
+
+template<typename T>
+void Task<T>::reset()
+{
+    if (!handle) {
+        return;
+    }
+    if (handle.promise().startCallId) {
+        TaskScheduler::cancelCall(handle.promise().startCallId);
+    }
+    handle.destroy();
+    handle = nullptr;
+}
+
+namespace detail {
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// the awaiters resume the task by a zero timer, so no eventloop callback is running when the awaiter is destroyed.
+class TaskAwaiterBase
+{
+public:
+    TaskAwaiterBase()
+        : callId(0)
+    {
+    }
+    ~TaskAwaiterBase()
+    {
+        if (callId) {
+            TaskScheduler::cancelCall(callId);
+        }
+    }
+    void wakeup()
+    {
+        if (!callId) {
+            callId = TaskScheduler::callLater(0, &TaskAwaiterBase::resumeNow, this);
+        }
+    }
+    static void resumeNow(void *data)
+    {
+        TaskAwaiterBase *self = static_cast<TaskAwaiterBase *>(data);
+        self->callId = 0;
+        self->handle.resume();
+    }
+    std::coroutine_handle<> handle;
+    int callId;
+};
+
+}  // namespace detail
+
+// co_await taskSleep(msecs);
+class TaskSleep : public detail::TaskAwaiterBase
+{
+public:
+    explicit TaskSleep(quint32 msecs)
+        : msecs(msecs)
+    {
+    }
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> awaiting)
+    {
+        handle = awaiting;
+        callId = TaskScheduler::callLater(msecs, &TaskAwaiterBase::resumeNow, static_cast<TaskAwaiterBase *>(this));
+    }
+    void await_resume() noexcept { }
+private:
+    const quint32 msecs;
+};
+
+inline TaskSleep taskSleep(quint32 msecs)
+{
+    return TaskSleep(msecs);
+}
+
+// co_await waitEvent(event, msecs) returns false if the event is not set in msecs, 0 waits forever. the event must
+// outlive the waiting.
+class TaskEventWaiter : public detail::TaskAwaiterBase
+{
+public:
+    TaskEventWaiter(Event &event, quint32 msecs)
+        : event(event)
+        , msecs(msecs)
+        , setCallbackId(0)
+        , timeoutId(0)
+        , timedOut(false)
+    {
+    }
+    ~TaskEventWaiter()
+    {
+        if (setCallbackId) {
+            event.removeSetCallback(setCallbackId);
+        }
+        if (timeoutId) {
+            TaskScheduler::cancelCall(timeoutId);
+        }
+    }
+    bool await_ready() const { return event.isSet(); }
+    void await_suspend(std::coroutine_handle<> awaiting)
+    {
+        handle = awaiting;
+        setCallbackId = event.addSetCallback([this] {
+            setCallbackId = 0;
+            wakeup();
+        });
+        if (msecs > 0) {
+            timeoutId = TaskScheduler::callLater(msecs, &TaskEventWaiter::onTimeout, this);
+        }
+    }
+    bool await_resume()
+    {
+        if (timeoutId) {
+            TaskScheduler::cancelCall(timeoutId);
+            timeoutId = 0;
+        }
+        return !timedOut && event.isSet();
+    }
+private:
+    static void onTimeout(void *data)
+    {
+        TaskEventWaiter *self = static_cast<TaskEventWaiter *>(data);
+        self->timeoutId = 0;
+        self->timedOut = true;
+        self->wakeup();
+    }
+    Event &event;
+    const quint32 msecs;
+    int setCallbackId;
+    int timeoutId;
+    bool timedOut;
+};
+
+inline TaskEventWaiter waitEvent(Event &event, quint32 msecs = 0)
+{
+    return TaskEventWaiter(event, msecs);
+}
+
+// co_await waitValue(valueEvent) returns the value sent, or a default value on timeout.
+template<typename Value>
+Task<Value> waitValue(ValueEvent<Value> &valueEvent, quint32 msecs = 0)
+{
+    if (!co_await waitEvent(valueEvent.event, msecs)) {
+        co_return Value();
+    }
+    co_return valueEvent.value;
+}
+
+// co_await waitReadable(socket) or waitWritable(socket) returns false on timeout or if the socket is closed.
+class TaskIoWaiter : public detail::TaskAwaiterBase
+{
+public:
+    TaskIoWaiter(QSharedPointer<Socket> socket, bool writing, quint32 msecs)
+        : socket(socket)
+        , msecs(msecs)
+        , watcherId(0)
+        , timeoutId(0)
+        , writing(writing)
+        , timedOut(false)
+    {
+    }
+    ~TaskIoWaiter()
+    {
+        if (watcherId) {
+            TaskScheduler::removeWatcher(watcherId);
+        }
+        if (timeoutId) {
+            TaskScheduler::cancelCall(timeoutId);
+        }
+    }
+    bool await_ready() const { return socket.isNull() || !socket->isValid(); }
+    void await_suspend(std::coroutine_handle<> awaiting)
+    {
+        handle = awaiting;
+        watcherId = TaskScheduler::watch(socket->fileno(), writing, &TaskIoWaiter::onReady, this);
+        if (msecs > 0) {
+            timeoutId = TaskScheduler::callLater(msecs, &TaskIoWaiter::onTimeout, this);
+        }
+    }
+    bool await_resume()
+    {
+        if (watcherId) {
+            TaskScheduler::removeWatcher(watcherId);
+            watcherId = 0;
+        }
+        if (timeoutId) {
+            TaskScheduler::cancelCall(timeoutId);
+            timeoutId = 0;
+        }
+        return !timedOut && !socket.isNull() && socket->isValid();
+    }
+private:
+    static void onReady(void *data)
+    {
+        TaskIoWaiter *self = static_cast<TaskIoWaiter *>(data);
+        TaskScheduler::stopWatching(self->watcherId);
+        self->wakeup();
+    }
+    static void onTimeout(void *data)
+    {
+        TaskIoWaiter *self = static_cast<TaskIoWaiter *>(data);
+        self->timeoutId = 0;
+        self->timedOut = true;
+        self->wakeup();
+    }
+    QSharedPointer<Socket> socket;
+    const quint32 msecs;
+    int watcherId;
+    int timeoutId;
+    const bool writing;
+    bool timedOut;
+};
+
+inline TaskIoWaiter waitReadable(QSharedPointer<Socket> socket, quint32 msecs = 0)
+{
+    return TaskIoWaiter(socket, false, msecs);
+}
+
+inline TaskIoWaiter waitWritable(QSharedPointer<Socket> socket, quint32 msecs = 0)
+{
+    return TaskIoWaiter(socket, true, msecs);
+}
+
+// the socket is read and written only after it is ready, so the calls do not block as long as no other coroutine
+// uses the same direction of the socket at the same time.
+inline Task<QByteArray> taskRecv(QSharedPointer<Socket> socket, qint32 size, quint32 msecs = 0)
+{
+    if (!co_await waitReadable(socket, msecs)) {
+        co_return QByteArray();
+    }
+    co_return socket->recv(size);
+}
+
+inline Task<qint32> taskSendall(QSharedPointer<Socket> socket, QByteArray data, quint32 msecs = 0)
+{
+    qint32 total = 0;
+    while (total < data.size()) {
+        if (!co_await waitWritable(socket, msecs)) {
+            break;
+        }
+        const qint32 sent = socket->send(data.constData() + total, data.size() - total);
+        if (sent <= 0) {
+            break;
+        }
+        total += sent;
+    }
+    co_return total;
+}
+
+// co_await a stackful coroutine, returns false if it is killed or deleted.
+inline Task<bool> joinCoroutine(QSharedPointer<Coroutine> coroutine)
+{
+    if (coroutine.isNull()) {
+        co_return false;
+    }
+    if (coroutine->isFinished()) {
+        co_return true;
+    }
+    Event done;
+    const int callbackId = coroutine->finished.addCallback([&done](BaseCoroutine *) { done.set(); });
+    co_await waitEvent(done);
+    coroutine->finished.remove(callbackId);
+    co_return coroutine->isFinished();
+}
+
+// run the blocking function in a new stackful coroutine, and co_await its result.
+template<typename T>
+Task<T> runInCoroutine(std::function<T()> func)
+{
+    QSharedPointer<std::optional<T>> result(new std::optional<T>());
+    QSharedPointer<Coroutine> coroutine(Coroutine::spawn([func, result] { result->emplace(func()); }));
+    co_await joinCoroutine(coroutine);
+    if (!result->has_value()) {
+        co_return T();
+    }
+    co_return std::move(**result);
+}
+
+inline Task<void> runInCoroutine(std::function<void()> func)
+{
+    QSharedPointer<Coroutine> coroutine(Coroutine::spawn(func));
+    co_await joinCoroutine(coroutine);
+}
+
+#endif  // QTNG_HAVE_TASK
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_TASK_H
@@ -0,0 +1,31 @@
+#ifndef QTNG_TRACING_H
+#define QTNG_TRACING_H
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qstring.h>
+#include "config.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// the trace points of coroutine switches, io waits, dns, connect, tls handshakes, http requests and data channels.
+// they are compiled in only if the library is built with QTNG_HAVE_TRACING (cmake -DQTNG_ENABLE_TRACING=ON, or
+// CONFIG += qtng_tracing), otherwise start() fails and the dumps are empty.
+//
+// every thread records into its own ring buffer, the oldest events are overwritten when it is full. the dump is in
+// the chrome trace event format, which chrome://tracing and ui.perfetto.dev open. threads are shown as processes
+// and coroutines as threads, so the spans of every coroutine are nested.
+class Tracing
+{
+public:
+    static bool isCompiledIn();
+    static bool start(int eventsPerThread = 64 * 1024);  // the buffers of previous recording are cleared.
+    static void stop();
+    static bool isRecording();
+    // stop() before dumping, the buffers are not locked against the recording threads.
+    static QByteArray chromeTrace();
+    static bool dumpChromeTrace(const QString &filePath);
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_TRACING_H
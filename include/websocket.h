@@ -0,0 +1,90 @@
+#ifndef QTNG_WEBSOCKET_H
+#define QTNG_WEBSOCKET_H
+
+#include "httpd.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+class HttpSession;
+class WebSocketPrivate;
+// the rfc 6455 websocket over an upgraded http/1.1 connection. messages are sent by any coroutine, and received by one
+// coroutine at a time, which answers the pings and the close frame of peer. the payloads are masked in place, and the
+// large messages are sent as fragments by one sendv(). permessage-deflate is used if both peers support it.
+class WebSocket
+{
+public:
+    enum MessageType {
+        TextMessage = 1,
+        BinaryMessage = 2,
+    };
+    enum CloseCode {
+        NormalClosure = 1000,
+        GoingAway = 1001,
+        ProtocolError = 1002,
+        UnsupportedData = 1003,
+        NoStatusReceived = 1005,
+        AbnormalClosure = 1006,
+        InvalidPayload = 1007,
+        PolicyViolation = 1008,
+        MessageTooBig = 1009,
+        InternalError = 1011,
+    };
+public:
+    // takes over the connection after the handshake, buffered is the bytes read after the http headers.
+    WebSocket(QSharedPointer<SocketLike> connection, const QByteArray &buffered, bool isClient, bool compressed);
+    ~WebSocket();
+    // the handshake of client, ws:// and wss:// urls are sent as http:// and https://. returns null if failed.
+    static QSharedPointer<WebSocket> connect(HttpSession *session, const QUrl &url, bool compression = true,
+                                             const QList<HttpHeader> &headers = QList<HttpHeader>());
+public:
+    bool sendMessage(const QByteArray &payload, MessageType type = BinaryMessage);
+    bool sendText(const QString &text) { return sendMessage(text.toUtf8(), TextMessage); }
+    bool sendBinary(const QByteArray &data) { return sendMessage(data, BinaryMessage); }
+    bool ping(const QByteArray &data = QByteArray());  // at most 125 bytes.
+    // blocked until a whole message is received, returns null after closed.
+    QByteArray recvMessage(MessageType *type = nullptr);
+    // send the close frame and close the connection.
+    void close(CloseCode code = NormalClosure, const QString &reason = QString());
+    void abort();
+public:
+    bool isClosed() const;
+    bool isCompressed() const;
+    quint16 closeCode() const;  // sent by the peer, or AbnormalClosure if the connection is broken.
+    QString closeReason() const;
+    void setMaxMessageSize(qint32 maxMessageSize);  // default to 16MB.
+    qint32 maxMessageSize() const;
+    void setFragmentSize(qint32 fragmentSize);  // the messages larger than it are fragmented, default to 64KB.
+    qint32 fragmentSize() const;
+    QSharedPointer<SocketLike> connection() const;
+private:
+    WebSocketPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(WebSocket)
+    friend class WebSocketRequestHandler;
+    Q_DISABLE_COPY(WebSocket)
+};
+
+// mask or unmask the bytes in place, offset is the position of data in the payload.
+void maskWebSocketPayload(char *data, qint64 size, const char key[4], qint64 offset = 0);
+
+// accepts the websocket upgrade of GET requests, and serves the websocket after the http handler is done, so the
+// request timeout does not apply.
+class WebSocketRequestHandler : public BaseHttpRequestHandler
+{
+public:
+    WebSocketRequestHandler();
+protected:
+    virtual void handle() override;
+    virtual void doGET() override;
+    virtual void serveWebSocket(QSharedPointer<WebSocket> webSocket) = 0;
+    // send the error and return false to refuse the handshake, such as checking the origin or path.
+    virtual bool acceptWebSocket();
+    // returns false if it is not a valid websocket request, in which case an error is sent.
+    bool upgradeToWebSocket();
+protected:
+    bool compression;  // default to true.
+    QSharedPointer<WebSocket> webSocket;
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif  // QTNG_WEBSOCKET_H
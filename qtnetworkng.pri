@@ -19,28 +19,47 @@ SOURCES += \
     $$PWD/src/io_utils.cpp \
     $$PWD/src/socket_utils.cpp \
     $$PWD/src/http_utils.cpp \
+    $$PWD/src/http_parser.cpp \
+    $$PWD/src/http2.cpp \
     $$PWD/src/http_proxy.cpp \
     $$PWD/src/http_cookie.cpp \
     $$PWD/src/socks5_proxy.cpp \
     $$PWD/src/eventloop_qt.cpp \
     $$PWD/src/msgpack.cpp \
+    $$PWD/src/json_stream.cpp \
     $$PWD/src/kcp.cpp \
+    $$PWD/src/kcp_fec.cpp \
     $$PWD/src/kcp/ikcp.c \
     $$PWD/src/socket_server.cpp \
     $$PWD/src/httpd.cpp \
     $$PWD/src/httpd2.cpp \
+    $$PWD/src/http_router.cpp \
+    $$PWD/src/websocket.cpp \
     $$PWD/src/socks5_server.cpp \
     $$PWD/src/random.cpp \
     $$PWD/src/hostaddress.cpp \
+    $$PWD/src/dns.cpp \
+    $$PWD/src/compression.cpp \
+    $$PWD/src/metrics.cpp \
+    $$PWD/src/buffer_budget.cpp \
+    $$PWD/src/tracing.cpp \
+    $$PWD/src/task.cpp \
+    $$PWD/src/access_log.cpp \
+    $$PWD/src/rpc.cpp \
     $$PWD/src/network_interface/network_interface.cpp
 
     
 PRIVATE_HEADERS += \
     $$PWD/include/private/coroutine_p.h \
     $$PWD/include/private/http_p.h \
+    $$PWD/include/private/http_parser_p.h \
+    $$PWD/include/private/http2_p.h \
     $$PWD/include/private/socket_p.h \
     $$PWD/include/private/hostaddress_p.h \
     $$PWD/include/private/network_interface_p.h \
+    $$PWD/include/private/kcp_fec_p.h \
+    $$PWD/include/private/tracing_p.h \
+    $$PWD/include/private/socks5_p.h \
     $$PWD/src/kcp/ikcp.h
 
     
@@ -60,19 +79,31 @@ HEADERS += \
     $$PWD/include/socks5_proxy.h \
     $$PWD/include/deferred.h \
     $$PWD/include/msgpack.h \
+    $$PWD/include/json_stream.h \
     $$PWD/include/kcp.h \
     $$PWD/include/socket_server.h \
     $$PWD/include/httpd.h \
+    $$PWD/include/http_router.h \
+    $$PWD/include/websocket.h \
     $$PWD/include/random.h \
     $$PWD/include/hostaddress.h \
+    $$PWD/include/dns.h \
+    $$PWD/include/compression.h \
+    $$PWD/include/metrics.h \
+    $$PWD/include/buffer_budget.h \
+    $$PWD/include/tracing.h \
+    $$PWD/include/task.h \
+    $$PWD/include/access_log.h \
+    $$PWD/include/rpc.h \
     $$PWD/include/network_interface.h
 
     
 win32 {
     SOURCES += $$PWD/src/socket_win.cpp \
         $$PWD/src/eventloop_win.cpp \
+        $$PWD/src/eventloop_iocp.cpp \
         $$PWD/src/network_interface/network_interface_win.cpp
-    LIBS += -lws2_32 -luser32
+    LIBS += -lws2_32 -luser32 -lmswsock
     DEFINES += "QTNETWORKNG_USE_WIN=1"
 } else: unix  {
     SOURCES += $$PWD/src/socket_unix.cpp \
@@ -87,16 +118,22 @@ win32 {
         DEFINES += "EV_USE_EVENTFD=1"
         DEFINES += "EV_USE_KQUEUE=0"
         DEFINES += "EV_USE_POLL=0"
+        DEFINES += "QTNETWORKNG_USE_EPOLL=1"
+        SOURCES += $$PWD/src/eventloop_epoll.cpp
     } else: netbsd { # use poll
         DEFINES += "EV_USE_EPOLL=0"
         DEFINES += "EV_USE_EVENTFD=0"
         DEFINES += "EV_USE_KQUEUE=0"
         DEFINES += "EV_USE_POLL=1"
-    } else: bsd {
+        DEFINES += "QTNETWORKNG_USE_KQUEUE=1"
+        SOURCES += $$PWD/src/eventloop_kqueue.cpp
+    } else: mac|bsd {
         DEFINES += "EV_USE_EPOLL=0"
         DEFINES += "EV_USE_EVENTFD=0"
         DEFINES += "EV_USE_KQUEUE=1"
         DEFINES += "EV_USE_POLL=0"
+        DEFINES += "QTNETWORKNG_USE_KQUEUE=1"
+        SOURCES += $$PWD/src/eventloop_kqueue.cpp
     } else {
         DEFINES += "EV_USE_EPOLL=0"
         DEFINES += "EV_USE_EVENTFD=0"
@@ -117,6 +154,7 @@ qtng_crypto {
     HEADERS += $$PWD/include/config.h \
         $$PWD/include/crypto.h \
         $$PWD/include/ssl.h \
+        $$PWD/include/ocsp.h \
         $$PWD/include/md.h \
         $$PWD/include/cipher.h \
         $$PWD/include/pkey.h \
@@ -124,6 +162,7 @@ qtng_crypto {
         $$PWD/include/qtcrypto.h
 
     SOURCES += $$PWD/src/ssl.cpp \
+        $$PWD/src/ocsp.cpp \
         $$PWD/src/crypto.cpp \
         $$PWD/src/md.cpp \
         $$PWD/src/pkey.cpp \
@@ -136,6 +175,29 @@ qtng_crypto {
     DEFINES += "QTNG_NO_CRYPTO=1"
 }
 
+# CONFIG += qtng_zstd qtng_brotli to support these content codings.
+qtng_zstd {
+    DEFINES += "QTNG_HAVE_ZSTD=1"
+    LIBS += -lzstd
+}
+
+qtng_brotli {
+    DEFINES += "QTNG_HAVE_BROTLI=1"
+    LIBS += -lbrotlienc -lbrotlidec
+}
+
+# CONFIG += qtng_zlib_ng to link zlib-ng built with ZLIB_COMPAT, whose deflate and crc32 use simd. its zlib.h must be
+# found before the one of qt or system.
+qtng_zlib_ng {
+    DEFINES += "QTNG_HAVE_ZLIB_NG=1"
+    LIBS += -lz
+}
+
+# CONFIG += qtng_tracing to compile in the trace points, see include/tracing.h
+qtng_tracing {
+    DEFINES += "QTNG_HAVE_TRACING=1"
+}
+
 # decide which fcontext asm file to use.
 android {
     equals(ANDROID_ARCHITECTURE, x86) {
@@ -224,7 +286,12 @@ android {
         SOURCES += $$PWD/src/context/asm/jump_mips32_o32_elf_gas.S \
             $$PWD/src/context/asm/make_mips32_o32_elf_gas.S \
             $$PWD/src/coroutine_fcontext.cpp
+    } else: equals(QT_ARCH, riscv64) {
+        SOURCES += $$PWD/src/context/asm/jump_riscv64_sysv_elf_gas.S \
+            $$PWD/src/context/asm/make_riscv64_sysv_elf_gas.S \
+            $$PWD/src/coroutine_fcontext.cpp
     } else {
+        # swapcontext() makes a syscall every switch, it is the last resort.
         SOURCES += $$PWD/src/coroutine_unix.cpp
     }
 } else: win32 {
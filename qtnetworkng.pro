@@ -7,6 +7,7 @@ TEMPLATE = lib
 TESTS_SOURCES = tests/simple_test.cpp \
     tests/many_httpget.cpp \
     tests/sleep_coroutines.cpp \
+    tests/qtng_bench.cpp \
     tests/test_crypto.cpp \
     tests/test_ssl.cpp \
     tests/test_coroutines.cpp
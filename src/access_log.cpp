@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <string.h>
+#include <QtCore/qdatetime.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qthread.h>
+#include <QtCore/qwaitcondition.h>
+#include "../include/access_log.h"
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.access_log");
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+namespace {
+
+enum AccessLogKind {
+    RequestRecord,
+    ErrorRecord,
+    ProxyRecord,
+};
+
+// followed by the utf-8 bytes of method (or command), path (or target) and message.
+struct AccessLogRecordHeader
+{
+    quint32 size;  // the whole record, including the strings.
+    quint8 kind;
+    quint8 success;
+    quint8 peerProtocol;
+    quint8 forwardProtocol;
+    quint16 port;
+    quint16 lengths[3];
+    qint32 status;
+    qint64 msecs;
+    qint64 bytes;
+    quint8 peer[16];
+    quint8 forward[16];
+};
+
+const int MaxFieldSize = 4096;
+
+void packAddress(const HostAddress &address, quint8 *protocol, quint8 *buf)
+{
+    if (address.protocol() == HostAddress::IPv4Protocol) {
+        *protocol = HostAddress::IPv4Protocol;
+        const quint32 ipv4 = address.toIPv4Address();
+        memcpy(buf, &ipv4, sizeof(ipv4));
+    } else if (address.protocol() == HostAddress::IPv6Protocol) {
+        *protocol = HostAddress::IPv6Protocol;
+        memcpy(buf, address.toIPv6Address().c, 16);
+    } else {
+        *protocol = 0;
+    }
+}
+
+HostAddress unpackAddress(quint8 protocol, const quint8 *buf)
+{
+    HostAddress address;
+    if (protocol == HostAddress::IPv4Protocol) {
+        quint32 ipv4;
+        memcpy(&ipv4, buf, sizeof(ipv4));
+        address.setAddress(ipv4);
+    } else if (protocol == HostAddress::IPv6Protocol) {
+        address.setAddress(buf);
+    }
+    return address;
+}
+
+}  // anonymous namespace
+
+class AccessLogWriter : public QThread
+{
+public:
+    explicit AccessLogWriter(AccessLogPrivate *d)
+        : d(d)
+    {
+    }
+protected:
+    virtual void run() override;
+private:
+    AccessLogPrivate * const d;
+};
+
+class AccessLogPrivate
+{
+public:
+    AccessLogPrivate(const QString &filePath);
+    ~AccessLogPrivate();
+    void append(AccessLogRecordHeader *header, const QByteArray &a, const QByteArray &b, const QByteArray &c);
+    void format(const QByteArray &records, QByteArray *out);
+    void appendTime(qint64 msecs, QByteArray *out);
+public:
+    QFile file;
+    QMutex mutex;
+    QWaitCondition hasRecords;
+    QWaitCondition written;
+    QByteArray buffer;  // filled by the eventloops.
+    AccessLogWriter writer;
+    quint64 dropped;
+    quint64 appended;  // the records appended and written, for flush().
+    quint64 writtenRecords;
+    int maxBufferSize;
+    bool stopping;
+    // the formatted time of last second, used by the writer only.
+    qint64 cachedSecond;
+    QByteArray cachedTime;
+};
+
+AccessLogPrivate::AccessLogPrivate(const QString &filePath)
+    : writer(this)
+    , dropped(0)
+    , appended(0)
+    , writtenRecords(0)
+    , maxBufferSize(1024 * 1024 * 4)
+    , stopping(false)
+    , cachedSecond(-1)
+{
+    bool ok;
+    if (filePath.isEmpty()) {
+        ok = file.open(stdout, QIODevice::WriteOnly | QIODevice::Unbuffered);
+    } else {
+        file.setFileName(filePath);
+        ok = file.open(QIODevice::WriteOnly | QIODevice::Append);
+    }
+    if (!ok) {
+        qtng_warning << "can not open access log:" << filePath << file.errorString();
+    }
+    buffer.reserve(maxBufferSize);
+    writer.start(QThread::LowPriority);
+}
+
+AccessLogPrivate::~AccessLogPrivate()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        hasRecords.wakeOne();
+    }
+    writer.wait();
+}
+
+void AccessLogPrivate::append(AccessLogRecordHeader *header, const QByteArray &a, const QByteArray &b,
+                              const QByteArray &c)
+{
+    header->lengths[0] = static_cast<quint16>(qMin(a.size(), MaxFieldSize));
+    header->lengths[1] = static_cast<quint16>(qMin(b.size(), MaxFieldSize));
+    header->lengths[2] = static_cast<quint16>(qMin(c.size(), MaxFieldSize));
+    header->size = static_cast<quint32>(sizeof(AccessLogRecordHeader)) + header->lengths[0] + header->lengths[1]
+            + header->lengths[2];
+    QMutexLocker locker(&mutex);
+    if (buffer.size() + static_cast<int>(header->size) > maxBufferSize) {
+        ++dropped;
+        return;
+    }
+    buffer.append(reinterpret_cast<const char *>(header), sizeof(AccessLogRecordHeader));
+    buffer.append(a.constData(), header->lengths[0]);
+    buffer.append(b.constData(), header->lengths[1]);
+    buffer.append(c.constData(), header->lengths[2]);
+    ++appended;
+    if (buffer.size() >= maxBufferSize / 2) {
+        hasRecords.wakeOne();
+    }
+}
+
+void AccessLogPrivate::appendTime(qint64 msecs, QByteArray *out)
+{
+    const qint64 second = msecs / 1000;
+    if (second != cachedSecond) {
+        cachedSecond = second;
+        cachedTime = QDateTime::fromMSecsSinceEpoch(second * 1000).toString(Qt::ISODate).toLatin1();
+    }
+    out->append(cachedTime);
+}
+
+void AccessLogPrivate::format(const QByteArray &records, QByteArray *out)
+{
+    char buf[64];
+    int pos = 0;
+    while (pos + static_cast<int>(sizeof(AccessLogRecordHeader)) <= records.size()) {
+        AccessLogRecordHeader header;
+        memcpy(&header, records.constData() + pos, sizeof(header));
+        const char *p = records.constData() + pos + sizeof(header);
+        const QByteArray first = QByteArray::fromRawData(p, header.lengths[0]);
+        const QByteArray second = QByteArray::fromRawData(p + header.lengths[0], header.lengths[1]);
+        const QByteArray third = QByteArray::fromRawData(p + header.lengths[0] + header.lengths[1], header.lengths[2]);
+        pos += static_cast<int>(header.size);
+
+        out->append(unpackAddress(header.peerProtocol, header.peer).toString().toLatin1());
+        out->append(" -- ");
+        appendTime(header.msecs, out);
+        out->append(' ');
+        out->append(first);
+        out->append(' ');
+        out->append(second);
+        if (header.kind == ProxyRecord) {
+            out->append(" -> ");
+            out->append(unpackAddress(header.forwardProtocol, header.forward).toString().toLatin1());
+            const int len = qsnprintf(buf, sizeof(buf), ":%u %s\n", static_cast<unsigned>(header.port),
+                                      header.success ? "OK" : "FAIL");
+            out->append(buf, len);
+        } else if (header.kind == ErrorRecord) {
+            const int len = qsnprintf(buf, sizeof(buf), " %d ", static_cast<int>(header.status));
+            out->append(buf, len);
+            out->append(third);
+            out->append('\n');
+        } else {
+            const int len = qsnprintf(buf, sizeof(buf), " %d %lld\n", static_cast<int>(header.status),
+                                      static_cast<long long>(header.bytes));
+            out->append(buf, len);
+        }
+    }
+}
+
+void AccessLogWriter::run()
+{
+    QByteArray records;
+    records.reserve(d->maxBufferSize);
+    QByteArray out;
+    while (true) {
+        quint64 count;
+        bool stopping;
+        {
+            QMutexLocker locker(&d->mutex);
+            if (d->buffer.isEmpty() && !d->stopping) {
+                // the records are written at least every 100ms.
+                d->hasRecords.wait(&d->mutex, 100);
+            }
+            records.swap(d->buffer);
+            count = d->appended;
+            stopping = d->stopping;
+        }
+        if (!records.isEmpty()) {
+            d->format(records, &out);
+            if (d->file.isOpen()) {
+                d->file.write(out);
+                d->file.flush();
+            }
+            out.resize(0);
+            records.resize(0);
+        }
+        {
+            QMutexLocker locker(&d->mutex);
+            d->writtenRecords = count;
+            d->written.wakeAll();
+        }
+        if (stopping) {
+            QMutexLocker locker(&d->mutex);
+            if (d->buffer.isEmpty()) {
+                return;
+            }
+        }
+    }
+}
+
+AccessLog::AccessLog(const QString &filePath)
+    : d_ptr(new AccessLogPrivate(filePath))
+{
+}
+
+AccessLog::~AccessLog()
+{
+    delete d_ptr;
+}
+
+void AccessLog::logRequest(const HostAddress &peer, const QString &method, const QString &path, int status,
+                           qint64 bodySize)
+{
+    Q_D(AccessLog);
+    AccessLogRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.kind = RequestRecord;
+    header.status = status;
+    header.bytes = bodySize;
+    header.msecs = QDateTime::currentMSecsSinceEpoch();
+    packAddress(peer, &header.peerProtocol, header.peer);
+    d->append(&header, method.toUtf8(), path.toUtf8(), QByteArray());
+}
+
+void AccessLog::logError(const HostAddress &peer, const QString &method, const QString &path, int status,
+                         const QString &message)
+{
+    Q_D(AccessLog);
+    AccessLogRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.kind = ErrorRecord;
+    header.status = status;
+    header.msecs = QDateTime::currentMSecsSinceEpoch();
+    packAddress(peer, &header.peerProtocol, header.peer);
+    d->append(&header, method.toUtf8(), path.toUtf8(), message.toUtf8());
+}
+
+void AccessLog::logProxy(const HostAddress &peer, const QString &command, const QString &target, quint16 port,
+                         const HostAddress &forwardAddress, bool success)
+{
+    Q_D(AccessLog);
+    AccessLogRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.kind = ProxyRecord;
+    header.success = success ? 1 : 0;
+    header.port = port;
+    header.msecs = QDateTime::currentMSecsSinceEpoch();
+    packAddress(peer, &header.peerProtocol, header.peer);
+    packAddress(forwardAddress, &header.forwardProtocol, header.forward);
+    d->append(&header, command.toUtf8(), target.toUtf8(), QByteArray());
+}
+
+int AccessLog::maxBufferSize() const
+{
+    Q_D(const AccessLog);
+    QMutexLocker locker(&const_cast<AccessLogPrivate *>(d)->mutex);
+    return d->maxBufferSize;
+}
+
+void AccessLog::setMaxBufferSize(int maxBufferSize)
+{
+    Q_D(AccessLog);
+    QMutexLocker locker(&d->mutex);
+    d->maxBufferSize = qMax(maxBufferSize, 1024);
+}
+
+quint64 AccessLog::droppedRecords() const
+{
+    Q_D(const AccessLog);
+    QMutexLocker locker(&const_cast<AccessLogPrivate *>(d)->mutex);
+    return d->dropped;
+}
+
+void AccessLog::flush()
+{
+    Q_D(AccessLog);
+    QMutexLocker locker(&d->mutex);
+    const quint64 target = d->appended;
+    d->hasRecords.wakeOne();
+    while (d->writtenRecords < target) {
+        d->written.wait(&d->mutex);
+    }
+}
+
+QTNETWORKNG_NAMESPACE_END
@@ -0,0 +1,260 @@
+#include <QtCore/qthreadstorage.h>
+#include "../include/buffer_budget.h"
+#include "../include/eventloop.h"
+#include "../include/locks.h"
+#include "../include/metrics.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+namespace {
+
+struct BufferBudgetMetrics
+{
+    BufferBudgetMetrics();
+    MetricGauge *used[BufferBudget::ConsumerCount];
+};
+
+BufferBudgetMetrics::BufferBudgetMetrics()
+{
+    MetricsRegistry *registry = MetricsRegistry::instance();
+    used[BufferBudget::DataChannelReceiving] = registry->gauge("qtng_buffer_data_channel_receiving_bytes",
+                                                               "Bytes received by DataChannel but not taken yet.");
+    used[BufferBudget::DataChannelSending] =
+            registry->gauge("qtng_buffer_data_channel_sending_bytes", "Bytes queued by DataChannel but not sent yet.");
+    used[BufferBudget::Exchanger] =
+            registry->gauge("qtng_buffer_exchanger_bytes", "Bytes received by Exchanger but not forwarded yet.");
+    used[BufferBudget::HttpBody] = registry->gauge("qtng_buffer_http_body_bytes", "Bytes of HttpResponse bodies.");
+    used[BufferBudget::KcpSending] =
+            registry->gauge("qtng_buffer_kcp_sending_bytes", "Bytes queued by KcpSocket but not acknowledged yet.");
+}
+
+BufferBudgetMetrics &bufferBudgetMetrics()
+{
+    static BufferBudgetMetrics metrics;
+    return metrics;
+}
+
+}  // namespace
+
+class BufferBudgetPrivate
+{
+public:
+    explicit BufferBudgetPrivate(QSharedPointer<BufferBudget> parent);
+public:
+    bool exceeds(qint64 bytes) const;
+    const QSharedPointer<BufferBudget> parent;
+    ThreadEvent room;  // set while the soft limit is not reached.
+    QAtomicInteger<qint64> used;
+    QAtomicInteger<qint64> usedBy[BufferBudget::ConsumerCount];
+    QAtomicInteger<qint64> softLimit;
+    QAtomicInteger<qint64> hardLimit;
+};
+
+BufferBudgetPrivate::BufferBudgetPrivate(QSharedPointer<BufferBudget> parent)
+    : parent(parent)
+    , used(0)
+    , softLimit(0)
+    , hardLimit(0)
+{
+    for (int i = 0; i < BufferBudget::ConsumerCount; ++i) {
+        usedBy[i].store(0);
+    }
+    room.set();
+}
+
+bool BufferBudgetPrivate::exceeds(qint64 bytes) const
+{
+    qint64 limit = hardLimit.loadAcquire();
+    if (limit > 0 && used.loadAcquire() + bytes > limit) {
+        return true;
+    }
+    return !parent.isNull() && parent->d_func()->exceeds(bytes);
+}
+
+BufferBudget::BufferBudget(QSharedPointer<BufferBudget> parent)
+    : d_ptr(new BufferBudgetPrivate(parent))
+{
+}
+
+BufferBudget::~BufferBudget()
+{
+    delete d_ptr;
+}
+
+QSharedPointer<BufferBudget> BufferBudget::global()
+{
+    static QSharedPointer<BufferBudget> budget(new BufferBudget(QSharedPointer<BufferBudget>()));
+    return budget;
+}
+
+Q_GLOBAL_STATIC(QThreadStorage<QSharedPointer<BufferBudget>>, localBudgets)
+
+QSharedPointer<BufferBudget> BufferBudget::current()
+{
+    QThreadStorage<QSharedPointer<BufferBudget>> *storage = localBudgets();
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(QSharedPointer<BufferBudget>(new BufferBudget(global())));
+    }
+    return storage->localData();
+}
+
+void BufferBudget::setLimits(qint64 softLimit, qint64 hardLimit)
+{
+    Q_D(BufferBudget);
+    d->softLimit.storeRelease(qMax<qint64>(softLimit, 0));
+    d->hardLimit.storeRelease(qMax<qint64>(hardLimit, 0));
+    if (softLimit <= 0 || d->used.loadAcquire() < softLimit) {
+        d->room.set();
+    } else {
+        d->room.clear();
+    }
+}
+
+qint64 BufferBudget::softLimit() const
+{
+    Q_D(const BufferBudget);
+    return d->softLimit.loadAcquire();
+}
+
+qint64 BufferBudget::hardLimit() const
+{
+    Q_D(const BufferBudget);
+    return d->hardLimit.loadAcquire();
+}
+
+qint64 BufferBudget::used() const
+{
+    Q_D(const BufferBudget);
+    return d->used.loadAcquire();
+}
+
+qint64 BufferBudget::used(Consumer consumer) const
+{
+    Q_D(const BufferBudget);
+    return d->usedBy[consumer].loadAcquire();
+}
+
+void BufferBudget::charge(Consumer consumer, qint64 bytes)
+{
+    Q_D(BufferBudget);
+    if (bytes <= 0) {
+        return;
+    }
+    d->usedBy[consumer].fetchAndAddRelaxed(bytes);
+    qint64 used = d->used.fetchAndAddAcquire(bytes) + bytes;
+    qint64 limit = d->softLimit.loadAcquire();
+    if (limit > 0 && used >= limit) {
+        d->room.clear();
+    }
+    if (d->parent.isNull()) {
+        bufferBudgetMetrics().used[consumer]->add(bytes);
+    } else {
+        d->parent->charge(consumer, bytes);
+    }
+}
+
+bool BufferBudget::tryCharge(Consumer consumer, qint64 bytes)
+{
+    Q_D(BufferBudget);
+    if (d->exceeds(bytes)) {
+        return false;
+    }
+    charge(consumer, bytes);
+    return true;
+}
+
+void BufferBudget::release(Consumer consumer, qint64 bytes)
+{
+    Q_D(BufferBudget);
+    if (bytes <= 0) {
+        return;
+    }
+    d->usedBy[consumer].fetchAndSubRelaxed(bytes);
+    qint64 used = d->used.fetchAndSubRelease(bytes) - bytes;
+    qint64 limit = d->softLimit.loadAcquire();
+    if (limit <= 0 || used < limit) {
+        d->room.set();
+    }
+    if (d->parent.isNull()) {
+        bufferBudgetMetrics().used[consumer]->sub(bytes);
+    } else {
+        d->parent->release(consumer, bytes);
+    }
+}
+
+bool BufferBudget::isPressured() const
+{
+    Q_D(const BufferBudget);
+    return !d->room.isSet() || (!d->parent.isNull() && d->parent->isPressured());
+}
+
+bool BufferBudget::waitForRoom(float timeout)
+{
+    Q_D(BufferBudget);
+    try {
+        Timeout t(timeout);
+        Q_UNUSED(t);
+        // the room of this thread is waited first, then the global room.
+        if (!d->room.wait()) {
+            return false;
+        }
+        if (!d->parent.isNull() && !d->parent->d_func()->room.wait()) {
+            return false;
+        }
+    } catch (TimeoutException &) {
+        return !isPressured();
+    }
+    return true;
+}
+
+BufferCharge::BufferCharge(BufferBudget::Consumer consumer)
+    : budget(BufferBudget::current())
+    , consumer(consumer)
+    , bytes(0)
+{
+}
+
+BufferCharge::~BufferCharge()
+{
+    budget->release(consumer, bytes);
+}
+
+void BufferCharge::add(qint64 bytes)
+{
+    if (bytes > 0) {
+        budget->charge(consumer, bytes);
+        this->bytes += bytes;
+    }
+}
+
+bool BufferCharge::tryAdd(qint64 bytes)
+{
+    if (bytes <= 0) {
+        return true;
+    }
+    if (!budget->tryCharge(consumer, bytes)) {
+        return false;
+    }
+    this->bytes += bytes;
+    return true;
+}
+
+void BufferCharge::sub(qint64 bytes)
+{
+    bytes = qMin(bytes, this->bytes);
+    if (bytes > 0) {
+        budget->release(consumer, bytes);
+        this->bytes -= bytes;
+    }
+}
+
+void BufferCharge::set(qint64 bytes)
+{
+    if (bytes > this->bytes) {
+        add(bytes - this->bytes);
+    } else {
+        sub(this->bytes - bytes);
+    }
+}
+
+QTNETWORKNG_NAMESPACE_END
@@ -15,7 +15,7 @@ QTNG_LOGGER("qtng.certificate");
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
-static QDateTime getTimeFromASN1(const ASN1_TIME *aTime)
+QDateTime getTimeFromASN1(const ASN1_TIME *aTime)
 {
     size_t lTimeLength = static_cast<size_t>(aTime->length);
     char *pString = reinterpret_cast<char *>(aTime->data);
@@ -192,6 +192,7 @@ public:
     CipherPrivate(Cipher::Algorithm algo, Cipher::Mode mode, Cipher::Operation operation);
     ~CipherPrivate();
     QByteArray addData(const char *data, int len);
+    int update(const char *in, int len, char *out);
     QByteArray finalData();
     QPair<QByteArray, QByteArray> bytesToKey(const QByteArray &password, MessageDigest::Algorithm hashAlgo,
                                              const QByteArray &salt, int i);
@@ -326,18 +327,30 @@ QByteArray CipherPrivate::addData(const char *data, int len)
     }
     QByteArray out;
     out.resize(len + EVP_MAX_BLOCK_LENGTH);
-    int outl = 0;
-    int rvalue = EVP_CipherUpdate(context, reinterpret_cast<unsigned char *>(out.data()), &outl,
-                                  reinterpret_cast<const unsigned char *>(data), len);
-    if (rvalue) {
+    int outl = update(data, len, out.data());
+    if (outl >= 0) {
         out.resize(outl);
         return out;
     } else {
-        hasError = true;
         return QByteArray();
     }
 }
 
+int CipherPrivate::update(const char *in, int len, char *out)
+{
+    if (!context || !inited || hasError) {
+        return -1;
+    }
+    int outl = 0;
+    int rvalue = EVP_CipherUpdate(context, reinterpret_cast<unsigned char *>(out), &outl,
+                                  reinterpret_cast<const unsigned char *>(in), len);
+    if (!rvalue) {
+        hasError = true;
+        return -1;
+    }
+    return outl;
+}
+
 QByteArray CipherPrivate::finalData()
 {
     if (!context || !inited || hasError) {
@@ -480,6 +493,12 @@ QByteArray Cipher::addData(const char *data, int len)
     return d->addData(data, len);
 }
 
+int Cipher::update(const char *in, int len, char *out)
+{
+    Q_D(Cipher);
+    return d->update(in, len, out);
+}
+
 QByteArray Cipher::finalData()
 {
     Q_D(Cipher);
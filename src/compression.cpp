@@ -0,0 +1,759 @@
+#include "../include/compression.h"
+#include <string.h>
+#ifdef QTNG_HAVE_ZLIB
+#  include "../include/gzip.h"
+#endif
+#ifdef QTNG_HAVE_ZSTD
+#  include <zstd.h>
+#endif
+#ifdef QTNG_HAVE_BROTLI
+#  include <brotli/encode.h>
+#  include <brotli/decode.h>
+#endif
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+static const qint32 DefaultInputBufferSize = 1024 * 8;
+static const qint32 DefaultOutputBufferSize = 1024 * 32;
+static const int DefaultZstdLevel = 3;
+static const int DefaultBrotliQuality = 5;
+
+// returns the bytes read from buf, which is filled by compress() until it has enough bytes or the input ends.
+template<typename P>
+static qint32 readCompressed(P *d, char *data, qint32 size)
+{
+    QByteArray inBuf;
+    while (d->buf.size() < size && !d->eof) {
+        if (inBuf.isEmpty()) {
+            inBuf.resize(DefaultInputBufferSize);
+        }
+        qint32 readBytes = d->backend->read(inBuf.data(), inBuf.size());
+        if (readBytes < 0) {
+            d->hasError = true;
+            return -1;
+        } else if (readBytes == 0) {
+            d->eof = true;
+        }
+        if (!d->compress(inBuf.constData(), readBytes, d->eof)) {
+            d->hasError = true;
+            return -1;
+        }
+    }
+    qint32 bytesToRead = qMin(size, d->buf.size());
+    memcpy(data, d->buf.constData(), static_cast<size_t>(bytesToRead));
+    d->buf.remove(0, bytesToRead);
+    return bytesToRead;
+}
+
+template<typename P>
+static qint32 writeCompressed(P *d, const char *data, qint32 size)
+{
+    if (d->eof) {
+        return size == 0 ? 0 : -1;
+    }
+    d->eof = (size == 0);
+    if (!d->compress(data, size, d->eof)) {
+        d->hasError = true;
+        return -1;
+    }
+    qint32 bytesWritten = d->backend->write(d->buf.constData(), d->buf.size());
+    bool success = (bytesWritten == d->buf.size());
+    d->buf.clear();
+    if (!success) {
+        d->hasError = true;
+        return -1;
+    }
+    return size;
+}
+
+class ZstdCompressFilePrivate
+{
+public:
+    ZstdCompressFilePrivate(QSharedPointer<FileLike> backend, int level);
+    ~ZstdCompressFilePrivate();
+    bool compress(const char *data, qint32 size, bool end);  // appends the output to buf.
+public:
+    QSharedPointer<FileLike> backend;
+    QByteArray buf;
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_CCtx *cctx;  // null if failed to initialize.
+#endif
+    bool hasError;
+    bool eof;
+};
+
+ZstdCompressFilePrivate::ZstdCompressFilePrivate(QSharedPointer<FileLike> backend, int level)
+    : backend(backend)
+    , hasError(false)
+    , eof(false)
+{
+#ifdef QTNG_HAVE_ZSTD
+    cctx = ZSTD_createCCtx();
+    if (cctx && ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level))) {
+        ZSTD_freeCCtx(cctx);
+        cctx = nullptr;
+    }
+    hasError = (cctx == nullptr);
+#else
+    Q_UNUSED(level);
+    hasError = true;
+#endif
+}
+
+ZstdCompressFilePrivate::~ZstdCompressFilePrivate()
+{
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_freeCCtx(cctx);
+#endif
+}
+
+bool ZstdCompressFilePrivate::compress(const char *data, qint32 size, bool end)
+{
+#ifdef QTNG_HAVE_ZSTD
+    const int chunkSize = static_cast<int>(ZSTD_CStreamOutSize());
+    ZSTD_inBuffer in = { data, static_cast<size_t>(size), 0 };
+    size_t remaining;
+    do {
+        const int oldSize = buf.size();
+        buf.resize(oldSize + chunkSize);
+        ZSTD_outBuffer out = { buf.data() + oldSize, static_cast<size_t>(chunkSize), 0 };
+        remaining = ZSTD_compressStream2(cctx, &out, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+        buf.resize(oldSize + static_cast<int>(out.pos));
+        if (ZSTD_isError(remaining)) {
+            return false;
+        }
+    } while (end ? remaining > 0 : in.pos < in.size);
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    Q_UNUSED(end);
+    return false;
+#endif
+}
+
+ZstdCompressFile::ZstdCompressFile(QSharedPointer<FileLike> backend, int level)
+    : d_ptr(new ZstdCompressFilePrivate(backend, level))
+{
+}
+
+ZstdCompressFile::~ZstdCompressFile()
+{
+    delete d_ptr;
+}
+
+qint32 ZstdCompressFile::read(char *data, qint32 size)
+{
+    Q_D(ZstdCompressFile);
+    if (d->hasError) {
+        return -1;
+    }
+    return readCompressed(d, data, size);
+}
+
+qint32 ZstdCompressFile::write(const char *data, qint32 size)
+{
+    Q_D(ZstdCompressFile);
+    if (d->hasError) {
+        return -1;
+    }
+    return writeCompressed(d, data, size);
+}
+
+class ZstdDecompressFilePrivate
+{
+public:
+    ZstdDecompressFilePrivate(QSharedPointer<FileLike> backend);
+    ~ZstdDecompressFilePrivate();
+public:
+    QSharedPointer<FileLike> backend;
+    QByteArray inBuf;
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_DCtx *dctx;  // null if failed to initialize.
+    ZSTD_inBuffer in;  // points to inBuf.
+    size_t lastHint;  // 0 if the last frame is decoded and flushed.
+#endif
+    bool pendingOutput;  // the last output buffer is full, there may be more in dctx.
+    bool hasError;
+    bool eof;
+};
+
+ZstdDecompressFilePrivate::ZstdDecompressFilePrivate(QSharedPointer<FileLike> backend)
+    : backend(backend)
+    , pendingOutput(false)
+    , hasError(false)
+    , eof(false)
+{
+#ifdef QTNG_HAVE_ZSTD
+    dctx = ZSTD_createDCtx();
+    if (dctx && ZSTD_isError(ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, 23))) {
+        ZSTD_freeDCtx(dctx);
+        dctx = nullptr;
+    }
+    in.src = nullptr;
+    in.size = 0;
+    in.pos = 0;
+    lastHint = 1;
+    hasError = (dctx == nullptr);
+#else
+    hasError = true;
+#endif
+}
+
+ZstdDecompressFilePrivate::~ZstdDecompressFilePrivate()
+{
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_freeDCtx(dctx);
+#endif
+}
+
+ZstdDecompressFile::ZstdDecompressFile(QSharedPointer<FileLike> backend)
+    : d_ptr(new ZstdDecompressFilePrivate(backend))
+{
+}
+
+ZstdDecompressFile::~ZstdDecompressFile()
+{
+    delete d_ptr;
+}
+
+qint32 ZstdDecompressFile::read(char *data, qint32 size)
+{
+    Q_D(ZstdDecompressFile);
+    if (d->hasError) {
+        return -1;
+    }
+    if (size <= 0) {
+        return 0;
+    }
+#ifdef QTNG_HAVE_ZSTD
+    // decode into the buffer of caller, so a small input can not expand to a large buffer of ours.
+    while (true) {
+        if (d->in.pos == d->in.size && !d->eof && !d->pendingOutput) {
+            if (d->inBuf.isEmpty()) {
+                d->inBuf.resize(DefaultInputBufferSize);
+            }
+            qint32 readBytes = d->backend->read(d->inBuf.data(), d->inBuf.size());
+            if (readBytes < 0) {
+                d->hasError = true;
+                return -1;
+            } else if (readBytes == 0) {
+                d->eof = true;
+            }
+            d->in.src = d->inBuf.constData();
+            d->in.size = static_cast<size_t>(readBytes);
+            d->in.pos = 0;
+        }
+        ZSTD_outBuffer out = { data, static_cast<size_t>(size), 0 };
+        size_t hint = ZSTD_decompressStream(d->dctx, &out, &d->in);
+        if (ZSTD_isError(hint)) {
+            d->hasError = true;
+            return -1;
+        }
+        d->lastHint = hint;
+        d->pendingOutput = (out.pos == out.size);
+        if (out.pos > 0) {
+            return static_cast<qint32>(out.pos);
+        }
+        if (d->eof && d->in.pos == d->in.size) {
+            if (d->lastHint != 0) {
+                // the input is truncated.
+                d->hasError = true;
+                return -1;
+            }
+            return 0;
+        }
+    }
+#else
+    Q_UNUSED(data);
+    return -1;
+#endif
+}
+
+qint32 ZstdDecompressFile::write(const char *data, qint32 size)
+{
+    Q_D(ZstdDecompressFile);
+    if (d->hasError) {
+        return -1;
+    }
+#ifdef QTNG_HAVE_ZSTD
+    if (size == 0) {
+        return d->lastHint == 0 ? 0 : -1;
+    }
+    QByteArray outBuf(DefaultOutputBufferSize, Qt::Uninitialized);
+    ZSTD_inBuffer in = { data, static_cast<size_t>(size), 0 };
+    while (true) {
+        ZSTD_outBuffer out = { outBuf.data(), static_cast<size_t>(outBuf.size()), 0 };
+        size_t hint = ZSTD_decompressStream(d->dctx, &out, &in);
+        if (ZSTD_isError(hint)) {
+            d->hasError = true;
+            return -1;
+        }
+        d->lastHint = hint;
+        const qint32 have = static_cast<qint32>(out.pos);
+        if (have > 0 && d->backend->write(outBuf.constData(), have) != have) {
+            d->hasError = true;
+            return -1;
+        }
+        if (in.pos == in.size && out.pos < out.size) {
+            return size;
+        }
+    }
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return -1;
+#endif
+}
+
+class BrotliCompressFilePrivate
+{
+public:
+    BrotliCompressFilePrivate(QSharedPointer<FileLike> backend, int quality);
+    ~BrotliCompressFilePrivate();
+    bool compress(const char *data, qint32 size, bool end);  // appends the output to buf.
+public:
+    QSharedPointer<FileLike> backend;
+    QByteArray buf;
+#ifdef QTNG_HAVE_BROTLI
+    BrotliEncoderState *state;  // null if failed to initialize.
+#endif
+    bool hasError;
+    bool eof;
+};
+
+BrotliCompressFilePrivate::BrotliCompressFilePrivate(QSharedPointer<FileLike> backend, int quality)
+    : backend(backend)
+    , hasError(false)
+    , eof(false)
+{
+#ifdef QTNG_HAVE_BROTLI
+    state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    if (state) {
+        BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, static_cast<quint32>(qMax(0, qMin(11, quality))));
+    }
+    hasError = (state == nullptr);
+#else
+    Q_UNUSED(quality);
+    hasError = true;
+#endif
+}
+
+BrotliCompressFilePrivate::~BrotliCompressFilePrivate()
+{
+#ifdef QTNG_HAVE_BROTLI
+    if (state) {
+        BrotliEncoderDestroyInstance(state);
+    }
+#endif
+}
+
+bool BrotliCompressFilePrivate::compress(const char *data, qint32 size, bool end)
+{
+#ifdef QTNG_HAVE_BROTLI
+    const int chunkSize = DefaultOutputBufferSize;
+    size_t availIn = static_cast<size_t>(size);
+    const uint8_t *nextIn = reinterpret_cast<const uint8_t *>(data);
+    const BrotliEncoderOperation op = end ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+    do {
+        const int oldSize = buf.size();
+        buf.resize(oldSize + chunkSize);
+        size_t availOut = static_cast<size_t>(chunkSize);
+        uint8_t *nextOut = reinterpret_cast<uint8_t *>(buf.data() + oldSize);
+        const bool ok = BrotliEncoderCompressStream(state, op, &availIn, &nextIn, &availOut, &nextOut, nullptr);
+        buf.resize(oldSize + chunkSize - static_cast<int>(availOut));
+        if (!ok) {
+            return false;
+        }
+    } while (availIn > 0 || BrotliEncoderHasMoreOutput(state) || (end && !BrotliEncoderIsFinished(state)));
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    Q_UNUSED(end);
+    return false;
+#endif
+}
+
+BrotliCompressFile::BrotliCompressFile(QSharedPointer<FileLike> backend, int quality)
+    : d_ptr(new BrotliCompressFilePrivate(backend, quality))
+{
+}
+
+BrotliCompressFile::~BrotliCompressFile()
+{
+    delete d_ptr;
+}
+
+qint32 BrotliCompressFile::read(char *data, qint32 size)
+{
+    Q_D(BrotliCompressFile);
+    if (d->hasError) {
+        return -1;
+    }
+    return readCompressed(d, data, size);
+}
+
+qint32 BrotliCompressFile::write(const char *data, qint32 size)
+{
+    Q_D(BrotliCompressFile);
+    if (d->hasError) {
+        return -1;
+    }
+    return writeCompressed(d, data, size);
+}
+
+class BrotliDecompressFilePrivate
+{
+public:
+    BrotliDecompressFilePrivate(QSharedPointer<FileLike> backend);
+    ~BrotliDecompressFilePrivate();
+public:
+    QSharedPointer<FileLike> backend;
+    QByteArray inBuf;
+#ifdef QTNG_HAVE_BROTLI
+    BrotliDecoderState *state;  // null if failed to initialize.
+    const uint8_t *nextIn;  // points to inBuf.
+    size_t availIn;
+#endif
+    bool hasError;
+    bool eof;
+};
+
+BrotliDecompressFilePrivate::BrotliDecompressFilePrivate(QSharedPointer<FileLike> backend)
+    : backend(backend)
+    , hasError(false)
+    , eof(false)
+{
+#ifdef QTNG_HAVE_BROTLI
+    state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+    nextIn = nullptr;
+    availIn = 0;
+    hasError = (state == nullptr);
+#else
+    hasError = true;
+#endif
+}
+
+BrotliDecompressFilePrivate::~BrotliDecompressFilePrivate()
+{
+#ifdef QTNG_HAVE_BROTLI
+    if (state) {
+        BrotliDecoderDestroyInstance(state);
+    }
+#endif
+}
+
+BrotliDecompressFile::BrotliDecompressFile(QSharedPointer<FileLike> backend)
+    : d_ptr(new BrotliDecompressFilePrivate(backend))
+{
+}
+
+BrotliDecompressFile::~BrotliDecompressFile()
+{
+    delete d_ptr;
+}
+
+qint32 BrotliDecompressFile::read(char *data, qint32 size)
+{
+    Q_D(BrotliDecompressFile);
+    if (d->hasError) {
+        return -1;
+    }
+    if (size <= 0) {
+        return 0;
+    }
+#ifdef QTNG_HAVE_BROTLI
+    while (true) {
+        size_t availOut = static_cast<size_t>(size);
+        uint8_t *nextOut = reinterpret_cast<uint8_t *>(data);
+        BrotliDecoderResult result =
+                BrotliDecoderDecompressStream(d->state, &d->availIn, &d->nextIn, &availOut, &nextOut, nullptr);
+        if (result == BROTLI_DECODER_RESULT_ERROR) {
+            d->hasError = true;
+            return -1;
+        }
+        const qint32 have = size - static_cast<qint32>(availOut);
+        if (have > 0) {
+            return have;
+        }
+        if (result == BROTLI_DECODER_RESULT_SUCCESS) {
+            return 0;
+        }
+        if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
+            if (d->eof) {
+                // the input is truncated.
+                d->hasError = true;
+                return -1;
+            }
+            if (d->inBuf.isEmpty()) {
+                d->inBuf.resize(DefaultInputBufferSize);
+            }
+            qint32 readBytes = d->backend->read(d->inBuf.data(), d->inBuf.size());
+            if (readBytes < 0) {
+                d->hasError = true;
+                return -1;
+            } else if (readBytes == 0) {
+                d->eof = true;
+            }
+            d->nextIn = reinterpret_cast<const uint8_t *>(d->inBuf.constData());
+            d->availIn = static_cast<size_t>(readBytes);
+        }
+    }
+#else
+    Q_UNUSED(data);
+    return -1;
+#endif
+}
+
+qint32 BrotliDecompressFile::write(const char *data, qint32 size)
+{
+    Q_D(BrotliDecompressFile);
+    if (d->hasError) {
+        return -1;
+    }
+#ifdef QTNG_HAVE_BROTLI
+    if (size == 0) {
+        return BrotliDecoderIsFinished(d->state) ? 0 : -1;
+    }
+    QByteArray outBuf(DefaultOutputBufferSize, Qt::Uninitialized);
+    size_t availIn = static_cast<size_t>(size);
+    const uint8_t *nextIn = reinterpret_cast<const uint8_t *>(data);
+    while (true) {
+        size_t availOut = static_cast<size_t>(outBuf.size());
+        uint8_t *nextOut = reinterpret_cast<uint8_t *>(outBuf.data());
+        BrotliDecoderResult result =
+                BrotliDecoderDecompressStream(d->state, &availIn, &nextIn, &availOut, &nextOut, nullptr);
+        if (result == BROTLI_DECODER_RESULT_ERROR) {
+            d->hasError = true;
+            return -1;
+        }
+        const qint32 have = outBuf.size() - static_cast<qint32>(availOut);
+        if (have > 0 && d->backend->write(outBuf.constData(), have) != have) {
+            d->hasError = true;
+            return -1;
+        }
+        if (result != BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+            // the bytes after the end of stream are not allowed.
+            if (result == BROTLI_DECODER_RESULT_SUCCESS && availIn > 0) {
+                d->hasError = true;
+                return -1;
+            }
+            return size;
+        }
+    }
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return -1;
+#endif
+}
+
+class ZstdPacketCompressorPrivate
+{
+public:
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_CCtx *cctx;  // null if failed to initialize.
+#endif
+    bool broken;
+};
+
+ZstdPacketCompressor::ZstdPacketCompressor(int level)
+    : d_ptr(new ZstdPacketCompressorPrivate)
+{
+    Q_D(ZstdPacketCompressor);
+#ifdef QTNG_HAVE_ZSTD
+    d->cctx = ZSTD_createCCtx();
+    if (d->cctx && ZSTD_isError(ZSTD_CCtx_setParameter(d->cctx, ZSTD_c_compressionLevel, level))) {
+        ZSTD_freeCCtx(d->cctx);
+        d->cctx = nullptr;
+    }
+    d->broken = (d->cctx == nullptr);
+#else
+    Q_UNUSED(level);
+    d->broken = true;
+#endif
+}
+
+ZstdPacketCompressor::~ZstdPacketCompressor()
+{
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_freeCCtx(d_ptr->cctx);
+#endif
+    delete d_ptr;
+}
+
+bool ZstdPacketCompressor::compress(const QByteArray &packet, QByteArray *compressed)
+{
+    Q_D(ZstdPacketCompressor);
+    if (d->broken) {
+        return false;
+    }
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_inBuffer in = { packet.constData(), static_cast<size_t>(packet.size()), 0 };
+    compressed->resize(static_cast<int>(ZSTD_compressBound(static_cast<size_t>(packet.size()))) + 16);
+    int have = 0;
+    size_t remaining;
+    do {
+        if (have == compressed->size()) {
+            compressed->resize(compressed->size() * 2);
+        }
+        ZSTD_outBuffer out = { compressed->data() + have, static_cast<size_t>(compressed->size() - have), 0 };
+        remaining = ZSTD_compressStream2(d->cctx, &out, &in, ZSTD_e_flush);
+        if (ZSTD_isError(remaining)) {
+            d->broken = true;
+            return false;
+        }
+        have += static_cast<int>(out.pos);
+    } while (remaining > 0);
+    compressed->resize(have);
+    return true;
+#else
+    Q_UNUSED(packet);
+    Q_UNUSED(compressed);
+    return false;
+#endif
+}
+
+class ZstdPacketDecompressorPrivate
+{
+public:
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_DCtx *dctx;  // null if failed to initialize.
+#endif
+    bool broken;
+};
+
+ZstdPacketDecompressor::ZstdPacketDecompressor()
+    : d_ptr(new ZstdPacketDecompressorPrivate)
+{
+    Q_D(ZstdPacketDecompressor);
+#ifdef QTNG_HAVE_ZSTD
+    d->dctx = ZSTD_createDCtx();
+    d->broken = (d->dctx == nullptr);
+#else
+    d->broken = true;
+#endif
+}
+
+ZstdPacketDecompressor::~ZstdPacketDecompressor()
+{
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_freeDCtx(d_ptr->dctx);
+#endif
+    delete d_ptr;
+}
+
+bool ZstdPacketDecompressor::decompress(const QByteArray &compressed, QByteArray *packet, int maxSize)
+{
+    Q_D(ZstdPacketDecompressor);
+    if (d->broken) {
+        return false;
+    }
+#ifdef QTNG_HAVE_ZSTD
+    ZSTD_inBuffer in = { compressed.constData(), static_cast<size_t>(compressed.size()), 0 };
+    packet->resize(qMin(maxSize, qMax(1024, compressed.size() * 4)));
+    int have = 0;
+    while (true) {
+        if (have == packet->size()) {
+            if (packet->size() >= maxSize) {
+                d->broken = true;
+                return false;
+            }
+            packet->resize(static_cast<int>(qMin<qint64>(maxSize, static_cast<qint64>(packet->size()) * 2)));
+        }
+        ZSTD_outBuffer out = { packet->data() + have, static_cast<size_t>(packet->size() - have), 0 };
+        size_t hint = ZSTD_decompressStream(d->dctx, &out, &in);
+        if (ZSTD_isError(hint)) {
+            d->broken = true;
+            return false;
+        }
+        have += static_cast<int>(out.pos);
+        if (in.pos == in.size && out.pos < out.size) {
+            break;
+        }
+    }
+    packet->resize(have);
+    return true;
+#else
+    Q_UNUSED(compressed);
+    Q_UNUSED(packet);
+    Q_UNUSED(maxSize);
+    return false;
+#endif
+}
+
+bool qIsContentCodingSupported(const QByteArray &coding)
+{
+#ifdef QTNG_HAVE_ZLIB
+    if (coding == "gzip" || coding == "deflate") {
+        return true;
+    }
+#endif
+#ifdef QTNG_HAVE_ZSTD
+    if (coding == "zstd") {
+        return true;
+    }
+#endif
+#ifdef QTNG_HAVE_BROTLI
+    if (coding == "br") {
+        return true;
+    }
+#endif
+    Q_UNUSED(coding);
+    return false;
+}
+
+QByteArray qAcceptEncoding()
+{
+    QByteArray codings;
+#ifdef QTNG_HAVE_ZLIB
+    codings.append("gzip, deflate");
+#endif
+#ifdef QTNG_HAVE_ZSTD
+    codings.append(codings.isEmpty() ? "zstd" : ", zstd");
+#endif
+#ifdef QTNG_HAVE_BROTLI
+    codings.append(codings.isEmpty() ? "br" : ", br");
+#endif
+    return codings.isEmpty() ? QByteArray("identity") : codings;
+}
+
+// deflate is not made here, it is decoded only. use qDeflateCompress() to make it.
+QSharedPointer<FileLike> qContentEncoder(const QByteArray &coding, QSharedPointer<FileLike> input, int level)
+{
+    if (!qIsContentCodingSupported(coding)) {
+        return QSharedPointer<FileLike>();
+    }
+    if (coding == "zstd") {
+        return QSharedPointer<ZstdCompressFile>::create(input, level < 0 ? DefaultZstdLevel : level);
+    } else if (coding == "br") {
+        return QSharedPointer<BrotliCompressFile>::create(input, level < 0 ? DefaultBrotliQuality : level);
+    }
+#ifdef QTNG_HAVE_ZLIB
+    if (coding == "gzip") {
+        return QSharedPointer<GzipCompressFile>::create(input, level);
+    }
+#endif
+    return QSharedPointer<FileLike>();
+}
+
+QSharedPointer<FileLike> qContentDecoder(const QByteArray &coding, QSharedPointer<FileLike> input)
+{
+    if (!qIsContentCodingSupported(coding)) {
+        return QSharedPointer<FileLike>();
+    }
+    if (coding == "zstd") {
+        return QSharedPointer<ZstdDecompressFile>::create(input);
+    } else if (coding == "br") {
+        return QSharedPointer<BrotliDecompressFile>::create(input);
+    }
+#ifdef QTNG_HAVE_ZLIB
+    // GzipDecompressFile detects the zlib format of deflate.
+    return QSharedPointer<GzipDecompressFile>::create(input);
+#else
+    return QSharedPointer<FileLike>();
+#endif
+}
+
+QTNETWORKNG_NAMESPACE_END
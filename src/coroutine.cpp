@@ -1,5 +1,19 @@
+#include <new>
 #include <QDebug>
+#include <QtCore/qmap.h>
+#include <QtCore/qvector.h>
+#include <QtCore/qvarlengtharray.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qmutex.h>
 #include "../include/private/coroutine_p.h"
+#include "debugger.h"
+
+#ifdef Q_OS_UNIX
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+QTNG_LOGGER("qtng.coroutine");
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
@@ -113,6 +127,486 @@ BaseCoroutine *BaseCoroutine::current()
     return currentCoroutine().get();
 }
 
+typedef void (*CoroutineLocalDestructor)(void *);
+Q_GLOBAL_STATIC(QVector<CoroutineLocalDestructor>, coroutineLocalDestructors)
+static QBasicMutex coroutineLocalMutex;
+
+static int allocateCoroutineLocalId(CoroutineLocalDestructor destructor)
+{
+    QMutexLocker locker(&coroutineLocalMutex);
+    coroutineLocalDestructors()->append(destructor);
+    return coroutineLocalDestructors()->size() - 1;
+}
+
+CoroutineLocalData::CoroutineLocalData(void (*destructor)(void *))
+    : id(allocateCoroutineLocalId(destructor))
+{
+}
+
+CoroutineLocalData::~CoroutineLocalData()
+{
+    QMutexLocker locker(&coroutineLocalMutex);
+    if (coroutineLocalDestructors.exists()) {
+        (*coroutineLocalDestructors())[id] = nullptr;
+    }
+}
+
+void **CoroutineLocalData::get() const
+{
+    QVector<void *> &values = coroutineLocalValues(BaseCoroutine::current())->values;
+    if (id >= values.size() || !values.at(id)) {
+        return nullptr;
+    }
+    return &values[id];
+}
+
+void **CoroutineLocalData::set(void *p)
+{
+    QVector<void *> &values = coroutineLocalValues(BaseCoroutine::current())->values;
+    if (id >= values.size()) {
+        values.resize(id + 1);
+    }
+    void *old = values.at(id);
+    values[id] = p;
+    if (old) {
+        CoroutineLocalDestructor destructor;
+        {
+            QMutexLocker locker(&coroutineLocalMutex);
+            destructor = coroutineLocalDestructors()->at(id);
+        }
+        if (destructor) {
+            destructor(old);
+        }
+    }
+    return &values[id];
+}
+
+void CoroutineLocalValues::clear()
+{
+    if (values.isEmpty()) {
+        return;
+    }
+    // the destructors may touch other coroutine locals.
+    QVector<void *> old;
+    old.swap(values);
+    QVarLengthArray<QPair<CoroutineLocalDestructor, void *>, 8> pending;
+    {
+        QMutexLocker locker(&coroutineLocalMutex);
+        for (int i = 0; i < old.size(); ++i) {
+            CoroutineLocalDestructor destructor = coroutineLocalDestructors()->value(i);
+            if (old.at(i) && destructor) {
+                pending.append(qMakePair(destructor, old.at(i)));
+            }
+        }
+    }
+    for (int i = 0; i < pending.size(); ++i) {
+        pending.at(i).first(pending.at(i).second);
+    }
+}
+
+static QBasicAtomicInteger<quint32> maxPooledStacksValue = Q_BASIC_ATOMIC_INITIALIZER(DEFAULT_COROUTINE_STACK_POOL_SIZE);
+
+void BaseCoroutine::setMaxPooledStacks(quint32 count)
+{
+    maxPooledStacksValue.storeRelease(count);
+}
+
+quint32 BaseCoroutine::maxPooledStacks()
+{
+    return maxPooledStacksValue.loadAcquire();
+}
+
+static QBasicAtomicInteger<int> stackGuardEnabledValue = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+void BaseCoroutine::setStackGuardEnabled(bool enabled)
+{
+    stackGuardEnabledValue.storeRelease(enabled ? 1 : 0);
+}
+
+bool BaseCoroutine::isStackGuardEnabled()
+{
+    return stackGuardEnabledValue.loadAcquire() != 0;
+}
+
+static QBasicAtomicInteger<int> hugePageStacksValue = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+void BaseCoroutine::setHugePageStacksEnabled(bool enabled)
+{
+    hugePageStacksValue.storeRelease(enabled ? 1 : 0);
+}
+
+bool BaseCoroutine::isHugePageStacksEnabled()
+{
+    return hugePageStacksValue.loadAcquire() != 0;
+}
+
+QBasicAtomicInt coroutineAccountingGeneration = Q_BASIC_ATOMIC_INITIALIZER(0);
+static QBasicAtomicInt lastAccountingGeneration = Q_BASIC_ATOMIC_INITIALIZER(0);
+static QBasicAtomicInteger<quint32> slowSliceThresholdValue = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+static qint64 accountingNsecs()
+{
+    struct StartedClock : public QElapsedTimer
+    {
+        StartedClock() { start(); }
+    };
+    static const StartedClock clock;
+    return clock.nsecsElapsed();
+}
+
+static inline qint64 currentSliceNsecs(const CoroutineSliceStats *stats, qint64 now)
+{
+    return stats->sliceNsecs + (stats->sliceStarted >= 0 ? now - stats->sliceStarted : 0);
+}
+
+void doAccountCoroutineSwitch(BaseCoroutine *old, BaseCoroutine *coroutine, int generation)
+{
+    const qint64 now = accountingNsecs();
+    CoroutineSliceStats *stats = coroutineSliceStats(old);
+    if (stats->generation == generation) {
+        const qint64 slice = currentSliceNsecs(stats, now);
+        stats->runNsecs += slice;
+        ++stats->switches;
+        const quint32 threshold = slowSliceThresholdValue.loadAcquire();
+        if (threshold && slice >= static_cast<qint64>(threshold) * 1000 * 1000) {
+            qtng_warning << "coroutine" << old->id() << old->objectName() << "ran" << (slice / 1000 / 1000)
+                         << "ms without switching.";
+        }
+    }
+    stats->sliceNsecs = 0;
+    stats->sliceStarted = -1;
+    stats = coroutineSliceStats(coroutine);
+    if (stats->generation != generation) {
+        stats->runNsecs = 0;
+        stats->switches = 0;
+        stats->generation = generation;
+    }
+    stats->sliceNsecs = 0;
+    stats->sliceStarted = now;
+}
+
+void doPauseCoroutineSlice(bool pause, int generation)
+{
+    BaseCoroutine *current = currentCoroutine().get(false);
+    if (!current) {
+        return;
+    }
+    CoroutineSliceStats *stats = coroutineSliceStats(current);
+    if (stats->generation != generation) {
+        return;
+    }
+    const qint64 now = accountingNsecs();
+    if (pause) {
+        stats->sliceNsecs = currentSliceNsecs(stats, now);
+        stats->sliceStarted = -1;
+    } else if (stats->sliceStarted < 0) {
+        stats->sliceStarted = now;
+    }
+}
+
+qint64 BaseCoroutine::runTimeNsecs() const
+{
+    const CoroutineSliceStats *stats = coroutineSliceStats(const_cast<BaseCoroutine *>(this));
+    if (stats->generation == 0 || stats->generation != coroutineAccountingGeneration.loadAcquire()) {
+        return stats->runNsecs;
+    }
+    return stats->runNsecs + currentSliceNsecs(stats, accountingNsecs());
+}
+
+quint64 BaseCoroutine::switchCount() const
+{
+    return coroutineSliceStats(const_cast<BaseCoroutine *>(this))->switches;
+}
+
+void BaseCoroutine::setAccountingEnabled(bool enabled)
+{
+    if (enabled == isAccountingEnabled()) {
+        return;
+    }
+    // a new generation, so the slices started before disabling are not counted.
+    coroutineAccountingGeneration.storeRelease(enabled ? lastAccountingGeneration.fetchAndAddOrdered(1) + 1 : 0);
+}
+
+bool BaseCoroutine::isAccountingEnabled()
+{
+    return coroutineAccountingGeneration.loadAcquire() != 0;
+}
+
+void BaseCoroutine::setSlowSliceThreshold(quint32 msecs)
+{
+    slowSliceThresholdValue.storeRelease(msecs);
+    if (msecs) {
+        setAccountingEnabled(true);
+    }
+}
+
+quint32 BaseCoroutine::slowSliceThreshold()
+{
+    return slowSliceThresholdValue.loadAcquire();
+}
+
+static size_t stackPageSize()
+{
+#ifdef Q_OS_UNIX
+    static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return pageSize;
+#else
+    return 4096;
+#endif
+}
+
+static void *mapStack(size_t stackSize, bool guarded)
+{
+#ifdef Q_OS_UNIX
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#  ifdef MAP_STACK
+    flags |= MAP_STACK;
+#  endif
+    if (guarded) {
+        // the guard page is the lowest page of mapping, do not let kernel grow it.
+        const size_t guardSize = stackPageSize();
+        char *base = static_cast<char *>(mmap(nullptr, stackSize + guardSize, PROT_READ | PROT_WRITE, flags, -1, 0));
+        if (static_cast<void *>(base) == MAP_FAILED) {
+            return nullptr;
+        }
+        if (mprotect(base, guardSize, PROT_NONE) < 0) {
+            munmap(base, stackSize + guardSize);
+            return nullptr;
+        }
+        return base + guardSize;
+    }
+#  ifdef MAP_GROWSDOWN
+    flags |= MAP_GROWSDOWN;
+#  endif
+    void *stack = mmap(nullptr, stackSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (stack == MAP_FAILED) {
+        return nullptr;
+    }
+    return stack;
+#else
+    Q_UNUSED(guarded);
+    return operator new(stackSize, std::nothrow);
+#endif
+}
+
+static void unmapStack(void *stack, size_t stackSize, bool guarded)
+{
+#ifdef Q_OS_UNIX
+    if (guarded) {
+        const size_t guardSize = stackPageSize();
+        munmap(static_cast<char *>(stack) - guardSize, stackSize + guardSize);
+    } else {
+        munmap(stack, stackSize);
+    }
+#else
+    Q_UNUSED(stackSize);
+    Q_UNUSED(guarded);
+    operator delete(stack);
+#endif
+}
+
+typedef QMap<size_t, QVector<void *>> FreeStacks;
+
+struct CoroutineStackPoolData
+{
+    CoroutineStackPoolData()
+        : arena(nullptr)
+        , arenaLeft(0)
+    {
+    }
+    ~CoroutineStackPoolData();
+    FreeStacks freeStacks;
+    FreeStacks freeGuardedStacks;
+    char *arena;  // the unused part of current huge page, the small stacks are cut from it.
+    size_t arenaLeft;
+};
+
+CoroutineStackPoolData::~CoroutineStackPoolData()
+{
+    for (FreeStacks::const_iterator itor = freeStacks.constBegin(); itor != freeStacks.constEnd(); ++itor) {
+        for (void *stack : itor.value()) {
+            unmapStack(stack, itor.key(), false);
+        }
+    }
+    for (FreeStacks::const_iterator itor = freeGuardedStacks.constBegin(); itor != freeGuardedStacks.constEnd();
+         ++itor) {
+        for (void *stack : itor.value()) {
+            unmapStack(stack, itor.key(), true);
+        }
+    }
+#ifdef Q_OS_UNIX
+    if (arenaLeft) {
+        munmap(arena, arenaLeft);
+    }
+#endif
+}
+
+// QThreadStorage deletes the pool while the thread exits.
+Q_GLOBAL_STATIC(QThreadStorage<CoroutineStackPoolData *>, stackPoolStorage)
+
+#if defined(Q_OS_LINUX) && defined(MADV_HUGEPAGE)
+static const size_t hugePageSize = 2 * 1024 * 1024;
+
+// an aligned mapping the kernel backs with transparent huge pages. the parts of it can be unmapped separately.
+static char *mapHugePages(size_t size)
+{
+    const size_t mapped = size + hugePageSize;
+    char *base = static_cast<char *>(mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (static_cast<void *>(base) == MAP_FAILED) {
+        return nullptr;
+    }
+    const quintptr p = reinterpret_cast<quintptr>(base);
+    char *aligned = reinterpret_cast<char *>((p + hugePageSize - 1) & ~static_cast<quintptr>(hugePageSize - 1));
+    if (aligned > base) {
+        munmap(base, aligned - base);
+    }
+    if (base + mapped > aligned + size) {
+        munmap(aligned + size, (base + mapped) - (aligned + size));
+    }
+    madvise(aligned, size, MADV_HUGEPAGE);
+    return aligned;
+}
+
+// the stacks smaller than a huge page share it, so the switches between them hit the same tlb entry.
+static void *allocateHugePageStack(QThreadStorage<CoroutineStackPoolData *> *storage, size_t stackSize)
+{
+    if (stackSize >= hugePageSize || !storage) {
+        return mapHugePages(stackSize);
+    }
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(new CoroutineStackPoolData());
+    }
+    CoroutineStackPoolData *pool = storage->localData();
+    if (pool->arenaLeft < stackSize) {
+        if (pool->arenaLeft) {
+            munmap(pool->arena, pool->arenaLeft);
+        }
+        pool->arena = mapHugePages(hugePageSize);
+        pool->arenaLeft = pool->arena ? hugePageSize : 0;
+        if (!pool->arena) {
+            return nullptr;
+        }
+    }
+    void *stack = pool->arena;
+    pool->arena += stackSize;
+    pool->arenaLeft -= stackSize;
+    return stack;
+}
+#endif
+
+void *CoroutineStackPool::allocate(size_t stackSize, bool guarded)
+{
+    QThreadStorage<CoroutineStackPoolData *> *storage = stackPoolStorage();
+    if (storage && storage->hasLocalData()) {
+        CoroutineStackPoolData *pool = storage->localData();
+        FreeStacks &stacks = guarded ? pool->freeGuardedStacks : pool->freeStacks;
+        FreeStacks::iterator itor = stacks.find(stackSize);
+        if (itor != stacks.end() && !itor.value().isEmpty()) {
+            void *stack = itor.value().last();
+            itor.value().removeLast();
+            return stack;
+        }
+    }
+#if defined(Q_OS_LINUX) && defined(MADV_HUGEPAGE)
+    // the guard page would split the huge pages, so guarded stacks never use them.
+    if (!guarded && hugePageStacksValue.loadAcquire() && stackSize % stackPageSize() == 0) {
+        void *stack = allocateHugePageStack(storage, stackSize);
+        if (stack) {
+            return stack;
+        }
+    }
+#endif
+    return mapStack(stackSize, guarded);
+}
+
+void CoroutineStackPool::release(void *stack, size_t stackSize, bool guarded)
+{
+    if (!stack) {
+        return;
+    }
+    const quint32 maxPooled = maxPooledStacksValue.loadAcquire();
+    QThreadStorage<CoroutineStackPoolData *> *storage = stackPoolStorage();
+    if (maxPooled == 0 || !storage) {  // pooling is disabled, or the process is exiting.
+        unmapStack(stack, stackSize, guarded);
+        return;
+    }
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(new CoroutineStackPoolData());
+    }
+    CoroutineStackPoolData *pool = storage->localData();
+    QVector<void *> &stacks = (guarded ? pool->freeGuardedStacks : pool->freeStacks)[stackSize];
+    if (static_cast<quint32>(stacks.size()) >= maxPooled) {
+        unmapStack(stack, stackSize, guarded);
+        return;
+    }
+#if defined(Q_OS_UNIX) && defined(MADV_DONTNEED)
+    // keep the mapping but drop the pages, so the idle stacks cost no memory. the huge pages are kept, as dropping a
+    // part of them splits them.
+    if (!hugePageStacksValue.loadAcquire()) {
+        madvise(stack, stackSize, MADV_DONTNEED);
+    }
+#endif
+    stacks.append(stack);
+}
+
+void CoroutineStackPool::trim(void *stack, size_t stackSize, const void *sp, char **trimmed)
+{
+#if defined(Q_OS_UNIX) && defined(MADV_DONTNEED)
+    const size_t pageSize = stackPageSize();
+    const quintptr bottom = reinterpret_cast<quintptr>(stack);
+    const quintptr p = reinterpret_cast<quintptr>(sp);
+    if (!stack || (bottom % pageSize) != 0 || p < bottom || p >= bottom + stackSize) {
+        return;  // not running on this stack, such as the main coroutine.
+    }
+    // one page is kept below sp for the frames of this function and madvise().
+    const quintptr boundary = (p & ~static_cast<quintptr>(pageSize - 1)) - pageSize;
+    if (boundary <= bottom) {
+        return;
+    }
+    char *top = reinterpret_cast<char *>(boundary);
+    if (*trimmed == top && *reinterpret_cast<quintptr *>(top - sizeof(quintptr)) == 0) {
+        return;  // the coroutine has not gone deeper since the last trimming.
+    }
+    madvise(stack, boundary - bottom, MADV_DONTNEED);
+    *trimmed = top;
+#else
+    Q_UNUSED(stack);
+    Q_UNUSED(stackSize);
+    Q_UNUSED(sp);
+    Q_UNUSED(trimmed);
+#endif
+}
+
+size_t CoroutineStackPool::highWaterMark(void *stack, size_t stackSize)
+{
+#ifdef Q_OS_UNIX
+    const size_t pageSize = stackPageSize();
+    if (!stack || stackSize < pageSize || (reinterpret_cast<quintptr>(stack) % pageSize) != 0) {
+        return 0;
+    }
+    const size_t pages = stackSize / pageSize;
+#  if defined(Q_OS_LINUX) || defined(Q_OS_ANDROID)
+    QVarLengthArray<unsigned char, 256> residents(static_cast<int>(pages));
+#  else
+    QVarLengthArray<char, 256> residents(static_cast<int>(pages));
+#  endif
+    if (mincore(stack, pages * pageSize, residents.data()) < 0) {
+        return 0;
+    }
+    // stacks grow down, so the lowest resident page is the deepest one.
+    for (size_t i = 0; i < pages; ++i) {
+        if (residents[static_cast<int>(i)] & 1) {
+            return stackSize - i * pageSize;
+        }
+    }
+    return 0;
+#else
+    Q_UNUSED(stack);
+    Q_UNUSED(stackSize);
+    return 0;
+#endif
+}
+
 QTNETWORKNG_NAMESPACE_END
 
 QDebug &operator<<(QDebug &out, const QTNETWORKNG_NAMESPACE::BaseCoroutine &coroutine)
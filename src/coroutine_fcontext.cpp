@@ -3,10 +3,7 @@
 #include <QtCore/qdebug.h>
 #include <QtCore/qlist.h>
 #include "../include/private/coroutine_p.h"
-
-#ifdef Q_OS_UNIX
-#  include <sys/mman.h>
-#endif
+#include "../include/private/tracing_p.h"
 
 #include "debugger.h"
 
@@ -38,6 +35,8 @@ public:
     bool raise(CoroutineException *exception = nullptr);
     bool yield();
     void cleanup() { q_ptr->cleanup(); }
+    static CoroutineSliceStats *sliceStatsOf(BaseCoroutine *coroutine) { return &coroutine->dd_ptr->stats; }
+    static CoroutineLocalValues *localsOf(BaseCoroutine *coroutine) { return &coroutine->dd_ptr->locals; }
 public:
     BaseCoroutine * const q_ptr;
     BaseCoroutine *previous;
@@ -47,6 +46,11 @@ public:
     void *stack;
     enum BaseCoroutine::State state;
     bool bad;
+    bool guarded;
+    bool trimming;
+    char *trimmed;  // the top of the stack pages given back last time.
+    CoroutineSliceStats stats;
+    CoroutineLocalValues locals;
     Q_DECLARE_PUBLIC(BaseCoroutine)
 private:
     static BaseCoroutinePrivate *getPrivateHelper(BaseCoroutine *coroutine) { return coroutine->dd_ptr; }
@@ -90,20 +94,12 @@ BaseCoroutinePrivate::BaseCoroutinePrivate(BaseCoroutine *q, BaseCoroutine *prev
     , stack(nullptr)
     , state(BaseCoroutine::Initialized)
     , bad(false)
+    , guarded(stackSize && BaseCoroutine::isStackGuardEnabled())
+    , trimming(false)
+    , trimmed(nullptr)
 {
     if (stackSize) {
-#ifdef Q_OS_UNIX
-        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
-#  ifdef MAP_STACK
-        flags |= MAP_STACK;
-#  endif
-#  ifdef MAP_GROWSDOWN
-        flags |= MAP_GROWSDOWN;
-#  endif
-        stack = mmap(nullptr, this->stackSize, PROT_READ | PROT_WRITE, flags, -1, 0);
-#else
-        stack = operator new(stackSize);
-#endif
+        stack = CoroutineStackPool::allocate(this->stackSize, guarded);
         if (!stack) {
             qtng_warning << "Coroutine can not malloc new memroy.";
             bad = true;
@@ -132,11 +128,7 @@ BaseCoroutinePrivate::~BaseCoroutinePrivate()
     }
 
     if (stack) {
-#ifdef Q_OS_UNIX
-        munmap(stack, stackSize);
-#else
-        operator delete(stack);
-#endif
+        CoroutineStackPool::release(stack, stackSize, guarded);
     }
 }
 
@@ -165,6 +157,13 @@ bool BaseCoroutinePrivate::yield()
 
     currentCoroutine().set(q);
 
+    BaseCoroutinePrivate *oldPrivate = old->d_func();
+    if (oldPrivate->trimming && oldPrivate->state == BaseCoroutine::Started) {
+        char sp;
+        CoroutineStackPool::trim(oldPrivate->stack, oldPrivate->stackSize, &sp, &oldPrivate->trimmed);
+    }
+    accountCoroutineSwitch(old, q);
+    QTNG_TRACE_INSTANT("coroutine", "resume", "from", old->id());
     intptr_t result = jump_fcontext(&old->d_func()->context, context, reinterpret_cast<intptr_t>(this), false);
     if (!result && state != BaseCoroutine::Stopped) {  // last coroutine private.
         qtng_warning << "jump_fcontext() return error.";
@@ -245,14 +244,25 @@ BaseCoroutine *createMainCoroutine()
         return nullptr;
     }
     BaseCoroutinePrivate *mainPrivate = main->d_func();
-    mainPrivate->stack = new char[1024];
     mainPrivate->stackSize = 1024;
+    mainPrivate->stack = CoroutineStackPool::allocate(mainPrivate->stackSize);
     void *stackTop = static_cast<char *>(mainPrivate->stack) + mainPrivate->stackSize;
     mainPrivate->context = make_fcontext(stackTop, mainPrivate->stackSize, nullptr);
     mainPrivate->state = BaseCoroutine::Started;
     return main;
 }
 
+CoroutineSliceStats *coroutineSliceStats(BaseCoroutine *coroutine)
+{
+    return BaseCoroutinePrivate::sliceStatsOf(coroutine);
+}
+
+
+CoroutineLocalValues *coroutineLocalValues(BaseCoroutine *coroutine)
+{
+    return BaseCoroutinePrivate::localsOf(coroutine);
+}
+
 BaseCoroutine::BaseCoroutine(BaseCoroutine *previous, size_t stackSize)
     : dd_ptr(new BaseCoroutinePrivate(this, previous, stackSize))
 {
@@ -295,6 +305,30 @@ bool BaseCoroutine::yield()
     return d->yield();
 }
 
+size_t BaseCoroutine::stackHighWaterMark() const
+{
+    Q_D(const BaseCoroutine);
+    return CoroutineStackPool::highWaterMark(d->stack, d->stackSize);
+}
+
+size_t BaseCoroutine::stackSize() const
+{
+    Q_D(const BaseCoroutine);
+    return d->stackSize;
+}
+
+void BaseCoroutine::setStackTrimmingEnabled(bool enabled)
+{
+    Q_D(BaseCoroutine);
+    d->trimming = enabled;
+}
+
+bool BaseCoroutine::isStackTrimmingEnabled() const
+{
+    Q_D(const BaseCoroutine);
+    return d->trimming;
+}
+
 BaseCoroutine *BaseCoroutine::previous() const
 {
     Q_D(const BaseCoroutine);
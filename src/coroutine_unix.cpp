@@ -1,10 +1,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <ucontext.h>
-#include <sys/mman.h>
 #include <QtCore/qdebug.h>
 #include <QtCore/qlist.h>
 #include "../include/private/coroutine_p.h"
+#include "../include/private/tracing_p.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
@@ -17,6 +17,8 @@ public:
     bool raise(CoroutineException *exception = nullptr);
     bool yield();
     void cleanup() { q_ptr->cleanup(); }
+    static CoroutineSliceStats *sliceStatsOf(BaseCoroutine *coroutine) { return &coroutine->dd_ptr->stats; }
+    static CoroutineLocalValues *localsOf(BaseCoroutine *coroutine) { return &coroutine->dd_ptr->locals; }
 public:
     BaseCoroutine * const q_ptr;
     BaseCoroutine * previous;
@@ -26,6 +28,11 @@ public:
     ucontext_t *context;
     enum BaseCoroutine::State state;
     bool bad;
+    bool guarded;
+    bool trimming;
+    char *trimmed;  // the top of the stack pages given back last time.
+    CoroutineSliceStats stats;
+    CoroutineLocalValues locals;
     Q_DECLARE_PUBLIC(BaseCoroutine)
 };
 
@@ -57,14 +64,11 @@ void run_stub(BaseCoroutinePrivate *coroutine)
 
 BaseCoroutinePrivate::BaseCoroutinePrivate(BaseCoroutine *q, BaseCoroutine *previous, size_t stackSize)
     :q_ptr(q), previous(previous), stackSize(stackSize), stack(nullptr),
-      exception(nullptr), context(nullptr), state(BaseCoroutine::Initialized), bad(false)
+      exception(nullptr), context(nullptr), state(BaseCoroutine::Initialized), bad(false),
+      guarded(stackSize && BaseCoroutine::isStackGuardEnabled()), trimming(false), trimmed(nullptr)
 {
     if (stackSize) {
-#ifdef MAP_GROWSDOWN
-        stack = mmap(nullptr, this->stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_GROWSDOWN, -1, 0);
-#else
-        stack = mmap(nullptr, this->stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-#endif
+        stack = CoroutineStackPool::allocate(this->stackSize, guarded);
         if (!stack) {
             qWarning("Coroutine can not malloc new memroy.");
             bad = true;
@@ -80,7 +84,7 @@ BaseCoroutinePrivate::~BaseCoroutinePrivate()
         qWarning() << "deleting running BaseCoroutine" << this;
     }
     if (stack) {
-        munmap(stack, stackSize);
+        CoroutineStackPool::release(stack, stackSize, guarded);
     }
 
     if (currentCoroutine().get(false) == q) {
@@ -120,6 +124,13 @@ bool BaseCoroutinePrivate::yield()
 
     currentCoroutine().set(q);
 
+    BaseCoroutinePrivate *oldPrivate = old->d_func();
+    if (oldPrivate->trimming && oldPrivate->state == BaseCoroutine::Started) {
+        char sp;
+        CoroutineStackPool::trim(oldPrivate->stack, oldPrivate->stackSize, &sp, &oldPrivate->trimmed);
+    }
+    accountCoroutineSwitch(old, q);
+    QTNG_TRACE_INSTANT("coroutine", "resume", "from", old->id());
     if (swapcontext(old->d_func()->context, this->context) < 0) {
         qDebug() << "swapcontext() return error: " << errno;
         return false;
@@ -222,6 +233,18 @@ BaseCoroutine* createMainCoroutine()
 }
 
 
+CoroutineSliceStats *coroutineSliceStats(BaseCoroutine *coroutine)
+{
+    return BaseCoroutinePrivate::sliceStatsOf(coroutine);
+}
+
+
+CoroutineLocalValues *coroutineLocalValues(BaseCoroutine *coroutine)
+{
+    return BaseCoroutinePrivate::localsOf(coroutine);
+}
+
+
 BaseCoroutine::BaseCoroutine(BaseCoroutine * previous, size_t stackSize)
     :dd_ptr(new BaseCoroutinePrivate(this, previous, stackSize))
 {
@@ -272,6 +295,34 @@ void BaseCoroutine::cleanup()
 }
 
 
+size_t BaseCoroutine::stackHighWaterMark() const
+{
+    Q_D(const BaseCoroutine);
+    return CoroutineStackPool::highWaterMark(d->stack, d->stackSize);
+}
+
+
+size_t BaseCoroutine::stackSize() const
+{
+    Q_D(const BaseCoroutine);
+    return d->stackSize;
+}
+
+
+void BaseCoroutine::setStackTrimmingEnabled(bool enabled)
+{
+    Q_D(BaseCoroutine);
+    d->trimming = enabled;
+}
+
+
+bool BaseCoroutine::isStackTrimmingEnabled() const
+{
+    Q_D(const BaseCoroutine);
+    return d->trimming;
+}
+
+
 BaseCoroutine *BaseCoroutine::previous() const
 {
     Q_D(const BaseCoroutine);
@@ -1,6 +1,16 @@
 #include <QtCore/qprocess.h>
+#if defined(Q_OS_LINUX)
+#  include <pthread.h>
+#  include <sched.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#elif defined(Q_OS_WIN)
+#  include <windows.h>
+#endif
 #include "../include/coroutine_utils.h"
 #include "../include/eventloop.h"
+#include "../include/metrics.h"
+#include "../include/private/eventloop_p.h"
 #include "debugger.h"
 
 QTNG_LOGGER("qtng.coroutine");
@@ -51,11 +61,15 @@ public:
     CoroutineThreadPrivate(quint32 capacity)
         : BaseCoroutine(nullptr)
         , tasks(capacity)
+        , cpu(-1)
+        , busyPolling(0)
     {
     }
     virtual void run() override;
 public:
     ThreadQueue<std::function<void()>> tasks;
+    int cpu;
+    quint32 busyPolling;
 };
 
 void CoroutineThreadPrivate::run()
@@ -80,12 +94,215 @@ CoroutineThread::~CoroutineThread()
 }
 void CoroutineThread::run()
 {
-    currentLoop()->getOrCreate()->runUntil(dd_ptr);
+    if (dd_ptr->cpu >= 0 && pinCurrentThread(dd_ptr->cpu)) {
+#if defined(Q_OS_LINUX) && defined(SYS_set_mempolicy)
+        // the stacks and the eventloop are allocated by this thread, take them from the numa node of its cpu even if
+        // the process is started with an interleaving policy.
+        const int localPolicy = 4;  // MPOL_LOCAL
+        syscall(SYS_set_mempolicy, localPolicy, nullptr, 0UL);
+#endif
+    }
+    QSharedPointer<EventLoopCoroutine> eventLoop = currentLoop()->getOrCreate();
+    if (dd_ptr->busyPolling) {
+        eventLoop->setBusyPolling(dd_ptr->busyPolling);
+    }
+    eventLoop->runUntil(dd_ptr);
 }
 void CoroutineThread::apply(const std::function<void()> &f)
 {
     dd_ptr->tasks.put(f);
 }
+void CoroutineThread::setCpuAffinity(int cpu)
+{
+    dd_ptr->cpu = cpu;
+}
+void CoroutineThread::setBusyPolling(quint32 usecs)
+{
+    dd_ptr->busyPolling = usecs;
+}
+bool CoroutineThread::pinCurrentThread(int cpu)
+{
+#if defined(Q_OS_LINUX)
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (r != 0) {
+        qtng_warning << "can not pin thread to cpu" << cpu << ":" << r;
+        return false;
+    }
+    return true;
+#elif defined(Q_OS_WIN)
+    if (cpu < 0 || cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+        return false;
+    }
+    if (SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) == 0) {
+        qtng_warning << "can not pin thread to cpu" << cpu << ":" << GetLastError();
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(cpu);
+    qtng_warning << "pinning threads to cpu is not supported in this platform.";
+    return false;
+#endif
+}
+
+namespace {
+
+struct RuntimeDeque
+{
+    QMutex mutex;
+    QList<std::function<void()>> tasks;
+};
+
+class RuntimeWorker;
+class RuntimeDriver : public BaseCoroutine
+{
+public:
+    RuntimeDriver(CoroutineRuntimePrivate *runtime, int index)
+        : BaseCoroutine(nullptr)
+        , runtime(runtime)
+        , index(index)
+    {
+    }
+    virtual void run() override;
+    CoroutineRuntimePrivate *runtime;
+    int index;
+};
+
+class RuntimeWorker : public QThread
+{
+public:
+    RuntimeWorker(CoroutineRuntimePrivate *runtime, int index)
+        : driver(new RuntimeDriver(runtime, index))
+    {
+    }
+    virtual ~RuntimeWorker() override { delete driver; }
+    virtual void run() override { currentLoop()->getOrCreate()->runUntil(driver); }
+    RuntimeDriver *driver;
+};
+
+}  // anonymous namespace
+
+class CoroutineRuntimePrivate
+{
+public:
+    bool take(int index, std::function<void()> *f);
+public:
+    QList<RuntimeDeque *> deques;
+    QList<RuntimeWorker *> workers;
+    ThreadEvent workAvailable;
+    QAtomicInt nextIndex;
+    QAtomicInt stopping;
+};
+
+// pop the newest function of own deque, or steal the oldest one from others.
+bool CoroutineRuntimePrivate::take(int index, std::function<void()> *f)
+{
+    for (int i = 0; i < deques.size(); ++i) {
+        RuntimeDeque *deque = deques.at((index + i) % deques.size());
+        QMutexLocker locker(&deque->mutex);
+        if (deque->tasks.isEmpty()) {
+            continue;
+        }
+        *f = i == 0 ? deque->tasks.takeLast() : deque->tasks.takeFirst();
+        return true;
+    }
+    return false;
+}
+
+void RuntimeDriver::run()
+{
+    CoroutineGroup operations;
+    while (true) {
+        std::function<void()> f;
+        if (!runtime->take(index, &f)) {
+            // clear before trying again, so the set() after that is not lost.
+            runtime->workAvailable.clear();
+            if (!runtime->take(index, &f)) {
+                if (runtime->stopping.loadAcquire()) {
+                    // the set() of destructor may be cleared by this worker after others checked stopping.
+                    runtime->workAvailable.set();
+                    break;
+                }
+                runtime->workAvailable.wait();
+                continue;
+            }
+        }
+        operations.spawn(f);
+        // let the new coroutine run, a busy thread comes back late and leaves its deque to the others.
+        Coroutine::msleep(0);
+    }
+    operations.joinall();
+}
+
+CoroutineRuntime::CoroutineRuntime(int threads)
+    : d_ptr(new CoroutineRuntimePrivate())
+{
+    Q_D(CoroutineRuntime);
+    if (threads <= 0) {
+        threads = qMax(1, QThread::idealThreadCount());
+    }
+    for (int i = 0; i < threads; ++i) {
+        d->deques.append(new RuntimeDeque());
+    }
+    for (int i = 0; i < threads; ++i) {
+        RuntimeWorker *worker = new RuntimeWorker(d, i);
+        d->workers.append(worker);
+        worker->start();
+    }
+}
+
+CoroutineRuntime::~CoroutineRuntime()
+{
+    Q_D(CoroutineRuntime);
+    d->stopping.storeRelease(1);
+    d->workAvailable.set();
+    for (RuntimeWorker *worker : d->workers) {
+        worker->wait();
+        delete worker;
+    }
+    qDeleteAll(d->deques);
+    delete d_ptr;
+}
+
+QSharedPointer<ThreadEvent> CoroutineRuntime::spawnAnywhere(const std::function<void()> &func)
+{
+    Q_D(CoroutineRuntime);
+    QSharedPointer<ThreadEvent> done(new ThreadEvent());
+    std::function<void()> task = [func, done] {
+        try {
+            func();
+        } catch (...) {
+            done->set();
+            throw;
+        }
+        done->set();
+    };
+    int index = -1;
+    RuntimeWorker *current = dynamic_cast<RuntimeWorker *>(QThread::currentThread());
+    if (current && current->driver->runtime == d) {
+        index = current->driver->index;
+    } else {
+        index = static_cast<int>(static_cast<uint>(d->nextIndex.fetchAndAddRelaxed(1)) % d->deques.size());
+    }
+    RuntimeDeque *deque = d->deques.at(index);
+    deque->mutex.lock();
+    deque->tasks.append(task);
+    deque->mutex.unlock();
+    d->workAvailable.set();
+    return done;
+}
+
+int CoroutineRuntime::threadCount() const
+{
+    Q_D(const CoroutineRuntime);
+    return d->workers.size();
+}
 
 bool waitThread(QThread *thread)
 {
@@ -149,17 +366,44 @@ bool CoroutineGroup::add(QSharedPointer<Coroutine> coroutine, const QString &nam
         }
         coroutine->setObjectName(name);
     }
-    QPointer<CoroutineGroup> self(this);
-    coroutine->finished.addCallback([self](BaseCoroutine *coroutine) {
-        if (self.isNull()) {
-            return;
-        }
-        self->deleteCoroutine(coroutine);
-    });
+    CoroutinePrivate *d = coroutine->d_func();
+    if (d->group.isNull() || d->group == this) {
+        d->group = this;  // called by the hook of finished, without allocating a callback.
+    } else {
+        QPointer<CoroutineGroup> self(this);
+        coroutine->finished.addCallback([self](BaseCoroutine *coroutine) {
+            if (self.isNull()) {
+                return;
+            }
+            self->deleteCoroutine(coroutine);
+        });
+    }
+    indexes.insert(coroutine.data(), coroutines.size());
     coroutines.append(coroutine);
     return true;
 }
 
+QSharedPointer<Coroutine> CoroutineGroup::take(Coroutine *coroutine)
+{
+    QHash<Coroutine *, int>::iterator itor = indexes.find(coroutine);
+    if (itor == indexes.end()) {
+        return QSharedPointer<Coroutine>();
+    }
+    const int index = itor.value();
+    indexes.erase(itor);
+    QSharedPointer<Coroutine> found = coroutines.at(index);
+    if (found->d_func()->group == this) {
+        found->d_func()->group.clear();
+    }
+    const int last = coroutines.size() - 1;
+    if (index != last) {
+        coroutines[index] = coroutines.at(last);
+        indexes[coroutines.at(index).data()] = index;
+    }
+    coroutines.removeLast();
+    return found;
+}
+
 QSharedPointer<Coroutine> CoroutineGroup::get(const QString &name)
 {
     QListIterator<QSharedPointer<Coroutine>> itor(coroutines);
@@ -270,7 +514,7 @@ bool CoroutineGroup::joinall()
         if (coroutine == Coroutine::current()) {
             continue;
         }
-        coroutines.removeOne(coroutine);
+        take(coroutine.data());
         coroutine->join();
     }
     return hasCoroutines;
@@ -321,14 +565,11 @@ void CoroutineGroup::deleteCoroutine(BaseCoroutine *baseCoroutine)
 {
     Coroutine *coroutine = dynamic_cast<Coroutine *>(baseCoroutine);
     Q_ASSERT(coroutine != nullptr);
-    for (QList<QSharedPointer<Coroutine>>::iterator itor = coroutines.begin(); itor != coroutines.end(); ++itor) {
-        if (itor->data() == coroutine) {
-            DeleteCoroutineFunctor *callback = new DeleteCoroutineFunctor();
-            callback->coroutine = *itor;
-            EventLoopCoroutine::get()->callLater(0, callback);
-            coroutines.erase(itor);
-            break;
-        }
+    QSharedPointer<Coroutine> found = take(coroutine);
+    if (!found.isNull()) {
+        DeleteCoroutineFunctor *callback = new DeleteCoroutineFunctor();
+        callback->coroutine = found;
+        EventLoopCoroutine::get()->callLater(0, callback);
     }
 }
 
@@ -412,12 +653,9 @@ void ThreadPoolWorkThread::run()
 }
 
 ThreadPool::ThreadPool(int threads)
+    : capacity(threads <= 0 ? QThread::idealThreadCount() * 2 + 1 : threads)
 {
-    if (threads <= 0) {
-        semaphore.reset(new Semaphore(QThread::idealThreadCount() * 2 + 1));
-    } else {
-        semaphore.reset(new Semaphore(threads));
-    }
+    semaphore.reset(new Semaphore(capacity));
 }
 
 ThreadPool::~ThreadPool()
@@ -444,4 +682,189 @@ void ThreadPool::call(std::function<void()> func)
     threads.append(thread);
 }
 
+void ThreadPool::callChunks(int size, const std::function<void(int, int)> &func)
+{
+    if (size <= 0) {
+        return;
+    }
+    const int workers = qMin(capacity, size);
+    QSharedPointer<QAtomicInt> next(new QAtomicInt(0));
+    std::function<void()> takeChunks = [func, next, size, workers] {
+        while (true) {
+            int begin = next->loadAcquire();
+            int remaining = size - begin;
+            if (remaining <= 0) {
+                return;
+            }
+            int chunk = qMax(1, remaining / (workers * 2));
+            if (next->testAndSetOrdered(begin, begin + chunk)) {
+                func(begin, begin + chunk);
+            }
+        }
+    };
+    if (workers == 1) {
+        call(takeChunks);
+        return;
+    }
+    CoroutineGroup operations;
+    for (int i = 0; i < workers; ++i) {
+        operations.spawn([this, takeChunks] { call(takeChunks); });
+    }
+    operations.joinall();
+}
+
+namespace {
+
+struct DeferCallMetrics
+{
+    DeferCallMetrics();
+    MetricGauge *queued;
+    MetricGauge *threads;
+    MetricCounter *calls;
+};
+
+DeferCallMetrics::DeferCallMetrics()
+{
+    MetricsRegistry *registry = MetricsRegistry::instance();
+    queued = registry->gauge("qtng_defer_call_queued", "Calls of spawnInThread() waiting for a worker thread.");
+    threads = registry->gauge("qtng_defer_call_threads", "Worker threads of spawnInThread().");
+    calls = registry->counter("qtng_defer_calls_total", "Calls of spawnInThread().");
+}
+
+DeferCallMetrics &deferCallMetrics()
+{
+    static DeferCallMetrics metrics;
+    return metrics;
+}
+
+}  // namespace
+
+class DeferCallPool
+{
+public:
+    DeferCallPool();
+    static DeferCallPool *instance();
+    void call(const ThreadPoolWorkItem &item);
+    void work();
+public:
+    QQueue<ThreadPoolWorkItem> queue;
+    QList<QThread *> finished;  // joined and deleted by the next call.
+    QMutex mutex;
+    QWaitCondition hasWork;
+    int maxThreads;
+    int threads;
+    int idle;
+};
+
+class DeferCallWorker : public QThread
+{
+public:
+    DeferCallWorker(DeferCallPool *pool)
+        : pool(pool)
+    {
+    }
+    virtual void run() override;
+private:
+    DeferCallPool *pool;
+};
+
+void DeferCallWorker::run()
+{
+    pool->work();
+    QMutexLocker locker(&pool->mutex);
+    pool->finished.append(this);
+}
+
+DeferCallPool::DeferCallPool()
+    : maxThreads(qMax(4, QThread::idealThreadCount() * 4))
+    , threads(0)
+    , idle(0)
+{
+}
+
+// never deleted, the workers may be still blocking while the process exits.
+DeferCallPool *DeferCallPool::instance()
+{
+    static DeferCallPool *pool = new DeferCallPool();
+    return pool;
+}
+
+void DeferCallPool::call(const ThreadPoolWorkItem &item)
+{
+    DeferCallMetrics &metrics = deferCallMetrics();
+    metrics.calls->add();
+    metrics.queued->add();
+    QList<QThread *> toJoin;
+    bool grow = false;
+    mutex.lock();
+    queue.enqueue(item);
+    if (idle > queue.size() - 1 || threads >= maxThreads) {
+        hasWork.wakeOne();
+    } else {
+        ++threads;
+        grow = true;
+    }
+    toJoin.swap(finished);
+    mutex.unlock();
+    if (grow) {
+        metrics.threads->add();
+        DeferCallWorker *worker = new DeferCallWorker(this);
+        worker->start();
+    }
+    for (QThread *thread : toJoin) {
+        thread->wait();
+        delete thread;
+    }
+}
+
+void DeferCallPool::work()
+{
+    DeferCallMetrics &metrics = deferCallMetrics();
+    mutex.lock();
+    while (true) {
+        if (queue.isEmpty()) {
+            ++idle;
+            hasWork.wait(&mutex, 60 * 1000);
+            --idle;
+            if (queue.isEmpty()) {
+                --threads;
+                mutex.unlock();
+                metrics.threads->sub();
+                return;
+            }
+        }
+        ThreadPoolWorkItem item = queue.dequeue();
+        mutex.unlock();
+        metrics.queued->sub();
+        item.makeResult();
+        if (!item.eventloop.isNull()) {
+            item.eventloop->callLaterThreadSafe(0, new MarkDoneFunctor(item.done));
+        }
+        mutex.lock();
+    }
+}
+
+QSharedPointer<Event> spawnInThread(const std::function<void()> &func)
+{
+    ThreadPoolWorkItem item;
+    item.makeResult = func;
+    item.eventloop = EventLoopCoroutine::get();
+    DeferCallPool::instance()->call(item);
+    return item.done;
+}
+
+void setDeferCallThreads(int threads)
+{
+    DeferCallPool *pool = DeferCallPool::instance();
+    QMutexLocker locker(&pool->mutex);
+    pool->maxThreads = qMax(1, threads);
+}
+
+int deferCallThreads()
+{
+    DeferCallPool *pool = DeferCallPool::instance();
+    QMutexLocker locker(&pool->mutex);
+    return pool->maxThreads;
+}
+
 QTNETWORKNG_NAMESPACE_END
@@ -1,4 +1,5 @@
 #include "../include/private/coroutine_p.h"
+#include "../include/private/tracing_p.h"
 #include <windows.h>
 #include <winbase.h>
 #include <QtCore/qdebug.h>
@@ -14,6 +15,8 @@ public:
     bool raise(CoroutineException *exception = nullptr);
     bool yield();
     void cleanup() { q_ptr->cleanup(); }
+    static CoroutineSliceStats *sliceStatsOf(BaseCoroutine *coroutine) { return &coroutine->dd_ptr->stats; }
+    static CoroutineLocalValues *localsOf(BaseCoroutine *coroutine) { return &coroutine->dd_ptr->locals; }
 public:
     BaseCoroutine * const q_ptr;
     BaseCoroutine * previous;
@@ -22,6 +25,9 @@ public:
     CoroutineException *exception;
     LPVOID context;
     bool bad;
+    bool trimming;  // fibers manage their own stacks, it is only kept.
+    CoroutineSliceStats stats;
+    CoroutineLocalValues locals;
     Q_DECLARE_PUBLIC(BaseCoroutine)
 };
 
@@ -52,7 +58,7 @@ void CALLBACK run_stub(BaseCoroutinePrivate *coroutine)
 
 
 BaseCoroutinePrivate::BaseCoroutinePrivate(BaseCoroutine *q, BaseCoroutine *previous, size_t stackSize)
-    :q_ptr(q), previous(previous), stackSize(stackSize), state(BaseCoroutine::Initialized), exception(nullptr), context(nullptr),  bad(false)
+    :q_ptr(q), previous(previous), stackSize(stackSize), state(BaseCoroutine::Initialized), exception(nullptr), context(nullptr),  bad(false), trimming(false)
 {
 
 }
@@ -159,6 +165,8 @@ bool BaseCoroutinePrivate::yield()
     }
 
     currentCoroutine().set(q);
+    accountCoroutineSwitch(old, q);
+    QTNG_TRACE_INSTANT("coroutine", "resume", "from", old->id());
     SwitchToFiber(context);
     if (currentCoroutine().get() != old) { // when coroutine finished, swapcontext auto yield to the previous.
         currentCoroutine().set(old);
@@ -209,6 +217,18 @@ BaseCoroutine* createMainCoroutine()
 }
 
 
+CoroutineSliceStats *coroutineSliceStats(BaseCoroutine *coroutine)
+{
+    return BaseCoroutinePrivate::sliceStatsOf(coroutine);
+}
+
+
+CoroutineLocalValues *coroutineLocalValues(BaseCoroutine *coroutine)
+{
+    return BaseCoroutinePrivate::localsOf(coroutine);
+}
+
+
 // here comes the public class.
 BaseCoroutine::BaseCoroutine(BaseCoroutine *previous, size_t stackSize)
     :dd_ptr(new BaseCoroutinePrivate(this, previous, stackSize))
@@ -259,6 +279,34 @@ void BaseCoroutine::cleanup()
 }
 
 
+size_t BaseCoroutine::stackHighWaterMark() const
+{
+    // fibers manage their own stacks.
+    return 0;
+}
+
+
+size_t BaseCoroutine::stackSize() const
+{
+    Q_D(const BaseCoroutine);
+    return d->stackSize;
+}
+
+
+void BaseCoroutine::setStackTrimmingEnabled(bool enabled)
+{
+    Q_D(BaseCoroutine);
+    d->trimming = enabled;
+}
+
+
+bool BaseCoroutine::isStackTrimmingEnabled() const
+{
+    Q_D(const BaseCoroutine);
+    return d->trimming;
+}
+
+
 BaseCoroutine *BaseCoroutine::previous() const
 {
     Q_D(const BaseCoroutine);
@@ -1,8 +1,12 @@
 #include <QtCore/qmap.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qqueue.h>
 #include <QtCore/qpointer.h>
 #include <QtCore/qsharedpointer.h>
+#include <QtCore/qscopedpointer.h>
 #include <QtCore/qendian.h>
 #include <QtCore/qdatetime.h>
+#include <QtCore/qatomic.h>
 #include "../include/locks.h"
 #include "../include/coroutine_utils.h"
 #include "../include/data_channel.h"
@@ -10,6 +14,21 @@
 #ifndef QTNG_NO_CRYPTO
 #  include "../include/ssl.h"
 #endif
+#ifdef QTNG_HAVE_ZLIB
+#  include "../include/gzip.h"
+#endif
+#include "../include/compression.h"
+#include "../include/metrics.h"
+#include "../include/buffer_budget.h"
+#include "../include/private/tracing_p.h"
+#include "../include/private/eventloop_p.h"
+#ifdef Q_OS_UNIX
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <sys/syscall.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
 
 #include "debugger.h"
 
@@ -25,8 +44,20 @@ const quint8 DESTROY_CHANNEL_REQUEST = 3;
 const quint8 SLOW_DOWN_REQUEST = 4;
 const quint8 GO_THROUGH_REQUEST = 5;
 const quint8 KEEPALIVE_REQUEST = 6;
+const quint8 WINDOW_UPDATE_REQUEST = 7;
+const quint8 COMPRESSION_REQUEST = 8;  // the sender can decompress packets.
+const quint8 COMPACT_FRAMING_REQUEST = 9;  // the sender can read the compact framing.
+const quint8 COMPACT_FRAMING_STARTED_REQUEST = 10;  // the following frames are compact.
+const quint8 ZSTD_COMPRESSION_REQUEST = 11;  // the sender can decompress zstd packets.
+const quint8 ZSTD_COMPRESSION_STARTED_REQUEST = 12;  // the following compressed packets are zstd.
 const quint32 DefaultPacketSize = 1024 * 64;
 const quint32 DefaultPayloadSize = 1400;
+const quint32 MoreFragmentsFlag = 0x80000000;  // the highest bit of payload size.
+const quint32 CompressedFlag = 0x40000000;
+const quint32 DefaultCompressionThreshold = 256;
+const int DefaultZstdLevel = 3;
+const int SendingBatchSize = 1024 * 64;
+const qint64 MaxReassemblingBytes = 1024 * 1024 * 16;  // of all channels, or 4 packets of the largest size.
 
 static QByteArray packMakeChannelRequest(quint32 channelNumber)
 {
@@ -73,6 +104,92 @@ static QByteArray packKeepaliveRequest()
     return QByteArray(reinterpret_cast<char *>(buf), sizeof(buf));
 }
 
+static QByteArray packCompressionRequest()
+{
+    uchar buf[sizeof(quint8)];
+    qToBigEndian(COMPRESSION_REQUEST, buf);
+    return QByteArray(reinterpret_cast<char *>(buf), sizeof(buf));
+}
+
+static QByteArray packCompactFramingRequest(bool started)
+{
+    uchar buf[sizeof(quint8)];
+    qToBigEndian(started ? COMPACT_FRAMING_STARTED_REQUEST : COMPACT_FRAMING_REQUEST, buf);
+    return QByteArray(reinterpret_cast<char *>(buf), sizeof(buf));
+}
+
+static QByteArray packZstdCompressionRequest(bool started)
+{
+    uchar buf[sizeof(quint8)];
+    qToBigEndian(started ? ZSTD_COMPRESSION_STARTED_REQUEST : ZSTD_COMPRESSION_REQUEST, buf);
+    return QByteArray(reinterpret_cast<char *>(buf), sizeof(buf));
+}
+
+// the compact frame is varint(payloadSize << 2 | more << 1 | compressed) + varint(zigzag(channelNumber)). the channel
+// numbers of negative pole count down from 0xffffffff, so they are small after zigzag as int32.
+const int MaxCompactHeaderSize = 10;
+
+static inline int writeVarint(uchar *buf, quint32 value)
+{
+    int n = 0;
+    while (value >= 0x80) {
+        buf[n++] = static_cast<uchar>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = static_cast<uchar>(value);
+    return n;
+}
+
+static bool readVarint(BufferedSocketReader &reader, quint32 *value)
+{
+    quint32 result = 0;
+    for (int i = 0; i < 5; ++i) {
+        if (reader.bufferedSize() == 0 && reader.fill() <= 0) {
+            return false;
+        }
+        const quint8 b = static_cast<quint8>(*reader.bufferedData());
+        reader.skip(1);
+        if (i == 4 && b > 0x0f) {
+            return false;
+        }
+        result |= static_cast<quint32>(b & 0x7f) << (7 * i);
+        if (!(b & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool isConnectionCommand(const QByteArray &packet)
+{
+    if (packet.size() != sizeof(quint8)) {
+        return false;
+    }
+    const quint8 command = static_cast<quint8>(packet.at(0));
+    return command == COMPRESSION_REQUEST || command == COMPACT_FRAMING_REQUEST
+            || command == COMPACT_FRAMING_STARTED_REQUEST;
+}
+
+static inline quint32 zigzagChannelNumber(quint32 channelNumber)
+{
+    return (channelNumber << 1) ^ (channelNumber & 0x80000000 ? 0xffffffff : 0);
+}
+
+static inline quint32 unzigzagChannelNumber(quint32 value)
+{
+    return (value >> 1) ^ (value & 1 ? 0xffffffff : 0);
+}
+
+static QByteArray packWindowUpdateRequest(quint32 increment)
+{
+    uchar buf[sizeof(quint8) + sizeof(quint32)];
+    qToBigEndian(WINDOW_UPDATE_REQUEST, buf);
+    qToBigEndian(increment, buf + sizeof(quint8));
+    return QByteArray(reinterpret_cast<char *>(buf), sizeof(buf));
+}
+
+// the channelNumber is the increment of window for WINDOW_UPDATE_REQUEST.
 static bool unpackCommand(QByteArray data, quint8 *command, quint32 *channelNumber)
 {
     if (data.size() == (sizeof(quint8) + sizeof(quint32))) {
@@ -82,7 +199,7 @@ static bool unpackCommand(QByteArray data, quint8 *command, quint32 *channelNumb
         *command = qFromBigEndian<quint8>(reinterpret_cast<const uchar *>(data.constData()));
 #endif
         if (*command != MAKE_CHANNEL_REQUEST && *command != CHANNEL_MADE_REQUEST
-            && *command != DESTROY_CHANNEL_REQUEST) {
+            && *command != DESTROY_CHANNEL_REQUEST && *command != WINDOW_UPDATE_REQUEST) {
             return false;
         }
 #if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
@@ -97,7 +214,9 @@ static bool unpackCommand(QByteArray data, quint8 *command, quint32 *channelNumb
 #else
         *command = qFromBigEndian<quint8>(reinterpret_cast<const uchar *>(data.constData()));
 #endif
-        if (*command != GO_THROUGH_REQUEST && *command != SLOW_DOWN_REQUEST && *command != KEEPALIVE_REQUEST) {
+        if (*command != GO_THROUGH_REQUEST && *command != SLOW_DOWN_REQUEST && *command != KEEPALIVE_REQUEST
+            && *command != COMPRESSION_REQUEST && *command != COMPACT_FRAMING_REQUEST
+            && *command != COMPACT_FRAMING_STARTED_REQUEST) {
             return false;
         }
         return true;
@@ -119,8 +238,13 @@ public:
     QSharedPointer<VirtualChannel> takeChannel(quint32 channelNumber);
     bool removeChannel(VirtualChannel *channel);
     QByteArray recvPacket();
+    QList<QByteArray> recvPackets(quint32 maxCount);
+    void ackReceivedPackets(quint32 sizeBefore, quint32 bytes);
     bool sendPacket(const QByteArray &packet);
+    bool sendPackets(const QList<QByteArray> &packets);
     bool sendPacketAsync(const QByteArray &packet);
+    bool sendReservedPacket(QByteArray &packet);
+    void setReceivingWindow(quint32 window);
     QString toString() const;
 
     // must be implemented by subclasses
@@ -134,19 +258,31 @@ public:
     virtual quint32 payloadSizeHint() const = 0;
     virtual quint32 headerSize() const = 0;
     virtual QSharedPointer<SocketLike> getBackend() const = 0;
+    // the headers of virtual channels are written to the reserved bytes of packet in place.
+    virtual quint32 reservedHeaderSize() const;
+    virtual bool sendReservedPacketRaw(quint32 channelNumber, QByteArray &packet, quint32 reserved, bool blocking);
+    // the commands about the whole connection.
+    virtual bool handleConnectionCommand(quint8 command) = 0;
 
     // called by the subclasses.
     bool handleCommand(const QByteArray &packet);
     void notifyChannelClose(quint32 channelNumber);
-    DataChannel::ChannelError handleIncomingPacket(quint32 channelNumber, const QByteArray &payload);
+    bool acquireSendingWindow(int size);
+    // the header of sub channel is removed from payload in place, which saves a copy if payload is not shared.
+    DataChannel::ChannelError handleIncomingPacket(quint32 channelNumber, QByteArray &payload);
 
     QString name;
     DataChannelPole pole;
     quint32 nextChannelNumber;
-    QMap<quint32, QWeakPointer<VirtualChannel>> subChannels;
+    QHash<quint32, QWeakPointer<VirtualChannel>> subChannels;  // looked up by every packet.
     Queue<QSharedPointer<VirtualChannel>> pendingChannels;
     Queue<QByteArray> receivingQueue;
+    BufferCharge receivingBytes;  // of the packets in receivingQueue.
     Gate goThrough;
+    Gate windowOpened;  // closed if the peer's credits are used up.
+    qint64 sendingWindow;  // bytes granted by the peer, -1 if the peer does not use credits.
+    quint32 receivingWindow;  // bytes granted to the peer, 0 if disabled.
+    quint32 unackedBytes;  // read by recvPacket() but not credited to the peer yet.
     DataChannel::ChannelError error;
 
     QSharedPointer<DataChannel> pluggedChannel;
@@ -169,21 +305,244 @@ class WritingPacket
 public:
     WritingPacket()
         : channelNumber(0)
+        , more(false)
     {
     }
     WritingPacket(quint32 channelNumber, const QByteArray &packet, QSharedPointer<ValueEvent<bool>> done)
         : packet(packet)
         , done(done)
         , channelNumber(channelNumber)
+        , more(false)
     {
     }
 
     QByteArray packet;
     QSharedPointer<ValueEvent<bool>> done;
     quint32 channelNumber;
+    bool more;  // a fragment followed by others of the same packet.
     bool isValid() { return !(channelNumber == 0 && packet.isNull() && done.isNull()); }
 };
 
+// the sending queue of socket channel. the commands go first, and others are scheduled by deficit round robin of
+// channels, so a bulk channel can not delay the small packets of others. a large packet is returned by fragments if
+// fragmentSize > 0, and the fragments of one packet are never mixed with other packets of the same channel.
+class SendingScheduler
+{
+public:
+    explicit SendingScheduler(quint32 capacity);
+public:
+    bool put(const WritingPacket &writingPacket);  // blocked until not full.
+    void putForcedly(const WritingPacket &writingPacket);
+    WritingPacket get(quint32 quantum, quint32 fragmentSize);  // blocked until not empty.
+    // remove the matched packets which are not started, a partly sent packet must be finished.
+    QList<WritingPacket> take(quint32 channelNumber, std::function<bool(const QByteArray &)> check);
+    QList<WritingPacket> takeAll();
+    void setWeight(quint32 channelNumber, quint32 weight);
+    quint32 weight(quint32 channelNumber) const { return weights.value(channelNumber, 1); }
+    void removeWeight(quint32 channelNumber) { weights.remove(channelNumber); }
+    bool isEmpty() const { return count == 0; }
+    quint32 size() const { return count; }
+private:
+    struct Flow
+    {
+        Flow()
+            : offset(0)
+            , deficit(0)
+            , charged(false)
+        {
+        }
+        QQueue<WritingPacket> packets;
+        int offset;  // of the first packet which is sent partly.
+        qint64 deficit;
+        bool charged;  // the quantum of this round is added.
+    };
+    void updateEvents();
+private:
+    QQueue<WritingPacket> commands;
+    QHash<quint32, Flow> flows;
+    QList<quint32> activeFlows;
+    QHash<quint32, quint32> weights;
+    Event notEmpty;
+    Event notFull;
+    BufferCharge budget;  // the bytes not sent yet.
+    quint32 count;
+    quint32 capacity;
+};
+
+SendingScheduler::SendingScheduler(quint32 capacity)
+    : budget(BufferBudget::DataChannelSending)
+    , count(0)
+    , capacity(capacity)
+{
+    notEmpty.clear();
+    notFull.set();
+}
+
+void SendingScheduler::updateEvents()
+{
+    if (count == 0) {
+        notEmpty.clear();
+    } else {
+        notEmpty.set();
+    }
+    if (count >= capacity) {
+        notFull.clear();
+    } else {
+        notFull.set();
+    }
+}
+
+bool SendingScheduler::put(const WritingPacket &writingPacket)
+{
+    // the senders are slowed down if too many bytes are buffered by the process.
+    if (budget.isPressured()) {
+        budget.waitForRoom();
+    }
+    if (!notFull.wait()) {
+        return false;
+    }
+    putForcedly(writingPacket);
+    return true;
+}
+
+void SendingScheduler::putForcedly(const WritingPacket &writingPacket)
+{
+    if (writingPacket.channelNumber == CommandChannelNumber) {
+        commands.enqueue(writingPacket);
+    } else {
+        Flow &flow = flows[writingPacket.channelNumber];
+        if (flow.packets.isEmpty()) {
+            activeFlows.append(writingPacket.channelNumber);
+        }
+        flow.packets.enqueue(writingPacket);
+    }
+    budget.add(writingPacket.packet.size());
+    ++count;
+    updateEvents();
+}
+
+WritingPacket SendingScheduler::get(quint32 quantum, quint32 fragmentSize)
+{
+    if (!notEmpty.wait() || count == 0) {
+        return WritingPacket();
+    }
+    if (!commands.isEmpty()) {
+        --count;
+        updateEvents();
+        const WritingPacket &command = commands.dequeue();
+        budget.sub(command.packet.size());
+        return command;
+    }
+    while (true) {
+        const quint32 channelNumber = activeFlows.first();
+        Flow &flow = flows[channelNumber];
+        const WritingPacket &head = flow.packets.head();
+        const int rest = head.packet.size() - flow.offset;
+        const int n = (fragmentSize > 0 && rest > static_cast<int>(fragmentSize)) ? static_cast<int>(fragmentSize)
+                                                                                  : rest;
+        if (!flow.charged) {
+            flow.deficit += static_cast<qint64>(quantum) * weight(channelNumber);
+            flow.charged = true;
+        }
+        if (flow.deficit < n) {
+            flow.charged = false;
+            activeFlows.append(activeFlows.takeFirst());
+            continue;
+        }
+        flow.deficit -= n;
+        budget.sub(n);
+        WritingPacket result;
+        if (n == rest) {
+            result = flow.packets.dequeue();
+            if (flow.offset > 0) {
+                result.packet = result.packet.mid(flow.offset);
+                flow.offset = 0;
+            }
+            --count;
+        } else {
+            result = WritingPacket(channelNumber, head.packet.mid(flow.offset, n), QSharedPointer<ValueEvent<bool>>());
+            result.more = true;
+            flow.offset += n;
+        }
+        if (flow.packets.isEmpty()) {
+            // an idle channel does not save the deficit.
+            flows.remove(channelNumber);
+            activeFlows.removeFirst();
+        }
+        updateEvents();
+        return result;
+    }
+}
+
+QList<WritingPacket> SendingScheduler::take(quint32 channelNumber, std::function<bool(const QByteArray &)> check)
+{
+    QList<WritingPacket> removed;
+    QQueue<WritingPacket> *packets;
+    int start = 0;
+    if (channelNumber == CommandChannelNumber) {
+        packets = &commands;
+    } else {
+        if (!flows.contains(channelNumber)) {
+            return removed;
+        }
+        Flow &flow = flows[channelNumber];
+        packets = &flow.packets;
+        start = flow.offset > 0 ? 1 : 0;
+    }
+    for (int i = packets->size() - 1; i >= start; --i) {
+        if (check(packets->at(i).packet)) {
+            removed.prepend(packets->takeAt(i));
+        }
+    }
+    if (packets->isEmpty() && channelNumber != CommandChannelNumber) {
+        flows.remove(channelNumber);
+        activeFlows.removeOne(channelNumber);
+    }
+    for (const WritingPacket &writingPacket : removed) {
+        budget.sub(writingPacket.packet.size());
+    }
+    count -= static_cast<quint32>(removed.size());
+    updateEvents();
+    return removed;
+}
+
+QList<WritingPacket> SendingScheduler::takeAll()
+{
+    QList<WritingPacket> removed = commands;
+    for (quint32 channelNumber : activeFlows) {
+        removed.append(flows.value(channelNumber).packets);
+    }
+    commands.clear();
+    flows.clear();
+    activeFlows.clear();
+    budget.set(0);
+    count = 0;
+    updateEvents();
+    return removed;
+}
+
+void SendingScheduler::setWeight(quint32 channelNumber, quint32 weight)
+{
+    if (weight <= 1) {
+        weights.remove(channelNumber);
+    } else {
+        weights.insert(channelNumber, weight);
+    }
+}
+
+class SocketChannelPrivate;
+// borrowed by the coarse timers of eventloop, so the keepalives of idle channels take no coroutine.
+struct KeepaliveFunctor : public Functor
+{
+    explicit KeepaliveFunctor(SocketChannelPrivate *channel)
+        : Functor(true)
+        , channel(channel)
+    {
+    }
+    virtual void operator()() override;
+    SocketChannelPrivate * const channel;
+};
+
 class SocketChannelPrivate : public DataChannelPrivate
 {
 public:
@@ -199,13 +558,17 @@ public:
     virtual quint32 payloadSizeHint() const override;
     virtual quint32 headerSize() const override;
     virtual QSharedPointer<SocketLike> getBackend() const override;
+    virtual bool handleConnectionCommand(quint8 command) override;
+    bool compressPacket(WritingPacket *writingPacket);
     void doSend();
     void doReceive();
-    void doKeepalive();
+    void checkKeepalive();
+    void armKeepalive(qint64 now);
+    void rearmKeepalive();  // after the timeout or interval is changed.
     HostAddress getPeerAddress();
 
     const QSharedPointer<SocketLike> connection;
-    Queue<WritingPacket> sendingQueue;
+    SendingScheduler sendingQueue;
     CoroutineGroup *operations;
     quint32 _maxPayloadSize;
     quint32 _payloadSizeHint;
@@ -213,6 +576,28 @@ public:
     qint64 lastKeepaliveTimestamp;
     qint64 keepaliveTimeout;
     qint64 keepaliveInterval;
+    KeepaliveFunctor keepaliveFunctor;
+    int keepaliveTimerId;
+    quint32 flushDelay;  // msecs.
+    bool fragmentation;  // send the packets larger than payloadSizeHint by fragments.
+#ifdef QTNG_HAVE_ZLIB
+    QScopedPointer<PacketCompressor> compressor;  // for all channels, created at the first compressed packet.
+    QScopedPointer<PacketDecompressor> decompressor;
+#endif
+    QScopedPointer<ZstdPacketCompressor> zstdCompressor;
+    QScopedPointer<ZstdPacketDecompressor> zstdDecompressor;
+    int compressionLevel;
+    quint32 compressionThreshold;
+    bool compressionEnabled;
+    bool peerCompression;  // the peer can decompress packets.
+    bool zstdEnabled;
+    bool peerZstd;  // the peer can decompress zstd packets.
+    bool sendingZstd;  // switched after ZSTD_COMPRESSION_STARTED_REQUEST is encoded.
+    bool receivingZstd;
+    bool compactFramingEnabled;
+    bool peerCompactFraming;  // the peer can read compact frames.
+    bool sendingCompact;  // switched after COMPACT_FRAMING_STARTED_REQUEST is encoded.
+    bool receivingCompact;
 
     Q_DECLARE_PUBLIC(SocketChannel)
 };
@@ -233,9 +618,14 @@ public:
     virtual quint32 payloadSizeHint() const override;
     virtual quint32 headerSize() const override;
     virtual QSharedPointer<SocketLike> getBackend() const override;
+    virtual quint32 reservedHeaderSize() const override;
+    virtual bool sendReservedPacketRaw(quint32 channelNumber, QByteArray &packet, quint32 reserved,
+                                       bool blocking) override;
+    virtual bool handleConnectionCommand(quint8 command) override;
 
     QPointer<DataChannel> parentChannel;
     quint32 channelNumber;
+    quint32 weight;
 
     Q_DECLARE_PUBLIC(VirtualChannel)
 };
@@ -243,6 +633,10 @@ public:
 DataChannelPrivate::DataChannelPrivate(DataChannelPole pole, DataChannel *parent)
     : pole(pole)
     , receivingQueue(1024)  // may consume 1024 * maxPayloadSize bytes.
+    , receivingBytes(BufferBudget::DataChannelReceiving)
+    , sendingWindow(-1)
+    , receivingWindow(0)
+    , unackedBytes(0)
     , error(DataChannel::NoError)
     , q_ptr(parent)
 {
@@ -294,7 +688,8 @@ void DataChannelPrivate::abort(DataChannel::ChannelError reason)
         pendingChannels.put(QSharedPointer<VirtualChannel>());
     }
     goThrough.open();
-    for (QMapIterator<quint32, QWeakPointer<VirtualChannel>> itor(subChannels); itor.hasNext();) {
+    windowOpened.open();
+    for (QHashIterator<quint32, QWeakPointer<VirtualChannel>> itor(subChannels); itor.hasNext();) {
         const QWeakPointer<VirtualChannel> &subChannel = itor.next().value();
         if (!subChannel.isNull()) {
             QSharedPointer<VirtualChannel> strong = subChannel.toStrongRef();
@@ -305,7 +700,7 @@ void DataChannelPrivate::abort(DataChannel::ChannelError reason)
     subChannels.clear();
 }
 
-DataChannel::ChannelError DataChannelPrivate::handleIncomingPacket(quint32 channelNumber, const QByteArray &payload)
+DataChannel::ChannelError DataChannelPrivate::handleIncomingPacket(quint32 channelNumber, QByteArray &payload)
 {
     if (!pluggedChannel.isNull()) {
         if (!getPrivateHelper(pluggedChannel)->sendPacketRaw(channelNumber, payload, false)) {
@@ -319,6 +714,7 @@ DataChannel::ChannelError DataChannelPrivate::handleIncomingPacket(quint32 chann
         if (receivingQueue.size() == (receivingQueue.capacity() * 3 / 4)) {
             sendPacketRaw(CommandChannelNumber, packSlowDownRequest(), false);
         }
+        receivingBytes.add(payload.size());
         receivingQueue.putForcedly(payload);
     } else if (channelNumber == CommandChannelNumber) {
         if (!handleCommand(payload)) {
@@ -345,11 +741,11 @@ DataChannel::ChannelError DataChannelPrivate::handleIncomingPacket(quint32 chann
 #if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
             quint32 channelNumber = qFromBigEndian<quint32>(payload.constData());
 #else
-            quint32 channelNumber = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(packet.constData()));
+            quint32 channelNumber = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(payload.constData()));
 #endif
-            const QByteArray &packet = payload.mid(headerSize);
+            payload.remove(0, headerSize);
             DataChannel::ChannelError handlePacketResult =
-                    channel->d_func()->handleIncomingPacket(channelNumber, packet);
+                    channel->d_func()->handleIncomingPacket(channelNumber, payload);
             if (handlePacketResult != DataChannel::NoError) {
 #ifdef DEBUG_PROTOCOL
                 qtng_debug << "the sub channel got an too small packet: " << channelNumber << payload.size()
@@ -387,6 +783,8 @@ QSharedPointer<VirtualChannel> DataChannelPrivate::makeChannel()
     nextChannelNumber += this->pole;
     QSharedPointer<VirtualChannel> channel = makeChannelInternal(DataChannelPole::PositivePole, channelNumber);
     sendPacketRaw(CommandChannelNumber, packMakeChannelRequest(channelNumber), false);
+    // the sub channel inherits the window, and grants it after the peer knows the channel.
+    channel->d_func()->setReceivingWindow(receivingWindow);
     return channel;
 }
 
@@ -432,25 +830,148 @@ QByteArray DataChannelPrivate::recvPacket()
     if (packet.isNull()) {
         return QByteArray();
     }
-    if (receivingQueue.size() == (receivingQueue.capacity() / 2)) {
+    receivingBytes.sub(packet.size());
+    ackReceivedPackets(receivingQueue.size() + 1, static_cast<quint32>(packet.size()));
+    return packet;
+}
+
+QList<QByteArray> DataChannelPrivate::recvPackets(quint32 maxCount)
+{
+    QList<QByteArray> packets;
+    if (receivingQueue.isEmpty() && error != DataChannel::NoError) {
+        return packets;
+    }
+    packets = receivingQueue.getMany(maxCount);
+    // the null packets wake up the receivers after aborted.
+    for (int i = 0; i < packets.size(); ++i) {
+        if (packets.at(i).isNull()) {
+            packets.erase(packets.begin() + i, packets.end());
+            break;
+        }
+    }
+    quint32 bytes = 0;
+    for (const QByteArray &packet : packets) {
+        bytes += static_cast<quint32>(packet.size());
+    }
+    receivingBytes.sub(bytes);
+    if (!packets.isEmpty()) {
+        ackReceivedPackets(receivingQueue.size() + static_cast<quint32>(packets.size()), bytes);
+    }
+    return packets;
+}
+
+void DataChannelPrivate::ackReceivedPackets(quint32 sizeBefore, quint32 bytes)
+{
+    const quint32 half = receivingQueue.capacity() / 2;
+    if (sizeBefore > half && receivingQueue.size() <= half) {
         sendPacketRaw(CommandChannelNumber, packGoThroughRequest(), false);
     }
-    return packet;
+    if (receivingWindow > 0) {
+        // credit the peer in batches, like the WINDOW_UPDATE of http2.
+        unackedBytes += bytes;
+        if (unackedBytes >= receivingWindow / 2) {
+            sendPacketRaw(CommandChannelNumber, packWindowUpdateRequest(unackedBytes), false);
+            unackedBytes = 0;
+        }
+    }
 }
 
-bool DataChannelPrivate::sendPacket(const QByteArray &packet)
+bool DataChannelPrivate::acquireSendingWindow(int size)
 {
     if (!goThrough.wait()) {
         return false;
     }
+    // a packet larger than the rest of window is allowed, so the window may be smaller than packets.
+    if (!windowOpened.wait() || error != DataChannel::NoError) {
+        return false;
+    }
+    if (sendingWindow >= 0) {
+        sendingWindow -= size;
+        if (sendingWindow <= 0) {
+            windowOpened.close();
+        }
+    }
+    return true;
+}
+
+bool DataChannelPrivate::sendPacket(const QByteArray &packet)
+{
+    if (!acquireSendingWindow(packet.size())) {
+        return false;
+    }
     return sendPacketRaw(DataChannelNumber, packet, true);
 }
 
+bool DataChannelPrivate::sendPackets(const QList<QByteArray> &packets)
+{
+    for (int i = 0; i < packets.size(); ++i) {
+        const QByteArray &packet = packets.at(i);
+        if (!acquireSendingWindow(packet.size())) {
+            return false;
+        }
+        // only the last one waits to be sent, the others go to the queue at once.
+        if (!sendPacketRaw(DataChannelNumber, packet, i == packets.size() - 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DataChannelPrivate::sendReservedPacket(QByteArray &packet)
+{
+    const quint32 reserved = reservedHeaderSize();
+    if (static_cast<quint32>(packet.size()) <= reserved) {
+        return false;
+    }
+    if (!acquireSendingWindow(packet.size() - static_cast<int>(reserved))) {
+        return false;
+    }
+    return sendReservedPacketRaw(DataChannelNumber, packet, reserved, true);
+}
+
+quint32 DataChannelPrivate::reservedHeaderSize() const
+{
+    return 0;
+}
+
+bool DataChannelPrivate::sendReservedPacketRaw(quint32 channelNumber, QByteArray &packet, quint32 reserved,
+                                               bool blocking)
+{
+    if (reserved > 0) {
+        // the packet is made for a virtual channel, so the headers are dropped by copying.
+        packet.remove(0, static_cast<int>(reserved));
+    }
+    return sendPacketRaw(channelNumber, packet, blocking);
+}
+
 bool DataChannelPrivate::sendPacketAsync(const QByteArray &packet)
 {
+    if (sendingWindow >= 0) {
+        sendingWindow -= packet.size();
+        if (sendingWindow <= 0) {
+            windowOpened.close();
+        }
+    }
     return sendPacketRaw(DataChannelNumber, packet, false);
 }
 
+void DataChannelPrivate::setReceivingWindow(quint32 window)
+{
+    if (window == receivingWindow || error != DataChannel::NoError) {
+        receivingWindow = window;
+        return;
+    }
+    if (window == 0) {
+        // the peer can not be switched back, so grant it plenty of credits.
+        sendPacketRaw(CommandChannelNumber, packWindowUpdateRequest(0x7fffffff), false);
+    } else if (window > receivingWindow) {
+        sendPacketRaw(CommandChannelNumber, packWindowUpdateRequest(window - receivingWindow), false);
+    }
+    // a smaller window takes effect after the peer spends the credits granted.
+    receivingWindow = window;
+    unackedBytes = 0;
+}
+
 bool DataChannelPrivate::handleCommand(const QByteArray &packet)
 {
     quint8 command;
@@ -472,6 +993,7 @@ bool DataChannelPrivate::handleCommand(const QByteArray &packet)
         }
         QSharedPointer<VirtualChannel> channel = makeChannelInternal(DataChannelPole::NegativePole, channelNumber);
         sendPacketRaw(CommandChannelNumber, packChannelMadeRequest(channelNumber), false);
+        channel->d_func()->setReceivingWindow(receivingWindow);
         pendingChannels.put(channel);
         return true;
     } else if (command == CHANNEL_MADE_REQUEST) {
@@ -516,6 +1038,20 @@ bool DataChannelPrivate::handleCommand(const QByteArray &packet)
         return true;
     } else if (command == KEEPALIVE_REQUEST) {
         return true;
+    } else if (command == COMPRESSION_REQUEST || command == COMPACT_FRAMING_REQUEST
+               || command == COMPACT_FRAMING_STARTED_REQUEST || command == ZSTD_COMPRESSION_REQUEST
+               || command == ZSTD_COMPRESSION_STARTED_REQUEST) {
+        return handleConnectionCommand(command);
+    } else if (command == WINDOW_UPDATE_REQUEST) {
+        // the first update switches the sender to credit mode.
+        if (sendingWindow < 0) {
+            sendingWindow = 0;
+        }
+        sendingWindow = qMin<qint64>(sendingWindow + channelNumber, 0x7fffffff);
+        if (sendingWindow > 0) {
+            windowOpened.open();
+        }
+        return true;
     } else {
         qtng_warning << "unknown command.";
         return false;
@@ -538,16 +1074,32 @@ SocketChannelPrivate::SocketChannelPrivate(QSharedPointer<SocketLike> connection
     , operations(new CoroutineGroup())
     , _maxPayloadSize(DefaultPacketSize - sizeof(quint32) * 2)
     , _payloadSizeHint(DefaultPayloadSize)  // tcp fragment size.
-    , lastActiveTimestamp(QDateTime::currentMSecsSinceEpoch())
+    , lastActiveTimestamp(EventLoopCoroutine::get()->now())
     , lastKeepaliveTimestamp(lastActiveTimestamp)
     , keepaliveTimeout(1000 * 10)
     , keepaliveInterval(1000 * 2)
+    , keepaliveFunctor(this)
+    , keepaliveTimerId(0)
+    , flushDelay(0)
+    , fragmentation(false)
+    , compressionLevel(-1)
+    , compressionThreshold(DefaultCompressionThreshold)
+    , compressionEnabled(false)
+    , peerCompression(false)
+    , zstdEnabled(false)
+    , peerZstd(false)
+    , sendingZstd(false)
+    , receivingZstd(false)
+    , compactFramingEnabled(false)
+    , peerCompactFraming(false)
+    , sendingCompact(false)
+    , receivingCompact(false)
 {
     // connection->setOption(Socket::LowDelayOption, true);
     connection->setOption(Socket::KeepAliveOption, false);  // we do it!
     operations->spawnWithName(QString::fromLatin1("receiving"), [this] { this->doReceive(); });
     operations->spawnWithName(QString::fromLatin1("sending"), [this] { this->doSend(); });
-    operations->spawnWithName(QString::fromLatin1("keepalive"), [this] { this->doKeepalive(); });
+    armKeepalive(lastActiveTimestamp);
 }
 
 SocketChannelPrivate::~SocketChannelPrivate()
@@ -579,12 +1131,79 @@ bool SocketChannelPrivate::sendPacketRaw(quint32 channelNumber, const QByteArray
     }
 }
 
+// returns true if the packet is replaced by the compressed one.
+bool SocketChannelPrivate::compressPacket(WritingPacket *writingPacket)
+{
+#ifdef QTNG_HAVE_ZLIB
+    const quint32 size = static_cast<quint32>(writingPacket->packet.size());
+    // the compressed packet may be a little larger for random data.
+    if (!compressionEnabled || !peerCompression || size < compressionThreshold
+        || size + size / 256 + 64 > _maxPayloadSize) {
+        return false;
+    }
+    QByteArray compressed;
+    bool ok;
+    if (sendingZstd) {
+        if (zstdCompressor.isNull()) {
+            zstdCompressor.reset(new ZstdPacketCompressor(compressionLevel < 0 ? DefaultZstdLevel : compressionLevel));
+        }
+        ok = zstdCompressor->compress(writingPacket->packet, &compressed);
+    } else {
+        if (compressor.isNull()) {
+            compressor.reset(new PacketCompressor(compressionLevel));
+        }
+        ok = compressor->compress(writingPacket->packet, &compressed);
+    }
+    if (!ok || static_cast<quint32>(compressed.size()) > _maxPayloadSize) {
+        // the dictionary of peer is out of sync now.
+        abort(DataChannel::SendingError);
+        return false;
+    }
+    writingPacket->packet = compressed;
+    return true;
+#else
+    Q_UNUSED(writingPacket);
+    return false;
+#endif
+}
+
+bool SocketChannelPrivate::handleConnectionCommand(quint8 command)
+{
+    if (command == COMPRESSION_REQUEST) {
+        peerCompression = true;
+    } else if (command == COMPACT_FRAMING_REQUEST) {
+        if (!peerCompactFraming && compactFramingEnabled) {
+            sendPacketRaw(CommandChannelNumber, packCompactFramingRequest(true), false);
+        }
+        peerCompactFraming = true;
+    } else if (command == COMPACT_FRAMING_STARTED_REQUEST) {
+        // this command is handled before reading the next header.
+        receivingCompact = true;
+    } else if (command == ZSTD_COMPRESSION_REQUEST) {
+        if (!peerZstd && zstdEnabled) {
+            sendPacketRaw(CommandChannelNumber, packZstdCompressionRequest(true), false);
+        }
+        peerZstd = true;
+    } else if (command == ZSTD_COMPRESSION_STARTED_REQUEST) {
+        receivingZstd = true;
+    }
+    return true;
+}
+
+// the queued packets are sent together by one sendall(), which is one syscall and one tls record for small packets.
+// if the connection keeps messages, such as KcpSocket in message mode, every batch is one message which holds whole
+// frames, so the receiver reads it by one recv() instead of assembling the stream of mss sized pieces.
 void SocketChannelPrivate::doSend()
 {
+    const int headerSize = static_cast<int>(sizeof(quint32) + sizeof(quint32));
+    const QByteArray &compactFramingStarted = packCompactFramingRequest(true);
+    const QByteArray &zstdCompressionStarted = packZstdCompressionRequest(true);
+    QByteArray buf;
+    QList<QSharedPointer<ValueEvent<bool>>> batchDone;
     while (true) {
         WritingPacket writingPacket;
         try {
-            writingPacket = sendingQueue.get();
+            writingPacket = sendingQueue.get(_payloadSizeHint, fragmentation ? _payloadSizeHint : 0);
         } catch (CoroutineExitException) {
             Q_ASSERT(error != DataChannel::NoError);
             return;
@@ -601,21 +1220,100 @@ void SocketChannelPrivate::doSend()
             }
             return;
         }
+        if (flushDelay > 0 && sendingQueue.size() * _payloadSizeHint < static_cast<quint32>(SendingBatchSize)) {
+            // trade a little latency for fewer packets.
+            try {
+                Coroutine::msleep(flushDelay);
+            } catch (CoroutineExitException) {
+                if (!writingPacket.done.isNull()) {
+                    writingPacket.done->send(false);
+                }
+                return;
+            }
+        }
 
-        uchar header[sizeof(quint32) + sizeof(quint32)];
-        qToBigEndian<quint32>(static_cast<quint32>(writingPacket.packet.size()), header);
-        qToBigEndian<quint32>(writingPacket.channelNumber, header + sizeof(quint32));
-        QByteArray data;
-        data.reserve(static_cast<int>(sizeof(header)) + writingPacket.packet.size());
-        data.append(reinterpret_cast<char *>(header), sizeof(header));
-        data.append(writingPacket.packet);
+        buf.clear();
+        batchDone.clear();
+        bool stopping = false;
+        const qint32 messageSize = connection->maxMessageSize();
+        int batchSize = SendingBatchSize;
+        if (messageSize > 0) {
+            // leave room for the largest frame, so the next one never straddles two messages.
+            batchSize = qMin(batchSize, messageSize - MaxCompactHeaderSize - headerSize
+                                                - static_cast<int>(_maxPayloadSize));
+        }
+        while (true) {
+            uchar header[MaxCompactHeaderSize];
+            const bool compressed = compressPacket(&writingPacket);
+            if (error != DataChannel::NoError) {
+                for (QSharedPointer<ValueEvent<bool>> done : batchDone) {
+                    done->send(false);
+                }
+                if (!writingPacket.done.isNull()) {
+                    writingPacket.done->send(false);
+                }
+                return;
+            }
+            const quint32 size = static_cast<quint32>(writingPacket.packet.size());
+            if (sendingCompact) {
+                quint32 sizeAndFlags = (size << 2) | (writingPacket.more ? 2 : 0) | (compressed ? 1 : 0);
+                int n = writeVarint(header, sizeAndFlags);
+                n += writeVarint(header + n, zigzagChannelNumber(writingPacket.channelNumber));
+                buf.append(reinterpret_cast<char *>(header), n);
+            } else {
+                quint32 payloadSize = size;
+                if (writingPacket.more) {
+                    payloadSize |= MoreFragmentsFlag;
+                }
+                if (compressed) {
+                    payloadSize |= CompressedFlag;
+                }
+                qToBigEndian<quint32>(payloadSize, header);
+                qToBigEndian<quint32>(writingPacket.channelNumber, header + sizeof(quint32));
+                buf.append(reinterpret_cast<char *>(header), headerSize);
+            }
+            buf.append(writingPacket.packet);
+            if (writingPacket.channelNumber == CommandChannelNumber) {
+                if (writingPacket.packet == compactFramingStarted) {
+                    sendingCompact = true;
+                } else if (writingPacket.packet == zstdCompressionStarted) {
+                    sendingZstd = true;
+                }
+            }
+            if (!writingPacket.done.isNull()) {
+                batchDone.append(writingPacket.done);
+            }
+            if (buf.size() >= batchSize || sendingQueue.isEmpty()) {
+                break;
+            }
+            writingPacket = sendingQueue.get(_payloadSizeHint, fragmentation ? _payloadSizeHint : 0);  // not blocked.
+            if (!writingPacket.isValid() || error != DataChannel::NoError) {
+                if (!writingPacket.done.isNull()) {
+                    writingPacket.done->send(false);
+                }
+                stopping = true;
+                break;
+            }
+        }
 
         int sentBytes;
         try {
-            sentBytes = connection->sendall(data);
+            if (messageSize > 0 && buf.size() > messageSize) {
+                // the max packet size is larger than a message, the receiver reads the frame as a stream.
+                sentBytes = 0;
+                while (sentBytes < buf.size()) {
+                    int n = connection->sendall(buf.constData() + sentBytes, qMin(messageSize, buf.size() - sentBytes));
+                    if (n <= 0) {
+                        break;
+                    }
+                    sentBytes += n;
+                }
+            } else {
+                sentBytes = connection->sendall(buf);
+            }
         } catch (CoroutineExitException) {
-            if (!writingPacket.done.isNull()) {
-                writingPacket.done->send(false);
+            for (QSharedPointer<ValueEvent<bool>> done : batchDone) {
+                done->send(false);
             }
             Q_ASSERT(error != DataChannel::NoError);
             return;
@@ -626,19 +1324,21 @@ void SocketChannelPrivate::doSend()
             return abort(DataChannel::UnknownError);
         }
 
-        if (sentBytes == data.size()) {
-            if (!writingPacket.done.isNull()) {
-                writingPacket.done->send(true);
-            }
-            lastKeepaliveTimestamp = QDateTime::currentMSecsSinceEpoch();
-        } else {
-            if (writingPacket.done.isNull()) {
-                //                continue; // why do this?
-            } else {
-                writingPacket.done->send(false);
-            }
+        const bool success = (sentBytes == buf.size());
+        for (QSharedPointer<ValueEvent<bool>> done : batchDone) {
+            done->send(success);
+        }
+        if (!success) {
             return abort(DataChannel::SendingError);
         }
+        lastKeepaliveTimestamp = EventLoopCoroutine::get()->now();
+        if (stopping) {
+            return;
+        }
+        // do not keep a large buffer for the rest small packets.
+        if (buf.capacity() > SendingBatchSize * 2) {
+            buf = QByteArray();
+        }
     }
 }
 
@@ -647,20 +1347,55 @@ void SocketChannelPrivate::doReceive()
     const size_t headerSize = sizeof(quint32) + sizeof(quint32);
     quint32 payloadSize;
     quint32 channelNumber;
+    bool more;
+    bool compressed;
     QByteArray payload;
+    QHash<quint32, QByteArray> fragments;  // the packets received partly.
+    qint64 fragmentBytes = 0;  // buffered in fragments.
+    const qint64 maxFragmentBytes = qMax<qint64>(MaxReassemblingBytes, static_cast<qint64>(_maxPayloadSize) * 4);
+    // most packets are small, read them together with the next header. a whole message is read in place.
+    qint32 blockSize = 1024 * 16;
+    const qint32 messageSize = connection->maxMessageSize();
+    if (messageSize > 0) {
+        const qint32 largestBatch = SendingBatchSize + static_cast<qint32>(_maxPayloadSize) + MaxCompactHeaderSize;
+        blockSize = qBound<qint32>(blockSize, largestBatch, messageSize);
+    }
+    BufferedSocketReader reader(connection, QByteArray(), blockSize);
     while (true) {
         try {
-            const QByteArray &header = connection->recvall(headerSize);
-            if (header.size() != headerSize) {
-                return abort(DataChannel::ReceivingError);
+            // stop reading the socket while too many bytes are buffered, so the peer is slowed down by tcp.
+            if (reader.bufferedSize() == 0 && receivingBytes.isPressured()) {
+                receivingBytes.waitForRoom();
             }
+            if (receivingCompact) {
+                quint32 sizeAndFlags;
+                if (!readVarint(reader, &sizeAndFlags) || !readVarint(reader, &channelNumber)) {
+                    return abort(DataChannel::ReceivingError);
+                }
+                channelNumber = unzigzagChannelNumber(channelNumber);
+                more = (sizeAndFlags & 2) != 0;
+                compressed = (sizeAndFlags & 1) != 0;
+                payloadSize = sizeAndFlags >> 2;
+            } else {
+                // parse the header in the buffer of reader, without allocation.
+                while (reader.bufferedSize() < static_cast<qint32>(headerSize)) {
+                    if (reader.fill() <= 0) {
+                        return abort(DataChannel::ReceivingError);
+                    }
+                }
+                const char *header = reader.bufferedData();
 #if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-            payloadSize = qFromBigEndian<quint32>(header.data());
-            channelNumber = qFromBigEndian<quint32>(header.data() + sizeof(quint32));
+                payloadSize = qFromBigEndian<quint32>(header);
+                channelNumber = qFromBigEndian<quint32>(header + sizeof(quint32));
 #else
-            packetSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header.data()));
-            channelNumber = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header.data() + sizeof(quint32)));
+                payloadSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header));
+                channelNumber = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header + sizeof(quint32)));
 #endif
+                reader.skip(static_cast<qint32>(headerSize));
+                more = (payloadSize & MoreFragmentsFlag) != 0;
+                compressed = (payloadSize & CompressedFlag) != 0;
+                payloadSize &= ~(MoreFragmentsFlag | CompressedFlag);
+            }
             if (payloadSize > _maxPayloadSize) {
 #ifdef DEBUG_PROTOCOL
                 qtng_debug
@@ -668,7 +1403,7 @@ void SocketChannelPrivate::doReceive()
 #endif
                 return abort(DataChannel::PakcetTooLarge);
             }
-            payload = connection->recvall(static_cast<qint32>(payloadSize));
+            payload = reader.readExactly(static_cast<qint32>(payloadSize));
             if (payload.size() != static_cast<int>(payloadSize)) {
                 qtng_debug << "invalid packet does not fit packet size:" << payloadSize << payload.size();
                 return abort(DataChannel::InvalidPacket);
@@ -679,39 +1414,111 @@ void SocketChannelPrivate::doReceive()
         } catch (...) {
             return abort(DataChannel::UnknownError);
         }
-        DataChannel::ChannelError handlePacketResult = handleIncomingPacket(channelNumber, payload);
-        if (handlePacketResult != DataChannel::NoError) {
-            return abort(handlePacketResult);
+        lastActiveTimestamp = EventLoopCoroutine::get()->now();
+        if (compressed) {
+            QByteArray decompressed;
+            if (receivingZstd) {
+                if (zstdDecompressor.isNull()) {
+                    zstdDecompressor.reset(new ZstdPacketDecompressor());
+                }
+                if (!zstdDecompressor->decompress(payload, &decompressed, static_cast<int>(_maxPayloadSize))) {
+                    return abort(DataChannel::InvalidPacket);
+                }
+            } else {
+#ifdef QTNG_HAVE_ZLIB
+                if (decompressor.isNull()) {
+                    decompressor.reset(new PacketDecompressor());
+                }
+                if (!decompressor->decompress(payload, &decompressed, static_cast<int>(_maxPayloadSize))) {
+                    return abort(DataChannel::InvalidPacket);
+                }
+#else
+                return abort(DataChannel::InvalidPacket);
+#endif
+            }
+            payload = decompressed;
         }
-        lastActiveTimestamp = QDateTime::currentMSecsSinceEpoch();
-    }
-}
-
-void SocketChannelPrivate::doKeepalive()
-{
-    while (true) {
-        Coroutine::sleep(0.5f);
-        qint64 now = QDateTime::currentMSecsSinceEpoch();
-        // now and lastActiveTimestamp both are unsigned int, we should check which is larger before apply minus
-        // operator to them.
-        if (now > lastActiveTimestamp && (now - lastActiveTimestamp > keepaliveTimeout)) {
+        if (more || fragments.contains(channelNumber)) {
+            // the packets of unknown channels are dropped, so are their fragments. the last one is dropped later.
+            if (!fragments.contains(channelNumber) && pluggedChannel.isNull() && channelNumber != DataChannelNumber
+                && channelNumber != CommandChannelNumber && !subChannels.contains(channelNumber)) {
+                continue;
+            }
+            QByteArray &buf = fragments[channelNumber];
+            fragmentBytes += payload.size();
+            if (static_cast<quint32>(buf.size() + payload.size()) > _maxPayloadSize
+                || fragmentBytes > maxFragmentBytes) {
+                return abort(DataChannel::PakcetTooLarge);
+            }
+            buf.append(payload);
+            if (more) {
+                continue;
+            }
+            payload = fragments.take(channelNumber);
+            fragmentBytes -= payload.size();
+        }
+        if (channelNumber == CommandChannelNumber && isConnectionCommand(payload)) {
+            // handled before the next header, and never passed to the plugged channel.
+            if (!handleCommand(payload)) {
+                return abort(DataChannel::InvalidCommand);
+            }
+            continue;
+        }
+        DataChannel::ChannelError handlePacketResult = handleIncomingPacket(channelNumber, payload);
+        if (handlePacketResult != DataChannel::NoError) {
+            return abort(handlePacketResult);
+        }
+    }
+}
+
+void KeepaliveFunctor::operator()()
+{
+    channel->checkKeepalive();
+}
+
+// runs in the eventloop, so it must not block. the timestamps only grow, the timer firing early just arms it again.
+void SocketChannelPrivate::checkKeepalive()
+{
+    keepaliveTimerId = 0;
+    if (error != DataChannel::NoError) {
+        return;
+    }
+    const qint64 now = EventLoopCoroutine::get()->now();
+    if (now - lastActiveTimestamp > keepaliveTimeout) {
 #ifdef DEBUG_PROTOCOL
-            qCDebug(qtng_logger) << "channel is timeout.";
+        qCDebug(qtng_logger) << "channel is timeout.";
 #endif
-            return abort(DataChannel::KeepaliveTimeoutError);
-        }
-        // now and lastKeepaliveTimestamp both are unsigned int, we should check which is larger before apply minus
-        // operator to them.
-        if (now > lastKeepaliveTimestamp && (now - lastKeepaliveTimestamp > keepaliveInterval)
-            && sendingQueue.isEmpty()) {
-            // lastKeepaliveTimestamp = now;  // no need to update the timestamp as the doSend() does it.
-            QSharedPointer<ValueEvent<bool>> done;
+        // abort() kills the coroutines of channel, which is done in a coroutine instead of the eventloop.
+        operations->spawnWithName(QString::fromLatin1("keepalive"),
+                                  [this] { abort(DataChannel::KeepaliveTimeoutError); });
+        return;
+    }
+    if (now - lastKeepaliveTimestamp > keepaliveInterval && sendingQueue.isEmpty()) {
 #ifdef DEBUG_PROTOCOL
-            qCDebug(qtng_logger) << "sending keepalive packet.";
+        qCDebug(qtng_logger) << "sending keepalive packet.";
 #endif
-            sendingQueue.putForcedly(WritingPacket(CommandChannelNumber, packKeepaliveRequest(), done));
-        }
+        sendingQueue.putForcedly(
+                WritingPacket(CommandChannelNumber, packKeepaliveRequest(), QSharedPointer<ValueEvent<bool>>()));
+        lastKeepaliveTimestamp = now;  // doSend() updates it again after the packet is sent.
+    }
+    armKeepalive(now);
+}
+
+void SocketChannelPrivate::armKeepalive(qint64 now)
+{
+    const qint64 due = qMin(lastActiveTimestamp + keepaliveTimeout, lastKeepaliveTimestamp + keepaliveInterval) + 1;
+    const quint32 msecs = static_cast<quint32>(qBound<qint64>(10, due - now, 1000 * 3600));
+    keepaliveTimerId = EventLoopCoroutine::get()->callLaterCoarse(msecs, &keepaliveFunctor);
+}
+
+void SocketChannelPrivate::rearmKeepalive()
+{
+    if (!keepaliveTimerId) {
+        return;
     }
+    EventLoopCoroutine *eventLoop = EventLoopCoroutine::get();
+    eventLoop->cancelCall(keepaliveTimerId);
+    armKeepalive(eventLoop->now());
 }
 
 void SocketChannelPrivate::abort(DataChannel::ChannelError reason)
@@ -726,8 +1533,7 @@ void SocketChannelPrivate::abort(DataChannel::ChannelError reason)
     Coroutine *current = Coroutine::current();
     connection->abort();
 
-    while (!sendingQueue.isEmpty()) {
-        const WritingPacket &writingPacket = sendingQueue.get();
+    for (const WritingPacket &writingPacket : sendingQueue.takeAll()) {
         if (!writingPacket.done.isNull()) {
             writingPacket.done->send(false);
         }
@@ -741,6 +1547,10 @@ void SocketChannelPrivate::abort(DataChannel::ChannelError reason)
     if (operations->get(QString::fromLatin1("keepalive")).data() != current) {
         operations->kill(QString::fromLatin1("keepalive"));
     }
+    if (keepaliveTimerId) {
+        EventLoopCoroutine::get()->cancelCall(keepaliveTimerId);
+        keepaliveTimerId = 0;
+    }
     DataChannelPrivate::abort(reason);
 }
 
@@ -764,25 +1574,17 @@ void SocketChannelPrivate::cleanChannel(quint32 channelNumber, bool sendDestroyP
         notifyChannelClose(channelNumber);
     }
     cleanSendingPacket(channelNumber, alwayTrue);
+    sendingQueue.removeWeight(channelNumber);
 }
 
 void SocketChannelPrivate::cleanSendingPacket(quint32 subChannelNumber,
                                               std::function<bool(const QByteArray &)> subCheckPacket)
 {
-    QList<WritingPacket> reserved;
-    while (!sendingQueue.isEmpty()) {
-        const WritingPacket &writingPacket = sendingQueue.get();
-        if (writingPacket.channelNumber == subChannelNumber && subCheckPacket(writingPacket.packet)) {
-            if (!writingPacket.done.isNull()) {
-                writingPacket.done.data()->send(false);
-            }
-        } else {
-            reserved.append(writingPacket);
+    for (const WritingPacket &writingPacket : sendingQueue.take(subChannelNumber, subCheckPacket)) {
+        if (!writingPacket.done.isNull()) {
+            writingPacket.done.data()->send(false);
         }
     }
-    for (const WritingPacket &writingPacket : reserved) {
-        sendingQueue.putForcedly(writingPacket);
-    }
 }
 
 quint32 SocketChannelPrivate::maxPayloadSize() const
@@ -810,262 +1612,1424 @@ VirtualChannelPrivate::VirtualChannelPrivate(DataChannel *parentChannel, DataCha
     : DataChannelPrivate(pole, parent)
     , parentChannel(parentChannel)
     , channelNumber(channelNumber)
+    , weight(1)
+{
+}
+
+VirtualChannelPrivate::~VirtualChannelPrivate()
+{
+    abort(DataChannel::UserShutdown);
+}
+
+bool VirtualChannelPrivate::sendPacketRaw(quint32 channelNumber, const QByteArray &packet, bool blocking)
+{
+    if (error != DataChannel::NoError || parentChannel.isNull() || packet.isEmpty()) {
+#ifdef DEBUG_PROTOCOL
+        qtng_debug << "the packet is empty?" << (error != DataChannel::NoError) << parentChannel.isNull()
+                   << packet.isEmpty();
+#endif
+        return false;
+    }
+    uchar header[sizeof(quint32)];
+    qToBigEndian(channelNumber, header);
+    QByteArray data;
+    data.reserve(packet.size() + static_cast<int>(sizeof(quint32)));
+    data.append(reinterpret_cast<char *>(header), sizeof(quint32));
+    data.append(packet);
+    return getPrivateHelper(parentChannel)->sendPacketRaw(this->channelNumber, data, blocking);
+}
+
+void VirtualChannelPrivate::abort(DataChannel::ChannelError reason)
+{
+    if (error != DataChannel::NoError) {
+        return;
+    }
+    error = reason;
+    if (!parentChannel.isNull()) {
+        getPrivateHelper(parentChannel)->cleanChannel(channelNumber, true);
+    }
+    DataChannelPrivate::abort(reason);
+}
+
+void VirtualChannelPrivate::cleanChannel(quint32 channelNumber, bool sendDestroyPacket)
+{
+    int found = subChannels.remove(channelNumber);
+    if (error != DataChannel::NoError || parentChannel.isNull() || found <= 0) {
+        return;
+    }
+    if (sendDestroyPacket) {
+        notifyChannelClose(channelNumber);
+    }
+    getPrivateHelper(parentChannel)
+            ->cleanSendingPacket(this->channelNumber, [channelNumber](const QByteArray &packet) -> bool {
+                const int headerSize = sizeof(quint32);
+                if (packet.size() < headerSize) {
+                    return false;
+                }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+                quint32 channelNumberInPacket = qFromBigEndian<quint32>(packet.constData());
+#else
+        quint32 channelNumberInPacket = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(packet.constData()));
+#endif
+                return channelNumberInPacket == channelNumber;
+            });
+}
+
+void VirtualChannelPrivate::cleanSendingPacket(quint32 subChannelNumber,
+                                               std::function<bool(const QByteArray &packet)> subCheckPacket)
+{
+    if (error != DataChannel::NoError || parentChannel.isNull()) {
+        return;
+    }
+    getPrivateHelper(parentChannel)
+            ->cleanSendingPacket(this->channelNumber, [subChannelNumber, subCheckPacket](const QByteArray &packet) {
+                const int headerSize = sizeof(quint32);
+                if (packet.size() < headerSize) {
+                    return false;
+                }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+                quint32 channelNumberInPacket = qFromBigEndian<quint32>(packet.constData());
+#else
+        quint32 channelNumberInPacket = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(packet.constData()));
+#endif
+                if (channelNumberInPacket != subChannelNumber) {
+                    return false;
+                }
+                return subCheckPacket(packet.mid(headerSize));
+            });
+}
+
+bool VirtualChannelPrivate::isBroken() const
+{
+    return error != DataChannel::NoError || parentChannel.isNull() || parentChannel->isBroken();
+}
+
+bool VirtualChannelPrivate::handleConnectionCommand(quint8)
+{
+    // compression and framing work for the whole connection.
+    return false;
+}
+
+quint32 VirtualChannelPrivate::maxPayloadSize() const
+{
+    if (isBroken()) {
+        return 1400;
+    } else {
+        return parentChannel->maxPayloadSize() - sizeof(quint32);
+    }
+}
+
+quint32 VirtualChannelPrivate::payloadSizeHint() const
+{
+    if (isBroken()) {
+        return 1400;
+    } else {
+        return parentChannel->payloadSizeHint() - sizeof(quint32);
+    }
+}
+
+quint32 VirtualChannelPrivate::headerSize() const
+{
+    return sizeof(quint32);
+}
+
+quint32 VirtualChannelPrivate::reservedHeaderSize() const
+{
+    if (isBroken()) {
+        return sizeof(quint32);
+    } else {
+        return getPrivateHelper(parentChannel)->reservedHeaderSize() + sizeof(quint32);
+    }
+}
+
+bool VirtualChannelPrivate::sendReservedPacketRaw(quint32 channelNumber, QByteArray &packet, quint32 reserved,
+                                                  bool blocking)
+{
+    if (reserved < sizeof(quint32)) {
+        return DataChannelPrivate::sendReservedPacketRaw(channelNumber, packet, reserved, blocking);
+    }
+    if (error != DataChannel::NoError || parentChannel.isNull()) {
+        return false;
+    }
+    // packet.data() does not copy if the packet is not shared by caller.
+    reserved -= sizeof(quint32);
+    qToBigEndian(channelNumber, reinterpret_cast<uchar *>(packet.data()) + reserved);
+    return getPrivateHelper(parentChannel)->sendReservedPacketRaw(this->channelNumber, packet, reserved, blocking);
+}
+
+QSharedPointer<SocketLike> VirtualChannelPrivate::getBackend() const
+{
+    if (error != DataChannel::NoError || parentChannel.isNull()) {
+        return QSharedPointer<SocketLike>();
+    }
+    return getPrivateHelper(parentChannel)->getBackend();
+}
+
+SocketChannel::SocketChannel(QSharedPointer<Socket> connection, DataChannelPole pole)
+    : DataChannel(new SocketChannelPrivate(asSocketLike(connection), pole, this))
+{
+}
+
+#ifndef QTNG_NO_CRYPTO
+SocketChannel::SocketChannel(QSharedPointer<SslSocket> connection, DataChannelPole pole)
+    : DataChannel(new SocketChannelPrivate(asSocketLike(connection), pole, this))
+{
+}
+#endif
+
+SocketChannel::SocketChannel(QSharedPointer<KcpSocket> connection, DataChannelPole pole)
+    : DataChannel(new SocketChannelPrivate(asSocketLike(connection), pole, this))
 {
 }
 
-VirtualChannelPrivate::~VirtualChannelPrivate()
+SocketChannel::SocketChannel(QSharedPointer<SocketLike> connection, DataChannelPole pole)
+    : DataChannel(new SocketChannelPrivate(connection, pole, this))
+{
+}
+
+void SocketChannel::setMaxPacketSize(quint32 size)
+{
+    Q_D(SocketChannel);
+    if (size == 0) {
+        size = DefaultPacketSize;
+    } else if (size < 64) {
+        qtng_warning << "the max packet size of DataChannel should not lesser than 64.";
+        return;
+    }
+    // the highest bits of payload size are flags.
+    size = qMin<quint32>(size, 0x3fffffff);
+    d->_maxPayloadSize = size - sizeof(quint32) - sizeof(quint32);
+    d->_payloadSizeHint = qMin(d->_payloadSizeHint, d->_maxPayloadSize);
+}
+
+void SocketChannel::setPayloadSizeHint(quint32 payloadSizeHint)
+{
+    Q_D(SocketChannel);
+    if (payloadSizeHint == 0) {
+        payloadSizeHint = DefaultPayloadSize;
+    } else if (payloadSizeHint < 64) {
+        qtng_warning << "the payload size hint of DataChannel should not lesser than 64.";
+        return;
+    }
+    d->_payloadSizeHint = qMin(payloadSizeHint, d->_maxPayloadSize);
+}
+
+void SocketChannel::setKeepaliveTimeout(float timeout)
+{
+    Q_D(SocketChannel);
+    if (timeout > 0) {
+        d->keepaliveTimeout = static_cast<qint64>(timeout * 1000);
+        if (d->keepaliveTimeout < 1000) {
+            d->keepaliveTimeout = 1000;
+        }
+        d->rearmKeepalive();
+    }
+}
+
+float SocketChannel::keepaliveTimeout() const
+{
+    Q_D(const SocketChannel);
+    return static_cast<float>(d->keepaliveTimeout) / 1000;
+}
+
+void SocketChannel::setKeepaliveInterval(float keepaliveInterval)
+{
+    Q_D(SocketChannel);
+    d->keepaliveInterval = static_cast<qint64>(keepaliveInterval * 1000);
+    if (d->keepaliveInterval < 200) {
+        d->keepaliveInterval = 200;
+    }
+    d->rearmKeepalive();
+}
+
+float SocketChannel::keepaliveInterval() const
+{
+    Q_D(const SocketChannel);
+    return static_cast<float>(d->keepaliveInterval) / 1000;
+}
+
+void SocketChannel::setFlushDelay(float flushDelay)
+{
+    Q_D(SocketChannel);
+    d->flushDelay = flushDelay > 0 ? static_cast<quint32>(flushDelay * 1000) : 0;
+}
+
+float SocketChannel::flushDelay() const
+{
+    Q_D(const SocketChannel);
+    return static_cast<float>(d->flushDelay) / 1000;
+}
+
+void SocketChannel::setFragmentation(bool fragmentation)
+{
+    Q_D(SocketChannel);
+    d->fragmentation = fragmentation;
+}
+
+bool SocketChannel::fragmentation() const
+{
+    Q_D(const SocketChannel);
+    return d->fragmentation;
+}
+
+bool SocketChannel::setCompression(bool enabled, int level, quint32 threshold)
+{
+    Q_D(SocketChannel);
+#ifdef QTNG_HAVE_ZLIB
+    if (enabled && !d->compressionEnabled) {
+        d->sendPacketRaw(CommandChannelNumber, packCompressionRequest(), false);
+    }
+    if (d->compressor.isNull()) {
+        d->compressionLevel = level;
+    }
+    d->compressionThreshold = threshold > 0 ? threshold : DefaultCompressionThreshold;
+    d->compressionEnabled = enabled;
+    return true;
+#else
+    Q_UNUSED(level);
+    Q_UNUSED(threshold);
+    return !enabled;
+#endif
+}
+
+void SocketChannel::setCompactFraming(bool enabled)
+{
+    Q_D(SocketChannel);
+    if (enabled && !d->compactFramingEnabled) {
+        d->sendPacketRaw(CommandChannelNumber, packCompactFramingRequest(false), false);
+        if (d->peerCompactFraming) {
+            d->sendPacketRaw(CommandChannelNumber, packCompactFramingRequest(true), false);
+        }
+    }
+    d->compactFramingEnabled = enabled;
+}
+
+bool SocketChannel::compactFraming() const
+{
+    Q_D(const SocketChannel);
+    return d->sendingCompact;
+}
+
+bool SocketChannel::setCompressionMethod(CompressionMethod method)
+{
+    Q_D(SocketChannel);
+    const bool zstd = (method == ZstdCompression);
+    if (zstd && !qIsContentCodingSupported(QByteArray("zstd"))) {
+        return false;
+    }
+    if (zstd && !d->zstdEnabled) {
+        d->sendPacketRaw(CommandChannelNumber, packZstdCompressionRequest(false), false);
+        if (d->peerZstd) {
+            d->sendPacketRaw(CommandChannelNumber, packZstdCompressionRequest(true), false);
+        }
+    }
+    d->zstdEnabled = zstd;
+    return true;
+}
+
+SocketChannel::CompressionMethod SocketChannel::compressionMethod() const
+{
+    Q_D(const SocketChannel);
+    return d->sendingZstd ? ZstdCompression : DeflateCompression;
+}
+
+bool SocketChannel::isCompressing() const
+{
+    Q_D(const SocketChannel);
+    return d->compressionEnabled && d->peerCompression;
+}
+
+quint32 SocketChannel::sendingQueueSize() const
+{
+    Q_D(const SocketChannel);
+    return d->sendingQueue.size();
+}
+
+QSharedPointer<SocketLike> SocketChannel::connection() const
+{
+    Q_D(const SocketChannel);
+    return d->connection;
+}
+
+VirtualChannel::VirtualChannel(DataChannel *parentChannel, DataChannelPole pole, quint32 channelNumber)
+    : DataChannel(new VirtualChannelPrivate(parentChannel, pole, channelNumber, this))
+{
+}
+
+quint32 VirtualChannel::channelNumber() const
+{
+    Q_D(const VirtualChannel);
+    return d->channelNumber;
+}
+
+void VirtualChannel::setWeight(quint32 weight)
+{
+    Q_D(VirtualChannel);
+    d->weight = qMax<quint32>(weight, 1);
+    if (!d->parentChannel.isNull()) {
+        SocketChannelPrivate *parent =
+                dynamic_cast<SocketChannelPrivate *>(DataChannelPrivate::getPrivateHelper(d->parentChannel));
+        if (parent) {
+            parent->sendingQueue.setWeight(d->channelNumber, d->weight);
+        }
+    }
+}
+
+quint32 VirtualChannel::weight() const
+{
+    Q_D(const VirtualChannel);
+    return d->weight;
+}
+
+// the header of one ring in shared memory, the positions count the bytes ever written and read.
+struct SharedRing
+{
+    QBasicAtomicInteger<quint32> head;  // moved by the writer only.
+    QBasicAtomicInteger<quint32> readerWaiting;  // the reader is sleeping on the local socket.
+    char headPadding[56];
+    QBasicAtomicInteger<quint32> tail;  // moved by the reader only.
+    QBasicAtomicInteger<quint32> writerWaiting;  // the writer is waiting for space.
+    char tailPadding[56];
+};
+
+const quint32 MinSharedRingSize = 1024 * 64;
+const quint32 MaxSharedRingSize = 1024 * 1024 * 512;
+const quint32 SharedPacketHeaderSize = sizeof(quint32) * 2;  // the payload size and channel number, in host order.
+const char SharedMemoryMagic[] = "QTNGSHM1";
+const int SharedMemoryHelloSize = 12;  // the magic and ring size.
+
+static inline quint32 alignedSharedPacketSize(quint32 payloadSize)
+{
+    return (SharedPacketHeaderSize + payloadSize + 7) & ~static_cast<quint32>(7);
+}
+
+static inline size_t sharedMemorySize(quint32 ringSize)
+{
+    return 2 * (sizeof(SharedRing) + static_cast<size_t>(ringSize));
+}
+
+static inline void writeRing(char *ring, quint32 ringSize, quint32 position, const char *data, quint32 size)
+{
+    const quint32 offset = position & (ringSize - 1);
+    const quint32 first = qMin(size, ringSize - offset);
+    memcpy(ring + offset, data, first);
+    memcpy(ring, data + first, size - first);
+}
+
+static inline void readRing(const char *ring, quint32 ringSize, quint32 position, char *data, quint32 size)
+{
+    const quint32 offset = position & (ringSize - 1);
+    const quint32 first = qMin(size, ringSize - offset);
+    memcpy(data, ring + offset, first);
+    memcpy(data + first, ring, size - first);
+}
+
+class SharedMemoryChannelPrivate : public DataChannelPrivate
+{
+public:
+    SharedMemoryChannelPrivate(QSharedPointer<Socket> connection, DataChannelPole pole, char *memory,
+                               quint32 ringSize, SharedMemoryChannel *parent);
+    virtual ~SharedMemoryChannelPrivate() override;
+    virtual bool isBroken() const override;
+    virtual void abort(DataChannel::ChannelError reason) override;
+    virtual bool sendPacketRaw(quint32 channelNumber, const QByteArray &packet, bool blocking) override;
+    virtual void cleanChannel(quint32 channelNumber, bool sendDestroyPacket) override;
+    virtual void cleanSendingPacket(quint32 subChannelNumber,
+                                    std::function<bool(const QByteArray &)> subCheckPacket) override;
+    virtual quint32 maxPayloadSize() const override;
+    virtual quint32 payloadSizeHint() const override;
+    virtual quint32 headerSize() const override;
+    virtual QSharedPointer<SocketLike> getBackend() const override;
+    virtual bool handleConnectionCommand(quint8 command) override;
+    bool putPacket(quint32 channelNumber, const QByteArray &packet);  // returns false if the ring is full.
+    bool flushPendingPackets();  // returns true if all pending packets are put.
+    void notifyReader();
+    void wakeUp();
+    DataChannel::ChannelError takePackets();
+    void doReceive();
+
+    const QSharedPointer<Socket> connection;
+    CoroutineGroup *operations;
+    char * const memory;
+    const quint32 ringSize;
+    SharedRing *sendingRing;
+    char *sendingData;
+    SharedRing *receivingRing;
+    char *receivingData;
+    QList<QPair<quint32, QByteArray>> pendingPackets;  // sent without blocking while the ring is full.
+    Event spaceAvailable;
+
+    Q_DECLARE_PUBLIC(SharedMemoryChannel)
+};
+
+SharedMemoryChannelPrivate::SharedMemoryChannelPrivate(QSharedPointer<Socket> connection, DataChannelPole pole,
+                                                       char *memory, quint32 ringSize, SharedMemoryChannel *parent)
+    : DataChannelPrivate(pole, parent)
+    , connection(connection)
+    , operations(new CoroutineGroup())
+    , memory(memory)
+    , ringSize(ringSize)
+{
+    // the positive pole writes the first ring.
+    char *first = memory;
+    char *second = memory + sizeof(SharedRing) + ringSize;
+    if (pole == PositivePole) {
+        sendingRing = reinterpret_cast<SharedRing *>(first);
+        receivingRing = reinterpret_cast<SharedRing *>(second);
+    } else {
+        sendingRing = reinterpret_cast<SharedRing *>(second);
+        receivingRing = reinterpret_cast<SharedRing *>(first);
+    }
+    sendingData = reinterpret_cast<char *>(sendingRing) + sizeof(SharedRing);
+    receivingData = reinterpret_cast<char *>(receivingRing) + sizeof(SharedRing);
+    operations->spawnWithName(QString::fromLatin1("receiving"), [this] { this->doReceive(); });
+}
+
+SharedMemoryChannelPrivate::~SharedMemoryChannelPrivate()
+{
+    abort(DataChannel::UserShutdown);
+    delete operations;
+#ifdef Q_OS_UNIX
+    munmap(memory, sharedMemorySize(ringSize));
+#endif
+}
+
+bool SharedMemoryChannelPrivate::putPacket(quint32 channelNumber, const QByteArray &packet)
+{
+    const quint32 size = static_cast<quint32>(packet.size());
+    const quint32 head = sendingRing->head.loadAcquire();
+    if (ringSize - (head - sendingRing->tail.loadAcquire()) < alignedSharedPacketSize(size)) {
+        return false;
+    }
+    const quint32 header[2] = { size, channelNumber };
+    writeRing(sendingData, ringSize, head, reinterpret_cast<const char *>(header), SharedPacketHeaderSize);
+    writeRing(sendingData, ringSize, head + SharedPacketHeaderSize, packet.constData(), size);
+    sendingRing->head.storeRelease(head + alignedSharedPacketSize(size));
+    return true;
+}
+
+bool SharedMemoryChannelPrivate::flushPendingPackets()
+{
+    while (!pendingPackets.isEmpty()) {
+        const QPair<quint32, QByteArray> &pendingPacket = pendingPackets.first();
+        if (!putPacket(pendingPacket.first, pendingPacket.second)) {
+            return false;
+        }
+        pendingPackets.removeFirst();
+    }
+    return true;
+}
+
+void SharedMemoryChannelPrivate::notifyReader()
+{
+    // pairs with the reader, which sets the flag before checking the head at last.
+    if (sendingRing->readerWaiting.fetchAndStoreOrdered(0)) {
+        wakeUp();
+    }
+}
+
+void SharedMemoryChannelPrivate::wakeUp()
+{
+    const char b = 0;
+    connection->send(&b, 1);
+}
+
+bool SharedMemoryChannelPrivate::sendPacketRaw(quint32 channelNumber, const QByteArray &packet, bool blocking)
+{
+    if (error != DataChannel::NoError || packet.isEmpty()) {
+        return false;
+    }
+    if (static_cast<quint32>(packet.size()) > maxPayloadSize()) {
+#ifdef DEBUG_PROTOCOL
+        qtng_debug << "the packet size is too large." << packet.size() << maxPayloadSize();
+#endif
+        return false;
+    }
+    while (true) {
+        const quint32 tail = sendingRing->tail.loadAcquire();
+        if (flushPendingPackets() && putPacket(channelNumber, packet)) {
+            notifyReader();
+            return true;
+        }
+        if (blocking) {
+            spaceAvailable.clear();
+        }
+        sendingRing->writerWaiting.fetchAndStoreOrdered(1);
+        if (!blocking) {
+            pendingPackets.append(qMakePair(channelNumber, packet));
+            // the reader may free the space before the flag is set.
+            if (sendingRing->tail.loadAcquire() != tail && flushPendingPackets()) {
+                notifyReader();
+            }
+            return true;
+        }
+        if (sendingRing->tail.loadAcquire() == tail && !spaceAvailable.wait()) {
+            return false;
+        }
+        if (error != DataChannel::NoError) {
+            return false;
+        }
+    }
+}
+
+DataChannel::ChannelError SharedMemoryChannelPrivate::takePackets()
+{
+    const quint32 head = receivingRing->head.loadAcquire();
+    quint32 tail = receivingRing->tail.loadAcquire();
+    if (head == tail) {
+        return DataChannel::NoError;
+    }
+    while (tail != head && error == DataChannel::NoError) {
+        quint32 header[2];
+        readRing(receivingData, ringSize, tail, reinterpret_cast<char *>(header), SharedPacketHeaderSize);
+        const quint32 size = header[0];
+        if (size == 0 || size > maxPayloadSize() || head - tail < alignedSharedPacketSize(size)) {
+            return DataChannel::InvalidPacket;
+        }
+        QByteArray payload(static_cast<int>(size), Qt::Uninitialized);
+        readRing(receivingData, ringSize, tail + SharedPacketHeaderSize, payload.data(), size);
+        tail += alignedSharedPacketSize(size);
+        receivingRing->tail.storeRelease(tail);
+        DataChannel::ChannelError result = handleIncomingPacket(header[1], payload);
+        if (result != DataChannel::NoError) {
+            return result;
+        }
+    }
+    // pairs with the writer, which sets the flag before checking the tail at last.
+    if (receivingRing->writerWaiting.fetchAndStoreOrdered(0)) {
+        wakeUp();
+    }
+    return DataChannel::NoError;
+}
+
+void SharedMemoryChannelPrivate::doReceive()
+{
+    char buf[64];
+    while (true) {
+        DataChannel::ChannelError result = takePackets();
+        if (result != DataChannel::NoError) {
+#ifdef DEBUG_PROTOCOL
+            qtng_debug << "invalid packet from shared memory:" << result;
+#endif
+            abort(result);
+            return;
+        }
+        if (error != DataChannel::NoError) {
+            return;
+        }
+        // the bytes of peer also tell the space freed in my sending ring.
+        if (!pendingPackets.isEmpty() && flushPendingPackets()) {
+            notifyReader();
+        }
+        spaceAvailable.set();
+        receivingRing->readerWaiting.fetchAndStoreOrdered(1);
+        if (receivingRing->head.loadAcquire() != receivingRing->tail.loadAcquire()) {
+            receivingRing->readerWaiting.storeRelease(0);
+            continue;
+        }
+        qint32 bs = connection->recv(buf, sizeof(buf));
+        if (bs <= 0) {
+            abort(DataChannel::RemotePeerClosedError);
+            return;
+        }
+    }
+}
+
+void SharedMemoryChannelPrivate::abort(DataChannel::ChannelError reason)
+{
+    if (error != DataChannel::NoError) {
+        return;
+    }
+    error = reason;
+    Coroutine *current = Coroutine::current();
+    connection->abort();
+    pendingPackets.clear();
+    spaceAvailable.set();
+    if (operations->get(QString::fromLatin1("receiving")).data() != current) {
+        operations->kill(QString::fromLatin1("receiving"));
+    }
+    DataChannelPrivate::abort(reason);
+}
+
+bool SharedMemoryChannelPrivate::isBroken() const
+{
+    return error != DataChannel::NoError || !connection->isValid();
+}
+
+void SharedMemoryChannelPrivate::cleanChannel(quint32 channelNumber, bool sendDestroyPacket)
+{
+    int found = subChannels.remove(channelNumber);
+    if (found <= 0) {
+        return;
+    }
+    if (sendDestroyPacket) {
+        notifyChannelClose(channelNumber);
+    }
+    cleanSendingPacket(channelNumber, alwayTrue);
+}
+
+void SharedMemoryChannelPrivate::cleanSendingPacket(quint32 subChannelNumber,
+                                                    std::function<bool(const QByteArray &)> subCheckPacket)
+{
+    for (int i = pendingPackets.size() - 1; i >= 0; --i) {
+        const QPair<quint32, QByteArray> &pendingPacket = pendingPackets.at(i);
+        if (pendingPacket.first == subChannelNumber && subCheckPacket(pendingPacket.second)) {
+            pendingPackets.removeAt(i);
+        }
+    }
+}
+
+quint32 SharedMemoryChannelPrivate::maxPayloadSize() const
+{
+    return ringSize / 4;
+}
+
+quint32 SharedMemoryChannelPrivate::payloadSizeHint() const
+{
+    return qMin(maxPayloadSize(), DefaultPacketSize - SharedPacketHeaderSize);
+}
+
+quint32 SharedMemoryChannelPrivate::headerSize() const
+{
+    return SharedPacketHeaderSize;
+}
+
+QSharedPointer<SocketLike> SharedMemoryChannelPrivate::getBackend() const
+{
+    return asSocketLike(connection);
+}
+
+bool SharedMemoryChannelPrivate::handleConnectionCommand(quint8)
+{
+    // the packets are neither framed nor compressed.
+    return true;
+}
+
+#ifdef Q_OS_UNIX
+static int createSharedMemory(size_t size)
+{
+    int fd;
+#  if defined(Q_OS_LINUX) && defined(SYS_memfd_create)
+    fd = static_cast<int>(syscall(SYS_memfd_create, "qtng-channel", 1));  // MFD_CLOEXEC
+#  else
+    fd = -1;
+#  endif
+    if (fd < 0) {
+        static QAtomicInteger<quint32> counter;
+        const QByteArray &name = QString::fromLatin1("/qtng-%1-%2")
+                                         .arg(getpid())
+                                         .arg(counter.fetchAndAddRelaxed(1))
+                                         .toLatin1();
+        fd = shm_open(name.constData(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            return -1;
+        }
+        shm_unlink(name.constData());
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+#endif
+
+QSharedPointer<SharedMemoryChannel> SharedMemoryChannel::create(QSharedPointer<Socket> connection,
+                                                                DataChannelPole pole, quint32 ringSize)
+{
+#ifdef Q_OS_UNIX
+    if (connection.isNull() || connection->type() != Socket::LocalSocket
+        || connection->state() != Socket::ConnectedState) {
+        return QSharedPointer<SharedMemoryChannel>();
+    }
+    char hello[SharedMemoryHelloSize];
+    void *memory = MAP_FAILED;
+    if (pole == PositivePole) {
+        quint32 size = MinSharedRingSize;
+        while (size < ringSize && size < MaxSharedRingSize) {
+            size <<= 1;
+        }
+        ringSize = size;
+        int fd = createSharedMemory(sharedMemorySize(ringSize));
+        if (fd < 0) {
+            qtng_warning << "can not create shared memory.";
+            return QSharedPointer<SharedMemoryChannel>();
+        }
+        memory = mmap(nullptr, sharedMemorySize(ringSize), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        memcpy(hello, SharedMemoryMagic, 8);
+        qToBigEndian(ringSize, reinterpret_cast<uchar *>(hello) + 8);
+        QList<qintptr> fds;
+        fds.append(fd);
+        bool ok = memory != MAP_FAILED
+                && connection->sendfds(hello, SharedMemoryHelloSize, fds) == SharedMemoryHelloSize;
+        ::close(fd);
+        if (!ok) {
+            if (memory != MAP_FAILED) {
+                munmap(memory, sharedMemorySize(ringSize));
+            }
+            return QSharedPointer<SharedMemoryChannel>();
+        }
+    } else {
+        QList<qintptr> fds;
+        qint32 received = connection->recvfds(hello, SharedMemoryHelloSize, &fds);
+        if (received > 0 && received < SharedMemoryHelloSize) {
+            qint32 rest = connection->recvall(hello + received, SharedMemoryHelloSize - received);
+            received = rest > 0 ? received + rest : rest;
+        }
+        if (received == SharedMemoryHelloSize && fds.size() == 1 && memcmp(hello, SharedMemoryMagic, 8) == 0) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+            ringSize = qFromBigEndian<quint32>(hello + 8);
+#else
+            ringSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(hello) + 8);
+#endif
+            struct stat st;
+            int fd = static_cast<int>(fds.first());
+            if (ringSize >= MinSharedRingSize && ringSize <= MaxSharedRingSize && !(ringSize & (ringSize - 1))
+                && fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sharedMemorySize(ringSize)) {
+                memory = mmap(nullptr, sharedMemorySize(ringSize), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+        }
+        for (qintptr fd : fds) {
+            ::close(static_cast<int>(fd));
+        }
+        if (memory == MAP_FAILED) {
+            qtng_debug << "invalid shared memory from peer.";
+            return QSharedPointer<SharedMemoryChannel>();
+        }
+    }
+    return QSharedPointer<SharedMemoryChannel>(
+            new SharedMemoryChannel(connection, pole, static_cast<char *>(memory), ringSize));
+#else
+    Q_UNUSED(connection);
+    Q_UNUSED(pole);
+    Q_UNUSED(ringSize);
+    return QSharedPointer<SharedMemoryChannel>();
+#endif
+}
+
+SharedMemoryChannel::SharedMemoryChannel(QSharedPointer<Socket> connection, DataChannelPole pole, char *memory,
+                                         quint32 ringSize)
+    : DataChannel(new SharedMemoryChannelPrivate(connection, pole, memory, ringSize, this))
+{
+}
+
+quint32 SharedMemoryChannel::ringSize() const
+{
+    Q_D(const SharedMemoryChannel);
+    return d->ringSize;
+}
+
+quint32 SharedMemoryChannel::pendingPacketsSize() const
+{
+    Q_D(const SharedMemoryChannel);
+    return static_cast<quint32>(d->pendingPackets.size());
+}
+
+QSharedPointer<Socket> SharedMemoryChannel::connection() const
+{
+    Q_D(const SharedMemoryChannel);
+    return d->connection;
+}
+
+const quint8 BONDED_DATA_FRAME = 1;  // seq, channel number and payload.
+const quint8 BONDED_ACK_FRAME = 2;  // the next seq expected, all packets before it are received.
+const quint8 BONDED_PING_FRAME = 3;
+const quint8 BONDED_PONG_FRAME = 4;
+const quint32 BondedHeaderSize = sizeof(quint8) + sizeof(quint32) * 2;
+const quint32 BondedWindowSize = 512;  // the packets not acknowledged.
+const quint32 BondedAckBatchSize = 32;
+const int BondedAckDelay = 20;  // msecs.
+const int BondedPingInterval = 1000;
+
+static inline bool seqBefore(quint32 a, quint32 b)
+{
+    return static_cast<qint32>(a - b) < 0;
+}
+
+static QByteArray packBondedFrame(quint8 type, quint32 seq, quint32 channelNumber, const QByteArray &payload)
+{
+    QByteArray frame(static_cast<int>(BondedHeaderSize) + payload.size(), Qt::Uninitialized);
+    uchar *buf = reinterpret_cast<uchar *>(frame.data());
+    buf[0] = type;
+    qToBigEndian(seq, buf + sizeof(quint8));
+    qToBigEndian(channelNumber, buf + sizeof(quint8) + sizeof(quint32));
+    memcpy(buf + BondedHeaderSize, payload.constData(), static_cast<size_t>(payload.size()));
+    return frame;
+}
+
+struct BondedPath
+{
+    QSharedPointer<DataChannel> channel;
+    qint64 rtt;  // msecs, smoothed.
+    int id;
+};
+
+struct BondedPacket
+{
+    QByteArray frame;
+    DataChannel *path;  // the path sent by.
+};
+
+class BondedChannelPrivate : public DataChannelPrivate
+{
+public:
+    BondedChannelPrivate(const QList<QSharedPointer<DataChannel>> &paths, DataChannelPole pole, BondedChannel *parent);
+    virtual ~BondedChannelPrivate() override;
+    virtual bool isBroken() const override;
+    virtual void abort(DataChannel::ChannelError reason) override;
+    virtual bool sendPacketRaw(quint32 channelNumber, const QByteArray &packet, bool blocking) override;
+    virtual void cleanChannel(quint32 channelNumber, bool sendDestroyPacket) override;
+    virtual void cleanSendingPacket(quint32 subChannelNumber,
+                                    std::function<bool(const QByteArray &)> subCheckPacket) override;
+    virtual quint32 maxPayloadSize() const override;
+    virtual quint32 payloadSizeHint() const override;
+    virtual quint32 headerSize() const override;
+    virtual QSharedPointer<SocketLike> getBackend() const override;
+    virtual bool handleConnectionCommand(quint8 command) override;
+    bool addPath(QSharedPointer<DataChannel> path);
+    void removePath(DataChannel *path);
+    int pickPath() const;
+    bool sendFrame(quint32 seq);
+    void sendAck();
+    bool handleFrame(BondedPath *path, const QByteArray &frame);
+    void doReceive(QSharedPointer<DataChannel> path);
+    void doAck();
+    void doPing();
+
+    QList<BondedPath> bondedPaths;
+    CoroutineGroup *operations;
+    QHash<quint32, BondedPacket> unackedPackets;
+    QHash<quint32, QPair<quint32, QByteArray>> reorderingPackets;  // received before the packets in front of them.
+    Event windowOpened;
+    Event ackNeeded;
+    quint32 _maxPayloadSize;
+    quint32 _payloadSizeHint;
+    quint32 nextSendingSeq;
+    quint32 firstUnackedSeq;
+    quint32 nextReceivingSeq;
+    quint32 unackedReceived;  // delivered but not acknowledged to the peer.
+    int nextPathId;
+
+    Q_DECLARE_PUBLIC(BondedChannel)
+};
+
+BondedChannelPrivate::BondedChannelPrivate(const QList<QSharedPointer<DataChannel>> &paths, DataChannelPole pole,
+                                           BondedChannel *parent)
+    : DataChannelPrivate(pole, parent)
+    , operations(new CoroutineGroup())
+    , _maxPayloadSize(DefaultPacketSize - BondedHeaderSize)
+    , _payloadSizeHint(DefaultPayloadSize)
+    , nextSendingSeq(0)
+    , firstUnackedSeq(0)
+    , nextReceivingSeq(0)
+    , unackedReceived(0)
+    , nextPathId(0)
+{
+    // the sizes are fixed by the first paths, the later ones must not be smaller.
+    bool first = true;
+    for (QSharedPointer<DataChannel> path : paths) {
+        if (path.isNull() || path->isBroken() || path->maxPayloadSize() <= BondedHeaderSize) {
+            continue;
+        }
+        if (first) {
+            _maxPayloadSize = path->maxPayloadSize() - BondedHeaderSize;
+            _payloadSizeHint = qMax(path->payloadSizeHint(), BondedHeaderSize + 1) - BondedHeaderSize;
+            first = false;
+        } else {
+            _maxPayloadSize = qMin(_maxPayloadSize, path->maxPayloadSize() - BondedHeaderSize);
+            _payloadSizeHint = qMin(_payloadSizeHint,
+                                    qMax(path->payloadSizeHint(), BondedHeaderSize + 1) - BondedHeaderSize);
+        }
+        addPath(path);
+    }
+    windowOpened.set();
+    operations->spawnWithName(QString::fromLatin1("acking"), [this] { this->doAck(); });
+    operations->spawnWithName(QString::fromLatin1("pinging"), [this] { this->doPing(); });
+}
+
+BondedChannelPrivate::~BondedChannelPrivate()
+{
+    abort(DataChannel::UserShutdown);
+    delete operations;
+}
+
+bool BondedChannelPrivate::addPath(QSharedPointer<DataChannel> path)
+{
+    if (error != DataChannel::NoError || path.isNull() || path->isBroken()
+        || path->maxPayloadSize() < _maxPayloadSize + BondedHeaderSize) {
+        return false;
+    }
+    for (const BondedPath &bondedPath : bondedPaths) {
+        if (bondedPath.channel == path) {
+            return true;
+        }
+    }
+    BondedPath bondedPath;
+    bondedPath.channel = path;
+    bondedPath.rtt = -1;
+    bondedPath.id = nextPathId++;
+    bondedPaths.append(bondedPath);
+    operations->spawnWithName(QString::fromLatin1("receiving-%1").arg(bondedPath.id),
+                              [this, path] { this->doReceive(path); });
+    return true;
+}
+
+void BondedChannelPrivate::removePath(DataChannel *path)
+{
+    bool found = false;
+    for (int i = 0; i < bondedPaths.size(); ++i) {
+        if (bondedPaths.at(i).channel.data() == path) {
+            bondedPaths.removeAt(i);
+            found = true;
+            break;
+        }
+    }
+    if (!found || error != DataChannel::NoError) {
+        return;
+    }
+    if (bondedPaths.isEmpty()) {
+        abort(DataChannel::RemotePeerClosedError);
+        return;
+    }
+    // the packets may be lost with the path, the peer drops the duplicated ones.
+    for (quint32 seq = firstUnackedSeq; seqBefore(seq, nextSendingSeq); ++seq) {
+        QHash<quint32, BondedPacket>::iterator itor = unackedPackets.find(seq);
+        if (itor != unackedPackets.end() && itor->path == path && !sendFrame(seq)) {
+            return;
+        }
+    }
+}
+
+int BondedChannelPrivate::pickPath() const
+{
+    int best = -1;
+    qint64 bestCost = 0;
+    for (int i = 0; i < bondedPaths.size(); ++i) {
+        const BondedPath &bondedPath = bondedPaths.at(i);
+        const SocketChannel *socketChannel = dynamic_cast<const SocketChannel *>(bondedPath.channel.data());
+        const qint64 queued = socketChannel ? socketChannel->sendingQueueSize() : 0;
+        const qint64 cost = (qMax<qint64>(bondedPath.rtt, 0) + 1) * (queued + 1);
+        if (best < 0 || cost < bestCost) {
+            best = i;
+            bestCost = cost;
+        }
+    }
+    return best;
+}
+
+bool BondedChannelPrivate::sendFrame(quint32 seq)
+{
+    int i = pickPath();
+    if (i < 0) {
+        abort(DataChannel::RemotePeerClosedError);
+        return false;
+    }
+    QSharedPointer<DataChannel> path = bondedPaths.at(i).channel;
+    BondedPacket &packet = unackedPackets[seq];
+    packet.path = path.data();
+    if (path->sendPacketAsync(packet.frame)) {
+        return true;
+    }
+    // the packets of path, including this one, are sent again by other paths.
+    path->abort();
+    removePath(path.data());
+    return error == DataChannel::NoError;
+}
+
+bool BondedChannelPrivate::sendPacketRaw(quint32 channelNumber, const QByteArray &packet, bool blocking)
+{
+    if (error != DataChannel::NoError || packet.isEmpty()) {
+        return false;
+    }
+    if (static_cast<quint32>(packet.size()) > _maxPayloadSize) {
+#ifdef DEBUG_PROTOCOL
+        qtng_debug << "the packet size is too large." << packet.size() << _maxPayloadSize;
+#endif
+        return false;
+    }
+    while (blocking && static_cast<quint32>(unackedPackets.size()) >= BondedWindowSize) {
+        windowOpened.clear();
+        if (!windowOpened.wait() || error != DataChannel::NoError) {
+            return false;
+        }
+    }
+    const quint32 seq = nextSendingSeq++;
+    BondedPacket bondedPacket;
+    bondedPacket.frame = packBondedFrame(BONDED_DATA_FRAME, seq, channelNumber, packet);
+    bondedPacket.path = nullptr;
+    unackedPackets.insert(seq, bondedPacket);
+    return sendFrame(seq);
+}
+
+void BondedChannelPrivate::sendAck()
+{
+    if (unackedReceived == 0 || error != DataChannel::NoError) {
+        return;
+    }
+    int i = pickPath();
+    if (i >= 0 && bondedPaths.at(i).channel->sendPacketAsync(
+                packBondedFrame(BONDED_ACK_FRAME, nextReceivingSeq, 0, QByteArray()))) {
+        unackedReceived = 0;
+    }
+}
+
+bool BondedChannelPrivate::handleFrame(BondedPath *path, const QByteArray &frame)
+{
+    if (static_cast<quint32>(frame.size()) < BondedHeaderSize) {
+        return false;
+    }
+    const uchar *buf = reinterpret_cast<const uchar *>(frame.constData());
+    const quint8 type = buf[0];
+    const quint32 seq = qFromBigEndian<quint32>(buf + sizeof(quint8));
+    const quint32 channelNumber = qFromBigEndian<quint32>(buf + sizeof(quint8) + sizeof(quint32));
+    if (type == BONDED_DATA_FRAME) {
+        if (seqBefore(seq, nextReceivingSeq) || reorderingPackets.contains(seq)) {
+            // sent again after a path is broken, acknowledge it to free the sender.
+            ++unackedReceived;
+            ackNeeded.set();
+            return true;
+        }
+        if (seq - nextReceivingSeq >= BondedWindowSize * 2) {
+            return false;
+        }
+        reorderingPackets.insert(seq, qMakePair(channelNumber, frame.mid(static_cast<int>(BondedHeaderSize))));
+        while (error == DataChannel::NoError) {
+            QHash<quint32, QPair<quint32, QByteArray>>::iterator itor = reorderingPackets.find(nextReceivingSeq);
+            if (itor == reorderingPackets.end()) {
+                break;
+            }
+            const quint32 packetChannelNumber = itor->first;
+            QByteArray payload = itor->second;
+            reorderingPackets.erase(itor);
+            ++nextReceivingSeq;
+            ++unackedReceived;
+            DataChannel::ChannelError result = handleIncomingPacket(packetChannelNumber, payload);
+            if (result != DataChannel::NoError) {
+                abort(result);
+                return true;
+            }
+        }
+        if (unackedReceived >= BondedAckBatchSize) {
+            sendAck();
+        } else {
+            ackNeeded.set();
+        }
+    } else if (type == BONDED_ACK_FRAME) {
+        if (seqBefore(nextSendingSeq, seq)) {
+            return false;
+        }
+        while (seqBefore(firstUnackedSeq, seq)) {
+            unackedPackets.remove(firstUnackedSeq++);
+        }
+        if (static_cast<quint32>(unackedPackets.size()) < BondedWindowSize) {
+            windowOpened.set();
+        }
+    } else if (type == BONDED_PING_FRAME) {
+        path->channel->sendPacketAsync(packBondedFrame(BONDED_PONG_FRAME, seq, channelNumber, QByteArray()));
+    } else if (type == BONDED_PONG_FRAME) {
+        // the timestamp of ping is split into seq and channel number.
+        const qint64 timestamp = (static_cast<qint64>(seq) << 32) | channelNumber;
+        const qint64 sample = qMax<qint64>(EventLoopCoroutine::get()->now() - timestamp, 0);
+        path->rtt = path->rtt < 0 ? sample : (path->rtt * 7 + sample) / 8;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void BondedChannelPrivate::doReceive(QSharedPointer<DataChannel> path)
+{
+    while (true) {
+        const QByteArray &frame = path->recvPacket();
+        if (frame.isNull()) {
+            break;
+        }
+        BondedPath *bondedPath = nullptr;
+        for (int i = 0; i < bondedPaths.size(); ++i) {
+            if (bondedPaths.at(i).channel == path) {
+                bondedPath = &bondedPaths[i];
+                break;
+            }
+        }
+        if (!bondedPath) {
+            return;
+        }
+        if (!handleFrame(bondedPath, frame)) {
+#ifdef DEBUG_PROTOCOL
+            qtng_debug << "invalid bonded frame from path:" << path->toString();
+#endif
+            abort(DataChannel::InvalidPacket);
+            return;
+        }
+        if (error != DataChannel::NoError) {
+            return;
+        }
+    }
+    removePath(path.data());
+}
+
+void BondedChannelPrivate::doAck()
 {
-    abort(DataChannel::UserShutdown);
+    while (ackNeeded.wait() && error == DataChannel::NoError) {
+        Coroutine::msleep(BondedAckDelay);
+        ackNeeded.clear();
+        sendAck();
+    }
 }
 
-bool VirtualChannelPrivate::sendPacketRaw(quint32 channelNumber, const QByteArray &packet, bool blocking)
+void BondedChannelPrivate::doPing()
 {
-    if (error != DataChannel::NoError || parentChannel.isNull() || packet.isEmpty()) {
-#ifdef DEBUG_PROTOCOL
-        qtng_debug << "the packet is empty?" << (error != DataChannel::NoError) << parentChannel.isNull()
-                   << packet.isEmpty();
-#endif
-        return false;
+    while (error == DataChannel::NoError) {
+        const qint64 now = EventLoopCoroutine::get()->now();
+        const QByteArray &frame = packBondedFrame(BONDED_PING_FRAME, static_cast<quint32>(now >> 32),
+                                                  static_cast<quint32>(now & 0xffffffff), QByteArray());
+        for (const BondedPath &bondedPath : bondedPaths) {
+            bondedPath.channel->sendPacketAsync(frame);
+        }
+        Coroutine::msleep(BondedPingInterval);
     }
-    uchar header[sizeof(quint32)];
-    qToBigEndian(channelNumber, header);
-    QByteArray data;
-    data.reserve(packet.size() + static_cast<int>(sizeof(quint32)));
-    data.append(reinterpret_cast<char *>(header), sizeof(quint32));
-    data.append(packet);
-    return getPrivateHelper(parentChannel)->sendPacketRaw(this->channelNumber, data, blocking);
 }
 
-void VirtualChannelPrivate::abort(DataChannel::ChannelError reason)
+void BondedChannelPrivate::abort(DataChannel::ChannelError reason)
 {
     if (error != DataChannel::NoError) {
         return;
     }
     error = reason;
-    if (!parentChannel.isNull()) {
-        getPrivateHelper(parentChannel)->cleanChannel(channelNumber, true);
+    Coroutine *current = Coroutine::current();
+    QStringList names;
+    names << QString::fromLatin1("acking") << QString::fromLatin1("pinging");
+    for (const BondedPath &bondedPath : bondedPaths) {
+        names << QString::fromLatin1("receiving-%1").arg(bondedPath.id);
+    }
+    const QList<BondedPath> paths = bondedPaths;
+    bondedPaths.clear();
+    for (const BondedPath &bondedPath : paths) {
+        bondedPath.channel->abort();
+    }
+    unackedPackets.clear();
+    reorderingPackets.clear();
+    windowOpened.set();
+    ackNeeded.set();
+    for (const QString &name : names) {
+        if (operations->get(name).data() != current) {
+            operations->kill(name);
+        }
     }
     DataChannelPrivate::abort(reason);
 }
 
-void VirtualChannelPrivate::cleanChannel(quint32 channelNumber, bool sendDestroyPacket)
+bool BondedChannelPrivate::isBroken() const
+{
+    return error != DataChannel::NoError || bondedPaths.isEmpty();
+}
+
+void BondedChannelPrivate::cleanChannel(quint32 channelNumber, bool sendDestroyPacket)
 {
     int found = subChannels.remove(channelNumber);
-    if (error != DataChannel::NoError || parentChannel.isNull() || found <= 0) {
+    if (found <= 0) {
         return;
     }
     if (sendDestroyPacket) {
         notifyChannelClose(channelNumber);
     }
-    getPrivateHelper(parentChannel)
-            ->cleanSendingPacket(this->channelNumber, [channelNumber](const QByteArray &packet) -> bool {
-                const int headerSize = sizeof(quint32);
-                if (packet.size() < headerSize) {
-                    return false;
-                }
-#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-                quint32 channelNumberInPacket = qFromBigEndian<quint32>(packet.constData());
-#else
-        quint32 channelNumberInPacket = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(packet.constData()));
-#endif
-                return channelNumberInPacket == channelNumber;
-            });
-}
-
-void VirtualChannelPrivate::cleanSendingPacket(quint32 subChannelNumber,
-                                               std::function<bool(const QByteArray &packet)> subCheckPacket)
-{
-    if (error != DataChannel::NoError || parentChannel.isNull()) {
-        return;
-    }
-    getPrivateHelper(parentChannel)
-            ->cleanSendingPacket(this->channelNumber, [subChannelNumber, subCheckPacket](const QByteArray &packet) {
-                const int headerSize = sizeof(quint32);
-                if (packet.size() < headerSize) {
-                    return false;
-                }
-#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-                quint32 channelNumberInPacket = qFromBigEndian<quint32>(packet.constData());
-#else
-        quint32 channelNumberInPacket = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(packet.constData()));
-#endif
-                if (channelNumberInPacket != subChannelNumber) {
-                    return false;
-                }
-                return subCheckPacket(packet.mid(headerSize));
-            });
 }
 
-bool VirtualChannelPrivate::isBroken() const
+void BondedChannelPrivate::cleanSendingPacket(quint32, std::function<bool(const QByteArray &)>)
 {
-    return error != DataChannel::NoError || parentChannel.isNull() || parentChannel->isBroken();
+    // the packets are numbered once sent, and can not be taken back without a gap.
 }
 
-quint32 VirtualChannelPrivate::maxPayloadSize() const
+quint32 BondedChannelPrivate::maxPayloadSize() const
 {
-    if (isBroken()) {
-        return 1400;
-    } else {
-        return parentChannel->maxPayloadSize() - sizeof(quint32);
-    }
+    return _maxPayloadSize;
 }
 
-quint32 VirtualChannelPrivate::payloadSizeHint() const
+quint32 BondedChannelPrivate::payloadSizeHint() const
 {
-    if (isBroken()) {
-        return 1400;
-    } else {
-        return parentChannel->payloadSizeHint() - sizeof(quint32);
-    }
+    return _payloadSizeHint;
 }
 
-quint32 VirtualChannelPrivate::headerSize() const
+quint32 BondedChannelPrivate::headerSize() const
 {
-    return sizeof(quint32);
+    return BondedHeaderSize;
 }
 
-QSharedPointer<SocketLike> VirtualChannelPrivate::getBackend() const
+QSharedPointer<SocketLike> BondedChannelPrivate::getBackend() const
 {
-    if (error != DataChannel::NoError || parentChannel.isNull()) {
+    if (bondedPaths.isEmpty()) {
         return QSharedPointer<SocketLike>();
     }
-    return getPrivateHelper(parentChannel)->getBackend();
+    return getPrivateHelper(bondedPaths.first().channel)->getBackend();
 }
 
-SocketChannel::SocketChannel(QSharedPointer<Socket> connection, DataChannelPole pole)
-    : DataChannel(new SocketChannelPrivate(asSocketLike(connection), pole, this))
+bool BondedChannelPrivate::handleConnectionCommand(quint8)
 {
+    // the paths compress and frame the packets by themselves.
+    return true;
 }
 
-#ifndef QTNG_NO_CRYPTO
-SocketChannel::SocketChannel(QSharedPointer<SslSocket> connection, DataChannelPole pole)
-    : DataChannel(new SocketChannelPrivate(asSocketLike(connection), pole, this))
+BondedChannel::BondedChannel(const QList<QSharedPointer<DataChannel>> &paths, DataChannelPole pole)
+    : DataChannel(new BondedChannelPrivate(paths, pole, this))
 {
 }
-#endif
 
-SocketChannel::SocketChannel(QSharedPointer<KcpSocket> connection, DataChannelPole pole)
-    : DataChannel(new SocketChannelPrivate(asSocketLike(connection), pole, this))
+bool BondedChannel::addPath(QSharedPointer<DataChannel> path)
 {
+    Q_D(BondedChannel);
+    return d->addPath(path);
 }
 
-SocketChannel::SocketChannel(QSharedPointer<SocketLike> connection, DataChannelPole pole)
-    : DataChannel(new SocketChannelPrivate(connection, pole, this))
+QList<QSharedPointer<DataChannel>> BondedChannel::paths() const
 {
+    Q_D(const BondedChannel);
+    QList<QSharedPointer<DataChannel>> result;
+    for (const BondedPath &bondedPath : d->bondedPaths) {
+        result.append(bondedPath.channel);
+    }
+    return result;
 }
 
-void SocketChannel::setMaxPacketSize(quint32 size)
+qint64 BondedChannel::pathRtt(QSharedPointer<DataChannel> path) const
 {
-    Q_D(SocketChannel);
-    if (size == 0) {
-        size = DefaultPacketSize;
-    } else if (size < 64) {
-        qtng_warning << "the max packet size of DataChannel should not lesser than 64.";
-        return;
+    Q_D(const BondedChannel);
+    for (const BondedPath &bondedPath : d->bondedPaths) {
+        if (bondedPath.channel == path) {
+            return bondedPath.rtt;
+        }
     }
-    d->_maxPayloadSize = size - sizeof(quint32) - sizeof(quint32);
-    d->_payloadSizeHint = qMin(d->_payloadSizeHint, d->_maxPayloadSize);
+    return -1;
 }
 
-void SocketChannel::setPayloadSizeHint(quint32 payloadSizeHint)
+quint32 BondedChannel::unackedPacketsSize() const
 {
-    Q_D(SocketChannel);
-    if (payloadSizeHint == 0) {
-        payloadSizeHint = DefaultPayloadSize;
-    } else if (payloadSizeHint < 64) {
-        qtng_warning << "the payload size hint of DataChannel should not lesser than 64.";
-        return;
-    }
-    d->_payloadSizeHint = qMin(payloadSizeHint, d->_maxPayloadSize);
+    Q_D(const BondedChannel);
+    return static_cast<quint32>(d->unackedPackets.size());
 }
 
-void SocketChannel::setKeepaliveTimeout(float timeout)
+DataChannel::DataChannel(DataChannelPrivate *d)
+    : d_ptr(d)
 {
-    Q_D(SocketChannel);
-    if (timeout > 0) {
-        d->keepaliveTimeout = static_cast<qint64>(timeout * 1000);
-        if (d->keepaliveTimeout < 1000) {
-            d->keepaliveTimeout = 1000;
-        }
-    }
 }
 
-float SocketChannel::keepaliveTimeout() const
+DataChannel::~DataChannel()
 {
-    Q_D(const SocketChannel);
-    return static_cast<float>(d->keepaliveTimeout) / 1000;
+    delete d_ptr;
 }
 
-void SocketChannel::setKeepaliveInterval(float keepaliveInterval)
+struct DataChannelMetrics
 {
-    Q_D(SocketChannel);
-    d->keepaliveInterval = static_cast<qint64>(keepaliveInterval * 1000);
-    if (d->keepaliveInterval < 200) {
-        d->keepaliveInterval = 200;
-    }
-}
+    DataChannelMetrics();
+    MetricCounter *sentPackets;
+    MetricCounter *sentBytes;
+    MetricCounter *receivedPackets;
+    MetricCounter *receivedBytes;
+};
 
-float SocketChannel::keepaliveInterval() const
+DataChannelMetrics::DataChannelMetrics()
 {
-    Q_D(const SocketChannel);
-    return static_cast<float>(d->keepaliveInterval) / 1000;
+    MetricsRegistry *registry = MetricsRegistry::instance();
+    sentPackets = registry->counter("qtng_datachannel_sent_packets_total", "Packets sent by data channels.");
+    sentBytes = registry->counter("qtng_datachannel_sent_bytes_total", "Bytes of packets sent by data channels.");
+    receivedPackets = registry->counter("qtng_datachannel_received_packets_total",
+                                        "Packets received by data channels.");
+    receivedBytes = registry->counter("qtng_datachannel_received_bytes_total",
+                                      "Bytes of packets received by data channels.");
 }
 
-quint32 SocketChannel::sendingQueueSize() const
+static DataChannelMetrics &dataChannelMetrics()
 {
-    Q_D(const SocketChannel);
-    return d->sendingQueue.size();
+    static DataChannelMetrics metrics;
+    return metrics;
 }
 
-QSharedPointer<SocketLike> SocketChannel::connection() const
+static inline bool countSentPacket(bool ok, int size)
 {
-    Q_D(const SocketChannel);
-    return d->connection;
+    if (ok) {
+        DataChannelMetrics &metrics = dataChannelMetrics();
+        metrics.sentPackets->add();
+        metrics.sentBytes->add(static_cast<quint64>(size));
+    }
+    return ok;
 }
 
-VirtualChannel::VirtualChannel(DataChannel *parentChannel, DataChannelPole pole, quint32 channelNumber)
-    : DataChannel(new VirtualChannelPrivate(parentChannel, pole, channelNumber, this))
+bool DataChannel::isBroken() const
 {
+    Q_D(const DataChannel);
+    return d->isBroken();
 }
 
-quint32 VirtualChannel::channelNumber() const
+bool DataChannel::sendPacket(const QByteArray &packet)
 {
-    Q_D(const VirtualChannel);
-    return d->channelNumber;
+    Q_D(DataChannel);
+    QTNG_TRACE_SCOPE_ARG("channel", "channel send", "bytes", packet.size());
+    return countSentPacket(d->sendPacket(packet), packet.size());
 }
 
-DataChannel::DataChannel(DataChannelPrivate *d)
-    : d_ptr(d)
+bool DataChannel::sendPackets(const QList<QByteArray> &packets)
 {
+    Q_D(DataChannel);
+    QTNG_TRACE_SCOPE_ARG("channel", "channel send", "packets", packets.size());
+    if (!d->sendPackets(packets)) {
+        return false;
+    }
+    DataChannelMetrics &metrics = dataChannelMetrics();
+    for (const QByteArray &packet : packets) {
+        metrics.sentPackets->add();
+        metrics.sentBytes->add(static_cast<quint64>(packet.size()));
+    }
+    return true;
 }
 
-DataChannel::~DataChannel()
+bool DataChannel::sendPacketAsync(const QByteArray &packet)
 {
-    delete d_ptr;
+    Q_D(DataChannel);
+    QTNG_TRACE_INSTANT("channel", "channel send async", "bytes", packet.size());
+    return countSentPacket(d->sendPacketAsync(packet), packet.size());
 }
 
-bool DataChannel::isBroken() const
+quint32 DataChannel::reservedHeaderSize() const
 {
     Q_D(const DataChannel);
-    return d->isBroken();
+    return d->reservedHeaderSize();
 }
 
-bool DataChannel::sendPacket(const QByteArray &packet)
+bool DataChannel::sendReservedPacket(QByteArray packet)
 {
     Q_D(DataChannel);
-    return d->sendPacket(packet);
+    const int size = packet.size() - static_cast<int>(d->reservedHeaderSize());
+    QTNG_TRACE_SCOPE_ARG("channel", "channel send", "bytes", size);
+    return countSentPacket(d->sendReservedPacket(packet), size);
 }
 
-bool DataChannel::sendPacketAsync(const QByteArray &packet)
+QByteArray DataChannel::recvPacket()
 {
     Q_D(DataChannel);
-    return d->sendPacketAsync(packet);
+    QTNG_TRACE_SCOPE("channel", "channel recv");
+    const QByteArray &packet = d->recvPacket();
+    if (!packet.isNull()) {
+        DataChannelMetrics &metrics = dataChannelMetrics();
+        metrics.receivedPackets->add();
+        metrics.receivedBytes->add(static_cast<quint64>(packet.size()));
+    }
+    return packet;
 }
 
-QByteArray DataChannel::recvPacket()
+QList<QByteArray> DataChannel::recvPackets(quint32 maxCount)
 {
     Q_D(DataChannel);
-    return d->recvPacket();
+    QTNG_TRACE_SCOPE("channel", "channel recv");
+    const QList<QByteArray> &packets = d->recvPackets(maxCount);
+    if (!packets.isEmpty()) {
+        quint64 bytes = 0;
+        for (const QByteArray &packet : packets) {
+            bytes += static_cast<quint64>(packet.size());
+        }
+        DataChannelMetrics &metrics = dataChannelMetrics();
+        metrics.receivedPackets->add(static_cast<quint64>(packets.size()));
+        metrics.receivedBytes->add(bytes);
+    }
+    return packets;
 }
 
 void DataChannel::abort()
@@ -1171,6 +3135,24 @@ quint32 DataChannel::capacity() const
     return d->receivingQueue.capacity();
 }
 
+void DataChannel::setReceivingWindow(quint32 window)
+{
+    Q_D(DataChannel);
+    d->setReceivingWindow(window);
+}
+
+quint32 DataChannel::receivingWindow() const
+{
+    Q_D(const DataChannel);
+    return d->receivingWindow;
+}
+
+qint64 DataChannel::sendingWindow() const
+{
+    Q_D(const DataChannel);
+    return d->sendingWindow;
+}
+
 quint32 DataChannel::receivingQueueSize() const
 {
     Q_D(const DataChannel);
@@ -1201,6 +3183,7 @@ class DataChannelSocketLikeImpl : public SocketLike
 {
 public:
     DataChannelSocketLikeImpl(QSharedPointer<DataChannel> channel);
+    virtual ~DataChannelSocketLikeImpl() override;
 public:
     virtual Socket::SocketError error() const override;
     virtual QString errorString() const override;
@@ -1239,14 +3222,35 @@ public:
     virtual void close() override;
 public:
     QSharedPointer<SocketLike> getBackend() const;
+    bool fillReceivingBuffer();
+    void skipReceivingBuffer(qint32 size);
+    bool flushSendingBuffer();
+    void scheduleFlush();
 public:
-    QByteArray buf;
+    // the packet being read, which is returned as is if the caller takes all of it.
+    QByteArray receivingBuffer;
+    qint32 receivingOffset;
+    // the small writes are sent together as one packet, at most payloadSizeHint() bytes.
+    QByteArray sendingBuffer;
+    int flushCallbackId;
     QSharedPointer<DataChannel> channel;
 };
 
 DataChannelSocketLikeImpl::DataChannelSocketLikeImpl(QSharedPointer<DataChannel> channel)
-    : channel(channel)
+    : receivingOffset(0)
+    , flushCallbackId(0)
+    , channel(channel)
+{
+}
+
+DataChannelSocketLikeImpl::~DataChannelSocketLikeImpl()
 {
+    if (flushCallbackId) {
+        EventLoopCoroutine::get()->cancelCall(flushCallbackId);
+    }
+    if (!sendingBuffer.isEmpty()) {
+        channel->sendPacketAsync(sendingBuffer);
+    }
 }
 
 QSharedPointer<SocketLike> DataChannelSocketLikeImpl::getBackend() const
@@ -1449,20 +3453,65 @@ QVariant DataChannelSocketLikeImpl::option(Socket::SocketOption option) const
     }
 }
 
+bool DataChannelSocketLikeImpl::fillReceivingBuffer()
+{
+    if (receivingOffset < receivingBuffer.size()) {
+        return true;
+    }
+    receivingBuffer = channel->recvPacket();
+    receivingOffset = 0;
+    return !receivingBuffer.isEmpty();
+}
+
+void DataChannelSocketLikeImpl::skipReceivingBuffer(qint32 size)
+{
+    receivingOffset += size;
+    if (receivingOffset >= receivingBuffer.size()) {
+        receivingBuffer.clear();
+        receivingOffset = 0;
+    }
+}
+
+bool DataChannelSocketLikeImpl::flushSendingBuffer()
+{
+    if (flushCallbackId) {
+        EventLoopCoroutine::get()->cancelCall(flushCallbackId);
+        flushCallbackId = 0;
+    }
+    if (sendingBuffer.isEmpty()) {
+        return true;
+    }
+    const QByteArray packet = sendingBuffer;
+    sendingBuffer.clear();
+    return channel->sendPacket(packet);
+}
+
+void DataChannelSocketLikeImpl::scheduleFlush()
+{
+    if (flushCallbackId || sendingBuffer.isEmpty()) {
+        return;
+    }
+    // sent after the caller yields, so the writes of one turn go together.
+    flushCallbackId = EventLoopCoroutine::get()->callLater(0, makeFunctor([this] {
+        flushCallbackId = 0;
+        if (!sendingBuffer.isEmpty()) {
+            channel->sendPacketAsync(sendingBuffer);
+            sendingBuffer.clear();
+        }
+    }));
+}
+
 qint32 DataChannelSocketLikeImpl::recv(char *data, qint32 size)
 {
     if (size <= 0) {
         return -1;
     }
-    if (buf.isEmpty()) {
-        buf = channel->recvPacket();
-        if (buf.isEmpty()) {
-            return 0;
-        }
+    if (!fillReceivingBuffer()) {
+        return 0;
     }
-    qint32 len = qMin(size, static_cast<qint32>(buf.size()));
-    memcpy(data, buf.data(), static_cast<size_t>(len));
-    buf.remove(0, len);
+    qint32 len = qMin(size, receivingBuffer.size() - receivingOffset);
+    memcpy(data, receivingBuffer.constData() + receivingOffset, static_cast<size_t>(len));
+    skipReceivingBuffer(len);
     return len;
 }
 
@@ -1471,57 +3520,77 @@ qint32 DataChannelSocketLikeImpl::recvall(char *data, qint32 size)
     if (size <= 0) {
         return -1;
     }
-    while (buf.size() < size) {
-        const QByteArray &packet = channel->recvPacket();
-        if (packet.isEmpty()) {
-            break;
-        }
-        buf.append(packet);
-    }
-    qint32 len = qMin(size, static_cast<qint32>(buf.size()));
-    if (len > 0) {
-        memcpy(data, buf.data(), static_cast<size_t>(len));
-        buf.remove(0, len);
+    qint32 count = 0;
+    while (count < size && fillReceivingBuffer()) {
+        qint32 len = qMin(size - count, receivingBuffer.size() - receivingOffset);
+        memcpy(data + count, receivingBuffer.constData() + receivingOffset, static_cast<size_t>(len));
+        skipReceivingBuffer(len);
+        count += len;
     }
-    return len;
+    return count;
 }
 
 qint32 DataChannelSocketLikeImpl::send(const char *data, qint32 size)
 {
+    if (size <= 0) {
+        return -1;
+    }
     qint32 len = qMin<qint32>(size, static_cast<qint32>(channel->payloadSizeHint()));
-    bool ok = channel->sendPacket(QByteArray(data, len));
-    return ok ? len : -1;
+    qint32 count = sendall(data, len);
+    return count > 0 ? count : -1;
 }
 
 qint32 DataChannelSocketLikeImpl::sendall(const char *data, qint32 size)
 {
+    const qint32 packetSize = static_cast<qint32>(channel->payloadSizeHint());
     qint32 count = 0;
-    qint32 maxPayloadSize = static_cast<qint32>(channel->payloadSizeHint());
     while (count < size) {
-        qint32 len = qMin(size - count, maxPayloadSize);
-        bool ok = channel->sendPacket(QByteArray(data + count, len));
-        if (!ok) {
-            break;
+        if (sendingBuffer.isEmpty() && size - count >= packetSize) {
+            // the whole packets skip the buffer.
+            if (!channel->sendPacket(QByteArray(data + count, packetSize))) {
+                return count;
+            }
+            count += packetSize;
+            continue;
+        }
+        qint32 len = qMin(size - count, packetSize - sendingBuffer.size());
+        sendingBuffer.append(data + count, len);
+        if (sendingBuffer.size() >= packetSize && !flushSendingBuffer()) {
+            return count;
         }
         count += len;
     }
+    scheduleFlush();
     return count;
 }
 
 QByteArray DataChannelSocketLikeImpl::recv(qint32 size)
 {
-    QByteArray t(size, Qt::Uninitialized);
-    qint32 len = recv(t.data(), size);
-    if (len <= 0) {
+    if (size <= 0 || !fillReceivingBuffer()) {
         return QByteArray();
-    } else {
-        t.resize(len);
-        return t;
     }
+    if (receivingOffset == 0 && receivingBuffer.size() <= size) {
+        // the whole packet is returned without copying.
+        QByteArray packet = receivingBuffer;
+        receivingBuffer.clear();
+        return packet;
+    }
+    qint32 len = qMin(size, receivingBuffer.size() - receivingOffset);
+    const QByteArray &t = receivingBuffer.mid(receivingOffset, len);
+    skipReceivingBuffer(len);
+    return t;
 }
 
 QByteArray DataChannelSocketLikeImpl::recvall(qint32 size)
 {
+    if (size <= 0 || !fillReceivingBuffer()) {
+        return QByteArray();
+    }
+    if (receivingOffset == 0 && receivingBuffer.size() == size) {
+        QByteArray packet = receivingBuffer;
+        receivingBuffer.clear();
+        return packet;
+    }
     QByteArray t(size, Qt::Uninitialized);
     qint32 len = recvall(t.data(), size);
     if (len <= 0) {
@@ -1534,16 +3603,24 @@ QByteArray DataChannelSocketLikeImpl::recvall(qint32 size)
 
 qint32 DataChannelSocketLikeImpl::send(const QByteArray &data)
 {
-    return send(data.data(), data.size());
+    return send(data.constData(), data.size());
 }
 
 qint32 DataChannelSocketLikeImpl::sendall(const QByteArray &data)
 {
-    return sendall(data.data(), data.size());
+    if (sendingBuffer.isEmpty() && data.size() >= static_cast<qint32>(channel->payloadSizeHint())
+        && data.size() <= static_cast<qint32>(channel->maxPayloadSize())) {
+        // sent as one packet without copying.
+        return channel->sendPacket(data) ? data.size() : 0;
+    }
+    return sendall(data.constData(), data.size());
 }
 
 void DataChannelSocketLikeImpl::close()
 {
+    if (!sendingBuffer.isEmpty()) {
+        flushSendingBuffer();
+    }
     channel->abort();
 }
 
@@ -0,0 +1,758 @@
+#include <QtCore/qfile.h>
+#include <QtCore/qurl.h>
+#include <QtCore/qendian.h>
+#include <QtCore/qthreadstorage.h>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+#  include <QtCore/qrandom.h>
+#endif
+#include "../include/dns.h"
+#include "../include/socket.h"
+#include "../include/coroutine_utils.h"
+#include "../include/private/tracing_p.h"
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.dns");
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+const quint16 DnsPort = 53;
+const quint16 DnsTypeA = 1;
+const quint16 DnsTypeCname = 5;
+const quint16 DnsTypeSoa = 6;
+const quint16 DnsTypeAaaa = 28;
+const quint16 DnsClassIn = 1;
+const int DnsNoError = 0;
+const int DnsNameError = 3;
+const int DnsHeaderSize = 12;
+const int MaxUdpMessageSize = 512;
+const int MaxCnameHops = 8;
+const quint32 HostsFileTtl = 3600;
+const quint32 SystemResolverTtl = 60;  // getaddrinfo() does not tell the ttl.
+
+struct DnsAnswer
+{
+    DnsAnswer()
+        : rcode(-1)
+        , ttl(0)
+    {
+    }
+    QList<HostAddress> addresses;
+    QByteArray cname;  // the end of cname chain if no address is found for it.
+    int rcode;  // -1 if no server answered.
+    quint32 ttl;  // for negative answers, it comes from the SOA record.
+};
+
+static inline quint16 readUInt16(const QByteArray &message, int offset)
+{
+    return qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(message.constData() + offset));
+}
+
+static inline quint32 readUInt32(const QByteArray &message, int offset)
+{
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(message.constData() + offset));
+}
+
+static inline void writeUInt16(QByteArray &message, int offset, quint16 value)
+{
+    qToBigEndian<quint16>(value, reinterpret_cast<uchar *>(message.data() + offset));
+}
+
+static QByteArray normalizeName(const QString &hostName)
+{
+    QByteArray name = QUrl::toAce(hostName).toLower();
+    if (name.endsWith('.')) {
+        name.chop(1);
+    }
+    return name;
+}
+
+static quint16 randomId()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    return static_cast<quint16>(QRandomGenerator::global()->bounded(65536));
+#else
+    return static_cast<quint16>(qrand() & 0xffff);
+#endif
+}
+
+static QByteArray encodeQuery(const QByteArray &name, quint16 type)
+{
+    QByteArray packet(DnsHeaderSize, '\0');
+    packet[2] = 0x01;  // recursion desired
+    packet[5] = 0x01;  // one question
+    const QList<QByteArray> &labels = name.split('.');
+    for (const QByteArray &label : labels) {
+        if (label.isEmpty() || label.size() > 63) {
+            return QByteArray();
+        }
+        packet.append(static_cast<char>(label.size()));
+        packet.append(label);
+    }
+    packet.append('\0');
+    if (packet.size() - DnsHeaderSize > 255) {
+        return QByteArray();
+    }
+    packet.append(QByteArray(4, '\0'));
+    writeUInt16(packet, packet.size() - 4, type);
+    writeUInt16(packet, packet.size() - 2, DnsClassIn);
+    return packet;
+}
+
+// read a name which may be compressed, the offset is moved past it.
+static bool readName(const QByteArray &message, int *offset, QByteArray *name)
+{
+    const int size = message.size();
+    int pos = *offset;
+    int end = -1;
+    int jumps = 0;
+    name->clear();
+    while (true) {
+        if (pos >= size) {
+            return false;
+        }
+        const quint8 len = static_cast<quint8>(message.at(pos));
+        if ((len & 0xc0) == 0xc0) {
+            if (pos + 1 >= size || ++jumps > 16) {
+                return false;
+            }
+            if (end < 0) {
+                end = pos + 2;
+            }
+            pos = ((len & 0x3f) << 8) | static_cast<quint8>(message.at(pos + 1));
+            continue;
+        } else if (len & 0xc0) {
+            return false;
+        }
+        ++pos;
+        if (len == 0) {
+            break;
+        }
+        if (pos + len > size) {
+            return false;
+        }
+        if (!name->isEmpty()) {
+            name->append('.');
+        }
+        name->append(message.constData() + pos, len);
+        pos += len;
+        if (name->size() > 255) {
+            return false;
+        }
+    }
+    *offset = end < 0 ? pos : end;
+    *name = name->toLower();
+    return true;
+}
+
+struct DnsRecord
+{
+    QByteArray owner;
+    QByteArray target;
+    HostAddress address;
+    quint16 type;
+    quint32 ttl;
+};
+
+static bool parseResponse(const QByteArray &message, quint16 id, const QByteArray &name, quint16 type,
+                          DnsAnswer *answer, bool *truncated)
+{
+    if (message.size() < DnsHeaderSize || readUInt16(message, 0) != id) {
+        return false;
+    }
+    const quint16 flags = readUInt16(message, 2);
+    if (!(flags & 0x8000)) {
+        return false;
+    }
+    *truncated = flags & 0x0200;
+    answer->rcode = flags & 0x000f;
+    const int questions = readUInt16(message, 4);
+    const int answers = readUInt16(message, 6);
+    const int authorities = readUInt16(message, 8);
+
+    int offset = DnsHeaderSize;
+    QByteArray owner;
+    for (int i = 0; i < questions; ++i) {
+        if (!readName(message, &offset, &owner)) {
+            return false;
+        }
+        if (i == 0 && owner != name) {
+            return false;
+        }
+        offset += 4;
+    }
+
+    QList<DnsRecord> records;
+    quint32 negativeTtl = 0;
+    for (int i = 0; i < answers + authorities; ++i) {
+        if (!readName(message, &offset, &owner) || offset + 10 > message.size()) {
+            return false;
+        }
+        DnsRecord record;
+        record.type = readUInt16(message, offset);
+        const quint16 rclass = readUInt16(message, offset + 2);
+        record.ttl = readUInt32(message, offset + 4);
+        const int rdlength = readUInt16(message, offset + 8);
+        offset += 10;
+        if (offset + rdlength > message.size()) {
+            return false;
+        }
+        if (rclass == DnsClassIn) {
+            record.owner = owner;
+            if (i >= answers) {
+                // rfc2308, the negative ttl is the minimum of the SOA ttl and its minimum field.
+                if (record.type == DnsTypeSoa && rdlength >= 22) {
+                    negativeTtl = qMin(record.ttl, readUInt32(message, offset + rdlength - 4));
+                }
+            } else if (record.type == DnsTypeA && rdlength == 4) {
+                record.address = HostAddress(readUInt32(message, offset));
+                records.append(record);
+            } else if (record.type == DnsTypeAaaa && rdlength == 16) {
+                record.address = HostAddress(reinterpret_cast<const quint8 *>(message.constData() + offset));
+                records.append(record);
+            } else if (record.type == DnsTypeCname) {
+                int targetOffset = offset;
+                if (!readName(message, &targetOffset, &record.target)) {
+                    return false;
+                }
+                records.append(record);
+            }
+        }
+        offset += rdlength;
+    }
+
+    // follow the cname chain inside this response.
+    QByteArray target = name;
+    quint32 ttl = UINT_MAX;
+    for (int hop = 0; hop <= MaxCnameHops; ++hop) {
+        QByteArray next;
+        quint32 cnameTtl = UINT_MAX;
+        for (const DnsRecord &record : records) {
+            if (record.owner != target) {
+                continue;
+            }
+            if (record.type == type) {
+                answer->addresses.append(record.address);
+                ttl = qMin(ttl, record.ttl);
+            } else if (record.type == DnsTypeCname) {
+                next = record.target;
+                cnameTtl = record.ttl;
+            }
+        }
+        if (!answer->addresses.isEmpty() || next.isEmpty()) {
+            break;
+        }
+        ttl = qMin(ttl, cnameTtl);
+        target = next;
+    }
+    if (answer->addresses.isEmpty()) {
+        if (target != name) {
+            answer->cname = target;
+        }
+        answer->ttl = ttl == UINT_MAX ? negativeTtl : qMin(ttl, negativeTtl);
+    } else {
+        answer->ttl = ttl;
+    }
+    return true;
+}
+
+// queries to a name server. every query is sent from a new udp socket, so the source port is random as well as the
+// id, and an off-path attacker has to guess both to spoof an answer.
+class DnsChannel
+{
+public:
+    DnsChannel(const HostAddress &server, quint16 port);
+public:
+    QByteArray exchange(const QByteArray &query, quint16 *id, float timeout);
+public:
+    const HostAddress server;
+    const quint16 port;
+};
+
+DnsChannel::DnsChannel(const HostAddress &server, quint16 port)
+    : server(server)
+    , port(port)
+{
+}
+
+QByteArray DnsChannel::exchange(const QByteArray &query, quint16 *id, float timeout)
+{
+    HostAddress::NetworkLayerProtocol protocol =
+            server.isIPv4() ? HostAddress::IPv4Protocol : HostAddress::IPv6Protocol;
+    Socket socket(protocol, Socket::UdpSocket);
+    *id = randomId();
+    QByteArray packet = query;
+    writeUInt16(packet, 0, *id);
+    if (socket.sendto(packet, server, port) != packet.size()) {
+        return QByteArray();
+    }
+    try {
+        Timeout timer(timeout);
+        while (true) {
+            HostAddress from;
+            quint16 fromPort = 0;
+            const QByteArray &message = socket.recvfrom(MaxUdpMessageSize, &from, &fromPort);
+            if (message.isEmpty()) {
+                qtng_debug << "dns query to" << server.toString() << "failed:" << socket.errorString();
+                return QByteArray();
+            }
+            if (message.size() < DnsHeaderSize || fromPort != port || from != server
+                || readUInt16(message, 0) != *id) {
+                continue;
+            }
+            return message;
+        }
+    } catch (TimeoutException &) {
+    }
+    return QByteArray();
+}
+
+class DnsResolverPrivate
+{
+public:
+    DnsResolverPrivate();
+public:
+    DnsAnswer query(const QByteArray &name, quint16 type);
+    DnsAnswer lookup(const QByteArray &name, quint16 type);
+    QByteArray exchangeTcp(QSharedPointer<DnsChannel> channel, const QByteArray &packet);
+    QList<QByteArray> candidates(const QByteArray &name, bool absolute) const;
+public:
+    QList<QSharedPointer<DnsChannel>> channels;
+    QStringList searchDomains;
+    QHash<QByteArray, QList<HostAddress>> hosts;
+    float timeout;
+    int attempts;
+    int ndots;
+    quint16 port;
+};
+
+DnsResolverPrivate::DnsResolverPrivate()
+    : timeout(5.0)
+    , attempts(2)
+    , ndots(1)
+    , port(DnsPort)
+{
+}
+
+DnsAnswer DnsResolverPrivate::query(const QByteArray &name, quint16 type)
+{
+    DnsAnswer answer;
+    const QByteArray &packet = encodeQuery(name, type);
+    if (packet.isEmpty()) {
+        return answer;
+    }
+    // copy it, name servers may be changed while we are waiting.
+    const QList<QSharedPointer<DnsChannel>> channels = this->channels;
+    for (int attempt = 0; attempt < attempts; ++attempt) {
+        for (QSharedPointer<DnsChannel> channel : channels) {
+            quint16 id = 0;
+            QByteArray response = channel->exchange(packet, &id, timeout);
+            if (response.isEmpty()) {
+                continue;
+            }
+            DnsAnswer result;
+            bool truncated = false;
+            if (!parseResponse(response, id, name, type, &result, &truncated)) {
+                continue;
+            }
+            if (truncated) {
+                QByteArray tcpPacket = packet;
+                writeUInt16(tcpPacket, 0, id);
+                response = exchangeTcp(channel, tcpPacket);
+                result = DnsAnswer();
+                if (response.isEmpty() || !parseResponse(response, id, name, type, &result, &truncated)) {
+                    continue;
+                }
+            }
+            if (result.rcode == DnsNoError || result.rcode == DnsNameError) {
+                return result;
+            }
+            // server failure or refused, try next name server.
+            answer = result;
+        }
+    }
+    return answer;
+}
+
+DnsAnswer DnsResolverPrivate::lookup(const QByteArray &name, quint16 type)
+{
+    DnsAnswer answer = query(name, type);
+    quint32 ttl = answer.ttl;
+    for (int hop = 0; hop < MaxCnameHops; ++hop) {
+        if (answer.rcode != DnsNoError || !answer.addresses.isEmpty() || answer.cname.isEmpty()) {
+            break;
+        }
+        answer = query(answer.cname, type);
+        ttl = qMin(ttl, answer.ttl);
+    }
+    answer.ttl = ttl;
+    return answer;
+}
+
+QByteArray DnsResolverPrivate::exchangeTcp(QSharedPointer<DnsChannel> channel, const QByteArray &packet)
+{
+    QByteArray response;
+    try {
+        Timeout timer(timeout);
+        QScopedPointer<Socket> socket(Socket::createConnection(channel->server, channel->port));
+        if (socket.isNull()) {
+            return response;
+        }
+        QByteArray request(2, '\0');
+        writeUInt16(request, 0, static_cast<quint16>(packet.size()));
+        request.append(packet);
+        if (socket->sendall(request) != request.size()) {
+            return response;
+        }
+        const QByteArray &header = socket->recvall(2);
+        if (header.size() != 2) {
+            return response;
+        }
+        const quint16 size = readUInt16(header, 0);
+        response = socket->recvall(size);
+        if (response.size() != size) {
+            response.clear();
+        }
+    } catch (TimeoutException &) {
+        response.clear();
+    }
+    return response;
+}
+
+QList<QByteArray> DnsResolverPrivate::candidates(const QByteArray &name, bool absolute) const
+{
+    QList<QByteArray> names;
+    if (absolute || searchDomains.isEmpty()) {
+        names.append(name);
+        return names;
+    }
+    const bool enoughDots = name.count('.') >= ndots;
+    if (enoughDots) {
+        names.append(name);
+    }
+    for (const QString &domain : searchDomains) {
+        const QByteArray &suffix = normalizeName(domain);
+        if (!suffix.isEmpty()) {
+            names.append(name + '.' + suffix);
+        }
+    }
+    if (!enoughDots) {
+        names.append(name);
+    }
+    return names;
+}
+
+static QList<HostAddress> filterAddresses(const QList<HostAddress> &addresses, int allowProtocol)
+{
+    QList<HostAddress> result;
+    for (const HostAddress &address : addresses) {
+        if ((address.isIPv4() && (allowProtocol & HostAddress::IPv4Protocol))
+            || (!address.isIPv4() && (allowProtocol & HostAddress::IPv6Protocol))) {
+            result.append(address);
+        }
+    }
+    return result;
+}
+
+// a failed server must not be remembered as a missing name.
+static quint32 mergeNegativeTtl(const DnsAnswer &answer, quint32 ttl)
+{
+    if (answer.rcode == DnsNoError || answer.rcode == DnsNameError) {
+        return qMin(ttl, answer.ttl);
+    }
+    return 0;
+}
+
+DnsResolver::DnsResolver()
+    : d_ptr(new DnsResolverPrivate())
+{
+}
+
+DnsResolver::~DnsResolver()
+{
+    delete d_ptr;
+}
+
+QList<HostAddress> DnsResolver::resolve(const QString &hostName, int allowProtocol, quint32 *ttl)
+{
+    Q_D(DnsResolver);
+    if (ttl) {
+        *ttl = 0;
+    }
+    HostAddress address;
+    if (HostAddress::parseLiteral(hostName, &address)) {
+        return filterAddresses(QList<HostAddress>() << address, allowProtocol);
+    }
+    QTNG_TRACE_SCOPE("dns", "dns resolve");
+    QByteArray name = QUrl::toAce(hostName).toLower();
+    const bool absolute = name.endsWith('.');
+    if (absolute) {
+        name.chop(1);
+    }
+    if (name.isEmpty()) {
+        return QList<HostAddress>();
+    }
+
+    if (d->hosts.contains(name)) {
+        const QList<HostAddress> &addresses = filterAddresses(d->hosts.value(name), allowProtocol);
+        if (!addresses.isEmpty()) {
+            if (ttl) {
+                *ttl = HostsFileTtl;
+            }
+            return addresses;
+        }
+    }
+
+    if (d->channels.isEmpty()) {
+        std::function<QList<HostAddress>()> task = [hostName] { return HostAddress::getHostAddressByName(hostName); };
+        const QList<HostAddress> &addresses = filterAddresses(callInThread<QList<HostAddress>>(task), allowProtocol);
+        if (ttl && !addresses.isEmpty()) {
+            *ttl = SystemResolverTtl;
+        }
+        return addresses;
+    }
+
+    quint32 negativeTtl = UINT_MAX;
+    const QList<QByteArray> &names = d->candidates(name, absolute);
+    for (const QByteArray &candidate : names) {
+        DnsAnswer ipv4, ipv6;
+        {
+            // both queries are in flight at the same time.
+            CoroutineGroup operations;
+            if (allowProtocol & HostAddress::IPv6Protocol) {
+                operations.spawn([d, candidate, &ipv6] { ipv6 = d->lookup(candidate, DnsTypeAaaa); });
+            }
+            if (allowProtocol & HostAddress::IPv4Protocol) {
+                ipv4 = d->lookup(candidate, DnsTypeA);
+            }
+            operations.joinall();
+        }
+        if (!ipv4.addresses.isEmpty() || !ipv6.addresses.isEmpty()) {
+            if (ttl) {
+                *ttl = UINT_MAX;
+                if (!ipv4.addresses.isEmpty()) {
+                    *ttl = qMin(*ttl, ipv4.ttl);
+                }
+                if (!ipv6.addresses.isEmpty()) {
+                    *ttl = qMin(*ttl, ipv6.ttl);
+                }
+            }
+            return ipv4.addresses + ipv6.addresses;
+        }
+        if (allowProtocol & HostAddress::IPv4Protocol) {
+            negativeTtl = mergeNegativeTtl(ipv4, negativeTtl);
+        }
+        if (allowProtocol & HostAddress::IPv6Protocol) {
+            negativeTtl = mergeNegativeTtl(ipv6, negativeTtl);
+        }
+    }
+    if (ttl) {
+        *ttl = negativeTtl == UINT_MAX ? 0 : negativeTtl;
+    }
+    return QList<HostAddress>();
+}
+
+QList<HostAddress> DnsResolver::nameServers() const
+{
+    Q_D(const DnsResolver);
+    QList<HostAddress> nameServers;
+    for (QSharedPointer<DnsChannel> channel : d->channels) {
+        nameServers.append(channel->server);
+    }
+    return nameServers;
+}
+
+void DnsResolver::setNameServers(const QList<HostAddress> &nameServers)
+{
+    Q_D(DnsResolver);
+    d->channels.clear();
+    for (const HostAddress &server : nameServers) {
+        d->channels.append(QSharedPointer<DnsChannel>(new DnsChannel(server, d->port)));
+    }
+}
+
+quint16 DnsResolver::nameServerPort() const
+{
+    Q_D(const DnsResolver);
+    return d->port;
+}
+
+void DnsResolver::setNameServerPort(quint16 port)
+{
+    Q_D(DnsResolver);
+    const QList<HostAddress> &nameServers = this->nameServers();
+    d->port = port;
+    setNameServers(nameServers);
+}
+
+QStringList DnsResolver::searchDomains() const
+{
+    Q_D(const DnsResolver);
+    return d->searchDomains;
+}
+
+void DnsResolver::setSearchDomains(const QStringList &searchDomains)
+{
+    Q_D(DnsResolver);
+    d->searchDomains = searchDomains;
+}
+
+int DnsResolver::ndots() const
+{
+    Q_D(const DnsResolver);
+    return d->ndots;
+}
+
+void DnsResolver::setNdots(int ndots)
+{
+    Q_D(DnsResolver);
+    d->ndots = qMax(0, ndots);
+}
+
+float DnsResolver::timeout() const
+{
+    Q_D(const DnsResolver);
+    return d->timeout;
+}
+
+void DnsResolver::setTimeout(float secs)
+{
+    Q_D(DnsResolver);
+    d->timeout = secs;
+}
+
+int DnsResolver::attempts() const
+{
+    Q_D(const DnsResolver);
+    return d->attempts;
+}
+
+void DnsResolver::setAttempts(int attempts)
+{
+    Q_D(DnsResolver);
+    d->attempts = qMax(1, attempts);
+}
+
+void DnsResolver::addHost(const QString &hostName, const HostAddress &address)
+{
+    Q_D(DnsResolver);
+    const QByteArray &name = normalizeName(hostName);
+    if (name.isEmpty() || address.isNull()) {
+        return;
+    }
+    QList<HostAddress> &addresses = d->hosts[name];
+    if (!addresses.contains(address)) {
+        addresses.append(address);
+    }
+}
+
+static QList<QByteArray> splitConfigLine(QByteArray line)
+{
+    int comment = line.indexOf('#');
+    if (comment >= 0) {
+        line.truncate(comment);
+    }
+    comment = line.indexOf(';');
+    if (comment >= 0) {
+        line.truncate(comment);
+    }
+    line = line.simplified();
+    if (line.isEmpty()) {
+        return QList<QByteArray>();
+    }
+    return line.split(' ');
+}
+
+bool DnsResolver::loadResolvConf(const QString &filePath)
+{
+    Q_D(DnsResolver);
+    QFile file(filePath.isEmpty() ? QString::fromLatin1("/etc/resolv.conf") : filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QList<HostAddress> nameServers;
+    QStringList searchDomains;
+    while (!file.atEnd()) {
+        const QList<QByteArray> &fields = splitConfigLine(file.readLine());
+        if (fields.size() < 2) {
+            continue;
+        }
+        const QByteArray &key = fields.at(0);
+        if (key == "nameserver") {
+            HostAddress server;
+            if (server.setAddress(QString::fromLatin1(fields.at(1)))) {
+                nameServers.append(server);
+            }
+        } else if (key == "search" || key == "domain") {
+            // the last one wins, same as glibc.
+            searchDomains.clear();
+            for (int i = 1; i < fields.size(); ++i) {
+                searchDomains.append(QString::fromLatin1(fields.at(i)));
+            }
+        } else if (key == "options") {
+            for (int i = 1; i < fields.size(); ++i) {
+                const QByteArray &option = fields.at(i);
+                if (option.startsWith("ndots:")) {
+                    d->ndots = qBound(0, option.mid(6).toInt(), 15);
+                } else if (option.startsWith("timeout:")) {
+                    d->timeout = qBound(1, option.mid(8).toInt(), 30);
+                } else if (option.startsWith("attempts:")) {
+                    d->attempts = qBound(1, option.mid(9).toInt(), 5);
+                }
+            }
+        }
+    }
+    if (nameServers.isEmpty()) {
+        nameServers.append(HostAddress(HostAddress::LocalHost));
+    }
+    setNameServers(nameServers);
+    d->searchDomains = searchDomains;
+    return true;
+}
+
+bool DnsResolver::loadHostsFile(const QString &filePath)
+{
+    QString path = filePath;
+    if (path.isEmpty()) {
+#ifdef Q_OS_WIN
+        path = QString::fromLocal8Bit(qgetenv("SystemRoot")) + QString::fromLatin1("\\System32\\drivers\\etc\\hosts");
+#else
+        path = QString::fromLatin1("/etc/hosts");
+#endif
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    while (!file.atEnd()) {
+        const QList<QByteArray> &fields = splitConfigLine(file.readLine());
+        if (fields.size() < 2) {
+            continue;
+        }
+        HostAddress address;
+        if (!address.setAddress(QString::fromLatin1(fields.at(0)))) {
+            continue;
+        }
+        for (int i = 1; i < fields.size(); ++i) {
+            addHost(QString::fromLatin1(fields.at(i)), address);
+        }
+    }
+    return true;
+}
+
+Q_GLOBAL_STATIC(QThreadStorage<QSharedPointer<DnsResolver>>, defaultResolvers)
+
+QSharedPointer<DnsResolver> DnsResolver::instance()
+{
+    QThreadStorage<QSharedPointer<DnsResolver>> *storage = defaultResolvers();
+    if (!storage->hasLocalData()) {
+        QSharedPointer<DnsResolver> resolver(new DnsResolver());
+        if (!resolver->loadResolvConf()) {
+            qtng_debug << "can not read resolv.conf, use the resolver of system.";
+        }
+        resolver->loadHostsFile();
+        storage->setLocalData(resolver);
+    }
+    return storage->localData();
+}
+
+QTNETWORKNG_NAMESPACE_END
@@ -2,8 +2,13 @@
 #include <QtCore/qpointer.h>
 #include <QtCore/qcoreapplication.h>
 #include <QtCore/qthread.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qdatetime.h>
 #include "../include/private/eventloop_p.h"
+#include "../include/private/coroutine_p.h"
+#include "../include/private/tracing_p.h"
 #include "../include/locks.h"
+#include "../include/coroutine_utils.h"
 #include "debugger.h"
 
 QTNG_LOGGER("qtng.eventloop");
@@ -12,17 +17,33 @@ QTNETWORKNG_NAMESPACE_BEGIN
 
 Q_GLOBAL_STATIC(CurrentLoopStorage, currentLoopStorage)
 Q_GLOBAL_STATIC(QAtomicInteger<int>, preferLibevFlag);
+Q_GLOBAL_STATIC(QAtomicInteger<int>, preferEpollFlag);
+Q_GLOBAL_STATIC(QAtomicInteger<int>, preferKqueueFlag);
+Q_GLOBAL_STATIC(QAtomicInteger<int>, preferIoUringFlag);
+Q_GLOBAL_STATIC(QAtomicInteger<int>, preferQtWithEpollFlag);
+// coroutines may be deleted in other threads, so they keep the counter of their thread alive.
+Q_GLOBAL_STATIC(QThreadStorage<QSharedPointer<QAtomicInt>>, liveCoroutineCounters);
 
 CurrentLoopStorage *currentLoop()
 {
     return currentLoopStorage();
 }
 
+static QSharedPointer<QAtomicInt> liveCoroutineCounter()
+{
+    QThreadStorage<QSharedPointer<QAtomicInt>> *counters = liveCoroutineCounters();
+    if (!counters->hasLocalData()) {
+        counters->setLocalData(QSharedPointer<QAtomicInt>::create(0));
+    }
+    return counters->localData();
+}
+
 class CoroutineSpawnHelper : public Coroutine
 {
 public:
-    CoroutineSpawnHelper(std::function<void()> f)
-        : f(new std::function<void()>(f))
+    CoroutineSpawnHelper(std::function<void()> f, size_t stackSize)
+        : Coroutine(stackSize)
+        , f(new std::function<void()>(f))
     {
     }
     virtual ~CoroutineSpawnHelper() override;
@@ -39,23 +60,110 @@ void CoroutineSpawnHelper::run()
     f.reset();
 }
 
-Coroutine *Coroutine::spawn(std::function<void()> f)
+Coroutine *Coroutine::spawn(std::function<void()> f, size_t stackSize)
 {
-    Coroutine *c = new CoroutineSpawnHelper(f);
+    Coroutine *c = new CoroutineSpawnHelper(f, stackSize);
     c->start();
     return c;
 }
 
+// runs the functions of spawnDetached() one after another, and waits in the free list of its thread between them.
+class RecycledCoroutine : public Coroutine
+{
+public:
+    RecycledCoroutine();
+    virtual void run() override;
+    std::function<void()> task;
+    YieldCurrentFunctor wakeup;  // borrowed by the eventloop.
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<QVector<RecycledCoroutine *>>, idleCoroutines)
+
+RecycledCoroutine::RecycledCoroutine()
+    : wakeup(true)
+{
+    wakeup.coroutine = this;
+    finished.addCallback([](BaseCoroutine *coroutine) {
+        EventLoopCoroutine::get()->callLater(0, new DeleteLaterFunctor<BaseCoroutine>(coroutine));
+    });
+}
+
+void RecycledCoroutine::run()
+{
+    QVector<RecycledCoroutine *> &idle = idleCoroutines()->localData();
+    while (true) {
+        {
+            std::function<void()> f;
+            f.swap(task);
+            f();
+        }
+        // the next function starts with no coroutine locals.
+        coroutineLocalValues(this)->clear();
+        if (static_cast<quint32>(idle.size()) >= BaseCoroutine::maxPooledStacks()) {
+            return;
+        }
+        idle.append(this);
+        try {
+            EventLoopCoroutine::get()->yield();
+        } catch (...) {
+            idle.removeOne(this);
+            throw;
+        }
+    }
+}
+
+void Coroutine::spawnDetached(std::function<void()> f)
+{
+    QVector<RecycledCoroutine *> &idle = idleCoroutines()->localData();
+    if (!idle.isEmpty()) {
+        RecycledCoroutine *c = idle.takeLast();
+        c->task = std::move(f);
+        EventLoopCoroutine::get()->callLater(0, &c->wakeup);
+        return;
+    }
+    RecycledCoroutine *c = new RecycledCoroutine();
+    c->task = std::move(f);
+    c->start();
+}
+
 void Coroutine::preferLibev()
 {
     preferLibevFlag->storeRelease(true);
 }
 
+void Coroutine::preferEpoll()
+{
+    preferEpollFlag->storeRelease(true);
+}
+
+void Coroutine::preferKqueue()
+{
+    preferKqueueFlag->storeRelease(true);
+}
+
+void Coroutine::preferIoUring()
+{
+    preferIoUringFlag->storeRelease(true);
+}
+
+void Coroutine::preferQtWithEpoll()
+{
+    preferQtWithEpollFlag->storeRelease(true);
+}
+
+#ifdef QTNETWORKNG_USE_EPOLL
+bool isQtWithEpollPreferred()
+{
+    return preferQtWithEpollFlag->loadAcquire();
+}
+#endif
+
 Functor::~Functor() { }
 
 void DoNothingFunctor::operator()() { }
 
-YieldCurrentFunctor::YieldCurrentFunctor()
+YieldCurrentFunctor::YieldCurrentFunctor(bool borrowed)
+    : Functor(borrowed)
 {
     coroutine = BaseCoroutine::current();
 }
@@ -73,12 +181,482 @@ void YieldCurrentFunctor::operator()()
     }
 }
 
+CallLaterQueue::CallLaterQueue()
+    : head(&stub)
+    , tail(&stub)
+    , wakeupPending(0)
+    , count(0)
+{
+    stub.next.storeRelease(nullptr);
+    stub.callback = nullptr;
+    stub.msecs = 0;
+}
+
+CallLaterQueue::~CallLaterQueue()
+{
+    quint32 msecs;
+    Functor *callback;
+    while (pop(&msecs, &callback)) {
+        releaseFunctor(callback);
+    }
+}
+
+bool CallLaterQueue::push(quint32 msecs, Functor *callback)
+{
+    Node *node = new Node();
+    node->next.storeRelease(nullptr);
+    node->callback = callback;
+    node->msecs = msecs;
+    count.ref();  // before the node is visible, so size() never goes negative.
+    Node *prev = head.fetchAndStoreAcquire(node);
+    prev->next.storeRelease(node);
+    return wakeupPending.testAndSetOrdered(0, 1);
+}
+
+void CallLaterQueue::clearWakeup()
+{
+    wakeupPending.fetchAndStoreOrdered(0);
+}
+
+// the algorithm of Dmitry Vyukov. a producer preempted between the exchange and the link hides the rest of the
+// queue for a moment, its own push() wakes the eventloop again.
+bool CallLaterQueue::pop(quint32 *msecs, Functor **callback)
+{
+    Node *t = tail;
+    Node *next = t->next.loadAcquire();
+    if (t == &stub) {
+        if (!next) {
+            return false;
+        }
+        tail = next;
+        t = next;
+        next = next->next.loadAcquire();
+    }
+    if (!next) {
+        if (t != head.loadAcquire()) {
+            return false;
+        }
+        stub.next.storeRelease(nullptr);
+        Node *prev = head.fetchAndStoreAcquire(&stub);
+        prev->next.storeRelease(&stub);
+        next = t->next.loadAcquire();
+        if (!next) {
+            return false;
+        }
+    }
+    tail = next;
+    *msecs = t->msecs;
+    *callback = t->callback;
+    delete t;
+    count.deref();
+    return true;
+}
+
+// a hierarchical timer wheel with 1ms ticks, 4 levels of 64 slots cover about 4.6 hours. longer timers wait in the
+// last slot of the top level and are placed again when it cascades. the wheel is driven by one timer of the backend,
+// which is armed at the next occupied tick of the first level, or at the next cascade.
+class TimerWheel
+{
+public:
+    explicit TimerWheel(EventLoopCoroutinePrivate *loop);
+    ~TimerWheel();
+public:
+    int add(quint32 msecs, Functor *callback);
+    bool restart(int timerId, quint32 msecs);
+    void cancel(int timerId);
+    void expire();
+    int size() const { return count; }
+private:
+    struct Entry
+    {
+        Functor *callback;
+        qint64 expires;
+        int prev;
+        int next;  // the next entry of the same slot, or the next free entry.
+        int slot;
+        quint32 generation;
+    };
+    enum {
+        LevelBits = 6,
+        SlotsPerLevel = 1 << LevelBits,
+        SlotMask = SlotsPerLevel - 1,
+        Levels = 4,
+    };
+    Entry *find(int timerId);
+    void link(int index);
+    void unlink(int index);
+    void cascade(int level, int slot);
+    qint64 nextCascade() const;
+    void arm();
+private:
+    QVector<Entry> entries;
+    int heads[Levels * SlotsPerLevel];
+    quint64 occupied[Levels];
+    QElapsedTimer clock;
+    EventLoopCoroutinePrivate * const loop;
+    qint64 current;  // the last tick processed.
+    qint64 driverDeadline;
+    int driverId;
+    FreeSlotQueue freeEntries;
+    int count;
+    friend struct TimerWheelDriverFunctor;
+};
+
+struct TimerWheelDriverFunctor : public Functor
+{
+    explicit TimerWheelDriverFunctor(TimerWheel *wheel)
+        : wheel(wheel)
+    {
+    }
+    virtual void operator()() override
+    {
+        wheel->driverId = 0;
+        wheel->expire();
+    }
+    TimerWheel * const wheel;
+};
+
+TimerWheel::TimerWheel(EventLoopCoroutinePrivate *loop)
+    : loop(loop)
+    , current(0)
+    , driverDeadline(0)
+    , driverId(0)
+    , count(0)
+{
+    for (int i = 0; i < Levels * SlotsPerLevel; ++i) {
+        heads[i] = -1;
+    }
+    for (int i = 0; i < Levels; ++i) {
+        occupied[i] = 0;
+    }
+    clock.start();
+}
+
+// the backend owns the driver timer, which is destroyed with it.
+TimerWheel::~TimerWheel()
+{
+    for (const Entry &entry : entries) {
+        releaseFunctor(entry.callback);
+    }
+}
+
+TimerWheel::Entry *TimerWheel::find(int timerId)
+{
+    int index = indexOfWatcherId(-timerId);
+    if (timerId >= 0 || index < 0 || index >= entries.size()) {
+        return nullptr;
+    }
+    Entry &entry = entries[index];
+    if (!entry.callback || (entry.generation & WatcherIdGenerationMask) != generationOfWatcherId(-timerId)) {
+        return nullptr;
+    }
+    return &entry;
+}
+
+void TimerWheel::link(int index)
+{
+    Entry &entry = entries[index];
+    qint64 expires = entry.expires;
+    if (expires <= current) {
+        expires = current + 1;
+    }
+    qint64 delta = expires - current;
+    int level = 0;
+    while (level < Levels - 1 && delta >= (Q_INT64_C(1) << ((level + 1) * LevelBits))) {
+        ++level;
+    }
+    if (delta >= (Q_INT64_C(1) << (Levels * LevelBits))) {
+        expires = current + (Q_INT64_C(1) << (Levels * LevelBits)) - 1;
+    }
+    int slot = level * SlotsPerLevel + static_cast<int>((expires >> (level * LevelBits)) & SlotMask);
+    entry.slot = slot;
+    entry.prev = -1;
+    entry.next = heads[slot];
+    if (entry.next >= 0) {
+        entries[entry.next].prev = index;
+    }
+    heads[slot] = index;
+    occupied[level] |= Q_UINT64_C(1) << (slot & SlotMask);
+}
+
+void TimerWheel::unlink(int index)
+{
+    Entry &entry = entries[index];
+    if (entry.prev >= 0) {
+        entries[entry.prev].next = entry.next;
+    } else {
+        heads[entry.slot] = entry.next;
+        if (entry.next < 0) {
+            occupied[entry.slot / SlotsPerLevel] &= ~(Q_UINT64_C(1) << (entry.slot & SlotMask));
+        }
+    }
+    if (entry.next >= 0) {
+        entries[entry.next].prev = entry.prev;
+    }
+    entry.prev = entry.next = -1;
+}
+
+int TimerWheel::add(quint32 msecs, Functor *callback)
+{
+    int index = freeEntries.take(entries, &Entry::next);
+    if (index < 0) {
+        if (!hasFreeWatcherIndex(entries.size())) {
+            releaseFunctor(callback);
+            return 0;
+        }
+        index = entries.size();
+        Entry empty;
+        empty.generation = 0;
+        entries.append(empty);
+    }
+    if (count == 0) {
+        // nothing to cascade, skip the idle ticks.
+        current = qMax(current, clock.elapsed());
+    }
+    Entry &entry = entries[index];
+    entry.callback = callback;
+    entry.expires = clock.elapsed() + msecs;
+    link(index);
+    ++count;
+    arm();
+    return -makeWatcherId(index, entries[index].generation);
+}
+
+bool TimerWheel::restart(int timerId, quint32 msecs)
+{
+    Entry *entry = find(timerId);
+    if (!entry) {
+        return false;
+    }
+    int index = indexOfWatcherId(-timerId);
+    unlink(index);
+    entries[index].expires = clock.elapsed() + msecs;
+    link(index);
+    arm();
+    return true;
+}
+
+void TimerWheel::cancel(int timerId)
+{
+    Entry *entry = find(timerId);
+    if (!entry) {
+        return;
+    }
+    int index = indexOfWatcherId(-timerId);
+    unlink(index);
+    Functor *callback = entry->callback;
+    entry->callback = nullptr;
+    ++entry->generation;
+    freeEntries.put(entries, &Entry::next, index);
+    --count;
+    // a running callback is already released, so it never reaches here.
+    releaseFunctor(callback);
+}
+
+void TimerWheel::cascade(int level, int slot)
+{
+    int head = heads[level * SlotsPerLevel + slot];
+    heads[level * SlotsPerLevel + slot] = -1;
+    occupied[level] &= ~(Q_UINT64_C(1) << slot);
+    while (head >= 0) {
+        int next = entries[head].next;
+        link(head);
+        head = next;
+    }
+}
+
+void TimerWheel::expire()
+{
+    const qint64 now = clock.elapsed();
+    while (current < now) {
+        if (!occupied[0]) {
+            // nothing to fire until the next cascade.
+            qint64 last = nextCascade() - 1;
+            if (last >= now) {
+                current = now;
+                break;
+            }
+            current = last;
+        }
+        ++current;
+        int slot = static_cast<int>(current & SlotMask);
+        if (slot == 0) {
+            for (int level = 1; level < Levels; ++level) {
+                int s = static_cast<int>((current >> (level * LevelBits)) & SlotMask);
+                cascade(level, s);
+                if (s != 0) {
+                    break;
+                }
+            }
+        }
+        int index;
+        while ((index = heads[slot]) >= 0) {
+            unlink(index);
+            Entry &entry = entries[index];
+            Functor *callback = entry.callback;
+            entry.callback = nullptr;
+            ++entry.generation;
+            freeEntries.put(entries, &Entry::next, index);
+            --count;
+            (*callback)();
+            releaseFunctor(callback);
+        }
+    }
+    arm();
+}
+
+// the tick at which the first occupied upper level cascades, the levels below it are empty or only need level 0.
+qint64 TimerWheel::nextCascade() const
+{
+    int level = 1;
+    while (level < Levels - 1 && !occupied[level]) {
+        ++level;
+    }
+    return (current | ((Q_INT64_C(1) << (level * LevelBits)) - 1)) + 1;
+}
+
+void TimerWheel::arm()
+{
+    if (count == 0) {
+        return;
+    }
+    qint64 deadline = nextCascade();
+    if (occupied[0]) {
+        // the nearest occupied slot after current, slots before it belong to the next round.
+        int base = static_cast<int>(current & SlotMask);
+        quint64 bits = occupied[0];
+        quint64 after = base == SlotMask ? 0 : bits & ~((Q_UINT64_C(2) << base) - 1);
+        int slot = 0;
+        quint64 b = after ? after : bits;
+        while (!(b & 1)) {
+            b >>= 1;
+            ++slot;
+        }
+        deadline = qMin(deadline, (current & ~static_cast<qint64>(SlotMask)) + slot + (after ? 0 : SlotsPerLevel));
+    }
+    if (driverId) {
+        if (driverDeadline <= deadline) {
+            return;
+        }
+        loop->cancelCall(driverId);
+    }
+    driverDeadline = deadline;
+    qint64 delay = qMax<qint64>(deadline - clock.elapsed(), 0);
+    driverId = loop->callLater(static_cast<quint32>(delay), new TimerWheelDriverFunctor(this));
+}
+
+EventLoopMetrics::EventLoopMetrics()
+    : iterations(0)
+    , callbacks(0)
+    , lastIterationCallbacks(0)
+    , maxIterationCallbacks(0)
+    , pollNsecs(0)
+    , busyNsecs(0)
+    , watchers(-1)
+    , timers(-1)
+    , pendingThreadSafeCalls(-1)
+    , coroutines(-1)
+{
+    for (int i = 0; i < LatencyBuckets; ++i) {
+        latencies[i] = 0;
+    }
+}
+
+qint64 EventLoopMetrics::latencyBucketBound(int bucket)
+{
+    if (bucket < 0 || bucket >= LatencyBuckets - 1) {
+        return -1;
+    }
+    return Q_INT64_C(16) << (2 * bucket);
+}
+
 EventLoopCoroutinePrivate::EventLoopCoroutinePrivate(EventLoopCoroutine *q)
     : q_ptr(q)
+    , wheel(nullptr)
+    , pollStarted(0)
+    , iterationStarted(-1)
+    , iterationCallbacks(0)
+    , spinNsecs(0)
+    , lastActive(0)
+    , cachedNow(-1)
+    , cachedWallNow(-1)
+{
+    metricsClock.start();
+}
+
+EventLoopCoroutinePrivate::~EventLoopCoroutinePrivate()
+{
+    delete wheel;
+}
+
+TimerWheel *EventLoopCoroutinePrivate::timerWheel()
+{
+    if (!wheel) {
+        wheel = new TimerWheel(this);
+    }
+    return wheel;
+}
+
+bool EventLoopCoroutinePrivate::completeIo(CompletionIo *)
 {
+    return false;
 }
 
-EventLoopCoroutinePrivate::~EventLoopCoroutinePrivate() { }
+void EventLoopCoroutinePrivate::fillMetrics(EventLoopMetrics *metrics)
+{
+    *metrics = counters;
+    metrics->coroutines = liveCoroutineCounter()->loadAcquire();
+    if (wheel) {
+        metrics->timers = wheel->size();
+    }
+}
+
+void EventLoopCoroutinePrivate::beforePoll()
+{
+    pauseCoroutineSlice();
+    const qint64 now = metricsClock.nsecsElapsed();
+    pollStarted = now;
+    if (iterationStarted < 0) {
+        return;
+    }
+    const qint64 busy = now - iterationStarted;
+    iterationStarted = -1;
+    ++counters.iterations;
+    counters.busyNsecs += busy;
+    counters.callbacks += iterationCallbacks;
+    counters.lastIterationCallbacks = iterationCallbacks;
+    counters.maxIterationCallbacks = qMax(counters.maxIterationCallbacks, iterationCallbacks);
+    iterationCallbacks = 0;
+    int bucket = 0;
+    for (qint64 bound = 16 * 1000; bucket < EventLoopMetrics::LatencyBuckets - 1 && busy >= bound; bound *= 4) {
+        ++bucket;
+    }
+    ++counters.latencies[bucket];
+}
+
+// keep polling without blocking until no callback runs for spinNsecs, so the events coming in that window are handled
+// without the wakeup latency of the kernel.
+bool EventLoopCoroutinePrivate::shouldSpin()
+{
+    if (spinNsecs <= 0) {
+        return false;
+    }
+    if (counters.lastIterationCallbacks > 0) {
+        lastActive = pollStarted;
+        return true;
+    }
+    return pollStarted - lastActive < spinNsecs;
+}
+
+void EventLoopCoroutinePrivate::afterPoll()
+{
+    const qint64 now = metricsClock.nsecsElapsed();
+    counters.pollNsecs += now - pollStarted;
+    iterationStarted = now;
+    cachedNow = metricsClock.msecsSinceReference() + now / (1000 * 1000);
+    cachedWallNow = -1;
+    resumeCoroutineSlice();
+}
 
 EventLoopCoroutine::EventLoopCoroutine(EventLoopCoroutinePrivate *d, size_t stackSize)
     : BaseCoroutine(BaseCoroutine::current(), stackSize)
@@ -153,9 +731,28 @@ int EventLoopCoroutine::callRepeat(quint32 msecs, Functor *callback)
 void EventLoopCoroutine::cancelCall(int callbackId)
 {
     Q_D(EventLoopCoroutine);
+    if (callbackId < 0) {
+        d->timerWheel()->cancel(callbackId);
+        return;
+    }
     return d->cancelCall(callbackId);
 }
 
+int EventLoopCoroutine::callLaterCoarse(quint32 msecs, Functor *callback)
+{
+    Q_D(EventLoopCoroutine);
+    return d->timerWheel()->add(msecs, callback);
+}
+
+bool EventLoopCoroutine::restartCall(int callbackId, quint32 msecs)
+{
+    Q_D(EventLoopCoroutine);
+    if (callbackId >= 0) {
+        return false;
+    }
+    return d->timerWheel()->restart(callbackId, msecs);
+}
+
 int EventLoopCoroutine::exitCode()
 {
     Q_D(EventLoopCoroutine);
@@ -174,6 +771,70 @@ void EventLoopCoroutine::yield()
     return d->yield();
 }
 
+EventLoopMetrics EventLoopCoroutine::metrics()
+{
+    Q_D(EventLoopCoroutine);
+    EventLoopMetrics metrics;
+    d->fillMetrics(&metrics);
+    return metrics;
+}
+
+void EventLoopCoroutine::setBusyPolling(quint32 usecs)
+{
+    Q_D(EventLoopCoroutine);
+    d->spinNsecs = static_cast<qint64>(usecs) * 1000;
+}
+
+quint32 EventLoopCoroutine::busyPolling()
+{
+    Q_D(EventLoopCoroutine);
+    return static_cast<quint32>(d->spinNsecs / 1000);
+}
+
+qint64 EventLoopCoroutine::now()
+{
+    Q_D(EventLoopCoroutine);
+    if (d->cachedNow < 0) {
+        return d->metricsClock.msecsSinceReference() + d->metricsClock.elapsed();
+    }
+    return d->cachedNow;
+}
+
+qint64 EventLoopCoroutine::wallNow()
+{
+    Q_D(EventLoopCoroutine);
+    if (d->cachedWallNow < 0) {
+        const qint64 wall = QDateTime::currentMSecsSinceEpoch();
+        if (d->cachedNow >= 0) {
+            d->cachedWallNow = wall;
+        }
+        return wall;
+    }
+    return d->cachedWallNow;
+}
+
+bool EventLoopCoroutine::completeIo(CompletionIo *io)
+{
+    Q_D(EventLoopCoroutine);
+    return d->completeIo(io);
+}
+
+#if !defined(QTNETWOKRNG_USE_EV) && QTNETWORKNG_USE_WIN
+// the completion port loop needs the afd driver, fall back to the WSAAsyncSelect loop without it.
+static EventLoopCoroutine *createWinEventLoop()
+{
+    EventLoopCoroutine *eventLoop;
+    if (IocpEventLoopCoroutine::isAvailable()) {
+        eventLoop = new IocpEventLoopCoroutine();
+        eventLoop->setObjectName(QString::fromLatin1("iocp_eventloop_coroutine"));
+    } else {
+        eventLoop = new WinEventLoopCoroutine();
+        eventLoop->setObjectName(QString::fromLatin1("win_eventloop_coroutine"));
+    }
+    return eventLoop;
+}
+#endif
+
 QSharedPointer<EventLoopCoroutine> CurrentLoopStorage::getOrCreate()
 {
     QSharedPointer<EventLoopCoroutine> eventLoop;
@@ -181,6 +842,35 @@ QSharedPointer<EventLoopCoroutine> CurrentLoopStorage::getOrCreate()
         eventLoop = storage.localData();
     }
     if (eventLoop.isNull()) {
+#ifdef QTNETWORKNG_USE_EPOLL
+        if (preferQtWithEpollFlag->loadAcquire() && QCoreApplication::instance()
+            && QCoreApplication::instance()->thread() == QThread::currentThread()) {
+            eventLoop.reset(new QtEpollEventLoopCoroutine());
+            eventLoop->setObjectName(QString::fromLatin1("qt_epoll_eventloop_coroutine"));
+            storage.setLocalData(eventLoop);
+            return eventLoop;
+        }
+        if (preferIoUringFlag->loadAcquire()) {
+            eventLoop.reset(new EpollEventLoopCoroutine(true));
+            eventLoop->setObjectName(QString::fromLatin1("io_uring_eventloop_coroutine"));
+            storage.setLocalData(eventLoop);
+            return eventLoop;
+        }
+        if (preferEpollFlag->loadAcquire()) {
+            eventLoop.reset(new EpollEventLoopCoroutine());
+            eventLoop->setObjectName(QString::fromLatin1("epoll_eventloop_coroutine"));
+            storage.setLocalData(eventLoop);
+            return eventLoop;
+        }
+#endif
+#ifdef QTNETWORKNG_USE_KQUEUE
+        if (preferKqueueFlag->loadAcquire()) {
+            eventLoop.reset(new KqueueEventLoopCoroutine());
+            eventLoop->setObjectName(QString::fromLatin1("kqueue_eventloop_coroutine"));
+            storage.setLocalData(eventLoop);
+            return eventLoop;
+        }
+#endif
 #ifdef QTNETWOKRNG_USE_EV
         if (preferLibevFlag->loadAcquire()) {
             eventLoop.reset(new EvEventLoopCoroutine());
@@ -202,8 +892,7 @@ QSharedPointer<EventLoopCoroutine> CurrentLoopStorage::getOrCreate()
         }
 #elif QTNETWORKNG_USE_WIN
         if (preferLibevFlag->loadAcquire()) {
-            eventLoop.reset(new WinEventLoopCoroutine());
-            eventLoop->setObjectName(QString::fromLatin1("win_eventloop_coroutine"));
+            eventLoop.reset(createWinEventLoop());
             storage.setLocalData(eventLoop);
         } else {
             if (QCoreApplication::instance() && QCoreApplication::instance()->thread() == QThread::currentThread()) {
@@ -211,8 +900,7 @@ QSharedPointer<EventLoopCoroutine> CurrentLoopStorage::getOrCreate()
                 eventLoop->setObjectName(QString::fromLatin1("qt_eventloop_coroutine"));
                 storage.setLocalData(eventLoop);
             } else {
-                eventLoop.reset(new WinEventLoopCoroutine());
-                eventLoop->setObjectName(QString::fromLatin1("win_eventloop_coroutine"));
+                eventLoop.reset(createWinEventLoop());
                 storage.setLocalData(eventLoop);
             }
         }
@@ -247,7 +935,8 @@ void CurrentLoopStorage::clean()
 }
 
 ScopedIoWatcher::ScopedIoWatcher(EventLoopCoroutine::EventType event, qintptr fd)
-    : event(event)
+    : callback(true)
+    , event(event)
     , fd(fd)
     , watcherId(0)
 {
@@ -257,9 +946,10 @@ void ScopedIoWatcher::start()
 {
     QSharedPointer<EventLoopCoroutine> eventLoop = currentLoopStorage->getOrCreate();
     if (watcherId <= 0) {
-        watcherId = eventLoop->createWatcher(event, fd, new YieldCurrentFunctor());
+        watcherId = eventLoop->createWatcher(event, fd, &callback);
     }
     eventLoop->startWatcher(watcherId);
+    QTNG_TRACE_SCOPE_ARG("io", "io wait", "fd", fd);
     eventLoop->yield();
 }
 
@@ -271,33 +961,49 @@ ScopedIoWatcher::~ScopedIoWatcher()
     }
 }
 
-class CoroutinePrivate : public QObject
-{
-public:
-    CoroutinePrivate(Coroutine *q, QObject *obj, const char *slot);
-    virtual ~CoroutinePrivate();
-private:
-    Coroutine * const q_ptr;
-    Event finishedEvent;
-    QObject * const obj;
-    const char * const slot;
-    int callbackId;
-
-    Q_DECLARE_PUBLIC(Coroutine)
-    friend struct StartCoroutineFunctor;
-    friend struct KillCoroutineFunctor;
-};
-
 CoroutinePrivate::CoroutinePrivate(Coroutine *q, QObject *obj, const char *slot)
     : q_ptr(q)
+    , joiner(nullptr)
+    , finishedEvent(nullptr)
     , obj(obj)
     , slot(slot)
+    , liveCounter(liveCoroutineCounter())
     , callbackId(0)
 {
-    q->finished.addCallback([this](BaseCoroutine *) { finishedEvent.set(); });
+    liveCounter->ref();
+    q->finished.setHook(onFinished, this);
 }
 
-CoroutinePrivate::~CoroutinePrivate() { }
+CoroutinePrivate::~CoroutinePrivate()
+{
+    wakeJoiners(true);
+    delete finishedEvent;  // the waiters return false.
+    liveCounter->deref();
+}
+
+void CoroutinePrivate::wakeJoiners(bool deleted)
+{
+    if (joiner) {
+        joiner->woken = true;
+        joiner->deleted = deleted;
+        YieldCurrentFunctor *wakeup = new YieldCurrentFunctor();
+        wakeup->coroutine = joiner->coroutine;
+        EventLoopCoroutine::get()->callLater(0, wakeup);
+        joiner = nullptr;
+    }
+    if (finishedEvent && !deleted) {
+        finishedEvent->set();
+    }
+}
+
+void CoroutinePrivate::onFinished(void *data, BaseCoroutine *const &)
+{
+    CoroutinePrivate *d = static_cast<CoroutinePrivate *>(data);
+    d->wakeJoiners(false);
+    if (!d->group.isNull()) {
+        d->group->deleteCoroutine(d->q_ptr);
+    }
+}
 
 struct StartCoroutineFunctor : public Functor
 {
@@ -399,7 +1105,7 @@ void Coroutine::kill(CoroutineException *e, quint32 msecs)
             }
             setState(Coroutine::Stopped);
             delete e;
-            d->finishedEvent.set();
+            d->wakeJoiners(false);
         } else {
             if (d->callbackId == 0) {
                 d->callbackId = c->callLater(msecs, new StartCoroutineFunctor(d));
@@ -425,7 +1131,7 @@ void Coroutine::cancelStart()
     }
     if (state() == Coroutine::Initialized) {
         setState(Coroutine::Stopped);
-        d->finishedEvent.set();
+        d->wakeJoiners(false);
     } else if (state() == Coroutine::Started) {
         c->callLater(0, new KillCoroutineFunctor(d, new CoroutineExitException()));
     }
@@ -455,10 +1161,32 @@ bool Coroutine::join()
     Q_D(Coroutine);
     if (state() == BaseCoroutine::Initialized || state() == BaseCoroutine::Started) {
         bool ok;
-        if (!dynamic_cast<Coroutine *>(BaseCoroutine::current())) {
+        BaseCoroutine *current = BaseCoroutine::current();
+        if (!dynamic_cast<Coroutine *>(current)) {
             ok = EventLoopCoroutine::get()->runUntil(this);
+        } else if (!d->joiner) {
+            CoroutineJoiner joiner = { current, false, false };
+            d->joiner = &joiner;
+            try {
+                while (!joiner.woken) {
+                    EventLoopCoroutine::get()->yield();
+                }
+            } catch (...) {
+                if (!joiner.woken) {
+                    d->joiner = nullptr;
+                }
+                throw;
+            }
+            if (joiner.deleted) {
+                qtng_debug << "coroutine is deleted while joining.";
+                return false;
+            }
+            ok = true;
         } else {
-            ok = d->finishedEvent.wait();
+            if (!d->finishedEvent) {
+                d->finishedEvent = new Event();
+            }
+            ok = d->finishedEvent->wait();
         }
         if (ok) {
             Q_ASSERT(isFinished());
@@ -535,19 +1263,22 @@ CoroutineException *TimeoutException::clone() const
     return new TimeoutException();
 }
 
+Q_GLOBAL_STATIC(CoroutineLocal<Timeout *>, currentTimeouts)
+
 Timeout::Timeout(float secs)
-    : msecs(static_cast<quint32>((secs > 0.0f ? secs : 0.0f) * 1000))
-    , timeoutId(0)
+    : Timeout(static_cast<quint32>((secs > 0.0f ? secs : 0.0f) * 1000), 0)
 {
-    if (msecs) {
-        restart();
-    }
 }
 
 Timeout::Timeout(quint32 msecs, int)
     : msecs(msecs)
     , timeoutId(0)
+    , deadline(-1)
+    , coroutine(BaseCoroutine::current())
 {
+    top = &currentTimeouts()->localData();
+    parent = *top;
+    *top = this;
     if (msecs) {
         restart();
     }
@@ -558,14 +1289,105 @@ Timeout::~Timeout()
     if (timeoutId) {
         EventLoopCoroutine::get()->cancelCall(timeoutId);
     }
+    if (coroutine.isNull()) {
+        return;
+    }
+    // usually the innermost one, but it may be deleted out of order.
+    Timeout *inner = nullptr;
+    for (Timeout *t = *top; t && t != this; t = t->parent) {
+        inner = t;
+    }
+    if (inner) {
+        inner->parent = parent;
+    } else if (*top == this) {
+        *top = parent;
+    }
+    // the inner ones trusted me to fire first.
+    for (Timeout *t = *top; t != parent; t = t->parent) {
+        if (!t->timeoutId && t->deadline >= 0) {
+            t->arm();
+        }
+    }
 }
 
-void Timeout::restart()
+qint64 Timeout::inheritedDeadline() const
+{
+    qint64 earliest = -1;
+    for (Timeout *t = parent; t; t = t->parent) {
+        if (t->deadline >= 0 && (earliest < 0 || t->deadline < earliest)) {
+            earliest = t->deadline;
+        }
+    }
+    return earliest;
+}
+
+void Timeout::arm()
 {
+    EventLoopCoroutine *eventLoop = EventLoopCoroutine::get();
+    const qint64 inherited = inheritedDeadline();
+    if (inherited >= 0 && inherited <= deadline) {
+        if (timeoutId) {
+            eventLoop->cancelCall(timeoutId);
+            timeoutId = 0;
+        }
+        return;
+    }
+    const quint32 delay = static_cast<quint32>(qMax<qint64>(deadline - eventLoop->now(), 0));
     if (timeoutId) {
-        EventLoopCoroutine::get()->cancelCall(timeoutId);
+        // move it to another bucket of the timer wheel if it is not fired yet.
+        if (eventLoop->restartCall(timeoutId, delay)) {
+            return;
+        }
+        eventLoop->cancelCall(timeoutId);
+    }
+    timeoutId = eventLoop->callLaterCoarse(delay, new TimeoutFunctor(this, coroutine.data()));
+}
+
+void Timeout::restart()
+{
+    deadline = EventLoopCoroutine::get()->now() + msecs;
+    arm();
+    if (coroutine.isNull()) {
+        return;
+    }
+    // the inner ones may be earlier than me now.
+    for (Timeout *t = *top; t && t != this; t = t->parent) {
+        if (!t->timeoutId && t->deadline >= 0) {
+            t->arm();
+        }
+    }
+}
+
+qint64 Timeout::currentDeadline()
+{
+    Timeout *t = currentTimeouts()->localData();
+    if (!t) {
+        return -1;
     }
-    timeoutId = EventLoopCoroutine::get()->callLater(msecs, new TimeoutFunctor(this, BaseCoroutine::current()));
+    qint64 earliest = t->inheritedDeadline();
+    if (t->deadline >= 0 && (earliest < 0 || t->deadline < earliest)) {
+        earliest = t->deadline;
+    }
+    return earliest;
+}
+
+float Timeout::remaining()
+{
+    const qint64 deadline = currentDeadline();
+    if (deadline < 0) {
+        return -1.0f;
+    }
+    return static_cast<float>(qMax<qint64>(deadline - EventLoopCoroutine::get()->now(), 0)) / 1000.0f;
+}
+
+EventLoopMetrics eventLoopMetrics()
+{
+    return EventLoopCoroutine::get()->metrics();
+}
+
+void setEventLoopBusyPolling(quint32 usecs)
+{
+    EventLoopCoroutine::get()->setBusyPolling(usecs);
 }
 
 QTNETWORKNG_NAMESPACE_END
@@ -0,0 +1,1287 @@
+#include <QtCore/qvector.h>
+#include <QtCore/qvarlengtharray.h>
+#include <QtCore/qpointer.h>
+#include <QtCore/qcoreapplication.h>
+#include <QtCore/qeventloop.h>
+#include <QtCore/qsocketnotifier.h>
+#include <QtCore/qtimer.h>
+#include <algorithm>
+#include <exception>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#if defined(__has_include)
+#  if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#    include <linux/io_uring.h>
+#    define QTNG_HAVE_IO_URING
+#  endif
+#endif
+#include "../include/private/eventloop_p.h"
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.eventloop_epoll");
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+static const int MaxEventsPerWait = 256;
+
+static inline qint64 monotonicMsecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<qint64>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct EpollIoWatcher
+{
+    Functor *callback;
+    int fd;
+    int prev;  // the previous watcher of the same fd.
+    int next;  // the next watcher of the same fd, or the next free slot.
+    quint32 generation;
+    quint8 events;
+    bool used;
+    bool active;
+};
+
+struct EpollFdState
+{
+    EpollFdState()
+        : firstWatcher(-1)
+        , firstIo(-1)
+        , readyEvents(0)
+        , registered(false)
+        , alwaysReady(false)
+    {
+    }
+    int firstWatcher;
+    int firstIo;  // operations submitted to io_uring, cancelled by triggerIoWatchers().
+    quint8 readyEvents;  // edges received while no watcher was waiting.
+    bool registered;
+    bool alwaysReady;  // epoll refuses regular files, which never block.
+};
+
+struct EpollTimer
+{
+    Functor *callback;
+    quint32 interval;
+    quint32 generation;
+    int nextFree;
+    bool used;
+    bool repeat;
+};
+
+struct EpollTimerItem
+{
+    qint64 deadline;
+    quint64 sequence;  // keeps callbacks with the same deadline in fifo order.
+    int index;
+    quint32 generation;
+};
+
+static inline bool operator>(const EpollTimerItem &a, const EpollTimerItem &b)
+{
+    return a.deadline > b.deadline || (a.deadline == b.deadline && a.sequence > b.sequence);
+}
+
+#ifdef QTNG_HAVE_IO_URING
+
+struct EpollPendingIo
+{
+    QPointer<BaseCoroutine> coroutine;
+    qint64 result;
+    int fd;
+    int prev;
+    int next;  // the next operation of the same fd, or the next free slot.
+    quint32 generation;
+    bool used;
+    bool done;
+};
+
+// a minimal io_uring binding using the raw syscalls, so we do not depend on liburing.
+class IoUring
+{
+public:
+    IoUring();
+    ~IoUring();
+    bool setup(unsigned entries);
+    struct io_uring_sqe *getSqe();
+    int submit();
+    bool popCompletion(quint64 *userData, qint32 *result);
+public:
+    int fd;
+private:
+    void *sqRing;
+    void *cqRing;
+    struct io_uring_sqe *sqes;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned sqeTail;  // sqes taken by getSqe() but not published yet.
+};
+
+IoUring::IoUring()
+    : fd(-1)
+    , sqRing(MAP_FAILED)
+    , cqRing(MAP_FAILED)
+    , sqes(static_cast<struct io_uring_sqe *>(MAP_FAILED))
+    , sqRingSize(0)
+    , cqRingSize(0)
+    , sqesSize(0)
+    , sqeTail(0)
+{
+}
+
+IoUring::~IoUring()
+{
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+bool IoUring::setup(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) {
+        qtng_debug << "io_uring is not available:" << errno;
+        return false;
+    }
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        sqRingSize = cqRingSize = qMax(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        return false;
+    }
+    if (singleMmap) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            return false;
+        }
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *p = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<struct io_uring_sqe *>(p);
+    char *sq = static_cast<char *>(sqRing);
+    char *cq = static_cast<char *>(cqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqEntries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    // sqes are always used in ring order, so the indirection array is the identity.
+    unsigned *array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sqEntries; ++i) {
+        array[i] = i;
+    }
+    sqeTail = *sqTail;
+    return true;
+}
+
+struct io_uring_sqe *IoUring::getSqe()
+{
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqeTail - head >= sqEntries) {
+        return nullptr;
+    }
+    struct io_uring_sqe *sqe = &sqes[sqeTail & sqMask];
+    ++sqeTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::submit()
+{
+    __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+    // entries left over by a short submission are still between head and tail.
+    unsigned pending = sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (!pending) {
+        return 0;
+    }
+    int r;
+    do {
+        r = static_cast<int>(syscall(__NR_io_uring_enter, fd, pending, 0, 0, nullptr, 0));
+    } while (r < 0 && errno == EINTR);
+    if (r < 0) {
+        qtng_warning << "io_uring_enter() failed:" << errno;
+    }
+    return r;
+}
+
+bool IoUring::popCompletion(quint64 *userData, qint32 *result)
+{
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    const struct io_uring_cqe &cqe = cqes[head & cqMask];
+    *userData = cqe.user_data;
+    *result = cqe.res;
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#endif
+
+class EpollEventLoopCoroutinePrivate : public EventLoopCoroutinePrivate
+{
+public:
+    explicit EpollEventLoopCoroutinePrivate(EventLoopCoroutine *q);
+    virtual ~EpollEventLoopCoroutinePrivate() override;
+public:
+    virtual void run() override;
+    virtual int createWatcher(EventLoopCoroutine::EventType event, qintptr fd, Functor *callback) override;
+    virtual void startWatcher(int watcherId) override;
+    virtual void stopWatcher(int watcherId) override;
+    virtual void removeWatcher(int watcherId) override;
+    virtual void triggerIoWatchers(qintptr fd) override;
+    virtual int callLater(quint32 msecs, Functor *callback) override;
+    virtual void callLaterThreadSafe(quint32 msecs, Functor *callback) override;
+    virtual int callRepeat(quint32 msecs, Functor *callback) override;
+    virtual void cancelCall(int callbackId) override;
+    virtual int exitCode() override;
+    virtual bool runUntil(BaseCoroutine *coroutine) override;
+    virtual void yield() override;
+    virtual bool completeIo(CompletionIo *io) override;
+    virtual void fillMetrics(EventLoopMetrics *metrics) override;
+public:
+    bool setupIoUring();
+private:
+    EpollIoWatcher *findIoWatcher(int watcherId);
+    EpollTimer *findTimer(int callbackId);
+    int addTimer(quint32 msecs, Functor *callback, bool repeat);
+    void pushTimer(qint64 deadline, int index, quint32 generation);
+    void compactTimers();
+    void registerFd(int fd);
+    void dispatch(int fd, quint32 revents);
+    void processPendingIo();
+    void processTimers();
+    void doCallLater();
+    int pollTimeout();
+    void runOnce(bool block = true);
+    void loop();
+#ifdef QTNG_HAVE_IO_URING
+    int submitIo(CompletionIo *io, CompletionIo::Operation operation);
+    void cancelIo(int index);
+    void releasePendingIo(int index);
+    void processCompletions();
+#endif
+private:
+    QVector<EpollIoWatcher> ioWatchers;
+    QVector<EpollFdState> fds;
+    QVector<int> pendingIo;
+    QVector<EpollTimer> timers;
+    QVector<EpollTimerItem> timerHeap;
+    QList<Functor *> uselessCallbacks;
+    CallLaterQueue callLaterQueue;
+#ifdef QTNG_HAVE_IO_URING
+    IoUring *ring;
+    QVector<EpollPendingIo> pendingIos;
+    FreeSlotQueue freePendingIos;
+#endif
+    QPointer<BaseCoroutine> loopCoroutine;
+    quint64 nextSequence;
+    int epollFd;
+    int eventFd;
+    int ioWatcherCount;
+    FreeSlotQueue freeIoWatchers;
+    FreeSlotQueue freeTimers;
+    int staleTimers;
+    bool breakOne;
+    Q_DECLARE_PUBLIC(EventLoopCoroutine)
+    friend class QtEpollEventLoopCoroutinePrivate;
+};
+
+EpollEventLoopCoroutinePrivate::EpollEventLoopCoroutinePrivate(EventLoopCoroutine *q)
+    : EventLoopCoroutinePrivate(q)
+#ifdef QTNG_HAVE_IO_URING
+    , ring(nullptr)
+#endif
+    , nextSequence(0)
+    , epollFd(-1)
+    , eventFd(-1)
+    , ioWatcherCount(0)
+    , staleTimers(0)
+    , breakOne(false)
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        qtng_warning << "can not create epoll fd:" << errno;
+        return;
+    }
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0) {
+        qtng_warning << "can not create eventfd:" << errno;
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = eventFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &ev) < 0) {
+        qtng_warning << "can not watch eventfd:" << errno;
+    }
+}
+
+EpollEventLoopCoroutinePrivate::~EpollEventLoopCoroutinePrivate()
+{
+    for (const EpollIoWatcher &watcher : ioWatchers) {
+        if (watcher.used) {
+            releaseFunctor(watcher.callback);
+        }
+    }
+    for (const EpollTimer &timer : timers) {
+        if (timer.used) {
+            releaseFunctor(timer.callback);
+        }
+    }
+    qDeleteAll(uselessCallbacks);
+#ifdef QTNG_HAVE_IO_URING
+    delete ring;
+#endif
+    if (eventFd >= 0) {
+        ::close(eventFd);
+    }
+    if (epollFd >= 0) {
+        ::close(epollFd);
+    }
+}
+
+EpollIoWatcher *EpollEventLoopCoroutinePrivate::findIoWatcher(int watcherId)
+{
+    int index = indexOfWatcherId(watcherId);
+    if (index < 0 || index >= ioWatchers.size()) {
+        return nullptr;
+    }
+    EpollIoWatcher &watcher = ioWatchers[index];
+    if (!watcher.used || (watcher.generation & WatcherIdGenerationMask) != generationOfWatcherId(watcherId)) {
+        return nullptr;
+    }
+    return &watcher;
+}
+
+EpollTimer *EpollEventLoopCoroutinePrivate::findTimer(int callbackId)
+{
+    int index = indexOfWatcherId(callbackId);
+    if (index < 0 || index >= timers.size()) {
+        return nullptr;
+    }
+    EpollTimer &timer = timers[index];
+    if (!timer.used || (timer.generation & WatcherIdGenerationMask) != generationOfWatcherId(callbackId)) {
+        return nullptr;
+    }
+    return &timer;
+}
+
+void EpollEventLoopCoroutinePrivate::run()
+{
+    try {
+        loop();
+    } catch (...) {
+        qtng_warning << "epoll eventloop got exception.";
+    }
+}
+
+int EpollEventLoopCoroutinePrivate::createWatcher(EventLoopCoroutine::EventType event, qintptr fd, Functor *callback)
+{
+    int index = freeIoWatchers.take(ioWatchers, &EpollIoWatcher::next);
+    if (index < 0) {
+        if (!hasFreeWatcherIndex(ioWatchers.size())) {
+            releaseFunctor(callback);
+            return 0;
+        }
+        index = ioWatchers.size();
+        EpollIoWatcher empty;
+        empty.generation = 0;
+        ioWatchers.append(empty);
+    }
+    EpollIoWatcher &watcher = ioWatchers[index];
+    watcher.callback = callback;
+    watcher.fd = static_cast<int>(fd);
+    watcher.prev = -1;
+    watcher.next = -1;
+    watcher.events = static_cast<quint8>(event);
+    watcher.used = true;
+    watcher.active = false;
+    ++ioWatcherCount;
+    if (fd >= 0) {
+        if (fd >= fds.size()) {
+            fds.resize(static_cast<int>(fd) + 1);
+        }
+        EpollFdState &state = fds[static_cast<int>(fd)];
+        watcher.next = state.firstWatcher;
+        if (watcher.next >= 0) {
+            ioWatchers[watcher.next].prev = index;
+        }
+        state.firstWatcher = index;
+    }
+    return makeWatcherId(index, watcher.generation);
+}
+
+void EpollEventLoopCoroutinePrivate::registerFd(int fd)
+{
+    EpollFdState &state = fds[fd];
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+        state.registered = true;
+        return;
+    }
+    int e = errno;
+    if (e == EEXIST && epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+        state.registered = true;
+        return;
+    }
+    if (e != EPERM) {
+        qtng_debug << "can not add fd to epoll:" << fd << e;
+    }
+    // let the caller try again, so it sees the real error from its syscall.
+    state.alwaysReady = true;
+}
+
+void EpollEventLoopCoroutinePrivate::startWatcher(int watcherId)
+{
+    EpollIoWatcher *watcher = findIoWatcher(watcherId);
+    if (!watcher || watcher->active) {
+        return;
+    }
+    watcher->active = true;
+    if (watcher->fd < 0) {
+        pendingIo.append(watcherId);
+        return;
+    }
+    EpollFdState &state = fds[watcher->fd];
+    if (!state.registered && !state.alwaysReady) {
+        registerFd(watcher->fd);
+    }
+    if (state.alwaysReady || (state.readyEvents & watcher->events)) {
+        state.readyEvents &= ~watcher->events;
+        pendingIo.append(watcherId);
+    }
+}
+
+void EpollEventLoopCoroutinePrivate::stopWatcher(int watcherId)
+{
+    EpollIoWatcher *watcher = findIoWatcher(watcherId);
+    if (watcher) {
+        watcher->active = false;
+    }
+}
+
+void EpollEventLoopCoroutinePrivate::removeWatcher(int watcherId)
+{
+    EpollIoWatcher *watcher = findIoWatcher(watcherId);
+    if (!watcher) {
+        return;
+    }
+    int index = indexOfWatcherId(watcherId);
+    if (watcher->prev >= 0) {
+        ioWatchers[watcher->prev].next = watcher->next;
+    } else if (watcher->fd >= 0) {
+        fds[watcher->fd].firstWatcher = watcher->next;
+    }
+    if (watcher->next >= 0) {
+        ioWatchers[watcher->next].prev = watcher->prev;
+    }
+    // the callback may be running right now, delete it in the next iteration.
+    // a borrowed callback may be destroyed by its owner right after, never touch it later.
+    if (!watcher->callback->isBorrowed()) {
+        uselessCallbacks.append(watcher->callback);
+    }
+    watcher->callback = nullptr;
+    watcher->used = false;
+    watcher->active = false;
+    ++watcher->generation;
+    freeIoWatchers.put(ioWatchers, &EpollIoWatcher::next, index);
+    --ioWatcherCount;
+}
+
+// fds are removed from epoll here, so code that closes a watched fd must call triggerIoWatchers() as Socket does.
+void EpollEventLoopCoroutinePrivate::triggerIoWatchers(qintptr fd)
+{
+    if (fd < 0 || fd >= fds.size()) {
+        return;
+    }
+    EpollFdState &state = fds[static_cast<int>(fd)];
+    for (int index = state.firstWatcher; index >= 0; index = ioWatchers[index].next) {
+        EpollIoWatcher &watcher = ioWatchers[index];
+        watcher.active = false;
+        pendingIo.append(makeWatcherId(index, watcher.generation));
+    }
+#ifdef QTNG_HAVE_IO_URING
+    for (int index = state.firstIo; index >= 0; index = pendingIos[index].next) {
+        cancelIo(index);
+    }
+#endif
+    if (state.registered) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, static_cast<int>(fd), nullptr);
+    }
+    state.registered = false;
+    state.alwaysReady = false;
+    state.readyEvents = 0;
+}
+
+void EpollEventLoopCoroutinePrivate::dispatch(int fd, quint32 revents)
+{
+    if (fd < 0 || fd >= fds.size()) {
+        return;
+    }
+    quint8 ready = 0;
+    if (revents & (EPOLLIN | EPOLLRDHUP | EPOLLPRI)) {
+        ready |= EventLoopCoroutine::Read;
+    }
+    if (revents & EPOLLOUT) {
+        ready |= EventLoopCoroutine::Write;
+    }
+    if (revents & (EPOLLERR | EPOLLHUP)) {
+        ready |= EventLoopCoroutine::ReadWrite;
+    }
+    // callbacks switch to other coroutines which may create or remove watchers, collect the ids first.
+    QVarLengthArray<int, 8> fired;
+    quint8 consumed = 0;
+    EpollFdState &state = fds[fd];
+    for (int index = state.firstWatcher; index >= 0; index = ioWatchers[index].next) {
+        const EpollIoWatcher &watcher = ioWatchers[index];
+        if (watcher.active && (watcher.events & ready)) {
+            consumed |= (watcher.events & ready);
+            fired.append(makeWatcherId(index, watcher.generation));
+        }
+    }
+    state.readyEvents |= (ready & ~consumed);
+    for (int watcherId : fired) {
+        EpollIoWatcher *watcher = findIoWatcher(watcherId);
+        if (watcher && watcher->active) {
+            countCallback();
+            (*watcher->callback)();
+        }
+    }
+}
+
+void EpollEventLoopCoroutinePrivate::processPendingIo()
+{
+    if (pendingIo.isEmpty()) {
+        return;
+    }
+    QVector<int> ids;
+    ids.swap(pendingIo);
+    for (int watcherId : ids) {
+        EpollIoWatcher *watcher = findIoWatcher(watcherId);
+        if (watcher) {
+            countCallback();
+            (*watcher->callback)();
+        }
+    }
+}
+
+void EpollEventLoopCoroutinePrivate::pushTimer(qint64 deadline, int index, quint32 generation)
+{
+    EpollTimerItem item;
+    item.deadline = deadline;
+    item.sequence = nextSequence++;
+    item.index = index;
+    item.generation = generation;
+    timerHeap.append(item);
+    std::push_heap(timerHeap.begin(), timerHeap.end(), std::greater<EpollTimerItem>());
+}
+
+int EpollEventLoopCoroutinePrivate::addTimer(quint32 msecs, Functor *callback, bool repeat)
+{
+    int index = freeTimers.take(timers, &EpollTimer::nextFree);
+    if (index < 0) {
+        if (!hasFreeWatcherIndex(timers.size())) {
+            releaseFunctor(callback);
+            return 0;
+        }
+        index = timers.size();
+        EpollTimer empty;
+        empty.generation = 0;
+        timers.append(empty);
+    }
+    EpollTimer &timer = timers[index];
+    timer.callback = callback;
+    timer.interval = msecs;
+    timer.nextFree = -1;
+    timer.used = true;
+    timer.repeat = repeat;
+    pushTimer(monotonicMsecs() + msecs, index, timer.generation);
+    return makeWatcherId(index, timer.generation);
+}
+
+int EpollEventLoopCoroutinePrivate::callLater(quint32 msecs, Functor *callback)
+{
+    return addTimer(msecs, callback, false);
+}
+
+int EpollEventLoopCoroutinePrivate::callRepeat(quint32 msecs, Functor *callback)
+{
+    return addTimer(qMax<quint32>(msecs, 1), callback, true);
+}
+
+void EpollEventLoopCoroutinePrivate::cancelCall(int callbackId)
+{
+    EpollTimer *timer = findTimer(callbackId);
+    if (!timer) {
+        return;
+    }
+    if (!timer->callback->isBorrowed()) {
+        uselessCallbacks.append(timer->callback);
+    }
+    timer->callback = nullptr;
+    timer->used = false;
+    ++timer->generation;
+    freeTimers.put(timers, &EpollTimer::nextFree, indexOfWatcherId(callbackId));
+    ++staleTimers;
+    compactTimers();
+}
+
+void EpollEventLoopCoroutinePrivate::compactTimers()
+{
+    // cancelled timers stay in the heap until they expire, rebuild it if they pile up.
+    if (staleTimers <= 1024 || staleTimers <= timerHeap.size() / 2) {
+        return;
+    }
+    QVector<EpollTimerItem> alive;
+    alive.reserve(timerHeap.size() - staleTimers);
+    for (const EpollTimerItem &item : timerHeap) {
+        const EpollTimer &timer = timers[item.index];
+        if (timer.used && timer.generation == item.generation) {
+            alive.append(item);
+        }
+    }
+    std::make_heap(alive.begin(), alive.end(), std::greater<EpollTimerItem>());
+    timerHeap.swap(alive);
+    staleTimers = 0;
+}
+
+void EpollEventLoopCoroutinePrivate::processTimers()
+{
+    const qint64 now = monotonicMsecs();
+    // timers added by the callbacks run in the next iteration.
+    const quint64 sequenceLimit = nextSequence;
+    while (!timerHeap.isEmpty()) {
+        const EpollTimerItem item = timerHeap.first();
+        if (item.deadline > now || item.sequence >= sequenceLimit) {
+            break;
+        }
+        std::pop_heap(timerHeap.begin(), timerHeap.end(), std::greater<EpollTimerItem>());
+        timerHeap.removeLast();
+        EpollTimer &timer = timers[item.index];
+        if (!timer.used || timer.generation != item.generation) {
+            if (staleTimers > 0) {
+                --staleTimers;
+            }
+            continue;
+        }
+        Functor *callback = timer.callback;
+        countCallback();
+        if (timer.repeat) {
+            pushTimer(now + timer.interval, item.index, item.generation);
+            (*callback)();
+        } else {
+            timer.callback = nullptr;
+            timer.used = false;
+            ++timer.generation;
+            freeTimers.put(timers, &EpollTimer::nextFree, item.index);
+            (*callback)();
+            releaseFunctor(callback);
+        }
+    }
+}
+
+void EpollEventLoopCoroutinePrivate::doCallLater()
+{
+    quint64 value;
+    while (::read(eventFd, &value, sizeof(value)) > 0) { }
+    callLaterQueue.clearWakeup();
+    quint32 msecs;
+    Functor *callback;
+    while (callLaterQueue.pop(&msecs, &callback)) {
+        callLater(msecs, callback);
+    }
+}
+
+void EpollEventLoopCoroutinePrivate::callLaterThreadSafe(quint32 msecs, Functor *callback)
+{
+    if (callLaterQueue.push(msecs, callback)) {
+        quint64 value = 1;
+        ssize_t r;
+        do {
+            r = ::write(eventFd, &value, sizeof(value));
+        } while (r < 0 && errno == EINTR);
+    }
+}
+
+// milliseconds to the next timer, 0 if some watchers are pending, or -1 to wait for io only.
+int EpollEventLoopCoroutinePrivate::pollTimeout()
+{
+    if (!pendingIo.isEmpty()) {
+        return 0;
+    } else if (!timerHeap.isEmpty()) {
+        qint64 delta = timerHeap.first().deadline - monotonicMsecs();
+        return static_cast<int>(qBound<qint64>(0, delta, 0x7fffffff));
+    }
+    return -1;
+}
+
+void EpollEventLoopCoroutinePrivate::runOnce(bool block)
+{
+    if (!uselessCallbacks.isEmpty()) {
+        QList<Functor *> callbacks;
+        callbacks.swap(uselessCallbacks);
+        qDeleteAll(callbacks);
+    }
+#ifdef QTNG_HAVE_IO_URING
+    if (ring) {
+        // all operations queued by coroutines since the last iteration go in one syscall.
+        ring->submit();
+    }
+#endif
+    int timeout = block ? pollTimeout() : 0;
+    struct epoll_event events[MaxEventsPerWait];
+    beforePoll();
+    if (timeout != 0 && shouldSpin()) {
+        timeout = 0;
+    }
+    int n = epoll_wait(epollFd, events, MaxEventsPerWait, timeout);
+    afterPoll();
+    if (n < 0 && errno != EINTR) {
+        qtng_warning << "epoll_wait() failed:" << errno;
+    }
+    for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == eventFd) {
+            doCallLater();
+#ifdef QTNG_HAVE_IO_URING
+        } else if (ring && fd == ring->fd) {
+            processCompletions();
+#endif
+        } else {
+            dispatch(fd, events[i].events);
+        }
+    }
+    processPendingIo();
+    processTimers();
+}
+
+void EpollEventLoopCoroutinePrivate::loop()
+{
+    while (!breakOne) {
+        runOnce();
+    }
+    breakOne = false;
+}
+
+int EpollEventLoopCoroutinePrivate::exitCode()
+{
+    return 0;
+}
+
+bool EpollEventLoopCoroutinePrivate::runUntil(BaseCoroutine *coroutine)
+{
+    QPointer<BaseCoroutine> current = BaseCoroutine::current();
+    if (!loopCoroutine.isNull() && loopCoroutine != current) {
+        Deferred<BaseCoroutine *>::Callback here = [current](BaseCoroutine *) {
+            if (!current.isNull()) {
+                current->yield();
+            }
+        };
+        int callbackId = coroutine->finished.addCallback(here);
+        loopCoroutine->yield();
+        coroutine->finished.remove(callbackId);
+    } else {
+        QPointer<BaseCoroutine> old = loopCoroutine;
+        loopCoroutine = current;
+        QPointer<BaseCoroutine> t = loopCoroutine;
+        bool *breakOne = &this->breakOne;
+        Deferred<BaseCoroutine *>::Callback exitOneDepth = [t, breakOne](BaseCoroutine *) {
+            *breakOne = true;
+            if (!t.isNull()) {
+                t->yield();
+            }
+        };
+        int callbackId = coroutine->finished.addCallback(exitOneDepth);
+        loop();
+        loopCoroutine = old;
+        coroutine->finished.remove(callbackId);
+    }
+    return true;
+}
+
+void EpollEventLoopCoroutinePrivate::fillMetrics(EventLoopMetrics *metrics)
+{
+    EventLoopCoroutinePrivate::fillMetrics(metrics);
+    metrics->watchers = ioWatcherCount;
+    metrics->timers = qMax(metrics->timers, 0) + timerHeap.size() - staleTimers;
+    metrics->pendingThreadSafeCalls = callLaterQueue.size();
+}
+
+void EpollEventLoopCoroutinePrivate::yield()
+{
+    Q_Q(EventLoopCoroutine);
+    if (!loopCoroutine.isNull()) {
+        loopCoroutine->yield();
+    } else {
+        q->BaseCoroutine::yield();
+    }
+}
+
+#ifdef QTNG_HAVE_IO_URING
+
+bool EpollEventLoopCoroutinePrivate::setupIoUring()
+{
+    if (ring || epollFd < 0) {
+        return ring;
+    }
+    QScopedPointer<IoUring> r(new IoUring());
+    if (!r->setup(256)) {
+        return false;
+    }
+    // the ring fd is readable while there are completions to reap.
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = r->fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, r->fd, &ev) < 0) {
+        qtng_debug << "can not watch io_uring fd:" << errno;
+        return false;
+    }
+    ring = r.take();
+    return true;
+}
+
+int EpollEventLoopCoroutinePrivate::submitIo(CompletionIo *io, CompletionIo::Operation operation)
+{
+    struct io_uring_sqe *sqe = ring->getSqe();
+    if (!sqe) {
+        ring->submit();
+        sqe = ring->getSqe();
+        if (!sqe) {
+            return -1;
+        }
+    }
+    int fd = static_cast<int>(io->fd);
+    sqe->fd = fd;
+    switch (operation) {
+    case CompletionIo::Poll:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = static_cast<__u32>(io->flags);
+        break;
+    case CompletionIo::Recv:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr = reinterpret_cast<quintptr>(io->data);
+        sqe->len = static_cast<__u32>(io->size);
+        sqe->msg_flags = static_cast<__u32>(io->flags);
+        break;
+    case CompletionIo::Send:
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = reinterpret_cast<quintptr>(io->data);
+        sqe->len = static_cast<__u32>(io->size);
+        sqe->msg_flags = static_cast<__u32>(io->flags);
+        break;
+    case CompletionIo::RecvMsg:
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->addr = reinterpret_cast<quintptr>(io->data);
+        sqe->len = 1;
+        sqe->msg_flags = static_cast<__u32>(io->flags);
+        break;
+    case CompletionIo::SendMsg:
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = reinterpret_cast<quintptr>(io->data);
+        sqe->len = 1;
+        sqe->msg_flags = static_cast<__u32>(io->flags);
+        break;
+    case CompletionIo::Accept:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->accept_flags = static_cast<__u32>(io->flags);
+        break;
+    case CompletionIo::Connect:
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->addr = reinterpret_cast<quintptr>(io->address);
+        sqe->off = static_cast<__u64>(io->addressSize);
+        break;
+    case CompletionIo::TransmitFile:
+        return -1;
+    }
+
+    int index = freePendingIos.take(pendingIos, &EpollPendingIo::next);
+    if (index < 0) {
+        index = pendingIos.size();
+        EpollPendingIo empty;
+        empty.generation = 0;
+        pendingIos.append(empty);
+    }
+    EpollPendingIo &pending = pendingIos[index];
+    pending.coroutine = BaseCoroutine::current();
+    pending.result = 0;
+    pending.fd = fd;
+    pending.used = true;
+    pending.done = false;
+    if (fd >= fds.size()) {
+        fds.resize(fd + 1);
+    }
+    EpollFdState &state = fds[fd];
+    pending.prev = -1;
+    pending.next = state.firstIo;
+    if (pending.next >= 0) {
+        pendingIos[pending.next].prev = index;
+    }
+    state.firstIo = index;
+    // zero user data is used by cancellations, whose completions are ignored.
+    sqe->user_data = (static_cast<quint64>(pending.generation) << 32) | (static_cast<quint32>(index) + 1);
+    return index;
+}
+
+void EpollEventLoopCoroutinePrivate::cancelIo(int index)
+{
+    const EpollPendingIo &pending = pendingIos[index];
+    struct io_uring_sqe *sqe = ring->getSqe();
+    if (!sqe) {
+        ring->submit();
+        sqe = ring->getSqe();
+        if (!sqe) {
+            qtng_warning << "can not cancel io_uring operation.";
+            return;
+        }
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (static_cast<quint64>(pending.generation) << 32) | (static_cast<quint32>(index) + 1);
+    sqe->user_data = 0;
+}
+
+void EpollEventLoopCoroutinePrivate::releasePendingIo(int index)
+{
+    EpollPendingIo &pending = pendingIos[index];
+    if (!pending.done) {
+        // still linked to the fd.
+        if (pending.prev >= 0) {
+            pendingIos[pending.prev].next = pending.next;
+        } else {
+            fds[pending.fd].firstIo = pending.next;
+        }
+        if (pending.next >= 0) {
+            pendingIos[pending.next].prev = pending.prev;
+        }
+    }
+    pending.coroutine.clear();
+    pending.used = false;
+    ++pending.generation;
+    freePendingIos.put(pendingIos, &EpollPendingIo::next, index);
+}
+
+void EpollEventLoopCoroutinePrivate::processCompletions()
+{
+    quint64 userData;
+    qint32 result;
+    while (ring->popCompletion(&userData, &result)) {
+        int index = static_cast<int>(static_cast<quint32>(userData)) - 1;
+        quint32 generation = static_cast<quint32>(userData >> 32);
+        if (index < 0 || index >= pendingIos.size()) {
+            continue;
+        }
+        EpollPendingIo &pending = pendingIos[index];
+        if (!pending.used || pending.done || pending.generation != generation) {
+            continue;
+        }
+        if (pending.prev >= 0) {
+            pendingIos[pending.prev].next = pending.next;
+        } else {
+            fds[pending.fd].firstIo = pending.next;
+        }
+        if (pending.next >= 0) {
+            pendingIos[pending.next].prev = pending.prev;
+        }
+        pending.done = true;
+        pending.result = result;
+        QPointer<BaseCoroutine> coroutine = pending.coroutine;
+        if (coroutine.isNull()) {
+            releasePendingIo(index);
+        } else {
+            coroutine->yield();
+        }
+    }
+}
+
+bool EpollEventLoopCoroutinePrivate::completeIo(CompletionIo *io)
+{
+    Q_Q(EventLoopCoroutine);
+    BaseCoroutine *current = BaseCoroutine::current();
+    if (!ring || io->fd < 0 || io->operation == CompletionIo::TransmitFile || current == q
+        || current == loopCoroutine.data()) {
+        return false;
+    }
+    CompletionIo::Operation operation = io->operation;
+    while (true) {
+        int index = submitIo(io, operation);
+        if (index < 0) {
+            return false;
+        }
+        // the kernel owns the buffers until the completion arrives, so an exception raised into this coroutine must
+        // wait for the cancellation before unwinding.
+        std::exception_ptr interruption;
+        while (!pendingIos[index].done) {
+            try {
+                yield();
+            } catch (...) {
+                if (!interruption) {
+                    interruption = std::current_exception();
+                    cancelIo(index);
+                }
+            }
+        }
+        qint64 result = pendingIos[index].result;
+        releasePendingIo(index);
+        if (interruption) {
+            std::rethrow_exception(interruption);
+        }
+        if (result == -EAGAIN && operation != CompletionIo::Poll) {
+            // the kernel honours O_NONBLOCK on some versions, wait for readiness instead.
+            int events = (operation == CompletionIo::Send || operation == CompletionIo::SendMsg) ? POLLOUT : POLLIN;
+            io->flags = events;
+            operation = CompletionIo::Poll;
+            continue;
+        }
+        if (operation == CompletionIo::Poll) {
+            // the caller retries its syscall.
+            io->hasResult = false;
+        } else {
+            io->result = result;
+            io->hasResult = true;
+        }
+        return true;
+    }
+}
+
+#else
+
+bool EpollEventLoopCoroutinePrivate::setupIoUring()
+{
+    return false;
+}
+
+bool EpollEventLoopCoroutinePrivate::completeIo(CompletionIo *)
+{
+    return false;
+}
+
+#endif
+
+static EpollEventLoopCoroutinePrivate *createEpollPrivate(EventLoopCoroutine *q, bool useIoUring)
+{
+    EpollEventLoopCoroutinePrivate *d = new EpollEventLoopCoroutinePrivate(q);
+    if (useIoUring && !d->setupIoUring()) {
+        qtng_debug << "io_uring is not available, use epoll only.";
+    }
+    return d;
+}
+
+EpollEventLoopCoroutine::EpollEventLoopCoroutine(bool useIoUring)
+    : EventLoopCoroutine(createEpollPrivate(this, useIoUring))
+{
+}
+
+// the qt eventloop runs, while the sockets and timers of coroutines are kept by epoll. qt watches the epoll fd by one
+// QSocketNotifier and the nearest timer by one QTimer, instead of two notifiers per watcher and a QObject timer per
+// callLater() as the QtEventLoopCoroutine does.
+class QtEpollEventLoopCoroutinePrivate : public EpollEventLoopCoroutinePrivate
+{
+public:
+    explicit QtEpollEventLoopCoroutinePrivate(EventLoopCoroutine *q);
+    virtual ~QtEpollEventLoopCoroutinePrivate() override;
+public:
+    virtual void run() override;
+    virtual void startWatcher(int watcherId) override;
+    virtual void triggerIoWatchers(qintptr fd) override;
+    virtual int callLater(quint32 msecs, Functor *callback) override;
+    virtual int callRepeat(quint32 msecs, Functor *callback) override;
+    virtual int exitCode() override;
+    virtual bool runUntil(BaseCoroutine *coroutine) override;
+public:
+    int exec();
+    void poll();
+    void schedule();
+    static QtEpollEventLoopCoroutinePrivate *getPrivateHelper(EventLoopCoroutine *coroutine)
+    {
+        return static_cast<QtEpollEventLoopCoroutinePrivate *>(EventLoopCoroutinePrivate::getPrivateHelper(coroutine));
+    }
+private:
+    QSocketNotifier *notifier;
+    QTimer *timer;
+    qint64 armedDeadline;  // of the QTimer, -1 if it is not armed.
+    int qtExitCode;
+};
+
+QtEpollEventLoopCoroutinePrivate::QtEpollEventLoopCoroutinePrivate(EventLoopCoroutine *q)
+    : EpollEventLoopCoroutinePrivate(q)
+    , notifier(nullptr)
+    , timer(new QTimer())
+    , armedDeadline(-1)
+    , qtExitCode(0)
+{
+    timer->setSingleShot(true);
+    timer->setTimerType(Qt::PreciseTimer);
+    QObject::connect(timer, &QTimer::timeout, [this] { poll(); });
+    if (epollFd >= 0) {
+        notifier = new QSocketNotifier(epollFd, QSocketNotifier::Read);
+        QObject::connect(notifier, &QSocketNotifier::activated, [this] { poll(); });
+    }
+}
+
+QtEpollEventLoopCoroutinePrivate::~QtEpollEventLoopCoroutinePrivate()
+{
+    delete notifier;
+    delete timer;
+}
+
+void QtEpollEventLoopCoroutinePrivate::run()
+{
+    QEventLoop localLoop;
+    qtExitCode = localLoop.exec();
+}
+
+// the epoll fd is readable while it has events, so one non-blocking iteration each time is enough.
+void QtEpollEventLoopCoroutinePrivate::poll()
+{
+    runOnce(false);
+    if (!timer->isActive()) {
+        armedDeadline = -1;
+    }
+    schedule();
+}
+
+// the QTimer is restarted only if the nearest deadline comes earlier, an early wakeup just polls once more.
+void QtEpollEventLoopCoroutinePrivate::schedule()
+{
+    const int timeout = pollTimeout();
+    if (timeout < 0) {
+        return;
+    }
+    const qint64 deadline = monotonicMsecs() + timeout;
+    if (armedDeadline >= 0 && armedDeadline <= deadline) {
+        return;
+    }
+    armedDeadline = deadline;
+    timer->start(timeout);
+}
+
+void QtEpollEventLoopCoroutinePrivate::startWatcher(int watcherId)
+{
+    EpollEventLoopCoroutinePrivate::startWatcher(watcherId);
+    if (!pendingIo.isEmpty()) {
+        schedule();
+    }
+}
+
+void QtEpollEventLoopCoroutinePrivate::triggerIoWatchers(qintptr fd)
+{
+    EpollEventLoopCoroutinePrivate::triggerIoWatchers(fd);
+    if (!pendingIo.isEmpty()) {
+        schedule();
+    }
+}
+
+int QtEpollEventLoopCoroutinePrivate::callLater(quint32 msecs, Functor *callback)
+{
+    int callbackId = EpollEventLoopCoroutinePrivate::callLater(msecs, callback);
+    schedule();
+    return callbackId;
+}
+
+int QtEpollEventLoopCoroutinePrivate::callRepeat(quint32 msecs, Functor *callback)
+{
+    int callbackId = EpollEventLoopCoroutinePrivate::callRepeat(msecs, callback);
+    schedule();
+    return callbackId;
+}
+
+int QtEpollEventLoopCoroutinePrivate::exitCode()
+{
+    return qtExitCode;
+}
+
+bool QtEpollEventLoopCoroutinePrivate::runUntil(BaseCoroutine *coroutine)
+{
+    QPointer<BaseCoroutine> current = BaseCoroutine::current();
+    if (!loopCoroutine.isNull() && loopCoroutine != current) {
+        Deferred<BaseCoroutine *>::Callback here = [current](BaseCoroutine *) {
+            if (!current.isNull()) {
+                current->yield();
+            }
+        };
+        int callbackId = coroutine->finished.addCallback(here);
+        loopCoroutine->yield();
+        coroutine->finished.remove(callbackId);
+    } else {
+        QPointer<BaseCoroutine> old = loopCoroutine;
+        loopCoroutine = current;
+        QSharedPointer<QEventLoop> sub(new QEventLoop());
+        QPointer<BaseCoroutine> t = loopCoroutine;
+        Deferred<BaseCoroutine *>::Callback shutdown = [t, sub](BaseCoroutine *) {
+            sub->exit();
+            if (!t.isNull()) {
+                t->yield();
+            }
+        };
+        int callbackId = coroutine->finished.addCallback(shutdown);
+        sub->exec();
+        coroutine->finished.remove(callbackId);
+        loopCoroutine = old;
+    }
+    return true;
+}
+
+QtEpollEventLoopCoroutine::QtEpollEventLoopCoroutine()
+    : EventLoopCoroutine(new QtEpollEventLoopCoroutinePrivate(this))
+{
+}
+
+int QtEpollEventLoopCoroutinePrivate::exec()
+{
+    loopCoroutine = BaseCoroutine::current();
+    int result = QCoreApplication::instance()->exec();
+    QCoreApplication::instance()->processEvents();
+    loopCoroutine.clear();
+    return result;
+}
+
+int startQtEpollLoop(EventLoopCoroutine *eventLoop)
+{
+    return QtEpollEventLoopCoroutinePrivate::getPrivateHelper(eventLoop)->exec();
+}
+
+QTNETWORKNG_NAMESPACE_END
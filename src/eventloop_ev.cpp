@@ -1,8 +1,6 @@
-#include <QtCore/qmap.h>
-#include <QtCore/qmutex.h>
-#include <QtCore/qqueue.h>
 #include <QtCore/qpointer.h>
 #include <QtCore/qdebug.h>
+#include <QtCore/qqueue.h>
 #include <stddef.h>
 #include "ev/ev.h"
 #include "../include/private/eventloop_p.h"
@@ -18,6 +16,8 @@ extern "C" void qtng__ev_io_callback(struct ev_loop *, ev_io *w, int);
 extern "C" void qtng__ev_timer_callback(struct ev_loop *, ev_timer *w, int);
 extern "C" void qtng__ev_async_callback(struct ev_loop *loop, ev_async *w, int revents);
 extern "C" void qtng__ev_prepare_callback(struct ev_loop *loop, ev_prepare *w, int);
+extern "C" void qtng__ev_check_callback(struct ev_loop *loop, ev_check *w, int);
+extern "C" void qtng__ev_spin_callback(struct ev_loop *loop, ev_timer *w, int);
 
 struct EvWatcher
 {
@@ -44,8 +44,25 @@ struct TimerWatcher : public EvWatcher
     int watcherId;
 };
 
+// the calls of zero delay are queued instead of timers, they are run after the poll in the order of calls.
+struct PendingCallWatcher : public EvWatcher
+{
+    virtual ~PendingCallWatcher();
+
+    Functor *callback;
+};
+
+// a few callbacks wake the coroutines which call callLater(0) again, one iteration runs this many calls at most so
+// the io watchers are not starved.
+const int MaxPendingCallsPerIteration = 1024;
+
 EvWatcher::~EvWatcher() { }
 
+PendingCallWatcher::~PendingCallWatcher()
+{
+    releaseFunctor(callback);
+}
+
 IoWatcher::IoWatcher(EventLoopCoroutine::EventType event, qintptr fd)
 {
     int flags = 0;
@@ -58,7 +75,7 @@ IoWatcher::IoWatcher(EventLoopCoroutine::EventType event, qintptr fd)
 
 IoWatcher::~IoWatcher()
 {
-    delete callback;
+    releaseFunctor(callback);
 }
 
 TimerWatcher::TimerWatcher(quint32 msecs, bool repeat)
@@ -74,7 +91,7 @@ TimerWatcher::TimerWatcher(quint32 msecs, bool repeat)
 
 TimerWatcher::~TimerWatcher()
 {
-    delete callback;
+    releaseFunctor(callback);
 }
 
 class EvEventLoopCoroutinePrivate : public EventLoopCoroutinePrivate
@@ -96,17 +113,20 @@ public:
     virtual int exitCode() override;
     virtual bool runUntil(BaseCoroutine *coroutine) override;
     virtual void yield() override;
+    virtual void fillMetrics(EventLoopMetrics *metrics) override;
     void doCallLater();
+    void runPendingCalls();
 public:
     struct ev_loop *loop;
-    QMap<int, EvWatcher *> watchers;
+    WatcherTable<EvWatcher> watchers;
     QList<EvWatcher *> uselessWatchers;
-    QMutex mqMutex;
-    QQueue<QPair<quint32, Functor *>> callLaterQueue;
+    CallLaterQueue callLaterQueue;
+    QQueue<int> pendingCalls;  // the ids of PendingCallWatcher, cancelled ones are skipped.
     ev_async asyncContext;
     ev_prepare prepareContext;
+    ev_check checkContext;
+    ev_timer spinContext;  // an expired timer makes ev_run() poll without blocking.
     QPointer<BaseCoroutine> loopCoroutine;
-    int nextWatcherId;
     QAtomicInteger<bool> exitingFlag;
     Q_DECLARE_PUBLIC(EventLoopCoroutine)
 };
@@ -114,7 +134,6 @@ public:
 EvEventLoopCoroutinePrivate::EvEventLoopCoroutinePrivate(EventLoopCoroutine *parent)
     : EventLoopCoroutinePrivate(parent)
     , loop(nullptr)
-    , nextWatcherId(1)
 {
     unsigned int flags = EVFLAG_NOENV;
     loop = ev_loop_new(flags);
@@ -124,34 +143,34 @@ EvEventLoopCoroutinePrivate::EvEventLoopCoroutinePrivate(EventLoopCoroutine *par
     ev_prepare_init(&prepareContext, qtng__ev_prepare_callback);
     prepareContext.data = this;
     ev_prepare_start(loop, &prepareContext);
+    ev_check_init(&checkContext, qtng__ev_check_callback);
+    checkContext.data = this;
+    ev_check_start(loop, &checkContext);
+    ev_timer_init(&spinContext, qtng__ev_spin_callback, 0.0, 0.0);
+    ev_set_userdata(loop, this);
 }
 
 EvEventLoopCoroutinePrivate::~EvEventLoopCoroutinePrivate()
 {
-    mqMutex.lock();
-    while (!callLaterQueue.isEmpty()) {
-        QPair<quint32, Functor *> item = callLaterQueue.dequeue();
-        delete item.second;
-    }
-    mqMutex.unlock();
+    ev_timer_stop(loop, &spinContext);
+    ev_check_stop(loop, &checkContext);
     ev_prepare_stop(loop, &prepareContext);
     ev_async_stop(loop, &asyncContext);
     ev_break(loop, EVBREAK_ONE);
     ev_loop_destroy(loop);  // FIXME run() function may not exit, but this situation is rare.
-    QMapIterator<int, EvWatcher *> itor(watchers);
-    while (itor.hasNext()) {
-        itor.next();
-        delete itor.value();
+    for (EvWatcher *watcher : watchers.values()) {
+        delete watcher;
     }
     for (EvWatcher *watcher : uselessWatchers) {
         delete watcher;
     }
 }
 
-extern "C" void qtng__ev_io_callback(struct ev_loop *, ev_io *w, int)
+extern "C" void qtng__ev_io_callback(struct ev_loop *loop, ev_io *w, int)
 {
     IoWatcher *watcher = static_cast<IoWatcher *>(w->data);
     if (Q_LIKELY(watcher)) {
+        static_cast<EvEventLoopCoroutinePrivate *>(ev_userdata(loop))->countCallback();
         (*watcher->callback)();
     }
 }
@@ -166,8 +185,9 @@ extern "C" void qtng__ev_timer_callback(struct ev_loop *loop, ev_timer *w, int)
     EvEventLoopCoroutinePrivate *parent = watcher->parent;
     if (qFuzzyIsNull(w->repeat)) {  // singleshot
         ev_timer_stop(loop, w);
-        parent->watchers.remove(watcher->watcherId);
+        parent->watchers.take(watcher->watcherId);
     }
+    parent->countCallback();
     (*watcher->callback)();
     if (qFuzzyIsNull(w->repeat)) {
         delete watcher;
@@ -190,6 +210,22 @@ extern "C" void qtng__ev_prepare_callback(struct ev_loop *, ev_prepare *w, int)
         EvWatcher *watcher = p->uselessWatchers.takeFirst();
         delete watcher;
     }
+    p->beforePoll();
+    if ((p->shouldSpin() || !p->pendingCalls.isEmpty()) && !ev_is_active(&p->spinContext)) {
+        ev_timer_set(&p->spinContext, 0.0, 0.0);
+        ev_timer_start(p->loop, &p->spinContext);
+    }
+}
+
+extern "C" void qtng__ev_check_callback(struct ev_loop *, ev_check *w, int)
+{
+    EvEventLoopCoroutinePrivate *p = static_cast<EvEventLoopCoroutinePrivate *>(w->data);
+    p->afterPoll();
+    p->runPendingCalls();
+}
+
+extern "C" void qtng__ev_spin_callback(struct ev_loop *, ev_timer *, int)
+{
 }
 
 void EvEventLoopCoroutinePrivate::run()
@@ -206,8 +242,11 @@ int EvEventLoopCoroutinePrivate::createWatcher(EventLoopCoroutine::EventType eve
     IoWatcher *watcher = new IoWatcher(event, fd);
     watcher->callback = callback;
     watcher->w.data = watcher;
-    watchers.insert(nextWatcherId, watcher);
-    return nextWatcherId++;
+    const int watcherId = watchers.insert(watcher, fd);
+    if (!watcherId) {
+        delete watcher;
+    }
+    return watcherId;
 }
 
 void EvEventLoopCoroutinePrivate::startWatcher(int watcherId)
@@ -232,6 +271,9 @@ void EvEventLoopCoroutinePrivate::removeWatcher(int watcherId)
     if (watcher) {
         ev_io_stop(loop, &watcher->w);
         watcher->w.data = nullptr;
+        if (watcher->callback->isBorrowed()) {
+            watcher->callback = nullptr;  // its owner may destroy it before the watcher is deleted.
+        }
         uselessWatchers.append(watcher);
     }
 }
@@ -256,41 +298,68 @@ struct TriggerIoWatchersFunctor : public Functor
 
 void EvEventLoopCoroutinePrivate::triggerIoWatchers(qintptr fd)
 {
-    for (QMap<int, EvWatcher *>::const_iterator itor = watchers.constBegin(); itor != watchers.constEnd(); ++itor) {
-        IoWatcher *watcher = dynamic_cast<IoWatcher *>(itor.value());
-        if (watcher && watcher->w.fd == fd) {
-            ev_io_stop(loop, &watcher->w);
-            callLater(0, new TriggerIoWatchersFunctor(itor.key(), this));
-        }
+    for (int watcherId : watchers.idsOfFd(fd)) {
+        IoWatcher *watcher = static_cast<IoWatcher *>(watchers.value(watcherId));
+        ev_io_stop(loop, &watcher->w);
+        callLater(0, new TriggerIoWatchersFunctor(watcherId, this));
     }
 }
 
 int EvEventLoopCoroutinePrivate::callLater(quint32 msecs, Functor *callback)
 {
+    if (msecs == 0) {
+        PendingCallWatcher *watcher = new PendingCallWatcher();
+        watcher->callback = callback;
+        const int watcherId = watchers.insert(watcher);
+        if (!watcherId) {
+            delete watcher;
+            return 0;
+        }
+        pendingCalls.enqueue(watcherId);
+        return watcherId;
+    }
     TimerWatcher *watcher = new TimerWatcher(msecs, false);
     watcher->callback = callback;
     watcher->parent = this;
-    watcher->watcherId = nextWatcherId;
+    watcher->watcherId = watchers.insert(watcher);
+    if (!watcher->watcherId) {
+        delete watcher;
+        return 0;
+    }
     watcher->w.data = watcher;
     ev_timer_start(loop, &watcher->w);
-    watchers.insert(nextWatcherId, watcher);
-    return nextWatcherId++;
+    return watcher->watcherId;
+}
+
+void EvEventLoopCoroutinePrivate::runPendingCalls()
+{
+    // the calls added by these callbacks run in the next iteration. the callbacks may run a nested loop which takes
+    // some of the queue too, so the queue is checked every time.
+    int n = qMin(pendingCalls.size(), MaxPendingCallsPerIteration);
+    while (n-- > 0 && !pendingCalls.isEmpty()) {
+        PendingCallWatcher *watcher = dynamic_cast<PendingCallWatcher *>(watchers.take(pendingCalls.dequeue()));
+        if (!watcher) {
+            continue;  // cancelled.
+        }
+        countCallback();
+        (*watcher->callback)();
+        delete watcher;
+    }
 }
 
 void EvEventLoopCoroutinePrivate::doCallLater()
 {
-    QMutexLocker locker(&mqMutex);
-    while (!callLaterQueue.isEmpty()) {
-        QPair<quint32, Functor *> item = callLaterQueue.dequeue();
-        callLater(item.first, item.second);
+    callLaterQueue.clearWakeup();
+    quint32 msecs;
+    Functor *callback;
+    while (callLaterQueue.pop(&msecs, &callback)) {
+        callLater(msecs, callback);
     }
 }
 
 void EvEventLoopCoroutinePrivate::callLaterThreadSafe(quint32 msecs, Functor *callback)
 {
-    QMutexLocker locker(&mqMutex);
-    callLaterQueue.enqueue(qMakePair(msecs, callback));
-    if (!ev_async_pending(&asyncContext)) {
+    if (callLaterQueue.push(msecs, callback)) {
         ev_async_send(loop, &asyncContext);
     }
 }
@@ -300,19 +369,31 @@ int EvEventLoopCoroutinePrivate::callRepeat(quint32 msecs, Functor *callback)
     TimerWatcher *watcher = new TimerWatcher(msecs, true);
     watcher->callback = callback;
     watcher->parent = this;
-    watcher->watcherId = 0;
+    watcher->watcherId = watchers.insert(watcher);
+    if (!watcher->watcherId) {
+        delete watcher;
+        return 0;
+    }
+    watcher->w.data = watcher;
     ev_timer_start(loop, &watcher->w);
-    watchers.insert(nextWatcherId, watcher);
-    return nextWatcherId++;
+    return watcher->watcherId;
 }
 
 void EvEventLoopCoroutinePrivate::cancelCall(int callbackId)
 {
-    TimerWatcher *watcher = dynamic_cast<TimerWatcher *>(watchers.take(callbackId));
-    if (watcher) {
+    EvWatcher *taken = watchers.take(callbackId);
+    if (TimerWatcher *watcher = dynamic_cast<TimerWatcher *>(taken)) {
         ev_timer_stop(loop, &watcher->w);
         watcher->w.data = nullptr;
+        if (watcher->callback->isBorrowed()) {
+            watcher->callback = nullptr;  // its owner may destroy it before the watcher is deleted.
+        }
         uselessWatchers.append(watcher);
+    } else if (PendingCallWatcher *watcher = dynamic_cast<PendingCallWatcher *>(taken)) {
+        if (watcher->callback->isBorrowed()) {
+            watcher->callback = nullptr;
+        }
+        uselessWatchers.append(watcher);  // its id is skipped by runPendingCalls().
     }
 }
 
@@ -362,6 +443,15 @@ void EvEventLoopCoroutinePrivate::yield()
     }
 }
 
+// io watchers, timers and the calls of zero delay share the watcher table in this backend, they are all counted as
+// watchers.
+void EvEventLoopCoroutinePrivate::fillMetrics(EventLoopMetrics *metrics)
+{
+    EventLoopCoroutinePrivate::fillMetrics(metrics);
+    metrics->watchers = watchers.size();
+    metrics->pendingThreadSafeCalls = callLaterQueue.size();
+}
+
 EvEventLoopCoroutine::EvEventLoopCoroutine()
     : EventLoopCoroutine(new EvEventLoopCoroutinePrivate(this))
 {
@@ -0,0 +1,1141 @@
+#include <QtCore/qvector.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qpointer.h>
+#include <QtCore/qelapsedtimer.h>
+#include <algorithm>
+#include <exception>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <windows.h>
+#include <winternl.h>
+#include "../include/private/eventloop_p.h"
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.eventloop_iocp");
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// readiness of sockets is polled through the AFD driver, the same way as wepoll and libuv do, so the watchers and the
+// overlapped socket operations share one completion port.
+#define QTNG_IOCTL_AFD_POLL 0x00012024
+#define QTNG_AFD_POLL_RECEIVE 0x0001
+#define QTNG_AFD_POLL_RECEIVE_EXPEDITED 0x0002
+#define QTNG_AFD_POLL_SEND 0x0004
+#define QTNG_AFD_POLL_DISCONNECT 0x0008
+#define QTNG_AFD_POLL_ABORT 0x0010
+#define QTNG_AFD_POLL_LOCAL_CLOSE 0x0020
+#define QTNG_AFD_POLL_ACCEPT 0x0080
+#define QTNG_AFD_POLL_CONNECT_FAIL 0x0100
+
+static const LONG QTNG_STATUS_CANCELLED = static_cast<LONG>(0xC0000120L);
+static const LONG QTNG_STATUS_BUFFER_OVERFLOW = static_cast<LONG>(0x80000005L);
+static const LONG QTNG_STATUS_CONNECTION_RESET = static_cast<LONG>(0xC000020DL);
+static const LONG QTNG_STATUS_CONNECTION_ABORTED = static_cast<LONG>(0xC0000241L);
+static const LONG QTNG_STATUS_CONNECTION_REFUSED = static_cast<LONG>(0xC0000236L);
+static const LONG QTNG_STATUS_LOCAL_DISCONNECT = static_cast<LONG>(0xC000013BL);
+static const LONG QTNG_STATUS_REMOTE_DISCONNECT = static_cast<LONG>(0xC000013CL);
+static const LONG QTNG_STATUS_NETWORK_UNREACHABLE = static_cast<LONG>(0xC000023CL);
+static const LONG QTNG_STATUS_HOST_UNREACHABLE = static_cast<LONG>(0xC000023DL);
+static const LONG QTNG_STATUS_IO_TIMEOUT = static_cast<LONG>(0xC00000B5L);
+
+struct AfdPollHandleInfo
+{
+    HANDLE handle;
+    ULONG events;
+    LONG status;
+};
+
+struct AfdPollInfo
+{
+    LARGE_INTEGER timeout;
+    ULONG numberOfHandles;
+    ULONG exclusive;
+    AfdPollHandleInfo handles[1];
+};
+
+typedef LONG(NTAPI *NtCreateFileFunction)(PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES, PIO_STATUS_BLOCK, PLARGE_INTEGER,
+                                          ULONG, ULONG, ULONG, ULONG, PVOID, ULONG);
+typedef LONG(NTAPI *NtDeviceIoControlFileFunction)(HANDLE, HANDLE, PVOID, PVOID, PIO_STATUS_BLOCK, ULONG, PVOID, ULONG,
+                                                   PVOID, ULONG);
+typedef LONG(NTAPI *NtCancelIoFileExFunction)(HANDLE, PIO_STATUS_BLOCK, PIO_STATUS_BLOCK);
+typedef ULONG(WINAPI *RtlNtStatusToDosErrorFunction)(LONG);
+
+struct NtFunctions
+{
+    NtFunctions();
+    NtCreateFileFunction createFile;
+    NtDeviceIoControlFileFunction deviceIoControlFile;
+    NtCancelIoFileExFunction cancelIoFileEx;
+    RtlNtStatusToDosErrorFunction statusToDosError;
+    LPFN_ACCEPTEX acceptEx;
+    LPFN_CONNECTEX connectEx;
+    LPFN_TRANSMITFILE transmitFile;
+    QAtomicInt extensionsLoaded;
+    void loadExtensions(SOCKET s);
+    HANDLE openAfd();
+    bool isValid() const { return createFile && deviceIoControlFile && cancelIoFileEx && statusToDosError; }
+};
+
+NtFunctions::NtFunctions()
+    : createFile(nullptr)
+    , deviceIoControlFile(nullptr)
+    , cancelIoFileEx(nullptr)
+    , statusToDosError(nullptr)
+    , acceptEx(nullptr)
+    , connectEx(nullptr)
+    , transmitFile(nullptr)
+{
+    HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+    if (ntdll) {
+        createFile = reinterpret_cast<NtCreateFileFunction>(GetProcAddress(ntdll, "NtCreateFile"));
+        deviceIoControlFile =
+                reinterpret_cast<NtDeviceIoControlFileFunction>(GetProcAddress(ntdll, "NtDeviceIoControlFile"));
+        cancelIoFileEx = reinterpret_cast<NtCancelIoFileExFunction>(GetProcAddress(ntdll, "NtCancelIoFileEx"));
+        statusToDosError =
+                reinterpret_cast<RtlNtStatusToDosErrorFunction>(GetProcAddress(ntdll, "RtlNtStatusToDosError"));
+    }
+}
+
+// the extension functions are the same for all tcp providers, load them from the first socket used.
+void NtFunctions::loadExtensions(SOCKET s)
+{
+    if (extensionsLoaded.loadAcquire()) {
+        return;
+    }
+    GUID acceptExId = WSAID_ACCEPTEX;
+    GUID connectExId = WSAID_CONNECTEX;
+    LPFN_ACCEPTEX acceptExFunction = nullptr;
+    LPFN_CONNECTEX connectExFunction = nullptr;
+    DWORD bytes = 0;
+    if (WSAIoctl(s, SIO_GET_EXTENSION_FUNCTION_POINTER, &acceptExId, sizeof(acceptExId), &acceptExFunction,
+                 sizeof(acceptExFunction), &bytes, nullptr, nullptr)
+        == SOCKET_ERROR) {
+        return;
+    }
+    if (WSAIoctl(s, SIO_GET_EXTENSION_FUNCTION_POINTER, &connectExId, sizeof(connectExId), &connectExFunction,
+                 sizeof(connectExFunction), &bytes, nullptr, nullptr)
+        == SOCKET_ERROR) {
+        return;
+    }
+    // TransmitFile() is optional, sendfile() copies in user space without it.
+    GUID transmitFileId = WSAID_TRANSMITFILE;
+    LPFN_TRANSMITFILE transmitFileFunction = nullptr;
+    if (WSAIoctl(s, SIO_GET_EXTENSION_FUNCTION_POINTER, &transmitFileId, sizeof(transmitFileId),
+                 &transmitFileFunction, sizeof(transmitFileFunction), &bytes, nullptr, nullptr)
+        == SOCKET_ERROR) {
+        transmitFileFunction = nullptr;
+    }
+    acceptEx = acceptExFunction;
+    connectEx = connectExFunction;
+    transmitFile = transmitFileFunction;
+    extensionsLoaded.storeRelease(1);
+}
+
+HANDLE NtFunctions::openAfd()
+{
+    if (!isValid()) {
+        return INVALID_HANDLE_VALUE;
+    }
+    wchar_t deviceName[] = L"\\Device\\Afd\\QtNetworkNg";
+    UNICODE_STRING name;
+    name.Length = static_cast<USHORT>(sizeof(deviceName) - sizeof(wchar_t));
+    name.MaximumLength = static_cast<USHORT>(sizeof(deviceName));
+    name.Buffer = deviceName;
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, &name, 0, nullptr, nullptr);
+    IO_STATUS_BLOCK iosb;
+    HANDLE h = INVALID_HANDLE_VALUE;
+    LONG status = createFile(&h, SYNCHRONIZE, &attributes, &iosb, nullptr, 0, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             1 /* FILE_OPEN */, 0, nullptr, 0);
+    if (status != 0) {
+        qtng_debug << "can not open afd device:" << statusToDosError(status);
+        return INVALID_HANDLE_VALUE;
+    }
+    return h;
+}
+
+Q_GLOBAL_STATIC(NtFunctions, ntFunctions)
+
+static const ULONG_PTR WakeupKey = 1;
+static const ULONG MaxEntriesPerWait = 128;
+
+// the kernel owns the OVERLAPPED until the completion arrives, so operations are allocated one by one and recycled.
+struct IocpOperation
+{
+    enum Kind {
+        AfdPoll,
+        SocketIo,
+    };
+    OVERLAPPED overlapped;
+    Kind kind;
+    qintptr fd;
+    IocpOperation *prev;  // in flight operations of the same fd.
+    IocpOperation *next;
+    // AfdPoll
+    AfdPollInfo pollInfo;
+    int watcherId;
+    // SocketIo
+    QPointer<BaseCoroutine> coroutine;
+    CompletionIo::Operation operation;
+    qint64 result;
+    bool done;
+    SOCKET acceptSocket;
+    INT addressSize;
+    char acceptBuffer[2 * (sizeof(SOCKADDR_STORAGE) + 16)];
+};
+
+struct IocpIoWatcher
+{
+    Functor *callback;
+    IocpOperation *poll;
+    qintptr fd;
+    int prev;
+    int next;  // the next watcher of the same fd, or the next free slot.
+    quint32 generation;
+    quint8 events;
+    bool used;
+    bool active;
+};
+
+struct IocpFdState
+{
+    IocpFdState()
+        : baseHandle(INVALID_HANDLE_VALUE)
+        , firstWatcher(-1)
+        , firstOperation(nullptr)
+        , associated(false)
+        , associateFailed(false)
+    {
+    }
+    HANDLE baseHandle;
+    int firstWatcher;
+    IocpOperation *firstOperation;
+    bool associated;
+    bool associateFailed;
+};
+
+struct IocpTimer
+{
+    Functor *callback;
+    quint32 interval;
+    quint32 generation;
+    int nextFree;
+    bool used;
+    bool repeat;
+};
+
+struct IocpTimerItem
+{
+    qint64 deadline;
+    quint64 sequence;
+    int index;
+    quint32 generation;
+};
+
+static inline bool operator>(const IocpTimerItem &a, const IocpTimerItem &b)
+{
+    return a.deadline > b.deadline || (a.deadline == b.deadline && a.sequence > b.sequence);
+}
+
+class IocpEventLoopCoroutinePrivate : public EventLoopCoroutinePrivate
+{
+public:
+    explicit IocpEventLoopCoroutinePrivate(EventLoopCoroutine *q);
+    virtual ~IocpEventLoopCoroutinePrivate() override;
+public:
+    virtual void run() override;
+    virtual int createWatcher(EventLoopCoroutine::EventType event, qintptr fd, Functor *callback) override;
+    virtual void startWatcher(int watcherId) override;
+    virtual void stopWatcher(int watcherId) override;
+    virtual void removeWatcher(int watcherId) override;
+    virtual void triggerIoWatchers(qintptr fd) override;
+    virtual int callLater(quint32 msecs, Functor *callback) override;
+    virtual void callLaterThreadSafe(quint32 msecs, Functor *callback) override;
+    virtual int callRepeat(quint32 msecs, Functor *callback) override;
+    virtual void cancelCall(int callbackId) override;
+    virtual int exitCode() override;
+    virtual bool runUntil(BaseCoroutine *coroutine) override;
+    virtual void yield() override;
+    virtual bool completeIo(CompletionIo *io) override;
+    virtual void fillMetrics(EventLoopMetrics *metrics) override;
+private:
+    IocpIoWatcher *findIoWatcher(int watcherId);
+    IocpTimer *findTimer(int callbackId);
+    IocpFdState &fdState(qintptr fd);
+    IocpOperation *allocateOperation(IocpOperation::Kind kind, qintptr fd);
+    void releaseOperation(IocpOperation *op);
+    void unlinkOperation(IocpOperation *op);
+    void submitPoll(IocpIoWatcher *watcher, int watcherId);
+    bool startSocketIo(IocpOperation *op, CompletionIo *io, IocpFdState &state);
+    void handleCompletion(IocpOperation *op, DWORD bytes);
+    void handlePollCompletion(IocpOperation *op);
+    void handleSocketIoCompletion(IocpOperation *op, DWORD bytes);
+    int addTimer(quint32 msecs, Functor *callback, bool repeat);
+    void pushTimer(qint64 deadline, int index, quint32 generation);
+    void compactTimers();
+    void processPendingIo();
+    void processTimers();
+    void doCallLater();
+    void runOnce();
+    void loop();
+    int errorFromStatus(LONG status);
+private:
+    QVector<IocpIoWatcher> ioWatchers;
+    QHash<qintptr, IocpFdState> fds;
+    QVector<int> pendingIo;
+    QVector<IocpOperation *> freeOperations;
+    QVector<IocpTimer> timers;
+    QVector<IocpTimerItem> timerHeap;
+    QList<Functor *> uselessCallbacks;
+    CallLaterQueue callLaterQueue;
+    QPointer<BaseCoroutine> loopCoroutine;
+    QElapsedTimer clock;
+    quint64 nextSequence;
+    HANDLE iocp;
+    HANDLE afd;
+    int inflight;
+    FreeSlotQueue freeIoWatchers;
+    FreeSlotQueue freeTimers;
+    int staleTimers;
+    bool breakOne;
+    Q_DECLARE_PUBLIC(EventLoopCoroutine)
+};
+
+IocpEventLoopCoroutinePrivate::IocpEventLoopCoroutinePrivate(EventLoopCoroutine *q)
+    : EventLoopCoroutinePrivate(q)
+    , nextSequence(0)
+    , iocp(nullptr)
+    , afd(INVALID_HANDLE_VALUE)
+    , inflight(0)
+    , staleTimers(0)
+    , breakOne(false)
+{
+    clock.start();
+    NtFunctions *nt = ntFunctions();
+    if (!nt->isValid()) {
+        return;
+    }
+    iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (!iocp) {
+        qtng_warning << "can not create io completion port:" << GetLastError();
+        return;
+    }
+    HANDLE h = nt->openAfd();
+    if (h == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    if (!CreateIoCompletionPort(h, iocp, 0, 0)) {
+        qtng_warning << "can not associate afd device:" << GetLastError();
+        CloseHandle(h);
+        return;
+    }
+    SetFileCompletionNotificationModes(h, FILE_SKIP_SET_EVENT_ON_HANDLE);
+    afd = h;
+}
+
+IocpEventLoopCoroutinePrivate::~IocpEventLoopCoroutinePrivate()
+{
+    for (const IocpIoWatcher &watcher : ioWatchers) {
+        if (watcher.used) {
+            releaseFunctor(watcher.callback);
+        }
+    }
+    for (const IocpTimer &timer : timers) {
+        if (timer.used) {
+            releaseFunctor(timer.callback);
+        }
+    }
+    qDeleteAll(uselessCallbacks);
+    // operations still in flight are leaked on purpose, the kernel may write to them until the handles are closed.
+    qDeleteAll(freeOperations);
+    if (afd != INVALID_HANDLE_VALUE) {
+        CloseHandle(afd);
+    }
+    if (iocp) {
+        CloseHandle(iocp);
+    }
+}
+
+IocpIoWatcher *IocpEventLoopCoroutinePrivate::findIoWatcher(int watcherId)
+{
+    int index = indexOfWatcherId(watcherId);
+    if (index < 0 || index >= ioWatchers.size()) {
+        return nullptr;
+    }
+    IocpIoWatcher &watcher = ioWatchers[index];
+    if (!watcher.used || (watcher.generation & WatcherIdGenerationMask) != generationOfWatcherId(watcherId)) {
+        return nullptr;
+    }
+    return &watcher;
+}
+
+IocpTimer *IocpEventLoopCoroutinePrivate::findTimer(int callbackId)
+{
+    int index = indexOfWatcherId(callbackId);
+    if (index < 0 || index >= timers.size()) {
+        return nullptr;
+    }
+    IocpTimer &timer = timers[index];
+    if (!timer.used || (timer.generation & WatcherIdGenerationMask) != generationOfWatcherId(callbackId)) {
+        return nullptr;
+    }
+    return &timer;
+}
+
+IocpFdState &IocpEventLoopCoroutinePrivate::fdState(qintptr fd)
+{
+    QHash<qintptr, IocpFdState>::iterator itor = fds.find(fd);
+    if (itor == fds.end()) {
+        itor = fds.insert(fd, IocpFdState());
+    }
+    return itor.value();
+}
+
+IocpOperation *IocpEventLoopCoroutinePrivate::allocateOperation(IocpOperation::Kind kind, qintptr fd)
+{
+    IocpOperation *op;
+    if (!freeOperations.isEmpty()) {
+        op = freeOperations.takeLast();
+    } else {
+        op = new IocpOperation();
+    }
+    memset(&op->overlapped, 0, sizeof(op->overlapped));
+    op->kind = kind;
+    op->fd = fd;
+    op->prev = nullptr;
+    op->next = nullptr;
+    op->watcherId = 0;
+    op->coroutine.clear();
+    op->result = 0;
+    op->done = false;
+    op->acceptSocket = INVALID_SOCKET;
+    op->addressSize = 0;
+    return op;
+}
+
+void IocpEventLoopCoroutinePrivate::unlinkOperation(IocpOperation *op)
+{
+    if (op->prev) {
+        op->prev->next = op->next;
+    } else {
+        QHash<qintptr, IocpFdState>::iterator itor = fds.find(op->fd);
+        if (itor != fds.end() && itor->firstOperation == op) {
+            itor->firstOperation = op->next;
+        }
+    }
+    if (op->next) {
+        op->next->prev = op->prev;
+    }
+    op->prev = op->next = nullptr;
+}
+
+void IocpEventLoopCoroutinePrivate::releaseOperation(IocpOperation *op)
+{
+    op->coroutine.clear();
+    if (freeOperations.size() < 1024) {
+        freeOperations.append(op);
+    } else {
+        delete op;
+    }
+}
+
+void IocpEventLoopCoroutinePrivate::run()
+{
+    try {
+        loop();
+    } catch (...) {
+        qtng_warning << "iocp eventloop got exception.";
+    }
+}
+
+int IocpEventLoopCoroutinePrivate::createWatcher(EventLoopCoroutine::EventType event, qintptr fd, Functor *callback)
+{
+    int index = freeIoWatchers.take(ioWatchers, &IocpIoWatcher::next);
+    if (index < 0) {
+        if (!hasFreeWatcherIndex(ioWatchers.size())) {
+            releaseFunctor(callback);
+            return 0;
+        }
+        index = ioWatchers.size();
+        IocpIoWatcher empty;
+        empty.generation = 0;
+        ioWatchers.append(empty);
+    }
+    IocpIoWatcher &watcher = ioWatchers[index];
+    watcher.callback = callback;
+    watcher.poll = nullptr;
+    watcher.fd = fd;
+    watcher.prev = -1;
+    watcher.events = static_cast<quint8>(event);
+    watcher.used = true;
+    watcher.active = false;
+    IocpFdState &state = fdState(fd);
+    watcher.next = state.firstWatcher;
+    if (watcher.next >= 0) {
+        ioWatchers[watcher.next].prev = index;
+    }
+    state.firstWatcher = index;
+    return makeWatcherId(index, watcher.generation);
+}
+
+void IocpEventLoopCoroutinePrivate::submitPoll(IocpIoWatcher *watcher, int watcherId)
+{
+    IocpFdState &state = fdState(watcher->fd);
+    if (state.baseHandle == INVALID_HANDLE_VALUE) {
+        SOCKET base = INVALID_SOCKET;
+        DWORD bytes = 0;
+        if (WSAIoctl(static_cast<SOCKET>(watcher->fd), SIO_BASE_HANDLE, nullptr, 0, &base, sizeof(base), &bytes,
+                     nullptr, nullptr)
+                    == SOCKET_ERROR
+            || base == INVALID_SOCKET) {
+            // not a socket, or already closed. let the caller find it out.
+            pendingIo.append(watcherId);
+            return;
+        }
+        state.baseHandle = reinterpret_cast<HANDLE>(base);
+    }
+    IocpOperation *op = allocateOperation(IocpOperation::AfdPoll, watcher->fd);
+    op->watcherId = watcherId;
+    op->pollInfo.timeout.QuadPart = INT64_MAX;
+    op->pollInfo.numberOfHandles = 1;
+    op->pollInfo.exclusive = FALSE;
+    op->pollInfo.handles[0].handle = state.baseHandle;
+    op->pollInfo.handles[0].status = 0;
+    ULONG events = QTNG_AFD_POLL_LOCAL_CLOSE;
+    if (watcher->events & EventLoopCoroutine::Read) {
+        events |= QTNG_AFD_POLL_RECEIVE | QTNG_AFD_POLL_ACCEPT | QTNG_AFD_POLL_DISCONNECT | QTNG_AFD_POLL_ABORT;
+    }
+    if (watcher->events & EventLoopCoroutine::Write) {
+        events |= QTNG_AFD_POLL_SEND | QTNG_AFD_POLL_CONNECT_FAIL | QTNG_AFD_POLL_ABORT;
+    }
+    op->pollInfo.handles[0].events = events;
+    PIO_STATUS_BLOCK iosb = reinterpret_cast<PIO_STATUS_BLOCK>(&op->overlapped);
+    iosb->Status = static_cast<NTSTATUS>(0x00000103L);  // STATUS_PENDING
+    LONG status = ntFunctions()->deviceIoControlFile(afd, nullptr, nullptr, iosb, iosb, QTNG_IOCTL_AFD_POLL,
+                                                     &op->pollInfo, sizeof(op->pollInfo), &op->pollInfo,
+                                                     sizeof(op->pollInfo));
+    if (status != 0 && status != 0x00000103L) {
+        releaseOperation(op);
+        pendingIo.append(watcherId);
+        return;
+    }
+    watcher->poll = op;
+    ++inflight;
+}
+
+void IocpEventLoopCoroutinePrivate::startWatcher(int watcherId)
+{
+    IocpIoWatcher *watcher = findIoWatcher(watcherId);
+    if (!watcher || watcher->active) {
+        return;
+    }
+    watcher->active = true;
+    if (!watcher->poll) {
+        submitPoll(watcher, watcherId);
+    }
+    // a poll that is being cancelled is re-armed when its completion arrives.
+}
+
+void IocpEventLoopCoroutinePrivate::stopWatcher(int watcherId)
+{
+    IocpIoWatcher *watcher = findIoWatcher(watcherId);
+    if (!watcher || !watcher->active) {
+        return;
+    }
+    watcher->active = false;
+    if (watcher->poll) {
+        IO_STATUS_BLOCK cancelIosb;
+        ntFunctions()->cancelIoFileEx(afd, reinterpret_cast<PIO_STATUS_BLOCK>(&watcher->poll->overlapped),
+                                      &cancelIosb);
+    }
+}
+
+void IocpEventLoopCoroutinePrivate::removeWatcher(int watcherId)
+{
+    IocpIoWatcher *watcher = findIoWatcher(watcherId);
+    if (!watcher) {
+        return;
+    }
+    stopWatcher(watcherId);
+    int index = indexOfWatcherId(watcherId);
+    if (watcher->prev >= 0) {
+        ioWatchers[watcher->prev].next = watcher->next;
+    } else {
+        QHash<qintptr, IocpFdState>::iterator itor = fds.find(watcher->fd);
+        if (itor != fds.end()) {
+            itor->firstWatcher = watcher->next;
+            // the association to the port lasts until the socket is closed.
+            if (itor->firstWatcher < 0 && !itor->firstOperation && !itor->associated) {
+                fds.erase(itor);
+            }
+        }
+    }
+    if (watcher->next >= 0) {
+        ioWatchers[watcher->next].prev = watcher->prev;
+    }
+    // a borrowed callback may be destroyed by its owner right after, never touch it later.
+    if (!watcher->callback->isBorrowed()) {
+        uselessCallbacks.append(watcher->callback);
+    }
+    watcher->callback = nullptr;
+    watcher->poll = nullptr;  // the completion of a cancelled poll finds no watcher and releases itself.
+    watcher->used = false;
+    ++watcher->generation;
+    freeIoWatchers.put(ioWatchers, &IocpIoWatcher::next, index);
+}
+
+void IocpEventLoopCoroutinePrivate::triggerIoWatchers(qintptr fd)
+{
+    QHash<qintptr, IocpFdState>::iterator itor = fds.find(fd);
+    if (itor == fds.end()) {
+        return;
+    }
+    for (int index = itor->firstWatcher; index >= 0; index = ioWatchers[index].next) {
+        IocpIoWatcher &watcher = ioWatchers[index];
+        int watcherId = makeWatcherId(index, watcher.generation);
+        stopWatcher(watcherId);
+        pendingIo.append(watcherId);
+    }
+    // closesocket() aborts the overlapped operations, but the socket may be closed by others.
+    for (IocpOperation *op = itor->firstOperation; op; op = op->next) {
+        CancelIoEx(reinterpret_cast<HANDLE>(fd), &op->overlapped);
+    }
+    // the handle value may be reused by a new socket.
+    if (itor->firstWatcher < 0 && !itor->firstOperation) {
+        fds.erase(itor);
+    } else {
+        itor->baseHandle = INVALID_HANDLE_VALUE;
+        itor->associated = false;
+        itor->associateFailed = false;
+    }
+}
+
+void IocpEventLoopCoroutinePrivate::handlePollCompletion(IocpOperation *op)
+{
+    int watcherId = op->watcherId;
+    IocpIoWatcher *watcher = findIoWatcher(watcherId);
+    if (!watcher || watcher->poll != op) {
+        releaseOperation(op);
+        return;
+    }
+    watcher->poll = nullptr;
+    PIO_STATUS_BLOCK iosb = reinterpret_cast<PIO_STATUS_BLOCK>(&op->overlapped);
+    bool cancelled = iosb->Status == QTNG_STATUS_CANCELLED;
+    ULONG events = op->pollInfo.numberOfHandles ? op->pollInfo.handles[0].events : 0;
+    releaseOperation(op);
+    if (!watcher->active) {
+        return;
+    }
+    if (cancelled && !events) {
+        // stopped and started again before the cancellation completed.
+        submitPoll(watcher, watcherId);
+        return;
+    }
+    (*watcher->callback)();
+    // watchers are level triggered, like the other backends.
+    watcher = findIoWatcher(watcherId);
+    if (watcher && watcher->active && !watcher->poll) {
+        submitPoll(watcher, watcherId);
+    }
+}
+
+int IocpEventLoopCoroutinePrivate::errorFromStatus(LONG status)
+{
+    switch (status) {
+    case QTNG_STATUS_CANCELLED:
+        return WSA_OPERATION_ABORTED;
+    case QTNG_STATUS_BUFFER_OVERFLOW:
+        return WSAEMSGSIZE;
+    case QTNG_STATUS_CONNECTION_RESET:
+        return WSAECONNRESET;
+    case QTNG_STATUS_CONNECTION_ABORTED:
+    case QTNG_STATUS_LOCAL_DISCONNECT:
+    case QTNG_STATUS_REMOTE_DISCONNECT:
+        return WSAECONNABORTED;
+    case QTNG_STATUS_CONNECTION_REFUSED:
+        return WSAECONNREFUSED;
+    case QTNG_STATUS_NETWORK_UNREACHABLE:
+        return WSAENETUNREACH;
+    case QTNG_STATUS_HOST_UNREACHABLE:
+        return WSAEHOSTUNREACH;
+    case QTNG_STATUS_IO_TIMEOUT:
+        return WSAETIMEDOUT;
+    default:
+        return static_cast<int>(ntFunctions()->statusToDosError(status));
+    }
+}
+
+void IocpEventLoopCoroutinePrivate::handleSocketIoCompletion(IocpOperation *op, DWORD bytes)
+{
+    unlinkOperation(op);
+    LONG status = static_cast<LONG>(op->overlapped.Internal);
+    SOCKET s = static_cast<SOCKET>(op->fd);
+    if (status == 0 || status == QTNG_STATUS_BUFFER_OVERFLOW) {
+        op->result = static_cast<qint64>(bytes);
+        if (op->operation == CompletionIo::Accept) {
+            if (setsockopt(op->acceptSocket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, reinterpret_cast<char *>(&s),
+                           sizeof(s))
+                == SOCKET_ERROR) {
+                op->result = -WSAGetLastError();
+                closesocket(op->acceptSocket);
+            } else {
+                op->result = static_cast<qint64>(op->acceptSocket);
+            }
+            op->acceptSocket = INVALID_SOCKET;
+        } else if (op->operation == CompletionIo::Connect) {
+            setsockopt(s, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, nullptr, 0);
+            op->result = 0;
+        }
+        // a truncated datagram is reported by WSARecvFrom() as WSAEMSGSIZE with the bytes read.
+    } else {
+        op->result = -errorFromStatus(status);
+        if (op->acceptSocket != INVALID_SOCKET) {
+            closesocket(op->acceptSocket);
+            op->acceptSocket = INVALID_SOCKET;
+        }
+    }
+    op->done = true;
+    QPointer<BaseCoroutine> coroutine = op->coroutine;
+    if (coroutine.isNull()) {
+        if (op->operation == CompletionIo::Accept && op->result > 0) {
+            closesocket(static_cast<SOCKET>(op->result));
+        }
+        releaseOperation(op);
+    } else {
+        coroutine->yield();
+    }
+}
+
+void IocpEventLoopCoroutinePrivate::handleCompletion(IocpOperation *op, DWORD bytes)
+{
+    --inflight;
+    if (op->kind == IocpOperation::AfdPoll) {
+        handlePollCompletion(op);
+    } else {
+        handleSocketIoCompletion(op, bytes);
+    }
+}
+
+bool IocpEventLoopCoroutinePrivate::startSocketIo(IocpOperation *op, CompletionIo *io, IocpFdState &state)
+{
+    NtFunctions *nt = ntFunctions();
+    SOCKET s = static_cast<SOCKET>(io->fd);
+    nt->loadExtensions(s);
+    WSABUF buf;
+    buf.buf = static_cast<char *>(io->data);
+    buf.len = static_cast<ULONG>(io->size);
+    DWORD flags = static_cast<DWORD>(io->flags);
+    int r = SOCKET_ERROR;
+    switch (io->operation) {
+    case CompletionIo::Recv:
+        r = WSARecv(s, &buf, 1, nullptr, &flags, &op->overlapped, nullptr);
+        break;
+    case CompletionIo::Send:
+        r = WSASend(s, &buf, 1, nullptr, flags, &op->overlapped, nullptr);
+        break;
+    case CompletionIo::RecvMsg:
+        op->addressSize = io->addressSize;
+        r = WSARecvFrom(s, &buf, 1, nullptr, &flags, static_cast<sockaddr *>(io->address), &op->addressSize,
+                        &op->overlapped, nullptr);
+        break;
+    case CompletionIo::SendMsg:
+        r = WSASendTo(s, &buf, 1, nullptr, flags, static_cast<const sockaddr *>(io->address), io->addressSize,
+                      &op->overlapped, nullptr);
+        break;
+    case CompletionIo::Accept: {
+        if (!nt->acceptEx) {
+            return false;
+        }
+        SOCKADDR_STORAGE local;
+        int localSize = sizeof(local);
+        if (getsockname(s, reinterpret_cast<sockaddr *>(&local), &localSize) == SOCKET_ERROR) {
+            return false;
+        }
+#ifdef WSA_FLAG_NO_HANDLE_INHERIT
+        const DWORD socketFlags = WSA_FLAG_OVERLAPPED | WSA_FLAG_NO_HANDLE_INHERIT;
+#else
+        const DWORD socketFlags = WSA_FLAG_OVERLAPPED;
+#endif
+        op->acceptSocket = WSASocketW(local.ss_family, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, socketFlags);
+        if (op->acceptSocket == INVALID_SOCKET) {
+            return false;
+        }
+        DWORD bytes = 0;
+        const DWORD addressLength = sizeof(SOCKADDR_STORAGE) + 16;
+        if (nt->acceptEx(s, op->acceptSocket, op->acceptBuffer, 0, addressLength, addressLength, &bytes,
+                         &op->overlapped)) {
+            r = 0;
+        }
+        break;
+    }
+    case CompletionIo::Connect: {
+        if (!nt->connectEx) {
+            return false;
+        }
+        // ConnectEx() requires a bound socket.
+        SOCKADDR_STORAGE local;
+        int localSize = sizeof(local);
+        if (getsockname(s, reinterpret_cast<sockaddr *>(&local), &localSize) == SOCKET_ERROR) {
+            memset(&local, 0, sizeof(local));
+            local.ss_family = static_cast<const sockaddr *>(io->address)->sa_family;
+            localSize = local.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+            if (bind(s, reinterpret_cast<sockaddr *>(&local), localSize) == SOCKET_ERROR) {
+                return false;
+            }
+        }
+        if (nt->connectEx(s, static_cast<const sockaddr *>(io->address), io->addressSize, nullptr, 0, nullptr,
+                          &op->overlapped)) {
+            r = 0;
+        }
+        break;
+    }
+    case CompletionIo::TransmitFile: {
+        if (!nt->transmitFile) {
+            return false;
+        }
+        const quint64 offset = static_cast<quint64>(*static_cast<const qint64 *>(io->address));
+        op->overlapped.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+        op->overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        if (nt->transmitFile(s, static_cast<HANDLE>(io->data), static_cast<DWORD>(io->size), 0, &op->overlapped,
+                             nullptr, 0)) {
+            r = 0;
+        }
+        break;
+    }
+    case CompletionIo::Poll:
+        return false;
+    }
+    if (r == SOCKET_ERROR) {
+        int e = WSAGetLastError();
+        if (e != WSA_IO_PENDING) {
+            if (op->acceptSocket != INVALID_SOCKET) {
+                closesocket(op->acceptSocket);
+                op->acceptSocket = INVALID_SOCKET;
+            }
+            op->result = -e;
+            op->done = true;
+            return true;
+        }
+    }
+    // a completion packet is queued even if the operation finished at once.
+    op->next = state.firstOperation;
+    if (op->next) {
+        op->next->prev = op;
+    }
+    state.firstOperation = op;
+    ++inflight;
+    return true;
+}
+
+bool IocpEventLoopCoroutinePrivate::completeIo(CompletionIo *io)
+{
+    Q_Q(EventLoopCoroutine);
+    BaseCoroutine *current = BaseCoroutine::current();
+    if (io->fd <= 0 || io->operation == CompletionIo::Poll || current == q || current == loopCoroutine.data()) {
+        return false;
+    }
+    IocpFdState &state = fdState(io->fd);
+    if (!state.associated) {
+        if (state.associateFailed) {
+            return false;
+        }
+        // a socket can only be associated with one port, sockets used by other threads stay with watchers.
+        if (!CreateIoCompletionPort(reinterpret_cast<HANDLE>(io->fd), iocp, 0, 0)) {
+            state.associateFailed = true;
+            return false;
+        }
+        state.associated = true;
+    }
+    IocpOperation *op = allocateOperation(IocpOperation::SocketIo, io->fd);
+    op->operation = io->operation;
+    op->coroutine = current;
+    if (!startSocketIo(op, io, state)) {
+        releaseOperation(op);
+        return false;
+    }
+    std::exception_ptr interruption;
+    while (!op->done) {
+        try {
+            yield();
+        } catch (...) {
+            if (!interruption) {
+                interruption = std::current_exception();
+                CancelIoEx(reinterpret_cast<HANDLE>(io->fd), &op->overlapped);
+            }
+        }
+    }
+    io->result = op->result;
+    io->hasResult = true;
+    if (io->operation == CompletionIo::RecvMsg) {
+        io->addressSize = op->addressSize;
+    }
+    releaseOperation(op);
+    if (interruption) {
+        if (io->operation == CompletionIo::Accept && io->result > 0) {
+            closesocket(static_cast<SOCKET>(io->result));
+        }
+        std::rethrow_exception(interruption);
+    }
+    return true;
+}
+
+void IocpEventLoopCoroutinePrivate::processPendingIo()
+{
+    if (pendingIo.isEmpty()) {
+        return;
+    }
+    QVector<int> ids;
+    ids.swap(pendingIo);
+    for (int watcherId : ids) {
+        IocpIoWatcher *watcher = findIoWatcher(watcherId);
+        if (watcher) {
+            (*watcher->callback)();
+        }
+    }
+}
+
+void IocpEventLoopCoroutinePrivate::pushTimer(qint64 deadline, int index, quint32 generation)
+{
+    IocpTimerItem item;
+    item.deadline = deadline;
+    item.sequence = nextSequence++;
+    item.index = index;
+    item.generation = generation;
+    timerHeap.append(item);
+    std::push_heap(timerHeap.begin(), timerHeap.end(), std::greater<IocpTimerItem>());
+}
+
+int IocpEventLoopCoroutinePrivate::addTimer(quint32 msecs, Functor *callback, bool repeat)
+{
+    int index = freeTimers.take(timers, &IocpTimer::nextFree);
+    if (index < 0) {
+        if (!hasFreeWatcherIndex(timers.size())) {
+            releaseFunctor(callback);
+            return 0;
+        }
+        index = timers.size();
+        IocpTimer empty;
+        empty.generation = 0;
+        timers.append(empty);
+    }
+    IocpTimer &timer = timers[index];
+    timer.callback = callback;
+    timer.interval = msecs;
+    timer.nextFree = -1;
+    timer.used = true;
+    timer.repeat = repeat;
+    pushTimer(clock.elapsed() + msecs, index, timer.generation);
+    return makeWatcherId(index, timer.generation);
+}
+
+int IocpEventLoopCoroutinePrivate::callLater(quint32 msecs, Functor *callback)
+{
+    return addTimer(msecs, callback, false);
+}
+
+int IocpEventLoopCoroutinePrivate::callRepeat(quint32 msecs, Functor *callback)
+{
+    return addTimer(qMax<quint32>(msecs, 1), callback, true);
+}
+
+void IocpEventLoopCoroutinePrivate::cancelCall(int callbackId)
+{
+    IocpTimer *timer = findTimer(callbackId);
+    if (!timer) {
+        return;
+    }
+    if (!timer->callback->isBorrowed()) {
+        uselessCallbacks.append(timer->callback);
+    }
+    timer->callback = nullptr;
+    timer->used = false;
+    ++timer->generation;
+    freeTimers.put(timers, &IocpTimer::nextFree, indexOfWatcherId(callbackId));
+    ++staleTimers;
+    compactTimers();
+}
+
+void IocpEventLoopCoroutinePrivate::compactTimers()
+{
+    if (staleTimers <= 1024 || staleTimers <= timerHeap.size() / 2) {
+        return;
+    }
+    QVector<IocpTimerItem> alive;
+    alive.reserve(timerHeap.size() - staleTimers);
+    for (const IocpTimerItem &item : timerHeap) {
+        const IocpTimer &timer = timers[item.index];
+        if (timer.used && timer.generation == item.generation) {
+            alive.append(item);
+        }
+    }
+    std::make_heap(alive.begin(), alive.end(), std::greater<IocpTimerItem>());
+    timerHeap.swap(alive);
+    staleTimers = 0;
+}
+
+void IocpEventLoopCoroutinePrivate::processTimers()
+{
+    const qint64 now = clock.elapsed();
+    const quint64 sequenceLimit = nextSequence;
+    while (!timerHeap.isEmpty()) {
+        const IocpTimerItem item = timerHeap.first();
+        if (item.deadline > now || item.sequence >= sequenceLimit) {
+            break;
+        }
+        std::pop_heap(timerHeap.begin(), timerHeap.end(), std::greater<IocpTimerItem>());
+        timerHeap.removeLast();
+        IocpTimer &timer = timers[item.index];
+        if (!timer.used || timer.generation != item.generation) {
+            if (staleTimers > 0) {
+                --staleTimers;
+            }
+            continue;
+        }
+        Functor *callback = timer.callback;
+        if (timer.repeat) {
+            pushTimer(now + timer.interval, item.index, item.generation);
+            (*callback)();
+        } else {
+            timer.callback = nullptr;
+            timer.used = false;
+            ++timer.generation;
+            freeTimers.put(timers, &IocpTimer::nextFree, item.index);
+            (*callback)();
+            releaseFunctor(callback);
+        }
+    }
+}
+
+void IocpEventLoopCoroutinePrivate::doCallLater()
+{
+    callLaterQueue.clearWakeup();
+    quint32 msecs;
+    Functor *callback;
+    while (callLaterQueue.pop(&msecs, &callback)) {
+        callLater(msecs, callback);
+    }
+}
+
+void IocpEventLoopCoroutinePrivate::callLaterThreadSafe(quint32 msecs, Functor *callback)
+{
+    if (callLaterQueue.push(msecs, callback)) {
+        PostQueuedCompletionStatus(iocp, 0, WakeupKey, nullptr);
+    }
+}
+
+void IocpEventLoopCoroutinePrivate::runOnce()
+{
+    if (!uselessCallbacks.isEmpty()) {
+        QList<Functor *> callbacks;
+        callbacks.swap(uselessCallbacks);
+        qDeleteAll(callbacks);
+    }
+    DWORD timeout = INFINITE;
+    if (!pendingIo.isEmpty()) {
+        timeout = 0;
+    } else if (!timerHeap.isEmpty()) {
+        qint64 delta = timerHeap.first().deadline - clock.elapsed();
+        timeout = static_cast<DWORD>(qBound<qint64>(0, delta, 0x7ffffffe));
+    }
+    OVERLAPPED_ENTRY entries[MaxEntriesPerWait];
+    ULONG n = 0;
+    beforePoll();
+    BOOL ok = GetQueuedCompletionStatusEx(iocp, entries, MaxEntriesPerWait, &n, timeout, FALSE);
+    afterPoll();
+    if (!ok) {
+        DWORD e = GetLastError();
+        if (e != WAIT_TIMEOUT) {
+            qtng_warning << "GetQueuedCompletionStatusEx() failed:" << e;
+        }
+        n = 0;
+    }
+    for (ULONG i = 0; i < n; ++i) {
+        if (entries[i].lpCompletionKey == WakeupKey) {
+            doCallLater();
+        } else if (entries[i].lpOverlapped) {
+            IocpOperation *op = reinterpret_cast<IocpOperation *>(entries[i].lpOverlapped);
+            handleCompletion(op, entries[i].dwNumberOfBytesTransferred);
+        }
+    }
+    processPendingIo();
+    processTimers();
+}
+
+void IocpEventLoopCoroutinePrivate::loop()
+{
+    while (!breakOne) {
+        runOnce();
+    }
+    breakOne = false;
+}
+
+int IocpEventLoopCoroutinePrivate::exitCode()
+{
+    return 0;
+}
+
+bool IocpEventLoopCoroutinePrivate::runUntil(BaseCoroutine *coroutine)
+{
+    QPointer<BaseCoroutine> current = BaseCoroutine::current();
+    if (!loopCoroutine.isNull() && loopCoroutine != current) {
+        Deferred<BaseCoroutine *>::Callback here = [current](BaseCoroutine *) {
+            if (!current.isNull()) {
+                current->yield();
+            }
+        };
+        int callbackId = coroutine->finished.addCallback(here);
+        loopCoroutine->yield();
+        coroutine->finished.remove(callbackId);
+    } else {
+        QPointer<BaseCoroutine> old = loopCoroutine;
+        loopCoroutine = current;
+        QPointer<BaseCoroutine> t = loopCoroutine;
+        bool *breakOne = &this->breakOne;
+        Deferred<BaseCoroutine *>::Callback exitOneDepth = [t, breakOne](BaseCoroutine *) {
+            *breakOne = true;
+            if (!t.isNull()) {
+                t->yield();
+            }
+        };
+        int callbackId = coroutine->finished.addCallback(exitOneDepth);
+        loop();
+        loopCoroutine = old;
+        coroutine->finished.remove(callbackId);
+    }
+    return true;
+}
+
+void IocpEventLoopCoroutinePrivate::fillMetrics(EventLoopMetrics *metrics)
+{
+    EventLoopCoroutinePrivate::fillMetrics(metrics);
+    metrics->timers = qMax(metrics->timers, 0) + timerHeap.size() - staleTimers;
+    metrics->pendingThreadSafeCalls = callLaterQueue.size();
+}
+
+void IocpEventLoopCoroutinePrivate::yield()
+{
+    Q_Q(EventLoopCoroutine);
+    if (!loopCoroutine.isNull()) {
+        loopCoroutine->yield();
+    } else {
+        q->BaseCoroutine::yield();
+    }
+}
+
+IocpEventLoopCoroutine::IocpEventLoopCoroutine()
+    : EventLoopCoroutine(new IocpEventLoopCoroutinePrivate(this))
+{
+}
+
+bool IocpEventLoopCoroutine::isAvailable()
+{
+    HANDLE h = ntFunctions()->openAfd();
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    CloseHandle(h);
+    return true;
+}
+
+QTNETWORKNG_NAMESPACE_END
@@ -0,0 +1,625 @@
+#include <QtCore/qvector.h>
+#include <QtCore/qvarlengtharray.h>
+#include <QtCore/qpointer.h>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include "../include/private/eventloop_p.h"
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.eventloop_kqueue");
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+static const int MaxEventsPerWait = 256;
+
+static inline qint64 monotonicMsecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<qint64>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct KqueueIoWatcher
+{
+    Functor *callback;
+    int fd;
+    quint8 events;
+    bool active;
+};
+
+struct KqueueFdState
+{
+    KqueueFdState()
+        : readyEvents(0)
+        , registered(false)
+        , alwaysReady(false)
+    {
+    }
+    quint8 readyEvents;  // edges received while no watcher was waiting.
+    bool registered;
+    bool alwaysReady;  // the fds refused by kqueue, such as some regular files, which never block.
+};
+
+struct KqueueTimer
+{
+    Functor *callback;
+    quint32 interval;
+    quint32 generation;
+    int nextFree;
+    bool used;
+    bool repeat;
+};
+
+struct KqueueTimerItem
+{
+    qint64 deadline;
+    quint64 sequence;  // keeps callbacks with the same deadline in fifo order.
+    int index;
+    quint32 generation;
+};
+
+static inline bool operator>(const KqueueTimerItem &a, const KqueueTimerItem &b)
+{
+    return a.deadline > b.deadline || (a.deadline == b.deadline && a.sequence > b.sequence);
+}
+
+// the kqueue backend of macos and bsd, which works like the epoll backend: the fds are registered once as edge
+// triggered (EV_CLEAR) read and write filters, and the timers are kept in a heap which decides the timeout of kevent(),
+// so a callLater() costs no syscall. callLaterThreadSafe() wakes the loop by EVFILT_USER, or a pipe if the system has
+// no EVFILT_USER.
+class KqueueEventLoopCoroutinePrivate : public EventLoopCoroutinePrivate
+{
+public:
+    explicit KqueueEventLoopCoroutinePrivate(EventLoopCoroutine *q);
+    virtual ~KqueueEventLoopCoroutinePrivate() override;
+public:
+    virtual void run() override;
+    virtual int createWatcher(EventLoopCoroutine::EventType event, qintptr fd, Functor *callback) override;
+    virtual void startWatcher(int watcherId) override;
+    virtual void stopWatcher(int watcherId) override;
+    virtual void removeWatcher(int watcherId) override;
+    virtual void triggerIoWatchers(qintptr fd) override;
+    virtual int callLater(quint32 msecs, Functor *callback) override;
+    virtual void callLaterThreadSafe(quint32 msecs, Functor *callback) override;
+    virtual int callRepeat(quint32 msecs, Functor *callback) override;
+    virtual void cancelCall(int callbackId) override;
+    virtual int exitCode() override;
+    virtual bool runUntil(BaseCoroutine *coroutine) override;
+    virtual void yield() override;
+    virtual void fillMetrics(EventLoopMetrics *metrics) override;
+private:
+    KqueueTimer *findTimer(int callbackId);
+    int addTimer(quint32 msecs, Functor *callback, bool repeat);
+    void pushTimer(qint64 deadline, int index, quint32 generation);
+    void compactTimers();
+    void registerFd(int fd);
+    void dispatch(const struct kevent &event);
+    void processPendingIo();
+    void processTimers();
+    void doCallLater();
+    int pollTimeout();
+    void runOnce();
+    void loop();
+private:
+    WatcherTable<KqueueIoWatcher> ioWatchers;
+    QVector<KqueueFdState> fds;
+    QVector<int> pendingIo;
+    QVector<KqueueTimer> timers;
+    QVector<KqueueTimerItem> timerHeap;
+    QList<Functor *> uselessCallbacks;
+    CallLaterQueue callLaterQueue;
+    QPointer<BaseCoroutine> loopCoroutine;
+    quint64 nextSequence;
+    int kqueueFd;
+    int wakeupPipe[2];
+    FreeSlotQueue freeTimers;
+    int staleTimers;
+    bool breakOne;
+    Q_DECLARE_PUBLIC(EventLoopCoroutine)
+};
+
+KqueueEventLoopCoroutinePrivate::KqueueEventLoopCoroutinePrivate(EventLoopCoroutine *q)
+    : EventLoopCoroutinePrivate(q)
+    , nextSequence(0)
+    , kqueueFd(-1)
+    , staleTimers(0)
+    , breakOne(false)
+{
+    wakeupPipe[0] = wakeupPipe[1] = -1;
+    kqueueFd = kqueue();
+    if (kqueueFd < 0) {
+        qtng_warning << "can not create kqueue fd:" << errno;
+        return;
+    }
+    fcntl(kqueueFd, F_SETFD, FD_CLOEXEC);
+    struct kevent change;
+#ifdef EVFILT_USER
+    EV_SET(&change, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+#else
+    if (pipe(wakeupPipe) < 0) {
+        qtng_warning << "can not create the wakeup pipe:" << errno;
+        return;
+    }
+    for (int fd : wakeupPipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    EV_SET(&change, wakeupPipe[0], EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, 0);
+#endif
+    if (kevent(kqueueFd, &change, 1, nullptr, 0, nullptr) < 0) {
+        qtng_warning << "can not watch the wakeup event:" << errno;
+    }
+}
+
+KqueueEventLoopCoroutinePrivate::~KqueueEventLoopCoroutinePrivate()
+{
+    for (KqueueIoWatcher *watcher : ioWatchers.values()) {
+        releaseFunctor(watcher->callback);
+        delete watcher;
+    }
+    for (const KqueueTimer &timer : timers) {
+        if (timer.used) {
+            releaseFunctor(timer.callback);
+        }
+    }
+    qDeleteAll(uselessCallbacks);
+    for (int fd : wakeupPipe) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    if (kqueueFd >= 0) {
+        ::close(kqueueFd);
+    }
+}
+
+KqueueTimer *KqueueEventLoopCoroutinePrivate::findTimer(int callbackId)
+{
+    int index = indexOfWatcherId(callbackId);
+    if (index < 0 || index >= timers.size()) {
+        return nullptr;
+    }
+    KqueueTimer &timer = timers[index];
+    if (!timer.used || (timer.generation & WatcherIdGenerationMask) != generationOfWatcherId(callbackId)) {
+        return nullptr;
+    }
+    return &timer;
+}
+
+void KqueueEventLoopCoroutinePrivate::run()
+{
+    try {
+        loop();
+    } catch (...) {
+        qtng_warning << "kqueue eventloop got exception.";
+    }
+}
+
+int KqueueEventLoopCoroutinePrivate::createWatcher(EventLoopCoroutine::EventType event, qintptr fd, Functor *callback)
+{
+    KqueueIoWatcher *watcher = new KqueueIoWatcher();
+    watcher->callback = callback;
+    watcher->fd = static_cast<int>(fd);
+    watcher->events = static_cast<quint8>(event);
+    watcher->active = false;
+    const int watcherId = ioWatchers.insert(watcher, fd);
+    if (!watcherId) {
+        releaseFunctor(callback);
+        delete watcher;
+        return 0;
+    }
+    if (fd >= fds.size()) {
+        fds.resize(static_cast<int>(fd) + 1);
+    }
+    return watcherId;
+}
+
+void KqueueEventLoopCoroutinePrivate::registerFd(int fd)
+{
+    KqueueFdState &state = fds[fd];
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, 0);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, 0);
+    // one by one, so the error of each filter is known.
+    if (kevent(kqueueFd, &changes[0], 1, nullptr, 0, nullptr) == 0
+        && kevent(kqueueFd, &changes[1], 1, nullptr, 0, nullptr) == 0) {
+        state.registered = true;
+        return;
+    }
+    qtng_debug << "can not add fd to kqueue:" << fd << errno;
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
+    kevent(kqueueFd, changes, 2, nullptr, 0, nullptr);
+    // let the caller try again, so it sees the real error from its syscall.
+    state.alwaysReady = true;
+}
+
+void KqueueEventLoopCoroutinePrivate::startWatcher(int watcherId)
+{
+    KqueueIoWatcher *watcher = ioWatchers.value(watcherId);
+    if (!watcher || watcher->active) {
+        return;
+    }
+    watcher->active = true;
+    if (watcher->fd < 0) {
+        pendingIo.append(watcherId);
+        return;
+    }
+    KqueueFdState &state = fds[watcher->fd];
+    if (!state.registered && !state.alwaysReady) {
+        registerFd(watcher->fd);
+    }
+    if (state.alwaysReady || (state.readyEvents & watcher->events)) {
+        state.readyEvents &= ~watcher->events;
+        pendingIo.append(watcherId);
+    }
+}
+
+void KqueueEventLoopCoroutinePrivate::stopWatcher(int watcherId)
+{
+    KqueueIoWatcher *watcher = ioWatchers.value(watcherId);
+    if (watcher) {
+        watcher->active = false;
+    }
+}
+
+void KqueueEventLoopCoroutinePrivate::removeWatcher(int watcherId)
+{
+    KqueueIoWatcher *watcher = ioWatchers.take(watcherId);
+    if (!watcher) {
+        return;
+    }
+    // the callback may be running right now, delete it in the next iteration.
+    // a borrowed callback may be destroyed by its owner right after, never touch it later.
+    if (!watcher->callback->isBorrowed()) {
+        uselessCallbacks.append(watcher->callback);
+    }
+    delete watcher;
+}
+
+// fds are removed from kqueue here, so code that closes a watched fd must call triggerIoWatchers() as Socket does.
+void KqueueEventLoopCoroutinePrivate::triggerIoWatchers(qintptr fd)
+{
+    if (fd < 0 || fd >= fds.size()) {
+        return;
+    }
+    for (int watcherId : ioWatchers.idsOfFd(fd)) {
+        ioWatchers.value(watcherId)->active = false;
+        pendingIo.append(watcherId);
+    }
+    KqueueFdState &state = fds[static_cast<int>(fd)];
+    if (state.registered) {
+        struct kevent changes[2];
+        EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
+        EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
+        kevent(kqueueFd, changes, 2, nullptr, 0, nullptr);
+    }
+    state.registered = false;
+    state.alwaysReady = false;
+    state.readyEvents = 0;
+}
+
+void KqueueEventLoopCoroutinePrivate::dispatch(const struct kevent &event)
+{
+    const int fd = static_cast<int>(event.ident);
+    if (fd < 0 || fd >= fds.size()) {
+        return;
+    }
+    quint8 ready = 0;
+    if (event.flags & EV_ERROR) {
+        ready = EventLoopCoroutine::ReadWrite;
+    } else if (event.filter == EVFILT_READ) {
+        ready = EventLoopCoroutine::Read;
+    } else if (event.filter == EVFILT_WRITE) {
+        ready = EventLoopCoroutine::Write;
+    }
+    if ((event.flags & EV_EOF) && event.fflags != 0) {
+        ready = EventLoopCoroutine::ReadWrite;  // fflags is the error of socket.
+    }
+    // callbacks switch to other coroutines which may create or remove watchers, collect the ids first.
+    QVarLengthArray<int, 8> fired;
+    quint8 consumed = 0;
+    for (int watcherId : ioWatchers.idsOfFd(fd)) {
+        const KqueueIoWatcher *watcher = ioWatchers.value(watcherId);
+        if (watcher->active && (watcher->events & ready)) {
+            consumed |= (watcher->events & ready);
+            fired.append(watcherId);
+        }
+    }
+    KqueueFdState &state = fds[fd];
+    state.readyEvents |= (ready & ~consumed);
+    for (int watcherId : fired) {
+        KqueueIoWatcher *watcher = ioWatchers.value(watcherId);
+        if (watcher && watcher->active) {
+            countCallback();
+            (*watcher->callback)();
+        }
+    }
+}
+
+void KqueueEventLoopCoroutinePrivate::processPendingIo()
+{
+    if (pendingIo.isEmpty()) {
+        return;
+    }
+    QVector<int> ids;
+    ids.swap(pendingIo);
+    for (int watcherId : ids) {
+        KqueueIoWatcher *watcher = ioWatchers.value(watcherId);
+        if (watcher) {
+            countCallback();
+            (*watcher->callback)();
+        }
+    }
+}
+
+void KqueueEventLoopCoroutinePrivate::pushTimer(qint64 deadline, int index, quint32 generation)
+{
+    KqueueTimerItem item;
+    item.deadline = deadline;
+    item.sequence = nextSequence++;
+    item.index = index;
+    item.generation = generation;
+    timerHeap.append(item);
+    std::push_heap(timerHeap.begin(), timerHeap.end(), std::greater<KqueueTimerItem>());
+}
+
+int KqueueEventLoopCoroutinePrivate::addTimer(quint32 msecs, Functor *callback, bool repeat)
+{
+    int index = freeTimers.take(timers, &KqueueTimer::nextFree);
+    if (index < 0) {
+        if (!hasFreeWatcherIndex(timers.size())) {
+            releaseFunctor(callback);
+            return 0;
+        }
+        index = timers.size();
+        KqueueTimer empty;
+        empty.generation = 0;
+        timers.append(empty);
+    }
+    KqueueTimer &timer = timers[index];
+    timer.callback = callback;
+    timer.interval = msecs;
+    timer.nextFree = -1;
+    timer.used = true;
+    timer.repeat = repeat;
+    pushTimer(monotonicMsecs() + msecs, index, timer.generation);
+    return makeWatcherId(index, timer.generation);
+}
+
+int KqueueEventLoopCoroutinePrivate::callLater(quint32 msecs, Functor *callback)
+{
+    return addTimer(msecs, callback, false);
+}
+
+int KqueueEventLoopCoroutinePrivate::callRepeat(quint32 msecs, Functor *callback)
+{
+    return addTimer(qMax<quint32>(msecs, 1), callback, true);
+}
+
+void KqueueEventLoopCoroutinePrivate::cancelCall(int callbackId)
+{
+    KqueueTimer *timer = findTimer(callbackId);
+    if (!timer) {
+        return;
+    }
+    if (!timer->callback->isBorrowed()) {
+        uselessCallbacks.append(timer->callback);
+    }
+    timer->callback = nullptr;
+    timer->used = false;
+    ++timer->generation;
+    freeTimers.put(timers, &KqueueTimer::nextFree, indexOfWatcherId(callbackId));
+    ++staleTimers;
+    compactTimers();
+}
+
+void KqueueEventLoopCoroutinePrivate::compactTimers()
+{
+    // cancelled timers stay in the heap until they expire, rebuild it if they pile up.
+    if (staleTimers <= 1024 || staleTimers <= timerHeap.size() / 2) {
+        return;
+    }
+    QVector<KqueueTimerItem> alive;
+    alive.reserve(timerHeap.size() - staleTimers);
+    for (const KqueueTimerItem &item : timerHeap) {
+        const KqueueTimer &timer = timers[item.index];
+        if (timer.used && timer.generation == item.generation) {
+            alive.append(item);
+        }
+    }
+    std::make_heap(alive.begin(), alive.end(), std::greater<KqueueTimerItem>());
+    timerHeap.swap(alive);
+    staleTimers = 0;
+}
+
+void KqueueEventLoopCoroutinePrivate::processTimers()
+{
+    const qint64 now = monotonicMsecs();
+    // timers added by the callbacks run in the next iteration.
+    const quint64 sequenceLimit = nextSequence;
+    while (!timerHeap.isEmpty()) {
+        const KqueueTimerItem item = timerHeap.first();
+        if (item.deadline > now || item.sequence >= sequenceLimit) {
+            break;
+        }
+        std::pop_heap(timerHeap.begin(), timerHeap.end(), std::greater<KqueueTimerItem>());
+        timerHeap.removeLast();
+        KqueueTimer &timer = timers[item.index];
+        if (!timer.used || timer.generation != item.generation) {
+            if (staleTimers > 0) {
+                --staleTimers;
+            }
+            continue;
+        }
+        Functor *callback = timer.callback;
+        countCallback();
+        if (timer.repeat) {
+            pushTimer(now + timer.interval, item.index, item.generation);
+            (*callback)();
+        } else {
+            timer.callback = nullptr;
+            timer.used = false;
+            ++timer.generation;
+            freeTimers.put(timers, &KqueueTimer::nextFree, item.index);
+            (*callback)();
+            releaseFunctor(callback);
+        }
+    }
+}
+
+void KqueueEventLoopCoroutinePrivate::doCallLater()
+{
+    if (wakeupPipe[0] >= 0) {
+        char buf[64];
+        while (::read(wakeupPipe[0], buf, sizeof(buf)) > 0) { }
+    }
+    callLaterQueue.clearWakeup();
+    quint32 msecs;
+    Functor *callback;
+    while (callLaterQueue.pop(&msecs, &callback)) {
+        callLater(msecs, callback);
+    }
+}
+
+void KqueueEventLoopCoroutinePrivate::callLaterThreadSafe(quint32 msecs, Functor *callback)
+{
+    if (!callLaterQueue.push(msecs, callback)) {
+        return;
+    }
+#ifdef EVFILT_USER
+    struct kevent change;
+    EV_SET(&change, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+    kevent(kqueueFd, &change, 1, nullptr, 0, nullptr);
+#else
+    const char c = 1;
+    ssize_t r;
+    do {
+        r = ::write(wakeupPipe[1], &c, 1);
+    } while (r < 0 && errno == EINTR);
+#endif
+}
+
+// milliseconds to the next timer, 0 if some watchers are pending, or -1 to wait for io only.
+int KqueueEventLoopCoroutinePrivate::pollTimeout()
+{
+    if (!pendingIo.isEmpty()) {
+        return 0;
+    } else if (!timerHeap.isEmpty()) {
+        qint64 delta = timerHeap.first().deadline - monotonicMsecs();
+        return static_cast<int>(qBound<qint64>(0, delta, 0x7fffffff));
+    }
+    return -1;
+}
+
+void KqueueEventLoopCoroutinePrivate::runOnce()
+{
+    if (!uselessCallbacks.isEmpty()) {
+        QList<Functor *> callbacks;
+        callbacks.swap(uselessCallbacks);
+        qDeleteAll(callbacks);
+    }
+    int timeout = pollTimeout();
+    struct kevent events[MaxEventsPerWait];
+    beforePoll();
+    if (timeout != 0 && shouldSpin()) {
+        timeout = 0;
+    }
+    struct timespec ts;
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = static_cast<long>(timeout % 1000) * 1000000;
+    int n = kevent(kqueueFd, nullptr, 0, events, MaxEventsPerWait, timeout < 0 ? nullptr : &ts);
+    afterPoll();
+    if (n < 0 && errno != EINTR) {
+        qtng_warning << "kevent() failed:" << errno;
+    }
+    for (int i = 0; i < n; ++i) {
+        const struct kevent &event = events[i];
+#ifdef EVFILT_USER
+        if (event.filter == EVFILT_USER) {
+#else
+        if (event.filter == EVFILT_READ && static_cast<int>(event.ident) == wakeupPipe[0]) {
+#endif
+            doCallLater();
+        } else {
+            dispatch(event);
+        }
+    }
+    processPendingIo();
+    processTimers();
+}
+
+void KqueueEventLoopCoroutinePrivate::loop()
+{
+    while (!breakOne) {
+        runOnce();
+    }
+    breakOne = false;
+}
+
+int KqueueEventLoopCoroutinePrivate::exitCode()
+{
+    return 0;
+}
+
+bool KqueueEventLoopCoroutinePrivate::runUntil(BaseCoroutine *coroutine)
+{
+    QPointer<BaseCoroutine> current = BaseCoroutine::current();
+    if (!loopCoroutine.isNull() && loopCoroutine != current) {
+        Deferred<BaseCoroutine *>::Callback here = [current](BaseCoroutine *) {
+            if (!current.isNull()) {
+                current->yield();
+            }
+        };
+        int callbackId = coroutine->finished.addCallback(here);
+        loopCoroutine->yield();
+        coroutine->finished.remove(callbackId);
+    } else {
+        QPointer<BaseCoroutine> old = loopCoroutine;
+        loopCoroutine = current;
+        QPointer<BaseCoroutine> t = loopCoroutine;
+        bool *breakOne = &this->breakOne;
+        Deferred<BaseCoroutine *>::Callback exitOneDepth = [t, breakOne](BaseCoroutine *) {
+            *breakOne = true;
+            if (!t.isNull()) {
+                t->yield();
+            }
+        };
+        int callbackId = coroutine->finished.addCallback(exitOneDepth);
+        loop();
+        loopCoroutine = old;
+        coroutine->finished.remove(callbackId);
+    }
+    return true;
+}
+
+void KqueueEventLoopCoroutinePrivate::fillMetrics(EventLoopMetrics *metrics)
+{
+    EventLoopCoroutinePrivate::fillMetrics(metrics);
+    metrics->watchers = ioWatchers.size();
+    metrics->timers = qMax(metrics->timers, 0) + timerHeap.size() - staleTimers;
+    metrics->pendingThreadSafeCalls = callLaterQueue.size();
+}
+
+void KqueueEventLoopCoroutinePrivate::yield()
+{
+    Q_Q(EventLoopCoroutine);
+    if (!loopCoroutine.isNull()) {
+        loopCoroutine->yield();
+    } else {
+        q->BaseCoroutine::yield();
+    }
+}
+
+KqueueEventLoopCoroutine::KqueueEventLoopCoroutine()
+    : EventLoopCoroutine(new KqueueEventLoopCoroutinePrivate(this))
+{
+}
+
+QTNETWORKNG_NAMESPACE_END
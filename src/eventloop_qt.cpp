@@ -1,4 +1,4 @@
-#include <QtCore/qmap.h>
+#include <QtCore/qhash.h>
 #include <QtCore/qeventloop.h>
 #include <QtCore/qcoreapplication.h>
 #include <QtCore/qthread.h>
@@ -55,7 +55,7 @@ IoWatcher::IoWatcher(qintptr fd, EventLoopCoroutine::EventType event, Functor *c
 
 IoWatcher::~IoWatcher()
 {
-    delete callback;
+    releaseFunctor(callback);
 }
 
 TimerWatcher::TimerWatcher(quint32 interval, bool singleshot, Functor *callback)
@@ -67,9 +67,7 @@ TimerWatcher::TimerWatcher(quint32 interval, bool singleshot, Functor *callback)
 
 TimerWatcher::~TimerWatcher()
 {
-    if (callback) {
-        delete callback;
-    }
+    releaseFunctor(callback);
 }
 
 }  // anonymous namespace
@@ -98,9 +96,8 @@ public:
     void timerEvent(QTimerEvent *event);
     void handleIoEvent(int socket, QSocketNotifier *n);
 private:
-    QMap<int, QtWatcher *> watchers;
-    QMap<int, int> timers;
-    int nextWatcherId;
+    WatcherTable<QtWatcher> watchers;
+    QHash<int, int> timers;
     int qtExitCode;
     QPointer<BaseCoroutine> loopCoroutine;
     EventLoopCoroutinePrivateQtHelper *helper;
@@ -144,14 +141,13 @@ private:
 
 QtEventLoopCoroutinePrivate::QtEventLoopCoroutinePrivate(EventLoopCoroutine *q)
     : EventLoopCoroutinePrivate(q)
-    , nextWatcherId(1)
     , helper(new EventLoopCoroutinePrivateQtHelper(this))
 {
 }
 
 QtEventLoopCoroutinePrivate::~QtEventLoopCoroutinePrivate()
 {
-    for (QtWatcher *watcher : watchers) {
+    for (QtWatcher *watcher : watchers.values()) {
         delete watcher;
     }
     delete helper;
@@ -180,8 +176,11 @@ void QtEventLoopCoroutinePrivate::handleIoEvent(int socket, QSocketNotifier *n)
 int QtEventLoopCoroutinePrivate::createWatcher(EventLoopCoroutine::EventType event, qintptr fd, Functor *callback)
 {
     IoWatcher *w = new IoWatcher(fd, event, callback);
-    watchers.insert(nextWatcherId, w);
-    return nextWatcherId++;
+    const int watcherId = watchers.insert(w, fd);
+    if (!watcherId) {
+        delete w;
+    }
+    return watcherId;
 }
 
 void QtEventLoopCoroutinePrivate::startWatcher(int watcherId)
@@ -259,17 +258,15 @@ void TriggerIoWatchersArgumentsFunctor::operator()()
 void QtEventLoopCoroutinePrivate::triggerIoWatchers(qintptr fd)
 {
     Q_Q(EventLoopCoroutine);
-    for (QMap<int, QtWatcher *>::const_iterator itor = watchers.constBegin(); itor != watchers.constEnd(); ++itor) {
-        IoWatcher *w = dynamic_cast<IoWatcher *>(itor.value());
-        if (w && w->fd == fd) {
-            if (!w->readNotifier.isNull()) {
-                w->readNotifier->setEnabled(false);
-            }
-            if (!w->writeNotifier.isNull()) {
-                w->writeNotifier->setEnabled(false);
-            }
-            callLater(0, new TriggerIoWatchersArgumentsFunctor(itor.key(), q));
+    for (int watcherId : watchers.idsOfFd(fd)) {
+        IoWatcher *w = static_cast<IoWatcher *>(watchers.value(watcherId));
+        if (!w->readNotifier.isNull()) {
+            w->readNotifier->setEnabled(false);
+        }
+        if (!w->writeNotifier.isNull()) {
+            w->writeNotifier->setEnabled(false);
         }
+        callLater(0, new TriggerIoWatchersArgumentsFunctor(watcherId, q));
     }
 }
 
@@ -287,8 +284,8 @@ void QtEventLoopCoroutinePrivate::timerEvent(QTimerEvent *event)
     }
 
     bool singleshot = watcher->singleshot;
-    if (singleshot && watchers.contains(watcherId)) {
-        watchers.remove(watcherId);
+    if (singleshot) {
+        watchers.take(watcherId);
         timers.remove(event->timerId());
         helper->killTimer(event->timerId());
     }
@@ -304,10 +301,14 @@ void QtEventLoopCoroutinePrivate::timerEvent(QTimerEvent *event)
 int QtEventLoopCoroutinePrivate::callLater(quint32 msecs, Functor *callback)
 {
     TimerWatcher *w = new TimerWatcher(msecs, true, callback);
+    int watcherId = watchers.insert(w);
+    if (!watcherId) {
+        delete w;
+        return 0;
+    }
     w->timerId = helper->startTimer(static_cast<int>(msecs), Qt::PreciseTimer);
-    watchers.insert(nextWatcherId, w);
-    timers.insert(w->timerId, nextWatcherId);
-    return nextWatcherId++;
+    timers.insert(w->timerId, watcherId);
+    return watcherId;
 }
 
 void QtEventLoopCoroutinePrivate::callLaterThreadSafe(quint32 msecs, Functor *callback)
@@ -319,10 +320,14 @@ void QtEventLoopCoroutinePrivate::callLaterThreadSafe(quint32 msecs, Functor *ca
 int QtEventLoopCoroutinePrivate::callRepeat(quint32 msecs, Functor *callback)
 {
     TimerWatcher *w = new TimerWatcher(msecs, false, callback);
+    int watcherId = watchers.insert(w);
+    if (!watcherId) {
+        delete w;
+        return 0;
+    }
     w->timerId = helper->startTimer(static_cast<int>(msecs));
-    watchers.insert(nextWatcherId, w);
-    timers.insert(w->timerId, nextWatcherId);
-    return nextWatcherId++;
+    timers.insert(w->timerId, watcherId);
+    return watcherId;
 }
 
 void QtEventLoopCoroutinePrivate::cancelCall(int callbackId)
@@ -393,6 +398,16 @@ int startQtLoop()
     }
 
     QSharedPointer<EventLoopCoroutine> eventLoop = currentLoop()->get();
+#ifdef QTNETWORKNG_USE_EPOLL
+    if (eventLoop.isNull() && isQtWithEpollPreferred()) {
+        eventLoop.reset(new QtEpollEventLoopCoroutine());
+        eventLoop->setObjectName(QString::fromLatin1("qt_epoll_eventloop_coroutine"));
+        currentLoop()->set(eventLoop);
+    }
+    if (dynamic_cast<QtEpollEventLoopCoroutine *>(eventLoop.data())) {
+        return startQtEpollLoop(eventLoop.data());
+    }
+#endif
     QtEventLoopCoroutine *qtEventLoop = nullptr;
     if (!eventLoop.isNull()) {
         qtEventLoop = dynamic_cast<QtEventLoopCoroutine *>(eventLoop.data());
@@ -1,6 +1,5 @@
-#include <QtCore/qmap.h>
-#include <QtCore/qmutex.h>
-#include <QtCore/qqueue.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qset.h>
 #include <QtCore/qpointer.h>
 #include <QtCore/qdebug.h>
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 7, 0))
@@ -65,9 +64,7 @@ IoWatcher::IoWatcher(EventLoopCoroutine::EventType event, qintptr fd)
 
 IoWatcher::~IoWatcher()
 {
-    if (callback) {
-        delete callback;
-    }
+    releaseFunctor(callback);
 }
 
 
@@ -79,7 +76,7 @@ TimerWatcher::TimerWatcher(quint32 interval, bool repeat, Functor *callback)
 
 TimerWatcher::~TimerWatcher()
 {
-    delete callback;
+    releaseFunctor(callback);
 }
 
 
@@ -102,6 +99,7 @@ public:
     virtual int exitCode() override;
     virtual bool runUntil(BaseCoroutine *coroutine) override;
     virtual void yield() override;
+    virtual void fillMetrics(EventLoopMetrics *metrics) override;
     void doCallLater();
 public:
     void updateIoMask(qintptr fd);
@@ -114,8 +112,8 @@ public:
     int addTimer(TimerWatcher *watcher);
     HWND internalHwnd;
 private:
-    QMap<int, WinWatcher*> watchers;
-    QMap<qintptr, QSet<IoWatcher *> > activeSockets;
+    WatcherTable<WinWatcher> watchers;
+    QHash<qintptr, QSet<IoWatcher *> > activeSockets;
 
     template <typename T>
     struct PriorityDataLess
@@ -126,13 +124,10 @@ private:
     std::priority_queue<TimerWatcher*,
         std::vector<TimerWatcher*>, PriorityDataLess<TimerWatcher*>> activeTimers;
 
-    QMutex mqMutex;
-    QQueue<TimerWatcher *> callLaterQueue;
+    CallLaterQueue callLaterQueue;
     QPointer<BaseCoroutine> loopCoroutine;
     QSharedPointer<QAtomicInt> interrupted;
     quint64 currentTimeStamp;
-    int nextWatcherId;
-    int padding;
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 7, 0))
     QElapsedTimer timer;
 #endif
@@ -146,7 +141,6 @@ WinEventLoopCoroutinePrivate::WinEventLoopCoroutinePrivate(EventLoopCoroutine *p
     : EventLoopCoroutinePrivate(parent)
     , internalHwnd(nullptr)
     , interrupted(new QAtomicInt(false))
-    , nextWatcherId(1)
 {
     createInternalWindow();
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 7, 0))
@@ -179,9 +173,8 @@ WinEventLoopCoroutinePrivate::~WinEventLoopCoroutinePrivate()
             activeTimers.pop();
         }
 
-        QMapIterator<int, WinWatcher*> watchersItor(watchers);
-        while (watchersItor.hasNext()) {
-            delete watchersItor.next().value();
+        for (WinWatcher *watcher: watchers.values()) {
+            delete watcher;
         }
         DestroyWindow(internalHwnd);
         PostQuitMessage(0);
@@ -207,7 +200,9 @@ void WinEventLoopCoroutinePrivate::run()
                 quint64 top_time = activeTimers.top()->at;
                 waittime = top_time > currentTimeStamp ? top_time - currentTimeStamp : 0;
             }
+            beforePoll();
             DWORD waitRet = MsgWaitForMultipleObjectsEx(nCount, pHandles, static_cast<quint32>(waittime), QS_ALLINPUT, MWMO_ALERTABLE | MWMO_INPUTAVAILABLE);
+            afterPoll();
             Q_UNUSED(waitRet);
             haveMessage = PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE);
             if (!haveMessage) {
@@ -232,10 +227,12 @@ int WinEventLoopCoroutinePrivate::createWatcher(EventLoopCoroutine::EventType ev
 {
     IoWatcher *watcher = new IoWatcher(event, fd);
     watcher->callback = callback;
-    int id = nextWatcherId++;
-    watcher->id = id;
-    watchers.insert(id, watcher);
-    return id;
+    watcher->id = watchers.insert(watcher, fd);
+    const int watcherId = watcher->id;
+    if (!watcherId) {
+        delete watcher;
+    }
+    return watcherId;
 }
 
 
@@ -303,7 +300,11 @@ struct TriggerIoWatchersFunctor: public Functor
     {
         IoWatcher *watcher = dynamic_cast<IoWatcher*>(eventloop->watchers.take(watcherId));
         if (watcher) {
-            (*watcher->callback)();
+            Functor *callback = watcher->callback;
+            if (callback->isBorrowed()) {
+                watcher->callback = nullptr;  // its owner may destroy it while it is running.
+            }
+            (*callback)();
             delete watcher;
         }
     }
@@ -327,9 +328,12 @@ int WinEventLoopCoroutinePrivate::addTimer(TimerWatcher *watcher)
     Q_ASSERT(!watcher->inUse); // Call addTimer self on watcher->callback ?
     int timerId = watcher->id;
     if (!timerId) {
-        timerId = nextWatcherId++;
+        timerId = watchers.insert(watcher);
+        if (!timerId) {
+            delete watcher;
+            return 0;
+        }
         watcher->id = timerId;
-        watchers.insert(timerId, watcher);
     }
     watcher->at = currentTimeStamp + watcher->interval;
     bool post = activeTimers.empty();
@@ -351,19 +355,19 @@ int WinEventLoopCoroutinePrivate::callLater(quint32 msecs, Functor *callback)
 
 void WinEventLoopCoroutinePrivate::doCallLater()
 {
-    QMutexLocker locker(&mqMutex);
-    while (!callLaterQueue.isEmpty()) {
-        TimerWatcher *watcher = callLaterQueue.dequeue();
-        addTimer(watcher);
+    callLaterQueue.clearWakeup();
+    quint32 msecs;
+    Functor *callback;
+    while (callLaterQueue.pop(&msecs, &callback)) {
+        callLater(msecs, callback);
     }
 }
 
 void WinEventLoopCoroutinePrivate::callLaterThreadSafe(quint32 msecs, Functor *callback)
 {
-    QMutexLocker locker(&mqMutex);
-    TimerWatcher *watcher = new TimerWatcher(msecs, false, callback);
-    callLaterQueue.enqueue(watcher);
-    PostMessage(internalHwnd, WM_QTNG_DO_CALL_LATER, 0, 0);
+    if (callLaterQueue.push(msecs, callback)) {
+        PostMessage(internalHwnd, WM_QTNG_DO_CALL_LATER, 0, 0);
+    }
 }
 
 
@@ -434,6 +438,13 @@ void WinEventLoopCoroutinePrivate::yield()
     }
 }
 
+void WinEventLoopCoroutinePrivate::fillMetrics(EventLoopMetrics *metrics)
+{
+    EventLoopCoroutinePrivate::fillMetrics(metrics);
+    metrics->watchers = watchers.size();
+    metrics->pendingThreadSafeCalls = callLaterQueue.size();
+}
+
 
 WinEventLoopCoroutine::WinEventLoopCoroutine()
     :EventLoopCoroutine(new WinEventLoopCoroutinePrivate(this))
@@ -482,7 +493,6 @@ LRESULT QT_WIN_CALLBACK evl_win_internal_proc(HWND hwnd, UINT message, WPARAM wp
     }
         break;
     case WM_QTNG_DO_CALL_LATER:
-        // TODO remove all WM_QTNG_DO_CALL_LATER messages.
         d->doCallLater();
         break;
     }
@@ -571,7 +581,7 @@ void WinEventLoopCoroutinePrivate::sendTimerEvent(TimerWatcher *watcher)
     }
 
     if (!watcher->repeat) {
-        watchers.remove(watcher->id);
+        watchers.take(watcher->id);
         watcher->id = 0;
     } else {
         addTimer(watcher);
@@ -595,18 +605,13 @@ void WinEventLoopCoroutinePrivate::sendIoEvent(qintptr fd, EventLoopCoroutine::E
         for (IoWatcher *watcher: activeSockets.value(fd)) {
             int id = watcher->id;
             (*watcher->callback)();
-            if (watchers.remove(id)) {
+            if (watchers.take(id)) {
                 delete watcher;
             }
         }
         activeSockets.remove(fd);
-        QMutableMapIterator<int, WinWatcher*> itor(watchers);
-        while (itor.hasNext()) {
-            IoWatcher *watcher = dynamic_cast<IoWatcher *>(itor.next().value());
-            if (Q_UNLIKELY(watcher && watcher->fd == fd)) {
-                itor.remove();
-                delete watcher;
-            }
+        for (int id: watchers.idsOfFd(fd)) {
+            delete watchers.take(id);
         }
     } else {
         for (IoWatcher *watcher: activeSockets.value(fd)) {
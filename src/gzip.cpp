@@ -1,29 +1,190 @@
 #include "../include/gzip.h"
+#include "../include/coroutine_utils.h"
+#include <string.h>
+#include <limits>
+#include <QtCore/qendian.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qthread.h>
+#include <QtCore/qthreadstorage.h>
 extern "C" {
 #include <zlib.h>
 }
+#if defined(QTNG_HAVE_ZLIB_NG) && !defined(ZLIBNG_VERSION)
+#error "QTNG_HAVE_ZLIB_NG is defined, but the zlib.h found is not the one of zlib-ng built with ZLIB_COMPAT."
+#endif
+#if !defined(QTNG_HAVE_ZLIB_NG) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QTNG_CRC32_PCLMUL
+#include <immintrin.h>
+#elif !defined(QTNG_HAVE_ZLIB_NG) && defined(__ARM_FEATURE_CRC32)
+#define QTNG_CRC32_ARM
+#include <arm_acle.h>
+#endif
 
 #define GZIP_WINDOWS_BIT (MAX_WBITS + 32)
+// deflate() can not detect the format, choose gzip.
+#define GZIP_COMPRESS_WINDOWS_BIT (MAX_WBITS + 16)
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
+static const qint32 DefaultInputBufferSize = 1024 * 8;
+static const qint32 DefaultOutputBufferSize = 1024 * 32;
+
+static z_stream *newZStream(bool deflating, int level, int windowBits)
+{
+    z_stream *zstream = new z_stream;
+    zstream->zalloc = nullptr;
+    zstream->zfree = nullptr;
+    zstream->opaque = nullptr;
+    zstream->avail_in = 0;
+    zstream->next_in = nullptr;
+    int ret;
+    if (deflating) {
+        ret = deflateInit2(zstream, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    } else {
+        ret = inflateInit2(zstream, windowBits);
+    }
+    if (ret != Z_OK) {
+        delete zstream;
+        return nullptr;
+    }
+    return zstream;
+}
+
+static void deleteZStream(z_stream *zstream, bool deflating)
+{
+    if (deflating) {
+        deflateEnd(zstream);
+    } else {
+        inflateEnd(zstream);
+    }
+    delete zstream;
+}
+
+// deflateInit2() allocates about 256KB for every stream, so the streams are reset and reused by one thread.
+class ZStreamPool
+{
+public:
+    ~ZStreamPool();
+public:
+    z_stream *acquire(bool deflating, int level, int windowBits);
+    void release(z_stream *zstream, bool deflating, int level, int windowBits);
+private:
+    static int key(bool deflating, int level, int windowBits)
+    {
+        return (deflating ? 0x10000 : 0) | ((level + 1) << 8) | (windowBits + 16);
+    }
+    QHash<int, QList<z_stream *>> streams;
+};
+
+ZStreamPool::~ZStreamPool()
+{
+    for (QHash<int, QList<z_stream *>>::const_iterator itor = streams.constBegin(); itor != streams.constEnd();
+         ++itor) {
+        for (z_stream *zstream : itor.value()) {
+            deleteZStream(zstream, itor.key() & 0x10000);
+        }
+    }
+}
+
+z_stream *ZStreamPool::acquire(bool deflating, int level, int windowBits)
+{
+    QList<z_stream *> &pool = streams[key(deflating, level, windowBits)];
+    if (!pool.isEmpty()) {
+        return pool.takeLast();
+    }
+    return newZStream(deflating, level, windowBits);
+}
+
+void ZStreamPool::release(z_stream *zstream, bool deflating, int level, int windowBits)
+{
+    const int MaxPooledStreams = 4;
+    QList<z_stream *> &pool = streams[key(deflating, level, windowBits)];
+    if (pool.size() < MaxPooledStreams && (deflating ? deflateReset(zstream) : inflateReset(zstream)) == Z_OK) {
+        pool.append(zstream);
+    } else {
+        deleteZStream(zstream, deflating);
+    }
+}
+
+// QThreadStorage deletes the pool while the thread exits.
+Q_GLOBAL_STATIC(QThreadStorage<ZStreamPool *>, zstreamPools)
+
+static ZStreamPool *currentZStreamPool()
+{
+    QThreadStorage<ZStreamPool *> *storage = zstreamPools();
+    if (!storage) {
+        return nullptr;  // the application is exiting.
+    }
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(new ZStreamPool());
+    }
+    return storage->localData();
+}
+
+static z_stream *acquireZStream(bool deflating, int level, int windowBits)
+{
+    ZStreamPool *pool = currentZStreamPool();
+    if (!pool) {
+        return newZStream(deflating, level, windowBits);
+    }
+    return pool->acquire(deflating, level, windowBits);
+}
+
+static void releaseZStream(z_stream *zstream, bool deflating, int level, int windowBits)
+{
+    if (!zstream) {
+        return;
+    }
+    ZStreamPool *pool = currentZStreamPool();
+    if (!pool) {
+        deleteZStream(zstream, deflating);
+    } else {
+        pool->release(zstream, deflating, level, windowBits);
+    }
+}
+
+static inline z_stream *acquireDeflate(int level, int windowBits)
+{
+    return acquireZStream(true, level, windowBits);
+}
+
+static inline void releaseDeflate(z_stream *zstream, int level, int windowBits)
+{
+    releaseZStream(zstream, true, level, windowBits);
+}
+
+static inline z_stream *acquireInflate(int windowBits)
+{
+    return acquireZStream(false, -1, windowBits);
+}
+
+static inline void releaseInflate(z_stream *zstream, int windowBits)
+{
+    releaseZStream(zstream, false, -1, windowBits);
+}
+
 class GzipCompressFilePrivate
 {
 public:
     GzipCompressFilePrivate(QSharedPointer<FileLike> backend, int level)
         : backend(backend)
         , level(qMax(-1, qMin(9, level)))
+        , inputBufferSize(DefaultInputBufferSize)
+        , outputBufferSize(DefaultOutputBufferSize)
         , hasError(false)
         , eof(false)
     {
+        zstream = acquireDeflate(this->level, GZIP_COMPRESS_WINDOWS_BIT);
     }
+    ~GzipCompressFilePrivate() { releaseDeflate(zstream, level, GZIP_COMPRESS_WINDOWS_BIT); }
 public:
     QSharedPointer<FileLike> backend;
     QByteArray buf;
-    z_stream zstream;
+    z_stream *zstream;  // null if failed to initialize.
     int level;
+    qint32 inputBufferSize;
+    qint32 outputBufferSize;
     bool hasError;
-    bool inited;
     bool eof;
 };
 
@@ -32,55 +193,74 @@ class GzipDecompressFilePrivate
 public:
     GzipDecompressFilePrivate(QSharedPointer<FileLike> backend)
         : backend(backend)
+        , windowBits(GZIP_WINDOWS_BIT)
+        , inputSize(0)
+        , inputBufferSize(DefaultInputBufferSize)
+        , outputBufferSize(DefaultOutputBufferSize)
         , hasError(false)
         , triedRawDeflate(false)
         , eof(false)
+        , finished(false)
     {
+        zstream = acquireInflate(windowBits);
     }
+    ~GzipDecompressFilePrivate() { releaseInflate(zstream, windowBits); }
+    bool switchToRawDeflate();
 public:
     QSharedPointer<FileLike> backend;
     QByteArray buf;
-    z_stream zstream;
+    QByteArray inBuf;  // read() inflates from it into the buffer of caller.
+    z_stream *zstream;  // null if failed to initialize.
+    int windowBits;
+    qint32 inputSize;
+    qint32 inputBufferSize;
+    qint32 outputBufferSize;
     bool hasError;
-    bool inited;
     bool triedRawDeflate;
     bool eof;
+    bool finished;  // got Z_STREAM_END.
 };
 
+bool GzipDecompressFilePrivate::switchToRawDeflate()
+{
+    triedRawDeflate = true;
+    releaseInflate(zstream, windowBits);
+    windowBits = -MAX_WBITS;
+    zstream = acquireInflate(windowBits);
+    return zstream != nullptr;
+}
+
 GzipCompressFile::GzipCompressFile(QSharedPointer<FileLike> backend, int level)
     : d_ptr(new GzipCompressFilePrivate(backend, level))
 {
-    Q_D(GzipCompressFile);
-    d->zstream.zalloc = nullptr;
-    d->zstream.zfree = nullptr;
-    d->zstream.opaque = nullptr;
-    d->zstream.avail_in = 0;
-    d->zstream.next_in = nullptr;
-    int ret = deflateInit2(&d->zstream, level, Z_DEFLATED, GZIP_WINDOWS_BIT, 8, Z_DEFAULT_STRATEGY);
-    d->inited = (ret == Z_OK);
 }
 
 GzipCompressFile::~GzipCompressFile()
 {
-    Q_D(GzipCompressFile);
-    if (d->inited) {
-        deflateEnd(&d->zstream);
-    }
     delete d_ptr;
 }
 
+void GzipCompressFile::setBufferSize(qint32 inputSize, qint32 outputSize)
+{
+    Q_D(GzipCompressFile);
+    d->inputBufferSize = qMax(64, inputSize);
+    d->outputBufferSize = qMax(64, outputSize);
+}
+
 qint32 GzipCompressFile::read(char *data, qint32 size)
 {
     Q_D(GzipCompressFile);
-    if (d->hasError || !d->inited) {
+    if (d->hasError || !d->zstream) {
         return -1;
     }
 
-    const int OutputBufferSize = 1024 * 32;
-    const int InputBufferSize = 1024 * 8;
+    QByteArray inBuf;
+    QByteArray outBuf;
     while (d->buf.size() < size && !d->eof) {
-        QByteArray inBuf(InputBufferSize, Qt::Uninitialized);
-        QByteArray outBuf(OutputBufferSize, Qt::Uninitialized);
+        if (inBuf.isEmpty()) {
+            inBuf.resize(d->inputBufferSize);
+            outBuf.resize(d->outputBufferSize);
+        }
 
         qint32 readBytes = d->backend->read(inBuf.data(), inBuf.size());
         if (readBytes < 0) {
@@ -89,25 +269,25 @@ qint32 GzipCompressFile::read(char *data, qint32 size)
         } else if (readBytes == 0) {
             d->eof = true;
         }
-        d->zstream.next_in = reinterpret_cast<Bytef *>(inBuf.data());
-        d->zstream.avail_in = static_cast<uint>(readBytes);
+        d->zstream->next_in = reinterpret_cast<Bytef *>(inBuf.data());
+        d->zstream->avail_in = static_cast<uint>(readBytes);
         do {
-            d->zstream.next_out = reinterpret_cast<Bytef *>(outBuf.data());
-            d->zstream.avail_out = static_cast<uint>(outBuf.size());
-            int ret = deflate(&d->zstream, readBytes > 0 ? Z_NO_FLUSH : Z_FINISH);
+            d->zstream->next_out = reinterpret_cast<Bytef *>(outBuf.data());
+            d->zstream->avail_out = static_cast<uint>(outBuf.size());
+            int ret = deflate(d->zstream, readBytes > 0 ? Z_NO_FLUSH : Z_FINISH);
             if (ret < 0 || ret == Z_NEED_DICT) {
                 d->hasError = true;
                 return -1;
             }
-            if (Q_UNLIKELY(d->zstream.avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
+            if (Q_UNLIKELY(d->zstream->avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
                 d->hasError = true;
                 return -1;
             }
-            int have = outBuf.size() - static_cast<int>(d->zstream.avail_out);
+            int have = outBuf.size() - static_cast<int>(d->zstream->avail_out);
             if (have > 0) {
                 d->buf.append(outBuf.data(), static_cast<qint32>(have));
             }
-        } while (d->zstream.avail_out == 0 || d->zstream.avail_in > 0);
+        } while (d->zstream->avail_out == 0 || d->zstream->avail_in > 0);
     }
     qint32 bytesToRead = qMin(size, d->buf.size());
     memcpy(data, d->buf.data(), bytesToRead);
@@ -118,35 +298,34 @@ qint32 GzipCompressFile::read(char *data, qint32 size)
 qint32 GzipCompressFile::write(const char *data, qint32 size)
 {
     Q_D(GzipCompressFile);
-    if (d->hasError || !d->inited) {
+    if (d->hasError || !d->zstream) {
         return -1;
     }
     if (Q_UNLIKELY(size == 0)) {
         return 0;
     }
 
-    const int OutputBufferSize = 1024 * 32;
-    QByteArray outBuf(OutputBufferSize, Qt::Uninitialized);
+    QByteArray outBuf(d->outputBufferSize, Qt::Uninitialized);
 
-    d->zstream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
-    d->zstream.avail_in = static_cast<uint>(size);
+    d->zstream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    d->zstream->avail_in = static_cast<uint>(size);
     do {
-        d->zstream.next_out = reinterpret_cast<Bytef *>(outBuf.data());
-        d->zstream.avail_out = static_cast<uint>(outBuf.size());
-        int ret = deflate(&d->zstream, size > 0 ? Z_NO_FLUSH : Z_FINISH);
+        d->zstream->next_out = reinterpret_cast<Bytef *>(outBuf.data());
+        d->zstream->avail_out = static_cast<uint>(outBuf.size());
+        int ret = deflate(d->zstream, size > 0 ? Z_NO_FLUSH : Z_FINISH);
         if (ret < 0 || ret == Z_NEED_DICT) {
             d->hasError = true;
             return -1;
         }
-        if (Q_UNLIKELY(d->zstream.avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
+        if (Q_UNLIKELY(d->zstream->avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
             d->hasError = true;
             return -1;
         }
-        int have = outBuf.size() - static_cast<int>(d->zstream.avail_out);
+        int have = outBuf.size() - static_cast<int>(d->zstream->avail_out);
         if (have > 0) {
             d->buf.append(outBuf.data(), static_cast<qint32>(have));
         }
-    } while (d->zstream.avail_out == 0 || d->zstream.avail_in > 0);
+    } while (d->zstream->avail_out == 0 || d->zstream->avail_in > 0);
 
     qint32 bytesWritten = d->backend->write(d->buf.constData(), d->buf.size());
     bool success = (bytesWritten == d->buf.size());
@@ -161,137 +340,113 @@ qint32 GzipCompressFile::write(const char *data, qint32 size)
 GzipDecompressFile::GzipDecompressFile(QSharedPointer<FileLike> backend)
     : d_ptr(new GzipDecompressFilePrivate(backend))
 {
-    Q_D(GzipDecompressFile);
-    d->zstream.zalloc = nullptr;
-    d->zstream.zfree = nullptr;
-    d->zstream.opaque = nullptr;
-    d->zstream.avail_in = 0;
-    d->zstream.next_in = nullptr;
-    int ret = inflateInit2(&d->zstream, GZIP_WINDOWS_BIT);
-    d->inited = (ret == Z_OK);
 }
 
 GzipDecompressFile::~GzipDecompressFile()
+{
+    delete d_ptr;
+}
+
+void GzipDecompressFile::setBufferSize(qint32 inputSize, qint32 outputSize)
 {
     Q_D(GzipDecompressFile);
-    if (d->inited) {
-        deflateEnd(&d->zstream);
+    if (d->inBuf.isEmpty()) {
+        d->inputBufferSize = qMax(64, inputSize);
     }
-    delete d_ptr;
+    d->outputBufferSize = qMax(64, outputSize);
 }
 
 qint32 GzipDecompressFile::read(char *data, qint32 size)
 {
     Q_D(GzipDecompressFile);
-    if (d->hasError || !d->inited) {
+    if (d->hasError || !d->zstream) {
         return -1;
     }
-    const int OutputBufferSize = 1024 * 32;
-    const int InputBufferSize = 1024 * 8;
-    QByteArray inBuf(InputBufferSize, Qt::Uninitialized);
-    QByteArray outBuf(OutputBufferSize, Qt::Uninitialized);
+    if (size <= 0 || d->finished) {
+        return 0;
+    }
+    if (d->inBuf.isEmpty()) {
+        d->inBuf.resize(d->inputBufferSize);
+    }
 
-    while (d->buf.size() < size && !d->eof) {
-        qint32 readBytes = d->backend->read(inBuf.data(), inBuf.size());
-        if (readBytes < 0) {
-            return false;
-        } else if (readBytes == 0) {
-            d->eof = true;
-        }
-        d->zstream.next_in = reinterpret_cast<Bytef *>(inBuf.data());
-        d->zstream.avail_in = static_cast<uint>(readBytes);
-        do {
-            d->zstream.next_out = reinterpret_cast<Bytef *>(outBuf.data());
-            d->zstream.avail_out = static_cast<uint>(outBuf.size());
-            int ret = inflate(&d->zstream, readBytes > 0 ? Z_FULL_FLUSH : Z_FINISH);
-            if (ret == Z_DATA_ERROR && !d->triedRawDeflate) {
-                d->triedRawDeflate = true;
-                inflateEnd(&d->zstream);
-                d->zstream.zalloc = nullptr;
-                d->zstream.zfree = nullptr;
-                d->zstream.opaque = nullptr;
-                d->zstream.avail_in = 0;
-                d->zstream.next_in = nullptr;
-                ret = inflateInit2(&d->zstream, -MAX_WBITS);
-                if (ret != Z_OK) {
-                    d->inited = false;
-                    return -1;
-                } else {
-                    d->zstream.next_in = reinterpret_cast<Bytef *>(inBuf.data());
-                    d->zstream.avail_in = static_cast<uint>(readBytes);
-                    continue;
-                }
-            } else if (ret < 0 || ret == Z_NEED_DICT) {
+    d->zstream->next_out = reinterpret_cast<Bytef *>(data);
+    d->zstream->avail_out = static_cast<uint>(size);
+    while (d->zstream->avail_out == static_cast<uint>(size) && !d->finished) {
+        if (d->zstream->avail_in == 0 && !d->eof) {
+            qint32 readBytes = d->backend->read(d->inBuf.data(), d->inBuf.size());
+            if (readBytes < 0) {
                 d->hasError = true;
                 return -1;
+            } else if (readBytes == 0) {
+                d->eof = true;
             }
-            if (Q_UNLIKELY(d->zstream.avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
-                d->hasError = true;
+            d->inputSize = readBytes;
+            d->zstream->next_in = reinterpret_cast<Bytef *>(d->inBuf.data());
+            d->zstream->avail_in = static_cast<uint>(readBytes);
+        }
+        int ret = inflate(d->zstream, d->eof ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_DATA_ERROR && !d->triedRawDeflate) {
+            // only the first block is tried, so it is still in the input buffer.
+            if (!d->switchToRawDeflate()) {
                 return -1;
             }
-            d->triedRawDeflate = true;
-            int have = outBuf.size() - static_cast<int>(d->zstream.avail_out);
-            if (have > 0) {
-                d->buf.append(outBuf.data(), have);
-            }
-        } while (d->zstream.avail_out == 0 || d->zstream.avail_in > 0);
+            d->zstream->next_in = reinterpret_cast<Bytef *>(d->inBuf.data());
+            d->zstream->avail_in = static_cast<uint>(d->inputSize);
+            d->zstream->next_out = reinterpret_cast<Bytef *>(data);
+            d->zstream->avail_out = static_cast<uint>(size);
+            continue;
+        } else if (ret == Z_STREAM_END) {
+            d->finished = true;
+        } else if (ret < 0 || ret == Z_NEED_DICT) {
+            // Z_BUF_ERROR is returned if the input ends before Z_STREAM_END.
+            d->hasError = true;
+            return -1;
+        }
+        d->triedRawDeflate = true;
     }
-    qint32 bytesToRead = qMin(size, d->buf.size());
-    memcpy(data, d->buf.data(), bytesToRead);
-    d->buf.remove(0, bytesToRead);
-    return bytesToRead;
+    return size - static_cast<qint32>(d->zstream->avail_out);
 }
 
 qint32 GzipDecompressFile::write(const char *data, qint32 size)
 {
     Q_D(GzipDecompressFile);
-    if (d->hasError || !d->inited) {
+    if (d->hasError || !d->zstream) {
         return -1;
     }
     if (Q_UNLIKELY(size == 0)) {
         return 0;
     }
 
-    const int OutputBufferSize = 1024 * 32;
-    QByteArray outBuf(OutputBufferSize, Qt::Uninitialized);
+    QByteArray outBuf(d->outputBufferSize, Qt::Uninitialized);
 
-    d->zstream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
-    d->zstream.avail_in = static_cast<uint>(size);
+    d->zstream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    d->zstream->avail_in = static_cast<uint>(size);
     do {
-        d->zstream.next_out = reinterpret_cast<Bytef *>(outBuf.data());
-        d->zstream.avail_out = static_cast<uint>(outBuf.size());
-        int ret = inflate(&d->zstream, size > 0 ? Z_FULL_FLUSH : Z_FINISH);
+        d->zstream->next_out = reinterpret_cast<Bytef *>(outBuf.data());
+        d->zstream->avail_out = static_cast<uint>(outBuf.size());
+        int ret = inflate(d->zstream, size > 0 ? Z_FULL_FLUSH : Z_FINISH);
         if (ret == Z_DATA_ERROR && !d->triedRawDeflate) {
-            d->triedRawDeflate = true;
-            inflateEnd(&d->zstream);
-            d->zstream.zalloc = nullptr;
-            d->zstream.zfree = nullptr;
-            d->zstream.opaque = nullptr;
-            d->zstream.avail_in = 0;
-            d->zstream.next_in = nullptr;
-            int ret = inflateInit2(&d->zstream, -MAX_WBITS);
-            if (ret != Z_OK) {
-                d->inited = false;
+            if (!d->switchToRawDeflate()) {
                 return -1;
             } else {
-                d->zstream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
-                d->zstream.avail_in = static_cast<uint>(size);
+                d->zstream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+                d->zstream->avail_in = static_cast<uint>(size);
                 continue;
             }
         } else if (ret < 0 || ret == Z_NEED_DICT) {
             d->hasError = true;
             return -1;
         }
-        if (Q_UNLIKELY(d->zstream.avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
+        if (Q_UNLIKELY(d->zstream->avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
             d->hasError = true;
             return -1;
         }
         d->triedRawDeflate = true;
-        int have = outBuf.size() - static_cast<int>(d->zstream.avail_out);
+        int have = outBuf.size() - static_cast<int>(d->zstream->avail_out);
         if (have > 0) {
             d->buf.append(outBuf.data(), have);
         }
-    } while (d->zstream.avail_out == 0 || d->zstream.avail_in > 0);
+    } while (d->zstream->avail_out == 0 || d->zstream->avail_in > 0);
 
     qint32 bytesWritten = d->backend->write(d->buf.constData(), d->buf.size());
     bool success = (bytesWritten == d->buf.size());
@@ -303,129 +458,690 @@ qint32 GzipDecompressFile::write(const char *data, qint32 size)
     }
 }
 
-bool qGzipCompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> output, int level)
+static bool compressFile(QSharedPointer<FileLike> input, QSharedPointer<FileLike> output, int level, int windowBits)
 {
     if (input.isNull() || output.isNull()) {
         return false;
     }
 
-    const int OutputBufferSize = 1024 * 32;
-    const int InputBufferSize = 1024 * 8;
-
     level = qMax(-1, qMin(9, level));
-    z_stream zstream;
-    zstream.zalloc = nullptr;
-    zstream.zfree = nullptr;
-    zstream.opaque = nullptr;
-    zstream.avail_in = 0;
-    zstream.next_in = nullptr;
-
-    int ret = deflateInit2(&zstream, level, Z_DEFLATED, GZIP_WINDOWS_BIT, 8, Z_DEFAULT_STRATEGY);
-
-    if (ret != Z_OK) {
+    z_stream *zstream = acquireDeflate(level, windowBits);
+    if (!zstream) {
         return false;
     }
 
-    QByteArray inBuf(InputBufferSize, Qt::Uninitialized);
-    QByteArray outBuf(OutputBufferSize, Qt::Uninitialized);
+    QByteArray inBuf(DefaultInputBufferSize, Qt::Uninitialized);
+    QByteArray outBuf(DefaultOutputBufferSize, Qt::Uninitialized);
     qint32 readBytes = 0;
+    int ret = Z_OK;
     do {
         readBytes = input->read(inBuf.data(), inBuf.size());
         if (readBytes < 0) {
+            releaseDeflate(zstream, level, windowBits);
             return false;
         }
-        zstream.next_in = reinterpret_cast<Bytef *>(inBuf.data());
-        zstream.avail_in = static_cast<uint>(readBytes);
+        zstream->next_in = reinterpret_cast<Bytef *>(inBuf.data());
+        zstream->avail_in = static_cast<uint>(readBytes);
         do {
-            zstream.next_out = reinterpret_cast<Bytef *>(outBuf.data());
-            zstream.avail_out = static_cast<uint>(outBuf.size());
-            ret = deflate(&zstream, readBytes > 0 ? Z_NO_FLUSH : Z_FINISH);
+            zstream->next_out = reinterpret_cast<Bytef *>(outBuf.data());
+            zstream->avail_out = static_cast<uint>(outBuf.size());
+            ret = deflate(zstream, readBytes > 0 ? Z_NO_FLUSH : Z_FINISH);
             if (ret < 0 || ret == Z_NEED_DICT) {
-                deflateEnd(&zstream);
+                releaseDeflate(zstream, level, windowBits);
                 return false;
             }
-            if (Q_UNLIKELY(zstream.avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
-                deflateEnd(&zstream);
+            if (Q_UNLIKELY(zstream->avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
+                releaseDeflate(zstream, level, windowBits);
                 return false;
             }
-            int have = outBuf.size() - static_cast<int>(zstream.avail_out);
+            int have = outBuf.size() - static_cast<int>(zstream->avail_out);
             if (have > 0) {
                 output->write(outBuf.data(), static_cast<qint32>(have));
             }
-        } while (zstream.avail_out == 0 || zstream.avail_in > 0);
+        } while (zstream->avail_out == 0 || zstream->avail_in > 0);
     } while (readBytes > 0);
-    deflateEnd(&zstream);
+    releaseDeflate(zstream, level, windowBits);
     return (ret == Z_STREAM_END);
 }
 
+bool qGzipCompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> output, int level)
+{
+    return compressFile(input, output, level, GZIP_COMPRESS_WINDOWS_BIT);
+}
+
+bool qDeflateCompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> output, int level)
+{
+    return compressFile(input, output, level, MAX_WBITS);
+}
+
 bool qGzipDecompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> output)
 {
     if (input.isNull() || output.isNull()) {
         return false;
     }
-    const int OutputBufferSize = 1024 * 32;
-    const int InputBufferSize = 1024 * 8;
-
-    z_stream zstream;
-    zstream.zalloc = nullptr;
-    zstream.zfree = nullptr;
-    zstream.opaque = nullptr;
-    zstream.avail_in = 0;
-    zstream.next_in = nullptr;
 
-    int ret = inflateInit2(&zstream, GZIP_WINDOWS_BIT);
-    if (ret != Z_OK) {
+    int windowBits = GZIP_WINDOWS_BIT;
+    z_stream *zstream = acquireInflate(windowBits);
+    if (!zstream) {
         return false;
     }
 
-    QByteArray inBuf(InputBufferSize, Qt::Uninitialized);
-    QByteArray outBuf(OutputBufferSize, Qt::Uninitialized);
+    QByteArray inBuf(DefaultInputBufferSize, Qt::Uninitialized);
+    QByteArray outBuf(DefaultOutputBufferSize, Qt::Uninitialized);
     qint32 readBytes = 0;
     bool triedRawDeflate = false;
+    int ret = Z_OK;
     do {
         readBytes = input->read(inBuf.data(), inBuf.size());
         if (readBytes < 0) {
+            releaseInflate(zstream, windowBits);
             return false;
         }
-        zstream.next_in = reinterpret_cast<Bytef *>(inBuf.data());
-        zstream.avail_in = static_cast<uint>(readBytes);
+        zstream->next_in = reinterpret_cast<Bytef *>(inBuf.data());
+        zstream->avail_in = static_cast<uint>(readBytes);
         do {
-            zstream.next_out = reinterpret_cast<Bytef *>(outBuf.data());
-            zstream.avail_out = static_cast<uint>(outBuf.size());
-            ret = inflate(&zstream, readBytes > 0 ? Z_FULL_FLUSH : Z_FINISH);
+            zstream->next_out = reinterpret_cast<Bytef *>(outBuf.data());
+            zstream->avail_out = static_cast<uint>(outBuf.size());
+            ret = inflate(zstream, readBytes > 0 ? Z_FULL_FLUSH : Z_FINISH);
             if (ret == Z_DATA_ERROR && !triedRawDeflate) {
                 triedRawDeflate = true;
-                inflateEnd(&zstream);
-                zstream.zalloc = nullptr;
-                zstream.zfree = nullptr;
-                zstream.opaque = nullptr;
-                zstream.avail_in = 0;
-                zstream.next_in = nullptr;
-                int ret = inflateInit2(&zstream, -MAX_WBITS);
-                if (ret != Z_OK) {
+                releaseInflate(zstream, windowBits);
+                windowBits = -MAX_WBITS;
+                zstream = acquireInflate(windowBits);
+                if (!zstream) {
                     return false;
                 } else {
-                    zstream.next_in = reinterpret_cast<Bytef *>(inBuf.data());
-                    zstream.avail_in = static_cast<uint>(readBytes);
+                    zstream->next_in = reinterpret_cast<Bytef *>(inBuf.data());
+                    zstream->avail_in = static_cast<uint>(readBytes);
                     continue;
                 }
             } else if (ret < 0 || ret == Z_NEED_DICT) {
-                deflateEnd(&zstream);
+                releaseInflate(zstream, windowBits);
                 return false;
             }
-            if (Q_UNLIKELY(zstream.avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
-                deflateEnd(&zstream);
+            if (Q_UNLIKELY(zstream->avail_out > static_cast<uint>(outBuf.size()))) {  // is this possible?
+                releaseInflate(zstream, windowBits);
                 return false;
             }
             triedRawDeflate = true;
-            int have = outBuf.size() - static_cast<int>(zstream.avail_out);
+            int have = outBuf.size() - static_cast<int>(zstream->avail_out);
             if (have > 0) {
                 output->write(outBuf.data(), static_cast<qint32>(have));
             }
-        } while (zstream.avail_out == 0 || zstream.avail_in > 0);
+        } while (zstream->avail_out == 0 || zstream->avail_in > 0);
     } while (readBytes > 0 && ret != Z_STREAM_END);
-    deflateEnd(&zstream);
+    releaseInflate(zstream, windowBits);
     return (ret == Z_STREAM_END);
 }
 
+static QByteArray compressBytes(const QByteArray &data, int level, int windowBits)
+{
+    level = qMax(-1, qMin(9, level));
+    z_stream *zstream = acquireDeflate(level, windowBits);
+    if (!zstream) {
+        return QByteArray();
+    }
+    // deflateBound() is enough for Z_FINISH, so deflate() is called once.
+    const uLong bound = deflateBound(zstream, static_cast<uLong>(data.size()));
+    if (bound > static_cast<uLong>(std::numeric_limits<int>::max())) {
+        releaseDeflate(zstream, level, windowBits);
+        return QByteArray();
+    }
+    QByteArray compressed(static_cast<int>(bound), Qt::Uninitialized);
+    zstream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    zstream->avail_in = static_cast<uint>(data.size());
+    zstream->next_out = reinterpret_cast<Bytef *>(compressed.data());
+    zstream->avail_out = static_cast<uint>(compressed.size());
+    int ret = deflate(zstream, Z_FINISH);
+    const int used = compressed.size() - static_cast<int>(zstream->avail_out);
+    releaseDeflate(zstream, level, windowBits);
+    if (ret != Z_STREAM_END) {
+        return QByteArray();
+    }
+    compressed.resize(used);
+    return compressed;
+}
+
+QByteArray qGzipCompress(const QByteArray &data, int level)
+{
+    return compressBytes(data, level, GZIP_COMPRESS_WINDOWS_BIT);
+}
+
+QByteArray qDeflateCompress(const QByteArray &data, int level)
+{
+    return compressBytes(data, level, MAX_WBITS);
+}
+
+// returns Z_STREAM_END, Z_DATA_ERROR or Z_BUF_ERROR which means truncated or too large.
+static int decompressBytes(z_stream *zstream, const QByteArray &compressed, QByteArray *data, int maxSize)
+{
+    // one more byte to tell the data of maxSize from the larger one.
+    const int limit = maxSize < std::numeric_limits<int>::max() ? maxSize + 1 : maxSize;
+    data->resize(static_cast<int>(qMin<qint64>(limit, static_cast<qint64>(compressed.size()) * 4 + 64)));
+    zstream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.constData()));
+    zstream->avail_in = static_cast<uint>(compressed.size());
+    int used = 0;
+    while (true) {
+        zstream->next_out = reinterpret_cast<Bytef *>(data->data()) + used;
+        zstream->avail_out = static_cast<uint>(data->size() - used);
+        int ret = inflate(zstream, Z_FINISH);
+        used = data->size() - static_cast<int>(zstream->avail_out);
+        if (ret == Z_STREAM_END) {
+            data->resize(used);
+            return used > maxSize ? Z_BUF_ERROR : Z_STREAM_END;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            return Z_DATA_ERROR;
+        } else if (zstream->avail_out > 0 || data->size() >= limit) {
+            // the input is truncated, or the output is larger than maxSize.
+            return Z_BUF_ERROR;
+        }
+        data->resize(static_cast<int>(qMin<qint64>(limit, static_cast<qint64>(data->size()) * 2)));
+    }
+}
+
+bool qGzipDecompress(const QByteArray &compressed, QByteArray *data, int maxSize)
+{
+    if (maxSize < 0) {
+        maxSize = std::numeric_limits<int>::max() - 1;
+    }
+    z_stream *zstream = acquireInflate(GZIP_WINDOWS_BIT);
+    if (!zstream) {
+        return false;
+    }
+    int ret = decompressBytes(zstream, compressed, data, maxSize);
+    releaseInflate(zstream, GZIP_WINDOWS_BIT);
+    if (ret == Z_DATA_ERROR) {
+        // some servers send the raw deflate as "deflate".
+        zstream = acquireInflate(-MAX_WBITS);
+        if (!zstream) {
+            return false;
+        }
+        ret = decompressBytes(zstream, compressed, data, maxSize);
+        releaseInflate(zstream, -MAX_WBITS);
+    }
+    if (ret != Z_STREAM_END) {
+        data->clear();
+        return false;
+    }
+    return true;
+}
+
+#ifdef QTNG_CRC32_PCLMUL
+// folds 64 bytes at a time by carry-less multiplication, then reduces to 32 bits by barrett, as "fast crc computation
+// for generic polynomials using PCLMULQDQ" of intel. size is a multiple of 16 and not less than 64, and crc is inverted
+// by the caller.
+__attribute__((target("pclmul,sse4.1"))) static quint32 crc32Pclmul(const uchar *buf, qint64 size, quint32 crc)
+{
+    alignas(16) static const quint64 k1k2[] = { Q_UINT64_C(0x0154442bd4), Q_UINT64_C(0x01c6e41596) };
+    alignas(16) static const quint64 k3k4[] = { Q_UINT64_C(0x01751997d0), Q_UINT64_C(0x00ccaa009e) };
+    alignas(16) static const quint64 k5k0[] = { Q_UINT64_C(0x0163cd6124), Q_UINT64_C(0x0000000000) };
+    alignas(16) static const quint64 poly[] = { Q_UINT64_C(0x01db710641), Q_UINT64_C(0x01f7011641) };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+    buf += 64;
+    size -= 64;
+    while (size >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30)));
+        buf += 64;
+        size -= 64;
+    }
+
+    // fold the four lanes into one.
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+    while (size >= 16) {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        size -= 16;
+    }
+
+    // 128 bits to 64 bits.
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // barrett reduction to 32 bits.
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return static_cast<quint32>(_mm_extract_epi32(x1, 1));
+}
+
+static bool hasPclmul()
+{
+    static const bool has = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    return has;
+}
+#endif
+
+quint32 qCrc32(const char *data, qint64 size, quint32 crc)
+{
+    const uchar *buf = reinterpret_cast<const uchar *>(data);
+    if (!buf || size <= 0) {
+        return crc;
+    }
+#if defined(QTNG_CRC32_PCLMUL)
+    if (size >= 64 && hasPclmul()) {
+        const qint64 folded = size & ~static_cast<qint64>(15);
+        crc = ~crc32Pclmul(buf, folded, ~crc);
+        buf += folded;
+        size -= folded;
+    }
+#elif defined(QTNG_CRC32_ARM)
+    crc = ~crc;
+    for (; size >= 8; buf += 8, size -= 8) {
+        quint64 word;
+        memcpy(&word, buf, 8);
+        crc = __crc32d(crc, word);
+    }
+    for (; size > 0; ++buf, --size) {
+        crc = __crc32b(crc, *buf);
+    }
+    return ~crc;
+#endif
+    // the tail, or all of it without the instructions. the length of zlib is uInt.
+    while (size > 0) {
+        const uInt n = static_cast<uInt>(qMin<qint64>(size, 1 << 30));
+        crc = static_cast<quint32>(crc32(crc, buf, n));
+        buf += n;
+        size -= n;
+    }
+    return crc;
+}
+
+namespace {
+
+struct ParallelGzipBlock
+{
+    QByteArray input;
+    QByteArray dictionary;  // the last 32KB of input before this block.
+    int level;
+    bool last;
+};
+
+struct ParallelGzipResult
+{
+    ParallelGzipResult()
+        : crc(0)
+        , ok(false)
+    {
+    }
+    QByteArray output;
+    uLong crc;
+    bool ok;
+};
+
+// runs in the threads of pool. every block is a raw deflate stream ended by Z_SYNC_FLUSH, which ends at the byte
+// boundary, so the blocks are joined as one stream. the last block is ended by Z_FINISH.
+ParallelGzipResult compressBlock(ParallelGzipBlock block)
+{
+    ParallelGzipResult result;
+    z_stream *zstream = acquireDeflate(block.level, -MAX_WBITS);
+    if (!zstream) {
+        return result;
+    }
+    if (!block.dictionary.isEmpty()
+        && deflateSetDictionary(zstream, reinterpret_cast<const Bytef *>(block.dictionary.constData()),
+                                static_cast<uInt>(block.dictionary.size()))
+                != Z_OK) {
+        releaseDeflate(zstream, block.level, -MAX_WBITS);
+        return result;
+    }
+    // the sync flush adds an empty stored block.
+    result.output.resize(static_cast<int>(deflateBound(zstream, static_cast<uLong>(block.input.size()))) + 16);
+    zstream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(block.input.constData()));
+    zstream->avail_in = static_cast<uint>(block.input.size());
+    int used = 0;
+    while (true) {
+        zstream->next_out = reinterpret_cast<Bytef *>(result.output.data()) + used;
+        zstream->avail_out = static_cast<uint>(result.output.size() - used);
+        int ret = deflate(zstream, block.last ? Z_FINISH : Z_SYNC_FLUSH);
+        used = result.output.size() - static_cast<int>(zstream->avail_out);
+        if (ret < 0 && ret != Z_BUF_ERROR) {
+            releaseDeflate(zstream, block.level, -MAX_WBITS);
+            return result;
+        }
+        if (zstream->avail_out > 0 && (!block.last || ret == Z_STREAM_END)) {
+            break;
+        }
+        result.output.resize(result.output.size() * 2);
+    }
+    releaseDeflate(zstream, block.level, -MAX_WBITS);
+    result.output.resize(used);
+    result.crc = qCrc32(block.input);
+    result.ok = true;
+    return result;
+}
+
+}  // anonymous namespace
+
+class ParallelGzipCompressFilePrivate
+{
+public:
+    ParallelGzipCompressFilePrivate(QSharedPointer<FileLike> backend, int level, QSharedPointer<ThreadPool> pool)
+        : backend(backend)
+        , pool(pool)
+        , crc(crc32(0L, nullptr, 0))
+        , inputSize(0)
+        , blockSize(1024 * 128)
+        , level(qMax(-1, qMin(9, level)))
+        , started(false)
+        , finished(false)
+        , hasError(false)
+    {
+        if (this->pool.isNull()) {
+            this->pool.reset(new ThreadPool());
+        }
+    }
+    bool readBlock(QByteArray *block);
+    bool compressBlocks();
+public:
+    QSharedPointer<FileLike> backend;
+    QSharedPointer<ThreadPool> pool;
+    QByteArray buf;  // the compressed bytes not read.
+    QByteArray nextBlock;  // read ahead to know which block is the last one.
+    QByteArray dictionary;
+    uLong crc;
+    quint32 inputSize;  // modulo 2^32, as the ISIZE of gzip.
+    qint32 blockSize;
+    int level;
+    bool started;
+    bool finished;
+    bool hasError;
+};
+
+bool ParallelGzipCompressFilePrivate::readBlock(QByteArray *block)
+{
+    block->resize(blockSize);
+    qint32 total = 0;
+    while (total < blockSize) {
+        qint32 readBytes = backend->read(block->data() + total, blockSize - total);
+        if (readBytes < 0) {
+            return false;
+        } else if (readBytes == 0) {
+            break;
+        }
+        total += readBytes;
+    }
+    block->resize(total);
+    return true;
+}
+
+bool ParallelGzipCompressFilePrivate::compressBlocks()
+{
+    const int DictionarySize = 1024 * 32;
+    if (!started) {
+        // the gzip header without file name and modification time.
+        static const char header[] = { '\x1f', '\x8b', '\x08', '\x00', '\x00', '\x00', '\x00', '\x00', '\x00', '\xff' };
+        buf.append(header, sizeof(header));
+        started = true;
+        if (!readBlock(&nextBlock)) {
+            return false;
+        }
+    }
+    // two blocks for every thread, so the threads are busy while the results are joined.
+    const int batchSize = qMax(1, QThread::idealThreadCount()) * 2;
+    QList<ParallelGzipBlock> blocks;
+    while (blocks.size() < batchSize) {
+        ParallelGzipBlock block;
+        block.input = nextBlock;
+        block.dictionary = dictionary;
+        block.level = level;
+        if (!readBlock(&nextBlock)) {
+            return false;
+        }
+        block.last = nextBlock.isEmpty();
+        if (block.input.size() >= DictionarySize) {
+            dictionary = block.input.right(DictionarySize);
+        } else {
+            dictionary = (dictionary + block.input).right(DictionarySize);
+        }
+        blocks.append(block);
+        if (block.last) {
+            break;
+        }
+    }
+
+    std::function<ParallelGzipResult(ParallelGzipBlock)> f = compressBlock;
+    const QList<ParallelGzipResult> &results = pool->map(f, blocks);
+    if (results.size() != blocks.size()) {
+        return false;
+    }
+    for (int i = 0; i < results.size(); ++i) {
+        const ParallelGzipResult &result = results.at(i);
+        if (!result.ok) {
+            return false;
+        }
+        const int size = blocks.at(i).input.size();
+        buf.append(result.output);
+        crc = crc32_combine(crc, result.crc, static_cast<z_off_t>(size));
+        inputSize += static_cast<quint32>(size);
+    }
+    if (blocks.last().last) {
+        uchar trailer[8];
+        qToLittleEndian<quint32>(static_cast<quint32>(crc), trailer);
+        qToLittleEndian<quint32>(inputSize, trailer + 4);
+        buf.append(reinterpret_cast<char *>(trailer), sizeof(trailer));
+        finished = true;
+    }
+    return true;
+}
+
+ParallelGzipCompressFile::ParallelGzipCompressFile(QSharedPointer<FileLike> backend, int level,
+                                                   QSharedPointer<ThreadPool> pool)
+    : d_ptr(new ParallelGzipCompressFilePrivate(backend, level, pool))
+{
+}
+
+ParallelGzipCompressFile::~ParallelGzipCompressFile()
+{
+    delete d_ptr;
+}
+
+void ParallelGzipCompressFile::setBlockSize(qint32 blockSize)
+{
+    Q_D(ParallelGzipCompressFile);
+    if (!d->started) {
+        d->blockSize = qMax(1024 * 32, blockSize);
+    }
+}
+
+qint32 ParallelGzipCompressFile::read(char *data, qint32 size)
+{
+    Q_D(ParallelGzipCompressFile);
+    if (d->hasError) {
+        return -1;
+    }
+    while (d->buf.size() < size && !d->finished) {
+        if (!d->compressBlocks()) {
+            d->hasError = true;
+            return -1;
+        }
+    }
+    qint32 bytesToRead = qMin(size, d->buf.size());
+    memcpy(data, d->buf.constData(), static_cast<size_t>(bytesToRead));
+    d->buf.remove(0, bytesToRead);
+    return bytesToRead;
+}
+
+qint32 ParallelGzipCompressFile::write(const char *, qint32)
+{
+    return -1;
+}
+
+// every flushed packet ends with this empty stored block, which is not sent.
+static const char SyncFlushTail[] = {'\x00', '\x00', '\xff', '\xff'};
+
+class PacketCompressorPrivate
+{
+public:
+    z_stream zstream;
+    bool inited;
+    bool hasError;
+};
+
+PacketCompressor::PacketCompressor(int level)
+    : d_ptr(new PacketCompressorPrivate)
+{
+    Q_D(PacketCompressor);
+    d->zstream.zalloc = nullptr;
+    d->zstream.zfree = nullptr;
+    d->zstream.opaque = nullptr;
+    d->zstream.avail_in = 0;
+    d->zstream.next_in = nullptr;
+    level = qMax(-1, qMin(9, level));
+    // the raw deflate without header and checksum, as every packet is small.
+    int ret = deflateInit2(&d->zstream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    d->inited = (ret == Z_OK);
+    d->hasError = false;
+}
+
+PacketCompressor::~PacketCompressor()
+{
+    Q_D(PacketCompressor);
+    if (d->inited) {
+        deflateEnd(&d->zstream);
+    }
+    delete d_ptr;
+}
+
+bool PacketCompressor::compress(const QByteArray &packet, QByteArray *compressed)
+{
+    Q_D(PacketCompressor);
+    if (!d->inited || d->hasError) {
+        return false;
+    }
+    compressed->resize(static_cast<int>(deflateBound(&d->zstream, static_cast<uLong>(packet.size()))) + 16);
+    d->zstream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(packet.constData()));
+    d->zstream.avail_in = static_cast<uint>(packet.size());
+    int used = 0;
+    while (true) {
+        d->zstream.next_out = reinterpret_cast<Bytef *>(compressed->data()) + used;
+        d->zstream.avail_out = static_cast<uint>(compressed->size() - used);
+        int ret = deflate(&d->zstream, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            d->hasError = true;
+            return false;
+        }
+        used = compressed->size() - static_cast<int>(d->zstream.avail_out);
+        if (d->zstream.avail_out > 0) {
+            break;
+        }
+        compressed->resize(compressed->size() * 2);
+    }
+    if (used < 4 || memcmp(compressed->constData() + used - 4, SyncFlushTail, 4) != 0) {
+        d->hasError = true;
+        return false;
+    }
+    compressed->resize(used - 4);
+    return true;
+}
+
+class PacketDecompressorPrivate
+{
+public:
+    z_stream zstream;
+    bool inited;
+    bool hasError;
+};
+
+PacketDecompressor::PacketDecompressor()
+    : d_ptr(new PacketDecompressorPrivate)
+{
+    Q_D(PacketDecompressor);
+    d->zstream.zalloc = nullptr;
+    d->zstream.zfree = nullptr;
+    d->zstream.opaque = nullptr;
+    d->zstream.avail_in = 0;
+    d->zstream.next_in = nullptr;
+    int ret = inflateInit2(&d->zstream, -MAX_WBITS);
+    d->inited = (ret == Z_OK);
+    d->hasError = false;
+}
+
+PacketDecompressor::~PacketDecompressor()
+{
+    Q_D(PacketDecompressor);
+    if (d->inited) {
+        inflateEnd(&d->zstream);
+    }
+    delete d_ptr;
+}
+
+bool PacketDecompressor::decompress(const QByteArray &compressed, QByteArray *packet, int maxSize)
+{
+    Q_D(PacketDecompressor);
+    if (!d->inited || d->hasError) {
+        return false;
+    }
+    QByteArray input;
+    input.reserve(compressed.size() + 4);
+    input.append(compressed);
+    input.append(SyncFlushTail, 4);
+    d->zstream.next_in = reinterpret_cast<Bytef *>(input.data());
+    d->zstream.avail_in = static_cast<uint>(input.size());
+    // one more byte to tell the packet of maxSize from the larger one.
+    const int limit = maxSize + 1;
+    packet->resize(qMin(limit, compressed.size() * 4 + 64));
+    int used = 0;
+    while (true) {
+        d->zstream.next_out = reinterpret_cast<Bytef *>(packet->data()) + used;
+        d->zstream.avail_out = static_cast<uint>(packet->size() - used);
+        int ret = inflate(&d->zstream, Z_SYNC_FLUSH);
+        if ((ret != Z_OK && ret != Z_BUF_ERROR) || (ret == Z_BUF_ERROR && d->zstream.avail_out > 0)) {
+            d->hasError = true;
+            return false;
+        }
+        used = packet->size() - static_cast<int>(d->zstream.avail_out);
+        if (used > maxSize) {
+            d->hasError = true;
+            return false;
+        }
+        if (d->zstream.avail_in == 0 && d->zstream.avail_out > 0) {
+            break;
+        }
+        if (d->zstream.avail_out == 0) {
+            packet->resize(qMin(limit, packet->size() * 2));
+        }
+    }
+    packet->resize(used);
+    return true;
+}
+
 QTNETWORKNG_NAMESPACE_END
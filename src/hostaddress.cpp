@@ -807,9 +807,164 @@ static bool parseIp6(const QString &address, IPv6Address &addr, QString *scopeId
     return parseIp6(addr, tmp.begin(), tmp.end()) == nullptr;
 }
 
+static inline int hexValue(ushort c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// the dotted decimal form only, the legacy forms such as 127.1 and 010.0.0.1 are left to parseIp4().
+static bool parseIp4Literal(const QChar *begin, const QChar *end, IPv4Address *address)
+{
+    quint32 result = 0;
+    const QChar *p = begin;
+    for (int parts = 0; parts < 4; ++parts) {
+        if (parts > 0) {
+            if (p == end || p->unicode() != '.')
+                return false;
+            ++p;
+        }
+        const QChar *partBegin = p;
+        quint32 part = 0;
+        while (p != end && p->unicode() >= '0' && p->unicode() <= '9') {
+            part = part * 10 + (p->unicode() - '0');
+            if (part > 255)
+                return false;
+            ++p;
+        }
+        if (p == partBegin || (p - partBegin > 1 && partBegin->unicode() == '0'))
+            return false;
+        result = (result << 8) | part;
+    }
+    if (p != end)
+        return false;
+    *address = result;
+    return true;
+}
+
+static bool parseIp6Literal(const QChar *begin, const QChar *end, IPv6Address *address)
+{
+    quint16 words[8];
+    int count = 0;
+    int gap = -1;  // the index of words where "::" is.
+    const QChar *p = begin;
+    if (p != end && p->unicode() == ':') {
+        if (end - p < 2 || p[1].unicode() != ':')
+            return false;
+        gap = 0;
+        p += 2;
+    }
+    while (p != end) {
+        const QChar *wordBegin = p;
+        quint32 word = 0;
+        while (p != end && hexValue(p->unicode()) >= 0) {
+            if (p - wordBegin == 4)
+                return false;
+            word = (word << 4) | static_cast<quint32>(hexValue(p->unicode()));
+            ++p;
+        }
+        if (p == wordBegin)
+            return false;
+        if (p != end && p->unicode() == '.') {
+            // the ipv4 address embedded at the end.
+            IPv4Address ipv4;
+            if (count > 6 || !parseIp4Literal(wordBegin, end, &ipv4))
+                return false;
+            words[count++] = static_cast<quint16>(ipv4 >> 16);
+            words[count++] = static_cast<quint16>(ipv4 & 0xffff);
+            break;
+        }
+        if (count == 8)
+            return false;
+        words[count++] = static_cast<quint16>(word);
+        if (p == end)
+            break;
+        if (p->unicode() != ':' || ++p == end)
+            return false;
+        if (p->unicode() == ':') {
+            if (gap >= 0)
+                return false;
+            gap = count;
+            ++p;
+        }
+    }
+    if ((gap < 0 && count != 8) || (gap >= 0 && count > 7))
+        return false;
+    memset(address->c, 0, sizeof(address->c));
+    for (int i = 0; i < count; ++i) {
+        const int index = (gap >= 0 && i >= gap) ? 8 - (count - i) : i;
+        address->c[index * 2] = static_cast<quint8>(words[i] >> 8);
+        address->c[index * 2 + 1] = static_cast<quint8>(words[i] & 0xff);
+    }
+    return true;
+}
+
+// the common literals, such as 127.0.0.1, ::1, fe80::1%eth0, and [::1] if allowBrackets, are parsed by hand without
+// allocation. the strings can not be parsed by parseIp4() or parseIp6() are rejected by the first character outside of
+// their alphabet, so the host names are passed to dns quickly.
+HostAddressPrivate::LiteralResult HostAddressPrivate::parseLiteral(const QChar *begin, const QChar *end,
+                                                                   bool allowBrackets)
+{
+    if (begin == end)
+        return NotLiteral;
+    bool bracketed = false;
+    if (begin->unicode() == '[') {
+        if (!allowBrackets || end - begin < 2 || (end - 1)->unicode() != ']')
+            return NotLiteral;
+        ++begin;
+        --end;
+        bracketed = true;
+    }
+    const QChar *zone = end;
+    bool hasColon = false;
+    for (const QChar *p = begin; p != end; ++p) {
+        const ushort c = p->unicode();
+        if (c == ':') {
+            hasColon = true;
+        } else if (c == '%') {
+            zone = p;
+            break;
+        } else if (hexValue(c) < 0 && c != '.' && c != 'x' && c != 'X' && !p->isSpace()) {
+            return NotLiteral;
+        }
+    }
+    if ((bracketed || zone != end) && !hasColon)
+        return NotLiteral;
+    if (hasColon) {
+        IPv6Address ip6;
+        if (!parseIp6Literal(begin, zone, &ip6))
+            return bracketed ? NotLiteral : MaybeLiteral;
+        setAddress(ip6);
+        if (zone != end) {
+            scopeId = QString(zone + 1, static_cast<int>(end - zone - 1));
+        } else {
+            scopeId.clear();
+        }
+        return LiteralParsed;
+    }
+    IPv4Address ip4;
+    if (!parseIp4Literal(begin, end, &ip4))
+        return MaybeLiteral;
+    setAddress(ip4);
+    return LiteralParsed;
+}
+
 bool HostAddressPrivate::parse(const QString &ipString)
 {
     protocol = HostAddress::UnknownNetworkLayerProtocol;
+    switch (parseLiteral(ipString.constBegin(), ipString.constEnd(), false)) {
+    case LiteralParsed:
+        return true;
+    case NotLiteral:
+        return false;
+    case MaybeLiteral:
+        break;
+    }
     QString simpleStr = ipString.simplified();
     if (simpleStr.isEmpty())
         return false;
@@ -1313,6 +1468,26 @@ void HostAddress::setScopeId(const QString &id)
         d->scopeId = id;
 }
 
+bool HostAddress::parseLiteral(const QString &host, HostAddress *address)
+{
+    HostAddressPrivate parsed;
+    switch (parsed.parseLiteral(host.constBegin(), host.constEnd(), true)) {
+    case HostAddressPrivate::LiteralParsed:
+        address->d = new HostAddressPrivate(parsed);
+        return true;
+    case HostAddressPrivate::NotLiteral:
+        return false;
+    case HostAddressPrivate::MaybeLiteral:
+        break;
+    }
+    HostAddress legacy;
+    if (legacy.setAddress(host)) {
+        *address = legacy;
+        return true;
+    }
+    return false;
+}
+
 QList<HostAddress> HostAddress::getHostAddressByName(const QString &hostName)
 {
     // IDN support
@@ -1390,6 +1565,69 @@ uint qHash(const HostAddress &key, uint seed) Q_DECL_NOEXCEPT
 #endif
 }
 
+CompactHostAddress::CompactHostAddress(const HostAddress &address)
+{
+    const IPv6Address &ipv6 = address.d->ipv6.a6;
+    memcpy(c, ipv6.c, sizeof(c));
+    quint32 scopeId = 0;
+    if (address.d->protocol == HostAddress::IPv6Protocol && !address.d->scopeId.isEmpty()) {
+        scopeId = address.d->scopeId.toUInt() & 0xffffff;
+    }
+    setProtocol(HostAddress::NetworkLayerProtocol(address.d->protocol), scopeId);
+}
+
+CompactHostAddress::CompactHostAddress(const sockaddr *sockaddr)
+    : CompactHostAddress()
+{
+    switch (sockaddr->sa_family) {
+    case AF_INET:
+        *this = CompactHostAddress(static_cast<IPv4Address>(ntohl(((sockaddr_in *) sockaddr)->sin_addr.s_addr)));
+        break;
+    case AF_INET6: {
+        sockaddr_in6 *sa6 = (sockaddr_in6 *) sockaddr;
+        memcpy(c, sa6->sin6_addr.s6_addr, sizeof(c));
+        setProtocol(HostAddress::IPv6Protocol, static_cast<quint32>(sa6->sin6_scope_id) & 0xffffff);
+        break;
+    }
+    default:
+        qtng_warning << "Unknown address type when get hostname";
+    }
+}
+
+CompactHostAddress::CompactHostAddress(IPv4Address ipv4)
+    : CompactHostAddress()
+{
+    // the same as HostAddressPrivate::setAddress(), 0.0.0.0 is not mapped.
+    if (ipv4) {
+        c[10] = 0xff;
+        c[11] = 0xff;
+        qToBigEndian(ipv4, c + 12);
+    }
+    setProtocol(HostAddress::IPv4Protocol, 0);
+}
+
+HostAddress CompactHostAddress::toHostAddress() const
+{
+    HostAddress address;
+    switch (protocol()) {
+    case HostAddress::IPv4Protocol:
+        address.setAddress(qFromBigEndian<quint32>(c + 12));
+        break;
+    case HostAddress::IPv6Protocol:
+        address.setAddress(c);
+        if (scopeId()) {
+            address.setScopeId(QString::number(scopeId()));
+        }
+        break;
+    case HostAddress::AnyIPProtocol:
+        address.setAddress(HostAddress::Any);
+        break;
+    default:
+        break;
+    }
+    return address;
+}
+
 QTNETWORKNG_NAMESPACE_END
 
 QDebug operator<<(QDebug out, const QTNETWORKNG_NAMESPACE::HostAddress &t)
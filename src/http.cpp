@@ -7,11 +7,19 @@
 #include <QtCore/qdatastream.h>
 #include <QtCore/qcryptographichash.h>
 #include <QtCore/qelapsedtimer.h>
+#include <QtCore/qfile.h>
+#include <algorithm>
 #if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
 #  include <QtCore/qrandom.h>
 #endif
 #include "../include/private/http_p.h"
+#include "../include/private/http_parser_p.h"
 #include "../include/socks5_proxy.h"
+#include "../include/compression.h"
+#include "../include/metrics.h"
+#include "../include/buffer_budget.h"
+#include "../include/private/tracing_p.h"
+#include "../include/private/eventloop_p.h"
 #ifdef QTNG_HAVE_ZLIB
 #  include "../include/gzip.h"
 #endif
@@ -64,32 +72,52 @@ QByteArray formatHeaderParam(const QString &name, const QString &value)
     return data;
 }
 
+static QByteArray formDataQueryPart(const QByteArray &boundary, const FormData::Query &query)
+{
+    QByteArray part;
+    part.append("--");
+    part.append(boundary);
+    part.append("\r\n");
+    part.append("Content-Disposition: form-data;");
+    part.append(formatHeaderParam(QString::fromLatin1("name"), query.name));
+    part.append("\r\n\r\n");
+    part.append(query.value.toUtf8());
+    part.append("\r\n");
+    return part;
+}
+
+static QByteArray formDataFileHeader(const QByteArray &boundary, const FormData::File &file)
+{
+    QByteArray header;
+    header.append("--");
+    header.append(boundary);
+    header.append("\r\n");
+    header.append("Content-Disposition: form-data;");
+    header.append(formatHeaderParam(QString::fromLatin1("name"), file.name));
+    header.append("; ");
+    header.append(formatHeaderParam(QString::fromLatin1("filename"), file.filename));
+    header.append("\r\n");
+    header.append("Content-Type: ");
+    header.append(file.contentType.toUtf8());
+    header.append("\r\n\r\n");
+    return header;
+}
+
 QByteArray FormData::toByteArray() const
 {
     QByteArray body;
     for (QList<FormData::Query>::const_iterator itor = queries.constBegin(); itor != queries.constEnd(); ++itor) {
-        body.append("--");
-        body.append(boundary);
-        body.append("\r\n");
-        body.append("Content-Disposition: form-data;");
-        body.append(formatHeaderParam(QString::fromLatin1("name"), itor->name));
-        body.append("\r\n\r\n");
-        body.append(itor->value.toUtf8());
-        body.append("\r\n");
+        body.append(formDataQueryPart(boundary, *itor));
     }
     for (QList<FormData::File>::const_iterator itor = files.constBegin(); itor != files.constEnd(); ++itor) {
-        body.append("--");
-        body.append(boundary);
-        body.append("\r\n");
-        body.append("Content-Disposition: form-data;");
-        body.append(formatHeaderParam(QString::fromLatin1("name"), itor->name));
-        body.append("; ");
-        body.append(formatHeaderParam(QString::fromLatin1("filename"), itor->filename));
+        body.append(formDataFileHeader(boundary, *itor));
+        if (itor->file.isNull()) {
+            body.append(itor->data);
+        } else {
+            bool ok;
+            body.append(itor->file->readall(&ok));
+        }
         body.append("\r\n");
-        body.append("Content-Type: ");
-        body.append(itor->contentType.toUtf8());
-        body.append("\r\n\r\n");
-        body.append(itor->data);
     }
     body.append("--");
     body.append(boundary);
@@ -97,6 +125,97 @@ QByteArray FormData::toByteArray() const
     return body;
 }
 
+// the parts of multipart body are read one after another.
+class FormDataFile : public FileLike
+{
+public:
+    explicit FormDataFile(const QList<QSharedPointer<FileLike>> &parts)
+        : parts(parts)
+        , current(0)
+    {
+    }
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *, qint32) override { return -1; }
+    virtual void close() override;
+    virtual qint64 size() override;
+private:
+    QList<QSharedPointer<FileLike>> parts;
+    int current;
+};
+
+qint32 FormDataFile::read(char *data, qint32 size)
+{
+    while (current < parts.size()) {
+        qint32 readBytes = parts.at(current)->read(data, size);
+        if (readBytes != 0) {
+            return readBytes;
+        }
+        ++current;
+    }
+    return 0;
+}
+
+void FormDataFile::close()
+{
+    for (QSharedPointer<FileLike> part : parts) {
+        part->close();
+    }
+}
+
+qint64 FormDataFile::size()
+{
+    qint64 total = 0;
+    for (QSharedPointer<FileLike> part : parts) {
+        qint64 partSize = part->size();
+        if (partSize < 0) {
+            return -1;  // sent as chunks.
+        }
+        total += partSize;
+    }
+    return total;
+}
+
+QSharedPointer<FileLike> FormData::toFileLike() const
+{
+    QList<QSharedPointer<FileLike>> parts;
+    QByteArray buf;
+    for (QList<FormData::Query>::const_iterator itor = queries.constBegin(); itor != queries.constEnd(); ++itor) {
+        buf.append(formDataQueryPart(boundary, *itor));
+    }
+    for (QList<FormData::File>::const_iterator itor = files.constBegin(); itor != files.constEnd(); ++itor) {
+        buf.append(formDataFileHeader(boundary, *itor));
+        if (itor->file.isNull()) {
+            buf.append(itor->data);
+        } else {
+            parts.append(FileLike::bytes(buf));
+            parts.append(itor->file);
+            buf.clear();
+        }
+        buf.append("\r\n");
+    }
+    buf.append("--");
+    buf.append(boundary);
+    buf.append("--");
+    parts.append(FileLike::bytes(buf));
+    return QSharedPointer<FormDataFile>::create(parts);
+}
+
+void FormData::addFile(const QString &name, const QString &filename, QSharedPointer<FileLike> file,
+                       const QString &contentType)
+{
+    QString newContentType = contentType;
+#ifndef Q_OS_ANDROID
+    if (newContentType.isEmpty()) {
+        QMimeDatabase db;
+        newContentType = db.mimeTypeForFile(filename, QMimeDatabase::MatchExtension).name();
+    }
+#endif
+    if (newContentType.isEmpty()) {
+        newContentType = QString::fromLatin1("application/octet-stream");
+    }
+    files.append(File(name, filename, file, newContentType));
+}
+
 class HttpRequestPrivate : public QSharedData
 {
 public:
@@ -118,6 +237,8 @@ public:
     HttpRequest::Priority priority;
     HttpVersion version;
     bool streamResponse;
+    float hedgeDelay;
+    bool recordTimings;
 };
 
 HttpRequestPrivate::HttpRequestPrivate()
@@ -129,6 +250,8 @@ HttpRequestPrivate::HttpRequestPrivate()
     , priority(HttpRequest::NormalPriority)
     , version(Unknown)
     , streamResponse(false)
+    , hedgeDelay(-1.0)
+    , recordTimings(false)
 {
 }
 
@@ -150,6 +273,8 @@ HttpRequestPrivate::HttpRequestPrivate(const HttpRequestPrivate &other)
     , priority(other.priority)
     , version(other.version)
     , streamResponse(other.streamResponse)
+    , hedgeDelay(other.hedgeDelay)
+    , recordTimings(other.recordTimings)
 {
 }
 
@@ -333,6 +458,26 @@ void HttpRequest::useConnection(QSharedPointer<SocketLike> connection)
     d->connection = connection;
 }
 
+bool HttpRequest::recordTimings() const
+{
+    return d->recordTimings;
+}
+
+void HttpRequest::setRecordTimings(bool recordTimings)
+{
+    d->recordTimings = recordTimings;
+}
+
+float HttpRequest::hedgeDelay() const
+{
+    return d->hedgeDelay;
+}
+
+void HttpRequest::setHedgeDelay(float delay)
+{
+    d->hedgeDelay = delay;
+}
+
 void HttpRequest::setBody(const FormData &formData)
 {
     QString contentType =
@@ -342,7 +487,7 @@ void HttpRequest::setBody(const FormData &formData)
     if (!hasHeader(mimeHeader)) {
         setHeader(mimeHeader, QByteArray("1.0"));
     }
-    setBody(formData.toByteArray());
+    setBody(formData.toFileLike());
 }
 
 void HttpRequest::setBody(const QJsonDocument &json)
@@ -390,9 +535,12 @@ public:
     QList<HttpCookie> cookies;
     HttpRequest request;
     QByteArray body;
+    QSharedPointer<BufferCharge> bodyCharge;  // shared by the copies of body.
     QList<HttpResponse> history;
     QSharedPointer<RequestError> error;
     QSharedPointer<SocketLike> stream;
+    QSharedPointer<FileLike> bodyReader;  // used by readChunk().
+    HttpTimings timings;
     qint64 elapsed;
     int statusCode;
     HttpVersion version;
@@ -416,7 +564,9 @@ HttpResponsePrivate::HttpResponsePrivate(const HttpResponsePrivate &other)
     , cookies(other.cookies)
     , request(other.request)
     , body(other.body)
+    , bodyCharge(other.bodyCharge)
     , history(other.history)
+    , timings(other.timings)
     , elapsed(other.elapsed)
     , statusCode(other.statusCode)
     , version(other.version)
@@ -574,7 +724,8 @@ QSharedPointer<FileLike> HttpResponse::bodyAsFile(bool processEncoding)
         }
         const QByteArray &transferEncodingHeader = header(QString::fromLatin1("Transfer-Encoding"));
         bool isChunked = (transferEncodingHeader.toLower() == QByteArray("chunked"));
-        if (isChunked && processEncoding) {
+        if (isChunked) {
+            // the framing is decoded even if the content encoding is kept.
             removeHeader(QString::fromLatin1("Transfer-Encoding"));
             bodyFile = QSharedPointer<ChunkedBodyFile>::create(d->request.maxBodySize(), d->body, d->stream);
         } else {
@@ -597,13 +748,36 @@ QSharedPointer<FileLike> HttpResponse::bodyAsFile(bool processEncoding)
             bodyFile = QSharedPointer<GzipDecompressFile>::create(bodyFile);
         } else
 #endif
-                if (!contentEncodingHeader.isEmpty() || !transferEncodingHeader.isEmpty()) {
+                if (qIsContentCodingSupported(contentEncodingHeader.toLower())) {
+            // zstd and br, which are optional.
+            removeHeader(QString::fromLatin1("Content-Encoding"));
+            bodyFile = qContentDecoder(contentEncodingHeader.toLower(), bodyFile);
+        } else if (!contentEncodingHeader.isEmpty() || !transferEncodingHeader.isEmpty()) {
             qtng_warning << "unsupported content encoding:" << contentEncodingHeader << transferEncodingHeader;
         }
     }
     return bodyFile;
 }
 
+static RequestError *toRequestError(QSharedPointer<FileLike> bodyFile)
+{
+#ifdef QTNG_HAVE_ZLIB
+    if (bodyFile.dynamicCast<GzipDecompressFile>()) {
+        return new ContentDecodingError();
+    }
+#endif
+    if (bodyFile.dynamicCast<ZstdDecompressFile>() || bodyFile.dynamicCast<BrotliDecompressFile>()) {
+        return new ContentDecodingError();
+    }
+    if (bodyFile.dynamicCast<ChunkedBodyFile>()) {
+        RequestError *error = toRequestError(bodyFile.dynamicCast<ChunkedBodyFile>()->error);
+        if (error != nullptr) {
+            return error;
+        }
+    }
+    return new ConnectionError();
+}
+
 QByteArray HttpResponse::body()
 {
     if (d->consumed) {
@@ -616,29 +790,57 @@ QByteArray HttpResponse::body()
     bool ok;
     const QByteArray &data = bodyFile->readall(&ok);
     if (!ok) {
-#ifdef QTNG_HAVE_ZLIB
-        if (bodyFile.dynamicCast<GzipDecompressFile>()) {
-            setError(new ContentDecodingError());
-        } else
-#endif
-                if (bodyFile.dynamicCast<ChunkedBodyFile>()) {
-            RequestError *error = nullptr;
-            error = toRequestError(bodyFile.dynamicCast<ChunkedBodyFile>()->error);
-            if (error != nullptr) {
-                setError(error);
-            } else {
-                setError(new ConnectionError());
-            }
-        } else {
-            setError(new ConnectionError());
-        }
+        setError(toRequestError(bodyFile));
+    }
+    QSharedPointer<BufferCharge> charge(new BufferCharge(BufferBudget::HttpBody));
+    if (!charge->tryAdd(data.size())) {
+        setError(new BufferBudgetExceeded());
+        d->body.clear();
+        return QByteArray();
     }
+    d->bodyCharge = charge;
     d->body = data;
     return data;
 }
 
+qint32 HttpResponse::readChunk(char *data, qint32 size)
+{
+    if (d->bodyReader.isNull()) {
+        if (d->consumed) {
+            // the body was read by session, read it from memory.
+            d->bodyReader = FileLike::bytes(d->body);
+        } else {
+            d->bodyReader = bodyAsFile();
+            if (d->bodyReader.isNull()) {
+                return -1;
+            }
+        }
+    }
+    qint32 readBytes = d->bodyReader->read(data, size);
+    if (readBytes < 0) {
+        setError(toRequestError(d->bodyReader));
+    }
+    return readBytes;
+}
+
+bool HttpResponse::readBody(std::function<bool(const char *data, qint32 size)> callback, qint32 blockSize)
+{
+    QByteArray buf(qMax(blockSize, 1024), Qt::Uninitialized);
+    while (true) {
+        qint32 readBytes = readChunk(buf.data(), buf.size());
+        if (readBytes < 0) {
+            return false;
+        } else if (readBytes == 0) {
+            return true;
+        } else if (!callback(buf.constData(), readBytes)) {
+            return false;
+        }
+    }
+}
+
 void HttpResponse::setBody(const QByteArray &body)
 {
+    d->bodyCharge.clear();
     d->body = body;
     d->consumed = true;
 }
@@ -673,6 +875,16 @@ void HttpResponse::setVersion(HttpVersion version)
     d->version = version;
 }
 
+HttpTimings HttpResponse::timings() const
+{
+    return d->timings;
+}
+
+void HttpResponse::setTimings(const HttpTimings &timings)
+{
+    d->timings = timings;
+}
+
 QString HttpResponse::text()
 {
     return QString::fromUtf8(body());
@@ -689,6 +901,37 @@ QJsonDocument HttpResponse::json()
     }
 }
 
+bool HttpResponse::readJson(std::function<bool(JsonStreamReader &reader)> callback)
+{
+    JsonStreamReader reader;
+    std::function<bool()> pull = [&reader, &callback] {
+        while (true) {
+            JsonStreamReader::Token token = reader.next();
+            if (token == JsonStreamReader::NeedMoreData || token == JsonStreamReader::EndOfDocument) {
+                return true;
+            } else if (token == JsonStreamReader::Invalid || !callback(reader)) {
+                return false;
+            }
+        }
+    };
+    bool ok = readBody([&reader, &pull](const char *data, qint32 size) {
+        reader.addData(data, size);
+        return pull();
+    });
+    if (!ok) {
+        return false;
+    }
+    reader.finish();
+    return pull();
+}
+
+bool HttpResponse::readJsonAsMsgPack(MsgPackStream *out, bool splitTopArray)
+{
+    JsonMsgPackTranscoder transcoder(out, splitTopArray);
+    bool ok = readBody([&transcoder](const char *data, qint32 size) { return transcoder.addData(data, size); });
+    return ok && transcoder.finish();
+}
+
 QString HttpResponse::html()
 {
     // TODO detect encoding;
@@ -720,35 +963,94 @@ void HttpResponse::setError(QSharedPointer<RequestError> error)
     d->error = error;
 }
 
+namespace {
+
+struct HttpClientMetrics
+{
+    HttpClientMetrics();
+    MetricCounter *requests;
+    MetricCounter *errors;
+    MetricCounter *responseBytes;
+    MetricHistogram *duration;
+    MetricCounter *poolHits;
+    MetricCounter *poolMisses;
+    MetricCounter *poolDropped;
+};
+
+HttpClientMetrics::HttpClientMetrics()
+{
+    MetricsRegistry *registry = MetricsRegistry::instance();
+    requests = registry->counter("qtng_http_client_requests_total", "Requests sent by HttpSession.");
+    errors = registry->counter("qtng_http_client_errors_total", "Requests failed, including http errors.");
+    responseBytes = registry->counter("qtng_http_client_response_bytes_total",
+                                      "Bytes of response bodies read by HttpSession, not counting streamed responses.");
+    duration = registry->histogram("qtng_http_client_request_duration_seconds",
+                                   "Time of HttpSession::send(), including redirections.");
+    poolHits = registry->counter("qtng_http_pool_hits_total",
+                                 "Requests sent through reused, pipelined or http2 connections.");
+    poolMisses = registry->counter("qtng_http_pool_misses_total", "Connections made by the connection pool.");
+    poolDropped = registry->counter("qtng_http_pool_dropped_total", "Idle connections found closed or expired.");
+}
+
+HttpClientMetrics &httpClientMetrics()
+{
+    static HttpClientMetrics metrics;
+    return metrics;
+}
+
+// records the response when HttpSession::send() returns.
+struct HttpClientMetricsRecorder
+{
+    HttpClientMetricsRecorder(const HttpResponse &response, const QElapsedTimer &timer)
+        : response(response)
+        , timer(timer)
+    {
+    }
+    ~HttpClientMetricsRecorder();
+    const HttpResponse &response;
+    const QElapsedTimer &timer;
+};
+
+HttpClientMetricsRecorder::~HttpClientMetricsRecorder()
+{
+    HttpClientMetrics &metrics = httpClientMetrics();
+    metrics.requests->add();
+    if (response.error()) {
+        metrics.errors->add();
+    }
+    metrics.duration->observe(timer.nsecsElapsed() / 1000);
+}
+
+}  // anonymous namespace
+
 HttpSessionPrivate::HttpSessionPrivate(HttpSession *q_ptr)
-    : defaultVersion(HttpVersion::Http1_1)
+    : cachedPort(-1)
+    , hedgingBudget(0.1f)
+    , hedgingTokens(0.0f)
+    , defaultVersion(HttpVersion::Http1_1)
     , q_ptr(q_ptr)
     , debugLevel(0)
     , managingCookies(true)
     , keepAlive(true)
+    , coalescingRequests(false)
 {
     defaultUserAgent = QString::fromLatin1("Mozilla/5.0 (X11; Linux x86_64; rv:52.0) Gecko/20100101 Firefox/52.0");
 }
 
 HttpSessionPrivate::~HttpSessionPrivate() { }
 
-static QUrl hostOnly(const QUrl &url)
-{
-    QUrl h;
-    h.setScheme(url.scheme());
-    h.setHost(url.host());
-    h.setPort(url.port());
-    return h;
-}
-
 ConnectionPool::ConnectionPool()
     : dnsCache(new SocketDnsCache)
     , proxySwitcher(new SimpleProxySwitcher)
     , maxConnectionsPerServer(5)
+    , maxPipelinedRequests(8)
     , timeToLive(60)
     , defaultConnectionTimeout(10.0)
     , defaultTimeout(20.0)
     , operations(new CoroutineGroup)
+    , pipelining(false)
+    , tcpFastOpen(false)
+    , balancingAddresses(false)
 {
     operations->spawnWithName(QString::fromLatin1("removeUnusedConnections"), [this] { removeUnusedConnections(); });
 }
@@ -758,55 +1060,250 @@ ConnectionPool::~ConnectionPool()
     delete operations;
 }
 
-ConnectionPoolItem &ConnectionPool::getItem(const QUrl &url)
+// proxies are compared by where they go instead of their addresses, which the switcher may recreate for each url.
+static QString proxyKey(const QSharedPointer<SocketProxy> &proxy)
+{
+    if (proxy.isNull()) {
+        return QString();
+    }
+    if (Socks5Proxy *socks5 = dynamic_cast<Socks5Proxy *>(proxy.data())) {
+        return QString::fromLatin1("socks5://%1@%2:%3").arg(socks5->user(), socks5->hostName()).arg(socks5->port());
+    }
+    if (HttpProxy *http = dynamic_cast<HttpProxy *>(proxy.data())) {
+        return QString::fromLatin1("http://%1@%2:%3").arg(http->user(), http->hostName()).arg(http->port());
+    }
+    // nothing else is known about other proxies.
+    return QString::fromLatin1("proxy:%1").arg(reinterpret_cast<quintptr>(proxy.data()));
+}
+
+ConnectionPoolKey ConnectionPool::keyForUrl(const QUrl &url) const
 {
-    const QUrl &h = hostOnly(url);
-    ConnectionPoolItem &item = items[h];
-    item.lastUsed = QDateTime::currentDateTimeUtc();
+    ConnectionPoolKey key;
+    key.scheme = url.scheme();
+    key.host = url.host();
+    key.port = static_cast<quint16>(url.port(key.scheme == QLatin1String("http") ? 80 : 443));
+    key.proxy = proxyKey(proxySwitcher->selectSocketProxy(url));
+    return key;
+}
+
+// do not keep the returned reference while switching coroutines, the items may be rehashed.
+ConnectionPoolItem &ConnectionPool::getItem(const ConnectionPoolKey &key)
+{
+    ConnectionPoolItem &item = items[key];
+    item.lastUsed = EventLoopCoroutine::get()->now();
     if (item.semaphore.isNull()) {
         item.semaphore.reset(new Semaphore(maxConnectionsPerServer));
     }
     return item;
 }
 
-QSharedPointer<Semaphore> ConnectionPool::getSemaphore(const QUrl &url)
+QSharedPointer<Semaphore> ConnectionPool::getSemaphore(const ConnectionPoolKey &key)
 {
-    ConnectionPoolItem &item = getItem(url);
+    ConnectionPoolItem &item = getItem(key);
     return item.semaphore;
 }
 
-void ConnectionPool::recycle(const QUrl &url, QSharedPointer<SocketLike> connection)
+static bool isIdleConnected(QSharedPointer<SocketLike> connection)
 {
-    ConnectionPoolItem &item = getItem(url);
-    if (item.connections.size() < maxConnectionsPerServer) {
-        item.connections.append(connection);
+    if (!connection->isValid()) {
+        return false;
     }
+    QSharedPointer<Socket> rawSocket = convertSocketLikeToSocket(connection);
+#ifndef QTNG_NO_CRYPTO
+    if (rawSocket.isNull()) {
+        QSharedPointer<SslSocket> ssl = convertSocketLikeToSslSocket(connection);
+        if (!ssl.isNull()) {
+            rawSocket = convertSocketLikeToSocket(ssl->backend());
+        }
+    }
+#endif
+    if (rawSocket.isNull()) {
+        // proxied connections can not be probed, find it out while sending request.
+        return true;
+    }
+    return rawSocket->isIdleConnected();
 }
 
-QSharedPointer<SocketLike> ConnectionPool::oldConnectionForUrl(const QUrl &url)
+QSharedPointer<PooledConnection> ConnectionPool::idleConnection(const ConnectionPoolKey &key)
 {
-    ConnectionPoolItem &item = getItem(url);
+    ConnectionPoolItem &item = getItem(key);
+    // the most recently used connection is the most likely one to be alive.
+    while (!item.idle.isEmpty()) {
+        QSharedPointer<PooledConnection> pooled = item.idle.takeLast();
+        if (isIdleConnected(pooled->connection)) {
+            ++stats.reusedConnections;
+            httpClientMetrics().poolHits->add();
+            return pooled;
+        }
+        ++stats.droppedConnections;
+        httpClientMetrics().poolDropped->add();
+    }
+    return QSharedPointer<PooledConnection>();
+}
 
-    while (!item.connections.isEmpty()) {
-        QSharedPointer<SocketLike> connection = item.connections.takeFirst();
-        if (!connection->isValid()) {
-            continue;
+QSharedPointer<PooledConnection> ConnectionPool::pipelinedConnection(const ConnectionPoolKey &key)
+{
+    ConnectionPoolItem &item = getItem(key);
+    for (QSharedPointer<PooledConnection> pooled : item.pipelining) {
+        if (!pooled->broken && pooled->sentRequests - pooled->readResponses < static_cast<quint64>(maxPipelinedRequests)
+            && pooled->connection->isValid()) {
+            ++stats.pipelinedRequests;
+            httpClientMetrics().poolHits->add();
+            return pooled;
         }
-        char tbuf[4];
-        try {
-            Timeout t(0.001f);
-            Q_UNUSED(t);
-            connection->recv(tbuf, 4);
-        } catch (TimeoutException &) {
-            // if the connection is ok, it always timeout.
-            return connection;
+    }
+    return QSharedPointer<PooledConnection>();
+}
+
+void ConnectionPool::startPipelining(const ConnectionPoolKey &key, QSharedPointer<PooledConnection> pooled)
+{
+    ConnectionPoolItem &item = getItem(key);
+    if (!item.pipelining.contains(pooled)) {
+        item.pipelining.append(pooled);
+    }
+}
+
+void ConnectionPool::release(const ConnectionPoolKey &key, QSharedPointer<PooledConnection> pooled, bool reusable)
+{
+    ++pooled->readResponses;
+    if (!reusable) {
+        pooled->broken = true;
+    }
+    pooled->turn.notifyAll();
+    if (!pooled->broken && pooled->readResponses != pooled->sentRequests) {
+        // pipelined requests are still waiting for their responses.
+        return;
+    }
+    ConnectionPoolItem &item = getItem(key);
+    item.pipelining.removeOne(pooled);
+    if (!pooled->broken && item.idle.size() < maxConnectionsPerServer) {
+        pooled->lastUsed = EventLoopCoroutine::get()->now();
+        item.idle.append(pooled);
+    }
+}
+
+QSharedPointer<Http2Connection> ConnectionPool::http2Connection(const ConnectionPoolKey &key)
+{
+    ConnectionPoolItem &item = getItem(key);
+    if (!item.http2.isNull() && !item.http2->canOpenStream()) {
+        // the server is going away, the new requests go to a new connection.
+        item.http2.clear();
+    }
+    if (!item.http2.isNull()) {
+        ++stats.multiplexedRequests;
+        httpClientMetrics().poolHits->add();
+    }
+    return item.http2;
+}
+
+QSharedPointer<Http2Connection> ConnectionPool::startHttp2(const ConnectionPoolKey &key,
+                                                           QSharedPointer<SocketLike> connection, bool shared)
+{
+    QSharedPointer<Http2Connection> http2(new Http2Connection(connection, false));
+    if (!http2->handshake()) {
+        return QSharedPointer<Http2Connection>();
+    }
+    ++stats.multiplexedRequests;
+    if (shared) {
+        // another coroutine may make a connection at the same time, the last one wins.
+        getItem(key).http2 = http2;
+    }
+    return http2;
+}
+
+static inline qint64 elapsedUsecs(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() / 1000;
+}
+
+static int randomIndex(int size)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    return QRandomGenerator::global()->bounded(size);
+#else
+    return qrand() % size;
+#endif
+}
+
+// the power of two choices: the one with less connections of two random addresses is taken, which spreads the load
+// without herding to the least busy one, and the nearer one by tcp rtt if they are even. the failed addresses are
+// evicted for a while.
+Socket *ConnectionPool::connectBalanced(const QString &host, quint16 port, QSharedPointer<PooledAddress> *address)
+{
+    QList<HostAddress> resolved;
+    HostAddress literal;
+    if (HostAddress::parseLiteral(host, &literal)) {
+        resolved.append(literal);
+    } else {
+        resolved = dnsCache.isNull() ? Socket::resolve(host) : dnsCache->resolve(host);
+    }
+    const qint64 now = EventLoopCoroutine::get()->now();
+    QList<QSharedPointer<PooledAddress>> all;
+    QList<QSharedPointer<PooledAddress>> alive;
+    for (const HostAddress &addr : resolved) {
+        QSharedPointer<PooledAddress> &pooledAddress = addresses[addr];
+        if (pooledAddress.isNull()) {
+            pooledAddress.reset(new PooledAddress(addr));
+        }
+        all.append(pooledAddress);
+        if (pooledAddress->evictedUntil <= now) {
+            alive.append(pooledAddress);
+        }
+    }
+    if (alive.isEmpty()) {
+        alive = all;  // try the evicted ones rather than nothing.
+    }
+    const bool fastOpen = tcpFastOpen;
+    std::function<Socket *(HostAddress::NetworkLayerProtocol)> makeSocket =
+            [fastOpen](HostAddress::NetworkLayerProtocol protocol) {
+                Socket *socket = new Socket(protocol);
+                if (fastOpen) {
+                    socket->setOption(Socket::FastOpenConnectSocketOption, 1);
+                }
+                return socket;
+            };
+    while (!alive.isEmpty()) {
+        int i = randomIndex(alive.size());
+        if (alive.size() > 1) {
+            int j = randomIndex(alive.size() - 1);
+            if (j >= i) {
+                ++j;
+            }
+            const PooledAddress &a = *alive.at(i);
+            const PooledAddress &b = *alive.at(j);
+            if (b.connections < a.connections
+                || (b.connections == a.connections && b.rtt > 0 && (a.rtt == 0 || b.rtt < a.rtt))) {
+                i = j;
+            }
         }
+        QSharedPointer<PooledAddress> picked = alive.takeAt(i);
+        Socket *socket = createConnection<Socket>(picked->address, port, nullptr,
+                                                  HostAddress::IPv4Protocol | HostAddress::IPv6Protocol, makeSocket);
+        if (socket) {
+            ++picked->createdConnections;
+            picked->evictedUntil = 0;
+            const TcpInfo &info = socket->tcpInfo();
+            if (info.rtt > 0) {
+                picked->rtt = picked->rtt == 0 ? info.rtt : (picked->rtt * 7 + info.rtt) / 8;
+            }
+            *address = picked;
+            return socket;
+        }
+        ++picked->failedConnections;
+        picked->evictedUntil = EventLoopCoroutine::get()->now() + PooledAddress::EvictionMsecs;
     }
-    return QSharedPointer<SocketLike>();
+    return nullptr;
 }
 
-QSharedPointer<SocketLike> ConnectionPool::newConnectionForUrl(const QUrl &url, RequestError **error)
+QSharedPointer<SocketLike> ConnectionPool::newConnectionForUrl(const QUrl &url, RequestError **error,
+                                                               HttpTimings *timings,
+                                                               QSharedPointer<PooledAddress> *address,
+                                                               const QByteArray &earlyData)
 {
+    QElapsedTimer timer;
+    if (timings) {
+        timer.start();
+    }
     QSharedPointer<SocketLike> connection;
     quint16 port;
     if (url.scheme() == QString::fromLatin1("http")) {
@@ -832,8 +1329,34 @@ QSharedPointer<SocketLike> ConnectionPool::newConnectionForUrl(const QUrl &url,
             return QSharedPointer<SocketLike>();
         }
     } else {
+        HostAddress address;
+        if (timings && !dnsCache.isNull() && !address.setAddress(url.host())) {
+            // the addresses are cached, so createConnection() resolves nothing again.
+            dnsCache->resolve(url.host());
+            timings->dns = elapsedUsecs(timer);
+            timer.restart();
+        }
         QSharedPointer<Socket> rawSocket;
-        rawSocket.reset(Socket::createConnection(url.host(), port, nullptr, dnsCache));
+        if (balancingAddresses) {
+            QSharedPointer<PooledAddress> picked;
+            rawSocket.reset(connectBalanced(url.host(), port, &picked));
+            if (address) {
+                *address = picked;
+            }
+        } else if (tcpFastOpen) {
+            // the first request goes in the SYN if the server gave a cookie before.
+            std::function<Socket *(HostAddress::NetworkLayerProtocol)> makeSocket =
+                    [](HostAddress::NetworkLayerProtocol protocol) {
+                        Socket *socket = new Socket(protocol);
+                        socket->setOption(Socket::FastOpenConnectSocketOption, 1);
+                        return socket;
+                    };
+            rawSocket.reset(createConnection<Socket>(url.host(), port, nullptr, dnsCache,
+                                                     HostAddress::IPv4Protocol | HostAddress::IPv6Protocol,
+                                                     makeSocket));
+        } else {
+            rawSocket.reset(Socket::createConnection(url.host(), port, nullptr, dnsCache));
+        }
         if (rawSocket.isNull()) {
             *error = new ConnectionError();
             return QSharedPointer<SocketLike>();
@@ -845,14 +1368,24 @@ QSharedPointer<SocketLike> ConnectionPool::newConnectionForUrl(const QUrl &url,
         }
         connection = asSocketLike(rawSocket);
     }
+    if (timings) {
+        timings->connect = elapsedUsecs(timer);
+        timer.restart();
+    }
 
     if (url.scheme() == QString::fromLatin1("https")) {
 #ifndef QTNG_NO_CRYPTO
         QSharedPointer<SslSocket> ssl(new SslSocket(connection, sslConfig));
+        if (!earlyData.isEmpty()) {
+            ssl->setEarlyData(earlyData, "http/1.1");
+        }
         if (!ssl->handshake(false, url.host())) {
             *error = new ConnectionError();
             return QSharedPointer<SocketLike>();
         }
+        if (timings) {
+            timings->tlsHandshake = elapsedUsecs(timer);
+        }
         connection = asSocketLike(ssl);
 #else
         *error = new ConnectionError();
@@ -870,16 +1403,115 @@ void ConnectionPool::removeUnusedConnections()
         } catch (CoroutineException &) {
             return;
         }
-        const QDateTime &now = QDateTime::currentDateTimeUtc();
-        QMap<QUrl, ConnectionPoolItem> newItems;
-        for (QMap<QUrl, ConnectionPoolItem>::const_iterator itor = items.constBegin(); itor != items.constEnd();
-             ++itor) {
-            if (itor.value().lastUsed.secsTo(now) < timeToLive || itor.value().semaphore->isUsed()) {
-                newItems.insert(itor.key(), itor.value());
+        const qint64 now = EventLoopCoroutine::get()->now();
+        const qint64 ttl = static_cast<qint64>(timeToLive) * 1000;
+        QList<QPair<QUrl, int>> warming;
+        QMutableHashIterator<ConnectionPoolKey, ConnectionPoolItem> itor(items);
+        while (itor.hasNext()) {
+            ConnectionPoolItem &item = itor.next().value();
+            while (item.idle.size() > item.minIdle && now - item.idle.first()->lastUsed >= ttl) {
+                item.idle.removeFirst();
+                ++stats.droppedConnections;
+                httpClientMetrics().poolDropped->add();
+            }
+            if (item.minIdle > 0) {
+                // the warm connections outlive the idle timeout, but not the closing of servers.
+                for (int i = item.idle.size() - 1; i >= 0; --i) {
+                    if (!isIdleConnected(item.idle.at(i)->connection)) {
+                        item.idle.removeAt(i);
+                        ++stats.droppedConnections;
+                        httpClientMetrics().poolDropped->add();
+                    }
+                }
+                const int lacking = item.minIdle - item.idle.size() - item.connecting;
+                if (item.http2.isNull() && lacking > 0) {
+                    warming.append(qMakePair(item.warmUrl, lacking));
+                }
+            }
+            if (!item.http2.isNull()
+                && (!item.http2->isValid() || (item.http2->activeStreams() == 0 && now - item.lastUsed >= ttl))) {
+                item.http2.clear();
+            }
+            if (item.idle.isEmpty() && item.pipelining.isEmpty() && item.http2.isNull() && now - item.lastUsed >= ttl
+                && !item.semaphore->isUsed() && item.minIdle == 0 && item.connecting == 0) {
+                itor.remove();
+            }
+        }
+        for (const QPair<QUrl, int> &p : warming) {
+            preconnect(p.first, p.second);
+        }
+    }
+}
+
+void ConnectionPool::preconnect(const QUrl &url, int count)
+{
+    const ConnectionPoolKey &key = keyForUrl(url);
+    ConnectionPoolItem &item = getItem(key);
+    if (!item.http2.isNull()) {
+        return;
+    }
+    const int n = qMin(count, maxConnectionsPerServer - item.idle.size() - item.connecting);
+    for (int i = 0; i < n; ++i) {
+        ++item.connecting;
+        operations->spawn([this, url, key] { makeIdleConnection(url, key); });
+    }
+}
+
+void ConnectionPool::setMinIdleConnections(const QUrl &url, int count)
+{
+    ConnectionPoolItem &item = getItem(keyForUrl(url));
+    item.minIdle = qMax(0, count);
+    item.warmUrl = url;
+    preconnect(url, item.minIdle - item.idle.size() - item.connecting);
+}
+
+void ConnectionPool::makeIdleConnection(const QUrl &url, const ConnectionPoolKey &key)
+{
+    RequestError *error = nullptr;
+    QSharedPointer<SocketLike> connection;
+    QSharedPointer<PooledAddress> address;
+    try {
+        Timeout timeout(defaultConnectionTimeout);
+        connection = newConnectionForUrl(url, &error, nullptr, &address);
+    } catch (TimeoutException &) {
+        connection.clear();
+    }
+    delete error;
+    ConnectionPoolItem &item = getItem(key);
+    item.connecting = qMax(0, item.connecting - 1);
+    if (connection.isNull()) {
+        return;
+    }
+    ++stats.createdConnections;
+#ifndef QTNG_NO_CRYPTO
+    QSharedPointer<SslSocket> ssl = convertSocketLikeToSslSocket(connection);
+    if (!ssl.isNull() && ssl->nextNegotiatedProtocol() == "h2") {
+        if (item.http2.isNull()) {
+            QSharedPointer<Http2Connection> http2(new Http2Connection(connection, false));
+            if (http2->handshake()) {
+                getItem(key).http2 = http2;
             }
         }
-        items = newItems;
+        return;
+    }
+#endif
+    QSharedPointer<PooledConnection> pooled(new PooledConnection(connection, address));
+    pooled->lastUsed = EventLoopCoroutine::get()->now();
+    item.idle.append(pooled);
+}
+
+HttpConnectionPoolStats ConnectionPool::poolStats() const
+{
+    HttpConnectionPoolStats result = stats;
+    result.servers = items.size();
+    for (const ConnectionPoolItem &item : items) {
+        result.idleConnections += item.idle.size();
+        result.pipeliningConnections += item.pipelining.size();
+        if (!item.http2.isNull()) {
+            ++result.http2Connections;
+        }
     }
+    return result;
 }
 
 QSharedPointer<SocketProxy> ConnectionPool::socketProxy() const
@@ -929,48 +1561,10 @@ void ConnectionPool::setHttpProxy(QSharedPointer<HttpProxy> proxy)
     }
 }
 
-RequestError *toRequestError(HeaderSplitter::Error error)
-{
-    switch (error) {
-    case HeaderSplitter::ConnectionError:
-        return new ConnectionError();
-    case HeaderSplitter::EncodingError:
-        return new InvalidHeader();
-    case HeaderSplitter::ExhausedMaxLine:
-        return new InvalidHeader();
-    case HeaderSplitter::LineTooLong:
-        return new InvalidHeader();
-    default:
-        return nullptr;
-    }
-}
+// the body is sent anyway if the server does not answer `Expect: 100-continue` in time, see rfc 7231.
+const quint32 ExpectContinueMsecs = 1000;
 
-// for old qt
-#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
-#  define QBYTEARRAYLIST QByteArrayList
-inline static QByteArray join(const QByteArrayList &lines)
-{
-    return lines.join();
-}
-#else
-#  define QBYTEARRAYLIST QList<QByteArray>
-inline static QByteArray join(const QList<QByteArray> &lines)
-{
-    QByteArray buf;
-    buf.reserve(1024 * 4 - 1);
-    for (const QByteArray &line : lines) {
-        buf.append(line);
-    }
-    return buf;
-}
-#endif
-inline static QString join(QChar c, const QStringList &l)
-{
-    return l.join(c);
-}
-// inline static QString join(QChar c, const QList<QString> &l) { return QStringList(l).join(c); }
-
-class SendRequestBodyCoroutine : public Coroutine
+class SendRequestBodyCoroutine : public Coroutine
 {
 public:
     SendRequestBodyCoroutine(QPointer<Coroutine> parentCoroutine, QSharedPointer<SocketLike> connection,
@@ -999,10 +1593,55 @@ void SendRequestBodyCoroutine::run()
     }
 }
 
-HttpResponse HttpSessionPrivate::send(HttpRequest &request)
+// every pooled request releases its connection on return, the connection is reused only if the whole response
+// is read.
+class PooledConnectionReleaser
 {
-    RequestError *error = nullptr;
+public:
+    explicit PooledConnectionReleaser(ConnectionPool *pool)
+        : pool(pool)
+        , reusable(false)
+    {
+    }
+    ~PooledConnectionReleaser()
+    {
+        if (!pooled.isNull()) {
+            pool->release(key, pooled, reusable);
+        }
+    }
+public:
+    ConnectionPool *pool;
+    ConnectionPoolKey key;
+    QSharedPointer<PooledConnection> pooled;
+    bool reusable;
+};
+
+class InflightRequestGuard
+{
+public:
+    InflightRequestGuard(HttpSessionPrivate *session, const QByteArray &key,
+                         QSharedPointer<HttpInflightRequest> inflight)
+        : session(session)
+        , key(key)
+        , inflight(inflight)
+    {
+    }
+    ~InflightRequestGuard()
+    {
+        if (session->inflights.value(key) == inflight) {
+            session->inflights.remove(key);
+        }
+        inflight->done.set();
+    }
+public:
+    HttpSessionPrivate *session;
+    QByteArray key;
+    QSharedPointer<HttpInflightRequest> inflight;
+};
 
+HttpResponse HttpSessionPrivate::send(HttpRequest &request)
+{
+    QTNG_TRACE_SCOPE("http", "http request");
     QUrl &url = request.d->url;
     HttpResponse response;
     response.d->url = url;
@@ -1030,14 +1669,17 @@ HttpResponse HttpSessionPrivate::send(HttpRequest &request)
         response.d->url = url;
     }
 
+    QList<HttpHeader> validators;  // revalidate the stale response in cache.
     if (!cacheManager.isNull()
         && (request.d->method == QLatin1String("GET") || request.d->method == QLatin1String("HEAD")
             || request.d->method == QLatin1String("OPTION"))) {
-        const QByteArray &cacheControlHeader = request.header(KnownHeader::CacheControlHeader);
-        if (!cacheControlHeader.contains("no-cache")) {
-            if (cacheManager->getResponse(&response)) {
-                return response;
-            }
+        if (cacheManager->getResponse(&response)) {
+            return response;
+        }
+        cacheManager->getValidators(&response, &validators);
+        if (request.d->streamResponse || request.hasHeader(QString::fromLatin1("If-None-Match"))
+            || request.hasHeader(QString::fromLatin1("If-Modified-Since"))) {
+            validators.clear();  // the conditional request of user, or the body is not read by session.
         }
     }
 
@@ -1045,16 +1687,39 @@ HttpResponse HttpSessionPrivate::send(HttpRequest &request)
         request.d->version = defaultVersion;
     }
 
-    mergeCookies(request, url);
-    QList<HttpHeader> allHeaders = makeHeaders(request, url);
+    QSharedPointer<HttpInflightRequest> inflight;
+    QScopedPointer<InflightRequestGuard> guard;  // the waiters are woken even if this coroutine is killed.
+    if (coalescingRequests && !request.d->streamResponse && request.d->body.isNull() && request.d->connection.isNull()
+        && (request.d->method == QLatin1String("GET") || request.d->method == QLatin1String("HEAD"))) {
+        const QByteArray &inflightKey = coalescingKey(request, url);
+        QSharedPointer<HttpInflightRequest> leader = inflights.value(inflightKey);
+        if (!leader.isNull()) {
+            leader->done.wait();
+            if (leader->completed) {
+                return leader->response;
+            }
+        } else {
+            inflight.reset(new HttpInflightRequest());
+            inflights.insert(inflightKey, inflight);
+            guard.reset(new InflightRequestGuard(this, inflightKey, inflight));
+        }
+    }
+
+    const QByteArray &cookieHeader = mergeCookies(request, url);
+    const bool chunkedBody = isChunkedBody(request);
+    // only h2 needs the list of headers.
+    auto http2Headers = [this, &request, &url, &cookieHeader, &validators] {
+        QList<HttpHeader> allHeaders = makeHeaders(request, url, cookieHeader);
+        allHeaders.append(validators);
+        return allHeaders;
+    };
 
-    QByteArray versionBytes;
+    const char *versionBytes;
     if (request.d->version == HttpVersion::Http1_0) {
         versionBytes = "HTTP/1.0";
-    } else if (request.d->version == HttpVersion::Http1_1) {
+    } else if (request.d->version == HttpVersion::Http1_1 || request.d->version == HttpVersion::Http2_0) {
+        // http2 is used only if the server selects h2 by ALPN, or else fallback to http 1.1
         versionBytes = "HTTP/1.1";
-        //    } else if(request.d->version == HttpVersion::Http2_0) {
-        //        versionBytes = "HTTP/2.0";
     } else {
         if (debugLevel > 0) {
             qtng_debug << "invalid http version:" << request.d->version;
@@ -1063,75 +1728,236 @@ HttpResponse HttpSessionPrivate::send(HttpRequest &request)
         return response;
     }
 
-    QBYTEARRAYLIST lines;
-    QByteArray resourcePath = url.toEncoded(QUrl::RemoveAuthority | QUrl::RemoveFragment | QUrl::RemoveScheme);
-    if (resourcePath.isEmpty()) {
-        resourcePath = "/";
+    const QByteArray &headerBytes = serializeRequest(request, url, cookieHeader, validators, versionBytes);
+    if (debugLevel > 0) {
+        qtng_debug << "sending headers:" << headerBytes;
+    }
+
+    if (inflight.isNull()) {
+        return transfer(request, response, headerBytes, chunkedBody, http2Headers);
     }
-    const QByteArray &commandLine = request.d->method.toUpper().toUtf8() + QByteArray(" ") + resourcePath
-            + QByteArray(" ") + versionBytes + QByteArray("\r\n");
-    lines.append(commandLine);
-    for (int i = 0; i < allHeaders.size(); ++i) {
-        const HttpHeader &header = allHeaders.at(i);
-        lines.append(header.name.toUtf8() + QByteArray(": ") + header.value + QByteArray("\r\n"));
+    inflight->response = transfer(request, response, headerBytes, chunkedBody, http2Headers);
+    inflight->completed = true;
+    return inflight->response;
+}
+
+QByteArray HttpSessionPrivate::coalescingKey(HttpRequest &request, const QUrl &url)
+{
+    QByteArray key = request.d->method.toLatin1();
+    key.append(' ');
+    key.append(url.toEncoded());
+    key.append(' ');
+    key.append(QByteArray::number(static_cast<int>(request.d->version)));
+    key.append(request.d->userAgent.toUtf8());
+    for (const HttpHeader &header : request.allHeaders()) {
+        key.append('\n');
+        key.append(header.name.toUtf8());
+        key.append(':');
+        key.append(header.value);
     }
-    lines.append(QByteArray("\r\n"));
-    if (debugLevel > 0) {
-        for (const QByteArray &line : lines) {
-            qtng_debug << "sending headers:" << line;
-        }
+    for (const HttpCookie &cookie : request.d->cookies) {
+        key.append('\n');
+        key.append(cookie.toRawForm(HttpCookie::NameAndValueOnly));
     }
-    const QByteArray &headerBytes = join(lines);
+    return key;
+}
+
+HttpResponse HttpSessionPrivate::transfer(HttpRequest &request, HttpResponse &response, const QByteArray &headerBytes,
+                                          bool chunkedBody, const std::function<QList<HttpHeader>()> &http2Headers)
+{
+    RequestError *error = nullptr;
+    // the phases are measured only if requested, or else every probe is a branch.
+    const bool recordingTimings = request.d->recordTimings;
+    QElapsedTimer phaseTimer;
+    const QUrl url = response.d->url;
 
     QScopedPointer<ScopedLock<Semaphore>> ptrLock;
     QSharedPointer<Semaphore> lock;
+    PooledConnectionReleaser releaser(this);
+    QSharedPointer<PooledConnection> &pooled = releaser.pooled;
+    // only GET requests without body are pipelined, and their responses are read here completely.
+    const bool pipelinable = pipelining && keepAlive && request.d->body.isNull() && !request.streamResponse()
+            && request.d->method.compare(QLatin1String("GET"), Qt::CaseInsensitive) == 0;
+    // the early data may be replayed, so only the idempotent requests are sent with the ClientHello.
+    const bool earlyDataAllowed = request.d->body.isNull()
+            && (request.d->method.compare(QLatin1String("GET"), Qt::CaseInsensitive) == 0
+                || request.d->method.compare(QLatin1String("HEAD"), Qt::CaseInsensitive) == 0);
+    bool sentEarly = false;
 
     QSharedPointer<SocketLike> connection = request.connection();
     if (connection.isNull()) {
-        lock = getSemaphore(url);
-        ptrLock.reset(new ScopedLock<Semaphore>(*lock));
-        if (!ptrLock->isSuccess()) {
-            response.setError(new ConnectionError());
-            return response;
+        QTNG_TRACE_SCOPE("http", "http get connection");
+        releaser.key = keyForUrl(url);
+        const bool http2Allowed = keepAlive && url.scheme() == QLatin1String("https");
+        QSharedPointer<Http2Connection> http2;
+        if (http2Allowed) {
+            http2 = http2Connection(releaser.key);
+            if (!http2.isNull()) {
+                response.d->timings.reusedConnection = true;
+                return sendHttp2(request, response, http2, http2Headers());
+            }
         }
-
-        // try keep-alive connections first.
-        if (keepAlive) {
-            connection = oldConnectionForUrl(url);
+        if (pipelinable) {
+            pooled = pipelinedConnection(releaser.key);
+            response.d->timings.reusedConnection = !pooled.isNull();
         }
-        // make a new connection.
-        if (connection.isNull()) {
-            float timeout = request.d->connectionTimeout < 0 ? defaultConnectionTimeout : request.d->connectionTimeout;
-            try {
-                Timeout t(timeout);
-                connection = newConnectionForUrl(url, &error);
-            } catch (TimeoutException &) {
-                response.setError(new ConnectTimeout());
+        if (pooled.isNull()) {
+            lock = getSemaphore(releaser.key);
+            ptrLock.reset(new ScopedLock<Semaphore>(*lock));
+            if (!ptrLock->isSuccess()) {
+                response.setError(new ConnectionError());
                 return response;
             }
-            if (error != nullptr) {
-                response.setError(error);
-                return response;
+            // the h2 connection may be made while waiting.
+            if (http2Allowed) {
+                http2 = http2Connection(releaser.key);
+                if (!http2.isNull()) {
+                    ptrLock.reset();
+                    response.d->timings.reusedConnection = true;
+                    return sendHttp2(request, response, http2, http2Headers());
+                }
+            }
+
+            // try keep-alive connections first.
+            if (keepAlive) {
+                pooled = idleConnection(releaser.key);
+                response.d->timings.reusedConnection = !pooled.isNull();
+            }
+            // make a new connection.
+            if (pooled.isNull()) {
+                float timeout =
+                        request.d->connectionTimeout < 0 ? defaultConnectionTimeout : request.d->connectionTimeout;
+                QSharedPointer<PooledAddress> address;
+                try {
+                    Timeout t(timeout);
+                    connection = newConnectionForUrl(url, &error, recordingTimings ? &response.d->timings : nullptr,
+                                                     &address, earlyDataAllowed ? headerBytes : QByteArray());
+                } catch (TimeoutException &) {
+                    response.setError(new ConnectTimeout());
+                    return response;
+                }
+                if (error != nullptr) {
+                    response.setError(error);
+                    return response;
+                }
+                ++stats.createdConnections;
+                httpClientMetrics().poolMisses->add();
+#ifndef QTNG_NO_CRYPTO
+                QSharedPointer<SslSocket> ssl = convertSocketLikeToSslSocket(connection);
+                // the rejected early data is sent again as usual.
+                sentEarly = !ssl.isNull() && ssl->isEarlyDataAccepted();
+                if (!ssl.isNull() && ssl->nextNegotiatedProtocol() == "h2") {
+                    // the streams are not limited by maxConnectionsPerServer.
+                    ptrLock.reset();
+                    http2 = startHttp2(releaser.key, connection, keepAlive);
+                    if (http2.isNull()) {
+                        response.setError(new ConnectionError());
+                        return response;
+                    }
+                    return sendHttp2(request, response, http2, http2Headers());
+                }
+#endif
+                pooled.reset(new PooledConnection(connection, address));
+            }
+            if (pipelinable) {
+                startPipelining(releaser.key, pooled);
             }
         }
+        connection = pooled->connection;
     }
 
-    if (connection->sendall(headerBytes) != headerBytes.size()) {
+    quint64 ticket = 0;
+    if (!pooled.isNull()) {
+        // the requests are written in the order of their tickets, and so are the responses read.
+        ScopedLock<Lock> writing(pooled->writing);
+        if (!writing.isSuccess() || pooled->broken) {
+            response.setError(new ConnectionError());
+            return response;
+        }
+        ticket = pooled->sentRequests++;
+        if (!sentEarly && connection->sendall(headerBytes) != headerBytes.size()) {
+            response.setError(new ConnectionError());
+            return response;
+        }
+    } else if (!sentEarly && connection->sendall(headerBytes) != headerBytes.size()) {
         response.setError(new ConnectionError());
         return response;
     }
+    QTNG_TRACE_INSTANT("http", "http headers sent", "bytes", headerBytes.size());
+    if (recordingTimings) {
+        phaseTimer.start();
+    }
 
-    HeaderSplitter headerSplitter(connection, debugLevel);
-    HeaderSplitter::Error headerSplitterError;
+    QByteArray unread;
+    if (!pooled.isNull()) {
+        while (!pooled->broken && pooled->readResponses != ticket) {
+            if (!pooled->turn.wait()) {
+                break;
+            }
+        }
+        if (pooled->broken || pooled->readResponses != ticket) {
+            response.setError(new ConnectionError());
+            return response;
+        }
+        unread.swap(pooled->unread);
+    }
+
+    BufferedSocketReader reader(connection, unread);
+    const int MaxHeaders = 64;
+    const int MaxHeadSize = 1024 * 64;
+    HttpHeaderSlice headerSlices[MaxHeaders];
+    HttpSlice statusText;
+    int minorVersion;
+    int statusCode;
+    int numHeaders;
+    int headSize;
+
+    // the server may reject the body by a final response before 100 Continue, or say nothing in a while.
+    bool bodyRejected = false;
+    if (!request.d->body.isNull() && request.header(QString::fromLatin1("Expect")).toLower() == "100-continue") {
+        try {
+            Timeout timeout(ExpectContinueMsecs, 0);
+            reader.fill();
+        } catch (TimeoutException &) {
+            const qint64 deadline = Timeout::currentDeadline();
+            if (deadline >= 0 && deadline <= EventLoopCoroutine::get()->now()) {
+                throw;  // the timeout of request.
+            }
+        }
+        while (reader.bufferedSize() > 0) {
+            numHeaders = MaxHeaders;
+            headSize = parseHttpResponseHead(reader.bufferedData(), reader.bufferedSize(), &minorVersion,
+                                             &statusCode, &statusText, headerSlices, &numHeaders);
+            if (headSize == HttpParseIncomplete && reader.bufferedSize() <= MaxHeadSize) {
+                if (reader.fill() <= 0) {
+                    response.setError(new ConnectionError());
+                    return response;
+                }
+                continue;
+            }
+            if (headSize >= 0 && statusCode == 100) {
+                reader.skip(headSize);
+            } else {
+                bodyRejected = true;  // the final response is parsed below.
+            }
+            break;
+        }
+    }
+    QSharedPointer<FileLike> requestBody = request.d->body;
+    if (chunkedBody) {
+        requestBody.reset(new ChunkedEncodedFile(requestBody));
+    }
     QScopedPointer<Coroutine> sendingReuqestBodyCoroutine(
-            new SendRequestBodyCoroutine(Coroutine::current(), connection, request.d->body));
-    if (!request.d->body.isNull()) {
+            new SendRequestBodyCoroutine(Coroutine::current(), connection, requestBody));
+    if (!request.d->body.isNull() && !bodyRejected) {
         if (debugLevel > 0) {
             qtng_debug << "sending body:" << request.d->body->size();
         }
         sendingReuqestBodyCoroutine->start();
         try {
-            headerSplitter.buf = connection->recv(1024 * 8);
+            if (reader.bufferedSize() == 0) {
+                reader.fill();
+            }
             if (sendingReuqestBodyCoroutine->isRunning()) {
                 sendingReuqestBodyCoroutine->kill();
                 sendingReuqestBodyCoroutine->join();
@@ -1144,66 +1970,76 @@ HttpResponse HttpSessionPrivate::send(HttpRequest &request)
         }
     }
 
-    // parse first line.
-    const QByteArray &firstLine = headerSplitter.nextLine(&headerSplitterError);
-    error = toRequestError(headerSplitterError);
-    if (error != nullptr) {
-        response.setError(error);
-        return response;
-    }
-    QStringList commands = QString::fromLatin1(firstLine).split(QRegExp(QLatin1String("\\s+")));
-    if (commands.size() < 3) {
-        response.setError(new InvalidHeader());
-        return response;
-    }
-    if (commands.at(0) == QString::fromLatin1("HTTP/1.0")) {
-        response.d->version = Http1_0;
-    } else if (commands.at(0) == QString::fromLatin1("HTTP/1.1")) {
-        response.d->version = Http1_1;
-    } else {
-        response.setError(new InvalidHeader());
-        return response;
-    }
-    bool ok;
-    response.d->statusCode = commands.at(1).toInt(&ok);
-    if (!ok) {
-        response.setError(new InvalidHeader());
-        return response;
-    }
-    response.d->statusText = join(QLatin1Char(' '), commands.mid(2));
-
-    // parse headers.
-    const int MaxHeaders = 64;
-    QList<HttpHeader> headers = headerSplitter.headers(MaxHeaders, &headerSplitterError);
-    if (headerSplitterError != HeaderSplitter::NoError) {
-        response.setError(toRequestError(headerSplitterError));
-        return response;
-    } else {
-        response.setHeaders(headers);
-        if (debugLevel > 0) {
-            for (const HttpHeader &header : headers) {
-                qtng_debug << "receiving header:" << header.name << header.value;
+    // parse the status line and headers in place.
+    QTNG_TRACE_INSTANT("http", "http waiting response", "ticket", static_cast<qint64>(ticket));
+    while (true) {
+        if (recordingTimings && response.d->timings.timeToFirstByte < 0 && reader.bufferedSize() > 0) {
+            response.d->timings.timeToFirstByte = elapsedUsecs(phaseTimer);
+            phaseTimer.restart();
+        }
+        numHeaders = MaxHeaders;
+        headSize = parseHttpResponseHead(reader.bufferedData(), reader.bufferedSize(), &minorVersion, &statusCode,
+                                         &statusText, headerSlices, &numHeaders);
+        if (headSize >= 0 && statusCode == 100) {
+            reader.skip(headSize);  // the interim response sent without asking.
+        } else if (headSize >= 0) {
+            break;
+        } else if (headSize == HttpParseIncomplete && reader.bufferedSize() <= MaxHeadSize) {
+            if (reader.fill() <= 0) {
+                response.setError(new ConnectionError());
+                return response;
             }
+        } else {
+            response.setError(new InvalidHeader());
+            return response;
         }
     }
-
-    // merge cookies.
-    if (managingCookies && response.hasHeader(QString::fromLatin1("Set-Cookie"))) {
-        for (const QByteArray &value : response.multiHeader(QString::fromLatin1("Set-Cookie"))) {
-            const QList<HttpCookie> &cookies = HttpCookie::parseCookies(value);
-            if (debugLevel > 0 && !cookies.isEmpty()) {
-                qtng_debug << "receiving cookie:" << cookies[0].toRawForm();
-            }
-            response.d->cookies.append(cookies);
+    QTNG_TRACE_INSTANT("http", "http response head", "status", statusCode);
+    if (recordingTimings) {
+        response.d->timings.headerParse = elapsedUsecs(phaseTimer);
+    }
+    const char *head = reader.bufferedData();
+    response.d->version = minorVersion == 0 ? Http1_0 : Http1_1;
+    response.d->statusCode = statusCode;
+    response.d->statusText = QString::fromLatin1(head + statusText.offset, statusText.length);
+    const QList<HttpHeader> &headers = toHttpHeaders(head, headerSlices, numHeaders);
+    reader.skip(headSize);
+    response.setHeaders(headers);
+    if (debugLevel > 0) {
+        for (const HttpHeader &header : headers) {
+            qtng_debug << "receiving header:" << header.name << header.value;
         }
-        cookieJar.setCookiesFromUrl(response.d->cookies, response.d->url);
     }
 
+    mergeResponseCookies(response);
+
     // read body.
-    response.d->body = headerSplitter.buf;
+    response.d->body = reader.takeBuffered();
     response.d->stream = connection;
+    // without a length or chunked framing, the body is read until the server closes the connection.
+    const qint64 contentLength = response.getContentLength();
+    const bool chunked = response.header(KnownHeader::TransferEncodingHeader).toLower().contains("chunked");
+    bool delimited = contentLength >= 0 || chunked;
+    if (pipelinable && !pooled.isNull()) {
+        // the next pipelined response may be received already.
+        if (contentLength >= 0 && !response.hasHeader(KnownHeader::TransferEncodingHeader)) {
+            if (response.d->body.size() > contentLength) {
+                pooled->unread = response.d->body.mid(static_cast<int>(contentLength));
+                response.d->body.truncate(static_cast<int>(contentLength));
+            }
+        } else {
+            delimited = false;
+        }
+    }
     if (!request.streamResponse()) {
+        QTNG_TRACE_SCOPE("http", "http read body");
+        if (recordingTimings) {
+            phaseTimer.restart();
+        }
         const QByteArray &body = response.body();
+        if (recordingTimings) {
+            response.d->timings.bodyDownload = elapsedUsecs(phaseTimer);
+        }
         if (!response.d->error.isNull()) {
             return response;
         }
@@ -1212,145 +2048,601 @@ HttpResponse HttpSessionPrivate::send(HttpRequest &request)
         } else if (debugLevel > 1 && !body.isEmpty()) {
             qtng_debug << "receiving body:" << body;
         }
-        if (!ptrLock.isNull() && connection->isValid()
-            && response.header(KnownHeader::ConnectionHeader).toLower() == "keep-alive" && keepAlive) {
-            recycle(response.d->url, connection);
-        }
+        const QByteArray &connectionHeader = response.header(KnownHeader::ConnectionHeader).toLower();
+        const bool keepingAlive = response.d->version == Http1_0 ? connectionHeader == "keep-alive"
+                                                                  : connectionHeader != "close";
+        releaser.reusable = delimited && keepingAlive && keepAlive && !bodyRejected && connection->isValid();
         response.d->stream.clear();
     }
-
-    // response.d->statusCode < 200 is not error.
-    if (response.d->statusCode >= 400) {
-        response.setError(new HTTPError(response.d->statusCode));
-    } else {
-        const QString &rm = request.method().toUpper();
-        if ((rm == QLatin1String("GET") || rm == QLatin1String("HEAD") || rm == QLatin1String("OPTION"))
-            && !cacheManager.isNull() && !request.streamResponse()) {
-            bool doCache = true;
-            const QByteArray &requestHeader = request.header(KnownHeader::CacheControlHeader).toLower();
-            if (requestHeader.contains("no-cache") || requestHeader.contains("no-store")) {
-                doCache = false;
-            } else {
-                const QByteArray &responseHeader = response.header(KnownHeader::CacheControlHeader).toLower();
-                if (responseHeader.contains("public") || responseHeader.contains("private")) {
-                    doCache = true;
-                } else if (responseHeader.contains("no-cache") || responseHeader.contains("no-store")) {
-                    doCache = false;
-                } else {
-                    doCache = false;
-                }
-            }
-            if (doCache) {
-                cacheManager->addResponse(response);
-            }
-        }
-    }
+    finishResponse(request, response);
     return response;
 }
 
-QList<HttpHeader> HttpSessionPrivate::makeHeaders(HttpRequest &request, const QUrl &url)
+bool HttpSessionPrivate::prepare(const HttpRequest &request, PreparedHttpRequestPrivate *prepared)
 {
-    QList<HttpHeader> allHeaders = request.allHeaders();
-
-    if (!request.hasHeader(QString::fromLatin1("Connection")) && request.version() == Http1_1) {
-        if (keepAlive) {
-            allHeaders.prepend(HttpHeader(QString::fromLatin1("Connection"), QByteArray("keep-alive")));
-        } else {
-            allHeaders.prepend(HttpHeader(QString::fromLatin1("Connection"), QByteArray("close")));
-        }
-    }
-    if (!request.hasHeader(QString::fromLatin1("Content-Length")) && !request.d->body.isNull()) {
-        qint64 requestBodySize = request.d->body->size();
-        if (requestBodySize > 0) {
-            allHeaders.prepend(HttpHeader(QString::fromLatin1("Content-Length"), QByteArray::number(requestBodySize)));
-        }
-    }
-    if (!request.hasHeader(QString::fromLatin1("User-Agent"))) {
-        if (request.userAgent().isEmpty()) {
-            allHeaders.prepend(HttpHeader(QString::fromLatin1("User-Agent"), defaultUserAgent.toUtf8()));
-        } else {
-            allHeaders.prepend(HttpHeader(QString::fromLatin1("User-Agent"), request.userAgent().toUtf8()));
-        }
+    HttpRequest r = request;
+    QUrl url = r.d->url;
+    if ((url.scheme() != QLatin1String("http") && url.scheme() != QLatin1String("https")) || r.d->method.isEmpty()) {
+        return false;
     }
-    if (!request.hasHeader(QString::fromLatin1("Host"))) {
-        QString httpHost = url.host();
-        if (url.port() != -1) {
-            httpHost += QString::fromLatin1(":") + QString::number(url.port());
+    if (!r.d->query.isEmpty()) {
+        QUrlQuery query(url);
+        for (const QPair<QString, QString> &p : r.d->query.queryItems()) {
+            query.addQueryItem(p.first, p.second);
         }
-        allHeaders.prepend(HttpHeader(QString::fromLatin1("Host"), httpHost.toUtf8()));
-    }
-    if (!request.hasHeader(QString::fromLatin1("Accept"))) {
-        allHeaders.append(HttpHeader(QString::fromLatin1("Accept"), QByteArray("*/*")));
-    }
-    if (!request.hasHeader(QString::fromLatin1("Accept-Language"))) {
-        allHeaders.append(HttpHeader(QString::fromLatin1("Accept-Language"), QByteArray("en-US,en;q=0.5")));
+        url.setQuery(query);
+        r.d->url = url;
+        r.d->query.clear();
     }
-    if (!request.hasHeader(QString::fromLatin1("Accept-Encoding"))) {
-#ifdef QTNG_HAVE_ZLIB
-        allHeaders.append(HttpHeader(QString::fromLatin1("Accept-Encoding"), QByteArray("gzip, deflate")));
-#else
-        allHeaders.append(HttpHeader(QString::fromLatin1("Accept-Encoding"), QByteArray("identity")));
-#endif
+    if (r.d->version == HttpVersion::Unknown) {
+        r.d->version = defaultVersion;
     }
-    if (!request.d->cookies.isEmpty() && !request.hasHeader(QString::fromLatin1("Cookie"))) {
-        QByteArray result;
-        bool first = true;
-        for (const HttpCookie &cookie : request.d->cookies) {
-            if (!first)
-                result += "; ";
-            first = false;
-            result += cookie.toRawForm(HttpCookie::NameAndValueOnly);
-        }
-        allHeaders.append(HttpHeader(QString::fromLatin1("Cookie"), result));
+    const char *versionBytes;
+    if (r.d->version == HttpVersion::Http1_0) {
+        versionBytes = "HTTP/1.0";
+    } else if (r.d->version == HttpVersion::Http1_1 || r.d->version == HttpVersion::Http2_0) {
+        versionBytes = "HTTP/1.1";
+    } else {
+        return false;
     }
-    return allHeaders;
+    r.setBody(QSharedPointer<FileLike>());
+
+    const QByteArray &serialized = serializeRequest(r, url, QByteArray(), QList<HttpHeader>(), versionBytes);
+    const int lineEnd = serialized.indexOf("\r\n");
+    const int pathStart = serialized.indexOf(' ') + 1;
+    const int pathEnd = serialized.lastIndexOf(' ', lineEnd);
+    prepared->request = r;
+    prepared->url = url;
+    prepared->method = serialized.left(pathStart);
+    prepared->path = serialized.mid(pathStart, pathEnd - pathStart);
+    prepared->version = serialized.mid(pathEnd, lineEnd + 2 - pathEnd);
+    prepared->headers = serialized.mid(lineEnd + 2, serialized.size() - lineEnd - 4);
+    return true;
 }
 
-void HttpSessionPrivate::mergeCookies(HttpRequest &request, const QUrl &url)
+HttpResponse HttpSessionPrivate::sendPrepared(const PreparedHttpRequestPrivate &prepared,
+                                              const QByteArray &pathAndQuery, const QByteArray &body,
+                                              const QList<HttpHeader> &extraHeaders)
 {
-    if (!managingCookies) {
-        return;
+    QTNG_TRACE_SCOPE("http", "http prepared request");
+    const QByteArray &path = pathAndQuery.isEmpty() ? prepared.path : pathAndQuery;
+    int size = prepared.method.size() + path.size() + prepared.version.size() + prepared.headers.size() + 48;
+    for (const HttpHeader &header : extraHeaders) {
+        size += header.name.size() + header.value.size() + 4;
     }
-    QList<HttpCookie> cookies = cookieJar.cookiesForUrl(url);
-    if (cookies.isEmpty()) {
-        return;
+    QByteArray head;
+    head.reserve(size);
+    head.append(prepared.method);
+    head.append(path);
+    head.append(prepared.version);
+    head.append(prepared.headers);
+    for (const HttpHeader &header : extraHeaders) {
+        head.append(header.name.toUtf8());
+        head.append(": ", 2);
+        head.append(header.value);
+        head.append("\r\n", 2);
     }
-    for (const HttpCookie &cookie : cookies) {
-        bool found = false;
-        for (const HttpCookie &newCookie : request.d->cookies) {
-            if (newCookie.hasSameIdentifier(cookie) && newCookie.isSecure() == cookie.isSecure()
-                && newCookie.isHttpOnly() == cookie.isHttpOnly()) {
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            request.d->cookies.append(cookie);
-        }
+    HttpRequest request = prepared.request;
+    if (!body.isEmpty()) {
+        request.setBody(body);
+        head.append("Content-Length: ");
+        head.append(QByteArray::number(body.size()));
+        head.append("\r\n", 2);
+    }
+    head.append("\r\n", 2);
+    if (debugLevel > 0) {
+        qtng_debug << "sending headers:" << head;
     }
+
+    HttpResponse response;
+    response.d->url = prepared.url;
+    response.d->request = request;
+    // h2 takes the path from the url, which is parsed only then.
+    auto http2Headers = [this, &request, &response, &path, &extraHeaders] {
+        response.d->url = response.d->url.resolved(QUrl::fromEncoded(path));
+        QList<HttpHeader> headers = makeHeaders(request, response.d->url, QByteArray());
+        headers.append(extraHeaders);
+        return headers;
+    };
+    return transfer(request, response, head, false, http2Headers);
 }
 
-void setProxySwitcher(HttpSession *session, QSharedPointer<BaseProxySwitcher> switcher)
+void HttpLatencyWindow::add(qint64 msecs)
 {
-    if (!switcher.isNull()) {
-        HttpSessionPrivate::getPrivateHelper(session)->proxySwitcher = switcher;
+    if (samples.size() < Size) {
+        samples.append(msecs);
     } else {
-        HttpSessionPrivate::getPrivateHelper(session)->proxySwitcher.reset(new SimpleProxySwitcher());
+        samples[next] = msecs;
+        next = (next + 1) % Size;
     }
 }
 
-HttpSession::HttpSession()
-    : d_ptr(new HttpSessionPrivate(this))
+qint64 HttpLatencyWindow::percentile(int p) const
 {
+    if (samples.size() < MinSamples) {
+        return -1;
+    }
+    QVector<qint64> sorted = samples;
+    const int n = qMin(sorted.size() - 1, sorted.size() * p / 100);
+    std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+    return sorted.at(n);
 }
 
-HttpSession::~HttpSession()
+HttpResponse HttpSessionPrivate::sendHedged(HttpRequest &request)
 {
-    delete d_ptr;
-}
+    const QString &method = request.d->method;
+    if ((method != QLatin1String("GET") && method != QLatin1String("HEAD")) || !request.d->body.isNull()
+        || !request.d->connection.isNull()) {
+        return send(request);
+    }
+    const ConnectionPoolKey &key = keyForUrl(request.d->url);
+    const qint64 delay = request.d->hedgeDelay > 0 ? static_cast<qint64>(request.d->hedgeDelay * 1000)
+                                                    : latencies.value(key).percentile(95);
+    // allow a burst of 10 duplicates at most.
+    hedgingTokens = qMin(hedgingTokens + hedgingBudget, qMax(10.0f, hedgingBudget));
+    QElapsedTimer timer;
+    timer.start();
+    if (delay < 0) {
+        HttpResponse response = send(request);
+        if (!response.hasNetworkError()) {
+            latencies[key].add(timer.elapsed());
+        }
+        return response;
+    }
 
-HttpResponse HttpSession::get(const QUrl &url)
-{
+    HttpRequest requests[2] = { request, request };
+    HttpResponse responses[2];
+    int winner = -1;
+    int running = 0;
+    bool due = false;
+    Event changed;
+    CoroutineGroup operations;
+    auto start = [this, &operations, &requests, &responses, &winner, &running, &changed](int i) {
+        ++running;
+        operations.spawn([this, &requests, &responses, &winner, &running, &changed, i] {
+            HttpResponse response = send(requests[i]);
+            --running;
+            // wait for the other one if this one is failed by network.
+            if (winner < 0 && (!response.hasNetworkError() || running == 0)) {
+                responses[i] = response;
+                winner = i;
+                changed.set();
+            }
+        });
+    };
+    EventLoopCoroutine *eventLoop = EventLoopCoroutine::get();
+    int callId = eventLoop->callLater(static_cast<quint32>(delay), makeFunctor([&due, &changed] {
+                                          due = true;
+                                          changed.set();
+                                      }));
+    start(0);
+    try {
+        while (winner < 0) {
+            changed.wait();
+            changed.clear();
+            if (due) {
+                due = false;
+                if (winner < 0 && hedgingTokens >= 1.0f) {
+                    hedgingTokens -= 1.0f;
+                    ++stats.hedgedRequests;
+                    start(1);
+                }
+            }
+        }
+    } catch (...) {
+        eventLoop->cancelCall(callId);
+        throw;
+    }
+    eventLoop->cancelCall(callId);
+    // the other one is killed with the group, and its connection is not reused.
+    request = requests[winner];
+    if (!responses[winner].hasNetworkError()) {
+        latencies[key].add(timer.elapsed());
+    }
+    return responses[winner];
+}
+
+HttpResponse HttpSessionPrivate::sendHttp2(HttpRequest &request, HttpResponse &response,
+                                           QSharedPointer<Http2Connection> http2, const QList<HttpHeader> &headers)
+{
+    QTNG_TRACE_SCOPE("http", "http2 stream");
+    const QUrl &url = response.d->url;
+    QByteArray resourcePath = url.toEncoded(QUrl::RemoveAuthority | QUrl::RemoveFragment | QUrl::RemoveScheme);
+    if (resourcePath.isEmpty()) {
+        resourcePath = "/";
+    }
+    QByteArray authority;
+    QList<HPackHeader> fields;
+    for (const HttpHeader &header : headers) {
+        const QByteArray &name = header.name.toLatin1().toLower();
+        if (name == "host") {
+            authority = header.value;
+        } else if (name == "connection" || name == "keep-alive" || name == "proxy-connection"
+                   || name == "transfer-encoding" || name == "upgrade" || (name == "te" && header.value != "trailers")) {
+            // the connection-specific headers are not allowed in http2.
+            continue;
+        } else {
+            fields.append(HPackHeader(name, header.value));
+        }
+    }
+    if (authority.isEmpty()) {
+        authority = url.host().toUtf8();
+    }
+    fields.prepend(HPackHeader(":path", resourcePath));
+    fields.prepend(HPackHeader(":authority", authority));
+    fields.prepend(HPackHeader(":scheme", url.scheme().toLatin1()));
+    fields.prepend(HPackHeader(":method", request.d->method.toUpper().toUtf8()));
+    if (debugLevel > 0) {
+        for (const HPackHeader &field : fields) {
+            qtng_debug << "sending http2 header:" << field.name << field.value;
+        }
+    }
+
+    const bool hasBody = !request.d->body.isNull();
+    QSharedPointer<Http2Stream> stream = http2->openStream(fields, !hasBody);
+    if (stream.isNull()) {
+        response.setError(new ConnectionError());
+        return response;
+    }
+    QSharedPointer<Http2StreamSocket> socket(new Http2StreamSocket(http2, stream));
+    if (hasBody) {
+        if (debugLevel > 0) {
+            qtng_debug << "sending body:" << request.d->body->size();
+        }
+        // the server may respond and reset the stream before reading the whole body.
+        const bool sent = sendfile(request.d->body, socket.staticCast<SocketLike>()) && socket->finish();
+        if (!sent && stream->headerBlocks.isEmpty()) {
+            response.setError(new ConnectionError());
+            return response;
+        }
+    }
+
+    QList<HPackHeader> fieldsReceived;
+    int statusCode = 0;
+    do {
+        // skip the informational responses.
+        if (!http2->recvHeaders(stream, &fieldsReceived) || fieldsReceived.isEmpty()
+            || fieldsReceived.first().name != ":status") {
+            response.setError(new ConnectionError());
+            return response;
+        }
+        bool ok;
+        statusCode = fieldsReceived.first().value.toInt(&ok);
+        if (!ok) {
+            response.setError(new InvalidHeader());
+            return response;
+        }
+    } while (statusCode >= 100 && statusCode < 200);
+
+    QList<HttpHeader> responseHeaders;
+    for (int i = 1; i < fieldsReceived.size(); ++i) {
+        const HPackHeader &field = fieldsReceived.at(i);
+        if (field.name.startsWith(':')) {
+            response.setError(new InvalidHeader());
+            return response;
+        }
+        responseHeaders.append(HttpHeader(QString::fromLatin1(field.name), field.value));
+    }
+    if (debugLevel > 0) {
+        for (const HttpHeader &header : responseHeaders) {
+            qtng_debug << "receiving header:" << header.name << header.value;
+        }
+    }
+    response.d->version = Http2_0;
+    response.d->statusCode = statusCode;
+    toMessage(static_cast<HttpStatus>(statusCode), &response.d->statusText, nullptr);
+    response.setHeaders(responseHeaders);
+    mergeResponseCookies(response);
+
+    // the stream is a socket ends at END_STREAM, so the body is read the same as http 1.x
+    response.d->stream = socket;
+    if (!request.streamResponse()) {
+        const QByteArray &body = response.body();
+        if (!response.d->error.isNull()) {
+            return response;
+        }
+        if (debugLevel == 1 && !body.isEmpty()) {
+            qtng_debug << "receiving body:" << body.size();
+        } else if (debugLevel > 1 && !body.isEmpty()) {
+            qtng_debug << "receiving body:" << body;
+        }
+        response.d->stream.clear();
+    }
+    finishResponse(request, response);
+    return response;
+}
+
+void HttpSessionPrivate::mergeResponseCookies(HttpResponse &response)
+{
+    if (managingCookies && response.hasHeader(QString::fromLatin1("Set-Cookie"))) {
+        for (const QByteArray &value : response.multiHeader(QString::fromLatin1("Set-Cookie"))) {
+            const QList<HttpCookie> &cookies = HttpCookie::parseCookies(value);
+            if (debugLevel > 0 && !cookies.isEmpty()) {
+                qtng_debug << "receiving cookie:" << cookies[0].toRawForm();
+            }
+            response.d->cookies.append(cookies);
+        }
+        cookieJar.setCookiesFromUrl(response.d->cookies, response.d->url);
+    }
+}
+
+void HttpSessionPrivate::finishResponse(HttpRequest &request, HttpResponse &response)
+{
+    if (response.d->consumed) {
+        httpClientMetrics().responseBytes->add(static_cast<quint64>(response.d->body.size()));
+    }
+    // only the secure origins may advertise, see rfc 7838.
+    if (response.url().scheme() == QLatin1String("https")) {
+        const QByteArray &altSvc = response.header(QString::fromLatin1("Alt-Svc"));
+        if (!altSvc.isEmpty()) {
+            recordAltSvc(response.url(), altSvc);
+        }
+    }
+    // response.d->statusCode < 200 is not error.
+    if (response.d->statusCode >= 400) {
+        response.setError(new HTTPError(response.d->statusCode));
+    } else {
+        const QString &rm = request.method().toUpper();
+        if ((rm == QLatin1String("GET") || rm == QLatin1String("HEAD") || rm == QLatin1String("OPTION"))
+            && !cacheManager.isNull() && !request.streamResponse()) {
+            if (response.d->statusCode == 304) {
+                // the validators are sent by send() if the user did not send them.
+                if (!request.hasHeader(QString::fromLatin1("If-None-Match"))
+                    && !request.hasHeader(QString::fromLatin1("If-Modified-Since"))) {
+                    cacheManager->updateResponse(&response);
+                }
+            } else {
+                // the directives of Cache-Control are checked by cache manager.
+                cacheManager->addResponse(response);
+            }
+        }
+    }
+}
+
+QList<HttpHeader> HttpSessionPrivate::makeHeaders(HttpRequest &request, const QUrl &url,
+                                                  const QByteArray &cookieHeader)
+{
+    QList<HttpHeader> allHeaders = request.allHeaders();
+
+    if (!request.hasHeader(QString::fromLatin1("Connection")) && request.version() == Http1_1) {
+        if (keepAlive) {
+            allHeaders.prepend(HttpHeader(QString::fromLatin1("Connection"), QByteArray("keep-alive")));
+        } else {
+            allHeaders.prepend(HttpHeader(QString::fromLatin1("Connection"), QByteArray("close")));
+        }
+    }
+    if (!request.hasHeader(QString::fromLatin1("Content-Length")) && !request.d->body.isNull()) {
+        qint64 requestBodySize = request.d->body->size();
+        if (requestBodySize > 0) {
+            allHeaders.prepend(HttpHeader(QString::fromLatin1("Content-Length"), QByteArray::number(requestBodySize)));
+        }
+    }
+    if (isChunkedBody(request)) {
+        allHeaders.prepend(HttpHeader(QString::fromLatin1("Transfer-Encoding"), QByteArray("chunked")));
+    }
+    if (!request.hasHeader(QString::fromLatin1("User-Agent"))) {
+        if (request.userAgent().isEmpty()) {
+            allHeaders.prepend(HttpHeader(QString::fromLatin1("User-Agent"), defaultUserAgent.toUtf8()));
+        } else {
+            allHeaders.prepend(HttpHeader(QString::fromLatin1("User-Agent"), request.userAgent().toUtf8()));
+        }
+    }
+    if (!request.hasHeader(QString::fromLatin1("Host"))) {
+        QString httpHost = url.host();
+        if (url.port() != -1) {
+            httpHost += QString::fromLatin1(":") + QString::number(url.port());
+        }
+        allHeaders.prepend(HttpHeader(QString::fromLatin1("Host"), httpHost.toUtf8()));
+    }
+    if (!request.hasHeader(QString::fromLatin1("Accept"))) {
+        allHeaders.append(HttpHeader(QString::fromLatin1("Accept"), QByteArray("*/*")));
+    }
+    if (!request.hasHeader(QString::fromLatin1("Accept-Language"))) {
+        allHeaders.append(HttpHeader(QString::fromLatin1("Accept-Language"), QByteArray("en-US,en;q=0.5")));
+    }
+    if (!request.hasHeader(QString::fromLatin1("Accept-Encoding"))) {
+        allHeaders.append(HttpHeader(QString::fromLatin1("Accept-Encoding"), qAcceptEncoding()));
+    }
+    if (!cookieHeader.isEmpty() && !request.hasHeader(QString::fromLatin1("Cookie"))) {
+        allHeaders.append(HttpHeader(QString::fromLatin1("Cookie"), cookieHeader));
+    } else if (!request.d->cookies.isEmpty() && !request.hasHeader(QString::fromLatin1("Cookie"))) {
+        QByteArray result;
+        bool first = true;
+        for (const HttpCookie &cookie : request.d->cookies) {
+            if (!first)
+                result += "; ";
+            first = false;
+            result += cookie.toRawForm(HttpCookie::NameAndValueOnly);
+        }
+        allHeaders.append(HttpHeader(QString::fromLatin1("Cookie"), result));
+    }
+    return allHeaders;
+}
+
+QByteArray HttpSessionPrivate::serializeRequest(HttpRequest &request, const QUrl &url, const QByteArray &cookieHeader,
+                                                const QList<HttpHeader> &validators, const char *version)
+{
+    QByteArray resourcePath = url.toEncoded(QUrl::RemoveAuthority | QUrl::RemoveFragment | QUrl::RemoveScheme);
+    if (resourcePath.isEmpty()) {
+        resourcePath = "/";
+    }
+    const bool hasAccept = request.hasHeader(AcceptHeader);
+    const bool hasAcceptLanguage = request.hasHeader(AcceptLanguageHeader);
+    const bool hasAcceptEncoding = request.hasHeader(AcceptEncodingHeader);
+    if (acceptBlock.isEmpty()) {
+        acceptBlock = "Accept: */*\r\nAccept-Language: en-US,en;q=0.5\r\nAccept-Encoding: " + qAcceptEncoding()
+                + "\r\n";
+    }
+
+    int size = request.d->method.size() + resourcePath.size() + 16 + request.headers.serializedSize()
+            + cookieHeader.size() + acceptBlock.size() + 128;
+    for (const HttpHeader &header : validators) {
+        size += header.name.size() + header.value.size() + 4;
+    }
+    QByteArray out;
+    out.reserve(size);
+
+    // the methods are ascii.
+    for (QChar c : request.d->method) {
+        out.append(static_cast<char>(c.toUpper().unicode()));
+    }
+    out.append(' ');
+    out.append(resourcePath);
+    out.append(' ');
+    out.append(version);
+    out.append("\r\n", 2);
+
+    if (!request.hasHeader(HostHeader)) {
+        out.append(hostBlock(url));
+    }
+    if (!request.hasHeader(UserAgentHeader)) {
+        const QString &userAgent = request.userAgent();
+        if (userAgent.isEmpty()) {
+            if (userAgentBlock.isEmpty()) {
+                userAgentBlock = "User-Agent: " + defaultUserAgent.toUtf8() + "\r\n";
+            }
+            out.append(userAgentBlock);
+        } else {
+            out.append("User-Agent: ");
+            out.append(userAgent.toUtf8());
+            out.append("\r\n", 2);
+        }
+    }
+    if (isChunkedBody(request)) {
+        out.append("Transfer-Encoding: chunked\r\n");
+    }
+    if (!request.hasHeader(ContentLengthHeader) && !request.d->body.isNull()) {
+        qint64 requestBodySize = request.d->body->size();
+        if (requestBodySize > 0) {
+            out.append("Content-Length: ");
+            out.append(QByteArray::number(requestBodySize));
+            out.append("\r\n", 2);
+        }
+    }
+    if (!request.hasHeader(ConnectionHeader) && request.version() == Http1_1) {
+        out.append(keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+    }
+
+    request.headers.serialize(&out);
+
+    if (!hasAccept && !hasAcceptLanguage && !hasAcceptEncoding) {
+        out.append(acceptBlock);
+    } else {
+        if (!hasAccept) {
+            out.append("Accept: */*\r\n");
+        }
+        if (!hasAcceptLanguage) {
+            out.append("Accept-Language: en-US,en;q=0.5\r\n");
+        }
+        if (!hasAcceptEncoding) {
+            out.append("Accept-Encoding: ");
+            out.append(qAcceptEncoding());
+            out.append("\r\n", 2);
+        }
+    }
+    if (!request.hasHeader(CookieHeader)) {
+        if (!cookieHeader.isEmpty()) {
+            out.append("Cookie: ");
+            out.append(cookieHeader);
+            out.append("\r\n", 2);
+        } else if (!request.d->cookies.isEmpty()) {
+            out.append("Cookie: ");
+            bool first = true;
+            for (const HttpCookie &cookie : request.d->cookies) {
+                if (!first) {
+                    out.append("; ", 2);
+                }
+                first = false;
+                out.append(cookie.toRawForm(HttpCookie::NameAndValueOnly));
+            }
+            out.append("\r\n", 2);
+        }
+    }
+    for (const HttpHeader &header : validators) {
+        out.append(header.name.toUtf8());
+        out.append(": ", 2);
+        out.append(header.value);
+        out.append("\r\n", 2);
+    }
+    out.append("\r\n", 2);
+    return out;
+}
+
+const QByteArray &HttpSessionPrivate::hostBlock(const QUrl &url)
+{
+    const QString &host = url.host();
+    const int port = url.port();
+    if (cachedHostBlock.isEmpty() || port != cachedPort || host != cachedHost) {
+        cachedHost = host;
+        cachedPort = port;
+        cachedHostBlock = "Host: " + host.toUtf8();
+        if (port != -1) {
+            cachedHostBlock += ':' + QByteArray::number(port);
+        }
+        cachedHostBlock += "\r\n";
+    }
+    return cachedHostBlock;
+}
+
+// the body of unknown size is sent as chunks by http 1.1, unless the user delimits it.
+bool HttpSessionPrivate::isChunkedBody(HttpRequest &request)
+{
+    return !request.d->body.isNull() && request.d->version != Http1_0
+            && !request.hasHeader(KnownHeader::ContentLengthHeader)
+            && !request.hasHeader(KnownHeader::TransferEncodingHeader) && request.d->body->size() < 0;
+}
+
+QByteArray HttpSessionPrivate::mergeCookies(HttpRequest &request, const QUrl &url)
+{
+    if (!managingCookies) {
+        return QByteArray();
+    }
+    QList<HttpCookie> cookies = cookieJar.cookiesForUrl(url);
+    if (cookies.isEmpty()) {
+        return QByteArray();
+    }
+    if (request.d->cookies.isEmpty()) {
+        // the most common case, use the header cached by cookie jar.
+        request.d->cookies = cookies;
+        return cookieJar.cookieHeaderForUrl(url);
+    }
+    for (const HttpCookie &cookie : cookies) {
+        bool found = false;
+        for (const HttpCookie &newCookie : request.d->cookies) {
+            if (newCookie.hasSameIdentifier(cookie) && newCookie.isSecure() == cookie.isSecure()
+                && newCookie.isHttpOnly() == cookie.isHttpOnly()) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            request.d->cookies.append(cookie);
+        }
+    }
+    return QByteArray();
+}
+
+void setProxySwitcher(HttpSession *session, QSharedPointer<BaseProxySwitcher> switcher)
+{
+    if (!switcher.isNull()) {
+        HttpSessionPrivate::getPrivateHelper(session)->proxySwitcher = switcher;
+    } else {
+        HttpSessionPrivate::getPrivateHelper(session)->proxySwitcher.reset(new SimpleProxySwitcher());
+    }
+}
+
+HttpSession::HttpSession()
+    : d_ptr(new HttpSessionPrivate(this))
+{
+}
+
+HttpSession::~HttpSession()
+{
+    delete d_ptr;
+}
+
+HttpResponse HttpSession::get(const QUrl &url)
+{
     HttpRequest request;
     request.setMethod(QString::fromLatin1("GET"));
     request.setUrl(url);
@@ -2578,10 +3870,12 @@ HttpResponse HttpSession::send(HttpRequest &request)
     timer.start();
 
     HttpResponse response;
+    HttpClientMetricsRecorder recorder(response, timer);
+    QTNG_TRACE_SCOPE("http", "HttpSession::send");
     QList<HttpResponse> history;
     Timeout tiemout(requestTimeout);
     try {
-        response = d->send(request);
+        response = request.hedgeDelay() < 0 ? d->send(request) : d->sendHedged(request);
     } catch (TimeoutException &) {
         response.setUrl(request.url());
         response.setError(new class RequestTimeout());
@@ -2630,24 +3924,144 @@ HttpResponse HttpSession::send(HttpRequest &request)
     return response;
 }
 
-HttpCookieJar &HttpSession::cookieJar()
+PreparedHttpRequest HttpSession::prepare(const HttpRequest &request)
 {
     Q_D(HttpSession);
-    return d->cookieJar;
+    PreparedHttpRequest prepared;
+    QSharedPointer<PreparedHttpRequestPrivate> p(new PreparedHttpRequestPrivate());
+    if (d->prepare(request, p.data())) {
+        prepared.d = p;
+    }
+    return prepared;
 }
 
-HttpCookie HttpSession::cookie(const QUrl &url, const QString &name)
+HttpResponse HttpSession::send(const PreparedHttpRequest &prepared, const QByteArray &pathAndQuery,
+                               const QByteArray &body, const QList<HttpHeader> &extraHeaders)
 {
     Q_D(HttpSession);
-    const HttpCookieJar &jar = d->cookieJar;
-    QList<HttpCookie> cookies = jar.cookiesForUrl(url);
-    for (int i = 0; i < cookies.size(); ++i) {
-        const HttpCookie &cookie = cookies.at(i);
-        if (cookie.name() == name.toUtf8()) {
-            return cookie;
-        }
+    QElapsedTimer timer;
+    timer.start();
+    HttpResponse response;
+    HttpClientMetricsRecorder recorder(response, timer);
+    if (prepared.d.isNull()) {
+        response.setError(new InvalidURL());
+        return response;
     }
-    return HttpCookie();
+    const float requestTimeout =
+            prepared.d->request.timeout() < 0 ? d->defaultTimeout : prepared.d->request.timeout();
+    Timeout timeout(requestTimeout);
+    try {
+        response = d->sendPrepared(*prepared.d, pathAndQuery, body, extraHeaders);
+    } catch (TimeoutException &) {
+        response.setUrl(prepared.d->url);
+        response.setError(new class RequestTimeout());
+    }
+    response.setElapsed(timer.elapsed());
+    return response;
+}
+
+PreparedHttpRequest::PreparedHttpRequest() { }
+
+PreparedHttpRequest::PreparedHttpRequest(const PreparedHttpRequest &other)
+    : d(other.d)
+{
+}
+
+PreparedHttpRequest::~PreparedHttpRequest() { }
+
+PreparedHttpRequest &PreparedHttpRequest::operator=(const PreparedHttpRequest &other)
+{
+    d = other.d;
+    return *this;
+}
+
+bool PreparedHttpRequest::isValid() const
+{
+    return !d.isNull();
+}
+
+HttpRequest PreparedHttpRequest::request() const
+{
+    return d.isNull() ? HttpRequest() : d->request;
+}
+
+QList<HttpResponse> HttpSession::sendMany(QList<HttpRequest> &requests, int concurrency)
+{
+    QList<HttpResponse> responses;
+    responses.reserve(requests.size());
+    for (int i = 0; i < requests.size(); ++i) {
+        responses.append(HttpResponse());
+    }
+    sendMany(
+            requests, [&responses](int index, HttpResponse &response) { responses[index] = response; },
+            concurrency);
+    return responses;
+}
+
+void HttpSession::sendMany(QList<HttpRequest> &requests,
+                           std::function<void(int index, HttpResponse &response)> callback, int concurrency)
+{
+    Q_D(HttpSession);
+    if (requests.isEmpty()) {
+        return;
+    }
+    QList<ConnectionPoolKey> keys;
+    QList<int> pending;  // the indexes of requests not sent yet.
+    for (int i = 0; i < requests.size(); ++i) {
+        keys.append(d->keyForUrl(requests.at(i).url()));
+        pending.append(i);
+    }
+    QHash<ConnectionPoolKey, int> sending;
+    Condition changed;
+
+    // a few workers take the requests one by one, instead of spawning a coroutine for every request. the requests
+    // to a busy server are skipped, so they do not keep the workers from other servers.
+    const int workers = qBound(1, concurrency, requests.size());
+    CoroutineGroup operations;
+    for (int i = 0; i < workers; ++i) {
+        operations.spawn([this, d, &requests, &callback, &keys, &pending, &sending, &changed] {
+            while (!pending.isEmpty()) {
+                int index = -1;
+                for (int j = 0; j < pending.size(); ++j) {
+                    if (sending.value(keys.at(pending.at(j))) < d->maxConnectionsPerServer) {
+                        index = pending.takeAt(j);
+                        break;
+                    }
+                }
+                if (index < 0) {
+                    changed.wait();
+                    continue;
+                }
+                const ConnectionPoolKey &key = keys.at(index);
+                ++sending[key];
+                HttpResponse response = send(requests[index]);
+                --sending[key];
+                changed.notifyAll();
+                callback(index, response);
+            }
+        });
+    }
+    operations.joinall();
+}
+
+HttpCookieJar &HttpSession::cookieJar()
+{
+    Q_D(HttpSession);
+    return d->cookieJar;
+}
+
+HttpCookie HttpSession::cookie(const QUrl &url, const QString &name)
+{
+    Q_D(HttpSession);
+    const HttpCookieJar &jar = d->cookieJar;
+    QList<HttpCookie> cookies = jar.cookiesForUrl(url);
+    for (int i = 0; i < cookies.size(); ++i) {
+        const HttpCookie &cookie = cookies.at(i);
+        if (cookie.name() == name.toUtf8()) {
+            return cookie;
+        }
+    }
+    return HttpCookie();
 }
 
 void HttpSession::setManagingCookies(bool managingCookies)
@@ -2656,279 +4070,1296 @@ void HttpSession::setManagingCookies(bool managingCookies)
     d->managingCookies = managingCookies;
 }
 
-void HttpSession::setMaxConnectionsPerServer(int maxConnectionsPerServer)
+void HttpSession::setMaxConnectionsPerServer(int maxConnectionsPerServer)
+{
+    Q_D(HttpSession);
+    if (maxConnectionsPerServer <= 0) {
+        maxConnectionsPerServer = INT_MAX;
+    }
+    d->maxConnectionsPerServer = maxConnectionsPerServer;
+    // TODO update semphores
+}
+
+int HttpSession::maxConnectionsPerServer()
+{
+    Q_D(HttpSession);
+    return d->maxConnectionsPerServer;
+}
+
+void HttpSession::setDebugLevel(int level)
+{
+    Q_D(HttpSession);
+    d->debugLevel = level;
+}
+
+void HttpSession::disableDebug()
+{
+    Q_D(HttpSession);
+    d->debugLevel = 0;
+}
+
+void HttpSession::setKeepAlive(bool keepAlive)
+{
+    Q_D(HttpSession);
+    d->keepAlive = keepAlive;
+}
+
+bool HttpSession::keepAlive() const
+{
+    Q_D(const HttpSession);
+    return d->keepAlive;
+}
+
+void HttpSession::setPipelining(bool pipelining)
+{
+    Q_D(HttpSession);
+    d->pipelining = pipelining;
+}
+
+bool HttpSession::pipelining() const
+{
+    Q_D(const HttpSession);
+    return d->pipelining;
+}
+
+void HttpSession::setTcpFastOpen(bool tcpFastOpen)
+{
+    Q_D(HttpSession);
+    d->tcpFastOpen = tcpFastOpen;
+}
+
+bool HttpSession::tcpFastOpen() const
+{
+    Q_D(const HttpSession);
+    return d->tcpFastOpen;
+}
+
+void HttpSession::setBalancingAddresses(bool balancingAddresses)
+{
+    Q_D(HttpSession);
+    d->balancingAddresses = balancingAddresses;
+}
+
+bool HttpSession::balancingAddresses() const
+{
+    Q_D(const HttpSession);
+    return d->balancingAddresses;
+}
+
+QList<HttpAddressStats> HttpSession::addressStats() const
+{
+    Q_D(const HttpSession);
+    QList<HttpAddressStats> result;
+    const qint64 now = EventLoopCoroutine::get()->now();
+    for (const QSharedPointer<PooledAddress> &address : d->addresses) {
+        HttpAddressStats stats;
+        stats.address = address->address;
+        stats.connections = address->connections;
+        stats.createdConnections = address->createdConnections;
+        stats.failedConnections = address->failedConnections;
+        stats.rtt = address->rtt;
+        stats.evicted = address->evictedUntil > now;
+        result.append(stats);
+    }
+    return result;
+}
+
+void HttpSession::preconnect(const QUrl &url, int count)
+{
+    Q_D(HttpSession);
+    if (d->keepAlive && url.isValid()) {
+        d->preconnect(url, count);
+    }
+}
+
+void HttpSession::setMinIdleConnections(const QUrl &url, int count)
+{
+    Q_D(HttpSession);
+    if (!url.isValid()) {
+        return;
+    }
+    if (d->keepAlive) {
+        d->setMinIdleConnections(url, count);
+    }
+}
+
+void HttpSession::setCoalescingRequests(bool coalescingRequests)
+{
+    Q_D(HttpSession);
+    d->coalescingRequests = coalescingRequests;
+}
+
+bool HttpSession::coalescingRequests() const
+{
+    Q_D(const HttpSession);
+    return d->coalescingRequests;
+}
+
+void HttpSession::setHedgingBudget(float budget)
+{
+    Q_D(HttpSession);
+    d->hedgingBudget = qMax(0.0f, budget);
+}
+
+float HttpSession::hedgingBudget() const
+{
+    Q_D(const HttpSession);
+    return d->hedgingBudget;
+}
+
+HttpConnectionPoolStats HttpSession::connectionPoolStats() const
+{
+    Q_D(const HttpSession);
+    return d->poolStats();
+}
+
+static QString originOf(const QUrl &url)
+{
+    const int port = url.port(url.scheme() == QLatin1String("https") ? 443 : 80);
+    return url.scheme() + QLatin1String("://") + url.host().toLower() + QLatin1Char(':') + QString::number(port);
+}
+
+QList<HttpAlternativeService> HttpSession::alternativeServices(const QUrl &url) const
+{
+    Q_D(const HttpSession);
+    QList<HttpAlternativeService> services;
+    const QDateTime &now = QDateTime::currentDateTimeUtc();
+    for (const HttpAlternativeService &service : d->alternativeServices.value(originOf(url))) {
+        if (service.expires > now) {
+            services.append(service);
+        }
+    }
+    return services;
+}
+
+void HttpSessionPrivate::recordAltSvc(const QUrl &url, const QByteArray &value)
+{
+    bool clear = false;
+    const QList<HttpAlternativeService> &services = parseAltSvc(value, &clear);
+    const QString &origin = originOf(url);
+    if (clear) {
+        alternativeServices.remove(origin);
+    } else if (!services.isEmpty() && (alternativeServices.contains(origin) || alternativeServices.size() < 1024)) {
+        alternativeServices.insert(origin, services);
+    }
+}
+
+QString HttpSession::defaultUserAgent() const
+{
+    Q_D(const HttpSession);
+    return d->defaultUserAgent;
+}
+
+void HttpSession::setDefaultUserAgent(const QString &userAgent)
+{
+    Q_D(HttpSession);
+    d->defaultUserAgent = userAgent;
+    d->userAgentBlock.clear();
+}
+
+HttpVersion HttpSession::defaultVersion() const
+{
+    Q_D(const HttpSession);
+    return d->defaultVersion;
+}
+
+void HttpSession::setDefaultVersion(HttpVersion defaultVersion)
+{
+    Q_D(HttpSession);
+    d->defaultVersion = defaultVersion;
+}
+
+float HttpSession::defaultConnnectionTimeout() const
+{
+    Q_D(const HttpSession);
+    return d->defaultConnectionTimeout;
+}
+
+void HttpSession::setDefaultConnectionTimeout(float timeout)
+{
+    Q_D(HttpSession);
+    d->defaultConnectionTimeout = timeout;
+}
+
+float HttpSession::defaultTimeout() const
+{
+    Q_D(const HttpSession);
+    return d->defaultTimeout;
+}
+
+void HttpSession::setDefaultTimeout(float defaultTimeout)
+{
+    Q_D(HttpSession);
+    d->defaultTimeout = defaultTimeout;
+}
+
+void HttpSession::setDnsCache(QSharedPointer<SocketDnsCache> dnsCache)
+{
+    Q_D(HttpSession);
+    d->dnsCache = dnsCache;
+}
+
+QSharedPointer<SocketDnsCache> HttpSession::dnsCache() const
+{
+    Q_D(const HttpSession);
+    return d->dnsCache;
+}
+
+QSharedPointer<SocketProxy> HttpSession::socketProxy() const
+{
+    Q_D(const HttpSession);
+    return d->socketProxy();
+}
+
+void HttpSession::setSocketProxy(QSharedPointer<SocketProxy> proxy)
+{
+    Q_D(HttpSession);
+    d->setSocketProxy(proxy);
+}
+
+QSharedPointer<HttpProxy> HttpSession::httpProxy() const
+{
+    Q_D(const HttpSession);
+    return d->httpProxy();
+}
+
+void HttpSession::setHttpProxy(QSharedPointer<HttpProxy> proxy)
+{
+    Q_D(HttpSession);
+    d->setHttpProxy(proxy);
+}
+
+QSharedPointer<HttpCacheManager> HttpSession::cacheManager() const
+{
+    Q_D(const HttpSession);
+    return d->cacheManager;
+}
+
+void HttpSession::setCacheManager(QSharedPointer<HttpCacheManager> cacheManager)
+{
+    Q_D(HttpSession);
+    d->cacheManager = cacheManager;
+}
+
+#ifndef QTNG_NO_CRYPTO
+
+SslConfiguration &HttpSession::sslConfiguration()
+{
+    Q_D(HttpSession);
+    return d->sslConfig;
+}
+
+#endif
+
+HttpCacheManager::HttpCacheManager() { }
+
+HttpCacheManager::~HttpCacheManager() { }
+
+namespace {
+
+// bump it if the format of cache entry is changed, the old entries are dropped then.
+const quint32 HttpCacheEntryVersion = 2;
+const qint64 MaxHeuristicFreshness = 60 * 60 * 24;  // in seconds.
+
+struct HttpCacheEntry
+{
+    HttpCacheEntry()
+        : receivedAt(0)
+        , freshUntil(0)
+        , statusCode(0)
+    {
+    }
+    qint64 receivedAt;  // in milliseconds since epoch.
+    qint64 freshUntil;
+    QList<HttpHeader> varyHeaders;  // the request headers selected by Vary.
+    int statusCode;
+    QString statusText;
+    QList<HttpHeader> headers;
+    QByteArray body;
+};
+
+}  // anonymous namespace
+
+static QByteArray packCacheEntry(const HttpCacheEntry &entry)
+{
+    QByteArray bs;
+    QDataStream ds(&bs, QIODevice::WriteOnly);
+    ds << HttpCacheEntryVersion << entry.receivedAt << entry.freshUntil << entry.varyHeaders << entry.statusCode
+       << entry.statusText << entry.headers << entry.body;
+    if (ds.status() != QDataStream::Ok) {
+        return QByteArray();
+    }
+    return bs;
+}
+
+static bool unpackCacheEntry(const QByteArray &bs, HttpCacheEntry *entry)
+{
+    QDataStream ds(bs);
+    quint32 version = 0;
+    ds >> version;
+    if (version != HttpCacheEntryVersion) {
+        return false;
+    }
+    ds >> entry->receivedAt >> entry->freshUntil >> entry->varyHeaders >> entry->statusCode >> entry->statusText
+            >> entry->headers >> entry->body;
+    return ds.status() == QDataStream::Ok;
+}
+
+static QByteArray findHeader(const QList<HttpHeader> &headers, const QString &name)
+{
+    for (const HttpHeader &header : headers) {
+        if (header.name.compare(name, Qt::CaseInsensitive) == 0) {
+            return header.value;
+        }
+    }
+    return QByteArray();
+}
+
+// the names of directives are in lower case, and the quoted values are unquoted.
+static QMap<QByteArray, QByteArray> parseCacheControl(const QByteArray &value)
+{
+    QMap<QByteArray, QByteArray> directives;
+    for (const QByteArray &part : value.split(',')) {
+        const int eq = part.indexOf('=');
+        const QByteArray &name = (eq < 0 ? part : part.left(eq)).trimmed().toLower();
+        if (name.isEmpty()) {
+            continue;
+        }
+        QByteArray argument = eq < 0 ? QByteArray() : part.mid(eq + 1).trimmed();
+        if (argument.size() >= 2 && argument.startsWith('"') && argument.endsWith('"')) {
+            argument = argument.mid(1, argument.size() - 2);
+        }
+        directives.insert(name, argument);
+    }
+    return directives;
+}
+
+static bool isCacheableStatus(int statusCode)
+{
+    // rfc 7231 section 6.1, the status codes cacheable by default.
+    switch (statusCode) {
+    case 200:
+    case 203:
+    case 204:
+    case 300:
+    case 301:
+    case 308:
+    case 404:
+    case 405:
+    case 410:
+    case 414:
+    case 501:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// rfc 7234 section 4.2.1 and 4.2.2, returns the time in milliseconds till the response is stale.
+static qint64 freshnessLifetime(const QList<HttpHeader> &headers, qint64 receivedAt)
+{
+    const QMap<QByteArray, QByteArray> &directives = parseCacheControl(findHeader(headers, QLatin1String("Cache-Control")));
+    qint64 lifetime = 0;
+    bool ok;
+    if (directives.contains("no-cache")) {
+        return 0;
+    } else if (directives.contains("max-age")) {
+        lifetime = directives.value("max-age").toLongLong(&ok);
+        if (!ok) {
+            return 0;
+        }
+        lifetime *= 1000;
+    } else {
+        const QDateTime &date = fromHttpDate(findHeader(headers, QLatin1String("Date")));
+        const qint64 dateTime = date.isValid() ? date.toMSecsSinceEpoch() : receivedAt;
+        const QByteArray &expiresHeader = findHeader(headers, QLatin1String("Expires"));
+        if (!expiresHeader.isEmpty()) {
+            const QDateTime &expires = fromHttpDate(expiresHeader);
+            if (!expires.isValid()) {  // such as `Expires: 0`
+                return 0;
+            }
+            lifetime = expires.toMSecsSinceEpoch() - dateTime;
+        } else {
+            // the heuristic freshness, 10% of the time since it was modified.
+            const QDateTime &lastModified = fromHttpDate(findHeader(headers, QLatin1String("Last-Modified")));
+            if (!lastModified.isValid()) {
+                return 0;
+            }
+            lifetime = qMin((dateTime - lastModified.toMSecsSinceEpoch()) / 10, MaxHeuristicFreshness * 1000);
+        }
+    }
+    const qint64 age = findHeader(headers, QLatin1String("Age")).trimmed().toLongLong(&ok);
+    if (ok && age > 0) {
+        lifetime -= age * 1000;
+    }
+    return qMax<qint64>(0, lifetime);
+}
+
+static bool matchVaryHeaders(const HttpCacheEntry &entry, const HttpRequest &request)
+{
+    for (const HttpHeader &header : entry.varyHeaders) {
+        if (request.header(header.name) != header.value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// HEAD responses have no body, they are not used for GET requests.
+static QString cacheKey(const HttpResponse &response)
+{
+    const QString &url = response.url().toString();
+    if (url.isEmpty()) {
+        return QString();
+    }
+    const QString &method = response.request().method().toUpper();
+    if (method == QLatin1String("GET")) {
+        return url;
+    }
+    return method + QLatin1Char(' ') + url;
+}
+
+bool HttpCacheManager::addResponse(HttpResponse &response)
+{
+    const QString &key = cacheKey(response);
+    if (key.isEmpty() || !isCacheableStatus(response.statusCode())) {
+        return false;
+    }
+    const HttpRequest &request = response.request();
+    const QMap<QByteArray, QByteArray> &requestDirectives =
+            parseCacheControl(request.header(KnownHeader::CacheControlHeader));
+    const QMap<QByteArray, QByteArray> &responseDirectives =
+            parseCacheControl(response.header(KnownHeader::CacheControlHeader));
+    if (requestDirectives.contains("no-store") || responseDirectives.contains("no-store")) {
+        remove(key);
+        return false;
+    }
+
+    HttpCacheEntry entry;
+    const QByteArray &vary = response.header(KnownHeader::VaryHeader);
+    for (const QByteArray &part : vary.split(',')) {
+        const QByteArray &name = part.trimmed();
+        if (name == "*") {
+            return false;
+        } else if (!name.isEmpty()) {
+            const QString &headerName = QString::fromLatin1(name);
+            entry.varyHeaders.append(HttpHeader(headerName, request.header(headerName)));
+        }
+    }
+    entry.headers = response.allHeaders();
+    entry.receivedAt = QDateTime::currentMSecsSinceEpoch();
+    entry.freshUntil = entry.receivedAt + freshnessLifetime(entry.headers, entry.receivedAt);
+    if (entry.freshUntil <= entry.receivedAt && !response.hasHeader(QLatin1String("ETag"))
+        && !response.hasHeader(KnownHeader::LastModifiedHeader)) {
+        return false;  // it can not be used, or revalidated.
+    }
+    entry.statusCode = response.statusCode();
+    entry.statusText = response.statusText();
+    entry.body = response.body();
+    if (!response.isOk()) {
+        return false;
+    }
+    const QByteArray &bs = packCacheEntry(entry);
+    if (bs.isEmpty()) {
+        return false;
+    }
+    return store(key, bs);
+}
+
+bool HttpCacheManager::getResponse(HttpResponse *response)
+{
+    const QString &key = cacheKey(*response);
+    if (key.isEmpty()) {
+        return false;
+    }
+    const HttpRequest &request = response->request();
+    const QMap<QByteArray, QByteArray> &directives =
+            parseCacheControl(request.header(KnownHeader::CacheControlHeader));
+    if (directives.contains("no-store")) {
+        return false;
+    }
+    const QByteArray &bs = load(key);
+    if (bs.isEmpty()) {
+        return false;
+    }
+    HttpCacheEntry entry;
+    if (!unpackCacheEntry(bs, &entry)) {
+        remove(key);
+        return false;
+    }
+    if (!matchVaryHeaders(entry, request)) {
+        return false;
+    }
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    bool fresh = now < entry.freshUntil && !directives.contains("no-cache")
+            && !request.header(KnownHeader::PragmaHeader).toLower().contains("no-cache");
+    if (fresh && directives.contains("max-age")) {
+        bool ok;
+        const qint64 maxAge = directives.value("max-age").toLongLong(&ok);
+        fresh = ok && now - entry.receivedAt <= maxAge * 1000;
+    }
+    if (fresh) {
+        response->setStatusCode(entry.statusCode);
+        response->setStatusText(entry.statusText);
+        response->setHeaders(entry.headers);
+        response->setBody(entry.body);
+        return true;
+    }
+    return false;
+}
+
+bool HttpCacheManager::getValidators(HttpResponse *response, QList<HttpHeader> *validators)
+{
+    const QString &key = cacheKey(*response);
+    if (key.isEmpty() || !validators) {
+        return false;
+    }
+    const HttpRequest &request = response->request();
+    if (parseCacheControl(request.header(KnownHeader::CacheControlHeader)).contains("no-store")) {
+        return false;
+    }
+    HttpCacheEntry entry;
+    if (!unpackCacheEntry(load(key), &entry) || !matchVaryHeaders(entry, request)) {
+        return false;
+    }
+    const QByteArray &etag = findHeader(entry.headers, QLatin1String("ETag"));
+    if (!etag.isEmpty()) {
+        validators->append(HttpHeader(QString::fromLatin1("If-None-Match"), etag));
+    }
+    const QByteArray &lastModified = findHeader(entry.headers, QLatin1String("Last-Modified"));
+    if (!lastModified.isEmpty()) {
+        validators->append(HttpHeader(QString::fromLatin1("If-Modified-Since"), lastModified));
+    }
+    return !etag.isEmpty() || !lastModified.isEmpty();
+}
+
+bool HttpCacheManager::updateResponse(HttpResponse *response)
+{
+    const QString &key = cacheKey(*response);
+    if (key.isEmpty() || response->statusCode() != 304) {
+        return false;
+    }
+    HttpCacheEntry entry;
+    if (!unpackCacheEntry(load(key), &entry) || !matchVaryHeaders(entry, response->request())) {
+        return false;
+    }
+    // rfc 7234 section 4.3.4, update the stored headers except the ones describing the body.
+    for (const HttpHeader &header : response->allHeaders()) {
+        if (header.name.compare(QLatin1String("Content-Length"), Qt::CaseInsensitive) == 0
+            || header.name.compare(QLatin1String("Content-Encoding"), Qt::CaseInsensitive) == 0
+            || header.name.compare(QLatin1String("Transfer-Encoding"), Qt::CaseInsensitive) == 0
+            || header.name.compare(QLatin1String("Connection"), Qt::CaseInsensitive) == 0) {
+            continue;
+        }
+        bool replaced = false;
+        for (HttpHeader &stored : entry.headers) {
+            if (stored.name.compare(header.name, Qt::CaseInsensitive) == 0) {
+                stored.value = header.value;
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) {
+            entry.headers.append(header);
+        }
+    }
+    entry.receivedAt = QDateTime::currentMSecsSinceEpoch();
+    entry.freshUntil = entry.receivedAt + freshnessLifetime(entry.headers, entry.receivedAt);
+    if (parseCacheControl(findHeader(entry.headers, QLatin1String("Cache-Control"))).contains("no-store")) {
+        remove(key);
+    } else {
+        const QByteArray &bs = packCacheEntry(entry);
+        if (!bs.isEmpty()) {
+            store(key, bs);
+        }
+    }
+    response->setStatusCode(entry.statusCode);
+    response->setStatusText(entry.statusText);
+    response->setHeaders(entry.headers);
+    response->setBody(entry.body);
+    return true;
+}
+
+bool HttpCacheManager::store(const QString &, const QByteArray &)
+{
+    return false;
+}
+
+QByteArray HttpCacheManager::load(const QString &)
+{
+    return QByteArray();
+}
+
+void HttpCacheManager::remove(const QString &) { }
+
+namespace {
+
+struct HttpMemoryCacheItem
+{
+    QByteArray data;
+    qint64 storedAt;
+    quint64 serial;  // the key of lru.
+};
+
+}  // anonymous namespace
+
+class HttpMemoryCacheManagerPrivate
+{
+public:
+    HttpMemoryCacheManagerPrivate()
+        : maxSize(1024 * 1024 * 64)
+        , currentSize(0)
+        , nextSerial(0)
+        , expireTime(60 * 60 * 24)  // one day
+    {
+    }
+public:
+    static qint64 itemSize(const QString &url, const HttpMemoryCacheItem &item)
+    {
+        return item.data.size() + url.size() * 2;
+    }
+    void remove(const QString &url);
+    void evict();
+public:
+    QHash<QString, HttpMemoryCacheItem> items;
+    QMap<quint64, QString> lru;  // the least recently used one is at the front.
+    qint64 maxSize;
+    qint64 currentSize;
+    quint64 nextSerial;
+    float expireTime;
+};
+
+void HttpMemoryCacheManagerPrivate::remove(const QString &url)
+{
+    QHash<QString, HttpMemoryCacheItem>::iterator itor = items.find(url);
+    if (itor == items.end()) {
+        return;
+    }
+    currentSize -= itemSize(url, itor.value());
+    lru.remove(itor.value().serial);
+    items.erase(itor);
+}
+
+void HttpMemoryCacheManagerPrivate::evict()
 {
-    Q_D(HttpSession);
-    if (maxConnectionsPerServer <= 0) {
-        maxConnectionsPerServer = INT_MAX;
+    while (currentSize > maxSize && !lru.isEmpty()) {
+        const QString url = lru.first();
+        remove(url);
     }
-    d->maxConnectionsPerServer = maxConnectionsPerServer;
-    // TODO update semphores
 }
 
-int HttpSession::maxConnectionsPerServer()
+HttpMemoryCacheManager::HttpMemoryCacheManager()
+    : d_ptr(new HttpMemoryCacheManagerPrivate())
 {
-    Q_D(HttpSession);
-    return d->maxConnectionsPerServer;
 }
 
-void HttpSession::setDebugLevel(int level)
+HttpMemoryCacheManager::~HttpMemoryCacheManager()
 {
-    Q_D(HttpSession);
-    d->debugLevel = level;
+    delete d_ptr;
 }
 
-void HttpSession::disableDebug()
+float HttpMemoryCacheManager::expireTime() const
 {
-    Q_D(HttpSession);
-    d->debugLevel = 0;
+    Q_D(const HttpMemoryCacheManager);
+    return d->expireTime;
 }
 
-void HttpSession::setKeepAlive(bool keepAlive)
+void HttpMemoryCacheManager::setExpireTime(float expireTime)
 {
-    Q_D(HttpSession);
-    d->keepAlive = keepAlive;
+    Q_D(HttpMemoryCacheManager);
+    d->expireTime = expireTime;
 }
 
-bool HttpSession::keepAlive() const
+qint64 HttpMemoryCacheManager::maxSize() const
 {
-    Q_D(const HttpSession);
-    return d->keepAlive;
+    Q_D(const HttpMemoryCacheManager);
+    return d->maxSize;
 }
 
-QString HttpSession::defaultUserAgent() const
+void HttpMemoryCacheManager::setMaxSize(qint64 maxSize)
 {
-    Q_D(const HttpSession);
-    return d->defaultUserAgent;
+    Q_D(HttpMemoryCacheManager);
+    d->maxSize = qMax<qint64>(0, maxSize);
+    d->evict();
 }
 
-void HttpSession::setDefaultUserAgent(const QString &userAgent)
+qint64 HttpMemoryCacheManager::size() const
 {
-    Q_D(HttpSession);
-    d->defaultUserAgent = userAgent;
+    Q_D(const HttpMemoryCacheManager);
+    return d->currentSize;
 }
 
-HttpVersion HttpSession::defaultVersion() const
+const QMap<QString, QByteArray> HttpMemoryCacheManager::cache() const
 {
-    Q_D(const HttpSession);
-    return d->defaultVersion;
+    Q_D(const HttpMemoryCacheManager);
+    QMap<QString, QByteArray> entries;
+    for (QHash<QString, HttpMemoryCacheItem>::const_iterator itor = d->items.constBegin();
+         itor != d->items.constEnd(); ++itor) {
+        entries.insert(itor.key(), itor.value().data);
+    }
+    return entries;
 }
 
-void HttpSession::setDefaultVersion(HttpVersion defaultVersion)
+bool HttpMemoryCacheManager::store(const QString &url, const QByteArray &data)
 {
-    Q_D(HttpSession);
-    d->defaultVersion = defaultVersion;
+    Q_D(HttpMemoryCacheManager);
+    d->remove(url);
+    HttpMemoryCacheItem item;
+    item.data = data;
+    item.storedAt = QDateTime::currentMSecsSinceEpoch();
+    item.serial = d->nextSerial++;
+    const qint64 size = HttpMemoryCacheManagerPrivate::itemSize(url, item);
+    if (size > d->maxSize) {
+        return false;
+    }
+    d->items.insert(url, item);
+    d->lru.insert(item.serial, url);
+    d->currentSize += size;
+    d->evict();
+    return true;
 }
 
-float HttpSession::defaultConnnectionTimeout() const
+QByteArray HttpMemoryCacheManager::load(const QString &url)
 {
-    Q_D(const HttpSession);
-    return d->defaultConnectionTimeout;
+    Q_D(HttpMemoryCacheManager);
+    QHash<QString, HttpMemoryCacheItem>::iterator itor = d->items.find(url);
+    if (itor == d->items.end()) {
+        return QByteArray();
+    }
+    HttpMemoryCacheItem &item = itor.value();
+    if (d->expireTime > 0 && QDateTime::currentMSecsSinceEpoch() - item.storedAt > d->expireTime * 1000) {
+        d->remove(url);
+        return QByteArray();
+    }
+    d->lru.remove(item.serial);
+    item.serial = d->nextSerial++;
+    d->lru.insert(item.serial, url);
+    return item.data;
 }
 
-void HttpSession::setDefaultConnectionTimeout(float timeout)
+void HttpMemoryCacheManager::remove(const QString &url)
 {
-    Q_D(HttpSession);
-    d->defaultConnectionTimeout = timeout;
+    Q_D(HttpMemoryCacheManager);
+    d->remove(url);
 }
 
-float HttpSession::defaultTimeout() const
+namespace {
+
+const quint32 DiskCacheRecordMagic = 0x51434452;
+const quint32 DiskCacheTombstone = 0xffffffff;  // the data size of removed entry.
+const qint32 DiskCacheRecordHeaderSize = 12;  // magic, key size and data size.
+const qint64 DiskCacheSegmentSize = 1024 * 1024 * 32;
+const qint32 DiskCacheMaxBatchSize = 1024 * 1024 * 8;
+
+struct DiskCacheLocation
 {
-    Q_D(const HttpSession);
-    return d->defaultTimeout;
-}
+    quint32 segment;
+    qint64 offset;  // of the data.
+    qint32 size;
+    qint32 recordSize;
+};
 
-void HttpSession::setDefaultTimeout(float defaultTimeout)
+struct DiskCacheSegment
 {
-    Q_D(HttpSession);
-    d->defaultTimeout = defaultTimeout;
-}
+    QSharedPointer<QFile> file;  // opened for load().
+    qint64 size;
+    qint64 liveSize;  // the records still in index.
+};
 
-void HttpSession::setDnsCache(QSharedPointer<SocketDnsCache> dnsCache)
+struct DiskCachePending
 {
-    Q_D(HttpSession);
-    d->dnsCache = dnsCache;
-}
+    QByteArray data;
+    quint64 serial;
+    bool removed;
+};
 
-QSharedPointer<SocketDnsCache> HttpSession::dnsCache() const
+struct DiskCacheRecord
 {
-    Q_D(const HttpSession);
-    return d->dnsCache;
-}
+    QString key;
+    qint64 offset;
+    qint32 size;
+    qint32 recordSize;
+    bool removed;
+};
 
-QSharedPointer<SocketProxy> HttpSession::socketProxy() const
+}  // anonymous namespace
+
+static void appendDiskCacheRecord(QByteArray *buf, const QByteArray &key, const QByteArray &data, bool removed)
 {
-    Q_D(const HttpSession);
-    return d->socketProxy();
+    char header[DiskCacheRecordHeaderSize];
+    qToBigEndian<quint32>(DiskCacheRecordMagic, reinterpret_cast<uchar *>(header));
+    qToBigEndian<quint32>(static_cast<quint32>(key.size()), reinterpret_cast<uchar *>(header + 4));
+    qToBigEndian<quint32>(removed ? DiskCacheTombstone : static_cast<quint32>(data.size()),
+                          reinterpret_cast<uchar *>(header + 8));
+    buf->append(header, DiskCacheRecordHeaderSize);
+    buf->append(key);
+    if (!removed) {
+        buf->append(data);
+    }
 }
 
-void HttpSession::setSocketProxy(QSharedPointer<SocketProxy> proxy)
+// runs in the thread. a broken tail left by crash is truncated.
+static bool scanDiskCacheSegment(const QString &path, QList<DiskCacheRecord> *records, qint64 *size)
 {
-    Q_D(HttpSession);
-    d->setSocketProxy(proxy);
+    QFile f(path);
+    if (!f.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+    const qint64 fileSize = f.size();
+    qint64 pos = 0;
+    while (pos + DiskCacheRecordHeaderSize <= fileSize) {
+        const QByteArray &header = f.read(DiskCacheRecordHeaderSize);
+        if (header.size() != DiskCacheRecordHeaderSize) {
+            break;
+        }
+        const uchar *p = reinterpret_cast<const uchar *>(header.constData());
+        const quint32 magic = qFromBigEndian<quint32>(p);
+        const quint32 keySize = qFromBigEndian<quint32>(p + 4);
+        const quint32 dataSize = qFromBigEndian<quint32>(p + 8);
+        const bool removed = dataSize == DiskCacheTombstone;
+        const qint64 recordSize = DiskCacheRecordHeaderSize + keySize + (removed ? 0 : dataSize);
+        if (magic != DiskCacheRecordMagic || keySize > 1024 * 64 || pos + recordSize > fileSize) {
+            break;
+        }
+        const QByteArray &key = f.read(keySize);
+        if (key.size() != static_cast<int>(keySize)) {
+            break;
+        }
+        DiskCacheRecord record;
+        record.key = QString::fromUtf8(key);
+        record.offset = pos + DiskCacheRecordHeaderSize + keySize;
+        record.size = removed ? 0 : static_cast<qint32>(dataSize);
+        record.recordSize = static_cast<qint32>(recordSize);
+        record.removed = removed;
+        records->append(record);
+        pos += recordSize;
+        if (!f.seek(pos)) {
+            break;
+        }
+    }
+    if (pos < fileSize) {
+        f.resize(pos);
+    }
+    *size = pos;
+    return true;
 }
 
-QSharedPointer<HttpProxy> HttpSession::httpProxy() const
+class HttpDiskCacheManagerPrivate
 {
-    Q_D(const HttpSession);
-    return d->httpProxy();
-}
+public:
+    HttpDiskCacheManagerPrivate(const QDir &dir);
+    ~HttpDiskCacheManagerPrivate();
+public:
+    bool open();
+    QString segmentPath(quint32 id) const;
+    bool openSegment(quint32 id);
+    void dropSegment(quint32 id);
+    void unindex(const QString &key);
+    void schedule(const QString &key, const QByteArray &data, bool removed);
+    void writePending();
+    void compact(quint32 id);
+    void maintain();
+public:
+    QDir dir;
+    QHash<QString, DiskCacheLocation> index;
+    QMap<quint32, DiskCacheSegment> segments;  // the oldest one is at the front.
+    QHash<QString, DiskCachePending> pending;  // stored but not written yet, load() finds them here.
+    QSharedPointer<QFile> writer;  // appends to the active segment, used only by thread.
+    QSharedPointer<ThreadPool> thread;
+    CoroutineGroup *operations;
+    Lock openLock;
+    qint64 maxSize;
+    qint64 totalSize;
+    quint64 nextSerial;
+    quint32 activeSegment;
+    bool opened;
+    bool broken;
+};
 
-void HttpSession::setHttpProxy(QSharedPointer<HttpProxy> proxy)
+HttpDiskCacheManagerPrivate::HttpDiskCacheManagerPrivate(const QDir &dir)
+    : dir(dir)
+    , thread(new ThreadPool(1))
+    , operations(new CoroutineGroup())
+    , maxSize(1024 * 1024 * 1024)
+    , totalSize(0)
+    , nextSerial(0)
+    , activeSegment(0)
+    , opened(false)
+    , broken(false)
 {
-    Q_D(HttpSession);
-    d->setHttpProxy(proxy);
 }
 
-QSharedPointer<HttpCacheManager> HttpSession::cacheManager() const
+HttpDiskCacheManagerPrivate::~HttpDiskCacheManagerPrivate()
 {
-    Q_D(const HttpSession);
-    return d->cacheManager;
+    // the pending writes are finished, so the thread does not own anything.
+    operations->join(QString::fromLatin1("writer"));
+    delete operations;
 }
 
-void HttpSession::setCacheManager(QSharedPointer<HttpCacheManager> cacheManager)
+QString HttpDiskCacheManagerPrivate::segmentPath(quint32 id) const
 {
-    Q_D(HttpSession);
-    d->cacheManager = cacheManager;
+    return dir.filePath(QString::fromLatin1("%1.seg").arg(id, 8, 10, QLatin1Char('0')));
 }
 
-#ifndef QTNG_NO_CRYPTO
-
-SslConfiguration &HttpSession::sslConfiguration()
+bool HttpDiskCacheManagerPrivate::open()
 {
-    Q_D(HttpSession);
-    return d->sslConfig;
-}
+    if (opened) {
+        return !broken;
+    }
+    ScopedLock<Lock> l(openLock);
+    if (opened) {
+        return !broken;
+    }
+    if (!dir.exists() && !dir.mkpath(QString::fromLatin1("."))) {
+        qtng_warning << "can not create the cache directory:" << dir.path();
+        broken = true;
+        opened = true;
+        return false;
+    }
 
-#endif
+    QList<quint32> ids;
+    for (const QString &filename : dir.entryList(QStringList() << QString::fromLatin1("*.seg"), QDir::Files)) {
+        bool ok;
+        const quint32 id = filename.left(filename.size() - 4).toUInt(&ok);
+        if (ok) {
+            ids.append(id);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
 
-HttpCacheManager::HttpCacheManager() { }
+    typedef QPair<qint64, QList<DiskCacheRecord>> ScanResult;
+    QSharedPointer<QList<ScanResult>> results(new QList<ScanResult>());
+    QStringList paths;
+    for (quint32 id : ids) {
+        paths.append(segmentPath(id));
+    }
+    thread->call([results, paths] {
+        for (const QString &path : paths) {
+            ScanResult result(-1, QList<DiskCacheRecord>());
+            if (!scanDiskCacheSegment(path, &result.second, &result.first)) {
+                result.first = -1;
+            }
+            results->append(result);
+        }
+    });
 
-HttpCacheManager::~HttpCacheManager() { }
+    for (int i = 0; i < ids.size() && i < results->size(); ++i) {
+        const ScanResult &result = results->at(i);
+        if (result.first < 0) {
+            continue;
+        }
+        QSharedPointer<QFile> file(new QFile(paths.at(i)));
+        if (!file->open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            continue;
+        }
+        DiskCacheSegment segment;
+        segment.file = file;
+        segment.size = result.first;
+        segment.liveSize = 0;
+        segments.insert(ids.at(i), segment);
+        totalSize += segment.size;
+        for (const DiskCacheRecord &record : result.second) {
+            unindex(record.key);
+            if (!record.removed) {
+                DiskCacheLocation location;
+                location.segment = ids.at(i);
+                location.offset = record.offset;
+                location.size = record.size;
+                location.recordSize = record.recordSize;
+                index.insert(record.key, location);
+                segments[ids.at(i)].liveSize += record.recordSize;
+            }
+        }
+    }
 
-bool HttpCacheManager::addResponse(HttpResponse &response)
+    quint32 id = segments.isEmpty() ? 1 : segments.lastKey();
+    if (!segments.isEmpty() && segments.last().size >= DiskCacheSegmentSize) {
+        ++id;
+    }
+    broken = !openSegment(id);
+    opened = true;
+    return !broken;
+}
+
+bool HttpDiskCacheManagerPrivate::openSegment(quint32 id)
 {
-    const QString &url = response.url().toString();
-    int statusCode = response.statusCode();
-    const QString &statusText = response.statusText();
-    const QList<HttpHeader> headers = response.allHeaders();
-    const QByteArray &body = response.body();
-    QByteArray bs;
-    QDataStream ds(&bs, QIODevice::WriteOnly);
-    ds << statusCode << statusText << headers << body;
-    if (ds.status() != QDataStream::Ok) {
+    const QString &path = segmentPath(id);
+    QSharedPointer<QFile> writer(new QFile(path));
+    if (!writer->open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qtng_warning << "can not open the cache segment:" << path;
         return false;
     }
-    return store(url, bs);
+    if (!segments.contains(id)) {
+        QSharedPointer<QFile> file(new QFile(path));
+        if (!file->open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            qtng_warning << "can not open the cache segment:" << path;
+            return false;
+        }
+        DiskCacheSegment segment;
+        segment.file = file;
+        segment.size = writer->size();
+        segment.liveSize = 0;
+        segments.insert(id, segment);
+        totalSize += segment.size;
+    }
+    this->writer = writer;
+    activeSegment = id;
+    return true;
 }
 
-bool HttpCacheManager::getResponse(HttpResponse *response)
+void HttpDiskCacheManagerPrivate::dropSegment(quint32 id)
 {
-    const QString &url = response->url().toString();
-    if (url.isEmpty()) {
-        return false;
+    QMap<quint32, DiskCacheSegment>::iterator itor = segments.find(id);
+    if (itor == segments.end() || id == activeSegment) {
+        return;
     }
-    const QByteArray &bs = load(url);
-    if (bs.isEmpty()) {
-        return false;
+    for (QHash<QString, DiskCacheLocation>::iterator i = index.begin(); i != index.end();) {
+        if (i.value().segment == id) {
+            i = index.erase(i);
+        } else {
+            ++i;
+        }
     }
-    QDataStream ds(bs);
-    int statusCode;
-    QString statusText;
-    QList<HttpHeader> headers;
-    QByteArray body;
-    ds >> statusCode >> statusText >> headers >> body;
-    if (ds.status() != QDataStream::Ok) {
-        return false;
+    totalSize -= itor.value().size;
+    itor.value().file->close();
+    segments.erase(itor);
+    QFile::remove(segmentPath(id));
+}
+
+void HttpDiskCacheManagerPrivate::unindex(const QString &key)
+{
+    QHash<QString, DiskCacheLocation>::iterator itor = index.find(key);
+    if (itor == index.end()) {
+        return;
     }
-    response->setStatusCode(statusCode);
-    response->setStatusText(statusText);
-    response->setHeaders(headers);
-    response->setBody(body);
-    return true;
+    QMap<quint32, DiskCacheSegment>::iterator segment = segments.find(itor.value().segment);
+    if (segment != segments.end()) {
+        segment.value().liveSize -= itor.value().recordSize;
+    }
+    index.erase(itor);
 }
 
-bool HttpCacheManager::store(const QString &, const QByteArray &)
+void HttpDiskCacheManagerPrivate::schedule(const QString &key, const QByteArray &data, bool removed)
 {
-    return false;
+    DiskCachePending entry;
+    entry.data = data;
+    entry.serial = nextSerial++;
+    entry.removed = removed;
+    pending.insert(key, entry);
+    const QString &name = QString::fromLatin1("writer");
+    QSharedPointer<Coroutine> writer = operations->get(name);
+    if (writer.isNull() || writer->isFinished()) {
+        operations->spawnWithName(name, [this] { writePending(); }, true);
+    }
 }
 
-QByteArray HttpCacheManager::load(const QString &)
+void HttpDiskCacheManagerPrivate::writePending()
 {
-    return QByteArray();
+    while (!pending.isEmpty() && !broken) {
+        // the entries stay in pending until written, and the ones stored again meanwhile are written next round.
+        QList<QPair<QString, quint64>> keys;
+        QList<qint64> offsets;
+        QByteArray buf;
+        for (QHash<QString, DiskCachePending>::const_iterator itor = pending.constBegin();
+             itor != pending.constEnd() && buf.size() < DiskCacheMaxBatchSize; ++itor) {
+            const QByteArray &key = itor.key().toUtf8();
+            keys.append(qMakePair(itor.key(), itor.value().serial));
+            offsets.append(buf.size());
+            appendDiskCacheRecord(&buf, key, itor.value().data, itor.value().removed);
+        }
+        offsets.append(buf.size());
+
+        QSharedPointer<QFile> writer = this->writer;
+        bool ok = thread->call<bool>([writer, buf] { return writer->write(buf) == buf.size() && writer->flush(); });
+        if (!ok) {
+            qtng_warning << "can not write the cache segment:" << segmentPath(activeSegment);
+            broken = true;
+            pending.clear();
+            return;
+        }
+
+        const quint32 id = activeSegment;
+        const qint64 base = segments.value(id).size;
+        segments[id].size += buf.size();
+        totalSize += buf.size();
+        for (int i = 0; i < keys.size(); ++i) {
+            const QString &key = keys.at(i).first;
+            QHash<QString, DiskCachePending>::iterator itor = pending.find(key);
+            if (itor == pending.end() || itor.value().serial != keys.at(i).second) {
+                continue;  // stored again, this record is garbage now.
+            }
+            const bool removed = itor.value().removed;
+            const qint32 recordSize = static_cast<qint32>(offsets.at(i + 1) - offsets.at(i));
+            pending.erase(itor);
+            unindex(key);
+            if (!removed) {
+                DiskCacheLocation location;
+                location.segment = id;
+                location.recordSize = recordSize;
+                location.size = recordSize - DiskCacheRecordHeaderSize - key.toUtf8().size();
+                location.offset = base + offsets.at(i) + (recordSize - location.size);
+                index.insert(key, location);
+                segments[id].liveSize += recordSize;
+            }
+        }
+        maintain();
+    }
 }
 
-class HttpMemoryCacheManagerPrivate
+// move the live entries of the oldest segment to pending, so they are written again to the active one. its garbage
+// and tombstones are dropped with it.
+void HttpDiskCacheManagerPrivate::compact(quint32 id)
 {
-public:
-    HttpMemoryCacheManagerPrivate()
-        : expireTime(60 * 60 * 24)  // one day
-    {
+    const QString &path = segmentPath(id);
+    QList<QPair<QString, DiskCacheLocation>> entries;
+    for (QHash<QString, DiskCacheLocation>::const_iterator itor = index.constBegin(); itor != index.constEnd();
+         ++itor) {
+        if (itor.value().segment == id && !pending.contains(itor.key())) {
+            entries.append(qMakePair(itor.key(), itor.value()));
+        }
     }
-public:
-    QMap<QString, QByteArray> cache;
-    float expireTime;
-};
+    QSharedPointer<QList<QByteArray>> data(new QList<QByteArray>());
+    thread->call([path, entries, data] {
+        QFile f(path);  // the file of segment is used by load() meanwhile.
+        if (!f.open(QIODevice::ReadOnly)) {
+            return;
+        }
+        for (const QPair<QString, DiskCacheLocation> &entry : entries) {
+            if (f.seek(entry.second.offset)) {
+                data->append(f.read(entry.second.size));
+            } else {
+                data->append(QByteArray());
+            }
+        }
+    });
+    for (int i = 0; i < entries.size() && i < data->size(); ++i) {
+        const QString &key = entries.at(i).first;
+        const DiskCacheLocation &location = index.value(key);
+        if (location.segment != id || location.offset != entries.at(i).second.offset || pending.contains(key)
+            || data->at(i).size() != location.size) {
+            continue;
+        }
+        DiskCachePending entry;
+        entry.data = data->at(i);
+        entry.serial = nextSerial++;
+        entry.removed = false;
+        pending.insert(key, entry);
+    }
+    dropSegment(id);
+}
 
-HttpMemoryCacheManager::HttpMemoryCacheManager()
-    : d_ptr(new HttpMemoryCacheManagerPrivate())
+void HttpDiskCacheManagerPrivate::maintain()
+{
+    if (segments.value(activeSegment).size >= DiskCacheSegmentSize) {
+        if (!openSegment(activeSegment + 1)) {
+            broken = true;
+            return;
+        }
+    }
+    // the oldest segments are dropped as a whole, it is much cheaper than lru.
+    while (totalSize > maxSize && segments.size() > 1) {
+        dropSegment(segments.firstKey());
+    }
+    // only the oldest segment is compacted. the tombstones in it hide nothing older, so dropping them never brings a
+    // removed entry back on the next open(), while a newer one may hide the records of older segments.
+    if (segments.size() > 1) {
+        const quint32 oldest = segments.firstKey();
+        const DiskCacheSegment &segment = segments.first();
+        if (oldest != activeSegment && segment.liveSize < segment.size / 2) {
+            compact(oldest);
+        }
+    }
+}
+
+HttpDiskCacheManager::HttpDiskCacheManager(const QDir &cacheDir)
+    : cacheDir(cacheDir)
+    , d_ptr(new HttpDiskCacheManagerPrivate(cacheDir))
 {
 }
 
-HttpMemoryCacheManager::~HttpMemoryCacheManager()
+HttpDiskCacheManager::HttpDiskCacheManager(const QString &cacheDir)
+    : cacheDir(cacheDir)
+    , d_ptr(new HttpDiskCacheManagerPrivate(this->cacheDir))
+{
+}
+
+HttpDiskCacheManager::~HttpDiskCacheManager()
 {
     delete d_ptr;
 }
 
-float HttpMemoryCacheManager::expireTime() const
+qint64 HttpDiskCacheManager::maxSize() const
 {
-    Q_D(const HttpMemoryCacheManager);
-    return d->expireTime;
+    Q_D(const HttpDiskCacheManager);
+    return d->maxSize;
 }
 
-void HttpMemoryCacheManager::setExpireTime(float expireTime)
+void HttpDiskCacheManager::setMaxSize(qint64 maxSize)
 {
-    Q_D(HttpMemoryCacheManager);
-    d->expireTime = expireTime;
+    Q_D(HttpDiskCacheManager);
+    d->maxSize = qMax<qint64>(DiskCacheSegmentSize, maxSize);
 }
 
-bool HttpMemoryCacheManager::store(const QString &url, const QByteArray &data)
+qint64 HttpDiskCacheManager::size() const
 {
-    Q_D(HttpMemoryCacheManager);
-    d->cache.insert(url, data);
-    return true;
+    Q_D(const HttpDiskCacheManager);
+    return d->totalSize;
 }
 
-QByteArray HttpMemoryCacheManager::load(const QString &url)
+bool HttpDiskCacheManager::flush()
 {
-    Q_D(HttpMemoryCacheManager);
-    return d->cache.value(url);
+    Q_D(HttpDiskCacheManager);
+    d->operations->join(QString::fromLatin1("writer"));
+    return !d->broken;
 }
 
 bool HttpDiskCacheManager::store(const QString &url, const QByteArray &data)
 {
-    const QByteArray &filename = QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha256).toHex();
-    const QString &fullpath = cacheDir.filePath(QString::fromLatin1(filename));
-    QFile f(fullpath);
-    if (!f.open(QIODevice::WriteOnly)) {
-        return false;
-    }
-    qint64 bs = f.write(data);
-    if (bs != data.size()) {
+    Q_D(HttpDiskCacheManager);
+    if (!d->open() || data.size() > d->maxSize / 2) {
         return false;
     }
+    d->schedule(url, data, false);
     return true;
 }
 
 QByteArray HttpDiskCacheManager::load(const QString &url)
 {
-    const QByteArray &filename = QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha256).toHex();
-    const QString &fullpath = cacheDir.filePath(QString::fromLatin1(filename));
-    QFile f(fullpath);
-    if (!f.open(QIODevice::ReadOnly)) {
+    Q_D(HttpDiskCacheManager);
+    if (!d->open()) {
+        return QByteArray();
+    }
+    QHash<QString, DiskCachePending>::const_iterator itor = d->pending.constFind(url);
+    if (itor != d->pending.constEnd()) {
+        return itor.value().removed ? QByteArray() : itor.value().data;
+    }
+    QHash<QString, DiskCacheLocation>::const_iterator found = d->index.constFind(url);
+    if (found == d->index.constEnd()) {
+        return QByteArray();
+    }
+    const DiskCacheLocation location = found.value();
+    QSharedPointer<QFile> file = d->segments.value(location.segment).file;
+    if (file.isNull() || !file->seek(location.offset)) {
         return QByteArray();
     }
-    return f.readAll();
+    const QByteArray &data = file->read(location.size);
+    if (data.size() != location.size) {
+        d->unindex(url);
+        return QByteArray();
+    }
+    return data;
+}
+
+void HttpDiskCacheManager::remove(const QString &url)
+{
+    Q_D(HttpDiskCacheManager);
+    if (!d->open()) {
+        return;
+    }
+    if (d->index.contains(url) || d->pending.contains(url)) {
+        d->schedule(url, QByteArray(), true);
+    }
 }
 
 RequestError::~RequestError() { }
@@ -3033,4 +5464,9 @@ QString UnrewindableBodyError::what() const
     return QString::fromLatin1("Requests encountered an error when trying to rewind a body");
 }
 
+QString BufferBudgetExceeded::what() const
+{
+    return QString::fromLatin1("The response body exceeds the buffer budget");
+}
+
 QTNETWORKNG_NAMESPACE_END
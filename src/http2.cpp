@@ -0,0 +1,1474 @@
+#include <QtCore/qendian.h>
+#include <QtCore/qvector.h>
+#include "../include/private/http2_p.h"
+#include "../include/socket_utils.h"
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.http2")
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// the huffman code of rfc 7541 appendix b, without EOS.
+static const quint32 huffmanCodes[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+
+static const quint8 huffmanCodeLengths[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+struct HPackStaticEntry
+{
+    const char *name;
+    const char *value;
+};
+
+// rfc 7541 appendix a, the index starts from 1.
+static const HPackStaticEntry staticTable[] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+static const quint32 StaticTableSize = sizeof(staticTable) / sizeof(staticTable[0]);
+
+namespace HPack {
+
+void encodeInteger(quint32 value, int prefixBits, quint8 firstByte, QByteArray *out)
+{
+    const quint32 maxPrefix = (1u << prefixBits) - 1;
+    if (value < maxPrefix) {
+        out->append(static_cast<char>(firstByte | value));
+        return;
+    }
+    out->append(static_cast<char>(firstByte | maxPrefix));
+    value -= maxPrefix;
+    while (value >= 128) {
+        out->append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->append(static_cast<char>(value));
+}
+
+bool decodeInteger(const char *&p, const char *end, int prefixBits, quint32 *value)
+{
+    if (p >= end) {
+        return false;
+    }
+    const quint32 maxPrefix = (1u << prefixBits) - 1;
+    quint64 v = static_cast<quint8>(*p++) & maxPrefix;
+    if (v < maxPrefix) {
+        *value = static_cast<quint32>(v);
+        return true;
+    }
+    for (int shift = 0; p < end && shift <= 28; shift += 7) {
+        const quint8 b = static_cast<quint8>(*p++);
+        v += static_cast<quint64>(b & 0x7f) << shift;
+        if (v > 0xffffffffu) {
+            return false;
+        }
+        if (!(b & 0x80)) {
+            *value = static_cast<quint32>(v);
+            return true;
+        }
+    }
+    return false;
+}
+
+void encodeString(const QByteArray &s, QByteArray *out)
+{
+    quint64 bits = 0;
+    for (int i = 0; i < s.size(); ++i) {
+        bits += huffmanCodeLengths[static_cast<quint8>(s.at(i))];
+    }
+    const quint32 huffmanSize = static_cast<quint32>((bits + 7) / 8);
+    if (huffmanSize >= static_cast<quint32>(s.size())) {
+        encodeInteger(static_cast<quint32>(s.size()), 7, 0x00, out);
+        out->append(s);
+        return;
+    }
+    encodeInteger(huffmanSize, 7, 0x80, out);
+    quint64 acc = 0;
+    int n = 0;
+    for (int i = 0; i < s.size(); ++i) {
+        const quint8 c = static_cast<quint8>(s.at(i));
+        acc = (acc << huffmanCodeLengths[c]) | huffmanCodes[c];
+        n += huffmanCodeLengths[c];
+        while (n >= 8) {
+            n -= 8;
+            out->append(static_cast<char>(acc >> n));
+        }
+        acc &= (static_cast<quint64>(1) << n) - 1;
+    }
+    if (n > 0) {
+        // pad with the most significant bits of EOS.
+        out->append(static_cast<char>((acc << (8 - n)) | (0xff >> n)));
+    }
+}
+
+struct HuffmanNode
+{
+    qint16 children[2];
+    qint16 symbol;
+};
+
+class HuffmanTree
+{
+public:
+    HuffmanTree();
+    QVector<HuffmanNode> nodes;
+};
+
+HuffmanTree::HuffmanTree()
+{
+    const HuffmanNode empty = { { -1, -1 }, -1 };
+    nodes.reserve(512);
+    nodes.append(empty);
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        const quint32 code = huffmanCodes[symbol];
+        int node = 0;
+        for (int i = huffmanCodeLengths[symbol] - 1; i >= 0; --i) {
+            const int bit = (code >> i) & 1;
+            if (nodes[node].children[bit] < 0) {
+                nodes.append(empty);
+                nodes[node].children[bit] = static_cast<qint16>(nodes.size() - 1);
+            }
+            node = nodes[node].children[bit];
+        }
+        nodes[node].symbol = static_cast<qint16>(symbol);
+    }
+}
+
+static bool decodeHuffman(const char *data, int len, QByteArray *out)
+{
+    static const HuffmanTree tree;
+    const HuffmanNode *nodes = tree.nodes.constData();
+    out->reserve(len * 8 / 5);
+    int node = 0;
+    int depth = 0;  // the bits since the last symbol.
+    bool allOnes = true;
+    for (int i = 0; i < len; ++i) {
+        const quint8 b = static_cast<quint8>(data[i]);
+        for (int j = 7; j >= 0; --j) {
+            const int bit = (b >> j) & 1;
+            node = nodes[node].children[bit];
+            if (node < 0) {
+                return false;
+            }
+            ++depth;
+            allOnes = allOnes && bit;
+            if (nodes[node].symbol >= 0) {
+                out->append(static_cast<char>(nodes[node].symbol));
+                node = 0;
+                depth = 0;
+                allOnes = true;
+            }
+        }
+    }
+    // the padding must be shorter than 8 bits and be the prefix of EOS.
+    return depth < 8 && allOnes;
+}
+
+bool decodeString(const char *&p, const char *end, QByteArray *out)
+{
+    if (p >= end) {
+        return false;
+    }
+    const bool huffman = static_cast<quint8>(*p) & 0x80;
+    quint32 len;
+    if (!decodeInteger(p, end, 7, &len) || len > static_cast<quint32>(end - p)) {
+        return false;
+    }
+    if (huffman) {
+        out->clear();
+        if (!decodeHuffman(p, static_cast<int>(len), out)) {
+            return false;
+        }
+    } else {
+        *out = QByteArray(p, static_cast<int>(len));
+    }
+    p += len;
+    return true;
+}
+
+}  // namespace HPack
+
+HPackTable::HPackTable()
+    : currentSize(0)
+    , currentMaxSize(4096)
+{
+}
+
+bool HPackTable::lookup(quint32 index, HPackHeader *header) const
+{
+    if (index == 0) {
+        return false;
+    }
+    if (index <= StaticTableSize) {
+        const HPackStaticEntry &entry = staticTable[index - 1];
+        header->name = QByteArray::fromRawData(entry.name, static_cast<int>(qstrlen(entry.name)));
+        header->value = QByteArray::fromRawData(entry.value, static_cast<int>(qstrlen(entry.value)));
+        return true;
+    }
+    index -= StaticTableSize + 1;
+    if (index >= static_cast<quint32>(entries.size())) {
+        return false;
+    }
+    *header = entries.at(static_cast<int>(index));
+    return true;
+}
+
+int HPackTable::find(const HPackHeader &header, bool *valueMatched) const
+{
+    int nameIndex = 0;
+    for (quint32 i = 0; i < StaticTableSize; ++i) {
+        const HPackStaticEntry &entry = staticTable[i];
+        if (header.name == entry.name) {
+            if (header.value == entry.value) {
+                *valueMatched = true;
+                return static_cast<int>(i + 1);
+            }
+            if (nameIndex == 0) {
+                nameIndex = static_cast<int>(i + 1);
+            }
+        }
+    }
+    for (int i = 0; i < entries.size(); ++i) {
+        const HPackHeader &entry = entries.at(i);
+        if (header.name == entry.name) {
+            if (header.value == entry.value) {
+                *valueMatched = true;
+                return static_cast<int>(StaticTableSize) + i + 1;
+            }
+            if (nameIndex == 0) {
+                nameIndex = static_cast<int>(StaticTableSize) + i + 1;
+            }
+        }
+    }
+    *valueMatched = false;
+    return nameIndex;
+}
+
+void HPackTable::insert(const HPackHeader &header)
+{
+    const quint32 size = header.size();
+    if (size > currentMaxSize) {
+        // not an error, the table is emptied.
+        entries.clear();
+        currentSize = 0;
+        return;
+    }
+    evict(size);
+    entries.prepend(header);
+    currentSize += size;
+}
+
+void HPackTable::setMaxSize(quint32 maxSize)
+{
+    currentMaxSize = maxSize;
+    evict(0);
+}
+
+void HPackTable::evict(quint32 wanted)
+{
+    while (!entries.isEmpty() && currentSize + wanted > currentMaxSize) {
+        currentSize -= entries.last().size();
+        entries.removeLast();
+    }
+}
+
+HPackEncoder::HPackEncoder()
+    : pendingTableSize(4096)
+    , tableSizeChanged(false)
+{
+}
+
+void HPackEncoder::setMaxTableSize(quint32 maxSize)
+{
+    // never use a table larger than the default one, the peer just allows it.
+    const quint32 wanted = qMin<quint32>(maxSize, 4096);
+    if (wanted != table.maxSize() || tableSizeChanged) {
+        pendingTableSize = wanted;
+        tableSizeChanged = true;
+    }
+}
+
+QByteArray HPackEncoder::encode(const QList<HPackHeader> &headers)
+{
+    QByteArray out;
+    if (tableSizeChanged) {
+        HPack::encodeInteger(pendingTableSize, 5, 0x20, &out);
+        table.setMaxSize(pendingTableSize);
+        tableSizeChanged = false;
+    }
+    for (const HPackHeader &header : headers) {
+        bool valueMatched;
+        const int index = table.find(header, &valueMatched);
+        if (index > 0 && valueMatched) {
+            HPack::encodeInteger(static_cast<quint32>(index), 7, 0x80, &out);
+            continue;
+        }
+        const bool sensitive = header.name == "authorization" || header.name == "proxy-authorization"
+                || (header.name == "cookie" && header.value.size() < 20);
+        if (sensitive) {
+            // never indexed, so the intermediaries do not index it either.
+            HPack::encodeInteger(static_cast<quint32>(index), 4, 0x10, &out);
+        } else if (header.size() <= table.maxSize() / 2 && header.name != "content-length") {
+            HPack::encodeInteger(static_cast<quint32>(index), 6, 0x40, &out);
+            table.insert(header);
+        } else {
+            HPack::encodeInteger(static_cast<quint32>(index), 4, 0x00, &out);
+        }
+        if (index == 0) {
+            HPack::encodeString(header.name, &out);
+        }
+        HPack::encodeString(header.value, &out);
+    }
+    return out;
+}
+
+HPackDecoder::HPackDecoder()
+    : allowedTableSize(4096)
+    , maxHeaderListSize(1024 * 256)
+{
+}
+
+void HPackDecoder::setMaxTableSize(quint32 maxSize)
+{
+    allowedTableSize = maxSize;
+    if (table.maxSize() > maxSize) {
+        table.setMaxSize(maxSize);
+    }
+}
+
+bool HPackDecoder::decode(const QByteArray &block, QList<HPackHeader> *headers)
+{
+    const char *p = block.constData();
+    const char *end = p + block.size();
+    quint32 listSize = 0;
+    bool headerDecoded = false;
+    while (p < end) {
+        const quint8 b = static_cast<quint8>(*p);
+        HPackHeader header;
+        quint32 index;
+        if (b & 0x80) {
+            if (!HPack::decodeInteger(p, end, 7, &index) || !table.lookup(index, &header)) {
+                return false;
+            }
+        } else if ((b & 0xe0) == 0x20) {
+            // dynamic table size update, only allowed at the beginning of a block.
+            quint32 size;
+            if (headerDecoded || !HPack::decodeInteger(p, end, 5, &size) || size > allowedTableSize) {
+                return false;
+            }
+            table.setMaxSize(size);
+            continue;
+        } else {
+            const bool indexing = b & 0x40;
+            if (!HPack::decodeInteger(p, end, indexing ? 6 : 4, &index)) {
+                return false;
+            }
+            if (index > 0) {
+                if (!table.lookup(index, &header)) {
+                    return false;
+                }
+            } else if (!HPack::decodeString(p, end, &header.name)) {
+                return false;
+            }
+            if (!HPack::decodeString(p, end, &header.value)) {
+                return false;
+            }
+            if (indexing) {
+                table.insert(header);
+            }
+        }
+        headerDecoded = true;
+        listSize += header.size();
+        if (listSize > maxHeaderListSize) {
+            return false;
+        }
+        headers->append(header);
+    }
+    return true;
+}
+
+static const char Http2Preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const int Http2PrefaceSize = sizeof(Http2Preface) - 1;
+static const quint32 DefaultWindowSize = 65535;
+static const quint32 LocalInitialWindowSize = 1024 * 1024;
+static const quint32 LocalConnectionWindowSize = 1024 * 1024 * 16;
+static const quint32 LocalMaxFrameSize = 16384;
+static const quint32 LocalMaxConcurrentStreams = 128;
+static const int MaxHeaderBlockSize = 1024 * 256;
+
+static void appendFrameHeader(QByteArray *out, quint32 length, quint8 type, quint8 flags, quint32 streamId)
+{
+    char header[9];
+    header[0] = static_cast<char>((length >> 16) & 0xff);
+    header[1] = static_cast<char>((length >> 8) & 0xff);
+    header[2] = static_cast<char>(length & 0xff);
+    header[3] = static_cast<char>(type);
+    header[4] = static_cast<char>(flags);
+    qToBigEndian<quint32>(streamId & 0x7fffffff, reinterpret_cast<uchar *>(header + 5));
+    out->append(header, 9);
+}
+
+static void appendSetting(QByteArray *out, quint16 id, quint32 value)
+{
+    char setting[6];
+    qToBigEndian<quint16>(id, reinterpret_cast<uchar *>(setting));
+    qToBigEndian<quint32>(value, reinterpret_cast<uchar *>(setting + 2));
+    out->append(setting, 6);
+}
+
+static QByteArray packUInt32(quint32 value)
+{
+    char buf[4];
+    qToBigEndian<quint32>(value, reinterpret_cast<uchar *>(buf));
+    return QByteArray(buf, 4);
+}
+
+static inline quint32 unpackUInt32(const char *data)
+{
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(data));
+}
+
+Http2Stream::Http2Stream(quint32 id)
+    : id(id)
+    , sendWindow(DefaultWindowSize)
+    , recvWindow(DefaultWindowSize)
+    , consumed(0)
+    , errorCode(Http2NoError)
+    , headersSent(false)
+    , localClosed(false)
+    , remoteClosed(false)
+    , reset(false)
+{
+}
+
+Http2Connection::Http2Connection(QSharedPointer<SocketLike> connection, bool asServer)
+    : connection(connection)
+    , debugLevel(0)
+    , operations(new CoroutineGroup)
+    , sendWindow(DefaultWindowSize)
+    , recvWindow(DefaultWindowSize)
+    , consumed(0)
+    , nextStreamId(asServer ? 2 : 1)
+    , lastPeerStreamId(0)
+    , remoteMaxConcurrentStreams(100)
+    , remoteInitialWindowSize(DefaultWindowSize)
+    , remoteMaxFrameSize(16384)
+    , asServer(asServer)
+    , goingAway(false)
+    , broken(false)
+{
+    decoder.setMaxHeaderListSize(MaxHeaderBlockSize);
+}
+
+Http2Connection::~Http2Connection()
+{
+    delete operations;
+    connection->close();
+}
+
+bool Http2Connection::handshake(const QByteArray &buffered)
+{
+    pending = buffered;
+    if (asServer) {
+        while (pending.size() < Http2PrefaceSize) {
+            const QByteArray &data = connection->recv(1024 * 16);
+            if (data.isEmpty()) {
+                return false;
+            }
+            pending.append(data);
+        }
+        if (!pending.startsWith(QByteArray::fromRawData(Http2Preface, Http2PrefaceSize))) {
+            if (debugLevel > 0) {
+                qtng_debug << "got invalid http2 preface.";
+            }
+            return false;
+        }
+        pending.remove(0, Http2PrefaceSize);
+    }
+
+    QByteArray frames;
+    if (!asServer) {
+        frames.append(Http2Preface, Http2PrefaceSize);
+    }
+    QByteArray settings;
+    if (asServer) {
+        appendSetting(&settings, Http2MaxConcurrentStreams, LocalMaxConcurrentStreams);
+    } else {
+        appendSetting(&settings, Http2EnablePush, 0);
+    }
+    appendSetting(&settings, Http2InitialWindowSize, LocalInitialWindowSize);
+    appendSetting(&settings, Http2MaxHeaderListSize, MaxHeaderBlockSize);
+    appendFrameHeader(&frames, static_cast<quint32>(settings.size()), Http2SettingsFrame, 0, 0);
+    frames.append(settings);
+    // the window of connection can only be changed by WINDOW_UPDATE.
+    appendFrameHeader(&frames, 4, Http2WindowUpdateFrame, 0, 0);
+    frames.append(packUInt32(LocalConnectionWindowSize - DefaultWindowSize));
+    recvWindow = LocalConnectionWindowSize;
+    if (!sendFrames(frames)) {
+        return false;
+    }
+    operations->spawnWithName(QString::fromLatin1("readFrames"), [this] { readFrames(); });
+    return true;
+}
+
+bool Http2Connection::join()
+{
+    return closed.wait();
+}
+
+bool Http2Connection::isValid() const
+{
+    return !broken && connection->isValid();
+}
+
+QSharedPointer<Http2Stream> Http2Connection::openStream(const QList<HPackHeader> &headers, bool endStream)
+{
+    while (true) {
+        if (!canOpenStream() || nextStreamId > 0x7fffffff) {
+            return QSharedPointer<Http2Stream>();
+        }
+        if (static_cast<quint32>(streams.size()) >= remoteMaxConcurrentStreams) {
+            if (!windowChanged.wait()) {
+                return QSharedPointer<Http2Stream>();
+            }
+            continue;
+        }
+        ScopedLock<Lock> lock(writeLock);
+        if (!lock.isSuccess()) {
+            return QSharedPointer<Http2Stream>();
+        }
+        if (!canOpenStream() || static_cast<quint32>(streams.size()) >= remoteMaxConcurrentStreams) {
+            continue;
+        }
+        // the stream ids and the hpack states must be in the same order as the frames are sent.
+        QSharedPointer<Http2Stream> stream(new Http2Stream(nextStreamId));
+        nextStreamId += 2;
+        stream->sendWindow = remoteInitialWindowSize;
+        stream->recvWindow = LocalInitialWindowSize;
+        stream->headersSent = true;
+        stream->localClosed = endStream;
+        streams.insert(stream->id, stream);
+        QByteArray frames;
+        appendHeaderFrames(&frames, stream->id, encoder.encode(headers), endStream);
+        if (connection->sendall(frames) != frames.size()) {
+            setBroken();
+            return QSharedPointer<Http2Stream>();
+        }
+        return stream;
+    }
+}
+
+bool Http2Connection::sendHeaders(QSharedPointer<Http2Stream> stream, const QList<HPackHeader> &headers,
+                                  bool endStream)
+{
+    ScopedLock<Lock> lock(writeLock);
+    if (!lock.isSuccess() || broken || stream->reset || stream->localClosed) {
+        return false;
+    }
+    QByteArray frames;
+    appendHeaderFrames(&frames, stream->id, encoder.encode(headers), endStream);
+    if (connection->sendall(frames) != frames.size()) {
+        setBroken();
+        return false;
+    }
+    stream->headersSent = true;
+    if (endStream) {
+        stream->localClosed = true;
+        if (stream->remoteClosed) {
+            removeStream(stream);
+        }
+    }
+    return true;
+}
+
+void Http2Connection::appendHeaderFrames(QByteArray *frames, quint32 streamId, const QByteArray &block,
+                                         bool endStream)
+{
+    int pos = 0;
+    bool first = true;
+    do {
+        const int size = qMin(block.size() - pos, static_cast<int>(remoteMaxFrameSize));
+        quint8 flags = pos + size == block.size() ? Http2EndHeadersFlag : 0;
+        if (first && endStream) {
+            flags |= Http2EndStreamFlag;
+        }
+        appendFrameHeader(frames, static_cast<quint32>(size), first ? Http2HeadersFrame : Http2ContinuationFrame,
+                          flags, streamId);
+        frames->append(block.constData() + pos, size);
+        pos += size;
+        first = false;
+    } while (pos < block.size());
+}
+
+bool Http2Connection::sendData(QSharedPointer<Http2Stream> stream, const char *data, qint32 size, bool endStream)
+{
+    if (size <= 0 && !endStream) {
+        return true;
+    }
+    qint32 sent = 0;
+    do {
+        while (!broken && !stream->reset && sent < size && (sendWindow <= 0 || stream->sendWindow <= 0)) {
+            if (!windowChanged.wait()) {
+                return false;
+            }
+        }
+        if (broken || stream->reset || stream->localClosed) {
+            return false;
+        }
+        qint64 chunk = qMin<qint64>(size - sent, qMin(sendWindow, stream->sendWindow));
+        chunk = qBound<qint64>(0, chunk, remoteMaxFrameSize);
+        const bool last = sent + chunk == size;
+        QByteArray frame;
+        frame.reserve(static_cast<int>(chunk) + 9);
+        appendFrameHeader(&frame, static_cast<quint32>(chunk), Http2DataFrame,
+                          last && endStream ? Http2EndStreamFlag : 0, stream->id);
+        frame.append(data + sent, static_cast<int>(chunk));
+        // take the windows before sending, the other coroutines may send while this one is blocked.
+        sendWindow -= chunk;
+        stream->sendWindow -= chunk;
+        if (!sendFrames(frame)) {
+            return false;
+        }
+        sent += static_cast<qint32>(chunk);
+    } while (sent < size);
+    if (endStream) {
+        stream->localClosed = true;
+        if (stream->remoteClosed) {
+            removeStream(stream);
+        }
+    }
+    return true;
+}
+
+bool Http2Connection::recvHeaders(QSharedPointer<Http2Stream> stream, QList<HPackHeader> *headers)
+{
+    while (stream->headerBlocks.isEmpty() && !stream->remoteClosed && !stream->reset) {
+        if (!stream->changed.wait()) {
+            return false;
+        }
+    }
+    if (stream->headerBlocks.isEmpty()) {
+        return false;
+    }
+    *headers = stream->headerBlocks.takeFirst();
+    return true;
+}
+
+qint32 Http2Connection::recvData(QSharedPointer<Http2Stream> stream, char *data, qint32 size)
+{
+    while (stream->data.isEmpty() && !stream->remoteClosed && !stream->reset) {
+        if (!stream->changed.wait()) {
+            return -1;
+        }
+    }
+    if (stream->data.isEmpty()) {
+        return stream->remoteClosed ? 0 : -1;
+    }
+    const qint32 n = qMin(size, stream->data.size());
+    memcpy(data, stream->data.constData(), static_cast<size_t>(n));
+    stream->data.remove(0, n);
+    stream->consumed += n;
+    if (!stream->remoteClosed && !stream->reset
+        && stream->consumed >= static_cast<qint32>(LocalInitialWindowSize / 2)) {
+        const qint32 increment = stream->consumed;
+        stream->consumed = 0;
+        stream->recvWindow += increment;
+        sendFrame(Http2WindowUpdateFrame, 0, stream->id, packUInt32(static_cast<quint32>(increment)));
+    }
+    return n;
+}
+
+void Http2Connection::closeStream(QSharedPointer<Http2Stream> stream)
+{
+    stream->data.clear();
+    if (stream->reset || (stream->localClosed && stream->remoteClosed)) {
+        return;
+    }
+    // a server may stop reading the request after the response is sent.
+    const Http2ErrorCode errorCode = stream->localClosed ? Http2NoError : Http2Cancel;
+    stream->reset = true;
+    stream->errorCode = errorCode;
+    removeStream(stream);
+    stream->changed.notifyAll();
+    if (broken) {
+        return;
+    }
+    // called by destructors, never block here.
+    const quint32 streamId = stream->id;
+    operations->spawn([this, streamId, errorCode] {
+        sendFrame(Http2RstStreamFrame, 0, streamId, packUInt32(errorCode));
+    });
+}
+
+void Http2Connection::goAway(Http2ErrorCode errorCode)
+{
+    if (broken) {
+        return;
+    }
+    if (debugLevel > 0) {
+        qtng_debug << "http2 connection goes away:" << errorCode;
+    }
+    goingAway = true;
+    QByteArray payload = packUInt32(lastPeerStreamId);
+    payload.append(packUInt32(errorCode));
+    sendFrame(Http2GoAwayFrame, 0, 0, payload);
+    setBroken();
+}
+
+void Http2Connection::handleNewStream(QSharedPointer<Http2Stream> stream)
+{
+    resetStream(stream, Http2RefusedStream, true);
+}
+
+void Http2Connection::readFrames()
+{
+    BufferedSocketReader reader(connection, pending, 1024 * 16);
+    pending.clear();
+    QByteArray headerBlock;
+    quint32 headerStreamId = 0;
+    bool headerEndStream = false;
+    bool continuing = false;
+    while (!broken) {
+        const QByteArray &head = reader.readExactly(9);
+        if (head.size() != 9) {
+            break;
+        }
+        const uchar *h = reinterpret_cast<const uchar *>(head.constData());
+        const quint32 length = (static_cast<quint32>(h[0]) << 16) | (static_cast<quint32>(h[1]) << 8) | h[2];
+        const quint8 type = h[3];
+        const quint8 flags = h[4];
+        const quint32 streamId = unpackUInt32(head.constData() + 5) & 0x7fffffff;
+        if (length > LocalMaxFrameSize) {
+            goAway(Http2FrameSizeError);
+            break;
+        }
+        const QByteArray &payload = reader.readExactly(static_cast<qint32>(length));
+        if (payload.size() != static_cast<int>(length)) {
+            break;
+        }
+        if (continuing) {
+            if (type != Http2ContinuationFrame || streamId != headerStreamId) {
+                goAway(Http2ProtocolError);
+                break;
+            }
+            headerBlock.append(payload);
+            if (headerBlock.size() > MaxHeaderBlockSize) {
+                goAway(Http2EnhanceYourCalm);
+                break;
+            }
+            if (flags & Http2EndHeadersFlag) {
+                continuing = false;
+                if (!handleHeaderBlock(headerStreamId, headerBlock, headerEndStream)) {
+                    break;
+                }
+                headerBlock.clear();
+            }
+            continue;
+        }
+        if (type == Http2HeadersFrame) {
+            if (streamId == 0) {
+                goAway(Http2ProtocolError);
+                break;
+            }
+            int pos = 0;
+            int end = payload.size();
+            if (flags & Http2PaddedFlag) {
+                if (payload.isEmpty()) {
+                    goAway(Http2ProtocolError);
+                    break;
+                }
+                pos = 1;
+                end -= static_cast<quint8>(payload.at(0));
+            }
+            if (flags & Http2PriorityFlag) {
+                pos += 5;
+            }
+            if (end < pos) {
+                goAway(Http2ProtocolError);
+                break;
+            }
+            const QByteArray &fragment = payload.mid(pos, end - pos);
+            if (!(flags & Http2EndHeadersFlag)) {
+                continuing = true;
+                headerStreamId = streamId;
+                headerEndStream = flags & Http2EndStreamFlag;
+                headerBlock = fragment;
+                continue;
+            }
+            if (!handleHeaderBlock(streamId, fragment, flags & Http2EndStreamFlag)) {
+                break;
+            }
+            continue;
+        }
+        if (!handleFrame(type, flags, streamId, payload)) {
+            break;
+        }
+    }
+    setBroken();
+}
+
+bool Http2Connection::handleFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    switch (type) {
+    case Http2DataFrame:
+        return handleData(flags, streamId, payload);
+    case Http2PriorityFrame:
+        if (payload.size() != 5) {
+            goAway(Http2FrameSizeError);
+            return false;
+        }
+        return true;
+    case Http2RstStreamFrame: {
+        if (streamId == 0) {
+            goAway(Http2ProtocolError);
+            return false;
+        }
+        if (payload.size() != 4) {
+            goAway(Http2FrameSizeError);
+            return false;
+        }
+        QSharedPointer<Http2Stream> stream = streams.value(streamId);
+        if (!stream.isNull()) {
+            stream->errorCode = unpackUInt32(payload.constData());
+            resetStream(stream, static_cast<Http2ErrorCode>(stream->errorCode), false);
+        }
+        return true;
+    }
+    case Http2SettingsFrame:
+        if (streamId != 0) {
+            goAway(Http2ProtocolError);
+            return false;
+        }
+        return handleSettings(flags, payload);
+    case Http2PushPromiseFrame:
+        // we never enable server push.
+        goAway(Http2ProtocolError);
+        return false;
+    case Http2PingFrame:
+        if (streamId != 0) {
+            goAway(Http2ProtocolError);
+            return false;
+        }
+        if (payload.size() != 8) {
+            goAway(Http2FrameSizeError);
+            return false;
+        }
+        if (!(flags & Http2AckFlag)) {
+            return sendFrame(Http2PingFrame, Http2AckFlag, 0, payload);
+        }
+        return true;
+    case Http2GoAwayFrame:
+        if (streamId != 0 || payload.size() < 8) {
+            goAway(Http2ProtocolError);
+            return false;
+        }
+        handleGoAway(payload);
+        return true;
+    case Http2WindowUpdateFrame:
+        return handleWindowUpdate(streamId, payload);
+    case Http2ContinuationFrame:
+        goAway(Http2ProtocolError);
+        return false;
+    default:
+        // the unknown frames must be ignored.
+        return true;
+    }
+}
+
+bool Http2Connection::handleHeaderBlock(quint32 streamId, const QByteArray &block, bool endStream)
+{
+    QList<HPackHeader> headers;
+    // decode every block even if the stream is gone, the hpack state is shared by the whole connection.
+    if (!decoder.decode(block, &headers)) {
+        goAway(Http2CompressionError);
+        return false;
+    }
+    QSharedPointer<Http2Stream> stream = streams.value(streamId);
+    if (stream.isNull()) {
+        if (asServer && (streamId & 1) && streamId > lastPeerStreamId) {
+            lastPeerStreamId = streamId;
+            stream.reset(new Http2Stream(streamId));
+            stream->sendWindow = remoteInitialWindowSize;
+            stream->recvWindow = LocalInitialWindowSize;
+            stream->remoteClosed = endStream;
+            stream->headerBlocks.append(headers);
+            streams.insert(streamId, stream);
+            if (goingAway || static_cast<quint32>(streams.size()) > LocalMaxConcurrentStreams) {
+                resetStream(stream, Http2RefusedStream, true);
+            } else {
+                handleNewStream(stream);
+            }
+            return true;
+        }
+        if ((asServer && streamId > lastPeerStreamId) || (!asServer && streamId >= nextStreamId)) {
+            // the stream is never opened.
+            goAway(Http2ProtocolError);
+            return false;
+        }
+        // the stream is closed or reset by us.
+        return true;
+    }
+    if (stream->remoteClosed) {
+        resetStream(stream, Http2StreamClosed, true);
+        return true;
+    }
+    stream->headerBlocks.append(headers);
+    if (endStream) {
+        stream->remoteClosed = true;
+        if (stream->localClosed) {
+            removeStream(stream);
+        }
+    }
+    stream->changed.notifyAll();
+    return true;
+}
+
+bool Http2Connection::handleData(quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    if (streamId == 0) {
+        goAway(Http2ProtocolError);
+        return false;
+    }
+    const qint32 length = payload.size();
+    recvWindow -= length;
+    if (recvWindow < 0) {
+        goAway(Http2FlowControlError);
+        return false;
+    }
+    // the window of connection is given back immediately, the windows of streams limit the buffered data.
+    consumed += length;
+    if (consumed >= static_cast<qint32>(LocalConnectionWindowSize / 2)) {
+        const qint32 increment = consumed;
+        consumed = 0;
+        recvWindow += increment;
+        if (!sendFrame(Http2WindowUpdateFrame, 0, 0, packUInt32(static_cast<quint32>(increment)))) {
+            return false;
+        }
+    }
+
+    int pos = 0;
+    int end = length;
+    if (flags & Http2PaddedFlag) {
+        if (length < 1 || static_cast<quint8>(payload.at(0)) >= length) {
+            goAway(Http2ProtocolError);
+            return false;
+        }
+        pos = 1;
+        end -= static_cast<quint8>(payload.at(0));
+    }
+
+    QSharedPointer<Http2Stream> stream = streams.value(streamId);
+    if (stream.isNull() || stream->remoteClosed) {
+        if ((asServer && streamId > lastPeerStreamId) || (!asServer && streamId >= nextStreamId)) {
+            goAway(Http2ProtocolError);
+            return false;
+        }
+        return true;
+    }
+    stream->recvWindow -= length;
+    if (stream->recvWindow < 0) {
+        resetStream(stream, Http2FlowControlError, true);
+        return true;
+    }
+    // the padding is consumed by nobody.
+    stream->consumed += length - (end - pos);
+    stream->data.append(payload.constData() + pos, end - pos);
+    if (flags & Http2EndStreamFlag) {
+        stream->remoteClosed = true;
+        if (stream->localClosed) {
+            removeStream(stream);
+        }
+    }
+    stream->changed.notifyAll();
+    return true;
+}
+
+bool Http2Connection::handleSettings(quint8 flags, const QByteArray &payload)
+{
+    if (flags & Http2AckFlag) {
+        if (!payload.isEmpty()) {
+            goAway(Http2FrameSizeError);
+            return false;
+        }
+        return true;
+    }
+    if (payload.size() % 6 != 0) {
+        goAway(Http2FrameSizeError);
+        return false;
+    }
+    for (int i = 0; i < payload.size(); i += 6) {
+        const quint16 id = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(payload.constData() + i));
+        const quint32 value = unpackUInt32(payload.constData() + i + 2);
+        switch (id) {
+        case Http2HeaderTableSize:
+            encoder.setMaxTableSize(value);
+            break;
+        case Http2EnablePush:
+            if (value > 1) {
+                goAway(Http2ProtocolError);
+                return false;
+            }
+            break;
+        case Http2MaxConcurrentStreams:
+            remoteMaxConcurrentStreams = value;
+            break;
+        case Http2InitialWindowSize: {
+            if (value > 0x7fffffff) {
+                goAway(Http2FlowControlError);
+                return false;
+            }
+            const qint64 delta = static_cast<qint64>(value) - remoteInitialWindowSize;
+            for (QSharedPointer<Http2Stream> stream : streams) {
+                stream->sendWindow += delta;
+                if (stream->sendWindow > 0x7fffffff) {
+                    goAway(Http2FlowControlError);
+                    return false;
+                }
+            }
+            remoteInitialWindowSize = value;
+            break;
+        }
+        case Http2MaxFrameSize:
+            if (value < 16384 || value > 16777215) {
+                goAway(Http2ProtocolError);
+                return false;
+            }
+            remoteMaxFrameSize = value;
+            break;
+        default:
+            break;
+        }
+    }
+    windowChanged.notifyAll();
+    return sendFrame(Http2SettingsFrame, Http2AckFlag, 0, QByteArray());
+}
+
+bool Http2Connection::handleWindowUpdate(quint32 streamId, const QByteArray &payload)
+{
+    if (payload.size() != 4) {
+        goAway(Http2FrameSizeError);
+        return false;
+    }
+    const quint32 increment = unpackUInt32(payload.constData()) & 0x7fffffff;
+    if (streamId == 0) {
+        if (increment == 0) {
+            goAway(Http2ProtocolError);
+            return false;
+        }
+        sendWindow += increment;
+        if (sendWindow > 0x7fffffff) {
+            goAway(Http2FlowControlError);
+            return false;
+        }
+    } else {
+        QSharedPointer<Http2Stream> stream = streams.value(streamId);
+        if (stream.isNull()) {
+            return true;
+        }
+        if (increment == 0) {
+            resetStream(stream, Http2ProtocolError, true);
+            return true;
+        }
+        stream->sendWindow += increment;
+        if (stream->sendWindow > 0x7fffffff) {
+            resetStream(stream, Http2FlowControlError, true);
+            return true;
+        }
+    }
+    windowChanged.notifyAll();
+    return true;
+}
+
+void Http2Connection::handleGoAway(const QByteArray &payload)
+{
+    const quint32 lastStreamId = unpackUInt32(payload.constData()) & 0x7fffffff;
+    const quint32 errorCode = unpackUInt32(payload.constData() + 4);
+    if (debugLevel > 0) {
+        qtng_debug << "http2 peer goes away:" << lastStreamId << errorCode;
+    }
+    goingAway = true;
+    // the streams after the last one are not processed, the requests can be retried.
+    const QList<QSharedPointer<Http2Stream>> all = streams.values();
+    for (QSharedPointer<Http2Stream> stream : all) {
+        const bool localInitiated = (stream->id & 1) == (asServer ? 0u : 1u);
+        if (localInitiated && stream->id > lastStreamId) {
+            resetStream(stream, Http2RefusedStream, false);
+        }
+    }
+    windowChanged.notifyAll();
+}
+
+void Http2Connection::resetStream(QSharedPointer<Http2Stream> stream, Http2ErrorCode errorCode, bool sendFrame)
+{
+    if (stream->reset) {
+        return;
+    }
+    stream->reset = true;
+    stream->errorCode = errorCode;
+    removeStream(stream);
+    stream->changed.notifyAll();
+    if (sendFrame) {
+        this->sendFrame(Http2RstStreamFrame, 0, stream->id, packUInt32(errorCode));
+    }
+}
+
+void Http2Connection::removeStream(QSharedPointer<Http2Stream> stream)
+{
+    if (streams.remove(stream->id) > 0) {
+        windowChanged.notifyAll();
+    }
+}
+
+bool Http2Connection::sendFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    QByteArray frame;
+    frame.reserve(payload.size() + 9);
+    appendFrameHeader(&frame, static_cast<quint32>(payload.size()), type, flags, streamId);
+    frame.append(payload);
+    return sendFrames(frame);
+}
+
+bool Http2Connection::sendFrames(const QByteArray &frames)
+{
+    ScopedLock<Lock> lock(writeLock);
+    if (!lock.isSuccess() || broken) {
+        return false;
+    }
+    if (connection->sendall(frames) != frames.size()) {
+        setBroken();
+        return false;
+    }
+    return true;
+}
+
+void Http2Connection::setBroken()
+{
+    if (broken) {
+        return;
+    }
+    broken = true;
+    const QList<QSharedPointer<Http2Stream>> all = streams.values();
+    streams.clear();
+    for (QSharedPointer<Http2Stream> stream : all) {
+        if (!stream->reset) {
+            stream->reset = true;
+            stream->errorCode = Http2ConnectError;
+        }
+        stream->changed.notifyAll();
+    }
+    windowChanged.notifyAll();
+    connection->abort();
+    closed.set();
+}
+
+Http2StreamSocket::Http2StreamSocket(QSharedPointer<Http2Connection> http2, QSharedPointer<Http2Stream> stream)
+    : http2(http2)
+    , stream(stream)
+{
+}
+
+Http2StreamSocket::~Http2StreamSocket()
+{
+    http2->closeStream(stream);
+}
+
+Socket::SocketError Http2StreamSocket::error() const
+{
+    if (stream->reset && stream->errorCode != Http2NoError) {
+        return Socket::RemoteHostClosedError;
+    }
+    return http2->connection->error();
+}
+
+QString Http2StreamSocket::errorString() const
+{
+    if (stream->reset && stream->errorCode != Http2NoError) {
+        return QString::fromLatin1("The http2 stream is reset.");
+    }
+    return http2->connection->errorString();
+}
+
+bool Http2StreamSocket::isValid() const
+{
+    return http2->isValid() && !stream->reset;
+}
+
+HostAddress Http2StreamSocket::localAddress() const
+{
+    return http2->connection->localAddress();
+}
+
+quint16 Http2StreamSocket::localPort() const
+{
+    return http2->connection->localPort();
+}
+
+HostAddress Http2StreamSocket::peerAddress() const
+{
+    return http2->connection->peerAddress();
+}
+
+QString Http2StreamSocket::peerName() const
+{
+    return http2->connection->peerName();
+}
+
+quint16 Http2StreamSocket::peerPort() const
+{
+    return http2->connection->peerPort();
+}
+
+qintptr Http2StreamSocket::fileno() const
+{
+    // the descriptor is shared by all streams, nobody can use it directly.
+    return -1;
+}
+
+Socket::SocketType Http2StreamSocket::type() const
+{
+    return http2->connection->type();
+}
+
+Socket::SocketState Http2StreamSocket::state() const
+{
+    return isValid() ? Socket::ConnectedState : Socket::UnconnectedState;
+}
+
+HostAddress::NetworkLayerProtocol Http2StreamSocket::protocol() const
+{
+    return http2->connection->protocol();
+}
+
+QString Http2StreamSocket::localAddressURI() const
+{
+    return http2->connection->localAddressURI();
+}
+
+QString Http2StreamSocket::peerAddressURI() const
+{
+    return http2->connection->peerAddressURI();
+}
+
+QSharedPointer<SocketLike> Http2StreamSocket::accept()
+{
+    return QSharedPointer<SocketLike>();
+}
+
+Socket *Http2StreamSocket::acceptRaw()
+{
+    return nullptr;
+}
+
+bool Http2StreamSocket::bind(const HostAddress &, quint16, Socket::BindMode)
+{
+    return false;
+}
+
+bool Http2StreamSocket::bind(quint16, Socket::BindMode)
+{
+    return false;
+}
+
+bool Http2StreamSocket::connect(const HostAddress &, quint16)
+{
+    return false;
+}
+
+bool Http2StreamSocket::connect(const QString &, quint16, QSharedPointer<SocketDnsCache>)
+{
+    return false;
+}
+
+void Http2StreamSocket::close()
+{
+    http2->closeStream(stream);
+}
+
+void Http2StreamSocket::abort()
+{
+    http2->closeStream(stream);
+}
+
+bool Http2StreamSocket::listen(int)
+{
+    return false;
+}
+
+bool Http2StreamSocket::setOption(Socket::SocketOption, const QVariant &)
+{
+    return false;
+}
+
+QVariant Http2StreamSocket::option(Socket::SocketOption option) const
+{
+    return http2->connection->option(option);
+}
+
+qint32 Http2StreamSocket::recv(char *data, qint32 size)
+{
+    return http2->recvData(stream, data, size);
+}
+
+qint32 Http2StreamSocket::recvall(char *data, qint32 size)
+{
+    qint32 total = 0;
+    while (total < size) {
+        qint32 n = http2->recvData(stream, data + total, size - total);
+        if (n <= 0) {
+            return total == 0 ? n : total;
+        }
+        total += n;
+    }
+    return total;
+}
+
+qint32 Http2StreamSocket::send(const char *data, qint32 size)
+{
+    return http2->sendData(stream, data, size, false) ? size : -1;
+}
+
+qint32 Http2StreamSocket::sendall(const char *data, qint32 size)
+{
+    return http2->sendData(stream, data, size, false) ? size : -1;
+}
+
+QByteArray Http2StreamSocket::recv(qint32 size)
+{
+    QByteArray buf(size, Qt::Uninitialized);
+    qint32 n = recv(buf.data(), size);
+    buf.resize(qMax(0, n));
+    return buf;
+}
+
+QByteArray Http2StreamSocket::recvall(qint32 size)
+{
+    QByteArray buf(size, Qt::Uninitialized);
+    qint32 n = recvall(buf.data(), size);
+    buf.resize(qMax(0, n));
+    return buf;
+}
+
+qint32 Http2StreamSocket::send(const QByteArray &data)
+{
+    return send(data.constData(), data.size());
+}
+
+qint32 Http2StreamSocket::sendall(const QByteArray &data)
+{
+    return sendall(data.constData(), data.size());
+}
+
+bool Http2StreamSocket::finish()
+{
+    return http2->sendData(stream, nullptr, 0, true);
+}
+
+QTNETWORKNG_NAMESPACE_END
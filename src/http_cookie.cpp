@@ -41,6 +41,8 @@
 #include <QtCore/qlocale.h>
 #include <QtCore/qregularexpression.h>
 #include <QtCore/qdebug.h>
+#include <QtCore/qhash.h>
+#include <limits>
 #include "../include/hostaddress.h"
 #include "../include/http_cookie.h"
 
@@ -63,10 +65,30 @@ public:
     bool httpOnly;
 };
 
+struct HttpCookieCacheEntry
+{
+    QList<HttpCookie> cookies;
+    QByteArray header;
+    qint64 validUntil;  // the first expiration of cookies, in milliseconds since epoch.
+};
+
+// the cookies of the domains sharing the last two labels.
+struct HttpCookieBucket
+{
+    QList<HttpCookie> cookies;  // the longer paths are at the front.
+    QHash<QString, HttpCookieCacheEntry> cache;  // cleared if the cookies changed.
+};
+
 class HttpCookieJarPrivate
 {
 public:
-    QList<HttpCookie> allCookies;
+    static QString bucketKey(const QString &domain);
+    QList<HttpCookie> allCookies() const;
+    const HttpCookieCacheEntry &lookup(const QUrl &url);
+    void insert(const HttpCookie &cookie);
+    bool remove(const HttpCookie &cookie);
+public:
+    QHash<QString, HttpCookieBucket> buckets;
 };
 
 HttpCookiePrivate::HttpCookiePrivate()
@@ -257,6 +279,70 @@ static QPair<QByteArray, QByteArray> nextField(const QByteArray &text, int &posi
     return qMakePair(first, second);
 }
 
+static inline bool isTrimmable(char c)
+{
+    // the same as QByteArray::trimmed()
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// the attributes after NAME=VALUE are located without copying, and only the values used are copied later.
+struct CookieAttribute
+{
+    bool is(const char *lowerName) const
+    {
+        int i = 0;
+        for (; i < nameSize && lowerName[i]; ++i) {
+            char c = name[i];
+            if (c >= 'A' && c <= 'Z') {
+                c = static_cast<char>(c - 'A' + 'a');
+            }
+            if (c != lowerName[i]) {
+                return false;
+            }
+        }
+        return i == nameSize && !lowerName[i];
+    }
+    QByteArray value() const { return QByteArray(valueData, valueSize); }
+    const char *name;
+    int nameSize;
+    const char *valueData;
+    int valueSize;
+    int valueStart;
+};
+
+static void nextAttribute(const QByteArray &text, int &position, CookieAttribute *attribute)
+{
+    const int length = text.length();
+    const char *data = text.constData();
+    position = nextNonWhitespace(text, position);
+    int semiColonPosition = text.indexOf(';', position);
+    if (semiColonPosition < 0) {
+        semiColonPosition = length;
+    }
+    int equalsPosition = text.indexOf('=', position);
+    if (equalsPosition < 0 || equalsPosition > semiColonPosition) {
+        equalsPosition = semiColonPosition;  // no '=' means there is an attribute-name but no attribute-value
+    }
+    int nameEnd = equalsPosition;
+    while (nameEnd > position && isTrimmable(data[nameEnd - 1])) {
+        --nameEnd;
+    }
+    attribute->name = data + position;
+    attribute->nameSize = nameEnd - position;
+    int valueStart = qMin(equalsPosition + 1, semiColonPosition);
+    int valueEnd = semiColonPosition;
+    while (valueStart < valueEnd && isTrimmable(data[valueStart])) {
+        ++valueStart;
+    }
+    while (valueEnd > valueStart && isTrimmable(data[valueEnd - 1])) {
+        --valueEnd;
+    }
+    attribute->valueData = data + valueStart;
+    attribute->valueSize = valueEnd - valueStart;
+    attribute->valueStart = valueStart;
+    position = semiColonPosition;
+}
+
 namespace {
 QByteArray sameSiteToRawString(HttpCookie::SameSite samesite)
 {
@@ -434,6 +520,92 @@ static bool checkStaticArray(int &val, const QByteArray &dateString, int at, con
     Or in their own words:
         "} // else what the hell is this."
 */
+// the domains of letters, digits and hyphens need not the round trip of punycode, which is expensive. the labels
+// starting with `xn--` are decoded by QUrl::fromAce(), so they go the slow way.
+static bool isPlainAsciiDomain(const QByteArray &domain)
+{
+    const char *s = domain.constData();
+    const int size = domain.size();
+    int labelStart = 0;
+    for (int i = 0; i <= size; ++i) {
+        if (i == size || s[i] == '.') {
+            const int labelSize = i - labelStart;
+            if (labelSize < 1 || labelSize > 63 || s[labelStart] == '-' || s[i - 1] == '-') {
+                return false;
+            }
+            if (labelSize >= 4 && (s[labelStart] | 0x20) == 'x' && (s[labelStart + 1] | 0x20) == 'n'
+                && s[labelStart + 2] == '-' && s[labelStart + 3] == '-') {
+                return false;
+            }
+            labelStart = i + 1;
+            continue;
+        }
+        const char c = s[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline int twoDigits(const char *s)
+{
+    return isNumber(s[0]) && isNumber(s[1]) ? (s[0] - '0') * 10 + (s[1] - '0') : -1;
+}
+
+// the dates of rfc 1123 and the official cookie format, `Sun, 06 Nov 1994 08:49:37 GMT` or `Sun, 06-Nov-1994 ...`,
+// which almost every server sends, are parsed without allocating. returns false for the others.
+static bool parseStandardDate(const char *s, int size, QDateTime *result)
+{
+    const int comma = qMin(size, 10);
+    int at = 0;
+    while (at < comma && s[at] != ',') {
+        ++at;
+    }
+    if (at == comma) {
+        return false;
+    }
+    ++at;
+    while (at < size && s[at] == ' ') {
+        ++at;
+    }
+    // DD Mon YYYY HH:MM:SS GMT
+    if (size - at != 24) {
+        return false;
+    }
+    s += at;
+    const char sep = s[2];
+    if ((sep != ' ' && sep != '-') || s[6] != sep || s[11] != ' ' || s[14] != ':' || s[17] != ':' || s[20] != ' ') {
+        return false;
+    }
+    if ((s[21] | 0x20) != 'g' || (s[22] | 0x20) != 'm' || (s[23] | 0x20) != 't') {
+        return false;
+    }
+    int month = -1;
+    for (int i = 0, j = 0; i < static_cast<int>(sizeof(months)) - 1; i += 4, ++j) {
+        if ((s[3] | 0x20) == months[i] && (s[4] | 0x20) == months[i + 1] && (s[5] | 0x20) == months[i + 2]) {
+            month = j + 1;
+            break;
+        }
+    }
+    const int day = twoDigits(s);
+    const int century = twoDigits(s + 7);
+    const int yearInCentury = twoDigits(s + 9);
+    const int hour = twoDigits(s + 12);
+    const int minute = twoDigits(s + 15);
+    const int second = twoDigits(s + 18);
+    if (month < 0 || day < 0 || century < 0 || yearInCentury < 0 || hour < 0 || minute < 0 || second < 0) {
+        return false;
+    }
+    const QDate date(century * 100 + yearInCentury, month, day);
+    const QTime time(hour, minute, second);
+    if (!date.isValid() || !time.isValid()) {
+        return false;
+    }
+    *result = QDateTime(date, time, Qt::UTC);
+    return true;
+}
+
 static QDateTime parseDateString(const QByteArray &dateString)
 {
     QTime time;
@@ -445,7 +617,7 @@ static QDateTime parseDateString(const QByteArray &dateString)
     int zoneOffset = -1;
 
     // hour:minute:second.ms pm
-    QRegularExpression timeRx(QLatin1String("(\\d{1,2}):(\\d{1,2})(:(\\d{1,2})|)(\\.(\\d{1,3})|)((\\s{0,}(am|pm))|)"));
+    static const QRegularExpression timeRx(QLatin1String("(\\d{1,2}):(\\d{1,2})(:(\\d{1,2})|)(\\.(\\d{1,3})|)((\\s{0,}(am|pm))|)"));
 
     int at = 0;
     while (at < dateString.length()) {
@@ -733,9 +905,16 @@ QList<HttpCookie> HttpCookie::parseCookies(const QByteArray &cookieString)
     // cookieString can be a number of set-cookie header strings joined together
     // by \n, parse each line separately.
     QList<HttpCookie> cookies;
-    QList<QByteArray> list = cookieString.split('\n');
-    for (int a = 0; a < list.size(); a++) {
-        cookies << HttpCookiePrivate::parseSetCookieHeaderLine(list.at(a));
+    int start = 0;
+    while (start <= cookieString.size()) {
+        int end = cookieString.indexOf('\n', start);
+        if (end < 0) {
+            end = cookieString.size();
+        }
+        // the lines are not copied, cookieString outlives them.
+        const QByteArray line = QByteArray::fromRawData(cookieString.constData() + start, end - start);
+        cookies << HttpCookiePrivate::parseSetCookieHeaderLine(line);
+        start = end + 1;
     }
     return cookies;
 }
@@ -768,28 +947,33 @@ QList<HttpCookie> HttpCookiePrivate::parseSetCookieHeaderLine(const QByteArray &
         cookie.setValue(field.second);
 
         position = nextNonWhitespace(cookieString, position);
+        CookieAttribute attribute;
         while (position < length) {
             switch (cookieString.at(position++)) {
             case ';':
                 // new field in the cookie
-                field = nextField(cookieString, position, false);
-                field.first = field.first.toLower();  // everything but the NAME=VALUE is case-insensitive
-
-                if (field.first == "expires") {
-                    position -= field.second.length();
+                nextAttribute(cookieString, position, &attribute);
+                // everything but the NAME=VALUE is case-insensitive
+                if (attribute.is("expires")) {
+                    position = attribute.valueStart;
                     int end;
                     for (end = position; end < length; ++end)
                         if (isValueSeparator(cookieString.at(end)))
                             break;
+                    int dateEnd = end;
+                    while (dateEnd > position && isTrimmable(cookieString.at(dateEnd - 1)))
+                        --dateEnd;
 
-                    QByteArray dateString = cookieString.mid(position, end - position).trimmed();
+                    QDateTime dt;
+                    if (!parseStandardDate(cookieString.constData() + position, dateEnd - position, &dt)) {
+                        dt = parseDateString(cookieString.mid(position, dateEnd - position).toLower());
+                    }
                     position = end;
-                    QDateTime dt = parseDateString(dateString.toLower());
                     if (dt.isValid())
                         cookie.setExpirationDate(dt);
                     // if unparsed, ignore the attribute but not the whole cookie (RFC6265 section 5.2.1)
-                } else if (field.first == "domain") {
-                    QByteArray rawDomain = field.second;
+                } else if (attribute.is("domain")) {
+                    QByteArray rawDomain = attribute.value();
                     // empty domain should be ignored (RFC6265 section 5.2.3)
                     if (!rawDomain.isEmpty()) {
                         QString maybeLeadingDot;
@@ -799,7 +983,12 @@ QList<HttpCookie> HttpCookiePrivate::parseSetCookieHeaderLine(const QByteArray &
                         }
 
                         // IDN domains are required by RFC6265, accepting utf8 as well doesn't break any test cases.
-                        QString normalizedDomain = QUrl::fromAce(QUrl::toAce(QString::fromUtf8(rawDomain)));
+                        QString normalizedDomain;
+                        if (isPlainAsciiDomain(rawDomain)) {
+                            normalizedDomain = QString::fromLatin1(rawDomain.toLower());
+                        } else {
+                            normalizedDomain = QUrl::fromAce(QUrl::toAce(QString::fromUtf8(rawDomain)));
+                        }
                         if (!normalizedDomain.isEmpty()) {
                             cookie.setDomain(maybeLeadingDot + normalizedDomain);
                         } else {
@@ -809,9 +998,9 @@ QList<HttpCookie> HttpCookiePrivate::parseSetCookieHeaderLine(const QByteArray &
                             return result;
                         }
                     }
-                } else if (field.first == "max-age") {
+                } else if (attribute.is("max-age")) {
                     bool ok = false;
-                    int secs = field.second.toInt(&ok);
+                    int secs = attribute.value().toInt(&ok);
                     if (ok) {
                         if (secs <= 0) {
                             // earliest representable time (RFC6265 section 5.2.2)
@@ -821,22 +1010,22 @@ QList<HttpCookie> HttpCookiePrivate::parseSetCookieHeaderLine(const QByteArray &
                         }
                     }
                     // if unparsed, ignore the attribute but not the whole cookie (RFC6265 section 5.2.2)
-                } else if (field.first == "path") {
-                    if (field.second.startsWith('/')) {
+                } else if (attribute.is("path")) {
+                    if (attribute.valueSize > 0 && attribute.valueData[0] == '/') {
                         // ### we should treat cookie paths as an octet sequence internally
                         // However RFC6265 says we should assume UTF-8 for presentation as a string
-                        cookie.setPath(QString::fromUtf8(field.second));
+                        cookie.setPath(QString::fromUtf8(attribute.valueData, attribute.valueSize));
                     } else {
                         // if the path doesn't start with '/' then set the default path (RFC6265 section 5.2.4)
                         // and also IETF test case path0030 which has valid and empty path in the same cookie
                         cookie.setPath(QString());
                     }
-                } else if (field.first == "secure") {
+                } else if (attribute.is("secure")) {
                     cookie.setSecure(true);
-                } else if (field.first == "httponly") {
+                } else if (attribute.is("httponly")) {
                     cookie.setHttpOnly(true);
-                } else if (field.first == "samesite") {
-                    cookie.setSameSitePolicy(sameSiteFromRawString(field.second));
+                } else if (attribute.is("samesite")) {
+                    cookie.setSameSitePolicy(sameSiteFromRawString(attribute.value()));
                 } else {
                     // ignore unknown fields in the cookie (RFC6265 section 5.2, rule 6)
                 }
@@ -878,27 +1067,6 @@ void HttpCookie::normalize(const QUrl &url)
     }
 }
 
-HttpCookieJar::HttpCookieJar()
-    : d_ptr(new HttpCookieJarPrivate())
-{
-}
-
-HttpCookieJar::~HttpCookieJar()
-{
-    delete d_ptr;
-}
-
-QList<HttpCookie> HttpCookieJar::allCookies() const
-{
-    return d_func()->allCookies;
-}
-
-void HttpCookieJar::setAllCookies(const QList<HttpCookie> &cookieList)
-{
-    Q_D(HttpCookieJar);
-    d->allCookies = cookieList;
-}
-
 static inline bool isParentPath(const QString &path, const QString &reference)
 {
     if ((path.isEmpty() && reference == QLatin1String("/")) || path.startsWith(reference)) {
@@ -926,71 +1094,171 @@ static inline bool isParentDomain(const QString &domain, const QString &referenc
     return domain.endsWith(reference) || domain == reference.mid(1);
 }
 
-bool HttpCookieJar::setCookiesFromUrl(const QList<HttpCookie> &cookieList, const QUrl &url)
+// a host and the domains of its cookies always share the last two labels, so it is a good key without the public
+// suffix list.
+QString HttpCookieJarPrivate::bucketKey(const QString &domain)
 {
-    bool added = false;
-    for (HttpCookie cookie : cookieList) {
-        cookie.normalize(url);
-        if (validateCookie(cookie, url) && insertCookie(cookie))
-            added = true;
+    int dot = domain.lastIndexOf(QLatin1Char('.'));
+    if (dot > 0) {
+        dot = domain.lastIndexOf(QLatin1Char('.'), dot - 1);
     }
-    return added;
+    QString key = dot < 0 ? domain : domain.mid(dot + 1);
+    if (key.startsWith(QLatin1Char('.'))) {
+        key = key.mid(1);
+    }
+    return key.toLower();
 }
 
-static bool qIsEffectiveTLD(const QString &domain)
+QList<HttpCookie> HttpCookieJarPrivate::allCookies() const
 {
-    // provide minimal checking by not accepting cookies on real TLDs
-    return !domain.contains(QLatin1Char('.'));
+    QList<HttpCookie> result;
+    for (const HttpCookieBucket &bucket : buckets) {
+        result.append(bucket.cookies);
+    }
+    return result;
 }
 
-QList<HttpCookie> HttpCookieJar::cookiesForUrl(const QUrl &url) const
+const HttpCookieCacheEntry &HttpCookieJarPrivate::lookup(const QUrl &url)
 {
-    //     \b Warning! This is only a dumb implementation!
-    //     It does NOT follow all of the recommendations from
-    //     http://wp.netscape.com/newsref/std/cookie_spec.html
-    //     It does not implement a very good cross-domain verification yet.
-
-    Q_D(const HttpCookieJar);
+    static const HttpCookieCacheEntry empty = { QList<HttpCookie>(), QByteArray(), 0 };
+    const QString &host = url.host();
+    QHash<QString, HttpCookieBucket>::iterator itor = buckets.find(bucketKey(host));
+    if (itor == buckets.end()) {
+        return empty;
+    }
+    HttpCookieBucket &bucket = itor.value();
+    const bool isEncrypted = url.scheme() == QLatin1String("https");
+    const QString &path = url.path();
+    const QString &cacheKey =
+            (isEncrypted ? QLatin1String("s ") : QLatin1String("p ")) + host + QLatin1Char(' ') + path;
     const QDateTime now = QDateTime::currentDateTimeUtc();
-    QList<HttpCookie> result;
-    bool isEncrypted = url.scheme() == QLatin1String("https");
+    const qint64 nowMSecs = now.toMSecsSinceEpoch();
+    QHash<QString, HttpCookieCacheEntry>::const_iterator cached = bucket.cache.constFind(cacheKey);
+    if (cached != bucket.cache.constEnd() && cached.value().validUntil > nowMSecs) {
+        return cached.value();
+    }
 
-    // scan our cookies for something that matches
-    QList<HttpCookie>::ConstIterator it = d->allCookies.constBegin(), end = d->allCookies.constEnd();
-    for (; it != end; ++it) {
-        if (!isParentDomain(url.host(), it->domain()))
+    HttpCookieCacheEntry entry;
+    entry.validUntil = std::numeric_limits<qint64>::max();
+    for (const HttpCookie &cookie : bucket.cookies) {
+        if (!isParentDomain(host, cookie.domain()))
             continue;
-        if (!isParentPath(url.path(), it->path()))
+        if (!isParentPath(path, cookie.path()))
             continue;
-        if (!(*it).isSessionCookie() && (*it).expirationDate() < now)
+        if (!cookie.isSessionCookie() && cookie.expirationDate() < now)
             continue;
-        if ((*it).isSecure() && !isEncrypted)
+        if (cookie.isSecure() && !isEncrypted)
             continue;
 
-        QString domain = it->domain();
+        QString domain = cookie.domain();
         if (domain.startsWith(QLatin1Char('.')))  /// Qt6?: remove when compliant with RFC6265
             domain = domain.mid(1);
-        if (!domain.contains(QLatin1Char('.')) && url.host() != domain)
+        if (!domain.contains(QLatin1Char('.')) && host != domain)
             continue;
 
-        // insert this cookie into result, sorted by path
-        QList<HttpCookie>::Iterator insertIt = result.begin();
-        while (insertIt != result.end()) {
-            if (insertIt->path().length() < it->path().length()) {
-                // insert here
-                insertIt = result.insert(insertIt, *it);
-                break;
+        // the bucket is sorted by path already.
+        if (!entry.cookies.isEmpty()) {
+            entry.header += "; ";
+        }
+        entry.header += cookie.toRawForm(HttpCookie::NameAndValueOnly);
+        entry.cookies.append(cookie);
+        if (!cookie.isSessionCookie()) {
+            entry.validUntil = qMin(entry.validUntil, cookie.expirationDate().toMSecsSinceEpoch());
+        }
+    }
+    if (bucket.cache.size() >= 256) {
+        bucket.cache.clear();
+    }
+    return bucket.cache.insert(cacheKey, entry).value();
+}
+
+void HttpCookieJarPrivate::insert(const HttpCookie &cookie)
+{
+    HttpCookieBucket &bucket = buckets[bucketKey(cookie.domain())];
+    QList<HttpCookie>::iterator itor = bucket.cookies.begin();
+    while (itor != bucket.cookies.end() && itor->path().length() >= cookie.path().length()) {
+        ++itor;
+    }
+    bucket.cookies.insert(itor, cookie);
+    bucket.cache.clear();
+}
+
+bool HttpCookieJarPrivate::remove(const HttpCookie &cookie)
+{
+    QHash<QString, HttpCookieBucket>::iterator bucket = buckets.find(bucketKey(cookie.domain()));
+    if (bucket == buckets.end()) {
+        return false;
+    }
+    QList<HttpCookie> &cookies = bucket.value().cookies;
+    for (QList<HttpCookie>::iterator itor = cookies.begin(); itor != cookies.end(); ++itor) {
+        if (itor->hasSameIdentifier(cookie)) {
+            cookies.erase(itor);
+            if (cookies.isEmpty()) {
+                buckets.erase(bucket);
             } else {
-                ++insertIt;
+                bucket.value().cache.clear();
             }
+            return true;
         }
+    }
+    return false;
+}
+
+HttpCookieJar::HttpCookieJar()
+    : d_ptr(new HttpCookieJarPrivate())
+{
+}
 
-        // this is the shortest path yet, just append
-        if (insertIt == result.end())
-            result += *it;
+HttpCookieJar::~HttpCookieJar()
+{
+    delete d_ptr;
+}
+
+QList<HttpCookie> HttpCookieJar::allCookies() const
+{
+    return d_func()->allCookies();
+}
+
+void HttpCookieJar::setAllCookies(const QList<HttpCookie> &cookieList)
+{
+    Q_D(HttpCookieJar);
+    d->buckets.clear();
+    for (const HttpCookie &cookie : cookieList) {
+        d->insert(cookie);
     }
+}
 
-    return result;
+bool HttpCookieJar::setCookiesFromUrl(const QList<HttpCookie> &cookieList, const QUrl &url)
+{
+    bool added = false;
+    for (HttpCookie cookie : cookieList) {
+        cookie.normalize(url);
+        if (validateCookie(cookie, url) && insertCookie(cookie))
+            added = true;
+    }
+    return added;
+}
+
+static bool qIsEffectiveTLD(const QString &domain)
+{
+    // provide minimal checking by not accepting cookies on real TLDs
+    return !domain.contains(QLatin1Char('.'));
+}
+
+QList<HttpCookie> HttpCookieJar::cookiesForUrl(const QUrl &url) const
+{
+    //     \b Warning! This is only a dumb implementation!
+    //     It does NOT follow all of the recommendations from
+    //     http://wp.netscape.com/newsref/std/cookie_spec.html
+    //     It does not implement a very good cross-domain verification yet.
+
+    // the cookies are sorted by path, and cached until they are changed.
+    return const_cast<HttpCookieJarPrivate *>(d_func())->lookup(url).cookies;
+}
+
+QByteArray HttpCookieJar::cookieHeaderForUrl(const QUrl &url) const
+{
+    return const_cast<HttpCookieJarPrivate *>(d_func())->lookup(url).header;
 }
 
 bool HttpCookieJar::insertCookie(const HttpCookie &cookie)
@@ -1002,7 +1270,7 @@ bool HttpCookieJar::insertCookie(const HttpCookie &cookie)
     deleteCookie(cookie);
 
     if (!isDeletion) {
-        d->allCookies += cookie;
+        d->insert(cookie);
         return true;
     }
     return false;
@@ -1018,14 +1286,7 @@ bool HttpCookieJar::updateCookie(const HttpCookie &cookie)
 bool HttpCookieJar::deleteCookie(const HttpCookie &cookie)
 {
     Q_D(HttpCookieJar);
-    QList<HttpCookie>::Iterator it;
-    for (it = d->allCookies.begin(); it != d->allCookies.end(); ++it) {
-        if (it->hasSameIdentifier(cookie)) {
-            d->allCookies.erase(it);
-            return true;
-        }
-    }
-    return false;
+    return d->remove(cookie);
 }
 
 bool HttpCookieJar::validateCookie(const HttpCookie &cookie, const QUrl &url) const
@@ -1035,6 +1296,11 @@ bool HttpCookieJar::validateCookie(const HttpCookie &cookie, const QUrl &url) co
     if (!isParentDomain(domain, host) && !isParentDomain(host, domain))
         return false;  // not accepted
 
+    // rfc 6265 section 5.1.3, an ip address is matched by itself only, not as the suffix of others.
+    HostAddress hostAddress;
+    if (HostAddress::parseLiteral(host, &hostAddress))
+        return domain == host;
+
     if (domain.startsWith(QLatin1Char('.')))
         domain = domain.mid(1);
 
@@ -0,0 +1,409 @@
+#include <string.h>
+#if defined(__SSE4_2__)
+#  include <nmmintrin.h>
+#  define QTNG_HTTP_PARSER_SSE42 1
+#endif
+#include "../include/private/http_parser_p.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+#ifdef QTNG_HTTP_PARSER_SSE42
+static bool simdEnabled = true;
+#endif
+
+bool setHttpParserSimdEnabled(bool enabled)
+{
+#ifdef QTNG_HTTP_PARSER_SSE42
+    simdEnabled = enabled;
+    return true;
+#else
+    Q_UNUSED(enabled);
+    return false;
+#endif
+}
+
+// the fast path of picohttpparser: skip 16 bytes at once until one of them falls into the ranges, which are pairs of
+// inclusive bounds. the caller validates the rest byte by byte, so this is only a hint.
+static inline const char *skipToRanges(const char *p, const char *end, const char *ranges16, int rangesSize)
+{
+#ifdef QTNG_HTTP_PARSER_SSE42
+    if (simdEnabled && end - p >= 16) {
+        const __m128i ranges = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ranges16));
+        do {
+            const __m128i b16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            int r = _mm_cmpestri(ranges, rangesSize, b16, 16,
+                                 _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+            if (r != 16) {
+                return p + r;
+            }
+            p += 16;
+        } while (end - p >= 16);
+    }
+#else
+    Q_UNUSED(end);
+    Q_UNUSED(ranges16);
+    Q_UNUSED(rangesSize);
+#endif
+    return p;
+}
+
+// control characters but tab, and DEL.
+static const char valueRanges[16] = "\000\010\012\037\177\177";
+// everything but tchar of rfc 7230.
+static const char tokenRanges[16] = { '\x00', ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{',
+                                      '\xff' };
+
+static inline bool isTokenChar(unsigned char c)
+{
+    if (c <= 0x20 || c >= 0x7f) {
+        return false;
+    }
+    return !strchr("\"(),/:;<=>?@[\\]{}", c);
+}
+
+static inline bool isVisibleChar(unsigned char c)
+{
+    return c > 0x20 && c != 0x7f;
+}
+
+// accept both CRLF and LF.
+static inline int skipLineEnd(const char *&p, const char *end)
+{
+    if (p == end) {
+        return HttpParseIncomplete;
+    }
+    if (*p == '\r') {
+        ++p;
+        if (p == end) {
+            return HttpParseIncomplete;
+        }
+        if (*p != '\n') {
+            return HttpParseError;
+        }
+        ++p;
+        return 0;
+    } else if (*p == '\n') {
+        ++p;
+        return 0;
+    }
+    return HttpParseError;
+}
+
+static inline int parseVersion(const char *&p, const char *end, int *minorVersion)
+{
+    static const char prefix[] = "HTTP/1.";
+    const int prefixSize = sizeof(prefix) - 1;
+    const int available = static_cast<int>(end - p);
+    if (memcmp(p, prefix, static_cast<size_t>(qMin(available, prefixSize))) != 0) {
+        return HttpParseError;
+    }
+    if (available < prefixSize + 1) {
+        return HttpParseIncomplete;
+    }
+    const char c = p[prefixSize];
+    if (c < '0' || c > '9') {
+        return HttpParseError;
+    }
+    *minorVersion = c - '0';
+    p += prefixSize + 1;
+    return 0;
+}
+
+static int parseHeaders(const char *buf, const char *&p, const char *end, HttpHeaderSlice *headers, int *numHeaders)
+{
+    const int maxHeaders = *numHeaders;
+    int n = 0;
+    while (true) {
+        if (p == end) {
+            return HttpParseIncomplete;
+        }
+        if (*p == '\r' || *p == '\n') {
+            int r = skipLineEnd(p, end);
+            if (r < 0) {
+                return r;
+            }
+            *numHeaders = n;
+            return static_cast<int>(p - buf);
+        }
+        if (n == maxHeaders) {
+            return HttpParseTooManyHeaders;
+        }
+        HttpHeaderSlice &header = headers[n];
+
+        const char *nameStart = p;
+        p = skipToRanges(p, end, tokenRanges, sizeof(tokenRanges));
+        while (true) {
+            if (p == end) {
+                return HttpParseIncomplete;
+            }
+            if (*p == ':') {
+                break;
+            }
+            if (!isTokenChar(static_cast<unsigned char>(*p))) {
+                return HttpParseError;  // including the obsolete line folding.
+            }
+            ++p;
+        }
+        if (p == nameStart) {
+            return HttpParseError;
+        }
+        header.name.offset = static_cast<qint32>(nameStart - buf);
+        header.name.length = static_cast<qint32>(p - nameStart);
+        header.knownHeader = findKnownHeader(nameStart, header.name.length);
+        ++p;
+
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+        const char *valueStart = p;
+        p = skipToRanges(p, end, valueRanges, 6);
+        while (true) {
+            if (p == end) {
+                return HttpParseIncomplete;
+            }
+            const unsigned char c = static_cast<unsigned char>(*p);
+            if (c == '\r' || c == '\n') {
+                break;
+            }
+            if ((c < 0x20 && c != '\t') || c == 0x7f) {
+                return HttpParseError;
+            }
+            ++p;
+        }
+        const char *valueEnd = p;
+        while (valueEnd > valueStart && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+            --valueEnd;
+        }
+        header.value.offset = static_cast<qint32>(valueStart - buf);
+        header.value.length = static_cast<qint32>(valueEnd - valueStart);
+        int r = skipLineEnd(p, end);
+        if (r < 0) {
+            return r;
+        }
+        ++n;
+    }
+}
+
+int parseHttpRequestHead(const char *buf, int len, HttpSlice *method, HttpSlice *path, int *minorVersion,
+                         HttpHeaderSlice *headers, int *numHeaders)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    // rfc 7230 3.5, ignore at least one empty line before the request line.
+    while (p < end && (*p == '\r' || *p == '\n')) {
+        ++p;
+    }
+
+    const char *start = p;
+    p = skipToRanges(p, end, tokenRanges, sizeof(tokenRanges));
+    while (true) {
+        if (p == end) {
+            return HttpParseIncomplete;
+        }
+        if (*p == ' ') {
+            break;
+        }
+        if (!isTokenChar(static_cast<unsigned char>(*p))) {
+            return HttpParseError;
+        }
+        ++p;
+    }
+    if (p == start) {
+        return HttpParseError;
+    }
+    method->offset = static_cast<qint32>(start - buf);
+    method->length = static_cast<qint32>(p - start);
+    ++p;
+
+    start = p;
+    while (true) {
+        if (p == end) {
+            return HttpParseIncomplete;
+        }
+        if (!isVisibleChar(static_cast<unsigned char>(*p))) {
+            break;
+        }
+        ++p;
+    }
+    if (p == start) {
+        return HttpParseError;
+    }
+    path->offset = static_cast<qint32>(start - buf);
+    path->length = static_cast<qint32>(p - start);
+
+    if (*p == ' ') {
+        ++p;
+        int r = parseVersion(p, end, minorVersion);
+        if (r < 0) {
+            return r;
+        }
+    } else {
+        *minorVersion = -1;  // HTTP/0.9 and some old clients send no version.
+    }
+    int r = skipLineEnd(p, end);
+    if (r < 0) {
+        return r;
+    }
+    return parseHeaders(buf, p, end, headers, numHeaders);
+}
+
+int parseHttpResponseHead(const char *buf, int len, int *minorVersion, int *statusCode, HttpSlice *message,
+                          HttpHeaderSlice *headers, int *numHeaders)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    int r = parseVersion(p, end, minorVersion);
+    if (r < 0) {
+        return r;
+    }
+    if (end - p < 4) {
+        return HttpParseIncomplete;
+    }
+    if (*p != ' ') {
+        return HttpParseError;
+    }
+    ++p;
+    int code = 0;
+    for (int i = 0; i < 3; ++i, ++p) {
+        if (*p < '0' || *p > '9') {
+            return HttpParseError;
+        }
+        code = code * 10 + (*p - '0');
+    }
+    *statusCode = code;
+
+    while (p < end && *p == ' ') {
+        ++p;
+    }
+    const char *start = p;
+    p = skipToRanges(p, end, valueRanges, 6);
+    while (true) {
+        if (p == end) {
+            return HttpParseIncomplete;
+        }
+        const unsigned char c = static_cast<unsigned char>(*p);
+        if (c == '\r' || c == '\n') {
+            break;
+        }
+        if ((c < 0x20 && c != '\t') || c == 0x7f) {
+            return HttpParseError;
+        }
+        ++p;
+    }
+    message->offset = static_cast<qint32>(start - buf);
+    message->length = static_cast<qint32>(p - start);
+    r = skipLineEnd(p, end);
+    if (r < 0) {
+        return r;
+    }
+    return parseHeaders(buf, p, end, headers, numHeaders);
+}
+
+struct KnownHeaderName
+{
+    const char *name;
+    int length;
+    KnownHeader header;
+};
+
+#define QTNG_KNOWN_HEADER(name, header) { name, sizeof(name) - 1, header }
+static const KnownHeaderName knownHeaderNames[] = {
+    QTNG_KNOWN_HEADER("Content-Type", ContentTypeHeader),
+    QTNG_KNOWN_HEADER("Content-Length", ContentLengthHeader),
+    QTNG_KNOWN_HEADER("Content-Encoding", ContentEncodingHeader),
+    QTNG_KNOWN_HEADER("Transfer-Encoding", TransferEncodingHeader),
+    QTNG_KNOWN_HEADER("Location", LocationHeader),
+    QTNG_KNOWN_HEADER("Last-Modified", LastModifiedHeader),
+    QTNG_KNOWN_HEADER("Cookie", CookieHeader),
+    QTNG_KNOWN_HEADER("Set-Cookie", SetCookieHeader),
+    QTNG_KNOWN_HEADER("Content-Disposition", ContentDispositionHeader),
+    QTNG_KNOWN_HEADER("Server", ServerHeader),
+    QTNG_KNOWN_HEADER("User-Agent", UserAgentHeader),
+    QTNG_KNOWN_HEADER("Accept", AcceptHeader),
+    QTNG_KNOWN_HEADER("Accept-Language", AcceptLanguageHeader),
+    QTNG_KNOWN_HEADER("Accept-Encoding", AcceptEncodingHeader),
+    QTNG_KNOWN_HEADER("Pragma", PragmaHeader),
+    QTNG_KNOWN_HEADER("Cache-Control", CacheControlHeader),
+    QTNG_KNOWN_HEADER("Date", DateHeader),
+    QTNG_KNOWN_HEADER("Allow", AllowHeader),
+    QTNG_KNOWN_HEADER("Vary", VaryHeader),
+    QTNG_KNOWN_HEADER("X-Frame-Options", FrameOptionsHeader),
+    QTNG_KNOWN_HEADER("MIME-Version", MIMEVersionHeader),
+    QTNG_KNOWN_HEADER("Connection", ConnectionHeader),
+    QTNG_KNOWN_HEADER("Upgrade", UpgradeHeader),
+    QTNG_KNOWN_HEADER("Host", HostHeader),
+};
+#undef QTNG_KNOWN_HEADER
+
+int findKnownHeader(const char *name, int len)
+{
+    for (const KnownHeaderName &known : knownHeaderNames) {
+        if (known.length == len && qstrnicmp(known.name, name, static_cast<uint>(len)) == 0) {
+            return known.header;
+        }
+    }
+    return -1;
+}
+
+int findKnownHeader(const QString &name)
+{
+    const int len = name.size();
+    const QChar *s = name.constData();
+    for (const KnownHeaderName &known : knownHeaderNames) {
+        if (known.length != len) {
+            continue;
+        }
+        int i = 0;
+        for (; i < len; ++i) {
+            ushort c = s[i].unicode();
+            if (c >= 'A' && c <= 'Z') {
+                c += 'a' - 'A';
+            }
+            char k = known.name[i];
+            if (k >= 'A' && k <= 'Z') {
+                k += 'a' - 'A';
+            }
+            if (c != static_cast<ushort>(k)) {
+                break;
+            }
+        }
+        if (i == len) {
+            return known.header;
+        }
+    }
+    return -1;
+}
+
+// the names of known headers are shared by all parsed headers instead of allocated for each of them.
+const QString &internedHeaderName(int knownHeader)
+{
+    static const QString names[] = {
+        toString(ContentTypeHeader),      toString(ContentLengthHeader),      toString(ContentEncodingHeader),
+        toString(TransferEncodingHeader), toString(LocationHeader),           toString(LastModifiedHeader),
+        toString(CookieHeader),           toString(SetCookieHeader),          toString(ContentDispositionHeader),
+        toString(ServerHeader),           toString(UserAgentHeader),          toString(AcceptHeader),
+        toString(AcceptLanguageHeader),   toString(AcceptEncodingHeader),     toString(PragmaHeader),
+        toString(CacheControlHeader),     toString(DateHeader),               toString(AllowHeader),
+        toString(VaryHeader),             toString(FrameOptionsHeader),       toString(MIMEVersionHeader),
+        toString(ConnectionHeader),       toString(UpgradeHeader),            toString(HostHeader),
+    };
+    return names[knownHeader];
+}
+
+QList<HttpHeader> toHttpHeaders(const char *buf, const HttpHeaderSlice *headers, int numHeaders)
+{
+    QList<HttpHeader> result;
+    result.reserve(numHeaders);
+    for (int i = 0; i < numHeaders; ++i) {
+        const HttpHeaderSlice &header = headers[i];
+        const QByteArray value(buf + header.value.offset, header.value.length);
+        if (header.knownHeader >= 0) {
+            result.append(HttpHeader(internedHeaderName(header.knownHeader), value));
+        } else {
+            result.append(HttpHeader(QString::fromLatin1(buf + header.name.offset, header.name.length), value));
+        }
+    }
+    return result;
+}
+
+QTNETWORKNG_NAMESPACE_END
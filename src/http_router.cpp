@@ -0,0 +1,290 @@
+#include <string.h>
+#include <QtCore/qurl.h>
+#include "../include/http_router.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+QString HttpRouteParams::value(const QString &name, const QString &defaultValue) const
+{
+    for (const QPair<QString, QString> &param : params) {
+        if (param.first == name) {
+            return param.second;
+        }
+    }
+    return defaultValue;
+}
+
+bool HttpRouteParams::contains(const QString &name) const
+{
+    for (const QPair<QString, QString> &param : params) {
+        if (param.first == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+
+struct RouteNode
+{
+    RouteNode()
+        : param(nullptr)
+        , catchAll(nullptr)
+    {
+    }
+    ~RouteNode()
+    {
+        qDeleteAll(children);
+        delete param;
+        delete catchAll;
+    }
+    QString prefix;  // empty for the parameter nodes.
+    QString name;  // of parameter.
+    QVector<RouteNode *> children;  // the first chars of their prefixes are different.
+    RouteNode *param;
+    RouteNode *catchAll;
+    QVector<QPair<QString, int>> methods;
+};
+
+struct RouteToken
+{
+    enum Type { Static, Param, CatchAll } type;
+    QString text;
+};
+
+}  // anonymous namespace
+
+class HttpRouteTreePrivate
+{
+public:
+    RouteNode *insertStatic(RouteNode *node, QString text);
+    int matchNode(const RouteNode *node, const QChar *p, const QChar *end, const QString &method,
+                  HttpRouteParams *params, QStringList *allowedMethods) const;
+    static int findMethod(const RouteNode *node, const QString &method, QStringList *allowedMethods);
+    static bool tokenize(const QString &pattern, QVector<RouteToken> *tokens);
+public:
+    RouteNode root;
+};
+
+bool HttpRouteTreePrivate::tokenize(const QString &pattern, QVector<RouteToken> *tokens)
+{
+    if (!pattern.startsWith(QLatin1Char('/'))) {
+        return false;
+    }
+    int i = 0;
+    while (i < pattern.size()) {
+        const QChar c = pattern.at(i);
+        if (c == QLatin1Char(':') || c == QLatin1Char('*')) {
+            // the parameters occupy whole segments.
+            if (pattern.at(i - 1) != QLatin1Char('/')) {
+                return false;
+            }
+            int j = pattern.indexOf(QLatin1Char('/'), i);
+            if (j < 0) {
+                j = pattern.size();
+            }
+            RouteToken token;
+            token.type = (c == QLatin1Char(':')) ? RouteToken::Param : RouteToken::CatchAll;
+            token.text = pattern.mid(i + 1, j - i - 1);
+            if (token.text.isEmpty() || (token.type == RouteToken::CatchAll && j != pattern.size())) {
+                return false;
+            }
+            tokens->append(token);
+            i = j;
+        } else {
+            int j = i;
+            while (j < pattern.size() && pattern.at(j) != QLatin1Char(':') && pattern.at(j) != QLatin1Char('*')) {
+                ++j;
+            }
+            RouteToken token;
+            token.type = RouteToken::Static;
+            token.text = pattern.mid(i, j - i);
+            tokens->append(token);
+            i = j;
+        }
+    }
+    return true;
+}
+
+RouteNode *HttpRouteTreePrivate::insertStatic(RouteNode *node, QString text)
+{
+    while (!text.isEmpty()) {
+        int index = -1;
+        for (int i = 0; i < node->children.size(); ++i) {
+            if (node->children.at(i)->prefix.at(0) == text.at(0)) {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0) {
+            RouteNode *child = new RouteNode();
+            child->prefix = text;
+            node->children.append(child);
+            return child;
+        }
+        RouteNode *child = node->children.at(index);
+        int l = 0;
+        while (l < text.size() && l < child->prefix.size() && text.at(l) == child->prefix.at(l)) {
+            ++l;
+        }
+        if (l < child->prefix.size()) {
+            // split the child at the common prefix.
+            RouteNode *middle = new RouteNode();
+            middle->prefix = child->prefix.left(l);
+            child->prefix = child->prefix.mid(l);
+            middle->children.append(child);
+            node->children[index] = middle;
+            child = middle;
+        }
+        text = text.mid(l);
+        node = child;
+    }
+    return node;
+}
+
+int HttpRouteTreePrivate::findMethod(const RouteNode *node, const QString &method, QStringList *allowedMethods)
+{
+    if (node->methods.isEmpty()) {
+        return -1;
+    }
+    int get = -1;
+    for (const QPair<QString, int> &m : node->methods) {
+        if (m.first == method) {
+            return m.second;
+        } else if (m.first == QLatin1String("GET")) {
+            get = m.second;
+        }
+    }
+    if (get >= 0 && method == QLatin1String("HEAD")) {
+        return get;
+    }
+    if (allowedMethods) {
+        for (const QPair<QString, int> &m : node->methods) {
+            if (!allowedMethods->contains(m.first)) {
+                allowedMethods->append(m.first);
+            }
+        }
+    }
+    return -1;
+}
+
+// the prefix of node is consumed already.
+int HttpRouteTreePrivate::matchNode(const RouteNode *node, const QChar *p, const QChar *end, const QString &method,
+                                    HttpRouteParams *params, QStringList *allowedMethods) const
+{
+    if (p == end) {
+        int id = findMethod(node, method, allowedMethods);
+        if (id >= 0) {
+            return id;
+        }
+    } else {
+        for (const RouteNode *child : node->children) {
+            if (child->prefix.at(0) != *p) {
+                continue;
+            }
+            const int l = child->prefix.size();
+            if (end - p >= l && memcmp(p, child->prefix.constData(), sizeof(QChar) * static_cast<size_t>(l)) == 0) {
+                int id = matchNode(child, p + l, end, method, params, allowedMethods);
+                if (id >= 0) {
+                    return id;
+                }
+            }
+            break;
+        }
+        if (node->param) {
+            const QChar *q = p;
+            while (q < end && *q != QLatin1Char('/')) {
+                ++q;
+            }
+            if (q > p) {
+                params->params.append(qMakePair(node->param->name, QString(p, static_cast<int>(q - p))));
+                int id = matchNode(node->param, q, end, method, params, allowedMethods);
+                if (id >= 0) {
+                    return id;
+                }
+                params->params.removeLast();
+            }
+        }
+    }
+    if (node->catchAll) {
+        int id = findMethod(node->catchAll, method, allowedMethods);
+        if (id >= 0) {
+            params->params.append(qMakePair(node->catchAll->name, QString(p, static_cast<int>(end - p))));
+            return id;
+        }
+    }
+    return -1;
+}
+
+HttpRouteTree::HttpRouteTree()
+    : d_ptr(new HttpRouteTreePrivate())
+{
+}
+
+HttpRouteTree::~HttpRouteTree()
+{
+    delete d_ptr;
+}
+
+bool HttpRouteTree::insert(const QString &method, const QString &pattern, int id)
+{
+    Q_D(HttpRouteTree);
+    QVector<RouteToken> tokens;
+    if (method.isEmpty() || id < 0 || !d->tokenize(pattern, &tokens)) {
+        return false;
+    }
+    RouteNode *node = &d->root;
+    for (const RouteToken &token : tokens) {
+        if (token.type == RouteToken::Static) {
+            node = d->insertStatic(node, token.text);
+        } else {
+            RouteNode *&child = (token.type == RouteToken::Param) ? node->param : node->catchAll;
+            if (!child) {
+                child = new RouteNode();
+                child->name = token.text;
+            } else if (child->name != token.text) {
+                // "/users/:id" and "/users/:name" can not be told apart.
+                return false;
+            }
+            node = child;
+        }
+    }
+    for (const QPair<QString, int> &m : node->methods) {
+        if (m.first == method) {
+            return false;
+        }
+    }
+    node->methods.append(qMakePair(method, id));
+    return true;
+}
+
+int HttpRouteTree::match(const QString &method, const QString &path, HttpRouteParams *params,
+                         QStringList *allowedMethods) const
+{
+    Q_D(const HttpRouteTree);
+    int size = path.indexOf(QLatin1Char('?'));
+    if (size < 0) {
+        size = path.size();
+    }
+    HttpRouteParams t;
+    if (!params) {
+        params = &t;
+    }
+    int id = d->matchNode(&d->root, path.constData(), path.constData() + size, method, params, allowedMethods);
+    if (id < 0) {
+        params->params.clear();
+        return -1;
+    }
+    if (allowedMethods) {
+        allowedMethods->clear();
+    }
+    for (QPair<QString, QString> &param : params->params) {
+        if (param.second.contains(QLatin1Char('%'))) {
+            param.second = QUrl::fromPercentEncoding(param.second.toUtf8());
+        }
+    }
+    return id;
+}
+
+QTNETWORKNG_NAMESPACE_END
@@ -1,5 +1,6 @@
 #include <QtCore/qlocale.h>
 #include "../include/http_utils.h"
+#include "../include/private/http_parser_p.h"
 #include "debugger.h"
 
 QTNG_LOGGER("qtng.http")
@@ -18,6 +19,307 @@ QDataStream &operator<<(QDataStream &ds, const HttpHeader &header)
     return ds;
 }
 
+static inline uint headerNameHash(const QString &name)
+{
+    uint h = 2166136261u;
+    const QChar *s = name.constData();
+    for (int i = 0; i < name.size(); ++i) {
+        ushort c = s[i].unicode();
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+HttpHeaderStorage::HttpHeaderStorage()
+    : unknownCount(0)
+    , removedCount(0)
+{
+    for (int &slot : knownSlots) {
+        slot = -1;
+    }
+}
+
+HttpHeaderStorage::HttpHeaderStorage(const QList<HttpHeader> &headers)
+    : HttpHeaderStorage()
+{
+    entries.reserve(headers.size());
+    for (const HttpHeader &header : headers) {
+        append(header);
+    }
+}
+
+void HttpHeaderStorage::append(const HttpHeader &header, bool normalize)
+{
+    const int knownHeader = findKnownHeader(header.name);
+    const int index = entries.size();
+    entries.append(header);
+    HttpHeader &entry = entries.last();
+    if (entry.name.isNull()) {
+        // null names mark the removed entries.
+        entry.name = QLatin1String("");
+    }
+    if (knownHeader >= 0) {
+        if (normalize) {
+            entry.name = internedHeaderName(knownHeader);
+        }
+        if (knownSlots[knownHeader] < 0) {
+            knownSlots[knownHeader] = index;
+        }
+    } else {
+        const int slot = unknownSlot(entry.name);
+        if (slot < 0 || unknownSlots.at(slot) < 0) {
+            insertUnknown(index);
+        }
+    }
+}
+
+QByteArray HttpHeaderStorage::value(const QString &name, const QByteArray &defaultValue) const
+{
+    const int index = firstIndex(name);
+    return index >= 0 ? entries.at(index).value : defaultValue;
+}
+
+QByteArray HttpHeaderStorage::value(KnownHeader header, const QByteArray &defaultValue) const
+{
+    const int index = knownSlots[header];
+    return index >= 0 ? entries.at(index).value : defaultValue;
+}
+
+QList<QByteArray> HttpHeaderStorage::values(const QString &name) const
+{
+    QList<QByteArray> result;
+    for (int index = firstIndex(name); index >= 0; index = nextIndex(index, name)) {
+        result.append(entries.at(index).value);
+    }
+    return result;
+}
+
+QList<QByteArray> HttpHeaderStorage::values(KnownHeader header) const
+{
+    QList<QByteArray> result;
+    const QString &name = internedHeaderName(header);
+    for (int index = knownSlots[header]; index >= 0; index = nextIndex(index, name)) {
+        result.append(entries.at(index).value);
+    }
+    return result;
+}
+
+bool HttpHeaderStorage::removeFirst(const QString &name)
+{
+    const int knownHeader = findKnownHeader(name);
+    if (knownHeader >= 0) {
+        return removeFirst(static_cast<KnownHeader>(knownHeader));
+    }
+    const int slot = unknownSlot(name);
+    if (slot < 0 || unknownSlots.at(slot) < 0) {
+        return false;
+    }
+    const int index = unknownSlots.at(slot);
+    const int next = nextIndex(index, name);
+    unknownSlots[slot] = next >= 0 ? next : -2;
+    return removeEntry(index);
+}
+
+bool HttpHeaderStorage::removeFirst(KnownHeader header)
+{
+    const int index = knownSlots[header];
+    if (index < 0) {
+        return false;
+    }
+    knownSlots[header] = nextIndex(index, internedHeaderName(header));
+    return removeEntry(index);
+}
+
+void HttpHeaderStorage::clear()
+{
+    entries.clear();
+    for (int &slot : knownSlots) {
+        slot = -1;
+    }
+    unknownSlots.clear();
+    unknownCount = 0;
+    removedCount = 0;
+}
+
+QList<HttpHeader> HttpHeaderStorage::toList() const
+{
+    QList<HttpHeader> result;
+    result.reserve(entries.size() - removedCount);
+    for (const HttpHeader &entry : entries) {
+        if (!entry.name.isNull()) {
+            result.append(entry);
+        }
+    }
+    return result;
+}
+
+int HttpHeaderStorage::serializedSize() const
+{
+    int size = 0;
+    for (const HttpHeader &entry : entries) {
+        if (!entry.name.isNull()) {
+            size += entry.name.size() + entry.value.size() + 4;
+        }
+    }
+    return size;
+}
+
+void HttpHeaderStorage::serialize(QByteArray *out) const
+{
+    for (const HttpHeader &entry : entries) {
+        if (entry.name.isNull()) {
+            continue;
+        }
+        const QChar *name = entry.name.constData();
+        const int size = entry.name.size();
+        int i = 0;
+        // the names are usually ascii, which are written without converting to utf8.
+        while (i < size && name[i].unicode() < 0x80) {
+            ++i;
+        }
+        if (i == size) {
+            for (i = 0; i < size; ++i) {
+                out->append(static_cast<char>(name[i].unicode()));
+            }
+        } else {
+            out->append(entry.name.toUtf8());
+        }
+        out->append(": ", 2);
+        out->append(entry.value);
+        out->append("\r\n", 2);
+    }
+}
+
+int HttpHeaderStorage::firstIndex(const QString &name) const
+{
+    const int knownHeader = findKnownHeader(name);
+    if (knownHeader >= 0) {
+        return knownSlots[knownHeader];
+    }
+    const int slot = unknownSlot(name);
+    return slot < 0 ? -1 : qMax(unknownSlots.at(slot), -1);
+}
+
+int HttpHeaderStorage::nextIndex(int from, const QString &name) const
+{
+    for (int index = from + 1; index < entries.size(); ++index) {
+        const HttpHeader &entry = entries.at(index);
+        if (!entry.name.isNull() && entry.name.compare(name, Qt::CaseInsensitive) == 0) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// returns the slot of name, or the empty slot where it should be inserted. -2 marks the slots of removed names.
+int HttpHeaderStorage::unknownSlot(const QString &name) const
+{
+    if (unknownSlots.isEmpty()) {
+        return -1;
+    }
+    const uint mask = static_cast<uint>(unknownSlots.size() - 1);
+    uint i = headerNameHash(name) & mask;
+    while (true) {
+        const int index = unknownSlots.at(static_cast<int>(i));
+        if (index == -1) {
+            return static_cast<int>(i);
+        }
+        if (index >= 0 && entries.at(index).name.compare(name, Qt::CaseInsensitive) == 0) {
+            return static_cast<int>(i);
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+void HttpHeaderStorage::insertUnknown(int index)
+{
+    // keep the load factor below 1/2, the removed slots are counted until rehashing.
+    if ((unknownCount + 1) * 2 > unknownSlots.size()) {
+        QVector<int> old;
+        old.swap(unknownSlots);
+        unknownSlots.fill(-1, qMax(8, old.size() * 2));
+        unknownCount = 0;
+        for (int oldIndex : old) {
+            if (oldIndex >= 0) {
+                unknownSlots[unknownSlot(entries.at(oldIndex).name)] = oldIndex;
+                ++unknownCount;
+            }
+        }
+    }
+    unknownSlots[unknownSlot(entries.at(index).name)] = index;
+    ++unknownCount;
+}
+
+const HttpHeader &HttpHeaderStorage::at(int i) const
+{
+    Q_ASSERT_X(i >= 0 && i < size(), "HttpHeaderStorage::at", "index out of range");
+    if (removedCount == 0) {
+        return entries.at(i);
+    }
+    for (const HttpHeader &entry : entries) {
+        if (!entry.name.isNull() && i-- == 0) {
+            return entry;
+        }
+    }
+    Q_UNREACHABLE();
+    return entries.last();
+}
+
+void HttpHeaderStorage::removeAt(int i)
+{
+    Q_ASSERT_X(i >= 0 && i < size(), "HttpHeaderStorage::removeAt", "index out of range");
+    int index = 0;
+    for (; index < entries.size(); ++index) {
+        if (!entries.at(index).name.isNull() && i-- == 0) {
+            break;
+        }
+    }
+    if (index >= entries.size()) {
+        return;
+    }
+    // move the slot of name to the next entry, as removeFirst() does, if this is the first one.
+    const QString name = entries.at(index).name;
+    const int knownHeader = findKnownHeader(name);
+    if (knownHeader >= 0) {
+        if (knownSlots[knownHeader] == index) {
+            knownSlots[knownHeader] = nextIndex(index, name);
+        }
+    } else {
+        const int slot = unknownSlot(name);
+        if (slot >= 0 && unknownSlots.at(slot) == index) {
+            const int next = nextIndex(index, name);
+            unknownSlots[slot] = next >= 0 ? next : -2;
+        }
+    }
+    removeEntry(index);
+}
+
+bool HttpHeaderStorage::removeEntry(int index)
+{
+    entries[index] = HttpHeader();
+    ++removedCount;
+    if (removedCount > 8 && removedCount * 2 > entries.size()) {
+        rebuild();
+    }
+    return true;
+}
+
+void HttpHeaderStorage::rebuild()
+{
+    QVector<HttpHeader> old;
+    old.swap(entries);
+    clear();
+    entries.reserve(old.size());
+    for (const HttpHeader &entry : old) {
+        if (!entry.name.isNull()) {
+            append(entry);
+        }
+    }
+}
+
 bool toMessage(HttpStatus status, QString *shortMessage, QString *longMessage)
 {
     switch (status) {
@@ -234,6 +536,11 @@ bool toMessage(HttpStatus status, QString *shortMessage, QString *longMessage)
         if (longMessage)
             *longMessage = QString::fromLatin1("Failed Dependency");
         return true;
+    case TooEarly:
+        *shortMessage = QString::fromLatin1("Too Early");
+        if (longMessage)
+            *longMessage = QString::fromLatin1("The request may be replayed, send it again after the handshake");
+        return true;
     case UpgradeRequired:
         *shortMessage = QString::fromLatin1("Upgrade Required");
         if (longMessage)
@@ -418,6 +725,51 @@ QByteArray toHttpDate(const QDateTime &dt)
     return QLocale::c().toString(dt, QLatin1String("ddd, dd MMM yyyy hh:mm:ss 'GMT'")).toLatin1();
 }
 
+QList<HttpAlternativeService> parseAltSvc(const QByteArray &value, bool *clear)
+{
+    QList<HttpAlternativeService> services;
+    const QByteArray &trimmed = value.trimmed();
+    if (clear) {
+        *clear = trimmed == "clear";
+    }
+    const QDateTime &now = QDateTime::currentDateTimeUtc();
+    for (const QByteArray &entry : trimmed.split(',')) {
+        const QList<QByteArray> &params = entry.split(';');
+        const QByteArray &first = params.first().trimmed();
+        const int eq = first.indexOf('=');
+        if (eq <= 0) {
+            continue;
+        }
+        QByteArray authority = first.mid(eq + 1).trimmed();
+        if (authority.size() < 2 || !authority.startsWith('"') || !authority.endsWith('"')) {
+            continue;
+        }
+        authority = authority.mid(1, authority.size() - 2);
+        const int colon = authority.lastIndexOf(':');
+        bool ok = false;
+        HttpAlternativeService service;
+        service.port = colon < 0 ? 0 : authority.mid(colon + 1).toUShort(&ok);
+        if (!ok || service.port == 0) {
+            continue;
+        }
+        service.protocol = QByteArray::fromPercentEncoding(first.left(eq).trimmed());
+        service.host = QString::fromLatin1(authority.left(colon));
+        qint64 maxAge = 24 * 3600;
+        for (int i = 1; i < params.size(); ++i) {
+            const QByteArray &param = params.at(i).trimmed();
+            if (param.startsWith("ma=")) {
+                maxAge = param.mid(3).toLongLong(&ok);
+                if (!ok) {
+                    maxAge = 24 * 3600;
+                }
+            }
+        }
+        service.expires = now.addSecs(maxAge);
+        services.append(service);
+    }
+    return services;
+}
+
 static QStringList knownHeaders = {
     QString::fromLatin1("Content-Type"),
     QString::fromLatin1("Content-Length"),
@@ -513,51 +865,24 @@ QString toString(KnownHeader knownHeader)
 QByteArray HeaderSplitter::nextLine(HeaderSplitter::Error *error)
 {
     const int MaxLineLength = 1024 * 64;
-    QByteArray line;
-    bool expectingLineBreak = false;
-
-    for (int i = 0; i < MaxLineLength; ++i) {
-        if (buf.isEmpty()) {
-            buf = connection->recv(1024);
-            if (buf.isEmpty()) {
-                *error = HeaderSplitter::ConnectionError;
-                return QByteArray();
-            }
-        }
-        int j = 0;
-        for (; j < buf.size() && j < MaxLineLength; ++j) {
-            char c = buf.at(j);
-            if (c == '\n') {
-                //                if(!expectingLineBreak) {
-                //                    *error = HeaderSplitter::EncodingError;
-                //                    return QByteArray();
-                //                }
-                buf.remove(0, j + 1);
-                if (buf.size() > MaxLineLength) {
-                    *error = HeaderSplitter::LineTooLong;
-                    return QByteArray();
-                } else {
-                    *error = HeaderSplitter::NoError;
-                    return line;
-                }
-            } else if (c == '\r') {
-                if (expectingLineBreak) {
-                    *error = HeaderSplitter::EncodingError;
-                    return QByteArray();
-                }
-                expectingLineBreak = true;
-            } else {
-                if (expectingLineBreak) {
-                    *error = HeaderSplitter::EncodingError;
-                    return QByteArray();
-                }
-                line.append(c);
-            }
-        }
-        buf.remove(0, j + 1);
+    BufferedSocketReader::Error readerError;
+    QByteArray line = reader.readUntil(QByteArray::fromRawData("\n", 1), MaxLineLength, &readerError);
+    if (readerError == BufferedSocketReader::ConnectionError) {
+        *error = HeaderSplitter::ConnectionError;
+        return QByteArray();
+    } else if (readerError == BufferedSocketReader::LimitExceeded) {
+        *error = HeaderSplitter::LineTooLong;
+        return QByteArray();
     }
-    *error = HeaderSplitter::ExhausedMaxLine;
-    return QByteArray();
+    if (line.endsWith('\r')) {
+        line.chop(1);
+    }
+    if (line.contains('\r')) {
+        *error = HeaderSplitter::EncodingError;
+        return QByteArray();
+    }
+    *error = HeaderSplitter::NoError;
+    return line;
 }
 
 HttpHeader HeaderSplitter::nextHeader(Error *error)
@@ -624,48 +949,15 @@ QList<QByteArray> splitBytes(const QByteArray &bs, char sep, int maxSplit)
 
 QByteArray ChunkedBlockReader::nextBlock(qint64 leftBytes, ChunkedBlockReader::Error *error)
 {
-    const int MaxLineLength = 6;  // ffff\r\n
-    QByteArray numBytes;
-    bool expectingLineBreak = false;
-    while (buf.size() < MaxLineLength && !buf.contains('\n')) {
-        const QByteArray &t = connection->recv(1024 * 8);
-        if (t.isEmpty()) {
-            break;
-        }
-        buf.append(t);  // most server send the header at one tcp block.
-    }
-    if (buf.size() < 3) {  // 0\r\n
+    const int MaxLineLength = 18;  // ffffffffffffffff\r\n
+    BufferedSocketReader::Error readerError;
+    QByteArray numBytes = reader.readUntil(QByteArray::fromRawData("\r\n", 2), MaxLineLength, &readerError);
+    if (readerError != BufferedSocketReader::NoError || numBytes.isEmpty()) {
         *error = ChunkedBlockReader::ChunkedEncodingError;
         return QByteArray();
     }
 
     bool ok = false;
-    for (int i = 0; i < buf.size() && i < MaxLineLength; ++i) {
-        char c = buf.at(i);
-        if (expectingLineBreak) {
-            if (c == '\n') {
-                buf.remove(0, i + 1);
-                ok = true;
-                break;
-            } else {
-                *error = ChunkedBlockReader::ChunkedEncodingError;
-                return QByteArray();
-            }
-        } else {
-            if (c == '\n') {
-                *error = ChunkedBlockReader::ChunkedEncodingError;
-                return QByteArray();
-            } else if (c == '\r') {
-                expectingLineBreak = true;
-            } else {
-                numBytes.append(c);
-            }
-        }
-    }
-    if (!ok) {
-        *error = ChunkedBlockReader::ChunkedEncodingError;
-        return QByteArray();
-    }
     qint32 bytesToRead = numBytes.toInt(&ok, 16);
     if (!ok) {
         if (debugLevel > 0) {
@@ -680,19 +972,14 @@ QByteArray ChunkedBlockReader::nextBlock(qint64 leftBytes, ChunkedBlockReader::E
         return QByteArray();
     }
 
-    while (buf.size() < bytesToRead + 2) {
-        const QByteArray t = connection->recv(1024 * 8);
-        if (t.isEmpty()) {
-            *error = ChunkedBlockReader::ConnectionError;
-            return QByteArray();
-        }
-        buf.append(t);
+    QByteArray result = reader.readExactly(bytesToRead + 2);
+    if (result.size() != bytesToRead + 2) {
+        *error = ChunkedBlockReader::ConnectionError;
+        return QByteArray();
     }
+    result.chop(2);
 
-    const QByteArray &result = buf.mid(0, bytesToRead);
-    buf.remove(0, bytesToRead + 2);
-
-    if (bytesToRead == 0 && !buf.isEmpty() && debugLevel > 0) {
+    if (bytesToRead == 0 && reader.bufferedSize() > 0 && debugLevel > 0) {
         qtng_debug << "bytesToRead == 0 but some bytes left.";
     }
 
@@ -704,16 +991,21 @@ PlainBodyFile::PlainBodyFile(qint64 contentLength, const QByteArray &partialBody
     : contentLength(contentLength)
     , stream(stream)
     , partialBody(partialBody)
+    , partialPos(0)
     , count(0)
 {
 }
 
 qint32 PlainBodyFile::read(char *data, qint32 size)
 {
-    if (!partialBody.isEmpty()) {
-        qint32 t = qMin(size, partialBody.size());
-        memcpy(data, partialBody.constData(), t);
-        partialBody.remove(0, t);
+    if (partialPos < partialBody.size()) {
+        qint32 t = qMin(size, partialBody.size() - partialPos);
+        memcpy(data, partialBody.constData() + partialPos, t);
+        partialPos += t;
+        if (partialPos >= partialBody.size()) {
+            partialBody.clear();
+            partialPos = 0;
+        }
         count += t;
         return t;
     }
@@ -737,32 +1029,116 @@ ChunkedBodyFile::ChunkedBodyFile(qint64 maxBodySize, const QByteArray &partialBo
     , error(ChunkedBlockReader::NoError)
     , maxBodySize(maxBodySize)
     , count(0)
+    , leftInChunk(0)
+    , needCrlf(false)
     , eof(false)
 {
 }
 
+// read the size line of next chunk, or the trailers after the last chunk.
+bool ChunkedBodyFile::nextChunk()
+{
+    BufferedSocketReader &buffered = reader.reader;
+    BufferedSocketReader::Error readerError;
+    if (needCrlf) {
+        const QByteArray &crlf = buffered.readExactly(2);
+        if (crlf != "\r\n") {
+            error = crlf.size() < 2 ? ChunkedBlockReader::ConnectionError : ChunkedBlockReader::ChunkedEncodingError;
+            return false;
+        }
+        needCrlf = false;
+    }
+    const int MaxLineLength = 1024;  // the size may be followed by chunk extensions.
+    QByteArray line = buffered.readUntil(QByteArray::fromRawData("\r\n", 2), MaxLineLength, &readerError);
+    if (readerError != BufferedSocketReader::NoError) {
+        error = ChunkedBlockReader::ChunkedEncodingError;
+        return false;
+    }
+    const int semicolon = line.indexOf(';');
+    if (semicolon >= 0) {
+        line.truncate(semicolon);
+    }
+    bool ok = false;
+    const qint64 chunkSize = line.trimmed().toLongLong(&ok, 16);
+    if (!ok || chunkSize < 0) {
+        if (reader.debugLevel > 0) {
+            qtng_debug << "got invalid chunked bytes:" << line;
+        }
+        error = ChunkedBlockReader::ChunkedEncodingError;
+        return false;
+    }
+    if (maxBodySize >= 0 && chunkSize > maxBodySize - count) {
+        error = ChunkedBlockReader::UnrewindableBodyError;
+        return false;
+    }
+    if (chunkSize > 0) {
+        leftInChunk = chunkSize;
+        return true;
+    }
+    // the last chunk, skip the trailers till the empty line.
+    while (true) {
+        const QByteArray &trailer =
+                buffered.readUntil(QByteArray::fromRawData("\r\n", 2), MaxLineLength * 8, &readerError);
+        if (readerError != BufferedSocketReader::NoError) {
+            error = ChunkedBlockReader::ChunkedEncodingError;
+            return false;
+        }
+        if (trailer.isEmpty()) {
+            break;
+        }
+    }
+    eof = true;
+    return true;
+}
+
 qint32 ChunkedBodyFile::read(char *data, qint32 size)
 {
-    while (buf.size() < size && !eof) {
-        qint64 leftBytes;
-        if (maxBodySize >= 0) {
-            leftBytes = qMax<qint64>(0, maxBodySize - count);
-            if (leftBytes <= 0) {
-                break;
-            }
-        } else {
-            leftBytes = INT_MAX;
+    if (error != ChunkedBlockReader::NoError) {
+        return -1;
+    }
+    while (leftInChunk == 0) {
+        if (eof) {
+            return 0;
         }
-        const QByteArray &block = reader.nextBlock(leftBytes, &error);
-        if (error != ChunkedBlockReader::NoError) {
+        if (!nextChunk()) {
             return -1;
         }
-        if (block.isEmpty()) {
+    }
+    qint32 bs = reader.reader.read(data, static_cast<qint32>(qMin<qint64>(size, leftInChunk)));
+    if (bs <= 0) {
+        error = ChunkedBlockReader::ConnectionError;
+        return -1;
+    }
+    leftInChunk -= bs;
+    count += bs;
+    needCrlf = (leftInChunk == 0);
+    return bs;
+}
+
+ChunkedEncodedFile::ChunkedEncodedFile(QSharedPointer<FileLike> body)
+    : body(body)
+    , eof(false)
+{
+}
+
+qint32 ChunkedEncodedFile::read(char *data, qint32 size)
+{
+    if (buf.isEmpty() && !eof) {
+        const qint32 blockSize = 1024 * 32;
+        QByteArray block(blockSize, Qt::Uninitialized);
+        qint32 readBytes = body->read(block.data(), blockSize);
+        if (readBytes < 0) {
+            return -1;
+        } else if (readBytes == 0) {
+            buf = "0\r\n\r\n";
             eof = true;
-            break;
+        } else {
+            buf.reserve(readBytes + 12);
+            buf.append(QByteArray::number(readBytes, 16));
+            buf.append("\r\n");
+            buf.append(block.constData(), readBytes);
+            buf.append("\r\n");
         }
-        count += block.size();
-        buf.append(block);
     }
     qint32 bytesToRead = qMin(buf.size(), size);
     memcpy(data, buf.constData(), bytesToRead);
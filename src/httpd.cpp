@@ -1,6 +1,14 @@
 #include <QtCore/qmimedatabase.h>
+#include <QtCore/qcryptographichash.h>
+#include <QtCore/qthreadstorage.h>
 #include <stdio.h>
 #include "../include/httpd.h"
+#include "../include/private/http_parser_p.h"
+#include "../include/private/http2_p.h"
+#include "../include/compression.h"
+#include "../include/metrics.h"
+#include "../include/access_log.h"
+#include "../include/private/eventloop_p.h"
 #ifdef QTNG_HAVE_ZLIB
 #  include "../include/gzip.h"
 #endif
@@ -26,34 +34,298 @@ static const QString DEFAULT_ERROR_MESSAGE =
                             "</html>\n");
 static const QString DEFAULT_ERROR_CONTENT_TYPE = QString::fromLatin1("text/html;charset=utf-8");
 
+// formatting dates and status lines costs more than sending small responses, so every thread caches them.
+struct HttpdFormatCache
+{
+    HttpdFormatCache()
+        : dateSecs(-1)
+    {
+    }
+    qint64 dateSecs;
+    QString date;
+    QHash<int, QPair<QString, QByteArray>> statusLines;  // (version << 16 | status) -> (short message, line)
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<HttpdFormatCache *>, formatCaches)
+
+static HttpdFormatCache *localFormatCache()
+{
+    QThreadStorage<HttpdFormatCache *> *storage = formatCaches();
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(new HttpdFormatCache());
+    }
+    return storage->localData();
+}
+
 //#define DEBUG_HTTP_PROTOCOL 1
 
 BaseHttpRequestHandler::BaseHttpRequestHandler()
-    : version(Http1_1)
+    : waitingNextRequest(false)
+    , version(Http1_1)
+    , earlyData(false)
     , serverVersion(Http1_1)
     , requestTimeout(60 * 60)
+    , keepAliveTimeout(60)
     , maxBodySize(1024 * 1024 * 32)
     , closeConnection(Maybe)
 {
+    // kept through the requests of a keep-alive connection, resize(0) does not free a reserved buffer.
+    headerBuffer.reserve(1024);
+}
+
+static const char Http2PrefaceLine[] = "PRI * HTTP/2.0\r\n";
+
+// buffers the responses while more pipelined requests are received, and sends all of them with the last one. the
+// buffer is flushed before reading, so the client never waits for a response held here.
+class PipelinedResponseWriter : public SocketLike
+{
+public:
+    enum { MaxBufferSize = 1024 * 64 };
+    explicit PipelinedResponseWriter(QSharedPointer<SocketLike> connection)
+        : connection(connection)
+        , buffering(false)
+    {
+    }
+public:
+    bool flush();
+    void setBuffering(bool buffering);
+public:
+    virtual Socket::SocketError error() const override { return connection->error(); }
+    virtual QString errorString() const override { return connection->errorString(); }
+    virtual bool isValid() const override { return connection->isValid(); }
+    virtual HostAddress localAddress() const override { return connection->localAddress(); }
+    virtual quint16 localPort() const override { return connection->localPort(); }
+    virtual HostAddress peerAddress() const override { return connection->peerAddress(); }
+    virtual QString peerName() const override { return connection->peerName(); }
+    virtual quint16 peerPort() const override { return connection->peerPort(); }
+    virtual qintptr fileno() const override { return connection->fileno(); }
+    virtual Socket::SocketType type() const override { return connection->type(); }
+    virtual Socket::SocketState state() const override { return connection->state(); }
+    virtual HostAddress::NetworkLayerProtocol protocol() const override { return connection->protocol(); }
+    virtual QString localAddressURI() const override { return connection->localAddressURI(); }
+    virtual QString peerAddressURI() const override { return connection->peerAddressURI(); }
+
+    virtual QSharedPointer<SocketLike> accept() override { return connection->accept(); }
+    virtual Socket *acceptRaw() override { return connection->acceptRaw(); }
+    virtual bool bind(const HostAddress &address, quint16 port, Socket::BindMode mode) override
+    {
+        return connection->bind(address, port, mode);
+    }
+    virtual bool bind(quint16 port, Socket::BindMode mode) override { return connection->bind(port, mode); }
+    virtual bool connect(const HostAddress &addr, quint16 port) override { return connection->connect(addr, port); }
+    virtual bool connect(const QString &hostName, quint16 port, QSharedPointer<SocketDnsCache> dnsCache) override
+    {
+        return connection->connect(hostName, port, dnsCache);
+    }
+    virtual void close() override
+    {
+        flush();
+        connection->close();
+    }
+    virtual void abort() override
+    {
+        output.clear();
+        connection->abort();
+    }
+    virtual bool listen(int backlog) override { return connection->listen(backlog); }
+    virtual bool setOption(Socket::SocketOption option, const QVariant &value) override
+    {
+        return connection->setOption(option, value);
+    }
+    virtual QVariant option(Socket::SocketOption option) const override { return connection->option(option); }
+
+    virtual qint32 recv(char *data, qint32 size) override { return flush() ? connection->recv(data, size) : -1; }
+    virtual qint32 recvall(char *data, qint32 size) override
+    {
+        return flush() ? connection->recvall(data, size) : -1;
+    }
+    virtual QByteArray recv(qint32 size) override { return flush() ? connection->recv(size) : QByteArray(); }
+    virtual QByteArray recvall(qint32 size) override { return flush() ? connection->recvall(size) : QByteArray(); }
+    virtual qint32 send(const char *data, qint32 size) override { return sendall(data, size); }
+    virtual qint32 sendall(const char *data, qint32 size) override;
+    virtual qint32 send(const QByteArray &data) override { return sendall(data.constData(), data.size()); }
+    virtual qint32 sendall(const QByteArray &data) override { return sendall(data.constData(), data.size()); }
+    virtual bool hasPendingData() const override { return connection->hasPendingData(); }
+    virtual qint32 maxMessageSize() const override { return connection->maxMessageSize(); }
+public:
+    QSharedPointer<SocketLike> connection;
+    QByteArray output;
+    bool buffering;
+};
+
+bool PipelinedResponseWriter::flush()
+{
+    if (output.isEmpty()) {
+        return true;
+    }
+    bool ok = connection->sendall(output) == output.size();
+    output.resize(0);
+    return ok;
+}
+
+void PipelinedResponseWriter::setBuffering(bool buffering)
+{
+    this->buffering = buffering;
+}
+
+qint32 PipelinedResponseWriter::sendall(const char *data, qint32 size)
+{
+    if (size <= 0 || (!buffering && output.isEmpty())) {
+        return connection->sendall(data, size);
+    }
+    if (output.size() + size <= MaxBufferSize) {
+        output.append(data, size);
+        if (buffering) {
+            return size;
+        }
+        return flush() ? size : -1;
+    }
+    if (!flush()) {
+        return -1;
+    }
+    return connection->sendall(data, size);
+}
+
+// the common methods are shared by all requests instead of allocated for each.
+static QString toMethod(const char *data, int size)
+{
+    static const QString knownMethods[] = {
+        QString::fromLatin1("GET"),     QString::fromLatin1("POST"),   QString::fromLatin1("HEAD"),
+        QString::fromLatin1("PUT"),     QString::fromLatin1("DELETE"), QString::fromLatin1("OPTIONS"),
+        QString::fromLatin1("PATCH"),   QString::fromLatin1("CONNECT"), QString::fromLatin1("TRACE"),
+    };
+    const QLatin1String s(data, size);
+    for (const QString &method : knownMethods) {
+        if (method.size() == size && method.compare(s, Qt::CaseInsensitive) == 0) {
+            return method;
+        }
+    }
+    return QString(s).toUpper();
+}
+
+static inline bool equalsIgnoreCase(const QByteArray &s, const char *literal)
+{
+    const uint len = qstrlen(literal);
+    return static_cast<uint>(s.size()) == len && qstrnicmp(s.constData(), literal, len) == 0;
+}
+
+// every stream is served by a new request handler, as if it is a connection.
+class Http2ServerConnection : public Http2Connection
+{
+public:
+    Http2ServerConnection(QSharedPointer<SocketLike> connection, BaseStreamServer *server, CoroutineGroup *handlers)
+        : Http2Connection(connection, true)
+        , server(server)
+        , handlers(handlers)
+    {
+    }
+protected:
+    virtual void handleNewStream(QSharedPointer<Http2Stream> stream) override;
+public:
+    QWeakPointer<Http2Connection> self;
+    BaseStreamServer *server;
+    CoroutineGroup *handlers;
+};
+
+void Http2ServerConnection::handleNewStream(QSharedPointer<Http2Stream> stream)
+{
+    QSharedPointer<Http2Connection> http2 = self.toStrongRef();
+    if (http2.isNull() || server == nullptr) {
+        Http2Connection::handleNewStream(stream);
+        return;
+    }
+    QSharedPointer<SocketLike> request(new Http2StreamSocket(http2, stream));
+    BaseStreamServer *streamServer = server;
+    handlers->spawn([streamServer, request] { streamServer->processSubRequest(request); });
 }
 
 void BaseHttpRequestHandler::handle()
 {
+    QSharedPointer<Http2StreamSocket> stream = request.dynamicCast<Http2StreamSocket>();
+    if (!stream.isNull()) {
+        // one request per stream, the stream is reset if nothing is sent.
+        closeConnection = Yes;
+        handleOneRequest();
+        if (stream->stream->headersSent) {
+            stream->finish();
+        }
+        return;
+    }
+#ifndef QTNG_NO_CRYPTO
+    QSharedPointer<SslSocket> ssl = convertSocketLikeToSslSocket(request);
+    if (!ssl.isNull() && ssl->nextNegotiatedProtocol() == "h2") {
+        handleHttp2(QByteArray());
+        return;
+    }
+#endif
+    waitingNextRequest = false;
+    QSharedPointer<SocketLike> connection = request;
     do {
         closeConnection = Maybe;
         handleOneRequest();
-    } while (closeConnection == No);
+        waitingNextRequest = true;
+    } while (closeConnection == No && !(server && server->isDraining()));
+    if (!pipelineWriter.isNull()) {
+        pipelineWriter->flush();
+        pipelineWriter.clear();
+        request = connection;
+    }
+    if (!http2Preface.isEmpty()) {
+        QByteArray buffered;
+        buffered.swap(http2Preface);
+        handleHttp2(buffered);
+    }
     // do not close the request, because it can be keep by other module.
 }
 
+void BaseHttpRequestHandler::handleHttp2(const QByteArray &buffered)
+{
+    CoroutineGroup handlers;
+    QSharedPointer<Http2ServerConnection> http2(new Http2ServerConnection(request, server, &handlers));
+    http2->self = http2;
+    if (!http2->handshake(buffered)) {
+        return;
+    }
+    http2->join();
+    // the streams are reset, so the handlers return soon.
+    handlers.joinall();
+}
+
 void BaseHttpRequestHandler::handleOneRequest()
 {
     try {
         Timeout timeout(requestTimeout);
+        bodyReader.clear();
+        chunkedBody.clear();
         if (!parseRequest()) {
             return;
         }
+        if (version == Http1_1 && hasHeader(QString::fromLatin1("Expect"))) {
+            if (!equalsIgnoreCase(header(QString::fromLatin1("Expect")), "100-continue")) {
+                closeConnection = Yes;
+                sendError(HttpStatus::ExpectationFailed);
+                return;
+            }
+            if (body.isEmpty() && getContentLength() != 0 && !checkContinue()) {
+                closeConnection = Yes;
+                return;
+            }
+        }
         doMethod();
+        // the rest of body would be parsed as the next request.
+        if (closeConnection != Yes && hasUnreadBody()) {
+            closeConnection = Yes;
+        }
+        // the next requests sent right after the chunked body are buffered by its reader. the last chunk may be left
+        // unread if the decoder of content stops before it, and the connection can not be reused then.
+        if (!chunkedBody.isNull()) {
+            if (closeConnection != Yes && chunkedBody->eof) {
+                pipelined.append(chunkedBody->reader.reader.takeBuffered());
+            } else {
+                closeConnection = Yes;
+            }
+            chunkedBody.clear();
+        }
     } catch (TimeoutException &) {
         QLatin1String message("HTTP request handler is timeout.");
         logError(HttpStatus::Gone, message, message);
@@ -61,6 +333,15 @@ void BaseHttpRequestHandler::handleOneRequest()
     }
 }
 
+bool BaseHttpRequestHandler::checkContinue()
+{
+    if (maxBodySize >= 0 && getContentLength() > maxBodySize) {
+        sendError(HttpStatus::RequestEntityTooLarge);
+        return false;
+    }
+    return true;
+}
+
 QString BaseHttpRequestHandler::normalizePath(const QString &path)
 {
     QUrl url = QUrl::fromEncoded(path.toLatin1(), QUrl::StrictMode);
@@ -69,71 +350,95 @@ QString BaseHttpRequestHandler::normalizePath(const QString &path)
 
 bool BaseHttpRequestHandler::parseRequest()
 {
-    bool done = false;
-    const QByteArray &buf = tryToHandleMagicCode(done);
-    if (done) {
-        return false;
+    if (!request.dynamicCast<Http2StreamSocket>().isNull()) {
+        return parseHttp2Request();
     }
-    HeaderSplitter headerSplitter(request, buf);
-    HeaderSplitter::Error headerSplitterError;
-    QByteArray firstLine = headerSplitter.nextLine(&headerSplitterError);
-    if (firstLine.isEmpty() || headerSplitterError != HeaderSplitter::NoError) {
-        return false;
+#ifndef QTNG_NO_CRYPTO
+    // the requests pipelined after an early one are received in the early data too.
+    if (pipelined.isEmpty() || !earlyData) {
+        QSharedPointer<SslSocket> ssl =
+                convertSocketLikeToSslSocket(pipelineWriter.isNull() ? request : pipelineWriter->connection);
+        earlyData = !ssl.isNull() && ssl->isReadingEarlyData();
     }
-#ifdef DEBUG_HTTP_PROTOCOL
-    qtng_debug << "first line is" << firstLine;
 #endif
-
-    const QString &commandLine = QString::fromLatin1(firstLine);
-    const QStringList &words = commandLine.split(QRegExp(QLatin1String("\\s+")));
-    if (words.isEmpty()) {
-        return false;
+    QByteArray buf;
+    if (pipelined.isEmpty()) {
+        bool done = false;
+        buf = tryToHandleMagicCode(done);
+        if (done) {
+            return false;
+        }
+    } else {
+        buf.swap(pipelined);
+    }
+    const int MaxHeaders = 64;
+    const int MaxHeadSize = 1024 * 64;
+    BufferedSocketReader reader(request, buf);
+    // an idle keep-alive connection is closed silently.
+    QScopedPointer<Timeout> idleTimeout;
+    if (waitingNextRequest && keepAliveTimeout > 0 && buf.isEmpty()) {
+        idleTimeout.reset(new Timeout(keepAliveTimeout));
     }
-    if (words.size() == 3) {
-        method = words.at(0);
-        path = words.at(1);
-        const QString &versionStr = words.at(2);
-        if (versionStr == QLatin1String("HTTP/1.0")) {
-            version = Http1_0;
-        } else if (versionStr == QLatin1String("HTTP/1.1")) {
-            version = Http1_1;
+    HttpSlice methodSlice, pathSlice;
+    HttpHeaderSlice headerSlices[MaxHeaders];
+    int minorVersion;
+    int numHeaders;
+    int headSize;
+    while (true) {
+        numHeaders = MaxHeaders;
+        headSize = parseHttpRequestHead(reader.bufferedData(), reader.bufferedSize(), &methodSlice, &pathSlice,
+                                        &minorVersion, headerSlices, &numHeaders);
+        if (headSize >= 0) {
+            break;
+        } else if (headSize == HttpParseIncomplete) {
+            if (reader.bufferedSize() > MaxHeadSize) {
+                sendError(HttpStatus::RequestHeaderFieldsTooLarge, QString::fromLatin1("Line too long"));
+                return false;
+            }
+            if (!idleTimeout.isNull()) {
+                qint32 bs;
+                try {
+                    bs = reader.fill();
+                } catch (TimeoutException &) {
+                    closeConnection = Yes;
+                    return false;
+                }
+                idleTimeout.reset();
+                if (bs <= 0) {
+                    return false;
+                }
+            } else if (reader.fill() <= 0) {
+                return false;
+            }
+        } else if (headSize == HttpParseTooManyHeaders) {
+            sendError(HttpStatus::RequestHeaderFieldsTooLarge, QString::fromLatin1("Too much headers"));
+            return false;
+        } else if (reader.bufferedSize() >= 16 && qstrncmp(reader.bufferedData(), Http2PrefaceLine, 16) == 0) {
+            // the client knows we speak http2.
+            http2Preface = reader.takeBuffered();
+            closeConnection = Yes;
+            return false;
         } else {
-            sendError(HttpStatus::BadRequest, QString::fromLatin1("Bad request version (%1").arg(versionStr));
+            sendError(HttpStatus::BadRequest, QString::fromLatin1("Bad request syntax"));
             return false;
         }
-    } else if (words.size() == 2) {
-        method = words.at(0);
-        path = words.at(1);
+    }
+    const char *head = reader.bufferedData();
+    method = toMethod(head + methodSlice.offset, methodSlice.length);
+    path = QString::fromLatin1(head + pathSlice.offset, pathSlice.length);
+#ifdef DEBUG_HTTP_PROTOCOL
+    qtng_debug << "first line is" << method << path << minorVersion;
+#endif
+    if (minorVersion == 1) {
+        version = Http1_1;
+    } else if (minorVersion <= 0) {
         version = Http1_0;
-    } else if (words.isEmpty()) {
-        return false;
     } else {
-        sendError(HttpStatus::BadRequest, QString::fromLatin1("Bad request syntax (%1)").arg(commandLine));
-        return false;
-    }
-    method = method.toUpper();
-    if (path.isEmpty()) {
-        sendError(HttpStatus::BadRequest, QString::fromLatin1("Bad request path (%1)").arg(path));
+        sendError(HttpStatus::BadRequest, QString::fromLatin1("Bad request version (HTTP/1.%1)").arg(minorVersion));
         return false;
     }
-
-    const int MaxHeaders = 64;
-    QList<HttpHeader> headers = headerSplitter.headers(MaxHeaders, &headerSplitterError);
-    switch (headerSplitterError) {
-    case HeaderSplitter::EncodingError:
-        sendError(HttpStatus::BadRequest, QString::fromLatin1("Bad request invalid header"));
-        return false;
-    case HeaderSplitter::ConnectionError:
-        return false;
-    case HeaderSplitter::ExhausedMaxLine:
-        sendError(HttpStatus::RequestHeaderFieldsTooLarge, QString::fromLatin1("Too much headers"));
-        return false;
-    case HeaderSplitter::LineTooLong:
-        sendError(HttpStatus::RequestHeaderFieldsTooLarge, QString::fromLatin1("Line too long"));
-        return false;
-    default:
-        break;
-    }
+    const QList<HttpHeader> &headers = toHttpHeaders(head, headerSlices, numHeaders);
+    reader.skip(headSize);
     setHeaders(headers);
 #ifdef DEBUG_HTTP_PROTOCOL
     for (const HttpHeader &header : headers) {
@@ -141,14 +446,95 @@ bool BaseHttpRequestHandler::parseRequest()
     }
 #endif
     const QByteArray &connectionType = header(ConnectionHeader);
-    if (connectionType.toLower() == QByteArray("close") || method.toUpper() == QLatin1String("CONNECT")) {
+    if (equalsIgnoreCase(connectionType, "close") || method == QLatin1String("CONNECT")) {
         closeConnection = Yes;
-    } else if (connectionType.toLower() == QByteArray("keep-alive") && version >= Http1_1 && serverVersion >= Http1_1) {
+    } else if (equalsIgnoreCase(connectionType, "keep-alive") && version >= Http1_1 && serverVersion >= Http1_1) {
         closeConnection = Maybe;
     } else {
         closeConnection = Yes;
     }
-    body = headerSplitter.buf;
+    body = reader.takeBuffered();
+    // split the next requests sent without waiting for this response. the chunked body is parsed by its reader, which
+    // gives back the bytes after the last chunk to handleOneRequest().
+    if (!body.isEmpty() && !hasHeader(QString::fromLatin1("Transfer-Encoding"))) {
+        const qint64 contentLength = qMax<qint64>(0, getContentLength());
+        if (body.size() > contentLength) {
+            pipelined = body.mid(static_cast<int>(contentLength));
+            body.truncate(static_cast<int>(contentLength));
+        }
+    }
+    if (!pipelined.isEmpty() && closeConnection != Yes) {
+        if (pipelineWriter.isNull()) {
+            pipelineWriter.reset(new PipelinedResponseWriter(request));
+            request = pipelineWriter;
+        }
+        pipelineWriter->setBuffering(true);
+    } else if (!pipelineWriter.isNull()) {
+        // the response of the last buffered request takes all of them.
+        pipelineWriter->setBuffering(false);
+    }
+    return true;
+}
+
+bool BaseHttpRequestHandler::parseHttp2Request()
+{
+    QSharedPointer<Http2StreamSocket> stream = request.dynamicCast<Http2StreamSocket>();
+    QList<HPackHeader> fields;
+    if (stream.isNull() || !stream->http2->recvHeaders(stream->stream, &fields)) {
+        return false;
+    }
+    QList<HttpHeader> headers;
+    QByteArray authority;
+    QByteArray cookies;
+    bool regularFound = false;
+    method.clear();
+    path.clear();
+    for (const HPackHeader &field : fields) {
+        if (field.name.startsWith(':')) {
+            if (regularFound) {
+                sendError(HttpStatus::BadRequest, QString::fromLatin1("Bad pseudo header"));
+                return false;
+            }
+            if (field.name == ":method") {
+                method = QString::fromLatin1(field.value).toUpper();
+            } else if (field.name == ":path") {
+                path = QString::fromLatin1(field.value);
+            } else if (field.name == ":authority") {
+                authority = field.value;
+            }
+            continue;
+        }
+        regularFound = true;
+        if (field.name == "cookie") {
+            // the cookie header may be split into many fields.
+            if (!cookies.isEmpty()) {
+                cookies.append("; ");
+            }
+            cookies.append(field.value);
+            continue;
+        }
+        headers.append(HttpHeader(QString::fromLatin1(field.name), field.value));
+    }
+    if (!cookies.isEmpty()) {
+        headers.append(HttpHeader(QString::fromLatin1("cookie"), cookies));
+    }
+    version = Http2_0;
+    closeConnection = Yes;
+    if (method.isEmpty() || (path.isEmpty() && method != QLatin1String("CONNECT"))) {
+        sendError(HttpStatus::BadRequest, QString::fromLatin1("Bad request syntax"));
+        return false;
+    }
+    if (method == QLatin1String("CONNECT")) {
+        path = QString::fromLatin1(authority);
+    }
+    setHeaders(headers);
+    if (!authority.isEmpty() && !hasHeader(HostHeader)) {
+        setHeader(HostHeader, authority);
+    }
+#ifdef DEBUG_HTTP_PROTOCOL
+    qtng_debug << "http2 request is" << method << path;
+#endif
+    body.clear();
     return true;
 }
 
@@ -251,8 +637,8 @@ bool BaseHttpRequestHandler::sendError(HttpStatus status, const QString &message
     }
     logError(status, shortMessage, longMessage);
     sendCommandLine(status, shortMessage);
-    sendHeader("Server", serverName().toUtf8());
-    sendHeader("Date", dateTimeString().toUtf8());
+    sendHeader(QByteArray("Server"), serverNameBytes());
+    sendHeader(QByteArray("Date"), dateTimeString().toLatin1());
     QByteArray body;
     if (status >= 200 && status != HttpStatus::NoContent && status != HttpStatus::ResetContent
         && status != HttpStatus::NotModified) {
@@ -273,7 +659,7 @@ bool BaseHttpRequestHandler::sendError(HttpStatus status, const QString &message
 bool BaseHttpRequestHandler::sendResponse(HttpStatus status, const QString &message)
 {
     QString shortMessage, longMessage;
-    bool ok = toMessage(HttpStatus::OK, &shortMessage, &longMessage);
+    bool ok = toMessage(status, &shortMessage, &longMessage);
     if (!ok) {
         shortMessage = longMessage = QString::fromLatin1("???");
     }
@@ -282,8 +668,8 @@ bool BaseHttpRequestHandler::sendResponse(HttpStatus status, const QString &mess
     }
     logRequest(status, 0);
     sendCommandLine(status, shortMessage);
-    sendHeader(QByteArray("Server"), serverName().toUtf8());
-    sendHeader(QByteArray("Date"), dateTimeString().toUtf8());
+    sendHeader(QByteArray("Server"), serverNameBytes());
+    sendHeader(QByteArray("Date"), dateTimeString().toLatin1());
     return true;
 }
 
@@ -299,25 +685,38 @@ QString BaseHttpRequestHandler::errorMessageContentType()
 
 void BaseHttpRequestHandler::sendCommandLine(HttpStatus status, const QString &shortMessage)
 {
-    QString versionStr;
-    if (serverVersion == Http1_0 || version == Http1_0) {
-        versionStr = QString::fromLatin1("HTTP/1.0");
-    } else {
-        versionStr = QString::fromLatin1("HTTP/1.1");
+    const bool http10 = serverVersion == Http1_0 || version == Http1_0;
+    QHash<int, QPair<QString, QByteArray>> &statusLines = localFormatCache()->statusLines;
+    const int key = (http10 ? 1 << 16 : 0) | static_cast<int>(status);
+    QHash<int, QPair<QString, QByteArray>>::const_iterator itor = statusLines.constFind(key);
+    if (itor != statusLines.constEnd() && itor.value().first == shortMessage) {
+        statusLine = itor.value().second;
+        return;
+    }
+    const QString &versionStr = http10 ? QString::fromLatin1("HTTP/1.0") : QString::fromLatin1("HTTP/1.1");
+    const QByteArray &firstLine = QString::fromLatin1("%1 %2 %3\r\n")
+                                          .arg(versionStr)
+                                          .arg(static_cast<int>(status))
+                                          .arg(shortMessage)
+                                          .toUtf8();
+    if (statusLines.size() < 1024) {
+        statusLines.insert(key, qMakePair(shortMessage, firstLine));
     }
-    const QString &firstLine =
-            QString::fromLatin1("%1 %2 %3\r\n").arg(versionStr).arg(static_cast<int>(status)).arg(shortMessage);
-    headerCache.prepend(firstLine.toUtf8());
+    statusLine = firstLine;
+}
+
+void BaseHttpRequestHandler::sendHeaders(const QByteArray &block)
+{
+    headerBuffer.append(block);
 }
 
 void BaseHttpRequestHandler::sendHeader(const QByteArray &name, const QByteArray &value)
 {
-    const QByteArray &line = name + ": " + value + "\r\n";
-    headerCache.append(line);
-    if (name.toLower() == QByteArray("transfer-encoding") && value.toLower() == QByteArray("chunked")) {
+    headerBuffer.append(name).append(": ", 2).append(value).append("\r\n", 2);
+    if (equalsIgnoreCase(name, "transfer-encoding") && equalsIgnoreCase(value, "chunked")) {
         closeConnection = Yes;
-    } else if (name.toLower() == QByteArray("connection")) {
-        if (value.toLower() == "keep-alive" && closeConnection != Yes) {
+    } else if (equalsIgnoreCase(name, "connection")) {
+        if (equalsIgnoreCase(value, "keep-alive") && closeConnection != Yes) {
             closeConnection = No;
         } else {
             closeConnection = Yes;
@@ -325,42 +724,286 @@ void BaseHttpRequestHandler::sendHeader(const QByteArray &name, const QByteArray
     }
 }
 
-#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
-inline static QByteArray join(const QByteArrayList &lines)
-{
-    return lines.join();
-}
-#else
-inline static QByteArray join(const QList<QByteArray> &lines)
+bool BaseHttpRequestHandler::endHeader()
 {
-    QByteArray buf;
-    buf.reserve(1024 * 4 - 1);
-    for (const QByteArray &line : lines) {
-        buf.append(line);
+    QSharedPointer<Http2StreamSocket> stream = request.dynamicCast<Http2StreamSocket>();
+    if (!stream.isNull()) {
+        // the status line and headers are sent as one HEADERS frame.
+        QList<HPackHeader> fields;
+        for (const QByteArray &line : (statusLine + headerBuffer).split('\n')) {
+            const QByteArray &l = line.trimmed();
+            if (l.isEmpty()) {
+                continue;
+            }
+            if (fields.isEmpty()) {
+                const QList<QByteArray> &parts = l.split(' ');
+                fields.append(HPackHeader(":status", parts.value(1)));
+                continue;
+            }
+            const int colon = l.indexOf(':');
+            if (colon <= 0) {
+                continue;
+            }
+            const QByteArray &name = l.left(colon).trimmed().toLower();
+            if (name == "connection" || name == "keep-alive" || name == "proxy-connection"
+                || name == "transfer-encoding" || name == "upgrade") {
+                continue;
+            }
+            fields.append(HPackHeader(name, l.mid(colon + 1).trimmed()));
+        }
+        statusLine.clear();
+        headerBuffer.resize(0);
+        return stream->http2->sendHeaders(stream->stream, fields, false);
     }
-    return buf;
+    finishHead();
+    bool ok = request->sendall(headerBuffer) == headerBuffer.size();
+    headerBuffer.resize(0);
+    return ok;
 }
-#endif
 
-bool BaseHttpRequestHandler::endHeader()
+void BaseHttpRequestHandler::finishHead()
 {
     if (closeConnection == Maybe) {
         closeConnection = No;
-        headerCache.append(QByteArray("Connection: keep-alive\r\n"));
+        headerBuffer.append("Connection: keep-alive\r\n");
+    }
+    headerBuffer.append("\r\n", 2);
+    // the status line is shared by the format cache, it is copied into the reserved buffer.
+    headerBuffer.prepend(statusLine);
+    statusLine.clear();
+}
+
+static bool containsHeaderLine(const QByteArray &block, const char *name)
+{
+    const int len = static_cast<int>(qstrlen(name));
+    int start = 0;
+    while (start < block.size()) {
+        int end = block.indexOf('\n', start);
+        if (end < 0) {
+            end = block.size();
+        }
+        if (end - start > len && block.at(start + len) == ':' && qstrnicmp(block.constData() + start, name, len) == 0) {
+            return true;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+QSharedPointer<HttpResponseWriter> BaseHttpRequestHandler::startBody(qint32 bufferSize)
+{
+    const bool discarding = method == QLatin1String("HEAD");
+    if (!request.dynamicCast<Http2StreamSocket>().isNull()) {
+        // the h2 frames carry the length.
+        if (!endHeader()) {
+            return QSharedPointer<HttpResponseWriter>();
+        }
+        return QSharedPointer<HttpResponseWriter>(
+                new HttpResponseWriter(request, QByteArray(), bufferSize, false, discarding));
+    }
+    bool chunked = false;
+    if (!discarding && !containsHeaderLine(headerBuffer, "content-length")) {
+        if (version >= Http1_1 && serverVersion >= Http1_1) {
+            // not by sendHeader(), which closes the connection for the chunked body of handlers.
+            headerBuffer.append("Transfer-Encoding: chunked\r\n");
+            chunked = true;
+        } else {
+            closeConnection = Yes;
+        }
+    }
+    finishHead();
+    QSharedPointer<HttpResponseWriter> writer(
+            new HttpResponseWriter(request, headerBuffer, bufferSize, chunked, discarding));
+    headerBuffer.resize(0);
+    return writer;
+}
+
+HttpResponseWriter::HttpResponseWriter(QSharedPointer<SocketLike> connection, const QByteArray &head,
+                                       qint32 bufferSize, bool chunked, bool discarding)
+    : connection(connection)
+    , count(0)
+    , bufferSize(qMax(1024, bufferSize))
+    , bodyStart(head.size())
+    , chunked(chunked)
+    , discarding(discarding)
+    , finished(false)
+    , broken(false)
+{
+    buffer.reserve(head.size() + this->bufferSize + 32);
+    buffer.append(head);
+}
+
+// put the size line before the pending body, so the buffer is ready to be sent.
+void HttpResponseWriter::frame()
+{
+    const int pending = buffer.size() - bodyStart;
+    if (chunked && pending > 0) {
+        buffer.insert(bodyStart, QByteArray::number(pending, 16).append("\r\n", 2));
+        buffer.append("\r\n", 2);
     }
-    headerCache.append("\r\n");
-    const QByteArray &data = join(headerCache);
-    headerCache.clear();
-    return request->sendall(data) == data.size();
+    bodyStart = buffer.size();
+}
+
+bool HttpResponseWriter::write(const char *data, qint32 size)
+{
+    if (finished || broken) {
+        return false;
+    }
+    if (size <= 0 || discarding) {
+        count += qMax(0, size);
+        return true;
+    }
+    count += size;
+    if (buffer.size() - bodyStart + size < bufferSize) {
+        buffer.append(data, size);
+        return true;
+    }
+    // the large block is not copied, but goes out with the buffer by one sendv().
+    frame();
+    if (chunked) {
+        buffer.append(QByteArray::number(size, 16)).append("\r\n", 2);
+    }
+    QList<QByteArray> parts;
+    parts.append(buffer);
+    parts.append(QByteArray::fromRawData(data, size));
+    qint32 total = buffer.size() + size;
+    if (chunked) {
+        parts.append(QByteArray::fromRawData("\r\n", 2));
+        total += 2;
+    }
+    broken = connection->sendv(parts) != total;
+    parts.clear();  // so the buffer is not detached, and keeps its capacity.
+    buffer.resize(0);
+    bodyStart = 0;
+    return !broken;
+}
+
+bool HttpResponseWriter::flush()
+{
+    if (broken) {
+        return false;
+    }
+    frame();
+    if (buffer.isEmpty()) {
+        return true;
+    }
+    broken = connection->sendall(buffer) != buffer.size();
+    buffer.resize(0);
+    bodyStart = 0;
+    return !broken;
+}
+
+bool HttpResponseWriter::finish()
+{
+    if (finished) {
+        return !broken;
+    }
+    finished = true;
+    if (broken) {
+        return false;
+    }
+    frame();
+    if (chunked) {
+        buffer.append("0\r\n\r\n", 5);
+        bodyStart = buffer.size();
+    }
+    return flush();
+}
+
+// tracks how much of the body is read, so the connection is closed if the handler leaves some of it.
+class RequestBodyFile : public FileLike
+{
+public:
+    RequestBodyFile(QSharedPointer<FileLike> backend, qint64 maxSize, QSharedPointer<SocketLike> continueTo)
+        : backend(backend)
+        , continueTo(continueTo)
+        , maxSize(maxSize)
+        , count(0)
+        , finished(false)
+        , broken(false)
+    {
+    }
+public:
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *, qint32) override { return -1; }
+    virtual void close() override { }
+    virtual qint64 size() override { return backend->size(); }
+public:
+    QSharedPointer<FileLike> backend;
+    QSharedPointer<SocketLike> continueTo;  // the client waits for 100 Continue before sending the body.
+    qint64 maxSize;
+    qint64 count;
+    bool finished;
+    bool broken;
+};
+
+qint32 RequestBodyFile::read(char *data, qint32 size)
+{
+    if (finished) {
+        return 0;
+    }
+    if (broken) {
+        return -1;
+    }
+    if (!continueTo.isNull()) {
+        const QByteArray line("HTTP/1.1 100 Continue\r\n\r\n");
+        bool ok = continueTo->sendall(line) == line.size();
+        continueTo.clear();
+        if (!ok) {
+            broken = true;
+            return -1;
+        }
+    }
+    qint32 bs = backend->read(data, size);
+    if (bs < 0) {
+        broken = true;
+        return -1;
+    } else if (bs == 0) {
+        finished = true;
+        return 0;
+    }
+    count += bs;
+    if (maxSize >= 0 && count > maxSize) {
+        // the decompressed body is too large.
+        broken = true;
+        return -1;
+    }
+    return bs;
 }
 
 QSharedPointer<FileLike> BaseHttpRequestHandler::bodyAsFile(bool processEncoding)
+{
+    // readall() can not read more than INT_MAX bytes.
+    return openBody(processEncoding, maxBodySize >= 0 ? maxBodySize : INT_MAX - 1);
+}
+
+QSharedPointer<FileLike> BaseHttpRequestHandler::bodyStream(qint64 maxSize)
+{
+    return openBody(true, maxSize);
+}
+
+#ifdef QTNG_HAVE_ZLIB
+// the buffered body is the whole body which is received already, so it is inflated at once. the streaming one reports
+// the errors of corrupted and too large bodies.
+static QSharedPointer<FileLike> decompressBody(QSharedPointer<FileLike> bodyFile, const QByteArray &bufferedBody,
+                                               qint64 maxSize)
+{
+    QByteArray decompressed;
+    if (!bufferedBody.isEmpty()
+        && qGzipDecompress(bufferedBody, &decompressed, static_cast<int>(qMin<qint64>(maxSize, INT_MAX - 1)))) {
+        return FileLike::bytes(decompressed);
+    }
+    return QSharedPointer<GzipDecompressFile>::create(bodyFile);
+}
+#endif
+
+QSharedPointer<FileLike> BaseHttpRequestHandler::openBody(bool processEncoding, qint64 maxSize)
 {
     qint64 contentLength = getContentLength();
 
     QSharedPointer<FileLike> bodyFile;
     if (contentLength >= 0) {
-        if (contentLength >= INT_MAX || (maxBodySize >= 0 && contentLength > maxBodySize)) {
+        if (maxSize >= 0 && contentLength > maxSize) {
             closeConnection = Yes;
             sendError(HttpStatus::RequestEntityTooLarge);
             return QSharedPointer<FileLike>();
@@ -377,15 +1020,25 @@ QSharedPointer<FileLike> BaseHttpRequestHandler::bodyAsFile(bool processEncoding
     } else {  // if (contentLength < 0) without `Content-Length` header.
         const QByteArray &transferEncodingHeader = header(QString::fromLatin1("Transfer-Encoding"));
         bool isChunked = (transferEncodingHeader.toLower() == QByteArray("chunked"));
-        if (isChunked && processEncoding) {
+        if (isChunked) {
+            // the framing is decoded even if the content encoding is kept.
             removeHeader(QString::fromLatin1("Transfer-Encoding"));
-            bodyFile = QSharedPointer<ChunkedBodyFile>::create(maxBodySize, body, request);
+            chunkedBody = QSharedPointer<ChunkedBodyFile>::create(maxSize, body, request);
+            bodyFile = chunkedBody;
+        } else if (version == Http2_0) {
+            // http2 streams are ended by END_STREAM.
+            bodyFile = QSharedPointer<PlainBodyFile>::create(-1, body, request);
         } else {
             // if the client does not send content length, it mean no content.
             // this is not the same as client side.
             bodyFile = FileLike::bytes(QByteArray());
         }
     }
+    const bool bodyBuffered = !body.isEmpty() && bodyFile.dynamicCast<PlainBodyFile>().isNull()
+            && bodyFile.dynamicCast<ChunkedBodyFile>().isNull();
+#ifdef QTNG_HAVE_ZLIB
+    const QByteArray bufferedBody = bodyBuffered ? body : QByteArray();
+#endif
     body.clear();
 
     if (processEncoding) {
@@ -395,11 +1048,11 @@ QSharedPointer<FileLike> BaseHttpRequestHandler::bodyAsFile(bool processEncoding
         if (contentEncodingHeader.toLower() == QByteArray("gzip")
             || contentEncodingHeader.toLower() == QByteArray("deflate")) {
             removeHeader(QString::fromLatin1("Content-Encoding"));
-            bodyFile = QSharedPointer<GzipDecompressFile>::create(bodyFile);
+            bodyFile = decompressBody(bodyFile, bufferedBody, maxSize);
         } else if (transferEncodingHeader.toLower() == QByteArray("gzip")
                    || transferEncodingHeader.toLower() == QByteArray("deflate")) {
             removeHeader(QString::fromLatin1("Transfer-Encoding"));
-            bodyFile = QSharedPointer<GzipDecompressFile>::create(bodyFile);
+            bodyFile = decompressBody(bodyFile, bufferedBody, maxSize);
         } else if (transferEncodingHeader.toLower() == QByteArray("qt")) {
             bool ok;
             const QByteArray &compBody = bodyFile->readall(&ok);
@@ -412,12 +1065,34 @@ QSharedPointer<FileLike> BaseHttpRequestHandler::bodyAsFile(bool processEncoding
             bodyFile = FileLike::bytes(decompBody);
         } else
 #endif
-                if (!contentEncodingHeader.isEmpty() || !transferEncodingHeader.isEmpty()) {
+                if (qIsContentCodingSupported(contentEncodingHeader.toLower())) {
+            // zstd and br, which are optional. the decoded size is limited by RequestBodyFile.
+            removeHeader(QString::fromLatin1("Content-Encoding"));
+            bodyFile = qContentDecoder(contentEncodingHeader.toLower(), bodyFile);
+        } else if (!contentEncodingHeader.isEmpty() || !transferEncodingHeader.isEmpty()) {
             qtng_warning << "unsupported content encoding." << contentEncodingHeader << transferEncodingHeader;
             closeConnection = Yes;
         }
     }
-    return bodyFile;
+
+    QSharedPointer<SocketLike> continueTo;
+    if (version == Http1_1 && !bodyBuffered && contentLength != 0
+        && header(QString::fromLatin1("Expect")).toLower() == QByteArray("100-continue")) {
+        continueTo = request;
+    }
+    bodyReader.reset(new RequestBodyFile(bodyFile, maxSize, continueTo));
+    return bodyReader;
+}
+
+bool BaseHttpRequestHandler::hasUnreadBody()
+{
+    if (version == Http2_0) {
+        return false;  // every stream has its own handler.
+    }
+    if (!bodyReader.isNull()) {
+        return !bodyReader->finished;
+    }
+    return getContentLength() > 0 || hasHeader(QString::fromLatin1("Transfer-Encoding"));
 }
 
 bool BaseHttpRequestHandler::readBody()
@@ -436,13 +1111,33 @@ QString BaseHttpRequestHandler::serverName()
     return QString::fromLatin1("QtNetworkNg");
 }
 
+QByteArray BaseHttpRequestHandler::serverNameBytes()
+{
+    if (serverNameCache.isNull()) {
+        serverNameCache = serverName().toUtf8();
+    }
+    return serverNameCache;
+}
+
 QString BaseHttpRequestHandler::dateTimeString()
 {
-    return QString::fromLatin1(toHttpDate(QDateTime::currentDateTimeUtc()));
+    // the http date has a resolution of one second.
+    HttpdFormatCache *cache = localFormatCache();
+    const qint64 now = EventLoopCoroutine::get()->wallNow();
+    if (cache->dateSecs != now / 1000) {
+        cache->dateSecs = now / 1000;
+        cache->date = QString::fromLatin1(toHttpDate(QDateTime::fromMSecsSinceEpoch(now, Qt::UTC)));
+    }
+    return cache->date;
 }
 
 void BaseHttpRequestHandler::logRequest(HttpStatus status, int bodySize)
 {
+    QSharedPointer<AccessLog> accessLog = server ? server->accessLog() : QSharedPointer<AccessLog>();
+    if (accessLog) {
+        accessLog->logRequest(request->peerAddress(), method, path, static_cast<int>(status), bodySize);
+        return;
+    }
     QString msg = QString::fromLatin1("%1 %2 %3 %4").arg(method).arg(path).arg(static_cast<int>(status)).arg(bodySize);
     msg = QString::fromLatin1("%1 -- %2 %3")
                   .arg(request->peerAddress().toString())
@@ -453,6 +1148,11 @@ void BaseHttpRequestHandler::logRequest(HttpStatus status, int bodySize)
 
 void BaseHttpRequestHandler::logError(HttpStatus status, const QString &shortMessage, const QString &)
 {
+    QSharedPointer<AccessLog> accessLog = server ? server->accessLog() : QSharedPointer<AccessLog>();
+    if (accessLog) {
+        accessLog->logError(request->peerAddress(), method, path, static_cast<int>(status), shortMessage);
+        return;
+    }
     QString msg =
             QString::fromLatin1("%1 %2 %3 %4").arg(method).arg(path).arg(static_cast<int>(status)).arg(shortMessage);
     msg = QString::fromLatin1("%1 -- %2 %3")
@@ -464,76 +1164,734 @@ void BaseHttpRequestHandler::logError(HttpStatus status, const QString &shortMes
 
 Q_GLOBAL_STATIC(QMimeDatabase, mimeDatabase);
 
-QSharedPointer<FileLike> StaticHttpRequestHandler::serveStaticFiles(const QDir &dir, const QString &subPath)
+namespace {
+
+struct FileRangePart
 {
-    QUrl url = QUrl::fromEncoded(subPath.toLatin1());
-    QFileInfo fileInfo = safeJoinPath(dir, url.path()).first;
-#ifdef DEBUG_HTTP_PROTOCOL
-    qtng_debug << "serve path" << subPath << "from" << fileInfo.absoluteFilePath();
-#endif
-    if (!fileInfo.exists() && !loadMissingFile(fileInfo)) {
-        sendError(HttpStatus::NotFound, QString::fromLatin1("File not found"));
-        return QSharedPointer<FileLike>();
+    QByteArray header;  // the boundary and headers of multipart/byteranges.
+    qint64 offset;
+    qint64 length;
+};
+
+// an opened static file, shared by the requests of one thread.
+struct StaticFile
+{
+    QFileInfo fileInfo;
+    QSharedPointer<QFile> file;
+    QByteArray contentType;
+    QByteArray etag;
+    QByteArray lastModified;
+    QSharedPointer<QFile> gzipFile;  // the .gz sibling, if it is newer than the file.
+    qint64 gzipSize;
+    qint64 gzipMtime;  // -1 if there is no sibling, -2 if not looked up.
+    qint64 size;
+    qint64 mtime;
+    qint64 checkedAt;
+    quint64 serial;
+};
+
+static const qint64 NoGzipFile = -1;
+static const qint64 GzipFileNotChecked = -2;
+static const qint64 MinCompressFileSize = 256;  // not worth the gzip header.
+static const qint64 MaxCompressFileSize = 1024 * 1024 * 4;  // compressed in memory.
+
+static qint64 gzipFileMtime(const QString &filePath)
+{
+    const QFileInfo gzipInfo(filePath + QLatin1String(".gz"));
+    return gzipInfo.isFile() ? gzipInfo.lastModified().toMSecsSinceEpoch() : NoGzipFile;
+}
+
+class StaticFileCache
+{
+public:
+    StaticFileCache()
+        : compressedSize(0)
+        , nextSerial(0)
+    {
     }
+public:
+    bool find(const QString &key, qint64 validMSecs, StaticFile *file);
+    void insert(const QString &key, StaticFile file, int capacity);
+    // the compressed files, keyed by path, etag and encoding.
+    bool findCompressed(const QByteArray &key, QByteArray *data);
+    void insertCompressed(const QByteArray &key, const QByteArray &data, qint64 capacity);
+private:
+    void remove(const QString &key);
+    void removeCompressed(const QByteArray &key);
+    QHash<QString, StaticFile> files;
+    QMap<quint64, QString> lru;
+    QHash<QByteArray, QPair<QByteArray, quint64>> compressed;
+    QMap<quint64, QByteArray> compressedLru;
+    qint64 compressedSize;
+    quint64 nextSerial;
+};
 
-    if (fileInfo.isDir()) {
-        const QString &p = url.path();
-        if (!p.endsWith(QLatin1String("/"))) {
-            url.setPath(p + QLatin1String("/"));
-            sendResponse(HttpStatus::MovedPermanently);
-            sendHeader("Location", url.toEncoded(QUrl::FullyEncoded));
-            endHeader();
-            return QSharedPointer<FileLike>();
-        } else {
-            QDir dir(fileInfo.filePath());
-            const QFileInfo &t = getIndexFile(dir);
-            if (t.isFile()) {
-                fileInfo = t;
-            } else if (enableDirectoryListing) {
-                return listDirectory(dir, p);
-            } else {
-                sendError(HttpStatus::NotFound, QString::fromLatin1("File Not Found"));
-                return QSharedPointer<FileLike>();
-            }
+// stat the file again if it is checked validMSecs ago, and drop it if changed.
+bool StaticFileCache::find(const QString &key, qint64 validMSecs, StaticFile *file)
+{
+    QHash<QString, StaticFile>::iterator itor = files.find(key);
+    if (itor == files.end()) {
+        return false;
+    }
+    StaticFile &f = itor.value();
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - f.checkedAt >= validMSecs) {
+        const QFileInfo fileInfo(f.fileInfo.filePath());
+        if (!fileInfo.isFile() || fileInfo.size() != f.size || fileInfo.lastModified().toMSecsSinceEpoch() != f.mtime
+            || (f.gzipMtime != GzipFileNotChecked && gzipFileMtime(fileInfo.filePath()) != f.gzipMtime)) {
+            remove(key);
+            return false;
         }
+        f.checkedAt = now;
+    }
+    lru.remove(f.serial);
+    f.serial = ++nextSerial;
+    lru.insert(f.serial, key);
+    *file = f;
+    return true;
+}
+
+void StaticFileCache::insert(const QString &key, StaticFile file, int capacity)
+{
+    remove(key);
+    while (!lru.isEmpty() && files.size() >= capacity) {
+        const QString oldest = lru.first();
+        remove(oldest);
+    }
+    file.checkedAt = QDateTime::currentMSecsSinceEpoch();
+    file.serial = ++nextSerial;
+    lru.insert(file.serial, key);
+    files.insert(key, file);
+}
+
+void StaticFileCache::remove(const QString &key)
+{
+    QHash<QString, StaticFile>::iterator itor = files.find(key);
+    if (itor == files.end()) {
+        return;
+    }
+    lru.remove(itor.value().serial);
+    // the requests using it hold their own references.
+    files.erase(itor);
+}
+
+bool StaticFileCache::findCompressed(const QByteArray &key, QByteArray *data)
+{
+    QHash<QByteArray, QPair<QByteArray, quint64>>::iterator itor = compressed.find(key);
+    if (itor == compressed.end()) {
+        return false;
+    }
+    compressedLru.remove(itor.value().second);
+    itor.value().second = ++nextSerial;
+    compressedLru.insert(itor.value().second, key);
+    *data = itor.value().first;
+    return true;
+}
+
+void StaticFileCache::insertCompressed(const QByteArray &key, const QByteArray &data, qint64 capacity)
+{
+    // a large file would flush all the others.
+    if (data.size() > capacity / 4) {
+        return;
+    }
+    removeCompressed(key);
+    while (!compressedLru.isEmpty() && compressedSize + data.size() > capacity) {
+        const QByteArray oldest = compressedLru.first();
+        removeCompressed(oldest);
     }
+    const quint64 serial = ++nextSerial;
+    compressed.insert(key, qMakePair(data, serial));
+    compressedLru.insert(serial, key);
+    compressedSize += data.size();
+}
 
-    QString contentType;
+void StaticFileCache::removeCompressed(const QByteArray &key)
+{
+    QHash<QByteArray, QPair<QByteArray, quint64>>::iterator itor = compressed.find(key);
+    if (itor == compressed.end()) {
+        return;
+    }
+    compressedLru.remove(itor.value().second);
+    compressedSize -= itor.value().first.size();
+    compressed.erase(itor);
+}
+
+}  // anonymous namespace
+
+Q_GLOBAL_STATIC(QThreadStorage<StaticFileCache *>, staticFileCaches)
+
+static StaticFileCache *localStaticFileCache()
+{
+    QThreadStorage<StaticFileCache *> *storage = staticFileCaches();
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(new StaticFileCache());
+    }
+    return storage->localData();
+}
 
+static QString guessContentType(const QFileInfo &fileInfo)
+{
 #ifdef Q_OS_ANDROID
     const QString &ext = fileInfo.completeSuffix().toLower();
     if (ext == QLatin1String("txt")) {
-        contentType = QString::fromLatin1("text/plain");
+        return QString::fromLatin1("text/plain");
     } else if (ext == QLatin1String("html") || ext == QLatin1String("htm")) {
-        contentType = QString::fromLatin1("text/html");
+        return QString::fromLatin1("text/html");
     } else if (ext == QLatin1String("js")) {
-        contentType = QString::fromLatin1("application/javascript");
+        return QString::fromLatin1("application/javascript");
     } else if (ext == QLatin1String("css")) {
-        contentType = QString::fromLatin1("text/css");
+        return QString::fromLatin1("text/css");
     } else {
-        contentType = QString::fromLatin1("application/octet-stream");
+        return QString::fromLatin1("application/octet-stream");
     }
 #else
     const QMimeType &ctype = mimeDatabase->mimeTypeForFile(fileInfo);
     if (!ctype.isValid()) {
-        contentType = QString::fromLatin1("application/octet-stream");
+        return QString::fromLatin1("application/octet-stream");
     } else {
-        contentType = ctype.name();
+        return ctype.name();
+    }
+#endif
+}
+
+static bool isCompressible(const QByteArray &contentType)
+{
+    return contentType.startsWith("text/") || contentType.endsWith("+xml") || contentType.endsWith("+json")
+            || contentType == "application/javascript" || contentType == "application/x-javascript"
+            || contentType == "application/json" || contentType == "application/xml";
+}
+
+// rfc 7231 section 5.3.4, the coding of the highest q is chosen, and the former of zstd, br, gzip and deflate if they
+// have the same q. zstd and br are chosen only if the client names them. returns empty for identity.
+static QByteArray negotiateEncoding(const QByteArray &acceptEncoding, bool gzipAvailable, bool canCompress)
+{
+    static const char * const codings[] = { "zstd", "br", "gzip", "deflate" };
+    const int codingCount = 4;
+    float qs[codingCount] = { -1.0f, -1.0f, -1.0f, -1.0f };
+    float anyQ = -1.0f;
+    for (const QByteArray &item : acceptEncoding.split(',')) {
+        const QList<QByteArray> &params = item.split(';');
+        QByteArray coding = params.first().trimmed().toLower();
+        float q = 1.0f;
+        for (int i = 1; i < params.size(); ++i) {
+            const QByteArray &param = params.at(i).trimmed();
+            if (param.startsWith("q=")) {
+                bool ok;
+                q = param.mid(2).toFloat(&ok);
+                if (!ok) {
+                    q = 0.0f;
+                }
+            }
+        }
+        if (coding == "x-gzip") {
+            coding = "gzip";
+        }
+        if (coding == "*") {
+            anyQ = q;
+        }
+        for (int i = 0; i < codingCount; ++i) {
+            if (coding == codings[i]) {
+                qs[i] = q;
+            }
+        }
+    }
+    int best = -1;
+    float bestQ = 0.0f;
+    for (int i = 0; i < codingCount; ++i) {
+        const QByteArray coding(codings[i]);
+        const bool named = qs[i] >= 0;
+        const float q = named ? qs[i] : (coding == "gzip" || coding == "deflate" ? anyQ : -1.0f);
+        const bool available = coding == "gzip" ? gzipAvailable : canCompress && qIsContentCodingSupported(coding);
+        if (available && q > bestQ) {
+            best = i;
+            bestQ = q;
+        }
     }
+    return best < 0 ? QByteArray() : QByteArray(codings[best]);
+}
+
+#ifdef QTNG_HAVE_ZLIB
+// compress the whole file in thread, returns empty if it is changed since opened.
+static QByteArray compressFile(const QString &filePath, qint64 expectedSize, const QByteArray &encoding)
+{
+    return callInThread<QByteArray>([filePath, expectedSize, encoding]() -> QByteArray {
+        QFile f(filePath);
+        if (!f.open(QIODevice::ReadOnly)) {
+            return QByteArray();
+        }
+        const QByteArray &data = f.readAll();
+        if (data.size() != expectedSize) {
+            return QByteArray();
+        }
+        QByteArray compressed;
+        bool ok;
+        if (encoding == "gzip") {
+            ok = qGzipCompress(FileLike::bytes(data), FileLike::bytes(&compressed));
+        } else if (encoding == "deflate") {
+            ok = qDeflateCompress(FileLike::bytes(data), FileLike::bytes(&compressed));
+        } else {
+            QSharedPointer<FileLike> encoder = qContentEncoder(encoding, FileLike::bytes(data));
+            ok = !encoder.isNull();
+            if (ok) {
+                compressed = encoder->readall(&ok);
+            }
+        }
+        return ok ? compressed : QByteArray();
+    });
+}
 #endif
-    QSharedPointer<QFile> f(new QFile(fileInfo.filePath()));
-    if (!f->open(QIODevice::ReadOnly)) {
-        sendError(HttpStatus::NotFound, QString::fromLatin1("File not found"));
+
+// the body of static file. it is readable as any file, or sent by sendTo() without copying the file data. the
+// position of file is set before every read, so the file can be shared by coroutines.
+class FileRangesBody : public FileLike
+{
+public:
+    FileRangesBody(QSharedPointer<RawFile> file, const QList<FileRangePart> &parts, const QByteArray &trailer,
+                   bool closeFile)
+        : file(file)
+        , parts(parts)
+        , trailer(trailer)
+        , partIndex(0)
+        , position(0)
+        , closeFile(closeFile)
+    {
+    }
+public:
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *data, qint32 size) override;
+    virtual void close() override
+    {
+        if (closeFile) {
+            file->close();
+        }
+    }
+    virtual qint64 size() override;
+    bool sendTo(QSharedPointer<SocketLike> socket);
+private:
+    QSharedPointer<RawFile> file;
+    QList<FileRangePart> parts;
+    QByteArray trailer;
+    int partIndex;
+    qint64 position;  // in the current part, the header is followed by the file data.
+    bool closeFile;  // false if the file is shared by the open file cache.
+};
+
+qint32 FileRangesBody::read(char *data, qint32 size)
+{
+    while (partIndex < parts.size()) {
+        const FileRangePart &part = parts.at(partIndex);
+        if (position < part.header.size()) {
+            const qint32 bs = static_cast<qint32>(qMin<qint64>(size, part.header.size() - position));
+            memcpy(data, part.header.constData() + position, static_cast<size_t>(bs));
+            position += bs;
+            return bs;
+        }
+        const qint64 done = position - part.header.size();
+        if (done < part.length) {
+            if (!file->seek(part.offset + done)) {
+                return -1;
+            }
+            const qint32 bs = file->read(data, static_cast<qint32>(qMin<qint64>(size, part.length - done)));
+            if (bs <= 0) {
+                return -1;
+            }
+            position += bs;
+            return bs;
+        }
+        ++partIndex;
+        position = 0;
+    }
+    if (position < trailer.size()) {
+        const qint32 bs = static_cast<qint32>(qMin<qint64>(size, trailer.size() - position));
+        memcpy(data, trailer.constData() + position, static_cast<size_t>(bs));
+        position += bs;
+        return bs;
+    }
+    return 0;
+}
+
+qint32 FileRangesBody::write(const char *, qint32)
+{
+    return -1;
+}
+
+qint64 FileRangesBody::size()
+{
+    qint64 total = trailer.size();
+    for (const FileRangePart &part : parts) {
+        total += part.header.size() + part.length;
+    }
+    return total;
+}
+
+bool FileRangesBody::sendTo(QSharedPointer<SocketLike> socket)
+{
+    for (const FileRangePart &part : parts) {
+        if (!part.header.isEmpty() && socket->sendall(part.header) != part.header.size()) {
+            return false;
+        }
+        if (!sendfile(file, socket, part.offset, part.length)) {
+            return false;
+        }
+    }
+    return trailer.isEmpty() || socket->sendall(trailer) == trailer.size();
+}
+
+// rfc 7233 section 2.1, returns false if the header is invalid and should be ignored. the unsatisfiable ranges are
+// skipped, so an empty list means 416.
+static bool parseByteRanges(const QByteArray &header, qint64 fileSize, QList<QPair<qint64, qint64>> *ranges)
+{
+    const int MaxRanges = 16;
+    const QByteArray &value = header.trimmed();
+    if (!value.startsWith("bytes=")) {
+        return false;
+    }
+    const QList<QByteArray> &specs = value.mid(6).split(',');
+    if (specs.size() > MaxRanges) {
+        return false;
+    }
+    for (const QByteArray &s : specs) {
+        const QByteArray &spec = s.trimmed();
+        const int dash = spec.indexOf('-');
+        if (dash < 0) {
+            return false;
+        }
+        const QByteArray &first = spec.left(dash).trimmed();
+        const QByteArray &last = spec.mid(dash + 1).trimmed();
+        bool ok;
+        qint64 start, end;
+        if (first.isEmpty()) {
+            const qint64 suffixLength = last.toLongLong(&ok);
+            if (!ok || suffixLength < 0) {
+                return false;
+            }
+            if (suffixLength == 0 || fileSize == 0) {
+                continue;
+            }
+            start = qMax<qint64>(0, fileSize - suffixLength);
+            end = fileSize - 1;
+        } else {
+            start = first.toLongLong(&ok);
+            if (!ok || start < 0) {
+                return false;
+            }
+            if (last.isEmpty()) {
+                end = fileSize - 1;
+            } else {
+                end = last.toLongLong(&ok);
+                if (!ok || end < start) {
+                    return false;
+                }
+                end = qMin(end, fileSize - 1);
+            }
+            if (start >= fileSize) {
+                continue;
+            }
+        }
+        // the overlapped ranges are a known way to amplify the response, refuse to serve them.
+        for (const QPair<qint64, qint64> &range : *ranges) {
+            if (start <= range.second && range.first <= end) {
+                return false;
+            }
+        }
+        ranges->append(qMakePair(start, end));
+    }
+    return true;
+}
+
+static bool matchETags(const QByteArray &header, const QByteArray &etag, bool weak)
+{
+    const QByteArray &opaque = etag.startsWith("W/") ? etag.mid(2) : etag;
+    for (const QByteArray &t : header.split(',')) {
+        const QByteArray &tag = t.trimmed();
+        if (tag == "*") {
+            return true;
+        }
+        if (tag.startsWith("W/")) {
+            if (weak && tag.mid(2) == opaque) {
+                return true;
+            }
+        } else if (tag == etag || (weak && tag == opaque)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void closeStaticFile(const StaticFile &file)
+{
+    file.file->close();
+    if (!file.gzipFile.isNull()) {
+        file.gzipFile->close();
+    }
+}
+
+QByteArray StaticHttpRequestHandler::makeETag(const QFileInfo &fileInfo)
+{
+    // the same as nginx, strong enough as long as the file is not changed twice in a second.
+    const qint64 mtime = fileInfo.lastModified().toMSecsSinceEpoch() / 1000;
+    return '"' + QByteArray::number(mtime, 16) + '-' + QByteArray::number(fileInfo.size(), 16) + '"';
+}
+
+// returns true if the 304 response is sent.
+bool StaticHttpRequestHandler::checkNotModified(const QFileInfo &fileInfo, const QByteArray &etag,
+                                                const QByteArray &lastModified)
+{
+    const QString &m = method.toUpper();
+    if (m != QLatin1String("GET") && m != QLatin1String("HEAD")) {
+        return false;
+    }
+    bool notModified = false;
+    const QByteArray &ifNoneMatch = header(QString::fromLatin1("If-None-Match"));
+    if (!ifNoneMatch.isEmpty()) {
+        notModified = matchETags(ifNoneMatch, etag, true);
+    } else {
+        const QDateTime &since = fromHttpDate(header(QString::fromLatin1("If-Modified-Since")));
+        notModified = since.isValid()
+                && fileInfo.lastModified().toMSecsSinceEpoch() / 1000 <= since.toMSecsSinceEpoch() / 1000;
+    }
+    if (!notModified) {
+        return false;
+    }
+    sendResponse(HttpStatus::NotModified);
+    sendHeader(QByteArray("ETag"), etag);
+    sendHeader(QByteArray("Last-Modified"), lastModified);
+    endHeader();
+    return true;
+}
+
+QSharedPointer<FileLike> StaticHttpRequestHandler::serveStaticFiles(const QDir &dir, const QString &subPath)
+{
+    QUrl url = QUrl::fromEncoded(subPath.toLatin1());
+    StaticFileCache *cache = openFileCacheSize > 0 ? localStaticFileCache() : nullptr;
+    const QString &cacheKey = cache ? dir.absolutePath() + QLatin1Char('\n') + url.path() : QString();
+    StaticFile file;
+    if (!cache || !cache->find(cacheKey, static_cast<qint64>(openFileCacheValid * 1000), &file)) {
+        QFileInfo fileInfo = safeJoinPath(dir, url.path()).first;
+#ifdef DEBUG_HTTP_PROTOCOL
+        qtng_debug << "serve path" << subPath << "from" << fileInfo.absoluteFilePath();
+#endif
+        if (!fileInfo.exists() && !loadMissingFile(fileInfo)) {
+            sendError(HttpStatus::NotFound, QString::fromLatin1("File not found"));
+            return QSharedPointer<FileLike>();
+        }
+
+        if (fileInfo.isDir()) {
+            const QString &p = url.path();
+            if (!p.endsWith(QLatin1String("/"))) {
+                url.setPath(p + QLatin1String("/"));
+                sendResponse(HttpStatus::MovedPermanently);
+                sendHeader("Location", url.toEncoded(QUrl::FullyEncoded));
+                endHeader();
+                return QSharedPointer<FileLike>();
+            } else {
+                QDir dir(fileInfo.filePath());
+                const QFileInfo &t = getIndexFile(dir);
+                if (t.isFile()) {
+                    fileInfo = t;
+                } else if (enableDirectoryListing) {
+                    return listDirectory(dir, p);
+                } else {
+                    sendError(HttpStatus::NotFound, QString::fromLatin1("File Not Found"));
+                    return QSharedPointer<FileLike>();
+                }
+            }
+        }
+
+        file.file.reset(new QFile(fileInfo.filePath()));
+        if (!file.file->open(QIODevice::ReadOnly)) {
+            sendError(HttpStatus::NotFound, QString::fromLatin1("File not found"));
+            return QSharedPointer<FileLike>();
+        }
+        file.fileInfo = fileInfo;
+        file.contentType = guessContentType(fileInfo).toUtf8();
+        file.etag = makeETag(fileInfo);
+        file.lastModified = toHttpDate(fileInfo.lastModified().toUTC());
+        file.size = file.file->size();
+        file.mtime = fileInfo.lastModified().toMSecsSinceEpoch();
+        file.gzipSize = 0;
+        file.gzipMtime = GzipFileNotChecked;
+        if (enableCompression && isCompressible(file.contentType)) {
+            file.gzipMtime = gzipFileMtime(fileInfo.filePath());
+            if (file.gzipMtime >= file.mtime) {
+                QSharedPointer<QFile> gzipFile(new QFile(fileInfo.filePath() + QLatin1String(".gz")));
+                if (gzipFile->open(QIODevice::ReadOnly)) {
+                    file.gzipFile = gzipFile;
+                    file.gzipSize = gzipFile->size();
+                }
+            }
+        }
+        if (cache) {
+            cache->insert(cacheKey, file, openFileCacheSize);
+        }
+    }
+    const QByteArray &lastModified = file.lastModified;
+    const qint64 fileSize = file.size;
+    // the cached file is shared by requests, it is never closed by them.
+    QSharedPointer<RawFile> rawFile = FileLike::rawFile(file.file).dynamicCast<RawFile>();
+    if (enableAsyncFileIO) {
+        rawFile->setAsync(true);
+    }
+
+    // the compressed variant has its own etag, so it is negotiated before the conditional requests. the ranges are
+    // always served from the identity.
+    const bool compressible = enableCompression && isCompressible(file.contentType);
+    QByteArray encoding;
+    if (compressible && fileSize >= MinCompressFileSize && header(QString::fromLatin1("Range")).isEmpty()) {
+#ifdef QTNG_HAVE_ZLIB
+        const bool canCompress = fileSize <= MaxCompressFileSize;
+#else
+        const bool canCompress = false;
+#endif
+        encoding = negotiateEncoding(header(QString::fromLatin1("Accept-Encoding")),
+                                     canCompress || !file.gzipFile.isNull(), canCompress);
+    }
+    QByteArray etag = file.etag;
+    if (!encoding.isEmpty() && etag.endsWith('"')) {
+        etag.chop(1);
+        etag.append('-').append(encoding).append('"');
+    }
+
+    if (checkNotModified(file.fileInfo, etag, lastModified)) {
+        if (!cache) {
+            closeStaticFile(file);
+        }
         return QSharedPointer<FileLike>();
     }
-    sendResponse(HttpStatus::OK);
-    sendHeader(QByteArray("Content-Type"), contentType.toUtf8());
-    sendHeader(QByteArray("Content-Length"), QByteArray::number(f->size()));
-    sendHeader(QByteArray("Last-Modified"), fileInfo.lastModified().toString(Qt::RFC2822Date).toUtf8());
+
+    if (!encoding.isEmpty()) {
+        QSharedPointer<FileLike> body;
+        qint64 bodySize;
+        if (encoding == "gzip" && !file.gzipFile.isNull()) {
+            FileRangePart part;
+            part.offset = 0;
+            part.length = file.gzipSize;
+            QSharedPointer<RawFile> gzipFile = FileLike::rawFile(file.gzipFile).dynamicCast<RawFile>();
+            if (enableAsyncFileIO) {
+                gzipFile->setAsync(true);
+            }
+            body.reset(new FileRangesBody(gzipFile, QList<FileRangePart>() << part, QByteArray(), !cache));
+            bodySize = file.gzipSize;
+            if (!cache) {
+                rawFile->close();
+            }
+        } else {
+#ifdef QTNG_HAVE_ZLIB
+            StaticFileCache *variants = compressionCacheSize > 0 ? localStaticFileCache() : nullptr;
+            const QByteArray &key = file.fileInfo.filePath().toUtf8() + '\n' + etag;
+            QByteArray data;
+            if (!variants || !variants->findCompressed(key, &data)) {
+                data = compressFile(file.fileInfo.filePath(), fileSize, encoding);
+                if (variants && !data.isEmpty()) {
+                    variants->insertCompressed(key, data, compressionCacheSize);
+                }
+            }
+            if (!cache) {
+                closeStaticFile(file);
+            }
+            if (data.isEmpty()) {
+                sendError(HttpStatus::InternalServerError);
+                return QSharedPointer<FileLike>();
+            }
+            body = FileLike::bytes(data);
+            bodySize = data.size();
+#else
+            Q_UNREACHABLE();
+#endif
+        }
+        sendResponse(HttpStatus::OK);
+        sendHeader(QByteArray("Content-Type"), file.contentType);
+        sendHeader(QByteArray("Content-Encoding"), encoding);
+        sendHeader(QByteArray("Content-Length"), QByteArray::number(bodySize));
+        sendHeader(QByteArray("Vary"), QByteArray("Accept-Encoding"));
+        sendHeader(QByteArray("ETag"), etag);
+        sendHeader(QByteArray("Last-Modified"), lastModified);
+        if (!endHeader()) {
+            body->close();
+            return QSharedPointer<FileLike>();
+        }
+        return body;
+    }
+
+    QList<QPair<qint64, qint64>> ranges;
+    bool useRanges = false;
+    const QByteArray &rangeHeader = header(QString::fromLatin1("Range"));
+    if (!rangeHeader.isEmpty() && method.toUpper() == QLatin1String("GET")) {
+        const QByteArray &ifRange = header(QString::fromLatin1("If-Range")).trimmed();
+        bool matched = true;
+        if (!ifRange.isEmpty()) {
+            if (ifRange.startsWith('"')) {
+                matched = (ifRange == etag);  // requires strong comparison.
+            } else {
+                matched = (fromHttpDate(ifRange) == fromHttpDate(lastModified));
+            }
+        }
+        useRanges = matched && parseByteRanges(rangeHeader, fileSize, &ranges);
+    }
+    if (useRanges && ranges.isEmpty()) {
+        if (!cache) {
+            closeStaticFile(file);
+        }
+        sendResponse(HttpStatus::RequestedRangeNotSatisfiable);
+        sendHeader(QByteArray("Content-Range"), "bytes */" + QByteArray::number(fileSize));
+        sendHeader(QByteArray("Content-Length"), QByteArray("0"));
+        endHeader();
+        return QSharedPointer<FileLike>();
+    }
+
+    QList<FileRangePart> parts;
+    QByteArray trailer;
+    if (!useRanges) {
+        FileRangePart part;
+        part.offset = 0;
+        part.length = fileSize;
+        parts.append(part);
+        sendResponse(HttpStatus::OK);
+        sendHeader(QByteArray("Content-Type"), file.contentType);
+    } else if (ranges.size() == 1) {
+        FileRangePart part;
+        part.offset = ranges.first().first;
+        part.length = ranges.first().second - part.offset + 1;
+        parts.append(part);
+        sendResponse(HttpStatus::PartialContent);
+        sendHeader(QByteArray("Content-Type"), file.contentType);
+        sendHeader(QByteArray("Content-Range"),
+                   "bytes " + QByteArray::number(ranges.first().first) + '-' + QByteArray::number(ranges.first().second)
+                           + '/' + QByteArray::number(fileSize));
+    } else {
+        const QByteArray &boundary =
+                QCryptographicHash::hash(etag + QByteArray::number(QDateTime::currentMSecsSinceEpoch()),
+                                         QCryptographicHash::Md5)
+                        .toHex();
+        for (int i = 0; i < ranges.size(); ++i) {
+            FileRangePart part;
+            part.offset = ranges.at(i).first;
+            part.length = ranges.at(i).second - part.offset + 1;
+            part.header = (i == 0 ? QByteArray() : QByteArray("\r\n")) + "--" + boundary + "\r\nContent-Type: "
+                    + file.contentType + "\r\nContent-Range: bytes " + QByteArray::number(ranges.at(i).first) + '-'
+                    + QByteArray::number(ranges.at(i).second) + '/' + QByteArray::number(fileSize) + "\r\n\r\n";
+            parts.append(part);
+        }
+        trailer = "\r\n--" + boundary + "--\r\n";
+        sendResponse(HttpStatus::PartialContent);
+        sendHeader(QByteArray("Content-Type"), "multipart/byteranges; boundary=" + boundary);
+    }
+    if (!cache && !file.gzipFile.isNull()) {
+        file.gzipFile->close();
+    }
+    QSharedPointer<FileRangesBody> body(new FileRangesBody(rawFile, parts, trailer, !cache));
+    sendHeader(QByteArray("Content-Length"), QByteArray::number(body->size()));
+    sendHeader(QByteArray("Accept-Ranges"), QByteArray("bytes"));
+    if (compressible) {
+        sendHeader(QByteArray("Vary"), QByteArray("Accept-Encoding"));
+    }
+    sendHeader(QByteArray("ETag"), etag);
+    sendHeader(QByteArray("Last-Modified"), lastModified);
     if (!endHeader()) {
+        body->close();
         return QSharedPointer<FileLike>();
     }
-    return FileLike::rawFile(f);
+    return body;
 }
 
 QSharedPointer<FileLike> StaticHttpRequestHandler::listDirectory(const QDir &dir, const QString &displayDir)
@@ -594,7 +1952,8 @@ void SimpleHttpRequestHandler::doGET()
 {
     QSharedPointer<FileLike> f = serveStaticFiles(rootDir, path);
     if (!f.isNull()) {
-        if (!sendfile(f, request)) {
+        QSharedPointer<FileRangesBody> ranges = f.dynamicCast<FileRangesBody>();
+        if (!(ranges.isNull() ? sendfile(f, request) : ranges->sendTo(request))) {
             request->close();
         }
         f->close();
@@ -609,4 +1968,34 @@ void SimpleHttpRequestHandler::doHEAD()
     }
 }
 
+QByteArray MetricsHttpRequestHandler::makeMetrics()
+{
+    QByteArray data;
+    data.reserve(16 * 1024);
+    MetricsRegistry::instance()->writeTo(&data);
+    writeEventLoopMetrics(&data);
+    return data;
+}
+
+void MetricsHttpRequestHandler::doGET()
+{
+    const QByteArray &data = makeMetrics();
+    sendResponse(HttpStatus::OK);
+    sendHeader(QByteArray("Content-Type"), QByteArray("text/plain; version=0.0.4; charset=utf-8"));
+    sendHeader(QByteArray("Content-Length"), QByteArray::number(data.size()));
+    if (!endHeader()) {
+        return;
+    }
+    if (request->sendall(data) != data.size()) {
+        request->close();
+    }
+}
+
+void MetricsHttpRequestHandler::doHEAD()
+{
+    sendResponse(HttpStatus::OK);
+    sendHeader(QByteArray("Content-Type"), QByteArray("text/plain; version=0.0.4; charset=utf-8"));
+    endHeader();
+}
+
 QTNETWORKNG_NAMESPACE_END
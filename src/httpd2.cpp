@@ -1,8 +1,171 @@
+#include <QtCore/qmutex.h>
+#include <QtCore/qthread.h>
 #include "../include/httpd.h"
 #include "../include/http.h"
+#include "../include/access_log.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
+struct IdleUpstreamConnection
+{
+    QSharedPointer<SocketLike> connection;
+    qint64 since;  // msecs since epoch.
+};
+
+class HttpProxyUpstreamPoolPrivate
+{
+public:
+    HttpProxyUpstreamPoolPrivate()
+        : maxIdlePerHost(8)
+        , idleTimeout(30.0f)
+    {
+    }
+    static QString keyOf(const QString &hostName, quint16 port)
+    {
+        // the connections are watched by the eventloop of their thread.
+        return QString::fromLatin1("%1:%2@%3")
+                .arg(hostName.toLower())
+                .arg(port)
+                .arg(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+    }
+public:
+    QMutex mutex;
+    QHash<QString, QList<IdleUpstreamConnection>> idle;
+    int maxIdlePerHost;
+    float idleTimeout;
+};
+
+HttpProxyUpstreamPool::HttpProxyUpstreamPool()
+    : d_ptr(new HttpProxyUpstreamPoolPrivate())
+{
+}
+
+HttpProxyUpstreamPool::~HttpProxyUpstreamPool()
+{
+    delete d_ptr;
+}
+
+static bool isIdleUpstreamConnected(QSharedPointer<SocketLike> connection)
+{
+    if (!connection->isValid()) {
+        return false;
+    }
+    QSharedPointer<Socket> rawSocket = convertSocketLikeToSocket(connection);
+    // other connections can not be probed, find it out while sending request.
+    return rawSocket.isNull() || rawSocket->isIdleConnected();
+}
+
+QSharedPointer<SocketLike> HttpProxyUpstreamPool::take(const QString &hostName, quint16 port)
+{
+    Q_D(HttpProxyUpstreamPool);
+    const QString &key = HttpProxyUpstreamPoolPrivate::keyOf(hostName, port);
+    const qint64 expired = QDateTime::currentMSecsSinceEpoch() - static_cast<qint64>(d->idleTimeout * 1000);
+    QList<IdleUpstreamConnection> dropped;  // closed outside the lock.
+    QSharedPointer<SocketLike> found;
+    {
+        QMutexLocker locker(&d->mutex);
+        QHash<QString, QList<IdleUpstreamConnection>>::iterator itor = d->idle.find(key);
+        if (itor == d->idle.end()) {
+            return found;
+        }
+        // the most recently used connection is the most likely one to be alive.
+        while (!itor->isEmpty()) {
+            IdleUpstreamConnection c = itor->takeLast();
+            if (c.since >= expired && isIdleUpstreamConnected(c.connection)) {
+                found = c.connection;
+                break;
+            }
+            dropped.append(c);
+        }
+        if (itor->isEmpty()) {
+            d->idle.erase(itor);
+        }
+    }
+    return found;
+}
+
+void HttpProxyUpstreamPool::release(const QString &hostName, quint16 port, QSharedPointer<SocketLike> connection)
+{
+    Q_D(HttpProxyUpstreamPool);
+    if (connection.isNull() || !connection->isValid()) {
+        return;
+    }
+    const QString &key = HttpProxyUpstreamPoolPrivate::keyOf(hostName, port);
+    IdleUpstreamConnection c;
+    c.connection = connection;
+    c.since = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker locker(&d->mutex);
+    QList<IdleUpstreamConnection> &connections = d->idle[key];
+    if (connections.size() < d->maxIdlePerHost) {
+        connections.append(c);
+    }
+}
+
+void HttpProxyUpstreamPool::clear()
+{
+    Q_D(HttpProxyUpstreamPool);
+    QHash<QString, QList<IdleUpstreamConnection>> dropped;
+    QMutexLocker locker(&d->mutex);
+    dropped.swap(d->idle);
+}
+
+int HttpProxyUpstreamPool::maxIdlePerHost() const
+{
+    Q_D(const HttpProxyUpstreamPool);
+    return d->maxIdlePerHost;
+}
+
+void HttpProxyUpstreamPool::setMaxIdlePerHost(int maxIdlePerHost)
+{
+    Q_D(HttpProxyUpstreamPool);
+    d->maxIdlePerHost = qMax(0, maxIdlePerHost);
+}
+
+float HttpProxyUpstreamPool::idleTimeout() const
+{
+    Q_D(const HttpProxyUpstreamPool);
+    return d->idleTimeout;
+}
+
+void HttpProxyUpstreamPool::setIdleTimeout(float idleTimeout)
+{
+    Q_D(HttpProxyUpstreamPool);
+    d->idleTimeout = idleTimeout;
+}
+
+// the headers of rfc 7230 6.1 and the options named by Connection are meant for one hop, and the Proxy-* headers for
+// this proxy. Transfer-Encoding is dropped with the chunked framing decoded by bodyAsFile().
+static QList<QByteArray> connectionOptions(const QByteArray &connectionHeader)
+{
+    QList<QByteArray> options;
+    for (const QByteArray &option : connectionHeader.split(',')) {
+        const QByteArray &trimmed = option.trimmed();
+        if (!trimmed.isEmpty()) {
+            options.append(trimmed);
+        }
+    }
+    return options;
+}
+
+static bool isHopByHopHeader(const QString &name, const QList<QByteArray> &options)
+{
+    static const QString connectionName = toString(KnownHeader::ConnectionHeader);
+    static const QString upgradeName = toString(KnownHeader::UpgradeHeader);
+    if (name.compare(connectionName, Qt::CaseInsensitive) == 0 || name.compare(upgradeName, Qt::CaseInsensitive) == 0
+        || name.startsWith(QLatin1String("Proxy-"), Qt::CaseInsensitive)
+        || name.compare(QLatin1String("Keep-Alive"), Qt::CaseInsensitive) == 0
+        || name.compare(QLatin1String("TE"), Qt::CaseInsensitive) == 0
+        || name.compare(QLatin1String("Trailer"), Qt::CaseInsensitive) == 0) {
+        return true;
+    }
+    for (const QByteArray &option : options) {
+        if (name.compare(QLatin1String(option), Qt::CaseInsensitive) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void BaseHttpProxyRequestHandler::logRequest(qtng::HttpStatus, int) { }
 
 void BaseHttpProxyRequestHandler::logError(qtng::HttpStatus, const QString &, const QString &) { }
@@ -76,8 +239,24 @@ void BaseHttpProxyRequestHandler::doProxy()
         return;
     }
     port = static_cast<quint16>(t);
+
+    // only the requests without body are sent over idle connections, as they can be sent again if the connection was
+    // closed by upstream server.
+    HttpProxyUpstreamPool *pool = upstreamPool();
+    const bool bodyless = getContentLength() <= 0 && !hasHeader(KnownHeader::TransferEncodingHeader);
     HostAddress forwardAddress;
-    QSharedPointer<SocketLike> forward = makeConnection(host, port, &forwardAddress);
+    QSharedPointer<SocketLike> forward;
+    bool reused = false;
+    if (pool && bodyless) {
+        forward = pool->take(host, port);
+        reused = !forward.isNull();
+        if (reused) {
+            forwardAddress = forward->peerAddress();
+        }
+    }
+    if (forward.isNull()) {
+        forward = makeConnection(host, port, &forwardAddress);
+    }
     if (forward.isNull()) {
         sendError(HttpStatus::BadGateway, QString::fromLatin1("Can not connect to remote host."));
         logProxy(host, port, HostAddress(), false);
@@ -87,28 +266,41 @@ void BaseHttpProxyRequestHandler::doProxy()
     HttpRequest newRequest;
     newRequest.setUrl(this->path);
     newRequest.setMethod(method);
-    newRequest.setVersion(this->version);
+    // the upstream connection is kept alive regardless of the client.
+    newRequest.setVersion(pool ? Http1_1 : this->version);
     newRequest.useConnection(forward);
     newRequest.setStreamResponse(true);
     newRequest.disableRedirects();
-    // ignore transfer-encoding and content-encoding header, pass it to remote host.
+    // the content encoding is passed to remote host, and the body is read while sending. the chunked body is decoded
+    // here and encoded again by the session.
     QSharedPointer<FileLike> bodyFile = bodyAsFile(false);
     if (bodyFile.isNull()) {
         return;
     }
     newRequest.setBody(bodyFile);
 
+    const QList<QByteArray> &requestOptions = connectionOptions(header(KnownHeader::ConnectionHeader));
     for (const HttpHeader &header : allHeaders()) {
-        const QString &hn = header.name.toLower();
-        if (hn.startsWith(QLatin1String("proxy-")) || hn == QLatin1String("connection")) {
-            continue;
+        if (!isHopByHopHeader(header.name, requestOptions)) {
+            newRequest.addHeader(header);
         }
-        newRequest.addHeader(header);
     }
 
     QSharedPointer<HttpResponse> response = sendRequest(newRequest);
+    if (reused && (!response || (!response->isOk() && !response->hasHttpError()))) {
+        // the idle connection is closed by upstream server, try a new one.
+        forward = makeConnection(host, port, &forwardAddress);
+        if (forward.isNull()) {
+            sendError(HttpStatus::BadGateway, QString::fromLatin1("Can not connect to remote host."));
+            logProxy(host, port, HostAddress(), false);
+            return;
+        }
+        newRequest.useConnection(forward);
+        response = sendRequest(newRequest);
+    }
     if (!response || (!response->isOk() && !response->hasHttpError())) {
-        sendError(HttpStatus::BadGateway, response->error()->what());
+        sendError(HttpStatus::BadGateway,
+                  response ? response->error()->what() : QString::fromLatin1("Can not send request to remote host."));
         logProxy(host, port, forwardAddress, false);
         return;
     }
@@ -116,28 +308,75 @@ void BaseHttpProxyRequestHandler::doProxy()
     logProxy(host, port, forwardAddress, true);
     sendCommandLine(static_cast<HttpStatus>(response->statusCode()), response->statusText());
 
+    const bool isHead = method.compare(QLatin1String("HEAD"), Qt::CaseInsensitive) == 0;
+    const int statusCode = response->statusCode();
+    const bool noBody = isHead || statusCode == 204 || statusCode == 304 || (statusCode >= 100 && statusCode < 200);
+    const bool chunked = !noBody && response->getContentLength() < 0
+            && response->header(KnownHeader::TransferEncodingHeader).toLower() == "chunked";
+    // the body is delimited, so both the client and upstream connection can be kept.
+    const bool delimited = noBody || chunked || response->getContentLength() >= 0;
+    if (!delimited) {
+        closeConnection = Yes;
+    }
+    // opened before the headers are relayed, so Transfer-Encoding is removed for the decoded chunks.
+    QSharedPointer<FileLike> f = noBody ? QSharedPointer<FileLike>() : response->bodyAsFile(false);
+    const QList<QByteArray> &responseOptions = connectionOptions(response->header(KnownHeader::ConnectionHeader));
     for (const HttpHeader &header : response->allHeaders()) {
-        const QString &hn = header.name.toLower();
-        if (hn.startsWith(QLatin1String("proxy-")) || hn == QLatin1String("connection")) {
-            continue;
+        if (!isHopByHopHeader(header.name, responseOptions)) {
+            sendHeader(header.name.toUtf8(), header.value);
         }
-        sendHeader(header.name.toUtf8(), header.value);
-    }
-    if (!endHeader()) {
-        return;
     }
-    if (method.toUpper() != QString::fromLatin1("HEAD")) {
-        QSharedPointer<FileLike> f = response->bodyAsFile(false);
+    if (chunked) {
+        // every chunk is relayed as soon as it arrives, such as the events streamed by upstream server.
+        QSharedPointer<HttpResponseWriter> writer = startBody();
+        bool ok = !writer.isNull() && !f.isNull();
+        QByteArray buf(1024 * 16, Qt::Uninitialized);
+        while (ok) {
+            const qint32 bs = f->read(buf.data(), buf.size());
+            if (bs <= 0) {
+                ok = bs == 0 && writer->finish();
+                break;
+            }
+            ok = writer->write(buf.constData(), bs) && writer->flush();
+        }
+        if (!ok) {
+            closeConnection = Yes;
+            this->request->close();
+            return;
+        }
+    } else {
+        if (!endHeader()) {
+            return;
+        }
         if (!f.isNull() && !sendfile(f, this->request)) {
             closeConnection = Yes;
             this->request->close();
+            return;
+        }
+    }
+    if (pool && delimited) {
+        const QByteArray &connectionHeader = response->header(KnownHeader::ConnectionHeader).toLower();
+        const bool keepingAlive = response->version() == Http1_0 ? connectionHeader == "keep-alive"
+                                                                 : connectionHeader != "close";
+        if (keepingAlive && forward->isValid()) {
+            pool->release(host, port, forward);
         }
     }
 }
 
+HttpProxyUpstreamPool *BaseHttpProxyRequestHandler::upstreamPool()
+{
+    return nullptr;
+}
+
 void BaseHttpProxyRequestHandler::logProxy(const QString &remoteHostName, quint16 remotePort,
                                            const HostAddress &forwardAddress, bool success)
 {
+    QSharedPointer<AccessLog> accessLog = server ? server->accessLog() : QSharedPointer<AccessLog>();
+    if (accessLog) {
+        accessLog->logProxy(request->peerAddress(), method, remoteHostName, remotePort, forwardAddress, success);
+        return;
+    }
     QString successStr;
     if (success) {
         successStr = QString::fromLatin1("SUCC");
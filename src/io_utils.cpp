@@ -1,14 +1,21 @@
+#include <string.h>
 #include <QtCore/qdir.h>
 #include <QtCore/qdatetime.h>
+#include <QtCore/qthreadstorage.h>
 #ifdef Q_OS_UNIX
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #ifdef Q_OS_ANDROID
 #include <errno.h>
 #endif
 #endif
 #include "../include/io_utils.h"
+#include "../include/socket_utils.h"
 #include "../include/coroutine_utils.h"
+#ifndef QTNG_NO_CRYPTO
+#  include "../include/ssl.h"
+#endif
 #include "debugger.h"
 
 QTNG_LOGGER("qtng.io_utils");
@@ -65,6 +72,9 @@ qint32 FileLike::write(const QByteArray &data)
 
 qint32 RawFile::read(char *data, qint32 size)
 {
+    if (!pool.isNull()) {
+        return asyncRead(data, size);
+    }
 #ifdef Q_OS_UNIX
     int fd = f->handle();
     if (fd <= 0) {
@@ -103,6 +113,9 @@ qint32 RawFile::read(char *data, qint32 size)
 
 qint32 RawFile::write(const char *data, qint32 size)
 {
+    if (!pool.isNull()) {
+        return asyncWrite(data, size);
+    }
 #ifdef Q_OS_UNIX
     int fd = f->handle();
     if (fd <= 0) {
@@ -166,11 +179,134 @@ bool RawFile::seek(qint64 pos)
 #endif
 }
 
+qint64 RawFile::pos() const
+{
+#ifdef Q_OS_UNIX
+    int fd = f->handle();
+    if (fd <= 0) {
+        return -1;
+    }
+#if defined(_LARGEFILE64_SOURCE)
+    return ::lseek64(fd, 0, SEEK_CUR);
+#else
+    return ::lseek(fd, 0, SEEK_CUR);
+#endif
+#else
+    return f->pos();
+#endif
+}
+
 QString RawFile::fileName() const
 {
     return f->fileName();
 }
 
+// the thread never touches the buffer of caller, which is gone if the coroutine is killed while waiting.
+qint32 RawFile::asyncRead(char *data, qint32 size)
+{
+    if (size <= 0) {
+        return 0;
+    }
+    QSharedPointer<QFile> f = this->f;
+    QSharedPointer<QByteArray> buf(new QByteArray(size, Qt::Uninitialized));
+    QSharedPointer<qint64> result(new qint64(-1));
+#ifdef Q_OS_UNIX
+    const int fd = f->handle();
+    if (fd <= 0) {
+        return -1;
+    }
+    const qint64 offset = pos();
+    if (offset < 0) {
+        // pipes and sockets are not seekable, but they can be watched by the event loop.
+        QSharedPointer<ThreadPool> pool;
+        qSwap(pool, this->pool);
+        const qint32 r = read(data, size);
+        qSwap(pool, this->pool);
+        return r;
+    }
+    pool->call([f, fd, offset, buf, result] {
+        ssize_t r = 0;
+        do {
+            r = ::pread(fd, buf->data(), static_cast<size_t>(buf->size()), static_cast<off_t>(offset));
+        } while (r < 0 && errno == EINTR);
+        *result = r;
+    });
+    if (*result > 0) {
+        seek(offset + *result);
+    }
+#else
+    pool->call([f, buf, result] { *result = f->read(buf->data(), buf->size()); });
+#endif
+    if (*result > 0) {
+        memcpy(data, buf->constData(), static_cast<size_t>(*result));
+    }
+    return static_cast<qint32>(*result);
+}
+
+qint32 RawFile::asyncWrite(const char *data, qint32 size)
+{
+    if (size <= 0) {
+        return 0;
+    }
+    QSharedPointer<QFile> f = this->f;
+    const QByteArray buf(data, size);
+    QSharedPointer<qint64> result(new qint64(-1));
+#ifdef Q_OS_UNIX
+    const int fd = f->handle();
+    if (fd <= 0) {
+        return -1;
+    }
+    const qint64 offset = pos();
+    if (offset < 0) {
+        QSharedPointer<ThreadPool> pool;
+        qSwap(pool, this->pool);
+        const qint32 r = write(data, size);
+        qSwap(pool, this->pool);
+        return r;
+    }
+    pool->call([f, fd, offset, buf, result] {
+        ssize_t r = 0;
+        do {
+            r = ::pwrite(fd, buf.constData(), static_cast<size_t>(buf.size()), static_cast<off_t>(offset));
+        } while (r < 0 && errno == EINTR);
+        *result = r;
+    });
+    if (*result > 0) {
+        seek(offset + *result);
+    }
+#else
+    pool->call([f, buf, result] { *result = f->write(buf); });
+#endif
+    return static_cast<qint32>(*result);
+}
+
+void RawFile::setAsync(bool async, QSharedPointer<ThreadPool> pool)
+{
+    if (!async) {
+        this->pool.clear();
+    } else if (pool.isNull()) {
+        this->pool = ioThreadPool();
+    } else {
+        this->pool = pool;
+    }
+}
+
+// ThreadPool waits by the Semaphore of coroutines, so every thread has its own pool.
+Q_GLOBAL_STATIC(QThreadStorage<QSharedPointer<ThreadPool>>, localIoThreadPools)
+
+QSharedPointer<ThreadPool> RawFile::ioThreadPool()
+{
+    const int IoThreads = 4;
+    QThreadStorage<QSharedPointer<ThreadPool>> *storage = localIoThreadPools();
+    if (!storage) {
+        return QSharedPointer<ThreadPool>(new ThreadPool(IoThreads));
+    }
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(QSharedPointer<ThreadPool>(new ThreadPool(IoThreads)));
+    }
+    return storage->localData();
+}
+
 static inline bool isTheMode(const QString &mode, const QString &essential)
 {
     QString t = mode;
@@ -258,6 +394,13 @@ QSharedPointer<FileLike> FileLike::rawFile(QSharedPointer<QFile> f)
     return QSharedPointer<RawFile>::create(f).dynamicCast<FileLike>();
 }
 
+QSharedPointer<FileLike> FileLike::asyncFile(QSharedPointer<QFile> f)
+{
+    QSharedPointer<RawFile> file = QSharedPointer<RawFile>::create(f);
+    file->setAsync(true);
+    return file.staticCast<FileLike>();
+}
+
 QSharedPointer<FileLike> FileLike::open(const QString &filepath, const QString &mode)
 {
     return RawFile::open(filepath, mode).staticCast<FileLike>();
@@ -368,12 +511,409 @@ QSharedPointer<FileLike> FileLike::bytes(QByteArray *data)
     return QSharedPointer<BytesIO>::create(data);
 }
 
-bool sendfile(QSharedPointer<FileLike> inputFile, QSharedPointer<FileLike> outputFile, qint64 bytesToCopy,
-              int suitableBlockSize)
+class SegmentedBytesIOPrivate
 {
-    if (inputFile.isNull() || outputFile.isNull()) {
+public:
+    SegmentedBytesIOPrivate(qint32 chunkSize)
+        : chunkSize(qMax(chunkSize, 64))
+        , total(0)
+        , headPos(0)
+        , tailWritable(false)
+    {
+    }
+    void removeFront(qint32 size);
+public:
+    QList<QByteArray> chunks;
+    qint32 chunkSize;
+    qint64 total;  // the bytes of chunks, including the read bytes of first chunk.
+    qint32 headPos;  // the read bytes of first chunk.
+    bool tailWritable;  // the last chunk is made by write(), not by append().
+};
+
+void SegmentedBytesIOPrivate::removeFront(qint32 size)
+{
+    headPos += size;
+    if (headPos >= chunks.first().size()) {
+        total -= chunks.first().size();
+        chunks.removeFirst();
+        headPos = 0;
+        if (chunks.isEmpty()) {
+            tailWritable = false;
+        }
+    }
+}
+
+SegmentedBytesIO::SegmentedBytesIO(qint32 chunkSize)
+    : d_ptr(new SegmentedBytesIOPrivate(chunkSize))
+{
+}
+
+SegmentedBytesIO::~SegmentedBytesIO()
+{
+    delete d_ptr;
+}
+
+qint32 SegmentedBytesIO::read(char *data, qint32 size)
+{
+    Q_D(SegmentedBytesIO);
+    qint32 readBytes = 0;
+    while (readBytes < size && !d->chunks.isEmpty()) {
+        const QByteArray &chunk = d->chunks.first();
+        const qint32 bs = qMin(size - readBytes, chunk.size() - d->headPos);
+        memcpy(data + readBytes, chunk.constData() + d->headPos, static_cast<size_t>(bs));
+        readBytes += bs;
+        d->removeFront(bs);
+    }
+    return readBytes;
+}
+
+qint32 SegmentedBytesIO::write(const char *data, qint32 size)
+{
+    Q_D(SegmentedBytesIO);
+    if (size <= 0) {
+        return 0;
+    }
+    qint32 written = 0;
+    if (d->tailWritable) {
+        QByteArray &tail = d->chunks.last();
+        const qint32 bs = qMin(size, d->chunkSize - tail.size());
+        if (bs > 0) {
+            tail.append(data, bs);
+            written = bs;
+        }
+    }
+    if (written < size) {
+        // a large write is kept in one segment.
+        QByteArray chunk;
+        chunk.reserve(qMax(d->chunkSize, size - written));
+        chunk.append(data + written, size - written);
+        d->chunks.append(chunk);
+        d->tailWritable = true;
+    }
+    d->total += size;
+    return size;
+}
+
+void SegmentedBytesIO::close() { }
+
+qint64 SegmentedBytesIO::size()
+{
+    Q_D(SegmentedBytesIO);
+    return d->total - d->headPos;
+}
+
+QByteArray SegmentedBytesIO::readall(bool *ok)
+{
+    Q_D(SegmentedBytesIO);
+    QByteArray data;
+    if (d->total - d->headPos >= static_cast<qint64>(INT32_MAX)) {
+        if (ok)
+            *ok = false;
+        return data;
+    }
+    if (ok)
+        *ok = true;
+    if (d->chunks.size() == 1 && d->headPos == 0) {
+        data = d->chunks.first();
+    } else {
+        data.reserve(static_cast<qint32>(d->total - d->headPos));
+        for (int i = 0; i < d->chunks.size(); ++i) {
+            const QByteArray &chunk = d->chunks.at(i);
+            const qint32 start = i == 0 ? d->headPos : 0;
+            data.append(chunk.constData() + start, chunk.size() - start);
+        }
+    }
+    d->chunks.clear();
+    d->total = 0;
+    d->headPos = 0;
+    d->tailWritable = false;
+    return data;
+}
+
+void SegmentedBytesIO::append(const QByteArray &data)
+{
+    Q_D(SegmentedBytesIO);
+    if (data.isEmpty()) {
+        return;
+    }
+    d->chunks.append(data);
+    d->total += data.size();
+    d->tailWritable = false;
+}
+
+qint64 SegmentedBytesIO::skip(qint64 size)
+{
+    Q_D(SegmentedBytesIO);
+    qint64 skipped = 0;
+    while (skipped < size && !d->chunks.isEmpty()) {
+        const qint32 bs = static_cast<qint32>(qMin<qint64>(size - skipped, d->chunks.first().size() - d->headPos));
+        skipped += bs;
+        d->removeFront(bs);
+    }
+    return skipped;
+}
+
+bool SegmentedBytesIO::isEmpty() const
+{
+    Q_D(const SegmentedBytesIO);
+    return d->chunks.isEmpty();
+}
+
+QList<QByteArray> SegmentedBytesIO::segments() const
+{
+    Q_D(const SegmentedBytesIO);
+    QList<QByteArray> l = d->chunks;
+    if (!l.isEmpty() && d->headPos > 0) {
+        l[0] = l.at(0).mid(d->headPos);
+    }
+    return l;
+}
+
+QList<QByteArray> SegmentedBytesIO::takeSegments()
+{
+    Q_D(SegmentedBytesIO);
+    const QList<QByteArray> &l = segments();
+    d->chunks.clear();
+    d->total = 0;
+    d->headPos = 0;
+    d->tailWritable = false;
+    return l;
+}
+
+bool SegmentedBytesIO::sendTo(QSharedPointer<SocketLike> socket)
+{
+    // sendv() counts in qint32, so the segments are sent in batches.
+    const qint64 MaxBatchSize = 1024 * 1024 * 1024;
+    while (!isEmpty()) {
+        const QList<QByteArray> &l = segments();
+        QList<QByteArray> batch;
+        qint64 batchSize = 0;
+        for (const QByteArray &segment : l) {
+            if (!batch.isEmpty() && batchSize + segment.size() > MaxBatchSize) {
+                break;
+            }
+            batch.append(segment);
+            batchSize += segment.size();
+        }
+        const qint32 sent = socket->sendv(batch);
+        if (sent <= 0) {
+            return false;
+        }
+        skip(sent);
+        if (sent != batchSize) {
+            return false;
+        }
+    }
+    return true;
+}
+
+class MappedFilePrivate
+{
+public:
+    MappedFilePrivate(QSharedPointer<QFile> f);
+    void unmap();
+public:
+    QSharedPointer<QFile> f;
+    uchar *base;
+    qint64 size;
+    qint64 pos;
+};
+
+MappedFilePrivate::MappedFilePrivate(QSharedPointer<QFile> f)
+    : f(f)
+    , base(nullptr)
+    , size(-1)
+    , pos(0)
+{
+    if (f.isNull() || !f->isOpen()) {
+        return;
+    }
+    const qint64 fileSize = f->size();
+    if (fileSize == 0) {
+        size = 0;  // an empty file can not be mapped.
+        return;
+    }
+    base = f->map(0, fileSize);
+    if (base) {
+        size = fileSize;
+    } else {
+        qtng_debug << "can not map file:" << f->fileName() << f->errorString();
+    }
+}
+
+void MappedFilePrivate::unmap()
+{
+    if (base) {
+        f->unmap(base);
+        base = nullptr;
+    }
+    size = -1;
+}
+
+MappedFile::MappedFile(QSharedPointer<QFile> f)
+    : d_ptr(new MappedFilePrivate(f))
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Q_D(MappedFile);
+    d->unmap();
+    delete d_ptr;
+}
+
+qint32 MappedFile::read(char *data, qint32 size)
+{
+    Q_D(MappedFile);
+    if (d->size < 0) {
+        return -1;
+    }
+    const qint32 readBytes = static_cast<qint32>(qBound<qint64>(0, d->size - d->pos, qMax(size, 0)));
+    if (readBytes > 0) {
+        memcpy(data, d->base + d->pos, static_cast<size_t>(readBytes));
+        d->pos += readBytes;
+    }
+    return readBytes;
+}
+
+qint32 MappedFile::write(const char *, qint32)
+{
+    return -1;
+}
+
+void MappedFile::close()
+{
+    Q_D(MappedFile);
+    d->unmap();
+    d->f->close();
+}
+
+qint64 MappedFile::size()
+{
+    Q_D(MappedFile);
+    return d->size;
+}
+
+QByteArray MappedFile::readall(bool *ok)
+{
+    Q_D(MappedFile);
+    const qint64 left = d->size - d->pos;
+    if (d->size < 0 || left >= static_cast<qint64>(INT32_MAX)) {
+        if (ok)
+            *ok = false;
+        return QByteArray();
+    }
+    if (ok)
+        *ok = true;
+    // a deep copy, it is still valid after the file is closed.
+    const QByteArray t(reinterpret_cast<const char *>(d->base + d->pos), static_cast<qint32>(left));
+    d->pos = d->size;
+    return t;
+}
+
+bool MappedFile::isValid() const
+{
+    Q_D(const MappedFile);
+    return d->size >= 0;
+}
+
+const char *MappedFile::data() const
+{
+    Q_D(const MappedFile);
+    return reinterpret_cast<const char *>(d->base);
+}
+
+QByteArray MappedFile::view(qint64 offset, qint32 len) const
+{
+    Q_D(const MappedFile);
+    if (d->size < 0 || offset < 0 || offset > d->size) {
+        return QByteArray();
+    }
+    if (len < 0) {
+        if (d->size - offset >= static_cast<qint64>(INT32_MAX)) {
+            return QByteArray();
+        }
+        len = static_cast<qint32>(d->size - offset);
+    } else if (len > d->size - offset) {
+        return QByteArray();
+    }
+    if (len == 0) {
+        return QByteArray("");
+    }
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(d->base + offset), len);
+}
+
+bool MappedFile::advise(Advice advice, qint64 offset, qint64 len)
+{
+    Q_D(MappedFile);
+    if (!d->base || offset < 0 || offset >= d->size) {
         return false;
     }
+    if (len < 0 || len > d->size - offset) {
+        len = d->size - offset;
+    }
+#ifdef Q_OS_UNIX
+    int flag;
+    switch (advice) {
+    case SequentialAccess:
+        flag = MADV_SEQUENTIAL;
+        break;
+    case RandomAccess:
+        flag = MADV_RANDOM;
+        break;
+    case WillNeed:
+        flag = MADV_WILLNEED;
+        break;
+    case DontNeed:
+        flag = MADV_DONTNEED;
+        break;
+    case NormalAccess:
+    default:
+        flag = MADV_NORMAL;
+        break;
+    }
+    // madvise() needs the address aligned to page.
+    const qint64 pageSize = static_cast<qint64>(::sysconf(_SC_PAGESIZE));
+    const qint64 aligned = pageSize > 0 ? offset - offset % pageSize : offset;
+    return ::madvise(d->base + aligned, static_cast<size_t>(len + offset - aligned), flag) == 0;
+#else
+    Q_UNUSED(advice);
+    return false;
+#endif
+}
+
+bool MappedFile::seek(qint64 pos)
+{
+    Q_D(MappedFile);
+    if (d->size < 0 || pos < 0 || pos > d->size) {
+        return false;
+    }
+    d->pos = pos;
+    return true;
+}
+
+qint64 MappedFile::pos() const
+{
+    Q_D(const MappedFile);
+    return d->size < 0 ? -1 : d->pos;
+}
+
+QSharedPointer<MappedFile> MappedFile::open(const QString &filepath)
+{
+    QSharedPointer<QFile> f(new QFile(filepath));
+    if (!f->open(QIODevice::ReadOnly)) {
+        return QSharedPointer<MappedFile>();
+    }
+    QSharedPointer<MappedFile> file(new MappedFile(f));
+    if (!file->isValid()) {
+        return QSharedPointer<MappedFile>();
+    }
+    return file;
+}
+
+static bool copyBlocks(QSharedPointer<FileLike> inputFile, QSharedPointer<FileLike> outputFile, qint64 bytesToCopy,
+                       int suitableBlockSize)
+{
     if (bytesToCopy == 0) {
         return true;
     } else if (bytesToCopy < 0) {
@@ -419,6 +959,114 @@ bool sendfile(QSharedPointer<FileLike> inputFile, QSharedPointer<FileLike> outpu
     }
 }
 
+// returns false if the file is not a RawFile or the socket is neither a tcp Socket nor an SslSocket offloaded to
+// the kernel.
+static bool copyInKernel(QSharedPointer<FileLike> inputFile, QSharedPointer<SocketLike> outputSocket, qint64 offset,
+                         qint64 bytesToCopy, bool *ok)
+{
+    QSharedPointer<RawFile> rawFile = inputFile.dynamicCast<RawFile>();
+    if (rawFile.isNull() || rawFile->f.isNull() || !rawFile->f->isOpen() || rawFile->isAsync()) {
+        return false;
+    }
+    QSharedPointer<Socket> socket = convertSocketLikeToSocket(outputSocket);
+#ifndef QTNG_NO_CRYPTO
+    if (socket.isNull()) {
+        // the kernel encrypts what is written to the tcp socket under it.
+        QSharedPointer<SslSocket> ssl = convertSocketLikeToSslSocket(outputSocket);
+        if (!ssl.isNull() && ssl->isKernelTlsActive()) {
+            socket = convertSocketLikeToSocket(ssl->backend());
+        }
+    }
+#endif
+    if (socket.isNull() || socket->type() != Socket::TcpSocket) {
+        return false;
+    }
+    if (offset < 0) {
+        offset = rawFile->pos();
+        if (offset < 0) {
+            return false;
+        }
+    }
+    if (bytesToCopy < 0) {
+        bytesToCopy = qMax<qint64>(0, rawFile->size() - offset);
+    }
+    qint64 sent = bytesToCopy > 0 ? socket->sendfile(rawFile->f.data(), offset, bytesToCopy) : 0;
+    if (sent > 0) {
+        // keep the file position as if it was read.
+        rawFile->seek(offset + sent);
+    }
+    *ok = (sent == bytesToCopy);
+    return true;
+}
+
+bool sendfile(QSharedPointer<FileLike> inputFile, QSharedPointer<FileLike> outputFile, qint64 bytesToCopy,
+              int suitableBlockSize)
+{
+    if (inputFile.isNull() || outputFile.isNull()) {
+        return false;
+    }
+    QSharedPointer<SocketLike> outputSocket = outputFile.dynamicCast<SocketLike>();
+    bool ok = false;
+    if (!outputSocket.isNull() && copyInKernel(inputFile, outputSocket, -1, bytesToCopy, &ok)) {
+        return ok;
+    }
+    return copyBlocks(inputFile, outputFile, bytesToCopy, suitableBlockSize);
+}
+
+bool sendfile(QSharedPointer<FileLike> inputFile, QSharedPointer<SocketLike> outputSocket, qint64 offset,
+              qint64 bytesToCopy)
+{
+    if (inputFile.isNull() || outputSocket.isNull() || offset < 0) {
+        return false;
+    }
+    bool ok = false;
+    if (copyInKernel(inputFile, outputSocket, offset, bytesToCopy, &ok)) {
+        return ok;
+    }
+    QSharedPointer<RawFile> rawFile = inputFile.dynamicCast<RawFile>();
+    if (!rawFile.isNull()) {
+        // seek before every block, the file may be shared by coroutines which move the position while we are sending.
+        if (bytesToCopy < 0) {
+            bytesToCopy = qMax<qint64>(0, rawFile->size() - offset);
+        }
+        char buf[1024 * 16];
+        qint64 copied = 0;
+        while (copied < bytesToCopy) {
+            if (!rawFile->seek(offset + copied)) {
+                return false;
+            }
+            qint32 readBytes = rawFile->read(buf, static_cast<qint32>(qMin<qint64>(sizeof(buf), bytesToCopy - copied)));
+            if (readBytes <= 0) {
+                return false;
+            }
+            if (outputSocket->sendall(buf, readBytes) != readBytes) {
+                return false;
+            }
+            copied += readBytes;
+        }
+        return true;
+    } else if (offset > 0) {
+        // not seekable, skip the leading bytes.
+        char buf[1024 * 8];
+        qint64 skipped = 0;
+        while (skipped < offset) {
+            qint32 readBytes = inputFile->read(buf, static_cast<qint32>(qMin<qint64>(sizeof(buf), offset - skipped)));
+            if (readBytes <= 0) {
+                return false;
+            }
+            skipped += readBytes;
+        }
+    }
+    if (bytesToCopy < 0) {
+        qint64 size = inputFile->size();
+        bytesToCopy = size < 0 ? -1 : qMax<qint64>(0, size - offset);
+        if (bytesToCopy == 0) {
+            return true;
+        }
+    }
+    return copyBlocks(inputFile, outputSocket, bytesToCopy, 1024 * 16);
+}
+
 class PosixPathPrivate : public QSharedData
 {
 public:
@@ -0,0 +1,833 @@
+#include <string.h>
+#if defined(__SSE4_2__)
+#  include <nmmintrin.h>
+#  define QTNG_JSON_STREAM_SSE42 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define QTNG_JSON_STREAM_SSE2 1
+#endif
+#include <QtCore/qalgorithms.h>
+#include <QtCore/qlist.h>
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qvector.h>
+#include "../include/json_stream.h"
+#include "../include/msgpack.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+namespace {
+
+inline bool isJsonSpace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// tests 8 bytes at once for the quote, the backslash and the control characters, so the plain runs of strings are
+// skipped by words.
+inline bool hasSpecialByte(quint64 v)
+{
+    const quint64 ones = 0x0101010101010101ULL;
+    const quint64 highs = 0x8080808080808080ULL;
+    const quint64 quote = v ^ (ones * '"');
+    const quint64 backslash = v ^ (ones * '\\');
+    return (((quote - ones) & ~quote) | ((backslash - ones) & ~backslash) | ((v - ones * 0x20) & ~v)) & highs;
+}
+
+#ifdef QTNG_JSON_STREAM_SSE42
+// the pairs of inclusive bounds of the bytes which end a plain run of string, and the json spaces, for _mm_cmpestri().
+const char stringRanges[16] = "\"\"\\\\\000\037";
+const char spaceChars[16] = " \t\r\n";
+#endif
+
+// returns the index of the first quote, backslash or control character from i, or a position near the end where the
+// caller goes on byte by byte. like the http parser, sse4.2 is used if the build enables it, sse2 otherwise.
+inline int skipPlainString(const char *data, int i, int size)
+{
+#if defined(QTNG_JSON_STREAM_SSE42)
+    if (size - i >= 16) {
+        const __m128i ranges = _mm_loadu_si128(reinterpret_cast<const __m128i *>(stringRanges));
+        do {
+            const __m128i b16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            const int r = _mm_cmpestri(ranges, 6, b16, 16,
+                                       _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+            if (r != 16) {
+                return i + r;
+            }
+            i += 16;
+        } while (size - i >= 16);
+    }
+#elif defined(QTNG_JSON_STREAM_SSE2)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i controlMax = _mm_set1_epi8(0x1f);
+    while (size - i >= 16) {
+        const __m128i b16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(b16, controlMax), b16);
+        const __m128i special =
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b16, quote), _mm_cmpeq_epi8(b16, backslash)), control);
+        const int mask = _mm_movemask_epi8(special);
+        if (mask) {
+            return i + static_cast<int>(qCountTrailingZeroBits(static_cast<quint32>(mask)));
+        }
+        i += 16;
+    }
+#endif
+    while (i + 8 <= size) {
+        quint64 v;
+        memcpy(&v, data + i, sizeof(v));
+        if (hasSpecialByte(v)) {
+            break;
+        }
+        i += 8;
+    }
+    return i;
+}
+
+// returns the index of the first byte which is not a json space from i. compact documents have no space or a single
+// one between tokens, so the vector loop starts only for longer runs such as the indents of pretty printed documents.
+inline int skipSpaces(const char *data, int i, int size)
+{
+    if (i >= size || !isJsonSpace(data[i])) {
+        return i;
+    }
+    ++i;
+    if (i >= size || !isJsonSpace(data[i])) {
+        return i;
+    }
+#if defined(QTNG_JSON_STREAM_SSE42)
+    if (size - i >= 16) {
+        const __m128i spaces = _mm_loadu_si128(reinterpret_cast<const __m128i *>(spaceChars));
+        do {
+            const __m128i b16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            const int r = _mm_cmpestri(spaces, 4, b16, 16,
+                                       _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_EQUAL_ANY | _SIDD_NEGATIVE_POLARITY
+                                               | _SIDD_UBYTE_OPS);
+            if (r != 16) {
+                return i + r;
+            }
+            i += 16;
+        } while (size - i >= 16);
+    }
+#elif defined(QTNG_JSON_STREAM_SSE2)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (size - i >= 16) {
+        const __m128i b16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const __m128i isSpace = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b16, space), _mm_cmpeq_epi8(b16, tab)),
+                                             _mm_or_si128(_mm_cmpeq_epi8(b16, cr), _mm_cmpeq_epi8(b16, lf)));
+        const int mask = _mm_movemask_epi8(isSpace) ^ 0xffff;
+        if (mask) {
+            return i + static_cast<int>(qCountTrailingZeroBits(static_cast<quint32>(mask)));
+        }
+        i += 16;
+    }
+#endif
+    while (i < size && isJsonSpace(data[i])) {
+        ++i;
+    }
+    return i;
+}
+
+int hexValue(const char *s)
+{
+    int value = 0;
+    for (int i = 0; i < 4; ++i) {
+        const char c = s[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        } else {
+            return -1;
+        }
+    }
+    return value;
+}
+
+void appendUtf8(QByteArray *out, uint codePoint)
+{
+    if (codePoint < 0x80) {
+        out->append(static_cast<char>(codePoint));
+    } else if (codePoint < 0x800) {
+        out->append(static_cast<char>(0xc0 | (codePoint >> 6)));
+        out->append(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    } else if (codePoint < 0x10000) {
+        out->append(static_cast<char>(0xe0 | (codePoint >> 12)));
+        out->append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+        out->append(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    } else {
+        out->append(static_cast<char>(0xf0 | (codePoint >> 18)));
+        out->append(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f)));
+        out->append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+        out->append(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    }
+}
+
+// the scanner makes sure that every backslash is followed by one byte at least.
+bool unescape(const char *s, int len, QByteArray *out)
+{
+    out->clear();
+    out->reserve(len);
+    int i = 0;
+    while (i < len) {
+        if (s[i] != '\\') {
+            const char *end = static_cast<const char *>(memchr(s + i, '\\', len - i));
+            const int j = end ? static_cast<int>(end - s) : len;
+            out->append(s + i, j - i);
+            i = j;
+            continue;
+        }
+        const char c = s[i + 1];
+        i += 2;
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            out->append(c);
+            break;
+        case 'b':
+            out->append('\b');
+            break;
+        case 'f':
+            out->append('\f');
+            break;
+        case 'n':
+            out->append('\n');
+            break;
+        case 'r':
+            out->append('\r');
+            break;
+        case 't':
+            out->append('\t');
+            break;
+        case 'u': {
+            if (i + 4 > len) {
+                return false;
+            }
+            int codePoint = hexValue(s + i);
+            i += 4;
+            if (codePoint < 0 || (codePoint >= 0xdc00 && codePoint <= 0xdfff)) {
+                return false;
+            }
+            if (codePoint >= 0xd800 && codePoint <= 0xdbff) {
+                if (i + 6 > len || s[i] != '\\' || s[i + 1] != 'u') {
+                    return false;
+                }
+                const int low = hexValue(s + i + 2);
+                if (low < 0xdc00 || low > 0xdfff) {
+                    return false;
+                }
+                i += 6;
+                codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+            }
+            appendUtf8(out, static_cast<uint>(codePoint));
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns the length of number at the start of s, or -1 if it is not a json number.
+int scanNumber(const char *s, int len, bool *isInteger)
+{
+    int i = 0;
+    if (i < len && s[i] == '-') {
+        ++i;
+    }
+    if (i >= len || !isDigit(s[i])) {
+        return -1;
+    }
+    if (s[i] == '0') {
+        ++i;
+    } else {
+        while (i < len && isDigit(s[i])) {
+            ++i;
+        }
+    }
+    *isInteger = true;
+    if (i < len && s[i] == '.') {
+        ++i;
+        if (i >= len || !isDigit(s[i])) {
+            return -1;
+        }
+        while (i < len && isDigit(s[i])) {
+            ++i;
+        }
+        *isInteger = false;
+    }
+    if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+        ++i;
+        if (i < len && (s[i] == '+' || s[i] == '-')) {
+            ++i;
+        }
+        if (i >= len || !isDigit(s[i])) {
+            return -1;
+        }
+        while (i < len && isDigit(s[i])) {
+            ++i;
+        }
+        *isInteger = false;
+    }
+    return i;
+}
+
+}  // anonymous namespace
+
+class JsonStreamReaderPrivate
+{
+public:
+    enum State {
+        ExpectValue,
+        ExpectValueOrEnd,  // after [
+        ExpectKey,
+        ExpectKeyOrEnd,  // after {
+        ExpectColon,
+        ExpectCommaOrEnd,
+        Finished,
+        Failed,
+    };
+    JsonStreamReaderPrivate();
+public:
+    JsonStreamReader::Token parse();
+    JsonStreamReader::Token parseValue(char c);
+    JsonStreamReader::Token parseLiteral(const char *literal, int len, JsonStreamReader::Token result, bool value);
+    JsonStreamReader::Token parseNumber();
+    int parseString();  // 1 if taken, 0 if more data is needed, -1 if failed.
+    JsonStreamReader::Token closeContainer(char c);
+    JsonStreamReader::Token needMoreData();
+    JsonStreamReader::Token fail(const QString &message);
+    void endValue() { state = stack.isEmpty() ? Finished : ExpectCommaOrEnd; }
+public:
+    QByteArray buffer;
+    QVector<char> stack;
+    QByteArray string;
+    QString errorString;
+    qint64 consumed;
+    qint64 integer;
+    double number;
+    int pos;
+    int scanned;  // the bytes of string scanned before more data is needed.
+    int maxDepth;
+    State state;
+    JsonStreamReader::Token token;
+    bool escaped;
+    bool boolean;
+    bool finishing;
+};
+
+JsonStreamReaderPrivate::JsonStreamReaderPrivate()
+    : consumed(0)
+    , integer(0)
+    , number(0.0)
+    , pos(0)
+    , scanned(0)
+    , maxDepth(512)
+    , state(ExpectValue)
+    , token(JsonStreamReader::NeedMoreData)
+    , escaped(false)
+    , boolean(false)
+    , finishing(false)
+{
+}
+
+JsonStreamReader::Token JsonStreamReaderPrivate::fail(const QString &message)
+{
+    state = Failed;
+    errorString = QString::fromLatin1("%1 at offset %2.").arg(message).arg(consumed + pos);
+    return JsonStreamReader::Invalid;
+}
+
+JsonStreamReader::Token JsonStreamReaderPrivate::needMoreData()
+{
+    if (finishing) {
+        return fail(QString::fromLatin1("unexpected end of document"));
+    }
+    if (pos > 0) {
+        consumed += pos;
+        buffer.remove(0, pos);
+        pos = 0;
+    }
+    return JsonStreamReader::NeedMoreData;
+}
+
+JsonStreamReader::Token JsonStreamReaderPrivate::parse()
+{
+    while (true) {
+        const char *data = buffer.constData();
+        const int size = buffer.size();
+        pos = skipSpaces(data, pos, size);
+        if (pos >= size) {
+            if (state == Finished) {
+                return JsonStreamReader::EndOfDocument;
+            }
+            return needMoreData();
+        }
+        const char c = data[pos];
+        switch (state) {
+        case ExpectValue:
+            return parseValue(c);
+        case ExpectValueOrEnd:
+            if (c == ']') {
+                return closeContainer(c);
+            }
+            return parseValue(c);
+        case ExpectKey:
+        case ExpectKeyOrEnd: {
+            if (c == '}' && state == ExpectKeyOrEnd) {
+                return closeContainer(c);
+            }
+            if (c != '"') {
+                return fail(QString::fromLatin1("expect a key"));
+            }
+            const int r = parseString();
+            if (r < 0) {
+                return JsonStreamReader::Invalid;
+            } else if (r == 0) {
+                return needMoreData();
+            }
+            state = ExpectColon;
+            return JsonStreamReader::Key;
+        }
+        case ExpectColon:
+            if (c != ':') {
+                return fail(QString::fromLatin1("expect a colon"));
+            }
+            ++pos;
+            state = ExpectValue;
+            continue;
+        case ExpectCommaOrEnd:
+            if (c == ',') {
+                ++pos;
+                state = stack.last() == '{' ? ExpectKey : ExpectValue;
+                continue;
+            }
+            return closeContainer(c);
+        case Finished:
+            return fail(QString::fromLatin1("unexpected data after the document"));
+        case Failed:
+            return JsonStreamReader::Invalid;
+        }
+    }
+}
+
+JsonStreamReader::Token JsonStreamReaderPrivate::parseValue(char c)
+{
+    switch (c) {
+    case '{':
+    case '[':
+        if (stack.size() >= maxDepth) {
+            return fail(QString::fromLatin1("the document is too deep"));
+        }
+        stack.append(c);
+        ++pos;
+        if (c == '{') {
+            state = ExpectKeyOrEnd;
+            return JsonStreamReader::StartObject;
+        } else {
+            state = ExpectValueOrEnd;
+            return JsonStreamReader::StartArray;
+        }
+    case '"': {
+        const int r = parseString();
+        if (r < 0) {
+            return JsonStreamReader::Invalid;
+        } else if (r == 0) {
+            return needMoreData();
+        }
+        endValue();
+        return JsonStreamReader::String;
+    }
+    case 't':
+        return parseLiteral("true", 4, JsonStreamReader::Bool, true);
+    case 'f':
+        return parseLiteral("false", 5, JsonStreamReader::Bool, false);
+    case 'n':
+        return parseLiteral("null", 4, JsonStreamReader::Null, false);
+    default:
+        if (c == '-' || isDigit(c)) {
+            return parseNumber();
+        }
+        return fail(QString::fromLatin1("unexpected character"));
+    }
+}
+
+JsonStreamReader::Token JsonStreamReaderPrivate::parseLiteral(const char *literal, int len,
+                                                              JsonStreamReader::Token result, bool value)
+{
+    const int available = buffer.size() - pos;
+    if (memcmp(buffer.constData() + pos, literal, static_cast<size_t>(qMin(available, len))) != 0) {
+        return fail(QString::fromLatin1("unexpected character"));
+    }
+    if (available < len) {
+        return needMoreData();
+    }
+    pos += len;
+    boolean = value;
+    endValue();
+    return result;
+}
+
+JsonStreamReader::Token JsonStreamReaderPrivate::parseNumber()
+{
+    const char *data = buffer.constData() + pos;
+    const int available = buffer.size() - pos;
+    int end = 0;
+    while (end < available && (isDigit(data[end]) || data[end] == '-' || data[end] == '+' || data[end] == '.'
+                               || data[end] == 'e' || data[end] == 'E')) {
+        ++end;
+    }
+    if (end == available && !finishing) {
+        return needMoreData();  // the number may go on.
+    }
+    bool isInteger = false;
+    if (scanNumber(data, end, &isInteger) != end) {
+        return fail(QString::fromLatin1("invalid number"));
+    }
+    const QByteArray text(data, end);
+    bool ok = false;
+    JsonStreamReader::Token result;
+    if (isInteger) {
+        integer = text.toLongLong(&ok);
+    }
+    if (ok) {
+        number = static_cast<double>(integer);
+        result = JsonStreamReader::Integer;
+    } else {
+        number = text.toDouble(&ok);  // the large integers go here too.
+        result = JsonStreamReader::Double;
+    }
+    pos += end;
+    endValue();
+    return result;
+}
+
+int JsonStreamReaderPrivate::parseString()
+{
+    const char *data = buffer.constData();
+    const int size = buffer.size();
+    int i = pos + 1 + scanned;
+    while (true) {
+        i = skipPlainString(data, i, size);
+        if (i >= size) {
+            break;
+        }
+        const uchar c = static_cast<uchar>(data[i]);
+        if (c == '"') {
+            const int len = i - pos - 1;
+            if (escaped) {
+                if (!unescape(data + pos + 1, len, &string)) {
+                    fail(QString::fromLatin1("invalid escape sequence"));
+                    return -1;
+                }
+            } else {
+                string = QByteArray(data + pos + 1, len);
+            }
+            pos = i + 1;
+            scanned = 0;
+            escaped = false;
+            return 1;
+        } else if (c == '\\') {
+            if (i + 1 >= size) {
+                break;
+            }
+            escaped = true;
+            i += 2;
+        } else if (c < 0x20) {
+            pos = i;
+            fail(QString::fromLatin1("control character in string"));
+            return -1;
+        } else {
+            ++i;
+        }
+    }
+    scanned = i - pos - 1;
+    return 0;
+}
+
+JsonStreamReader::Token JsonStreamReaderPrivate::closeContainer(char c)
+{
+    if (stack.isEmpty() || (stack.last() == '{' && c != '}') || (stack.last() == '[' && c != ']')) {
+        return fail(QString::fromLatin1("unexpected character"));
+    }
+    stack.removeLast();
+    ++pos;
+    endValue();
+    return c == '}' ? JsonStreamReader::EndObject : JsonStreamReader::EndArray;
+}
+
+JsonStreamReader::JsonStreamReader()
+    : d_ptr(new JsonStreamReaderPrivate())
+{
+}
+
+JsonStreamReader::~JsonStreamReader()
+{
+    delete d_ptr;
+}
+
+void JsonStreamReader::addData(const char *data, qint32 size)
+{
+    Q_D(JsonStreamReader);
+    if (size > 0 && !d->finishing) {
+        d->buffer.append(data, size);
+    }
+}
+
+void JsonStreamReader::finish()
+{
+    Q_D(JsonStreamReader);
+    d->finishing = true;
+}
+
+JsonStreamReader::Token JsonStreamReader::next()
+{
+    Q_D(JsonStreamReader);
+    d->token = d->parse();
+    return d->token;
+}
+
+JsonStreamReader::Token JsonStreamReader::token() const
+{
+    Q_D(const JsonStreamReader);
+    return d->token;
+}
+
+QByteArray JsonStreamReader::stringValue() const
+{
+    Q_D(const JsonStreamReader);
+    if (d->token == Key || d->token == String) {
+        return d->string;
+    }
+    return QByteArray();
+}
+
+QString JsonStreamReader::toString() const
+{
+    return QString::fromUtf8(stringValue());
+}
+
+qint64 JsonStreamReader::integerValue() const
+{
+    Q_D(const JsonStreamReader);
+    return d->token == Integer ? d->integer : 0;
+}
+
+double JsonStreamReader::doubleValue() const
+{
+    Q_D(const JsonStreamReader);
+    return (d->token == Integer || d->token == Double) ? d->number : 0.0;
+}
+
+bool JsonStreamReader::boolValue() const
+{
+    Q_D(const JsonStreamReader);
+    return d->token == Bool && d->boolean;
+}
+
+int JsonStreamReader::depth() const
+{
+    Q_D(const JsonStreamReader);
+    return d->stack.size();
+}
+
+qint64 JsonStreamReader::offset() const
+{
+    Q_D(const JsonStreamReader);
+    return d->consumed + d->pos;
+}
+
+void JsonStreamReader::setMaxDepth(int maxDepth)
+{
+    Q_D(JsonStreamReader);
+    d->maxDepth = qMax(1, maxDepth);
+}
+
+int JsonStreamReader::maxDepth() const
+{
+    Q_D(const JsonStreamReader);
+    return d->maxDepth;
+}
+
+QString JsonStreamReader::errorString() const
+{
+    Q_D(const JsonStreamReader);
+    return d->errorString;
+}
+
+namespace {
+
+struct JsonMsgPackFrame
+{
+    JsonMsgPackFrame(bool isMap, bool passthrough)
+        : stream(&data, QIODevice::WriteOnly)
+        , count(0)
+        , isMap(isMap)
+        , passthrough(passthrough)
+    {
+    }
+    QByteArray data;
+    MsgPackStream stream;
+    quint32 count;  // the elements of array, or the keys of map.
+    bool isMap;
+    bool passthrough;  // the top array of splitTopArray, whose elements are written to out.
+};
+
+}  // anonymous namespace
+
+class JsonMsgPackTranscoderPrivate
+{
+public:
+    JsonMsgPackTranscoderPrivate(MsgPackStream *out, bool splitTopArray)
+        : out(out)
+        , valuesWritten(0)
+        , splitTopArray(splitTopArray)
+        , failed(false)
+    {
+    }
+    bool consume();
+    MsgPackStream *current() const
+    {
+        return (frames.isEmpty() || frames.last()->passthrough) ? out : &frames.last()->stream;
+    }
+    void counted()
+    {
+        if (frames.isEmpty() || frames.last()->passthrough) {
+            ++valuesWritten;
+        } else if (!frames.last()->isMap) {
+            ++frames.last()->count;
+        }
+    }
+public:
+    JsonStreamReader reader;
+    QList<QSharedPointer<JsonMsgPackFrame>> frames;
+    QString errorString;
+    MsgPackStream *out;
+    quint64 valuesWritten;
+    bool splitTopArray;
+    bool failed;
+};
+
+bool JsonMsgPackTranscoderPrivate::consume()
+{
+    while (!failed) {
+        const JsonStreamReader::Token token = reader.next();
+        switch (token) {
+        case JsonStreamReader::NeedMoreData:
+        case JsonStreamReader::EndOfDocument:
+            return true;
+        case JsonStreamReader::Invalid:
+            errorString = reader.errorString();
+            failed = true;
+            return false;
+        case JsonStreamReader::StartObject:
+        case JsonStreamReader::StartArray: {
+            const bool passthrough = splitTopArray && frames.isEmpty() && token == JsonStreamReader::StartArray;
+            frames.append(
+                    QSharedPointer<JsonMsgPackFrame>::create(token == JsonStreamReader::StartObject, passthrough));
+            break;
+        }
+        case JsonStreamReader::EndObject:
+        case JsonStreamReader::EndArray: {
+            QSharedPointer<JsonMsgPackFrame> frame = frames.takeLast();
+            if (frame->passthrough) {
+                break;
+            }
+            MsgPackStream *s = current();
+            if (frame->isMap) {
+                s->writeMapHeader(frame->count);
+            } else {
+                s->writeArrayHeader(frame->count);
+            }
+            s->writeBytes(frame->data.constData(), frame->data.size());
+            counted();
+            break;
+        }
+        case JsonStreamReader::Key:
+            current()->writeString(reader.stringValue());
+            ++frames.last()->count;
+            break;
+        case JsonStreamReader::String:
+            current()->writeString(reader.stringValue());
+            counted();
+            break;
+        case JsonStreamReader::Integer:
+            *current() << reader.integerValue();
+            counted();
+            break;
+        case JsonStreamReader::Double:
+            *current() << reader.doubleValue();
+            counted();
+            break;
+        case JsonStreamReader::Bool:
+            *current() << reader.boolValue();
+            counted();
+            break;
+        case JsonStreamReader::Null:
+            *current() << QVariant();
+            counted();
+            break;
+        }
+        if (out->status() != MsgPackStream::Ok) {
+            errorString = QString::fromLatin1("can not write msgpack.");
+            failed = true;
+        }
+    }
+    return false;
+}
+
+JsonMsgPackTranscoder::JsonMsgPackTranscoder(MsgPackStream *out, bool splitTopArray)
+    : d_ptr(new JsonMsgPackTranscoderPrivate(out, splitTopArray))
+{
+}
+
+JsonMsgPackTranscoder::~JsonMsgPackTranscoder()
+{
+    delete d_ptr;
+}
+
+bool JsonMsgPackTranscoder::addData(const char *data, qint32 size)
+{
+    Q_D(JsonMsgPackTranscoder);
+    if (d->failed) {
+        return false;
+    }
+    d->reader.addData(data, size);
+    return d->consume();
+}
+
+bool JsonMsgPackTranscoder::finish()
+{
+    Q_D(JsonMsgPackTranscoder);
+    if (d->failed) {
+        return false;
+    }
+    d->reader.finish();
+    return d->consume();
+}
+
+quint64 JsonMsgPackTranscoder::valuesWritten() const
+{
+    Q_D(const JsonMsgPackTranscoder);
+    return d->valuesWritten;
+}
+
+QString JsonMsgPackTranscoder::errorString() const
+{
+    Q_D(const JsonMsgPackTranscoder);
+    return d->errorString;
+}
+
+QTNETWORKNG_NAMESPACE_END
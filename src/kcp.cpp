@@ -1,7 +1,10 @@
 #include <QtCore/qdatetime.h>
 #include <QtCore/qelapsedtimer.h>
 #include <QtCore/qbytearray.h>
+#include <QtCore/qhash.h>
 #include <QtCore/qendian.h>
+#include <QtCore/qthreadstorage.h>
+#include <QtCore/qvector.h>
 #if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
 #  include <QtCore/qrandom.h>
 #endif
@@ -9,9 +12,20 @@
 #include "../include/socket_utils.h"
 #include "../include/coroutine_utils.h"
 #include "../include/random.h"
+#include "../include/buffer_budget.h"
+#include "../include/metrics.h"
 #include "../include/private/socket_p.h"
+#include "../include/private/kcp_fec_p.h"
 #include "./kcp/ikcp.h"
 #include "debugger.h"
+#ifdef Q_OS_LINUX
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <linux/filter.h>
+#  ifndef SO_ATTACH_REUSEPORT_CBPF
+#    define SO_ATTACH_REUSEPORT_CBPF 51
+#  endif
+#endif
 
 QTNG_LOGGER("qtng.kcp");
 
@@ -21,6 +35,23 @@ const char PACKET_TYPE_UNCOMPRESSED_DATA = 0x01;
 const char PACKET_TYPE_CREATE_MULTIPATH = 0x02;
 const char PACKET_TYPE_CLOSE = 0X03;
 const char PACKET_TYPE_KEEPALIVE = 0x04;
+const char PACKET_TYPE_FEC_ANNOUNCE = 0x05;
+const char PACKET_TYPE_FEC_DATA = 0x06;
+const char PACKET_TYPE_FEC_PARITY = 0x07;
+const char PACKET_TYPE_MTU_PROBE = 0x08;  // padded to the probed size, or the acknowledgement with the size received.
+
+// type, connection id, data shards, parity shards and sequence.
+const int FecHeaderSize = 11;
+// compared with the data packet, the parity packet has the fec header and the length of data shard but no conv.
+const int FecOverhead = 8;
+const int MaxFecAnnounces = 8;
+const quint64 AdaptInterval = 1000;
+// the path mtu is searched between BasePathMtu and MaxPathMtu, which are the sizes of udp payload.
+const quint32 BasePathMtu = 1200;
+const quint32 MaxPathMtu = 1024 * 64 - 256;
+const quint32 PathMtuResolution = 16;
+const int MaxPathMtuProbes = 3;
+const quint64 PathMtuRaiseInterval = 1000 * 600;
 
 //#define DEBUG_PROTOCOL 1
 
@@ -57,20 +88,47 @@ public:
     virtual bool leaveMulticastGroup(const HostAddress &groupAddress, const NetworkInterface &iface) = 0;
     virtual NetworkInterface multicastInterface() const = 0;
     virtual bool setMulticastInterface(const NetworkInterface &iface) = 0;
+    virtual bool setShard(int index, int count) = 0;
 public:
     void setMode(KcpSocket::Mode mode);
+    // called by updateOnce() with kcpLock held. measures the loss, and tunes kcp in Adaptive mode.
+    void adapt(quint64 now);
+    bool setPathMtuDiscovery(bool enabled);
+    void probePathMtu(quint64 now);
+    void sendPathMtuProbe(quint64 now);
+    void handlePathMtuProbe(const char *buf, quint32 len);
+    void applyPathMtu();
+    // forbid the fragmentation of udp socket, so the probes larger than the path are dropped.
+    virtual bool setDontFragment(bool enabled) = 0;
     qint32 send(const char *data, qint32 size, bool all);
     qint32 recv(char *data, qint32 size, bool all);
+    // ikcp_send() refuses the messages of IKCP_WND_RCV (128) fragments or more.
+    inline qint32 maxMessageSize() const { return static_cast<qint32>(kcp->mss) * (128 - 1); }
     bool handleDatagram(const char *buf, quint32 len);
-    void updateKcp();
+    void inputKcp(const char *data, quint32 len);
+    void handleFecPacket(const char *buf, quint32 len);
+    void handleFecAnnounce(bool ack);
+    void setFecEncoding(bool enabled);
+    void makeOutputPackets(const char *buf, int len, QList<QByteArray> *packets);
+    virtual void updateKcp();
     void doUpdate();
+    // returns false if the socket is closed. the output datagrams are appended to packets, which are sent by caller.
+    bool updateOnce(quint64 now, QList<QByteArray> *packets, quint32 *interval);
+    inline bool isUpdating() const
+    {
+        // in close(), state is set to Socket::UnconnectedState but error = NoError.
+        return state == Socket::ConnectedState || (state == Socket::UnconnectedState && error == Socket::NoError);
+    }
     virtual qint32 rawSend(const char *data, qint32 size) = 0;
+    virtual qint32 rawSendMany(const QList<QByteArray> &packets) = 0;
     virtual qint32 udpSend(const char *data, qint32 size, const HostAddress &addr, quint16 port) = 0;
 
     QByteArray makeDataPacket(const char *data, qint32 size);
     QByteArray makeShutdownPacket(quint32 connectionId);
     QByteArray makeKeepalivePacket();
     QByteArray makeMultiPathPacket(quint32 connectionId);
+    QByteArray makeFecPacket(char type, quint32 seq, const char *data, qint32 size);
+    QByteArray makeFecAnnouncePacket(bool ack);
 public:
     KcpSocket * const q_ptr;
     Q_DECLARE_PUBLIC(KcpSocket)
@@ -83,6 +141,7 @@ public:
     Event sendingQueueNotFull;
     Event sendingQueueEmpty;
     Event receivingQueueNotEmpty;
+    BufferCharge sendingBytes;  // estimated by the segments waiting for ack.
     RLock kcpLock;
     Gate forceToUpdate;
     QByteArray receivingBuffer;
@@ -92,6 +151,7 @@ public:
     quint64 lastKeepaliveTimestamp;
     quint64 tearDownTime;
     ikcpcb *kcp;
+    QList<QByteArray> *outputBatch;  // collect the output of ikcp_update() and send them by one syscall.
     quint32 waterLine;
     quint32 connectionId;
 
@@ -99,13 +159,68 @@ public:
     quint16 remotePort;
 
     KcpSocket::Mode mode;
+
+    // the fec is used after the peer sends any fec packet, the old peers ignore the announce packets.
+    QScopedPointer<KcpFecEncoder> fecEncoder;
+    QScopedPointer<KcpFecDecoder> fecDecoder;
+    quint64 lastFecAnnounceTimestamp;
+    int fecDataShards;  // 0 if disabled.
+    int fecParityShards;
+    int fecAnnounces;
+    bool peerFec;
+    bool fecAckPending;
+    bool messageMode;
+
+    // the samples of statistics() and Adaptive mode.
+    quint64 lastAdaptTimestamp;
+    quint32 lastXmit;
+    quint32 lastSndNxt;
+    float lossRate;
+    int adaptiveLevel;  // 0 is the fastest.
+
+    // the binary search of path mtu, between probeLow which is acknowledged and probeHigh which is not.
+    bool pathMtuDiscovery;
+    quint32 pathMtu;
+    quint32 probeLow;
+    quint32 probeHigh;
+    quint32 probingSize;  // 0 if no probe is in flight.
+    int probeCount;
+    quint64 lastProbeTimestamp;
+    quint64 nextSearchTimestamp;
+};
+
+// the binary key of udp peer looked up by every datagram.
+struct KcpPeerKey
+{
+    KcpPeerKey()
+        : port(0)
+    {
+    }
+    KcpPeerKey(const HostAddress &addr, quint16 port)
+        : address(addr)
+        , port(port)
+    {
+    }
+    bool operator==(const KcpPeerKey &other) const { return port == other.port && address == other.address; }
+    CompactHostAddress address;
+    quint16 port;
 };
 
-static inline QString concat(const HostAddress &addr, quint16 port)
+inline uint qHash(const KcpPeerKey &key, uint seed = 0)
 {
-    return addr.toString() + QLatin1String(":") + QString::number(port);
+    return qHash(key.address, seed ^ key.port);
 }
 
+// the slaves of server are updated by one coroutine of master with a timing wheel, instead of a timer for every slave.
+const quint64 UpdateWheelGranularity = 5;  // msecs per slot.
+const int UpdateWheelSize = 512;
+
+struct KcpUpdateEntry
+{
+    QPointer<class SlaveKcpSocketPrivate> slave;
+    quint64 tick;  // stale if the slave is scheduled again.
+};
+
 class MasterKcpSocketPrivate : public KcpSocketPrivate
 {
 public:
@@ -136,23 +251,40 @@ public:
     virtual bool leaveMulticastGroup(const HostAddress &groupAddress, const NetworkInterface &iface) override;
     virtual NetworkInterface multicastInterface() const override;
     virtual bool setMulticastInterface(const NetworkInterface &iface) override;
+    virtual bool setShard(int index, int count) override;
+    virtual bool setDontFragment(bool enabled) override;
 public:
     virtual qint32 rawSend(const char *data, qint32 size) override;
+    virtual qint32 rawSendMany(const QList<QByteArray> &packets) override;
     virtual qint32 udpSend(const char *data, qint32 size, const HostAddress &addr, quint16 port) override;
 public:
-    void removeSlave(const QString &originalHostAndPort) { receiversByHostAndPort.remove(originalHostAndPort); }
+    void removeSlave(const KcpPeerKey &originalPeer) { receiversByHostAndPort.remove(originalPeer); }
     void removeSlave(quint32 connectionId) { receiversByConnectionId.remove(connectionId); }
     quint32 nextConnectionId();
     void doReceive();
     void doAccept();
+    void receiveDatagrams(bool (MasterKcpSocketPrivate::*handler)(char *, qint32, HostAddress, quint16));
+    bool handleReceivedDatagram(char *data, qint32 len, HostAddress addr, quint16 port);
+    bool handleAcceptedDatagram(char *data, qint32 len, HostAddress addr, quint16 port);
     bool startReceivingCoroutine();
+    void scheduleUpdate(SlaveKcpSocketPrivate *slave, quint64 due);
+    void updateNow(SlaveKcpSocketPrivate *slave);
+    void doUpdateSlaves();
     HostAddress resolve(const QString &hostName, QSharedPointer<SocketDnsCache> dnsCache);
 public:
-    QMap<QString, QPointer<class SlaveKcpSocketPrivate>> receiversByHostAndPort;
-    QMap<quint32, QPointer<class SlaveKcpSocketPrivate>> receiversByConnectionId;
+    QHash<KcpPeerKey, QPointer<class SlaveKcpSocketPrivate>> receiversByHostAndPort;
+    QHash<quint32, QPointer<class SlaveKcpSocketPrivate>> receiversByConnectionId;
     QSharedPointer<Socket> rawSocket;
     Queue<KcpSocket *> pendingSlaves;
+    QVector<QList<KcpUpdateEntry>> updateWheel;
+    QList<QPointer<SlaveKcpSocketPrivate>> urgentUpdates;  // by updateKcp(), such as sending data.
+    Event updateWakeUp;
+    quint64 updateTick;  // the last tick processed.
+    quint64 updatePass;
+    int scheduledUpdates;
     int nextPathSocket;  // 0 for rawSocket
+    int shardIndex;  // the connection ids of slaves are congruent to shardIndex modulo shardCount.
+    int shardCount;
 };
 
 class SlaveKcpSocketPrivate : public KcpSocketPrivate
@@ -186,12 +318,19 @@ public:
     virtual bool leaveMulticastGroup(const HostAddress &groupAddress, const NetworkInterface &iface) override;
     virtual NetworkInterface multicastInterface() const override;
     virtual bool setMulticastInterface(const NetworkInterface &iface) override;
+    virtual bool setShard(int index, int count) override;
+    virtual bool setDontFragment(bool enabled) override;
 public:
     virtual qint32 rawSend(const char *data, qint32 size) override;
+    virtual qint32 rawSendMany(const QList<QByteArray> &packets) override;
     virtual qint32 udpSend(const char *data, qint32 size, const HostAddress &addr, quint16 port) override;
+    virtual void updateKcp() override;
 public:
-    QString originalHostAndPort;
+    KcpPeerKey originalPeer;
     QPointer<MasterKcpSocketPrivate> parent;
+    quint64 scheduledTick;  // in the timing wheel of parent, 0 if not scheduled.
+    quint64 updatePass;  // updated once in a pass of parent.
+    bool urgentUpdate;
 };
 
 KcpSocket *SlaveKcpSocketPrivate::create(KcpSocketPrivate *d, const HostAddress &addr, quint16 port,
@@ -212,9 +351,13 @@ int kcp_callback(const char *buf, int len, ikcpcb *, void *user)
         qtng_warning << "kcp_callback got invalid data.";
         return -1;
     }
-    const QByteArray &packet = p->makeDataPacket(buf, len);
+    QList<QByteArray> packets;
+    p->makeOutputPackets(buf, len, p->outputBatch ? p->outputBatch : &packets);
+    if (p->outputBatch) {
+        return len;
+    }
     qint32 sentBytes = -1;
-    for (int i = 0; i < 1; ++i) {
+    for (const QByteArray &packet : packets) {
         sentBytes = p->rawSend(packet.data(), packet.size());
         if (sentBytes != packet.size()) {  // but why this happens?
             if (p->error == Socket::NoError) {
@@ -228,7 +371,133 @@ int kcp_callback(const char *buf, int len, ikcpcb *, void *user)
             return -1;
         }
     }
-    return sentBytes;
+    return len;
+}
+
+namespace {
+
+struct KcpSegmentPoolMetrics
+{
+    KcpSegmentPoolMetrics();
+    MetricCounter *hits;
+    MetricCounter *misses;
+    MetricGauge *idleBytes;
+};
+
+KcpSegmentPoolMetrics::KcpSegmentPoolMetrics()
+{
+    MetricsRegistry *registry = MetricsRegistry::instance();
+    hits = registry->counter("qtng_kcp_segment_pool_hits_total", "Kcp segments allocated from the pools.");
+    misses = registry->counter("qtng_kcp_segment_pool_misses_total", "Kcp segments allocated by malloc().");
+    idleBytes = registry->gauge("qtng_kcp_segment_pool_idle_bytes", "Bytes of free kcp segments kept by the pools.");
+}
+
+KcpSegmentPoolMetrics &kcpSegmentPoolMetrics()
+{
+    static KcpSegmentPoolMetrics metrics;
+    return metrics;
+}
+
+}  // namespace
+
+// ikcp allocates a segment for every fragment sent, received and acknowledged, so the blocks are recycled by the
+// thread freeing them, in power of two classes from 256 bytes to 64KB. every block starts with its class, because
+// ikcp_free() is not told the size.
+class KcpSegmentPool
+{
+public:
+    enum { MinClassShift = 8, ClassCount = 9, MaxIdleBytesPerClass = 1024 * 1024, HeaderSize = 16 };
+    ~KcpSegmentPool();
+    static void *allocate(size_t size);
+    static void release(void *ptr);
+private:
+    static KcpSegmentPool *local();
+    QVector<char *> idle[ClassCount];
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<KcpSegmentPool *>, kcpSegmentPools)
+
+KcpSegmentPool::~KcpSegmentPool()
+{
+    for (int i = 0; i < ClassCount; ++i) {
+        kcpSegmentPoolMetrics().idleBytes->sub(static_cast<qint64>(idle[i].size()) << (MinClassShift + i));
+        for (char *block : idle[i]) {
+            free(block);
+        }
+    }
+}
+
+KcpSegmentPool *KcpSegmentPool::local()
+{
+    // null while the process exits, then the blocks are freed directly.
+    QThreadStorage<KcpSegmentPool *> *storage = kcpSegmentPools();
+    if (!storage) {
+        return nullptr;
+    }
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(new KcpSegmentPool());
+    }
+    return storage->localData();
+}
+
+void *KcpSegmentPool::allocate(size_t size)
+{
+    int sizeClass = 0;
+    while (sizeClass < ClassCount && (static_cast<size_t>(1) << (MinClassShift + sizeClass)) < size + HeaderSize) {
+        ++sizeClass;
+    }
+    char *block = nullptr;
+    if (sizeClass < ClassCount) {
+        KcpSegmentPool *pool = local();
+        if (pool && !pool->idle[sizeClass].isEmpty()) {
+            block = pool->idle[sizeClass].takeLast();
+            kcpSegmentPoolMetrics().idleBytes->sub(static_cast<qint64>(1) << (MinClassShift + sizeClass));
+            kcpSegmentPoolMetrics().hits->add();
+        } else {
+            block = static_cast<char *>(malloc(static_cast<size_t>(1) << (MinClassShift + sizeClass)));
+            kcpSegmentPoolMetrics().misses->add();
+        }
+    } else {
+        sizeClass = -1;  // too large to be pooled.
+        block = static_cast<char *>(malloc(size + HeaderSize));
+    }
+    if (!block) {
+        return nullptr;
+    }
+    *reinterpret_cast<int *>(block) = sizeClass;
+    return block + HeaderSize;
+}
+
+void KcpSegmentPool::release(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    char *block = static_cast<char *>(ptr) - HeaderSize;
+    const int sizeClass = *reinterpret_cast<int *>(block);
+    if (sizeClass >= 0) {
+        KcpSegmentPool *pool = local();
+        const qint64 blockSize = static_cast<qint64>(1) << (MinClassShift + sizeClass);
+        if (pool && (pool->idle[sizeClass].size() + 1) * blockSize <= MaxIdleBytesPerClass) {
+            pool->idle[sizeClass].append(block);
+            kcpSegmentPoolMetrics().idleBytes->add(blockSize);
+            return;
+        }
+    }
+    free(block);
+}
+
+static bool setKcpAllocator()
+{
+    ikcp_allocator(KcpSegmentPool::allocate, KcpSegmentPool::release);
+    return true;
+}
+
+static void installKcpAllocator()
+{
+    // once for the process, before any block is allocated by ikcp.
+    static const bool installed = setKcpAllocator();
+    Q_UNUSED(installed);
 }
 
 KcpSocketPrivate::KcpSocketPrivate(KcpSocket *q)
@@ -236,15 +505,38 @@ KcpSocketPrivate::KcpSocketPrivate(KcpSocket *q)
     , operations(new CoroutineGroup)
     , state(Socket::UnconnectedState)
     , error(Socket::NoError)
+    , sendingBytes(BufferBudget::KcpSending)
     , zeroTimestamp(static_cast<quint64>(QDateTime::currentMSecsSinceEpoch()))
     , lastActiveTimestamp(zeroTimestamp)
     , lastKeepaliveTimestamp(zeroTimestamp)
     , tearDownTime(1000 * 30)
+    , outputBatch(nullptr)
     , waterLine(1024)
     , connectionId(0)
     , remotePort(0)
     , mode(KcpSocket::Internet)
-{
+    , lastFecAnnounceTimestamp(0)
+    , fecDataShards(0)
+    , fecParityShards(0)
+    , fecAnnounces(0)
+    , peerFec(false)
+    , fecAckPending(false)
+    , messageMode(false)
+    , lastAdaptTimestamp(0)
+    , lastXmit(0)
+    , lastSndNxt(0)
+    , lossRate(0.0f)
+    , adaptiveLevel(-1)
+    , pathMtuDiscovery(false)
+    , pathMtu(BasePathMtu)
+    , probeLow(BasePathMtu)
+    , probeHigh(BasePathMtu)
+    , probingSize(0)
+    , probeCount(0)
+    , lastProbeTimestamp(0)
+    , nextSearchTimestamp(0)
+{
+    installKcpAllocator();
     kcp = ikcp_create(0, this);
     ikcp_setoutput(kcp, kcp_callback);
     sendingQueueEmpty.set();
@@ -320,7 +612,185 @@ void KcpSocketPrivate::setMode(KcpSocket::Mode mode)
         ikcp_wndsize(kcp, 32, 128);
         kcp->interval = 5;
         break;
+    case KcpSocket::Adaptive:
+        waterLine = 256;
+        ikcp_nodelay(kcp, 1, 30, 3, 1);
+        ikcp_setmtu(kcp, 1400);
+        ikcp_wndsize(kcp, 128, 512);
+        lastXmit = kcp->xmit;
+        lastSndNxt = kcp->snd_nxt;
+        lossRate = 0.0f;
+        adaptiveLevel = 2;
+        break;
+    }
+    if (pathMtuDiscovery) {
+        ikcp_setmtu(kcp, static_cast<int>(pathMtu) - 1);
+    }
+    if (!fecEncoder.isNull()) {
+        ikcp_setmtu(kcp, static_cast<int>(kcp->mtu) - FecOverhead);
+    }
+}
+
+void KcpSocketPrivate::adapt(quint64 now)
+{
+    if (now < lastAdaptTimestamp + AdaptInterval) {
+        return;
+    }
+    lastAdaptTimestamp = now;
+    const quint32 resent = kcp->xmit - lastXmit;
+    const quint32 sent = kcp->snd_nxt - lastSndNxt + resent;
+    lastXmit = kcp->xmit;
+    lastSndNxt = kcp->snd_nxt;
+    if (sent == 0) {
+        return;  // nothing is measured on idle links.
+    }
+    lossRate = lossRate * 0.75f + (static_cast<float>(resent) / sent) * 0.25f;
+    if (mode != KcpSocket::Adaptive) {
+        return;
+    }
+
+    const qint32 rtt = kcp->rx_srtt;
+    int level;
+    if (lossRate > 0.1f || rtt > 300) {
+        level = 3;
+    } else if (lossRate > 0.02f || rtt > 100) {
+        level = 2;
+    } else if (rtt > 20) {
+        level = 1;
+    } else {
+        level = 0;
+    }
+    if (level != adaptiveLevel) {
+        // the presets of Ethernet, FastInternet, Internet and LargeDelayInternet.
+        static const int settings[4][4] = { { 1, 10, 2, 1 }, { 1, 20, 2, 1 }, { 1, 30, 3, 1 }, { 0, 40, 4, 1 } };
+        const int *setting = settings[level];
+        ikcp_nodelay(kcp, setting[0], setting[1], setting[2], setting[3]);
+#ifdef DEBUG_PROTOCOL
+        qtng_debug << "adapt kcp to level" << level << "rtt:" << rtt << "loss:" << lossRate;
+#endif
+        adaptiveLevel = level;
+    }
+
+    // grow the window while the queue is longer than it, and halve it on heavy loss.
+    quint32 sendWindow = kcp->snd_wnd;
+    const int waiting = ikcp_waitsnd(kcp);
+    if (lossRate > 0.1f) {
+        sendWindow = qMax<quint32>(32, sendWindow / 2);
+    } else if (lossRate < 0.02f && waiting > static_cast<int>(sendWindow)) {
+        sendWindow = qMin<quint32>(1024, sendWindow * 2);
+    }
+    if (sendWindow != kcp->snd_wnd) {
+        ikcp_wndsize(kcp, static_cast<int>(sendWindow), static_cast<int>(qMax(kcp->rcv_wnd, sendWindow)));
+    }
+}
+
+bool KcpSocketPrivate::setPathMtuDiscovery(bool enabled)
+{
+    if (!setDontFragment(enabled) && enabled) {
+        return false;
+    }
+    pathMtuDiscovery = enabled;
+    if (enabled) {
+        // start from the base, which is never fragmented, and raise it by the acknowledged probes.
+        pathMtu = probeLow = probeHigh = BasePathMtu;
+        probingSize = 0;
+        nextSearchTimestamp = 0;
+        ScopedLock<RLock> l(kcpLock);
+        Q_UNUSED(l);
+        applyPathMtu();
     }
+    return true;
+}
+
+void KcpSocketPrivate::probePathMtu(quint64 now)
+{
+    if (probingSize != 0) {
+        const quint64 timeout = static_cast<quint64>(qMax<qint32>(200, kcp->rx_rto));
+        if (now < lastProbeTimestamp + timeout) {
+            return;
+        }
+        if (probeCount < MaxPathMtuProbes) {
+            sendPathMtuProbe(now);
+            return;
+        }
+        // all probes are lost, it is larger than the path.
+        probeHigh = probingSize;
+        probingSize = 0;
+    } else if (probeHigh - probeLow <= PathMtuResolution) {
+        if (now < nextSearchTimestamp) {
+            return;
+        }
+        // search again, the path may be changed.
+        probeLow = pathMtu;
+        probeHigh = MaxPathMtu;
+    }
+    if (probeHigh - probeLow <= PathMtuResolution) {
+        nextSearchTimestamp = now + PathMtuRaiseInterval;
+        return;
+    }
+    probingSize = probeLow + (probeHigh - probeLow) / 2;
+    probeCount = 0;
+    sendPathMtuProbe(now);
+}
+
+void KcpSocketPrivate::sendPathMtuProbe(quint64 now)
+{
+    QByteArray packet(static_cast<int>(probingSize), '\0');
+    uchar *header = reinterpret_cast<uchar *>(packet.data());
+    header[0] = static_cast<uchar>(PACKET_TYPE_MTU_PROBE);
+    qToBigEndian<quint32>(this->connectionId, header + 1);
+    header[5] = 0x00;
+    ++probeCount;
+    lastProbeTimestamp = now;
+    if (rawSend(packet.constData(), packet.size()) != packet.size()) {
+        // EMSGSIZE if it is larger than the mtu of interface.
+        probeHigh = probingSize;
+        probingSize = 0;
+    }
+}
+
+void KcpSocketPrivate::handlePathMtuProbe(const char *buf, quint32 len)
+{
+    if (len < 6) {
+        return;
+    }
+    if (buf[5] == 0x00) {
+        // acknowledge the size received, the probes of old peers are never answered.
+        uchar ack[10];
+        ack[0] = static_cast<uchar>(PACKET_TYPE_MTU_PROBE);
+        qToBigEndian<quint32>(this->connectionId, ack + 1);
+        ack[5] = 0x01;
+        qToBigEndian<quint32>(len, ack + 6);
+        rawSend(reinterpret_cast<char *>(ack), sizeof(ack));
+        return;
+    }
+    if (len < 10 || !pathMtuDiscovery) {
+        return;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    const quint32 size = qFromBigEndian<quint32>(buf + 6);
+#else
+    const quint32 size = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(buf + 6));
+#endif
+    if (size <= pathMtu || size > MaxPathMtu) {
+        return;
+    }
+    // a late acknowledgement of the former probes also proves the size.
+    pathMtu = size;
+    probeLow = qMax(probeLow, size);
+    probeHigh = qMax(probeHigh, probeLow);
+    if (size >= probingSize) {
+        probingSize = 0;
+    }
+    ScopedLock<RLock> l(kcpLock);
+    Q_UNUSED(l);
+    applyPathMtu();
+}
+
+void KcpSocketPrivate::applyPathMtu()
+{
+    // the data packet is the output of kcp after a type byte.
+    ikcp_setmtu(kcp, static_cast<int>(pathMtu) - 1 - (fecEncoder.isNull() ? 0 : FecOverhead));
 }
 
 qint32 KcpSocketPrivate::send(const char *data, qint32 size, bool all)
@@ -328,6 +798,11 @@ qint32 KcpSocketPrivate::send(const char *data, qint32 size, bool all)
     if (size <= 0 || !isValid()) {
         return -1;
     }
+    if (messageMode && size > maxMessageSize()) {
+        error = Socket::DatagramTooLargeError;
+        errorString = QString::fromLatin1("the message is larger than KcpSocket::maxMessageSize().");
+        return -1;
+    }
 
     int count = 0;
     while (count < size) {
@@ -336,12 +811,16 @@ qint32 KcpSocketPrivate::send(const char *data, qint32 size, bool all)
             errorString = QString::fromLatin1("KcpSocket is not connected.");
             return -1;
         }
+        if (sendingBytes.isPressured()) {
+            sendingBytes.waitForRoom();
+        }
         bool ok = sendingQueueNotFull.wait();
         if (!ok) {
             return -1;
         }
         ScopedLock<RLock> l(kcpLock);
-        qint32 nextBlockSize = qMin<qint32>(static_cast<qint32>(kcp->mss), size - count);
+        // kcp splits the message into fragments, and the receiver assembles them.
+        qint32 nextBlockSize = messageMode ? size : qMin<qint32>(static_cast<qint32>(kcp->mss), size - count);
         int result = ikcp_send(kcp, data + count, nextBlockSize);
         if (result < 0) {
             qtng_warning << "why this happended?";
@@ -374,12 +853,23 @@ qint32 KcpSocketPrivate::recv(char *data, qint32 size, bool all)
         }
         int peeksize = ikcp_peeksize(kcp);
         if (peeksize > 0) {
-            QByteArray buf(peeksize, Qt::Uninitialized);
             ScopedLock<RLock> l(kcpLock);
             Q_UNUSED(l);
-            int readBytes = ikcp_recv(kcp, buf.data(), buf.size());
-            Q_ASSERT(readBytes == peeksize);
-            receivingBuffer.append(buf);
+            if (receivingBuffer.isEmpty() && peeksize <= size) {
+                // read the message into the buffer of caller directly, without allocation.
+                int readBytes = ikcp_recv(kcp, data, peeksize);
+                Q_ASSERT(readBytes == peeksize);
+                if (!all || readBytes == size) {
+                    return readBytes;
+                }
+                receivingBuffer.append(data, readBytes);
+            } else {
+                const int oldSize = receivingBuffer.size();
+                receivingBuffer.resize(oldSize + peeksize);
+                int readBytes = ikcp_recv(kcp, receivingBuffer.data() + oldSize, peeksize);
+                Q_ASSERT(readBytes == peeksize);
+                receivingBuffer.resize(oldSize + qMax(0, readBytes));
+            }
         }
         if (!receivingBuffer.isEmpty()) {
             if (!all || receivingBuffer.size() >= size) {
@@ -403,23 +893,17 @@ bool KcpSocketPrivate::handleDatagram(const char *buf, quint32 len)
     if (len < 5) {
         return true;
     }
-    int result;
     switch (buf[0]) {
-    case PACKET_TYPE_UNCOMPRESSED_DATA: {
-        ScopedLock<RLock> l(kcpLock);
-        Q_UNUSED(l);
-        result = ikcp_input(kcp, buf + 1, len - 1);
-    }
-        if (result < 0) {
-            // invalid datagram
-#ifdef DEBUG_PROTOCOL
-            qtng_debug << "invalid datagram. kcp returns" << result;
-#endif
-        } else {
-            lastActiveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
-            receivingQueueNotEmpty.set();
-            updateKcp();
-        }
+    case PACKET_TYPE_UNCOMPRESSED_DATA:
+        inputKcp(buf + 1, len - 1);
+        break;
+    case PACKET_TYPE_FEC_DATA:
+    case PACKET_TYPE_FEC_PARITY:
+        handleFecPacket(buf, len);
+        break;
+    case PACKET_TYPE_FEC_ANNOUNCE:
+        lastActiveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+        handleFecAnnounce(len > 5 && (buf[5] & 0x01));
         break;
     case PACKET_TYPE_CREATE_MULTIPATH:
         break;
@@ -429,82 +913,138 @@ bool KcpSocketPrivate::handleDatagram(const char *buf, quint32 len)
     case PACKET_TYPE_KEEPALIVE:
         lastActiveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
         break;
+    case PACKET_TYPE_MTU_PROBE:
+        lastActiveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+        handlePathMtuProbe(buf, len);
+        break;
     default:
         break;
     }
     return true;
 }
 
-void KcpSocketPrivate::doUpdate()
+void KcpSocketPrivate::inputKcp(const char *data, quint32 len)
 {
-    Q_Q(KcpSocket);
-    // in close(), state is set to Socket::UnconnectedState but error = NoError.
-    while (state == Socket::ConnectedState || (state == Socket::UnconnectedState && error == Socket::NoError)) {
-        quint64 now = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
-        // now and lastActiveTimestamp both are unsigned int, we should check which is larger before apply minus
-        // operator to them.
-        if (now > lastActiveTimestamp && (now - lastActiveTimestamp > tearDownTime)
-            && state == Socket::ConnectedState) {
+    int result;
+    {
+        ScopedLock<RLock> l(kcpLock);
+        Q_UNUSED(l);
+        result = ikcp_input(kcp, data, len);
+    }
+    if (result < 0) {
+        // invalid datagram
 #ifdef DEBUG_PROTOCOL
-            qtng_debug << "kcp socket tearDown!";
+        qtng_debug << "invalid datagram. kcp returns" << result;
 #endif
-            error = Socket::SocketTimeoutError;
-            errorString = QString::fromLatin1("KcpSocket is timeout.");
-            close(true);
-            return;
-        }
-        quint32 current = static_cast<quint32>(now - zeroTimestamp);  // impossible to overflow.
-        {
-            ScopedLock<RLock> l(kcpLock);
-            Q_UNUSED(l);
-            ikcp_update(kcp,
-                        current);  // ikcp_update() call ikcp_flush() and then kcp_callback(), and maybe close(true)
+    } else {
+        lastActiveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+        receivingQueueNotEmpty.set();
+        updateKcp();
+    }
+}
+
+void KcpSocketPrivate::handleFecPacket(const char *buf, quint32 len)
+{
+    if (len < static_cast<quint32>(FecHeaderSize)) {
+        return;
+    }
+    if (!peerFec) {
+        handleFecAnnounce(true);
+    }
+    const bool isParity = buf[0] == PACKET_TYPE_FEC_PARITY;
+    const int dataShards = static_cast<quint8>(buf[5]);
+    const int parityShards = static_cast<quint8>(buf[6]);
+    const quint32 seq = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(buf + 7));
+    const char *shard = buf + FecHeaderSize;
+    const int size = static_cast<int>(len) - FecHeaderSize;
+    // the conv of kcp segment is not sent, which is zero as the connection id replaced by receiver.
+    QByteArray segment;
+    if (!isParity) {
+        segment.resize(size + 4);
+        memset(segment.data(), 0, 4);
+        memcpy(segment.data() + 4, shard, static_cast<size_t>(size));
+        inputKcp(segment.constData(), static_cast<quint32>(segment.size()));
+    }
+    if (fecDecoder.isNull()) {
+        fecDecoder.reset(new KcpFecDecoder());
+    }
+    QList<QByteArray> recovered;
+    fecDecoder->addShard(seq, dataShards, parityShards, shard, size, isParity, &recovered);
+    for (const QByteArray &data : recovered) {
+        segment.resize(data.size() + 4);
+        memset(segment.data(), 0, 4);
+        memcpy(segment.data() + 4, data.constData(), static_cast<size_t>(data.size()));
+        inputKcp(segment.constData(), static_cast<quint32>(segment.size()));
+    }
+}
+
+void KcpSocketPrivate::handleFecAnnounce(bool ack)
+{
+    if (!ack) {
+        fecAckPending = true;
+        updateKcp();
+    }
+    if (!peerFec) {
+        peerFec = true;
+        setFecEncoding(fecDataShards > 0);
+    }
+}
+
+void KcpSocketPrivate::setFecEncoding(bool enabled)
+{
+    ScopedLock<RLock> l(kcpLock);
+    Q_UNUSED(l);
+    if (enabled && peerFec) {
+        if (fecEncoder.isNull()) {
+            ikcp_setmtu(kcp, static_cast<int>(kcp->mtu) - FecOverhead);
         }
-        if (!(state == Socket::ConnectedState || (state == Socket::UnconnectedState && error == Socket::NoError))) {
+        fecEncoder.reset(new KcpFecEncoder(fecDataShards, fecParityShards));
+    } else if (!fecEncoder.isNull()) {
+        fecEncoder.reset();
+        ikcp_setmtu(kcp, static_cast<int>(kcp->mtu) + FecOverhead);
+    }
+}
+
+void KcpSocketPrivate::makeOutputPackets(const char *buf, int len, QList<QByteArray> *packets)
+{
+    if (fecEncoder.isNull() || len < 4) {
+        packets->append(makeDataPacket(buf, len));
+        return;
+    }
+    // one parity group is made of the consecutive output of kcp, which is usually a burst of segments.
+    QVector<QByteArray> parity;
+    const quint32 seq = fecEncoder->addData(buf + 4, len - 4, &parity);
+    packets->append(makeFecPacket(PACKET_TYPE_FEC_DATA, seq, buf + 4, len - 4));
+    for (int i = 0; i < parity.size(); ++i) {
+        const QByteArray &shard = parity.at(i);
+        packets->append(makeFecPacket(PACKET_TYPE_FEC_PARITY, seq + 1 + static_cast<quint32>(i), shard.constData(),
+                                      shard.size()));
+    }
+}
+
+void KcpSocketPrivate::doUpdate()
+{
+    while (isUpdating()) {
+        quint64 now = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+        QList<QByteArray> packets;
+        quint32 interval;
+        if (!updateOnce(now, &packets, &interval)) {
             return;
         }
-
-        // now and lastKeepaliveTimestamp both are unsigned int, we should check which is larger before apply minus
-        // operator to them.
-        if (now > lastKeepaliveTimestamp && (now - lastKeepaliveTimestamp > 1000 * 5)
-            && state == Socket::ConnectedState) {
-            const QByteArray &packet = makeKeepalivePacket();
-            if (rawSend(packet.data(), packet.size()) != packet.size()) {
-#ifdef DEBUG_PROTOCOL
-                qtng_debug << "can not send keep alive packet.";
-#endif
-                close(true);
-                return;
-            } else {
+        if (!packets.isEmpty() && rawSendMany(packets) != packets.size()) {
+            if (error == Socket::NoError) {
+                error = Socket::SocketAccessError;
+                errorString = QString::fromLatin1("can not send udp packet");
+            }
 #ifdef DEBUG_PROTOCOL
-                qtng_debug << "keep alive packet sent.";
+            qtng_warning << "can not send packet.";
 #endif
-            }
+            close(true);
+            return;
         }
-
-        int sendingQueueSize = ikcp_waitsnd(kcp);
-        if (sendingQueueSize <= 0) {
-            sendingQueueNotFull.set();
-            sendingQueueEmpty.set();
-            q->busy.clear();
-            q->notBusy.set();
-        } else {
-            sendingQueueEmpty.clear();
-            if (static_cast<quint32>(sendingQueueSize) > waterLine) {
-                if (static_cast<quint32>(sendingQueueSize) > (waterLine * 1.2)) {
-                    sendingQueueNotFull.clear();
-                }
-                q->busy.set();
-                q->notBusy.clear();
-            } else {
-                sendingQueueNotFull.set();
-                q->busy.clear();
-                q->notBusy.set();
-            }
+        if (!isUpdating()) {
+            return;
         }
-
-        quint32 ts = ikcp_check(kcp, current);
-        quint32 interval = ts - current;
         if (interval > 0) {
             forceToUpdate.close();
             try {
@@ -521,6 +1061,81 @@ void KcpSocketPrivate::doUpdate()
     }
 }
 
+bool KcpSocketPrivate::updateOnce(quint64 now, QList<QByteArray> *packets, quint32 *interval)
+{
+    Q_Q(KcpSocket);
+    // now and lastActiveTimestamp both are unsigned int, we should check which is larger before apply minus
+    // operator to them.
+    if (now > lastActiveTimestamp && (now - lastActiveTimestamp > tearDownTime) && state == Socket::ConnectedState) {
+#ifdef DEBUG_PROTOCOL
+        qtng_debug << "kcp socket tearDown!";
+#endif
+        error = Socket::SocketTimeoutError;
+        errorString = QString::fromLatin1("KcpSocket is timeout.");
+        close(true);
+        return false;
+    }
+    quint32 current = static_cast<quint32>(now - zeroTimestamp);  // impossible to overflow.
+    {
+        ScopedLock<RLock> l(kcpLock);
+        Q_UNUSED(l);
+        outputBatch = packets;
+        ikcp_update(kcp, current);  // ikcp_update() call ikcp_flush() and then kcp_callback()
+        outputBatch = nullptr;
+        adapt(now);
+    }
+
+    // now and lastKeepaliveTimestamp both are unsigned int, we should check which is larger before apply minus
+    // operator to them. the keepalive is not needed if there is any output, which updates lastKeepaliveTimestamp.
+    if (packets->isEmpty() && now > lastKeepaliveTimestamp && (now - lastKeepaliveTimestamp > 1000 * 5)
+        && state == Socket::ConnectedState) {
+#ifdef DEBUG_PROTOCOL
+        qtng_debug << "sending keep alive packet.";
+#endif
+        packets->append(makeKeepalivePacket());
+    }
+    // the announce is sent after the peer is known, it makes a new slave of server if the connection id is zero.
+    if (fecAckPending
+        || (fecDataShards > 0 && !peerFec && connectionId != 0 && fecAnnounces < MaxFecAnnounces
+            && now > lastFecAnnounceTimestamp + 1000 && state == Socket::ConnectedState)) {
+        packets->append(makeFecAnnouncePacket(fecAckPending));
+        if (!fecAckPending) {
+            ++fecAnnounces;
+        }
+        fecAckPending = false;
+        lastFecAnnounceTimestamp = now;
+    }
+    if (pathMtuDiscovery && connectionId != 0 && state == Socket::ConnectedState) {
+        probePathMtu(now);
+    }
+
+    int sendingQueueSize = ikcp_waitsnd(kcp);
+    sendingBytes.set(static_cast<qint64>(qMax(sendingQueueSize, 0)) * kcp->mss);
+    if (sendingQueueSize <= 0) {
+        sendingQueueNotFull.set();
+        sendingQueueEmpty.set();
+        q->busy.clear();
+        q->notBusy.set();
+    } else {
+        sendingQueueEmpty.clear();
+        if (static_cast<quint32>(sendingQueueSize) > waterLine) {
+            if (static_cast<quint32>(sendingQueueSize) > (waterLine * 1.2)) {
+                sendingQueueNotFull.clear();
+            }
+            q->busy.set();
+            q->notBusy.clear();
+        } else {
+            sendingQueueNotFull.set();
+            q->busy.clear();
+            q->notBusy.set();
+        }
+    }
+
+    quint32 ts = ikcp_check(kcp, current);
+    *interval = ts - current;
+    return true;
+}
+
 void KcpSocketPrivate::updateKcp()
 {
     QSharedPointer<Coroutine> t = operations->spawnWithName(
@@ -592,24 +1207,66 @@ QByteArray KcpSocketPrivate::makeMultiPathPacket(quint32 connectionId)
     return packet;
 }
 
+QByteArray KcpSocketPrivate::makeFecPacket(char type, quint32 seq, const char *data, qint32 size)
+{
+    QByteArray packet(FecHeaderSize + size, Qt::Uninitialized);
+    uchar *header = reinterpret_cast<uchar *>(packet.data());
+    header[0] = static_cast<uchar>(type);
+    qToBigEndian<quint32>(this->connectionId, header + 1);
+    header[5] = static_cast<uchar>(fecEncoder->dataShards());
+    header[6] = static_cast<uchar>(fecEncoder->parityShards());
+    qToBigEndian<quint32>(seq, header + 7);
+    memcpy(packet.data() + FecHeaderSize, data, static_cast<size_t>(size));
+    return packet;
+}
+
+QByteArray KcpSocketPrivate::makeFecAnnouncePacket(bool ack)
+{
+    QByteArray packet(8, Qt::Uninitialized);
+    uchar *header = reinterpret_cast<uchar *>(packet.data());
+    header[0] = static_cast<uchar>(PACKET_TYPE_FEC_ANNOUNCE);
+    qToBigEndian<quint32>(this->connectionId, header + 1);
+    header[5] = ack ? 0x01 : 0x00;
+    header[6] = static_cast<uchar>(fecDataShards);
+    header[7] = static_cast<uchar>(fecParityShards);
+    return packet;
+}
+
 MasterKcpSocketPrivate::MasterKcpSocketPrivate(HostAddress::NetworkLayerProtocol protocol, KcpSocket *q)
     : KcpSocketPrivate(q)
     , rawSocket(new Socket(protocol, Socket::UdpSocket))
+    , updateTick(0)
+    , updatePass(0)
+    , scheduledUpdates(0)
     , nextPathSocket(0)
+    , shardIndex(0)
+    , shardCount(1)
 {
+    // the registered io of windows, a no-op elsewhere.
+    rawSocket->setOption(Socket::RegisteredIoSocketOption, true);
 }
 
 MasterKcpSocketPrivate::MasterKcpSocketPrivate(qintptr socketDescriptor, KcpSocket *q)
     : KcpSocketPrivate(q)
     , rawSocket(new Socket(socketDescriptor))
+    , updateTick(0)
+    , updatePass(0)
+    , scheduledUpdates(0)
     , nextPathSocket(0)
+    , shardIndex(0)
+    , shardCount(1)
 {
 }
 
 MasterKcpSocketPrivate::MasterKcpSocketPrivate(QSharedPointer<Socket> rawSocket, KcpSocket *q)
     : KcpSocketPrivate(q)
     , rawSocket(rawSocket)
+    , updateTick(0)
+    , updatePass(0)
+    , scheduledUpdates(0)
     , nextPathSocket(0)
+    , shardIndex(0)
+    , shardCount(1)
 {
 }
 
@@ -725,183 +1382,364 @@ quint32 MasterKcpSocketPrivate::nextConnectionId()
 {
     quint32 id;
     do {
-#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-        id = qFromBigEndian<quint32>(randomBytes(4).constData());
-#else
-        id = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(randomBytes(4).constData()));
-#endif
-    } while (receiversByConnectionId.contains(id));
+        randomBytes(reinterpret_cast<char *>(&id), static_cast<int>(sizeof(id)));
+        if (shardCount > 1) {
+            const quint64 t = static_cast<quint64>(id) - id % static_cast<quint32>(shardCount)
+                    + static_cast<quint32>(shardIndex);
+            id = t > 0xffffffffu ? 0 : static_cast<quint32>(t);
+        }
+    } while (id == 0 || receiversByConnectionId.contains(id));
     return id;
 }
 
-void MasterKcpSocketPrivate::doReceive()
+// read datagrams in batches, recvmmsg() moves many of them per syscall on linux.
+void MasterKcpSocketPrivate::receiveDatagrams(bool (MasterKcpSocketPrivate::*handler)(char *, qint32, HostAddress,
+                                                                                      quint16))
 {
-    Q_Q(KcpSocket);
-    HostAddress addr;
-    quint16 port;
-    QByteArray buf(1024 * 64, Qt::Uninitialized);
+    const qint32 batchSize = 16;
+    const qint32 maxSlotSize = 1024 * 64;
+    qint32 slotSize = qBound<qint32>(1500, static_cast<qint32>(kcp->mtu) + 128, maxSlotSize);
+    QByteArray buf(slotSize * batchSize, Qt::Uninitialized);
+    qint32 sizes[batchSize];
+    HostAddress addrs[batchSize];
+    quint16 ports[batchSize];
     while (true) {
-        qint32 len = rawSocket->recvfrom(buf.data(), buf.size(), &addr, &port);
-        if (Q_UNLIKELY(len < 0 || addr.isNull() || port == 0)) {
+        qint32 count = rawSocket->recvfromMany(buf.data(), slotSize, batchSize, sizes, addrs, ports);
+        if (Q_UNLIKELY(count <= 0)) {
 #ifdef DEBUG_PROTOCOL
             qtng_debug << "KcpSocket can not receive udp packet." << rawSocket->errorString();
 #endif
             MasterKcpSocketPrivate::close(true);
             return;
         }
-        if (q->filter(buf.data(), &len, &addr, &port)) {
-            continue;
+        bool truncated = false;
+        for (qint32 i = 0; i < count; ++i) {
+            if (Q_UNLIKELY(sizes[i] > slotSize)) {
+                truncated = true;
+                continue;
+            }
+            if (Q_UNLIKELY(addrs[i].isNull() || ports[i] == 0)) {
+                MasterKcpSocketPrivate::close(true);
+                return;
+            }
+            if (!(this->*handler)(buf.data() + i * slotSize, sizes[i], addrs[i], ports[i])) {
+                return;
+            }
+        }
+        if (truncated && slotSize < maxSlotSize) {
+            // the peer uses a larger mtu, drop it and let kcp retransmit.
+            slotSize = maxSlotSize;
+            buf.resize(slotSize * batchSize);
         }
-        if (len < 5) {
+    }
+}
+
+void MasterKcpSocketPrivate::doReceive()
+{
+    receiveDatagrams(&MasterKcpSocketPrivate::handleReceivedDatagram);
+}
+
+bool MasterKcpSocketPrivate::handleReceivedDatagram(char *data, qint32 len, HostAddress addr, quint16 port)
+{
+    Q_Q(KcpSocket);
+    if (q->filter(data, &len, &addr, &port)) {
+        return true;
+    }
+    if (len < 5) {
 #ifdef DEBUG_PROTOCOL
-            qtng_debug << "got invalid kcp packet smaller than 5 bytes." << QByteArray(buf.data(), len);
+        qtng_debug << "got invalid kcp packet smaller than 5 bytes." << QByteArray(data, len);
 #endif
-            continue;
-        }
+        return true;
+    }
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-        quint32 connectionId = qFromBigEndian<quint32>(buf.data() + 1);
+    quint32 connectionId = qFromBigEndian<quint32>(data + 1);
 #else
-        quint32 connectionId = qFromBigEndian<quint32>(reinterpret_cast<uchar *>(buf.data() + 1));
+    quint32 connectionId = qFromBigEndian<quint32>(reinterpret_cast<uchar *>(data + 1));
 #endif
-        if (connectionId == 0) {
+    if (connectionId == 0) {
 #ifdef DEBUG_PROTOCOL
-            qtng_debug << "the kcp server side returns an invalid packet with zero connection id.";
+        qtng_debug << "the kcp server side returns an invalid packet with zero connection id.";
 #endif
-            continue;
+        return true;
+    } else {
+        if (this->connectionId == 0) {
+            this->connectionId = connectionId;
         } else {
-            if (this->connectionId == 0) {
-                this->connectionId = connectionId;
-            } else {
-                if (connectionId != this->connectionId) {
+            if (connectionId != this->connectionId) {
 #ifdef DEBUG_PROTOCOL
-                    qtng_debug << "the kcp server side returns an invalid packet with mismatched connection id.";
+                qtng_debug << "the kcp server side returns an invalid packet with mismatched connection id.";
 #endif
-                    continue;
-                } else {
-                    // do nothing.
-                }
+                return true;
+            } else {
+                // do nothing.
             }
         }
-        qToBigEndian<quint32>(0, reinterpret_cast<uchar *>(buf.data() + 1));
-        if (!handleDatagram(buf.data(), static_cast<quint32>(len))) {
-            return;
-        }
     }
+    qToBigEndian<quint32>(0, reinterpret_cast<uchar *>(data + 1));
+    if (!handleDatagram(data, static_cast<quint32>(len))) {
+        return false;
+    }
+    return true;
 }
 
 void MasterKcpSocketPrivate::doAccept()
+{
+    receiveDatagrams(&MasterKcpSocketPrivate::handleAcceptedDatagram);
+}
+
+bool MasterKcpSocketPrivate::handleAcceptedDatagram(char *data, qint32 len, HostAddress addr, quint16 port)
 {
     Q_Q(KcpSocket);
-    HostAddress addr;
-    quint16 port;
-    QByteArray buf(1024 * 64, Qt::Uninitialized);
-    while (true) {
-        qint32 len = rawSocket->recvfrom(buf.data(), buf.size(), &addr, &port);
-        if (Q_UNLIKELY(len < 0 || addr.isNull() || port == 0)) {
-#ifdef DEBUG_PROTOCOL
-            qtng_debug << "KcpSocket can not receive udp packet." << rawSocket->errorString();
-#endif
-            MasterKcpSocketPrivate::close(true);
-            return;
-        }
-        if (q->filter(buf.data(), &len, &addr, &port)) {
-            continue;
-        }
-        if (len < 5) {
+    if (q->filter(data, &len, &addr, &port)) {
+        return true;
+    }
+    if (len < 5) {
 #ifdef DEBUG_PROTOCOL
-            qtng_debug << "got invalid kcp packet smaller than 5 bytes.";
+        qtng_debug << "got invalid kcp packet smaller than 5 bytes.";
 #endif
-            continue;
-        }
+        return true;
+    }
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-        quint32 connectionId = qFromBigEndian<quint32>(buf.data() + 1);
-        qToBigEndian<quint32>(0, buf.data() + 1);
+    quint32 connectionId = qFromBigEndian<quint32>(data + 1);
+    qToBigEndian<quint32>(0, data + 1);
 #else
-        quint32 connectionId = qFromBigEndian<quint32>(reinterpret_cast<uchar *>(buf.data() + 1));
-        qToBigEndian<quint32>(0, reinterpret_cast<uchar *>(buf.data() + 1));
+    quint32 connectionId = qFromBigEndian<quint32>(reinterpret_cast<uchar *>(data + 1));
+    qToBigEndian<quint32>(0, reinterpret_cast<uchar *>(data + 1));
 #endif
-        const QString &key = concat(addr, port);
-        QPointer<SlaveKcpSocketPrivate> receiver;
-        receiver = receiversByHostAndPort.value(key);
-        if (!receiver.isNull()) {
+    const KcpPeerKey key(addr, port);
+    QPointer<SlaveKcpSocketPrivate> receiver;
+    if (connectionId != 0) {
+        // the fast path of established connections, which need not the lookup by address.
+        receiver = receiversByConnectionId.value(connectionId);
+        if (!receiver.isNull() && receiver->originalPeer == key) {
             receiver->remoteAddress = addr;
             receiver->remotePort = port;
-            if (connectionId != 0) {
-                if (receiver->connectionId == 0) {
-                    // only if the slave was created by accept(host, port), we had zero id.
-                    // if this connectionId is unique in client. we add it to the receiversByConnectionId map.
-                    // if it is not, say sorry, and disable the multipath feature.
-                    if (!receiversByConnectionId.contains(connectionId)) {
-                        // only happened in the newly accept(host, port) connections.
-                        // or remote create new conn with the same port as old, and the old packet is received.
-                        receiver->connectionId = connectionId;
-                        receiversByConnectionId.insert(connectionId, receiver);
-                    }
-                } else if (connectionId != receiver->connectionId) {
-#ifdef DEBUG_PROTOCOL
-                    qtng_debug << "the client sent a invalid connection id";
-#endif
-                    continue;
-                }
-            }
-            if (!receiver->handleDatagram(buf.data(), static_cast<quint32>(len))) {
-                receiversByHostAndPort.remove(receiver->originalHostAndPort);
+            if (!receiver->handleDatagram(data, static_cast<quint32>(len))) {
+                receiversByHostAndPort.remove(receiver->originalPeer);
                 receiversByConnectionId.remove(receiver->connectionId);
             }
-        } else {
-            if (connectionId != 0) {  // a multipath packet.
-                receiver = receiversByConnectionId.value(connectionId);
-                if (receiver.isNull()) {
-                    // it must be bad packet.
-                    const QByteArray &closePacket = makeShutdownPacket(connectionId);
-                    if (rawSocket->sendto(closePacket, addr, port) != closePacket.size()) {
-                        if (error == Socket::NoError) {
-                            error = Socket::SocketResourceError;
-                            errorString = QString::fromLatin1("KcpSocket can not send udp packet.");
-                        }
+            return true;
+        }
+    }
+    receiver = receiversByHostAndPort.value(key);
+    if (!receiver.isNull()) {
+        receiver->remoteAddress = addr;
+        receiver->remotePort = port;
+        if (connectionId != 0) {
+            if (receiver->connectionId == 0) {
+                // only if the slave was created by accept(host, port), we had zero id.
+                // if this connectionId is unique in client. we add it to the receiversByConnectionId map.
+                // if it is not, say sorry, and disable the multipath feature.
+                if (!receiversByConnectionId.contains(connectionId)) {
+                    // only happened in the newly accept(host, port) connections.
+                    // or remote create new conn with the same port as old, and the old packet is received.
+                    receiver->connectionId = connectionId;
+                    receiversByConnectionId.insert(connectionId, receiver);
+                }
+            } else if (connectionId != receiver->connectionId) {
 #ifdef DEBUG_PROTOCOL
-                        qtng_debug << errorString;
+                qtng_debug << "the client sent a invalid connection id";
 #endif
-                        MasterKcpSocketPrivate::close(true);
+                return true;
+            }
+        }
+        if (!receiver->handleDatagram(data, static_cast<quint32>(len))) {
+            receiversByHostAndPort.remove(receiver->originalPeer);
+            receiversByConnectionId.remove(receiver->connectionId);
+        }
+    } else {
+        if (connectionId != 0) {  // a multipath packet.
+            receiver = receiversByConnectionId.value(connectionId);
+            if (receiver.isNull()) {
+                // it must be bad packet.
+                const QByteArray &closePacket = makeShutdownPacket(connectionId);
+                if (rawSocket->sendto(closePacket, addr, port) != closePacket.size()) {
+                    if (error == Socket::NoError) {
+                        error = Socket::SocketResourceError;
+                        errorString = QString::fromLatin1("KcpSocket can not send udp packet.");
                     }
-                } else {
-                    Q_ASSERT(connectionId == receiver->connectionId);
-                    receiver->remoteAddress = addr;
-                    receiver->remotePort = port;
-                    if (!receiver->handleDatagram(buf.data(), static_cast<quint32>(len))) {
 #ifdef DEBUG_PROTOCOL
-                        qtng_debug << "can not handle multipath packet.";
+                    qtng_debug << errorString;
 #endif
-                        receiversByHostAndPort.remove(receiver->originalHostAndPort);
-                        receiversByConnectionId.remove(receiver->connectionId);
-                    }
+                    MasterKcpSocketPrivate::close(true);
                 }
-            } else if (pendingSlaves.size() < pendingSlaves.capacity()) {  // not full. process new connection.
-                QScopedPointer<KcpSocket> slave(SlaveKcpSocketPrivate::create(this, addr, port, this->mode));
-                SlaveKcpSocketPrivate *d = SlaveKcpSocketPrivate::getPrivateHelper(slave.data());
-                d->originalHostAndPort = key;
-                d->connectionId = nextConnectionId();
-                if (d->handleDatagram(buf.data(), static_cast<quint32>(len))) {
-                    receiversByHostAndPort.insert(key, d);
-                    receiversByConnectionId.insert(d->connectionId, d);
-                    pendingSlaves.put(slave.take());
-                    const QByteArray &multiPathPacket = makeMultiPathPacket(d->connectionId);
-                    if (rawSocket->sendto(multiPathPacket, addr, port) != multiPathPacket.size()) {
-                        if (error == Socket::NoError) {
-                            error = Socket::SocketResourceError;
-                            errorString = QString::fromLatin1("KcpSocket can not send udp packet.");
-                        }
+            } else {
+                Q_ASSERT(connectionId == receiver->connectionId);
+                receiver->remoteAddress = addr;
+                receiver->remotePort = port;
+                if (!receiver->handleDatagram(data, static_cast<quint32>(len))) {
 #ifdef DEBUG_PROTOCOL
-                        qtng_debug << errorString;
+                    qtng_debug << "can not handle multipath packet.";
 #endif
-                        MasterKcpSocketPrivate::close(true);
+                    receiversByHostAndPort.remove(receiver->originalPeer);
+                    receiversByConnectionId.remove(receiver->connectionId);
+                }
+            }
+        } else if (pendingSlaves.size() < pendingSlaves.capacity()) {  // not full. process new connection.
+            QScopedPointer<KcpSocket> slave(SlaveKcpSocketPrivate::create(this, addr, port, this->mode));
+            SlaveKcpSocketPrivate *d = SlaveKcpSocketPrivate::getPrivateHelper(slave.data());
+            d->originalPeer = key;
+            d->connectionId = nextConnectionId();
+            if (d->handleDatagram(data, static_cast<quint32>(len))) {
+                receiversByHostAndPort.insert(key, d);
+                receiversByConnectionId.insert(d->connectionId, d);
+                pendingSlaves.put(slave.take());
+                const QByteArray &multiPathPacket = makeMultiPathPacket(d->connectionId);
+                if (rawSocket->sendto(multiPathPacket, addr, port) != multiPathPacket.size()) {
+                    if (error == Socket::NoError) {
+                        error = Socket::SocketResourceError;
+                        errorString = QString::fromLatin1("KcpSocket can not send udp packet.");
                     }
+#ifdef DEBUG_PROTOCOL
+                    qtng_debug << errorString;
+#endif
+                    MasterKcpSocketPrivate::close(true);
                 }
             }
         }
     }
+    return true;
+}
+
+void MasterKcpSocketPrivate::updateNow(SlaveKcpSocketPrivate *slave)
+{
+    if (!slave->urgentUpdate) {
+        slave->urgentUpdate = true;
+        urgentUpdates.append(slave);
+    }
+    operations->spawnWithName(
+            QString::fromLatin1("update_slaves"), [this] { doUpdateSlaves(); }, false);
+    updateWakeUp.set();
+}
+
+void MasterKcpSocketPrivate::scheduleUpdate(SlaveKcpSocketPrivate *slave, quint64 due)
+{
+    if (updateWheel.isEmpty()) {
+        updateWheel.resize(UpdateWheelSize);
+    }
+    // a slot is processed at its end, so round up.
+    quint64 tick = qMax((due + UpdateWheelGranularity - 1) / UpdateWheelGranularity, updateTick + 1);
+    KcpUpdateEntry entry;
+    entry.slave = slave;
+    entry.tick = tick;
+    updateWheel[static_cast<int>(tick % UpdateWheelSize)].append(entry);
+    slave->scheduledTick = tick;
+    ++scheduledUpdates;
+}
+
+void MasterKcpSocketPrivate::doUpdateSlaves()
+{
+    QList<QByteArray> datagrams;
+    QVector<HostAddress> addrs;
+    QVector<quint16> ports;
+    QList<QPointer<SlaveKcpSocketPrivate>> senders;
+    QList<QPointer<SlaveKcpSocketPrivate>> due;
+    QList<QByteArray> packets;
+    while (true) {
+        const quint64 now = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+        const quint64 nowTick = now / UpdateWheelGranularity;
+        due.clear();
+        due.swap(urgentUpdates);
+        if (!updateWheel.isEmpty() && nowTick > updateTick) {
+            const quint64 lastTick = qMin(nowTick, updateTick + UpdateWheelSize);
+            for (quint64 tick = updateTick + 1; tick <= lastTick; ++tick) {
+                QList<KcpUpdateEntry> &slot = updateWheel[static_cast<int>(tick % UpdateWheelSize)];
+                for (int i = 0; i < slot.size();) {
+                    const KcpUpdateEntry &entry = slot.at(i);
+                    if (entry.slave.isNull() || entry.slave->scheduledTick != entry.tick) {
+                        slot.removeAt(i);
+                        --scheduledUpdates;
+                    } else if (entry.tick > nowTick) {
+                        ++i;  // the later round of wheel.
+                    } else {
+                        entry.slave->scheduledTick = 0;
+                        due.append(entry.slave);
+                        slot.removeAt(i);
+                        --scheduledUpdates;
+                    }
+                }
+            }
+        }
+        updateTick = qMax(updateTick, nowTick);
+
+        ++updatePass;
+        for (QPointer<SlaveKcpSocketPrivate> slave : due) {
+            if (slave.isNull() || slave->updatePass == updatePass) {
+                continue;
+            }
+            slave->updatePass = updatePass;
+            slave->urgentUpdate = false;
+            if (!slave->isUpdating()) {
+                continue;
+            }
+            packets.clear();
+            quint32 interval;
+            if (!slave->updateOnce(now, &packets, &interval) || slave.isNull()) {
+                continue;
+            }
+            if (!packets.isEmpty()) {
+                slave->lastKeepaliveTimestamp = now;
+                for (const QByteArray &packet : packets) {
+                    datagrams.append(packet);
+                    addrs.append(slave->remoteAddress);
+                    ports.append(slave->remotePort);
+                    senders.append(slave);
+                }
+            }
+            if (slave->isUpdating()) {
+                scheduleUpdate(slave.data(), now + interval);
+            }
+        }
+
+        // the datagrams of all slaves are sent by sendmmsg().
+        if (!datagrams.isEmpty()) {
+            qint32 sent = rawSocket->sendtoMany(datagrams, addrs.constData(), ports.constData());
+            for (int i = qMax(0, sent); i < senders.size(); ++i) {
+                QPointer<SlaveKcpSocketPrivate> slave = senders.at(i);
+                if (!slave.isNull() && slave->error == Socket::NoError) {
+                    slave->error = Socket::SocketAccessError;
+                    slave->errorString = QString::fromLatin1("can not send udp packet");
+                    slave->close(true);
+                }
+            }
+            datagrams.clear();
+            addrs.clear();
+            ports.clear();
+            senders.clear();
+        }
+
+        if (!urgentUpdates.isEmpty()) {
+            continue;
+        }
+        updateWakeUp.clear();
+        qint64 sleepMsecs = -1;
+        if (scheduledUpdates > 0) {
+            for (quint64 tick = updateTick + 1; tick <= updateTick + UpdateWheelSize; ++tick) {
+                if (!updateWheel.at(static_cast<int>(tick % UpdateWheelSize)).isEmpty()) {
+                    const quint64 current = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+                    sleepMsecs = qMax<qint64>(1, static_cast<qint64>(tick * UpdateWheelGranularity) - current);
+                    break;
+                }
+            }
+        }
+        if (sleepMsecs < 0) {
+            if (!updateWakeUp.wait()) {
+                return;
+            }
+        } else {
+            try {
+                Timeout timeout(static_cast<quint32>(sleepMsecs), 0);
+                Q_UNUSED(timeout);
+                if (!updateWakeUp.wait()) {
+                    return;
+                }
+            } catch (TimeoutException &) {
+                // continue
+            }
+        }
+    }
 }
 
 bool MasterKcpSocketPrivate::startReceivingCoroutine()
@@ -941,7 +1779,7 @@ KcpSocket *MasterKcpSocketPrivate::accept(const HostAddress &addr, quint16 port)
         return nullptr;
     }
     startReceivingCoroutine();
-    const QString &key = concat(addr, port);
+    const KcpPeerKey key(addr, port);
     QPointer<SlaveKcpSocketPrivate> receiver;
     receiver = receiversByHostAndPort.value(key);
     if (!receiver.isNull() && receiver->isValid()) {
@@ -949,7 +1787,7 @@ KcpSocket *MasterKcpSocketPrivate::accept(const HostAddress &addr, quint16 port)
     } else {
         QScopedPointer<KcpSocket> slave(SlaveKcpSocketPrivate::create(this, addr, port, this->mode));
         SlaveKcpSocketPrivate *d = SlaveKcpSocketPrivate::getPrivateHelper(slave.data());
-        d->originalHostAndPort = key;
+        d->originalPeer = key;
         d->updateKcp();
         receiversByHostAndPort.insert(key, d);
         // the connectionId is generated in server side. accept() is acually a connect().
@@ -1000,7 +1838,7 @@ HostAddress MasterKcpSocketPrivate::resolve(const QString &hostName, QSharedPoin
 {
     QList<HostAddress> addresses;
     HostAddress t;
-    if (t.setAddress(hostName)) {
+    if (HostAddress::parseLiteral(hostName, &t)) {
         addresses.append(t);
     } else {
         if (dnsCache.isNull()) {
@@ -1029,6 +1867,13 @@ qint32 MasterKcpSocketPrivate::rawSend(const char *data, qint32 size)
     return rawSocket->sendto(data, size, remoteAddress, remotePort);
 }
 
+qint32 MasterKcpSocketPrivate::rawSendMany(const QList<QByteArray> &packets)
+{
+    lastKeepaliveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+    startReceivingCoroutine();
+    return rawSocket->sendtoMany(packets, remoteAddress, remotePort);
+}
+
 qint32 MasterKcpSocketPrivate::udpSend(const char *data, qint32 size, const HostAddress &addr, quint16 port)
 {
     return rawSocket->sendto(data, size, addr, port);
@@ -1096,14 +1941,81 @@ bool MasterKcpSocketPrivate::setMulticastInterface(const NetworkInterface &iface
     return rawSocket->setMulticastInterface(iface);
 }
 
+bool MasterKcpSocketPrivate::setShard(int index, int count)
+{
+    if (count < 1 || index < 0 || index >= count) {
+        return false;
+    }
+    shardIndex = index;
+    shardCount = count;
+    if (count == 1) {
+        return true;
+    }
+#ifdef Q_OS_LINUX
+    // the reuseport program returns the index of socket in the group, which is the order of binding. the packets of
+    // new connections have zero connection id, and they are balanced by the hash of address as the index is invalid.
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, 1 },  // the connection id after the packet type.
+        { BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0 },
+        { BPF_RET | BPF_K, 0, 0, 0xffffffff },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<quint32>(count) },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog program;
+    program.len = sizeof(code) / sizeof(code[0]);
+    program.filter = code;
+    int fd = static_cast<int>(rawSocket->fileno());
+    if (fd < 0 || ::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) != 0) {
+        qtng_debug << "can not attach the reuseport program, the sessions are steered by address.";
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool MasterKcpSocketPrivate::setDontFragment(bool enabled)
+{
+#if defined(Q_OS_LINUX) && defined(IP_PMTUDISC_PROBE)
+    // the probe mode sets the DF bit but ignores the path mtu cached by kernel, which limits the probes.
+    int fd = static_cast<int>(rawSocket->fileno());
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = false;
+    if (rawSocket->protocol() != HostAddress::IPv6Protocol) {
+        int value = enabled ? IP_PMTUDISC_PROBE : IP_PMTUDISC_WANT;
+        ok = ::setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value)) == 0;
+    }
+#  ifdef IPV6_PMTUDISC_PROBE
+    if (rawSocket->protocol() != HostAddress::IPv4Protocol) {
+        int value = enabled ? IPV6_PMTUDISC_PROBE : IPV6_PMTUDISC_WANT;
+        ok = (::setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &value, sizeof(value)) == 0) || ok;
+    }
+#  endif
+    return ok;
+#else
+    Q_UNUSED(enabled);
+    return false;
+#endif
+}
+
 SlaveKcpSocketPrivate::SlaveKcpSocketPrivate(MasterKcpSocketPrivate *parent, const HostAddress &addr, quint16 port,
                                              KcpSocket *q)
     : KcpSocketPrivate(q)
     , parent(parent)
+    , scheduledTick(0)
+    , updatePass(0)
+    , urgentUpdate(false)
 {
     remoteAddress = addr;
     remotePort = port;
     state = Socket::ConnectedState;
+    fecDataShards = parent->fecDataShards;
+    fecParityShards = parent->fecParityShards;
+    messageMode = parent->messageMode;
+    pathMtuDiscovery = parent->pathMtuDiscovery;
 }
 
 SlaveKcpSocketPrivate::~SlaveKcpSocketPrivate()
@@ -1189,7 +2101,7 @@ bool SlaveKcpSocketPrivate::close(bool force)
     }
     operations->killall();
     if (!parent.isNull()) {
-        parent->removeSlave(originalHostAndPort);
+        parent->removeSlave(originalPeer);
         parent->removeSlave(connectionId);
         parent.clear();
     }
@@ -1245,6 +2157,25 @@ qint32 SlaveKcpSocketPrivate::rawSend(const char *data, qint32 size)
     }
 }
 
+qint32 SlaveKcpSocketPrivate::rawSendMany(const QList<QByteArray> &packets)
+{
+    if (parent.isNull()) {
+        return -1;
+    } else {
+        lastKeepaliveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+        return parent->rawSocket->sendtoMany(packets, remoteAddress, remotePort);
+    }
+}
+
+void SlaveKcpSocketPrivate::updateKcp()
+{
+    if (parent.isNull()) {
+        KcpSocketPrivate::updateKcp();
+    } else {
+        parent->updateNow(this);
+    }
+}
+
 qint32 SlaveKcpSocketPrivate::udpSend(const char *data, qint32 size, const HostAddress &addr, quint16 port)
 {
     if (parent.isNull()) {
@@ -1298,6 +2229,20 @@ bool SlaveKcpSocketPrivate::setMulticastInterface(const NetworkInterface &)
     return false;
 }
 
+bool SlaveKcpSocketPrivate::setShard(int, int)
+{
+    return false;
+}
+
+bool SlaveKcpSocketPrivate::setDontFragment(bool enabled)
+{
+    // the udp socket is shared with the other slaves, which inherit the discovery of parent.
+    if (parent.isNull()) {
+        return false;
+    }
+    return !enabled || parent->pathMtuDiscovery || parent->setDontFragment(true);
+}
+
 KcpSocket::KcpSocket(HostAddress::NetworkLayerProtocol protocol)
     : d_ptr(new MasterKcpSocketPrivate(protocol, this))
 {
@@ -1340,7 +2285,7 @@ void KcpSocket::setUdpPacketSize(quint32 udpPacketSize)
 {
     Q_D(const KcpSocket);
     if (udpPacketSize < 65535) {
-        ikcp_setmtu(d->kcp, static_cast<int>(udpPacketSize));
+        ikcp_setmtu(d->kcp, static_cast<int>(udpPacketSize) - (d->fecEncoder.isNull() ? 0 : FecOverhead));
     }
 }
 
@@ -1368,6 +2313,51 @@ quint32 KcpSocket::payloadSizeHint() const
     return d->kcp->mss;
 }
 
+bool KcpSocket::setPathMtuDiscovery(bool enabled)
+{
+    Q_D(KcpSocket);
+    return d->setPathMtuDiscovery(enabled);
+}
+
+bool KcpSocket::isPathMtuDiscoveryEnabled() const
+{
+    Q_D(const KcpSocket);
+    return d->pathMtuDiscovery;
+}
+
+KcpSocket::Statistics KcpSocket::statistics() const
+{
+    Q_D(const KcpSocket);
+    Statistics stats;
+    stats.rtt = static_cast<quint32>(qMax(0, d->kcp->rx_srtt));
+    stats.rto = static_cast<quint32>(qMax(0, d->kcp->rx_rto));
+    stats.lossRate = d->lossRate;
+    stats.retransmissions = d->kcp->xmit;
+    stats.sendQueueSize = static_cast<quint32>(qMax(0, ikcp_waitsnd(d->kcp)));
+    stats.sendWindow = d->kcp->snd_wnd;
+    stats.receiveWindow = d->kcp->rcv_wnd;
+    stats.interval = d->kcp->interval;
+    return stats;
+}
+
+void KcpSocket::setMessageMode(bool messageMode)
+{
+    Q_D(KcpSocket);
+    d->messageMode = messageMode;
+}
+
+bool KcpSocket::isMessageMode() const
+{
+    Q_D(const KcpSocket);
+    return d->messageMode;
+}
+
+qint32 KcpSocket::maxMessageSize() const
+{
+    Q_D(const KcpSocket);
+    return d->maxMessageSize();
+}
+
 void KcpSocket::setTearDownTime(float secs)
 {
     Q_D(KcpSocket);
@@ -1385,6 +2375,43 @@ float KcpSocket::tearDownTime() const
     return d->tearDownTime / 1000.0f;
 }
 
+bool KcpSocket::setForwardErrorCorrection(int dataShards, int parityShards)
+{
+    Q_D(KcpSocket);
+    if (dataShards <= 0 || parityShards <= 0) {
+        dataShards = 0;
+        parityShards = 0;
+    } else if (!ReedSolomon::isValid(dataShards, parityShards)) {
+        return false;
+    }
+    if (d->fecDataShards == dataShards && d->fecParityShards == parityShards) {
+        return true;
+    }
+    d->fecDataShards = dataShards;
+    d->fecParityShards = parityShards;
+    d->fecAnnounces = 0;
+    d->setFecEncoding(dataShards > 0);
+    return true;
+}
+
+int KcpSocket::fecDataShards() const
+{
+    Q_D(const KcpSocket);
+    return d->fecDataShards;
+}
+
+int KcpSocket::fecParityShards() const
+{
+    Q_D(const KcpSocket);
+    return d->fecParityShards;
+}
+
+bool KcpSocket::setShard(int index, int count)
+{
+    Q_D(KcpSocket);
+    return d->setShard(index, count);
+}
+
 Socket::SocketError KcpSocket::error() const
 {
     Q_D(const KcpSocket);
@@ -1606,15 +2633,14 @@ qint32 KcpSocket::sendall(const char *data, qint32 size)
 QByteArray KcpSocket::recv(qint32 size)
 {
     Q_D(KcpSocket);
-    QByteArray bs;
-    bs.resize(size);
-
+    QByteArray bs = takeRecvBuffer(size);
     qint32 bytes = d->recv(bs.data(), bs.size(), false);
-    if (bytes > 0) {
-        bs.resize(bytes);
-        return bs;
-    }
-    return QByteArray();
+    return finishRecvBuffer(bs, bytes);
+}
+
+qint32 KcpSocket::recvInto(QByteArray &buf, qint32 maxSize)
+{
+    return recvIntoBuffer(this, buf, maxSize);
 }
 
 QByteArray KcpSocket::recvall(qint32 size)
@@ -1648,6 +2674,23 @@ qint32 KcpSocket::sendall(const QByteArray &data)
     return d->send(data.data(), data.size(), true);
 }
 
+qint32 KcpSocket::sendv(const QList<QByteArray> &data)
+{
+    Q_D(KcpSocket);
+    qint32 total = 0;
+    for (const QByteArray &buffer : data) {
+        if (buffer.isEmpty()) {
+            continue;
+        }
+        qint32 sent = d->send(buffer.constData(), buffer.size(), true);
+        if (sent < buffer.size()) {
+            return sent > 0 ? total + sent : (total > 0 ? total : -1);
+        }
+        total += sent;
+    }
+    return total;
+}
+
 bool KcpSocket::filter(char *data, qint32 *len, HostAddress *addr, quint16 *port)
 {
     Q_UNUSED(data);
@@ -1724,6 +2767,8 @@ public:
     virtual QByteArray recvall(qint32 size) override;
     virtual qint32 send(const QByteArray &data) override;
     virtual qint32 sendall(const QByteArray &data) override;
+    virtual qint32 sendv(const QList<QByteArray> &data) override;
+    virtual qint32 maxMessageSize() const override;
 public:
     QSharedPointer<KcpSocket> s;
 };
@@ -1899,6 +2944,16 @@ qint32 KcpSocketLikeImpl::sendall(const QByteArray &data)
     return s->sendall(data);
 }
 
+qint32 KcpSocketLikeImpl::sendv(const QList<QByteArray> &data)
+{
+    return s->sendv(data);
+}
+
+qint32 KcpSocketLikeImpl::maxMessageSize() const
+{
+    return s->isMessageMode() ? s->maxMessageSize() : 0;
+}
+
 }  // namespace
 
 QSharedPointer<SocketLike> asSocketLike(QSharedPointer<KcpSocket> s)
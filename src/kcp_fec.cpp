@@ -0,0 +1,302 @@
+#include <string.h>
+#include <QtCore/qendian.h>
+#include "../include/private/kcp_fec_p.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+namespace {
+
+// GF(256) with the polynomial x^8 + x^4 + x^3 + x^2 + 1.
+struct GaloisField
+{
+    GaloisField()
+    {
+        int x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = static_cast<quint8>(x);
+            exp[i + 255] = static_cast<quint8>(x);
+            log[x] = static_cast<quint8>(i);
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= 0x11d;
+            }
+        }
+        log[0] = 0;
+        for (int a = 0; a < 256; ++a) {
+            for (int b = 0; b < 256; ++b) {
+                mul[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+            }
+        }
+    }
+    quint8 inverse(quint8 a) const { return exp[255 - log[a]]; }
+    quint8 exp[510];
+    quint8 log[256];
+    quint8 mul[256][256];
+};
+
+const GaloisField &gf()
+{
+    static GaloisField field;
+    return field;
+}
+
+// shard ^= c * source
+inline void mulAdd(quint8 c, const char *source, char *shard, int size)
+{
+    if (c == 0) {
+        return;
+    }
+    const quint8 *row = gf().mul[c];
+    const quint8 *s = reinterpret_cast<const quint8 *>(source);
+    quint8 *d = reinterpret_cast<quint8 *>(shard);
+    for (int i = 0; i < size; ++i) {
+        d[i] ^= row[s[i]];
+    }
+}
+
+}  // anonymous namespace
+
+ReedSolomon::ReedSolomon(int dataShards, int parityShards)
+    : k(dataShards)
+    , m(parityShards)
+    , matrix(dataShards * parityShards)
+{
+    Q_ASSERT(isValid(dataShards, parityShards));
+    const GaloisField &field = gf();
+    // the cauchy matrix 1 / (x_i + y_j) with x_i = k + i and y_j = j, every square sub matrix of [I; C] is invertible.
+    for (int i = 0; i < m; ++i) {
+        for (int j = 0; j < k; ++j) {
+            matrix[i * k + j] = field.inverse(static_cast<quint8>((k + i) ^ j));
+        }
+    }
+}
+
+bool ReedSolomon::isValid(int dataShards, int parityShards)
+{
+    return dataShards > 0 && parityShards > 0 && dataShards + parityShards <= 255;
+}
+
+void ReedSolomon::encode(const QVector<QByteArray> &data, QVector<QByteArray> *parity) const
+{
+    Q_ASSERT(data.size() == k);
+    const int size = data.at(0).size();
+    parity->resize(m);
+    for (int i = 0; i < m; ++i) {
+        QByteArray shard(size, '\0');
+        for (int j = 0; j < k; ++j) {
+            mulAdd(matrix.at(i * k + j), data.at(j).constData(), shard.data(), size);
+        }
+        (*parity)[i] = shard;
+    }
+}
+
+bool ReedSolomon::reconstruct(QVector<QByteArray> *shards) const
+{
+    Q_ASSERT(shards->size() == k + m);
+    QVector<int> rows;
+    QVector<int> missing;
+    int size = -1;
+    for (int i = 0; i < k + m; ++i) {
+        const QByteArray &shard = shards->at(i);
+        if (shard.isNull()) {
+            if (i < k) {
+                missing.append(i);
+            }
+        } else if (rows.size() < k) {
+            if (size >= 0 && shard.size() != size) {
+                return false;
+            }
+            size = shard.size();
+            rows.append(i);
+        }
+    }
+    if (missing.isEmpty()) {
+        return true;
+    }
+    if (rows.size() < k) {
+        return false;
+    }
+
+    // invert the rows of [I; C] for the present shards by gauss-jordan elimination.
+    const GaloisField &field = gf();
+    QVector<quint8> a(k * k, 0);
+    QVector<quint8> inv(k * k, 0);
+    for (int r = 0; r < k; ++r) {
+        const int shard = rows.at(r);
+        if (shard < k) {
+            a[r * k + shard] = 1;
+        } else {
+            memcpy(a.data() + r * k, matrix.constData() + (shard - k) * k, static_cast<size_t>(k));
+        }
+        inv[r * k + r] = 1;
+    }
+    for (int c = 0; c < k; ++c) {
+        int pivot = c;
+        while (pivot < k && a.at(pivot * k + c) == 0) {
+            ++pivot;
+        }
+        if (pivot == k) {
+            return false;
+        }
+        if (pivot != c) {
+            for (int j = 0; j < k; ++j) {
+                qSwap(a[pivot * k + j], a[c * k + j]);
+                qSwap(inv[pivot * k + j], inv[c * k + j]);
+            }
+        }
+        const quint8 *scale = field.mul[field.inverse(a.at(c * k + c))];
+        for (int j = 0; j < k; ++j) {
+            a[c * k + j] = scale[a.at(c * k + j)];
+            inv[c * k + j] = scale[inv.at(c * k + j)];
+        }
+        for (int r = 0; r < k; ++r) {
+            const quint8 factor = a.at(r * k + c);
+            if (r == c || factor == 0) {
+                continue;
+            }
+            const quint8 *f = field.mul[factor];
+            for (int j = 0; j < k; ++j) {
+                a[r * k + j] ^= f[a.at(c * k + j)];
+                inv[r * k + j] ^= f[inv.at(c * k + j)];
+            }
+        }
+    }
+
+    // data_j = sum(inv[j][r] * shard_r)
+    for (int j : missing) {
+        QByteArray shard(size, '\0');
+        for (int r = 0; r < k; ++r) {
+            mulAdd(inv.at(j * k + r), shards->at(rows.at(r)).constData(), shard.data(), size);
+        }
+        (*shards)[j] = shard;
+    }
+    return true;
+}
+
+KcpFecEncoder::KcpFecEncoder(int dataShards, int parityShards)
+    : rs(dataShards, parityShards)
+    , maxSize(0)
+    , nextSeq(0)
+{
+}
+
+quint32 KcpFecEncoder::addData(const char *data, int size, QVector<QByteArray> *parity)
+{
+    Q_ASSERT(size >= 0 && size <= 0xffff);
+    QByteArray shard(size + 2, Qt::Uninitialized);
+    qToBigEndian<quint16>(static_cast<quint16>(size), reinterpret_cast<uchar *>(shard.data()));
+    memcpy(shard.data() + 2, data, static_cast<size_t>(size));
+    maxSize = qMax(maxSize, shard.size());
+    pending.append(shard);
+    const quint32 seq = nextSeq++;
+    if (pending.size() < rs.dataShards()) {
+        parity->clear();
+        return seq;
+    }
+    for (QByteArray &t : pending) {
+        if (t.size() < maxSize) {
+            t.append(QByteArray(maxSize - t.size(), '\0'));
+        }
+    }
+    rs.encode(pending, parity);
+    nextSeq += static_cast<quint32>(rs.parityShards());
+    pending.clear();
+    maxSize = 0;
+    return seq;
+}
+
+KcpFecDecoder::KcpFecDecoder() { }
+
+void KcpFecDecoder::addShard(quint32 seq, int dataShards, int parityShards, const char *shard, int size,
+                             bool isParity, QList<QByteArray> *recovered)
+{
+    // the groups which miss too many shards are dropped, kcp retransmits them.
+    const int MaxGroups = 64;
+    if (!ReedSolomon::isValid(dataShards, parityShards)) {
+        return;
+    }
+    if (rs.isNull() || rs->dataShards() != dataShards || rs->parityShards() != parityShards) {
+        rs.reset(new ReedSolomon(dataShards, parityShards));
+        groups.clear();
+    }
+    const quint32 total = static_cast<quint32>(dataShards + parityShards);
+    const quint32 groupId = seq / total;
+    const int index = static_cast<int>(seq % total);
+    if (isParity != (index >= dataShards)) {
+        return;
+    }
+    if (!groups.contains(groupId)) {
+        if (groups.size() >= MaxGroups) {
+            if (groupId < groups.firstKey()) {
+                return;
+            }
+            groups.erase(groups.begin());
+        }
+    }
+    Group &group = groups[groupId];
+    if (group.done) {
+        return;
+    }
+    if (group.shards.isEmpty()) {
+        group.shards.resize(static_cast<int>(total));
+    }
+    if (!group.shards.at(index).isNull()) {
+        return;
+    }
+    if (isParity) {
+        group.shards[index] = QByteArray(shard, size);
+    } else {
+        QByteArray t(size + 2, Qt::Uninitialized);
+        qToBigEndian<quint16>(static_cast<quint16>(size), reinterpret_cast<uchar *>(t.data()));
+        memcpy(t.data() + 2, shard, static_cast<size_t>(size));
+        group.shards[index] = t;
+        ++group.receivedData;
+    }
+    ++group.received;
+    if (group.receivedData == dataShards) {
+        group.done = true;
+        group.shards.clear();
+        return;
+    }
+    if (group.received < dataShards) {
+        return;
+    }
+
+    // the data shards are padded to the size of parity shards.
+    int paddedSize = -1;
+    for (int i = dataShards; i < group.shards.size(); ++i) {
+        if (!group.shards.at(i).isNull()) {
+            paddedSize = group.shards.at(i).size();
+            break;
+        }
+    }
+    QVector<QByteArray> shards = group.shards;
+    for (int i = 0; i < dataShards; ++i) {
+        QByteArray &t = shards[i];
+        if (t.isNull()) {
+            continue;
+        }
+        if (t.size() > paddedSize) {
+            group.done = true;  // invalid group.
+            group.shards.clear();
+            return;
+        }
+        t.append(QByteArray(paddedSize - t.size(), '\0'));
+    }
+    if (rs->reconstruct(&shards)) {
+        for (int i = 0; i < dataShards; ++i) {
+            if (!group.shards.at(i).isNull()) {
+                continue;
+            }
+            const QByteArray &t = shards.at(i);
+            const int len = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(t.constData()));
+            if (len + 2 <= t.size()) {
+                recovered->append(t.mid(2, len));
+            }
+        }
+    }
+    group.done = true;
+    group.shards.clear();
+}
+
+QTNETWORKNG_NAMESPACE_END
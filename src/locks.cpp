@@ -9,17 +9,88 @@ QTNG_LOGGER("qtng.locks");
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
+// a waiter lives in the stack of coroutine which is blocked in acquire(), so waiting costs no allocation.
+struct SemaphoreWaiter
+{
+    enum State {
+        Waiting,  // in the waiters list.
+        Granted,  // in the ready list, the counter is handed to it by release().
+        Cancelled,  // in the ready list, the semaphore is deleted.
+        Resumed,
+    };
+    BaseCoroutine *coroutine;
+    SemaphoreWaiter *prev;
+    SemaphoreWaiter *next;
+    State state;
+};
+
+// an intrusive fifo of waiters.
+struct SemaphoreWaiterList
+{
+    SemaphoreWaiterList()
+        : first(nullptr)
+        , last(nullptr)
+    {
+    }
+    bool isEmpty() const { return !first; }
+    void append(SemaphoreWaiter *waiter);
+    void remove(SemaphoreWaiter *waiter);
+    SemaphoreWaiter *takeFirst();
+    SemaphoreWaiter *first;
+    SemaphoreWaiter *last;
+};
+
+void SemaphoreWaiterList::append(SemaphoreWaiter *waiter)
+{
+    waiter->prev = last;
+    waiter->next = nullptr;
+    if (last) {
+        last->next = waiter;
+    } else {
+        first = waiter;
+    }
+    last = waiter;
+}
+
+void SemaphoreWaiterList::remove(SemaphoreWaiter *waiter)
+{
+    if (waiter->prev) {
+        waiter->prev->next = waiter->next;
+    } else {
+        first = waiter->next;
+    }
+    if (waiter->next) {
+        waiter->next->prev = waiter->prev;
+    } else {
+        last = waiter->prev;
+    }
+    waiter->prev = waiter->next = nullptr;
+}
+
+SemaphoreWaiter *SemaphoreWaiterList::takeFirst()
+{
+    SemaphoreWaiter *waiter = first;
+    if (waiter) {
+        remove(waiter);
+    }
+    return waiter;
+}
+
 class SemaphorePrivate
 {
 public:
     SemaphorePrivate(int value);
     virtual ~SemaphorePrivate();
 public:
-    bool acquire(bool blocking);
+    bool acquire(QSharedPointer<SemaphorePrivate> self, bool blocking);
     void release(QSharedPointer<SemaphorePrivate> self, int value);
     void scheduleDelete(QSharedPointer<SemaphorePrivate> self);
+    void handOff(QSharedPointer<SemaphorePrivate> self);
+    void scheduleResume(QSharedPointer<SemaphorePrivate> self);
 public:
-    QList<QPointer<BaseCoroutine>> waiters;
+    SemaphoreWaiterList waiters;
+    SemaphoreWaiterList ready;  // granted or cancelled, to be resumed by the event loop.
+    quint32 waiterCount;
     const int init_value;
     volatile int counter;
     int notified;
@@ -29,7 +100,8 @@ public:
 };
 
 SemaphorePrivate::SemaphorePrivate(int value)
-    : init_value(value)
+    : waiterCount(0)
+    , init_value(value)
     , counter(value)
     , notified(0)
 {
@@ -37,11 +109,12 @@ SemaphorePrivate::SemaphorePrivate(int value)
 
 SemaphorePrivate::~SemaphorePrivate()
 {
-    Q_ASSERT(waiters.isEmpty());
+    Q_ASSERT(waiters.isEmpty() && ready.isEmpty());
 }
 
-bool SemaphorePrivate::acquire(bool blocking)
+bool SemaphorePrivate::acquire(QSharedPointer<SemaphorePrivate> self, bool blocking)
 {
+    // the counter is handed to the waiters directly, so it is zero while anyone is waiting.
     if (counter > 0) {
         --counter;
         return true;
@@ -49,77 +122,113 @@ bool SemaphorePrivate::acquire(bool blocking)
     if (!blocking)
         return false;
 
-    waiters.append(BaseCoroutine::current());
+    SemaphoreWaiter waiter;
+    waiter.coroutine = BaseCoroutine::current();
+    waiter.state = SemaphoreWaiter::Waiting;
+    waiters.append(&waiter);
+    ++waiterCount;
     try {
         Q_ASSERT_X(EventLoopCoroutine::get() != BaseCoroutine::current(), "SemaphorePrivate",
                    "coroutine locks should not be called from eventloop coroutine.");
         EventLoopCoroutine::get()->yield();
-        // if there is no exception, the release() has remove the waiter.
-        bool found = waiters.contains(BaseCoroutine::current());
-        Q_ASSERT_X(!found, "SemaphorePrivate",
+        Q_ASSERT_X(waiter.state == SemaphoreWaiter::Resumed, "SemaphorePrivate",
                    "have you forget to start a new coroutine?");  // usually caused by locks running in eventloop.
     } catch (...) {
         // if we caught an exception, the release() must not touch me.
-        // the waiter should be remove.
-        bool found = waiters.removeAll(BaseCoroutine::current());
-        Q_ASSERT(found);
+        if (waiter.state == SemaphoreWaiter::Waiting) {
+            waiters.remove(&waiter);
+            --waiterCount;
+        } else if (waiter.state != SemaphoreWaiter::Resumed) {
+            ready.remove(&waiter);
+            --waiterCount;
+            if (waiter.state == SemaphoreWaiter::Granted) {
+                // pass the counter to next waiter.
+                handOff(self);
+            }
+        }
         throw;
     }
-    return notified != 0;
+    return waiter.coroutine != nullptr;
 }
 
 class SemaphoreNotifyWaitersFunctor : public Functor
 {
 public:
-    SemaphoreNotifyWaitersFunctor(QSharedPointer<SemaphorePrivate> sp, bool doDelete)
+    SemaphoreNotifyWaitersFunctor(QSharedPointer<SemaphorePrivate> sp)
         : sp(sp)
-        , doDelete(doDelete)
     {
     }
     QSharedPointer<SemaphorePrivate> sp;
-    bool doDelete;
     virtual void operator()() override
     {
-        while ((sp->notified != 0 || doDelete) && (sp->counter > 0 || doDelete) && !sp->waiters.isEmpty()) {
-            QPointer<BaseCoroutine> waiter = sp->waiters.takeFirst();
-            if (waiter.isNull()) {
-                qtng_debug << "waiter was deleted.";
-                continue;
-            }
-            if (!doDelete) {
-                --sp->counter;
-            }
-            waiter->yield();
+        // the waiters made ready while resuming are left to the next call, or a ping-pong starves the event loop.
+        int count = 0;
+        for (SemaphoreWaiter *waiter = sp->ready.first; waiter; waiter = waiter->next) {
+            ++count;
         }
-        // do not move this line above the loop, see the return statement in ::acquire()
         sp->notified = 0;
+        for (int i = 0; i < count && !sp->ready.isEmpty(); ++i) {
+            // the waiter is gone after it is resumed, do not touch it later.
+            SemaphoreWaiter *waiter = sp->ready.takeFirst();
+            --sp->waiterCount;
+            BaseCoroutine *coroutine = waiter->coroutine;
+            if (waiter->state == SemaphoreWaiter::Cancelled) {
+                waiter->coroutine = nullptr;
+            }
+            waiter->state = SemaphoreWaiter::Resumed;
+            coroutine->yield();
+        }
     }
 };
 
+void SemaphorePrivate::scheduleResume(QSharedPointer<SemaphorePrivate> self)
+{
+    if (!notified && !ready.isEmpty()) {
+        notified = EventLoopCoroutine::get()->callLater(0, new SemaphoreNotifyWaitersFunctor(self));
+    }
+}
+
+// give one counter to the first waiter, or return it to the semaphore if nobody is waiting.
+void SemaphorePrivate::handOff(QSharedPointer<SemaphorePrivate> self)
+{
+    SemaphoreWaiter *waiter = waiters.takeFirst();
+    if (waiter) {
+        waiter->state = SemaphoreWaiter::Granted;
+        ready.append(waiter);
+        scheduleResume(self);
+    } else if (counter < init_value) {
+        ++counter;
+    }
+}
+
 void SemaphorePrivate::release(QSharedPointer<SemaphorePrivate> self, int value)
 {
     if (value <= 0) {
         return;
     }
+    while (value > 0 && !waiters.isEmpty()) {
+        SemaphoreWaiter *waiter = waiters.takeFirst();
+        waiter->state = SemaphoreWaiter::Granted;
+        ready.append(waiter);
+        --value;
+    }
     if (counter > INT_MAX - value) {
         counter = INT_MAX;
     } else {
         counter += value;
     }
     counter = qMin(static_cast<int>(counter), init_value);
-    if (!notified && !waiters.isEmpty()) {
-        notified = EventLoopCoroutine::get()->callLater(0, new SemaphoreNotifyWaitersFunctor(self, false));
-    }
+    scheduleResume(self);
 }
 
 void SemaphorePrivate::scheduleDelete(QSharedPointer<SemaphorePrivate> self)
 {
-    if (notified) {
-        EventLoopCoroutine::get()->cancelCall(notified);
-        notified = 0;
+    while (!waiters.isEmpty()) {
+        SemaphoreWaiter *waiter = waiters.takeFirst();
+        waiter->state = SemaphoreWaiter::Cancelled;
+        ready.append(waiter);
     }
-    counter += waiters.count();
-    EventLoopCoroutine::get()->callLater(0, new SemaphoreNotifyWaitersFunctor(self, true));
+    scheduleResume(self);
 }
 
 Semaphore::Semaphore(int value)
@@ -138,7 +247,7 @@ bool Semaphore::acquire(bool blocking)
     if (!d) {
         return false;
     }
-    return d->acquire(blocking);
+    return d->acquire(d, blocking);
 }
 
 bool Semaphore::acquire(int value, bool blocking)
@@ -150,7 +259,7 @@ bool Semaphore::acquire(int value, bool blocking)
         return false;
     }
     for (int i = 0; i < value; ++i) {
-        if (!d->acquire(blocking)) {
+        if (!d->acquire(d, blocking)) {
             return false;
         }
     }
@@ -186,7 +295,7 @@ quint32 Semaphore::getting() const
     if (!d) {
         return 0;
     }
-    return d->waiters.size();
+    return d->waiterCount;
 }
 
 Lock::Lock()
@@ -386,12 +495,15 @@ private:
     volatile bool flag;
     QList<Event *> linkTo;
     QList<Event *> linkFrom;
+    QList<QPair<int, std::function<void()>>> setCallbacks;
+    int nextCallbackId;
     Q_DECLARE_PUBLIC(Event)
 };
 
 EventPrivate::EventPrivate(Event *q)
     : q_ptr(q)
     , flag(false)
+    , nextCallbackId(1)
 {
 }
 
@@ -416,6 +528,11 @@ void EventPrivate::set()
         for (Event *other : linkTo) {
             other->set();
         }
+        QList<QPair<int, std::function<void()>>> callbacks;
+        callbacks.swap(setCallbacks);
+        for (const QPair<int, std::function<void()>> &callback : callbacks) {
+            callback.second();
+        }
     }
 }
 
@@ -493,10 +610,35 @@ void Event::unlink(Event &other)
     other.d_ptr->linkFrom.removeOne(this);
 }
 
+int Event::addSetCallback(std::function<void()> callback)
+{
+    Q_D(Event);
+    const int callbackId = d->nextCallbackId++;
+    d->setCallbacks.append(qMakePair(callbackId, callback));
+    return callbackId;
+}
+
+void Event::removeSetCallback(int callbackId)
+{
+    Q_D(Event);
+    for (int i = 0; i < d->setCallbacks.size(); ++i) {
+        if (d->setCallbacks.at(i).first == callbackId) {
+            d->setCallbacks.removeAt(i);
+            return;
+        }
+    }
+}
+
+// the coroutines of one eventloop waiting for a thread event. they are woken by one functor however many they are.
 struct Behold
 {
+    Behold()
+        : scheduled(0)
+    {
+    }
     QPointer<EventLoopCoroutine> eventloop;
-    QSharedPointer<Condition> condition;
+    Condition condition;
+    QAtomicInt scheduled;  // a NotifiyCondition is queued to the eventloop.
 };
 
 class ThreadEventPrivate
@@ -511,7 +653,7 @@ public:
 public:
     QWaitCondition condition;
     QMutex mutex;
-    QList<Behold> holds;
+    QHash<EventLoopCoroutine *, QSharedPointer<Behold>> holds;
     QList<ThreadEvent *> linkTo;
     QList<ThreadEvent *> linkFrom;
     QAtomicInteger<int> flag;
@@ -522,12 +664,16 @@ public:
 class NotifiyCondition : public Functor
 {
 public:
-    NotifiyCondition(QSharedPointer<Condition> condition)
-        : condition(condition)
+    NotifiyCondition(QSharedPointer<Behold> hold)
+        : hold(hold)
     {
     }
-    virtual void operator()() { condition->notifyAll(); }
-    QSharedPointer<Condition> condition;
+    virtual void operator()()
+    {
+        hold->scheduled.storeRelease(0);
+        hold->condition.notifyAll();
+    }
+    QSharedPointer<Behold> hold;
 };
 
 ThreadEventPrivate::ThreadEventPrivate()
@@ -542,20 +688,17 @@ void ThreadEventPrivate::notify()
     incref();
     mutex.lock();
     QSharedPointer<EventLoopCoroutine> current = currentLoop()->get();
-    QMutableListIterator<Behold> itor(holds);
+    QMutableHashIterator<EventLoopCoroutine *, QSharedPointer<Behold>> itor(holds);
     // XXX the flag can be false.
     while (itor.hasNext() && ref.loadAcquire() > 1) {
-        const Behold &hold = itor.next();
-        QSharedPointer<Condition> holdCondition = hold.condition;
-        EventLoopCoroutine *holdEventloop = hold.eventloop.data();
-        if (holdEventloop) {
-            if (holdEventloop == current) {
-                holdCondition->notifyAll();
-            } else {
-                holdEventloop->callLaterThreadSafe(0, new NotifiyCondition(holdCondition));
-            }
-        } else {
+        QSharedPointer<Behold> hold = itor.next().value();
+        EventLoopCoroutine *holdEventloop = hold->eventloop.data();
+        if (!holdEventloop) {
             itor.remove();
+        } else if (holdEventloop == current) {
+            hold->condition.notifyAll();
+        } else if (hold->scheduled.testAndSetOrdered(0, 1)) {
+            holdEventloop->callLaterThreadSafe(0, new NotifiyCondition(hold));
         }
     }
     mutex.unlock();
@@ -585,25 +728,17 @@ bool ThreadEventPrivate::wait(bool blocking)
         --count;
         mutex.unlock();
     } else {
-        QSharedPointer<Condition> condition;
-        // should we use QMap<EventLoopCoroutine *, Hold> to accelerate?
-        for (const Behold &hold : qAsConst(holds)) {
-            if (hold.eventloop.data() == current) {
-                condition = hold.condition;
-                break;
-            }
-        }
-        if (condition.isNull()) {
-            condition.reset(new Condition());
-            Behold hold;
-            hold.condition = condition;
-            hold.eventloop = current;
-            holds.append(hold);
+        QSharedPointer<Behold> hold = holds.value(current);
+        if (hold.isNull() || hold->eventloop.isNull()) {
+            // the address of a deleted eventloop may be reused.
+            hold.reset(new Behold());
+            hold->eventloop = current;
+            holds.insert(current, hold);
         }
         mutex.unlock();
         while (!(f = flag.loadAcquire()) && ref.loadAcquire() > 1) {
             try {
-                condition->wait();
+                hold->condition.wait();
             } catch (...) {
                 decref();
                 throw;
@@ -619,10 +754,8 @@ quint32 ThreadEventPrivate::getting()
     incref();
     mutex.lock();
     quint32 count = this->count.loadAcquire();
-    for (const Behold &hold : qAsConst(holds)) {
-        if (!hold.condition.isNull()) {
-            count += hold.condition->getting();
-        }
+    for (const QSharedPointer<Behold> &hold : qAsConst(holds)) {
+        count += hold->condition.getting();
     }
     mutex.unlock();
     decref();
@@ -788,4 +921,326 @@ void Gate::close()
     }
 }
 
+class RWLockPrivate
+{
+public:
+    explicit RWLockPrivate(bool fair);
+public:
+    // the caller keeps a reference of self, so the waiters can see the lock is deleted.
+    bool lockForRead(bool blocking);
+    bool lockForWrite(bool blocking);
+    void unlock();
+    void wake();
+public:
+    Condition readable;
+    Condition writable;
+    quint32 readers;
+    quint32 waitingWriters;
+    quint32 passes;  // the readers allowed to go before the waiting writers, only if fair.
+    const bool fair;
+    bool writing;
+    bool deleted;
+};
+
+RWLockPrivate::RWLockPrivate(bool fair)
+    : readers(0)
+    , waitingWriters(0)
+    , passes(0)
+    , fair(fair)
+    , writing(false)
+    , deleted(false)
+{
+}
+
+bool RWLockPrivate::lockForRead(bool blocking)
+{
+    while (!deleted && (writing || (waitingWriters > 0 && passes == 0))) {
+        if (!blocking) {
+            return false;
+        }
+        try {
+            readable.wait();
+        } catch (...) {
+            // the writers wait for the passes to be used up.
+            if (passes > 0 && --passes == 0) {
+                wake();
+            }
+            throw;
+        }
+    }
+    if (deleted) {
+        return false;
+    }
+    if (passes > 0) {
+        --passes;
+    }
+    ++readers;
+    return true;
+}
+
+bool RWLockPrivate::lockForWrite(bool blocking)
+{
+    if (deleted) {
+        return false;
+    }
+    if (!writing && readers == 0 && passes == 0) {
+        writing = true;
+        return true;
+    }
+    if (!blocking) {
+        return false;
+    }
+    ++waitingWriters;
+    while (!deleted && (writing || readers > 0 || passes > 0)) {
+        try {
+            writable.wait();
+        } catch (...) {
+            // i may be notified already, so pass it to the others.
+            --waitingWriters;
+            wake();
+            throw;
+        }
+    }
+    --waitingWriters;
+    if (deleted) {
+        return false;
+    }
+    writing = true;
+    return true;
+}
+
+void RWLockPrivate::unlock()
+{
+    if (writing) {
+        writing = false;
+        const quint32 waitingReaders = readable.getting();
+        if (fair && waitingWriters > 0 && waitingReaders > 0) {
+            passes = waitingReaders;
+            readable.notifyAll();
+            return;
+        }
+    } else if (readers > 0) {
+        --readers;
+    } else {
+        qtng_warning << "unlock a rwlock which is not locked.";
+        return;
+    }
+    wake();
+}
+
+void RWLockPrivate::wake()
+{
+    if (writing) {
+        return;
+    }
+    if (waitingWriters == 0) {
+        passes = 0;
+        readable.notifyAll();
+    } else if (readers == 0 && passes == 0) {
+        writable.notify();
+    }
+}
+
+RWLock::RWLock(bool fair)
+    : d(new RWLockPrivate(fair))
+{
+}
+
+RWLock::~RWLock()
+{
+    d->deleted = true;
+    d->readable.notifyAll();
+    d->writable.notifyAll();
+}
+
+bool RWLock::lockForRead(bool blocking)
+{
+    QSharedPointer<RWLockPrivate> self = d;
+    return self->lockForRead(blocking);
+}
+
+bool RWLock::lockForWrite(bool blocking)
+{
+    QSharedPointer<RWLockPrivate> self = d;
+    return self->lockForWrite(blocking);
+}
+
+void RWLock::unlock()
+{
+    d->unlock();
+}
+
+bool RWLock::isLocked() const
+{
+    return d->writing || d->readers > 0;
+}
+
+bool RWLock::isWriting() const
+{
+    return d->writing;
+}
+
+quint32 RWLock::readers() const
+{
+    return d->readers;
+}
+
+quint32 RWLock::getting() const
+{
+    return d->readable.getting() + d->writable.getting();
+}
+
+// the waiters clear the event with the mutex held and find the lock busy, so the next unlock always sets it again.
+class ThreadRWLockPrivate
+{
+public:
+    ThreadRWLockPrivate();
+public:
+    bool lockForRead(bool blocking);
+    bool lockForWrite(bool blocking);
+    void unlock();
+public:
+    QMutex mutex;
+    ThreadEvent changed;
+    quint32 readers;
+    quint32 waitingReaders;
+    quint32 waitingWriters;
+    bool writing;
+    bool deleted;
+};
+
+ThreadRWLockPrivate::ThreadRWLockPrivate()
+    : readers(0)
+    , waitingReaders(0)
+    , waitingWriters(0)
+    , writing(false)
+    , deleted(false)
+{
+}
+
+bool ThreadRWLockPrivate::lockForRead(bool blocking)
+{
+    QMutexLocker locker(&mutex);
+    while (!deleted && (writing || waitingWriters > 0)) {
+        if (!blocking) {
+            return false;
+        }
+        changed.clear();
+        ++waitingReaders;
+        locker.unlock();
+        try {
+            changed.wait();
+        } catch (...) {
+            locker.relock();
+            --waitingReaders;
+            throw;
+        }
+        locker.relock();
+        --waitingReaders;
+    }
+    if (deleted) {
+        return false;
+    }
+    ++readers;
+    return true;
+}
+
+bool ThreadRWLockPrivate::lockForWrite(bool blocking)
+{
+    QMutexLocker locker(&mutex);
+    if (!deleted && (writing || readers > 0) && !blocking) {
+        return false;
+    }
+    ++waitingWriters;
+    while (!deleted && (writing || readers > 0)) {
+        changed.clear();
+        locker.unlock();
+        try {
+            changed.wait();
+        } catch (...) {
+            locker.relock();
+            --waitingWriters;
+            // the readers waiting for me.
+            changed.set();
+            throw;
+        }
+        locker.relock();
+    }
+    --waitingWriters;
+    if (deleted) {
+        if (waitingWriters == 0) {
+            changed.set();
+        }
+        return false;
+    }
+    writing = true;
+    return true;
+}
+
+void ThreadRWLockPrivate::unlock()
+{
+    QMutexLocker locker(&mutex);
+    if (writing) {
+        writing = false;
+    } else if (readers > 0) {
+        --readers;
+        if (readers > 0) {
+            return;  // only the writers are waiting for readers.
+        }
+    } else {
+        qtng_warning << "unlock a rwlock which is not locked.";
+        return;
+    }
+    if (waitingReaders > 0 || waitingWriters > 0) {
+        changed.set();
+    }
+}
+
+ThreadRWLock::ThreadRWLock()
+    : d(new ThreadRWLockPrivate())
+{
+}
+
+ThreadRWLock::~ThreadRWLock()
+{
+    QMutexLocker locker(&d->mutex);
+    d->deleted = true;
+    d->changed.set();
+}
+
+bool ThreadRWLock::lockForRead(bool blocking)
+{
+    QSharedPointer<ThreadRWLockPrivate> self = d;
+    return self->lockForRead(blocking);
+}
+
+bool ThreadRWLock::lockForWrite(bool blocking)
+{
+    QSharedPointer<ThreadRWLockPrivate> self = d;
+    return self->lockForWrite(blocking);
+}
+
+void ThreadRWLock::unlock()
+{
+    d->unlock();
+}
+
+bool ThreadRWLock::isLocked() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->writing || d->readers > 0;
+}
+
+bool ThreadRWLock::isWriting() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->writing;
+}
+
+quint32 ThreadRWLock::readers() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->readers;
+}
+
 QTNETWORKNG_NAMESPACE_END
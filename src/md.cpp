@@ -1,3 +1,4 @@
+#include <string.h>
 #include "../include/md.h"
 #include "../include/private/crypto_p.h"
 
@@ -46,15 +47,18 @@ public:
     MessageDigestPrivate(MessageDigest::Algorithm algo);
     ~MessageDigestPrivate();
     void addData(const char *buf, int len);
-    QByteArray result();
+    bool finish();
+    bool reset();
     EVP_MD_CTX *context;
-    QByteArray finalData;
+    unsigned char finalData[EVP_MAX_MD_SIZE];
+    int finalSize;  // -1 before finish().
     MessageDigest::Algorithm algo;
     bool hasError;
 };
 
 MessageDigestPrivate::MessageDigestPrivate(MessageDigest::Algorithm algo)
     : context(nullptr)
+    , finalSize(-1)
     , algo(algo)
     , hasError(false)
 {
@@ -96,25 +100,33 @@ void MessageDigestPrivate::addData(const char *buf, int len)
     hasError = !rvalue;
 }
 
-QByteArray MessageDigestPrivate::result()
+bool MessageDigestPrivate::finish()
 {
     if (hasError) {
-        return QByteArray();
+        return false;
     }
-    if (!finalData.isEmpty()) {
-        return finalData;
+    if (finalSize >= 0) {
+        return true;
     }
     unsigned int len;
-    finalData.resize(EVP_MAX_MD_SIZE);
-    int rvalue = EVP_DigestFinal_ex(context, reinterpret_cast<unsigned char *>(finalData.data()), &len);
+    int rvalue = EVP_DigestFinal_ex(context, finalData, &len);
     if (!rvalue) {
         hasError = true;
-        finalData.clear();
-    } else {
-        finalData.resize(static_cast<int>(len));
+        return false;
     }
+    finalSize = static_cast<int>(len);
+    return true;
+}
 
-    return finalData;
+// the context is initialized again without reallocation.
+bool MessageDigestPrivate::reset()
+{
+    if (!context) {
+        return false;
+    }
+    finalSize = -1;
+    hasError = !EVP_DigestInit_ex(context, getOpenSSL_MD(algo), nullptr);
+    return !hasError;
 }
 
 MessageDigest::MessageDigest(MessageDigest::Algorithm algo)
@@ -136,7 +148,57 @@ void MessageDigest::addData(const char *data, int len)
 QByteArray MessageDigest::result()
 {
     Q_D(MessageDigest);
-    return d->result();
+    if (!d->finish()) {
+        return QByteArray();
+    }
+    return QByteArray(reinterpret_cast<const char *>(d->finalData), d->finalSize);
+}
+
+int MessageDigest::result(char *out)
+{
+    Q_D(MessageDigest);
+    if (!d->finish()) {
+        return -1;
+    }
+    memcpy(out, d->finalData, static_cast<size_t>(d->finalSize));
+    return d->finalSize;
+}
+
+bool MessageDigest::reset()
+{
+    Q_D(MessageDigest);
+    return d->reset();
+}
+
+QList<QByteArray> MessageDigest::digestMany(const QList<QByteArray> &data, Algorithm algo)
+{
+    QList<QByteArray> results;
+    results.reserve(data.size());
+    MessageDigest m(algo);
+    for (const QByteArray &item : data) {
+        m.addData(item);
+        results.append(m.result());
+        m.reset();
+    }
+    return results;
+}
+
+QList<QByteArray> MessageDigest::hashMany(const QList<QByteArray> &data, Algorithm algo)
+{
+    QList<QByteArray> results = digestMany(data, algo);
+    for (QByteArray &result : results) {
+        result = result.toHex();
+    }
+    return results;
+}
+
+int MessageDigest::digestSize() const
+{
+    Q_D(const MessageDigest);
+    if (!d->context) {
+        return -1;
+    }
+    return EVP_MD_size(EVP_MD_CTX_md(d->context));
 }
 
 QByteArray PBKDF2_HMAC(int keylen, const QByteArray &password, const QByteArray &salt,
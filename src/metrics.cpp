@@ -0,0 +1,307 @@
+#include <QtCore/qmutex.h>
+#include <QtCore/qmap.h>
+#include "../include/metrics.h"
+#include "../include/eventloop.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+static void appendUnsigned(QByteArray *out, quint64 value)
+{
+    char buf[32];
+    int len = qsnprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(value));
+    out->append(buf, len);
+}
+
+static void appendSigned(QByteArray *out, qint64 value)
+{
+    char buf[32];
+    int len = qsnprintf(buf, sizeof(buf), "%lld", static_cast<long long>(value));
+    out->append(buf, len);
+}
+
+static void appendSeconds(QByteArray *out, qint64 usecs)
+{
+    char buf[48];
+    int len = qsnprintf(buf, sizeof(buf), "%.6f", static_cast<double>(usecs) / 1000000.0);
+    out->append(buf, len);
+}
+
+static void appendSample(QByteArray *out, const QByteArray &prefix, quint64 value)
+{
+    out->append(prefix);
+    appendUnsigned(out, value);
+    out->append('\n');
+}
+
+Metric::Metric(Type type, const QByteArray &name)
+    : metricName(name)
+    , t(type)
+{
+}
+
+Metric::~Metric() { }
+
+MetricCounter::MetricCounter(const QByteArray &name)
+    : Metric(Metric::Counter, name)
+    , v(0)
+{
+}
+
+void MetricCounter::writeTo(QByteArray *out) const
+{
+    out->append(metricName);
+    out->append(' ');
+    appendUnsigned(out, value());
+    out->append('\n');
+}
+
+MetricGauge::MetricGauge(const QByteArray &name)
+    : Metric(Metric::Gauge, name)
+    , v(0)
+{
+}
+
+void MetricGauge::writeTo(QByteArray *out) const
+{
+    out->append(metricName);
+    out->append(' ');
+    appendSigned(out, value());
+    out->append('\n');
+}
+
+MetricHistogram::MetricHistogram(const QByteArray &name, const QVector<qint64> &bounds)
+    : Metric(Metric::Histogram, name)
+    , bounds(bounds)
+    , buckets(new QAtomicInteger<quint64>[bounds.size() + 1])
+    , total(0)
+    , sum(0)
+{
+    for (int i = 0; i <= bounds.size(); ++i) {
+        buckets[i].storeRelease(0);
+    }
+}
+
+MetricHistogram::~MetricHistogram()
+{
+    delete[] buckets;
+}
+
+void MetricHistogram::observe(qint64 usecs)
+{
+    int i = 0;
+    while (i < bounds.size() && usecs > bounds.at(i)) {
+        ++i;
+    }
+    buckets[i].fetchAndAddRelaxed(1);
+    sum.fetchAndAddRelaxed(usecs);
+    total.fetchAndAddRelaxed(1);
+}
+
+void MetricHistogram::writeTo(QByteArray *out) const
+{
+    quint64 cumulative = 0;
+    for (int i = 0; i <= bounds.size(); ++i) {
+        cumulative += buckets[i].loadAcquire();
+        out->append(metricName);
+        out->append("_bucket{le=\"");
+        if (i < bounds.size()) {
+            appendSeconds(out, bounds.at(i));
+        } else {
+            out->append("+Inf");
+        }
+        out->append("\"} ");
+        appendUnsigned(out, cumulative);
+        out->append('\n');
+    }
+    out->append(metricName);
+    out->append("_sum ");
+    appendSeconds(out, sum.loadAcquire());
+    out->append('\n');
+    out->append(metricName);
+    out->append("_count ");
+    // the buckets are not read atomically with the count, so keep the exposition consistent.
+    appendUnsigned(out, cumulative);
+    out->append('\n');
+}
+
+QVector<qint64> MetricHistogram::latencyBounds()
+{
+    QVector<qint64> bounds;
+    bounds << 1000 << 2500 << 5000 << 10000 << 25000 << 50000 << 100000 << 250000 << 500000 << 1000000 << 2500000
+           << 5000000 << 10000000;
+    return bounds;
+}
+
+struct RegisteredMetric
+{
+    Metric *metric;
+    QByteArray header;  // the HELP and TYPE lines.
+};
+
+class MetricsRegistryPrivate
+{
+public:
+    Metric *find(const QByteArray &name, Metric::Type type, bool *found) const;
+    void add(Metric *metric, const QByteArray &help);
+public:
+    mutable QMutex lock;
+    QVector<RegisteredMetric> metrics;
+    QMap<QByteArray, int> names;
+};
+
+Metric *MetricsRegistryPrivate::find(const QByteArray &name, Metric::Type type, bool *found) const
+{
+    QMap<QByteArray, int>::const_iterator itor = names.constFind(name);
+    if (itor == names.constEnd()) {
+        *found = false;
+        return nullptr;
+    }
+    *found = true;
+    Metric *metric = metrics.at(itor.value()).metric;
+    return metric->type() == type ? metric : nullptr;
+}
+
+void MetricsRegistryPrivate::add(Metric *metric, const QByteArray &help)
+{
+    static const char *typeNames[] = { "counter", "gauge", "histogram" };
+    RegisteredMetric registered;
+    registered.metric = metric;
+    registered.header = "# HELP " + metric->name() + " " + help + "\n# TYPE " + metric->name() + " "
+            + typeNames[metric->type()] + "\n";
+    names.insert(metric->name(), metrics.size());
+    metrics.append(registered);
+}
+
+MetricsRegistry::MetricsRegistry()
+    : d_ptr(new MetricsRegistryPrivate())
+{
+}
+
+// never called, the metrics must outlive the code keeping their pointers.
+MetricsRegistry::~MetricsRegistry()
+{
+    delete d_ptr;
+}
+
+MetricsRegistry *MetricsRegistry::instance()
+{
+    static MetricsRegistry *registry = new MetricsRegistry();
+    return registry;
+}
+
+MetricCounter *MetricsRegistry::counter(const QByteArray &name, const QByteArray &help)
+{
+    Q_D(MetricsRegistry);
+    QMutexLocker locker(&d->lock);
+    bool found;
+    Metric *metric = d->find(name, Metric::Counter, &found);
+    if (!found) {
+        metric = new MetricCounter(name);
+        d->add(metric, help);
+    }
+    return static_cast<MetricCounter *>(metric);
+}
+
+MetricGauge *MetricsRegistry::gauge(const QByteArray &name, const QByteArray &help)
+{
+    Q_D(MetricsRegistry);
+    QMutexLocker locker(&d->lock);
+    bool found;
+    Metric *metric = d->find(name, Metric::Gauge, &found);
+    if (!found) {
+        metric = new MetricGauge(name);
+        d->add(metric, help);
+    }
+    return static_cast<MetricGauge *>(metric);
+}
+
+MetricHistogram *MetricsRegistry::histogram(const QByteArray &name, const QByteArray &help,
+                                            const QVector<qint64> &bounds)
+{
+    Q_D(MetricsRegistry);
+    QMutexLocker locker(&d->lock);
+    bool found;
+    Metric *metric = d->find(name, Metric::Histogram, &found);
+    if (!found) {
+        metric = new MetricHistogram(name, bounds);
+        d->add(metric, help);
+    }
+    return static_cast<MetricHistogram *>(metric);
+}
+
+void MetricsRegistry::writeTo(QByteArray *out) const
+{
+    Q_D(const MetricsRegistry);
+    QMutexLocker locker(&d->lock);
+    for (const RegisteredMetric &registered : d->metrics) {
+        out->append(registered.header);
+        registered.metric->writeTo(out);
+    }
+}
+
+QByteArray MetricsRegistry::exposition() const
+{
+    QByteArray out;
+    out.reserve(8192);
+    writeTo(&out);
+    return out;
+}
+
+static void appendEventLoopMetric(QByteArray *out, const char *name, const char *type, const char *help,
+                                  qint64 value)
+{
+    out->append("# HELP qtng_eventloop_");
+    out->append(name);
+    out->append(' ');
+    out->append(help);
+    out->append("\n# TYPE qtng_eventloop_");
+    out->append(name);
+    out->append(' ');
+    out->append(type);
+    out->append("\nqtng_eventloop_");
+    out->append(name);
+    out->append(' ');
+    appendSigned(out, value);
+    out->append('\n');
+}
+
+void writeEventLoopMetrics(QByteArray *out)
+{
+    const EventLoopMetrics metrics = eventLoopMetrics();
+    appendEventLoopMetric(out, "iterations_total", "counter", "Iterations of the eventloop.",
+                          static_cast<qint64>(metrics.iterations));
+    appendEventLoopMetric(out, "callbacks_total", "counter", "Watcher and timer callbacks run by the eventloop.",
+                          static_cast<qint64>(metrics.callbacks));
+    appendEventLoopMetric(out, "max_iteration_callbacks", "gauge", "The most callbacks run in one iteration.",
+                          metrics.maxIterationCallbacks);
+    appendEventLoopMetric(out, "watchers", "gauge", "Live io watchers.", metrics.watchers);
+    appendEventLoopMetric(out, "timers", "gauge", "Pending timers.", metrics.timers);
+    appendEventLoopMetric(out, "pending_threadsafe_calls", "gauge", "Calls from other threads not taken yet.",
+                          metrics.pendingThreadSafeCalls);
+    appendEventLoopMetric(out, "coroutines", "gauge", "Live coroutines of the thread.", metrics.coroutines);
+
+    out->append("# HELP qtng_eventloop_poll_seconds_total Time blocked in the backend poll.\n"
+                "# TYPE qtng_eventloop_poll_seconds_total counter\nqtng_eventloop_poll_seconds_total ");
+    appendSeconds(out, metrics.pollNsecs / 1000);
+    out->append("\n# HELP qtng_eventloop_iteration_seconds The busy time of iterations.\n"
+                "# TYPE qtng_eventloop_iteration_seconds histogram\n");
+    quint64 cumulative = 0;
+    for (int i = 0; i < EventLoopMetrics::LatencyBuckets; ++i) {
+        cumulative += metrics.latencies[i];
+        out->append("qtng_eventloop_iteration_seconds_bucket{le=\"");
+        const qint64 bound = EventLoopMetrics::latencyBucketBound(i);
+        if (bound >= 0) {
+            appendSeconds(out, bound);
+        } else {
+            out->append("+Inf");
+        }
+        out->append("\"} ");
+        appendUnsigned(out, cumulative);
+        out->append('\n');
+    }
+    out->append("qtng_eventloop_iteration_seconds_sum ");
+    appendSeconds(out, metrics.busyNsecs / 1000);
+    appendSample(out, "\nqtng_eventloop_iteration_seconds_count ", cumulative);
+}
+
+QTNETWORKNG_NAMESPACE_END
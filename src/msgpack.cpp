@@ -1,3 +1,4 @@
+#include <string.h>
 #include <QtCore/qbuffer.h>
 #include <QtCore/qdebug.h>
 #include "../include/msgpack.h"
@@ -89,34 +90,51 @@ public:
     bool unpack_longlong(qint64 &i64);
     bool unpack_ulonglong(quint64 &u64);
     bool unpackString(QString &s);
+    bool unpackStringBytes(QByteArray &buf);
     bool unpack(QVariant &v);
 public:
     QMap<intptr_t, MsgPackExtUserData *> userData;
     QIODevice *dev;
+    // the streams of byte array read and write the buffer of QBuffer directly, until device() is called.
+    mutable QByteArray *buffer;
+    mutable qint64 pos;
     MsgPackStream::Status status;
     quint32 limit;
     int version;
     bool owndev;
     bool flushWrites;
+    bool readable;
+    bool writable;
+    bool counting;  // the written bytes are counted but not written.
 };
 
 MsgPackStreamPrivate::MsgPackStreamPrivate()
     : dev(nullptr)
+    , buffer(nullptr)
+    , pos(0)
     , status(MsgPackStream::Ok)
     , limit(std::numeric_limits<quint32>::max())
     , version(0)
     , owndev(false)
     , flushWrites(false)
+    , readable(false)
+    , writable(false)
+    , counting(false)
 {
 }
 
 MsgPackStreamPrivate::MsgPackStreamPrivate(QIODevice *d)
     : dev(d)
+    , buffer(nullptr)
+    , pos(0)
     , status(MsgPackStream::Ok)
     , limit(std::numeric_limits<quint32>::max())
     , version(0)
     , owndev(false)
     , flushWrites(false)
+    , readable(false)
+    , writable(false)
+    , counting(false)
 {
 }
 
@@ -125,10 +143,15 @@ MsgPackStreamPrivate::MsgPackStreamPrivate(QByteArray *a, QIODevice::OpenMode mo
     , version(0)
     , owndev(true)
     , flushWrites(false)
+    , counting(false)
 {
     QBuffer *buf = new QBuffer(a);
     buf->open(mode);
     dev = buf;
+    buffer = &buf->buffer();
+    pos = buf->pos();  // QBuffer handles the Append and Truncate flags.
+    readable = buf->isReadable();
+    writable = buf->isWritable();
     if (mode == QIODevice::ReadOnly) {
         limit = a->size();
     } else {
@@ -137,16 +160,21 @@ MsgPackStreamPrivate::MsgPackStreamPrivate(QByteArray *a, QIODevice::OpenMode mo
 }
 
 MsgPackStreamPrivate::MsgPackStreamPrivate(const QByteArray &a)
-    : status(MsgPackStream::Ok)
+    : pos(0)
+    , status(MsgPackStream::Ok)
     , limit(a.size())
     , version(0)
     , owndev(true)
     , flushWrites(false)
+    , writable(false)
+    , counting(false)
 {
     QBuffer *buf = new QBuffer();
     buf->setData(a);
     buf->open(QIODevice::ReadOnly);
     dev = buf;
+    buffer = &buf->buffer();
+    readable = buf->isReadable();
 }
 
 MsgPackStreamPrivate::~MsgPackStreamPrivate()
@@ -173,6 +201,16 @@ bool MsgPackStreamPrivate::readBytes(char *data, qint64 len)
     if (len > limit) {
         return false;
     }
+    if (buffer) {
+        if (!readable || len > buffer->size() - pos) {
+            pos = buffer->size();
+            status = MsgPackStream::ReadPastEnd;
+            return false;
+        }
+        memcpy(data, buffer->constData() + pos, static_cast<size_t>(len));
+        pos += len;
+        return true;
+    }
     qint64 total = 0;
     while (total < len) {
         qint64 bs = dev->read(data, (len - total));
@@ -420,6 +458,16 @@ bool MsgPackStreamPrivate::unpack_ulonglong(quint64 &u64)
 }
 
 bool MsgPackStreamPrivate::unpackString(QString &s)
+{
+    QByteArray buf;
+    if (!unpackStringBytes(buf)) {
+        return false;
+    }
+    s = QString::fromUtf8(buf);
+    return true;
+}
+
+bool MsgPackStreamPrivate::unpackStringBytes(QByteArray &buf)
 {
     quint8 p[5];
     if (!readBytes(p, 1)) {
@@ -457,14 +505,14 @@ bool MsgPackStreamPrivate::unpackString(QString &s)
         status = MsgPackStream::ReadCorruptData;
         return false;
     }
-    QByteArray buf;
     if (len > 0) {
         buf.resize(static_cast<int>(len));
         if (!readBytes(buf.data(), len)) {
             return false;
         }
+    } else {
+        buf.clear();
     }
-    s = QString::fromUtf8(buf);
     return true;
 }
 
@@ -889,6 +937,22 @@ bool MsgPackStreamPrivate::writeBytes(const char *data, qint64 len)
         status = MsgPackStream::WriteFailed;
         return false;
     }
+    if (buffer) {
+        if (!writable || pos + len > std::numeric_limits<int>::max()) {
+            status = MsgPackStream::WriteFailed;
+            return false;
+        }
+        if (counting) {
+            pos += len;
+            return true;
+        }
+        if (pos + len > buffer->size()) {
+            buffer->resize(static_cast<int>(pos + len));
+        }
+        memcpy(buffer->data() + pos, data, static_cast<size_t>(len));
+        pos += len;
+        return true;
+    }
     qint64 total = 0;
     while (total < len) {
         qint64 bs = dev->write(data, len - total);
@@ -1024,6 +1088,19 @@ MsgPackStream::MsgPackStream(const QByteArray &a)
 {
 }
 
+MsgPackStream::MsgPackStream(CountingMode)
+    : d_ptr(new MsgPackStreamPrivate())
+{
+    Q_D(MsgPackStream);
+    QBuffer *buf = new QBuffer();
+    buf->open(QIODevice::WriteOnly);
+    d->dev = buf;
+    d->owndev = true;
+    d->buffer = &buf->buffer();
+    d->writable = true;
+    d->counting = true;
+}
+
 MsgPackStream::~MsgPackStream()
 {
     delete d_ptr;
@@ -1036,18 +1113,34 @@ void MsgPackStream::setDevice(QIODevice *dev)
         delete d->dev;
     }
     d->dev = dev;
+    d->buffer = nullptr;
     d->owndev = false;
 }
 
 QIODevice *MsgPackStream::device() const
 {
     Q_D(const MsgPackStream);
+    if (d->buffer) {
+        // the device may be used by caller, so it is used by us since now.
+        d->dev->seek(d->pos);
+        d->buffer = nullptr;
+    }
     return d->dev;
 }
 
+qint64 MsgPackStream::countedSize() const
+{
+    Q_D(const MsgPackStream);
+    // the bytes after device() is called are written to the buffer.
+    return d->buffer ? d->pos : d->dev->pos();
+}
+
 bool MsgPackStream::atEnd() const
 {
     Q_D(const MsgPackStream);
+    if (d->buffer) {
+        return d->pos >= d->buffer->size();
+    }
     return d->dev ? d->dev->atEnd() : true;
 }
 
@@ -1563,9 +1656,14 @@ MsgPackStream &MsgPackStream::operator<<(double f)
 
 MsgPackStream &MsgPackStream::operator<<(const QString &str)
 {
-    CHECK_STREAM_PRECOND(*this);
-    const QByteArray &bytes = str.toUtf8();
-    quint32 len = static_cast<quint32>(bytes.size());
+    writeString(str.toUtf8());
+    return *this;
+}
+
+bool MsgPackStream::writeString(const QByteArray &utf8)
+{
+    CHECK_STREAM_PRECOND(false);
+    quint32 len = static_cast<quint32>(utf8.size());
     quint8 p[5];
     int sz;
     if (len <= 31) {
@@ -1585,10 +1683,9 @@ MsgPackStream &MsgPackStream::operator<<(const QString &str)
         sz = 5;
     }
     if (!d->writeBytes(p, sz)) {
-        return *this;
+        return false;
     }
-    d->writeBytes(bytes.data(), len);
-    return *this;
+    return d->writeBytes(utf8.constData(), len);
 }
 
 MsgPackStream &MsgPackStream::operator<<(const QByteArray &array)
@@ -1703,6 +1800,12 @@ MsgPackStream &MsgPackStream::operator<<(const QVariant &v)
     }
 }
 
+bool MsgPackStream::readString(QByteArray &utf8)
+{
+    CHECK_STREAM_PRECOND(false);
+    return d->unpackStringBytes(utf8);
+}
+
 bool MsgPackStream::writeBytes(const char *data, qint64 len)
 {
     Q_D(MsgPackStream);
@@ -1727,4 +1830,774 @@ bool MsgPackStream::writeExtHeader(quint32 len, quint8 msgpackType)
     return d->writeExtHeader(len, msgpackType);
 }
 
+qint64 MsgPackStream::readTypedArrayHeader(char code, int elementSize)
+{
+    Q_D(MsgPackStream);
+    quint32 len;
+    quint8 msgpackType;
+    if (!d->readExtHeader(len, msgpackType)) {
+        return -1;
+    }
+    char c;
+    if (msgpackType != TypedArrayExtType || len < 1 || !d->readBytes(&c, 1)) {
+        d->status = ReadCorruptData;
+        return -1;
+    }
+    if (c != code || (len - 1) % static_cast<quint32>(elementSize) != 0) {
+        d->status = ReadCorruptData;
+        return -1;
+    }
+    return (len - 1) / static_cast<quint32>(elementSize);
+}
+
+namespace {
+
+// the numbers of arrays are packed and unpacked by blocks of this count, to write and read the device less.
+const int NumberBlockSize = 4096;
+
+// the same bytes as MsgPackStream::operator<<(quint64)
+inline int packUnsigned(quint8 *p, quint64 u)
+{
+    if (u <= FirstByte::POSITIVE_FIXINT) {
+        p[0] = static_cast<quint8>(u);
+        return 1;
+    } else if (u <= std::numeric_limits<quint8>::max()) {
+        p[0] = FirstByte::UINT8;
+        p[1] = static_cast<quint8>(u);
+        return 2;
+    } else if (u <= std::numeric_limits<quint16>::max()) {
+        p[0] = FirstByte::UINT16;
+        _msgpack_store16(p + 1, static_cast<quint16>(u));
+        return 3;
+    } else if (u <= std::numeric_limits<quint32>::max()) {
+        p[0] = FirstByte::UINT32;
+        _msgpack_store32(p + 1, static_cast<quint32>(u));
+        return 5;
+    } else {
+        p[0] = FirstByte::UINT64;
+        _msgpack_store64(p + 1, u);
+        return 9;
+    }
+}
+
+// the same bytes as MsgPackStream::operator<<(qint64)
+inline int packSigned(quint8 *p, qint64 i)
+{
+    if (i >= 0) {
+        return packUnsigned(p, static_cast<quint64>(i));
+    } else if (i >= -32) {
+        p[0] = static_cast<quint8>(i);
+        return 1;
+    } else if (i >= std::numeric_limits<qint8>::min()) {
+        p[0] = FirstByte::INT8;
+        p[1] = static_cast<quint8>(i);
+        return 2;
+    } else if (i >= std::numeric_limits<qint16>::min()) {
+        p[0] = FirstByte::INT16;
+        _msgpack_store16(p + 1, static_cast<qint16>(i));
+        return 3;
+    } else if (i >= std::numeric_limits<qint32>::min()) {
+        p[0] = FirstByte::INT32;
+        _msgpack_store32(p + 1, static_cast<qint32>(i));
+        return 5;
+    } else {
+        p[0] = FirstByte::INT64;
+        _msgpack_store64(p + 1, i);
+        return 9;
+    }
+}
+
+inline int packNumber(quint8 *p, qint32 i)
+{
+    return packSigned(p, i);
+}
+
+inline int packNumber(quint8 *p, qint64 i)
+{
+    return packSigned(p, i);
+}
+
+inline int packNumber(quint8 *p, quint32 u)
+{
+    return packUnsigned(p, u);
+}
+
+inline int packNumber(quint8 *p, quint64 u)
+{
+    return packUnsigned(p, u);
+}
+
+inline int packNumber(quint8 *p, float f)
+{
+    quint32 u;
+    memcpy(&u, &f, sizeof(u));
+    p[0] = FirstByte::FLOAT32;
+    _msgpack_store32(p + 1, u);
+    return 5;
+}
+
+inline int packNumber(quint8 *p, double f)
+{
+    quint64 u;
+    memcpy(&u, &f, sizeof(u));
+    p[0] = FirstByte::FLOAT64;
+    _msgpack_store64(p + 1, u);
+    return 9;
+}
+
+template<typename T>
+MsgPackStream &packNumbers(MsgPackStream &s, const QVector<T> &list)
+{
+    if (!s.writeArrayHeader(static_cast<quint32>(list.size()))) {
+        return s;
+    }
+    // the stack of coroutine is small.
+    QByteArray buf(qMin(list.size(), NumberBlockSize) * 9, Qt::Uninitialized);
+    quint8 *block = reinterpret_cast<quint8 *>(buf.data());
+    const T *values = list.constData();
+    for (int i = 0; i < list.size();) {
+        const int end = qMin(list.size(), i + NumberBlockSize);
+        int size = 0;
+        for (; i < end; ++i) {
+            size += packNumber(block + size, values[i]);
+        }
+        if (!s.writeBytes(buf.constData(), size)) {
+            break;
+        }
+    }
+    return s;
+}
+
+// float and double are always packed in fixed size, so the whole block is read at once.
+template<typename T, typename U>
+MsgPackStream &unpackFloats(MsgPackStream &s, QVector<T> &list, quint8 firstByte)
+{
+    const int elementSize = static_cast<int>(sizeof(U)) + 1;
+    quint32 len = 0;
+    if (!s.readArrayHeader(len)) {
+        return s;
+    }
+    list.clear();
+    list.reserve(static_cast<int>(len));
+    QByteArray buf(static_cast<int>(qMin<quint32>(len, NumberBlockSize)) * elementSize, Qt::Uninitialized);
+    quint8 *block = reinterpret_cast<quint8 *>(buf.data());
+    while (len > 0) {
+        const int count = static_cast<int>(qMin<quint32>(len, NumberBlockSize));
+        if (!s.readBytes(buf.data(), count * elementSize)) {
+            break;
+        }
+        for (int i = 0; i < count; ++i) {
+            const quint8 *p = block + i * elementSize;
+            if (p[0] != firstByte) {
+                s.setStatus(MsgPackStream::ReadCorruptData);
+                return s;
+            }
+            const U u = qFromBigEndian<U>(p + 1);
+            T f;
+            memcpy(&f, &u, sizeof(f));
+            list.append(f);
+        }
+        len -= static_cast<quint32>(count);
+    }
+    return s;
+}
+
+}  // anonymous namespace
+
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<float> &list)
+{
+    return packNumbers(s, list);
+}
+
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<double> &list)
+{
+    return packNumbers(s, list);
+}
+
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<qint32> &list)
+{
+    return packNumbers(s, list);
+}
+
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<quint32> &list)
+{
+    return packNumbers(s, list);
+}
+
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<qint64> &list)
+{
+    return packNumbers(s, list);
+}
+
+MsgPackStream &operator<<(MsgPackStream &s, const QVector<quint64> &list)
+{
+    return packNumbers(s, list);
+}
+
+MsgPackStream &operator>>(MsgPackStream &s, QVector<float> &list)
+{
+    return unpackFloats<float, quint32>(s, list, FirstByte::FLOAT32);
+}
+
+MsgPackStream &operator>>(MsgPackStream &s, QVector<double> &list)
+{
+    return unpackFloats<double, quint64>(s, list, FirstByte::FLOAT64);
+}
+
+namespace {
+
+inline quint64 loadBigEndian(const uchar *p, int size)
+{
+    quint64 u = 0;
+    for (int i = 0; i < size; ++i) {
+        u = (u << 8) | p[i];
+    }
+    return u;
+}
+
+// returns false if the header or the payload of scalar is out of buffer.
+bool parseHeader(const uchar *p, const uchar *end, MsgPackView::Type *type, const uchar **payload, quint64 *length)
+{
+    if (!p || p >= end) {
+        return false;
+    }
+    const quint8 c = *p;
+    int lengthSize = 0;  // the bytes of length field after the first byte.
+    int extra = 0;  // the type of extension.
+    quint64 fixed = 0;
+    if (c <= FirstByte::POSITIVE_FIXINT || c >= FirstByte::NEGATIVE_FIXINT) {
+        *type = c <= FirstByte::POSITIVE_FIXINT ? MsgPackView::UnsignedInteger : MsgPackView::Integer;
+    } else if (c < FirstByte::FIXARRAY) {
+        *type = MsgPackView::Map;
+        fixed = c & 0xf;
+    } else if (c < FirstByte::FIXSTR) {
+        *type = MsgPackView::Array;
+        fixed = c & 0xf;
+    } else if (c < FirstByte::NIL) {
+        *type = MsgPackView::String;
+        fixed = c & 0x1f;
+    } else {
+        switch (c) {
+        case FirstByte::NIL:
+            *type = MsgPackView::Nil;
+            break;
+        case FirstByte::MFALSE:
+        case FirstByte::MTRUE:
+            *type = MsgPackView::Bool;
+            break;
+        case FirstByte::BIN8:
+        case FirstByte::BIN16:
+        case FirstByte::BIN32:
+            *type = MsgPackView::Binary;
+            lengthSize = 1 << (c - FirstByte::BIN8);
+            break;
+        case FirstByte::EXT8:
+        case FirstByte::EXT16:
+        case FirstByte::EXT32:
+            *type = MsgPackView::Extension;
+            lengthSize = 1 << (c - FirstByte::EXT8);
+            extra = 1;
+            break;
+        case FirstByte::FLOAT32:
+            *type = MsgPackView::Float;
+            fixed = 4;
+            break;
+        case FirstByte::FLOAT64:
+            *type = MsgPackView::Double;
+            fixed = 8;
+            break;
+        case FirstByte::UINT8:
+        case FirstByte::UINT16:
+        case FirstByte::UINT32:
+        case FirstByte::UINT64:
+            *type = MsgPackView::UnsignedInteger;
+            fixed = 1u << (c - FirstByte::UINT8);
+            break;
+        case FirstByte::INT8:
+        case FirstByte::INT16:
+        case FirstByte::INT32:
+        case FirstByte::INT64:
+            *type = MsgPackView::Integer;
+            fixed = 1u << (c - FirstByte::INT8);
+            break;
+        case FirstByte::FIXEXT1:
+        case FirstByte::FIXEXT2:
+        case FirstByte::FIXEXT4:
+        case FirstByte::FIXEXT8:
+        case FirstByte::FIXEX16:
+            *type = MsgPackView::Extension;
+            fixed = 1u << (c - FirstByte::FIXEXT1);
+            extra = 1;
+            break;
+        case FirstByte::STR8:
+        case FirstByte::STR16:
+        case FirstByte::STR32:
+            *type = MsgPackView::String;
+            lengthSize = 1 << (c - FirstByte::STR8);
+            break;
+        case FirstByte::ARRAY16:
+        case FirstByte::ARRAY32:
+            *type = MsgPackView::Array;
+            lengthSize = 2 << (c - FirstByte::ARRAY16);
+            break;
+        case FirstByte::MAP16:
+        case FirstByte::MAP32:
+            *type = MsgPackView::Map;
+            lengthSize = 2 << (c - FirstByte::MAP16);
+            break;
+        default:
+            return false;
+        }
+    }
+    const uchar *q = p + 1;
+    if (end - q < lengthSize + extra) {
+        return false;
+    }
+    *length = lengthSize > 0 ? loadBigEndian(q, lengthSize) : fixed;
+    *payload = q + lengthSize + extra;
+    if (*type == MsgPackView::Array || *type == MsgPackView::Map) {
+        return true;
+    }
+    return *length <= static_cast<quint64>(end - *payload);
+}
+
+// returns the end of count values from p, or nullptr if they are out of buffer. the nested values are counted
+// instead of recursion.
+const uchar *skipValues(const uchar *p, const uchar *end, quint64 count)
+{
+    while (count > 0) {
+        MsgPackView::Type type;
+        const uchar *payload;
+        quint64 length;
+        if (!parseHeader(p, end, &type, &payload, &length)) {
+            return nullptr;
+        }
+        --count;
+        if (type == MsgPackView::Array) {
+            count += length;
+            p = payload;
+        } else if (type == MsgPackView::Map) {
+            count += length * 2;
+            p = payload;
+        } else {
+            p = payload + length;
+        }
+    }
+    return p;
+}
+
+}  // anonymous namespace
+
+MsgPackView::MsgPackView()
+    : p(nullptr)
+    , end(nullptr)
+    , payload(nullptr)
+    , valueEnd(nullptr)
+    , length(0)
+    , t(Invalid)
+{
+}
+
+MsgPackView::MsgPackView(const QByteArray &data)
+    : holder(data)
+    , p(reinterpret_cast<const uchar *>(holder.constData()))
+    , end(p + holder.size())
+    , payload(nullptr)
+    , valueEnd(nullptr)
+    , length(0)
+    , t(Invalid)
+{
+    parse();
+}
+
+MsgPackView::MsgPackView(const char *data, int size)
+    : p(reinterpret_cast<const uchar *>(data))
+    , end(p + qMax(0, size))
+    , payload(nullptr)
+    , valueEnd(nullptr)
+    , length(0)
+    , t(Invalid)
+{
+    parse();
+}
+
+MsgPackView::MsgPackView(const QByteArray &holder, const uchar *p, const uchar *end)
+    : holder(holder)
+    , p(p)
+    , end(end)
+    , payload(nullptr)
+    , valueEnd(nullptr)
+    , length(0)
+    , t(Invalid)
+{
+    parse();
+}
+
+void MsgPackView::parse()
+{
+    if (!parseHeader(p, end, &t, &payload, &length)) {
+        t = Invalid;
+        return;
+    }
+    if (t != Array && t != Map) {
+        valueEnd = payload + length;
+    }
+}
+
+bool MsgPackView::toBool(bool defaultValue) const
+{
+    return t == Bool ? *p == FirstByte::MTRUE : defaultValue;
+}
+
+qint64 MsgPackView::toInteger(qint64 defaultValue) const
+{
+    if (t == Integer) {
+        if (*p >= FirstByte::NEGATIVE_FIXINT) {
+            return static_cast<qint8>(*p);
+        }
+        const int size = static_cast<int>(length);
+        const quint64 u = loadBigEndian(payload, size);
+        if (size == 8) {
+            return static_cast<qint64>(u);
+        }
+        // sign extension.
+        const int shift = 64 - size * 8;
+        return static_cast<qint64>(u << shift) >> shift;
+    } else if (t == UnsignedInteger) {
+        const quint64 u = toUnsignedInteger();
+        if (u <= static_cast<quint64>(std::numeric_limits<qint64>::max())) {
+            return static_cast<qint64>(u);
+        }
+    }
+    return defaultValue;
+}
+
+quint64 MsgPackView::toUnsignedInteger(quint64 defaultValue) const
+{
+    if (t == UnsignedInteger) {
+        if (*p <= FirstByte::POSITIVE_FIXINT) {
+            return *p;
+        }
+        return loadBigEndian(payload, static_cast<int>(length));
+    } else if (t == Integer) {
+        const qint64 i = toInteger();
+        if (i >= 0) {
+            return static_cast<quint64>(i);
+        }
+    }
+    return defaultValue;
+}
+
+double MsgPackView::toDouble(double defaultValue) const
+{
+    if (t == Float) {
+        const quint32 u = static_cast<quint32>(loadBigEndian(payload, 4));
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        return f;
+    } else if (t == Double) {
+        const quint64 u = loadBigEndian(payload, 8);
+        double d;
+        memcpy(&d, &u, sizeof(d));
+        return d;
+    } else if (t == Integer) {
+        return static_cast<double>(toInteger());
+    } else if (t == UnsignedInteger) {
+        return static_cast<double>(toUnsignedInteger());
+    }
+    return defaultValue;
+}
+
+QByteArray MsgPackView::toBytes() const
+{
+    if (t != String && t != Binary && t != Extension) {
+        return QByteArray();
+    }
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(payload), static_cast<int>(length));
+}
+
+QString MsgPackView::toString() const
+{
+    if (t != String) {
+        return QString();
+    }
+    return QString::fromUtf8(reinterpret_cast<const char *>(payload), static_cast<int>(length));
+}
+
+quint8 MsgPackView::extensionType() const
+{
+    return t == Extension ? payload[-1] : 0;
+}
+
+QVariant MsgPackView::toVariant() const
+{
+    const QByteArray &bs = raw();
+    if (bs.isEmpty()) {
+        return QVariant();
+    }
+    MsgPackStream stream(bs);
+    QVariant v;
+    stream >> v;
+    return v;
+}
+
+QByteArray MsgPackView::raw() const
+{
+    if (t == Invalid) {
+        return QByteArray();
+    }
+    const uchar *e = valueEnd ? valueEnd : skipValues(p, end, 1);
+    if (!e) {
+        return QByteArray();
+    }
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(p), static_cast<int>(e - p));
+}
+
+int MsgPackView::size() const
+{
+    if (t != Array && t != Map) {
+        return 0;
+    }
+    return static_cast<int>(qMin<quint64>(length, static_cast<quint64>(std::numeric_limits<int>::max())));
+}
+
+MsgPackView MsgPackView::at(int i) const
+{
+    if (t != Array || i < 0 || static_cast<quint64>(i) >= length) {
+        return MsgPackView();
+    }
+    return MsgPackView(holder, skipValues(payload, end, static_cast<quint64>(i)), end);
+}
+
+MsgPackView MsgPackView::value(const QByteArray &key) const
+{
+    if (t != Map) {
+        return MsgPackView();
+    }
+    const uchar *q = payload;
+    for (quint64 i = 0; i < length && q; ++i) {
+        MsgPackView k(holder, q, end);
+        if (!k.isValid() || !k.valueEnd) {
+            // the keys of containers are skipped.
+            q = skipValues(q, end, 1);
+        } else {
+            q = k.valueEnd;
+            if (k.t == String && k.length == static_cast<quint64>(key.size())
+                && memcmp(k.payload, key.constData(), static_cast<size_t>(key.size())) == 0) {
+                return MsgPackView(holder, q, end);
+            }
+        }
+        q = skipValues(q, end, 1);
+    }
+    return MsgPackView();
+}
+
+MsgPackView MsgPackView::first() const
+{
+    if ((t != Array && t != Map) || length == 0) {
+        return MsgPackView();
+    }
+    return MsgPackView(holder, payload, end);
+}
+
+MsgPackView MsgPackView::next() const
+{
+    if (t == Invalid) {
+        return MsgPackView();
+    }
+    const uchar *e = valueEnd ? valueEnd : skipValues(p, end, 1);
+    return MsgPackView(holder, e, end);
+}
+
+class MsgPackUnpackerPrivate
+{
+public:
+    MsgPackUnpackerPrivate();
+public:
+    void scan();
+    void compact();
+public:
+    QByteArray buffer;
+    QList<int> ends;  // the ends of complete values in buffer.
+    int start;  // of next value.
+    int feeding;  // the offset of space returned by beginFeed().
+    int scanned;  // the bytes before are scanned.
+    quint64 remaining;  // the values to skip before the value under scanning is complete, 0 at the boundaries.
+    quint32 limit;
+    bool corrupt;
+};
+
+MsgPackUnpackerPrivate::MsgPackUnpackerPrivate()
+    : start(0)
+    , feeding(-1)
+    , scanned(0)
+    , remaining(0)
+    , limit(std::numeric_limits<quint32>::max())
+    , corrupt(false)
+{
+}
+
+void MsgPackUnpackerPrivate::scan()
+{
+    const uchar *begin = reinterpret_cast<const uchar *>(buffer.constData());
+    const uchar *end = begin + buffer.size();
+    while (!corrupt && scanned < buffer.size()) {
+        const uchar *p = begin + scanned;
+        if (*p == FirstByte::NEVER_USED) {
+            corrupt = true;
+            return;
+        }
+        MsgPackView::Type type;
+        const uchar *payload;
+        quint64 length = 0;
+        const bool complete = parseHeader(p, end, &type, &payload, &length);
+        // the length is known once the header is complete, even if the payload is not.
+        if (length > limit) {
+            corrupt = true;
+            return;
+        }
+        if (!complete) {
+            return;
+        }
+        if (remaining == 0) {
+            remaining = 1;
+        }
+        --remaining;
+        if (type == MsgPackView::Array) {
+            remaining += length;
+            p = payload;
+        } else if (type == MsgPackView::Map) {
+            remaining += length * 2;
+            p = payload;
+        } else {
+            p = payload + length;
+        }
+        scanned = static_cast<int>(p - begin);
+        if (remaining == 0) {
+            ends.append(scanned);
+        }
+    }
+}
+
+void MsgPackUnpackerPrivate::compact()
+{
+    // moves the rest of bytes to the front if the taken bytes are the majority.
+    if (start == 0 || start < buffer.size() / 2) {
+        return;
+    }
+    buffer.remove(0, start);
+    for (int &e : ends) {
+        e -= start;
+    }
+    scanned -= start;
+    start = 0;
+}
+
+MsgPackUnpacker::MsgPackUnpacker()
+    : d_ptr(new MsgPackUnpackerPrivate())
+{
+}
+
+MsgPackUnpacker::~MsgPackUnpacker()
+{
+    delete d_ptr;
+}
+
+void MsgPackUnpacker::feed(const char *data, int size)
+{
+    Q_D(MsgPackUnpacker);
+    if (size <= 0 || d->corrupt) {
+        return;
+    }
+    d->compact();
+    d->buffer.append(data, size);
+    d->scan();
+}
+
+char *MsgPackUnpacker::beginFeed(int size)
+{
+    Q_D(MsgPackUnpacker);
+    d->compact();
+    d->feeding = d->buffer.size();
+    d->buffer.resize(d->feeding + qMax(0, size));
+    return d->buffer.data() + d->feeding;
+}
+
+void MsgPackUnpacker::endFeed(int size)
+{
+    Q_D(MsgPackUnpacker);
+    if (d->feeding < 0) {
+        return;
+    }
+    d->buffer.resize(qMin(d->buffer.size(), d->feeding + qMax(0, size)));
+    d->feeding = -1;
+    d->scan();
+}
+
+bool MsgPackUnpacker::hasNext() const
+{
+    Q_D(const MsgPackUnpacker);
+    return !d->corrupt && !d->ends.isEmpty();
+}
+
+QByteArray MsgPackUnpacker::peek() const
+{
+    Q_D(const MsgPackUnpacker);
+    if (!hasNext()) {
+        return QByteArray();
+    }
+    return QByteArray::fromRawData(d->buffer.constData() + d->start, d->ends.first() - d->start);
+}
+
+void MsgPackUnpacker::skip()
+{
+    Q_D(MsgPackUnpacker);
+    if (!hasNext()) {
+        return;
+    }
+    d->start = d->ends.takeFirst();
+    if (d->start == d->buffer.size()) {
+        // the common case, reserve() keeps the space of buffer while resizing to 0.
+        d->buffer.reserve(d->buffer.capacity());
+        d->buffer.resize(0);
+        d->scanned = 0;
+        d->start = 0;
+    }
+}
+
+QByteArray MsgPackUnpacker::takeRaw()
+{
+    const QByteArray &raw = peek();
+    if (raw.isNull()) {
+        return QByteArray();
+    }
+    QByteArray t(raw.constData(), raw.size());
+    skip();
+    return t;
+}
+
+bool MsgPackUnpacker::isCorrupt() const
+{
+    Q_D(const MsgPackUnpacker);
+    return d->corrupt;
+}
+
+int MsgPackUnpacker::bufferedSize() const
+{
+    Q_D(const MsgPackUnpacker);
+    return d->buffer.size() - d->start;
+}
+
+void MsgPackUnpacker::setLengthLimit(quint32 limit)
+{
+    Q_D(MsgPackUnpacker);
+    d->limit = limit;
+}
+
+quint32 MsgPackUnpacker::lengthLimit() const
+{
+    Q_D(const MsgPackUnpacker);
+    return d->limit;
+}
+
 QTNETWORKNG_NAMESPACE_END
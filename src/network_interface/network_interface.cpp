@@ -77,8 +77,17 @@ static QList<NetworkInterfacePrivate *> postProcess(QList<NetworkInterfacePrivat
 }
 
 Q_GLOBAL_STATIC(NetworkInterfaceManager, manager)
-NetworkInterfaceManager::NetworkInterfaceManager() { }
-NetworkInterfaceManager::~NetworkInterfaceManager() { }
+NetworkInterfaceManager::NetworkInterfaceManager()
+    : watching(false)
+    , cacheValid(false)
+{
+    watchers[0] = watchers[1] = 0;
+}
+
+NetworkInterfaceManager::~NetworkInterfaceManager()
+{
+    stopWatching();
+}
 
 QSharedDataPointer<NetworkInterfacePrivate> NetworkInterfaceManager::interfaceFromName(const QString &name)
 {
@@ -110,23 +119,28 @@ QSharedDataPointer<NetworkInterfacePrivate> NetworkInterfaceManager::interfaceFr
     return empty;
 }
 
+// the interfaces are scanned again only if the platform watcher reports changes, so the lookups of multicast options and
+// scope ids are cheap.
 QList<QSharedDataPointer<NetworkInterfacePrivate>> NetworkInterfaceManager::allInterfaces()
 {
-    const QList<NetworkInterfacePrivate *> list = postProcess(scan());
-    QList<QSharedDataPointer<NetworkInterfacePrivate>> result;
-    result.reserve(list.size());
-
-    for (NetworkInterfacePrivate *ptr : list) {
-        if ((ptr->flags & NetworkInterface::IsUp) == 0) {
-            // if the network interface isn't UP, the addresses are ineligible for DNS
-            for (NetworkAddressEntry &addr : ptr->addressEntries) {
-                addr.setDnsEligibility(NetworkAddressEntry::DnsIneligible);
+    QMutexLocker locker(&cacheLock);
+    // check before scanning, the changes happened while scanning are seen by next call.
+    if (checkChanges() || !cacheValid) {
+        cache.clear();
+        const QList<NetworkInterfacePrivate *> list = postProcess(scan());
+        cache.reserve(list.size());
+        for (NetworkInterfacePrivate *ptr : list) {
+            if ((ptr->flags & NetworkInterface::IsUp) == 0) {
+                // if the network interface isn't UP, the addresses are ineligible for DNS
+                for (NetworkAddressEntry &addr : ptr->addressEntries) {
+                    addr.setDnsEligibility(NetworkAddressEntry::DnsIneligible);
+                }
             }
+            cache << QSharedDataPointer<NetworkInterfacePrivate>(ptr);
         }
-        result << QSharedDataPointer<NetworkInterfacePrivate>(ptr);
+        cacheValid = true;
     }
-
-    return result;
+    return cache;
 }
 
 static inline char toHexUpper(uchar i)
@@ -66,6 +66,11 @@
 #ifdef Q_OS_SOLARIS
 #  include <sys/sockio.h>
 #endif
+#ifdef Q_OS_LINUX
+#  include <string.h>
+#  include <linux/netlink.h>
+#  include <linux/rtnetlink.h>
+#endif
 #ifdef Q_OS_HAIKU
 #  include <sys/sockio.h>
 #  define IFF_RUNNING 0x0001
@@ -137,6 +142,72 @@ static NetworkInterface::InterfaceFlags convertFlags(uint rawFlags)
     return flags;
 }
 
+#ifdef Q_OS_LINUX
+// returns the netlink socket subscribed to the changes of links and addresses, or -1 if it is not permitted.
+static inline int openInterfaceWatcher()
+{
+    int fd = qt_safe_socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE, O_NONBLOCK);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        qt_safe_close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// reads all pending notifications, returns true if there are some. the notifications are not parsed, any of them
+// makes the interfaces scanned again. ENOBUFS means some are lost.
+static inline bool drainInterfaceWatcher(int fd)
+{
+    char buf[4096];
+    bool changed = false;
+    while (true) {
+        ssize_t r = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (r > 0 || (r < 0 && errno == ENOBUFS)) {
+            changed = true;
+        } else if (r < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return changed;
+        }
+    }
+}
+
+bool NetworkInterfaceManager::checkChanges()
+{
+    if (!watching) {
+        watching = true;
+        watchers[0] = openInterfaceWatcher();
+        return true;
+    }
+    if (watchers[0] < 0) {
+        return true;
+    }
+    return drainInterfaceWatcher(static_cast<int>(watchers[0]));
+}
+
+void NetworkInterfaceManager::stopWatching()
+{
+    if (watching && watchers[0] >= 0) {
+        qt_safe_close(static_cast<int>(watchers[0]));
+    }
+    watching = false;
+}
+#else
+// no notification of interface changes, scan every time.
+bool NetworkInterfaceManager::checkChanges()
+{
+    return true;
+}
+
+void NetworkInterfaceManager::stopWatching() { }
+#endif
+
 QTNETWORKNG_NAMESPACE_END
 
 #endif // QNETWORKINTERFACE_UNIX_P_H
@@ -80,6 +80,14 @@ typedef NETIO_STATUS (WINAPI *PtrConvertInterfaceNameToLuid)(const wchar_t*, NET
 static PtrConvertInterfaceNameToLuid ptrConvertInterfaceNameToLuid = 0;
 typedef NETIO_STATUS (WINAPI *PtrConvertInterfaceIndexToLuid)(NET_IFINDEX, PNET_LUID);
 static PtrConvertInterfaceIndexToLuid ptrConvertInterfaceIndexToLuid = 0;
+typedef NETIO_STATUS (WINAPI *PtrNotifyIpInterfaceChange)(ADDRESS_FAMILY, PIPINTERFACE_CHANGE_CALLBACK, PVOID, BOOLEAN,
+                                                          HANDLE *);
+static PtrNotifyIpInterfaceChange ptrNotifyIpInterfaceChange = 0;
+typedef NETIO_STATUS (WINAPI *PtrNotifyUnicastIpAddressChange)(ADDRESS_FAMILY, PUNICASTIPADDRESS_CHANGE_CALLBACK, PVOID,
+                                                               BOOLEAN, HANDLE *);
+static PtrNotifyUnicastIpAddressChange ptrNotifyUnicastIpAddressChange = 0;
+typedef NETIO_STATUS (WINAPI *PtrCancelMibChangeNotify2)(HANDLE);
+static PtrCancelMibChangeNotify2 ptrCancelMibChangeNotify2 = 0;
 
 static void resolveLibs()
 {
@@ -100,6 +108,10 @@ static void resolveLibs()
         ptrConvertInterfaceLuidToIndex = (PtrConvertInterfaceLuidToIndex) lib.resolve("ConvertInterfaceLuidToIndex");
         ptrConvertInterfaceNameToLuid = (PtrConvertInterfaceNameToLuid) lib.resolve("ConvertInterfaceNameToLuidW");
         ptrConvertInterfaceIndexToLuid = (PtrConvertInterfaceIndexToLuid) lib.resolve("ConvertInterfaceIndexToLuid");
+        ptrNotifyIpInterfaceChange = (PtrNotifyIpInterfaceChange) lib.resolve("NotifyIpInterfaceChange");
+        ptrNotifyUnicastIpAddressChange =
+                (PtrNotifyUnicastIpAddressChange) lib.resolve("NotifyUnicastIpAddressChange");
+        ptrCancelMibChangeNotify2 = (PtrCancelMibChangeNotify2) lib.resolve("CancelMibChangeNotify2");
     }
 }
 
@@ -471,5 +483,52 @@ QList<NetworkInterfacePrivate *> NetworkInterfaceManager::scan()
     return interfaceListing();
 }
 
+// called by the threads of system.
+static void WINAPI interfaceChanged(PVOID context, PMIB_IPINTERFACE_ROW, MIB_NOTIFICATION_TYPE)
+{
+    static_cast<NetworkInterfaceManager *>(context)->changed.storeRelease(1);
+}
+
+static void WINAPI addressChanged(PVOID context, PMIB_UNICASTIPADDRESS_ROW, MIB_NOTIFICATION_TYPE)
+{
+    static_cast<NetworkInterfaceManager *>(context)->changed.storeRelease(1);
+}
+
+bool NetworkInterfaceManager::checkChanges()
+{
+    if (!watching) {
+        watching = true;
+        resolveLibs();
+        if (!ptrNotifyIpInterfaceChange || !ptrNotifyUnicastIpAddressChange || !ptrCancelMibChangeNotify2) {
+            return true;
+        }
+        HANDLE interfaceHandle = nullptr;
+        HANDLE addressHandle = nullptr;
+        if (ptrNotifyIpInterfaceChange(AF_UNSPEC, interfaceChanged, this, FALSE, &interfaceHandle) == NO_ERROR) {
+            watchers[0] = reinterpret_cast<qintptr>(interfaceHandle);
+        }
+        if (ptrNotifyUnicastIpAddressChange(AF_UNSPEC, addressChanged, this, FALSE, &addressHandle) == NO_ERROR) {
+            watchers[1] = reinterpret_cast<qintptr>(addressHandle);
+        }
+        changed.storeRelease(0);
+        return true;
+    }
+    if (!watchers[0] || !watchers[1]) {
+        return true;
+    }
+    return changed.fetchAndStoreAcquire(0) != 0;
+}
+
+void NetworkInterfaceManager::stopWatching()
+{
+    for (int i = 0; i < 2; ++i) {
+        if (watchers[i]) {
+            ptrCancelMibChangeNotify2(reinterpret_cast<HANDLE>(watchers[i]));
+            watchers[i] = 0;
+        }
+    }
+    watching = false;
+}
+
 
 QTNETWORKNG_NAMESPACE_END
@@ -0,0 +1,208 @@
+#include <QtCore/qmutex.h>
+#include <openssl/ocsp.h>
+#include <openssl/x509v3.h>
+#include "../include/ocsp.h"
+#include "../include/http.h"
+#include "../include/coroutine_utils.h"
+#include "../include/private/crypto_p.h"
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.ocsp");
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+class OcspStaplingPrivate
+{
+public:
+    OcspStaplingPrivate(const Certificate &certificate, const Certificate &issuer, QSharedPointer<HttpSession> session);
+    ~OcspStaplingPrivate();
+    bool fetch(QByteArray *der, QDateTime *nextUpdate);
+    bool refresh();
+    void refreshForever();
+public:
+    Certificate certificate;
+    Certificate issuer;
+    QSharedPointer<HttpSession> session;
+    CoroutineGroup *operations;
+    QUrl responderUrl;
+    mutable QMutex mutex;
+    QByteArray response;
+    QDateTime nextUpdate;
+    qint64 expiry;  // the msecs since epoch of nextUpdate, checked by every handshake.
+};
+
+OcspStaplingPrivate::OcspStaplingPrivate(const Certificate &certificate, const Certificate &issuer,
+                                         QSharedPointer<HttpSession> session)
+    : certificate(certificate)
+    , issuer(issuer)
+    , session(session)
+    , operations(new CoroutineGroup())
+    , expiry(0)
+{
+    if (this->session.isNull()) {
+        this->session.reset(new HttpSession());
+    }
+    X509 *x509 = static_cast<X509 *>(certificate.handle());
+    if (x509) {
+        STACK_OF(OPENSSL_STRING) *urls = X509_get1_ocsp(x509);
+        if (urls && sk_OPENSSL_STRING_num(urls) > 0) {
+            responderUrl = QUrl(QString::fromLatin1(sk_OPENSSL_STRING_value(urls, 0)));
+        }
+        X509_email_free(urls);
+    }
+}
+
+OcspStaplingPrivate::~OcspStaplingPrivate()
+{
+    delete operations;
+}
+
+bool OcspStaplingPrivate::fetch(QByteArray *der, QDateTime *nextUpdate)
+{
+    X509 *x509 = static_cast<X509 *>(certificate.handle());
+    X509 *issuerX509 = static_cast<X509 *>(issuer.handle());
+    if (responderUrl.isEmpty() || !x509 || !issuerX509) {
+        return false;
+    }
+    OCSP_CERTID *id = OCSP_cert_to_id(nullptr, x509, issuerX509);
+    if (!id) {
+        return false;
+    }
+    QByteArray body;
+    OCSP_REQUEST *request = OCSP_REQUEST_new();
+    OCSP_CERTID *requestId = OCSP_CERTID_dup(id);
+    if (request && requestId && OCSP_request_add0_id(request, requestId)) {
+        int len = i2d_OCSP_REQUEST(request, nullptr);
+        if (len > 0) {
+            body.resize(len);
+            unsigned char *p = reinterpret_cast<unsigned char *>(body.data());
+            i2d_OCSP_REQUEST(request, &p);
+        }
+    } else {
+        OCSP_CERTID_free(requestId);
+    }
+    OCSP_REQUEST_free(request);
+    if (body.isEmpty()) {
+        OCSP_CERTID_free(id);
+        return false;
+    }
+
+    QMap<QString, QByteArray> headers;
+    headers.insert(QString::fromLatin1("Content-Type"), "application/ocsp-request");
+    HttpResponse httpResponse = session->post(responderUrl, body, headers);
+    if (!httpResponse.isOk()) {
+        qtng_debug << "can not fetch ocsp response from" << responderUrl << httpResponse.statusCode();
+        OCSP_CERTID_free(id);
+        return false;
+    }
+    const QByteArray &data = httpResponse.body();
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data.constData());
+    OCSP_RESPONSE *ocspResponse = d2i_OCSP_RESPONSE(nullptr, &p, data.size());
+    bool ok = false;
+    if (ocspResponse && OCSP_response_status(ocspResponse) == OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+        OCSP_BASICRESP *basic = OCSP_response_get1_basic(ocspResponse);
+        int status = -1, reason = 0;
+        ASN1_GENERALIZEDTIME *revokedAt = nullptr, *thisUpdate = nullptr, *next = nullptr;
+        if (basic && OCSP_resp_find_status(basic, id, &status, &reason, &revokedAt, &thisUpdate, &next)
+            && OCSP_check_validity(thisUpdate, next, 300, -1)) {
+            if (status == V_OCSP_CERTSTATUS_GOOD) {
+                *der = data;
+                // without nextUpdate, the responder always has newer information. keep it for an hour.
+                *nextUpdate = next ? getTimeFromASN1(next) : QDateTime::currentDateTimeUtc().addSecs(3600);
+                ok = nextUpdate->isValid();
+            } else {
+                qtng_warning << "the ocsp status of certificate is not good:" << status;
+            }
+        } else {
+            qtng_debug << "invalid ocsp response from" << responderUrl;
+        }
+        OCSP_BASICRESP_free(basic);
+    }
+    OCSP_RESPONSE_free(ocspResponse);
+    OCSP_CERTID_free(id);
+    return ok;
+}
+
+bool OcspStaplingPrivate::refresh()
+{
+    QByteArray der;
+    QDateTime next;
+    if (!fetch(&der, &next)) {
+        return false;
+    }
+    QMutexLocker locker(&mutex);
+    response = der;
+    nextUpdate = next;
+    expiry = next.toMSecsSinceEpoch();
+    return true;
+}
+
+void OcspStaplingPrivate::refreshForever()
+{
+    while (true) {
+        qint64 secs = 60;  // retry failures every minute, the old response is stapled until it expires.
+        if (refresh()) {
+            QMutexLocker locker(&mutex);
+            secs = qBound<qint64>(60, QDateTime::currentDateTimeUtc().secsTo(nextUpdate) / 2, 3600 * 24);
+        }
+        Coroutine::sleep(static_cast<float>(secs));
+    }
+}
+
+OcspStapling::OcspStapling(const Certificate &certificate, const Certificate &issuer,
+                           QSharedPointer<HttpSession> session)
+    : d_ptr(new OcspStaplingPrivate(certificate, issuer, session))
+{
+}
+
+OcspStapling::~OcspStapling()
+{
+    delete d_ptr;
+}
+
+QByteArray OcspStapling::response()
+{
+    Q_D(OcspStapling);
+    QMutexLocker locker(&d->mutex);
+    if (d->response.isEmpty() || d->expiry <= QDateTime::currentMSecsSinceEpoch()) {
+        return QByteArray();
+    }
+    return d->response;
+}
+
+QUrl OcspStapling::responderUrl() const
+{
+    Q_D(const OcspStapling);
+    return d->responderUrl;
+}
+
+QDateTime OcspStapling::nextUpdate() const
+{
+    Q_D(const OcspStapling);
+    QMutexLocker locker(&d->mutex);
+    return d->nextUpdate;
+}
+
+bool OcspStapling::start()
+{
+    Q_D(OcspStapling);
+    if (d->responderUrl.isEmpty()) {
+        return false;
+    }
+    d->operations->spawnWithName(QString::fromLatin1("refresh"), [d] { d->refreshForever(); });
+    return true;
+}
+
+void OcspStapling::stop()
+{
+    Q_D(OcspStapling);
+    d->operations->kill(QString::fromLatin1("refresh"));
+}
+
+bool OcspStapling::refresh()
+{
+    Q_D(OcspStapling);
+    return d->refresh();
+}
+
+QTNETWORKNG_NAMESPACE_END
@@ -1,14 +1,23 @@
 #include "../include/random.h"
 
 #ifdef QTNG_NO_CRYPTO
+#  include <string.h>
 #  if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
 #    include <QtCore/qrandom.h>
 #  else
 #    include <QtCore/qdatetime.h>
+#    include <QtCore/qthread.h>
+#    include <QtCore/qthreadstorage.h>
 #  endif
 #else
+#  include <string.h>
+#  include <QtCore/qendian.h>
+#  include <QtCore/qthreadstorage.h>
 #  include "../include/private/crypto_p.h"
 #  include <openssl/rand.h>
+#  ifdef Q_OS_UNIX
+#    include <unistd.h>
+#  endif
 #endif
 
 QTNETWORKNG_NAMESPACE_BEGIN
@@ -17,41 +26,222 @@ QTNETWORKNG_NAMESPACE_BEGIN
 
 #  if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
 
-QByteArray randomBytes(int numBytes)
+bool randomBytes(char *out, int numBytes)
 {
-    QByteArray b;
-    b.reserve(numBytes);
-    QRandomGenerator *generator = QRandomGenerator::global();
-    for (int i = 0; i < numBytes; ++i) {
-        b.append(static_cast<char>(generator->bounded(0xff)));
+    QRandomGenerator *generator = QRandomGenerator::system();
+    quint32 block[64];
+    while (numBytes > 0) {
+        const int n = qMin<int>(numBytes, sizeof(block));
+        generator->fillRange(block, (n + 3) / 4);
+        memcpy(out, block, static_cast<size_t>(n));
+        out += n;
+        numBytes -= n;
     }
-    return b;
+    return true;
 }
 
 #  else
 
-QByteArray randomBytes(int numBytes)
+bool randomBytes(char *out, int numBytes)
 {
-    QByteArray b;
-    b.reserve(numBytes);
-    qsrand(static_cast<uint>(QDateTime::currentMSecsSinceEpoch()));
+    // qrand() keeps its seed per thread, seed it once for every thread.
+    static QThreadStorage<bool> seeded;
+    if (!seeded.hasLocalData()) {
+        const quintptr threadId = reinterpret_cast<quintptr>(QThread::currentThreadId());
+        qsrand(static_cast<uint>(QDateTime::currentMSecsSinceEpoch()) ^ static_cast<uint>(threadId));
+        seeded.setLocalData(true);
+    }
     for (int i = 0; i < numBytes; ++i) {
-        b.append(static_cast<char>(0xff & qrand()));
+        out[i] = static_cast<char>(0xff & qrand());
     }
-    return b;
+    return true;
 }
 
 #  endif
 
+QByteArray randomBytes(int numBytes)
+{
+    if (numBytes <= 0) {
+        return QByteArray();
+    }
+    QByteArray b(numBytes, Qt::Uninitialized);
+    randomBytes(b.data(), numBytes);
+    return b;
+}
+
 #else
 
-QByteArray randomBytes(int numBytes)
+namespace {
+
+inline quint32 rotateLeft(quint32 v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+inline void quarterRound(quint32 *x, int a, int b, int c, int d)
+{
+    x[a] += x[b];
+    x[d] = rotateLeft(x[d] ^ x[a], 16);
+    x[c] += x[d];
+    x[b] = rotateLeft(x[b] ^ x[c], 12);
+    x[a] += x[b];
+    x[d] = rotateLeft(x[d] ^ x[a], 8);
+    x[c] += x[d];
+    x[b] = rotateLeft(x[b] ^ x[c], 7);
+}
+
+// rfc 8439, the nonce is zero because the key is never used twice.
+void chacha20Block(const quint32 *key, quint32 counter, uchar *out)
+{
+    quint32 state[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574, key[0], key[1], key[2], key[3],
+                          key[4],     key[5],     key[6],     key[7],     counter, 0,      0,      0 };
+    quint32 x[16];
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; ++i) {
+        quarterRound(x, 0, 4, 8, 12);
+        quarterRound(x, 1, 5, 9, 13);
+        quarterRound(x, 2, 6, 10, 14);
+        quarterRound(x, 3, 7, 11, 15);
+        quarterRound(x, 0, 5, 10, 15);
+        quarterRound(x, 1, 6, 11, 12);
+        quarterRound(x, 2, 7, 8, 13);
+        quarterRound(x, 3, 4, 9, 14);
+    }
+    for (int i = 0; i < 16; ++i) {
+        qToLittleEndian<quint32>(x[i] + state[i], out + i * 4);
+    }
+}
+
+// the fast key erasure generator of chacha20. every refill makes some blocks of key stream, and the first 32 bytes
+// of them replace the key. the bytes are erased from the buffer once returned, so the past output can not be
+// recovered from the state. the key is mixed with the system rng every ReseedInterval bytes, and after fork().
+class ChaChaRandom
+{
+public:
+    ChaChaRandom();
+    ~ChaChaRandom();
+public:
+    bool generate(char *out, int size);
+private:
+    bool reseed();
+    void refill();
+private:
+    enum { BlockSize = 64, BufferSize = BlockSize * 16, KeySize = 32 };
+    static const qint64 ReseedInterval = 1024 * 1024;
+    quint32 key[KeySize / 4];
+    uchar buffer[BufferSize];
+    int pos;  // the bytes before pos are used and erased.
+    qint64 generated;  // bytes since last reseed.
+#ifdef Q_OS_UNIX
+    pid_t pid;
+#endif
+    bool seeded;
+};
+
+ChaChaRandom::ChaChaRandom()
+    : pos(BufferSize)
+    , generated(0)
+#ifdef Q_OS_UNIX
+    , pid(0)
+#endif
+    , seeded(false)
 {
+    memset(key, 0, sizeof(key));
     initOpenSSL();
-    QByteArray b;
-    b.resize(numBytes);
-    RAND_bytes(reinterpret_cast<unsigned char *>(b.data()), numBytes);
+}
+
+ChaChaRandom::~ChaChaRandom()
+{
+    memset(key, 0, sizeof(key));
+    memset(buffer, 0, sizeof(buffer));
     cleanupOpenSSL();
+}
+
+bool ChaChaRandom::reseed()
+{
+    uchar seed[KeySize];
+    if (RAND_bytes(seed, sizeof(seed)) != 1) {
+        return seeded;  // keep going with the old key if it is seeded once.
+    }
+    for (int i = 0; i < KeySize / 4; ++i) {
+        key[i] ^= qFromLittleEndian<quint32>(seed + i * 4);
+    }
+    memset(seed, 0, sizeof(seed));
+    pos = BufferSize;  // drop the bytes made by the old key.
+    generated = 0;
+#ifdef Q_OS_UNIX
+    pid = getpid();
+#endif
+    seeded = true;
+    return true;
+}
+
+void ChaChaRandom::refill()
+{
+    for (int i = 0; i < BufferSize / BlockSize; ++i) {
+        chacha20Block(key, static_cast<quint32>(i), buffer + i * BlockSize);
+    }
+    for (int i = 0; i < KeySize / 4; ++i) {
+        key[i] = qFromLittleEndian<quint32>(buffer + i * 4);
+    }
+    memset(buffer, 0, KeySize);
+    pos = KeySize;
+}
+
+bool ChaChaRandom::generate(char *out, int size)
+{
+    bool needSeed = !seeded || generated >= ReseedInterval;
+#ifdef Q_OS_UNIX
+    needSeed = needSeed || pid != getpid();
+#endif
+    if (needSeed && !reseed()) {
+        return false;
+    }
+    generated += size;
+    while (size > 0) {
+        if (pos == BufferSize) {
+            refill();
+        }
+        const int n = qMin(size, BufferSize - pos);
+        memcpy(out, buffer + pos, static_cast<size_t>(n));
+        memset(buffer + pos, 0, static_cast<size_t>(n));
+        pos += n;
+        out += n;
+        size -= n;
+    }
+    return true;
+}
+
+}  // anonymous namespace
+
+// QThreadStorage deletes the generator while the thread exits.
+Q_GLOBAL_STATIC(QThreadStorage<ChaChaRandom *>, localRandoms)
+
+bool randomBytes(char *out, int numBytes)
+{
+    if (numBytes <= 0) {
+        return numBytes == 0;
+    }
+    QThreadStorage<ChaChaRandom *> *storage = localRandoms();
+    if (!storage) {
+        // the application is exiting.
+        initOpenSSL();
+        bool ok = RAND_bytes(reinterpret_cast<unsigned char *>(out), numBytes) == 1;
+        cleanupOpenSSL();
+        return ok;
+    }
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(new ChaChaRandom());
+    }
+    return storage->localData()->generate(out, numBytes);
+}
+
+QByteArray randomBytes(int numBytes)
+{
+    QByteArray b(qMax(0, numBytes), Qt::Uninitialized);
+    if (!randomBytes(b.data(), b.size())) {
+        return QByteArray();
+    }
     return b;
 }
 
@@ -0,0 +1,419 @@
+#include <QtCore/qhash.h>
+#include "../include/rpc.h"
+#include "../include/coroutine_utils.h"
+#include "../include/private/eventloop_p.h"
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.rpc");
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+const quint8 RpcRequest = 0;
+const quint8 RpcResponse = 1;
+const quint8 RpcNotification = 2;
+const quint32 RpcReceivingBatchSize = 64;
+const char RpcNil = '\xc0';
+
+// lives in the stack of caller until it is answered, timed out or failed.
+struct RpcPendingCall
+{
+    RpcPendingCall()
+        : timerId(0)
+    {
+    }
+    Event done;
+    QByteArray result;
+    RpcError error;
+    int timerId;
+};
+
+class RpcPeerPrivate
+{
+public:
+    RpcPeerPrivate(QSharedPointer<DataChannel> channel, quint32 maxPendingCalls, RpcPeer *q);
+    ~RpcPeerPrivate();
+    RpcError call(const QString &method, const QByteArray &params, QByteArray *result, float timeout);
+    bool send(const QByteArray &message);
+    void finishCall(quint32 callId, const RpcError &error, const QByteArray &result);
+    void failAll(const RpcError &error);
+    bool handleMessage(const QByteArray &message);
+    void serve(quint32 callId, const QString &method, const QByteArray &params, bool responding);
+    void doReceive();
+    void doSend();
+    void close();
+public:
+    QSharedPointer<DataChannel> channel;
+    CoroutineGroup *operations;
+    QHash<quint32, RpcPendingCall *> pendingCalls;
+    QHash<QString, RpcPeer::Handler> handlers;
+    QList<QByteArray> sendingQueue;
+    Event sendingReady;
+    Semaphore callSlots;
+    Semaphore servingSlots;
+    quint32 nextCallId;
+    qint64 callTimeout;  // msecs.
+    bool closed;
+    RpcPeer * const q_ptr;
+    Q_DECLARE_PUBLIC(RpcPeer)
+};
+
+static QByteArray packRpcRequest(quint32 callId, const QString &method, const QByteArray &params)
+{
+    QByteArray message;
+    message.reserve(params.size() + method.size() + 16);
+    MsgPackStream s(&message, QIODevice::WriteOnly);
+    s.writeArrayHeader(4);
+    s << RpcRequest << callId << method;
+    s.writeBytes(params.constData(), params.size());
+    return message;
+}
+
+static QByteArray packRpcNotification(const QString &method, const QByteArray &params)
+{
+    QByteArray message;
+    message.reserve(params.size() + method.size() + 16);
+    MsgPackStream s(&message, QIODevice::WriteOnly);
+    s.writeArrayHeader(3);
+    s << RpcNotification << method;
+    s.writeBytes(params.constData(), params.size());
+    return message;
+}
+
+static QByteArray packRpcResponse(quint32 callId, const RpcError &error, const QByteArray &result)
+{
+    QByteArray message;
+    message.reserve(result.size() + error.message.size() + 16);
+    MsgPackStream s(&message, QIODevice::WriteOnly);
+    s.writeArrayHeader(4);
+    s << RpcResponse << callId;
+    if (error.isOk()) {
+        s.writeBytes(&RpcNil, 1);
+        s.writeBytes(result.constData(), result.size());
+    } else {
+        s.writeArrayHeader(2);
+        s << static_cast<quint8>(error.code) << error.message;
+        s.writeBytes(&RpcNil, 1);
+    }
+    return message;
+}
+
+RpcPeerPrivate::RpcPeerPrivate(QSharedPointer<DataChannel> channel, quint32 maxPendingCalls, RpcPeer *q)
+    : channel(channel)
+    , operations(new CoroutineGroup())
+    , callSlots(static_cast<int>(qMax<quint32>(maxPendingCalls, 1)))
+    , servingSlots(static_cast<int>(qMax<quint32>(maxPendingCalls, 1)))
+    , nextCallId(1)
+    , callTimeout(30 * 1000)
+    , closed(false)
+    , q_ptr(q)
+{
+    operations->spawnWithName(QString::fromLatin1("receiving"), [this] { doReceive(); });
+    operations->spawnWithName(QString::fromLatin1("sending"), [this] { doSend(); });
+}
+
+RpcPeerPrivate::~RpcPeerPrivate()
+{
+    close();
+    delete operations;
+}
+
+RpcError RpcPeerPrivate::call(const QString &method, const QByteArray &params, QByteArray *result, float timeout)
+{
+    if (closed) {
+        return RpcError(RpcError::ChannelBroken, QString::fromLatin1("the rpc peer is closed."));
+    }
+    ScopedLock<Semaphore> slot(callSlots);
+    if (!slot.isSuccess() || closed) {
+        return RpcError(RpcError::ChannelBroken, QString::fromLatin1("the rpc peer is closed."));
+    }
+    quint32 callId = nextCallId++;
+    while (callId == 0 || pendingCalls.contains(callId)) {
+        callId = nextCallId++;
+    }
+    RpcPendingCall pendingCall;
+    pendingCalls.insert(callId, &pendingCall);
+    const qint64 msecs = timeout < 0 ? callTimeout : static_cast<qint64>(timeout * 1000);
+    // the Timeout of caller fires first, no need of another timer.
+    const float remaining = Timeout::remaining();
+    if (msecs > 0 && (remaining < 0 || static_cast<qint64>(remaining * 1000) > msecs)) {
+        pendingCall.timerId = EventLoopCoroutine::get()->callLaterCoarse(
+                static_cast<quint32>(msecs), makeFunctor([this, callId] {
+                    RpcPendingCall *pendingCall = pendingCalls.value(callId);
+                    if (pendingCall) {
+                        pendingCall->timerId = 0;
+                        finishCall(callId, RpcError(RpcError::Timeout, QString::fromLatin1("the call is timed out.")),
+                                   QByteArray());
+                    }
+                }));
+    }
+    try {
+        if (send(packRpcRequest(callId, method, params))) {
+            pendingCall.done.wait();
+        } else {
+            finishCall(callId, RpcError(RpcError::ChannelBroken, QString::fromLatin1("can not send the request.")),
+                       QByteArray());
+        }
+    } catch (...) {
+        // killed while waiting.
+        if (pendingCalls.value(callId) == &pendingCall) {
+            pendingCalls.remove(callId);
+            if (pendingCall.timerId) {
+                EventLoopCoroutine::get()->cancelCall(pendingCall.timerId);
+            }
+        }
+        throw;
+    }
+    if (pendingCall.error.isOk()) {
+        *result = pendingCall.result;
+    }
+    return pendingCall.error;
+}
+
+bool RpcPeerPrivate::send(const QByteArray &message)
+{
+    if (closed || message.isEmpty()) {
+        return false;
+    }
+    sendingQueue.append(message);
+    sendingReady.set();
+    return true;
+}
+
+void RpcPeerPrivate::finishCall(quint32 callId, const RpcError &error, const QByteArray &result)
+{
+    RpcPendingCall *pendingCall = pendingCalls.take(callId);
+    if (!pendingCall) {
+        return;
+    }
+    if (pendingCall->timerId) {
+        EventLoopCoroutine::get()->cancelCall(pendingCall->timerId);
+        pendingCall->timerId = 0;
+    }
+    pendingCall->error = error;
+    pendingCall->result = result;
+    pendingCall->done.set();
+}
+
+void RpcPeerPrivate::failAll(const RpcError &error)
+{
+    const QList<quint32> &callIds = pendingCalls.keys();
+    for (quint32 callId : callIds) {
+        finishCall(callId, error, QByteArray());
+    }
+}
+
+bool RpcPeerPrivate::handleMessage(const QByteArray &message)
+{
+    MsgPackStream s(message);
+    quint32 len;
+    quint8 type;
+    if (!s.readArrayHeader(len)) {
+        return false;
+    }
+    s >> type;
+    if (type == RpcRequest && len == 4) {
+        quint32 callId;
+        QString method;
+        s >> callId >> method;
+        if (s.status() != MsgPackStream::Ok) {
+            return false;
+        }
+        serve(callId, method, message.mid(static_cast<int>(s.device()->pos())), true);
+    } else if (type == RpcNotification && len == 3) {
+        QString method;
+        s >> method;
+        if (s.status() != MsgPackStream::Ok) {
+            return false;
+        }
+        serve(0, method, message.mid(static_cast<int>(s.device()->pos())), false);
+    } else if (type == RpcResponse && len == 4) {
+        quint32 callId;
+        QVariant error;
+        s >> callId >> error;
+        if (s.status() != MsgPackStream::Ok) {
+            return false;
+        }
+        if (!error.isValid()) {
+            finishCall(callId, RpcError(), message.mid(static_cast<int>(s.device()->pos())));
+        } else {
+            const QVariantList &fields = error.toList();
+            if (fields.size() != 2) {
+                return false;
+            }
+            const int code = fields.at(0).toInt();
+            RpcError remoteError(code > RpcError::NoError && code <= RpcError::RemoteError
+                                         ? static_cast<RpcError::Code>(code)
+                                         : RpcError::RemoteError,
+                                 fields.at(1).toString());
+            finishCall(callId, remoteError, QByteArray());
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void RpcPeerPrivate::serve(quint32 callId, const QString &method, const QByteArray &params, bool responding)
+{
+    if (!handlers.contains(method)) {
+        if (responding) {
+            send(packRpcResponse(callId, RpcError(RpcError::MethodNotFound, method), QByteArray()));
+        }
+        return;
+    }
+    // blocks the receiving coroutine if too many handlers are running, the peer slows down by the flow control.
+    if (!servingSlots.acquire()) {
+        return;
+    }
+    const RpcPeer::Handler handler = handlers.value(method);
+    operations->spawn([this, handler, callId, params, responding] {
+        QByteArray result;
+        RpcError error;
+        try {
+            error = handler(params, &result);
+        } catch (CoroutineException &) {
+            servingSlots.release();
+            throw;
+        } catch (...) {
+            error = RpcError(RpcError::RemoteError, QString::fromLatin1("the handler throws an exception."));
+        }
+        servingSlots.release();
+        if (responding) {
+            send(packRpcResponse(callId, error, result));
+        }
+    });
+}
+
+void RpcPeerPrivate::doReceive()
+{
+    while (true) {
+        const QList<QByteArray> &messages = channel->recvPackets(RpcReceivingBatchSize);
+        if (messages.isEmpty()) {
+            break;
+        }
+        for (const QByteArray &message : messages) {
+            if (!handleMessage(message)) {
+                qtng_debug << "invalid rpc message from" << channel->toString();
+                channel->abort();
+                break;
+            }
+        }
+    }
+    closed = true;
+    sendingReady.set();
+    failAll(RpcError(RpcError::ChannelBroken, channel->errorString()));
+}
+
+void RpcPeerPrivate::doSend()
+{
+    while (true) {
+        if (sendingQueue.isEmpty()) {
+            if (closed) {
+                return;
+            }
+            sendingReady.clear();
+            if (!sendingReady.wait()) {
+                return;
+            }
+            continue;
+        }
+        // the messages queued in one turn are sent together.
+        QList<QByteArray> batch;
+        batch.swap(sendingQueue);
+        if (!channel->sendPackets(batch)) {
+            channel->abort();
+            return;
+        }
+    }
+}
+
+void RpcPeerPrivate::close()
+{
+    if (closed && operations->isEmpty()) {
+        return;
+    }
+    closed = true;
+    Coroutine *current = Coroutine::current();
+    channel->abort();
+    sendingQueue.clear();
+    sendingReady.set();
+    failAll(RpcError(RpcError::ChannelBroken, QString::fromLatin1("the rpc peer is closed.")));
+    if (operations->get(QString::fromLatin1("receiving")).data() != current) {
+        operations->kill(QString::fromLatin1("receiving"));
+    }
+    if (operations->get(QString::fromLatin1("sending")).data() != current) {
+        operations->kill(QString::fromLatin1("sending"));
+    }
+}
+
+RpcPeer::RpcPeer(QSharedPointer<DataChannel> channel, quint32 maxPendingCalls)
+    : d_ptr(new RpcPeerPrivate(channel, maxPendingCalls, this))
+{
+}
+
+RpcPeer::~RpcPeer()
+{
+    delete d_ptr;
+}
+
+RpcError RpcPeer::callRaw(const QString &method, const QByteArray &params, QByteArray *result, float timeout)
+{
+    Q_D(RpcPeer);
+    return d->call(method, params, result, timeout);
+}
+
+bool RpcPeer::notifyRaw(const QString &method, const QByteArray &params)
+{
+    Q_D(RpcPeer);
+    return d->send(packRpcNotification(method, params));
+}
+
+void RpcPeer::registerRawMethod(const QString &method, Handler handler)
+{
+    Q_D(RpcPeer);
+    d->handlers.insert(method, handler);
+}
+
+void RpcPeer::unregisterMethod(const QString &method)
+{
+    Q_D(RpcPeer);
+    d->handlers.remove(method);
+}
+
+void RpcPeer::setCallTimeout(float timeout)
+{
+    Q_D(RpcPeer);
+    d->callTimeout = static_cast<qint64>(timeout * 1000);
+}
+
+float RpcPeer::callTimeout() const
+{
+    Q_D(const RpcPeer);
+    return static_cast<float>(d->callTimeout) / 1000;
+}
+
+quint32 RpcPeer::pendingCallsSize() const
+{
+    Q_D(const RpcPeer);
+    return static_cast<quint32>(d->pendingCalls.size());
+}
+
+QSharedPointer<DataChannel> RpcPeer::channel() const
+{
+    Q_D(const RpcPeer);
+    return d->channel;
+}
+
+bool RpcPeer::isBroken() const
+{
+    Q_D(const RpcPeer);
+    return d->closed || d->channel->isBroken();
+}
+
+void RpcPeer::close()
+{
+    Q_D(RpcPeer);
+    d->close();
+}
+
+QTNETWORKNG_NAMESPACE_END
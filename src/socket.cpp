@@ -1,10 +1,17 @@
 #include <QtCore/qthread.h>
 #include <QtCore/qcoreapplication.h>
-#include <QtCore/qmap.h>
 #include <QtCore/qset.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qqueue.h>
 #include <QtCore/qcache.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qthreadstorage.h>
+#include <QtCore/qvector.h>
 #include "../include/private/socket_p.h"
 #include "../include/coroutine_utils.h"
+#include "../include/socket_utils.h"
+#include "../include/dns.h"
+#include "../include/private/tracing_p.h"
 #include "debugger.h"
 
 QTNG_LOGGER("qtng.socket");
@@ -17,6 +24,14 @@ SocketPrivate::SocketPrivate(HostAddress::NetworkLayerProtocol protocol, Socket:
     , type(type)
     , error(Socket::NoError)
     , state(Socket::UnconnectedState)
+    , udpSegmentUnsupported(false)
+#ifdef Q_OS_LINUX
+    , zeroCopySequence(0)
+    , zeroCopy(false)
+#endif
+#ifdef Q_OS_WIN
+    , registeredIo(nullptr)
+#endif
 {
 #ifdef Q_OS_WIN
     initWinSock();
@@ -37,6 +52,14 @@ SocketPrivate::SocketPrivate(HostAddress::NetworkLayerProtocol protocol, Socket:
 SocketPrivate::SocketPrivate(qintptr socketDescriptor, Socket *parent)
     : q_ptr(parent)
     , error(Socket::NoError)
+    , udpSegmentUnsupported(false)
+#ifdef Q_OS_LINUX
+    , zeroCopySequence(0)
+    , zeroCopy(false)
+#endif
+#ifdef Q_OS_WIN
+    , registeredIo(nullptr)
+#endif
 {
 #ifdef Q_OS_WIN
     initWinSock();
@@ -187,7 +210,7 @@ bool SocketPrivate::connect(const QString &hostName, quint16 port, QSharedPointe
     state = Socket::HostLookupState;
     QList<HostAddress> addresses;
     HostAddress t;
-    if (t.setAddress(hostName)) {
+    if (HostAddress::parseLiteral(hostName, &t)) {
         addresses.append(t);
     } else {
         if (dnsCache.isNull()) {
@@ -262,6 +285,18 @@ bool Socket::isValid() const
     return d->isValid();
 }
 
+bool Socket::isIdleConnected() const
+{
+    Q_D(const Socket);
+    return d->isIdleConnected();
+}
+
+TcpInfo Socket::tcpInfo() const
+{
+    Q_D(const Socket);
+    return d->tcpInfo();
+}
+
 HostAddress Socket::localAddress() const
 {
     Q_D(const Socket);
@@ -318,6 +353,9 @@ HostAddress::NetworkLayerProtocol Socket::protocol() const
 QString Socket::localAddressURI() const
 {
     Q_D(const Socket);
+    if (d->isLocal()) {
+        return QString::fromLatin1("unix:%1").arg(d->localPath);
+    }
     QString address;
     if (d->type == Socket::TcpSocket) {
         address = QLatin1String("tcp://%1:%2");
@@ -336,6 +374,9 @@ QString Socket::localAddressURI() const
 QString Socket::peerAddressURI() const
 {
     Q_D(const Socket);
+    if (d->isLocal()) {
+        return QString::fromLatin1("unix:%1").arg(d->peerPath);
+    }
     QString address;
     if (d->type == Socket::TcpSocket) {
         address = QLatin1String("tcp://%1:%2");
@@ -361,6 +402,16 @@ Socket *Socket::accept()
     return d->accept();
 }
 
+QList<Socket *> Socket::acceptMany(int maxCount)
+{
+    Q_D(Socket);
+    ScopedLock<Lock> lock(d->readLock);
+    if (!lock.isSuccess()) {
+        return QList<Socket *>();
+    }
+    return d->acceptMany(qMax(1, maxCount));
+}
+
 bool Socket::bind(const HostAddress &address, quint16 port, Socket::BindMode mode)
 {
     Q_D(Socket);
@@ -380,6 +431,7 @@ bool Socket::connect(const HostAddress &host, quint16 port)
     if (!lock.isSuccess()) {
         return false;
     }
+    QTNG_TRACE_SCOPE("net", "connect");
     return d->connect(host, port);
 }
 
@@ -390,9 +442,39 @@ bool Socket::connect(const QString &hostName, quint16 port, QSharedPointer<Socke
     if (!lock.isSuccess()) {
         return false;
     }
+    QTNG_TRACE_SCOPE("net", "connect");
     return d->connect(hostName, port, dnsCache);
 }
 
+bool Socket::bind(const QString &path)
+{
+    Q_D(Socket);
+    return d->bind(path);
+}
+
+bool Socket::connect(const QString &path)
+{
+    Q_D(Socket);
+    ScopedLock<Lock> lock(d->writeLock);
+    if (!lock.isSuccess()) {
+        return false;
+    }
+    QTNG_TRACE_SCOPE("net", "connect");
+    return d->connect(path);
+}
+
+QString Socket::localPath() const
+{
+    Q_D(const Socket);
+    return d->localPath;
+}
+
+QString Socket::peerPath() const
+{
+    Q_D(const Socket);
+    return d->peerPath;
+}
+
 void Socket::close()
 {
     Q_D(Socket);
@@ -506,6 +588,46 @@ qint32 Socket::sendall(const char *data, qint32 size)
     return d->send(data, size, true);
 }
 
+qint32 Socket::sendv(const QList<QByteArray> &data)
+{
+    Q_D(Socket);
+    ScopedLock<Lock> lock(d->writeLock);
+    if (!lock.isSuccess()) {
+        return -1;
+    }
+    return d->sendv(data);
+}
+
+qint64 Socket::sendfile(QFile *file, qint64 offset, qint64 count)
+{
+    Q_D(Socket);
+    ScopedLock<Lock> lock(d->writeLock);
+    if (!lock.isSuccess()) {
+        return -1;
+    }
+    return d->sendfile(file, offset, count);
+}
+
+qint32 Socket::sendfds(const char *data, qint32 size, const QList<qintptr> &fds)
+{
+    Q_D(Socket);
+    ScopedLock<Lock> lock(d->writeLock);
+    if (!lock.isSuccess()) {
+        return -1;
+    }
+    return d->sendfds(data, size, fds);
+}
+
+qint32 Socket::recvfds(char *data, qint32 size, QList<qintptr> *fds)
+{
+    Q_D(Socket);
+    ScopedLock<Lock> lock(d->readLock);
+    if (!lock.isSuccess()) {
+        return -1;
+    }
+    return d->recvfds(data, size, fds);
+}
+
 qint32 Socket::recvfrom(char *data, qint32 size, HostAddress *addr, quint16 *port)
 {
     Q_D(Socket);
@@ -526,6 +648,60 @@ qint32 Socket::sendto(const char *data, qint32 size, const HostAddress &addr, qu
     return d->sendto(data, size, addr, port);
 }
 
+struct RecvBuffers
+{
+    enum { MinSize = 1024 * 4, MaxSize = 1024 * 256, MaxCount = 8 };
+    QVector<QByteArray> idle;
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<RecvBuffers *>, localRecvBuffers)
+
+static RecvBuffers *recvBuffers()
+{
+    // null while the process exits.
+    QThreadStorage<RecvBuffers *> *storage = localRecvBuffers();
+    if (!storage) {
+        return nullptr;
+    }
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(new RecvBuffers());
+    }
+    return storage->localData();
+}
+
+QByteArray takeRecvBuffer(qint32 size)
+{
+    RecvBuffers *buffers = size > RecvBuffers::MinSize && size <= RecvBuffers::MaxSize ? recvBuffers() : nullptr;
+    if (buffers) {
+        for (int i = buffers->idle.size() - 1; i >= 0; --i) {
+            if (buffers->idle.at(i).capacity() >= size) {
+                QByteArray buf = buffers->idle.takeAt(i);
+                buf.resize(size);
+                return buf;
+            }
+        }
+    }
+    return QByteArray(size, Qt::Uninitialized);
+}
+
+QByteArray finishRecvBuffer(QByteArray &buf, qint32 bytes)
+{
+    if (bytes <= 0) {
+        bytes = 0;
+    } else if (buf.size() <= RecvBuffers::MinSize || bytes >= buf.size() / 2) {
+        // filled mostly, no need to copy.
+        buf.resize(bytes);
+        return buf;
+    }
+    const QByteArray result = bytes > 0 ? QByteArray(buf.constData(), bytes) : QByteArray();
+    RecvBuffers *buffers = buf.capacity() <= RecvBuffers::MaxSize ? recvBuffers() : nullptr;
+    if (buffers && buffers->idle.size() < RecvBuffers::MaxCount) {
+        buffers->idle.append(buf);
+    }
+    buf = QByteArray();
+    return result;
+}
+
 QByteArray Socket::recv(qint32 size)
 {
     Q_D(Socket);
@@ -533,13 +709,14 @@ QByteArray Socket::recv(qint32 size)
     if (!lock.isSuccess()) {
         return QByteArray();
     }
-    QByteArray bs(size, Qt::Uninitialized);
+    QByteArray bs = takeRecvBuffer(size);
     qint32 bytes = d->recv(bs.data(), bs.size(), false);
-    if (bytes > 0) {
-        bs.resize(static_cast<int>(bytes));
-        return bs;
-    }
-    return QByteArray();
+    return finishRecvBuffer(bs, bytes);
+}
+
+qint32 Socket::recvInto(QByteArray &buf, qint32 maxSize)
+{
+    return recvIntoBuffer(this, buf, maxSize);
 }
 
 QByteArray Socket::recvall(qint32 size)
@@ -580,7 +757,43 @@ qint32 Socket::sendall(const QByteArray &data)
     if (!lock.isSuccess()) {
         return -1;
     }
-    return d->send(data.data(), data.size(), true);
+#ifdef Q_OS_LINUX
+    if (d->zeroCopy) {
+        return d->sendZeroCopy(data);
+    }
+#endif
+    return d->send(data.constData(), data.size(), true);
+}
+
+qint32 Socket::recvfromMany(char *buffer, qint32 datagramSize, qint32 count, qint32 *sizes, HostAddress *addrs,
+                            quint16 *ports)
+{
+    Q_D(Socket);
+    ScopedLock<Lock> lock(d->readLock);
+    if (!lock.isSuccess()) {
+        return -1;
+    }
+    return d->recvfromMany(buffer, datagramSize, count, sizes, addrs, ports);
+}
+
+qint32 Socket::sendtoMany(const QList<QByteArray> &datagrams, const HostAddress &addr, quint16 port)
+{
+    Q_D(Socket);
+    ScopedLock<Lock> lock(d->writeLock);
+    if (!lock.isSuccess()) {
+        return -1;
+    }
+    return d->sendtoMany(datagrams, addr, port);
+}
+
+qint32 Socket::sendtoMany(const QList<QByteArray> &datagrams, const HostAddress *addrs, const quint16 *ports)
+{
+    Q_D(Socket);
+    ScopedLock<Lock> lock(d->writeLock);
+    if (!lock.isSuccess()) {
+        return -1;
+    }
+    return d->sendtoMany(datagrams, addrs, ports);
 }
 
 QByteArray Socket::recvfrom(qint32 size, HostAddress *addr, quint16 *port)
@@ -612,19 +825,37 @@ qint32 Socket::sendto(const QByteArray &data, const HostAddress &addr, quint16 p
 QList<HostAddress> Socket::resolve(const QString &hostName)
 {
     HostAddress tmp;
-    if (tmp.setAddress(hostName)) {
+    if (HostAddress::parseLiteral(hostName, &tmp)) {
         QList<HostAddress> result;
         result.append(tmp);
         return result;
     }
 
-    std::function<QList<HostAddress>()> task = [hostName]() {
-        QList<HostAddress> addr = HostAddress::getHostAddressByName(hostName);
-        return addr;
-    };
+    return DnsResolver::instance()->resolve(hostName);
+}
 
-    QList<HostAddress> addr = callInThread<QList<HostAddress>>(task);
-    return addr;
+QList<HostAddress> happyEyeballsOrder(const QList<HostAddress> &addresses, int allowProtocol)
+{
+    QList<HostAddress> ipv4, ipv6;
+    for (const HostAddress &addr : addresses) {
+        if (addr.isIPv4()) {
+            if ((allowProtocol & HostAddress::IPv4Protocol) && !ipv4.contains(addr)) {
+                ipv4.append(addr);
+            }
+        } else if ((allowProtocol & HostAddress::IPv6Protocol) && !ipv6.contains(addr)) {
+            ipv6.append(addr);
+        }
+    }
+    QList<HostAddress> result;
+    for (int i = 0; i < qMax(ipv4.size(), ipv6.size()); ++i) {
+        if (i < ipv6.size()) {
+            result.append(ipv6.at(i));
+        }
+        if (i < ipv4.size()) {
+            result.append(ipv4.at(i));
+        }
+    }
+    return result;
 }
 
 Socket *Socket::createConnection(const HostAddress &host, quint16 port, Socket::SocketError *error, int allowProtocol)
@@ -644,112 +875,194 @@ Socket *Socket::createServer(const HostAddress &host, quint16 port, int backlog)
     return QTNETWORKNG_NAMESPACE::createServer<Socket>(host, port, backlog, MakeSocketType<Socket>);
 }
 
+Socket *Socket::createLocalConnection(const QString &path, Socket::SocketError *error)
+{
+    QScopedPointer<Socket> socket(new Socket(HostAddress::UnknownNetworkLayerProtocol, Socket::LocalSocket));
+    bool ok = socket->connect(path);
+    if (error) {
+        *error = ok ? Socket::NoError : socket->error();
+    }
+    return ok ? socket.take() : nullptr;
+}
+
+Socket *Socket::createLocalServer(const QString &path, int backlog)
+{
+    QScopedPointer<Socket> socket(new Socket(HostAddress::UnknownNetworkLayerProtocol, Socket::LocalSocket));
+    if (backlog > 0 && (!socket->bind(path) || !socket->listen(backlog))) {
+        return nullptr;
+    }
+    return socket.take();
+}
+
+// the events seen by watchers, shared with the callbacks which may outlive the Poll.
+struct PollReadyQueue
+{
+    void mark(const void *key, int event);
+
+    QHash<const void *, int> events;
+    QQueue<const void *> order;  // in the order they get ready, the removed ones are skipped.
+    Event done;
+};
+
+void PollReadyQueue::mark(const void *key, int event)
+{
+    int &ready = events[key];
+    if (!ready) {
+        order.enqueue(key);
+    }
+    ready |= event;
+    done.set();
+}
+
+struct PollWatch
+{
+    QWeakPointer<Socket> socket;
+    QWeakPointer<SocketLike> socketLike;
+    int readWatcher;
+    int writeWatcher;
+};
+
 class PollPrivate
 {
 public:
     PollPrivate();
     ~PollPrivate();
 public:
-    void add(QSharedPointer<Socket> socket, EventLoopCoroutine::EventType event);
-    void remove(QSharedPointer<Socket> socket);
-    QSharedPointer<Socket> wait(float secs = 0);
+    void add(const void *key, const PollWatch &watch, qintptr fd, EventLoopCoroutine::EventType event);
+    void remove(const void *key);
+    QList<Poll::ReadyEvent> waitMany(int maxEvents, float secs);
 private:
-    QMap<QSharedPointer<Socket>, int> watchers;
-    QSharedPointer<QSet<QSharedPointer<Socket>>> events;
-    QSharedPointer<Event> done;
+    QHash<const void *, PollWatch> watches;
+    QSet<const void *> pendingCandidates;  // the SocketLike read by Poll, they may buffer some decrypted bytes.
+    QSharedPointer<PollReadyQueue> queue;
 };
 
 class PollFunctor : public Functor
 {
 public:
-    PollFunctor(QSharedPointer<QSet<QSharedPointer<Socket>>> events, QSharedPointer<Event> done,
-                QSharedPointer<Socket> socket);
+    PollFunctor(QSharedPointer<PollReadyQueue> queue, const void *key, int event);
     virtual void operator()();
-    QSharedPointer<QSet<QSharedPointer<Socket>>> events;
-    QSharedPointer<Event> done;
-    QWeakPointer<Socket> socket;
+    QSharedPointer<PollReadyQueue> queue;
+    const void * const key;
+    const int event;
 };
 
-PollFunctor::PollFunctor(QSharedPointer<QSet<QSharedPointer<Socket>>> events, QSharedPointer<Event> done,
-                         QSharedPointer<Socket> socket)
-    : events(events)
-    , done(done)
-    , socket(socket)
+PollFunctor::PollFunctor(QSharedPointer<PollReadyQueue> queue, const void *key, int event)
+    : queue(queue)
+    , key(key)
+    , event(event)
 {
 }
 
 void PollFunctor::operator()()
 {
-    if (!socket.isNull()) {
-        events->insert(socket.toStrongRef());
-        done->set();
-    }
+    queue->mark(key, event);
 }
 
 PollPrivate::PollPrivate()
-    : events(new QSet<QSharedPointer<Socket>>())
-    , done(new Event())
+    : queue(new PollReadyQueue())
 {
 }
 
 PollPrivate::~PollPrivate()
 {
-    QMapIterator<QSharedPointer<Socket>, int> itor(watchers);
-    while (itor.hasNext()) {
-        EventLoopCoroutine::get()->removeWatcher(itor.value());
+    while (!watches.isEmpty()) {
+        remove(watches.begin().key());
     }
 }
 
-void PollPrivate::add(QSharedPointer<Socket> socket, EventLoopCoroutine::EventType event)
+void PollPrivate::add(const void *key, const PollWatch &watch, qintptr fd, EventLoopCoroutine::EventType event)
 {
-    if (watchers.contains(socket)) {
-        remove(socket);
+    remove(key);
+    EventLoopCoroutine *eventLoop = EventLoopCoroutine::get();
+    PollWatch &w = watches[key];
+    w = watch;
+    // one watcher for each direction, so the ready events are told apart.
+    if (event & EventLoopCoroutine::Read) {
+        w.readWatcher = eventLoop->createWatcher(EventLoopCoroutine::Read, fd,
+                                                 new PollFunctor(queue, key, EventLoopCoroutine::Read));
+        eventLoop->startWatcher(w.readWatcher);
+        if (!w.socketLike.isNull()) {
+            pendingCandidates.insert(key);
+        }
+    }
+    if (event & EventLoopCoroutine::Write) {
+        w.writeWatcher = eventLoop->createWatcher(EventLoopCoroutine::Write, fd,
+                                                  new PollFunctor(queue, key, EventLoopCoroutine::Write));
+        eventLoop->startWatcher(w.writeWatcher);
     }
-    PollFunctor *callback = new PollFunctor(events, done, socket);
-    int watcherId = EventLoopCoroutine::get()->createWatcher(event, socket->fileno(), callback);
-    EventLoopCoroutine::get()->startWatcher(watcherId);
-    watchers.insert(socket, watcherId);
 }
 
-void PollPrivate::remove(QSharedPointer<Socket> socket)
+void PollPrivate::remove(const void *key)
 {
-    int watcherId = watchers.value(socket, 0);
-    if (!watcherId)
+    QHash<const void *, PollWatch>::iterator itor = watches.find(key);
+    if (itor == watches.end()) {
         return;
-    EventLoopCoroutine::get()->removeWatcher(watcherId);
-    watchers.remove(socket);
-}
-
-QSharedPointer<Socket> PollPrivate::wait(float secs)
-{
-    if (!events->isEmpty()) {
-        QMutableSetIterator<QSharedPointer<Socket>> itor(*events);
-        QSharedPointer<Socket> socket = itor.next();
-        itor.remove();
-        return socket;
-    }
-    done->clear();
-    if (!qFuzzyIsNull(secs)) {
-        try {
-            Timeout timeout(secs);
-            Q_UNUSED(timeout);
-            done->wait();
-        } catch (TimeoutException &) {
-            return QSharedPointer<Socket>();
+    }
+    EventLoopCoroutine *eventLoop = EventLoopCoroutine::get();
+    if (itor->readWatcher) {
+        eventLoop->removeWatcher(itor->readWatcher);
+    }
+    if (itor->writeWatcher) {
+        eventLoop->removeWatcher(itor->writeWatcher);
+    }
+    watches.erase(itor);
+    pendingCandidates.remove(key);
+    queue->events.remove(key);
+}
+
+QList<Poll::ReadyEvent> PollPrivate::waitMany(int maxEvents, float secs)
+{
+    QList<Poll::ReadyEvent> result;
+    if (maxEvents <= 0) {
+        return result;
+    }
+    for (const void *key : pendingCandidates) {
+        QSharedPointer<SocketLike> socketLike = watches.value(key).socketLike.toStrongRef();
+        if (!socketLike.isNull() && socketLike->hasPendingData()) {
+            queue->mark(key, EventLoopCoroutine::Read);
+        }
+    }
+    if (queue->order.isEmpty()) {
+        queue->done.clear();
+        if (!qFuzzyIsNull(secs)) {
+            try {
+                Timeout timeout(secs);
+                Q_UNUSED(timeout);
+                queue->done.wait();
+            } catch (TimeoutException &) {
+                return result;
+            }
+        } else {
+            queue->done.wait();
         }
-    } else {
-        done->wait();
     }
 
-    if (!events->isEmpty()) {
-        // is there some one hungry?
-        QMutableSetIterator<QSharedPointer<Socket>> itor(*events);
-        QSharedPointer<Socket> socket = itor.next();
-        itor.remove();
-        return socket;
-    } else {
-        return QSharedPointer<Socket>();
+    QList<const void *> gone;
+    while (result.size() < maxEvents && !queue->order.isEmpty()) {
+        const void *key = queue->order.dequeue();
+        const int events = queue->events.take(key);
+        QHash<const void *, PollWatch>::const_iterator itor = watches.constFind(key);
+        if (!events || itor == watches.constEnd()) {
+            continue;
+        }
+        Poll::ReadyEvent ready;
+        ready.socket = itor->socket.toStrongRef();
+        ready.socketLike = itor->socketLike.toStrongRef();
+        ready.events = static_cast<Poll::EventType>(events);
+        if (ready.socket.isNull() && ready.socketLike.isNull()) {
+            gone.append(key);
+            continue;
+        }
+        result.append(ready);
     }
+    for (const void *key : gone) {
+        remove(key);
+    }
+    if (queue->order.isEmpty()) {
+        queue->done.clear();
+    }
+    return result;
 }
 
 Poll::Poll()
@@ -765,32 +1078,102 @@ Poll::~Poll()
 void Poll::add(QSharedPointer<Socket> socket, Poll::EventType event)
 {
     Q_D(Poll);
-    d->add(socket, static_cast<EventLoopCoroutine::EventType>(event));
+    PollWatch watch = { socket, QWeakPointer<SocketLike>(), 0, 0 };
+    d->add(socket.data(), watch, socket->fileno(), static_cast<EventLoopCoroutine::EventType>(event));
 }
 
 void Poll::remove(QSharedPointer<Socket> socket)
 {
     Q_D(Poll);
-    d->remove(socket);
+    d->remove(socket.data());
+}
+
+void Poll::add(QSharedPointer<SocketLike> socket, Poll::EventType event)
+{
+    Q_D(Poll);
+    PollWatch watch = { QWeakPointer<Socket>(), socket, 0, 0 };
+    d->add(socket.data(), watch, socket->fileno(), static_cast<EventLoopCoroutine::EventType>(event));
+}
+
+void Poll::remove(QSharedPointer<SocketLike> socket)
+{
+    Q_D(Poll);
+    d->remove(socket.data());
 }
 
 QSharedPointer<Socket> Poll::wait(float secs)
 {
     Q_D(Poll);
-    return d->wait(secs);
+    const QList<ReadyEvent> ready = d->waitMany(1, secs);
+    return ready.isEmpty() ? QSharedPointer<Socket>() : ready.first().socket;
+}
+
+QList<Poll::ReadyEvent> Poll::waitMany(int maxEvents, float secs)
+{
+    Q_D(Poll);
+    return d->waitMany(maxEvents, secs);
 }
 
+struct SocketDnsCacheEntry
+{
+    QList<HostAddress> addresses;  // empty for negative entries.
+    qint64 created;
+    qint64 expires;  // in msecs of SocketDnsCachePrivate::clock, -1 means never.
+    bool refreshing;
+};
+
 class SocketDnsCachePrivate
 {
 public:
     SocketDnsCachePrivate()
         : cache(1024)
+        , operations(new CoroutineGroup)
+        , maxTtl(3600)
+        , negativeTtl(30)
     {
+        clock.start();
     }
-
-    QCache<QString, QList<HostAddress>> cache;
+    ~SocketDnsCachePrivate() { delete operations; }
+    QList<HostAddress> lookup(const QString &hostName);
+    void insert(const QString &hostName, const QList<HostAddress> &addresses, qint64 ttl);
+
+    QCache<QString, SocketDnsCacheEntry> cache;
+    QElapsedTimer clock;
+    CoroutineGroup *operations;
+    quint32 maxTtl;
+    quint32 negativeTtl;
 };
 
+QList<HostAddress> SocketDnsCachePrivate::lookup(const QString &hostName)
+{
+    quint32 ttl = 0;
+    const QList<HostAddress> &addresses =
+            DnsResolver::instance()->resolve(hostName, HostAddress::IPv4Protocol | HostAddress::IPv6Protocol, &ttl);
+    if (addresses.isEmpty()) {
+        // zero means the server failed, keep the old entry if there is one.
+        ttl = qMin(ttl, negativeTtl);
+        if (ttl > 0) {
+            insert(hostName, addresses, ttl);
+        }
+    } else if (ttl > 0) {
+        insert(hostName, addresses, qMin(ttl, maxTtl));
+    } else {
+        // rfc 1035 section 3.2.1, the answer of zero ttl is used by this lookup only.
+        cache.remove(hostName);
+    }
+    return addresses;
+}
+
+void SocketDnsCachePrivate::insert(const QString &hostName, const QList<HostAddress> &addresses, qint64 ttl)
+{
+    SocketDnsCacheEntry *entry = new SocketDnsCacheEntry();
+    entry->addresses = addresses;
+    entry->created = clock.elapsed();
+    entry->expires = ttl < 0 ? -1 : entry->created + ttl * 1000;
+    entry->refreshing = false;
+    cache.insert(hostName, entry);
+}
+
 SocketDnsCache::SocketDnsCache()
     : d_ptr(new SocketDnsCachePrivate())
 {
@@ -804,36 +1187,76 @@ SocketDnsCache::~SocketDnsCache()
 QList<HostAddress> SocketDnsCache::resolve(const QString &hostName)
 {
     Q_D(SocketDnsCache);
-    if (d->cache.contains(hostName)) {
-        return *(d->cache.object(hostName));
+    HostAddress tmp;
+    if (HostAddress::parseLiteral(hostName, &tmp)) {
+        return QList<HostAddress>() << tmp;
     }
-    const QList<HostAddress> &addresses = Socket::resolve(hostName);
-    if (addresses.isEmpty()) {
-        return QList<HostAddress>();
-    } else {
-        d->cache.insert(hostName, new QList<HostAddress>(addresses));
-        return addresses;
+    SocketDnsCacheEntry *entry = d->cache.object(hostName);
+    if (entry) {
+        const qint64 now = d->clock.elapsed();
+        if (entry->expires < 0) {
+            return entry->addresses;
+        }
+        if (now < entry->expires) {
+            // an entry used in the last tenth of its ttl is refreshed in background, so hot names never wait.
+            if (!entry->refreshing && !entry->addresses.isEmpty()
+                && (entry->expires - now) * 10 < entry->expires - entry->created) {
+                entry->refreshing = true;
+                d->operations->spawn([d, hostName] {
+                    d->lookup(hostName);
+                    SocketDnsCacheEntry *entry = d->cache.object(hostName);
+                    if (entry) {
+                        entry->refreshing = false;
+                    }
+                });
+            }
+            return entry->addresses;
+        }
     }
+    return d->lookup(hostName);
 }
 
 bool SocketDnsCache::hasHost(const QString &hostName) const
 {
     Q_D(const SocketDnsCache);
-    return d->cache.contains(hostName);
+    SocketDnsCacheEntry *entry = d->cache.object(hostName);
+    return entry && !entry->addresses.isEmpty() && (entry->expires < 0 || d->clock.elapsed() < entry->expires);
 }
 
 void SocketDnsCache::addHost(const QString &hostName, const QList<HostAddress> &addrList)
 {
     Q_D(SocketDnsCache);
-    d->cache.insert(hostName, new QList<HostAddress>(addrList));
+    d->insert(hostName, addrList, -1);
 }
 
 void SocketDnsCache::addHost(const QString &hostName, const HostAddress &addr)
 {
     Q_D(SocketDnsCache);
-    QList<HostAddress> *addrList = new QList<HostAddress>();
-    addrList->append(addr);
-    d->cache.insert(hostName, addrList);
+    d->insert(hostName, QList<HostAddress>() << addr, -1);
+}
+
+quint32 SocketDnsCache::maxTtl() const
+{
+    Q_D(const SocketDnsCache);
+    return d->maxTtl;
+}
+
+void SocketDnsCache::setMaxTtl(quint32 secs)
+{
+    Q_D(SocketDnsCache);
+    d->maxTtl = qMax<quint32>(1, secs);
+}
+
+quint32 SocketDnsCache::negativeTtl() const
+{
+    Q_D(const SocketDnsCache);
+    return d->negativeTtl;
+}
+
+void SocketDnsCache::setNegativeTtl(quint32 secs)
+{
+    Q_D(SocketDnsCache);
+    d->negativeTtl = secs;
 }
 
 QTNETWORKNG_NAMESPACE_END
@@ -1,5 +1,26 @@
 #include <QtCore/qloggingcategory.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qatomic.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qcoreapplication.h>
+#include <QtCore/qfile.h>
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef Q_OS_LINUX
+#include <linux/filter.h>
+#endif
+
+extern char **environ;
+#endif
 #include "../include/socket_server.h"
+#include "../include/metrics.h"
+#include "../include/access_log.h"
 
 // #define DEBUG_PROTOCOL 1
 
@@ -9,31 +30,219 @@ static Q_LOGGING_CATEGORY(logger, "qtng.socket_server");
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
+// an extra thread accepting requests with its own listener bound to the same port.
+struct BaseStreamServerWorker
+{
+    BaseStreamServerWorker(quint16 port)
+        : thread(new CoroutineThread())
+        , port(port)
+        , index(0)
+        , bound(false)
+        , stopping(false)
+    {
+    }
+    ~BaseStreamServerWorker() { delete thread; }
+    CoroutineThread *thread;
+    QSharedPointer<SocketLike> serverSocket;  // only touched in the worker thread.
+    quint16 port;
+    int index;  // in the SO_REUSEPORT group.
+    bool bound;
+    bool stopping;
+};
+
+#ifdef Q_OS_UNIX
+// a worker process of the supervisor.
+struct WorkerProcess
+{
+    qint64 startedAt;  // or the time to restart it if pid is 0.
+    pid_t pid;
+    int control;  // our end of the control socket, closing it lets the worker drain.
+};
+
+static const char ListenerVariable[] = "QTNG_SERVER_LISTENER_FD";
+static const char ControlVariable[] = "QTNG_SERVER_CONTROL_FD";
+
+// the fds given by the supervisor, taken once and hidden from the child processes of worker.
+struct InheritedServerFds
+{
+    InheritedServerFds();
+    qintptr listener;
+    qintptr control;
+};
+
+InheritedServerFds::InheritedServerFds()
+    : listener(-1)
+    , control(-1)
+{
+    bool ok;
+    int fd = qgetenv(ListenerVariable).toInt(&ok);
+    if (ok && fd >= 0 && ::fcntl(fd, F_SETFD, FD_CLOEXEC) == 0) {
+        listener = fd;
+    }
+    fd = qgetenv(ControlVariable).toInt(&ok);
+    if (ok && fd >= 0 && ::fcntl(fd, F_SETFD, FD_CLOEXEC) == 0) {
+        control = fd;
+    }
+    qunsetenv(ListenerVariable);
+    qunsetenv(ControlVariable);
+}
+
+static InheritedServerFds &inheritedServerFds()
+{
+    static InheritedServerFds fds;
+    return fds;
+}
+#endif
+
+// the connections accepted by one thread.
+struct AcceptLoopState
+{
+    AcceptLoopState()
+        : active(0)
+        , listener(0)
+    {
+    }
+    int active;
+    int listener;  // the listenerIndex() of thread.
+    Condition finished;
+};
+
+#ifdef Q_OS_LINUX
+static bool isStreamListener(qintptr fd)
+{
+    int type = 0;
+    socklen_t len = sizeof(type);
+    return ::getsockopt(static_cast<int>(fd), SOL_SOCKET, SO_TYPE, &type, &len) == 0 && type == SOCK_STREAM;
+}
+
+// let the kernel choose the listener of the cpu receiving the syn, which is the index in the reuseport group.
+static bool steerToCpu(qintptr fd, int listener, int listeners)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    // A = the cpu, A %= listeners, return A. every listener attaches the same program to the group.
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<__u32>(SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<__u32>(listeners) },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog program;
+    program.len = sizeof(code) / sizeof(code[0]);
+    program.filter = code;
+    if (::setsockopt(static_cast<int>(fd), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == 0) {
+        return true;
+    }
+#else
+    Q_UNUSED(listeners);
+#endif
+#ifdef SO_INCOMING_CPU
+    // a weaker hint, the listener of the same cpu wins only if the others score the same.
+    int cpu = listener;
+    return ::setsockopt(static_cast<int>(fd), SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == 0;
+#else
+    Q_UNUSED(listener);
+    return false;
+#endif
+}
+#endif
+
 class BaseStreamServerPrivate
 {
 public:
     BaseStreamServerPrivate(BaseStreamServer *q, const HostAddress &serverAddress, quint16 serverPort)
         : operations(new CoroutineGroup)
+        , connections(new CoroutineGroup)
         , serverAddress(serverAddress)
         , userData(nullptr)
         , requestQueueSize(100)
+        , workerThreads(1)
+        , workerProcesses(0)
+        , boundListeners(0)
+        , listeningListeners(0)
+        , listenerIndex(0)
+        , maxConnections(0)
+        , maxConnectionsPerAddress(0)
+        , acceptBatchSize(16)
+        , fastOpenQueueSize(0)
+        , deferAcceptSecs(0)
+        , stackSize(DEFAULT_COROUTINE_STACK_SIZE)
+        , drainTimeout(30.0f)
         , serverPort(serverPort)
         , allowReuseAddress(true)
         , bound(false)
+        , stackTrimming(false)
+        , steeringByCpu(false)
+        , adopted(false)
+        , supervising(false)
         , q_ptr(q)
     {
     }
-    ~BaseStreamServerPrivate() { delete operations; }
+    ~BaseStreamServerPrivate()
+    {
+        // the workers use this object until they are joined. serveForever() may be stopping them now, kill it first.
+        operations->kill(QString::fromLatin1("serve"));
+        stopWorkers();
+        delete connections;
+        delete operations;
+    }
     void serveForever();
+    void acceptRequests(CoroutineGroup *connections);
+    bool waitForRoom(QSharedPointer<AcceptLoopState> state);
+    int acceptLimit();
+    void handleRequest(CoroutineGroup *connections, QSharedPointer<SocketLike> request,
+                       QSharedPointer<AcceptLoopState> state);
+    bool admitConnection(const HostAddress &address, int listener);
+    void releaseConnection(const HostAddress &address);
+    void startWorkers();
+    void stopWorkers();
+    void serveWorker(BaseStreamServerWorker *worker);
+    BaseStreamServerWorker *currentWorker() const;
+    bool setupListener();
+#ifdef Q_OS_UNIX
+    void superviseWorkers();
+    bool spawnWorkerProcess(WorkerProcess *process);
+    void reapWorkerProcesses(QList<WorkerProcess> *processes, bool restart);
+#endif
 public:
     QSharedPointer<SocketLike> serverSocket;
     CoroutineGroup *operations;
+    CoroutineGroup *connections;  // accepted by the thread of server.
     HostAddress serverAddress;
+    QList<BaseStreamServerWorker *> workers;
+    mutable QMutex workersLock;
+    QHash<CompactHostAddress, int> connectionsPerAddress;
+    StreamServerCounters counters;
+    QVector<quint64> acceptedPerListener;
+    mutable QMutex countersLock;  // for the counters shared by worker threads.
+    QMutex bindLock;  // the listeners are bound one by one, so their indexes are known.
+    QAtomicInt draining;
+    QAtomicInt reloading;
+#ifdef Q_OS_UNIX
+    QList<WorkerProcess> processes;
+    QList<WorkerProcess> retiredProcesses;  // of the old generations, draining.
+    QElapsedTimer clock;
+#endif
+    QSharedPointer<AccessLog> accessLog;
     void *userData;
     int requestQueueSize;
+    int workerThreads;
+    int workerProcesses;
+    int boundListeners;
+    int listeningListeners;  // the order of listen() when steering, which is the order of reuseport group of tcp.
+    int listenerIndex;
+    int maxConnections;
+    int maxConnectionsPerAddress;
+    int acceptBatchSize;
+    int fastOpenQueueSize;
+    int deferAcceptSecs;
+    size_t stackSize;
+    float drainTimeout;
     quint16 serverPort;
     bool allowReuseAddress;
     bool bound;
+    bool stackTrimming;
+    bool steeringByCpu;
+    bool adopted;  // the listener is inherited from the supervisor.
+    bool supervising;
 private:
     BaseStreamServer * const q_ptr;
     Q_DECLARE_PUBLIC(BaseStreamServer)
@@ -85,11 +294,154 @@ void BaseStreamServer::setRequestQueueSize(int requestQueueSize)
     d->requestQueueSize = requestQueueSize;
 }
 
+int BaseStreamServer::workerThreads() const
+{
+    Q_D(const BaseStreamServer);
+    return d->workerThreads;
+}
+
+void BaseStreamServer::setWorkerThreads(int workerThreads)
+{
+    Q_D(BaseStreamServer);
+    d->workerThreads = qMax(1, workerThreads);
+}
+
+int BaseStreamServer::workerProcesses() const
+{
+    Q_D(const BaseStreamServer);
+    return d->workerProcesses;
+}
+
+void BaseStreamServer::setWorkerProcesses(int workerProcesses)
+{
+    Q_D(BaseStreamServer);
+    d->workerProcesses = qMax(0, workerProcesses);
+}
+
+void BaseStreamServer::reloadWorkers()
+{
+    Q_D(BaseStreamServer);
+    d->reloading.storeRelease(1);
+}
+
+int BaseStreamServer::maxConnections() const
+{
+    Q_D(const BaseStreamServer);
+    return d->maxConnections;
+}
+
+void BaseStreamServer::setMaxConnections(int maxConnections)
+{
+    Q_D(BaseStreamServer);
+    d->maxConnections = qMax(0, maxConnections);
+}
+
+int BaseStreamServer::maxConnectionsPerAddress() const
+{
+    Q_D(const BaseStreamServer);
+    return d->maxConnectionsPerAddress;
+}
+
+void BaseStreamServer::setMaxConnectionsPerAddress(int maxConnectionsPerAddress)
+{
+    Q_D(BaseStreamServer);
+    d->maxConnectionsPerAddress = qMax(0, maxConnectionsPerAddress);
+}
+
+int BaseStreamServer::acceptBatchSize() const
+{
+    Q_D(const BaseStreamServer);
+    return d->acceptBatchSize;
+}
+
+void BaseStreamServer::setAcceptBatchSize(int acceptBatchSize)
+{
+    Q_D(BaseStreamServer);
+    d->acceptBatchSize = qMax(1, acceptBatchSize);
+}
+
+int BaseStreamServer::fastOpenQueueSize() const
+{
+    Q_D(const BaseStreamServer);
+    return d->fastOpenQueueSize;
+}
+
+void BaseStreamServer::setFastOpenQueueSize(int fastOpenQueueSize)
+{
+    Q_D(BaseStreamServer);
+    d->fastOpenQueueSize = qMax(0, fastOpenQueueSize);
+}
+
+int BaseStreamServer::deferAccept() const
+{
+    Q_D(const BaseStreamServer);
+    return d->deferAcceptSecs;
+}
+
+void BaseStreamServer::setDeferAccept(int secs)
+{
+    Q_D(BaseStreamServer);
+    d->deferAcceptSecs = qMax(0, secs);
+}
+
+bool BaseStreamServer::stackTrimming() const
+{
+    Q_D(const BaseStreamServer);
+    return d->stackTrimming;
+}
+
+void BaseStreamServer::setStackTrimming(bool stackTrimming)
+{
+    Q_D(BaseStreamServer);
+    d->stackTrimming = stackTrimming;
+}
+
+size_t BaseStreamServer::stackSize() const
+{
+    Q_D(const BaseStreamServer);
+    return d->stackSize;
+}
+
+void BaseStreamServer::setStackSize(size_t stackSize)
+{
+    Q_D(BaseStreamServer);
+    d->stackSize = stackSize ? stackSize : DEFAULT_COROUTINE_STACK_SIZE;
+}
+
+bool BaseStreamServer::steeringByCpu() const
+{
+    Q_D(const BaseStreamServer);
+    return d->steeringByCpu;
+}
+
+void BaseStreamServer::setSteeringByCpu(bool steeringByCpu)
+{
+    Q_D(BaseStreamServer);
+    d->steeringByCpu = steeringByCpu;
+}
+
+StreamServerCounters BaseStreamServer::counters() const
+{
+    Q_D(const BaseStreamServer);
+    QMutexLocker locker(&d->countersLock);
+    return d->counters;
+}
+
+QList<quint64> BaseStreamServer::acceptedConnectionsPerListener() const
+{
+    Q_D(const BaseStreamServer);
+    QMutexLocker locker(&d->countersLock);
+    return d->acceptedPerListener.toList();
+}
+
 bool BaseStreamServer::serverBind()
 {
     Q_D(BaseStreamServer);
-    if (d->bound) {
-        Socket::SocketState state = d->serverSocket->state();
+    BaseStreamServerWorker *worker = d->currentWorker();
+    QSharedPointer<SocketLike> serverSocket = worker ? worker->serverSocket : d->serverSocket;
+    bool &bound = worker ? worker->bound : d->bound;
+    if (bound) {
+        Socket::SocketState state = serverSocket->state();
         return state == Socket::BoundState || state == Socket::ListeningState;
     }
 
@@ -99,28 +451,79 @@ bool BaseStreamServer::serverBind()
     } else {
         mode = Socket::DefaultForPlatform;
     }
-    d->bound = d->serverSocket->bind(d->serverAddress, d->serverPort, mode);
+    if (d->workerThreads > 1) {
+        mode |= Socket::ReusePortHint;
+    }
+    // workers bind to the port the first listener got, in case of serverPort is zero.
+    quint16 port = worker ? worker->port : d->serverPort;
+    {
+        QMutexLocker locker(&d->bindLock);
+        bound = serverSocket->bind(d->serverAddress, port, mode);
+        if (bound) {
+            if (!worker) {
+                // the listener of server is bound before workers started.
+                d->boundListeners = 0;
+            }
+            (worker ? worker->index : d->listenerIndex) = d->boundListeners++;
+        }
+    }
 #ifdef DEBUG_PROTOCOL
-    if (!ok) {
-        qCInfo(logger) << "server can not bind to" << d->serverAddress.toString() << ":" << d->serverPort;
+    if (!bound) {
+        qCInfo(logger) << "server can not bind to" << d->serverAddress.toString() << ":" << port;
     }
 #endif
-    return d->bound;
+    return bound;
+}
+
+int BaseStreamServer::listenerIndex() const
+{
+    Q_D(const BaseStreamServer);
+    BaseStreamServerWorker *worker = d->currentWorker();
+    return worker ? worker->index : d->listenerIndex;
 }
 
 bool BaseStreamServer::serverActivate()
 {
     Q_D(BaseStreamServer);
-    if (!d->bound) {
+    BaseStreamServerWorker *worker = d->currentWorker();
+    QSharedPointer<SocketLike> serverSocket = worker ? worker->serverSocket : d->serverSocket;
+    if (!(worker ? worker->bound : d->bound)) {
         return false;
     }
-    if (d->serverSocket->state() == Socket::ListeningState) {
+    if (serverSocket->state() == Socket::ListeningState) {
         return true;
     }
-    if (d->serverSocket->state() != Socket::BoundState) {
+    if (serverSocket->state() != Socket::BoundState) {
         return false;
     }
-    bool ok = d->serverSocket->listen(d->requestQueueSize);
+    // not every platform or socket supports them, the server works the same without.
+    if (d->fastOpenQueueSize > 0) {
+        serverSocket->setOption(Socket::FastOpenSocketOption, d->fastOpenQueueSize);
+    }
+    if (d->deferAcceptSecs > 0) {
+        serverSocket->setOption(Socket::DeferAcceptSocketOption, d->deferAcceptSecs);
+    }
+    bool ok;
+#ifdef Q_OS_LINUX
+    if (d->steeringByCpu && d->workerThreads > 1 && !d->adopted && isStreamListener(serverSocket->fileno())) {
+        // tcp listeners join the reuseport group by listen(), so they are numbered again in that order.
+        QMutexLocker locker(&d->bindLock);
+        ok = serverSocket->listen(d->requestQueueSize);
+        if (ok) {
+            if (!worker) {
+                d->listeningListeners = 0;
+            }
+            int &index = worker ? worker->index : d->listenerIndex;
+            index = d->listeningListeners++;
+            steerToCpu(serverSocket->fileno(), index, d->workerThreads);
+            CoroutineThread::pinCurrentThread(index % qMax(1, QThread::idealThreadCount()));
+        }
+    } else {
+        ok = serverSocket->listen(d->requestQueueSize);
+    }
+#else
+    ok = serverSocket->listen(d->requestQueueSize);
+#endif
 #ifdef DEBUG_PROTOCOL
     if (!ok) {
         qCInfo(logger) << "server can not listen to" << d->serverAddress.toString() << ":" << d->serverPort;
@@ -132,61 +535,539 @@ bool BaseStreamServer::serverActivate()
 void BaseStreamServer::serverClose()
 {
     Q_D(BaseStreamServer);
-    d->serverSocket->close();
+    BaseStreamServerWorker *worker = d->currentWorker();
+    if (worker) {
+        worker->serverSocket->close();
+    } else {
+        d->serverSocket->close();
+    }
+}
+
+BaseStreamServerWorker *BaseStreamServerPrivate::currentWorker() const
+{
+    QMutexLocker locker(&workersLock);
+    if (workers.isEmpty()) {
+        return nullptr;
+    }
+    QThread *thread = QThread::currentThread();
+    for (BaseStreamServerWorker *worker : workers) {
+        if (worker->thread == thread) {
+            return worker;
+        }
+    }
+    return nullptr;
+}
+
+void BaseStreamServerPrivate::startWorkers()
+{
+    if (workerThreads <= 1 || supervising) {
+        return;
+    }
+    const quint16 port = serverSocket->localPort();
+    QMutexLocker locker(&workersLock);
+    for (int i = 1; i < workerThreads; ++i) {
+        BaseStreamServerWorker *worker = new BaseStreamServerWorker(port);
+        workers.append(worker);
+        worker->thread->start();
+        worker->thread->apply([this, worker] { serveWorker(worker); });
+    }
+}
+
+void BaseStreamServerPrivate::stopWorkers()
+{
+    QList<BaseStreamServerWorker *> pending;
+    {
+        QMutexLocker locker(&workersLock);
+        pending = workers;
+    }
+    for (BaseStreamServerWorker *worker : pending) {
+        // the listener belongs to the worker thread, close it there.
+        worker->thread->apply([worker] {
+            worker->stopping = true;
+            if (!worker->serverSocket.isNull()) {
+                worker->serverSocket->close();
+            }
+        });
+    }
+    // remove one by one, so the rest can still be stopped if we are killed while waiting.
+    for (BaseStreamServerWorker *worker : pending) {
+        waitThread(worker->thread);
+        bool removed;
+        {
+            QMutexLocker locker(&workersLock);
+            removed = workers.removeOne(worker);
+        }
+        if (removed) {
+            delete worker;
+        }
+    }
+}
+
+void BaseStreamServerPrivate::serveWorker(BaseStreamServerWorker *worker)
+{
+    Q_Q(BaseStreamServer);
+    {
+        CoroutineGroup workerOperations;
+#ifdef Q_OS_UNIX
+        if (adopted) {
+            // the threads of worker process share the inherited listener.
+            int fd = ::dup(static_cast<int>(serverSocket->fileno()));
+            if (fd >= 0) {
+                ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+                worker->serverSocket = asSocketLike(new Socket(fd));
+                worker->bound = true;
+            }
+        } else {
+            worker->serverSocket = q->serverCreate();
+        }
+#else
+        worker->serverSocket = q->serverCreate();
+#endif
+        if (!worker->serverSocket.isNull()) {
+            if (q->serverBind() && q->serverActivate()) {
+                if (!worker->stopping) {
+                    acceptRequests(&workerOperations);
+                }
+            }
+#ifdef DEBUG_PROTOCOL
+            else {
+                qCInfo(logger) << "worker can not listen to" << serverAddress.toString() << ":" << worker->port;
+            }
+#endif
+            q->serverClose();
+            worker->serverSocket.clear();
+        }
+    }
+    // let the coroutine thread quit.
+    worker->thread->apply(std::function<void()>());
 }
 
 void BaseStreamServerPrivate::serveForever()
 {
     Q_Q(BaseStreamServer);
+#ifdef Q_OS_UNIX
+    if (supervising) {
+        superviseWorkers();
+        return;
+    }
+#endif
     q->started->set();
     q->stopped->clear();
-    while (true) {
-        QSharedPointer<SocketLike> request = q->getRequest();
-        if (request.isNull()) {
-            break;
+    QSharedPointer<Coroutine> watcher;
+#ifdef Q_OS_UNIX
+    const qintptr control = adopted ? inheritedServerFds().control : -1;
+    if (control >= 0) {
+        inheritedServerFds().control = -1;
+        // the supervisor closes the control socket to stop us, or it is gone.
+        QSharedPointer<Socket> controlSocket(new Socket(control));
+        watcher = operations->spawnWithName(QString::fromLatin1("supervisor"), [this, controlSocket] {
+            Q_Q(BaseStreamServer);
+            controlSocket->recv(1);
+            draining.storeRelease(1);
+            q->stop();
+        });
+    }
+#endif
+    acceptRequests(connections);
+    q->serverClose();
+    stopWorkers();
+    if (!watcher.isNull()) {
+        operations->kill(QString::fromLatin1("supervisor"));
+        draining.storeRelease(0);
+    }
+    q->started->clear();
+    q->stopped->set();
+}
+
+#ifdef Q_OS_UNIX
+
+// run the executable again with the listener and one end of a new control socket inherited.
+bool BaseStreamServerPrivate::spawnWorkerProcess(WorkerProcess *process)
+{
+    const int listener = static_cast<int>(serverSocket->fileno());
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        return false;
+    }
+    ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    // only async signal safe functions can be called after fork(), prepare everything before.
+    const QByteArray program = QFile::encodeName(QCoreApplication::applicationFilePath());
+    QList<QByteArray> arguments;
+    for (const QString &argument : QCoreApplication::arguments()) {
+        arguments.append(argument.toLocal8Bit());
+    }
+    QList<QByteArray> environment;
+    for (char **e = environ; *e; ++e) {
+        environment.append(QByteArray(*e));
+    }
+    environment.append(QByteArray(ListenerVariable) + "=" + QByteArray::number(listener));
+    environment.append(QByteArray(ControlVariable) + "=" + QByteArray::number(fds[1]));
+    QVector<char *> argv;
+    for (QByteArray &argument : arguments) {
+        argv.append(argument.data());
+    }
+    argv.append(nullptr);
+    QVector<char *> envp;
+    for (QByteArray &variable : environment) {
+        envp.append(variable.data());
+    }
+    envp.append(nullptr);
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        ::fcntl(listener, F_SETFD, 0);
+        ::fcntl(fds[1], F_SETFD, 0);
+        ::execve(program.constData(), argv.data(), envp.data());
+        ::_exit(127);
+    }
+    ::close(fds[1]);
+    if (pid < 0) {
+        ::close(fds[0]);
+        return false;
+    }
+    process->pid = pid;
+    process->control = fds[0];
+    process->startedAt = clock.elapsed();
+    return true;
+}
+
+void BaseStreamServerPrivate::reapWorkerProcesses(QList<WorkerProcess> *processes, bool restart)
+{
+    const qint64 now = clock.elapsed();
+    for (int i = processes->size() - 1; i >= 0; --i) {
+        WorkerProcess &process = (*processes)[i];
+        if (process.pid == 0) {
+            if (restart && now >= process.startedAt && !spawnWorkerProcess(&process)) {
+                process.startedAt = now + 1000;
+            }
+            continue;
         }
-        if (q->verifyRequest(request)) {
-            operations->spawn([this, request] {
-                Q_Q(BaseStreamServer);
-                QSharedPointer<SocketLike> sslRequest = q->prepareRequest(request);
-                if (!sslRequest.isNull()) {
-                    try {
-                        q->processRequest(sslRequest);  // close request.
-                        return;
-                    } catch (CoroutineExitException &) {
-                    } catch (...) {
-                        q->handleError(sslRequest);
-                    }
-                    q->closeRequest(sslRequest);
-                }
-            });
+        int status;
+        pid_t r = ::waitpid(process.pid, &status, WNOHANG);
+        if (r == 0 || (r < 0 && errno == EINTR)) {
+            continue;
+        }
+#ifdef DEBUG_PROTOCOL
+        qCInfo(logger) << "worker process" << process.pid << "exited with" << status;
+#endif
+        if (process.control >= 0) {
+            ::close(process.control);
+        }
+        if (restart) {
+            // the workers crashing at start are restarted once a second.
+            process.pid = 0;
+            process.control = -1;
+            process.startedAt = qMax(now, process.startedAt + 1000);
         } else {
-            request->close();
+            processes->removeAt(i);
         }
-        if (!q->serviceActions()) {
-            break;
+    }
+}
+
+void BaseStreamServerPrivate::superviseWorkers()
+{
+    Q_Q(BaseStreamServer);
+    q->started->set();
+    q->stopped->clear();
+    clock.start();
+    for (int i = 0; i < workerProcesses; ++i) {
+        WorkerProcess process;
+        process.pid = 0;
+        process.control = -1;
+        process.startedAt = 0;
+        processes.append(process);
+    }
+    // stop() closes the listener of supervisor, the workers keep theirs until drained.
+    while (serverSocket->isValid()) {
+        if (reloading.fetchAndStoreAcquire(0)) {
+            // the new generation is started before the old one drains.
+            const QList<WorkerProcess> old = processes;
+            for (WorkerProcess &process : processes) {
+                process.pid = 0;
+                process.control = -1;
+                process.startedAt = 0;
+            }
+            reapWorkerProcesses(&processes, true);
+            for (WorkerProcess process : old) {
+                if (process.pid != 0) {
+                    ::close(process.control);
+                    process.control = -1;
+                    retiredProcesses.append(process);
+                }
+            }
         }
+        reapWorkerProcesses(&processes, true);
+        reapWorkerProcesses(&retiredProcesses, false);
+        Coroutine::msleep(100);
     }
-    q->serverClose();
+    for (const WorkerProcess &process : processes) {
+        if (process.pid != 0) {
+            ::close(process.control);
+            WorkerProcess retired = process;
+            retired.control = -1;
+            retiredProcesses.append(retired);
+        }
+    }
+    processes.clear();
+    const qint64 deadline = clock.elapsed() + static_cast<qint64>(drainTimeout * 1000) + 1000;
+    while (!retiredProcesses.isEmpty() && clock.elapsed() < deadline) {
+        reapWorkerProcesses(&retiredProcesses, false);
+        if (!retiredProcesses.isEmpty()) {
+            Coroutine::msleep(100);
+        }
+    }
+    for (const WorkerProcess &process : retiredProcesses) {
+        ::kill(process.pid, SIGKILL);
+        ::waitpid(process.pid, nullptr, 0);
+    }
+    retiredProcesses.clear();
     q->started->clear();
     q->stopped->set();
 }
 
-bool BaseStreamServer::serveForever()
+#endif
+
+bool BaseStreamServerPrivate::setupListener()
 {
-    Q_D(BaseStreamServer);
-    d->serverSocket = serverCreate();
-    if (d->serverSocket.isNull()) {
+    Q_Q(BaseStreamServer);
+    adopted = false;
+    supervising = false;
+#ifdef Q_OS_UNIX
+    if (workerProcesses > 0 && inheritedServerFds().listener >= 0) {
+        serverSocket = asSocketLike(new Socket(inheritedServerFds().listener));
+        inheritedServerFds().listener = -1;
+        adopted = bound = true;
+    } else {
+        serverSocket = q->serverCreate();
+    }
+#else
+    serverSocket = q->serverCreate();
+#endif
+    if (serverSocket.isNull()) {
         return false;
     }
-    if (!serverBind()) {
-        serverClose();
+    {
+        QMutexLocker locker(&countersLock);
+        acceptedPerListener = QVector<quint64>(workerThreads, 0);
+    }
+    if (!q->serverBind()) {
+        q->serverClose();
         return false;
     }
-    if (!serverActivate()) {
-        serverClose();
+    if (!q->serverActivate()) {
+        q->serverClose();
         return false;
     }
+#ifdef Q_OS_UNIX
+    if (workerProcesses > 0 && !adopted && QCoreApplication::instance()) {
+        QSharedPointer<Socket> socket = convertSocketLikeToSocket(serverSocket);
+        supervising = !socket.isNull() && socket->type() == Socket::TcpSocket;
+    }
+#endif
+    return true;
+}
+
+namespace {
+
+struct ServerMetrics
+{
+    ServerMetrics();
+    MetricCounter *accepted;
+    MetricCounter *rejected;
+    MetricGauge *active;
+};
+
+ServerMetrics::ServerMetrics()
+{
+    MetricsRegistry *registry = MetricsRegistry::instance();
+    accepted = registry->counter("qtng_server_accepted_connections_total", "Connections accepted by servers.");
+    rejected = registry->counter("qtng_server_rejected_connections_total",
+                                 "Connections rejected by verifyRequest() or the per address limit.");
+    active = registry->gauge("qtng_server_active_connections", "Connections being served.");
+}
+
+ServerMetrics &serverMetrics()
+{
+    static ServerMetrics metrics;
+    return metrics;
+}
+
+// release the connection even if the coroutine is killed, or never runs.
+struct ConnectionGuard
+{
+    ConnectionGuard(BaseStreamServerPrivate *d, const HostAddress &address, QSharedPointer<AcceptLoopState> state)
+        : d(d)
+        , address(address)
+        , state(state)
+    {
+    }
+    ~ConnectionGuard()
+    {
+        d->releaseConnection(address);
+        --state->active;
+        state->finished.notifyAll();
+    }
+    BaseStreamServerPrivate *d;
+    HostAddress address;
+    QSharedPointer<AcceptLoopState> state;
+};
+
+}  // anonymous namespace
+
+bool BaseStreamServerPrivate::admitConnection(const HostAddress &address, int listener)
+{
+    QMutexLocker locker(&countersLock);
+    if (maxConnectionsPerAddress > 0) {
+        int &count = connectionsPerAddress[address];
+        if (count >= maxConnectionsPerAddress) {
+            ++counters.rejectedConnections;
+            serverMetrics().rejected->add();
+            return false;
+        }
+        ++count;
+    }
+    ++counters.activeConnections;
+    ++counters.acceptedConnections;
+    if (listener >= 0 && listener < acceptedPerListener.size()) {
+        ++acceptedPerListener[listener];
+    }
+    serverMetrics().accepted->add();
+    serverMetrics().active->add();
+    return true;
+}
+
+void BaseStreamServerPrivate::releaseConnection(const HostAddress &address)
+{
+    QMutexLocker locker(&countersLock);
+    --counters.activeConnections;
+    serverMetrics().active->sub();
+    QHash<CompactHostAddress, int>::iterator itor = connectionsPerAddress.find(address);
+    if (itor != connectionsPerAddress.end() && --itor.value() <= 0) {
+        connectionsPerAddress.erase(itor);
+    }
+}
+
+// returns false if the server is stopped or draining while waiting.
+bool BaseStreamServerPrivate::waitForRoom(QSharedPointer<AcceptLoopState> state)
+{
+    Q_Q(BaseStreamServer);
+    bool paused = false;
+    while (!draining.loadAcquire() && maxConnections > 0) {
+        {
+            QMutexLocker locker(&countersLock);
+            if (counters.activeConnections < maxConnections) {
+                return true;
+            }
+            if (!paused) {
+                ++counters.acceptPauses;
+                paused = true;
+            }
+        }
+        QSharedPointer<SocketLike> serverSocket = q->serverSocket();
+        if (serverSocket.isNull() || !serverSocket->isValid()) {
+            return false;
+        }
+        // the connections of other threads do not notify us.
+        try {
+            Timeout timeout(0.1f);
+            state->finished.wait();
+        } catch (TimeoutException &) { }
+    }
+    return !draining.loadAcquire();
+}
+
+// the batch never takes more connections than maxConnections allows.
+int BaseStreamServerPrivate::acceptLimit()
+{
+    if (maxConnections <= 0) {
+        return acceptBatchSize;
+    }
+    QMutexLocker locker(&countersLock);
+    return qBound(1, maxConnections - counters.activeConnections, acceptBatchSize);
+}
+
+void BaseStreamServerPrivate::handleRequest(CoroutineGroup *connections, QSharedPointer<SocketLike> request,
+                                            QSharedPointer<AcceptLoopState> state)
+{
+    Q_Q(BaseStreamServer);
+    const HostAddress &address = request->peerAddress();
+    if (!q->verifyRequest(request)) {
+        QMutexLocker locker(&countersLock);
+        ++counters.rejectedConnections;
+        serverMetrics().rejected->add();
+        request->close();
+    } else if (!admitConnection(address, state->listener)) {
+        request->close();
+    } else {
+        ++state->active;
+        // the guard is owned before spawning, a connection killed before it starts is released with the functor.
+        QSharedPointer<ConnectionGuard> admitted(new ConnectionGuard(this, address, state));
+        connections->spawn([this, request, admitted]() mutable {
+            Q_Q(BaseStreamServer);
+            QSharedPointer<ConnectionGuard> guard;
+            guard.swap(admitted);
+            if (stackTrimming) {
+                BaseCoroutine::current()->setStackTrimmingEnabled(true);
+            }
+            QSharedPointer<SocketLike> sslRequest = q->prepareRequest(request);
+            if (!sslRequest.isNull()) {
+                try {
+                    q->processRequest(sslRequest);  // close request.
+                    return;
+                } catch (CoroutineExitException &) {
+                } catch (...) {
+                    q->handleError(sslRequest);
+                }
+                q->closeRequest(sslRequest);
+            }
+        }, stackSize);
+    }
+}
+
+void BaseStreamServerPrivate::acceptRequests(CoroutineGroup *connections)
+{
+    Q_Q(BaseStreamServer);
+    QSharedPointer<AcceptLoopState> state(new AcceptLoopState());
+    state->listener = q->listenerIndex();
+    while (waitForRoom(state)) {
+        const QList<QSharedPointer<SocketLike>> &requests = q->getRequests(acceptLimit());
+        if (requests.isEmpty()) {
+            break;
+        }
+        // the handlers start after the whole batch is accepted.
+        for (const QSharedPointer<SocketLike> &request : requests) {
+            handleRequest(connections, request, state);
+        }
+        if (!q->serviceActions()) {
+            break;
+        }
+    }
+    if (draining.loadAcquire()) {
+        try {
+            Timeout timeout(drainTimeout);
+            while (state->active > 0) {
+                state->finished.wait();
+            }
+        } catch (TimeoutException &) { }
+        if (state->active > 0) {
+            {
+                QMutexLocker locker(&countersLock);
+                counters.killedConnections += static_cast<quint64>(state->active);
+            }
+            connections->killall();
+        }
+    }
+}
+
+bool BaseStreamServer::serveForever()
+{
+    Q_D(BaseStreamServer);
+    if (!d->setupListener()) {
+        return false;
+    }
+    d->startWorkers();
     d->serveForever();
     return true;
 }
@@ -198,18 +1079,10 @@ bool BaseStreamServer::start()
     if (started->isSet() || d->operations->has(QString::fromLatin1("serve"))) {
         return true;
     }
-    d->serverSocket = serverCreate();
-    if (d->serverSocket.isNull()) {
-        return false;
-    }
-    if (!serverBind()) {
-        serverClose();
-        return false;
-    }
-    if (!serverActivate()) {
-        serverClose();
+    if (!d->setupListener()) {
         return false;
     }
+    d->startWorkers();
     d->operations->spawnWithName(QString::fromLatin1("serve"), [d] { d->serveForever(); });
     return true;
 }
@@ -222,6 +1095,26 @@ void BaseStreamServer::stop()
     }
 }
 
+bool BaseStreamServer::drain(float timeout)
+{
+    Q_D(BaseStreamServer);
+    const quint64 killed = counters().killedConnections;
+    d->drainTimeout = timeout;
+    d->draining.storeRelease(1);
+    stop();
+    if (started->isSet()) {
+        stopped->wait();
+    }
+    d->draining.storeRelease(0);
+    return counters().killedConnections == killed;
+}
+
+bool BaseStreamServer::isDraining() const
+{
+    Q_D(const BaseStreamServer);
+    return d->draining.loadAcquire() != 0;
+}
+
 bool BaseStreamServer::wait()
 {
     Q_D(BaseStreamServer);
@@ -240,6 +1133,11 @@ bool BaseStreamServer::isSecure() const
     return false;
 }
 
+void BaseStreamServer::processSubRequest(QSharedPointer<SocketLike> request)
+{
+    processRequest(request);
+}
+
 void BaseStreamServer::setUserData(void *data)
 {
     Q_D(BaseStreamServer);
@@ -252,6 +1150,18 @@ void *BaseStreamServer::userData() const
     return d->userData;
 }
 
+void BaseStreamServer::setAccessLog(QSharedPointer<AccessLog> accessLog)
+{
+    Q_D(BaseStreamServer);
+    d->accessLog = accessLog;
+}
+
+QSharedPointer<AccessLog> BaseStreamServer::accessLog() const
+{
+    Q_D(const BaseStreamServer);
+    return d->accessLog;
+}
+
 quint16 BaseStreamServer::serverPort() const
 {
     Q_D(const BaseStreamServer);
@@ -273,7 +1183,8 @@ HostAddress BaseStreamServer::serverAddress() const
 QSharedPointer<SocketLike> BaseStreamServer::serverSocket() const
 {
     Q_D(const BaseStreamServer);
-    return d->serverSocket;
+    BaseStreamServerWorker *worker = d->currentWorker();
+    return worker ? worker->serverSocket : d->serverSocket;
 }
 
 bool BaseStreamServer::serviceActions()
@@ -293,8 +1204,20 @@ bool BaseStreamServer::verifyRequest(QSharedPointer<SocketLike>)
 
 QSharedPointer<SocketLike> BaseStreamServer::getRequest()
 {
-    Q_D(BaseStreamServer);
-    return d->serverSocket->accept();
+    return serverSocket()->accept();
+}
+
+QList<QSharedPointer<SocketLike>> BaseStreamServer::getRequests(int maxCount)
+{
+    if (maxCount <= 1) {
+        QList<QSharedPointer<SocketLike>> requests;
+        QSharedPointer<SocketLike> request = getRequest();
+        if (!request.isNull()) {
+            requests.append(request);
+        }
+        return requests;
+    }
+    return serverSocket()->acceptMany(maxCount);
 }
 
 void BaseStreamServer::handleError(QSharedPointer<SocketLike>) { }
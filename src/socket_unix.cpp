@@ -8,14 +8,44 @@
 #endif
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#ifdef Q_OS_LINUX
+#  include <netinet/udp.h>
+#endif
+#include <poll.h>
+#ifdef Q_OS_LINUX
+#  include <sys/sendfile.h>
+#  include <linux/errqueue.h>
+#endif
+#include <QtCore/qvarlengtharray.h>
+#include <QtCore/qfile.h>
 
 #ifndef SOCK_NONBLOCK
 #  define SOCK_NONBLOCK O_NONBLOCK
 #endif
 
+#ifdef Q_OS_LINUX  // older libc headers do not have them.
+#  ifndef TCP_FASTOPEN_CONNECT
+#    define TCP_FASTOPEN_CONNECT 30
+#  endif
+#  ifndef SO_ZEROCOPY
+#    define SO_ZEROCOPY 60
+#  endif
+#  ifndef MSG_ZEROCOPY
+#    define MSG_ZEROCOPY 0x4000000
+#  endif
+#  ifndef SO_EE_ORIGIN_ZEROCOPY
+#    define SO_EE_ORIGIN_ZEROCOPY 5
+#  endif
+#  ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#    define SO_EE_CODE_ZEROCOPY_COPIED 1
+#  endif
+#endif
+
 #ifdef Q_OS_UNIX
 #  ifdef Q_OS_ANDROID
 #    include <unistd.h>
@@ -55,6 +85,31 @@ union qt_sockaddr {
     sockaddr_in6 a6;
 };
 
+// the number of datagrams moved by one recvmmsg()/sendmmsg() call.
+static const int MaxDatagramsPerCall = 64;
+
+// park on the eventloop until the operation completes if it supports completion based io, or until the fd is ready.
+static inline void waitForIo(ScopedIoWatcher &watcher, CompletionIo &io)
+{
+    if (!EventLoopCoroutine::get()->completeIo(&io)) {
+        watcher.start();
+    }
+}
+
+// turn the result of a completed operation back into a syscall result.
+static inline ssize_t takeIoResult(CompletionIo &io)
+{
+    io.hasResult = false;
+    if (io.result == -EINTR || io.result == -ECANCELED) {
+        errno = EAGAIN;
+        return -1;
+    } else if (io.result < 0) {
+        errno = static_cast<int>(-io.result);
+        return -1;
+    }
+    return static_cast<ssize_t>(io.result);
+}
+
 static void qt_ignore_sigpipe()
 {
     // Set to ignore SIGPIPE once only.
@@ -112,6 +167,42 @@ static inline void qt_socket_getPortAndAddress(const qt_sockaddr *s, quint16 *po
     }
 }
 
+static bool qt_socket_setLocalPath(const QString &path, sockaddr_un *aa, QT_SOCKLEN_T *sockAddrSize)
+{
+    const QByteArray &name = QFile::encodeName(path);
+    memset(aa, 0, sizeof(sockaddr_un));
+    aa->sun_family = AF_UNIX;
+    if (name.isEmpty() || static_cast<size_t>(name.size()) >= sizeof(aa->sun_path)) {
+        return false;
+    }
+#ifdef Q_OS_LINUX
+    if (name.at(0) == '@') {
+        // the abstract name starts with a zero byte, and is not terminated.
+        memcpy(aa->sun_path + 1, name.constData() + 1, static_cast<size_t>(name.size() - 1));
+        *sockAddrSize = static_cast<QT_SOCKLEN_T>(offsetof(sockaddr_un, sun_path) + name.size());
+        return true;
+    }
+#endif
+    memcpy(aa->sun_path, name.constData(), static_cast<size_t>(name.size()));
+    *sockAddrSize = static_cast<QT_SOCKLEN_T>(offsetof(sockaddr_un, sun_path) + name.size() + 1);
+    return true;
+}
+
+static QString qt_socket_getLocalPath(const sockaddr_un *aa, QT_SOCKLEN_T sockAddrSize)
+{
+    const size_t offset = offsetof(sockaddr_un, sun_path);
+    if (sockAddrSize <= offset) {
+        return QString();  // not bound.
+    }
+    const int size = static_cast<int>(qMin<size_t>(sockAddrSize - offset, sizeof(aa->sun_path)));
+#ifdef Q_OS_LINUX
+    if (aa->sun_path[0] == '\0') {
+        return QString::fromLatin1("@") + QFile::decodeName(QByteArray(aa->sun_path + 1, size - 1));
+    }
+#endif
+    return QFile::decodeName(QByteArray(aa->sun_path, static_cast<int>(qstrnlen(aa->sun_path, size))));
+}
+
 #ifdef Q_OS_MAC
 #  ifdef SOCK_CLOEXEC
 #    define CREATE_FLAGS SOCK_CLOEXEC
@@ -131,10 +222,12 @@ bool SocketPrivate::createSocket()
     qt_ignore_sigpipe();
     int flags = CREATE_FLAGS;
     int family = AF_INET;
-    if (protocol == HostAddress::IPv6Protocol) {
+    if (isLocal()) {
+        family = AF_UNIX;
+    } else if (protocol == HostAddress::IPv6Protocol) {
         family = AF_INET6;
     }
-    if (type == Socket::TcpSocket) {
+    if (isStream()) {
         flags = SOCK_STREAM | flags;
     } else {
         flags = SOCK_DGRAM | flags;
@@ -242,6 +335,75 @@ bool SocketPrivate::isValid() const
     return result == 0 && error == 0;
 }
 
+#ifndef MSG_DONTWAIT
+#  define MSG_DONTWAIT 0
+#endif
+
+bool SocketPrivate::isIdleConnected() const
+{
+    if (!checkState() || !isStream()) {
+        return false;
+    }
+    // the socket is nonblocking, peeking one byte returns EAGAIN only if nothing and no eof is pending.
+    char c;
+    ssize_t r;
+    do {
+        r = ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    } while (r < 0 && errno == EINTR);
+    return r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+#ifdef Q_OS_LINUX
+// the layout of struct tcp_info in linux/tcp.h, as the libc headers lag behind. older kernels fill a shorter prefix.
+struct LinuxTcpInfo
+{
+    quint8 state, caState, retransmits, probes, backoff, options, wscale, flags;
+    quint32 rto, ato, sndMss, rcvMss;
+    quint32 unacked, sacked, lost, retrans, fackets;
+    quint32 lastDataSent, lastAckSent, lastDataRecv, lastAckRecv;
+    quint32 pmtu, rcvSsthresh, rtt, rttvar, sndSsthresh, sndCwnd, advmss, reordering;
+    quint32 rcvRtt, rcvSpace;
+    quint32 totalRetrans;
+    quint64 pacingRate, maxPacingRate, bytesAcked, bytesReceived;
+    quint32 segsOut, segsIn;
+    quint32 notsentBytes, minRtt, dataSegsIn, dataSegsOut;
+    quint64 deliveryRate;
+    quint64 busyTime, rwndLimited, sndbufLimited;
+    quint32 delivered, deliveredCe;
+    quint64 bytesSent, bytesRetrans;
+};
+#endif
+
+TcpInfo SocketPrivate::tcpInfo() const
+{
+    TcpInfo result;
+    if (!checkState() || type != Socket::TcpSocket) {
+        return result;
+    }
+#ifdef Q_OS_LINUX
+    LinuxTcpInfo info;
+    memset(&info, 0, sizeof(info));
+    socklen_t len = sizeof(info);
+    if (::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+        return result;
+    }
+    result.rtt = info.rtt;
+    result.rttVariance = info.rttvar;
+    result.minRtt = info.minRtt;
+    result.congestionWindow = info.sndCwnd;
+    result.slowStartThreshold = info.sndSsthresh;
+    result.mss = info.sndMss;
+    result.retransmits = info.totalRetrans;
+    result.lost = info.lost;
+    result.deliveryRate = info.deliveryRate;
+    result.bytesSent = info.bytesSent;
+    result.bytesReceived = info.bytesReceived;
+    result.bytesRetransmitted = info.bytesRetrans;
+    result.valid = true;
+#endif
+    return result;
+}
+
 bool SocketPrivate::bind(const HostAddress &address, quint16 port, Socket::BindMode mode)
 {
     if (!checkState()) {
@@ -262,6 +424,13 @@ bool SocketPrivate::bind(const HostAddress &address, quint16 port, Socket::BindM
     if (mode & Socket::ReuseAddressHint) {
         setOption(Socket::AddressReusable, true);
     }
+#ifdef SO_REUSEPORT
+    if (mode & Socket::ReusePortHint) {
+        // let several sockets bind to the same port, the kernel balances incoming connections between them.
+        int reusePort = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, static_cast<void *>(&reusePort), sizeof(reusePort));
+    }
+#endif
 #ifdef IPV6_V6ONLY
     if (aa.a.sa_family == AF_INET6) {
         int ipv6only = 1;
@@ -304,52 +473,31 @@ bool SocketPrivate::bind(const HostAddress &address, quint16 port, Socket::BindM
     return true;
 }
 
-bool SocketPrivate::connect(const HostAddress &address, quint16 port)
+// connect() has been started by the first call, the completion only tells it is done.
+static bool connectTo(SocketPrivate *d, const sockaddr *addr, QT_SOCKLEN_T addrSize)
 {
-    // if (!checkState()) { // not require NoError
-    if (fd == 0) {
-        return false;
-    }
-    if (state != Socket::UnconnectedState && state != Socket::BoundState && state != Socket::ConnectingState) {
-        return false;
-    }
-    qt_sockaddr aa;
-    QT_SOCKLEN_T sockAddrSize;
-    int t;
-    if (!setPortAndAddress(port, address, &aa, &t)) {
-        setError(Socket::UnsupportedSocketOperationError, ProtocolUnsupportedErrorString);
-        return false;
-    }
-    sockAddrSize = static_cast<QT_SOCKLEN_T>(t);
-#ifdef IPV6_V6ONLY
-    if (protocol == HostAddress::IPv6Protocol) {
-        int ipv6only = 1;
-        // default value of this socket option varies depending on unix variant (or system configuration on BSD), so
-        // always set it explicitly
-        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, static_cast<void *>(&ipv6only), sizeof(ipv6only));
-    }
-#endif
-    state = Socket::ConnectingState;
-    ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    d->state = Socket::ConnectingState;
+    ScopedIoWatcher watcher(EventLoopCoroutine::Write, d->fd);
+    CompletionIo io(CompletionIo::Poll, d->fd);
     while (true) {
-        if (!checkState())
+        if (!d->checkState())
             return false;
-        if (state != Socket::ConnectingState)
+        if (d->state != Socket::ConnectingState)
             return false;
         int result;
         do {
-            result = ::connect(fd, &aa.a, sockAddrSize);
+            result = ::connect(d->fd, addr, addrSize);
         } while (result < 0 && errno == EINTR);
         if (result >= 0) {
-            state = Socket::ConnectedState;
-            fetchConnectionParameters();
+            d->state = Socket::ConnectedState;
+            d->fetchConnectionParameters();
             return true;
         }
         int t = errno;
         switch (t) {
         case EISCONN:
-            state = Socket::ConnectedState;
-            fetchConnectionParameters();
+            d->state = Socket::ConnectedState;
+            d->fetchConnectionParameters();
             return true;
         case EINPROGRESS:
         case EALREADY:
@@ -357,62 +505,250 @@ bool SocketPrivate::connect(const HostAddress &address, quint16 port)
             break;
 
         case ECONNREFUSED:
+        case ENOENT:  // the path of unix domain socket.
         case EINVAL:
-            setError(Socket::ConnectionRefusedError, ConnectionRefusedErrorString);
-            state = Socket::UnconnectedState;
+            d->setError(Socket::ConnectionRefusedError, SocketPrivate::ConnectionRefusedErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         case ETIMEDOUT:
-            setError(Socket::NetworkError, ConnectionTimeOutErrorString);
-            state = Socket::UnconnectedState;
+            d->setError(Socket::NetworkError, SocketPrivate::ConnectionTimeOutErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         case EHOSTUNREACH:
-            setError(Socket::NetworkError, HostUnreachableErrorString);
-            state = Socket::UnconnectedState;
+            d->setError(Socket::NetworkError, SocketPrivate::HostUnreachableErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         case ENETUNREACH:
-            setError(Socket::NetworkError, NetworkUnreachableErrorString);
-            state = Socket::UnconnectedState;
+            d->setError(Socket::NetworkError, SocketPrivate::NetworkUnreachableErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         case EADDRINUSE:
-            setError(Socket::NetworkError, AddressInuseErrorString);
-            state = Socket::UnconnectedState;
+            d->setError(Socket::NetworkError, SocketPrivate::AddressInuseErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         case EADDRNOTAVAIL:
-            setError(Socket::NetworkError, UnknownSocketErrorString);
-            state = Socket::UnconnectedState;
+            d->setError(Socket::NetworkError, SocketPrivate::UnknownSocketErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         case EACCES:
         case EPERM:
-            setError(Socket::SocketAccessError, AccessErrorString);
-            state = Socket::UnconnectedState;
+            d->setError(Socket::SocketAccessError, SocketPrivate::AccessErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         case EAFNOSUPPORT:
-            setError(Socket::UnsupportedSocketOperationError, UnknownSocketErrorString);
-            state = Socket::UnconnectedState;
+            d->setError(Socket::UnsupportedSocketOperationError, SocketPrivate::UnknownSocketErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         case EBADF:
         case EFAULT:
         case ENOTSOCK:
-            fd = -1;
-            setError(Socket::UnsupportedSocketOperationError, UnknownSocketErrorString);
-            state = Socket::UnconnectedState;
+            d->fd = -1;
+            d->setError(Socket::UnsupportedSocketOperationError, SocketPrivate::UnknownSocketErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         default:
             qtng_debug << t << strerror(t);
-            setError(Socket::UnknownSocketError, UnknownSocketErrorString);
-            state = Socket::UnconnectedState;
+            d->setError(Socket::UnknownSocketError, SocketPrivate::UnknownSocketErrorString);
+            d->state = Socket::UnconnectedState;
             return false;
         }
-        watcher.start();
+        io.flags = POLLOUT;
+        if (t == EAGAIN && d->isLocal()) {
+            // the backlog of unix domain server is full, and the socket is always writable.
+            Coroutine::msleep(1);
+            continue;
+        }
+        waitForIo(watcher, io);
     }
 }
 
+bool SocketPrivate::connect(const HostAddress &address, quint16 port)
+{
+    // if (!checkState()) { // not require NoError
+    if (fd == 0) {
+        return false;
+    }
+    if (state != Socket::UnconnectedState && state != Socket::BoundState && state != Socket::ConnectingState) {
+        return false;
+    }
+    qt_sockaddr aa;
+    QT_SOCKLEN_T sockAddrSize;
+    int t;
+    if (!setPortAndAddress(port, address, &aa, &t)) {
+        setError(Socket::UnsupportedSocketOperationError, ProtocolUnsupportedErrorString);
+        return false;
+    }
+    sockAddrSize = static_cast<QT_SOCKLEN_T>(t);
+#ifdef IPV6_V6ONLY
+    if (protocol == HostAddress::IPv6Protocol) {
+        int ipv6only = 1;
+        // default value of this socket option varies depending on unix variant (or system configuration on BSD), so
+        // always set it explicitly
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, static_cast<void *>(&ipv6only), sizeof(ipv6only));
+    }
+#endif
+    return connectTo(this, &aa.a, sockAddrSize);
+}
+
+bool SocketPrivate::bind(const QString &path)
+{
+    if (!checkState()) {
+        return false;
+    }
+    if (state != Socket::UnconnectedState) {
+        return false;
+    }
+    sockaddr_un aa;
+    QT_SOCKLEN_T sockAddrSize;
+    if (!isLocal()) {
+        setError(Socket::UnsupportedSocketOperationError, OperationUnsupportedErrorString);
+        return false;
+    }
+    if (!qt_socket_setLocalPath(path, &aa, &sockAddrSize)) {
+        setError(Socket::SocketAddressNotAvailableError, AddressNotAvailableErrorString);
+        return false;
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&aa), sockAddrSize) < 0) {
+        switch (errno) {
+        case EADDRINUSE:
+            setError(Socket::AddressInUseError, AddressInuseErrorString);
+            break;
+        case EACCES:
+        case EPERM:
+        case EROFS:
+            setError(Socket::SocketAccessError, AccessErrorString);
+            break;
+        case ENOENT:
+        case ENOTDIR:
+            setError(Socket::SocketAddressNotAvailableError, AddressNotAvailableErrorString);
+            break;
+        default:
+            setError(Socket::UnknownSocketError, UnknownSocketErrorString);
+            break;
+        }
+        return false;
+    }
+    state = Socket::BoundState;
+    localPath = path;
+    return true;
+}
+
+bool SocketPrivate::connect(const QString &path)
+{
+    if (fd == 0) {
+        return false;
+    }
+    if (state != Socket::UnconnectedState && state != Socket::BoundState && state != Socket::ConnectingState) {
+        return false;
+    }
+    sockaddr_un aa;
+    QT_SOCKLEN_T sockAddrSize;
+    if (!isLocal()) {
+        setError(Socket::UnsupportedSocketOperationError, OperationUnsupportedErrorString);
+        return false;
+    }
+    if (!qt_socket_setLocalPath(path, &aa, &sockAddrSize)) {
+        setError(Socket::SocketAddressNotAvailableError, AddressNotAvailableErrorString);
+        return false;
+    }
+    if (!connectTo(this, reinterpret_cast<sockaddr *>(&aa), sockAddrSize)) {
+        return false;
+    }
+    peerPath = path;
+    return true;
+}
+
+#ifdef Q_OS_LINUX
+// drop the buffers which the kernel has sent, returns true if the kernel copied them instead of pinning.
+static bool reapZeroCopyCompletions(int fd, QList<SocketPrivate::ZeroCopyBuffer> *buffers)
+{
+    bool copied = false;
+    while (!buffers->isEmpty()) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t r;
+        do {
+            r = ::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        } while (r < 0 && errno == EINTR);
+        if (r < 0) {
+            break;  // EAGAIN if no completion comes.
+        }
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                copied = true;
+            }
+            // the sends in [ee_info, ee_data] are done, tcp completes them in order.
+            while (!buffers->isEmpty() && static_cast<qint32>(buffers->first().sequence - err.ee_data) <= 0) {
+                buffers->removeFirst();
+            }
+        }
+    }
+    return copied;
+}
+
+// the kernel still reads the buffers of a closed socket until they are acked, and malloc() may reuse their memory if
+// they are freed. so the fd is kept open with the buffers till all completions come, or reset after a while, which
+// discards the unsent data.
+struct ZeroCopyCloser
+{
+    enum { IntervalMsecs = 10, TimeoutMsecs = 30 * 1000 };
+    void operator()();
+    QList<SocketPrivate::ZeroCopyBuffer> buffers;
+    qint64 deadline;
+    int fd;
+};
+
+void ZeroCopyCloser::operator()()
+{
+    reapZeroCopyCompletions(fd, &buffers);
+    EventLoopCoroutine *eventLoop = EventLoopCoroutine::get();
+    if (!buffers.isEmpty() && eventLoop->now() < deadline) {
+        eventLoop->callLaterCoarse(IntervalMsecs, makeFunctor(ZeroCopyCloser(*this)));
+        return;
+    }
+    if (!buffers.isEmpty()) {
+        struct linger l;
+        l.l_onoff = 1;
+        l.l_linger = 0;
+        ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+    }
+    ::close(fd);
+}
+#endif
+
 void SocketPrivate::close()
 {
     if (fd > 0) {
         // TODO flush socket.
         ::shutdown(fd, SHUT_RDWR);
+#ifdef Q_OS_LINUX
+        reapZeroCopy();
+        if (!zeroCopyBuffers.isEmpty()) {
+            ZeroCopyCloser closer;
+            closer.buffers = zeroCopyBuffers;
+            closer.fd = fd;
+            EventLoopCoroutine *eventLoop = EventLoopCoroutine::get();
+            closer.deadline = eventLoop->now() + ZeroCopyCloser::TimeoutMsecs;
+            eventLoop->callLaterCoarse(ZeroCopyCloser::IntervalMsecs, makeFunctor(std::move(closer)));
+            zeroCopyBuffers.clear();
+        } else {
+            ::close(fd);
+        }
+#else
         ::close(fd);
+#endif
         EventLoopCoroutine::get()->triggerIoWatchers(fd);
         fd = -1;
     }
@@ -421,20 +757,36 @@ void SocketPrivate::close()
     localPort = 0;
     peerAddress.clear();
     peerPort = 0;
+    localPath.clear();
+    peerPath.clear();
 }
 
 void SocketPrivate::abort()
 {
     if (fd > 0) {
+#ifdef Q_OS_LINUX
+        if (!zeroCopyBuffers.isEmpty()) {
+            // reset the connection, so the kernel discards the unsent data and never reads the buffers again.
+            struct linger l;
+            l.l_onoff = 1;
+            l.l_linger = 0;
+            ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        }
+#endif
         ::close(fd);
         EventLoopCoroutine::get()->triggerIoWatchers(fd);
         fd = -1;
     }
+#ifdef Q_OS_LINUX
+    zeroCopyBuffers.clear();
+#endif
     state = Socket::UnconnectedState;
     localAddress.clear();
     localPort = 0;
     peerAddress.clear();
     peerPort = 0;
+    localPath.clear();
+    peerPath.clear();
 }
 
 bool SocketPrivate::listen(int backlog)
@@ -460,6 +812,29 @@ bool SocketPrivate::listen(int backlog)
     return true;
 }
 
+static bool fetchLocalParameters(SocketPrivate *d)
+{
+    sockaddr_un aa;
+    QT_SOCKLEN_T sockAddrSize = sizeof(aa);
+    d->protocol = HostAddress::UnknownNetworkLayerProtocol;
+    if (::getsockname(d->fd, reinterpret_cast<sockaddr *>(&aa), &sockAddrSize) == 0) {
+        d->localPath = qt_socket_getLocalPath(&aa, sockAddrSize);
+    }
+    sockAddrSize = sizeof(aa);
+    if (::getpeername(d->fd, reinterpret_cast<sockaddr *>(&aa), &sockAddrSize) == 0) {
+        const QString &peerPath = qt_socket_getLocalPath(&aa, sockAddrSize);
+        if (!peerPath.isEmpty()) {
+            d->peerPath = peerPath;  // keep the path connected to, the peer may be unnamed.
+        }
+    }
+    int value = 0;
+    socklen_t valueSize = sizeof(int);
+    if (::getsockopt(d->fd, SOL_SOCKET, SO_TYPE, &value, &valueSize) == 0) {
+        d->type = (value == SOCK_STREAM) ? Socket::LocalSocket : Socket::LocalDatagramSocket;
+    }
+    return true;
+}
+
 bool SocketPrivate::fetchConnectionParameters()
 {
     localPort = 0;
@@ -476,6 +851,9 @@ bool SocketPrivate::fetchConnectionParameters()
     // Determine local address
     memset(&sa, 0, sizeof(sa));
     if (::getsockname(fd, &sa.a, &sockAddrSize) == 0) {
+        if (sa.a.sa_family == AF_UNIX) {
+            return fetchLocalParameters(this);
+        }
         qt_socket_getPortAndAddress(&sa, &localPort, &localAddress);
 
         // Determine protocol family
@@ -505,6 +883,14 @@ bool SocketPrivate::fetchConnectionParameters()
     if (::getsockopt(fd, SOL_SOCKET, SO_TYPE, &value, &valueSize) == 0) {
         if (value == SOCK_STREAM) {
             type = Socket::TcpSocket;
+#ifdef SO_ACCEPTCONN
+            // such as the listeners inherited from a supervisor process.
+            int listening = 0;
+            valueSize = sizeof(int);
+            if (::getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &valueSize) == 0 && listening) {
+                state = Socket::ListeningState;
+            }
+#endif
         } else if (value == SOCK_DGRAM) {
             type = Socket::UdpSocket;
             state = Socket::UnconnectedState;
@@ -521,6 +907,7 @@ qint32 SocketPrivate::recv(char *data, qint32 size, bool all)
         return -1;
     }
     ScopedIoWatcher watcher(EventLoopCoroutine::Read, fd);
+    CompletionIo io(CompletionIo::Recv, fd);
     qint32 total = 0;
     while (total < size) {
         if (!checkState()) {
@@ -528,9 +915,13 @@ qint32 SocketPrivate::recv(char *data, qint32 size, bool all)
             return total == 0 ? -1 : total;
         }
         ssize_t r = 0;
-        do {
-            r = ::recv(fd, data + total, static_cast<size_t>(size - total), 0);
-        } while (r < 0 && errno == EINTR);
+        if (io.hasResult) {
+            r = takeIoResult(io);
+        } else {
+            do {
+                r = ::recv(fd, data + total, static_cast<size_t>(size - total), 0);
+            } while (r < 0 && errno == EINTR);
+        }
 
         if (r < 0) {
             int e = errno;
@@ -544,7 +935,7 @@ qint32 SocketPrivate::recv(char *data, qint32 size, bool all)
 #if defined(Q_OS_VXWORKS)
             case ESHUTDOWN:
 #endif
-                if (type == Socket::TcpSocket) {
+                if (isStream()) {
                     setError(Socket::RemoteHostClosedError, RemoteHostClosedErrorString);
                     abort();
                 }
@@ -557,7 +948,7 @@ qint32 SocketPrivate::recv(char *data, qint32 size, bool all)
                 abort();
                 return total == 0 ? -1 : total;
             }
-        } else if (r == 0 && type == Socket::TcpSocket) {
+        } else if (r == 0 && isStream()) {
             setError(Socket::RemoteHostClosedError, RemoteHostClosedErrorString);
             abort();
             return total;
@@ -569,92 +960,457 @@ qint32 SocketPrivate::recv(char *data, qint32 size, bool all)
                 return total;
             }
         }
-        watcher.start();
+        io.data = data + total;
+        io.size = static_cast<size_t>(size - total);
+        io.flags = 0;
+        waitForIo(watcher, io);
+    }
+    return total;
+}
+
+// openbsd do not support MSG_MORE?
+#ifndef MSG_MORE
+#  define MSG_MORE 0
+#endif
+
+qint32 SocketPrivate::send(const char *data, qint32 size, bool all)
+{
+    if (!checkState() || size <= 0) {
+        return -1;
+    }
+    qint32 sent = 0;
+    ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    CompletionIo io(CompletionIo::Send, fd);
+    // TODO UDP socket may send zero length packet
+    while (sent < size) {
+        if (!checkState()) {
+            return sent;
+        }
+        int flags = all && ((size - sent) > 1024 * 4) ? (MSG_MORE | MSG_NOSIGNAL) : MSG_NOSIGNAL;
+        ssize_t w;
+        if (io.hasResult) {
+            w = takeIoResult(io);
+        } else {
+            do {
+                w = ::send(fd, data + sent, static_cast<size_t>(size - sent), flags);
+            } while (w < 0 && errno == EINTR);
+        }
+        if (w > 0) {
+            if (!all) {
+                return static_cast<qint32>(w);
+            } else {
+                sent += w;
+                continue;
+            }
+        } else if (w == 0 && isStream()) {
+            setError(Socket::RemoteHostClosedError, RemoteHostClosedErrorString);
+            abort();
+            return sent;
+        } else {  // w < 0 || (w == 0 && !isStream())
+            int e = errno;
+            switch (e) {
+#if EWOULDBLOCK - 0 && EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+#endif
+            case EAGAIN:
+            case EINPROGRESS:  // the SYN of TCP_FASTOPEN_CONNECT is sent without cookie, wait for the handshake.
+                if (sent > 0 && !all) {
+                    return sent;
+                }
+                break;
+            case EACCES:
+                setError(Socket::SocketAccessError, AccessErrorString);
+                abort();
+                return -1;
+            case EBADF:
+            case EFAULT:
+            case EINVAL:
+            case ENOTCONN:
+            case ENOTSOCK:
+                setError(Socket::UnsupportedSocketOperationError, InvalidSocketErrorString);
+                abort();
+                return -1;
+            case EMSGSIZE:
+            case ENOBUFS:
+                if (type != Socket::UdpSocket) {
+                    qtng_warning << "not a udp socket!";
+                }
+                setError(Socket::DatagramTooLargeError, DatagramTooLargeErrorString);
+                return -1;
+            case ENOMEM:
+                setError(Socket::OutOfMemoryError, OutOfMemoryErrorString);
+                abort();
+                return -1;
+            case EPIPE:
+            case ECONNRESET:
+                setError(Socket::RemoteHostClosedError, RemoteHostClosedErrorString);
+                abort();
+                return -1;
+            default:
+                setError(Socket::UnknownSocketError, UnknownSocketErrorString);
+                abort();
+                return -1;
+            }
+        }
+        io.data = const_cast<char *>(data + sent);
+        io.size = static_cast<size_t>(size - sent);
+        io.flags = flags;
+        waitForIo(watcher, io);
+    }
+    return sent;
+}
+
+#ifdef Q_OS_LINUX
+// the kernel copies small buffers faster than it pins and releases their pages.
+static const qint32 ZeroCopyThreshold = 32 * 1024;
+
+// the kernel reads the pages of data while transmitting, so the data is kept until the completion of its last send()
+// comes from the error queue. if the kernel copies anyway, such as to loopback, zero copy is disabled for this socket.
+qint32 SocketPrivate::sendZeroCopy(const QByteArray &data)
+{
+    if (!checkState() || data.isEmpty()) {
+        return -1;
+    }
+    reapZeroCopy();
+    const qint32 size = data.size();
+    if (!zeroCopy || size < ZeroCopyThreshold) {
+        return send(data.constData(), size, true);
+    }
+    qint32 sent = 0;
+    ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    while (sent < size) {
+        if (!checkState()) {
+            return sent;
+        }
+        ssize_t w;
+        do {
+            w = ::send(fd, data.constData() + sent, static_cast<size_t>(size - sent), MSG_ZEROCOPY | MSG_NOSIGNAL);
+        } while (w < 0 && errno == EINTR);
+        if (w > 0) {
+            sent += static_cast<qint32>(w);
+            // every successful send() takes a sequence number, even a partial one.
+            if (!zeroCopyBuffers.isEmpty() && zeroCopyBuffers.last().data.constData() == data.constData()) {
+                zeroCopyBuffers.last().sequence = zeroCopySequence++;
+            } else {
+                ZeroCopyBuffer buffer;
+                buffer.sequence = zeroCopySequence++;
+                buffer.data = data;
+                zeroCopyBuffers.append(buffer);
+            }
+        } else if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            reapZeroCopy();
+            watcher.start();
+        } else {
+            // ENOBUFS if the pinned pages are over the limit. send() copies the rest, and maps the other errors.
+            qint32 r = send(data.constData() + sent, size - sent, true);
+            if (r < 0) {
+                return sent > 0 ? sent : -1;
+            }
+            return sent + r;
+        }
+    }
+    return sent;
+}
+
+void SocketPrivate::reapZeroCopy()
+{
+    if (reapZeroCopyCompletions(fd, &zeroCopyBuffers)) {
+        zeroCopy = false;
+    }
+}
+#endif
+
+// send all buffers with sendmsg(), so headers are not copied into the payload.
+qint32 SocketPrivate::sendv(const QList<QByteArray> &buffers)
+{
+    if (!checkState()) {
+        return -1;
+    }
+    QVarLengthArray<struct iovec, 16> vecs;
+    qint64 total = 0;
+    for (const QByteArray &buffer : buffers) {
+        if (!buffer.isEmpty()) {
+            struct iovec vec;
+            vec.iov_base = const_cast<char *>(buffer.constData());
+            vec.iov_len = static_cast<size_t>(buffer.size());
+            vecs.append(vec);
+            total += buffer.size();
+        }
+    }
+    if (vecs.isEmpty()) {
+        return 0;  // nothing to send, as SocketLike::sendv().
+    } else if (total > INT_MAX) {
+        return -1;
+    }
+    qint32 sent = 0;
+    int first = 0;
+    ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    while (first < vecs.size()) {
+        if (!checkState()) {
+            return sent;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vecs.data() + first;
+        msg.msg_iovlen = qMin(vecs.size() - first, 64);
+        ssize_t w;
+        do {
+            w = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        } while (w < 0 && errno == EINTR);
+        if (w > 0) {
+            sent += static_cast<qint32>(w);
+            while (w > 0) {
+                struct iovec &vec = vecs[first];
+                if (static_cast<size_t>(w) >= vec.iov_len) {
+                    w -= static_cast<ssize_t>(vec.iov_len);
+                    ++first;
+                } else {
+                    vec.iov_base = static_cast<char *>(vec.iov_base) + w;
+                    vec.iov_len -= static_cast<size_t>(w);
+                    w = 0;
+                }
+            }
+        } else if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watcher.start();
+        } else {
+            // send() maps the error of current buffer and aborts the socket the same way.
+            const struct iovec &vec = vecs[first];
+            qint32 r = send(static_cast<const char *>(vec.iov_base), static_cast<qint32>(vec.iov_len), true);
+            if (r < 0) {
+                return sent > 0 ? sent : -1;
+            }
+            sent += r;
+            if (static_cast<size_t>(r) < vec.iov_len) {
+                return sent;
+            }
+            ++first;
+        }
+    }
+    return sent;
+}
+
+// copy the file to the socket inside the kernel by sendfile(), or by pread() and send() if it is not available.
+qint64 SocketPrivate::sendfile(QFile *file, qint64 offset, qint64 count)
+{
+    if (!checkState() || !file || offset < 0) {
+        return -1;
+    }
+    const int fileFd = file->handle();
+    if (fileFd < 0) {
+        setError(Socket::UnsupportedSocketOperationError, OperationUnsupportedErrorString);
+        return -1;
+    }
+    if (count < 0) {
+        count = qMax<qint64>(0, file->size() - offset);
+    }
+    qint64 total = 0;
+#ifdef Q_OS_LINUX
+    ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    while (total < count) {
+        if (!checkState()) {
+            return total > 0 ? total : -1;
+        }
+        off_t pos = static_cast<off_t>(offset + total);
+        const size_t chunk = static_cast<size_t>(qMin<qint64>(count - total, 0x7ffff000));
+        ssize_t w;
+        do {
+            w = ::sendfile(fd, fileFd, &pos, chunk);
+        } while (w < 0 && errno == EINTR);
+        if (w > 0) {
+            total += w;
+            continue;
+        } else if (w == 0) {  // the file is shorter than expected.
+            return total;
+        }
+        int e = errno;
+        if (e == EAGAIN || e == EWOULDBLOCK) {
+            watcher.start();
+            continue;
+        } else if (e == EINVAL || e == ENOSYS || e == EOPNOTSUPP) {
+            break;  // the file can not be mmap()ed, copy it in user space.
+        } else if (e == EPIPE || e == ECONNRESET) {
+            setError(Socket::RemoteHostClosedError, RemoteHostClosedErrorString);
+        } else {
+            setError(Socket::UnknownSocketError, UnknownSocketErrorString);
+        }
+        abort();
+        // the bytes already sent are reported, as send(all = true) does.
+        return total > 0 ? total : -1;
+    }
+#endif
+    QByteArray buf(1024 * 64, Qt::Uninitialized);
+    while (total < count) {
+        ssize_t r;
+        do {
+            r = ::pread(fileFd, buf.data(), static_cast<size_t>(qMin<qint64>(count - total, buf.size())),
+                        static_cast<off_t>(offset + total));
+        } while (r < 0 && errno == EINTR);
+        if (r < 0) {
+            if (total == 0) {
+                setError(Socket::UnknownSocketError, UnknownSocketErrorString);
+                return -1;
+            }
+            return total;
+        } else if (r == 0) {
+            return total;
+        }
+        qint32 sent = send(buf.constData(), static_cast<qint32>(r), true);
+        if (sent != r) {
+            return sent < 0 && total == 0 ? -1 : total + qMax(0, sent);
+        }
+        total += r;
     }
     return total;
 }
 
-// openbsd do not support MSG_MORE?
-#ifndef MSG_MORE
-#  define MSG_MORE 0
-#endif
-
-qint32 SocketPrivate::send(const char *data, qint32 size, bool all)
+// the descriptors go with the first byte, the rest of stream is sent by send().
+qint32 SocketPrivate::sendfds(const char *data, qint32 size, const QList<qintptr> &fds)
 {
     if (!checkState() || size <= 0) {
         return -1;
     }
-    qint32 sent = 0;
+    if (!isLocal()) {
+        setError(Socket::UnsupportedSocketOperationError, OperationUnsupportedErrorString);
+        return -1;
+    }
+    if (fds.isEmpty()) {
+        return send(data, size, true);
+    }
+    const size_t fdsSize = sizeof(int) * static_cast<size_t>(fds.size());
+    QVarLengthArray<char, 256> control(static_cast<int>(CMSG_SPACE(fdsSize)));
+    memset(control.data(), 0, static_cast<size_t>(control.size()));
+    struct iovec vec;
+    vec.iov_base = const_cast<char *>(data);
+    vec.iov_len = static_cast<size_t>(size);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &vec;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = static_cast<size_t>(control.size());
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fdsSize);
+    for (int i = 0; i < fds.size(); ++i) {
+        int descriptor = static_cast<int>(fds.at(i));
+        memcpy(CMSG_DATA(cmsg) + sizeof(int) * static_cast<size_t>(i), &descriptor, sizeof(int));
+    }
+
     ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
-    // TODO UDP socket may send zero length packet
-    while (sent < size) {
+    while (true) {
         if (!checkState()) {
-            return sent;
+            return -1;
         }
         ssize_t w;
         do {
-            w = ::send(fd, data + sent, static_cast<size_t>(size - sent),
-                       all && ((size - sent) > 1024 * 4) ? (MSG_MORE | MSG_NOSIGNAL) : MSG_NOSIGNAL);
+            w = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
         } while (w < 0 && errno == EINTR);
-        if (w > 0) {
-            if (!all) {
-                return static_cast<qint32>(w);
-            } else {
-                sent += w;
-                continue;
+        if (w >= 0) {
+            if (w < size && type == Socket::LocalSocket) {
+                qint32 r = send(data + w, size - static_cast<qint32>(w), true);
+                return r < 0 ? static_cast<qint32>(w) : static_cast<qint32>(w) + r;
             }
-        } else if (w == 0 && type == Socket::TcpSocket) {
+            return static_cast<qint32>(w);
+        }
+        switch (errno) {
+#if EWOULDBLOCK - 0 && EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+        case EAGAIN:
+            watcher.start();
+            break;
+        case EPIPE:
+        case ECONNRESET:
             setError(Socket::RemoteHostClosedError, RemoteHostClosedErrorString);
             abort();
-            return sent;
-        } else {  // w < 0 || (w == 0 && type != Socket::TcpSocket)
-            int e = errno;
-            switch (e) {
-#if EWOULDBLOCK - 0 && EWOULDBLOCK != EAGAIN
-            case EWOULDBLOCK:
+            return -1;
+        case EMSGSIZE:
+            setError(Socket::DatagramTooLargeError, DatagramTooLargeErrorString);
+            return -1;
+        case ENOBUFS:
+        case ENOMEM:
+            setError(Socket::SocketResourceError, ResourceErrorString);
+            return -1;
+        default:  // EBADF if some descriptors are invalid, and ETOOMANYREFS.
+            setError(Socket::UnsupportedSocketOperationError, InvalidSocketErrorString);
+            return -1;
+        }
+    }
+}
+
+qint32 SocketPrivate::recvfds(char *data, qint32 size, QList<qintptr> *fds)
+{
+    if (!checkState() || size <= 0 || !fds) {
+        return -1;
+    }
+    if (!isLocal()) {
+        setError(Socket::UnsupportedSocketOperationError, OperationUnsupportedErrorString);
+        return -1;
+    }
+    const int MaxDescriptors = 64;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * MaxDescriptors)];
+        struct cmsghdr align;
+    } control;
+    int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
 #endif
-            case EAGAIN:
-                if (sent > 0 && !all) {
-                    return sent;
-                }
-                break;
-            case EACCES:
-                setError(Socket::SocketAccessError, AccessErrorString);
-                abort();
-                return -1;
-            case EBADF:
-            case EFAULT:
-            case EINVAL:
-            case ENOTCONN:
-            case ENOTSOCK:
-                setError(Socket::UnsupportedSocketOperationError, InvalidSocketErrorString);
-                abort();
-                return -1;
-            case EMSGSIZE:
-            case ENOBUFS:
-                if (type != Socket::UdpSocket) {
-                    qtng_warning << "not a udp socket!";
-                }
-                setError(Socket::DatagramTooLargeError, DatagramTooLargeErrorString);
-                return -1;
-            case ENOMEM:
-                setError(Socket::OutOfMemoryError, OutOfMemoryErrorString);
-                abort();
-                return -1;
-            case EPIPE:
-            case ECONNRESET:
+
+    ScopedIoWatcher watcher(EventLoopCoroutine::Read, fd);
+    while (true) {
+        if (!checkState()) {
+            return -1;
+        }
+        struct iovec vec;
+        vec.iov_base = data;
+        vec.iov_len = static_cast<size_t>(size);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &vec;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ssize_t r;
+        do {
+            r = ::recvmsg(fd, &msg, flags);
+        } while (r < 0 && errno == EINTR);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                watcher.start();
+                continue;
+            } else if (errno == ECONNRESET) {
                 setError(Socket::RemoteHostClosedError, RemoteHostClosedErrorString);
                 abort();
-                return -1;
-            default:
-                setError(Socket::UnknownSocketError, UnknownSocketErrorString);
-                abort();
-                return -1;
+            } else {
+                setError(Socket::NetworkError, ReadErrorString);
             }
+            return -1;
         }
-        watcher.start();
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i) {
+                int descriptor;
+                memcpy(&descriptor, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(int));
+#ifndef MSG_CMSG_CLOEXEC
+                ::fcntl(descriptor, F_SETFD, FD_CLOEXEC);
+#endif
+                fds->append(descriptor);
+            }
+        }
+        if (msg.msg_flags & MSG_CTRUNC) {
+            qtng_warning << "some file descriptors are dropped, at most" << MaxDescriptors << "are received at once.";
+        }
+        if (r == 0 && type == Socket::LocalSocket) {
+            setError(Socket::RemoteHostClosedError, RemoteHostClosedErrorString);
+            abort();
+        }
+        return static_cast<qint32>(r);
     }
-    return sent;
 }
 
 qint32 SocketPrivate::recvfrom(char *data, qint32 maxSize, HostAddress *addr, quint16 *port)
@@ -681,14 +1437,19 @@ qint32 SocketPrivate::recvfrom(char *data, qint32 maxSize, HostAddress *addr, qu
 
     ssize_t recvResult = 0;
     ScopedIoWatcher watcher(EventLoopCoroutine::Read, fd);
+    CompletionIo io(CompletionIo::RecvMsg, fd);
     while (true) {
         if (!checkState()) {
             setError(Socket::SocketAccessError, AccessErrorString);
             return -1;
         }
-        do {
-            recvResult = ::recvmsg(fd, &msg, 0);
-        } while (recvResult == -1 && errno == EINTR);
+        if (io.hasResult) {
+            recvResult = takeIoResult(io);
+        } else {
+            do {
+                recvResult = ::recvmsg(fd, &msg, 0);
+            } while (recvResult == -1 && errno == EINTR);
+        }
 
         if (recvResult < 0) {
             int e = errno;
@@ -734,7 +1495,10 @@ qint32 SocketPrivate::recvfrom(char *data, qint32 maxSize, HostAddress *addr, qu
             // return qint64(maxSize ? recvResult : recvResult == -1 ? -1 : 0);
             return static_cast<qint32>(recvResult);
         }
-        watcher.start();
+        msg.msg_namelen = sizeof(aa);
+        io.data = &msg;
+        io.flags = 0;
+        waitForIo(watcher, io);
     }
 }
 
@@ -766,13 +1530,18 @@ qint32 SocketPrivate::sendto(const char *data, qint32 size, const HostAddress &a
 
     ssize_t sentBytes = 0;
     ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    CompletionIo io(CompletionIo::SendMsg, fd);
     while (true) {
         if (!checkState()) {
             return -1;
         }
-        do {
-            sentBytes = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
-        } while (sentBytes == -1 && error == EINTR);
+        if (io.hasResult) {
+            sentBytes = takeIoResult(io);
+        } else {
+            do {
+                sentBytes = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+            } while (sentBytes == -1 && errno == EINTR);
+        }
 
         if (sentBytes < 0) {
             int e = errno;
@@ -817,8 +1586,254 @@ qint32 SocketPrivate::sendto(const char *data, qint32 size, const HostAddress &a
             }
             return static_cast<qint32>(sentBytes);
         }
-        watcher.start();
+        io.data = &msg;
+        io.flags = MSG_NOSIGNAL;
+        waitForIo(watcher, io);
+    }
+}
+
+qint32 SocketPrivate::recvfromMany(char *buffer, qint32 datagramSize, qint32 count, qint32 *sizes,
+                                   HostAddress *addrs, quint16 *ports)
+{
+    if (!checkState() || datagramSize <= 0 || count <= 0) {
+        return -1;
+    }
+#if defined(Q_OS_LINUX) && !defined(Q_OS_ANDROID)
+    const qint32 n = qMin(count, MaxDatagramsPerCall);
+    QVarLengthArray<struct mmsghdr, MaxDatagramsPerCall> msgs(n);
+    QVarLengthArray<struct iovec, MaxDatagramsPerCall> vecs(n);
+    QVarLengthArray<qt_sockaddr, MaxDatagramsPerCall> names(n);
+    ScopedIoWatcher watcher(EventLoopCoroutine::Read, fd);
+    while (true) {
+        if (!checkState()) {
+            setError(Socket::SocketAccessError, AccessErrorString);
+            return -1;
+        }
+        memset(msgs.data(), 0, sizeof(struct mmsghdr) * static_cast<size_t>(n));
+        for (qint32 i = 0; i < n; ++i) {
+            vecs[i].iov_base = buffer + i * datagramSize;
+            vecs[i].iov_len = static_cast<size_t>(datagramSize);
+            msgs[i].msg_hdr.msg_iov = &vecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &names[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(qt_sockaddr);
+        }
+        int received;
+        do {
+            received = ::recvmmsg(fd, msgs.data(), static_cast<unsigned int>(n), MSG_DONTWAIT | MSG_TRUNC, nullptr);
+        } while (received == -1 && errno == EINTR);
+        if (received > 0) {
+            for (int i = 0; i < received; ++i) {
+                sizes[i] = static_cast<qint32>(msgs[i].msg_len);
+                qt_socket_getPortAndAddress(&names[i], &ports[i], &addrs[i]);
+            }
+            return received;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watcher.start();
+            continue;
+        }
+        // ENOSYS or a real error, the plain path reports it the usual way.
+        break;
+    }
+#endif
+    qint32 len = recvfrom(buffer, datagramSize, &addrs[0], &ports[0]);
+    if (len < 0) {
+        return -1;
+    }
+    sizes[0] = len;
+    return 1;
+}
+
+#if defined(Q_OS_LINUX) && defined(UDP_SEGMENT)
+// how many datagrams from first can be sent as one gso buffer, they must have the same size but the last one.
+static int countSegments(const QList<QByteArray> &datagrams, int first, int last, int *total)
+{
+    const int segmentSize = datagrams.at(first).size();
+    int n = 0;
+    *total = 0;
+    for (int i = first; i < last && n < MaxDatagramsPerCall; ++i) {
+        const int size = datagrams.at(i).size();
+        if (size > segmentSize || size == 0 || *total + size > 65000) {
+            break;
+        }
+        *total += size;
+        ++n;
+        if (size < segmentSize) {
+            break;
+        }
+    }
+    return n;
+}
+#endif
+
+qint32 SocketPrivate::sendtoMany(const QList<QByteArray> &datagrams, const HostAddress &addr, quint16 port)
+{
+    if (!checkState()) {
+        return -1;
+    }
+    const int total = datagrams.size();
+    int sent = 0;
+#if defined(Q_OS_LINUX) && !defined(Q_OS_ANDROID)
+    qt_sockaddr aa;
+    int t;
+    memset(&aa, 0, sizeof(aa));
+    if (!setPortAndAddress(port, addr, &aa, &t)) {
+        setError(Socket::UnsupportedSocketOperationError, ProtocolUnsupportedErrorString);
+        return -1;
+    }
+    const QT_SOCKLEN_T len = static_cast<QT_SOCKLEN_T>(t);
+    ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    QVarLengthArray<struct mmsghdr, MaxDatagramsPerCall> msgs(MaxDatagramsPerCall);
+    QVarLengthArray<struct iovec, MaxDatagramsPerCall> vecs(MaxDatagramsPerCall);
+    while (sent < total) {
+        if (!checkState()) {
+            return sent > 0 ? sent : -1;
+        }
+        int result;
+#  ifdef UDP_SEGMENT
+        int gsoBytes = 0;
+        const int segments = udpSegmentUnsupported ? 0 : countSegments(datagrams, sent, total, &gsoBytes);
+        if (segments >= 2) {
+            // one sendmsg() with UDP_SEGMENT, the kernel splits it to datagrams of the first size.
+            union {
+                char buf[CMSG_SPACE(sizeof(quint16))];
+                struct cmsghdr align;
+            } control;
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            memset(&control, 0, sizeof(control));
+            for (int i = 0; i < segments; ++i) {
+                const QByteArray &datagram = datagrams.at(sent + i);
+                vecs[i].iov_base = const_cast<char *>(datagram.constData());
+                vecs[i].iov_len = static_cast<size_t>(datagram.size());
+            }
+            msg.msg_name = &aa.a;
+            msg.msg_namelen = len;
+            msg.msg_iov = vecs.data();
+            msg.msg_iovlen = static_cast<size_t>(segments);
+            msg.msg_control = control.buf;
+            msg.msg_controllen = sizeof(control.buf);
+            struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = IPPROTO_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(quint16));
+            const quint16 segmentSize = static_cast<quint16>(datagrams.at(sent).size());
+            memcpy(CMSG_DATA(cm), &segmentSize, sizeof(segmentSize));
+            ssize_t bytes;
+            do {
+                bytes = ::sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+            } while (bytes == -1 && errno == EINTR);
+            if (bytes >= 0) {
+                sent += segments;
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                watcher.start();
+                continue;
+            }
+            // the kernel or the nic does not support gso, never try again.
+            qtng_debug << "UDP_SEGMENT is not supported, fall back to sendmmsg().";
+            udpSegmentUnsupported = true;
+        }
+#  endif
+        const int n = qMin(total - sent, static_cast<int>(MaxDatagramsPerCall));
+        memset(msgs.data(), 0, sizeof(struct mmsghdr) * static_cast<size_t>(n));
+        for (int i = 0; i < n; ++i) {
+            const QByteArray &datagram = datagrams.at(sent + i);
+            vecs[i].iov_base = const_cast<char *>(datagram.constData());
+            vecs[i].iov_len = static_cast<size_t>(datagram.size());
+            msgs[i].msg_hdr.msg_iov = &vecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &aa.a;
+            msgs[i].msg_hdr.msg_namelen = len;
+        }
+        do {
+            result = ::sendmmsg(fd, msgs.data(), static_cast<unsigned int>(n), MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (result == -1 && errno == EINTR);
+        if (result > 0) {
+            sent += result;
+            continue;
+        }
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watcher.start();
+            continue;
+        }
+        // ENOSYS or a real error, let sendto() report it.
+        break;
+    }
+    if (sent > 0 && type == Socket::UdpSocket && !localPort && localAddress.isNull()) {
+        fetchConnectionParameters();
+    }
+#endif
+    for (; sent < total; ++sent) {
+        const QByteArray &datagram = datagrams.at(sent);
+        if (sendto(datagram.constData(), datagram.size(), addr, port) != datagram.size()) {
+            return sent > 0 ? sent : -1;
+        }
+    }
+    return sent;
+}
+
+qint32 SocketPrivate::sendtoMany(const QList<QByteArray> &datagrams, const HostAddress *addrs, const quint16 *ports)
+{
+    if (!checkState()) {
+        return -1;
+    }
+    const int total = datagrams.size();
+    int sent = 0;
+#if defined(Q_OS_LINUX) && !defined(Q_OS_ANDROID)
+    ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    QVarLengthArray<struct mmsghdr, MaxDatagramsPerCall> msgs(MaxDatagramsPerCall);
+    QVarLengthArray<struct iovec, MaxDatagramsPerCall> vecs(MaxDatagramsPerCall);
+    QVarLengthArray<qt_sockaddr, MaxDatagramsPerCall> names(MaxDatagramsPerCall);
+    while (sent < total) {
+        if (!checkState()) {
+            return sent > 0 ? sent : -1;
+        }
+        const int n = qMin(total - sent, static_cast<int>(MaxDatagramsPerCall));
+        memset(msgs.data(), 0, sizeof(struct mmsghdr) * static_cast<size_t>(n));
+        memset(names.data(), 0, sizeof(qt_sockaddr) * static_cast<size_t>(n));
+        for (int i = 0; i < n; ++i) {
+            int t;
+            if (!setPortAndAddress(ports[sent + i], addrs[sent + i], &names[i], &t)) {
+                setError(Socket::UnsupportedSocketOperationError, ProtocolUnsupportedErrorString);
+                return sent > 0 ? sent : -1;
+            }
+            const QByteArray &datagram = datagrams.at(sent + i);
+            vecs[i].iov_base = const_cast<char *>(datagram.constData());
+            vecs[i].iov_len = static_cast<size_t>(datagram.size());
+            msgs[i].msg_hdr.msg_iov = &vecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &names[i].a;
+            msgs[i].msg_hdr.msg_namelen = static_cast<QT_SOCKLEN_T>(t);
+        }
+        int result;
+        do {
+            result = ::sendmmsg(fd, msgs.data(), static_cast<unsigned int>(n), MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (result == -1 && errno == EINTR);
+        if (result > 0) {
+            sent += result;
+            continue;
+        }
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watcher.start();
+            continue;
+        }
+        // ENOSYS or a real error, let sendto() report it.
+        break;
+    }
+    if (sent > 0 && type == Socket::UdpSocket && !localPort && localAddress.isNull()) {
+        fetchConnectionParameters();
+    }
+#endif
+    for (; sent < total; ++sent) {
+        const QByteArray &datagram = datagrams.at(sent);
+        if (sendto(datagram.constData(), datagram.size(), addrs[sent], ports[sent]) != datagram.size()) {
+            return sent > 0 ? sent : -1;
+        }
     }
+    return sent;
 }
 
 static void convertToLevelAndOption(Socket::SocketOption opt, HostAddress::NetworkLayerProtocol socketProtocol,
@@ -913,9 +1928,39 @@ static void convertToLevelAndOption(Socket::SocketOption opt, HostAddress::Netwo
 #endif
         }
         break;
+    case Socket::BusyPollSocketOption:
+#ifdef SO_BUSY_POLL
+        *n = SO_BUSY_POLL;
+#endif
+        break;
+    case Socket::FastOpenSocketOption:
+#ifdef TCP_FASTOPEN
+        *level = IPPROTO_TCP;
+        *n = TCP_FASTOPEN;
+#endif
+        break;
+    case Socket::FastOpenConnectSocketOption:
+#ifdef TCP_FASTOPEN_CONNECT
+        *level = IPPROTO_TCP;
+        *n = TCP_FASTOPEN_CONNECT;
+#endif
+        break;
+    case Socket::DeferAcceptSocketOption:
+#ifdef TCP_DEFER_ACCEPT
+        *level = IPPROTO_TCP;
+        *n = TCP_DEFER_ACCEPT;
+#endif
+        break;
+    case Socket::ZeroCopySocketOption:
+#ifdef Q_OS_LINUX
+        *n = SO_ZEROCOPY;
+#endif
+        break;
     case Socket::MaxStreamsSocketOption:
     case Socket::NonBlockingSocketOption:
     case Socket::BindExclusively:
+    case Socket::RegisteredIoSocketOption:
+    case Socket::CongestionControlSocketOption:
     default:
         Q_UNREACHABLE();
     }
@@ -932,7 +1977,18 @@ QVariant SocketPrivate::option(Socket::SocketOption option) const
     case Socket::MaxStreamsSocketOption:
     case Socket::NonBlockingSocketOption:
     case Socket::BindExclusively:
+    case Socket::RegisteredIoSocketOption:
         return -1;
+    case Socket::CongestionControlSocketOption: {
+#ifdef TCP_CONGESTION
+        char name[64];
+        QT_SOCKLEN_T len = sizeof(name);
+        if (::getsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name, &len) == 0) {
+            return QString::fromLatin1(name, static_cast<int>(qstrnlen(name, len)));
+        }
+#endif
+        return QVariant();
+    }
     case Socket::PathMtuSocketOption:
 #if defined(IPV6_PATHMTU) && !defined(IPV6_MTU)
         // Prefer IPV6_MTU (handled by convertToLevelAndOption), if available
@@ -969,9 +2025,21 @@ bool SocketPrivate::setOption(Socket::SocketOption option, const QVariant &value
     switch (option) {
     case Socket::NonBlockingSocketOption:
     case Socket::MaxStreamsSocketOption:
+    case Socket::RegisteredIoSocketOption:
         return false;
     case Socket::BindExclusively:
         return true;
+    case Socket::CongestionControlSocketOption: {
+#ifdef TCP_CONGESTION
+        const QByteArray &name = value.toString().toLatin1();
+        return !name.isEmpty()
+                && ::setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name.constData(),
+                                static_cast<QT_SOCKLEN_T>(name.size()))
+                == 0;
+#else
+        return false;
+#endif
+    }
     default:
         break;
     }
@@ -993,7 +2061,15 @@ bool SocketPrivate::setOption(Socket::SocketOption option, const QVariant &value
             n = SO_REUSEPORT;
     }
 #endif
-    return ::setsockopt(fd, level, n, reinterpret_cast<char *>(&v), sizeof(v)) == 0;
+    if (::setsockopt(fd, level, n, reinterpret_cast<char *>(&v), sizeof(v)) != 0) {
+        return false;
+    }
+#ifdef Q_OS_LINUX
+    if (option == Socket::ZeroCopySocketOption) {
+        zeroCopy = (v != 0);
+    }
+#endif
+    return true;
 }
 
 bool SocketPrivate::setNonblocking()
@@ -1250,16 +2326,22 @@ Socket *SocketPrivate::accept()
         return nullptr;
     }
 
-    if (state != Socket::ListeningState || type != Socket::TcpSocket) {
+    if (state != Socket::ListeningState || !isStream()) {
         return nullptr;
     }
 
     ScopedIoWatcher watcher(EventLoopCoroutine::Read, fd);
+    CompletionIo io(CompletionIo::Accept, fd);
     while (true) {
         if (!checkState() || state != Socket::ListeningState) {
             return nullptr;
         }
-        int acceptedDescriptor = qt_safe_accept(fd, nullptr, nullptr);
+        int acceptedDescriptor;
+        if (io.hasResult) {
+            acceptedDescriptor = static_cast<int>(takeIoResult(io));
+        } else {
+            acceptedDescriptor = qt_safe_accept(fd, nullptr, nullptr);
+        }
         if (acceptedDescriptor == -1) {
             int e = errno;
             switch (e) {
@@ -1303,8 +2385,30 @@ Socket *SocketPrivate::accept()
             Socket *conn = new Socket(acceptedDescriptor);
             return conn;
         }
-        watcher.start();
+#ifdef SOCK_CLOEXEC
+        io.flags = SOCK_CLOEXEC;
+#endif
+        waitForIo(watcher, io);
+    }
+}
+
+// drain the backlog after the first connection, so a storm of connections wakes the eventloop once per batch.
+QList<Socket *> SocketPrivate::acceptMany(int maxCount)
+{
+    QList<Socket *> accepted;
+    Socket *first = accept();
+    if (!first) {
+        return accepted;
+    }
+    accepted.append(first);
+    while (accepted.size() < maxCount && checkState() && state == Socket::ListeningState) {
+        int acceptedDescriptor = qt_safe_accept(fd, nullptr, nullptr);
+        if (acceptedDescriptor == -1) {
+            break;  // EAGAIN, or the next accept() reports the error.
+        }
+        accepted.append(new Socket(acceptedDescriptor));
     }
+    return accepted;
 }
 
 QTNETWORKNG_NAMESPACE_END
@@ -1,6 +1,16 @@
 #include <string.h>
+#include <limits>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qmutex.h>
 #include "../include/coroutine_utils.h"
 #include "../include/socket_utils.h"
+#include "../include/buffer_budget.h"
+#include "../include/private/socket_p.h"
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
@@ -18,13 +28,63 @@ qint32 SocketLike::write(const char *data, qint32 size)
     return sendall(data, size);
 }
 
+qint32 SocketLike::recvInto(QByteArray &buf, qint32 maxSize)
+{
+    return recvIntoBuffer(this, buf, maxSize);
+}
+
 qint64 SocketLike::size()
 {
     return -1;
 }
 
+bool SocketLike::hasPendingData() const
+{
+    return false;
+}
+
+qint32 SocketLike::maxMessageSize() const
+{
+    return 0;
+}
+
+TcpInfo SocketLike::tcpInfo() const
+{
+    return TcpInfo();
+}
+
+QList<QSharedPointer<SocketLike>> SocketLike::acceptMany(int)
+{
+    QList<QSharedPointer<SocketLike>> requests;
+    QSharedPointer<SocketLike> request = accept();
+    if (!request.isNull()) {
+        requests.append(request);
+    }
+    return requests;
+}
+
+qint32 SocketLike::sendv(const QList<QByteArray> &data)
+{
+    qint32 total = 0;
+    for (const QByteArray &buffer : data) {
+        if (buffer.isEmpty()) {
+            continue;
+        }
+        qint32 sent = sendall(buffer);
+        if (sent < 0) {
+            return total > 0 ? total : -1;
+        }
+        total += sent;
+        if (sent < buffer.size()) {
+            break;
+        }
+    }
+    return total;
+}
+
 namespace {
-class SocketLikeImpl : public SocketLike
+// final, so the calls through SocketLikeImpl itself are not virtual.
+class SocketLikeImpl final : public SocketLike
 {
 public:
     SocketLikeImpl(QSharedPointer<Socket> s);
@@ -46,6 +106,7 @@ public:
 
     virtual Socket *acceptRaw() override;
     virtual QSharedPointer<SocketLike> accept() override;
+    virtual QList<QSharedPointer<SocketLike>> acceptMany(int maxCount) override;
     virtual bool bind(const HostAddress &address, quint16 port, Socket::BindMode mode) override;
     virtual bool bind(quint16 port, Socket::BindMode mode) override;
     virtual bool connect(const HostAddress &addr, quint16 port) override;
@@ -65,6 +126,8 @@ public:
     virtual QByteArray recvall(qint32 size) override;
     virtual qint32 send(const QByteArray &data) override;
     virtual qint32 sendall(const QByteArray &data) override;
+    virtual qint32 sendv(const QList<QByteArray> &data) override;
+    virtual TcpInfo tcpInfo() const override;
 public:
     QSharedPointer<Socket> s;
 };
@@ -159,6 +222,15 @@ QSharedPointer<SocketLike> SocketLikeImpl::accept()
     }
 }
 
+QList<QSharedPointer<SocketLike>> SocketLikeImpl::acceptMany(int maxCount)
+{
+    QList<QSharedPointer<SocketLike>> requests;
+    for (Socket *r : s->acceptMany(maxCount)) {
+        requests.append(asSocketLike(r));
+    }
+    return requests;
+}
+
 bool SocketLikeImpl::bind(const HostAddress &address, quint16 port, Socket::BindMode mode)
 {
     return s->bind(address, port, mode);
@@ -244,6 +316,16 @@ qint32 SocketLikeImpl::sendall(const QByteArray &data)
     return s->sendall(data);
 }
 
+qint32 SocketLikeImpl::sendv(const QList<QByteArray> &data)
+{
+    return s->sendv(data);
+}
+
+TcpInfo SocketLikeImpl::tcpInfo() const
+{
+    return s->tcpInfo();
+}
+
 }  // anonymous namespace
 
 QSharedPointer<SocketLike> asSocketLike(QSharedPointer<Socket> s)
@@ -254,6 +336,12 @@ QSharedPointer<SocketLike> asSocketLike(QSharedPointer<Socket> s)
     return QSharedPointer<SocketLikeImpl>::create(s).dynamicCast<SocketLike>();
 }
 
+Socket *plainSocketOf(const QSharedPointer<SocketLike> &socket)
+{
+    SocketLikeImpl *impl = dynamic_cast<SocketLikeImpl *>(socket.data());
+    return impl ? impl->s.data() : nullptr;
+}
+
 QSharedPointer<Socket> convertSocketLikeToSocket(QSharedPointer<SocketLike> socket)
 {
     QSharedPointer<SocketLikeImpl> impl = socket.dynamicCast<SocketLikeImpl>();
@@ -264,6 +352,277 @@ QSharedPointer<Socket> convertSocketLikeToSocket(QSharedPointer<SocketLike> sock
     }
 }
 
+BufferedSocketReader::BufferedSocketReader(QSharedPointer<SocketLike> connection, const QByteArray &buf,
+                                           qint32 blockSize)
+    : connection(connection)
+    , plain(plainSocketOf(connection))
+    , buf(buf)
+    , pos(0)
+    , blockSize(qMax(blockSize, 16))
+{
+    // keep the capacity while the buffer is drained and filled again.
+    this->buf.reserve(qMax(buf.size(), this->blockSize * 2));
+}
+
+void BufferedSocketReader::compact()
+{
+    if (pos == 0) {
+        return;
+    }
+    if (pos >= buf.size()) {
+        buf.resize(0);
+        pos = 0;
+    } else if (pos >= buf.size() / 2 || buf.capacity() - buf.size() < blockSize) {
+        // move the tail to the front only if it is cheap compared with the data consumed.
+        buf.remove(0, pos);
+        pos = 0;
+    }
+}
+
+qint32 BufferedSocketReader::fill()
+{
+    if (connection.isNull()) {
+        return -1;
+    }
+    compact();
+    const qint32 oldSize = buf.size();
+    buf.resize(oldSize + blockSize);
+    qint32 len = recvSome(buf.data() + oldSize, blockSize);
+    buf.resize(oldSize + qMax(0, len));
+    return len;
+}
+
+QByteArray BufferedSocketReader::peek(qint32 size)
+{
+    while (bufferedSize() < size) {
+        if (fill() <= 0) {
+            break;
+        }
+    }
+    return QByteArray(bufferedData(), qMin(size, bufferedSize()));
+}
+
+QByteArray BufferedSocketReader::readUntil(const QByteArray &delimiter, qint32 maxSize, Error *error)
+{
+    if (delimiter.isEmpty()) {
+        *error = NoError;
+        return QByteArray();
+    }
+    qint32 scanned = 0;  // the bytes after pos which can not start the delimiter.
+    while (true) {
+        int found = buf.indexOf(delimiter, pos + scanned);
+        if (found >= 0) {
+            const qint32 len = found - pos;
+            if (len > maxSize) {
+                *error = LimitExceeded;
+                return QByteArray();
+            }
+            QByteArray result(buf.constData() + pos, len);
+            pos = found + delimiter.size();
+            *error = NoError;
+            return result;
+        }
+        scanned = qMax(0, bufferedSize() - delimiter.size() + 1);
+        if (scanned > maxSize) {
+            *error = LimitExceeded;
+            return QByteArray();
+        }
+        if (fill() <= 0) {
+            *error = ConnectionError;
+            return QByteArray();
+        }
+    }
+}
+
+QByteArray BufferedSocketReader::readExactly(qint32 size)
+{
+    if (size <= 0) {
+        return QByteArray();
+    }
+    if (bufferedSize() >= size) {
+        QByteArray result(bufferedData(), size);
+        pos += size;
+        return result;
+    }
+    QByteArray result(size, Qt::Uninitialized);
+    qint32 got = bufferedSize();
+    memcpy(result.data(), bufferedData(), static_cast<size_t>(got));
+    pos = buf.size();
+    compact();
+    if (size - got >= blockSize && !connection.isNull()) {
+        // a large payload is received into the result directly.
+        qint32 len = connection->recvall(result.data() + got, size - got);
+        got += qMax(0, len);
+    } else {
+        while (got < size && fill() > 0) {
+            qint32 n = qMin(bufferedSize(), size - got);
+            memcpy(result.data() + got, bufferedData(), static_cast<size_t>(n));
+            pos += n;
+            got += n;
+        }
+    }
+    result.resize(got);
+    return result;
+}
+
+qint32 BufferedSocketReader::recvSome(char *data, qint32 size)
+{
+    return plain ? plain->recv(data, size) : connection->recv(data, size);
+}
+
+qint32 BufferedSocketReader::read(char *data, qint32 size)
+{
+    if (size <= 0) {
+        return 0;
+    }
+    if (bufferedSize() == 0) {
+        if (size >= blockSize && !connection.isNull()) {
+            return recvSome(data, size);
+        }
+        qint32 len = fill();
+        if (len <= 0) {
+            return len;
+        }
+    }
+    qint32 n = qMin(bufferedSize(), size);
+    memcpy(data, bufferedData(), static_cast<size_t>(n));
+    pos += n;
+    return n;
+}
+
+void BufferedSocketReader::skip(qint32 size)
+{
+    pos += qBound(0, size, bufferedSize());
+}
+
+void BufferedSocketReader::unread(const QByteArray &data)
+{
+    if (data.isEmpty()) {
+        return;
+    }
+    if (pos >= data.size()) {
+        pos -= data.size();
+        memcpy(buf.data() + pos, data.constData(), static_cast<size_t>(data.size()));
+    } else {
+        buf.replace(0, pos, data);
+        pos = 0;
+    }
+}
+
+QByteArray BufferedSocketReader::takeBuffered()
+{
+    QByteArray result(bufferedData(), bufferedSize());
+    buf.resize(0);
+    pos = 0;
+    return result;
+}
+
+class RateLimiterPrivate
+{
+public:
+    RateLimiterPrivate(qint64 rate, qint64 burst);
+    void refill();
+    QMutex mutex;
+    QElapsedTimer clock;  // monotonic, the loops of threads do not share a clock.
+    qint64 lastRefill;  // nsecs of clock.
+    double tokens;
+    qint64 rate;
+    qint64 burst;
+};
+
+RateLimiterPrivate::RateLimiterPrivate(qint64 rate, qint64 burst)
+    : lastRefill(0)
+    , rate(rate)
+    , burst(burst > 0 ? burst : rate)
+{
+    clock.start();
+    tokens = static_cast<double>(this->burst);
+}
+
+void RateLimiterPrivate::refill()
+{
+    const qint64 now = clock.nsecsElapsed();
+    tokens = qMin<double>(static_cast<double>(burst), tokens + static_cast<double>(now - lastRefill) * rate / 1e9);
+    lastRefill = now;
+}
+
+RateLimiter::RateLimiter(qint64 bytesPerSecond, qint64 burstBytes)
+    : d_ptr(new RateLimiterPrivate(bytesPerSecond, burstBytes))
+{
+}
+
+RateLimiter::~RateLimiter()
+{
+    delete d_ptr;
+}
+
+void RateLimiter::setRate(qint64 bytesPerSecond, qint64 burstBytes)
+{
+    Q_D(RateLimiter);
+    QMutexLocker locker(&d->mutex);
+    d->refill();
+    d->rate = bytesPerSecond;
+    d->burst = burstBytes > 0 ? burstBytes : bytesPerSecond;
+    d->tokens = qMin<double>(d->tokens, static_cast<double>(d->burst));
+}
+
+qint64 RateLimiter::rate() const
+{
+    Q_D(const RateLimiter);
+    return d->rate;
+}
+
+qint64 RateLimiter::burst() const
+{
+    Q_D(const RateLimiter);
+    return d->burst;
+}
+
+qint64 RateLimiter::available()
+{
+    Q_D(RateLimiter);
+    QMutexLocker locker(&d->mutex);
+    if (d->rate <= 0) {
+        return std::numeric_limits<qint64>::max();
+    }
+    d->refill();
+    return static_cast<qint64>(d->tokens);
+}
+
+qint64 RateLimiter::wait(qint64 maxBytes)
+{
+    Q_D(RateLimiter);
+    while (true) {
+        quint32 msecs;
+        {
+            QMutexLocker locker(&d->mutex);
+            if (d->rate <= 0) {
+                return maxBytes;
+            }
+            d->refill();
+            if (d->tokens >= 1.0) {
+                // the reads are not smaller than 20ms of rate, so a throttled reader wakes 50 times a second at most.
+                const qint64 minBytes = qMax<qint64>(1024, d->rate / 50);
+                return qMin(maxBytes, qMax(static_cast<qint64>(d->tokens), minBytes));
+            }
+            msecs = static_cast<quint32>(qMin<double>((1.0 - d->tokens) * 1000.0 / d->rate + 1.0, 1000.0 * 60));
+        }
+        Coroutine::msleep(msecs);
+    }
+}
+
+void RateLimiter::consume(qint64 bytes)
+{
+    Q_D(RateLimiter);
+    if (bytes <= 0) {
+        return;
+    }
+    QMutexLocker locker(&d->mutex);
+    if (d->rate > 0) {
+        d->tokens -= static_cast<double>(bytes);
+    }
+}
+
 class ExchangerPrivate
 {
 public:
@@ -277,12 +636,17 @@ public:
     void sendIncoming();
     void in2out();
     void out2in();
+    void relay(QSharedPointer<SocketLike> from, QSharedPointer<SocketLike> to, const QString &peer);
 public:
     QSharedPointer<SocketLike> request;
     QSharedPointer<SocketLike> forward;
     CoroutineGroup *operations;
     Queue<QByteArray> incoming;
     Queue<QByteArray> outgoing;
+    BufferCharge buffered;  // of incoming and outgoing.
+    QSharedPointer<RateLimiter> upload;  // request to forward.
+    QSharedPointer<RateLimiter> download;
+    quint32 maxBufferSize;
     float timeout;
 };
 
@@ -295,6 +659,8 @@ ExchangerPrivate::ExchangerPrivate(QSharedPointer<SocketLike> request, QSharedPo
     , operations(new CoroutineGroup)
     , incoming(maxBufferSize / EXCHANGER_PACKET_SIZE)
     , outgoing(maxBufferSize / EXCHANGER_PACKET_SIZE)
+    , buffered(BufferBudget::Exchanger)
+    , maxBufferSize(maxBufferSize)
     , timeout(timeout)
 {
 }
@@ -308,6 +674,9 @@ void ExchangerPrivate::receiveOutgoing()
 {
     QByteArray buf(EXCHANGER_PACKET_SIZE, Qt::Uninitialized);
     while (true) {
+        if (buffered.isPressured()) {
+            buffered.waitForRoom();
+        }
         qint32 len = forward->recv(buf.data(), buf.size());
         if (len <= 0) {
             operations->kill(QString::fromLatin1("receive_incoming"), false);
@@ -315,6 +684,7 @@ void ExchangerPrivate::receiveOutgoing()
             incoming.put(QByteArray());
             return;
         }
+        buffered.add(len);
         incoming.put(QByteArray(buf.constData(), len));
     }
 }
@@ -323,6 +693,9 @@ void ExchangerPrivate::receiveIncoming()
 {
     QByteArray buf(EXCHANGER_PACKET_SIZE, Qt::Uninitialized);
     while (true) {
+        if (buffered.isPressured()) {
+            buffered.waitForRoom();
+        }
         qint32 len = request->recv(buf.data(), buf.size());
         if (len <= 0) {
             operations->kill(QString::fromLatin1("receive_outgoing"), false);
@@ -330,6 +703,7 @@ void ExchangerPrivate::receiveIncoming()
             outgoing.put(QByteArray());
             return;
         }
+        buffered.add(len);
         outgoing.put(QByteArray(buf.constData(), len));
     }
 }
@@ -345,6 +719,7 @@ void ExchangerPrivate::sendOutgoing()
                 buf.append(outgoing.get());
             }
         }
+        buffered.sub(buf.size());
         qint32 len;
         try {
             Timeout timeout(this->timeout);
@@ -371,6 +746,7 @@ void ExchangerPrivate::sendIncoming()
                 buf.append(incoming.get());
             }
         }
+        buffered.sub(buf.size());
         qint32 len;
         try {
             Timeout timeout(this->timeout);
@@ -386,58 +762,147 @@ void ExchangerPrivate::sendIncoming()
     }
 }
 
-void ExchangerPrivate::in2out()
+#ifdef Q_OS_LINUX
+// move the bytes from one tcp socket to another through a pipe, so they never enter user space.
+// returns 0 at the end of stream, -1 if failed, or -2 if splice() is not supported before anything is moved.
+struct SplicePipe
 {
-    QByteArray buf(EXCHANGER_PACKET_SIZE, Qt::Uninitialized);
+    SplicePipe() { ok = ::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0; }
+    ~SplicePipe()
+    {
+        if (ok) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+        }
+    }
+    int fds[2];
+    bool ok;
+};
+
+static int spliceRelay(int from, int to, float secs, RateLimiter *limiter)
+{
+    SplicePipe pipe;  // closed even if this coroutine is killed.
+    if (!pipe.ok) {
+        return -2;
+    }
+    ScopedIoWatcher readWatcher(EventLoopCoroutine::Read, from);
+    ScopedIoWatcher writeWatcher(EventLoopCoroutine::Write, to);
+    const size_t chunkSize = 1024 * 64;
+    bool moved = false;
+    int result = -1;
     while (true) {
-        qint32 len = request->recv(buf.data(), buf.size());
-        if (len <= 0) {
-            forward->abort();
-            operations->kill(QString::fromLatin1("out2in"));
-            return;
+        // the read watcher is not started while throttled, so the sender is slowed down by tcp.
+        const size_t allowed = limiter ? static_cast<size_t>(limiter->wait(chunkSize)) : chunkSize;
+        ssize_t pending;
+        do {
+            pending = ::splice(from, nullptr, pipe.fds[1], nullptr, allowed, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        } while (pending < 0 && errno == EINTR);
+        if (pending == 0) {
+            result = 0;
+            break;
+        } else if (pending < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                readWatcher.start();
+                continue;
+            }
+            if (!moved && (errno == EINVAL || errno == ENOSYS)) {
+                result = -2;
+            }
+            break;
+        }
+        moved = true;
+        if (limiter) {
+            limiter->consume(pending);
         }
-        qint32 sentBytes;
         try {
-            Timeout timeout(this->timeout);
+            Timeout timeout(secs);
             Q_UNUSED(timeout);
-            sentBytes = forward->sendall(buf.data(), len);
+            while (pending > 0) {
+                ssize_t written;
+                do {
+                    written = ::splice(pipe.fds[0], nullptr, to, nullptr, static_cast<size_t>(pending),
+                                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                } while (written < 0 && errno == EINTR);
+                if (written > 0) {
+                    pending -= written;
+                } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    writeWatcher.start();
+                } else {
+                    break;
+                }
+            }
         } catch (TimeoutException &) {
-            sentBytes = -1;
         }
-        if (sentBytes != len) {
-            forward->abort();
-            operations->kill(QString::fromLatin1("out2in"));
+        if (pending > 0) {
+            break;
+        }
+    }
+    return result;
+}
+#endif
+
+void ExchangerPrivate::relay(QSharedPointer<SocketLike> from, QSharedPointer<SocketLike> to, const QString &peer)
+{
+    QSharedPointer<RateLimiter> limiter = from == request ? upload : download;
+#ifdef Q_OS_LINUX
+    QSharedPointer<Socket> fromSocket = convertSocketLikeToSocket(from);
+    QSharedPointer<Socket> toSocket = convertSocketLikeToSocket(to);
+    if (!fromSocket.isNull() && !toSocket.isNull() && fromSocket->type() == Socket::TcpSocket
+        && toSocket->type() == Socket::TcpSocket) {
+        int result = spliceRelay(static_cast<int>(fromSocket->fileno()), static_cast<int>(toSocket->fileno()),
+                                 timeout, limiter.data());
+        if (result != -2) {
+            to->abort();
+            operations->kill(peer);
             return;
         }
     }
-}
-
-void ExchangerPrivate::out2in()
-{
+#endif
+    // grow the buffer while the peer fills it, so bulk transfers take less syscalls.
     QByteArray buf(EXCHANGER_PACKET_SIZE, Qt::Uninitialized);
+    const qint32 maxPacketSize = qMax<qint32>(EXCHANGER_PACKET_SIZE, qMin<quint32>(maxBufferSize, 1024 * 256));
+    Socket *fromPlain = plainSocketOf(from);
+    Socket *toPlain = plainSocketOf(to);
     while (true) {
-        qint32 len = forward->recv(buf.data(), buf.size());
+        const qint32 allowed = limiter.isNull() ? buf.size() : static_cast<qint32>(limiter->wait(buf.size()));
+        qint32 len = fromPlain ? fromPlain->recv(buf.data(), allowed) : from->recv(buf.data(), allowed);
         if (len <= 0) {
-            request->abort();
-            operations->kill(QString::fromLatin1("in2out"));
+            to->abort();
+            operations->kill(peer);
             return;
         }
+        if (!limiter.isNull()) {
+            limiter->consume(len);
+        }
         qint32 sentBytes;
         try {
             Timeout timeout(this->timeout);
             Q_UNUSED(timeout);
-            sentBytes = request->sendall(buf.data(), len);
+            sentBytes = toPlain ? toPlain->sendall(buf.data(), len) : to->sendall(buf.data(), len);
         } catch (TimeoutException &) {
             sentBytes = -1;
         }
         if (sentBytes != len) {
-            request->abort();
-            operations->kill(QString::fromLatin1("in2out"));
+            to->abort();
+            operations->kill(peer);
             return;
         }
+        if (len == buf.size() && buf.size() < maxPacketSize) {
+            buf.resize(qMin(buf.size() * 2, maxPacketSize));
+        }
     }
 }
 
+void ExchangerPrivate::in2out()
+{
+    relay(request, forward, QString::fromLatin1("out2in"));
+}
+
+void ExchangerPrivate::out2in()
+{
+    relay(forward, request, QString::fromLatin1("in2out"));
+}
+
 Exchanger::Exchanger(QSharedPointer<SocketLike> request, QSharedPointer<SocketLike> forward, quint32 maxBufferSize,
                      float timeout)
     : d_ptr(new ExchangerPrivate(request, forward, maxBufferSize, timeout))
@@ -449,6 +914,13 @@ Exchanger::~Exchanger()
     delete d_ptr;
 }
 
+void Exchanger::setRateLimiters(QSharedPointer<RateLimiter> upload, QSharedPointer<RateLimiter> download)
+{
+    Q_D(Exchanger);
+    d->upload = upload;
+    d->download = download;
+}
+
 void Exchanger::exchange()
 {
     Q_D(Exchanger);
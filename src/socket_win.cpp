@@ -2,7 +2,13 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <mswsock.h>
+#include <mstcpip.h>
 #include <QtCore/qbytearray.h>
+#include <QtCore/qvarlengtharray.h>
+#include <QtCore/qqueue.h>
+#include <QtCore/qvector.h>
+#include <QtCore/qfile.h>
+#include <io.h>
 #if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
 #include <QtCore/qoperatingsystemversion.h>
 #else
@@ -211,6 +217,13 @@ static void convertToLevelAndOption(Socket::SocketOption opt,
     case Socket::NonBlockingSocketOption:      // WSAIoctl
     case Socket::TypeOfServiceOption:          // not supported
     case Socket::MaxStreamsSocketOption:
+    case Socket::BusyPollSocketOption:         // not supported
+    case Socket::FastOpenSocketOption:
+    case Socket::FastOpenConnectSocketOption:
+    case Socket::DeferAcceptSocketOption:
+    case Socket::ZeroCopySocketOption:
+    case Socket::RegisteredIoSocketOption:
+    case Socket::CongestionControlSocketOption:
         Q_UNREACHABLE();
 
     case Socket::ReceiveBufferSizeSocketOption:
@@ -280,6 +293,31 @@ static void convertToLevelAndOption(Socket::SocketOption opt,
 }
 
 
+// park on the eventloop until the operation completes if it supports completion based io, or until the socket is ready.
+static inline void waitForIo(ScopedIoWatcher &watcher, CompletionIo &io)
+{
+    if (!EventLoopCoroutine::get()->completeIo(&io)) {
+        watcher.start();
+    }
+}
+
+// turn the result of a completed operation back into a winsock result.
+static inline int takeIoResult(CompletionIo &io, DWORD *bytes)
+{
+    io.hasResult = false;
+    *bytes = 0;
+    if (io.result == -WSA_OPERATION_ABORTED || io.result == -WSAEINTR) {
+        ::WSASetLastError(WSAEWOULDBLOCK);
+        return SOCKET_ERROR;
+    } else if (io.result < 0) {
+        ::WSASetLastError(static_cast<int>(-io.result));
+        return SOCKET_ERROR;
+    }
+    *bytes = static_cast<DWORD>(io.result);
+    return 0;
+}
+
+
 static inline Socket::SocketType qt_socket_getType(qintptr socketDescriptor)
 {
     int value = 0;
@@ -349,6 +387,11 @@ bool SocketPrivate::setPortAndAddress(quint16 port, const HostAddress &address,
 
 bool SocketPrivate::createSocket()
 {
+    if (isLocal()) {
+        fd = -1;
+        setError(Socket::UnsupportedSocketOperationError, ProtocolUnsupportedErrorString);
+        return false;
+    }
     //Windows XP and 2003 support IPv6 but not dual stack sockets
     int protocol = this->protocol == HostAddress::IPv6Protocol ? AF_INET6 : AF_INET;
     int type = (this->type == Socket::UdpSocket) ? SOCK_DGRAM : SOCK_STREAM;
@@ -360,9 +403,16 @@ bool SocketPrivate::createSocket()
     // SetHandleInformation is supported since W2K but isn't atomic
 #ifndef WSA_FLAG_NO_HANDLE_INHERIT
 #define WSA_FLAG_NO_HANDLE_INHERIT 0x80
+#endif
+#ifndef WSA_FLAG_REGISTERED_IO
+#define WSA_FLAG_REGISTERED_IO 0x100
 #endif
 
-    SOCKET socket = ::WSASocketW(protocol, type, 0, nullptr, 0, WSA_FLAG_NO_HANDLE_INHERIT | WSA_FLAG_OVERLAPPED);
+    DWORD flags = WSA_FLAG_NO_HANDLE_INHERIT | WSA_FLAG_OVERLAPPED;
+    if (registeredIo) {
+        flags |= WSA_FLAG_REGISTERED_IO;
+    }
+    SOCKET socket = ::WSASocketW(protocol, type, 0, nullptr, 0, flags);
     // previous call fails if the windows 7 service pack 1 or hot fix isn't installed.
 
     // Try the old API if the new one failed on Windows 7
@@ -454,6 +504,44 @@ bool SocketPrivate::isValid() const
     return result == 0 && error == 0;
 }
 
+bool SocketPrivate::isIdleConnected() const
+{
+    if (!checkState() || type != Socket::TcpSocket) {
+        return false;
+    }
+    char c;
+    int r = ::recv(static_cast<SOCKET>(fd), &c, 1, MSG_PEEK);
+    return r == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+TcpInfo SocketPrivate::tcpInfo() const
+{
+    TcpInfo result;
+    if (!checkState() || type != Socket::TcpSocket) {
+        return result;
+    }
+#ifdef SIO_TCP_INFO  // windows 10 1703 or later.
+    DWORD version = 0;
+    TCP_INFO_v0 info;
+    DWORD bytes = 0;
+    if (WSAIoctl(static_cast<SOCKET>(fd), SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info), &bytes,
+                 nullptr, nullptr) != 0) {
+        WS_ERROR_DEBUG(WSAGetLastError());
+        return result;
+    }
+    result.rtt = info.RttUs;
+    result.minRtt = info.MinRttUs;
+    result.mss = info.Mss;
+    result.congestionWindow = info.Mss > 0 ? info.Cwnd / info.Mss : 0;  // windows counts it in bytes.
+    result.retransmits = info.FastRetrans + info.TimeoutEpisodes;
+    result.bytesSent = info.BytesOut;
+    result.bytesReceived = info.BytesIn;
+    result.bytesRetransmitted = info.BytesRetrans;
+    result.valid = true;
+#endif
+    return result;
+}
+
 
 bool SocketPrivate::bind(const HostAddress &a, quint16 port, Socket::BindMode mode)
 {
@@ -610,6 +698,22 @@ bool SocketPrivate::connect(const HostAddress &address, quint16 port)
     }
 
     state = Socket::ConnectingState;
+    if (type == Socket::TcpSocket) {
+        CompletionIo io(CompletionIo::Connect, fd);
+        io.address = &aa.a;
+        io.addressSize = sockAddrSize;
+        if (EventLoopCoroutine::get()->completeIo(&io)) {
+            if (!checkState() || state != Socket::ConnectingState) {
+                return false;
+            }
+            if (io.result < 0) {
+                return setErrorFromWASError(this, static_cast<int>(-io.result));
+            }
+            state = Socket::ConnectedState;
+            fetchConnectionParameters();
+            return true;
+        }
+    }
     ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
     int tries = 0;
     while (true) {
@@ -665,6 +769,19 @@ bool SocketPrivate::connect(const HostAddress &address, quint16 port)
 }
 
 
+// the unix domain sockets are not supported, createSocket() refuses them.
+bool SocketPrivate::bind(const QString &)
+{
+    setError(Socket::UnsupportedSocketOperationError, OperationUnsupportedErrorString);
+    return false;
+}
+
+bool SocketPrivate::connect(const QString &)
+{
+    setError(Socket::UnsupportedSocketOperationError, OperationUnsupportedErrorString);
+    return false;
+}
+
 void SocketPrivate::close()
 {
     if (fd > 0) {
@@ -672,6 +789,7 @@ void SocketPrivate::close()
         EventLoopCoroutine::get()->triggerIoWatchers(fd);
         fd = -1;
     }
+    closeRegisteredIo();
     state = Socket::UnconnectedState;
     localAddress.clear();
     localPort = 0;
@@ -687,6 +805,7 @@ void SocketPrivate::abort()
         EventLoopCoroutine::get()->triggerIoWatchers(fd);
         fd = -1;
     }
+    closeRegisteredIo();
     state = Socket::UnconnectedState;
     localAddress.clear();
     localPort = 0;
@@ -816,6 +935,7 @@ qint32 SocketPrivate::recv(char *data, qint32 size, bool all)
         return -1;
     }
     ScopedIoWatcher watcher(EventLoopCoroutine::Read, fd);
+    CompletionIo io(CompletionIo::Recv, fd);
     qint32 total = 0;
     while (total < size) {
         if (!checkState()) {
@@ -827,7 +947,13 @@ qint32 SocketPrivate::recv(char *data, qint32 size, bool all)
         buf.len = static_cast<quint32>(size - total);
         DWORD flags = 0;
         DWORD bytesRead = 0;
-        if (::WSARecv(static_cast<SOCKET>(fd), &buf, 1, &bytesRead, &flags, nullptr, nullptr) ==  SOCKET_ERROR) {
+        int socketRet;
+        if (io.hasResult) {
+            socketRet = takeIoResult(io, &bytesRead);
+        } else {
+            socketRet = ::WSARecv(static_cast<SOCKET>(fd), &buf, 1, &bytesRead, &flags, nullptr, nullptr);
+        }
+        if (socketRet == SOCKET_ERROR) {
             int err = WSAGetLastError();
             WS_ERROR_DEBUG(err);
             switch (err) {
@@ -859,7 +985,9 @@ qint32 SocketPrivate::recv(char *data, qint32 size, bool all)
                 return total;
             }
         }
-        watcher.start();
+        io.data = data + total;
+        io.size = static_cast<size_t>(size - total);
+        waitForIo(watcher, io);
     }
     return total;
 }
@@ -870,6 +998,7 @@ qint32 SocketPrivate::send(const char *data, qint32 size, bool all)
         return -1;
     }
     ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    CompletionIo io(CompletionIo::Send, fd);
     qint32 ret = 0;
     qint32 bytesToSend = qMin<qint32>(49152, size);
     while (bytesToSend > 0) {
@@ -884,7 +1013,12 @@ qint32 SocketPrivate::send(const char *data, qint32 size, bool all)
         DWORD flags = 0;
         DWORD bytesWritten = 0;
 
-        int socketRet = ::WSASend(static_cast<SOCKET>(fd), &buf, 1, &bytesWritten, flags, nullptr, nullptr);
+        int socketRet;
+        if (io.hasResult) {
+            socketRet = takeIoResult(io, &bytesWritten);
+        } else {
+            socketRet = ::WSASend(static_cast<SOCKET>(fd), &buf, 1, &bytesWritten, flags, nullptr, nullptr);
+        }
         ret += bytesWritten;
         bytesToSend = qMin<qint32>(49152, size - ret);
 
@@ -960,12 +1094,151 @@ qint32 SocketPrivate::send(const char *data, qint32 size, bool all)
                 return -1;
             }
         }
-        watcher.start();
+        io.data = const_cast<char *>(data + ret);
+        io.size = static_cast<size_t>(bytesToSend);
+        waitForIo(watcher, io);
     }
     return ret;
 }
 
 
+// send all buffers with one WSASend(), so headers are not copied into the payload.
+qint32 SocketPrivate::sendv(const QList<QByteArray> &buffers)
+{
+    if (!checkState()) {
+        return -1;
+    }
+    QVarLengthArray<WSABUF, 16> bufs;
+    qint64 total = 0;
+    for (const QByteArray &buffer : buffers) {
+        if (!buffer.isEmpty()) {
+            WSABUF buf;
+            buf.buf = const_cast<char *>(buffer.constData());
+            buf.len = static_cast<u_long>(buffer.size());
+            bufs.append(buf);
+            total += buffer.size();
+        }
+    }
+    if (bufs.isEmpty()) {
+        return 0;  // nothing to send, as SocketLike::sendv().
+    } else if (total > INT_MAX) {
+        return -1;
+    }
+    qint32 sent = 0;
+    int first = 0;
+    ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    while (first < bufs.size()) {
+        if (!checkState()) {
+            return sent;
+        }
+        DWORD bytesWritten = 0;
+        int socketRet = ::WSASend(static_cast<SOCKET>(fd), bufs.data() + first, static_cast<DWORD>(bufs.size() - first),
+                                  &bytesWritten, 0, nullptr, nullptr);
+        if (socketRet != SOCKET_ERROR) {
+            sent += static_cast<qint32>(bytesWritten);
+            while (bytesWritten > 0) {
+                WSABUF &buf = bufs[first];
+                if (bytesWritten >= buf.len) {
+                    bytesWritten -= buf.len;
+                    ++first;
+                } else {
+                    buf.buf += bytesWritten;
+                    buf.len -= bytesWritten;
+                    bytesWritten = 0;
+                }
+            }
+        } else if (WSAGetLastError() == WSAEWOULDBLOCK) {
+            watcher.start();
+        } else {
+            // send() maps the error of current buffer and closes the socket the same way.
+            const WSABUF &buf = bufs[first];
+            qint32 r = send(buf.buf, static_cast<qint32>(buf.len), true);
+            if (r < 0) {
+                return sent > 0 ? sent : -1;
+            }
+            sent += r;
+            if (static_cast<u_long>(r) < buf.len) {
+                return sent;
+            }
+            ++first;
+        }
+    }
+    return sent;
+}
+
+// TransmitFile() works only with the iocp eventloop, which completes it without blocking the thread.
+// otherwise the file is copied in user space.
+qint32 SocketPrivate::sendfds(const char *, qint32, const QList<qintptr> &)
+{
+    setError(Socket::UnsupportedSocketOperationError, OperationUnsupportedErrorString);
+    return -1;
+}
+
+qint32 SocketPrivate::recvfds(char *, qint32, QList<qintptr> *)
+{
+    setError(Socket::UnsupportedSocketOperationError, OperationUnsupportedErrorString);
+    return -1;
+}
+
+qint64 SocketPrivate::sendfile(QFile *file, qint64 offset, qint64 count)
+{
+    if (!checkState() || !file || offset < 0) {
+        return -1;
+    }
+    if (count < 0) {
+        count = qMax<qint64>(0, file->size() - offset);
+    }
+    qint64 total = 0;
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    if (file->handle() >= 0) {
+        fileHandle = reinterpret_cast<HANDLE>(_get_osfhandle(file->handle()));
+    }
+    while (fileHandle != INVALID_HANDLE_VALUE && total < count) {
+        if (!checkState()) {
+            return total;
+        }
+        qint64 pos = offset + total;
+        CompletionIo io(CompletionIo::TransmitFile, fd);
+        io.data = fileHandle;
+        io.size = static_cast<size_t>(qMin<qint64>(count - total, 1024 * 1024 * 1024));
+        io.address = &pos;
+        if (!EventLoopCoroutine::get()->completeIo(&io)) {
+            break;
+        }
+        if (io.result > 0) {
+            total += io.result;
+        } else if (io.result == 0) {
+            return total;
+        } else if (total == 0 && (io.result == -WSAEOPNOTSUPP || io.result == -WSAEINVAL)) {
+            break;
+        } else {
+            setError(Socket::RemoteHostClosedError, RemoteHostClosedErrorString);
+            close();
+            return total > 0 ? total : -1;
+        }
+    }
+    QByteArray buf(1024 * 64, Qt::Uninitialized);
+    while (total < count) {
+        if (!file->seek(offset + total)) {
+            break;
+        }
+        qint64 r = file->read(buf.data(), qMin<qint64>(count - total, buf.size()));
+        if (r <= 0) {
+            if (r < 0 && total == 0) {
+                setError(Socket::UnknownSocketError, UnknownSocketErrorString);
+                return -1;
+            }
+            break;
+        }
+        qint32 sent = send(buf.constData(), static_cast<qint32>(r), true);
+        if (sent != r) {
+            return sent < 0 && total == 0 ? -1 : total + qMax(0, sent);
+        }
+        total += r;
+    }
+    return total;
+}
+
 qint32 SocketPrivate::recvfrom(char *data, qint32 size, HostAddress *addr, quint16 *port)
 {
     if (!checkState() || size < 0) {
@@ -992,14 +1265,21 @@ qint32 SocketPrivate::recvfrom(char *data, qint32 size, HostAddress *addr, quint
     qint32 ret;
 
     ScopedIoWatcher watcher(EventLoopCoroutine::Read, fd);
+    CompletionIo io(CompletionIo::RecvMsg, fd);
 
     while (true) {
         if (!checkState()) {
             setError(Socket::SocketAccessError, AccessErrorString);
             return -1;
         }
-        ret = ::WSARecvFrom(static_cast<SOCKET>(fd), &buf, 1, &bytesRead, &flags,
-                            msg.name, &msg.namelen, nullptr, nullptr);
+        if (io.hasResult) {
+            msg.namelen = io.addressSize;
+            ret = takeIoResult(io, &bytesRead);
+        } else {
+            msg.namelen = sizeof(aa);
+            ret = ::WSARecvFrom(static_cast<SOCKET>(fd), &buf, 1, &bytesRead, &flags,
+                                msg.name, &msg.namelen, nullptr, nullptr);
+        }
 //        if (static_cast<qint32>(bytesRead) < 0) {
 //            qWarning("recv too much data.");
 //            return -1;
@@ -1065,7 +1345,12 @@ qint32 SocketPrivate::recvfrom(char *data, qint32 size, HostAddress *addr, quint
 #endif
             return ret;
         } else {
-            watcher.start();
+            flags = 0;
+            io.data = buf.buf;
+            io.size = buf.len;
+            io.address = msg.name;
+            io.addressSize = sizeof(aa);
+            waitForIo(watcher, io);
         }
     }
 }
@@ -1099,12 +1384,18 @@ qint32 SocketPrivate::sendto(const char *data, qint32 size, const HostAddress &a
     DWORD bytesSent = 0;
 
     ScopedIoWatcher watcher(EventLoopCoroutine::Write, fd);
+    CompletionIo io(CompletionIo::SendMsg, fd);
     while (true) {
         if (!checkState()) {
             return -1;
         }
-        int socketRet = ::WSASendTo(static_cast<SOCKET>(fd), &buf, 1, &bytesSent, flags,
+        int socketRet;
+        if (io.hasResult) {
+            socketRet = takeIoResult(io, &bytesSent);
+        } else {
+            socketRet = ::WSASendTo(static_cast<SOCKET>(fd), &buf, 1, &bytesSent, flags,
                                     msg.name, msg.namelen, nullptr, nullptr);
+        }
         ret += bytesSent;
 
         if (socketRet == SOCKET_ERROR) {
@@ -1150,10 +1441,443 @@ qint32 SocketPrivate::sendto(const char *data, qint32 size, const HostAddress &a
                 return ret;
             }
         }
-        watcher.start();
+        io.data = buf.buf;
+        io.size = buf.len;
+        io.address = msg.name;
+        io.addressSize = msg.namelen;
+        waitForIo(watcher, io);
+    }
+}
+
+// winsock has no recvmmsg()/sendmmsg(), move one datagram per call unless the registered io is enabled.
+qint32 SocketPrivate::recvfromMany(char *buffer, qint32 datagramSize, qint32 count, qint32 *sizes,
+                                   HostAddress *addrs, quint16 *ports)
+{
+    if (count <= 0) {
+        return -1;
+    }
+    if (registeredIo) {
+        return recvfromRegistered(buffer, datagramSize, count, sizes, addrs, ports);
+    }
+    qint32 len = recvfrom(buffer, datagramSize, &addrs[0], &ports[0]);
+    if (len < 0) {
+        return -1;
+    }
+    sizes[0] = len;
+    return 1;
+}
+
+qint32 SocketPrivate::sendtoMany(const QList<QByteArray> &datagrams, const HostAddress &addr, quint16 port)
+{
+    if (registeredIo) {
+        return sendtoRegistered(datagrams, &addr, &port, true);
+    }
+    qint32 sent = 0;
+    for (; sent < datagrams.size(); ++sent) {
+        const QByteArray &datagram = datagrams.at(sent);
+        if (sendto(datagram.constData(), datagram.size(), addr, port) != datagram.size()) {
+            return sent > 0 ? sent : -1;
+        }
+    }
+    return sent;
+}
+
+qint32 SocketPrivate::sendtoMany(const QList<QByteArray> &datagrams, const HostAddress *addrs, const quint16 *ports)
+{
+    if (registeredIo) {
+        return sendtoRegistered(datagrams, addrs, ports, false);
+    }
+    qint32 sent = 0;
+    for (; sent < datagrams.size(); ++sent) {
+        const QByteArray &datagram = datagrams.at(sent);
+        if (sendto(datagram.constData(), datagram.size(), addrs[sent], ports[sent]) != datagram.size()) {
+            return sent > 0 ? sent : -1;
+        }
+    }
+    return sent;
+}
+
+#if defined(SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER) && defined(WSAID_MULTIPLE_RIO)
+#  define QTNG_HAVE_RIO
+#endif
+
+#ifdef QTNG_HAVE_RIO
+
+// the registered io of windows 8. the datagrams are copied to and from one buffer registered at start, the receives
+// stay posted all the time, and the requests and completions are moved in batches without a syscall for each. the
+// completion queue signals an event, which a wait of the thread pool forwards to the coroutines by ThreadEvent.
+const DWORD RegisteredIoReceiveSlots = 32;
+const DWORD RegisteredIoSendSlots = 64;
+const DWORD RegisteredIoReceiveSlotSize = 1024 * 64;
+const DWORD RegisteredIoSendSlotSize = 1024 * 2;  // larger datagrams are sent by sendto().
+const ULONGLONG RegisteredIoSendTag = 0x80000000u;  // in the request context of sends.
+
+struct RegisteredIoQueue
+{
+    struct Received
+    {
+        DWORD slot;
+        ULONG bytes;
+        LONG status;
+    };
+    RegisteredIoQueue();
+    ~RegisteredIoQueue();
+    bool open(SOCKET s);
+    bool reap();
+    bool postReceive(DWORD slot, DWORD flags);
+    void commitReceives();
+    void commitSends();
+    void arm();
+    DWORD receiveOffset(DWORD slot) const { return slot * RegisteredIoReceiveSlotSize; }
+    DWORD sendOffset(DWORD slot) const
+    {
+        return RegisteredIoReceiveSlots * RegisteredIoReceiveSlotSize + slot * RegisteredIoSendSlotSize;
+    }
+    DWORD addressOffset(DWORD slot, bool send) const
+    {
+        const DWORD first = RegisteredIoReceiveSlots * RegisteredIoReceiveSlotSize
+                + RegisteredIoSendSlots * RegisteredIoSendSlotSize;
+        return first + (send ? RegisteredIoReceiveSlots + slot : slot) * sizeof(SOCKADDR_INET);
+    }
+    static DWORD bufferSize()
+    {
+        return RegisteredIoReceiveSlots * (RegisteredIoReceiveSlotSize + sizeof(SOCKADDR_INET))
+                + RegisteredIoSendSlots * (RegisteredIoSendSlotSize + sizeof(SOCKADDR_INET));
+    }
+
+    RIO_EXTENSION_FUNCTION_TABLE rio;
+    RIO_CQ cq;
+    RIO_RQ rq;
+    RIO_BUFFERID bufferId;
+    char *buffer;
+    HANDLE event;
+    HANDLE wait;
+    ThreadEvent notified;
+    QQueue<Received> received;
+    QVector<DWORD> freeSendSlots;
+};
+
+static VOID CALLBACK registeredIoNotified(PVOID context, BOOLEAN)
+{
+    static_cast<RegisteredIoQueue *>(context)->notified.set();
+}
+
+RegisteredIoQueue::RegisteredIoQueue()
+    : cq(RIO_INVALID_CQ)
+    , rq(RIO_INVALID_RQ)
+    , bufferId(RIO_INVALID_BUFFERID)
+    , buffer(nullptr)
+    , event(nullptr)
+    , wait(nullptr)
+{
+    memset(&rio, 0, sizeof(rio));
+}
+
+// the request queue is freed with the socket, so the socket must be closed before.
+RegisteredIoQueue::~RegisteredIoQueue()
+{
+    if (wait) {
+        UnregisterWaitEx(wait, INVALID_HANDLE_VALUE);
+    }
+    if (cq != RIO_INVALID_CQ) {
+        rio.RIOCloseCompletionQueue(cq);
+    }
+    if (bufferId != RIO_INVALID_BUFFERID) {
+        rio.RIODeregisterBuffer(bufferId);
+    }
+    if (event) {
+        CloseHandle(event);
+    }
+    if (buffer) {
+        VirtualFree(buffer, 0, MEM_RELEASE);
+    }
+    notified.set();  // wake the coroutines waiting for completions, they find the socket closed.
+}
+
+bool RegisteredIoQueue::open(SOCKET s)
+{
+    GUID functionTableId = WSAID_MULTIPLE_RIO;
+    DWORD bytes = 0;
+    if (::WSAIoctl(s, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &functionTableId, sizeof(functionTableId), &rio,
+                   sizeof(rio), &bytes, nullptr, nullptr) == SOCKET_ERROR) {
+        return false;
+    }
+    buffer = static_cast<char *>(VirtualAlloc(nullptr, bufferSize(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (!buffer) {
+        return false;
+    }
+    bufferId = rio.RIORegisterBuffer(buffer, bufferSize());
+    if (bufferId == RIO_INVALID_BUFFERID) {
+        return false;
+    }
+    event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!event) {
+        return false;
+    }
+    RIO_NOTIFICATION_COMPLETION completion;
+    completion.Type = RIO_EVENT_COMPLETION;
+    completion.Event.EventHandle = event;
+    completion.Event.NotifyReset = FALSE;
+    cq = rio.RIOCreateCompletionQueue(RegisteredIoReceiveSlots + RegisteredIoSendSlots, &completion);
+    if (cq == RIO_INVALID_CQ) {
+        return false;
+    }
+    rq = rio.RIOCreateRequestQueue(s, RegisteredIoReceiveSlots, 1, RegisteredIoSendSlots, 1, cq, cq, nullptr);
+    if (rq == RIO_INVALID_RQ) {
+        return false;
+    }
+    if (!RegisterWaitForSingleObject(&wait, event, registeredIoNotified, this, INFINITE, WT_EXECUTEINWAITTHREAD)) {
+        wait = nullptr;
+        return false;
+    }
+    for (DWORD slot = 0; slot < RegisteredIoReceiveSlots; ++slot) {
+        if (!postReceive(slot, RIO_MSG_DEFER)) {
+            return false;
+        }
     }
+    commitReceives();
+    freeSendSlots.reserve(RegisteredIoSendSlots);
+    for (DWORD slot = RegisteredIoSendSlots; slot > 0; --slot) {
+        freeSendSlots.append(slot - 1);
+    }
+    return true;
+}
+
+bool RegisteredIoQueue::postReceive(DWORD slot, DWORD flags)
+{
+    RIO_BUF data;
+    data.BufferId = bufferId;
+    data.Offset = receiveOffset(slot);
+    data.Length = RegisteredIoReceiveSlotSize;
+    RIO_BUF address;
+    address.BufferId = bufferId;
+    address.Offset = addressOffset(slot, false);
+    address.Length = sizeof(SOCKADDR_INET);
+    return rio.RIOReceiveEx(rq, &data, 1, nullptr, &address, nullptr, nullptr, flags,
+                            reinterpret_cast<PVOID>(static_cast<ULONG_PTR>(slot)));
 }
 
+void RegisteredIoQueue::commitReceives()
+{
+    rio.RIOReceiveEx(rq, nullptr, 0, nullptr, nullptr, nullptr, nullptr, RIO_MSG_COMMIT_ONLY, nullptr);
+}
+
+void RegisteredIoQueue::commitSends()
+{
+    rio.RIOSendEx(rq, nullptr, 0, nullptr, nullptr, nullptr, nullptr, RIO_MSG_COMMIT_ONLY, nullptr);
+}
+
+// take the completions of both directions, the sending slots are freed and the received ones are queued.
+bool RegisteredIoQueue::reap()
+{
+    RIORESULT results[RegisteredIoReceiveSlots + RegisteredIoSendSlots];
+    ULONG n = rio.RIODequeueCompletion(cq, results, RegisteredIoReceiveSlots + RegisteredIoSendSlots);
+    if (n == RIO_CORRUPT_CQ) {
+        return false;
+    }
+    for (ULONG i = 0; i < n; ++i) {
+        const RIORESULT &result = results[i];
+        if (result.RequestContext & RegisteredIoSendTag) {
+            freeSendSlots.append(static_cast<DWORD>(result.RequestContext & ~RegisteredIoSendTag));
+        } else {
+            Received r;
+            r.slot = static_cast<DWORD>(result.RequestContext);
+            r.bytes = result.BytesTransferred;
+            r.status = result.Status;
+            received.enqueue(r);
+        }
+    }
+    return true;
+}
+
+// the event is signaled at once if some completions came after the last reap().
+void RegisteredIoQueue::arm()
+{
+    rio.RIONotify(cq);  // WSAEALREADY if armed by another coroutine.
+}
+
+bool SocketPrivate::enableRegisteredIo()
+{
+    if (registeredIo) {
+        return true;
+    }
+    if (!checkState() || type != Socket::UdpSocket || state != Socket::UnconnectedState) {
+        return false;
+    }
+    // WSA_FLAG_REGISTERED_IO is given only when the socket is created, replace the unbound one.
+    registeredIo = new RegisteredIoQueue();
+    ::closesocket(static_cast<SOCKET>(fd));
+    EventLoopCoroutine::get()->triggerIoWatchers(fd);
+    fd = -1;
+    if (!createSocket()) {
+        closeRegisteredIo();
+        return false;
+    }
+    bool ok = registeredIo->open(static_cast<SOCKET>(fd));
+    if (!ok) {
+        qtng_debug << "registered io is not supported:" << WSAGetLastError();
+        // some receives may be posted already, so go back to a plain socket.
+        ::closesocket(static_cast<SOCKET>(fd));
+        fd = -1;
+        closeRegisteredIo();
+        if (!createSocket()) {
+            return false;
+        }
+    }
+    setOption(Socket::BroadcastSocketOption, 1);
+    setOption(Socket::ReceivePacketInformation, 1);
+    setOption(Socket::ReceiveHopLimit, 1);
+    return ok;
+}
+
+void SocketPrivate::closeRegisteredIo()
+{
+    if (registeredIo) {
+        RegisteredIoQueue *queue = registeredIo;
+        registeredIo = nullptr;
+        delete queue;
+    }
+}
+
+qint32 SocketPrivate::recvfromRegistered(char *buffer, qint32 datagramSize, qint32 count, qint32 *sizes,
+                                         HostAddress *addrs, quint16 *ports)
+{
+    qint32 received = 0;
+    while (received == 0) {
+        RegisteredIoQueue *queue = registeredIo;
+        if (!checkState() || !queue) {
+            setError(Socket::SocketAccessError, AccessErrorString);
+            return -1;
+        }
+        queue->notified.clear();
+        if (!queue->reap()) {
+            setError(Socket::NetworkError, ReceiveDatagramErrorString);
+            return -1;
+        }
+        if (queue->received.isEmpty()) {
+            queue->arm();
+            queue->notified.wait();
+            continue;
+        }
+        while (received < count && !queue->received.isEmpty()) {
+            const RegisteredIoQueue::Received r = queue->received.dequeue();
+            if (r.status == 0 || r.status == WSAEMSGSIZE) {
+                const qint32 len = r.status == 0 ? static_cast<qint32>(r.bytes)
+                                                 : static_cast<qint32>(RegisteredIoReceiveSlotSize) + 1;
+                // the size is larger than datagramSize if the datagram is truncated, as MSG_TRUNC of linux.
+                memcpy(buffer + received * datagramSize, queue->buffer + queue->receiveOffset(r.slot),
+                       qMin<qint32>(qMin(len, datagramSize), RegisteredIoReceiveSlotSize));
+                sizes[received] = len;
+                const qt_sockaddr *aa =
+                        reinterpret_cast<const qt_sockaddr *>(queue->buffer + queue->addressOffset(r.slot, false));
+                qt_socket_getPortAndAddress(static_cast<SOCKET>(fd), aa, &ports[received], &addrs[received]);
+                ++received;
+            }
+            // other errors, such as the icmp port unreachable, are dropped as recvfrom() does.
+            if (!queue->postReceive(r.slot, RIO_MSG_DEFER)) {
+                WS_ERROR_DEBUG(WSAGetLastError());
+            }
+        }
+        queue->commitReceives();
+    }
+    return received;
+}
+
+qint32 SocketPrivate::sendtoRegistered(const QList<QByteArray> &datagrams, const HostAddress *addrs,
+                                       const quint16 *ports, bool sameAddress)
+{
+    qint32 sent = 0;
+    while (sent < datagrams.size()) {
+        RegisteredIoQueue *queue = registeredIo;
+        if (!checkState() || !queue) {
+            setError(Socket::SocketAccessError, AccessErrorString);
+            return sent > 0 ? sent : -1;
+        }
+        queue->notified.clear();
+        if (!queue->reap()) {
+            setError(Socket::NetworkError, SendDatagramErrorString);
+            return sent > 0 ? sent : -1;
+        }
+        if (queue->freeSendSlots.isEmpty()) {
+            queue->arm();
+            queue->notified.wait();
+            continue;
+        }
+        bool posted = false;
+        bool failed = false;
+        while (sent < datagrams.size() && !queue->freeSendSlots.isEmpty()) {
+            const QByteArray &datagram = datagrams.at(sent);
+            if (datagram.size() > static_cast<int>(RegisteredIoSendSlotSize)) {
+                break;
+            }
+            const DWORD slot = queue->freeSendSlots.last();
+            const int i = sameAddress ? 0 : sent;
+            qt_sockaddr *aa = reinterpret_cast<qt_sockaddr *>(queue->buffer + queue->addressOffset(slot, true));
+            int sockAddrSize = 0;
+            if (!setPortAndAddress(ports[i], addrs[i], aa, &sockAddrSize)) {
+                setError(Socket::UnsupportedSocketOperationError, ProtocolUnsupportedErrorString);
+                failed = true;
+                break;
+            }
+            memcpy(queue->buffer + queue->sendOffset(slot), datagram.constData(), datagram.size());
+            RIO_BUF data;
+            data.BufferId = queue->bufferId;
+            data.Offset = queue->sendOffset(slot);
+            data.Length = static_cast<ULONG>(datagram.size());
+            RIO_BUF address;
+            address.BufferId = queue->bufferId;
+            address.Offset = queue->addressOffset(slot, true);
+            address.Length = sizeof(SOCKADDR_INET);
+            if (!queue->rio.RIOSendEx(queue->rq, &data, 1, nullptr, &address, nullptr, nullptr, RIO_MSG_DEFER,
+                                      reinterpret_cast<PVOID>(static_cast<ULONG_PTR>(slot | RegisteredIoSendTag)))) {
+                WS_ERROR_DEBUG(WSAGetLastError());
+                setError(Socket::NetworkError, SendDatagramErrorString);
+                failed = true;
+                break;
+            }
+            queue->freeSendSlots.removeLast();
+            posted = true;
+            ++sent;
+        }
+        if (posted) {
+            queue->commitSends();
+        }
+        if (failed) {
+            return sent > 0 ? sent : -1;
+        }
+        if (sent < datagrams.size() && datagrams.at(sent).size() > static_cast<int>(RegisteredIoSendSlotSize)) {
+            const QByteArray &datagram = datagrams.at(sent);
+            const int i = sameAddress ? 0 : sent;
+            if (sendto(datagram.constData(), datagram.size(), addrs[i], ports[i]) != datagram.size()) {
+                return sent > 0 ? sent : -1;
+            }
+            ++sent;
+        }
+    }
+    return sent;
+}
+
+#else
+
+bool SocketPrivate::enableRegisteredIo()
+{
+    return false;
+}
+
+void SocketPrivate::closeRegisteredIo() { }
+
+qint32 SocketPrivate::recvfromRegistered(char *, qint32, qint32, qint32 *, HostAddress *, quint16 *)
+{
+    return -1;
+}
+
+qint32 SocketPrivate::sendtoRegistered(const QList<QByteArray> &, const HostAddress *, const quint16 *, bool)
+{
+    return -1;
+}
+
+#endif  // QTNG_HAVE_RIO
+
 
 QVariant SocketPrivate::option(Socket::SocketOption option) const
 {
@@ -1165,7 +1889,15 @@ QVariant SocketPrivate::option(Socket::SocketOption option) const
     case Socket::NonBlockingSocketOption:
     case Socket::TypeOfServiceOption:
     case Socket::MaxStreamsSocketOption:
+    case Socket::BusyPollSocketOption:
+    case Socket::FastOpenSocketOption:
+    case Socket::FastOpenConnectSocketOption:
+    case Socket::DeferAcceptSocketOption:
+    case Socket::ZeroCopySocketOption:
+    case Socket::CongestionControlSocketOption:
         return -1;
+    case Socket::RegisteredIoSocketOption:
+        return registeredIo ? 1 : 0;
     default:
         break;
     }
@@ -1204,7 +1936,15 @@ bool SocketPrivate::setOption(Socket::SocketOption option, const QVariant &value
     case Socket::NonBlockingSocketOption:
     case Socket::TypeOfServiceOption:
     case Socket::MaxStreamsSocketOption:
+    case Socket::BusyPollSocketOption:
+    case Socket::FastOpenSocketOption:
+    case Socket::FastOpenConnectSocketOption:
+    case Socket::DeferAcceptSocketOption:
+    case Socket::ZeroCopySocketOption:
+    case Socket::CongestionControlSocketOption:
         return false;
+    case Socket::RegisteredIoSocketOption:
+        return value.toBool() ? enableRegisteredIo() : !registeredIo;
 
     default:
         break;
@@ -1447,8 +2187,18 @@ Socket *SocketPrivate::accept()
         return nullptr;
 
     ScopedIoWatcher watcher(EventLoopCoroutine::Read, fd);
+    CompletionIo io(CompletionIo::Accept, fd);
     while (true) {
-        SOCKET acceptedDescriptor = WSAAccept(static_cast<SOCKET>(fd), nullptr, nullptr, nullptr, 0);
+        SOCKET acceptedDescriptor;
+        if (io.hasResult) {
+            DWORD unused;
+            acceptedDescriptor = static_cast<SOCKET>(io.result);
+            if (takeIoResult(io, &unused) == SOCKET_ERROR) {
+                acceptedDescriptor = static_cast<SOCKET>(SOCKET_ERROR);
+            }
+        } else {
+            acceptedDescriptor = WSAAccept(static_cast<SOCKET>(fd), nullptr, nullptr, nullptr, 0);
+        }
         if (acceptedDescriptor == static_cast<SOCKET>(SOCKET_ERROR)) {
             int err = WSAGetLastError();
             switch (err) {
@@ -1487,8 +2237,27 @@ Socket *SocketPrivate::accept()
             Socket *conn = new Socket(static_cast<qintptr>(acceptedDescriptor));
             return conn;
         }
-        watcher.start();
+        waitForIo(watcher, io);
+    }
+}
+
+// drain the backlog after the first connection, so a storm of connections wakes the eventloop once per batch.
+QList<Socket *> SocketPrivate::acceptMany(int maxCount)
+{
+    QList<Socket *> accepted;
+    Socket *first = accept();
+    if (!first) {
+        return accepted;
+    }
+    accepted.append(first);
+    while (accepted.size() < maxCount && checkState() && state == Socket::ListeningState) {
+        SOCKET acceptedDescriptor = WSAAccept(static_cast<SOCKET>(fd), nullptr, nullptr, nullptr, 0);
+        if (acceptedDescriptor == static_cast<SOCKET>(SOCKET_ERROR)) {
+            break;  // WSAEWOULDBLOCK, or the next accept() reports the error.
+        }
+        accepted.append(new Socket(static_cast<qintptr>(acceptedDescriptor)));
     }
+    return accepted;
 }
 
 
@@ -1,6 +1,7 @@
 #include <QtCore/qurl.h>
 #include <QtCore/qendian.h>
 #include "../include/socks5_proxy.h"
+#include "../include/private/socks5_p.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
@@ -27,6 +28,11 @@ QTNETWORKNG_NAMESPACE_BEGIN
 
 #define S5_PASSWORDAUTH_VERSION 0x01
 
+Socks5Exception::Error Socks5Exception::error() const
+{
+    return err;
+}
+
 QString Socks5Exception::errorString() const
 {
     switch (err) {
@@ -64,30 +70,55 @@ QString Socks5Exception::errorString() const
 class Socks5ProxyPrivate
 {
 public:
-    Socks5ProxyPrivate() { }
+    Socks5ProxyPrivate()
+        : operations(new CoroutineGroup)
+        , idleConnections(0)
+        , warming(0)
+        , pipelining(false)
+    {
+    }
     Socks5ProxyPrivate(const QString &hostName, quint16 port, const QString &user, const QString &password)
         : hostName(hostName)
         , user(user)
         , password(password)
+        , operations(new CoroutineGroup)
+        , idleConnections(0)
+        , warming(0)
         , port(port)
+        , pipelining(false)
     {
         capabilities |= Socks5Proxy::TunnelingCapability;
         capabilities |= Socks5Proxy::HostNameLookupCapability;
     }
+    ~Socks5ProxyPrivate() { delete operations; }
 public:
+    QSharedPointer<Socket> openSocket() const;
+    QByteArray makeHelloRequest() const;
+    QByteArray makeAuthRequest() const;
+    bool checkHelloResponse(const QByteArray &helloResponse) const;
+    void readAuthResponse(QSharedPointer<Socket> s) const;
     QSharedPointer<Socket> getControlSocket() const;
-    QSharedPointer<SocketLike> connect(const QString &hostName, quint16 port) const;
-    QSharedPointer<SocketLike> connect(const HostAddress &host, quint16 port) const;
+    QSharedPointer<Socket> takeIdleSocket();
+    void fillIdleSockets();
+    QSharedPointer<SocketLike> connect(const QByteArray &connectRequest);
+    QSharedPointer<SocketLike> connect(const QString &hostName, quint16 port);
+    QSharedPointer<SocketLike> connect(const HostAddress &host, quint16 port);
+    QSharedPointer<Socks5UdpAssociation> udpAssociate() const;
     QSharedPointer<SocketLike> listen(quint16 port) const;
 public:
     QString hostName;
     QString user;
     QString password;
     QFlags<Socks5Proxy::Capability> capabilities;
+    QList<QSharedPointer<Socket>> idle;  // finished greeting and authentication.
+    CoroutineGroup *operations;
+    int idleConnections;
+    int warming;  // the idle sockets in progress.
     quint16 port;
+    bool pipelining;
 };
 
-QSharedPointer<Socket> Socks5ProxyPrivate::getControlSocket() const
+QSharedPointer<Socket> Socks5ProxyPrivate::openSocket() const
 {
     Socket::SocketError error;
     QSharedPointer<Socket> s(Socket::createConnection(hostName, port, &error));
@@ -104,7 +135,12 @@ QSharedPointer<Socket> Socks5ProxyPrivate::getControlSocket() const
             throw Socks5Exception(Socks5Exception::ProxyProtocolError);
         }
     }
+    return s;
+}
 
+QByteArray Socks5ProxyPrivate::makeHelloRequest() const
+{
+    // offer only one method, so the reply is known before it comes.
     QByteArray helloRequest;
     helloRequest.reserve(3);
     helloRequest.append(static_cast<char>(S5_VERSION_5));
@@ -114,13 +150,27 @@ QSharedPointer<Socket> Socks5ProxyPrivate::getControlSocket() const
     } else {
         helloRequest.append(static_cast<char>(S5_AUTHMETHOD_NONE));
     }
+    return helloRequest;
+}
 
-    qint64 sentBytes = s->sendall(helloRequest);
-    if (sentBytes < helloRequest.size()) {
-        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+QByteArray Socks5ProxyPrivate::makeAuthRequest() const
+{
+    QByteArray authRequest;
+    if (user.isEmpty() || password.isEmpty()) {
+        return authRequest;
     }
+    authRequest.reserve(3 + user.size() + password.size());
+    authRequest.append(static_cast<char>(S5_PASSWORDAUTH_VERSION));
+    authRequest.append(static_cast<char>(user.size()));
+    authRequest.append(user.toUtf8());
+    authRequest.append(static_cast<char>(password.size()));
+    authRequest.append(password.toUtf8());
+    return authRequest;
+}
 
-    const QByteArray &helloResponse = s->recvall(2);
+// return true if the proxy asks for the password.
+bool Socks5ProxyPrivate::checkHelloResponse(const QByteArray &helloResponse) const
+{
     if (helloResponse.size() != 2) {
         throw Socks5Exception(Socks5Exception::ProxyProtocolError);
     }
@@ -134,29 +184,42 @@ QSharedPointer<Socket> Socks5ProxyPrivate::getControlSocket() const
         if (user.isEmpty() || password.isEmpty()) {
             throw Socks5Exception(Socks5Exception::ProxyAuthenticationRequiredError);
         }
-        QByteArray authRequest;
-        authRequest.reserve(3 + user.size() + password.size());
-        authRequest.append(static_cast<char>(S5_PASSWORDAUTH_VERSION));
-        authRequest.append(static_cast<char>(user.size()));
-        authRequest.append(user.toUtf8());
-        authRequest.append(static_cast<char>(password.size()));
-        authRequest.append(password.toUtf8());
+        return true;
+    } else if (helloResponse.at(1) == negOne) {
+        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+    }
+    return false;
+}
+
+void Socks5ProxyPrivate::readAuthResponse(QSharedPointer<Socket> s) const
+{
+    const QByteArray authResponse = s->recvall(2);
+    if (authResponse.size() != 2) {
+        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+    }
+    if (authResponse.at(0) != S5_PASSWORDAUTH_VERSION) {
+        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+    }
+    if (authResponse.at(1) != 0x0) {
+        throw Socks5Exception(Socks5Exception::ProxyAuthenticationRequiredError);
+    }
+}
+
+QSharedPointer<Socket> Socks5ProxyPrivate::getControlSocket() const
+{
+    QSharedPointer<Socket> s = openSocket();
+    const QByteArray &helloRequest = makeHelloRequest();
+    qint64 sentBytes = s->sendall(helloRequest);
+    if (sentBytes < helloRequest.size()) {
+        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+    }
+    if (checkHelloResponse(s->recvall(2))) {
+        const QByteArray &authRequest = makeAuthRequest();
         sentBytes = s->sendall(authRequest);
         if (sentBytes < authRequest.size()) {
             throw Socks5Exception(Socks5Exception::ProxyProtocolError);
         }
-        const QByteArray authResponse = s->recvall(2);
-        if (authResponse.size() != 2) {
-            throw Socks5Exception(Socks5Exception::ProxyProtocolError);
-        }
-        if (authResponse.at(0) != S5_PASSWORDAUTH_VERSION) {
-            throw Socks5Exception(Socks5Exception::ProxyProtocolError);
-        }
-        if (authResponse.at(1) != 0x0) {
-            throw Socks5Exception(Socks5Exception::ProxyAuthenticationRequiredError);
-        }
-    } else if (helloResponse.at(1) == negOne) {
-        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+        readAuthResponse(s);
     }
     return s;
 }
@@ -227,12 +290,11 @@ static bool qt_socks5_set_host_name_and_port(const QString &hostname, quint16 po
     return true;
 }
 
-static QSharedPointer<Socket> sendConnectRequest(QSharedPointer<Socket> s, const QByteArray &connectRequest)
+// the bound address is null if the proxy replies a domain name.
+static QSharedPointer<Socket> readConnectResponse(QSharedPointer<Socket> s, HostAddress *boundAddress = nullptr,
+                                                  quint16 *boundPort = nullptr)
 {
-    qint64 sentBytes = s->sendall(connectRequest);
-    if (sentBytes < connectRequest.size()) {
-        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
-    }
+    HostAddress boundIp;
     const QByteArray &connectResponse = s->recvall(2);
     if (connectResponse.size() < 2) {
         throw Socks5Exception(Socks5Exception::ProxyProtocolError);
@@ -272,7 +334,6 @@ static QSharedPointer<Socket> sendConnectRequest(QSharedPointer<Socket> s, const
         if (ipv4.size() < 4) {
             throw Socks5Exception(Socks5Exception::ProxyProtocolError);
         }
-        HostAddress boundIp;
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 7, 0))
         boundIp.setAddress(qFromBigEndian<quint32>(reinterpret_cast<const void *>(ipv4.constData())));
 #else
@@ -283,7 +344,6 @@ static QSharedPointer<Socket> sendConnectRequest(QSharedPointer<Socket> s, const
         if (ipv6.size() < 16) {
             throw Socks5Exception(Socks5Exception::ProxyProtocolError);
         }
-        HostAddress boundIp;
         boundIp.setAddress(reinterpret_cast<quint8 *>(ipv6.data()));
     } else if (addressType.at(1) == S5_DOMAINNAME) {
         const QByteArray &len = s->recvall(1);
@@ -307,42 +367,205 @@ static QSharedPointer<Socket> sendConnectRequest(QSharedPointer<Socket> s, const
 #else
     quint16 port = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(portBytes.constData()));
 #endif
-
-    Q_UNUSED(port);
+    if (boundAddress) {
+        *boundAddress = boundIp;
+    }
+    if (boundPort) {
+        *boundPort = port;
+    }
 
     return s;
 }
 
-QSharedPointer<SocketLike> Socks5ProxyPrivate::connect(const QString &hostName, quint16 port) const
+QSharedPointer<Socket> Socks5ProxyPrivate::takeIdleSocket()
 {
-    QSharedPointer<Socket> s = getControlSocket();
-    QByteArray connectRequest = makeConnectRequest();
+    while (!idle.isEmpty()) {
+        QSharedPointer<Socket> s = idle.takeFirst();
+        if (s->isValid()) {
+            return s;
+        }
+    }
+    return QSharedPointer<Socket>();
+}
 
-    if (!qt_socks5_set_host_name_and_port(hostName, port, &connectRequest)) {
-        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+void Socks5ProxyPrivate::fillIdleSockets()
+{
+    while (idle.size() + warming < idleConnections) {
+        ++warming;
+        operations->spawn([this] {
+            try {
+                QSharedPointer<Socket> s = getControlSocket();
+                idle.append(s);
+            } catch (Socks5Exception &) {
+                // try again at next connect().
+            }
+            --warming;
+        });
     }
+}
 
-    QSharedPointer<Socket> ret = sendConnectRequest(s, connectRequest);
-    if (ret) {
-        return asSocketLike(ret);
+QSharedPointer<SocketLike> Socks5ProxyPrivate::connect(const QByteArray &connectRequest)
+{
+    QSharedPointer<Socket> s = takeIdleSocket();
+    if (!s.isNull()) {
+        fillIdleSockets();
+        try {
+            if (s->sendall(connectRequest) == connectRequest.size()) {
+                return asSocketLike(readConnectResponse(s));
+            }
+        } catch (Socks5Exception &e) {
+            // the proxy may close idle connections, and the idle one may be closed before it is used.
+            if (e.error() != Socks5Exception::ProxyProtocolError) {
+                throw;
+            }
+        }
+    } else {
+        fillIdleSockets();
     }
-    return QSharedPointer<SocketLike>();
+
+    if (pipelining) {
+        // the only one auth method is offered, so send all requests without waiting for the replies.
+        s = openSocket();
+        const QByteArray &authRequest = makeAuthRequest();
+        const QByteArray &request = makeHelloRequest() + authRequest + connectRequest;
+        if (s->sendall(request) < request.size()) {
+            throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+        }
+        const bool authRequired = checkHelloResponse(s->recvall(2));
+        if (authRequired != !authRequest.isEmpty()) {
+            // the CONNECT request is taken as the auth request, or the other way.
+            throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+        }
+        if (authRequired) {
+            readAuthResponse(s);
+        }
+    } else {
+        s = getControlSocket();
+        if (s->sendall(connectRequest) < connectRequest.size()) {
+            throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+        }
+    }
+    return asSocketLike(readConnectResponse(s));
 }
 
-QSharedPointer<SocketLike> Socks5ProxyPrivate::connect(const HostAddress &host, quint16 port) const
+QSharedPointer<SocketLike> Socks5ProxyPrivate::connect(const QString &hostName, quint16 port)
 {
-    QSharedPointer<Socket> s = getControlSocket();
     QByteArray connectRequest = makeConnectRequest();
+    if (!qt_socks5_set_host_name_and_port(hostName, port, &connectRequest)) {
+        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+    }
+    return connect(connectRequest);
+}
 
+QSharedPointer<SocketLike> Socks5ProxyPrivate::connect(const HostAddress &host, quint16 port)
+{
+    QByteArray connectRequest = makeConnectRequest();
     if (!qt_socks5_set_host_address_and_port(host, port, &connectRequest)) {
         throw Socks5Exception(Socks5Exception::ProxyProtocolError);
     }
+    return connect(connectRequest);
+}
 
-    QSharedPointer<Socket> ret = sendConnectRequest(s, connectRequest);
-    if (ret) {
-        return asSocketLike(ret);
+bool packSocks5UdpHeader(const QString &hostName, const HostAddress &address, quint16 port, QByteArray *buf)
+{
+    // RSV and FRAG
+    buf->append(static_cast<char>(0x00));
+    buf->append(static_cast<char>(0x00));
+    buf->append(static_cast<char>(0x00));
+    if (!hostName.isEmpty()) {
+        return qt_socks5_set_host_name_and_port(hostName, port, buf);
+    } else {
+        return qt_socks5_set_host_address_and_port(address, port, buf);
     }
-    return QSharedPointer<SocketLike>();
+}
+
+static inline quint16 readBigEndian16(const char *p)
+{
+    return static_cast<quint16>((static_cast<uchar>(p[0]) << 8) | static_cast<uchar>(p[1]));
+}
+
+int unpackSocks5UdpHeader(const char *data, int size, QString *hostName, HostAddress *address, quint16 *port)
+{
+    if (size < 4 || data[0] != 0 || data[1] != 0 || data[2] != 0) {
+        return -1;
+    }
+    int pos = 4;
+    if (data[3] == S5_IP_V4) {
+        if (size < pos + 4 + 2) {
+            return -1;
+        }
+        const quint32 ipv4 = (static_cast<quint32>(readBigEndian16(data + pos)) << 16) | readBigEndian16(data + pos + 2);
+        address->setAddress(ipv4);
+        hostName->clear();
+        pos += 4;
+    } else if (data[3] == S5_IP_V6) {
+        if (size < pos + 16 + 2) {
+            return -1;
+        }
+        address->setAddress(reinterpret_cast<const quint8 *>(data + pos));
+        hostName->clear();
+        pos += 16;
+    } else if (data[3] == S5_DOMAINNAME) {
+        if (size < pos + 1) {
+            return -1;
+        }
+        const int len = static_cast<uchar>(data[pos]);
+        ++pos;
+        if (len == 0 || size < pos + len + 2) {
+            return -1;
+        }
+        *hostName = QUrl::fromAce(QByteArray::fromRawData(data + pos, len));
+        *address = HostAddress();
+        pos += len;
+    } else {
+        return -1;
+    }
+    *port = readBigEndian16(data + pos);
+    return pos + 2;
+}
+
+class Socks5UdpAssociationPrivate
+{
+public:
+    QSharedPointer<Socket> control;
+    QSharedPointer<Socket> udp;
+    HostAddress relayAddress;
+    quint16 relayPort;
+};
+
+QSharedPointer<Socks5UdpAssociation> Socks5ProxyPrivate::udpAssociate() const
+{
+    QSharedPointer<Socket> control = getControlSocket();
+    const HostAddress &localAddress = control->localAddress();
+    QSharedPointer<Socket> udp(new Socket(localAddress.protocol(), Socket::UdpSocket));
+    if (!udp->bind(localAddress, 0)) {
+        throw Socks5Exception(Socks5Exception::SocksFailure);
+    }
+    QByteArray request;
+    request.append(static_cast<char>(S5_VERSION_5));
+    request.append(static_cast<char>(S5_UDP_ASSOCIATE));
+    request.append(static_cast<char>(0x00));
+    // where the datagrams come from, the proxy may ignore it if we are behind NAT.
+    if (!qt_socks5_set_host_address_and_port(localAddress, udp->localPort(), &request)) {
+        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+    }
+    if (control->sendall(request) < request.size()) {
+        throw Socks5Exception(Socks5Exception::ProxyProtocolError);
+    }
+    Socks5UdpAssociationPrivate *d = new Socks5UdpAssociationPrivate();
+    d->control = control;
+    d->udp = udp;
+    try {
+        readConnectResponse(control, &d->relayAddress, &d->relayPort);
+    } catch (...) {
+        delete d;
+        throw;
+    }
+    if (d->relayAddress.isNull() || d->relayAddress == HostAddress::AnyIPv4
+        || d->relayAddress == HostAddress::AnyIPv6) {
+        d->relayAddress = control->peerAddress();
+    }
+    return QSharedPointer<Socks5UdpAssociation>(new Socks5UdpAssociation(d));
 }
 
 QSharedPointer<SocketLike> Socks5ProxyPrivate::listen(quint16 port) const
@@ -365,6 +588,8 @@ Socks5Proxy::Socks5Proxy(const QString &hostName, quint16 port, const QString &u
 Socks5Proxy::Socks5Proxy(const Socks5Proxy &other)
     : d_ptr(new Socks5ProxyPrivate(other.d_ptr->hostName, other.d_ptr->port, other.d_ptr->user, other.d_ptr->password))
 {
+    d_ptr->idleConnections = other.d_ptr->idleConnections;
+    d_ptr->pipelining = other.d_ptr->pipelining;
 }
 
 Socks5Proxy::~Socks5Proxy()
@@ -377,6 +602,8 @@ Socks5Proxy &Socks5Proxy::operator=(const Socks5Proxy &other)
 {
     delete d_ptr;
     d_ptr = new Socks5ProxyPrivate(other.hostName(), other.port(), other.user(), other.password());
+    d_ptr->idleConnections = other.idleConnections();
+    d_ptr->pipelining = other.isPipeliningEnabled();
     return *this;
 }
 
@@ -454,18 +681,155 @@ void Socks5Proxy::setPassword(const QString &password)
     d->password = password;
 }
 
-QSharedPointer<SocketLike> Socks5Proxy::connect(const QString &hostName, quint16 port)
+bool Socks5Proxy::isPipeliningEnabled() const
+{
+    Q_D(const Socks5Proxy);
+    return d->pipelining;
+}
+
+void Socks5Proxy::setPipeliningEnabled(bool enabled)
+{
+    Q_D(Socks5Proxy);
+    d->pipelining = enabled;
+}
+
+int Socks5Proxy::idleConnections() const
 {
     Q_D(const Socks5Proxy);
+    return d->idleConnections;
+}
+
+void Socks5Proxy::setIdleConnections(int count)
+{
+    Q_D(Socks5Proxy);
+    d->idleConnections = qMax(0, count);
+    while (d->idle.size() > d->idleConnections) {
+        d->idle.removeLast();
+    }
+}
+
+void Socks5Proxy::prewarm()
+{
+    Q_D(Socks5Proxy);
+    d->fillIdleSockets();
+}
+
+QSharedPointer<SocketLike> Socks5Proxy::connect(const QString &hostName, quint16 port)
+{
+    Q_D(Socks5Proxy);
     return d->connect(hostName, port);
 }
 
 QSharedPointer<SocketLike> Socks5Proxy::connect(const HostAddress &host, quint16 port)
 {
-    Q_D(const Socks5Proxy);
+    Q_D(Socks5Proxy);
     return d->connect(host, port);
 }
 
+QSharedPointer<Socks5UdpAssociation> Socks5Proxy::udpAssociate()
+{
+    Q_D(const Socks5Proxy);
+    return d->udpAssociate();
+}
+
+Socks5UdpAssociation::Socks5UdpAssociation(Socks5UdpAssociationPrivate *d)
+    : d_ptr(d)
+{
+}
+
+Socks5UdpAssociation::~Socks5UdpAssociation()
+{
+    delete d_ptr;
+}
+
+qint32 Socks5UdpAssociation::sendto(const QByteArray &data, const HostAddress &addr, quint16 port)
+{
+    Q_D(Socks5UdpAssociation);
+    QByteArray datagram;
+    datagram.reserve(22 + data.size());
+    if (!packSocks5UdpHeader(QString(), addr, port, &datagram)) {
+        return -1;
+    }
+    datagram.append(data);
+    return d->udp->sendto(datagram, d->relayAddress, d->relayPort) == datagram.size() ? data.size() : -1;
+}
+
+qint32 Socks5UdpAssociation::sendto(const QByteArray &data, const QString &hostName, quint16 port)
+{
+    Q_D(Socks5UdpAssociation);
+    QByteArray datagram;
+    datagram.reserve(262 + data.size());
+    if (!packSocks5UdpHeader(hostName, HostAddress(), port, &datagram)) {
+        return -1;
+    }
+    datagram.append(data);
+    return d->udp->sendto(datagram, d->relayAddress, d->relayPort) == datagram.size() ? data.size() : -1;
+}
+
+qint32 Socks5UdpAssociation::sendtoMany(const QList<QByteArray> &datagrams, const HostAddress &addr, quint16 port)
+{
+    Q_D(Socks5UdpAssociation);
+    QByteArray header;
+    if (!packSocks5UdpHeader(QString(), addr, port, &header)) {
+        return -1;
+    }
+    QList<QByteArray> wrapped;
+    wrapped.reserve(datagrams.size());
+    for (const QByteArray &data : datagrams) {
+        wrapped.append(header + data);
+    }
+    return d->udp->sendtoMany(wrapped, d->relayAddress, d->relayPort);
+}
+
+QByteArray Socks5UdpAssociation::recvfrom(qint32 size, HostAddress *addr, quint16 *port)
+{
+    Q_D(Socks5UdpAssociation);
+    QByteArray buf(size + 262, Qt::Uninitialized);
+    while (true) {
+        HostAddress from;
+        quint16 fromPort = 0;
+        qint32 len = d->udp->recvfrom(buf.data(), buf.size(), &from, &fromPort);
+        if (len < 0) {
+            return QByteArray();
+        }
+        // drop the datagrams not relayed by the proxy.
+        if (from != d->relayAddress || fromPort != d->relayPort) {
+            continue;
+        }
+        QString hostName;
+        const int headerSize = unpackSocks5UdpHeader(buf.constData(), len, &hostName, addr, port);
+        if (headerSize < 0) {
+            continue;
+        }
+        return buf.mid(headerSize, qMin(size, len - headerSize));
+    }
+}
+
+void Socks5UdpAssociation::close()
+{
+    Q_D(Socks5UdpAssociation);
+    d->udp->close();
+    d->control->close();
+}
+
+bool Socks5UdpAssociation::isValid() const
+{
+    Q_D(const Socks5UdpAssociation);
+    return d->control->isValid() && d->udp->isValid();
+}
+
+HostAddress Socks5UdpAssociation::relayAddress() const
+{
+    Q_D(const Socks5UdpAssociation);
+    return d->relayAddress;
+}
+
+quint16 Socks5UdpAssociation::relayPort() const
+{
+    Q_D(const Socks5UdpAssociation);
+    return d->relayPort;
+}
+
 QSharedPointer<SocketLike> Socks5Proxy::listen(quint16 port)
 {
     Q_D(const Socks5Proxy);
@@ -2,6 +2,8 @@
 #include <QtCore/qdatetime.h>
 #include <QtCore/qurl.h>
 #include "../include/socket_server.h"
+#include "../include/private/socks5_p.h"
+#include "../include/access_log.h"
 #include "debugger.h"
 
 QTNG_LOGGER("qtng.socks5server");
@@ -49,6 +51,120 @@ void Socks5RequestHandler::doConnect(const QString &hostName, const HostAddress
     exchange(request, forward);
 }
 
+void Socks5RequestHandler::doUdpAssociate(const HostAddress &hostAddress, quint16 port)
+{
+    Q_UNUSED(hostAddress);
+    Q_UNUSED(port);
+    const HostAddress &localAddress = request->localAddress();
+    QSharedPointer<Socket> relay(new Socket(localAddress.protocol(), Socket::UdpSocket));
+    if (!relay->bind(localAddress, 0)) {
+        sendFailedReply();
+        logProxy(QString(), localAddress, 0, HostAddress(), false);
+        return;
+    }
+    if (!sendConnectReply(relay->localAddress(), relay->localPort())) {
+        logProxy(QString(), localAddress, relay->localPort(), relay->localAddress(), false);
+        return;
+    }
+    logProxy(QString(), localAddress, relay->localPort(), relay->localAddress(), true);
+
+    CoroutineGroup operations;
+    const HostAddress &clientAddress = request->peerAddress();
+    operations.spawn([this, relay, clientAddress] { relayDatagrams(relay, clientAddress); });
+    // the association terminates with the request.
+    char buf[64];
+    while (request->recv(buf, sizeof(buf)) > 0) { }
+    operations.killall();
+}
+
+// the datagrams are moved in batches by recvmmsg() and sendmmsg(), larger ones are dropped.
+const qint32 RelayDatagramSize = 1024 * 8;
+const qint32 RelayBatchSize = 16;
+const int MaxRelayTargets = 1024 * 4;
+
+void Socks5RequestHandler::relayDatagrams(QSharedPointer<Socket> relay, const HostAddress &clientAddress)
+{
+    // the targets sent by client, and the headers prepended to their replies. the others are not relayed.
+    QHash<QPair<CompactHostAddress, quint16>, QByteArray> targets;
+    QHash<QString, HostAddress> names;
+    quint16 clientPort = 0;  // learned from the first datagram of client.
+
+    QByteArray buffer(RelayDatagramSize * RelayBatchSize, Qt::Uninitialized);
+    qint32 sizes[RelayBatchSize];
+    HostAddress addrs[RelayBatchSize];
+    quint16 ports[RelayBatchSize];
+    QList<QByteArray> toClient;
+    QList<QByteArray> toTargets;
+    QVector<HostAddress> targetAddrs;
+    QVector<quint16> targetPorts;
+    while (true) {
+        const qint32 count = relay->recvfromMany(buffer.data(), RelayDatagramSize, RelayBatchSize, sizes, addrs, ports);
+        if (count <= 0) {
+            return;
+        }
+        for (qint32 i = 0; i < count; ++i) {
+            if (sizes[i] > RelayDatagramSize) {
+                qtng_debug << "drop truncated datagram from" << addrs[i] << ports[i];
+                continue;
+            }
+            const char *data = buffer.constData() + i * RelayDatagramSize;
+            if (addrs[i] == clientAddress && (clientPort == 0 || clientPort == ports[i])) {
+                clientPort = ports[i];
+                QString hostName;
+                HostAddress target;
+                quint16 targetPort = 0;
+                const int headerSize = unpackSocks5UdpHeader(data, sizes[i], &hostName, &target, &targetPort);
+                if (headerSize < 0 || targetPort == 0) {
+                    continue;
+                }
+                if (!hostName.isEmpty()) {
+                    QHash<QString, HostAddress>::const_iterator itor = names.constFind(hostName);
+                    if (itor != names.constEnd()) {
+                        target = itor.value();
+                    } else {
+                        const QList<HostAddress> &resolved = Socket::resolve(hostName);
+                        target = resolved.isEmpty() ? HostAddress() : resolved.first();
+                        names.insert(hostName, target);
+                    }
+                }
+                if (target.isNull()) {
+                    continue;
+                }
+                const QPair<CompactHostAddress, quint16> key(CompactHostAddress(target), targetPort);
+                if (!targets.contains(key)) {
+                    if (targets.size() >= MaxRelayTargets) {
+                        targets.clear();
+                    }
+                    QByteArray header;
+                    packSocks5UdpHeader(QString(), target, targetPort, &header);
+                    targets.insert(key, header);
+                }
+                // the buffer is not touched until they are sent.
+                toTargets.append(QByteArray::fromRawData(data + headerSize, sizes[i] - headerSize));
+                targetAddrs.append(target);
+                targetPorts.append(targetPort);
+            } else {
+                QHash<QPair<CompactHostAddress, quint16>, QByteArray>::const_iterator itor =
+                        targets.constFind(qMakePair(CompactHostAddress(addrs[i]), ports[i]));
+                if (itor == targets.constEnd() || clientPort == 0) {
+                    continue;
+                }
+                toClient.append(itor.value() + QByteArray::fromRawData(data, sizes[i]));
+            }
+        }
+        if (!toTargets.isEmpty()) {
+            relay->sendtoMany(toTargets, targetAddrs.constData(), targetPorts.constData());
+            toTargets.clear();
+            targetAddrs.clear();
+            targetPorts.clear();
+        }
+        if (!toClient.isEmpty()) {
+            relay->sendtoMany(toClient, clientAddress, clientPort);
+            toClient.clear();
+        }
+    }
+}
+
 bool Socks5RequestHandler::sendConnectReply(const HostAddress &hostAddress, quint16 port)
 {
     bool ok;
@@ -99,6 +215,12 @@ bool Socks5RequestHandler::sendConnectReply(const HostAddress &hostAddress, quin
 void Socks5RequestHandler::logProxy(const QString &hostName, const HostAddress &hostAddress, quint16 port,
                                     const HostAddress &forwardAddress, bool success)
 {
+    QSharedPointer<AccessLog> accessLog = server ? server->accessLog() : QSharedPointer<AccessLog>();
+    if (accessLog) {
+        const QString &host = hostName.isEmpty() ? hostAddress.toString() : hostName;
+        accessLog->logProxy(request->peerAddress(), QString::fromLatin1("CONNECT"), host, port, forwardAddress, success);
+        return;
+    }
     const QString &status = success ? QLatin1String("OK") : QLatin1String("FAIL");
     const QDateTime &now = QDateTime::currentDateTime();
     QString host;
@@ -182,15 +304,18 @@ void Socks5RequestHandler::handle()
         return;
     }
 
-    if ((hostName.isEmpty() && addr.isNull()) || port == 0) {
-        logProxy(QString(), HostAddress(), 0, HostAddress(), false);
-        return;
-    }
-
     switch (commandHeader.at(1)) {
     case S5_CONNECT:
+        if ((hostName.isEmpty() && addr.isNull()) || port == 0) {
+            logProxy(QString(), HostAddress(), 0, HostAddress(), false);
+            return;
+        }
         doConnect(hostName, addr, port);
         break;
+    case S5_UDP_ASSOCIATE:
+        // the client may not know its address and port yet, zeros are allowed.
+        doUdpAssociate(addr, port);
+        break;
     default:
         qtng_debug << "unsupported command: " << commandHeader.at(1);
         doFailed(hostName, addr, port);
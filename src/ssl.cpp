@@ -1,12 +1,51 @@
 #include <QtCore/qfile.h>
 #include <QtCore/qdatetime.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qset.h>
+#include <QtCore/qqueue.h>
+#include <QtCore/qurl.h>
+#include <algorithm>
+#include <limits.h>
 #include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#ifdef Q_OS_LINUX
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <linux/tls.h>
+#  include <errno.h>
+#  include <string.h>
+#  ifndef SOL_TLS
+#    define SOL_TLS 282
+#  endif
+#  ifndef TCP_ULP
+#    define TCP_ULP 31
+#  endif
+#endif
+#ifdef Q_OS_WIN
+#  include <winsock2.h>
+#else
+#  include <sys/socket.h>
+#  include <errno.h>
+#  ifndef MSG_NOSIGNAL
+#    define MSG_NOSIGNAL 0
+#  endif
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+#  define QTNG_HAVE_EARLY_DATA
+#endif
 #include "../include/locks.h"
+#include "../include/coroutine_utils.h"
 #include "../include/ssl.h"
 #include "../include/socket.h"
 #include "../include/private/socket_p.h"
 #include "../include/socket_utils.h"
+#include "../include/metrics.h"
 #include "../include/private/crypto_p.h"
+#include "../include/private/tracing_p.h"
 #include "debugger.h"
 
 QTNG_LOGGER("qtng.ssl");
@@ -212,15 +251,431 @@ QDebug operator<<(QDebug debug, const SslCipher &cipher)
     return debug;
 }
 
+// the X509_STORE is built once for a set of ca certificates, and shared by all contexts trusting them. the chains
+// verified are remembered until any certificate of them expires, or an hour passed. the store of system certificates
+// is loaded once at the first use, and kept till exit.
+class SslCertificateStore
+{
+public:
+    struct VerifiedChain
+    {
+        qint64 expiry;
+    };
+    explicit SslCertificateStore(const QList<Certificate> &caCertificates);
+    ~SslCertificateStore();
+public:
+    static QSharedPointer<SslCertificateStore> get(const QList<Certificate> &caCertificates);
+    static QSharedPointer<SslCertificateStore> system();
+    bool isVerified(const QByteArray &key);
+    void addVerified(const QByteArray &key, qint64 expiry);
+public:
+    X509_STORE *store;
+    QList<Certificate> certificates;  // of the system store, immutable.
+private:
+    QMutex mutex;
+    QHash<QByteArray, VerifiedChain> verified;
+};
+
+SslCertificateStore::SslCertificateStore(const QList<Certificate> &caCertificates)
+    : store(X509_STORE_new())
+{
+    if (!store) {
+        return;
+    }
+    if (caCertificates.isEmpty()) {
+        X509_STORE_set_default_paths(store);
+        // the certificates of hashed directory are looked up later, so only the bundle file is listed.
+        STACK_OF(X509_OBJECT) *objects = X509_STORE_get0_objects(store);
+        for (int i = 0; i < sk_X509_OBJECT_num(objects); ++i) {
+            X509 *x = X509_OBJECT_get0_X509(sk_X509_OBJECT_value(objects, i));
+            Certificate certificate;
+            if (x && openssl_setCertificate(&certificate, x)) {
+                certificates.append(certificate);
+            }
+        }
+    }
+    for (const Certificate &certificate : caCertificates) {
+        X509 *x = static_cast<X509 *>(certificate.handle());
+        if (x && !X509_STORE_add_cert(store, x)) {
+            qtng_debug << "can not add ca certificate.";
+        }
+    }
+}
+
+SslCertificateStore::~SslCertificateStore()
+{
+    if (store) {
+        X509_STORE_free(store);
+    }
+}
+
+static SslCertificateStore *loadSystemStore()
+{
+    // the store is kept till exit, and so is openssl.
+    initOpenSSL();
+    return new SslCertificateStore(QList<Certificate>());
+}
+
+QSharedPointer<SslCertificateStore> SslCertificateStore::system()
+{
+    // parsing hundreds of certificates takes milliseconds, so it is never done again.
+    static QSharedPointer<SslCertificateStore> store(loadSystemStore());
+    if (!store->store) {
+        return QSharedPointer<SslCertificateStore>();
+    }
+    return store;
+}
+
+QSharedPointer<SslCertificateStore> SslCertificateStore::get(const QList<Certificate> &caCertificates)
+{
+    if (caCertificates.isEmpty()) {
+        return system();
+    }
+    QSharedPointer<SslCertificateStore> systemStore = system();
+    if (!systemStore.isNull() && caCertificates.isSharedWith(systemStore->certificates)) {
+        // added by addCaCertificates(SslConfiguration::systemCaCertificates()), no need to digest them.
+        return systemStore;
+    }
+    static QMutex storesMutex;
+    static QMap<QByteArray, QWeakPointer<SslCertificateStore>> stores;
+    QList<QByteArray> digests;
+    for (const Certificate &certificate : caCertificates) {
+        digests.append(certificate.digest(MessageDigest::Sha256));
+    }
+    std::sort(digests.begin(), digests.end());
+    QByteArray key;
+    for (const QByteArray &digest : digests) {
+        key.append(digest);
+    }
+    QMutexLocker locker(&storesMutex);
+    QSharedPointer<SslCertificateStore> store = stores.value(key).toStrongRef();
+    if (store.isNull()) {
+        for (QMap<QByteArray, QWeakPointer<SslCertificateStore>>::iterator itor = stores.begin();
+             itor != stores.end();) {
+            if (itor.value().isNull()) {
+                itor = stores.erase(itor);
+            } else {
+                ++itor;
+            }
+        }
+        store.reset(new SslCertificateStore(caCertificates));
+        if (!store->store) {
+            return QSharedPointer<SslCertificateStore>();
+        }
+        stores.insert(key, store);
+    }
+    return store;
+}
+
+bool SslCertificateStore::isVerified(const QByteArray &key)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QByteArray, VerifiedChain>::iterator itor = verified.find(key);
+    if (itor == verified.end()) {
+        return false;
+    }
+    if (itor.value().expiry <= QDateTime::currentMSecsSinceEpoch()) {
+        verified.erase(itor);
+        return false;
+    }
+    return true;
+}
+
+void SslCertificateStore::addVerified(const QByteArray &key, qint64 expiry)
+{
+    const int MaxVerifiedChains = 1024;
+    QMutexLocker locker(&mutex);
+    if (verified.size() >= MaxVerifiedChains && !verified.contains(key)) {
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        QHash<QByteArray, VerifiedChain>::iterator soonest = verified.end();
+        for (QHash<QByteArray, VerifiedChain>::iterator itor = verified.begin(); itor != verified.end();) {
+            if (itor.value().expiry <= now) {
+                itor = verified.erase(itor);
+            } else {
+                if (soonest == verified.end() || itor.value().expiry < soonest.value().expiry) {
+                    soonest = itor;
+                }
+                ++itor;
+            }
+        }
+        if (verified.size() >= MaxVerifiedChains && soonest != verified.end()) {
+            verified.erase(soonest);
+        }
+    }
+    VerifiedChain chain;
+    chain.expiry = expiry;
+    verified.insert(key, chain);
+}
+
+// the argument of verify callback, owned by the context.
+struct SslVerifyTarget
+{
+    QSharedPointer<SslCertificateStore> store;
+    bool failIfInvalid;  // false for QueryPeer, the error is still reported by SSL_get_verify_result().
+};
+
+static QByteArray verifyHostOf(SSL *ssl);
+
+static QByteArray chainKey(X509_STORE_CTX *storeContext)
+{
+    QByteArray key;
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    X509 *leaf = X509_STORE_CTX_get0_cert(storeContext);
+    if (!leaf || !X509_digest(leaf, EVP_sha256(), md, &len)) {
+        return QByteArray();
+    }
+    key.append(reinterpret_cast<const char *>(md), static_cast<int>(len));
+    STACK_OF(X509) *untrusted = X509_STORE_CTX_get0_untrusted(storeContext);
+    for (int i = 0; untrusted && i < sk_X509_num(untrusted); ++i) {
+        if (!X509_digest(sk_X509_value(untrusted, i), EVP_sha256(), md, &len)) {
+            return QByteArray();
+        }
+        key.append(reinterpret_cast<const char *>(md), static_cast<int>(len));
+    }
+    // the result also depends on the depth and the purpose.
+    SSL *ssl = static_cast<SSL *>(X509_STORE_CTX_get_ex_data(storeContext, SSL_get_ex_data_X509_STORE_CTX_idx()));
+    key.append(ssl && SSL_is_server(ssl) ? 'c' : 's');
+    key.append(QByteArray::number(X509_VERIFY_PARAM_get_depth(X509_STORE_CTX_get0_param(storeContext))));
+    // a chain verified for one server name is not for another.
+    if (ssl) {
+        key.append('@').append(verifyHostOf(ssl));
+    }
+    return key;
+}
+
+static int verifyPeerChain(X509_STORE_CTX *storeContext, void *arg)
+{
+    SslVerifyTarget *target = static_cast<SslVerifyTarget *>(arg);
+    const QByteArray &key = chainKey(storeContext);
+    if (!key.isEmpty() && target->store->isVerified(key)) {
+        X509_STORE_CTX_set_error(storeContext, X509_V_OK);
+        return 1;
+    }
+    int ok = X509_verify_cert(storeContext);
+    if (ok > 0 && !key.isEmpty()) {
+        qint64 expiry = QDateTime::currentMSecsSinceEpoch() + 1000 * 3600;
+        STACK_OF(X509) *chain = X509_STORE_CTX_get0_chain(storeContext);
+        for (int i = 0; chain && i < sk_X509_num(chain); ++i) {
+            Certificate certificate;
+            if (openssl_setCertificate(&certificate, sk_X509_value(chain, i))) {
+                expiry = qMin(expiry, certificate.expiryDate().toMSecsSinceEpoch());
+            }
+        }
+        target->store->addVerified(key, expiry);
+    }
+    return target->failIfInvalid ? ok : 1;
+}
+
+// the contexts and client sessions are shared by the copies of one SslConfiguration and by all default ones, and dropped
+// if it is changed.
+class SslContextCache
+{
+public:
+    struct ClientSession
+    {
+        QString key;
+        QSharedPointer<SSL_SESSION> session;
+    };
+public:
+    QSharedPointer<SSL_SESSION> findSession(const QString &key);
+    void addSession(const QString &key, SSL_SESSION *session, int maxSize);  // take the reference of session.
+public:
+    QMutex mutex;
+    QSharedPointer<SSL_CTX> clientContext;
+    QSharedPointer<SSL_CTX> serverContext;
+    QList<ClientSession> sessions;  // the most recently used one is at the back.
+};
+
+QSharedPointer<SSL_SESSION> SslContextCache::findSession(const QString &key)
+{
+    QMutexLocker locker(&mutex);
+    for (int i = sessions.size() - 1; i >= 0; --i) {
+        if (sessions.at(i).key == key) {
+            sessions.move(i, sessions.size() - 1);
+            return sessions.last().session;
+        }
+    }
+    return QSharedPointer<SSL_SESSION>();
+}
+
+void SslContextCache::addSession(const QString &key, SSL_SESSION *session, int maxSize)
+{
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i < sessions.size(); ++i) {
+        if (sessions.at(i).key == key) {
+            sessions.removeAt(i);
+            break;
+        }
+    }
+    ClientSession item;
+    item.key = key;
+    item.session.reset(session, SSL_SESSION_free);
+    sessions.append(item);
+    while (sessions.size() > maxSize) {
+        sessions.removeFirst();
+    }
+}
+
+// every SSL of clients refers it by app data, so new sessions can be put into the cache.
+struct SslSessionTarget
+{
+    SslSessionTarget()
+        : maxSize(0)
+        , earlyDataWritten(0)
+        , earlyDataPending(false)
+    {
+    }
+    QSharedPointer<SslContextCache> cache;
+    QString key;
+    int maxSize;
+    QByteArray earlyData;  // to send by clients, or received by servers.
+    QByteArray verifyHost;  // the name which the certificate of server must match, in ascii.
+    int earlyDataWritten;
+    bool earlyDataPending;  // being written by clients or read by servers while handshaking.
+};
+
+static QByteArray verifyHostOf(SSL *ssl)
+{
+    SslSessionTarget *target = static_cast<SslSessionTarget *>(SSL_get_app_data(ssl));
+    return target ? target->verifyHost : QByteArray();
+}
+
+// the name is checked by X509_verify_cert() with the chain.
+static bool setVerifyHost(SSL *ssl, SslSessionTarget *target, const QString &name)
+{
+    X509_VERIFY_PARAM *param = SSL_get0_param(ssl);
+    const HostAddress address(name);
+    if (!address.isNull()) {
+        target->verifyHost = address.toString().toLatin1();
+        return X509_VERIFY_PARAM_set1_ip_asc(param, target->verifyHost.constData()) == 1;
+    }
+    target->verifyHost = QUrl::toAce(name);
+    if (target->verifyHost.isEmpty()) {
+        return false;
+    }
+    X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+    return X509_VERIFY_PARAM_set1_host(param, target->verifyHost.constData(),
+                                       static_cast<size_t>(target->verifyHost.size())) == 1;
+}
+
+static int handleNewSession(SSL *ssl, SSL_SESSION *session)
+{
+    SslSessionTarget *target = static_cast<SslSessionTarget *>(SSL_get_app_data(ssl));
+    if (!target || target->cache.isNull() || target->key.isEmpty()) {
+        return 0;
+    }
+    target->cache->addSession(target->key, session, target->maxSize);
+    return 1;
+}
+
+struct SslTicketKey
+{
+    unsigned char name[16];
+    unsigned char aesKey[32];
+    unsigned char hmacKey[32];
+    qint64 created;  // secs since epoch
+};
+
+// a new key is used to encrypt tickets every lifetime, and the previous one is still accepted.
+class SslTicketKeys
+{
+public:
+    explicit SslTicketKeys(int lifetime)
+        : lifetime(lifetime)
+    {
+    }
+public:
+    bool current(SslTicketKey *key);
+    bool find(const unsigned char *name, SslTicketKey *key, bool *renew);
+public:
+    QMutex mutex;
+    QList<SslTicketKey> keys;  // the newest one is at the front.
+    int lifetime;
+};
+
+bool SslTicketKeys::current(SslTicketKey *key)
+{
+    QMutexLocker locker(&mutex);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch() / 1000;
+    if (keys.isEmpty() || now - keys.first().created >= lifetime) {
+        SslTicketKey newKey;
+        if (RAND_bytes(newKey.name, sizeof(newKey.name)) != 1 || RAND_bytes(newKey.aesKey, sizeof(newKey.aesKey)) != 1
+            || RAND_bytes(newKey.hmacKey, sizeof(newKey.hmacKey)) != 1) {
+            return false;
+        }
+        newKey.created = now;
+        keys.prepend(newKey);
+        while (keys.size() > 2) {
+            keys.removeLast();
+        }
+    }
+    *key = keys.first();
+    return true;
+}
+
+bool SslTicketKeys::find(const unsigned char *name, SslTicketKey *key, bool *renew)
+{
+    QMutexLocker locker(&mutex);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch() / 1000;
+    for (int i = 0; i < keys.size(); ++i) {
+        const SslTicketKey &k = keys.at(i);
+        if (memcmp(k.name, name, sizeof(k.name)) == 0) {
+            if (now - k.created >= static_cast<qint64>(lifetime) * 2) {
+                return false;
+            }
+            *key = k;
+            // issue a new ticket if it is encrypted by an old key.
+            *renew = i > 0 || now - k.created >= lifetime;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int handleTicketKey(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cipherContext,
+                           HMAC_CTX *hmacContext, int encrypt)
+{
+    SslTicketKeys *keys = static_cast<SslTicketKeys *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    if (!keys) {
+        return -1;
+    }
+    SslTicketKey key;
+    if (encrypt) {
+        if (!keys->current(&key) || RAND_bytes(iv, 16) != 1) {
+            return -1;
+        }
+        memcpy(name, key.name, sizeof(key.name));
+        if (!EVP_EncryptInit_ex(cipherContext, EVP_aes_256_cbc(), nullptr, key.aesKey, iv)
+            || !HMAC_Init_ex(hmacContext, key.hmacKey, sizeof(key.hmacKey), EVP_sha256(), nullptr)) {
+            return -1;
+        }
+        return 1;
+    }
+    bool renew = false;
+    if (!keys->find(name, &key, &renew)) {
+        // do a full handshake.
+        return 0;
+    }
+    if (!HMAC_Init_ex(hmacContext, key.hmacKey, sizeof(key.hmacKey), EVP_sha256(), nullptr)
+        || !EVP_DecryptInit_ex(cipherContext, EVP_aes_256_cbc(), nullptr, key.aesKey, iv)) {
+        return -1;
+    }
+    return renew ? 2 : 1;
+}
+
 class SslConfigurationPrivate : public QSharedData
 {
 public:
     SslConfigurationPrivate();
-    SslConfigurationPrivate(const SslConfigurationPrivate &) = default;
+    SslConfigurationPrivate(const SslConfigurationPrivate &other);
     bool isNull() const;
     bool operator==(const SslConfigurationPrivate &other) const;
     static QSharedPointer<SSL_CTX> makeContext(const SslConfiguration &config, bool asServer);
+    static QSharedPointer<SSL_CTX> context(const SslConfiguration &config, bool asServer);  // made once.
+    static QSharedPointer<SslContextCache> cacheOf(const SslConfiguration &config) { return config.d->cache; }
     void setSendTlsExtHostName(bool sendTlsExtHostName);
+    void changed() { cache.reset(new SslContextCache()); }
 
     QList<Certificate> caCertificates;
     Certificate localCertificate;
@@ -229,7 +684,16 @@ public:
     Ssl::PeerVerifyMode peerVerifyMode;
     QList<SslCipher> ciphers;
     QSharedPointer<ChooseTlsExtNameCallback> chooseTlsExtNameCallback;
+    QHash<QString, SslConfiguration> serverNames;  // the lower case names.
+    QSharedPointer<OcspStaplingCallback> ocspStapling;
+    QSharedPointer<SslContextCache> cache;
+    QSharedPointer<ThreadPool> handshakeThreadPool;
     int peerVerifyDepth;
+    int sessionCacheSize;
+    int sessionTicketKeyLifetime;
+    int dynamicRecordThreshold;
+    int maxEarlyData;
+    bool kernelTls;
     bool onlySecureProtocol;
     bool supportCompression;
 };
@@ -239,27 +703,74 @@ bool SslConfigurationPrivate::operator==(const SslConfigurationPrivate &other) c
     return caCertificates == other.caCertificates && localCertificate == other.localCertificate
             && privateKey == other.privateKey && allowedNextProtocols == other.allowedNextProtocols
             && peerVerifyMode == other.peerVerifyMode && ciphers == other.ciphers
-            && chooseTlsExtNameCallback == other.chooseTlsExtNameCallback && peerVerifyDepth == other.peerVerifyDepth
-            && onlySecureProtocol == other.onlySecureProtocol && supportCompression == other.supportCompression;
+            && chooseTlsExtNameCallback == other.chooseTlsExtNameCallback && serverNames == other.serverNames
+            && ocspStapling == other.ocspStapling
+            && handshakeThreadPool == other.handshakeThreadPool && peerVerifyDepth == other.peerVerifyDepth
+            && sessionCacheSize == other.sessionCacheSize && sessionTicketKeyLifetime == other.sessionTicketKeyLifetime
+            && dynamicRecordThreshold == other.dynamicRecordThreshold && maxEarlyData == other.maxEarlyData
+            && kernelTls == other.kernelTls && onlySecureProtocol == other.onlySecureProtocol && supportCompression == other.supportCompression;
 }
 
 bool SslConfigurationPrivate::isNull() const
 {
     return caCertificates.isEmpty() && localCertificate.isNull() && !privateKey.isValid()
             && allowedNextProtocols.isEmpty() && peerVerifyMode == Ssl::AutoVerifyPeer && ciphers.isEmpty()
-            && chooseTlsExtNameCallback.isNull() && peerVerifyDepth == 4 && onlySecureProtocol == true
-            && supportCompression == true;
+            && chooseTlsExtNameCallback.isNull() && serverNames.isEmpty() && ocspStapling.isNull()
+            && handshakeThreadPool.isNull() && peerVerifyDepth == 4 && sessionCacheSize == 1024
+            && sessionTicketKeyLifetime == 3600 && dynamicRecordThreshold == 1024 * 1024 && maxEarlyData == 0
+            && !kernelTls && onlySecureProtocol == true && supportCompression == true;
+}
+
+// every SslSocket made without a configuration has a new default one, they share the contexts and client sessions
+// instead of loading the ca certificates again for every connection.
+Q_GLOBAL_STATIC_WITH_ARGS(QSharedPointer<SslContextCache>, defaultContextCache, (new SslContextCache()))
+
+static QSharedPointer<SslContextCache> sharedDefaultCache()
+{
+    QSharedPointer<SslContextCache> *cache = defaultContextCache();
+    return cache ? *cache : QSharedPointer<SslContextCache>(new SslContextCache());  // destroyed at exit.
 }
 
 SslConfigurationPrivate::SslConfigurationPrivate()
     : peerVerifyMode(Ssl::AutoVerifyPeer)
+    , cache(sharedDefaultCache())
     , peerVerifyDepth(4)
+    , sessionCacheSize(1024)
+    , sessionTicketKeyLifetime(3600)
+    , dynamicRecordThreshold(1024 * 1024)
+    , maxEarlyData(0)
+    , kernelTls(false)
     , onlySecureProtocol(true)
     , supportCompression(true)
 {
     setSendTlsExtHostName(true);
 }
 
+// the detached copy is going to be changed, so it does not share the cache.
+SslConfigurationPrivate::SslConfigurationPrivate(const SslConfigurationPrivate &other)
+    : QSharedData(other)
+    , caCertificates(other.caCertificates)
+    , localCertificate(other.localCertificate)
+    , privateKey(other.privateKey)
+    , allowedNextProtocols(other.allowedNextProtocols)
+    , peerVerifyMode(other.peerVerifyMode)
+    , ciphers(other.ciphers)
+    , chooseTlsExtNameCallback(other.chooseTlsExtNameCallback)
+    , serverNames(other.serverNames)
+    , ocspStapling(other.ocspStapling)
+    , cache(new SslContextCache())
+    , handshakeThreadPool(other.handshakeThreadPool)
+    , peerVerifyDepth(other.peerVerifyDepth)
+    , sessionCacheSize(other.sessionCacheSize)
+    , sessionTicketKeyLifetime(other.sessionTicketKeyLifetime)
+    , dynamicRecordThreshold(other.dynamicRecordThreshold)
+    , maxEarlyData(other.maxEarlyData)
+    , kernelTls(other.kernelTls)
+    , onlySecureProtocol(other.onlySecureProtocol)
+    , supportCompression(other.supportCompression)
+{
+}
+
 class AlwaysTheSameChooseTlsExtNameCallback : public ChooseTlsExtNameCallback
 {
     virtual QString choose(const QString &hostName) override { return hostName; }
@@ -275,6 +786,122 @@ void SslConfigurationPrivate::setSendTlsExtHostName(bool sendTlsExtHostName)
     }
 }
 
+// the alpn wire format: every protocol is prefixed by its length in one byte.
+static QByteArray toAlpnProtocols(const QList<QByteArray> &protocols)
+{
+    QByteArray wire;
+    for (const QByteArray &protocol : protocols) {
+        if (protocol.isEmpty() || protocol.size() > 255) {
+            qtng_warning << "invalid alpn protocol:" << protocol;
+            continue;
+        }
+        wire.append(static_cast<char>(protocol.size()));
+        wire.append(protocol);
+    }
+    return wire;
+}
+
+static int selectAlpnProtocol(SSL *, const unsigned char **out, unsigned char *outlen, const unsigned char *in,
+                              unsigned int inlen, void *arg)
+{
+    const QByteArray *protocols = static_cast<const QByteArray *>(arg);
+    unsigned char *selected = nullptr;
+    // prefer the order of server.
+    int r = SSL_select_next_proto(&selected, outlen, reinterpret_cast<const unsigned char *>(protocols->constData()),
+                                  static_cast<unsigned int>(protocols->size()), in, inlen);
+    if (r != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+// switch to the context of the configuration added for the server name. the session and ticket callbacks keep using
+// the original context.
+static int selectServerName(SSL *ssl, int *, void *arg)
+{
+    const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!name) {
+        return SSL_TLSEXT_ERR_OK;
+    }
+    const QHash<QString, SslConfiguration> *serverNames = static_cast<const QHash<QString, SslConfiguration> *>(arg);
+    const QString &hostName = QString::fromLatin1(name).toLower();
+    QHash<QString, SslConfiguration>::const_iterator itor = serverNames->constFind(hostName);
+    if (itor == serverNames->constEnd()) {
+        int dot = hostName.indexOf(QLatin1Char('.'));
+        if (dot <= 0) {
+            return SSL_TLSEXT_ERR_OK;
+        }
+        itor = serverNames->constFind(QLatin1Char('*') + hostName.mid(dot));
+        if (itor == serverNames->constEnd()) {
+            return SSL_TLSEXT_ERR_OK;
+        }
+    }
+    const QSharedPointer<SSL_CTX> &ctx = SslConfigurationPrivate::context(itor.value(), true);
+    if (ctx.isNull() || !SSL_set_SSL_CTX(ssl, ctx.data())) {
+        qtng_debug << "can not switch ssl context for" << hostName;
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+    SSL_set_verify(ssl, SSL_CTX_get_verify_mode(ctx.data()), nullptr);
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static int stapleOcspResponse(SSL *ssl, void *arg)
+{
+    const QByteArray &response = static_cast<OcspStaplingCallback *>(arg)->response();
+    if (response.isEmpty()) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    unsigned char *buf = static_cast<unsigned char *>(OPENSSL_malloc(static_cast<size_t>(response.size())));
+    if (!buf) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    memcpy(buf, response.constData(), static_cast<size_t>(response.size()));
+    SSL_set_tlsext_status_ocsp_resp(ssl, buf, response.size());  // takes the buffer.
+    return SSL_TLSEXT_ERR_OK;
+}
+
+#ifdef QTNG_HAVE_EARLY_DATA
+// openssl rejects the early data of tickets older than their age allows, which is 10 seconds off at most. within the
+// window, a ClientHello replayed by attackers has the same random as the one seen, so it is rejected.
+class EarlyDataReplayFilter
+{
+public:
+    enum { WindowMsecs = 10 * 1000 };
+    bool accept(const QByteArray &clientRandom);
+public:
+    QMutex mutex;
+    QSet<QByteArray> seen;
+    QQueue<QPair<qint64, QByteArray>> expiries;
+};
+
+bool EarlyDataReplayFilter::accept(const QByteArray &clientRandom)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker locker(&mutex);
+    while (!expiries.isEmpty() && expiries.head().first <= now) {
+        seen.remove(expiries.dequeue().second);
+    }
+    if (seen.contains(clientRandom)) {
+        return false;
+    }
+    seen.insert(clientRandom);
+    expiries.enqueue(qMakePair(now + WindowMsecs, clientRandom));
+    return true;
+}
+
+Q_GLOBAL_STATIC(EarlyDataReplayFilter, earlyDataReplayFilter)
+
+static int allowEarlyData(SSL *ssl, void *)
+{
+    unsigned char clientRandom[SSL3_RANDOM_SIZE];
+    size_t len = SSL_get_client_random(ssl, clientRandom, sizeof(clientRandom));
+    return earlyDataReplayFilter()->accept(QByteArray(reinterpret_cast<char *>(clientRandom), static_cast<int>(len)))
+            ? 1
+            : 0;
+}
+#endif
+
 QSharedPointer<SSL_CTX> SslConfigurationPrivate::makeContext(const SslConfiguration &config, bool asServer)
 {
     QSharedPointer<SSL_CTX> ctx;
@@ -287,18 +914,112 @@ QSharedPointer<SSL_CTX> SslConfigurationPrivate::makeContext(const SslConfigurat
     if (!method) {
         return ctx;
     }
-    ctx.reset(SSL_CTX_new(method), SSL_CTX_free);
+    const QByteArray &alpnProtocols = toAlpnProtocols(config.allowedNextProtocols());
+    // the select callback of server refers the protocols until the context is freed.
+    QByteArray *serverProtocols = asServer && !alpnProtocols.isEmpty() ? new QByteArray(alpnProtocols) : nullptr;
+    const int sessionCacheSize = config.sessionCacheSize();
+    const int ticketKeyLifetime = config.sessionTicketKeyLifetime();
+    SslTicketKeys *ticketKeys =
+            asServer && sessionCacheSize > 0 && ticketKeyLifetime > 0 ? new SslTicketKeys(ticketKeyLifetime) : nullptr;
+    // the cached contexts of them are kept alive by the copied configurations.
+    QHash<QString, SslConfiguration> *serverNames = asServer && !config.d->serverNames.isEmpty()
+            ? new QHash<QString, SslConfiguration>(config.d->serverNames)
+            : nullptr;
+    const QSharedPointer<OcspStaplingCallback> ocspStapling =
+            asServer ? config.d->ocspStapling : QSharedPointer<OcspStaplingCallback>();
+    const Ssl::PeerVerifyMode verifyMode = config.peerVerifyMode();
+    SslVerifyTarget *verifyTarget = nullptr;
+    if (verifyMode == Ssl::VerifyPeer || verifyMode == Ssl::QueryPeer) {
+        verifyTarget = new SslVerifyTarget();
+        verifyTarget->store = SslCertificateStore::get(config.caCertificates());
+        verifyTarget->failIfInvalid = (verifyMode == Ssl::VerifyPeer);
+        if (verifyTarget->store.isNull()) {
+            delete verifyTarget;
+            verifyTarget = nullptr;
+            qtng_debug << "can not create certificate store.";
+        }
+    }
+    ctx.reset(SSL_CTX_new(method), [serverProtocols, serverNames, ocspStapling, ticketKeys, verifyTarget](SSL_CTX *ctx) {
+        Q_UNUSED(ocspStapling);  // kept alive by the context.
+        SSL_CTX_free(ctx);
+        delete serverProtocols;
+        delete serverNames;
+        delete ticketKeys;
+        delete verifyTarget;
+    });
     if (ctx.isNull()) {
+        // qt does not call the deleter of null pointer.
+        delete serverProtocols;
+        delete serverNames;
+        delete ticketKeys;
+        delete verifyTarget;
         return ctx;
     }
+    if (serverNames) {
+        SSL_CTX_set_tlsext_servername_callback(ctx.data(), selectServerName);
+        SSL_CTX_set_tlsext_servername_arg(ctx.data(), serverNames);
+    }
+    if (!ocspStapling.isNull()) {
+        SSL_CTX_set_tlsext_status_cb(ctx.data(), stapleOcspResponse);
+        SSL_CTX_set_tlsext_status_arg(ctx.data(), ocspStapling.data());
+    }
+    if (serverProtocols) {
+        SSL_CTX_set_alpn_select_cb(ctx.data(), selectAlpnProtocol, serverProtocols);
+    } else if (!alpnProtocols.isEmpty()) {
+        if (SSL_CTX_set_alpn_protos(ctx.data(), reinterpret_cast<const unsigned char *>(alpnProtocols.constData()),
+                                    static_cast<unsigned int>(alpnProtocols.size()))
+            != 0) {
+            qtng_debug << "can not set alpn protocols.";
+        }
+    }
     SSL_CTX_set_verify_depth(ctx.data(), config.peerVerifyDepth());
+    if (verifyTarget) {
+        // AutoVerifyPeer keeps the old behavior, no verification.
+        X509_STORE_up_ref(verifyTarget->store->store);
+        SSL_CTX_set_cert_store(ctx.data(), verifyTarget->store->store);
+        SSL_CTX_set_cert_verify_callback(ctx.data(), verifyPeerChain, verifyTarget);
+        int mode = SSL_VERIFY_PEER;
+        if (asServer && verifyMode == Ssl::VerifyPeer) {
+            mode |= SSL_VERIFY_FAIL_IF_NO_PEER_CERT;
+        }
+        SSL_CTX_set_verify(ctx.data(), mode, nullptr);
+    }
     long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_TLSv1;
+    if (sessionCacheSize <= 0) {
+        SSL_CTX_set_session_cache_mode(ctx.data(), SSL_SESS_CACHE_OFF);
+        flags |= SSL_OP_NO_TICKET;
+    } else if (asServer) {
+        static const unsigned char sessionIdContext[] = "qtng";
+        SSL_CTX_set_session_cache_mode(ctx.data(), SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx.data(), sessionCacheSize);
+        SSL_CTX_set_session_id_context(ctx.data(), sessionIdContext, sizeof(sessionIdContext) - 1);
+        if (ticketKeys) {
+            SSL_CTX_set_timeout(ctx.data(), ticketKeyLifetime * 2);
+            SSL_CTX_set_app_data(ctx.data(), ticketKeys);
+            SSL_CTX_set_tlsext_ticket_key_cb(ctx.data(), handleTicketKey);
+        } else {
+            flags |= SSL_OP_NO_TICKET;
+        }
+    } else {
+        // the sessions are kept by SslContextCache, and also the tickets of tls 1.3 after handshake.
+        SSL_CTX_set_session_cache_mode(ctx.data(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx.data(), handleNewSession);
+    }
     if (config.onlySecureProtocol()) {
         flags |= SSL_OP_NO_TLSv1_1;
     }
     if (!config.supportCompression()) {
         flags |= SSL_OP_NO_COMPRESSION;
     }
+#ifdef QTNG_HAVE_EARLY_DATA
+    if (asServer && config.maxEarlyData() > 0 && sessionCacheSize > 0) {
+        // the tickets are stateless, so the replays are filtered by us instead of the session cache of openssl.
+        flags |= SSL_OP_NO_ANTI_REPLAY;
+        SSL_CTX_set_max_early_data(ctx.data(), static_cast<uint32_t>(config.maxEarlyData()));
+        SSL_CTX_set_recv_max_early_data(ctx.data(), static_cast<uint32_t>(config.maxEarlyData()));
+        SSL_CTX_set_allow_early_data_cb(ctx.data(), allowEarlyData, nullptr);
+    }
+#endif
     SSL_CTX_set_options(ctx.data(), flags);
     const PrivateKey &privateKey = config.privateKey();
     if (privateKey.isValid()) {
@@ -317,6 +1038,17 @@ QSharedPointer<SSL_CTX> SslConfigurationPrivate::makeContext(const SslConfigurat
     return ctx;
 }
 
+QSharedPointer<SSL_CTX> SslConfigurationPrivate::context(const SslConfiguration &config, bool asServer)
+{
+    QSharedPointer<SslContextCache> cache = config.d->cache;
+    QMutexLocker locker(&cache->mutex);
+    QSharedPointer<SSL_CTX> &ctx = asServer ? cache->serverContext : cache->clientContext;
+    if (ctx.isNull()) {
+        ctx = makeContext(config, asServer);
+    }
+    return ctx;
+}
+
 SslConfiguration::SslConfiguration()
     : d(new SslConfigurationPrivate())
 {
@@ -396,6 +1128,36 @@ PrivateKey SslConfiguration::privateKey() const
     return d->privateKey;
 }
 
+int SslConfiguration::sessionCacheSize() const
+{
+    return d->sessionCacheSize;
+}
+
+int SslConfiguration::sessionTicketKeyLifetime() const
+{
+    return d->sessionTicketKeyLifetime;
+}
+
+bool SslConfiguration::kernelTlsEnabled() const
+{
+    return d->kernelTls;
+}
+
+int SslConfiguration::dynamicRecordThreshold() const
+{
+    return d->dynamicRecordThreshold;
+}
+
+int SslConfiguration::maxEarlyData() const
+{
+    return d->maxEarlyData;
+}
+
+QSharedPointer<ThreadPool> SslConfiguration::handshakeThreadPool() const
+{
+    return d->handshakeThreadPool;
+}
+
 bool SslConfiguration::onlySecureProtocol() const
 {
     return d->onlySecureProtocol;
@@ -416,34 +1178,50 @@ QSharedPointer<ChooseTlsExtNameCallback> SslConfiguration::tlsExtHostNameCallbac
     return d->chooseTlsExtNameCallback;
 }
 
+QHash<QString, SslConfiguration> SslConfiguration::serverNameConfigurations() const
+{
+    return d->serverNames;
+}
+
+QSharedPointer<OcspStaplingCallback> SslConfiguration::ocspStaplingCallback() const
+{
+    return d->ocspStapling;
+}
+
 void SslConfiguration::addCaCertificate(const Certificate &certificate)
 {
     d->caCertificates.append(certificate);
+    d->changed();
 }
 
 void SslConfiguration::addCaCertificates(const QList<Certificate> &certificates)
 {
     d->caCertificates.append(certificates);
+    d->changed();
 }
 
 void SslConfiguration::setAllowedNextProtocols(const QList<QByteArray> &protocols)
 {
     d->allowedNextProtocols = protocols;
+    d->changed();
 }
 
 void SslConfiguration::setPeerVerifyDepth(int depth)
 {
     d->peerVerifyDepth = depth;
+    d->changed();
 }
 
 void SslConfiguration::setPeerVerifyMode(Ssl::PeerVerifyMode mode)
 {
     d->peerVerifyMode = mode;
+    d->changed();
 }
 
 void SslConfiguration::setLocalCertificate(const Certificate &certificate)
 {
     d->localCertificate = certificate;
+    d->changed();
 }
 
 bool SslConfiguration::setLocalCertificate(const QString &path, Ssl::EncodingFormat format)
@@ -467,12 +1245,14 @@ bool SslConfiguration::setLocalCertificate(const QString &path, Ssl::EncodingFor
         return false;
     }
     d->localCertificate = cert;
+    d->changed();
     return true;
 }
 
 void SslConfiguration::setPrivateKey(const PrivateKey &key)
 {
     d->privateKey = key;
+    d->changed();
 }
 
 bool SslConfiguration::setPrivateKey(const QString &fileName, Ssl::EncodingFormat format, const QByteArray &passPhrase)
@@ -496,27 +1276,90 @@ bool SslConfiguration::setPrivateKey(const QString &fileName, Ssl::EncodingForma
         return false;
     }
     d->privateKey = key;
+    d->changed();
+    return true;
+}
+
+void SslConfiguration::setSessionCacheSize(int size)
+{
+    d->sessionCacheSize = size;
+    d->changed();
+}
+
+void SslConfiguration::setSessionTicketKeyLifetime(int seconds)
+{
+    d->sessionTicketKeyLifetime = seconds;
+    d->changed();
+}
+
+void SslConfiguration::setKernelTlsEnabled(bool enabled)
+{
+    // the contexts are not changed.
+    d->kernelTls = enabled;
+}
+
+void SslConfiguration::setDynamicRecordThreshold(int bytes)
+{
+    // the contexts are not changed.
+    d->dynamicRecordThreshold = qMax(bytes, 0);
+}
+
+bool SslConfiguration::setMaxEarlyData(int bytes)
+{
+#ifdef QTNG_HAVE_EARLY_DATA
+    d->maxEarlyData = qMax(bytes, 0);
+    d->changed();
     return true;
+#else
+    return bytes <= 0;
+#endif
+}
+
+void SslConfiguration::setHandshakeThreadPool(QSharedPointer<ThreadPool> pool)
+{
+    d->handshakeThreadPool = pool;
 }
 
 void SslConfiguration::setOnlySecureProtocol(bool onlySecureProtocol)
 {
     d->onlySecureProtocol = onlySecureProtocol;
+    d->changed();
 }
 
 void SslConfiguration::setSupportCompression(bool supportCompression)
 {
     d->supportCompression = supportCompression;
+    d->changed();
 }
 
 void SslConfiguration::setSendTlsExtHostName(bool sendTlsExtHostName)
 {
     d->setSendTlsExtHostName(sendTlsExtHostName);
+    d->changed();
+}
+
+void SslConfiguration::addServerNameConfiguration(const QString &hostName, const SslConfiguration &config)
+{
+    d->serverNames.insert(hostName.toLower(), config);
+    d->changed();
+}
+
+void SslConfiguration::setOcspStaplingCallback(QSharedPointer<OcspStaplingCallback> callback)
+{
+    d->ocspStapling = callback;
+    d->changed();
 }
 
 void SslConfiguration::setTlsExtHostNameCallback(QSharedPointer<ChooseTlsExtNameCallback> callback)
 {
     d->chooseTlsExtNameCallback = callback;
+    d->changed();
+}
+
+QList<Certificate> SslConfiguration::systemCaCertificates()
+{
+    QSharedPointer<SslCertificateStore> store = SslCertificateStore::system();
+    return store.isNull() ? QList<Certificate>() : store->certificates;
 }
 
 QList<SslCipher> SslConfiguration::supportedCiphers()
@@ -705,7 +1548,6 @@ QDebug &operator<<(QDebug &debug, const SslError::Error &error)
     return debug;
 }
 
-/*
 static SslError _q_OpenSSL_to_SslError(int errorCode, const Certificate &cert)
 {
     SslError error;
@@ -749,12 +1591,285 @@ static SslError _q_OpenSSL_to_SslError(int errorCode, const Certificate &cert)
         error = SslError(SslError::CertificateUntrusted, cert); break;
     case X509_V_ERR_CERT_REJECTED:
         error = SslError(SslError::CertificateRejected, cert); break;
+    case X509_V_ERR_HOSTNAME_MISMATCH:
+    case X509_V_ERR_IP_ADDRESS_MISMATCH:
+        error = SslError(SslError::HostNameMismatch, cert); break;
     default:
         error = SslError(SslError::UnspecifiedError, cert); break;
     }
     return error;
 }
-*/
+
+struct SslSocketBioTarget
+{
+    SslSocketBioTarget()
+        : socket(nullptr)
+        , kernelTls(false)
+    {
+    }
+    Socket *socket;
+    bool kernelTls;  // the kernel encrypts what we send, records made by openssl can not be sent any more.
+};
+
+// one recv() or send() of the nonblocking socket. returns -1 and sets *retry if the socket is not ready.
+static int socketTryIo(Socket *socket, char *data, int size, bool reading, bool *retry)
+{
+    *retry = false;
+#ifdef Q_OS_WIN
+    const SOCKET fd = static_cast<SOCKET>(socket->fileno());
+    int r = reading ? ::recv(fd, data, size, 0) : ::send(fd, data, size, 0);
+    if (r == SOCKET_ERROR) {
+        *retry = WSAGetLastError() == WSAEWOULDBLOCK;
+        return -1;
+    }
+#else
+    const int fd = static_cast<int>(socket->fileno());
+    ssize_t r;
+    do {
+        r = reading ? ::recv(fd, data, static_cast<size_t>(size), 0)
+                    : ::send(fd, data, static_cast<size_t>(size), MSG_NOSIGNAL);
+    } while (r < 0 && errno == EINTR);
+    if (r < 0) {
+        *retry = errno == EAGAIN || errno == EWOULDBLOCK;
+        return -1;
+    }
+#endif
+    return static_cast<int>(r);
+}
+
+// reads and writes the socket directly, so no copy to memory BIOs is needed. it never blocks inside openssl: the
+// socket not ready is reported as a retry, and SslConnection waits for it by the socket watcher outside of openssl.
+static int socketBioWrite(BIO *bio, const char *data, int size)
+{
+    BIO_clear_retry_flags(bio);
+    SslSocketBioTarget *target = static_cast<SslSocketBioTarget *>(BIO_get_data(bio));
+    if (!target || !target->socket || target->kernelTls || size <= 0) {
+        return -1;
+    }
+    bool retry;
+    int bs = socketTryIo(target->socket, const_cast<char *>(data), size, false, &retry);
+    if (bs < 0 && retry) {
+        BIO_set_retry_write(bio);
+    }
+    return bs;
+}
+
+static int socketBioRead(BIO *bio, char *data, int size)
+{
+    BIO_clear_retry_flags(bio);
+    SslSocketBioTarget *target = static_cast<SslSocketBioTarget *>(BIO_get_data(bio));
+    if (!target || !target->socket || size <= 0) {
+        return -1;
+    }
+    bool retry;
+    int bs = socketTryIo(target->socket, data, size, true, &retry);
+    if (bs < 0 && retry) {
+        BIO_set_retry_read(bio);
+    }
+    return bs;
+}
+
+static int socketBioPuts(BIO *bio, const char *str)
+{
+    return socketBioWrite(bio, str, static_cast<int>(qstrlen(str)));
+}
+
+static long socketBioCtrl(BIO *bio, int cmd, long num, void *ptr)
+{
+    Q_UNUSED(bio);
+    Q_UNUSED(num);
+    Q_UNUSED(ptr);
+    switch (cmd) {
+    case BIO_CTRL_FLUSH:
+    case BIO_CTRL_DUP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int socketBioCreate(BIO *bio)
+{
+    BIO_set_data(bio, nullptr);
+    BIO_set_init(bio, 1);
+    return 1;
+}
+
+static int socketBioDestroy(BIO *bio)
+{
+    if (!bio) {
+        return 0;
+    }
+    BIO_set_data(bio, nullptr);
+    return 1;
+}
+
+static BIO_METHOD *socketBioMethod()
+{
+    static BIO_METHOD *method = [] {
+        BIO_METHOD *m = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "qtng socket");
+        if (m) {
+            BIO_meth_set_write(m, socketBioWrite);
+            BIO_meth_set_read(m, socketBioRead);
+            BIO_meth_set_puts(m, socketBioPuts);
+            BIO_meth_set_ctrl(m, socketBioCtrl);
+            BIO_meth_set_create(m, socketBioCreate);
+            BIO_meth_set_destroy(m, socketBioDestroy);
+        }
+        return m;
+    }();
+    return method;
+}
+
+#if defined(Q_OS_LINUX) && defined(TLS_TX)
+// the P_hash of rfc 5246 section 5.
+static QByteArray tls12Prf(const EVP_MD *md, const unsigned char *secret, int secretSize, const QByteArray &seed,
+                           int size)
+{
+    QByteArray out;
+    QByteArray a = seed;
+    unsigned char buf[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    while (out.size() < size) {
+        if (!HMAC(md, secret, secretSize, reinterpret_cast<const unsigned char *>(a.constData()),
+                  static_cast<size_t>(a.size()), buf, &len)) {
+            return QByteArray();
+        }
+        a = QByteArray(reinterpret_cast<const char *>(buf), static_cast<int>(len));
+        const QByteArray &t = a + seed;
+        if (!HMAC(md, secret, secretSize, reinterpret_cast<const unsigned char *>(t.constData()),
+                  static_cast<size_t>(t.size()), buf, &len)) {
+            return QByteArray();
+        }
+        out.append(reinterpret_cast<const char *>(buf), static_cast<int>(len));
+    }
+    OPENSSL_cleanse(buf, sizeof(buf));
+    out.truncate(size);
+    return out;
+}
+
+// derive the write key of tls 1.2 aes-gcm from the master secret and hand it to the kernel. only the sending side
+// is offloaded, openssl still decrypts the received records.
+static bool enableKernelTls(SSL *ssl, int fd, bool asServer)
+{
+    if (SSL_version(ssl) != TLS1_2_VERSION || SSL_get_session(ssl) == nullptr) {
+        return false;
+    }
+    const SSL_CIPHER *cipher = SSL_get_current_cipher(ssl);
+    if (!cipher) {
+        return false;
+    }
+    const int nid = SSL_CIPHER_get_cipher_nid(cipher);
+    int keySize;
+    const EVP_MD *md;
+    if (nid == NID_aes_128_gcm) {
+        keySize = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+        md = EVP_sha256();
+#  ifdef TLS_CIPHER_AES_GCM_256
+    } else if (nid == NID_aes_256_gcm) {
+        keySize = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+        md = EVP_sha384();
+#  endif
+    } else {
+        return false;
+    }
+    const int saltSize = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+
+    unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+    const size_t masterSize = SSL_SESSION_get_master_key(SSL_get_session(ssl), master, sizeof(master));
+    QByteArray seed("key expansion");
+    unsigned char random[SSL3_RANDOM_SIZE];
+    if (masterSize == 0 || SSL_get_server_random(ssl, random, sizeof(random)) != sizeof(random)) {
+        return false;
+    }
+    seed.append(reinterpret_cast<const char *>(random), sizeof(random));
+    if (SSL_get_client_random(ssl, random, sizeof(random)) != sizeof(random)) {
+        return false;
+    }
+    seed.append(reinterpret_cast<const char *>(random), sizeof(random));
+    // client_write_key, server_write_key, client_write_iv, server_write_iv. aead ciphers have no mac keys.
+    QByteArray keyBlock = tls12Prf(md, master, static_cast<int>(masterSize), seed, keySize * 2 + saltSize * 2);
+    OPENSSL_cleanse(master, sizeof(master));
+    if (keyBlock.isEmpty()) {
+        return false;
+    }
+    const char *key = keyBlock.constData() + (asServer ? keySize : 0);
+    const char *salt = keyBlock.constData() + keySize * 2 + (asServer ? saltSize : 0);
+    // the Finished message took the sequence number 0.
+    unsigned char seq[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+    bool ok = false;
+    if (::setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0) {
+        if (keySize == TLS_CIPHER_AES_GCM_128_KEY_SIZE) {
+            struct tls12_crypto_info_aes_gcm_128 info;
+            memset(&info, 0, sizeof(info));
+            info.info.version = TLS_1_2_VERSION;
+            info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+            memcpy(info.key, key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+            memcpy(info.salt, salt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+            memcpy(info.iv, seq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+            memcpy(info.rec_seq, seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+            ok = ::setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info)) == 0;
+            OPENSSL_cleanse(&info, sizeof(info));
+#  ifdef TLS_CIPHER_AES_GCM_256
+        } else {
+            struct tls12_crypto_info_aes_gcm_256 info;
+            memset(&info, 0, sizeof(info));
+            info.info.version = TLS_1_2_VERSION;
+            info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+            memcpy(info.key, key, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+            memcpy(info.salt, salt, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+            memcpy(info.iv, seq, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+            memcpy(info.rec_seq, seq, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+            ok = ::setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info)) == 0;
+            OPENSSL_cleanse(&info, sizeof(info));
+#  endif
+        }
+    }
+    OPENSSL_cleanse(keyBlock.data(), keyBlock.size());
+    if (!ok) {
+        qtng_debug << "kernel tls is not available:" << strerror(errno);
+    }
+    return ok;
+}
+
+// alerts are sent as records of their own type once the kernel owns the write key.
+static bool sendKernelTlsAlert(int fd, unsigned char level, unsigned char description)
+{
+    unsigned char alert[2] = { level, description };
+    struct iovec iov;
+    iov.iov_base = alert;
+    iov.iov_len = sizeof(alert);
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(cmsg) = 21;  // alert
+    ssize_t sent;
+    do {
+        sent = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == static_cast<ssize_t>(sizeof(alert));
+}
+#else
+static bool enableKernelTls(SSL *, int, bool)
+{
+    return false;
+}
+
+static bool sendKernelTlsAlert(int, unsigned char, unsigned char)
+{
+    return false;
+}
+#endif
 
 template<typename SocketType>
 class SslConnection
@@ -764,6 +1879,7 @@ public:
     SslConnection();
     ~SslConnection();
     bool handshake(bool asServer, const QString &hostName);
+    bool startHandshake(bool asServer, const QString &hostName);
     bool _handshake();
     bool close();
     void abort();
@@ -771,6 +1887,8 @@ public:
     qint32 send(const char *data, qint32 size, bool all);
     bool pumpOutgoing();
     bool pumpIncoming();
+    int nextWriteSize(int size);
+    void useSocketBio(QSharedPointer<Socket> socket, BIO_METHOD *method);
     Certificate localCertificate() const;
     QList<Certificate> localCertificateChain() const;
     Certificate peerCertificate() const;
@@ -779,26 +1897,44 @@ public:
     SslCipher cipher() const;
     SslSocket::SslMode mode() const;
     Ssl::SslProtocol sslProtocol() const;
+    QByteArray nextNegotiatedProtocol() const;
+    SslSocket::NextProtocolNegotiationStatus nextProtocolNegotiationStatus() const;
+    bool isSessionReused() const;
 
     QSharedPointer<SocketType> rawSocket;
+    QSharedPointer<Socket> plainSocket;  // not null if the socket BIO is used.
+    SslSocketBioTarget bioTarget;
     SslConfiguration config;
     QSharedPointer<SSL_CTX> ctx;
     QSharedPointer<SSL> ssl;
+    QSharedPointer<SslSessionTarget> session;  // shared with the handshake running in thread pool.
     QList<SslError> errors;
     QString peerVerifyName;
     QString tlsExtHostName;
+    qint64 smallRecordBytes;  // sent by small records since connected or idle.
+    qint64 lastWriteTime;  // msecs of EventLoopCoroutine::now()
+    QByteArray earlyDataProtocol;  // the alpn protocol which the early data is written for.
+    bool earlyDataAccepted;
     bool asServer;
 };
 
 template<typename SocketType>
 SslConnection<SocketType>::SslConnection(const SslConfiguration &config)
     : config(config)
+    , session(new SslSessionTarget())
+    , smallRecordBytes(0)
+    , lastWriteTime(0)
+    , earlyDataAccepted(false)
 {
     initOpenSSL();
 }
 
 template<typename SocketType>
 SslConnection<SocketType>::SslConnection()
+    : session(new SslSessionTarget())
+    , smallRecordBytes(0)
+    , lastWriteTime(0)
+    , earlyDataAccepted(false)
 {
     initOpenSSL();
 }
@@ -806,14 +1942,58 @@ SslConnection<SocketType>::SslConnection()
 template<typename SocketType>
 SslConnection<SocketType>::~SslConnection()
 {
+    // openssl marks the session of a connection freed without shutdown as not resumable.
+    if (!ssl.isNull() && SSL_is_init_finished(ssl.data())) {
+        SSL_set_shutdown(ssl.data(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    }
     rawSocket->abort();
     cleanupOpenSSL();
 }
 
+struct SslMetrics
+{
+    SslMetrics();
+    MetricCounter *clientHandshakes;
+    MetricCounter *serverHandshakes;
+    MetricCounter *failures;
+    MetricHistogram *duration;
+};
+
+SslMetrics::SslMetrics()
+{
+    MetricsRegistry *registry = MetricsRegistry::instance();
+    clientHandshakes = registry->counter("qtng_ssl_client_handshakes_total", "Tls handshakes done as client.");
+    serverHandshakes = registry->counter("qtng_ssl_server_handshakes_total", "Tls handshakes done as server.");
+    failures = registry->counter("qtng_ssl_handshake_failures_total", "Tls handshakes failed.");
+    duration = registry->histogram("qtng_ssl_handshake_duration_seconds", "Time of tls handshakes.");
+}
+
+static SslMetrics &sslMetrics()
+{
+    static SslMetrics metrics;
+    return metrics;
+}
+
 template<typename SocketType>
 bool SslConnection<SocketType>::handshake(bool asServer, const QString &hostName)
 {
-    // FIXME use verifyMode to set verifyPeerName
+    QTNG_TRACE_SCOPE_ARG("tls", "tls handshake", "server", asServer);
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = startHandshake(asServer, hostName);
+    SslMetrics &metrics = sslMetrics();
+    if (ok) {
+        (asServer ? metrics.serverHandshakes : metrics.clientHandshakes)->add();
+    } else {
+        metrics.failures->add();
+    }
+    metrics.duration->observe(timer.nsecsElapsed() / 1000);
+    return ok;
+}
+
+template<typename SocketType>
+bool SslConnection<SocketType>::startHandshake(bool asServer, const QString &hostName)
+{
     if (tlsExtHostName.isEmpty() && !hostName.isEmpty()) {
         tlsExtHostName = hostName;
     }
@@ -822,17 +2002,36 @@ bool SslConnection<SocketType>::handshake(bool asServer, const QString &hostName
     }
     this->asServer = asServer;
 
-    BIO *incoming = BIO_new(BIO_s_mem());
-    if (!incoming) {
-        return false;
-    }
-    BIO *outgoing = BIO_new(BIO_s_mem());
-    if (!outgoing) {
-        BIO_free(incoming);
-        return false;
+    // plain sockets are read and written by openssl directly, others are pumped through memory BIOs. the handshake
+    // offloaded to thread pool can not touch the coroutine socket, so it uses memory BIOs till finished.
+    BIO *incoming = nullptr;
+    BIO *outgoing = nullptr;
+    QSharedPointer<Socket> socket = convertSocketLikeToSocket(rawSocket);
+    BIO_METHOD *method = socket.isNull() ? nullptr : socketBioMethod();
+    const bool offload = !config.handshakeThreadPool().isNull();
+    if (method && !offload) {
+        plainSocket = socket;
+        incoming = BIO_new(method);
+        if (!incoming) {
+            return false;
+        }
+        bioTarget.socket = plainSocket.data();
+        BIO_set_data(incoming, &bioTarget);
+        outgoing = incoming;  // SSL_set_bio() takes only one reference if both are the same.
+    } else {
+        plainSocket.clear();
+        incoming = BIO_new(BIO_s_mem());
+        if (!incoming) {
+            return false;
+        }
+        outgoing = BIO_new(BIO_s_mem());
+        if (!outgoing) {
+            BIO_free(incoming);
+            return false;
+        }
     }
 
-    ctx = SslConfigurationPrivate::makeContext(config, asServer);
+    ctx = SslConfigurationPrivate::context(config, asServer);
     bool freeBIOs = true;
     if (!ctx.isNull()) {
         ssl.reset(SSL_new(ctx.data()), SSL_free);
@@ -840,6 +2039,23 @@ bool SslConnection<SocketType>::handshake(bool asServer, const QString &hostName
             // do not free incoming & outgoing
             freeBIOs = false;
             SSL_set_bio(ssl.data(), incoming, outgoing);
+            if (!plainSocket.isNull()) {
+                // let openssl read as many records as possible for every recv().
+                SSL_set_read_ahead(ssl.data(), 1);
+            }
+            // the verify callback finds the expected server name by it.
+            SSL_set_app_data(ssl.data(), session.data());
+            const Ssl::PeerVerifyMode verifyMode = config.peerVerifyMode();
+            if (!asServer && (verifyMode == Ssl::VerifyPeer || verifyMode == Ssl::QueryPeer)) {
+                const QString &name = peerVerifyName.isEmpty() ? tlsExtHostName : peerVerifyName;
+                if (!name.isEmpty() && !setVerifyHost(ssl.data(), session.data(), name)) {
+                    qtng_debug << "can not set the name to verify:" << name;
+                    ssl.clear();
+                    ctx.clear();
+                    plainSocket.clear();
+                    return false;
+                }
+            }
             QSharedPointer<ChooseTlsExtNameCallback> callback = config.tlsExtHostNameCallback();
             if (!asServer && !tlsExtHostName.isEmpty() && !callback.isNull()) {
                 const QByteArray &t = callback->choose(tlsExtHostName).toUtf8();
@@ -847,7 +2063,57 @@ bool SslConnection<SocketType>::handshake(bool asServer, const QString &hostName
                     SSL_set_tlsext_host_name(ssl.data(), t.data());
                 }
             }
-            if (_handshake()) {
+            if (!asServer && config.sessionCacheSize() > 0) {
+                // resume the last session to the same server.
+                const QString &serverName =
+                        tlsExtHostName.isEmpty() ? rawSocket->peerAddress().toString() : tlsExtHostName;
+                session->cache = SslConfigurationPrivate::cacheOf(config);
+                session->key = serverName + QLatin1Char(':') + QString::number(rawSocket->peerPort());
+                session->maxSize = config.sessionCacheSize();
+                QSharedPointer<SSL_SESSION> cached = session->cache->findSession(session->key);
+                if (!cached.isNull()) {
+                    SSL_set_session(ssl.data(), cached.data());
+#ifdef QTNG_HAVE_EARLY_DATA
+                    // the early data is sent only if the server allows enough of it for the same protocol.
+                    const unsigned char *alpn = nullptr;
+                    size_t alpnSize = 0;
+                    SSL_SESSION_get0_alpn_selected(cached.data(), &alpn, &alpnSize);
+                    const QByteArray sessionProtocol(reinterpret_cast<const char *>(alpn), static_cast<int>(alpnSize));
+                    session->earlyDataPending = !session->earlyData.isEmpty()
+                            && SSL_SESSION_get_max_early_data(cached.data())
+                                    >= static_cast<uint32_t>(session->earlyData.size())
+                            && (sessionProtocol.isEmpty() || sessionProtocol == earlyDataProtocol);
+#endif
+                }
+            }
+#ifdef QTNG_HAVE_EARLY_DATA
+            if (asServer && config.maxEarlyData() > 0) {
+                session->earlyDataPending = true;
+            }
+#endif
+            const bool done = _handshake();
+            if (config.peerVerifyMode() == Ssl::VerifyPeer || config.peerVerifyMode() == Ssl::QueryPeer) {
+                const long verifyResult = SSL_get_verify_result(ssl.data());
+                if (verifyResult != X509_V_OK) {
+                    errors.append(_q_OpenSSL_to_SslError(static_cast<int>(verifyResult), peerCertificate()));
+                }
+            }
+            if (done) {
+#ifdef QTNG_HAVE_EARLY_DATA
+                earlyDataAccepted = SSL_get_early_data_status(ssl.data()) == SSL_EARLY_DATA_ACCEPTED;
+#endif
+                if (!asServer) {
+                    // the caller sends it again if it is rejected.
+                    session->earlyData.clear();
+                }
+                session->earlyDataPending = false;
+                if (method && offload) {
+                    useSocketBio(socket, method);
+                }
+                if (!plainSocket.isNull() && config.kernelTlsEnabled() && plainSocket->type() == Socket::TcpSocket) {
+                    bioTarget.kernelTls =
+                            enableKernelTls(ssl.data(), static_cast<int>(plainSocket->fileno()), asServer);
+                }
                 return true;
             }
             ssl.clear();
@@ -856,8 +2122,11 @@ bool SslConnection<SocketType>::handshake(bool asServer, const QString &hostName
     }
     if (freeBIOs) {
         BIO_free(incoming);
-        BIO_free(outgoing);
+        if (outgoing != incoming) {
+            BIO_free(outgoing);
+        }
     }
+    plainSocket.clear();
     return false;
 }
 
@@ -867,6 +2136,16 @@ bool SslConnection<SocketType>::pumpOutgoing()
     if (ssl.isNull()) {
         return false;
     }
+    if (!plainSocket.isNull()) {
+        // written to the socket already, unless the socket BIO asked for a retry.
+        BIO *bio = SSL_get_wbio(ssl.data());
+        if (BIO_should_retry(bio) && BIO_should_write(bio)) {
+            ScopedIoWatcher watcher(EventLoopCoroutine::Write, plainSocket->fileno());
+            watcher.start();
+            return plainSocket->isValid();
+        }
+        return true;
+    }
     int pendingBytes;
     QVarLengthArray<char, 1024 * 8> buf;
     BIO *outgoing = SSL_get_wbio(ssl.data());
@@ -889,6 +2168,12 @@ bool SslConnection<SocketType>::pumpIncoming()
         qtng_warning << "ssl is null while pump incoming.";
         return false;
     }
+    if (!plainSocket.isNull()) {
+        // openssl wants more records, which the socket BIO reads after the socket is readable.
+        ScopedIoWatcher watcher(EventLoopCoroutine::Read, plainSocket->fileno());
+        watcher.start();
+        return plainSocket->isValid();
+    }
     const QByteArray &buf = rawSocket->recv(1024 * 8);
     if (buf.isEmpty()) {
         return false;
@@ -908,14 +2193,89 @@ bool SslConnection<SocketType>::pumpIncoming()
     return true;
 }
 
+template<typename SocketType>
+void SslConnection<SocketType>::useSocketBio(QSharedPointer<Socket> socket, BIO_METHOD *method)
+{
+    // the records received after handshaking are kept in the memory BIO, go on with it.
+    if (!pumpOutgoing() || BIO_pending(SSL_get_rbio(ssl.data())) > 0 || SSL_pending(ssl.data()) > 0) {
+        return;
+    }
+    BIO *bio = BIO_new(method);
+    if (!bio) {
+        return;
+    }
+    plainSocket = socket;
+    bioTarget.socket = socket.data();
+    BIO_set_data(bio, &bioTarget);
+    SSL_set_bio(ssl.data(), bio, bio);
+    SSL_set_read_ahead(ssl.data(), 1);
+}
+
+// the error queue of openssl is per thread, so it is read where the handshake runs.
+static int handshakeStep(SSL *ssl, bool asServer, SslSessionTarget *target, int *err)
+{
+    ERR_clear_error();
+#ifdef QTNG_HAVE_EARLY_DATA
+    // the early data goes with the ClientHello, so it is exchanged before the rest of handshake.
+    while (target->earlyDataPending) {
+        if (asServer) {
+            char buf[1024 * 16];
+            size_t readBytes = 0;
+            int result = SSL_read_early_data(ssl, buf, sizeof(buf), &readBytes);
+            if (result == SSL_READ_EARLY_DATA_ERROR) {
+                *err = SSL_get_error(ssl, 0);
+                return 0;
+            }
+            target->earlyData.append(buf, static_cast<int>(readBytes));
+            if (result == SSL_READ_EARLY_DATA_FINISH) {
+                target->earlyDataPending = false;
+            }
+        } else {
+            size_t written = 0;
+            const int left = target->earlyData.size() - target->earlyDataWritten;
+            if (SSL_write_early_data(ssl, target->earlyData.constData() + target->earlyDataWritten,
+                                     static_cast<size_t>(left), &written)
+                != 1) {
+                *err = SSL_get_error(ssl, 0);
+                return 0;
+            }
+            target->earlyDataWritten += static_cast<int>(written);
+            if (target->earlyDataWritten >= target->earlyData.size()) {
+                target->earlyDataPending = false;
+            }
+        }
+    }
+#else
+    Q_UNUSED(target);
+#endif
+    int result = asServer ? SSL_accept(ssl) : SSL_connect(ssl);
+    *err = result <= 0 ? SSL_get_error(ssl, result) : SSL_ERROR_NONE;
+    return result;
+}
+
 template<typename SocketType>
 bool SslConnection<SocketType>::_handshake()
 {
     Q_ASSERT(!ssl.isNull());
+    QSharedPointer<ThreadPool> pool = config.handshakeThreadPool();
     while (true) {
-        int result = asServer ? SSL_accept(ssl.data()) : SSL_connect(ssl.data());
+        int result;
+        int err;
+        if (pool.isNull()) {
+            result = handshakeStep(ssl.data(), asServer, session.data(), &err);
+        } else {
+            // the private key operations run in the pool while the coroutine waits. the memory BIOs never block, and
+            // the step keeps ssl and its app data alive in case this coroutine is killed.
+            QSharedPointer<SSL> s = ssl;
+            QSharedPointer<SslSessionTarget> target = session;
+            QSharedPointer<int> stepError(new int(SSL_ERROR_SSL));
+            const bool server = asServer;
+            result = pool->call<int>([s, target, stepError, server] {
+                return handshakeStep(s.data(), server, target.data(), stepError.data());
+            });
+            err = *stepError;
+        }
         if (result <= 0) {
-            int err = SSL_get_error(ssl.data(), result);
             switch (err) {
             case SSL_ERROR_WANT_READ:
                 if (!pumpOutgoing())
@@ -954,6 +2314,17 @@ qint32 SslConnection<SocketType>::recv(char *data, qint32 size, bool all)
     if (ssl.isNull()) {
         return -1;
     }
+    if (asServer && !session->earlyData.isEmpty()) {
+        // the early data received while handshaking comes first.
+        const qint32 taken = qMin(size, session->earlyData.size());
+        memcpy(data, session->earlyData.constData(), static_cast<size_t>(taken));
+        session->earlyData.remove(0, taken);
+        if (!all || taken == size) {
+            return taken;
+        }
+        const qint32 rest = recv(data + taken, size - taken, all);
+        return rest < 0 ? taken : taken + rest;
+    }
     qint32 total = 0;
     while (true) {
         int result = SSL_read(ssl.data(), data + total, size - total);
@@ -994,16 +2365,47 @@ qint32 SslConnection<SocketType>::recv(char *data, qint32 size, bool all)
     }
 }
 
+// 1369 bytes and the overhead of a record fit one segment of 1500 bytes mtu with ipv6 and tcp options, as nginx does.
+#define SMALL_RECORD_SIZE 1369
+#define DYNAMIC_RECORD_IDLE_MSECS 1000
+
+// the size of next SSL_write(). openssl makes records of 16KB at most, and the small ones are wanted at the start.
+template<typename SocketType>
+int SslConnection<SocketType>::nextWriteSize(int size)
+{
+    const int threshold = config.dynamicRecordThreshold();
+    if (threshold <= 0) {
+        return size;
+    }
+    const qint64 now = EventLoopCoroutine::get()->now();
+    if (now - lastWriteTime > DYNAMIC_RECORD_IDLE_MSECS) {
+        // the congestion window may be shrunk after idle, start small again.
+        smallRecordBytes = 0;
+    }
+    lastWriteTime = now;
+    if (smallRecordBytes >= threshold) {
+        return size;
+    }
+    const int n = qMin(size, SMALL_RECORD_SIZE);
+    smallRecordBytes += n;
+    return n;
+}
+
 template<typename SocketType>
 qint32 SslConnection<SocketType>::send(const char *data, qint32 size, bool all)
 {
     if (ssl.isNull() || size <= 0) {
         return -1;
     }
+    if (bioTarget.kernelTls) {
+        return all ? plainSocket->sendall(data, size) : plainSocket->send(data, size);
+    }
     qint32 total = 0;
+    // a retried SSL_write() must be given the same buffer, so the size is chosen once for every write.
+    int writeSize = nextWriteSize(size);
     // be careful for dead lock
     while (true) {
-        int result = SSL_write(ssl.data(), data + total, size - total);
+        int result = SSL_write(ssl.data(), data + total, writeSize);
         if (result <= 0) {
             int err = SSL_get_error(ssl.data(), result);
             switch (err) {
@@ -1045,6 +2447,7 @@ qint32 SslConnection<SocketType>::send(const char *data, qint32 size, bool all)
                 return total;
             } else {
                 if (all) {
+                    writeSize = nextWriteSize(size - total);
                     continue;
                 } else {
                     if (!pumpOutgoing())
@@ -1062,6 +2465,11 @@ bool SslConnection<SocketType>::close()
     if (ssl.isNull() || !rawSocket->isValid()) {
         return false;
     }
+    if (bioTarget.kernelTls) {
+        // close_notify, openssl can not send it with the key it does not own.
+        SSL_set_shutdown(ssl.data(), SSL_SENT_SHUTDOWN);
+        return sendKernelTlsAlert(static_cast<int>(plainSocket->fileno()), 1, 0);
+    }
     int tried = 0;
     while (true) {
         int result = SSL_shutdown(ssl.data());
@@ -1184,18 +2592,8 @@ Ssl::PeerVerifyMode SslConnection<SocketType>::peerVerifyMode() const
     if (ssl.isNull()) {
         return Ssl::AutoVerifyPeer;
     }
-    int mode = SSL_get_verify_mode(ssl.data());
-    if (mode == SSL_VERIFY_NONE) {
-        return Ssl::VerifyNone;
-    } else if (mode == SSL_VERIFY_PEER) {
-        return Ssl::VerifyPeer;
-    } else if (mode == SSL_VERIFY_FAIL_IF_NO_PEER_CERT) {
-        return Ssl::QueryPeer;
-    } else if (mode == SSL_VERIFY_CLIENT_ONCE) {
-        return Ssl::AutoVerifyPeer;
-    } else {
-        return Ssl::AutoVerifyPeer;
-    }
+    // VerifyPeer and QueryPeer both use SSL_VERIFY_PEER, they differ in the verify callback.
+    return config.peerVerifyMode();
 }
 
 template<typename SocketType>
@@ -1208,6 +2606,39 @@ SslCipher SslConnection<SocketType>::cipher() const
     return SslCipherPrivate::from_SSL_CIPHER(sessionCipher);
 }
 
+template<typename SocketType>
+QByteArray SslConnection<SocketType>::nextNegotiatedProtocol() const
+{
+    if (ssl.isNull()) {
+        return QByteArray();
+    }
+    const unsigned char *data = nullptr;
+    unsigned int len = 0;
+    SSL_get0_alpn_selected(ssl.data(), &data, &len);
+    if (!data || len == 0) {
+        return QByteArray();
+    }
+    return QByteArray(reinterpret_cast<const char *>(data), static_cast<int>(len));
+}
+
+template<typename SocketType>
+bool SslConnection<SocketType>::isSessionReused() const
+{
+    return !ssl.isNull() && SSL_session_reused(ssl.data());
+}
+
+template<typename SocketType>
+SslSocket::NextProtocolNegotiationStatus SslConnection<SocketType>::nextProtocolNegotiationStatus() const
+{
+    if (ssl.isNull() || config.allowedNextProtocols().isEmpty()) {
+        return SslSocket::NextProtocolNegotiationNone;
+    }
+    if (nextNegotiatedProtocol().isEmpty()) {
+        return SslSocket::NextProtocolNegotiationUnsupported;
+    }
+    return SslSocket::NextProtocolNegotiationNegotiated;
+}
+
 template<typename SocketType>
 SslSocket::SslMode SslConnection<SocketType>::mode() const
 {
@@ -1316,58 +2747,134 @@ Certificate SslSocket::localCertificate() const
     return d->localCertificate();
 }
 
-QList<Certificate> SslSocket::localCertificateChain() const
+QList<Certificate> SslSocket::localCertificateChain() const
+{
+    Q_D(const SslSocket);
+    return d->localCertificateChain();
+}
+
+Certificate SslSocket::peerCertificate() const
+{
+    Q_D(const SslSocket);
+    return d->peerCertificate();
+}
+
+QList<Certificate> SslSocket::peerCertificateChain() const
+{
+    Q_D(const SslSocket);
+    return d->peerCertificateChain();
+}
+
+Ssl::PeerVerifyMode SslSocket::peerVerifyMode() const
+{
+    Q_D(const SslSocket);
+    return d->peerVerifyMode();
+}
+
+QString SslSocket::peerVerifyName() const
+{
+    Q_D(const SslSocket);
+    return d->peerVerifyName;
+}
+
+PrivateKey SslSocket::privateKey() const
+{
+    Q_D(const SslSocket);
+    return d->config.privateKey();
+}
+
+Ssl::SslProtocol SslSocket::sslProtocol() const
+{
+    Q_D(const SslSocket);
+    return d->sslProtocol();
+}
+
+SslCipher SslSocket::cipher() const
+{
+    Q_D(const SslSocket);
+    return d->cipher();
+}
+
+SslSocket::SslMode SslSocket::mode() const
 {
     Q_D(const SslSocket);
-    return d->localCertificateChain();
+    return d->mode();
 }
 
-Certificate SslSocket::peerCertificate() const
+QByteArray SslSocket::nextNegotiatedProtocol() const
 {
     Q_D(const SslSocket);
-    return d->peerCertificate();
+    return d->nextNegotiatedProtocol();
 }
 
-QList<Certificate> SslSocket::peerCertificateChain() const
+SslSocket::NextProtocolNegotiationStatus SslSocket::nextProtocolNegotiationStatus() const
 {
     Q_D(const SslSocket);
-    return d->peerCertificateChain();
+    return d->nextProtocolNegotiationStatus();
 }
 
-Ssl::PeerVerifyMode SslSocket::peerVerifyMode() const
+bool SslSocket::isSessionReused() const
 {
     Q_D(const SslSocket);
-    return d->peerVerifyMode();
+    return d->isSessionReused();
 }
 
-QString SslSocket::peerVerifyName() const
+bool SslSocket::isKernelTlsActive() const
 {
     Q_D(const SslSocket);
-    return d->peerVerifyName;
+    return d->bioTarget.kernelTls;
 }
 
-PrivateKey SslSocket::privateKey() const
+bool SslSocket::setEarlyData(const QByteArray &data, const QByteArray &nextProtocol)
 {
-    Q_D(const SslSocket);
-    return d->config.privateKey();
+#ifdef QTNG_HAVE_EARLY_DATA
+    Q_D(SslSocket);
+    if (!d->ssl.isNull()) {
+        return false;
+    }
+    d->session->earlyData = data;
+    d->earlyDataProtocol = nextProtocol;
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(nextProtocol);
+    return false;
+#endif
 }
 
-Ssl::SslProtocol SslSocket::sslProtocol() const
+bool SslSocket::isEarlyDataAccepted() const
 {
     Q_D(const SslSocket);
-    return d->sslProtocol();
+    return d->earlyDataAccepted;
 }
 
-SslCipher SslSocket::cipher() const
+bool SslSocket::isReadingEarlyData() const
 {
     Q_D(const SslSocket);
-    return d->cipher();
+    return !d->ssl.isNull() && d->asServer && !d->session->earlyData.isEmpty();
 }
 
-SslSocket::SslMode SslSocket::mode() const
+bool SslSocket::hasPendingData() const
 {
     Q_D(const SslSocket);
-    return d->mode();
+    if (d->ssl.isNull()) {
+        return false;
+    }
+    if (d->asServer && !d->session->earlyData.isEmpty()) {
+        return true;
+    }
+    if (SSL_pending(d->ssl.data()) > 0) {
+        return true;
+    }
+    // the memory BIO keeps the records received but not decrypted.
+    if (d->plainSocket.isNull() && BIO_pending(SSL_get_rbio(d->ssl.data())) > 0) {
+        return true;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    return SSL_has_pending(d->ssl.data()) != 0;
+#else
+    return false;
+#endif
 }
 
 SslConfiguration SslSocket::sslConfiguration() const
@@ -1605,15 +3112,14 @@ qint32 SslSocket::sendall(const char *data, qint32 size)
 QByteArray SslSocket::recv(qint32 size)
 {
     Q_D(SslSocket);
-    QByteArray bs;
-    bs.resize(size);
-
+    QByteArray bs = takeRecvBuffer(size);
     qint32 bytes = d->recv(bs.data(), bs.size(), false);
-    if (bytes > 0) {
-        bs.resize(bytes);
-        return bs;
-    }
-    return QByteArray();
+    return finishRecvBuffer(bs, bytes);
+}
+
+qint32 SslSocket::recvInto(QByteArray &buf, qint32 maxSize)
+{
+    return recvIntoBuffer(this, buf, maxSize);
 }
 
 QByteArray SslSocket::recvall(qint32 size)
@@ -1647,6 +3153,45 @@ qint32 SslSocket::sendall(const QByteArray &data)
     return d->send(data.data(), data.size(), true);
 }
 
+qint32 SslSocket::sendv(const QList<QByteArray> &data)
+{
+    Q_D(SslSocket);
+    // every SSL_write() makes at least one record, so glue small buffers up to the record size.
+    const int maxRecordSize = 1024 * 16;
+    qint32 total = 0;
+    auto sendAll = [d, &total](const QByteArray &buffer) -> bool {
+        if (buffer.isEmpty()) {
+            return true;
+        }
+        qint32 sent = d->send(buffer.constData(), buffer.size(), true);
+        if (sent > 0) {
+            total += sent;
+        }
+        return sent == buffer.size();
+    };
+    QByteArray pending;
+    for (const QByteArray &buffer : data) {
+        if (buffer.size() >= maxRecordSize) {
+            if (!sendAll(pending) || !sendAll(buffer)) {
+                return total > 0 ? total : -1;
+            }
+            pending.clear();
+        } else {
+            if (pending.size() + buffer.size() > maxRecordSize) {
+                if (!sendAll(pending)) {
+                    return total > 0 ? total : -1;
+                }
+                pending.clear();
+            }
+            pending.append(buffer);
+        }
+    }
+    if (!sendAll(pending)) {
+        return total > 0 ? total : -1;
+    }
+    return total;
+}
+
 SslSocket *SslSocket::createConnection(const HostAddress &host, quint16 port, const SslConfiguration &config,
                                        Socket::SocketError *error, int allowProtocol)
 {
@@ -1719,6 +3264,9 @@ public:
     virtual QByteArray recvall(qint32 size) override;
     virtual qint32 send(const QByteArray &data) override;
     virtual qint32 sendall(const QByteArray &data) override;
+    virtual qint32 sendv(const QList<QByteArray> &data) override;
+    virtual bool hasPendingData() const override;
+    virtual TcpInfo tcpInfo() const override;
 public:
     QSharedPointer<SslSocket> s;
 };
@@ -1894,6 +3442,22 @@ qint32 SslSocketLikeImpl::sendall(const QByteArray &data)
     return s->sendall(data);
 }
 
+qint32 SslSocketLikeImpl::sendv(const QList<QByteArray> &data)
+{
+    return s->sendv(data);
+}
+
+bool SslSocketLikeImpl::hasPendingData() const
+{
+    return s->hasPendingData();
+}
+
+TcpInfo SslSocketLikeImpl::tcpInfo() const
+{
+    QSharedPointer<SocketLike> backend = s->backend();
+    return backend.isNull() ? TcpInfo() : backend->tcpInfo();
+}
+
 }  // anonymous namespace
 
 QSharedPointer<SocketLike> asSocketLike(QSharedPointer<SslSocket> s)
@@ -1913,10 +3477,14 @@ QSharedPointer<SslSocket> convertSocketLikeToSslSocket(QSharedPointer<SocketLike
 
 namespace {
 
-class EncryptedSocketLike : public SocketLike
+// forwards everything but the data to the wrapped socket.
+class WrappedSocketLike : public SocketLike
 {
 public:
-    EncryptedSocketLike(QSharedPointer<Cipher> cipher, QSharedPointer<SocketLike> s);
+    explicit WrappedSocketLike(QSharedPointer<SocketLike> s)
+        : s(s)
+    {
+    }
 public:
     virtual Socket::SocketError error() const override;
     virtual QString errorString() const override;
@@ -1944,7 +3512,16 @@ public:
     virtual bool listen(int backlog) override;
     virtual bool setOption(Socket::SocketOption option, const QVariant &value) override;
     virtual QVariant option(Socket::SocketOption option) const override;
+    virtual TcpInfo tcpInfo() const override;
+public:
+    QSharedPointer<SocketLike> s;
+};
 
+class EncryptedSocketLike : public WrappedSocketLike
+{
+public:
+    EncryptedSocketLike(QSharedPointer<Cipher> cipher, QSharedPointer<SocketLike> s);
+public:
     qint32 recv(char *data, qint32 size, bool all);
     qint32 send(const char *data, qint32 size, bool all);
 
@@ -1959,169 +3536,165 @@ public:
 public:
     QSharedPointer<Cipher> incomingCipher;
     QSharedPointer<Cipher> outgoingCipher;
-    QSharedPointer<SocketLike> s;
 };
 
-EncryptedSocketLike::EncryptedSocketLike(QSharedPointer<Cipher> cipher, QSharedPointer<SocketLike> s)
-    : incomingCipher(cipher->copy(Cipher::Decrypt))
-    , outgoingCipher(cipher->copy(Cipher::Encrypt))
-    , s(s)
-{
-}
-
-Socket::SocketError EncryptedSocketLike::error() const
+Socket::SocketError WrappedSocketLike::error() const
 {
     return s->error();
 }
 
-QString EncryptedSocketLike::errorString() const
+QString WrappedSocketLike::errorString() const
 {
     return s->errorString();
 }
 
-bool EncryptedSocketLike::isValid() const
+bool WrappedSocketLike::isValid() const
 {
     return s->isValid();
 }
 
-HostAddress EncryptedSocketLike::localAddress() const
+HostAddress WrappedSocketLike::localAddress() const
 {
     return s->localAddress();
 }
 
-quint16 EncryptedSocketLike::localPort() const
+quint16 WrappedSocketLike::localPort() const
 {
     return s->localPort();
 }
 
-HostAddress EncryptedSocketLike::peerAddress() const
+HostAddress WrappedSocketLike::peerAddress() const
 {
     return s->peerAddress();
 }
 
-QString EncryptedSocketLike::peerName() const
+QString WrappedSocketLike::peerName() const
 {
     return s->peerName();
 }
 
-quint16 EncryptedSocketLike::peerPort() const
+quint16 WrappedSocketLike::peerPort() const
 {
     return s->peerPort();
 }
 
-qintptr EncryptedSocketLike::fileno() const
+qintptr WrappedSocketLike::fileno() const
 {
     return s->fileno();
 }
 
-Socket::SocketType EncryptedSocketLike::type() const
+Socket::SocketType WrappedSocketLike::type() const
 {
     return s->type();
 }
 
-Socket::SocketState EncryptedSocketLike::state() const
+Socket::SocketState WrappedSocketLike::state() const
 {
     return s->state();
 }
 
-HostAddress::NetworkLayerProtocol EncryptedSocketLike::protocol() const
+HostAddress::NetworkLayerProtocol WrappedSocketLike::protocol() const
 {
     return s->protocol();
 }
 
-QString EncryptedSocketLike::localAddressURI() const
+QString WrappedSocketLike::localAddressURI() const
 {
     return QLatin1String("encrypted+") + s->localAddressURI();
 }
 
-QString EncryptedSocketLike::peerAddressURI() const
+QString WrappedSocketLike::peerAddressURI() const
 {
     return QLatin1String("encrypted+") + s->peerAddressURI();
 }
 
-Socket *EncryptedSocketLike::acceptRaw()
+Socket *WrappedSocketLike::acceptRaw()
 {
     return s->acceptRaw();
 }
 
-QSharedPointer<SocketLike> EncryptedSocketLike::accept()
+QSharedPointer<SocketLike> WrappedSocketLike::accept()
 {
     return s->accept();
 }
 
-bool EncryptedSocketLike::bind(const HostAddress &address, quint16 port = 0,
-                               Socket::BindMode mode = Socket::DefaultForPlatform)
+bool WrappedSocketLike::bind(const HostAddress &address, quint16 port, Socket::BindMode mode)
 {
     return s->bind(address, port, mode);
 }
 
-bool EncryptedSocketLike::bind(quint16 port, Socket::BindMode mode)
+bool WrappedSocketLike::bind(quint16 port, Socket::BindMode mode)
 {
     return s->bind(port, mode);
 }
 
-bool EncryptedSocketLike::connect(const HostAddress &addr, quint16 port)
+bool WrappedSocketLike::connect(const HostAddress &addr, quint16 port)
 {
     return s->connect(addr, port);
 }
 
-bool EncryptedSocketLike::connect(const QString &hostName, quint16 port, QSharedPointer<SocketDnsCache> dnsCache)
+bool WrappedSocketLike::connect(const QString &hostName, quint16 port, QSharedPointer<SocketDnsCache> dnsCache)
 {
     return s->connect(hostName, port, dnsCache);
 }
 
-void EncryptedSocketLike::close()
+void WrappedSocketLike::close()
 {
     s->close();
 }
 
-void EncryptedSocketLike::abort()
+void WrappedSocketLike::abort()
 {
     s->abort();
 }
 
-bool EncryptedSocketLike::listen(int backlog)
+bool WrappedSocketLike::listen(int backlog)
 {
     return s->listen(backlog);
 }
 
-bool EncryptedSocketLike::setOption(Socket::SocketOption option, const QVariant &value)
+bool WrappedSocketLike::setOption(Socket::SocketOption option, const QVariant &value)
 {
     return s->setOption(option, value);
 }
 
-QVariant EncryptedSocketLike::option(Socket::SocketOption option) const
+QVariant WrappedSocketLike::option(Socket::SocketOption option) const
 {
     return s->option(option);
 }
 
-qint32 EncryptedSocketLike::recv(char *data, qint32 size, bool all)
+TcpInfo WrappedSocketLike::tcpInfo() const
 {
-    QByteArray buf(size, Qt::Uninitialized);
-    QByteArray decrypted;
-    decrypted.reserve(size);
+    return s->tcpInfo();
+}
+
+EncryptedSocketLike::EncryptedSocketLike(QSharedPointer<Cipher> cipher, QSharedPointer<SocketLike> s)
+    : WrappedSocketLike(s)
+    , incomingCipher(cipher->copy(Cipher::Decrypt))
+    , outgoingCipher(cipher->copy(Cipher::Encrypt))
+{
+}
 
+// the cipher is a stream cipher, so the data is decrypted in place.
+qint32 EncryptedSocketLike::recv(char *data, qint32 size, bool all)
+{
     qint32 bs;
     if (all) {
-        bs = s->recvall(buf.data(), buf.size());
+        bs = s->recvall(data, size);
     } else {
-        bs = s->recv(buf.data(), buf.size());
+        bs = s->recv(data, size);
     }
 
     if (bs <= 0) {
         return bs;
-    } else {
-        decrypted = incomingCipher->addData(buf.data(), bs);
-        if (decrypted.size() != bs) {
-            qtng_warning << "EncryptedSocketLike can not decrypt data: expected" << bs << "bytes, got"
-                         << decrypted.size() << "bytes";
-            return -1;
-        }
     }
-
-    Q_ASSERT(decrypted.size() <= size);
-    memcpy(data, decrypted.constData(), static_cast<size_t>(decrypted.size()));
-    return decrypted.size();
+    int decrypted = incomingCipher->update(data, bs, data);
+    if (decrypted != bs) {
+        qtng_warning << "EncryptedSocketLike can not decrypt data: expected" << bs << "bytes, got" << decrypted
+                     << "bytes";
+        return -1;
+    }
+    return bs;
 }
 
 qint32 EncryptedSocketLike::send(const char *data, qint32 size, bool)
@@ -2129,7 +3702,10 @@ qint32 EncryptedSocketLike::send(const char *data, qint32 size, bool)
     if (size <= 0) {
         return -1;
     }
-    const QByteArray &encrypted = outgoingCipher->addData(data, size);
+    QByteArray encrypted(size, Qt::Uninitialized);
+    if (outgoingCipher->update(data, size, encrypted.data()) != size) {
+        return -1;
+    }
     qint32 bs = s->sendall(encrypted);  // only support sendall.
     if (bs < encrypted.size()) {
         return -1;
@@ -2196,6 +3772,366 @@ qint32 EncryptedSocketLike::sendall(const QByteArray &data)
     return send(data.constData(), data.size(), true);
 }
 
+// aes-gcm and chacha20-poly1305 are EVP_AEAD in libressl, and EVP_CIPHER with the tag by ctrl in openssl. both use
+// aes-ni and clmul if the cpu has them.
+class AeadContext
+{
+public:
+    enum { NonceSize = 12, TagSize = 16 };
+    AeadContext(Cipher::Algorithm algo, const QByteArray &key);
+    ~AeadContext();
+public:
+    bool isValid() const { return valid; }
+    // out has len + TagSize bytes, and can be the same as in.
+    bool seal(const uchar *nonce, const uchar *ad, int adLen, const char *in, int len, char *out);
+    // in has len + TagSize bytes, and out has len bytes. out can be the same as in.
+    bool open(const uchar *nonce, const uchar *ad, int adLen, const char *in, int len, char *out);
+private:
+#ifdef LIBRESSL_VERSION_NUMBER
+    EVP_AEAD_CTX context;
+#else
+    EVP_CIPHER_CTX *encryptContext;
+    EVP_CIPHER_CTX *decryptContext;
+#endif
+    bool valid;
+};
+
+#ifdef LIBRESSL_VERSION_NUMBER
+
+AeadContext::AeadContext(Cipher::Algorithm algo, const QByteArray &key)
+    : valid(false)
+{
+    const EVP_AEAD *aead = nullptr;
+    switch (algo) {
+    case Cipher::AES128:
+        aead = EVP_aead_aes_128_gcm();
+        break;
+    case Cipher::AES256:
+        aead = EVP_aead_aes_256_gcm();
+        break;
+    case Cipher::ChaCha20Poly1305:
+        aead = EVP_aead_chacha20_poly1305();
+        break;
+    default:
+        break;
+    }
+    if (!aead || static_cast<size_t>(key.size()) != EVP_AEAD_key_length(aead)) {
+        return;
+    }
+    valid = EVP_AEAD_CTX_init(&context, aead, reinterpret_cast<const unsigned char *>(key.constData()),
+                              static_cast<size_t>(key.size()), EVP_AEAD_DEFAULT_TAG_LENGTH, nullptr)
+            == 1;
+}
+
+AeadContext::~AeadContext()
+{
+    if (valid) {
+        EVP_AEAD_CTX_cleanup(&context);
+    }
+}
+
+bool AeadContext::seal(const uchar *nonce, const uchar *ad, int adLen, const char *in, int len, char *out)
+{
+    size_t outLen = 0;
+    return EVP_AEAD_CTX_seal(&context, reinterpret_cast<unsigned char *>(out), &outLen,
+                             static_cast<size_t>(len + TagSize), nonce, NonceSize,
+                             reinterpret_cast<const unsigned char *>(in), static_cast<size_t>(len), ad,
+                             static_cast<size_t>(adLen))
+            == 1;
+}
+
+bool AeadContext::open(const uchar *nonce, const uchar *ad, int adLen, const char *in, int len, char *out)
+{
+    size_t outLen = 0;
+    return EVP_AEAD_CTX_open(&context, reinterpret_cast<unsigned char *>(out), &outLen, static_cast<size_t>(len),
+                             nonce, NonceSize, reinterpret_cast<const unsigned char *>(in),
+                             static_cast<size_t>(len + TagSize), ad, static_cast<size_t>(adLen))
+            == 1
+            && outLen == static_cast<size_t>(len);
+}
+
+#else
+
+AeadContext::AeadContext(Cipher::Algorithm algo, const QByteArray &key)
+    : encryptContext(nullptr)
+    , decryptContext(nullptr)
+    , valid(false)
+{
+    const EVP_CIPHER *cipher = nullptr;
+    switch (algo) {
+    case Cipher::AES128:
+        cipher = EVP_aes_128_gcm();
+        break;
+    case Cipher::AES256:
+        cipher = EVP_aes_256_gcm();
+        break;
+#  if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    case Cipher::ChaCha20Poly1305:
+        cipher = EVP_chacha20_poly1305();
+        break;
+#  endif
+    default:
+        break;
+    }
+    if (!cipher || key.size() != EVP_CIPHER_key_length(cipher)) {
+        return;
+    }
+    const unsigned char *k = reinterpret_cast<const unsigned char *>(key.constData());
+    encryptContext = EVP_CIPHER_CTX_new();
+    decryptContext = EVP_CIPHER_CTX_new();
+    valid = encryptContext && decryptContext && EVP_EncryptInit_ex(encryptContext, cipher, nullptr, k, nullptr) == 1
+            && EVP_DecryptInit_ex(decryptContext, cipher, nullptr, k, nullptr) == 1;
+}
+
+AeadContext::~AeadContext()
+{
+    if (encryptContext) {
+        EVP_CIPHER_CTX_free(encryptContext);
+    }
+    if (decryptContext) {
+        EVP_CIPHER_CTX_free(decryptContext);
+    }
+}
+
+bool AeadContext::seal(const uchar *nonce, const uchar *ad, int adLen, const char *in, int len, char *out)
+{
+    unsigned char *o = reinterpret_cast<unsigned char *>(out);
+    int outl = 0, finall = 0;
+    return EVP_EncryptInit_ex(encryptContext, nullptr, nullptr, nullptr, nonce) == 1
+            && EVP_EncryptUpdate(encryptContext, nullptr, &outl, ad, adLen) == 1
+            && EVP_EncryptUpdate(encryptContext, o, &outl, reinterpret_cast<const unsigned char *>(in), len) == 1
+            && EVP_EncryptFinal_ex(encryptContext, o + outl, &finall) == 1
+            && EVP_CIPHER_CTX_ctrl(encryptContext, EVP_CTRL_GCM_GET_TAG, TagSize, o + len) == 1;
+}
+
+bool AeadContext::open(const uchar *nonce, const uchar *ad, int adLen, const char *in, int len, char *out)
+{
+    unsigned char *o = reinterpret_cast<unsigned char *>(out);
+    unsigned char tag[TagSize];
+    memcpy(tag, in + len, TagSize);  // out may overwrite it.
+    int outl = 0, finall = 0;
+    return EVP_DecryptInit_ex(decryptContext, nullptr, nullptr, nullptr, nonce) == 1
+            && EVP_DecryptUpdate(decryptContext, nullptr, &outl, ad, adLen) == 1
+            && EVP_DecryptUpdate(decryptContext, o, &outl, reinterpret_cast<const unsigned char *>(in), len) == 1
+            && EVP_CIPHER_CTX_ctrl(decryptContext, EVP_CTRL_GCM_SET_TAG, TagSize, tag) == 1
+            && EVP_DecryptFinal_ex(decryptContext, o + outl, &finall) == 1;
+}
+
+#endif
+
+// every record is a 4-byte length of plaintext, the ciphertext and the tag. the length is authenticated as the
+// additional data. the random nonce base of each direction is sent before its first record.
+class AeadSocketLike : public WrappedSocketLike
+{
+public:
+    AeadSocketLike(QSharedPointer<AeadContext> context, qint32 maxRecordSize, QSharedPointer<SocketLike> s);
+public:
+    virtual qint32 recv(char *data, qint32 size) override;
+    virtual qint32 recvall(char *data, qint32 size) override;
+    virtual qint32 send(const char *data, qint32 size) override;
+    virtual qint32 sendall(const char *data, qint32 size) override;
+    virtual QByteArray recv(qint32 size) override;
+    virtual QByteArray recvall(qint32 size) override;
+    virtual qint32 send(const QByteArray &data) override;
+    virtual qint32 sendall(const QByteArray &data) override;
+public:
+    int readRecord();  // returns 0 if the connection is closed between records, -1 if failed.
+    static void makeNonce(const uchar *base, quint64 seq, uchar *nonce);
+
+    QSharedPointer<AeadContext> context;
+    QByteArray record;  // the decrypted record, read from recordPos.
+    int recordPos;
+    qint32 maxRecordSize;
+    quint64 sendingSeq;
+    quint64 receivingSeq;
+    uchar sendingBase[AeadContext::NonceSize];
+    uchar receivingBase[AeadContext::NonceSize];
+    bool baseSent;
+    bool baseReceived;
+    bool broken;
+};
+
+AeadSocketLike::AeadSocketLike(QSharedPointer<AeadContext> context, qint32 maxRecordSize,
+                               QSharedPointer<SocketLike> s)
+    : WrappedSocketLike(s)
+    , context(context)
+    , recordPos(0)
+    , maxRecordSize(maxRecordSize)
+    , sendingSeq(0)
+    , receivingSeq(0)
+    , baseSent(false)
+    , baseReceived(false)
+    , broken(false)
+{
+    broken = RAND_bytes(sendingBase, sizeof(sendingBase)) != 1;
+}
+
+// the nonce of tls 1.3, the base xor the sequence.
+void AeadSocketLike::makeNonce(const uchar *base, quint64 seq, uchar *nonce)
+{
+    memcpy(nonce, base, AeadContext::NonceSize);
+    uchar t[sizeof(quint64)];
+    qToBigEndian<quint64>(seq, t);
+    for (int i = 0; i < static_cast<int>(sizeof(quint64)); ++i) {
+        nonce[AeadContext::NonceSize - sizeof(quint64) + i] ^= t[i];
+    }
+}
+
+int AeadSocketLike::readRecord()
+{
+    if (!baseReceived) {
+        qint32 bs = s->recvall(reinterpret_cast<char *>(receivingBase), sizeof(receivingBase));
+        if (bs == 0) {
+            return 0;
+        } else if (bs != static_cast<qint32>(sizeof(receivingBase))) {
+            broken = true;
+            return -1;
+        }
+        baseReceived = true;
+    }
+    uchar header[sizeof(quint32)];
+    qint32 bs = s->recvall(reinterpret_cast<char *>(header), sizeof(header));
+    if (bs == 0) {
+        return 0;
+    } else if (bs != static_cast<qint32>(sizeof(header))) {
+        broken = true;
+        return -1;
+    }
+    const quint32 len = qFromBigEndian<quint32>(header);
+    if (len == 0 || len > static_cast<quint32>(maxRecordSize)) {
+        qtng_warning << "the encrypted record is too large:" << len;
+        broken = true;
+        return -1;
+    }
+    record.resize(static_cast<int>(len) + AeadContext::TagSize);
+    if (s->recvall(record.data(), record.size()) != record.size()) {
+        broken = true;
+        return -1;
+    }
+    uchar nonce[AeadContext::NonceSize];
+    makeNonce(receivingBase, receivingSeq++, nonce);
+    if (!context->open(nonce, header, sizeof(header), record.constData(), static_cast<int>(len), record.data())) {
+        qtng_warning << "the encrypted record is forged.";
+        broken = true;
+        return -1;
+    }
+    record.resize(static_cast<int>(len));
+    recordPos = 0;
+    return 1;
+}
+
+qint32 AeadSocketLike::recv(char *data, qint32 size)
+{
+    if (broken) {
+        return -1;
+    }
+    if (size <= 0) {
+        return 0;
+    }
+    if (recordPos >= record.size()) {
+        int r = readRecord();
+        if (r <= 0) {
+            return r;
+        }
+    }
+    const qint32 n = qMin(size, record.size() - recordPos);
+    memcpy(data, record.constData() + recordPos, static_cast<size_t>(n));
+    recordPos += n;
+    return n;
+}
+
+qint32 AeadSocketLike::recvall(char *data, qint32 size)
+{
+    qint32 total = 0;
+    while (total < size) {
+        qint32 bs = recv(data + total, size - total);
+        if (bs < 0) {
+            return -1;
+        } else if (bs == 0) {
+            break;
+        }
+        total += bs;
+    }
+    return total;
+}
+
+// the records of one call are sent together by one sendall().
+qint32 AeadSocketLike::send(const char *data, qint32 size)
+{
+    if (broken || size <= 0) {
+        return -1;
+    }
+    const qint32 headerSize = static_cast<qint32>(sizeof(quint32));
+    const qint64 records = (static_cast<qint64>(size) + maxRecordSize - 1) / maxRecordSize;
+    const qint64 total = (baseSent ? 0 : AeadContext::NonceSize) + size + records * (headerSize + AeadContext::TagSize);
+    if (total > INT_MAX) {
+        return -1;
+    }
+    QByteArray buf(static_cast<int>(total), Qt::Uninitialized);
+    char *p = buf.data();
+    if (!baseSent) {
+        memcpy(p, sendingBase, sizeof(sendingBase));
+        p += sizeof(sendingBase);
+        baseSent = true;
+    }
+    for (qint32 offset = 0; offset < size;) {
+        const qint32 len = qMin(maxRecordSize, size - offset);
+        uchar *header = reinterpret_cast<uchar *>(p);
+        qToBigEndian<quint32>(static_cast<quint32>(len), header);
+        uchar nonce[AeadContext::NonceSize];
+        makeNonce(sendingBase, sendingSeq++, nonce);
+        if (!context->seal(nonce, header, headerSize, data + offset, len, p + headerSize)) {
+            broken = true;
+            return -1;
+        }
+        p += headerSize + len + AeadContext::TagSize;
+        offset += len;
+    }
+    qint32 bs = s->sendall(buf);
+    if (bs != buf.size()) {
+        broken = true;
+        return -1;
+    }
+    return size;
+}
+
+qint32 AeadSocketLike::sendall(const char *data, qint32 size)
+{
+    return send(data, size);
+}
+
+QByteArray AeadSocketLike::recv(qint32 size)
+{
+    QByteArray buf(size, Qt::Uninitialized);
+    qint32 bs = recv(buf.data(), buf.size());
+    if (bs <= 0) {
+        return QByteArray();
+    }
+    buf.resize(bs);
+    return buf;
+}
+
+QByteArray AeadSocketLike::recvall(qint32 size)
+{
+    QByteArray buf(size, Qt::Uninitialized);
+    qint32 bs = recvall(buf.data(), buf.size());
+    if (bs <= 0) {
+        return QByteArray();
+    }
+    buf.resize(bs);
+    return buf;
+}
+
+qint32 AeadSocketLike::send(const QByteArray &data)
+{
+    return send(data.constData(), data.size());
+}
+
+qint32 AeadSocketLike::sendall(const QByteArray &data)
+{
+    return send(data.constData(), data.size());
+}
+
 }  // anonymous namespace
 
 QSharedPointer<SocketLike> encrypted(QSharedPointer<Cipher> cipher, QSharedPointer<SocketLike> socket)
@@ -2206,4 +4142,22 @@ QSharedPointer<SocketLike> encrypted(QSharedPointer<Cipher> cipher, QSharedPoint
     return QSharedPointer<SocketLike>(new EncryptedSocketLike(cipher, socket));
 }
 
+QSharedPointer<SocketLike> encryptedRecords(Cipher::Algorithm algo, const QByteArray &key,
+                                            QSharedPointer<SocketLike> socket, qint32 maxRecordSize)
+{
+    const qint32 MaxRecordSize = 1024 * 1024 * 16;
+    if (socket.isNull() || maxRecordSize <= 0 || maxRecordSize > MaxRecordSize) {
+        return QSharedPointer<SocketLike>();
+    }
+    QSharedPointer<AeadContext> context(new AeadContext(algo, key));
+    if (!context->isValid()) {
+        return QSharedPointer<SocketLike>();
+    }
+    QSharedPointer<AeadSocketLike> s(new AeadSocketLike(context, maxRecordSize, socket));
+    if (s->broken) {
+        return QSharedPointer<SocketLike>();
+    }
+    return s;
+}
+
 QTNETWORKNG_NAMESPACE_END
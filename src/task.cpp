@@ -0,0 +1,62 @@
+#include "../include/task.h"
+#include "../include/private/eventloop_p.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+namespace {
+
+class TaskCallbackFunctor : public Functor
+{
+public:
+    TaskCallbackFunctor(TaskScheduler::Callback callback, void *data)
+        : callback(callback)
+        , data(data)
+    {
+    }
+    virtual void operator()() override { callback(data); }
+    TaskScheduler::Callback const callback;
+    void * const data;
+};
+
+}  // anonymous namespace
+
+int TaskScheduler::callLater(quint32 msecs, Callback callback, void *data)
+{
+    return EventLoopCoroutine::get()->callLater(msecs, new TaskCallbackFunctor(callback, data));
+}
+
+void TaskScheduler::cancelCall(int callId)
+{
+    EventLoopCoroutine::get()->cancelCall(callId);
+}
+
+int TaskScheduler::watch(qintptr fd, bool writing, Callback callback, void *data)
+{
+    EventLoopCoroutine *eventLoop = EventLoopCoroutine::get();
+    const int watcherId = eventLoop->createWatcher(writing ? EventLoopCoroutine::Write : EventLoopCoroutine::Read, fd,
+                                                   new TaskCallbackFunctor(callback, data));
+    eventLoop->startWatcher(watcherId);
+    return watcherId;
+}
+
+void TaskScheduler::stopWatching(int watcherId)
+{
+    EventLoopCoroutine::get()->stopWatcher(watcherId);
+}
+
+void TaskScheduler::removeWatcher(int watcherId)
+{
+    EventLoopCoroutine::get()->removeWatcher(watcherId);
+}
+
+bool TaskScheduler::wait(Event &event)
+{
+    if (dynamic_cast<Coroutine *>(BaseCoroutine::current())) {
+        return event.wait();
+    }
+    // the main coroutine runs the eventloop until a helper coroutine sees the event.
+    QScopedPointer<Coroutine> waiter(Coroutine::spawn([&event] { event.wait(); }));
+    return waiter->join() && event.isSet();
+}
+
+QTNETWORKNG_NAMESPACE_END
@@ -0,0 +1,267 @@
+#include <QtCore/qfile.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qvector.h>
+#include <QtCore/qthreadstorage.h>
+#include <QtCore/qelapsedtimer.h>
+#include "../include/private/tracing_p.h"
+#include "../include/private/coroutine_p.h"
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.tracing");
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+#ifdef QTNG_HAVE_TRACING
+
+QBasicAtomicInt tracingEnabled = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+namespace {
+
+struct TraceEvent
+{
+    const char *category;
+    const char *name;
+    const char *argName;
+    qint64 arg;
+    qint64 timestamp;
+    qint64 duration;  // -1 for instant events.
+    quintptr coroutine;
+};
+
+// written by its thread only. the buffers are kept after the threads exit, so their events are still dumped.
+struct TraceBuffer
+{
+    explicit TraceBuffer(int index, int capacity)
+        : events(capacity)
+        , next(0)
+        , count(0)
+        , index(index)
+    {
+    }
+    void append(const TraceEvent &event);
+    QVector<TraceEvent> events;
+    int next;
+    int count;
+    const int index;
+};
+
+void TraceBuffer::append(const TraceEvent &event)
+{
+    events[next] = event;
+    next = (next + 1) % events.size();
+    if (count < events.size()) {
+        ++count;
+    }
+}
+
+struct TraceRegistry
+{
+    TraceRegistry()
+        : capacity(64 * 1024)
+        , generation(0)
+    {
+        clock.start();
+    }
+    QMutex lock;
+    QVector<TraceBuffer *> buffers;
+    QElapsedTimer clock;
+    int capacity;
+    int generation;
+};
+
+struct LocalTraceBuffer
+{
+    TraceBuffer *buffer;
+    int generation;
+};
+
+}  // anonymous namespace
+
+Q_GLOBAL_STATIC(TraceRegistry, traceRegistry)
+Q_GLOBAL_STATIC(QThreadStorage<LocalTraceBuffer>, localTraceBuffers)
+
+static TraceBuffer *currentTraceBuffer()
+{
+    TraceRegistry *registry = traceRegistry();
+    QThreadStorage<LocalTraceBuffer> *storage = localTraceBuffers();
+    if (!registry || !storage) {
+        return nullptr;
+    }
+    if (storage->hasLocalData()) {
+        const LocalTraceBuffer &local = storage->localData();
+        // the generation is read without the lock, a stale buffer is found by the comparing below.
+        if (local.buffer && local.generation == registry->generation) {
+            return local.buffer;
+        }
+    }
+    QMutexLocker locker(&registry->lock);
+    TraceBuffer *buffer = new TraceBuffer(registry->buffers.size() + 1, registry->capacity);
+    registry->buffers.append(buffer);
+    LocalTraceBuffer local;
+    local.buffer = buffer;
+    local.generation = registry->generation;
+    storage->setLocalData(local);
+    return buffer;
+}
+
+static void appendTraceEvent(const char *category, const char *name, qint64 timestamp, qint64 duration,
+                             const char *argName, qint64 arg)
+{
+    TraceBuffer *buffer = currentTraceBuffer();
+    if (!buffer) {
+        return;
+    }
+    TraceEvent event;
+    event.category = category;
+    event.name = name;
+    event.argName = argName;
+    event.arg = arg;
+    event.timestamp = timestamp;
+    event.duration = duration;
+    BaseCoroutine *coroutine = currentCoroutine().get(false);
+    event.coroutine = coroutine ? coroutine->id() : 0;
+    buffer->append(event);
+}
+
+qint64 traceNow()
+{
+    TraceRegistry *registry = traceRegistry();
+    return registry ? registry->clock.nsecsElapsed() / 1000 : 0;
+}
+
+void traceComplete(const char *category, const char *name, qint64 started, const char *argName, qint64 arg)
+{
+    appendTraceEvent(category, name, started, traceNow() - started, argName, arg);
+}
+
+void traceInstant(const char *category, const char *name, const char *argName, qint64 arg)
+{
+    appendTraceEvent(category, name, traceNow(), -1, argName, arg);
+}
+
+static void appendJsonString(QByteArray *out, const char *s)
+{
+    out->append('"');
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') {
+            out->append('\\');
+        }
+        out->append(*s);
+    }
+    out->append('"');
+}
+
+#endif
+
+bool Tracing::isCompiledIn()
+{
+#ifdef QTNG_HAVE_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Tracing::start(int eventsPerThread)
+{
+#ifdef QTNG_HAVE_TRACING
+    if (eventsPerThread <= 0) {
+        return false;
+    }
+    TraceRegistry *registry = traceRegistry();
+    if (!registry) {
+        return false;
+    }
+    tracingEnabled.storeRelease(0);
+    {
+        QMutexLocker locker(&registry->lock);
+        // the buffers may be still in use by the threads which did not see the flag, leak them.
+        registry->buffers.clear();
+        registry->capacity = eventsPerThread;
+        ++registry->generation;
+    }
+    tracingEnabled.storeRelease(1);
+    return true;
+#else
+    Q_UNUSED(eventsPerThread);
+    qtng_warning << "tracing is not compiled in, build with QTNG_HAVE_TRACING.";
+    return false;
+#endif
+}
+
+void Tracing::stop()
+{
+#ifdef QTNG_HAVE_TRACING
+    tracingEnabled.storeRelease(0);
+#endif
+}
+
+bool Tracing::isRecording()
+{
+#ifdef QTNG_HAVE_TRACING
+    return tracingEnabled.loadAcquire() != 0;
+#else
+    return false;
+#endif
+}
+
+QByteArray Tracing::chromeTrace()
+{
+    QByteArray out("{\"traceEvents\":[");
+#ifdef QTNG_HAVE_TRACING
+    TraceRegistry *registry = traceRegistry();
+    if (registry) {
+        QMutexLocker locker(&registry->lock);
+        bool first = true;
+        char buf[160];
+        for (const TraceBuffer *buffer : registry->buffers) {
+            const int size = buffer->events.size();
+            const int begin = (buffer->next - buffer->count + size) % size;
+            for (int i = 0; i < buffer->count; ++i) {
+                const TraceEvent &event = buffer->events.at((begin + i) % size);
+                if (!first) {
+                    out.append(',');
+                }
+                first = false;
+                out.append("\n{\"name\":");
+                appendJsonString(&out, event.name);
+                out.append(",\"cat\":");
+                appendJsonString(&out, event.category);
+                int len;
+                if (event.duration >= 0) {
+                    len = qsnprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%llu",
+                                    static_cast<long long>(event.timestamp), static_cast<long long>(event.duration),
+                                    buffer->index, static_cast<unsigned long long>(event.coroutine));
+                } else {
+                    len = qsnprintf(buf, sizeof(buf), ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%d,\"tid\":%llu",
+                                    static_cast<long long>(event.timestamp), buffer->index,
+                                    static_cast<unsigned long long>(event.coroutine));
+                }
+                out.append(buf, len);
+                if (event.argName) {
+                    out.append(",\"args\":{");
+                    appendJsonString(&out, event.argName);
+                    len = qsnprintf(buf, sizeof(buf), ":%lld}", static_cast<long long>(event.arg));
+                    out.append(buf, len);
+                }
+                out.append('}');
+            }
+        }
+    }
+#endif
+    out.append("\n],\"displayTimeUnit\":\"ms\"}\n");
+    return out;
+}
+
+bool Tracing::dumpChromeTrace(const QString &filePath)
+{
+    QFile f(filePath);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qtng_warning << "can not open trace file:" << filePath;
+        return false;
+    }
+    const QByteArray &data = chromeTrace();
+    return f.write(data) == data.size();
+}
+
+QTNETWORKNG_NAMESPACE_END
@@ -0,0 +1,699 @@
+#include <QtCore/qcryptographichash.h>
+#include <QtCore/qendian.h>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+#  include <QtCore/qrandom.h>
+#endif
+#include "../include/websocket.h"
+#include "../include/http.h"
+#include "../include/locks.h"
+#ifdef QTNG_HAVE_ZLIB
+#  include "../include/gzip.h"
+#endif
+#include "debugger.h"
+
+QTNG_LOGGER("qtng.websocket");
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+namespace {
+
+enum Opcode {
+    ContinuationFrame = 0,
+    TextFrame = 1,
+    BinaryFrame = 2,
+    CloseFrame = 8,
+    PingFrame = 9,
+    PongFrame = 10,
+};
+
+const char WebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+const qint32 MaxControlPayload = 125;
+const qint32 MinCompressSize = 64;  // deflate makes the tiny messages larger.
+
+struct Frame
+{
+    QByteArray payload;
+    quint8 opcode;
+    bool fin;
+    bool rsv1;
+};
+
+QByteArray makeAccept(const QByteArray &key)
+{
+    return QCryptographicHash::hash(key + QByteArray(WebSocketGuid), QCryptographicHash::Sha1).toBase64();
+}
+
+void makeMaskKey(char key[4])
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    const quint32 r = QRandomGenerator::global()->generate();
+#else
+    const quint32 r = (static_cast<quint32>(qrand()) << 16) ^ static_cast<quint32>(qrand());
+#endif
+    memcpy(key, &r, 4);
+}
+
+QByteArray makeHeader(quint8 opcode, bool fin, bool rsv1, qint64 size, const char *key)
+{
+    QByteArray header;
+    header.reserve(14);
+    header.append(static_cast<char>((fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | opcode));
+    const quint8 maskBit = key ? 0x80 : 0;
+    if (size < 126) {
+        header.append(static_cast<char>(maskBit | size));
+    } else if (size <= 0xffff) {
+        uchar buf[2];
+        qToBigEndian<quint16>(static_cast<quint16>(size), buf);
+        header.append(static_cast<char>(maskBit | 126));
+        header.append(reinterpret_cast<const char *>(buf), 2);
+    } else {
+        uchar buf[8];
+        qToBigEndian<quint64>(static_cast<quint64>(size), buf);
+        header.append(static_cast<char>(maskBit | 127));
+        header.append(reinterpret_cast<const char *>(buf), 8);
+    }
+    if (key) {
+        header.append(key, 4);
+    }
+    return header;
+}
+
+bool hasToken(const QByteArray &value, const QByteArray &token)
+{
+    for (const QByteArray &part : value.split(',')) {
+        if (part.trimmed().toLower() == token) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// find the first permessage-deflate which can be followed. the compressor always uses 15 bits window, and the
+// decompressor accepts any window. resetCompressor is set if my compressor must not take over the context.
+bool parseDeflateExtension(const QByteArray &value, bool isClient, bool *resetCompressor)
+{
+    const QByteArray myNoContextTakeover = isClient ? "client_no_context_takeover" : "server_no_context_takeover";
+    const QByteArray peerNoContextTakeover = isClient ? "server_no_context_takeover" : "client_no_context_takeover";
+    const QByteArray myMaxWindowBits = isClient ? "client_max_window_bits" : "server_max_window_bits";
+    const QByteArray peerMaxWindowBits = isClient ? "server_max_window_bits" : "client_max_window_bits";
+    for (const QByteArray &extension : value.split(',')) {
+        const QList<QByteArray> &params = extension.split(';');
+        if (params.first().trimmed().toLower() != "permessage-deflate") {
+            continue;
+        }
+        bool ok = true;
+        bool reset = false;
+        for (int i = 1; i < params.size() && ok; ++i) {
+            const QByteArray &param = params.at(i).trimmed().toLower();
+            const int eq = param.indexOf('=');
+            const QByteArray &name = eq < 0 ? param : param.left(eq).trimmed();
+            QByteArray arg = eq < 0 ? QByteArray() : param.mid(eq + 1).trimmed();
+            if (arg.size() >= 2 && arg.startsWith('"') && arg.endsWith('"')) {
+                arg = arg.mid(1, arg.size() - 2);
+            }
+            if (name == myNoContextTakeover) {
+                reset = true;
+            } else if (name == peerNoContextTakeover || name == peerMaxWindowBits) {
+                // nothing to do with my decompressor.
+            } else if (name == myMaxWindowBits) {
+                ok = arg.isEmpty() || arg.toInt() == 15;
+            } else {
+                ok = false;
+            }
+        }
+        if (ok) {
+            *resetCompressor = reset;
+            return true;
+        }
+        if (isClient) {
+            return false;  // the server responds one extension only.
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+// xor eight bytes at a time, which is vectorized by compilers. offset keeps the key aligned for the fragments.
+void maskWebSocketPayload(char *data, qint64 size, const char key[4], qint64 offset)
+{
+    char rotated[8];
+    for (int i = 0; i < 8; ++i) {
+        rotated[i] = key[(offset + i) & 3];
+    }
+    quint64 key64;
+    memcpy(&key64, rotated, 8);
+    qint64 i = 0;
+    for (; i + 8 <= size; i += 8) {
+        quint64 word;
+        memcpy(&word, data + i, 8);
+        word ^= key64;
+        memcpy(data + i, &word, 8);
+    }
+    for (; i < size; ++i) {
+        data[i] ^= rotated[i & 7];
+    }
+}
+
+class WebSocketPrivate
+{
+public:
+    WebSocketPrivate(QSharedPointer<SocketLike> connection, const QByteArray &buffered, bool isClient,
+                     bool compressed);
+    bool readBytes(qint32 size, QByteArray *out);
+    quint16 recvFrame(Frame *frame);  // returns 0 or the close code of error.
+    bool sendFrames(quint8 opcode, QByteArray payload, bool rsv1);  // the sending lock must be held.
+    bool sendControl(quint8 opcode, const QByteArray &payload);
+    bool sendClose(quint16 code, const QString &reason);
+    void fail(quint16 code, const QString &reason);
+public:
+    QSharedPointer<SocketLike> connection;
+    QByteArray buffered;
+    qint32 pos;  // the bytes of buffered before it are consumed.
+    Lock sending;
+#ifdef QTNG_HAVE_ZLIB
+    QScopedPointer<PacketCompressor> compressor;
+    QScopedPointer<PacketDecompressor> decompressor;
+#endif
+    QString closeReason;
+    qint32 maxMessageSize;
+    qint32 fragmentSize;
+    quint16 closeCode;
+    bool isClient;
+    bool compressed;
+    bool resetCompressor;
+    bool closeSent;
+    bool closeReceived;
+};
+
+WebSocketPrivate::WebSocketPrivate(QSharedPointer<SocketLike> connection, const QByteArray &buffered, bool isClient,
+                                   bool compressed)
+    : connection(connection)
+    , buffered(buffered)
+    , pos(0)
+    , maxMessageSize(1024 * 1024 * 16)
+    , fragmentSize(1024 * 64)
+    , closeCode(WebSocket::NoStatusReceived)
+    , isClient(isClient)
+    , compressed(compressed)
+    , resetCompressor(false)
+    , closeSent(false)
+    , closeReceived(false)
+{
+#ifndef QTNG_HAVE_ZLIB
+    this->compressed = false;
+#endif
+}
+
+bool WebSocketPrivate::readBytes(qint32 size, QByteArray *out)
+{
+    const qint32 ChunkSize = 1024 * 16;
+    qint32 available = buffered.size() - pos;
+    if (available < size && size > ChunkSize) {
+        // the large payload is read into its own buffer directly.
+        out->resize(size);
+        memcpy(out->data(), buffered.constData() + pos, static_cast<size_t>(available));
+        buffered.clear();
+        pos = 0;
+        return connection->recvall(out->data() + available, size - available) == size - available;
+    }
+    if (available < size) {
+        buffered = buffered.mid(pos);
+        pos = 0;
+        while (buffered.size() < size) {
+            const int old = buffered.size();
+            buffered.resize(old + ChunkSize);
+            qint32 bs = connection->recv(buffered.data() + old, ChunkSize);
+            if (bs <= 0) {
+                buffered.resize(old);
+                return false;
+            }
+            buffered.resize(old + bs);
+        }
+        available = buffered.size();
+    }
+    if (pos == 0 && available == size) {
+        out->swap(buffered);
+        buffered.clear();
+    } else {
+        *out = buffered.mid(pos, size);
+        pos += size;
+        if (pos == buffered.size()) {
+            buffered.clear();
+            pos = 0;
+        }
+    }
+    return true;
+}
+
+quint16 WebSocketPrivate::recvFrame(Frame *frame)
+{
+    QByteArray head;
+    if (!readBytes(2, &head)) {
+        return WebSocket::AbnormalClosure;
+    }
+    const quint8 b0 = static_cast<quint8>(head.at(0));
+    const quint8 b1 = static_cast<quint8>(head.at(1));
+    frame->fin = b0 & 0x80;
+    frame->rsv1 = b0 & 0x40;
+    frame->opcode = b0 & 0x0f;
+    const bool masked = b1 & 0x80;
+    // the server must not mask, and the client must.
+    if ((b0 & 0x30) || masked == isClient || (frame->rsv1 && !compressed)) {
+        return WebSocket::ProtocolError;
+    }
+    quint64 size = b1 & 0x7f;
+    if (size == 126) {
+        if (!readBytes(2, &head)) {
+            return WebSocket::AbnormalClosure;
+        }
+        size = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(head.constData()));
+    } else if (size == 127) {
+        if (!readBytes(8, &head)) {
+            return WebSocket::AbnormalClosure;
+        }
+        size = qFromBigEndian<quint64>(reinterpret_cast<const uchar *>(head.constData()));
+    }
+    if (size > static_cast<quint64>(maxMessageSize)) {
+        return WebSocket::MessageTooBig;
+    }
+    QByteArray key;
+    if (masked && !readBytes(4, &key)) {
+        return WebSocket::AbnormalClosure;
+    }
+    frame->payload.clear();
+    if (size > 0) {
+        if (!readBytes(static_cast<qint32>(size), &frame->payload)) {
+            return WebSocket::AbnormalClosure;
+        }
+        if (masked) {
+            maskWebSocketPayload(frame->payload.data(), frame->payload.size(), key.constData());
+        }
+    }
+    return 0;
+}
+
+// the fragments are masked in the copy of payload, and written with their headers by one sendv().
+bool WebSocketPrivate::sendFrames(quint8 opcode, QByteArray payload, bool rsv1)
+{
+    const qint32 size = payload.size();
+    const qint32 fragment = opcode >= CloseFrame ? qMax(1, size) : qMax(1, fragmentSize);
+    char *data = isClient && size > 0 ? payload.data() : nullptr;
+    QList<QByteArray> buffers;
+    qint64 total = 0;
+    qint32 offset = 0;
+    do {
+        const qint32 n = qMin(fragment, size - offset);
+        const bool first = offset == 0;
+        char key[4];
+        if (isClient) {
+            makeMaskKey(key);
+            if (n > 0) {
+                maskWebSocketPayload(data + offset, n, key);
+            }
+        }
+        const QByteArray &header = makeHeader(first ? opcode : static_cast<quint8>(ContinuationFrame),
+                                              offset + n >= size, first && rsv1, n, isClient ? key : nullptr);
+        buffers.append(header);
+        total += header.size();
+        if (n > 0) {
+            buffers.append(QByteArray::fromRawData(payload.constData() + offset, n));
+            total += n;
+        }
+        offset += n;
+    } while (offset < size);
+    return connection->sendv(buffers) == total;
+}
+
+bool WebSocketPrivate::sendControl(quint8 opcode, const QByteArray &payload)
+{
+    ScopedLock<Lock> l(sending);
+    if (!l.isSuccess() || closeSent) {
+        return false;
+    }
+    return sendFrames(opcode, payload.left(MaxControlPayload), false);
+}
+
+bool WebSocketPrivate::sendClose(quint16 code, const QString &reason)
+{
+    ScopedLock<Lock> l(sending);
+    if (!l.isSuccess() || closeSent) {
+        return false;
+    }
+    closeSent = true;
+    QByteArray payload;
+    if (code != WebSocket::NoStatusReceived) {
+        uchar buf[2];
+        qToBigEndian<quint16>(code, buf);
+        payload.append(reinterpret_cast<const char *>(buf), 2);
+        payload.append(reason.toUtf8().left(MaxControlPayload - 2));
+    }
+    return sendFrames(CloseFrame, payload, false);
+}
+
+void WebSocketPrivate::fail(quint16 code, const QString &reason)
+{
+    closeCode = code;
+    closeReason = reason;
+    if (code != WebSocket::AbnormalClosure) {
+        sendClose(code, reason);
+    }
+    closeSent = true;
+    closeReceived = true;
+    connection->close();
+}
+
+WebSocket::WebSocket(QSharedPointer<SocketLike> connection, const QByteArray &buffered, bool isClient,
+                     bool compressed)
+    : d_ptr(new WebSocketPrivate(connection, buffered, isClient, compressed))
+{
+}
+
+WebSocket::~WebSocket()
+{
+    delete d_ptr;
+}
+
+bool WebSocket::sendMessage(const QByteArray &payload, MessageType type)
+{
+    Q_D(WebSocket);
+    ScopedLock<Lock> l(d->sending);
+    if (!l.isSuccess() || d->closeSent) {
+        return false;
+    }
+#ifdef QTNG_HAVE_ZLIB
+    // compressed in the sending lock, so the messages are sent in the order of context.
+    if (d->compressed && payload.size() >= MinCompressSize) {
+        if (d->compressor.isNull() || d->resetCompressor) {
+            d->compressor.reset(new PacketCompressor());
+        }
+        QByteArray deflated;
+        if (!d->compressor->compress(payload, &deflated)) {
+            return false;
+        }
+        return d->sendFrames(static_cast<quint8>(type), deflated, true);
+    }
+#endif
+    return d->sendFrames(static_cast<quint8>(type), payload, false);
+}
+
+bool WebSocket::ping(const QByteArray &data)
+{
+    Q_D(WebSocket);
+    return d->sendControl(PingFrame, data);
+}
+
+QByteArray WebSocket::recvMessage(MessageType *type)
+{
+    Q_D(WebSocket);
+    QByteArray message;
+    quint8 messageOpcode = 0;
+    bool messageCompressed = false;
+    Frame frame;
+    while (!d->closeReceived) {
+        quint16 error = d->recvFrame(&frame);
+        if (error) {
+            d->fail(error, QString());
+            return QByteArray();
+        }
+        if (frame.opcode >= CloseFrame) {
+            if (!frame.fin || frame.payload.size() > MaxControlPayload || frame.rsv1) {
+                d->fail(ProtocolError, QString());
+                return QByteArray();
+            }
+            if (frame.opcode == PingFrame) {
+                d->sendControl(PongFrame, frame.payload);
+            } else if (frame.opcode == CloseFrame) {
+                d->closeReceived = true;
+                if (frame.payload.size() >= 2) {
+                    d->closeCode = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(frame.payload.constData()));
+                    d->closeReason = QString::fromUtf8(frame.payload.mid(2));
+                }
+                // echo the status code.
+                d->sendClose(d->closeCode, QString());
+                d->connection->close();
+                return QByteArray();
+            } else if (frame.opcode != PongFrame) {
+                d->fail(ProtocolError, QString());
+                return QByteArray();
+            }
+            continue;
+        }
+        if (frame.opcode == ContinuationFrame) {
+            if (messageOpcode == 0 || frame.rsv1) {
+                d->fail(ProtocolError, QString());
+                return QByteArray();
+            }
+            if (message.size() + frame.payload.size() > d->maxMessageSize) {
+                d->fail(MessageTooBig, QString());
+                return QByteArray();
+            }
+            message.append(frame.payload);
+        } else if ((frame.opcode == TextFrame || frame.opcode == BinaryFrame) && messageOpcode == 0) {
+            messageOpcode = frame.opcode;
+            messageCompressed = frame.rsv1;
+            message = frame.payload;
+        } else {
+            d->fail(ProtocolError, QString());
+            return QByteArray();
+        }
+        if (!frame.fin) {
+            continue;
+        }
+#ifdef QTNG_HAVE_ZLIB
+        if (messageCompressed) {
+            if (d->decompressor.isNull()) {
+                d->decompressor.reset(new PacketDecompressor());
+            }
+            QByteArray inflated;
+            if (!d->decompressor->decompress(message, &inflated, d->maxMessageSize)) {
+                d->fail(InvalidPayload, QString());
+                return QByteArray();
+            }
+            message.swap(inflated);
+        }
+#endif
+        if (type) {
+            *type = static_cast<MessageType>(messageOpcode);
+        }
+        if (message.isNull()) {
+            message = QByteArray("");  // the empty message is not null.
+        }
+        return message;
+    }
+    return QByteArray();
+}
+
+void WebSocket::close(CloseCode code, const QString &reason)
+{
+    Q_D(WebSocket);
+    if (!d->closeSent) {
+        d->closeCode = code;
+        d->closeReason = reason;
+        d->sendClose(code, reason);
+    }
+    d->closeReceived = true;
+    d->connection->close();
+}
+
+void WebSocket::abort()
+{
+    Q_D(WebSocket);
+    d->closeSent = true;
+    d->closeReceived = true;
+    d->closeCode = AbnormalClosure;
+    d->connection->abort();
+}
+
+bool WebSocket::isClosed() const
+{
+    Q_D(const WebSocket);
+    return d->closeSent || d->closeReceived;
+}
+
+bool WebSocket::isCompressed() const
+{
+    Q_D(const WebSocket);
+    return d->compressed;
+}
+
+quint16 WebSocket::closeCode() const
+{
+    Q_D(const WebSocket);
+    return d->closeCode;
+}
+
+QString WebSocket::closeReason() const
+{
+    Q_D(const WebSocket);
+    return d->closeReason;
+}
+
+void WebSocket::setMaxMessageSize(qint32 maxMessageSize)
+{
+    Q_D(WebSocket);
+    d->maxMessageSize = qMax(1, maxMessageSize);
+}
+
+qint32 WebSocket::maxMessageSize() const
+{
+    Q_D(const WebSocket);
+    return d->maxMessageSize;
+}
+
+void WebSocket::setFragmentSize(qint32 fragmentSize)
+{
+    Q_D(WebSocket);
+    d->fragmentSize = qMax(1, fragmentSize);
+}
+
+qint32 WebSocket::fragmentSize() const
+{
+    Q_D(const WebSocket);
+    return d->fragmentSize;
+}
+
+QSharedPointer<SocketLike> WebSocket::connection() const
+{
+    Q_D(const WebSocket);
+    return d->connection;
+}
+
+QSharedPointer<WebSocket> WebSocket::connect(HttpSession *session, const QUrl &url, bool compression,
+                                             const QList<HttpHeader> &headers)
+{
+    QUrl httpUrl(url);
+    if (url.scheme() == QLatin1String("ws")) {
+        httpUrl.setScheme(QString::fromLatin1("http"));
+    } else if (url.scheme() == QLatin1String("wss")) {
+        httpUrl.setScheme(QString::fromLatin1("https"));
+    }
+    QByteArray nonce(16, Qt::Uninitialized);
+    for (int i = 0; i < nonce.size(); i += 4) {
+        makeMaskKey(nonce.data() + i);
+    }
+    const QByteArray &key = nonce.toBase64();
+
+    HttpRequest request;
+    request.setMethod(QString::fromLatin1("GET"));
+    request.setUrl(httpUrl);
+    for (const HttpHeader &header : headers) {
+        request.addHeader(header);
+    }
+    request.setHeader(UpgradeHeader, "websocket");
+    request.setHeader(ConnectionHeader, "Upgrade");
+    request.setHeader(QString::fromLatin1("Sec-WebSocket-Key"), key);
+    request.setHeader(QString::fromLatin1("Sec-WebSocket-Version"), "13");
+#ifdef QTNG_HAVE_ZLIB
+    if (compression) {
+        request.setHeader(QString::fromLatin1("Sec-WebSocket-Extensions"), "permessage-deflate");
+    }
+#else
+    Q_UNUSED(compression);
+#endif
+    request.setVersion(Http1_1);
+    request.setStreamResponse(true);
+    request.disableRedirects();
+    HttpResponse response = session->send(request);
+    // the websocket over http2 of rfc 8441 is not supported.
+    if (response.statusCode() != 101 || response.version() == Http2_0) {
+        qtng_debug << "websocket handshake is refused by" << url << response.statusCode();
+        return QSharedPointer<WebSocket>();
+    }
+    if (response.header(UpgradeHeader).toLower() != "websocket"
+        || response.header(QString::fromLatin1("Sec-WebSocket-Accept")) != makeAccept(key)) {
+        qtng_debug << "invalid websocket handshake from" << url;
+        return QSharedPointer<WebSocket>();
+    }
+    bool compressed = false;
+    bool resetCompressor = false;
+    const QByteArray &extensions = response.header(QString::fromLatin1("Sec-WebSocket-Extensions"));
+    if (!extensions.isEmpty()) {
+        compressed = parseDeflateExtension(extensions, true, &resetCompressor);
+        if (!compressed) {
+            qtng_debug << "unknown websocket extensions from" << url << extensions;
+            return QSharedPointer<WebSocket>();
+        }
+    }
+    QByteArray buffered;
+    QSharedPointer<SocketLike> stream = response.takeStream(&buffered);
+    if (stream.isNull()) {
+        return QSharedPointer<WebSocket>();
+    }
+    QSharedPointer<WebSocket> webSocket(new WebSocket(stream, buffered, true, compressed));
+    webSocket->d_ptr->resetCompressor = resetCompressor;
+    return webSocket;
+}
+
+WebSocketRequestHandler::WebSocketRequestHandler()
+    : compression(true)
+{
+}
+
+void WebSocketRequestHandler::handle()
+{
+    BaseHttpRequestHandler::handle();
+    if (webSocket.isNull()) {
+        return;
+    }
+    serveWebSocket(webSocket);
+    if (!webSocket->isClosed()) {
+        webSocket->close(WebSocket::GoingAway);
+    }
+    webSocket.clear();
+}
+
+void WebSocketRequestHandler::doGET()
+{
+    upgradeToWebSocket();
+}
+
+bool WebSocketRequestHandler::acceptWebSocket()
+{
+    return true;
+}
+
+bool WebSocketRequestHandler::upgradeToWebSocket()
+{
+    if (version != Http1_1 || header(UpgradeHeader).toLower() != "websocket"
+        || !hasToken(header(ConnectionHeader), "upgrade")) {
+        sendError(HttpStatus::UpgradeRequired, QString::fromLatin1("Only websocket is served here."));
+        return false;
+    }
+    const QByteArray &key = header(QString::fromLatin1("Sec-WebSocket-Key")).trimmed();
+    if (QByteArray::fromBase64(key).size() != 16
+        || header(QString::fromLatin1("Sec-WebSocket-Version")).trimmed() != "13") {
+        sendError(HttpStatus::BadRequest, QString::fromLatin1("Bad websocket handshake."));
+        return false;
+    }
+    if (!acceptWebSocket()) {
+        return false;
+    }
+    bool compressed = false;
+    bool resetCompressor = false;
+#ifdef QTNG_HAVE_ZLIB
+    if (compression) {
+        compressed = parseDeflateExtension(header(QString::fromLatin1("Sec-WebSocket-Extensions")), false,
+                                           &resetCompressor);
+    }
+#endif
+    sendResponse(HttpStatus::SwitchProtocol);
+    sendHeader("Upgrade", "websocket");
+    sendHeader("Connection", "Upgrade");
+    sendHeader("Sec-WebSocket-Accept", makeAccept(key));
+    if (compressed) {
+        sendHeader("Sec-WebSocket-Extensions",
+                   resetCompressor ? "permessage-deflate; server_no_context_takeover" : "permessage-deflate");
+    }
+    if (!endHeader()) {
+        return false;
+    }
+    // the bytes after the request head are the first frames.
+    webSocket.reset(new WebSocket(request, body, false, compressed));
+    webSocket->d_ptr->resetCompressor = resetCompressor;
+    body.clear();
+    closeConnection = Yes;
+    return true;
+}
+
+QTNETWORKNG_NAMESPACE_END
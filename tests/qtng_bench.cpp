@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <algorithm>
+#include <QtCore/qcoreapplication.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qjsonarray.h>
+#include <QtCore/qjsondocument.h>
+#include <QtCore/qjsonobject.h>
+#include <QtCore/qfile.h>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+#if defined(__GLIBC__) && !defined(QTNG_BENCH_NO_MALLOC_COUNTER)
+// counts the calls of malloc() by interposing it, which the allocations of qt containers go through.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+static QBasicAtomicInteger<qint64> mallocCalls = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+extern "C" void *malloc(size_t size)
+{
+    mallocCalls.fetchAndAddRelaxed(1);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+    mallocCalls.fetchAndAddRelaxed(1);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *p, size_t size)
+{
+    mallocCalls.fetchAndAddRelaxed(1);
+    return __libc_realloc(p, size);
+}
+
+static qint64 allocationCount()
+{
+    return mallocCalls.loadAcquire();
+}
+#else
+static qint64 allocationCount()
+{
+    return -1;
+}
+#endif
+
+// usage: qtng_bench [--quick] [--output=result.json] [name...]
+// runs the benchmarks whose names contain any of the given names, or all of them. the result is written as json, so
+// it can be compared with the result of another version.
+
+namespace {
+
+struct BenchResult
+{
+    BenchResult()
+        : operations(0)
+        , bytes(0)
+        , seconds(0.0)
+        , allocations(-1)
+        , ok(true)
+    {
+    }
+    QString name;
+    qint64 operations;
+    qint64 bytes;
+    double seconds;
+    qint64 allocations;  // the calls of malloc(), -1 if they are not counted.
+    QList<double> latencies;  // in microseconds.
+    bool ok;
+};
+
+int scale = 10;  // --quick makes it 1.
+
+double percentile(QList<double> l, double p)
+{
+    if (l.isEmpty()) {
+        return 0.0;
+    }
+    std::sort(l.begin(), l.end());
+    const int i = qBound(0, static_cast<int>(p * l.size()), l.size() - 1);
+    return l.at(i);
+}
+
+QJsonObject toJson(const BenchResult &result)
+{
+    QJsonObject o;
+    o.insert(QLatin1String("name"), result.name);
+    o.insert(QLatin1String("ok"), result.ok);
+    o.insert(QLatin1String("operations"), static_cast<double>(result.operations));
+    o.insert(QLatin1String("seconds"), result.seconds);
+    if (result.seconds > 0) {
+        o.insert(QLatin1String("ops_per_second"), result.operations / result.seconds);
+        if (result.bytes > 0) {
+            o.insert(QLatin1String("bytes"), static_cast<double>(result.bytes));
+            o.insert(QLatin1String("mbytes_per_second"), result.bytes / result.seconds / 1024 / 1024);
+        }
+    }
+    if (result.allocations >= 0 && result.operations > 0) {
+        o.insert(QLatin1String("allocations_per_operation"), static_cast<double>(result.allocations) / result.operations);
+    }
+    if (!result.latencies.isEmpty()) {
+        o.insert(QLatin1String("latency_p50_us"), percentile(result.latencies, 0.5));
+        o.insert(QLatin1String("latency_p90_us"), percentile(result.latencies, 0.9));
+        o.insert(QLatin1String("latency_p99_us"), percentile(result.latencies, 0.99));
+    }
+    return o;
+}
+
+double elapsedSeconds(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() / 1e9;
+}
+
+BenchResult benchCoroutineSpawn()
+{
+    BenchResult result;
+    const int n = 10000 * scale;
+    QElapsedTimer timer;
+    timer.start();
+    CoroutineGroup operations;
+    for (int i = 0; i < n; ++i) {
+        operations.spawn([] { });
+    }
+    operations.joinall();
+    result.seconds = elapsedSeconds(timer);
+    result.operations = n;
+    return result;
+}
+
+BenchResult benchCoroutineSpawnDetached()
+{
+    BenchResult result;
+    const int n = 100000 * scale;
+    QElapsedTimer timer;
+    timer.start();
+    int done = 0;
+    Event finished;
+    for (int i = 0; i < n; ++i) {
+        Coroutine::spawnDetached([&done, &finished, n] {
+            if (++done == n) {
+                finished.set();
+            }
+        });
+    }
+    finished.wait();
+    result.seconds = elapsedSeconds(timer);
+    result.operations = n;
+    return result;
+}
+
+BenchResult benchCoroutineSwitch()
+{
+    BenchResult result;
+    const int n = 20000 * scale;
+    QElapsedTimer timer;
+    timer.start();
+    CoroutineGroup operations;
+    for (int i = 0; i < 2; ++i) {
+        operations.spawn([n] {
+            for (int j = 0; j < n / 2; ++j) {
+                Coroutine::msleep(0);
+            }
+        });
+    }
+    operations.joinall();
+    result.seconds = elapsedSeconds(timer);
+    result.operations = n;
+    return result;
+}
+
+// switches back and forth with the caller without the eventloop, so it measures the context switch itself.
+class PingPongCoroutine : public BaseCoroutine
+{
+public:
+    explicit PingPongCoroutine(BaseCoroutine *caller)
+        : BaseCoroutine(caller)
+        , caller(caller)
+        , stopping(false)
+    {
+    }
+    virtual void run() override
+    {
+        while (!stopping) {
+            caller->yield();
+        }
+    }
+    BaseCoroutine *caller;
+    bool stopping;
+};
+
+BenchResult benchContextSwitch()
+{
+    BenchResult result;
+    const int n = 200000 * scale;
+    PingPongCoroutine peer(BaseCoroutine::current());
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < n / 2; ++i) {
+        if (!peer.yield()) {
+            result.ok = false;
+            break;
+        }
+    }
+    result.seconds = elapsedSeconds(timer);
+    result.operations = n;
+    peer.stopping = true;
+    peer.yield();  // returns to the caller after the run() ends.
+    return result;
+}
+
+BenchResult benchLockPingPong()
+{
+    BenchResult result;
+    const int n = 20000 * scale;
+    QSharedPointer<Lock> lock(new Lock);
+    lock->acquire();
+    CoroutineGroup operations;
+    for (int i = 0; i < 2; ++i) {
+        operations.spawn([lock, n] {
+            for (int j = 0; j < n / 2; ++j) {
+                lock->acquire();
+                lock->release();
+            }
+        });
+    }
+    Coroutine::msleep(1);
+    QElapsedTimer timer;
+    timer.start();
+    lock->release();
+    operations.joinall();
+    result.seconds = elapsedSeconds(timer);
+    result.operations = n;
+    return result;
+}
+
+BenchResult benchQueuePingPong()
+{
+    BenchResult result;
+    const int n = 20000 * scale;
+    QSharedPointer<Queue<int>> ping(new Queue<int>(1));
+    QSharedPointer<Queue<int>> pong(new Queue<int>(1));
+    QElapsedTimer timer;
+    timer.start();
+    CoroutineGroup operations;
+    operations.spawn([ping, pong, n] {
+        for (int i = 0; i < n / 2; ++i) {
+            pong->put(ping->get());
+        }
+    });
+    for (int i = 0; i < n / 2; ++i) {
+        ping->put(i);
+        if (pong->get() != i) {
+            result.ok = false;
+            break;
+        }
+    }
+    operations.joinall();
+    result.seconds = elapsedSeconds(timer);
+    result.operations = n;
+    return result;
+}
+
+template<typename S>
+void receiveAll(QSharedPointer<S> request, qint64 total, qint64 *received)
+{
+    QByteArray buf(1024 * 64, Qt::Uninitialized);
+    while (*received < total) {
+        const qint32 bs = request->recv(buf.data(), buf.size());
+        if (bs <= 0) {
+            return;
+        }
+        *received += bs;
+    }
+}
+
+template<typename S>
+bool sendAll(S *client, qint64 total)
+{
+    const QByteArray block(1024 * 64, 'x');
+    for (qint64 sent = 0; sent < total; sent += block.size()) {
+        if (client->sendall(block) != block.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+BenchResult benchSocketLoopback()
+{
+    BenchResult result;
+    const qint64 total = 1024LL * 1024 * 32 * scale;
+    Socket server;
+    if (!server.bind(HostAddress::LocalHost, 0) || !server.listen(10)) {
+        result.ok = false;
+        return result;
+    }
+    const quint16 port = server.localPort();
+    QSharedPointer<qint64> received(new qint64(0));
+    QElapsedTimer timer;
+    timer.start();
+    CoroutineGroup operations;
+    operations.spawn([&server, total, received] {
+        QSharedPointer<Socket> request(server.accept());
+        if (!request.isNull()) {
+            receiveAll(request, total, received.data());
+        }
+    });
+    Socket client;
+    result.ok = client.connect(HostAddress::LocalHost, port) && sendAll(&client, total);
+    operations.joinall();
+    result.seconds = elapsedSeconds(timer);
+    result.ok = result.ok && *received == total;
+    result.bytes = *received;
+    result.operations = 1;
+    return result;
+}
+
+#ifndef QTNG_NO_CRYPTO
+BenchResult benchSslHandshake()
+{
+    BenchResult result;
+    const int n = 20 * scale;
+    const SslConfiguration &config = SslConfiguration::testPurpose(QString::fromLatin1("qtng_bench"),
+                                                                   QString::fromLatin1("CN"),
+                                                                   QString::fromLatin1("Example"));
+    SslSocket server(HostAddress::IPv4Protocol, config);
+    if (!server.bind(HostAddress::LocalHost, 0) || !server.listen(100)) {
+        result.ok = false;
+        return result;
+    }
+    const quint16 port = server.localPort();
+    CoroutineGroup operations;
+    operations.spawn([&server, n] {
+        for (int i = 0; i < n; ++i) {
+            QSharedPointer<SslSocket> request(server.accept());
+            if (request.isNull()) {
+                return;
+            }
+            request->sendall(QByteArray("x"));
+        }
+    });
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < n; ++i) {
+        QElapsedTimer latency;
+        latency.start();
+        SslSocket client;
+        if (!client.connect(HostAddress::LocalHost, port) || client.recv(1).size() != 1) {
+            result.ok = false;
+            break;
+        }
+        result.latencies.append(latency.nsecsElapsed() / 1e3);
+        ++result.operations;
+    }
+    result.seconds = elapsedSeconds(timer);
+    operations.killall();
+    return result;
+}
+
+BenchResult benchSslBulk()
+{
+    BenchResult result;
+    const qint64 total = 1024LL * 1024 * 8 * scale;
+    const SslConfiguration &config = SslConfiguration::testPurpose(QString::fromLatin1("qtng_bench"),
+                                                                   QString::fromLatin1("CN"),
+                                                                   QString::fromLatin1("Example"));
+    SslSocket server(HostAddress::IPv4Protocol, config);
+    if (!server.bind(HostAddress::LocalHost, 0) || !server.listen(10)) {
+        result.ok = false;
+        return result;
+    }
+    const quint16 port = server.localPort();
+    QSharedPointer<qint64> received(new qint64(0));
+    CoroutineGroup operations;
+    operations.spawn([&server, total, received] {
+        QSharedPointer<SslSocket> request(server.accept());
+        if (!request.isNull()) {
+            receiveAll(request, total, received.data());
+        }
+    });
+    SslSocket client;
+    if (!client.connect(HostAddress::LocalHost, port)) {
+        result.ok = false;
+        operations.killall();
+        return result;
+    }
+    // the handshake is not counted.
+    QElapsedTimer timer;
+    timer.start();
+    result.ok = sendAll(&client, total);
+    operations.joinall();
+    result.seconds = elapsedSeconds(timer);
+    result.ok = result.ok && *received == total;
+    result.bytes = *received;
+    result.operations = 1;
+    return result;
+}
+#endif
+
+class BenchRequestHandler : public BaseHttpRequestHandler
+{
+protected:
+    virtual void doGET() override
+    {
+        sendResponse(HttpStatus::OK);
+        sendHeader(QByteArray("Content-Type"), QByteArray("text/plain"));
+        sendHeader(QByteArray("Content-Length"), QByteArray("2"));
+        endHeader();
+        request->sendall(QByteArray("ok"));
+    }
+    virtual void logRequest(HttpStatus, int) override { }
+};
+
+BenchResult benchHttp()
+{
+    BenchResult result;
+    const int n = 1000 * scale;
+    const int concurrency = 16;
+    TcpServer<BenchRequestHandler> httpd(HostAddress::LocalHost, 0);
+    if (!httpd.start()) {
+        result.ok = false;
+        return result;
+    }
+    const QUrl url(QString::fromLatin1("http://127.0.0.1:%1/").arg(httpd.serverPort()));
+    HttpSession session;
+    QSharedPointer<int> next(new int(0));
+    QElapsedTimer timer;
+    timer.start();
+    // counts both of the client and the server, as they run in this thread.
+    const qint64 allocations = allocationCount();
+    CoroutineGroup operations;
+    for (int i = 0; i < concurrency; ++i) {
+        operations.spawn([&session, &result, url, next, n] {
+            while (*next < n) {
+                ++*next;
+                QElapsedTimer latency;
+                latency.start();
+                const HttpResponse &response = session.get(url);
+                if (!response.isOk() || response.body() != "ok") {
+                    result.ok = false;
+                    return;
+                }
+                result.latencies.append(latency.nsecsElapsed() / 1e3);
+                ++result.operations;
+            }
+        });
+    }
+    operations.joinall();
+    result.seconds = elapsedSeconds(timer);
+    if (allocations >= 0) {
+        result.allocations = allocationCount() - allocations;
+    }
+    httpd.stop();
+    return result;
+}
+
+BenchResult benchDataChannel()
+{
+    BenchResult result;
+    const int n = 20000 * scale;
+    const QByteArray packet(64, 'x');
+    Socket server;
+    if (!server.bind(HostAddress::LocalHost, 0) || !server.listen(10)) {
+        result.ok = false;
+        return result;
+    }
+    const quint16 port = server.localPort();
+    QSharedPointer<int> received(new int(0));
+    CoroutineGroup operations;
+    operations.spawn([&server, received, n] {
+        QSharedPointer<Socket> request(server.accept());
+        if (request.isNull()) {
+            return;
+        }
+        SocketChannel channel(request, NegativePole);
+        while (*received < n && !channel.recvPacket().isEmpty()) {
+            ++*received;
+        }
+    });
+    QSharedPointer<Socket> client(new Socket());
+    if (!client->connect(HostAddress::LocalHost, port)) {
+        result.ok = false;
+        operations.killall();
+        return result;
+    }
+    SocketChannel channel(client, PositivePole);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < n; ++i) {
+        if (!channel.sendPacketAsync(packet)) {
+            result.ok = false;
+            break;
+        }
+    }
+    operations.joinall();
+    result.seconds = elapsedSeconds(timer);
+    result.ok = result.ok && *received == n;
+    result.operations = *received;
+    result.bytes = static_cast<qint64>(*received) * packet.size();
+    return result;
+}
+
+BenchResult benchKcp()
+{
+    BenchResult result;
+    const qint64 total = 1024LL * 1024 * 2 * scale;
+    KcpSocket server;
+    if (!server.bind(HostAddress::LocalHost, 0) || !server.listen(10)) {
+        result.ok = false;
+        return result;
+    }
+    const quint16 port = server.localPort();
+    QSharedPointer<qint64> received(new qint64(0));
+    QElapsedTimer timer;
+    timer.start();
+    CoroutineGroup operations;
+    operations.spawn([&server, total, received] {
+        QSharedPointer<KcpSocket> request(server.accept());
+        if (!request.isNull()) {
+            receiveAll(request, total, received.data());
+        }
+    });
+    KcpSocket client;
+    result.ok = client.connect(HostAddress::LocalHost, port) && sendAll(&client, total);
+    try {
+        Timeout _(30.0f);
+        operations.joinall();
+    } catch (TimeoutException &) {
+        result.ok = false;
+        operations.killall();
+    }
+    result.seconds = elapsedSeconds(timer);
+    result.ok = result.ok && *received == total;
+    result.bytes = *received;
+    result.operations = 1;
+    return result;
+}
+
+BenchResult benchMsgPack()
+{
+    BenchResult result;
+    const int n = 10000 * scale;
+    QVariantMap message;
+    message.insert(QString::fromLatin1("id"), 12345);
+    message.insert(QString::fromLatin1("name"), QString::fromLatin1("qtnetworkng"));
+    message.insert(QString::fromLatin1("payload"), QByteArray(256, 'x'));
+    message.insert(QString::fromLatin1("tags"), QVariantList() << 1 << 2 << 3);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < n; ++i) {
+        QByteArray bs;
+        MsgPackStream os(&bs, QIODevice::WriteOnly);
+        os << QVariant(message);
+        MsgPackStream is(bs);
+        QVariant v;
+        is >> v;
+        if (os.status() != MsgPackStream::Ok || is.status() != MsgPackStream::Ok) {
+            result.ok = false;
+            break;
+        }
+        result.bytes += bs.size();
+        ++result.operations;
+    }
+    result.seconds = elapsedSeconds(timer);
+    return result;
+}
+
+struct Bench
+{
+    const char *name;
+    BenchResult (*func)();
+};
+
+const Bench benches[] = {
+    { "coroutine_spawn", benchCoroutineSpawn },
+    { "coroutine_spawn_detached", benchCoroutineSpawnDetached },
+    { "coroutine_switch", benchCoroutineSwitch },
+    { "context_switch", benchContextSwitch },
+    { "lock_pingpong", benchLockPingPong },
+    { "queue_pingpong", benchQueuePingPong },
+    { "socket_loopback", benchSocketLoopback },
+#ifndef QTNG_NO_CRYPTO
+    { "ssl_handshake", benchSslHandshake },
+    { "ssl_bulk", benchSslBulk },
+#endif
+    { "http_rps", benchHttp },
+    { "data_channel_packets", benchDataChannel },
+    { "kcp_throughput", benchKcp },
+    { "msgpack_roundtrip", benchMsgPack },
+};
+
+}  // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QString outputPath;
+    QStringList filters;
+    const QStringList &args = app.arguments().mid(1);
+    for (const QString &arg : args) {
+        if (arg == QLatin1String("--quick")) {
+            scale = 1;
+        } else if (arg.startsWith(QLatin1String("--output="))) {
+            outputPath = arg.mid(9);
+        } else {
+            filters.append(arg);
+        }
+    }
+
+    QJsonArray results;
+    bool allOk = true;
+    for (const Bench &bench : benches) {
+        const QString name = QString::fromLatin1(bench.name);
+        bool selected = filters.isEmpty();
+        for (const QString &filter : filters) {
+            selected = selected || name.contains(filter);
+        }
+        if (!selected) {
+            continue;
+        }
+        BenchResult result = bench.func();
+        result.name = name;
+        allOk = allOk && result.ok;
+        results.append(toJson(result));
+    }
+
+    QJsonObject report;
+    report.insert(QLatin1String("scale"), scale);
+    report.insert(QLatin1String("results"), results);
+    const QByteArray &json = QJsonDocument(report).toJson();
+    if (outputPath.isEmpty()) {
+        printf("%s", json.constData());
+    } else {
+        QFile f(outputPath);
+        if (!f.open(QIODevice::WriteOnly) || f.write(json) != json.size()) {
+            fprintf(stderr, "can not write to %s\n", qPrintable(outputPath));
+            return 2;
+        }
+    }
+    return allOk ? 0 : 1;
+}
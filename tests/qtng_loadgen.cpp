@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <QtCore/qcoreapplication.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qjsonarray.h>
+#include <QtCore/qjsondocument.h>
+#include <QtCore/qjsonobject.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qvector.h>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+// usage: qtng_loadgen --rate=1000 [--duration=10] [--threads=2] [--connections=64] [--reuse=keepalive|pipeline|close]
+//                     [--http=1.1|2] [--method=GET] [--body=data] [--timeout=10] [--max-in-flight=10000]
+//                     [--output=result.json] url
+// an open-loop load generator, like wrk2. every thread sends its share of the rate at constant intervals whether the
+// previous responses came or not, and the latency of a request counts from the time it should be sent, so a stalled
+// server can not hide its queueing by slowing the generator down (the coordinated omission). the service time counts
+// from the time it is actually sent. the requests over --max-in-flight of a thread are not sent, and reported as
+// missed, which means the rate is beyond the server or the generator.
+
+namespace {
+
+// a log-linear histogram like HdrHistogram, which records microseconds with 1.6% precision in fixed memory. values
+// below 128 are exact, and every power of two above is divided into 64 buckets.
+class LatencyHistogram
+{
+public:
+    enum { SubBuckets = 64, Exponents = 36 };
+    LatencyHistogram()
+        : counts(SubBuckets * (Exponents + 1), 0)
+        , total(0)
+        , sum(0)
+        , minimum(-1)
+        , maximum(0)
+    {
+    }
+public:
+    void record(qint64 usecs);
+    void add(const LatencyHistogram &other);
+    qint64 percentile(double p) const;
+    quint64 count() const { return total; }
+    qint64 min() const { return qMax<qint64>(minimum, 0); }
+    qint64 max() const { return maximum; }
+    double mean() const { return total ? static_cast<double>(sum) / total : 0.0; }
+    QJsonObject toJson() const;
+private:
+    static int indexOf(qint64 usecs);
+    static qint64 highestValueAt(int index);
+    QVector<quint64> counts;
+    quint64 total;
+    qint64 sum;
+    qint64 minimum;
+    qint64 maximum;
+};
+
+int LatencyHistogram::indexOf(qint64 usecs)
+{
+    if (usecs < SubBuckets * 2) {
+        return static_cast<int>(usecs);
+    }
+    int highestBit = 0;
+    for (quint64 v = static_cast<quint64>(usecs); v > 1; v >>= 1) {
+        ++highestBit;
+    }
+    const int exponent = highestBit - 6;
+    const int index = SubBuckets * (exponent + 1) + static_cast<int>((usecs >> exponent) - SubBuckets);
+    return qMin(index, SubBuckets * (Exponents + 1) - 1);
+}
+
+qint64 LatencyHistogram::highestValueAt(int index)
+{
+    if (index < SubBuckets * 2) {
+        return index;
+    }
+    const int exponent = index / SubBuckets - 1;
+    const qint64 sub = index % SubBuckets + SubBuckets;
+    return ((sub + 1) << exponent) - 1;
+}
+
+void LatencyHistogram::record(qint64 usecs)
+{
+    usecs = qMax<qint64>(usecs, 0);
+    ++counts[indexOf(usecs)];
+    ++total;
+    sum += usecs;
+    if (minimum < 0 || usecs < minimum) {
+        minimum = usecs;
+    }
+    maximum = qMax(maximum, usecs);
+}
+
+void LatencyHistogram::add(const LatencyHistogram &other)
+{
+    for (int i = 0; i < counts.size(); ++i) {
+        counts[i] += other.counts.at(i);
+    }
+    total += other.total;
+    sum += other.sum;
+    if (other.minimum >= 0 && (minimum < 0 || other.minimum < minimum)) {
+        minimum = other.minimum;
+    }
+    maximum = qMax(maximum, other.maximum);
+}
+
+qint64 LatencyHistogram::percentile(double p) const
+{
+    if (total == 0) {
+        return 0;
+    }
+    const quint64 rank = qMax<quint64>(1, static_cast<quint64>(p / 100.0 * total + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < counts.size(); ++i) {
+        seen += counts.at(i);
+        if (seen >= rank) {
+            return qMin(highestValueAt(i), maximum);
+        }
+    }
+    return maximum;
+}
+
+QJsonObject LatencyHistogram::toJson() const
+{
+    QJsonObject o;
+    o.insert(QLatin1String("count"), static_cast<double>(total));
+    o.insert(QLatin1String("min_us"), static_cast<double>(min()));
+    o.insert(QLatin1String("mean_us"), mean());
+    o.insert(QLatin1String("max_us"), static_cast<double>(max()));
+    const double percentiles[] = { 50.0, 75.0, 90.0, 99.0, 99.9, 99.99 };
+    const char * const names[] = { "p50_us", "p75_us", "p90_us", "p99_us", "p999_us", "p9999_us" };
+    for (int i = 0; i < 6; ++i) {
+        o.insert(QLatin1String(names[i]), static_cast<double>(percentile(percentiles[i])));
+    }
+    return o;
+}
+
+struct LoadOptions
+{
+    LoadOptions()
+        : rate(1000.0)
+        , duration(10.0)
+        , threads(2)
+        , connections(64)
+        , maxInFlight(10000)
+        , timeout(10.0f)
+        , version(HttpVersion::Http1_1)
+        , keepAlive(true)
+        , pipelining(false)
+        , method(QString::fromLatin1("GET"))
+    {
+    }
+    double rate;  // requests per second of all threads.
+    double duration;  // in seconds.
+    int threads;
+    int connections;  // of all threads.
+    int maxInFlight;  // of every thread.
+    float timeout;
+    HttpVersion version;
+    bool keepAlive;
+    bool pipelining;
+    QString method;
+    QByteArray body;
+    QString url;
+};
+
+struct LoadResult
+{
+    LoadResult()
+        : sent(0)
+        , completed(0)
+        , errors(0)
+        , non2xx(0)
+        , missed(0)
+        , bytes(0)
+        , createdConnections(0)
+        , reusedConnections(0)
+    {
+    }
+    void add(const LoadResult &other);
+    LatencyHistogram latency;  // from the intended time of sending.
+    LatencyHistogram serviceTime;  // from the actual time of sending.
+    quint64 sent;
+    quint64 completed;
+    quint64 errors;  // the network errors and timeouts.
+    quint64 non2xx;
+    quint64 missed;  // not sent because of maxInFlight.
+    qint64 bytes;  // of response bodies.
+    quint64 createdConnections;
+    quint64 reusedConnections;
+};
+
+void LoadResult::add(const LoadResult &other)
+{
+    latency.add(other.latency);
+    serviceTime.add(other.serviceTime);
+    sent += other.sent;
+    completed += other.completed;
+    errors += other.errors;
+    non2xx += other.non2xx;
+    missed += other.missed;
+    bytes += other.bytes;
+    createdConnections += other.createdConnections;
+    reusedConnections += other.reusedConnections;
+}
+
+// runs in a CoroutineThread, with a session of its own.
+void generateLoad(const LoadOptions &options, int threadIndex, LoadResult *result)
+{
+    HttpSession session;
+    session.setDefaultVersion(options.version);
+    session.setKeepAlive(options.keepAlive);
+    session.setPipelining(options.pipelining);
+    session.setDefaultTimeout(options.timeout);
+    session.setManagingCookies(false);
+    const int connections = qMax(1, options.connections / options.threads);
+    session.setMaxConnectionsPerServer(connections);
+
+    HttpRequest request(options.method, options.url);
+    request.setVersion(options.version);
+    const PreparedHttpRequest &prepared = session.prepare(request);
+    if (!prepared.isValid()) {
+        result->errors = 1;
+        return;
+    }
+    // the connections are made before the clock starts, so the handshakes do not count as latency.
+    session.preconnect(QUrl(options.url), connections);
+    Coroutine::msleep(200);
+
+    const double ratePerThread = options.rate / options.threads;
+    const qint64 interval = qMax<qint64>(1, static_cast<qint64>(1e9 / ratePerThread));
+    // the threads send in turn instead of at the same instants.
+    const qint64 offset = interval * threadIndex / options.threads;
+    const qint64 durationNsecs = static_cast<qint64>(options.duration * 1e9);
+    QSharedPointer<int> inFlight(new int(0));
+    QSharedPointer<Event> drained(new Event());
+    drained->set();
+    QElapsedTimer clock;
+    clock.start();
+    for (qint64 i = 0;; ++i) {
+        const qint64 intended = offset + i * interval;
+        if (intended >= durationNsecs) {
+            break;
+        }
+        const qint64 ahead = intended - clock.nsecsElapsed();
+        if (ahead >= 1000 * 1000) {
+            Coroutine::msleep(static_cast<quint32>(ahead / (1000 * 1000)));
+        }
+        // behind the schedule, or less than 1ms ahead, the request is sent at once.
+        if (*inFlight >= options.maxInFlight) {
+            ++result->missed;
+            continue;
+        }
+        ++*inFlight;
+        drained->clear();
+        ++result->sent;
+        Coroutine::spawnDetached([&session, &prepared, &options, &clock, result, inFlight, drained, intended] {
+            const qint64 sentAt = clock.nsecsElapsed();
+            HttpResponse response = session.send(prepared, QByteArray(), options.body);
+            const qint64 doneAt = clock.nsecsElapsed();
+            if (response.hasNetworkError()) {
+                ++result->errors;
+            } else {
+                ++result->completed;
+                if (response.statusCode() < 200 || response.statusCode() >= 300) {
+                    ++result->non2xx;
+                }
+                result->bytes += response.body().size();
+                result->latency.record((doneAt - intended) / 1000);
+                result->serviceTime.record((doneAt - sentAt) / 1000);
+            }
+            if (--*inFlight == 0) {
+                drained->set();
+            }
+        });
+    }
+    drained->wait();
+    const HttpConnectionPoolStats &stats = session.connectionPoolStats();
+    result->createdConnections = stats.createdConnections;
+    result->reusedConnections = stats.reusedConnections;
+}
+
+}  // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    LoadOptions options;
+    QString outputPath;
+    const QStringList &args = app.arguments().mid(1);
+    for (const QString &arg : args) {
+        if (arg.startsWith(QLatin1String("--rate="))) {
+            options.rate = arg.mid(7).toDouble();
+        } else if (arg.startsWith(QLatin1String("--duration="))) {
+            options.duration = arg.mid(11).toDouble();
+        } else if (arg.startsWith(QLatin1String("--threads="))) {
+            options.threads = qMax(1, arg.mid(10).toInt());
+        } else if (arg.startsWith(QLatin1String("--connections="))) {
+            options.connections = qMax(1, arg.mid(14).toInt());
+        } else if (arg.startsWith(QLatin1String("--max-in-flight="))) {
+            options.maxInFlight = qMax(1, arg.mid(16).toInt());
+        } else if (arg.startsWith(QLatin1String("--timeout="))) {
+            options.timeout = arg.mid(10).toFloat();
+        } else if (arg == QLatin1String("--reuse=keepalive")) {
+            options.keepAlive = true;
+            options.pipelining = false;
+        } else if (arg == QLatin1String("--reuse=pipeline")) {
+            options.keepAlive = true;
+            options.pipelining = true;
+        } else if (arg == QLatin1String("--reuse=close")) {
+            options.keepAlive = false;
+            options.pipelining = false;
+        } else if (arg == QLatin1String("--http=1.1")) {
+            options.version = HttpVersion::Http1_1;
+        } else if (arg == QLatin1String("--http=2")) {
+            options.version = HttpVersion::Http2_0;
+        } else if (arg.startsWith(QLatin1String("--method="))) {
+            options.method = arg.mid(9).toUpper();
+        } else if (arg.startsWith(QLatin1String("--body="))) {
+            options.body = arg.mid(7).toUtf8();
+        } else if (arg.startsWith(QLatin1String("--output="))) {
+            outputPath = arg.mid(9);
+        } else if (!arg.startsWith(QLatin1String("--")) && options.url.isEmpty()) {
+            options.url = arg;
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", qPrintable(arg));
+            return 2;
+        }
+    }
+    if (options.url.isEmpty() || options.rate <= 0 || options.duration <= 0) {
+        fprintf(stderr, "usage: qtng_loadgen --rate=1000 [--duration=10] [--threads=2] url\n");
+        return 2;
+    }
+
+    QVector<LoadResult> results(options.threads);
+    QList<QSharedPointer<CoroutineThread>> threads;
+    QList<QSharedPointer<ThreadEvent>> finished;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < options.threads; ++i) {
+        QSharedPointer<CoroutineThread> thread(new CoroutineThread());
+        QSharedPointer<ThreadEvent> done(new ThreadEvent());
+        LoadResult *result = &results[i];
+        thread->start();
+        thread->apply([&options, i, result, done] {
+            generateLoad(options, i, result);
+            done->set();
+        });
+        threads.append(thread);
+        finished.append(done);
+    }
+    for (int i = 0; i < options.threads; ++i) {
+        finished.at(i)->wait();
+        threads.at(i)->apply(std::function<void()>());
+        threads.at(i)->wait();
+    }
+    const double seconds = timer.nsecsElapsed() / 1e9;
+
+    LoadResult total;
+    for (const LoadResult &result : results) {
+        total.add(result);
+    }
+    QJsonObject report;
+    report.insert(QLatin1String("url"), options.url);
+    report.insert(QLatin1String("rate"), options.rate);
+    report.insert(QLatin1String("duration"), options.duration);
+    report.insert(QLatin1String("threads"), options.threads);
+    report.insert(QLatin1String("connections"), options.connections);
+    report.insert(QLatin1String("http"), options.version == HttpVersion::Http2_0 ? QLatin1String("2")
+                                                                                 : QLatin1String("1.1"));
+    report.insert(QLatin1String("reuse"), !options.keepAlive ? QLatin1String("close")
+                                          : options.pipelining ? QLatin1String("pipeline")
+                                                               : QLatin1String("keepalive"));
+    report.insert(QLatin1String("seconds"), seconds);
+    report.insert(QLatin1String("sent"), static_cast<double>(total.sent));
+    report.insert(QLatin1String("completed"), static_cast<double>(total.completed));
+    report.insert(QLatin1String("errors"), static_cast<double>(total.errors));
+    report.insert(QLatin1String("non_2xx"), static_cast<double>(total.non2xx));
+    report.insert(QLatin1String("missed"), static_cast<double>(total.missed));
+    report.insert(QLatin1String("bytes"), static_cast<double>(total.bytes));
+    report.insert(QLatin1String("completed_per_second"), total.completed / options.duration);
+    report.insert(QLatin1String("created_connections"), static_cast<double>(total.createdConnections));
+    report.insert(QLatin1String("reused_connections"), static_cast<double>(total.reusedConnections));
+    report.insert(QLatin1String("latency"), total.latency.toJson());
+    report.insert(QLatin1String("service_time"), total.serviceTime.toJson());
+    const QByteArray &json = QJsonDocument(report).toJson();
+    if (outputPath.isEmpty()) {
+        printf("%s", json.constData());
+    } else {
+        QFile f(outputPath);
+        if (!f.open(QIODevice::WriteOnly) || f.write(json) != json.size()) {
+            fprintf(stderr, "can not write to %s\n", qPrintable(outputPath));
+            return 2;
+        }
+    }
+    return total.errors == 0 && total.missed == 0 ? 0 : 1;
+}
@@ -0,0 +1,583 @@
+#include <stdio.h>
+#include <algorithm>
+#include <QtCore/qcoreapplication.h>
+#include <QtCore/qdir.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qjsonarray.h>
+#include <QtCore/qjsondocument.h>
+#include <QtCore/qjsonobject.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qprocess.h>
+#include <QtCore/qtemporarydir.h>
+#include "qtnetworkng.h"
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+using namespace qtng;
+
+// usage: qtng_scale [--connections=100000] [--active=100] [--rounds=100] [--backend=name|all] [--stack-trimming]
+//                   [--output=result.json] [server...]
+// opens many idle keep-alive connections to the servers from a client process, and reports what they cost in the
+// server process: the resident memory and the coroutines per connection, the accept rate, and the latency of a few
+// active connections among the idle ones. the servers are `http` (SimpleHttpServer), `socks5` (the connections are
+// relayed to an echo server of the client process) and `channel` (an echo server of SocketChannel). the backend `all`
+// runs this program again for every eventloop of the platform.
+//
+// the clients connect to 127.0.0.x of many x, so the ephemeral ports of one address are not used up. raise the hard
+// limit of open files and net.core.somaxconn before running it with a million connections.
+
+namespace {
+
+struct ScaleOptions
+{
+    ScaleOptions()
+        : connections(100000)
+        , active(100)
+        , rounds(100)
+        , stackTrimming(false)
+    {
+    }
+    int connections;
+    int active;  // the connections measuring latency after all are established.
+    int rounds;  // the round trips of every active connection.
+    bool stackTrimming;
+    QString backend;
+};
+
+ScaleOptions options;
+
+const int connectionsPerAddress = 20000;  // under the 28232 ephemeral ports of linux.
+const int connectingCoroutines = 256;
+
+double percentile(QList<double> l, double p)
+{
+    if (l.isEmpty()) {
+        return 0.0;
+    }
+    std::sort(l.begin(), l.end());
+    const int i = qBound(0, static_cast<int>(p * l.size()), l.size() - 1);
+    return l.at(i);
+}
+
+double elapsedSeconds(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() / 1e9;
+}
+
+qint64 residentBytes()
+{
+#ifdef Q_OS_LINUX
+    QFile f(QString::fromLatin1("/proc/self/statm"));
+    if (!f.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    const QList<QByteArray> &fields = f.readAll().split(' ');
+    if (fields.size() < 2) {
+        return -1;
+    }
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
+
+void raiseOpenFilesLimit()
+{
+#ifdef Q_OS_UNIX
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
+
+bool preferBackend(const QString &backend)
+{
+    if (backend.isEmpty() || backend == QLatin1String("qt")) {
+        return true;
+    } else if (backend == QLatin1String("epoll")) {
+        Coroutine::preferEpoll();
+    } else if (backend == QLatin1String("io_uring")) {
+        Coroutine::preferIoUring();
+    } else if (backend == QLatin1String("kqueue")) {
+        Coroutine::preferKqueue();
+    } else if (backend == QLatin1String("libev")) {
+        Coroutine::preferLibev();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+QStringList platformBackends()
+{
+    QStringList backends;
+#if defined(Q_OS_LINUX)
+    backends << QString::fromLatin1("epoll") << QString::fromLatin1("io_uring");
+#elif defined(Q_OS_MACOS) || defined(Q_OS_FREEBSD) || defined(Q_OS_OPENBSD) || defined(Q_OS_NETBSD)
+    backends << QString::fromLatin1("kqueue");
+#endif
+    backends << QString::fromLatin1("libev") << QString::fromLatin1("qt");
+    return backends;
+}
+
+// the i-th connection goes to 127.0.0.x, and its socks5 target is 127.0.1.x
+HostAddress loopbackAddress(int i, int subnet)
+{
+    const quint32 x = 1 + static_cast<quint32>(i / connectionsPerAddress) % 254;
+    return HostAddress((127u << 24) | (static_cast<quint32>(subnet) << 8) | x);
+}
+
+QByteArray readLine(Socket *socket, QByteArray *buf)
+{
+    while (true) {
+        const int i = buf->indexOf('\n');
+        if (i >= 0) {
+            const QByteArray line = buf->left(i);
+            buf->remove(0, i + 1);
+            return line;
+        }
+        const QByteArray &data = socket->recv(1024 * 4);
+        if (data.isEmpty()) {
+            return QByteArray();
+        }
+        buf->append(data);
+    }
+}
+
+class ChannelEchoRequestHandler : public BaseRequestHandler
+{
+protected:
+    virtual void handle() override
+    {
+        QSharedPointer<SocketChannel> channel(new SocketChannel(request, NegativePole));
+        while (true) {
+            const QByteArray &packet = channel->recvPacket();
+            if (packet.isEmpty() || !channel->sendPacket(packet)) {
+                return;
+            }
+        }
+    }
+};
+
+// the client side of one connection.
+struct ScaleConnection
+{
+    QSharedPointer<Socket> socket;
+    QSharedPointer<SocketChannel> channel;
+};
+
+bool httpRoundTrip(ScaleConnection *connection)
+{
+    static const QByteArray request("GET /ok.txt HTTP/1.1\r\nHost: qtng_scale\r\n\r\n");
+    if (connection->socket->sendall(request) != request.size()) {
+        return false;
+    }
+    QByteArray response;
+    int headerEnd = -1;
+    qint64 contentLength = -1;
+    while (true) {
+        if (headerEnd < 0) {
+            headerEnd = response.indexOf("\r\n\r\n");
+            if (headerEnd >= 0) {
+                const QByteArray &header = response.left(headerEnd).toLower();
+                const int i = header.indexOf("\r\ncontent-length:");
+                if (i < 0) {
+                    return false;
+                }
+                const int end = header.indexOf('\r', i + 2);
+                contentLength = header.mid(i + 17, end < 0 ? -1 : end - i - 17).trimmed().toLongLong();
+            }
+        }
+        if (headerEnd >= 0 && response.size() >= headerEnd + 4 + contentLength) {
+            return response.startsWith("HTTP/1.1 200");
+        }
+        const QByteArray &data = connection->socket->recv(1024 * 4);
+        if (data.isEmpty()) {
+            return false;
+        }
+        response.append(data);
+    }
+}
+
+bool echoRoundTrip(ScaleConnection *connection)
+{
+    static const QByteArray ping("ping");
+    if (!connection->channel.isNull()) {
+        return connection->channel->sendPacket(ping) && connection->channel->recvPacket() == ping;
+    }
+    return connection->socket->sendall(ping) == ping.size() && connection->socket->recvall(ping.size()) == ping;
+}
+
+bool socks5Connect(ScaleConnection *connection, const HostAddress &target, quint16 port)
+{
+    Socket *socket = connection->socket.data();
+    if (socket->sendall(QByteArray("\x05\x01\x00", 3)) != 3 || socket->recvall(2) != QByteArray("\x05\x00", 2)) {
+        return false;
+    }
+    QByteArray request("\x05\x01\x00\x01", 4);
+    const quint32 ip4 = target.toIPv4Address();
+    request.append(static_cast<char>(ip4 >> 24)).append(static_cast<char>(ip4 >> 16));
+    request.append(static_cast<char>(ip4 >> 8)).append(static_cast<char>(ip4));
+    request.append(static_cast<char>(port >> 8)).append(static_cast<char>(port));
+    if (socket->sendall(request) != request.size()) {
+        return false;
+    }
+    const QByteArray &reply = socket->recvall(5);
+    if (reply.size() != 5 || reply.at(0) != 0x05 || reply.at(1) != 0x00) {
+        return false;
+    }
+    // the bound address of proxy is skipped, its first byte is read already.
+    int rest;
+    switch (reply.at(3)) {
+    case 0x01:
+        rest = 4 - 1 + 2;
+        break;
+    case 0x04:
+        rest = 16 - 1 + 2;
+        break;
+    case 0x03:
+        rest = static_cast<quint8>(reply.at(4)) + 2;
+        break;
+    default:
+        return false;
+    }
+    return socket->recvall(rest).size() == rest;
+}
+
+// the client process, which opens the connections, tells the server process they are ready, and measures the latency
+// when it is told to go.
+int runClient(const QString &server, quint16 serverPort, quint16 controlPort)
+{
+    Socket control;
+    if (!control.connect(HostAddress::LocalHost, controlPort)) {
+        fprintf(stderr, "can not connect to the control port %d\n", controlPort);
+        return 2;
+    }
+    CoroutineGroup operations;
+    quint16 echoPort = 0;
+    QSharedPointer<Socket> echoServer;
+    if (server == QLatin1String("socks5")) {
+        echoServer.reset(Socket::createServer(HostAddress::Any, 0, 4096));
+        if (echoServer.isNull()) {
+            fprintf(stderr, "can not start the echo server.\n");
+            return 2;
+        }
+        echoPort = echoServer->localPort();
+        operations.spawn([echoServer, &operations] {
+            while (true) {
+                QSharedPointer<Socket> request(echoServer->accept());
+                if (request.isNull()) {
+                    return;
+                }
+                operations.spawn([request] {
+                    while (true) {
+                        const QByteArray &data = request->recv(1024 * 4);
+                        if (data.isEmpty() || request->sendall(data) != data.size()) {
+                            return;
+                        }
+                    }
+                });
+            }
+        });
+    }
+
+    QVector<ScaleConnection> connections(options.connections);
+    int next = 0;
+    int failed = 0;
+    QElapsedTimer timer;
+    timer.start();
+    CoroutineGroup connecting;
+    for (int c = 0; c < connectingCoroutines; ++c) {
+        connecting.spawn([&] {
+            while (next < connections.size()) {
+                const int i = next++;
+                ScaleConnection &connection = connections[i];
+                connection.socket.reset(new Socket());
+                bool ok = connection.socket->connect(loopbackAddress(i, 0), serverPort);
+                if (ok && server == QLatin1String("http")) {
+                    ok = httpRoundTrip(&connection);
+                } else if (ok && server == QLatin1String("socks5")) {
+                    ok = socks5Connect(&connection, loopbackAddress(i, 1), echoPort) && echoRoundTrip(&connection);
+                } else if (ok) {
+                    connection.channel.reset(new SocketChannel(connection.socket, PositivePole));
+                    ok = echoRoundTrip(&connection);
+                }
+                if (!ok) {
+                    ++failed;
+                    connection.channel.clear();
+                    connection.socket.clear();
+                }
+            }
+        });
+    }
+    connecting.joinall();
+    const double connectSeconds = elapsedSeconds(timer);
+
+    QByteArray buf;
+    if (control.sendall(QByteArray("ready\n")) != 6 || readLine(&control, &buf) != "go") {
+        return 2;
+    }
+
+    QList<double> latencies;
+    int failedRounds = 0;
+    const int active = qMin(options.active, options.connections);
+    CoroutineGroup measuring;
+    for (int a = 0; a < active; ++a) {
+        // spread over the addresses and the order of connecting.
+        const qint64 i = static_cast<qint64>(a) * connections.size() / active;
+        ScaleConnection *connection = &connections[static_cast<int>(i)];
+        if (connection->socket.isNull()) {
+            continue;
+        }
+        measuring.spawn([&, connection] {
+            for (int r = 0; r < options.rounds; ++r) {
+                QElapsedTimer latency;
+                latency.start();
+                const bool ok = server == QLatin1String("http") ? httpRoundTrip(connection) : echoRoundTrip(connection);
+                if (!ok) {
+                    ++failedRounds;
+                    return;
+                }
+                latencies.append(latency.nsecsElapsed() / 1e3);
+            }
+        });
+    }
+    measuring.joinall();
+
+    QJsonObject o;
+    o.insert(QLatin1String("failed_connections"), failed);
+    o.insert(QLatin1String("connect_seconds"), connectSeconds);
+    o.insert(QLatin1String("failed_rounds"), failedRounds);
+    o.insert(QLatin1String("latency_p50_us"), percentile(latencies, 0.5));
+    o.insert(QLatin1String("latency_p90_us"), percentile(latencies, 0.9));
+    o.insert(QLatin1String("latency_p99_us"), percentile(latencies, 0.99));
+    control.sendall(QJsonDocument(o).toJson(QJsonDocument::Compact) + "\n");
+    control.close();
+    if (!echoServer.isNull()) {
+        echoServer->close();
+    }
+    operations.killall();
+    return 0;
+}
+
+QSharedPointer<BaseStreamServer> createServer(const QString &server, const QTemporaryDir &dir)
+{
+    QSharedPointer<BaseStreamServer> s;
+    // listens on all addresses, so the clients can connect to 127.0.0.x of many x.
+    if (server == QLatin1String("http")) {
+        s.reset(new SimpleHttpServer(HostAddress::Any, 0));
+    } else if (server == QLatin1String("socks5")) {
+        s.reset(new TcpServer<Socks5RequestHandler>(HostAddress::Any, 0));
+    } else if (server == QLatin1String("channel")) {
+        s.reset(new TcpServer<ChannelEchoRequestHandler>(HostAddress::Any, 0));
+    } else {
+        return s;
+    }
+    s->setRequestQueueSize(4096);
+    s->setStackTrimming(options.stackTrimming);
+    s->setAccessLog(QSharedPointer<AccessLog>(new AccessLog(dir.filePath(QString::fromLatin1("access.log")))));
+    return s;
+}
+
+QJsonObject runServer(const QString &server, const QTemporaryDir &dir)
+{
+    QJsonObject o;
+    o.insert(QLatin1String("name"), server);
+    o.insert(QLatin1String("backend"), options.backend.isEmpty() ? QString::fromLatin1("default") : options.backend);
+    o.insert(QLatin1String("connections"), options.connections);
+    o.insert(QLatin1String("ok"), false);
+
+    QSharedPointer<BaseStreamServer> s = createServer(server, dir);
+    QSharedPointer<Socket> control(Socket::createServer(HostAddress::LocalHost, 0, 1));
+    if (s.isNull() || !s->start() || control.isNull()) {
+        return o;
+    }
+    const qint64 rssBefore = residentBytes();
+    const int coroutinesBefore = eventLoopMetrics().coroutines;
+
+    QStringList args;
+    args << QString::fromLatin1("--client=%1").arg(server);
+    args << QString::fromLatin1("--server-port=%1").arg(s->serverPort());
+    args << QString::fromLatin1("--control-port=%1").arg(control->localPort());
+    args << QString::fromLatin1("--connections=%1").arg(options.connections);
+    args << QString::fromLatin1("--active=%1").arg(options.active);
+    args << QString::fromLatin1("--rounds=%1").arg(options.rounds);
+    // detached, so the client needs no qt eventloop here whatever the backend is.
+    if (!QProcess::startDetached(QCoreApplication::applicationFilePath(), args)) {
+        s->stop();
+        return o;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QSharedPointer<Socket> peer;
+    QByteArray buf;
+    QByteArray ready;
+    try {
+        Timeout _(60.0f + options.connections / 1000.0f);
+        peer.reset(control->accept());
+        if (!peer.isNull()) {
+            ready = readLine(peer.data(), &buf);
+        }
+    } catch (TimeoutException &) {
+        ready.clear();
+    }
+    const double acceptSeconds = elapsedSeconds(timer);
+    if (ready != "ready") {
+        s->stop();
+        return o;
+    }
+
+    const StreamServerCounters &counters = s->counters();
+    const qint64 rssAfter = residentBytes();
+    const int coroutines = eventLoopMetrics().coroutines - coroutinesBefore;
+    o.insert(QLatin1String("accepted_connections"), static_cast<double>(counters.acceptedConnections));
+    o.insert(QLatin1String("active_connections"), static_cast<double>(counters.activeConnections));
+    o.insert(QLatin1String("accept_seconds"), acceptSeconds);
+    if (acceptSeconds > 0) {
+        o.insert(QLatin1String("accepts_per_second"), counters.acceptedConnections / acceptSeconds);
+    }
+    o.insert(QLatin1String("coroutines"), coroutines);
+    o.insert(QLatin1String("stack_size"), static_cast<double>(s->stackSize()));
+    o.insert(QLatin1String("stack_trimming"), options.stackTrimming);
+    if (rssBefore >= 0 && rssAfter >= 0) {
+        o.insert(QLatin1String("rss_bytes"), static_cast<double>(rssAfter));
+        if (counters.activeConnections > 0) {
+            o.insert(QLatin1String("rss_bytes_per_connection"),
+                     static_cast<double>(rssAfter - rssBefore) / counters.activeConnections);
+        }
+    }
+
+    QJsonObject client;
+    if (peer->sendall(QByteArray("go\n")) == 3) {
+        client = QJsonDocument::fromJson(readLine(peer.data(), &buf)).object();
+    }
+    for (QJsonObject::const_iterator itor = client.constBegin(); itor != client.constEnd(); ++itor) {
+        o.insert(itor.key(), itor.value());
+    }
+    o.insert(QLatin1String("ok"), !client.isEmpty() && client.value(QLatin1String("failed_connections")).toInt() == 0
+                     && client.value(QLatin1String("failed_rounds")).toInt() == 0);
+    peer->close();
+    s->stop();
+    return o;
+}
+
+// runs this program for every backend, as the eventloop of a thread is chosen once.
+int runAllBackends(const QStringList &servers, QJsonArray *results)
+{
+    bool allOk = true;
+    for (const QString &backend : platformBackends()) {
+        QStringList args;
+        args << QString::fromLatin1("--backend=%1").arg(backend);
+        args << QString::fromLatin1("--connections=%1").arg(options.connections);
+        args << QString::fromLatin1("--active=%1").arg(options.active);
+        args << QString::fromLatin1("--rounds=%1").arg(options.rounds);
+        if (options.stackTrimming) {
+            args << QString::fromLatin1("--stack-trimming");
+        }
+        args << servers;
+        QProcess process;
+        process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        process.start(QCoreApplication::applicationFilePath(), args);
+        if (!process.waitForFinished(-1)) {
+            allOk = false;
+            continue;
+        }
+        allOk = allOk && process.exitCode() == 0;
+        const QJsonObject &report = QJsonDocument::fromJson(process.readAllStandardOutput()).object();
+        const QJsonArray &backendResults = report.value(QLatin1String("results")).toArray();
+        for (const QJsonValue &result : backendResults) {
+            results->append(result);
+        }
+    }
+    return allOk ? 0 : 1;
+}
+
+}  // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QString outputPath;
+    QString clientOf;
+    quint16 serverPort = 0;
+    quint16 controlPort = 0;
+    QStringList servers;
+    const QStringList &args = app.arguments().mid(1);
+    for (const QString &arg : args) {
+        if (arg.startsWith(QLatin1String("--connections="))) {
+            options.connections = qMax(1, arg.mid(14).toInt());
+        } else if (arg.startsWith(QLatin1String("--active="))) {
+            options.active = qMax(0, arg.mid(9).toInt());
+        } else if (arg.startsWith(QLatin1String("--rounds="))) {
+            options.rounds = qMax(0, arg.mid(9).toInt());
+        } else if (arg.startsWith(QLatin1String("--backend="))) {
+            options.backend = arg.mid(10);
+        } else if (arg == QLatin1String("--stack-trimming")) {
+            options.stackTrimming = true;
+        } else if (arg.startsWith(QLatin1String("--output="))) {
+            outputPath = arg.mid(9);
+        } else if (arg.startsWith(QLatin1String("--client="))) {
+            clientOf = arg.mid(9);
+        } else if (arg.startsWith(QLatin1String("--server-port="))) {
+            serverPort = static_cast<quint16>(arg.mid(14).toUInt());
+        } else if (arg.startsWith(QLatin1String("--control-port="))) {
+            controlPort = static_cast<quint16>(arg.mid(15).toUInt());
+        } else {
+            servers.append(arg);
+        }
+    }
+    raiseOpenFilesLimit();
+    if (!clientOf.isEmpty()) {
+        return runClient(clientOf, serverPort, controlPort);
+    }
+    if (servers.isEmpty()) {
+        servers << QString::fromLatin1("http") << QString::fromLatin1("socks5") << QString::fromLatin1("channel");
+    }
+
+    QJsonArray results;
+    int exitCode;
+    if (options.backend == QLatin1String("all")) {
+        exitCode = runAllBackends(servers, &results);
+    } else {
+        if (!preferBackend(options.backend)) {
+            fprintf(stderr, "unknown backend: %s\n", qPrintable(options.backend));
+            return 2;
+        }
+        QTemporaryDir dir;
+        QFile okFile(dir.filePath(QString::fromLatin1("ok.txt")));
+        if (!dir.isValid() || !okFile.open(QIODevice::WriteOnly) || okFile.write("ok") != 2) {
+            fprintf(stderr, "can not create the files served.\n");
+            return 2;
+        }
+        okFile.close();
+        // SimpleHttpServer serves current directory.
+        QDir::setCurrent(dir.path());
+        bool allOk = true;
+        for (const QString &server : servers) {
+            const QJsonObject &result = runServer(server, dir);
+            allOk = allOk && result.value(QLatin1String("ok")).toBool();
+            results.append(result);
+        }
+        exitCode = allOk ? 0 : 1;
+    }
+
+    QJsonObject report;
+    report.insert(QLatin1String("connections"), options.connections);
+    report.insert(QLatin1String("results"), results);
+    const QByteArray &json = QJsonDocument(report).toJson();
+    if (outputPath.isEmpty()) {
+        printf("%s", json.constData());
+    } else {
+        QFile f(outputPath);
+        if (!f.open(QIODevice::WriteOnly) || f.write(json) != json.size()) {
+            fprintf(stderr, "can not write to %s\n", qPrintable(outputPath));
+            return 2;
+        }
+    }
+    return exitCode;
+}
@@ -0,0 +1,212 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+#include "../include/compression.h"
+
+using namespace qtng;
+
+// text with some random bytes, so the compressed streams have several blocks.
+static QByteArray makeInput(int size)
+{
+    QByteArray data;
+    data.reserve(size + 128);
+    for (int i = 0; data.size() < size; ++i) {
+        data.append("line " + QByteArray::number(i % 1000) + " of the input, ");
+        if (i % 7 == 0) {
+            data.append(randomBytes(i % 50));
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+// reads until the end in pieces of chunkSize, returns false if any read() fails.
+static bool readAll(QSharedPointer<FileLike> f, int chunkSize, QByteArray *data)
+{
+    QByteArray buf(chunkSize, Qt::Uninitialized);
+    while (true) {
+        qint32 readBytes = f->read(buf.data(), buf.size());
+        if (readBytes < 0) {
+            return false;
+        } else if (readBytes == 0) {
+            return true;
+        }
+        data->append(buf.constData(), readBytes);
+    }
+}
+
+// writes in pieces of chunkSize and ends the stream by write(data, 0), returns false if any write() fails.
+static bool writeAll(QSharedPointer<FileLike> f, const QByteArray &data, int chunkSize)
+{
+    for (int i = 0; i < data.size(); i += chunkSize) {
+        const qint32 size = qMin(chunkSize, data.size() - i);
+        if (f->write(data.constData() + i, size) != size) {
+            return false;
+        }
+    }
+    return f->write(data.constData(), 0) == 0;
+}
+
+class TestCompression : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testSupported();
+    void testReadRoundTrip_data();
+    void testReadRoundTrip();
+    void testWriteRoundTrip_data();
+    void testWriteRoundTrip();
+    void testZstdPackets();
+};
+
+void TestCompression::testSupported()
+{
+#ifdef QTNG_HAVE_ZSTD
+    QVERIFY(qIsContentCodingSupported("zstd"));
+    QVERIFY(qAcceptEncoding().contains("zstd"));
+#else
+    QVERIFY(!qIsContentCodingSupported("zstd"));
+    QVERIFY(qContentEncoder("zstd", FileLike::bytes(QByteArray("data"))).isNull());
+#endif
+#ifdef QTNG_HAVE_BROTLI
+    QVERIFY(qIsContentCodingSupported("br"));
+    QVERIFY(qAcceptEncoding().contains("br"));
+#else
+    QVERIFY(!qIsContentCodingSupported("br"));
+    QVERIFY(qContentEncoder("br", FileLike::bytes(QByteArray("data"))).isNull());
+#endif
+}
+
+// returns false if no codec is built in.
+static bool addCodingRows()
+{
+    QTest::addColumn<QByteArray>("coding");
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("level");
+    QTest::addColumn<int>("chunkSize");
+    QList<QByteArray> codings;
+#ifdef QTNG_HAVE_ZSTD
+    codings.append("zstd");
+#endif
+#ifdef QTNG_HAVE_BROTLI
+    codings.append("br");
+#endif
+    for (const QByteArray &coding : codings) {
+        QTest::newRow((coding + " empty").constData()) << coding << 0 << -1 << 1024;
+        QTest::newRow((coding + " one byte").constData()) << coding << 1 << -1 << 1024;
+        QTest::newRow((coding + " small pieces").constData()) << coding << 1024 * 100 << -1 << 7;
+        QTest::newRow((coding + " large pieces").constData()) << coding << 1024 * 1024 * 3 + 1 << -1 << 1024 * 64;
+        QTest::newRow((coding + " fastest").constData()) << coding << 1024 * 300 << (coding == "br" ? 0 : 1) << 1000;
+        QTest::newRow((coding + " best").constData()) << coding << 1024 * 100 << (coding == "br" ? 11 : 19) << 1000;
+    }
+    return !codings.isEmpty();
+}
+
+void TestCompression::testReadRoundTrip_data()
+{
+    if (!addCodingRows()) {
+        QSKIP("neither QTNG_USE_ZSTD nor QTNG_USE_BROTLI is set.");
+    }
+}
+
+// the encoder reads the input, and the decoder reads the encoder.
+void TestCompression::testReadRoundTrip()
+{
+    QFETCH(QByteArray, coding);
+    QFETCH(int, size);
+    QFETCH(int, level);
+    QFETCH(int, chunkSize);
+    const QByteArray &data = makeInput(size);
+
+    QSharedPointer<FileLike> encoder = qContentEncoder(coding, FileLike::bytes(data), level);
+    QVERIFY(!encoder.isNull());
+    QByteArray compressed;
+    QVERIFY(readAll(encoder, chunkSize, &compressed));
+    QVERIFY(!compressed.isEmpty());
+    if (size > 1024) {
+        QVERIFY(compressed.size() < size / 2);
+    }
+
+    QByteArray decompressed;
+    QVERIFY(readAll(qContentDecoder(coding, FileLike::bytes(compressed)), chunkSize, &decompressed));
+    QCOMPARE(decompressed.size(), data.size());
+    QVERIFY(decompressed == data);
+
+    // a cut stream is an error, not a shorter result.
+    decompressed.clear();
+    QSharedPointer<FileLike> cut = FileLike::bytes(compressed.left(compressed.size() - 1));
+    QVERIFY(!readAll(qContentDecoder(coding, cut), chunkSize, &decompressed));
+}
+
+void TestCompression::testWriteRoundTrip_data()
+{
+    if (!addCodingRows()) {
+        QSKIP("neither QTNG_USE_ZSTD nor QTNG_USE_BROTLI is set.");
+    }
+}
+
+// the encoder and the decoder write to their backends, and write(data, 0) checks the end of stream.
+void TestCompression::testWriteRoundTrip()
+{
+    QFETCH(QByteArray, coding);
+    QFETCH(int, size);
+    QFETCH(int, level);
+    QFETCH(int, chunkSize);
+    const QByteArray &data = makeInput(size);
+
+    QByteArray compressed;
+    QSharedPointer<FileLike> encoder = qContentEncoder(coding, FileLike::bytes(&compressed), level);
+    QVERIFY(!encoder.isNull());
+    QVERIFY(writeAll(encoder, data, chunkSize));
+    QVERIFY(!compressed.isEmpty());
+    // the stream is ended.
+    QCOMPARE(encoder->write(data.constData(), 0), 0);
+    QCOMPARE(encoder->write("more", 4), -1);
+
+    QByteArray decompressed;
+    QVERIFY(writeAll(qContentDecoder(coding, FileLike::bytes(&decompressed)), compressed, chunkSize));
+    QCOMPARE(decompressed.size(), data.size());
+    QVERIFY(decompressed == data);
+
+    decompressed.clear();
+    QVERIFY(!writeAll(qContentDecoder(coding, FileLike::bytes(&decompressed)), compressed.left(compressed.size() - 1),
+                      chunkSize));
+}
+
+// the packets share the window, so a repeated packet is smaller, and every one is decompressed at once.
+void TestCompression::testZstdPackets()
+{
+#ifdef QTNG_HAVE_ZSTD
+    ZstdPacketCompressor compressor;
+    ZstdPacketDecompressor decompressor;
+    QList<QByteArray> packets;
+    packets << makeInput(1000) << QByteArray() << makeInput(1) << makeInput(1024 * 200);
+    packets << packets.at(0);
+    QList<QByteArray> compressed;
+    for (const QByteArray &packet : packets) {
+        QByteArray t;
+        QVERIFY(compressor.compress(packet, &t));
+        compressed.append(t);
+    }
+    QVERIFY(compressed.last().size() < compressed.first().size() / 4);
+    for (int i = 0; i < packets.size(); ++i) {
+        QByteArray packet;
+        QVERIFY(decompressor.decompress(compressed.at(i), &packet, 1024 * 256));
+        QVERIFY(packet == packets.at(i));
+    }
+
+    // a packet larger than maxSize breaks the decompressor.
+    ZstdPacketDecompressor small;
+    QByteArray packet;
+    for (int i = 0; i < 3; ++i) {
+        QVERIFY(small.decompress(compressed.at(i), &packet, 1024 * 100));
+    }
+    QVERIFY(!small.decompress(compressed.at(3), &packet, 1024 * 100));
+    QVERIFY(!small.decompress(compressed.at(4), &packet, 1024 * 256));
+#else
+    QSKIP("QTNG_USE_ZSTD is not set.");
+#endif
+}
+
+QTEST_MAIN(TestCompression)
+
+#include "test_compression.moc"
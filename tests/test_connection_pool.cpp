@@ -0,0 +1,160 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+// a keep-alive http server on the loopback, which answers every GET by the number of its connection after `delay`
+// msecs. it closes the connection after the first response if `closing` is set.
+class PoolServer
+{
+public:
+    PoolServer()
+        : connections(0)
+        , active(0)
+        , maxActive(0)
+        , delay(0)
+        , closing(false)
+    {
+    }
+    bool start()
+    {
+        if (!server.bind(HostAddress::LocalHost, 0) || !server.listen(50)) {
+            return false;
+        }
+        operations.spawn([this] { serve(); });
+        return true;
+    }
+    QUrl url() const { return QUrl(QString::fromLatin1("http://127.0.0.1:%1/").arg(server.localPort())); }
+private:
+    void serve()
+    {
+        while (true) {
+            QSharedPointer<Socket> request(server.accept());
+            if (request.isNull()) {
+                return;
+            }
+            const int id = ++connections;
+            operations.spawn([this, request, id] { handle(request, id); });
+        }
+    }
+    void handle(QSharedPointer<Socket> request, int id)
+    {
+        QByteArray buf;
+        while (true) {
+            int headEnd;
+            while ((headEnd = buf.indexOf("\r\n\r\n")) < 0) {
+                const QByteArray &data = request->recv(1024 * 4);
+                if (data.isEmpty()) {
+                    return;
+                }
+                buf.append(data);
+            }
+            buf.remove(0, headEnd + 4);
+            maxActive = qMax(maxActive, ++active);
+            if (delay > 0) {
+                Coroutine::msleep(delay);
+            }
+            --active;
+            const QByteArray &body = QByteArray::number(id);
+            const QByteArray &response = "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nContent-Length: "
+                    + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+            if (request->sendall(response) != response.size()) {
+                return;
+            }
+            if (closing) {
+                request->close();
+                return;
+            }
+        }
+    }
+public:
+    int connections;
+    int active;
+    int maxActive;
+    quint32 delay;
+    bool closing;
+private:
+    Socket server;
+    CoroutineGroup operations;  // destroyed first, so the coroutines never see the deleted members.
+};
+
+class TestConnectionPool : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testKeepAliveReused();
+    void testPeerClosedDiscarded();
+    void testMaxConnectionsPerServer();
+};
+
+// the sequential requests go through the same connection.
+void TestConnectionPool::testKeepAliveReused()
+{
+    PoolServer server;
+    QVERIFY(server.start());
+    HttpSession session;
+    for (int i = 0; i < 3; ++i) {
+        HttpResponse response = session.get(server.url());
+        QVERIFY(response.isOk());
+        QCOMPARE(response.body(), QByteArray("1"));
+    }
+    QCOMPARE(server.connections, 1);
+    const HttpConnectionPoolStats &stats = session.connectionPoolStats();
+    QCOMPARE(stats.createdConnections, quint64(1));
+    QCOMPARE(stats.reusedConnections, quint64(2));
+    QCOMPARE(stats.idleConnections, 1);
+}
+
+// the idle connection closed by server is found by probing before it is taken, so the request goes to a new one
+// instead of failing.
+void TestConnectionPool::testPeerClosedDiscarded()
+{
+    PoolServer server;
+    server.closing = true;
+    QVERIFY(server.start());
+    HttpSession session;
+    HttpResponse response = session.get(server.url());
+    QVERIFY(response.isOk());
+    QCOMPARE(response.body(), QByteArray("1"));
+    QCOMPARE(session.connectionPoolStats().idleConnections, 1);
+
+    Coroutine::msleep(100);  // the FIN arrives.
+    response = session.get(server.url());
+    QVERIFY(response.isOk());
+    QCOMPARE(response.body(), QByteArray("2"));
+    QCOMPARE(server.connections, 2);
+    const HttpConnectionPoolStats &stats = session.connectionPoolStats();
+    QCOMPARE(stats.createdConnections, quint64(2));
+    QCOMPARE(stats.reusedConnections, quint64(0));
+    QCOMPARE(stats.droppedConnections, quint64(1));
+}
+
+// the concurrent requests wait for the connections in use, and reuse them.
+void TestConnectionPool::testMaxConnectionsPerServer()
+{
+    PoolServer server;
+    server.delay = 100;
+    QVERIFY(server.start());
+    HttpSession session;
+    session.setMaxConnectionsPerServer(2);
+    QCOMPARE(session.maxConnectionsPerServer(), 2);
+    QSharedPointer<int> succeeded(new int(0));
+    CoroutineGroup operations;
+    for (int i = 0; i < 6; ++i) {
+        operations.spawn([&session, &server, succeeded] {
+            HttpResponse response = session.get(server.url());
+            if (response.isOk()) {
+                ++*succeeded;
+            }
+        });
+    }
+    operations.joinall();
+    QCOMPARE(*succeeded, 6);
+    QCOMPARE(server.maxActive, 2);
+    QVERIFY(server.connections <= 2);
+    QVERIFY(session.connectionPoolStats().idleConnections <= 2);
+}
+
+QTEST_MAIN(TestConnectionPool)
+
+#include "test_connection_pool.moc"
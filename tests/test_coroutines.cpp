@@ -13,6 +13,26 @@ private slots:
     void testJoinall();
     void testMap();
     void testeach();
+    void testStackReuse();
+    void testStackHighWaterMark();
+    void testStackTrimming();
+    void testSpawnStackSize();
+    void testHugePageStacks();
+    void testTimeoutRestart();
+    void testNestedTimeout();
+    void testLockHandOff();
+    void benchmarkLockPingPong();
+    void testRWLock();
+    void testThreadRWLock();
+    void benchmarkRWLockReadHeavy();
+    void testRingQueue();
+    void testSpawnAnywhere();
+    void testEventLoopMetrics();
+    void testCoroutineAccounting();
+    void testTracing();
+    void testTask();
+    void testCoroutineLocal();
+    void testJoiners();
 };
 
 
@@ -100,6 +120,515 @@ void TestCoroutines::testeach()
 }
 
 
+// every coroutine is deleted before the next one is spawned, so the pool gives back the same stack, and the local
+// variable of the same frame is at the same address.
+void TestCoroutines::testStackReuse()
+{
+    int counter = 0;
+    QSet<quintptr> addresses;
+    for (int i = 0; i < 1000; ++i) {
+        QSharedPointer<Coroutine> c(Coroutine::spawn([&counter, &addresses] {
+            char buf[1024 * 16];
+            memset(buf, 0, sizeof(buf));
+            counter += buf[0] + 1;
+            addresses.insert(reinterpret_cast<quintptr>(buf));
+        }));
+        c->join();
+    }
+    QCOMPARE(counter, 1000);
+#ifdef Q_OS_UNIX
+    QCOMPARE(addresses.size(), 1);
+#else
+    QVERIFY(!addresses.isEmpty());
+#endif
+}
+
+
+void TestCoroutines::testStackHighWaterMark()
+{
+    BaseCoroutine::setStackGuardEnabled(true);
+    QSharedPointer<Coroutine> c(Coroutine::spawn([] {
+        volatile char buf[1024 * 64];
+        for (size_t i = 0; i < sizeof(buf); i += 512) {
+            buf[i] = 1;
+        }
+    }));
+    c->join();
+    BaseCoroutine::setStackGuardEnabled(false);
+#ifdef Q_OS_UNIX
+    QVERIFY(c->stackHighWaterMark() >= 1024 * 64);
+    QVERIFY(c->stackHighWaterMark() <= DEFAULT_COROUTINE_STACK_SIZE);
+#endif
+}
+
+
+static void touchStack()
+{
+    volatile char buf[1024 * 64];
+    for (size_t i = 0; i < sizeof(buf); i += 512) {
+        buf[i] = 1;
+    }
+}
+
+
+void TestCoroutines::testStackTrimming()
+{
+    QSharedPointer<Event> touched(new Event());
+    QSharedPointer<Event> checked(new Event());
+    int value = 0;
+    QSharedPointer<Coroutine> c(Coroutine::spawn([touched, checked, &value] {
+        volatile int live = 42;
+        touchStack();
+        touched->set();
+        checked->tryWait();
+        value = live;
+    }));
+    c->setStackTrimmingEnabled(true);
+    QVERIFY(c->isStackTrimmingEnabled());
+    QVERIFY(touched->tryWait());
+#ifdef Q_OS_LINUX
+    QVERIFY(c->stackHighWaterMark() < 1024 * 64);
+#endif
+    checked->set();
+    c->join();
+    QCOMPARE(value, 42);
+}
+
+
+void TestCoroutines::testSpawnStackSize()
+{
+    CoroutineGroup operations;
+    bool done = false;
+    QSharedPointer<Coroutine> c = operations.spawn([&done] { done = true; }, 1024 * 32);
+    QCOMPARE(c->stackSize(), static_cast<size_t>(1024 * 32));
+    operations.joinall();
+    QVERIFY(done);
+    QSharedPointer<Coroutine> d(Coroutine::spawn([] {}));
+    QCOMPARE(d->stackSize(), static_cast<size_t>(DEFAULT_COROUTINE_STACK_SIZE));
+    d->join();
+}
+
+
+void TestCoroutines::testHugePageStacks()
+{
+    BaseCoroutine::setHugePageStacksEnabled(true);
+    QList<QSharedPointer<Coroutine>> coroutines;
+    int counter = 0;
+    for (int i = 0; i < 20; ++i) {
+        coroutines.append(QSharedPointer<Coroutine>(Coroutine::spawn([&counter] {
+            volatile char buf[1024 * 16];
+            buf[0] = 1;
+            Coroutine::msleep(10);
+            counter += buf[0];
+        })));
+    }
+    BaseCoroutine::setHugePageStacksEnabled(false);
+    for (QSharedPointer<Coroutine> c : coroutines) {
+        c->join();
+    }
+    QCOMPARE(counter, 20);
+}
+
+
+void TestCoroutines::testTimeoutRestart()
+{
+    bool timedout = false;
+    QElapsedTimer timer;
+    timer.start();
+    try {
+        Timeout out(0.05f);
+        for (int i = 0; i < 4; ++i) {
+            Coroutine::sleep(0.03f);
+            out.restart();
+        }
+        Coroutine::sleep(1.0f);
+    } catch (TimeoutException &) {
+        timedout = true;
+    }
+    QVERIFY(timedout);
+    QVERIFY(timer.elapsed() >= 150);
+    QVERIFY(timer.elapsed() < 1000);
+}
+
+
+void TestCoroutines::testNestedTimeout()
+{
+    QCOMPARE(Timeout::currentDeadline(), -1ll);
+    bool timedout = false;
+    QElapsedTimer timer;
+    timer.start();
+    try {
+        Timeout outer(0.05f);
+        const qint64 deadline = Timeout::currentDeadline();
+        QVERIFY(deadline > 0);
+        {
+            // the inner deadline is later, so the outer one holds.
+            Timeout inner(10.0f);
+            QCOMPARE(Timeout::currentDeadline(), deadline);
+            QVERIFY(Timeout::remaining() <= 0.05f);
+        }
+        {
+            Timeout inner(0.01f);
+            QVERIFY(Timeout::currentDeadline() < deadline);
+            try {
+                Coroutine::sleep(1.0f);
+            } catch (TimeoutException &) {
+            }
+        }
+        QCOMPARE(Timeout::currentDeadline(), deadline);
+        Timeout inner(10.0f);
+        Coroutine::sleep(1.0f);
+    } catch (TimeoutException &) {
+        timedout = true;
+    }
+    QVERIFY(timedout);
+    QVERIFY(timer.elapsed() < 1000);
+    QCOMPARE(Timeout::currentDeadline(), -1ll);
+}
+
+
+void TestCoroutines::testLockHandOff()
+{
+    QSharedPointer<Lock> lock(new Lock);
+    QSharedPointer<QList<int>> order(new QList<int>());
+    QVERIFY(lock->acquire());
+    CoroutineGroup operations;
+    for (int i = 0; i < 3; ++i) {
+        operations.spawnWithName(QString::number(i), [lock, order, i] {
+            if (lock->acquire()) {
+                order->append(i);
+                lock->release();
+            }
+        });
+    }
+    Coroutine::sleep(0.01f);
+    QCOMPARE(lock->getting(), 3u);
+    // the first waiter is killed after the lock is handed to it, so it passes the lock to the next.
+    operations.kill(QString::fromLatin1("0"), false);
+    lock->release();
+    operations.joinall();
+    QCOMPARE(*order, QList<int>() << 1 << 2);
+    QVERIFY(!lock->isLocked());
+    QCOMPARE(lock->getting(), 0u);
+}
+
+
+void TestCoroutines::benchmarkLockPingPong()
+{
+    QSharedPointer<Lock> lock(new Lock);
+    QBENCHMARK {
+        lock->acquire();
+        CoroutineGroup operations;
+        for (int i = 0; i < 2; ++i) {
+            operations.spawn([lock] {
+                // the lock is handed to the other coroutine on every release.
+                for (int j = 0; j < 10000; ++j) {
+                    lock->acquire();
+                    lock->release();
+                }
+            });
+        }
+        Coroutine::sleep(0.001f);
+        lock->release();
+        operations.joinall();
+    }
+}
+
+
+void TestCoroutines::testRWLock()
+{
+    QSharedPointer<RWLock> lock(new RWLock());
+    QVERIFY(lock->lockForRead());
+    QVERIFY(lock->lockForRead());
+    QCOMPARE(lock->readers(), 2u);
+    QVERIFY(!lock->lockForWrite(false));
+
+    QSharedPointer<QStringList> order(new QStringList());
+    CoroutineGroup operations;
+    operations.spawn([lock, order] {
+        if (lock->lockForWrite()) {
+            order->append(QString::fromLatin1("w"));
+            lock->unlock();
+        }
+    });
+    Coroutine::sleep(0.01f);
+    // the writer waiting goes before the readers coming later.
+    QVERIFY(!lock->lockForRead(false));
+    operations.spawn([lock, order] {
+        ScopedReadLock<RWLock> l(*lock);
+        order->append(QString::fromLatin1("r"));
+    });
+    Coroutine::sleep(0.01f);
+    QCOMPARE(lock->getting(), 2u);
+    lock->unlock();
+    lock->unlock();
+    operations.joinall();
+    QCOMPARE(*order, QStringList() << QString::fromLatin1("w") << QString::fromLatin1("r"));
+    QVERIFY(!lock->isLocked());
+
+    // the fair lock lets the readers waiting for a writer go before the next writer.
+    QSharedPointer<RWLock> fair(new RWLock(true));
+    order->clear();
+    QVERIFY(fair->lockForWrite());
+    for (int i = 0; i < 2; ++i) {
+        operations.spawn([fair, order] {
+            ScopedWriteLock<RWLock> l(*fair);
+            order->append(QString::fromLatin1("w"));
+        });
+        operations.spawn([fair, order] {
+            ScopedReadLock<RWLock> l(*fair);
+            order->append(QString::fromLatin1("r"));
+            Coroutine::msleep(1);
+        });
+    }
+    Coroutine::sleep(0.01f);
+    fair->unlock();
+    operations.joinall();
+    QCOMPARE(order->size(), 4);
+    QCOMPARE(order->at(0), QString::fromLatin1("r"));
+    QCOMPARE(order->at(1), QString::fromLatin1("r"));
+    QVERIFY(!fair->isLocked());
+}
+
+void TestCoroutines::testThreadRWLock()
+{
+    QSharedPointer<ThreadRWLock> lock(new ThreadRWLock());
+    QSharedPointer<QAtomicInt> value(new QAtomicInt(0));
+    QVERIFY(lock->lockForWrite());
+    QThread *thread = QThread::create([lock, value] {
+        ScopedReadLock<ThreadRWLock> l(*lock);
+        value->storeRelease(1);
+    });
+    thread->start();
+    Coroutine::sleep(0.01f);
+    QCOMPARE(value->loadAcquire(), 0);
+    lock->unlock();
+    QVERIFY(waitThread(thread));
+    delete thread;
+    QCOMPARE(value->loadAcquire(), 1);
+    QVERIFY(!lock->isLocked());
+}
+
+void TestCoroutines::benchmarkRWLockReadHeavy()
+{
+    QSharedPointer<RWLock> lock(new RWLock());
+    QSharedPointer<QHash<int, int>> cache(new QHash<int, int>());
+    QBENCHMARK {
+        CoroutineGroup operations;
+        for (int i = 0; i < 16; ++i) {
+            operations.spawn([lock, cache, i] {
+                // one write in a hundred, the readers yield inside the lock.
+                for (int j = 0; j < 1000; ++j) {
+                    if (j % 100 == i) {
+                        ScopedWriteLock<RWLock> l(*lock);
+                        cache->insert(j, i);
+                    } else {
+                        ScopedReadLock<RWLock> l(*lock);
+                        cache->value(j);
+                        if (j % 10 == 0) {
+                            Coroutine::msleep(0);
+                        }
+                    }
+                }
+            });
+        }
+        operations.joinall();
+    }
+}
+
+
+void TestCoroutines::testRingQueue()
+{
+    QSharedPointer<RingQueue<int>> queue(new RingQueue<int>(4));
+    QList<int> items;
+    for (int i = 0; i < 10; ++i) {
+        items.append(i);
+    }
+    QSharedPointer<Coroutine> producer(Coroutine::spawn([queue, items] { queue->putMany(items); }));
+    QList<int> received;
+    while (received.size() < items.size()) {
+        const QList<int> &batch = queue->getMany(3);
+        QVERIFY(!batch.isEmpty() && batch.size() <= 3);
+        received.append(batch);
+    }
+    producer->join();
+    QCOMPARE(received, items);
+    QVERIFY(queue->isEmpty());
+}
+
+
+void TestCoroutines::testSpawnAnywhere()
+{
+    CoroutineRuntime runtime(2);
+    QSharedPointer<QAtomicInt> counter(new QAtomicInt(0));
+    QList<QSharedPointer<ThreadEvent>> events;
+    for (int i = 0; i < 100; ++i) {
+        events.append(runtime.spawnAnywhere([counter] {
+            Coroutine::msleep(1);
+            counter->ref();
+        }));
+    }
+    for (QSharedPointer<ThreadEvent> event : events) {
+        QVERIFY(event->wait());
+    }
+    QCOMPARE(counter->loadAcquire(), 100);
+}
+
+
+void TestCoroutines::testEventLoopMetrics()
+{
+    const EventLoopMetrics before = eventLoopMetrics();
+    QSharedPointer<Coroutine> c(Coroutine::spawn([] { Coroutine::msleep(10); }));
+    QCOMPARE(eventLoopMetrics().coroutines, before.coroutines + 1);
+    c->join();
+    const EventLoopMetrics after = eventLoopMetrics();
+    QVERIFY(after.iterations > before.iterations);
+    QVERIFY(after.pollNsecs > before.pollNsecs);
+    quint64 histogram = 0;
+    for (int i = 0; i < EventLoopMetrics::LatencyBuckets; ++i) {
+        histogram += after.latencies[i];
+    }
+    QCOMPARE(histogram, after.iterations);
+    c.clear();
+    QCOMPARE(eventLoopMetrics().coroutines, before.coroutines);
+}
+
+
+void TestCoroutines::testCoroutineAccounting()
+{
+    BaseCoroutine::setAccountingEnabled(true);
+    QSharedPointer<Coroutine> c(Coroutine::spawn([] {
+        QElapsedTimer timer;
+        timer.start();
+        while (timer.elapsed() < 20) { }
+        Coroutine::msleep(50);
+    }));
+    c->join();
+    BaseCoroutine::setAccountingEnabled(false);
+    QVERIFY(c->runTimeNsecs() >= 20 * 1000 * 1000);
+    // the sleeping is not counted.
+    QVERIFY(c->runTimeNsecs() < 50 * 1000 * 1000);
+    QVERIFY(c->switchCount() >= 2);
+}
+
+
+#ifdef QTNG_HAVE_TASK
+static Task<int> addLater(int a, int b)
+{
+    co_await taskSleep(10);
+    co_return a + b;
+}
+
+static Task<int> sumTasks(Event &event)
+{
+    const int first = co_await addLater(1, 2);
+    const bool ok = co_await waitEvent(event, 1000);
+    co_return ok ? first + co_await addLater(3, 4) : -1;
+}
+#endif
+
+
+void TestCoroutines::testTask()
+{
+#ifdef QTNG_HAVE_TASK
+    Event event;
+    Task<int> task = sumTasks(event);
+    task.start();
+    QSharedPointer<Coroutine> setter(Coroutine::spawn([&event] {
+        Coroutine::msleep(20);
+        event.set();
+    }));
+    QCOMPARE(task.join(), 10);
+    QVERIFY(task.isFinished());
+    Event never;
+    Task<int> timedOut = sumTasks(never);
+    QCOMPARE(timedOut.join(), -1);
+#else
+    QSKIP("Task needs c++20 coroutines.");
+#endif
+}
+
+
+void TestCoroutines::testTracing()
+{
+    if (!Tracing::isCompiledIn()) {
+        QVERIFY(!Tracing::start());
+        QVERIFY(Tracing::chromeTrace().startsWith("{\"traceEvents\":["));
+        return;
+    }
+    QVERIFY(Tracing::start());
+    QSharedPointer<Coroutine> c(Coroutine::spawn([] { Coroutine::msleep(10); }));
+    c->join();
+    Tracing::stop();
+    const QByteArray &trace = Tracing::chromeTrace();
+    QVERIFY(trace.contains("\"name\":\"resume\""));
+    QVERIFY(trace.endsWith("],\"displayTimeUnit\":\"ms\"}\n"));
+}
+
+
 QTEST_MAIN(TestCoroutines)
 
+struct CountedLocal
+{
+    CountedLocal() : value(0) { ++alive; }
+    CountedLocal(const CountedLocal &other) : value(other.value) { ++alive; }
+    ~CountedLocal() { --alive; }
+    int value;
+    static int alive;
+};
+
+int CountedLocal::alive = 0;
+
+void TestCoroutines::testCoroutineLocal()
+{
+    CoroutineLocal<CountedLocal> local;
+    QVERIFY(!local.hasLocalData());
+    CoroutineGroup operations;
+    for (int i = 1; i <= 3; ++i) {
+        operations.spawn([&local, i] {
+            local.localData().value = i;
+            Coroutine::sleep(0.01);
+            QCOMPARE(local.localData().value, i);
+        });
+    }
+    operations.joinall();
+    QVERIFY(!local.hasLocalData());
+    Coroutine::msleep(10);  // finished coroutines are deleted later.
+    QCOMPARE(CountedLocal::alive, 0);
+
+    Event done;
+    Coroutine::spawnDetached([&local] { local.localData().value = 1; });
+    Coroutine::spawnDetached([&local, &done] {
+        QVERIFY(!local.hasLocalData());
+        done.set();
+    });
+    done.wait();
+}
+
+void TestCoroutines::testJoiners()
+{
+    QSharedPointer<Coroutine> c(Coroutine::spawn([] { Coroutine::msleep(10); }));
+    int joined = 0;
+    CoroutineGroup operations;
+    for (int i = 0; i < 3; ++i) {
+        operations.spawn([c, &joined] {
+            if (c->join()) {
+                ++joined;
+            }
+        });
+    }
+    operations.joinall();
+    QCOMPARE(joined, 3);
+    QVERIFY(operations.isEmpty());
+
+    // the joiner killed while waiting does not leave itself behind.
+    QSharedPointer<Coroutine> slow(Coroutine::spawn([] { Coroutine::msleep(50); }));
+    QSharedPointer<Coroutine> joiner = operations.spawn([slow] { slow->join(); });
+    Coroutine::msleep(10);
+    joiner->kill();
+    joiner->join();
+    QVERIFY(slow->join());
+    QVERIFY(slow->isFinished());
+}
+
 #include "test_coroutines.moc"
@@ -21,6 +21,7 @@ private slots:
     void testAES256();
     void testBlowfish();
     void testDecrypt();
+    void testInPlace();
     void testGenRSA();
     void testSignRSA();
     void testCryptoRSA();
@@ -138,6 +139,36 @@ void TestCrypto::testDecrypt()
     QCOMPARE(clearText, QByteArray("fish is here."));
 }
 
+void TestCrypto::testInPlace()
+{
+    Cipher c1(Cipher::AES128, Cipher::CTR, Cipher::Encrypt);
+    c1.setPassword("123456", MessageDigest::Sha256, "12345678", 1000);
+    QScopedPointer<Cipher> c2(c1.copy(Cipher::Encrypt));
+    const QByteArray text("fish is here, and it is in place.");
+    const QByteArray &expected = c1.addData(text);
+    QByteArray buf = text;
+    QCOMPARE(c2->update(buf.constData(), buf.size(), buf.data()), text.size());
+    QCOMPARE(buf, expected);
+
+    MessageDigest m(MessageDigest::Sha256);
+    m.addData("123456");
+    QCOMPARE(m.digestSize(), 32);
+    char digest[32];
+    QCOMPARE(m.result(digest), 32);
+    QCOMPARE(QByteArray(digest, 32).toHex(), QByteArray("8d969eef6ecad3c29a3a629280e686cf0c3f5d5a86aff3ca12020c923adc6c92"));
+    QCOMPARE(m.result(), QByteArray(digest, 32));
+
+    QVERIFY(m.reset());
+    m.addData("123456");
+    QCOMPARE(m.result(), QByteArray(digest, 32));
+    const QList<QByteArray> &hashes = MessageDigest::hashMany(QList<QByteArray>() << "123456" << "" << "123456",
+                                                              MessageDigest::Sha256);
+    QCOMPARE(hashes.size(), 3);
+    QCOMPARE(hashes.at(0), MessageDigest::hash("123456", MessageDigest::Sha256));
+    QCOMPARE(hashes.at(1), MessageDigest::hash("", MessageDigest::Sha256));
+    QCOMPARE(hashes.at(2), hashes.at(0));
+}
+
 
 void TestCrypto::testGenRSA()
 {
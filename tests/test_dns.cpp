@@ -0,0 +1,137 @@
+#include <QtTest>
+#include <QtCore/qendian.h>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+// answers the A queries by 10.0.0.1 with the ttl in the first label, "ttl0.qtng.test" gets zero. AAAA queries get
+// no address. the A queries are counted by names.
+static void serveQueries(QSharedPointer<Socket> server, QSharedPointer<QMap<QByteArray, int>> queries)
+{
+    while (true) {
+        HostAddress from;
+        quint16 port = 0;
+        const QByteArray &query = server->recvfrom(512, &from, &port);
+        if (query.isEmpty()) {
+            return;
+        }
+        QByteArray name;
+        int offset = 12;
+        while (offset < query.size() && query.at(offset) != 0) {
+            const int len = static_cast<quint8>(query.at(offset));
+            name.append(name.isEmpty() ? "" : ".").append(query.mid(offset + 1, len));
+            offset += len + 1;
+        }
+        offset += 5;
+        if (offset > query.size()) {
+            continue;
+        }
+        const quint16 type = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(query.constData() + offset - 4));
+        QByteArray response = query.left(offset);
+        response[2] = static_cast<char>(0x81);  // response, recursion desired
+        response[3] = static_cast<char>(0x80);  // recursion available, no error
+        if (type == 1) {
+            (*queries)[name] += 1;
+            const quint32 ttl = name.split('.').first().mid(3).toUInt();
+            uchar ttlBytes[4];
+            qToBigEndian<quint32>(ttl, ttlBytes);
+            response[7] = 1;  // one answer
+            response.append("\xc0\x0c\x00\x01\x00\x01", 6);
+            response.append(reinterpret_cast<const char *>(ttlBytes), 4);
+            response.append("\x00\x04\x0a\x00\x00\x01", 6);
+        }
+        server->sendto(response, from, port);
+    }
+}
+
+class TestDns : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testTtlExpiry_data();
+    void testTtlExpiry();
+    void testZeroTtl();
+private:
+    QSharedPointer<Socket> server;
+    QSharedPointer<QMap<QByteArray, int>> queries;
+    CoroutineGroup operations;
+    QList<HostAddress> savedNameServers;
+    quint16 savedPort;
+    QStringList savedSearchDomains;
+};
+
+// SocketDnsCache resolves by the resolver of current thread, which is pointed to the fake name server.
+void TestDns::initTestCase()
+{
+    server.reset(new Socket(HostAddress::IPv4Protocol, Socket::UdpSocket));
+    QVERIFY(server->bind(HostAddress::LocalHost, 0));
+    queries.reset(new QMap<QByteArray, int>());
+    operations.spawn([this] { serveQueries(server, queries); });
+
+    QSharedPointer<DnsResolver> resolver = DnsResolver::instance();
+    savedNameServers = resolver->nameServers();
+    savedPort = resolver->nameServerPort();
+    savedSearchDomains = resolver->searchDomains();
+    resolver->setNameServers(QList<HostAddress>() << HostAddress(HostAddress::LocalHost));
+    resolver->setNameServerPort(server->localPort());
+    resolver->setSearchDomains(QStringList());
+}
+
+void TestDns::cleanupTestCase()
+{
+    QSharedPointer<DnsResolver> resolver = DnsResolver::instance();
+    resolver->setNameServerPort(savedPort);
+    resolver->setNameServers(savedNameServers);
+    resolver->setSearchDomains(savedSearchDomains);
+    operations.killall();
+}
+
+void TestDns::testTtlExpiry_data()
+{
+    QTest::addColumn<QString>("hostName");
+    QTest::addColumn<quint32>("maxTtl");
+    QTest::newRow("ttl of answer") << QString::fromLatin1("ttl1.qtng.test") << quint32(3600);
+    QTest::newRow("max ttl") << QString::fromLatin1("ttl600.qtng.test") << quint32(1);
+}
+
+// the answer is used till its ttl, and resolved again after.
+void TestDns::testTtlExpiry()
+{
+    QFETCH(QString, hostName);
+    QFETCH(quint32, maxTtl);
+    const QList<HostAddress> expected = QList<HostAddress>() << HostAddress(QString::fromLatin1("10.0.0.1"));
+    const QByteArray &name = hostName.toLatin1();
+
+    SocketDnsCache cache;
+    cache.setMaxTtl(maxTtl);
+    QCOMPARE(cache.resolve(hostName), expected);
+    QCOMPARE(queries->value(name), 1);
+    QVERIFY(cache.hasHost(hostName));
+    QCOMPARE(cache.resolve(hostName), expected);
+    QCOMPARE(queries->value(name), 1);
+
+    Coroutine::msleep(1100);
+    QVERIFY(!cache.hasHost(hostName));
+    QCOMPARE(cache.resolve(hostName), expected);
+    QCOMPARE(queries->value(name), 2);
+    QVERIFY(cache.hasHost(hostName));
+}
+
+// rfc 1035 section 3.2.1, the answer of zero ttl is used by the lookup only.
+void TestDns::testZeroTtl()
+{
+    const QString hostName = QString::fromLatin1("ttl0.qtng.test");
+    const QList<HostAddress> expected = QList<HostAddress>() << HostAddress(QString::fromLatin1("10.0.0.1"));
+
+    SocketDnsCache cache;
+    QCOMPARE(cache.resolve(hostName), expected);
+    QVERIFY(!cache.hasHost(hostName));
+    QCOMPARE(cache.resolve(hostName), expected);
+    QCOMPARE(queries->value("ttl0.qtng.test"), 2);
+}
+
+QTEST_MAIN(TestDns)
+
+#include "test_dns.moc"
@@ -0,0 +1,156 @@
+#include <QtTest>
+#include <QtCore/qendian.h>
+#include "qtnetworkng.h"
+#include "../include/gzip.h"
+extern "C" {
+#include <zlib.h>
+}
+
+using namespace qtng;
+
+// text with some random bytes, so the blocks are compressible and refer to the blocks before them.
+static QByteArray makeInput(int size)
+{
+    QByteArray data;
+    data.reserve(size + 128);
+    for (int i = 0; data.size() < size; ++i) {
+        data.append("line " + QByteArray::number(i % 1000) + " of the input, ");
+        if (i % 7 == 0) {
+            data.append(randomBytes(i % 50));
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+// reads until the end in pieces of chunkSize, returns false if any read() fails.
+static bool readAll(QSharedPointer<FileLike> f, int chunkSize, QByteArray *data)
+{
+    QByteArray buf(chunkSize, Qt::Uninitialized);
+    while (true) {
+        qint32 readBytes = f->read(buf.data(), buf.size());
+        if (readBytes < 0) {
+            return false;
+        } else if (readBytes == 0) {
+            return true;
+        }
+        data->append(buf.constData(), readBytes);
+    }
+}
+
+class TestGzip : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testParallelCompress_data();
+    void testParallelCompress();
+    void testCrc32();
+};
+
+void TestGzip::testParallelCompress_data()
+{
+    const int blockSize = 1024 * 32;
+    // compressBlocks() takes two blocks for every thread at once.
+    const int batch = qMax(1, QThread::idealThreadCount()) * 2;
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("level");
+    QTest::addColumn<int>("chunkSize");
+    QTest::newRow("empty") << 0 << -1 << 1024;
+    QTest::newRow("one byte") << 1 << -1 << 1024;
+    QTest::newRow("one block") << blockSize << -1 << 1024;
+    QTest::newRow("one block and one byte") << blockSize + 1 << -1 << 1024;
+    QTest::newRow("five blocks") << blockSize * 5 - 7 << 6 << 1000;
+    QTest::newRow("one batch") << blockSize * batch << 1 << 1024 * 64;
+    QTest::newRow("three batches") << blockSize * batch * 3 + 12345 << 9 << 7;
+    QTest::newRow("stored") << blockSize * 3 + 1 << 0 << 1024;
+}
+
+// the blocks compressed by the threads are one gzip stream, which GzipDecompressFile reads back.
+void TestGzip::testParallelCompress()
+{
+    QFETCH(int, size);
+    QFETCH(int, level);
+    QFETCH(int, chunkSize);
+    const QByteArray &data = makeInput(size);
+    QSharedPointer<ThreadPool> pool(new ThreadPool(4));
+
+    QSharedPointer<ParallelGzipCompressFile> compressor(
+            new ParallelGzipCompressFile(FileLike::bytes(data), level, pool));
+    compressor->setBlockSize(1024 * 32);
+    QByteArray compressed;
+    QVERIFY(readAll(compressor, chunkSize, &compressed));
+    QCOMPARE(compressor->read(compressed.data(), 1), 0);
+    QVERIFY(compressed.size() >= 18);
+    QVERIFY(compressed.startsWith("\x1f\x8b\x08"));
+    // the trailer is the crc32 and the size of input.
+    const uchar *trailer = reinterpret_cast<const uchar *>(compressed.constData()) + compressed.size() - 8;
+    QCOMPARE(qFromLittleEndian<quint32>(trailer), qCrc32(data));
+    QCOMPARE(qFromLittleEndian<quint32>(trailer + 4), static_cast<quint32>(size));
+    if (level != 0 && size > 1024) {
+        QVERIFY(compressed.size() < size / 2);
+    }
+
+    QByteArray decompressed;
+    QVERIFY(readAll(QSharedPointer<GzipDecompressFile>::create(FileLike::bytes(compressed)), chunkSize,
+                    &decompressed));
+    QCOMPARE(decompressed.size(), data.size());
+    QVERIFY(decompressed == data);
+
+    decompressed.clear();
+    QVERIFY(qGzipDecompress(compressed, &decompressed));
+    QVERIFY(decompressed == data);
+
+    // a cut stream is an error, not a shorter result.
+    if (size > 0) {
+        decompressed.clear();
+        QSharedPointer<FileLike> cut = FileLike::bytes(compressed.left(compressed.size() - 9));
+        QVERIFY(!readAll(QSharedPointer<GzipDecompressFile>::create(cut), chunkSize, &decompressed));
+    }
+}
+
+static quint32 zlibCrc32(const char *data, int size, quint32 crc = 0)
+{
+    return static_cast<quint32>(crc32(crc, reinterpret_cast<const Bytef *>(data), static_cast<uInt>(size)));
+}
+
+// the folded paths take 64 bytes and more, and leave a tail of 16 bytes. every length below 3000 at every alignment
+// of 16 bytes is compared to zlib, and so are the calls continued from a split point.
+void TestGzip::testCrc32()
+{
+    const QByteArray &buf = randomBytes(3000 + 16);
+    QCOMPARE(qCrc32(static_cast<const char *>(nullptr), 0), 0u);
+    QCOMPARE(qCrc32(buf.constData(), 0, 0x12345678u), 0x12345678u);
+    QCOMPARE(qCrc32(QByteArray("123456789")), 0xcbf43926u);
+    for (int size = 0; size < 3000; ++size) {
+        const char *data = buf.constData() + size % 16;
+        const quint32 expected = zlibCrc32(data, size);
+        if (qCrc32(data, size) != expected) {
+            QFAIL(qPrintable(QString::fromLatin1("the crc32 of %1 bytes is wrong.").arg(size)));
+        }
+        for (int split : { size / 3, size / 2, size - 1, 17 }) {
+            if (split < 0 || split > size) {
+                continue;
+            }
+            const quint32 crc = qCrc32(data + split, size - split, qCrc32(data, split));
+            if (crc != expected) {
+                const QString &message = QString::fromLatin1("the crc32 of %1 bytes split at %2 is wrong.");
+                QFAIL(qPrintable(message.arg(size).arg(split)));
+            }
+        }
+        const quint32 seed = zlibCrc32(buf.constData(), 16);
+        if (qCrc32(data, size, seed) != zlibCrc32(data, size, seed)) {
+            QFAIL(qPrintable(QString::fromLatin1("the crc32 of %1 bytes continued is wrong.").arg(size)));
+        }
+    }
+    for (int size : { 63, 64, 65, 128, 1000, 2999 }) {
+        const quint32 expected = zlibCrc32(buf.constData(), size);
+        for (int split = 0; split <= size; ++split) {
+            const quint32 crc = qCrc32(buf.constData() + split, size - split, qCrc32(buf.constData(), split));
+            QCOMPARE(crc, expected);
+        }
+    }
+}
+
+QTEST_MAIN(TestGzip)
+
+#include "test_gzip.moc"
@@ -0,0 +1,522 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+#include "../include/private/http2_p.h"
+
+using namespace qtng;
+
+static QList<HPackHeader> makeHeaders(const QList<QPair<const char *, const char *>> &pairs)
+{
+    QList<HPackHeader> headers;
+    for (const QPair<const char *, const char *> &pair : pairs) {
+        headers.append(HPackHeader(pair.first, pair.second));
+    }
+    return headers;
+}
+
+static bool sameHeaders(const QList<HPackHeader> &a, const QList<HPackHeader> &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (int i = 0; i < a.size(); ++i) {
+        if (a.at(i).name != b.at(i).name || a.at(i).value != b.at(i).value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static QByteArray makeFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    QByteArray frame;
+    const quint32 length = static_cast<quint32>(payload.size());
+    frame.append(static_cast<char>(length >> 16));
+    frame.append(static_cast<char>(length >> 8));
+    frame.append(static_cast<char>(length));
+    frame.append(static_cast<char>(type));
+    frame.append(static_cast<char>(flags));
+    frame.append(static_cast<char>(streamId >> 24));
+    frame.append(static_cast<char>(streamId >> 16));
+    frame.append(static_cast<char>(streamId >> 8));
+    frame.append(static_cast<char>(streamId));
+    frame.append(payload);
+    return frame;
+}
+
+static quint32 unpackUInt32(const QByteArray &data, int pos)
+{
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(data.constData() + pos));
+}
+
+// a raw peer of the Http2Connection under test, it speaks frames by hand.
+class RawHttp2Peer
+{
+public:
+    bool setup();
+    bool readFrame(quint8 *type, quint8 *flags, quint32 *streamId, QByteArray *payload);
+    bool waitFrame(quint8 type, quint8 *flags, quint32 *streamId, QByteArray *payload);
+    bool send(const QByteArray &data) { return peer->sendall(data) == data.size(); }
+public:
+    QSharedPointer<Http2Connection> http2;
+    QSharedPointer<Socket> peer;
+};
+
+bool RawHttp2Peer::setup()
+{
+    Socket server;
+    if (!server.bind(HostAddress::LocalHost, 0) || !server.listen(5)) {
+        return false;
+    }
+    QSharedPointer<Socket> client(new Socket());
+    if (!client->connect(HostAddress::LocalHost, server.localPort())) {
+        return false;
+    }
+    peer.reset(server.accept());
+    if (peer.isNull()) {
+        return false;
+    }
+    http2.reset(new Http2Connection(asSocketLike(client), false));
+    if (!http2->handshake()) {
+        return false;
+    }
+    if (peer->recvall(24) != QByteArray("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n")) {
+        return false;
+    }
+    quint8 flags;
+    quint32 streamId;
+    QByteArray payload;
+    if (!waitFrame(Http2SettingsFrame, &flags, &streamId, &payload)) {
+        return false;
+    }
+    return send(makeFrame(Http2SettingsFrame, 0, 0, QByteArray()));
+}
+
+bool RawHttp2Peer::readFrame(quint8 *type, quint8 *flags, quint32 *streamId, QByteArray *payload)
+{
+    const QByteArray &head = peer->recvall(9);
+    if (head.size() != 9) {
+        return false;
+    }
+    const uchar *h = reinterpret_cast<const uchar *>(head.constData());
+    const int length = (h[0] << 16) | (h[1] << 8) | h[2];
+    *type = h[3];
+    *flags = h[4];
+    *streamId = unpackUInt32(head, 5) & 0x7fffffff;
+    *payload = length > 0 ? peer->recvall(length) : QByteArray();
+    return payload->size() == length;
+}
+
+bool RawHttp2Peer::waitFrame(quint8 type, quint8 *flags, quint32 *streamId, QByteArray *payload)
+{
+    quint8 t;
+    while (readFrame(&t, flags, streamId, payload)) {
+        if (t == type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+class TestHttp2 : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testIntegers();
+    void testLiterals();
+    void testHuffmanStrings();
+    void testRequestsWithoutHuffman();
+    void testRequestsWithHuffman();
+    void testEncoder();
+    void testResponsesWithoutHuffman();
+    void testResponsesWithHuffman();
+    void testPaddedHeadersAndContinuation();
+    void testInvalidPadding_data();
+    void testInvalidPadding();
+    void testStreamWindow();
+    void testWindowUpdate();
+};
+
+// rfc 7541 c.1
+void TestHttp2::testIntegers()
+{
+    QByteArray out;
+    HPack::encodeInteger(10, 5, 0x00, &out);
+    QCOMPARE(out, QByteArray::fromHex("0a"));
+    out.clear();
+    HPack::encodeInteger(1337, 5, 0x00, &out);
+    QCOMPARE(out, QByteArray::fromHex("1f9a0a"));
+    out.clear();
+    HPack::encodeInteger(42, 8, 0x00, &out);
+    QCOMPARE(out, QByteArray::fromHex("2a"));
+
+    const QByteArray &encoded = QByteArray::fromHex("1f9a0a");
+    const char *p = encoded.constData();
+    quint32 value = 0;
+    QVERIFY(HPack::decodeInteger(p, encoded.constData() + encoded.size(), 5, &value));
+    QCOMPARE(value, 1337u);
+    QVERIFY(p == encoded.constData() + encoded.size());
+    // truncated.
+    p = encoded.constData();
+    QVERIFY(!HPack::decodeInteger(p, encoded.constData() + 2, 5, &value));
+}
+
+// rfc 7541 c.2
+void TestHttp2::testLiterals()
+{
+    HPackDecoder decoder;
+    QList<HPackHeader> headers;
+    QVERIFY(decoder.decode(QByteArray::fromHex("400a637573746f6d2d6b65790d637573746f6d2d686561646572"), &headers));
+    QVERIFY(sameHeaders(headers, makeHeaders({ { "custom-key", "custom-header" } })));
+    // the entry is indexed as 62.
+    headers.clear();
+    QVERIFY(decoder.decode(QByteArray::fromHex("be"), &headers));
+    QVERIFY(sameHeaders(headers, makeHeaders({ { "custom-key", "custom-header" } })));
+
+    headers.clear();
+    QVERIFY(decoder.decode(QByteArray::fromHex("040c2f73616d706c652f70617468"), &headers));
+    QVERIFY(sameHeaders(headers, makeHeaders({ { ":path", "/sample/path" } })));
+
+    headers.clear();
+    QVERIFY(decoder.decode(QByteArray::fromHex("100870617373776f726406736563726574"), &headers));
+    QVERIFY(sameHeaders(headers, makeHeaders({ { "password", "secret" } })));
+
+    headers.clear();
+    QVERIFY(decoder.decode(QByteArray::fromHex("82"), &headers));
+    QVERIFY(sameHeaders(headers, makeHeaders({ { ":method", "GET" } })));
+
+    // neither the literal without indexing nor the never indexed one is in the table, 63 is out of range.
+    headers.clear();
+    QVERIFY(!decoder.decode(QByteArray::fromHex("bf"), &headers));
+}
+
+void TestHttp2::testHuffmanStrings()
+{
+    const QList<QPair<QByteArray, QByteArray>> strings = {
+        { "www.example.com", "8cf1e3c2e5f23a6ba0ab90f4ff" },
+        { "no-cache", "86a8eb10649cbf" },
+        { "custom-key", "8825a849e95ba97d7f" },
+        { "custom-value", "8925a849e95bb8e8b4bf" },
+    };
+    for (const QPair<QByteArray, QByteArray> &s : strings) {
+        QByteArray out;
+        HPack::encodeString(s.first, &out);
+        QCOMPARE(out.toHex(), s.second);
+        const char *p = out.constData();
+        QByteArray decoded;
+        QVERIFY(HPack::decodeString(p, out.constData() + out.size(), &decoded));
+        QCOMPARE(decoded, s.first);
+    }
+    // a padding longer than 7 bits, and a padding which is not the prefix of EOS.
+    const QList<QByteArray> invalid = { QByteArray::fromHex("82ffff"), QByteArray::fromHex("8100") };
+    for (const QByteArray &s : invalid) {
+        const char *p = s.constData();
+        QByteArray decoded;
+        QVERIFY(!HPack::decodeString(p, s.constData() + s.size(), &decoded));
+    }
+}
+
+static const char * const requestsWithoutHuffman[] = {
+    "828684410f7777772e6578616d706c652e636f6d",
+    "828684be58086e6f2d6361636865",
+    "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+};
+
+static const char * const requestsWithHuffman[] = {
+    "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+    "828684be5886a8eb10649cbf",
+    "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+};
+
+static QList<QList<HPackHeader>> expectedRequests()
+{
+    return {
+        makeHeaders({ { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+                      { ":authority", "www.example.com" } }),
+        makeHeaders({ { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+                      { ":authority", "www.example.com" }, { "cache-control", "no-cache" } }),
+        makeHeaders({ { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" },
+                      { ":authority", "www.example.com" }, { "custom-key", "custom-value" } }),
+    };
+}
+
+// rfc 7541 c.3, the later requests refer to the dynamic table built by the former.
+void TestHttp2::testRequestsWithoutHuffman()
+{
+    HPackDecoder decoder;
+    const QList<QList<HPackHeader>> &expected = expectedRequests();
+    for (int i = 0; i < 3; ++i) {
+        QList<HPackHeader> headers;
+        QVERIFY(decoder.decode(QByteArray::fromHex(requestsWithoutHuffman[i]), &headers));
+        QVERIFY(sameHeaders(headers, expected.at(i)));
+    }
+}
+
+// rfc 7541 c.4
+void TestHttp2::testRequestsWithHuffman()
+{
+    HPackDecoder decoder;
+    const QList<QList<HPackHeader>> &expected = expectedRequests();
+    for (int i = 0; i < 3; ++i) {
+        QList<HPackHeader> headers;
+        QVERIFY(decoder.decode(QByteArray::fromHex(requestsWithHuffman[i]), &headers));
+        QVERIFY(sameHeaders(headers, expected.at(i)));
+    }
+}
+
+// our encoder makes the same choices as the examples of c.4.
+void TestHttp2::testEncoder()
+{
+    HPackEncoder encoder;
+    const QList<QList<HPackHeader>> &expected = expectedRequests();
+    for (int i = 0; i < 3; ++i) {
+        QCOMPARE(encoder.encode(expected.at(i)).toHex(), QByteArray(requestsWithHuffman[i]));
+    }
+    // and the table size update is sent before the next block.
+    encoder.setMaxTableSize(256);
+    HPackDecoder decoder;
+    decoder.setMaxTableSize(256);
+    QList<HPackHeader> headers;
+    const QByteArray &block = encoder.encode(expected.at(0));
+    QCOMPARE(static_cast<quint8>(block.at(0)) & 0xe0, 0x20);
+    QVERIFY(decoder.decode(block, &headers));
+    QVERIFY(sameHeaders(headers, expected.at(0)));
+}
+
+static const char * const responsesWithoutHuffman[] = {
+    "4803333032580770726976617465611d4d6f6e2c203231204f637420323031332032303a31333a323120474d546e1768747470733a2f2f"
+    "7777772e6578616d706c652e636f6d",
+    "4803333037c1c0bf",
+    "88c1611d4d6f6e2c203231204f637420323031332032303a31333a323220474d54c05a04677a69707738666f6f3d4153444a4b4851"
+    "4b425a584f5157454f50495541585157454f49553b206d61782d6167653d333630303b2076657273696f6e3d31",
+};
+
+static const char * const responsesWithHuffman[] = {
+    "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+    "4883640effc1c0bf",
+    "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f"
+    "3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007",
+};
+
+static QList<QList<HPackHeader>> expectedResponses()
+{
+    return {
+        makeHeaders({ { ":status", "302" }, { "cache-control", "private" },
+                      { "date", "Mon, 21 Oct 2013 20:13:21 GMT" }, { "location", "https://www.example.com" } }),
+        makeHeaders({ { ":status", "307" }, { "cache-control", "private" },
+                      { "date", "Mon, 21 Oct 2013 20:13:21 GMT" }, { "location", "https://www.example.com" } }),
+        makeHeaders({ { ":status", "200" }, { "cache-control", "private" },
+                      { "date", "Mon, 21 Oct 2013 20:13:22 GMT" }, { "location", "https://www.example.com" },
+                      { "content-encoding", "gzip" },
+                      { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" } }),
+    };
+}
+
+// rfc 7541 c.5, the table of 256 bytes evicts entries.
+void TestHttp2::testResponsesWithoutHuffman()
+{
+    HPackDecoder decoder;
+    decoder.setMaxTableSize(256);
+    const QList<QList<HPackHeader>> &expected = expectedResponses();
+    for (int i = 0; i < 3; ++i) {
+        QList<HPackHeader> headers;
+        QVERIFY(decoder.decode(QByteArray::fromHex(responsesWithoutHuffman[i]), &headers));
+        QVERIFY(sameHeaders(headers, expected.at(i)));
+    }
+    // only three entries are left, 65 is evicted.
+    QList<HPackHeader> headers;
+    QVERIFY(decoder.decode(QByteArray::fromHex("c0"), &headers));
+    QVERIFY(sameHeaders(headers, makeHeaders({ { "date", "Mon, 21 Oct 2013 20:13:22 GMT" } })));
+    QVERIFY(!decoder.decode(QByteArray::fromHex("c1"), &headers));
+}
+
+// rfc 7541 c.6
+void TestHttp2::testResponsesWithHuffman()
+{
+    HPackDecoder decoder;
+    decoder.setMaxTableSize(256);
+    const QList<QList<HPackHeader>> &expected = expectedResponses();
+    for (int i = 0; i < 3; ++i) {
+        QList<HPackHeader> headers;
+        QVERIFY(decoder.decode(QByteArray::fromHex(responsesWithHuffman[i]), &headers));
+        QVERIFY(sameHeaders(headers, expected.at(i)));
+    }
+}
+
+void TestHttp2::testPaddedHeadersAndContinuation()
+{
+    RawHttp2Peer peer;
+    QVERIFY(peer.setup());
+    const QList<HPackHeader> &request = makeHeaders({ { ":method", "GET" }, { ":scheme", "http" },
+                                                      { ":path", "/" }, { ":authority", "localhost" } });
+    QSharedPointer<Http2Stream> stream = peer.http2->openStream(request, true);
+    QVERIFY(!stream.isNull());
+    quint8 flags;
+    quint32 streamId;
+    QByteArray payload;
+    QVERIFY(peer.waitFrame(Http2HeadersFrame, &flags, &streamId, &payload));
+    QCOMPARE(streamId, stream->id);
+    QVERIFY(flags & Http2EndStreamFlag);
+
+    HPackEncoder encoder;
+    const QList<HPackHeader> &response = makeHeaders({ { ":status", "200" }, { "x-padded", "yes" },
+                                                       { "content-type", "text/plain" } });
+    const QByteArray &block = encoder.encode(response);
+    const int half = block.size() / 2;
+    // HEADERS with padding and priority, then the rest of the block in two CONTINUATION frames.
+    QByteArray headersPayload;
+    headersPayload.append('\x03');
+    headersPayload.append(QByteArray::fromHex("0000000010"));
+    headersPayload.append(block.left(half));
+    headersPayload.append(QByteArray(3, '\0'));
+    QByteArray frames = makeFrame(Http2HeadersFrame, Http2PaddedFlag | Http2PriorityFlag, streamId, headersPayload);
+    frames.append(makeFrame(Http2ContinuationFrame, 0, streamId, block.mid(half, 1)));
+    frames.append(makeFrame(Http2ContinuationFrame, Http2EndHeadersFlag, streamId, block.mid(half + 1)));
+    QByteArray dataPayload;
+    dataPayload.append('\x04');
+    dataPayload.append("hello");
+    dataPayload.append(QByteArray(4, '\0'));
+    frames.append(makeFrame(Http2DataFrame, Http2PaddedFlag | Http2EndStreamFlag, streamId, dataPayload));
+    QVERIFY(peer.send(frames));
+
+    QList<HPackHeader> headers;
+    QVERIFY(peer.http2->recvHeaders(stream, &headers));
+    QVERIFY(sameHeaders(headers, response));
+    char buf[16];
+    QCOMPARE(peer.http2->recvData(stream, buf, sizeof(buf)), 5);
+    QCOMPARE(QByteArray(buf, 5), QByteArray("hello"));
+    QCOMPARE(peer.http2->recvData(stream, buf, sizeof(buf)), 0);
+    QVERIFY(peer.http2->isValid());
+}
+
+void TestHttp2::testInvalidPadding_data()
+{
+    QTest::addColumn<quint8>("type");
+    QTest::addColumn<quint8>("flags");
+    QTest::addColumn<QByteArray>("payload");
+    const quint8 paddedHeaders = Http2PaddedFlag | Http2EndHeadersFlag;
+    QTest::newRow("empty padded headers") << quint8(Http2HeadersFrame) << paddedHeaders << QByteArray();
+    QTest::newRow("headers padding too long") << quint8(Http2HeadersFrame) << paddedHeaders
+                                              << QByteArray::fromHex("0582");
+    // the padding leaves 4 bytes for the 5 bytes of priority fields.
+    QTest::newRow("padding covers priority") << quint8(Http2HeadersFrame)
+                                             << quint8(paddedHeaders | Http2PriorityFlag)
+                                             << QByteArray::fromHex("010000000000");
+    QTest::newRow("empty padded data") << quint8(Http2DataFrame) << quint8(Http2PaddedFlag) << QByteArray();
+    QTest::newRow("data padding too long") << quint8(Http2DataFrame) << quint8(Http2PaddedFlag)
+                                           << QByteArray::fromHex("0261");
+}
+
+// rfc 7540 6.1 and 6.2, the padding must be shorter than the payload, or it is a PROTOCOL_ERROR of connection.
+void TestHttp2::testInvalidPadding()
+{
+    QFETCH(quint8, type);
+    QFETCH(quint8, flags);
+    QFETCH(QByteArray, payload);
+    RawHttp2Peer peer;
+    QVERIFY(peer.setup());
+    QSharedPointer<Http2Stream> stream = peer.http2->openStream(
+            makeHeaders({ { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" } }), true);
+    QVERIFY(!stream.isNull());
+    quint8 receivedFlags;
+    quint32 streamId;
+    QByteArray received;
+    QVERIFY(peer.waitFrame(Http2HeadersFrame, &receivedFlags, &streamId, &received));
+
+    const QByteArray &frame = makeFrame(type, flags, streamId, payload);
+    QVERIFY(peer.send(frame));
+    QVERIFY(peer.waitFrame(Http2GoAwayFrame, &receivedFlags, &streamId, &received));
+    QCOMPARE(streamId, 0u);
+    QVERIFY(received.size() >= 8);
+    QCOMPARE(unpackUInt32(received, 4), static_cast<quint32>(Http2ProtocolError));
+    QList<HPackHeader> headers;
+    QVERIFY(!peer.http2->recvHeaders(stream, &headers));
+    QVERIFY(!peer.http2->isValid());
+}
+
+// the padding counts against the window of stream, which is 1M since we announce it.
+void TestHttp2::testStreamWindow()
+{
+    RawHttp2Peer peer;
+    QVERIFY(peer.setup());
+    QSharedPointer<Http2Stream> stream = peer.http2->openStream(
+            makeHeaders({ { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" } }), true);
+    QVERIFY(!stream.isNull());
+    quint8 flags;
+    quint32 streamId;
+    QByteArray received;
+    QVERIFY(peer.waitFrame(Http2HeadersFrame, &flags, &streamId, &received));
+
+    HPackEncoder encoder;
+    QByteArray frames = makeFrame(Http2HeadersFrame, Http2EndHeadersFlag, streamId,
+                                  encoder.encode(makeHeaders({ { ":status", "200" } })));
+    const QByteArray chunk(16384, 'x');
+    for (int i = 0; i < 63; ++i) {
+        frames.append(makeFrame(Http2DataFrame, 0, streamId, chunk));
+    }
+    QByteArray padded;
+    padded.append('\xff');
+    padded.append(QByteArray(16384 - 256, 'y'));
+    padded.append(QByteArray(255, '\0'));
+    frames.append(makeFrame(Http2DataFrame, Http2PaddedFlag, streamId, padded));
+    QVERIFY(peer.send(frames));
+    QList<HPackHeader> headers;
+    QVERIFY(peer.http2->recvHeaders(stream, &headers));
+    // the window is used up exactly, the stream is still fine.
+    while (stream->data.size() < 63 * 16384 + 16384 - 256) {
+        QVERIFY(stream->changed.wait());
+    }
+    QVERIFY(!stream->reset);
+    QCOMPARE(stream->recvWindow, static_cast<qint64>(0));
+
+    // one more byte than the window allows.
+    QVERIFY(peer.send(makeFrame(Http2DataFrame, 0, streamId, QByteArray("z"))));
+    QVERIFY(peer.waitFrame(Http2RstStreamFrame, &flags, &streamId, &received));
+    QCOMPARE(streamId, stream->id);
+    QCOMPARE(received.size(), 4);
+    QCOMPARE(unpackUInt32(received, 0), static_cast<quint32>(Http2FlowControlError));
+    QVERIFY(stream->reset);
+    // only the stream is reset.
+    QVERIFY(peer.http2->isValid());
+}
+
+// the window of stream is given back after the half of it is read.
+void TestHttp2::testWindowUpdate()
+{
+    RawHttp2Peer peer;
+    QVERIFY(peer.setup());
+    QSharedPointer<Http2Stream> stream = peer.http2->openStream(
+            makeHeaders({ { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" } }), true);
+    QVERIFY(!stream.isNull());
+    quint8 flags;
+    quint32 streamId;
+    QByteArray received;
+    QVERIFY(peer.waitFrame(Http2HeadersFrame, &flags, &streamId, &received));
+
+    HPackEncoder encoder;
+    QByteArray frames = makeFrame(Http2HeadersFrame, Http2EndHeadersFlag, streamId,
+                                  encoder.encode(makeHeaders({ { ":status", "200" } })));
+    const QByteArray chunk(16384, 'x');
+    for (int i = 0; i < 32; ++i) {
+        frames.append(makeFrame(Http2DataFrame, 0, streamId, chunk));
+    }
+    QVERIFY(peer.send(frames));
+    QList<HPackHeader> headers;
+    QVERIFY(peer.http2->recvHeaders(stream, &headers));
+    QByteArray buf(16384, Qt::Uninitialized);
+    qint32 total = 0;
+    while (total < 32 * 16384) {
+        const qint32 n = peer.http2->recvData(stream, buf.data(), buf.size());
+        QVERIFY(n > 0);
+        total += n;
+    }
+    // the window of connection is 16M, so this one is for the stream.
+    QVERIFY(peer.waitFrame(Http2WindowUpdateFrame, &flags, &streamId, &received));
+    QCOMPARE(streamId, stream->id);
+    QCOMPARE(received.size(), 4);
+    QCOMPARE(unpackUInt32(received, 0), static_cast<quint32>(32 * 16384));
+    QCOMPARE(stream->recvWindow, static_cast<qint64>(1024 * 1024));
+}
+
+QTEST_MAIN(TestHttp2)
+
+#include "test_http2.moc"
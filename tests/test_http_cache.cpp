@@ -0,0 +1,483 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+class TestCacheManager : public HttpMemoryCacheManager
+{
+public:
+    using HttpMemoryCacheManager::cache;
+};
+
+class TestDiskCacheManager : public HttpDiskCacheManager
+{
+public:
+    TestDiskCacheManager(const QString &cacheDir)
+        : HttpDiskCacheManager(cacheDir)
+    {
+    }
+    using HttpDiskCacheManager::store;
+    using HttpDiskCacheManager::load;
+    using HttpDiskCacheManager::remove;
+};
+
+static const char url[] = "http://example.com/index.html";
+
+// the headers are `Name: value` lines.
+static QList<HttpHeader> parseHeaders(const QByteArray &lines)
+{
+    QList<HttpHeader> headers;
+    for (const QByteArray &line : lines.split('\n')) {
+        const int colon = line.indexOf(':');
+        if (colon > 0) {
+            headers.append(HttpHeader(QString::fromLatin1(line.left(colon)), line.mid(colon + 1).trimmed()));
+        }
+    }
+    return headers;
+}
+
+static HttpRequest makeRequest(const QString &method, const QByteArray &headers = QByteArray())
+{
+    HttpRequest request(method, QString::fromLatin1(url));
+    for (const HttpHeader &header : parseHeaders(headers)) {
+        request.addHeader(header);
+    }
+    return request;
+}
+
+static HttpResponse makeResponse(const HttpRequest &request, const QByteArray &headers, const QByteArray &body,
+                                 int statusCode = 200)
+{
+    HttpResponse response;
+    response.setRequest(request);
+    response.setUrl(QUrl(QString::fromLatin1(url)));
+    response.setStatusCode(statusCode);
+    response.setStatusText(QString::fromLatin1(statusCode == 304 ? "Not Modified" : "OK"));
+    for (const HttpHeader &header : parseHeaders(headers)) {
+        response.addHeader(header);
+    }
+    response.setBody(body);
+    return response;
+}
+
+static QByteArray formatHeaders(const QList<HttpHeader> &headers)
+{
+    QByteArrayList lines;
+    for (const HttpHeader &header : headers) {
+        lines.append(header.name.toLatin1() + ": " + header.value);
+    }
+    return lines.join('\n');
+}
+
+// a response to look up, which has only the request and url.
+static HttpResponse makeLookup(const HttpRequest &request)
+{
+    HttpResponse response;
+    response.setRequest(request);
+    response.setUrl(QUrl(QString::fromLatin1(url)));
+    return response;
+}
+
+static QByteArray httpDate(qint64 secondsFromNow)
+{
+    return toHttpDate(QDateTime::currentDateTimeUtc().addSecs(secondsFromNow));
+}
+
+// large enough that 8 of them fill a segment of 32MB, and distinct by the index.
+static QByteArray makeEntry(int i)
+{
+    QByteArray data(1024 * 1024 * 4, static_cast<char>('a' + i));
+    data.replace(0, 4, QByteArray::number(1000 + i));
+    return data;
+}
+
+static QString entryKey(int i)
+{
+    return QString::fromLatin1("http://example.com/%1").arg(i);
+}
+
+static bool segmentExists(const QTemporaryDir &dir, int id)
+{
+    return QFile::exists(dir.filePath(QString::fromLatin1("%1.seg").arg(id, 8, 10, QLatin1Char('0'))));
+}
+
+class TestHttpCache : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testFreshness_data();
+    void testFreshness();
+    void testRequestDirectives();
+    void testRevalidation();
+    void testVary();
+    void testMethodKeys();
+    void testMaxSize();
+    void testDiskRestart();
+    void testDiskTombstone();
+    void testDiskCompaction();
+    void testDiskEviction();
+};
+
+void TestHttpCache::testFreshness_data()
+{
+    QTest::addColumn<QByteArray>("headers");
+    QTest::addColumn<int>("statusCode");
+    QTest::addColumn<bool>("stored");
+    QTest::addColumn<bool>("fresh");
+    QTest::addColumn<QByteArray>("validators");
+
+    QTest::newRow("max-age") << QByteArray("Cache-Control: public, max-age=60") << 200 << true << true
+                             << QByteArray();
+    QTest::newRow("quoted max-age") << QByteArray("Cache-Control: max-age=\"60\"") << 200 << true << true
+                                    << QByteArray();
+    QTest::newRow("max-age over expires")
+            << QByteArray("Cache-Control: max-age=60\nExpires: " + httpDate(-60)) << 200 << true << true
+            << QByteArray();
+    QTest::newRow("max-age=0") << QByteArray("Cache-Control: max-age=0") << 200 << false << false << QByteArray();
+    QTest::newRow("invalid max-age") << QByteArray("Cache-Control: max-age=soon") << 200 << false << false
+                                     << QByteArray();
+    QTest::newRow("max-age=0 with etag") << QByteArray("Cache-Control: max-age=0\nETag: \"v1\"") << 200 << true
+                                         << false << QByteArray("If-None-Match: \"v1\"");
+    QTest::newRow("no-cache with etag") << QByteArray("Cache-Control: no-cache, max-age=60\nETag: \"v1\"") << 200
+                                        << true << false << QByteArray("If-None-Match: \"v1\"");
+    QTest::newRow("no-store") << QByteArray("Cache-Control: no-store, max-age=60\nETag: \"v1\"") << 200 << false
+                              << false << QByteArray();
+    QTest::newRow("age within max-age") << QByteArray("Cache-Control: max-age=60\nAge: 30") << 200 << true << true
+                                        << QByteArray();
+    QTest::newRow("age over max-age") << QByteArray("Cache-Control: max-age=60\nAge: 61") << 200 << false << false
+                                      << QByteArray();
+    QTest::newRow("expires") << QByteArray("Date: " + httpDate(0) + "\nExpires: " + httpDate(60)) << 200 << true
+                             << true << QByteArray();
+    QTest::newRow("expired") << QByteArray("Date: " + httpDate(0) + "\nExpires: " + httpDate(-60)) << 200 << false
+                             << false << QByteArray();
+    QTest::newRow("expires: 0") << QByteArray("Expires: 0") << 200 << false << false << QByteArray();
+    const QByteArray &lastModified = httpDate(-3600 * 24 * 10);
+    QTest::newRow("expired with last-modified")
+            << QByteArray("Expires: 0\nLast-Modified: " + lastModified) << 200 << true << false
+            << QByteArray("If-Modified-Since: " + lastModified);
+    QTest::newRow("both validators")
+            << QByteArray("Cache-Control: no-cache\nETag: W/\"v2\"\nLast-Modified: " + lastModified) << 200 << true
+            << false << QByteArray("If-None-Match: W/\"v2\"\nIf-Modified-Since: " + lastModified);
+    // 10% of the time since it was modified.
+    QTest::newRow("heuristic") << QByteArray("Date: " + httpDate(0) + "\nLast-Modified: " + lastModified) << 200
+                               << true << true << QByteArray();
+    const QByteArray &now = httpDate(0);
+    QTest::newRow("heuristic of new one") << QByteArray("Date: " + now + "\nLast-Modified: " + now) << 200 << true
+                                          << false << QByteArray("If-Modified-Since: " + now);
+    QTest::newRow("no freshness") << QByteArray("Content-Type: text/plain") << 200 << false << false
+                                  << QByteArray();
+    QTest::newRow("not cacheable status") << QByteArray("Cache-Control: max-age=60") << 201 << false << false
+                                          << QByteArray();
+    QTest::newRow("301") << QByteArray("Cache-Control: max-age=60") << 301 << true << true << QByteArray();
+    QTest::newRow("vary *") << QByteArray("Cache-Control: max-age=60\nVary: *") << 200 << false << false
+                            << QByteArray();
+}
+
+// rfc 7234 section 4.2, the freshness lifetime of max-age, Expires and the heuristic, minus Age.
+void TestHttpCache::testFreshness()
+{
+    QFETCH(QByteArray, headers);
+    QFETCH(int, statusCode);
+    QFETCH(bool, stored);
+    QFETCH(bool, fresh);
+    QFETCH(QByteArray, validators);
+
+    TestCacheManager manager;
+    const HttpRequest &request = makeRequest(QString::fromLatin1("GET"));
+    HttpResponse response = makeResponse(request, headers, "the body", statusCode);
+    QCOMPARE(manager.addResponse(response), stored);
+    QCOMPARE(manager.cache().contains(QString::fromLatin1(url)), stored);
+    QCOMPARE(manager.size() > 0, stored);
+
+    HttpResponse cached = makeLookup(request);
+    QList<HttpHeader> got;
+    QCOMPARE(manager.getResponse(&cached), fresh);
+    if (fresh) {
+        QCOMPARE(cached.statusCode(), statusCode);
+        QCOMPARE(cached.body(), QByteArray("the body"));
+        QCOMPARE(formatHeaders(cached.allHeaders()), formatHeaders(response.allHeaders()));
+    } else {
+        QCOMPARE(manager.getValidators(&cached, &got), !validators.isEmpty());
+    }
+    QCOMPARE(formatHeaders(got), validators);
+}
+
+// the directives of request make the fresh responses unusable.
+void TestHttpCache::testRequestDirectives()
+{
+    TestCacheManager manager;
+    HttpResponse response =
+            makeResponse(makeRequest(QString::fromLatin1("GET")), "Cache-Control: max-age=60\nETag: \"v1\"", "body");
+    QVERIFY(manager.addResponse(response));
+
+    HttpResponse cached = makeLookup(makeRequest(QString::fromLatin1("GET"), "Cache-Control: max-age=100"));
+    QVERIFY(manager.getResponse(&cached));
+    QCOMPARE(cached.body(), QByteArray("body"));
+
+    for (const char *headers : { "Cache-Control: no-cache", "Pragma: no-cache", "Cache-Control: no-store",
+                                 "Cache-Control: max-age=never" }) {
+        HttpResponse stale = makeLookup(makeRequest(QString::fromLatin1("GET"), headers));
+        QList<HttpHeader> validators;
+        QVERIFY2(!manager.getResponse(&stale), headers);
+        // no-store does not look at the stored one.
+        const bool noStore = QByteArray(headers).contains("no-store");
+        QCOMPARE(manager.getValidators(&stale, &validators), !noStore);
+        QCOMPARE(formatHeaders(validators), noStore ? QByteArray() : QByteArray("If-None-Match: \"v1\""));
+    }
+
+    // the request with no-store removes the stored one.
+    HttpResponse again = makeResponse(makeRequest(QString::fromLatin1("GET"), "Cache-Control: no-store"),
+                                      "Cache-Control: max-age=60", "body");
+    QVERIFY(!manager.addResponse(again));
+    QVERIFY(manager.cache().isEmpty());
+    QCOMPARE(manager.size(), Q_INT64_C(0));
+}
+
+// rfc 7234 section 4.3.4, the 304 response refreshes the headers of stored one, but not its body.
+void TestHttpCache::testRevalidation()
+{
+    TestCacheManager manager;
+    const HttpRequest &request = makeRequest(QString::fromLatin1("GET"));
+    HttpResponse response = makeResponse(request, "Cache-Control: no-cache\nETag: \"v1\"\nX-Version: 1", "body");
+    QVERIFY(manager.addResponse(response));
+
+    HttpResponse cached = makeLookup(request);
+    QList<HttpHeader> validators;
+    QVERIFY(!manager.getResponse(&cached));
+    QVERIFY(manager.getValidators(&cached, &validators));
+    QCOMPARE(formatHeaders(validators), QByteArray("If-None-Match: \"v1\""));
+
+    HttpResponse notModified =
+            makeResponse(request, "Cache-Control: max-age=60\nX-Version: 2\nContent-Length: 0", QByteArray(), 304);
+    QVERIFY(manager.updateResponse(&notModified));
+    QCOMPARE(notModified.statusCode(), 200);
+    QCOMPARE(notModified.body(), QByteArray("body"));
+    QCOMPARE(notModified.header(QString::fromLatin1("X-Version")), QByteArray("2"));
+    QCOMPARE(notModified.header(QString::fromLatin1("ETag")), QByteArray("\"v1\""));
+    QVERIFY(!notModified.hasHeader(QString::fromLatin1("Content-Length")));
+
+    cached = makeLookup(request);
+    QVERIFY(manager.getResponse(&cached));
+    QCOMPARE(cached.header(QString::fromLatin1("X-Version")), QByteArray("2"));
+
+    // only 304 is merged.
+    HttpResponse ok = makeResponse(request, "Cache-Control: max-age=60", "new body");
+    QVERIFY(!manager.updateResponse(&ok));
+    QCOMPARE(ok.body(), QByteArray("new body"));
+}
+
+// rfc 7234 section 4.1, the headers named by Vary must be the same as the request of stored response.
+void TestHttpCache::testVary()
+{
+    TestCacheManager manager;
+    HttpResponse response = makeResponse(makeRequest(QString::fromLatin1("GET"), "Accept-Encoding: gzip"),
+                                         "Cache-Control: max-age=60\nVary: accept-encoding, Accept-Language",
+                                         "gzipped");
+    QVERIFY(manager.addResponse(response));
+
+    HttpResponse cached = makeLookup(makeRequest(QString::fromLatin1("GET"), "accept-encoding: gzip"));
+    QVERIFY(manager.getResponse(&cached));
+    QCOMPARE(cached.body(), QByteArray("gzipped"));
+
+    cached = makeLookup(makeRequest(QString::fromLatin1("GET"), "Accept-Encoding: br"));
+    QVERIFY(!manager.getResponse(&cached));
+    cached = makeLookup(makeRequest(QString::fromLatin1("GET")));
+    QVERIFY(!manager.getResponse(&cached));
+    cached = makeLookup(makeRequest(QString::fromLatin1("GET"), "Accept-Encoding: gzip\nAccept-Language: en"));
+    QVERIFY(!manager.getResponse(&cached));
+
+    // a 304 to the other variant is not merged.
+    HttpResponse notModified = makeResponse(makeRequest(QString::fromLatin1("GET"), "Accept-Encoding: br"),
+                                            "Cache-Control: max-age=60", QByteArray(), 304);
+    QVERIFY(!manager.updateResponse(&notModified));
+
+    // the other variant replaces the stored one.
+    HttpResponse other = makeResponse(makeRequest(QString::fromLatin1("GET"), "Accept-Encoding: br"),
+                                      "Cache-Control: max-age=60\nVary: Accept-Encoding", "brotli");
+    QVERIFY(manager.addResponse(other));
+    QCOMPARE(manager.cache().size(), 1);
+    cached = makeLookup(makeRequest(QString::fromLatin1("GET"), "Accept-Encoding: gzip"));
+    QVERIFY(!manager.getResponse(&cached));
+    cached = makeLookup(makeRequest(QString::fromLatin1("GET"), "Accept-Encoding: br"));
+    QVERIFY(manager.getResponse(&cached));
+    QCOMPARE(cached.body(), QByteArray("brotli"));
+}
+
+// GET is keyed by the url, and the others by `METHOD url`, so a HEAD response never serves a GET.
+void TestHttpCache::testMethodKeys()
+{
+    TestCacheManager manager;
+    HttpResponse head = makeResponse(makeRequest(QString::fromLatin1("head")), "Cache-Control: max-age=60", "");
+    QVERIFY(manager.addResponse(head));
+    HttpResponse cached = makeLookup(makeRequest(QString::fromLatin1("GET")));
+    QVERIFY(!manager.getResponse(&cached));
+
+    HttpResponse get = makeResponse(makeRequest(QString::fromLatin1("GET")), "Cache-Control: max-age=60", "get");
+    QVERIFY(manager.addResponse(get));
+    HttpResponse post = makeResponse(makeRequest(QString::fromLatin1("POST")), "Cache-Control: max-age=60", "post");
+    QVERIFY(manager.addResponse(post));
+
+    const QString &key = QString::fromLatin1(url);
+    const QStringList &keys = QStringList() << QLatin1String("HEAD ") + key << QLatin1String("POST ") + key << key;
+    QCOMPARE(QStringList(manager.cache().keys()), keys);
+
+    cached = makeLookup(makeRequest(QString::fromLatin1("GET")));
+    QVERIFY(manager.getResponse(&cached));
+    QCOMPARE(cached.body(), QByteArray("get"));
+    cached = makeLookup(makeRequest(QString::fromLatin1("HEAD")));
+    QVERIFY(manager.getResponse(&cached));
+    QVERIFY(cached.body().isEmpty());
+    cached = makeLookup(makeRequest(QString::fromLatin1("POST")));
+    QVERIFY(manager.getResponse(&cached));
+    QCOMPARE(cached.body(), QByteArray("post"));
+
+    // a response without url is not stored.
+    HttpResponse noUrl;
+    noUrl.setRequest(makeRequest(QString::fromLatin1("GET")));
+    noUrl.setStatusCode(200);
+    noUrl.setHeader(QString::fromLatin1("Cache-Control"), "max-age=60");
+    QVERIFY(!manager.addResponse(noUrl));
+    QCOMPARE(manager.cache().size(), 3);
+}
+
+// the least recently used entries are dropped.
+void TestHttpCache::testMaxSize()
+{
+    TestCacheManager manager;
+    const QByteArray body(1000, 'x');
+    for (const char *method : { "GET", "HEAD", "POST" }) {
+        HttpResponse response = makeResponse(makeRequest(QString::fromLatin1(method)), "Cache-Control: max-age=60",
+                                             body);
+        QVERIFY(manager.addResponse(response));
+    }
+    const qint64 size = manager.size();
+    QVERIFY(size > 3000);
+
+    // touch the GET one, so HEAD is the least recently used.
+    HttpResponse cached = makeLookup(makeRequest(QString::fromLatin1("GET")));
+    QVERIFY(manager.getResponse(&cached));
+    manager.setMaxSize(size - 1);
+    QCOMPARE(manager.cache().size(), 2);
+    QVERIFY(!manager.cache().contains(QLatin1String("HEAD ") + QString::fromLatin1(url)));
+    QVERIFY(manager.size() < size);
+
+    manager.setMaxSize(0);
+    QVERIFY(manager.cache().isEmpty());
+    QCOMPARE(manager.size(), Q_INT64_C(0));
+    HttpResponse response = makeResponse(makeRequest(QString::fromLatin1("GET")), "Cache-Control: max-age=60", body);
+    QVERIFY(!manager.addResponse(response));
+}
+
+// the entries are indexed again from the segments by a new manager.
+void TestHttpCache::testDiskRestart()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    {
+        TestDiskCacheManager manager(dir.path());
+        HttpResponse response = makeResponse(makeRequest(QString::fromLatin1("GET")), "Cache-Control: max-age=60",
+                                             "hello");
+        QVERIFY(manager.addResponse(response));
+        QVERIFY(manager.store(entryKey(1), "first"));
+        QVERIFY(manager.store(entryKey(2), "second"));
+        QVERIFY(manager.store(entryKey(1), "first again"));
+        QVERIFY(manager.flush());
+        QVERIFY(manager.size() > 0);
+    }
+    TestDiskCacheManager manager(dir.path());
+    HttpResponse cached = makeLookup(makeRequest(QString::fromLatin1("GET")));
+    QVERIFY(manager.getResponse(&cached));
+    QCOMPARE(cached.body(), QByteArray("hello"));
+    QCOMPARE(manager.load(entryKey(1)), QByteArray("first again"));
+    QCOMPARE(manager.load(entryKey(2)), QByteArray("second"));
+    QVERIFY(manager.load(entryKey(3)).isEmpty());
+    QVERIFY(manager.size() > 0);
+}
+
+// the record of removed entry hides the older one, before and after it is written, and after restart.
+void TestHttpCache::testDiskTombstone()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    {
+        TestDiskCacheManager manager(dir.path());
+        QVERIFY(manager.store(entryKey(1), "removed"));
+        QVERIFY(manager.store(entryKey(2), "kept"));
+        QVERIFY(manager.flush());
+        const qint64 size = manager.size();
+        manager.remove(entryKey(1));
+        QVERIFY(manager.load(entryKey(1)).isEmpty());
+        QVERIFY(manager.flush());
+        QVERIFY(manager.load(entryKey(1)).isEmpty());
+        QVERIFY(manager.size() > size);
+        // nothing is written for the missing one.
+        const qint64 sizeWithTombstone = manager.size();
+        manager.remove(entryKey(3));
+        QVERIFY(manager.flush());
+        QCOMPARE(manager.size(), sizeWithTombstone);
+    }
+    TestDiskCacheManager manager(dir.path());
+    QVERIFY(manager.load(entryKey(1)).isEmpty());
+    QCOMPARE(manager.load(entryKey(2)), QByteArray("kept"));
+    QVERIFY(manager.store(entryKey(1), "stored again"));
+    QVERIFY(manager.flush());
+    QCOMPARE(manager.load(entryKey(1)), QByteArray("stored again"));
+}
+
+// the first segment is full after 8 entries. it is compacted once most of them are removed, the live ones are moved to
+// the active segment and the file is deleted.
+void TestHttpCache::testDiskCompaction()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    {
+        TestDiskCacheManager manager(dir.path());
+        for (int i = 0; i < 8; ++i) {
+            QVERIFY(manager.store(entryKey(i), makeEntry(i)));
+        }
+        QVERIFY(manager.flush());
+        QVERIFY(segmentExists(dir, 1));
+        QVERIFY(segmentExists(dir, 2));
+        const qint64 size = manager.size();
+
+        for (int i = 0; i < 5; ++i) {
+            manager.remove(entryKey(i));
+        }
+        QVERIFY(manager.flush());
+        QVERIFY(!segmentExists(dir, 1));
+        QVERIFY(manager.size() < size);
+        for (int i = 0; i < 8; ++i) {
+            QVERIFY2(manager.load(entryKey(i)) == (i < 5 ? QByteArray() : makeEntry(i)), qPrintable(entryKey(i)));
+        }
+    }
+    TestDiskCacheManager manager(dir.path());
+    for (int i = 0; i < 8; ++i) {
+        QVERIFY2(manager.load(entryKey(i)) == (i < 5 ? QByteArray() : makeEntry(i)), qPrintable(entryKey(i)));
+    }
+}
+
+// the oldest segment is dropped as a whole once maxSize is exceeded.
+void TestHttpCache::testDiskEviction()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDiskCacheManager manager(dir.path());
+    manager.setMaxSize(1024 * 1024 * 32);
+    QCOMPARE(manager.maxSize(), Q_INT64_C(1024 * 1024 * 32));
+    QVERIFY(!manager.store(entryKey(100), QByteArray(1024 * 1024 * 16 + 1, 'x')));
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(manager.store(entryKey(i), makeEntry(i)));
+        QVERIFY(manager.flush());
+    }
+    QVERIFY(manager.size() <= manager.maxSize());
+    QVERIFY(!segmentExists(dir, 1));
+    for (int i = 0; i < 8; ++i) {
+        QVERIFY2(manager.load(entryKey(i)).isEmpty(), qPrintable(entryKey(i)));
+    }
+    QCOMPARE(manager.load(entryKey(8)), makeEntry(8));
+    QCOMPARE(manager.load(entryKey(9)), makeEntry(9));
+}
+
+QTEST_MAIN(TestHttpCache)
+
+#include "test_http_cache.moc"
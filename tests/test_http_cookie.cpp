@@ -0,0 +1,173 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+static HttpCookie makeCookie(const QByteArray &name, const QByteArray &value, const QString &domain = QString(),
+                             const QString &path = QString())
+{
+    HttpCookie cookie(name, value);
+    cookie.setDomain(domain);
+    cookie.setPath(path);
+    return cookie;
+}
+
+static QUrl url(const char *s)
+{
+    return QUrl(QString::fromLatin1(s));
+}
+
+class TestHttpCookie : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testHeaderCacheInvalidated();
+    void testHeaderCacheExpired();
+    void testDomainCookie_data();
+    void testDomainCookie();
+    void testIPLiteralHost_data();
+    void testIPLiteralHost();
+    void testPathPrefix_data();
+    void testPathPrefix();
+};
+
+// the cached header of a url is dropped once the cookies of its domain are changed.
+void TestHttpCookie::testHeaderCacheInvalidated()
+{
+    HttpCookieJar jar;
+    const QUrl &page = url("http://www.example.com/index.html");
+    QCOMPARE(jar.cookieHeaderForUrl(page), QByteArray());
+    QVERIFY(jar.setCookiesFromUrl(QList<HttpCookie>() << makeCookie("a", "1"), page));
+    QCOMPARE(jar.cookieHeaderForUrl(page), QByteArray("a=1"));
+
+    QVERIFY(jar.setCookiesFromUrl(QList<HttpCookie>() << makeCookie("b", "2"), page));
+    QCOMPARE(jar.cookieHeaderForUrl(page), QByteArray("a=1; b=2"));
+    QCOMPARE(jar.cookiesForUrl(page).size(), 2);
+
+    // replaced, so it is moved after the others of the same path.
+    QVERIFY(jar.setCookiesFromUrl(QList<HttpCookie>() << makeCookie("a", "3"), page));
+    QCOMPARE(jar.cookieHeaderForUrl(page), QByteArray("b=2; a=3"));
+
+    HttpCookie expired = makeCookie("b", "");
+    expired.setExpirationDate(QDateTime::currentDateTimeUtc().addSecs(-60));
+    QVERIFY(!jar.setCookiesFromUrl(QList<HttpCookie>() << expired, page));
+    QCOMPARE(jar.cookieHeaderForUrl(page), QByteArray("a=3"));
+
+    // the other domain sharing the bucket.
+    QVERIFY(jar.setCookiesFromUrl(QList<HttpCookie>() << makeCookie("c", "4"), url("http://api.example.com/")));
+    QCOMPARE(jar.cookieHeaderForUrl(page), QByteArray("a=3"));
+}
+
+// the cached header is used until the first cookie in it expires.
+void TestHttpCookie::testHeaderCacheExpired()
+{
+    HttpCookieJar jar;
+    const QUrl &page = url("http://www.example.com/");
+    HttpCookie shortLived = makeCookie("short", "1");
+    shortLived.setExpirationDate(QDateTime::currentDateTimeUtc().addMSecs(500));
+    HttpCookie longLived = makeCookie("long", "2");
+    longLived.setExpirationDate(QDateTime::currentDateTimeUtc().addSecs(3600));
+    QVERIFY(jar.setCookiesFromUrl(QList<HttpCookie>() << shortLived << longLived << makeCookie("session", "3"),
+                                  page));
+    QCOMPARE(jar.cookieHeaderForUrl(page), QByteArray("short=1; long=2; session=3"));
+    QThread::msleep(600);
+    QCOMPARE(jar.cookieHeaderForUrl(page), QByteArray("long=2; session=3"));
+    QCOMPARE(jar.cookiesForUrl(page).size(), 2);
+}
+
+void TestHttpCookie::testDomainCookie_data()
+{
+    QTest::addColumn<QUrl>("target");
+    QTest::addColumn<QByteArray>("header");
+    QTest::newRow("setter") << url("http://www.example.com/") << QByteArray("domain=1; host=2");
+    QTest::newRow("sibling") << url("http://api.example.com/") << QByteArray("domain=1");
+    QTest::newRow("deeper") << url("http://a.b.example.com/") << QByteArray("domain=1");
+    QTest::newRow("parent") << url("http://example.com/") << QByteArray("domain=1");
+    QTest::newRow("upper case") << url("http://API.Example.COM/") << QByteArray("domain=1");
+    QTest::newRow("same suffix") << url("http://badexample.com/") << QByteArray();
+    QTest::newRow("other") << url("http://example.org/") << QByteArray();
+}
+
+// the cookie with Domain attribute is shared by all subdomains, while the host-only one is not.
+void TestHttpCookie::testDomainCookie()
+{
+    QFETCH(QUrl, target);
+    QFETCH(QByteArray, header);
+
+    HttpCookieJar jar;
+    const QUrl &setter = url("http://www.example.com/");
+    QVERIFY(jar.setCookiesFromUrl(QList<HttpCookie>() << makeCookie("domain", "1", QString::fromLatin1("example.com"))
+                                                      << makeCookie("host", "2"),
+                                  setter));
+    // the top level domain is rejected.
+    QVERIFY(!jar.setCookiesFromUrl(QList<HttpCookie>() << makeCookie("tld", "3", QString::fromLatin1("com")), setter));
+    QCOMPARE(jar.cookieHeaderForUrl(target), header);
+}
+
+void TestHttpCookie::testIPLiteralHost_data()
+{
+    QTest::addColumn<QUrl>("setter");
+    QTest::addColumn<QString>("domain");
+    QTest::addColumn<bool>("accepted");
+    QTest::addColumn<QUrl>("target");
+    QTest::addColumn<QByteArray>("header");
+    QTest::newRow("host only") << url("http://192.168.1.10/") << QString() << true << url("http://192.168.1.10/a")
+                               << QByteArray("ip=1");
+    QTest::newRow("same address") << url("http://192.168.1.10/") << QString::fromLatin1("192.168.1.10") << true
+                                  << url("http://192.168.1.10/") << QByteArray("ip=1");
+    // shares the bucket of the last two labels.
+    QTest::newRow("suffix address") << url("http://192.168.1.10/") << QString() << true << url("http://2.168.1.10/")
+                                    << QByteArray();
+    QTest::newRow("suffix domain") << url("http://192.168.1.10/") << QString::fromLatin1(".168.1.10") << false
+                                   << url("http://2.168.1.10/") << QByteArray();
+    QTest::newRow("ipv6") << url("http://[::1]:8080/") << QString() << true << url("http://[::1]/")
+                          << QByteArray("ip=1");
+    QTest::newRow("other ipv6") << url("http://[::1]/") << QString() << true << url("http://[::2]/") << QByteArray();
+}
+
+// rfc 6265 section 5.1.3, the ip addresses are never matched by suffix.
+void TestHttpCookie::testIPLiteralHost()
+{
+    QFETCH(QUrl, setter);
+    QFETCH(QString, domain);
+    QFETCH(bool, accepted);
+    QFETCH(QUrl, target);
+    QFETCH(QByteArray, header);
+
+    HttpCookieJar jar;
+    QCOMPARE(jar.setCookiesFromUrl(QList<HttpCookie>() << makeCookie("ip", "1", domain), setter), accepted);
+    QCOMPARE(jar.cookieHeaderForUrl(target), header);
+}
+
+void TestHttpCookie::testPathPrefix_data()
+{
+    QTest::addColumn<QUrl>("target");
+    QTest::addColumn<QByteArray>("header");
+    QTest::newRow("same path") << url("http://example.com/docs") << QByteArray("docs=1; root=2");
+    QTest::newRow("directory") << url("http://example.com/docs/") << QByteArray("docs=1; root=2");
+    QTest::newRow("deeper") << url("http://example.com/docs/web/index.html")
+                            << QByteArray("web=3; docs=1; root=2");
+    QTest::newRow("not a segment") << url("http://example.com/docsets") << QByteArray("root=2");
+    QTest::newRow("parent") << url("http://example.com/") << QByteArray("root=2");
+    QTest::newRow("case sensitive") << url("http://example.com/Docs") << QByteArray("root=2");
+}
+
+// rfc 6265 section 5.1.4, the cookie path is a prefix ending at a slash, and the longer paths are sent first.
+void TestHttpCookie::testPathPrefix()
+{
+    QFETCH(QUrl, target);
+    QFETCH(QByteArray, header);
+
+    HttpCookieJar jar;
+    const QUrl &setter = url("http://example.com/docs/web/");
+    const QList<HttpCookie> cookies = QList<HttpCookie>()
+            << makeCookie("root", "2", QString(), QString::fromLatin1("/"))
+            << makeCookie("docs", "1", QString(), QString::fromLatin1("/docs"))
+            << makeCookie("web", "3");  // the default path is the directory of setter.
+    QVERIFY(jar.setCookiesFromUrl(cookies, setter));
+    QCOMPARE(jar.cookieHeaderForUrl(target), header);
+}
+
+QTEST_MAIN(TestHttpCookie)
+
+#include "test_http_cookie.moc"
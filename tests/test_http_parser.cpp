@@ -0,0 +1,241 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+#include "../include/private/http_parser_p.h"
+
+using namespace qtng;
+
+static QByteArray sliceOf(const QByteArray &buf, const HttpSlice &slice)
+{
+    return buf.mid(slice.offset, slice.length);
+}
+
+// the result and every slice in one string, so the two paths are compared by QCOMPARE.
+static QByteArray describe(const QByteArray &buf, bool request)
+{
+    HttpSlice method = { 0, 0 };
+    HttpSlice path = { 0, 0 };
+    HttpSlice message = { 0, 0 };
+    HttpHeaderSlice headers[16];
+    int numHeaders = 16;
+    int minorVersion = -2;
+    int statusCode = 0;
+    int r;
+    if (request) {
+        r = parseHttpRequestHead(buf.constData(), buf.size(), &method, &path, &minorVersion, headers, &numHeaders);
+    } else {
+        r = parseHttpResponseHead(buf.constData(), buf.size(), &minorVersion, &statusCode, &message, headers,
+                                  &numHeaders);
+    }
+    QByteArray result = QByteArray::number(r);
+    if (r < 0) {
+        return result;
+    }
+    if (request) {
+        result += " " + sliceOf(buf, method) + " " + sliceOf(buf, path);
+    } else {
+        result += " " + QByteArray::number(statusCode) + " " + sliceOf(buf, message);
+    }
+    result += " 1." + QByteArray::number(minorVersion);
+    for (int i = 0; i < numHeaders; ++i) {
+        result += "\n" + sliceOf(buf, headers[i].name) + ": " + sliceOf(buf, headers[i].value) + " ("
+                + QByteArray::number(headers[i].knownHeader) + ")";
+    }
+    return result;
+}
+
+static QByteArray describeScalar(const QByteArray &buf, bool request)
+{
+    setHttpParserSimdEnabled(false);
+    const QByteArray &result = describe(buf, request);
+    setHttpParserSimdEnabled(true);
+    return result;
+}
+
+// the headers are longer than 16 bytes, so the sse4.2 path skips some of them.
+static const char longRequest[] = "GET /index.html?name=value&other=value HTTP/1.1\r\n"
+                                  "Host: www.example.com\r\n"
+                                  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+                                  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                                  "X-A-Rather-Long-Custom-Header-Name: \tvalue with\ttabs and trailing spaces  \r\n"
+                                  "Empty:\r\n"
+                                  "\r\n";
+
+static const char longResponse[] = "HTTP/1.1 200 OK, and a long reason phrase\r\n"
+                                   "Content-Type: application/json; charset=utf-8\r\n"
+                                   "Content-Length: 1234\r\n"
+                                   "Set-Cookie: session=0123456789abcdef0123456789abcdef; Path=/; HttpOnly\r\n"
+                                   "\r\n";
+
+class TestHttpParser : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void testSplitAtEveryByte_data();
+    void testSplitAtEveryByte();
+    void testLineEnds_data();
+    void testLineEnds();
+    void testObsoleteLineFolding_data();
+    void testObsoleteLineFolding();
+    void testInvalidTokenChars();
+    void testInvalidValueChars();
+};
+
+void TestHttpParser::initTestCase()
+{
+    if (!setHttpParserSimdEnabled(true)) {
+        qDebug() << "the build has no sse4.2 path, only the scalar path is tested.";
+    }
+}
+
+void TestHttpParser::testSplitAtEveryByte_data()
+{
+    QTest::addColumn<QByteArray>("head");
+    QTest::addColumn<bool>("request");
+    QTest::newRow("request") << QByteArray(longRequest) << true;
+    QTest::newRow("response") << QByteArray(longResponse) << false;
+    QTest::newRow("lf request") << QByteArray(longRequest).replace("\r\n", "\n") << true;
+    QTest::newRow("lf response") << QByteArray(longResponse).replace("\r\n", "\n") << false;
+    QTest::newRow("empty lines before request") << QByteArray("\r\n\r\n").append(longRequest) << true;
+}
+
+// a head received piece by piece is incomplete until its last byte.
+void TestHttpParser::testSplitAtEveryByte()
+{
+    QFETCH(QByteArray, head);
+    QFETCH(bool, request);
+    const QByteArray &incomplete = QByteArray::number(HttpParseIncomplete);
+    for (int i = 0; i < head.size(); ++i) {
+        const QByteArray &part = head.left(i);
+        QCOMPARE(describe(part, request), incomplete);
+        QCOMPARE(describeScalar(part, request), incomplete);
+    }
+    const QByteArray &withBody = head + "the body, which is not parsed";
+    const QByteArray &simd = describe(withBody, request);
+    QCOMPARE(simd, describeScalar(withBody, request));
+    QVERIFY(simd.startsWith(QByteArray::number(head.size()) + " "));
+}
+
+void TestHttpParser::testLineEnds_data()
+{
+    QTest::addColumn<QByteArray>("head");
+    QTest::addColumn<bool>("request");
+    QTest::addColumn<QByteArray>("expected");
+    QTest::newRow("crlf") << QByteArray("GET /path HTTP/1.1\r\nHost: example.com\r\nX-Custom-Header-Name: v\r\n\r\n")
+                          << true << QByteArray("GET /path 1.1\nHost: example.com (23)\nX-Custom-Header-Name: v (-1)");
+    QTest::newRow("lf") << QByteArray("GET /path HTTP/1.1\nHost: example.com\nX-Custom-Header-Name: v\n\n") << true
+                        << QByteArray("GET /path 1.1\nHost: example.com (23)\nX-Custom-Header-Name: v (-1)");
+    QTest::newRow("mixed") << QByteArray("GET /path HTTP/1.1\nHost: example.com\r\nX-Custom-Header-Name: v\n\r\n")
+                           << true << QByteArray("GET /path 1.1\nHost: example.com (23)\nX-Custom-Header-Name: v (-1)");
+    QTest::newRow("lf response") << QByteArray("HTTP/1.0 404 Not Found\nContent-Length: 0\n\n") << false
+                                 << QByteArray("404 Not Found 1.0\nContent-Length: 0 (1)");
+    QTest::newRow("http/0.9") << QByteArray("GET /path\n\n") << true << QByteArray("GET /path 1.-1");
+    // a bare CR is not a line end.
+    QTest::newRow("bare cr") << QByteArray("GET /path HTTP/1.1\rHost: example.com\r\n\r\n") << true
+                             << QByteArray();
+    QTest::newRow("bare cr after header")
+            << QByteArray("GET /path HTTP/1.1\r\nX-Custom-Header-Name: value value value\rX: y\r\n\r\n") << true
+            << QByteArray();
+}
+
+void TestHttpParser::testLineEnds()
+{
+    QFETCH(QByteArray, head);
+    QFETCH(bool, request);
+    QFETCH(QByteArray, expected);
+    const QByteArray &simd = describe(head, request);
+    QCOMPARE(simd, describeScalar(head, request));
+    if (expected.isEmpty()) {
+        QCOMPARE(simd, QByteArray::number(HttpParseError));
+    } else {
+        QCOMPARE(simd, QByteArray::number(head.size()) + " " + expected);
+    }
+}
+
+void TestHttpParser::testObsoleteLineFolding_data()
+{
+    QTest::addColumn<QByteArray>("head");
+    QTest::addColumn<bool>("request");
+    QTest::newRow("space") << QByteArray("GET / HTTP/1.1\r\nX-Folded-Header-Name: first\r\n second\r\n\r\n") << true;
+    QTest::newRow("tab") << QByteArray("GET / HTTP/1.1\r\nX-Folded-Header-Name: first\r\n\tsecond\r\n\r\n") << true;
+    QTest::newRow("lf") << QByteArray("GET / HTTP/1.1\nX-Folded-Header-Name: first\n second\n\n") << true;
+    QTest::newRow("response") << QByteArray("HTTP/1.1 200 OK\r\nContent-Type: text/plain;\r\n charset=utf-8\r\n\r\n")
+                              << false;
+    QTest::newRow("first header") << QByteArray("GET / HTTP/1.1\r\n Host: example.com\r\n\r\n") << true;
+}
+
+// rfc 7230 3.2.4, the obsolete line folding is rejected.
+void TestHttpParser::testObsoleteLineFolding()
+{
+    QFETCH(QByteArray, head);
+    QFETCH(bool, request);
+    const QByteArray &error = QByteArray::number(HttpParseError);
+    QCOMPARE(describe(head, request), error);
+    QCOMPARE(describeScalar(head, request), error);
+}
+
+// every delimiter of rfc 7230 3.2.6, spaces, controls, DEL and the 8 bit bytes, in and after the first 16 bytes.
+void TestHttpParser::testInvalidTokenChars()
+{
+    const QByteArray invalid = QByteArray("\"(),/;<=>?@[\\]{} \t\x01\x1f\x7f\x80\xff", 23) + QByteArray(1, '\0');
+    const QByteArray &error = QByteArray::number(HttpParseError);
+    const QByteArray name(40, 'n');
+    const QByteArray method(24, 'M');
+    for (char c : invalid) {
+        for (int pos : { 0, 5, 15, 16, 17, 31, 39 }) {
+            QByteArray badName = name;
+            badName[pos] = c;
+            const QByteArray &head = "GET / HTTP/1.1\r\n" + badName + ": value\r\n\r\n";
+            QCOMPARE(describe(head, true), error);
+            QCOMPARE(describeScalar(head, true), error);
+            const QByteArray &response = "HTTP/1.1 200 OK\r\n" + badName + ": value\r\n\r\n";
+            QCOMPARE(describe(response, false), error);
+            QCOMPARE(describeScalar(response, false), error);
+            if (pos >= method.size() || c == ' ') {
+                continue;
+            }
+            QByteArray badMethod = method;
+            badMethod[pos] = c;
+            const QByteArray &request = badMethod + " / HTTP/1.1\r\n\r\n";
+            QCOMPARE(describe(request, true), error);
+            QCOMPARE(describeScalar(request, true), error);
+        }
+    }
+    // all tchars are fine.
+    const QByteArray &tchars = "!#$%&'*+-.^_`|~0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const QByteArray &head = "GET / HTTP/1.1\r\n" + tchars + ": value\r\n\r\n";
+    const QByteArray &simd = describe(head, true);
+    QCOMPARE(simd, describeScalar(head, true));
+    QCOMPARE(simd, QByteArray::number(head.size()) + " GET / 1.1\n" + tchars + ": value (-1)");
+}
+
+// controls but tab, and DEL are not allowed in values, the 8 bit bytes are.
+void TestHttpParser::testInvalidValueChars()
+{
+    const QByteArray &error = QByteArray::number(HttpParseError);
+    const QByteArray value(40, 'v');
+    for (char c : QByteArray("\x01\x08\x0b\x1f\x7f", 5) + QByteArray(1, '\0')) {
+        for (int pos : { 0, 15, 16, 17, 39 }) {
+            QByteArray badValue = value;
+            badValue[pos] = c;
+            const QByteArray &head = "GET / HTTP/1.1\r\nX-Header: " + badValue + "\r\n\r\n";
+            QCOMPARE(describe(head, true), error);
+            QCOMPARE(describeScalar(head, true), error);
+            const QByteArray &response = "HTTP/1.1 200 " + badValue + "\r\n\r\n";
+            QCOMPARE(describe(response, false), error);
+            QCOMPARE(describeScalar(response, false), error);
+        }
+    }
+    for (char c : QByteArray("\t\x80\xff", 3)) {
+        QByteArray goodValue = value;
+        goodValue[20] = c;
+        const QByteArray &head = "GET / HTTP/1.1\r\nX-Header: " + goodValue + "\r\n\r\n";
+        const QByteArray &simd = describe(head, true);
+        QCOMPARE(simd, describeScalar(head, true));
+        QCOMPARE(simd, QByteArray::number(head.size()) + " GET / 1.1\nX-Header: " + goodValue + " (-1)");
+    }
+}
+
+QTEST_MAIN(TestHttpParser)
+
+#include "test_http_parser.moc"
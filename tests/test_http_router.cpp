@@ -0,0 +1,187 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+class TestHttpRouter : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testInvalidPatterns();
+    void testPrecedence_data();
+    void testPrecedence();
+    void testBacktracking();
+    void testMethods();
+    void testPercentDecoding_data();
+    void testPercentDecoding();
+};
+
+// the parameters occupy whole segments, the rest is the last one, and the same node can not be named twice.
+void TestHttpRouter::testInvalidPatterns()
+{
+    HttpRouteTree tree;
+    QVERIFY(!tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("users"), 0));
+    QVERIFY(!tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/users:id"), 0));
+    QVERIFY(!tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/users/:"), 0));
+    QVERIFY(!tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/files/*"), 0));
+    QVERIFY(!tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/files/*path/info"), 0));
+    QVERIFY(!tree.insert(QString(), QString::fromLatin1("/users"), 0));
+    QVERIFY(!tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/users"), -1));
+
+    QVERIFY(tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/users/:id"), 0));
+    QVERIFY(!tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/users/:id"), 1));
+    QVERIFY(!tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/users/:name/posts"), 1));
+    QVERIFY(tree.insert(QString::fromLatin1("POST"), QString::fromLatin1("/users/:id"), 1));
+    QVERIFY(tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/users/:id/posts"), 2));
+}
+
+void TestHttpRouter::testPrecedence_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<int>("id");
+    QTest::addColumn<QString>("params");
+    QTest::newRow("root") << QString::fromLatin1("/") << 0 << QString();
+    QTest::newRow("static") << QString::fromLatin1("/users/new") << 1 << QString();
+    QTest::newRow("param") << QString::fromLatin1("/users/42") << 2 << QString::fromLatin1("id=42");
+    QTest::newRow("static prefix of param") << QString::fromLatin1("/users/newer") << 2
+                                            << QString::fromLatin1("id=newer");
+    QTest::newRow("rest") << QString::fromLatin1("/users/42/posts/7") << 3 << QString::fromLatin1("rest=42/posts/7");
+    QTest::newRow("nested static") << QString::fromLatin1("/users/42/profile") << 4 << QString::fromLatin1("id=42");
+    QTest::newRow("two params") << QString::fromLatin1("/users/42/friends/7") << 5
+                                << QString::fromLatin1("id=42,friend=7");
+    QTest::newRow("empty rest") << QString::fromLatin1("/users/") << 3 << QString::fromLatin1("rest=");
+    QTest::newRow("query") << QString::fromLatin1("/users/42?tab=posts") << 2 << QString::fromLatin1("id=42");
+    QTest::newRow("not found") << QString::fromLatin1("/groups") << -1 << QString();
+    QTest::newRow("trailing slash") << QString::fromLatin1("/users/new/") << 3 << QString::fromLatin1("rest=new/");
+}
+
+// static routes are preferred to parameters, and parameters to the rest.
+void TestHttpRouter::testPrecedence()
+{
+    QFETCH(QString, path);
+    QFETCH(int, id);
+    QFETCH(QString, params);
+
+    HttpRouteTree tree;
+    const QString get = QString::fromLatin1("GET");
+    QVERIFY(tree.insert(get, QString::fromLatin1("/"), 0));
+    QVERIFY(tree.insert(get, QString::fromLatin1("/users/new"), 1));
+    QVERIFY(tree.insert(get, QString::fromLatin1("/users/:id"), 2));
+    QVERIFY(tree.insert(get, QString::fromLatin1("/users/*rest"), 3));
+    QVERIFY(tree.insert(get, QString::fromLatin1("/users/:id/profile"), 4));
+    QVERIFY(tree.insert(get, QString::fromLatin1("/users/:id/friends/:friend"), 5));
+
+    HttpRouteParams result;
+    QCOMPARE(tree.match(get, path, &result), id);
+    QStringList l;
+    for (const QPair<QString, QString> &param : result.params) {
+        l.append(param.first + QLatin1Char('=') + param.second);
+    }
+    QCOMPARE(l.join(QLatin1Char(',')), params);
+}
+
+// a static branch which matches the prefix but fails later gives way to the parameters and the rest.
+void TestHttpRouter::testBacktracking()
+{
+    HttpRouteTree tree;
+    const QString get = QString::fromLatin1("GET");
+    QVERIFY(tree.insert(get, QString::fromLatin1("/api/users/:id/profile"), 0));
+    QVERIFY(tree.insert(get, QString::fromLatin1("/api/:resource/:id"), 1));
+    QVERIFY(tree.insert(get, QString::fromLatin1("/static/css/:file"), 2));
+    QVERIFY(tree.insert(get, QString::fromLatin1("/static/*path"), 3));
+
+    HttpRouteParams params;
+    QCOMPARE(tree.match(get, QString::fromLatin1("/api/users/7/profile"), &params), 0);
+    QCOMPARE(params.size(), 1);
+    QCOMPARE(params.value(QString::fromLatin1("id")), QString::fromLatin1("7"));
+
+    // the id captured in the failed static branch is dropped.
+    params = HttpRouteParams();
+    QCOMPARE(tree.match(get, QString::fromLatin1("/api/users/7"), &params), 1);
+    QCOMPARE(params.size(), 2);
+    QCOMPARE(params.params.at(0), qMakePair(QString::fromLatin1("resource"), QString::fromLatin1("users")));
+    QCOMPARE(params.params.at(1), qMakePair(QString::fromLatin1("id"), QString::fromLatin1("7")));
+
+    params = HttpRouteParams();
+    QCOMPARE(tree.match(get, QString::fromLatin1("/static/css/site.css"), &params), 2);
+    QCOMPARE(params.value(QString::fromLatin1("file")), QString::fromLatin1("site.css"));
+
+    params = HttpRouteParams();
+    QCOMPARE(tree.match(get, QString::fromLatin1("/static/css/vendor/site.css"), &params), 3);
+    QCOMPARE(params.size(), 1);
+    QCOMPARE(params.value(QString::fromLatin1("path")), QString::fromLatin1("css/vendor/site.css"));
+
+    // the parameters are never empty.
+    params = HttpRouteParams();
+    QCOMPARE(tree.match(get, QString::fromLatin1("/api/users/"), &params), -1);
+    QVERIFY(params.isEmpty());
+    QCOMPARE(tree.match(get, QString::fromLatin1("/api//7"), &params), -1);
+    QVERIFY(params.isEmpty());
+}
+
+void TestHttpRouter::testMethods()
+{
+    HttpRouteTree tree;
+    QVERIFY(tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/users/:id"), 0));
+    QVERIFY(tree.insert(QString::fromLatin1("DELETE"), QString::fromLatin1("/users/:id"), 1));
+    QVERIFY(tree.insert(QString::fromLatin1("POST"), QString::fromLatin1("/users"), 2));
+
+    HttpRouteParams params;
+    QStringList allowed;
+    QCOMPARE(tree.match(QString::fromLatin1("DELETE"), QString::fromLatin1("/users/1"), &params, &allowed), 1);
+    QVERIFY(allowed.isEmpty());
+    QCOMPARE(tree.match(QString::fromLatin1("HEAD"), QString::fromLatin1("/users/1"), &params, &allowed), 0);
+
+    QCOMPARE(tree.match(QString::fromLatin1("PUT"), QString::fromLatin1("/users/1"), &params, &allowed), -1);
+    QCOMPARE(allowed, QStringList() << QString::fromLatin1("GET") << QString::fromLatin1("DELETE"));
+    QVERIFY(params.isEmpty());
+
+    allowed.clear();
+    QCOMPARE(tree.match(QString::fromLatin1("GET"), QString::fromLatin1("/users"), &params, &allowed), -1);
+    QCOMPARE(allowed, QStringList() << QString::fromLatin1("POST"));
+
+    // not found at all.
+    allowed.clear();
+    QCOMPARE(tree.match(QString::fromLatin1("GET"), QString::fromLatin1("/groups"), &params, &allowed), -1);
+    QVERIFY(allowed.isEmpty());
+    QCOMPARE(tree.match(QString::fromLatin1("GET"), QString::fromLatin1("/users/1"), nullptr), 0);
+}
+
+void TestHttpRouter::testPercentDecoding_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<int>("id");
+    QTest::addColumn<QString>("value");
+    QTest::newRow("utf8") << QString::fromLatin1("/users/J%C3%BCrgen") << 0 << QString::fromUtf8("J\xc3\xbcrgen");
+    QTest::newRow("space") << QString::fromLatin1("/users/a%20b") << 0 << QString::fromLatin1("a b");
+    // the path is matched before decoding, so an encoded slash stays in the segment.
+    QTest::newRow("slash") << QString::fromLatin1("/users/a%2Fb") << 0 << QString::fromLatin1("a/b");
+    QTest::newRow("plus") << QString::fromLatin1("/users/a+b") << 0 << QString::fromLatin1("a+b");
+    QTest::newRow("rest") << QString::fromLatin1("/files/a%20b/c%25d") << 1 << QString::fromLatin1("a b/c%d");
+    // the static parts are compared as they are.
+    QTest::newRow("encoded static") << QString::fromLatin1("/%75sers/1") << -1 << QString();
+}
+
+void TestHttpRouter::testPercentDecoding()
+{
+    QFETCH(QString, path);
+    QFETCH(int, id);
+    QFETCH(QString, value);
+
+    HttpRouteTree tree;
+    QVERIFY(tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/users/:name"), 0));
+    QVERIFY(tree.insert(QString::fromLatin1("GET"), QString::fromLatin1("/files/*path"), 1));
+
+    HttpRouteParams params;
+    QCOMPARE(tree.match(QString::fromLatin1("GET"), path, &params), id);
+    if (id < 0) {
+        QVERIFY(params.isEmpty());
+    } else {
+        QCOMPARE(params.size(), 1);
+        QCOMPARE(params.params.at(0).second, value);
+    }
+}
+
+QTEST_MAIN(TestHttpRouter)
+
+#include "test_http_router.moc"
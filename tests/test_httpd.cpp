@@ -0,0 +1,423 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+// echoes the body of POST, and the path of GET.
+class EchoHttpRequestHandler : public BaseHttpRequestHandler
+{
+protected:
+    virtual void doGET() override { reply(path.toLatin1()); }
+    virtual void doPOST() override
+    {
+        if (readBody()) {
+            reply(body);
+        }
+    }
+private:
+    void reply(const QByteArray &data)
+    {
+        sendResponse(HttpStatus::OK);
+        sendHeader(QByteArray("Content-Length"), QByteArray::number(data.size()));
+        if (endHeader() && request->sendall(data) != data.size()) {
+            request->close();
+        }
+    }
+};
+
+// returns all bytes received until the peer closes the connection, or nothing if it does not in 5 seconds.
+static QByteArray recvAll(Socket *client)
+{
+    QByteArray received;
+    try {
+        Timeout timeout(5.0);
+        while (true) {
+            const QByteArray &buf = client->recv(1024 * 8);
+            if (buf.isEmpty()) {
+                break;
+            }
+            received.append(buf);
+        }
+    } catch (TimeoutException &) {
+        return QByteArray();
+    }
+    return received;
+}
+
+// sends the raw request, and returns all bytes received until the server closes the connection.
+static QByteArray exchange(quint16 port, const QByteArray &data)
+{
+    Socket client;
+    if (!client.connect(HostAddress::LocalHost, port) || client.sendall(data) != data.size()) {
+        return QByteArray();
+    }
+    return recvAll(&client);
+}
+
+// returns the bytes received till the end of a head, or nothing if it is not received in 5 seconds.
+static QByteArray recvHead(Socket *client)
+{
+    QByteArray received;
+    try {
+        Timeout timeout(5.0);
+        while (!received.contains("\r\n\r\n")) {
+            const QByteArray &buf = client->recv(1024);
+            if (buf.isEmpty()) {
+                return QByteArray();
+            }
+            received.append(buf);
+        }
+    } catch (TimeoutException &) {
+        return QByteArray();
+    }
+    return received;
+}
+
+struct RawResponse
+{
+    int statusCode;
+    QMap<QByteArray, QByteArray> headers;  // by lower case names.
+    QByteArray body;
+};
+
+// splits the responses received. the body is read by Content-Length, or till the end if it is not sent.
+static QList<RawResponse> parseResponses(const QByteArray &data)
+{
+    QList<RawResponse> responses;
+    int pos = 0;
+    while (pos < data.size()) {
+        const int headEnd = data.indexOf("\r\n\r\n", pos);
+        if (headEnd < 0) {
+            break;
+        }
+        const QList<QByteArray> &lines = data.mid(pos, headEnd - pos).split('\n');
+        RawResponse response;
+        response.statusCode = lines.first().split(' ').value(1).toInt();
+        for (int i = 1; i < lines.size(); ++i) {
+            const int colon = lines.at(i).indexOf(':');
+            if (colon > 0) {
+                const QByteArray &name = lines.at(i).left(colon).trimmed().toLower();
+                response.headers.insert(name, lines.at(i).mid(colon + 1).trimmed());
+            }
+        }
+        pos = headEnd + 4;
+        if (response.statusCode >= 200 && response.statusCode != 204 && response.statusCode != 304) {
+            bool ok;
+            const int contentLength = response.headers.value("content-length").toInt(&ok);
+            response.body = ok ? data.mid(pos, contentLength) : data.mid(pos);
+            pos += response.body.size();
+        }
+        responses.append(response);
+    }
+    return responses;
+}
+
+// binary, so it is served as application/octet-stream.
+static QByteArray makeFileData()
+{
+    QByteArray data;
+    for (int i = 0; i < 100; ++i) {
+        data.append(static_cast<char>(i * 37 + 11));
+    }
+    return data;
+}
+
+static QString &staticRoot()
+{
+    static QString root;
+    return root;
+}
+
+// serves data.bin in a temporary directory.
+class RangeHttpRequestHandler : public SimpleHttpRequestHandler
+{
+public:
+    RangeHttpRequestHandler() { setRootDir(QDir(staticRoot())); }
+};
+
+class TestHttpd : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void testPipelinedAfterChunkedBody();
+    void testRanges_data();
+    void testRanges();
+    void testMultipartRanges_data();
+    void testMultipartRanges();
+    void testIfRange();
+    void testExpectContinue();
+    void testExpectRejected_data();
+    void testExpectRejected();
+    void testClientBodyRejected();
+private:
+    QList<RawResponse> getRange(const QByteArray &headers);
+private:
+    QTemporaryDir dir;
+};
+
+void TestHttpd::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    staticRoot() = dir.path();
+    QFile f(dir.filePath(QString::fromLatin1("data.bin")));
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    QCOMPARE(f.write(makeFileData()), Q_INT64_C(100));
+    f.close();
+}
+
+// the GET sent in the same write as the chunked POST is served after it, instead of waiting for keepAliveTimeout.
+void TestHttpd::testPipelinedAfterChunkedBody()
+{
+    TcpServer<EchoHttpRequestHandler> server(HostAddress::LocalHost, 18232);
+    QVERIFY(server.start());
+    const QByteArray requests("POST /echo HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n"
+                              "Transfer-Encoding: chunked\r\n\r\n"
+                              "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n"
+                              "GET /second HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+    const QByteArray &responses = exchange(18232, requests);
+    QCOMPARE(responses.count("HTTP/1.1 200"), 2);
+    const int first = responses.indexOf("hello world");
+    QVERIFY(first > 0);
+    QVERIFY(responses.indexOf("/second") > first);
+    server.stop();
+}
+
+QList<RawResponse> TestHttpd::getRange(const QByteArray &headers)
+{
+    TcpServer<RangeHttpRequestHandler> server(HostAddress::LocalHost, 18233);
+    if (!server.start()) {
+        return QList<RawResponse>();
+    }
+    const QByteArray &responses = exchange(18233, "GET /data.bin HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+                                                          + headers + "\r\n");
+    server.stop();
+    return parseResponses(responses);
+}
+
+void TestHttpd::testRanges_data()
+{
+    const QByteArray &data = makeFileData();
+    QTest::addColumn<QByteArray>("range");
+    QTest::addColumn<int>("statusCode");
+    QTest::addColumn<QByteArray>("contentRange");
+    QTest::addColumn<QByteArray>("body");
+    QTest::newRow("first bytes") << QByteArray("bytes=0-9") << 206 << QByteArray("bytes 0-9/100") << data.mid(0, 10);
+    QTest::newRow("one byte") << QByteArray("bytes=50-50") << 206 << QByteArray("bytes 50-50/100") << data.mid(50, 1);
+    QTest::newRow("suffix") << QByteArray("bytes=-10") << 206 << QByteArray("bytes 90-99/100") << data.mid(90);
+    QTest::newRow("suffix longer than file") << QByteArray("bytes=-200") << 206 << QByteArray("bytes 0-99/100")
+                                             << data;
+    QTest::newRow("open-ended") << QByteArray("bytes=95-") << 206 << QByteArray("bytes 95-99/100") << data.mid(95);
+    QTest::newRow("end past the file") << QByteArray("bytes=90-1000") << 206 << QByteArray("bytes 90-99/100")
+                                       << data.mid(90);
+    QTest::newRow("spaces") << QByteArray("bytes= 1 - 2 ") << 206 << QByteArray("bytes 1-2/100") << data.mid(1, 2);
+    // an unsatisfiable range is skipped if another one is satisfiable.
+    QTest::newRow("one of two out of bounds") << QByteArray("bytes=0-9,200-300") << 206
+                                              << QByteArray("bytes 0-9/100") << data.mid(0, 10);
+    // rfc 7233 section 4.4
+    QTest::newRow("start at the size") << QByteArray("bytes=100-") << 416 << QByteArray("bytes */100") << QByteArray();
+    QTest::newRow("out of bounds") << QByteArray("bytes=200-300") << 416 << QByteArray("bytes */100") << QByteArray();
+    QTest::newRow("empty suffix") << QByteArray("bytes=-0") << 416 << QByteArray("bytes */100") << QByteArray();
+    // the invalid header is ignored, and so are the overlapped ranges.
+    QTest::newRow("reversed") << QByteArray("bytes=5-1") << 200 << QByteArray() << data;
+    QTest::newRow("not bytes") << QByteArray("items=0-1") << 200 << QByteArray() << data;
+    QTest::newRow("no dash") << QByteArray("bytes=5") << 200 << QByteArray() << data;
+    QTest::newRow("overlapped") << QByteArray("bytes=0-9,5-14") << 200 << QByteArray() << data;
+    QTest::newRow("contained") << QByteArray("bytes=0-50,10-20") << 200 << QByteArray() << data;
+    QTest::newRow("overlapped suffix") << QByteArray("bytes=80-89,-15") << 200 << QByteArray() << data;
+}
+
+void TestHttpd::testRanges()
+{
+    QFETCH(QByteArray, range);
+    QFETCH(int, statusCode);
+    QFETCH(QByteArray, contentRange);
+    QFETCH(QByteArray, body);
+
+    const QList<RawResponse> &responses = getRange("Range: " + range + "\r\n");
+    QCOMPARE(responses.size(), 1);
+    const RawResponse &response = responses.first();
+    QCOMPARE(response.statusCode, statusCode);
+    QCOMPARE(response.headers.value("content-range"), contentRange);
+    QCOMPARE(response.headers.value("content-length"), QByteArray::number(body.size()));
+    QCOMPARE(response.body, body);
+    if (statusCode != 416) {
+        QCOMPARE(response.headers.value("accept-ranges"), QByteArray("bytes"));
+    }
+}
+
+void TestHttpd::testMultipartRanges_data()
+{
+    QTest::addColumn<QByteArray>("range");
+    QTest::addColumn<QList<int>>("bounds");
+    QTest::newRow("two") << QByteArray("bytes=0-4,10-14") << (QList<int>() << 0 << 4 << 10 << 14);
+    // the adjacent ranges are not overlapped, and they are not merged.
+    QTest::newRow("adjacent") << QByteArray("bytes=0-4,5-9") << (QList<int>() << 0 << 4 << 5 << 9);
+    QTest::newRow("open-ended") << QByteArray("bytes=90-,0-4") << (QList<int>() << 90 << 99 << 0 << 4);
+    QTest::newRow("suffix") << QByteArray("bytes=-5,10-10,20-29")
+                            << (QList<int>() << 95 << 99 << 10 << 10 << 20 << 29);
+}
+
+// rfc 7233 appendix a, the parts are sent in the order of request.
+void TestHttpd::testMultipartRanges()
+{
+    QFETCH(QByteArray, range);
+    QFETCH(QList<int>, bounds);
+    const QByteArray &data = makeFileData();
+
+    const QList<RawResponse> &responses = getRange("Range: " + range + "\r\n");
+    QCOMPARE(responses.size(), 1);
+    const RawResponse &response = responses.first();
+    QCOMPARE(response.statusCode, 206);
+    QVERIFY(!response.headers.contains("content-range"));
+    const QByteArray &contentType = response.headers.value("content-type");
+    QVERIFY(contentType.startsWith("multipart/byteranges; boundary="));
+    const QByteArray &boundary = contentType.mid(contentType.indexOf('=') + 1);
+    QVERIFY(!boundary.isEmpty());
+
+    QByteArray expected;
+    for (int i = 0; i < bounds.size(); i += 2) {
+        const QByteArray &contentRange = "bytes " + QByteArray::number(bounds.at(i)) + '-'
+                + QByteArray::number(bounds.at(i + 1)) + "/100";
+        expected.append(i == 0 ? "" : "\r\n");
+        expected.append("--" + boundary + "\r\nContent-Type: application/octet-stream\r\nContent-Range: " + contentRange
+                        + "\r\n\r\n");
+        expected.append(data.mid(bounds.at(i), bounds.at(i + 1) - bounds.at(i) + 1));
+    }
+    expected.append("\r\n--" + boundary + "--\r\n");
+    QCOMPARE(response.headers.value("content-length"), QByteArray::number(expected.size()));
+    QCOMPARE(response.body, expected);
+}
+
+// rfc 7233 section 3.2, the ranges are ignored unless If-Range matches the strong etag or the date.
+void TestHttpd::testIfRange()
+{
+    const QByteArray &data = makeFileData();
+    const QList<RawResponse> &full = getRange(QByteArray());
+    QCOMPARE(full.size(), 1);
+    QCOMPARE(full.first().statusCode, 200);
+    QCOMPARE(full.first().body, data);
+    const QByteArray &etag = full.first().headers.value("etag");
+    const QByteArray &lastModified = full.first().headers.value("last-modified");
+    QVERIFY(etag.startsWith('"'));
+    QVERIFY(!lastModified.isEmpty());
+
+    QList<RawResponse> responses = getRange("Range: bytes=0-9\r\nIf-Range: " + etag + "\r\n");
+    QCOMPARE(responses.size(), 1);
+    QCOMPARE(responses.first().statusCode, 206);
+    QCOMPARE(responses.first().body, data.left(10));
+
+    responses = getRange("Range: bytes=0-9\r\nIf-Range: " + lastModified + "\r\n");
+    QCOMPARE(responses.size(), 1);
+    QCOMPARE(responses.first().statusCode, 206);
+
+    for (const QByteArray &ifRange : { QByteArray("\"mismatched\""), "W/" + etag,
+                                       QByteArray("Thu, 01 Jan 1970 00:00:00 GMT") }) {
+        responses = getRange("Range: bytes=0-9\r\nIf-Range: " + ifRange + "\r\n");
+        QCOMPARE(responses.size(), 1);
+        QVERIFY2(responses.first().statusCode == 200, ifRange.constData());
+        QVERIFY(!responses.first().headers.contains("content-range"));
+        QCOMPARE(responses.first().body, data);
+    }
+}
+
+// the client waits for 100 Continue before sending the body, so it must be sent before the body is read.
+void TestHttpd::testExpectContinue()
+{
+    TcpServer<EchoHttpRequestHandler> server(HostAddress::LocalHost, 18234);
+    QVERIFY(server.start());
+    Socket client;
+    QVERIFY(client.connect(HostAddress::LocalHost, 18234));
+    const QByteArray head("POST /echo HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+                          "Expect: 100-continue\r\nContent-Length: 5\r\n\r\n");
+    QCOMPARE(client.sendall(head), head.size());
+    QCOMPARE(recvHead(&client), QByteArray("HTTP/1.1 100 Continue\r\n\r\n"));
+    QCOMPARE(client.sendall("hello"), 5);
+    const QList<RawResponse> &responses = parseResponses(recvAll(&client));
+    QCOMPARE(responses.size(), 1);
+    QCOMPARE(responses.first().statusCode, 200);
+    QCOMPARE(responses.first().body, QByteArray("hello"));
+    server.stop();
+}
+
+void TestHttpd::testExpectRejected_data()
+{
+    QTest::addColumn<QByteArray>("expect");
+    QTest::addColumn<QByteArray>("contentLength");
+    QTest::addColumn<int>("statusCode");
+    QTest::newRow("unknown expectation") << QByteArray("something-else") << QByteArray("5") << 417;
+    QTest::newRow("too large") << QByteArray("100-continue") << QByteArray("1000000000") << 413;
+}
+
+// the body may follow the head without waiting, so the connection is closed instead of parsing it as the next
+// request. the keep-alive connection is closed by the server, or recvAll() returns nothing.
+void TestHttpd::testExpectRejected()
+{
+    QFETCH(QByteArray, expect);
+    QFETCH(QByteArray, contentLength);
+    QFETCH(int, statusCode);
+
+    TcpServer<EchoHttpRequestHandler> server(HostAddress::LocalHost, 18234);
+    QVERIFY(server.start());
+    const QByteArray requests("POST /echo HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\nExpect: " + expect
+                              + "\r\nContent-Length: " + contentLength + "\r\n\r\nhello"
+                              "GET /second HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    const QByteArray &received = exchange(18234, requests);
+    QVERIFY(!received.contains("100 Continue"));
+    const QList<RawResponse> &responses = parseResponses(received);
+    QCOMPARE(responses.size(), 1);
+    QCOMPARE(responses.first().statusCode, statusCode);
+    QVERIFY(!received.contains("/second"));
+    server.stop();
+}
+
+// the server answers 413 to the head without reading the body. the client does not send the body, and does not
+// reuse the connection because the server does not know whether the body is coming.
+void TestHttpd::testClientBodyRejected()
+{
+    Socket server;
+    QVERIFY(server.bind(HostAddress::LocalHost, 0) && server.listen(10));
+    const quint16 port = server.localPort();
+    QSharedPointer<int> connections(new int(0));
+    QSharedPointer<QByteArray> unexpected(new QByteArray());
+    CoroutineGroup operations;
+    operations.spawn([&server, connections, unexpected] {
+        try {
+            Timeout timeout(20.0);
+            while (*connections < 2) {
+                QSharedPointer<Socket> request(server.accept());
+                if (request.isNull()) {
+                    return;
+                }
+                ++*connections;
+                const QByteArray &head = recvHead(request.data());
+                unexpected->append(head.mid(head.indexOf("\r\n\r\n") + 4));
+                const QByteArray response("HTTP/1.1 413 Payload Too Large\r\nConnection: keep-alive\r\n"
+                                          "Content-Length: 5\r\n\r\nnope!");
+                if (head.isEmpty() || request->sendall(response) != response.size()) {
+                    return;
+                }
+                // the body, or the next request if the connection is reused.
+                unexpected->append(recvAll(request.data()));
+            }
+        } catch (TimeoutException &) { }
+    });
+
+    HttpSession session;
+    const QString &url = QString::fromLatin1("http://127.0.0.1:%1/upload").arg(port);
+    for (int i = 0; i < 2; ++i) {
+        HttpRequest request(QString::fromLatin1("POST"), url);
+        request.setHeader(QString::fromLatin1("Expect"), QByteArray("100-continue"));
+        request.setBody(QByteArray("hello"));
+        HttpResponse response = session.send(request);
+        QCOMPARE(response.statusCode(), 413);
+        QCOMPARE(response.body(), QByteArray("nope!"));
+    }
+    operations.joinall();
+    QCOMPARE(*connections, 2);
+    QCOMPARE(*unexpected, QByteArray());
+}
+
+QTEST_MAIN(TestHttpd)
+
+#include "test_httpd.moc"
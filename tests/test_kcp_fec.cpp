@@ -0,0 +1,252 @@
+#include <functional>
+#include <QtTest>
+#include "qtnetworkng.h"
+#include "../include/private/kcp_fec_p.h"
+
+using namespace qtng;
+
+// calls f with every subset of [0, n) which has at most max elements.
+template<typename F>
+static void forEachErasure(int n, int max, F f)
+{
+    QVector<int> erased;
+    std::function<void(int)> walk = [&](int start) {
+        f(erased);
+        if (erased.size() == max) {
+            return;
+        }
+        for (int i = start; i < n; ++i) {
+            erased.append(i);
+            walk(i + 1);
+            erased.removeLast();
+        }
+    };
+    walk(0);
+}
+
+static QVector<int> randomErasure(int n, int count)
+{
+    QVector<int> all;
+    for (int i = 0; i < n; ++i) {
+        all.append(i);
+    }
+    QVector<int> erased;
+    const QByteArray &r = randomBytes(count);
+    for (int i = 0; i < count; ++i) {
+        erased.append(all.takeAt(static_cast<quint8>(r.at(i)) % all.size()));
+    }
+    return erased;
+}
+
+class TestKcpFec : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testReconstruct_data();
+    void testReconstruct();
+    void testUnequalSizes();
+    void testDecoder_data();
+    void testDecoder();
+    void testDecoderUnequalSizes();
+};
+
+void TestKcpFec::testReconstruct_data()
+{
+    QTest::addColumn<int>("dataShards");
+    QTest::addColumn<int>("parityShards");
+    QTest::newRow("1+1") << 1 << 1;
+    QTest::newRow("1+3") << 1 << 3;
+    QTest::newRow("3+2") << 3 << 2;
+    QTest::newRow("4+4") << 4 << 4;
+    QTest::newRow("10+3") << 10 << 3;
+    QTest::newRow("20+10") << 20 << 10;
+    QTest::newRow("200+55") << 200 << 55;
+}
+
+// any dataShards of all shards recover the data, and fewer do not.
+void TestKcpFec::testReconstruct()
+{
+    QFETCH(int, dataShards);
+    QFETCH(int, parityShards);
+    const int total = dataShards + parityShards;
+    ReedSolomon rs(dataShards, parityShards);
+    QCOMPARE(rs.dataShards(), dataShards);
+    QCOMPARE(rs.parityShards(), parityShards);
+
+    QVector<QByteArray> data;
+    for (int i = 0; i < dataShards; ++i) {
+        data.append(randomBytes(97));
+    }
+    QVector<QByteArray> parity;
+    rs.encode(data, &parity);
+    QCOMPARE(parity.size(), parityShards);
+    for (const QByteArray &shard : parity) {
+        QCOMPARE(shard.size(), 97);
+    }
+    const QVector<QByteArray> &all = data + parity;
+
+    int tested = 0;
+    auto check = [&](const QVector<int> &erased) {
+        QVector<QByteArray> shards = all;
+        for (int i : erased) {
+            shards[i] = QByteArray();
+        }
+        if (!rs.reconstruct(&shards)) {
+            return false;
+        }
+        ++tested;
+        return shards.mid(0, dataShards) == data;
+    };
+    if (total <= 13) {
+        bool ok = true;
+        forEachErasure(total, parityShards, [&](const QVector<int> &erased) { ok = ok && check(erased); });
+        QVERIFY(ok);
+    } else {
+        for (int i = 0; i < 20; ++i) {
+            const QVector<int> &erased = randomErasure(total, 1 + i % parityShards);
+            QVERIFY2(check(erased), qPrintable(QString::number(i)));
+        }
+        // as many data shards as parity shards are lost.
+        QVector<int> erased;
+        for (int i = 0; i < parityShards; ++i) {
+            erased.append(i);
+        }
+        QVERIFY(check(erased));
+    }
+    QVERIFY(tested > 0);
+
+    // one more erasure is too many.
+    const QVector<int> &tooMany = randomErasure(total, parityShards + 1);
+    QVector<QByteArray> shards = all;
+    for (int i : tooMany) {
+        shards[i] = QByteArray();
+    }
+    QVERIFY(!rs.reconstruct(&shards));
+}
+
+void TestKcpFec::testUnequalSizes()
+{
+    ReedSolomon rs(3, 2);
+    QVector<QByteArray> data;
+    data << QByteArray(16, 'a') << QByteArray(16, 'b') << QByteArray(16, 'c');
+    QVector<QByteArray> parity;
+    rs.encode(data, &parity);
+
+    QVector<QByteArray> shards = data + parity;
+    shards[0] = QByteArray();
+    shards[1].append('b');
+    QVERIFY(!rs.reconstruct(&shards));
+    QVERIFY(shards.at(0).isNull());
+
+    shards = data + parity;
+    shards[0] = QByteArray();
+    shards[3].chop(1);
+    QVERIFY(!rs.reconstruct(&shards));
+
+    // nothing is missing, nothing to check.
+    shards = data + parity;
+    QVERIFY(rs.reconstruct(&shards));
+    QVERIFY(!ReedSolomon::isValid(0, 1));
+    QVERIFY(!ReedSolomon::isValid(1, 0));
+    QVERIFY(!ReedSolomon::isValid(200, 56));
+}
+
+void TestKcpFec::testDecoder_data()
+{
+    QTest::addColumn<int>("dataShards");
+    QTest::addColumn<int>("parityShards");
+    QTest::newRow("3+2") << 3 << 2;
+    QTest::newRow("10+3") << 10 << 3;
+    QTest::newRow("1+1") << 1 << 1;
+}
+
+// the data shards of different sizes go through the encoder, up to parityShards of every group are lost, and the
+// decoder gives back the lost ones.
+void TestKcpFec::testDecoder()
+{
+    QFETCH(int, dataShards);
+    QFETCH(int, parityShards);
+    const int total = dataShards + parityShards;
+    const int groups = 20;
+    KcpFecEncoder encoder(dataShards, parityShards);
+    KcpFecDecoder decoder;
+    QList<QByteArray> lost;
+    QList<QByteArray> recovered;
+    for (int g = 0; g < groups; ++g) {
+        QMap<quint32, QByteArray> shards;
+        quint32 first = 0;
+        for (int i = 0; i < dataShards; ++i) {
+            const QByteArray &payload = randomBytes(1 + (g * 31 + i * 17) % 300);
+            QVector<QByteArray> parity;
+            const quint32 seq = encoder.addData(payload.constData(), payload.size(), &parity);
+            if (i == 0) {
+                first = seq;
+            }
+            QCOMPARE(seq, first + static_cast<quint32>(i));
+            shards.insert(seq, payload);
+            QCOMPARE(parity.size(), i == dataShards - 1 ? parityShards : 0);
+            for (int j = 0; j < parity.size(); ++j) {
+                shards.insert(seq + 1 + static_cast<quint32>(j), parity.at(j));
+            }
+        }
+        QCOMPARE(first, static_cast<quint32>(g * total));
+        // lose g % (parityShards + 1) shards, the data ones first.
+        QVector<int> erased;
+        for (int i = 0; i < g % (parityShards + 1); ++i) {
+            erased.append((i * 2) % total);
+        }
+        for (int i : erased) {
+            if (i < dataShards) {
+                lost.append(shards.value(first + static_cast<quint32>(i)));
+            }
+        }
+        for (int i = 0; i < total; ++i) {
+            if (erased.contains(i)) {
+                continue;
+            }
+            const quint32 seq = first + static_cast<quint32>(i);
+            const QByteArray &shard = shards.value(seq);
+            decoder.addShard(seq, dataShards, parityShards, shard.constData(), shard.size(), i >= dataShards,
+                             &recovered);
+        }
+    }
+    QCOMPARE(recovered, lost);
+}
+
+// a data shard longer than the parity shards, or parity shards of different sizes, drop the group.
+void TestKcpFec::testDecoderUnequalSizes()
+{
+    KcpFecEncoder encoder(3, 2);
+    QVector<QByteArray> parity;
+    const QByteArray payload(10, 'x');
+    for (int i = 0; i < 3; ++i) {
+        encoder.addData(payload.constData(), payload.size(), &parity);
+    }
+    QCOMPARE(parity.size(), 2);
+    QCOMPARE(parity.at(0).size(), 12);
+
+    KcpFecDecoder decoder;
+    QList<QByteArray> recovered;
+    const QByteArray longer(20, 'x');
+    decoder.addShard(0, 3, 2, longer.constData(), longer.size(), false, &recovered);
+    decoder.addShard(2, 3, 2, payload.constData(), payload.size(), false, &recovered);
+    decoder.addShard(3, 3, 2, parity.at(0).constData(), parity.at(0).size(), true, &recovered);
+    decoder.addShard(4, 3, 2, parity.at(1).constData(), parity.at(1).size(), true, &recovered);
+    QVERIFY(recovered.isEmpty());
+
+    // the same shards in the next group, but one parity shard is cut.
+    decoder.addShard(7, 3, 2, payload.constData(), payload.size(), false, &recovered);
+    decoder.addShard(8, 3, 2, parity.at(0).constData(), parity.at(0).size(), true, &recovered);
+    decoder.addShard(9, 3, 2, parity.at(1).constData(), parity.at(1).size() - 1, true, &recovered);
+    QVERIFY(recovered.isEmpty());
+
+    // and the intact ones are recovered.
+    decoder.addShard(12, 3, 2, payload.constData(), payload.size(), false, &recovered);
+    decoder.addShard(13, 3, 2, parity.at(0).constData(), parity.at(0).size(), true, &recovered);
+    decoder.addShard(14, 3, 2, parity.at(1).constData(), parity.at(1).size(), true, &recovered);
+    QCOMPARE(recovered, QList<QByteArray>() << payload << payload);
+}
+
+QTEST_MAIN(TestKcpFec)
+
+#include "test_kcp_fec.moc"
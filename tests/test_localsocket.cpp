@@ -0,0 +1,189 @@
+#include <QtTest>
+#include <unistd.h>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+class TestLocalSocket : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testStream();
+    void testPassDescriptors();
+    void testSharedMemoryChannel();
+    void testBondedChannel();
+};
+
+static bool makeLocalPair(const QString &path, QSharedPointer<Socket> *client, QSharedPointer<Socket> *request)
+{
+    QScopedPointer<Socket> server(Socket::createLocalServer(path));
+    if (server.isNull()) {
+        return false;
+    }
+    CoroutineGroup operations;
+    operations.spawn([&server, request] { request->reset(server->accept()); });
+    client->reset(Socket::createLocalConnection(path));
+    operations.joinall();
+    return !client->isNull() && !request->isNull();
+}
+
+void TestLocalSocket::testStream()
+{
+    const QString &path = QString::fromLatin1("@qtng_test_stream_%1").arg(QCoreApplication::applicationPid());
+    QScopedPointer<Socket> server(Socket::createLocalServer(path));
+    QVERIFY(!server.isNull());
+    QCOMPARE(server->type(), Socket::LocalSocket);
+    QCOMPARE(server->localPath(), path);
+
+    CoroutineGroup operations;
+    operations.spawn([&server] {
+        QScopedPointer<Socket> request(server->accept());
+        if (request.isNull()) {
+            return;
+        }
+        const QByteArray &data = request->recv(1024);
+        request->sendall(data);
+    });
+    QScopedPointer<Socket> client(Socket::createLocalConnection(path));
+    QVERIFY(!client.isNull());
+    QCOMPARE(client->peerAddressURI(), QString::fromLatin1("unix:%1").arg(path));
+    QCOMPARE(client->sendall(QByteArray("hello")), 5);
+    QCOMPARE(client->recv(1024), QByteArray("hello"));
+    operations.joinall();
+}
+
+void TestLocalSocket::testPassDescriptors()
+{
+    const QString &path = QString::fromLatin1("@qtng_test_fds_%1").arg(QCoreApplication::applicationPid());
+    QScopedPointer<Socket> server(Socket::createLocalServer(path));
+    QVERIFY(!server.isNull());
+    int pipes[2];
+    QCOMPARE(::pipe(pipes), 0);
+
+    CoroutineGroup operations;
+    operations.spawn([&server, pipes] {
+        QScopedPointer<Socket> request(server->accept());
+        if (!request.isNull()) {
+            QList<qintptr> fds;
+            fds.append(pipes[1]);
+            request->sendfds("x", 1, fds);
+        }
+    });
+    QScopedPointer<Socket> client(Socket::createLocalConnection(path));
+    QVERIFY(!client.isNull());
+    char c;
+    QList<qintptr> fds;
+    QCOMPARE(client->recvfds(&c, 1, &fds), 1);
+    QCOMPARE(fds.size(), 1);
+    QVERIFY(fds.first() != pipes[1]);
+    QCOMPARE(::write(static_cast<int>(fds.first()), "y", 1), static_cast<ssize_t>(1));
+    QCOMPARE(::read(pipes[0], &c, 1), static_cast<ssize_t>(1));
+    QCOMPARE(c, 'y');
+    ::close(static_cast<int>(fds.first()));
+    ::close(pipes[0]);
+    ::close(pipes[1]);
+    operations.joinall();
+}
+
+void TestLocalSocket::testSharedMemoryChannel()
+{
+    const QString &path = QString::fromLatin1("@qtng_test_shm_%1").arg(QCoreApplication::applicationPid());
+    QScopedPointer<Socket> server(Socket::createLocalServer(path));
+    QVERIFY(!server.isNull());
+
+    QSharedPointer<SharedMemoryChannel> negative;
+    CoroutineGroup operations;
+    operations.spawn([&server, &negative] {
+        QSharedPointer<Socket> request(server->accept());
+        if (!request.isNull()) {
+            negative = SharedMemoryChannel::create(request, NegativePole);
+        }
+    });
+    QSharedPointer<Socket> client(Socket::createLocalConnection(path));
+    QVERIFY(!client.isNull());
+    QSharedPointer<SharedMemoryChannel> positive = SharedMemoryChannel::create(client, PositivePole, 1000);
+    QVERIFY(!positive.isNull());
+    operations.joinall();
+    QVERIFY(!negative.isNull());
+    QCOMPARE(positive->ringSize(), negative->ringSize());
+
+    // more packets than the ring can hold at once.
+    const QByteArray packet(positive->maxPayloadSize() / 2, 'x');
+    operations.spawn([positive, packet] {
+        for (int i = 0; i < 100; ++i) {
+            positive->sendPacket(packet);
+        }
+    });
+    for (int i = 0; i < 100; ++i) {
+        QCOMPARE(negative->recvPacket(), packet);
+    }
+
+    QList<QByteArray> packets;
+    for (int i = 0; i < 10; ++i) {
+        packets.append(QByteArray::number(i));
+    }
+    QVERIFY(positive->sendPackets(packets));
+    QList<QByteArray> received;
+    while (received.size() < packets.size()) {
+        const QList<QByteArray> &batch = negative->recvPackets(4);
+        QVERIFY(!batch.isEmpty() && batch.size() <= 4);
+        received.append(batch);
+    }
+    QCOMPARE(received, packets);
+
+    QSharedPointer<VirtualChannel> subChannel = positive->makeChannel();
+    QVERIFY(subChannel->sendPacket("hello"));
+    QSharedPointer<VirtualChannel> peerChannel = negative->takeChannel();
+    QVERIFY(!peerChannel.isNull());
+    QCOMPARE(peerChannel->recvPacket(), QByteArray("hello"));
+
+    positive->abort();
+    QVERIFY(negative->recvPacket().isNull());
+    QVERIFY(negative->isBroken());
+}
+
+void TestLocalSocket::testBondedChannel()
+{
+    QList<QSharedPointer<DataChannel>> positivePaths, negativePaths;
+    for (int i = 0; i < 2; ++i) {
+        QSharedPointer<Socket> client, request;
+        const QString &path =
+                QString::fromLatin1("@qtng_test_bond_%1_%2").arg(QCoreApplication::applicationPid()).arg(i);
+        QVERIFY(makeLocalPair(path, &client, &request));
+        positivePaths.append(QSharedPointer<SocketChannel>::create(client, PositivePole));
+        negativePaths.append(QSharedPointer<SocketChannel>::create(request, NegativePole));
+    }
+    QSharedPointer<BondedChannel> positive(new BondedChannel(positivePaths, PositivePole));
+    QSharedPointer<BondedChannel> negative(new BondedChannel(negativePaths, NegativePole));
+    QCOMPARE(positive->paths().size(), 2);
+
+    for (int i = 0; i < 100; ++i) {
+        QVERIFY(positive->sendPacket(QByteArray::number(i)));
+    }
+    for (int i = 0; i < 100; ++i) {
+        QCOMPARE(negative->recvPacket(), QByteArray::number(i));
+    }
+    QSharedPointer<VirtualChannel> subChannel = positive->makeChannel();
+    QVERIFY(subChannel->sendPacket("hello"));
+    QSharedPointer<VirtualChannel> peerChannel = negative->takeChannel();
+    QVERIFY(!peerChannel.isNull());
+    QCOMPARE(peerChannel->recvPacket(), QByteArray("hello"));
+
+    // the packets go on after one path is broken.
+    positivePaths.first()->abort();
+    for (int i = 0; i < 100; ++i) {
+        QVERIFY(positive->sendPacket(QByteArray::number(i)));
+    }
+    for (int i = 0; i < 100; ++i) {
+        QCOMPARE(negative->recvPacket(), QByteArray::number(i));
+    }
+    QCOMPARE(positive->paths().size(), 1);
+    QVERIFY(!negative->isBroken());
+
+    positivePaths.last()->abort();
+    QVERIFY(negative->recvPacket().isNull());
+    QVERIFY(negative->isBroken());
+}
+
+QTEST_MAIN(TestLocalSocket)
+#include "test_localsocket.moc"
@@ -4,6 +4,14 @@
 
 using namespace qtng;
 
+struct TestMessage
+{
+    QString type;
+    qint64 id;
+    QList<QString> tags;
+};
+QTNG_MSGPACK_FIELDS(TestMessage, type, id, tags)
+
 class TestMsgPack: public QObject
 {
     Q_OBJECT
@@ -21,6 +29,12 @@ private slots:
     void testString();
     void testByteArray();
     void testDateTime();
+    void testView();
+    void testFields();
+    void testPackedSize();
+    void testUnpacker();
+    void testNumberArray();
+    void testJson();
 };
 
 
@@ -364,5 +378,180 @@ void TestMsgPack::testDateTime()
     QCOMPARE(dt, t);
 }
 
+void TestMsgPack::testView()
+{
+    QByteArray bs;
+    MsgPackStream os(&bs, QIODevice::WriteOnly);
+    os.writeMapHeader(4);
+    os << QString::fromLatin1("list") << (QVariantList() << 1 << -200 << QString::fromLatin1("x"));
+    os << QString::fromLatin1("type") << QString::fromLatin1("ping");
+    os << QString::fromLatin1("id") << static_cast<quint64>(1) << 40;
+    os << QString::fromLatin1("blob") << QByteArray("\x00\x01", 2);
+    QVERIFY(os.status() == MsgPackStream::Ok);
+
+    MsgPackView message(bs);
+    QCOMPARE(message.type(), MsgPackView::Map);
+    QCOMPARE(message.size(), 4);
+    QCOMPARE(message.value("type").toBytes(), QByteArray("ping"));
+    QCOMPARE(message.value("id").toInteger(), static_cast<qint64>(1) << 40);
+    QCOMPARE(message.value("blob").type(), MsgPackView::Binary);
+    QCOMPARE(message.value("blob").toBytes(), QByteArray("\x00\x01", 2));
+    QVERIFY(!message.value("missing").isValid());
+    MsgPackView list = message.value("list");
+    QCOMPARE(list.size(), 3);
+    QCOMPARE(list.at(1).toInteger(), static_cast<qint64>(-200));
+    QCOMPARE(list.at(2).toString(), QString::fromLatin1("x"));
+    QVERIFY(!list.at(3).isValid());
+    QCOMPARE(list.first().next().next().toString(), QString::fromLatin1("x"));
+    QCOMPARE(message.toVariant().toMap().size(), 4);
+    QVERIFY(!MsgPackView(bs.left(bs.size() - 1)).value("blob").isValid());
+}
+
+void TestMsgPack::testFields()
+{
+    TestMessage message;
+    message.type = QString::fromLatin1("ping");
+    message.id = 42;
+    message.tags << QString::fromLatin1("a") << QString::fromLatin1("b");
+    QByteArray bs;
+    MsgPackStream os(&bs, QIODevice::WriteOnly);
+    os << message;
+    QVERIFY(os.status() == MsgPackStream::Ok);
+    QCOMPARE(MsgPackView(bs).value("id").toInteger(), static_cast<qint64>(42));
+
+    MsgPackStream is(bs);
+    TestMessage t;
+    is >> t;
+    QVERIFY(is.status() == MsgPackStream::Ok);
+    QCOMPARE(t.type, message.type);
+    QCOMPARE(t.id, message.id);
+    QCOMPARE(t.tags, message.tags);
+}
+
+void TestMsgPack::testPackedSize()
+{
+    QVariantMap map;
+    map.insert(QString::fromLatin1("id"), 42);
+    map.insert(QString::fromLatin1("data"), QByteArray(1000, 'x'));
+    QByteArray bs;
+    MsgPackStream os(&bs, QIODevice::WriteOnly);
+    os << map;
+    QVERIFY(os.status() == MsgPackStream::Ok);
+    QCOMPARE(MsgPackStream::packedSize(map), static_cast<qint64>(bs.size()));
+
+    const QByteArray packed = MsgPackStream::pack(map, 4);
+    QCOMPARE(packed.size(), bs.size() + 4);
+    QCOMPARE(packed.mid(4), bs);
+    QCOMPARE(MsgPackStream::pack(map), bs);
+}
+
+void TestMsgPack::testUnpacker()
+{
+    QByteArray bs;
+    MsgPackStream os(&bs, QIODevice::WriteOnly);
+    for (int i = 0; i < 100; ++i) {
+        QVariantMap map;
+        map.insert(QString::fromLatin1("id"), i);
+        map.insert(QString::fromLatin1("data"), QByteArray(i * 10, 'x'));
+        os << map;
+    }
+    QVERIFY(os.status() == MsgPackStream::Ok);
+
+    MsgPackUnpacker unpacker;
+    int count = 0;
+    for (int i = 0; i < bs.size(); i += 7) {
+        unpacker.feed(bs.mid(i, 7));
+        QVariant v;
+        while (unpacker.take(v)) {
+            QCOMPARE(v.toMap().value(QString::fromLatin1("id")).toInt(), count);
+            QCOMPARE(v.toMap().value(QString::fromLatin1("data")).toByteArray().size(), count * 10);
+            ++count;
+        }
+    }
+    QCOMPARE(count, 100);
+    QCOMPARE(unpacker.bufferedSize(), 0);
+    QVERIFY(!unpacker.isCorrupt());
+
+    unpacker.feed(QByteArray(1, '\xc1'));
+    QVERIFY(unpacker.isCorrupt());
+}
+
+void TestMsgPack::testNumberArray()
+{
+    QVector<double> doubles;
+    QVector<qint64> integers;
+    for (int i = 0; i < 10000; ++i) {
+        doubles.append(i * 0.5);
+        integers.append((i % 2 ? -1 : 1) * (static_cast<qint64>(1) << (i % 63)));
+    }
+    QByteArray bs;
+    MsgPackStream os(&bs, QIODevice::WriteOnly);
+    os << doubles << integers;
+    QVERIFY(os.writeTypedArray(doubles));
+    QVERIFY(os.status() == MsgPackStream::Ok);
+
+    // the same bytes as the generic ones.
+    QList<double> list = doubles.toList();
+    QCOMPARE(MsgPackStream::pack(list), MsgPackStream::pack(doubles));
+
+    MsgPackStream is(bs);
+    QVector<double> d1, d2;
+    QList<qint64> i1;
+    is >> d1 >> i1;
+    QVERIFY(is.readTypedArray(d2));
+    QVERIFY(is.status() == MsgPackStream::Ok);
+    QCOMPARE(d1, doubles);
+    QCOMPARE(i1, integers.toList());
+    QCOMPARE(d2, doubles);
+}
+
+void TestMsgPack::testJson()
+{
+    const QByteArray json("[{\"id\": 1, \"name\": \"a\\u00e9\\n\", \"tags\": [true, null], \"score\": -1.5e2}, "
+                          "{\"id\": 12345678901, \"name\": \"\\ud83d\\ude00\", \"tags\": [], \"score\": 0}]");
+    // fed by pieces of 3 bytes, so the strings and numbers are split.
+    QByteArray bs;
+    MsgPackStream os(&bs, QIODevice::WriteOnly);
+    JsonMsgPackTranscoder transcoder(&os, true);
+    for (int i = 0; i < json.size(); i += 3) {
+        QVERIFY(transcoder.addData(json.mid(i, 3)));
+    }
+    QVERIFY(transcoder.finish());
+    QCOMPARE(transcoder.valuesWritten(), static_cast<quint64>(2));
+
+    MsgPackStream is(bs);
+    QVariantMap first, second;
+    is >> first >> second;
+    QVERIFY(is.status() == MsgPackStream::Ok);
+    QCOMPARE(first.value(QString::fromLatin1("id")).toInt(), 1);
+    QCOMPARE(first.value(QString::fromLatin1("name")).toString(), QString::fromUtf8("a\xc3\xa9\n"));
+    QCOMPARE(first.value(QString::fromLatin1("tags")).toList().size(), 2);
+    QCOMPARE(first.value(QString::fromLatin1("score")).toDouble(), -150.0);
+    QCOMPARE(second.value(QString::fromLatin1("id")).toLongLong(), Q_INT64_C(12345678901));
+    QCOMPARE(second.value(QString::fromLatin1("name")).toString(), QString::fromUtf8("\xf0\x9f\x98\x80"));
+
+    JsonStreamReader reader;
+    reader.addData(QByteArray("{\"a\": [1, 2"));
+    QCOMPARE(reader.next(), JsonStreamReader::StartObject);
+    QCOMPARE(reader.next(), JsonStreamReader::Key);
+    QCOMPARE(reader.stringValue(), QByteArray("a"));
+    QCOMPARE(reader.next(), JsonStreamReader::StartArray);
+    QCOMPARE(reader.next(), JsonStreamReader::Integer);
+    QCOMPARE(reader.next(), JsonStreamReader::NeedMoreData);  // 2 may go on.
+    reader.addData(QByteArray("]}"));
+    QCOMPARE(reader.next(), JsonStreamReader::Integer);
+    QCOMPARE(reader.integerValue(), Q_INT64_C(2));
+    QCOMPARE(reader.next(), JsonStreamReader::EndArray);
+    QCOMPARE(reader.next(), JsonStreamReader::EndObject);
+    QCOMPARE(reader.next(), JsonStreamReader::EndOfDocument);
+
+    QByteArray invalid;
+    MsgPackStream os2(&invalid, QIODevice::WriteOnly);
+    JsonMsgPackTranscoder truncated(&os2);
+    QVERIFY(truncated.addData(QByteArray("{\"a\": 1")));
+    QVERIFY(!truncated.finish());
+    QVERIFY(!truncated.errorString().isEmpty());
+}
+
 QTEST_MAIN(TestMsgPack)
 #include "test_msgpack.moc"
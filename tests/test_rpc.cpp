@@ -0,0 +1,67 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+static qint32 add(qint32 a, qint32 b)
+{
+    return a + b;
+}
+
+class TestRpc : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testCall();
+};
+
+void TestRpc::testCall()
+{
+    QScopedPointer<Socket> server(Socket::createServer(HostAddress::LocalHost, 0));
+    QVERIFY(!server.isNull());
+    QSharedPointer<Socket> request;
+    CoroutineGroup operations;
+    operations.spawn([&server, &request] { request.reset(server->accept()); });
+    QSharedPointer<Socket> client(Socket::createConnection(HostAddress::LocalHost, server->localPort()));
+    operations.joinall();
+    QVERIFY(!client.isNull() && !request.isNull());
+
+    RpcPeer caller(QSharedPointer<SocketChannel>::create(client, PositivePole));
+    RpcPeer callee(QSharedPointer<SocketChannel>::create(request, NegativePole));
+    callee.registerMethod(QString::fromLatin1("add"), add);
+    callee.registerMethod(QString::fromLatin1("echo"),
+                          std::function<QString(QString)>([](const QString &s) { return s; }));
+    callee.registerMethod(QString::fromLatin1("sleep"),
+                          std::function<void(float)>([](float secs) { Coroutine::sleep(secs); }));
+
+    qint32 sum = 0;
+    QVERIFY(caller.call(QString::fromLatin1("add"), &sum, 1, 2).isOk());
+    QCOMPARE(sum, 3);
+
+    // the calls of coroutines are pipelined.
+    QVector<qint32> results(100);
+    for (int i = 0; i < results.size(); ++i) {
+        operations.spawn([&caller, &results, i] { caller.call(QString::fromLatin1("add"), &results[i], i, i); });
+    }
+    operations.joinall();
+    for (int i = 0; i < results.size(); ++i) {
+        QCOMPARE(results.at(i), i * 2);
+    }
+
+    QString echo;
+    QVERIFY(caller.call(QString::fromLatin1("echo"), &echo, QString::fromLatin1("hello")).isOk());
+    QCOMPARE(echo, QString::fromLatin1("hello"));
+    QCOMPARE(caller.call(QString::fromLatin1("missing"), &echo).code, RpcError::MethodNotFound);
+    QCOMPARE(caller.call(QString::fromLatin1("add"), &sum, QString::fromLatin1("1")).code, RpcError::InvalidParams);
+
+    caller.setCallTimeout(0.1f);
+    QVariant nothing;
+    QCOMPARE(caller.call(QString::fromLatin1("sleep"), &nothing, 1.0f).code, RpcError::Timeout);
+    QCOMPARE(caller.pendingCallsSize(), 0u);
+
+    callee.close();
+    QCOMPARE(caller.call(QString::fromLatin1("add"), &sum, 1, 2).code, RpcError::ChannelBroken);
+}
+
+QTEST_MAIN(TestRpc)
+#include "test_rpc.moc"
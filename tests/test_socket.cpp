@@ -1,18 +1,207 @@
-#include <QtCore/qdebug.h>
-#include <QtCore/qcoreapplication.h>
-#include "../qtnetworkng.h"
+#include <QtTest>
+#include <limits.h>
+#include "qtnetworkng.h"
 
 using namespace qtng;
 
-int main(int argc, char **argv)
+#ifdef IOV_MAX
+const int MaxIoVectors = IOV_MAX;
+#else
+const int MaxIoVectors = 1024;
+#endif
+
+// makes a pair of connected sockets by the loopback.
+static bool makePair(QSharedPointer<Socket> *client, QSharedPointer<Socket> *peer)
+{
+    Socket server;
+    if (!server.bind(HostAddress::LocalHost, 0) || !server.listen(1)) {
+        return false;
+    }
+    client->reset(new Socket());
+    if (!(*client)->connect(HostAddress::LocalHost, server.localPort())) {
+        return false;
+    }
+    peer->reset(server.accept());
+    return !peer->isNull();
+}
+
+static QByteArray join(const QList<QByteArray> &buffers)
+{
+    QByteArray data;
+    for (const QByteArray &buffer : buffers) {
+        data.append(buffer);
+    }
+    return data;
+}
+
+// reads slowly by small pieces, so the sender is blocked by the full buffer in the middle of its buffers.
+static QByteArray recvSlowly(QSharedPointer<Socket> peer, qint32 size)
+{
+    QByteArray received;
+    try {
+        Timeout timeout(10.0);
+        while (received.size() < size) {
+            const QByteArray &buf = peer->recv(1024 * 4);
+            if (buf.isEmpty()) {
+                break;
+            }
+            received.append(buf);
+            Coroutine::msleep(1);
+        }
+    } catch (TimeoutException &) { }
+    return received;
+}
+
+// the ipv6 attempts never answer like a black-holed route, and the ipv4 attempts connect. the sockets are counted.
+class StalledIPv6Socket : public Socket
+{
+public:
+    explicit StalledIPv6Socket(HostAddress::NetworkLayerProtocol protocol)
+        : Socket(protocol)
+    {
+        ++alive;
+    }
+    virtual ~StalledIPv6Socket() { --alive; }
+    bool connect(const HostAddress &addr, quint16 port)
+    {
+        if (addr.isIPv4()) {
+            return Socket::connect(addr, port);
+        }
+        ++stalled;
+        try {
+            Coroutine::msleep(1000 * 60);
+        } catch (CoroutineExitException &) {
+            ++cancelled;
+            throw;
+        }
+        return false;
+    }
+public:
+    static int alive;
+    static int stalled;
+    static int cancelled;
+};
+
+int StalledIPv6Socket::alive = 0;
+int StalledIPv6Socket::stalled = 0;
+int StalledIPv6Socket::cancelled = 0;
+
+class TestSocket : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testSendvEmpty();
+    void testSendvPartial();
+    void testSendvManyBuffers();
+    void testHappyEyeballs();
+#ifndef QTNG_NO_CRYPTO
+    void testSslGet();
+#endif
+};
+
+// nothing is sent, and the socket is still usable.
+void TestSocket::testSendvEmpty()
+{
+    QSharedPointer<Socket> client, peer;
+    QVERIFY(makePair(&client, &peer));
+    QCOMPARE(client->sendv(QList<QByteArray>()), 0);
+    QCOMPARE(client->sendv(QList<QByteArray>() << QByteArray() << QByteArray()), 0);
+    QCOMPARE(client->sendv(QList<QByteArray>() << QByteArray() << QByteArray("abc") << QByteArray()), 3);
+    QCOMPARE(peer->recvall(3), QByteArray("abc"));
+}
+
+// the small send buffer is filled in the middle of buffers, so sendmsg() writes part of them and continues from
+// the offset inside a buffer.
+void TestSocket::testSendvPartial()
+{
+    QSharedPointer<Socket> client, peer;
+    QVERIFY(makePair(&client, &peer));
+    client->setOption(Socket::SendBufferSizeSocketOption, 1024 * 4);
+    QList<QByteArray> buffers;
+    for (int i = 0; i < 16; ++i) {
+        buffers.append(QByteArray(1 + i * 7919 % 65536, static_cast<char>('a' + i)));
+        if (i % 5 == 0) {
+            buffers.append(QByteArray());
+        }
+    }
+    const QByteArray &data = join(buffers);
+    CoroutineGroup operations;
+    QSharedPointer<QByteArray> received(new QByteArray());
+    operations.spawn([peer, received, &data] { *received = recvSlowly(peer, data.size()); });
+    QCOMPARE(client->sendv(buffers), data.size());
+    operations.joinall();
+    QCOMPARE(received->size(), data.size());
+    QVERIFY(*received == data);
+}
+
+// sendmsg() takes no more than IOV_MAX buffers a time, the rest are sent in the next calls.
+void TestSocket::testSendvManyBuffers()
+{
+    QSharedPointer<Socket> client, peer;
+    QVERIFY(makePair(&client, &peer));
+    QList<QByteArray> buffers;
+    for (int i = 0; i < MaxIoVectors * 3 + 7; ++i) {
+        buffers.append(QByteArray(i % 7, static_cast<char>(i % 251)));
+    }
+    const QByteArray &data = join(buffers);
+    CoroutineGroup operations;
+    QSharedPointer<QByteArray> received(new QByteArray());
+    operations.spawn([peer, received, &data] { *received = recvSlowly(peer, data.size()); });
+    QCOMPARE(client->sendv(buffers), data.size());
+    operations.joinall();
+    QVERIFY(*received == data);
+}
+
+// rfc 8305, the ipv4 attempt starts after the ipv6 one stalls for HappyEyeballsAttemptDelay. the ipv6 attempt is
+// cancelled once ipv4 wins, and its socket is deleted.
+void TestSocket::testHappyEyeballs()
+{
+    Socket server;
+    QVERIFY(server.bind(HostAddress::LocalHost, 0) && server.listen(1));
+    const QList<HostAddress> &addresses = happyEyeballsOrder(
+            QList<HostAddress>() << HostAddress(HostAddress::LocalHost) << HostAddress(HostAddress::LocalHostIPv6),
+            HostAddress::IPv4Protocol | HostAddress::IPv6Protocol);
+    QCOMPARE(addresses.size(), 2);
+    QVERIFY(!addresses.first().isIPv4());
+
+    std::function<StalledIPv6Socket *(HostAddress::NetworkLayerProtocol)> func =
+            [](HostAddress::NetworkLayerProtocol protocol) { return new StalledIPv6Socket(protocol); };
+    Socket::SocketError error = Socket::UnknownSocketError;
+    QElapsedTimer timer;
+    timer.start();
+    QScopedPointer<StalledIPv6Socket> winner(
+            happyEyeballsConnect<StalledIPv6Socket>(addresses, server.localPort(), &error, func));
+    const qint64 elapsed = timer.elapsed();
+    QVERIFY(!winner.isNull());
+    QCOMPARE(error, Socket::NoError);
+    QVERIFY(winner->peerAddress().isIPv4());
+    QVERIFY(elapsed >= HappyEyeballsAttemptDelay - 10);
+    QVERIFY(elapsed < 1000 * 10);
+    QCOMPARE(StalledIPv6Socket::stalled, 1);
+    QCOMPARE(StalledIPv6Socket::cancelled, 1);
+    QCOMPARE(StalledIPv6Socket::alive, 1);
+    winner.reset();
+    QCOMPARE(StalledIPv6Socket::alive, 0);
+}
+
+#ifndef QTNG_NO_CRYPTO
+// needs the internet.
+void TestSocket::testSslGet()
 {
     SslSocket s;
-    bool ok = s.connect("www.baidu.com", 443);
-    s.sendall("GET / HTTP/1.0\r\nHost: www.baidu.com\r\n\r\n");
+    if (!s.connect(QString::fromLatin1("www.baidu.com"), 443)) {
+        QSKIP("can not connect to www.baidu.com.");
+    }
+    const QByteArray request("GET / HTTP/1.0\r\nHost: www.baidu.com\r\n\r\n");
+    QCOMPARE(s.sendall(request), request.size());
     const QByteArray &data = s.recvall(1024 * 1024);
-    qDebug() << QString::fromUtf8(data);
-    Certificate cert = s.peerCertificate();
-    QList<Certificate> certs = s.peerCertificateChain();
-    qDebug() << cert.digest() << certs.size() << s.cipher().name();
-    return 0;
+    QVERIFY(data.startsWith("HTTP/1."));
+    QVERIFY(!s.peerCertificate().isNull());
+    QVERIFY(!s.peerCertificateChain().isEmpty());
+    QVERIFY(!s.cipher().name().isEmpty());
 }
+#endif
+
+QTEST_MAIN(TestSocket)
+
+#include "test_socket.moc"
@@ -12,6 +12,12 @@ private slots:
 //    void testSocks5Proxy();
     void testVersion10();
     void testServer();
+    void testServerName();
+    void testEncryptedRecords();
+    void testPollPendingData();
+    void testDynamicRecords();
+    void testEarlyData();
+    void testSystemCaCertificates();
 };
 
 
@@ -95,6 +101,202 @@ void TestSsl::testServer()
     }
     clientCoroutine->join();
 }
+
+void TestSsl::testServerName()
+{
+    SslConfiguration config = SslConfiguration::testPurpose("Goldfish", "CN", "Example");
+    SslConfiguration wildcard = SslConfiguration::testPurpose("Starfish", "CN", "Example");
+    config.addServerNameConfiguration("*.Example.com", wildcard);
+    SslSocket server(Socket::AnyIPProtocol, config);
+    QVERIFY(server.bind());
+    server.listen(100);
+    quint16 port = server.localPort();
+    QSharedPointer<Coroutine> serverCoroutine(Coroutine::spawn([&server] {
+        for (int i = 0; i < 2; ++i) {
+            QSharedPointer<SslSocket> request = server.accept();
+            if (request.isNull()) {
+                return;
+            }
+            request->recv(1024);
+        }
+    }));
+    const QStringList names = QStringList() << "www.example.com" << "example.org";
+    const QList<SslConfiguration> expected = QList<SslConfiguration>() << wildcard << config;
+    for (int i = 0; i < names.size(); ++i) {
+        Timeout _(5.0);
+        SslSocket client;
+        client.setTlsExtHostName(names.at(i));
+        QVERIFY(client.connect(HostAddress::LocalHost, port));
+        QCOMPARE(client.peerCertificate().digest(MessageDigest::Sha256),
+                 expected.at(i).localCertificate().digest(MessageDigest::Sha256));
+        client.sendall("fish is here.");
+        client.close();
+    }
+    serverCoroutine->join();
+}
+
+void TestSsl::testEncryptedRecords()
+{
+    const QByteArray key(32, 'k');
+    Socket server;
+    QVERIFY(server.bind(HostAddress::LocalHost, 0));
+    server.listen(100);
+    quint16 port = server.localPort();
+    QByteArray data;
+    for (int i = 0; i < 5000; ++i) {
+        data.append("fish is here.");
+    }
+    QSharedPointer<Coroutine> clientCoroutine(Coroutine::spawn([port, key, data] {
+        QSharedPointer<Socket> client(new Socket);
+        if (!client->connect(HostAddress::LocalHost, port)) {
+            return;
+        }
+        QSharedPointer<SocketLike> s = encryptedRecords(Cipher::ChaCha20Poly1305, key, asSocketLike(client), 4096);
+        s->sendall(data);
+        s->close();
+    }));
+    {
+        Timeout _(5.0);
+        QSharedPointer<SocketLike> request = encryptedRecords(Cipher::ChaCha20Poly1305, key,
+                                                              asSocketLike(server.accept()), 4096);
+        QVERIFY(!request.isNull());
+        QCOMPARE(request->recvall(data.size() + 1), data);
+    }
+    clientCoroutine->join();
+}
+
+void TestSsl::testPollPendingData()
+{
+    SslConfiguration config = SslConfiguration::testPurpose("Goldfish", "CN", "Example");
+    SslSocket server(Socket::AnyIPProtocol, config);
+    QVERIFY(server.bind());
+    server.listen(100);
+    quint16 port = server.localPort();
+    QSharedPointer<Event> finished(new Event());
+    QSharedPointer<Coroutine> clientCoroutine(Coroutine::spawn([port, finished] {
+        SslSocket client;
+        if (!client.connect(HostAddress::LocalHost, port)) {
+            return;
+        }
+        client.sendall("fish is here.");
+        finished->wait();
+        client.close();
+    }));
+    {
+        Timeout _(5.0);
+        QSharedPointer<SslSocket> request(server.accept());
+        QVERIFY(!request.isNull());
+        QCOMPARE(request->recv(4), QByteArray("fish"));
+        // the rest of record is decrypted already, the fd has nothing to read.
+        QVERIFY(request->hasPendingData());
+        QSharedPointer<SocketLike> requestLike = asSocketLike(request);
+        Poll poll;
+        poll.add(requestLike, Poll::Read);
+        const QList<Poll::ReadyEvent> ready = poll.waitMany(16, 1.0);
+        QCOMPARE(ready.size(), 1);
+        QVERIFY(ready.first().socketLike == requestLike);
+        QCOMPARE(ready.first().events, Poll::Read);
+        QCOMPARE(request->recv(1024), QByteArray(" is here."));
+    }
+    finished->set();
+    clientCoroutine->join();
+}
+
+void TestSsl::testDynamicRecords()
+{
+    SslConfiguration config = SslConfiguration::testPurpose("Goldfish", "CN", "Example");
+    QCOMPARE(config.dynamicRecordThreshold(), 1024 * 1024);
+    SslSocket server(Socket::AnyIPProtocol, config);
+    QVERIFY(server.bind());
+    server.listen(100);
+    quint16 port = server.localPort();
+    QByteArray data;
+    for (int i = 0; i < 5000; ++i) {
+        data.append("fish is here.");
+    }
+    QSharedPointer<Coroutine> clientCoroutine(Coroutine::spawn([port, data] {
+        SslConfiguration clientConfig;
+        clientConfig.setDynamicRecordThreshold(4096);
+        SslSocket client(HostAddress::IPv4Protocol, clientConfig);
+        if (!client.connect(HostAddress::LocalHost, port)) {
+            return;
+        }
+        client.sendall(data);
+        client.close();
+    }));
+    {
+        Timeout _(5.0);
+        QSharedPointer<SslSocket> request(server.accept());
+        QVERIFY(!request.isNull());
+        // one record is decrypted by one read, the first ones are small.
+        const QByteArray &first = request->recv(1024 * 16);
+        QVERIFY(!first.isEmpty() && first.size() <= 1369);
+        QCOMPARE(first + request->recvall(data.size()), data);
+    }
+    clientCoroutine->join();
+}
+
+void TestSsl::testEarlyData()
+{
+    SslConfiguration config = SslConfiguration::testPurpose("Goldfish", "CN", "Example");
+    if (!config.setMaxEarlyData(1024)) {
+        QSKIP("the tls library does not support early data.");
+    }
+    SslSocket server(Socket::AnyIPProtocol, config);
+    QVERIFY(server.bind());
+    server.listen(100);
+    quint16 port = server.localPort();
+    QSharedPointer<bool> accepted(new bool(false));
+    QSharedPointer<Coroutine> clientCoroutine(Coroutine::spawn([port, accepted] {
+        SslConfiguration clientConfig;
+        {
+            // the session ticket is received with the first reply.
+            SslSocket client(HostAddress::IPv4Protocol, clientConfig);
+            if (!client.connect(HostAddress::LocalHost, port) || client.recv(1024) != "first") {
+                return;
+            }
+            client.close();
+        }
+        SslSocket client(HostAddress::IPv4Protocol, clientConfig);
+        client.setEarlyData("early");
+        if (!client.connect(HostAddress::LocalHost, port)) {
+            return;
+        }
+        *accepted = client.isEarlyDataAccepted();
+        if (!*accepted) {
+            client.sendall("early");
+        }
+        client.recv(1024);
+        client.close();
+    }));
+    {
+        Timeout _(5.0);
+        QSharedPointer<SslSocket> first(server.accept());
+        QVERIFY(!first.isNull());
+        QVERIFY(!first->isEarlyDataAccepted());
+        first->sendall("first");
+        first->recv(1024);
+        QSharedPointer<SslSocket> second(server.accept());
+        QVERIFY(!second.isNull());
+        QVERIFY(second->isReadingEarlyData());
+        QCOMPARE(second->recv(1024), QByteArray("early"));
+        QVERIFY(!second->isReadingEarlyData());
+        QVERIFY(second->isEarlyDataAccepted());
+        second->sendall("second");
+    }
+    clientCoroutine->join();
+    QVERIFY(*accepted);
+}
+
+void TestSsl::testSystemCaCertificates()
+{
+    const QList<Certificate> &certificates = SslConfiguration::systemCaCertificates();
+    QVERIFY(certificates.isSharedWith(SslConfiguration::systemCaCertificates()));
+    SslConfiguration config;
+    config.addCaCertificates(certificates);
+    QVERIFY(config.caCertificates().isSharedWith(certificates));
+}
+
 QTEST_MAIN(TestSsl)
 
 #include "test_ssl.moc"
@@ -11,6 +11,13 @@ private slots:
     void testBasic();
     void testMultiProducer();
     void testCoroutineConsumer();
+    void testLockFreeCoroutineConsumer();
+    void testDeferCallPool();
+    void testThreadPoolMap();
+    void testChannel();
+    void testMultiChannel();
+    void benchmarkThreadQueue();
+    void benchmarkLockFreeThreadQueue();
 };
 
 
@@ -117,5 +124,207 @@ void TestThreadQueue::testCoroutineConsumer()
     QVERIFY(done->isSet());
 }
 
+
+void TestThreadQueue::testLockFreeCoroutineConsumer()
+{
+    QSharedPointer<LockFreeThreadQueue<QByteArray>> queue(new LockFreeThreadQueue<QByteArray>(8));
+    QList<QSharedPointer<Event>> producers;
+
+    const int ProducerNumber = 100;
+    const int Blocks = 1000;
+
+    for (int i = 0; i < ProducerNumber; ++i) {
+        int base = i * Blocks;
+        QSharedPointer<Event> producer = spawnInThread([queue, base] {
+            for (int i = 0; i < Blocks; ++i) {
+                queue->put(QByteArray::number(base + i));
+            }
+        });
+        producers.append(producer);
+    }
+
+    QSharedPointer<QSet<QByteArray>> received(new QSet<QByteArray>());
+    QScopedPointer<Coroutine> consumer(Coroutine::spawn([queue, received] {
+        for (int i = 0; i < ProducerNumber * Blocks; ++i) {
+            received->insert(queue->get());
+        }
+    }));
+
+    consumer->join();
+    for (int i = 0; i < ProducerNumber; ++i) {
+        producers.at(i)->wait();
+    }
+
+    QCOMPARE(received->size(), ProducerNumber * Blocks);
+    QVERIFY(queue->isEmpty());
+}
+
+
+// the scenario of testMultiProducer(), with fewer producers to measure the queue instead of threads.
+template<typename Queue>
+static bool multiProducer()
+{
+    QSharedPointer<Queue> queue(new Queue(1024));
+    QList<QSharedPointer<QThread>> producers;
+
+    const int ProducerNumber = 4;
+    const int Blocks = 100000;
+
+    for (int i = 0; i < ProducerNumber; ++i) {
+        QSharedPointer<QThread> producer(QThread::create([queue] {
+            for (int i = 0; i < Blocks; ++i) {
+                queue->put(i + 1);
+            }
+        }));
+        producer->start();
+        producers.append(producer);
+    }
+
+    QSharedPointer<Event> done = QSharedPointer<Event>::create();
+    QScopedPointer<QThread> consumer(QThread::create([queue, done] {
+        for (int i = 0; i < ProducerNumber * Blocks; ++i) {
+            if (queue->get() == 0) {
+                return;
+            }
+        }
+        done->set();
+    }));
+    consumer->start();
+
+    for (int i = 0; i < ProducerNumber; ++i) {
+        producers.at(i)->wait();
+    }
+    consumer->wait();
+    return done->isSet();
+}
+
+
+void TestThreadQueue::benchmarkThreadQueue()
+{
+    bool ok = true;
+    QBENCHMARK {
+        ok = ok && multiProducer<ThreadQueue<int>>();
+    }
+    QVERIFY(ok);
+}
+
+
+void TestThreadQueue::benchmarkLockFreeThreadQueue()
+{
+    bool ok = true;
+    QBENCHMARK {
+        ok = ok && multiProducer<LockFreeThreadQueue<int>>();
+    }
+    QVERIFY(ok);
+}
+
+void TestThreadQueue::testDeferCallPool()
+{
+    const int oldThreads = deferCallThreads();
+    setDeferCallThreads(2);
+    QSharedPointer<QMutex> mutex(new QMutex());
+    QSharedPointer<QSet<QThread *>> workers(new QSet<QThread *>());
+    QList<QSharedPointer<Event>> calls;
+    for (int i = 0; i < 20; ++i) {
+        calls.append(spawnInThread([mutex, workers] {
+            QThread::msleep(1);
+            QMutexLocker locker(mutex.data());
+            workers->insert(QThread::currentThread());
+        }));
+    }
+    for (QSharedPointer<Event> call : calls) {
+        QVERIFY(call->wait());
+    }
+    QVERIFY(workers->size() <= 2);
+    QVERIFY(!workers->contains(QThread::currentThread()));
+    QCOMPARE(callInThread<int>([] { return 42; }), 42);
+    setDeferCallThreads(oldThreads);
+}
+
+void TestThreadQueue::testThreadPoolMap()
+{
+    QList<int> l;
+    for (int i = 0; i < 100000; ++i) {
+        l.append(i);
+    }
+    ThreadPool pool(4);
+    std::function<qint64(int)> square = [](int i) -> qint64 { return static_cast<qint64>(i) * i; };
+    const QList<qint64> &results = pool.map(square, l);
+    QCOMPARE(results.size(), l.size());
+    for (int i = 0; i < l.size(); ++i) {
+        QCOMPARE(results.at(i), static_cast<qint64>(i) * i);
+    }
+    QAtomicInteger<qint64> sum(0);
+    std::function<void(int)> add = [&sum](int i) { sum.fetchAndAddRelaxed(i); };
+    pool.each(add, l);
+    QCOMPARE(sum.loadAcquire(), static_cast<qint64>(l.size()) * (l.size() - 1) / 2);
+    QVERIFY(pool.map(square, QList<int>()).isEmpty());
+}
+
+void TestThreadQueue::testChannel()
+{
+    QSharedPointer<Channel<int>> channel(new Channel<int>(16));
+    const int Items = 100000;
+    QSharedPointer<Event> producer = spawnInThread([channel] {
+        QList<int> batch;
+        for (int i = 0; i < Items; ++i) {
+            batch.append(i);
+            if (batch.size() == 100) {
+                channel->sendMany(batch);
+                batch.clear();
+            }
+        }
+        channel->close();
+    });
+    qint64 sum = 0;
+    int count = 0;
+    while (true) {
+        const QList<int> &l = channel->recvMany(64);
+        if (l.isEmpty()) {
+            break;
+        }
+        for (int i : l) {
+            QCOMPARE(i, count);
+            sum += i;
+            ++count;
+        }
+    }
+    QVERIFY(producer->wait());
+    QCOMPARE(count, Items);
+    QCOMPARE(sum, static_cast<qint64>(Items) * (Items - 1) / 2);
+    QVERIFY(!channel->send(0));
+}
+
+void TestThreadQueue::testMultiChannel()
+{
+    QSharedPointer<Channel<int>> c1(new Channel<int>(4));
+    QSharedPointer<Channel<int>> c2(new Channel<int>(4));
+    MultiChannel<int> channels;
+    channels.addChannel(c1);
+    channels.addChannel(c2);
+    QSharedPointer<Event> p1 = spawnInThread([c1] {
+        for (int i = 0; i < 1000; ++i) {
+            c1->send(1);
+        }
+        c1->close();
+    });
+    QSharedPointer<Event> p2 = spawnInThread([c2] {
+        for (int i = 0; i < 1000; ++i) {
+            c2->send(2);
+        }
+        c2->close();
+    });
+    int e, index;
+    int counts[2] = { 0, 0 };
+    while (channels.recv(&e, &index)) {
+        QCOMPARE(e, index + 1);
+        ++counts[index];
+    }
+    QVERIFY(p1->wait());
+    QVERIFY(p2->wait());
+    QCOMPARE(counts[0], 1000);
+    QCOMPARE(counts[1], 1000);
+}
+
 QTEST_MAIN(TestThreadQueue)
 #include "test_threadqueue.moc"
@@ -0,0 +1,81 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+class EchoWebSocketHandler : public WebSocketRequestHandler
+{
+protected:
+    virtual void serveWebSocket(QSharedPointer<WebSocket> webSocket) override
+    {
+        WebSocket::MessageType type;
+        while (true) {
+            const QByteArray &message = webSocket->recvMessage(&type);
+            if (message.isNull() || !webSocket->sendMessage(message, type)) {
+                return;
+            }
+        }
+    }
+};
+
+class TestWebSocket : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testMask();
+    void testEcho();
+};
+
+void TestWebSocket::testMask()
+{
+    const char key[4] = { '\x12', '\x34', '\x56', '\x78' };
+    QByteArray data(1027, 'x');
+    for (int i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i);
+    }
+    QByteArray masked = data;
+    maskWebSocketPayload(masked.data(), masked.size(), key);
+    for (int i = 0; i < data.size(); ++i) {
+        QCOMPARE(masked.at(i), static_cast<char>(data.at(i) ^ key[i % 4]));
+    }
+    // the fragments keep the key aligned.
+    maskWebSocketPayload(masked.data(), 13, key);
+    maskWebSocketPayload(masked.data() + 13, masked.size() - 13, key, 13);
+    QCOMPARE(masked, data);
+}
+
+void TestWebSocket::testEcho()
+{
+    TcpServer<EchoWebSocketHandler> server(HostAddress::LocalHost, 18231);
+    QVERIFY(server.start());
+    HttpSession session;
+    QSharedPointer<WebSocket> webSocket = WebSocket::connect(&session, QUrl(QString::fromLatin1("ws://127.0.0.1:18231/")));
+    QVERIFY(!webSocket.isNull());
+    webSocket->setFragmentSize(1000);
+
+    QVERIFY(webSocket->sendText(QString::fromLatin1("hello")));
+    WebSocket::MessageType type;
+    QCOMPARE(webSocket->recvMessage(&type), QByteArray("hello"));
+    QCOMPARE(type, WebSocket::TextMessage);
+
+    QByteArray large;
+    for (int i = 0; i < 100000; ++i) {
+        large.append(static_cast<char>(i % 251));
+    }
+    QVERIFY(webSocket->sendBinary(large));
+    QCOMPARE(webSocket->recvMessage(&type), large);
+    QCOMPARE(type, WebSocket::BinaryMessage);
+
+    QVERIFY(webSocket->ping("ping"));
+    QVERIFY(webSocket->sendBinary(QByteArray()));
+    const QByteArray &empty = webSocket->recvMessage();
+    QVERIFY(!empty.isNull() && empty.isEmpty());
+
+    webSocket->close();
+    QVERIFY(webSocket->isClosed());
+    QVERIFY(!webSocket->sendText(QString::fromLatin1("closed")));
+    server.stop();
+}
+
+QTEST_MAIN(TestWebSocket)
+#include "test_websocket.moc"